@@ -4,6 +4,6 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := libjnicam
 LOCAL_CFLAGS    := -Wno-narrowing -Wno-deprecated-declarations -Werror -O2 -fPIC -fvisibility=hidden
 LOCAL_SRC_FILES := $(JNI_RTPATH)/jnicam.cpp
-LOCAL_LDLIBS    := -llog
+LOCAL_LDLIBS    := -llog -landroid
 LOCAL_SHARED_LIBRARIES := toupcam
 include $(BUILD_SHARED_LIBRARY)
\ No newline at end of file
@@ -1,29 +1,129 @@
 #include <jni.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <condition_variable>
 #include <android/log.h>
+#include <android/native_window_jni.h>
 #include "toupcam.h"
 
 #define  LOGE(...)  __android_log_print(ANDROID_LOG_ERROR, "JNI_CAM", __VA_ARGS__)
 
 jobject gObject = nullptr;
+jmethodID gOnEvent = nullptr;
 JavaVM *gLocalVm = nullptr;
 HToupcam gHcam = nullptr;
 
-static void ucamCallback(unsigned nEvent, void *pCallbackCtx) {
-    bool isAttached = false;
-    JNIEnv *env = nullptr;
-    if (gLocalVm->GetEnv((void**)&env, JNI_VERSION_1_2) < 0) {
-        if (gLocalVm->AttachCurrentThread(&env, nullptr) < 0)
+/*
+ * setSurface: the frames are pulled straight into the buffers of the ANativeWindow of a Surface (RGBX_8888, the
+ * camera in RGB32 so that the SDK does not convert, the row pitch of the window), on the callback thread, and
+ * TOUPCAM_EVENT_IMAGE is no longer passed to Java, which has nothing to copy nor to upload to a Bitmap.
+ * AHardwareBuffer would need API 26, APP_PLATFORM is android-21.
+ */
+std::mutex gWindowMutex;
+ANativeWindow *gWindow = nullptr;
+int gWindowWidth = 0, gWindowHeight = 0;
+
+/*
+ * Events reach Java on a thread of our own, attached to the VM once for its lifetime: the callback of the SDK only
+ * queues them, and never calls into the VM. The image events are coalesced into one "a frame is available", which is
+ * not repeated until Java has pulled it by pullLatest (or pullImage), so the JNI work is one call per frame Java
+ * actually takes, whatever the frame rate of the camera. The backend deque is kept at its minimum, so what Java pulls
+ * is the latest frame.
+ */
+enum { IMAGE_NONE, IMAGE_AVAILABLE, IMAGE_NOTIFIED };
+
+std::mutex gEventMutex;
+std::condition_variable gEventCond;
+std::deque<unsigned> gEvents;               /* other than TOUPCAM_EVENT_IMAGE */
+int gImageState = IMAGE_NONE;
+bool gEventLoop = false;
+std::thread gEventThread;
+
+static void postEvent(unsigned nEvent) {
+    {
+        std::lock_guard<std::mutex> lock(gEventMutex);
+        if (TOUPCAM_EVENT_IMAGE != nEvent)
+            gEvents.push_back(nEvent);
+        else if (IMAGE_NONE == gImageState)
+            gImageState = IMAGE_AVAILABLE;
+        else
             return;
-        isAttached = true;
     }
-    jmethodID onEvent = env->GetMethodID(env->GetObjectClass(gObject), "OnEvent", "(I)V");
-    if (onEvent != nullptr)
-        env->CallVoidMethod(gObject, onEvent, nEvent);
+    gEventCond.notify_one();
+}
 
-    if (isAttached)
-        gLocalVm->DetachCurrentThread();
+static void eventLoop() {
+    JNIEnv *env = nullptr;
+    if (gLocalVm->AttachCurrentThread(&env, nullptr) < 0) {
+        LOGE("%s: AttachCurrentThread failed\n", __FUNCTION__);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(gEventMutex);
+    while (gEventLoop) {
+        if (gEvents.empty() && (IMAGE_AVAILABLE != gImageState)) {
+            gEventCond.wait(lock);
+            continue;
+        }
+        unsigned nEvent = TOUPCAM_EVENT_IMAGE;
+        if (!gEvents.empty()) {
+            nEvent = gEvents.front();
+            gEvents.pop_front();
+        } else
+            gImageState = IMAGE_NOTIFIED;
+        lock.unlock();
+        if (gOnEvent)
+            env->CallVoidMethod(gObject, gOnEvent, nEvent);
+        lock.lock();
+    }
+    lock.unlock();
+    gLocalVm->DetachCurrentThread();
+}
+
+/* after a pull: notify again if there is another one already */
+static void imagePulled() {
+    int num = 0;
+    {
+        std::lock_guard<std::mutex> lock(gEventMutex);
+        gImageState = IMAGE_NONE;
+    }
+    if (gHcam && SUCCEEDED(Toupcam_get_Option(gHcam, TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT, &num)) && (num > 0))
+        postEvent(TOUPCAM_EVENT_IMAGE);
+}
+
+/* with gWindowMutex */
+static void setWindowGeometry() {
+    int width = 0, height = 0;
+    if (gWindow && gHcam && SUCCEEDED(Toupcam_get_FinalSize(gHcam, &width, &height))) {
+        if (0 == ANativeWindow_setBuffersGeometry(gWindow, width, height, WINDOW_FORMAT_RGBX_8888)) {
+            gWindowWidth = width;
+            gWindowHeight = height;
+        }
+    }
+}
+
+/* true if rendered to the window */
+static bool renderImage() {
+    std::lock_guard<std::mutex> lock(gWindowMutex);
+    if (nullptr == gWindow)
+        return false;
+    ANativeWindow_Buffer buffer;
+    if (0 == ANativeWindow_lock(gWindow, &buffer, nullptr)) {
+        if ((buffer.width == gWindowWidth) && (buffer.height == gWindowHeight))
+            Toupcam_PullImageV4(gHcam, buffer.bits, 0, 32, buffer.stride * 4, nullptr);
+        ANativeWindow_unlockAndPost(gWindow);
+        if ((buffer.width != gWindowWidth) || (buffer.height != gWindowHeight))
+            setWindowGeometry();    /* the size changed, the frame is pulled with the next one */
+    }
+    return true;
+}
+
+static void ucamCallback(unsigned nEvent, void *pCallbackCtx) {
+    if ((TOUPCAM_EVENT_IMAGE == nEvent) && renderImage())
+        return;
+    postEvent(nEvent);
 }
 
 extern "C" {
@@ -32,11 +132,18 @@ JNIEXPORT jstring JNICALL Java_com_droid_usbcam_CamLib_getModelName(JNIEnv *env,
 JNIEXPORT jint JNICALL Java_com_droid_usbcam_CamLib_openDevice(JNIEnv *env, jobject obj, jint vendorId, jint productId, jint fd);
 JNIEXPORT jintArray JNICALL Java_com_droid_usbcam_CamLib_getPreviewSize(JNIEnv *env, jobject obj);
 JNIEXPORT void JNICALL Java_com_droid_usbcam_CamLib_pullImage(JNIEnv *env, jobject obj, jobject directBuffer);
+JNIEXPORT jboolean JNICALL Java_com_droid_usbcam_CamLib_pullLatest(JNIEnv *env, jobject obj, jobject directBuffer);
+JNIEXPORT void JNICALL Java_com_droid_usbcam_CamLib_setSurface(JNIEnv *env, jobject obj, jobject surface);
 JNIEXPORT jboolean JNICALL Java_com_droid_usbcam_CamLib_isAlive(JNIEnv *env, jobject obj);
 JNIEXPORT void JNICALL Java_com_droid_usbcam_CamLib_releaseCamera(JNIEnv *env, jobject obj);
 
 JNIEXPORT void JNICALL Java_com_droid_usbcam_CamLib_init(JNIEnv *env, jobject obj) {
     gObject = env->NewGlobalRef(obj);
+    gOnEvent = env->GetMethodID(env->GetObjectClass(obj), "OnEvent", "(I)V");
+    if (!gEventLoop) {
+        gEventLoop = true;
+        gEventThread = std::thread(eventLoop);
+    }
 }
 
 JNIEXPORT jint JNICALL Java_com_droid_usbcam_CamLib_openDevice(JNIEnv *env, jobject obj, jint vendorId, jint productId, jint fd) {
@@ -48,6 +155,14 @@ JNIEXPORT jint JNICALL Java_com_droid_usbcam_CamLib_openDevice(JNIEnv *env, jobj
     sprintf(camId, "fd-%d-%04x-%04x", fd, vendorId, productId);
     gHcam = Toupcam_Open(camId);
     if (gHcam) {
+        Toupcam_put_Option(gHcam, TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, 2);
+        {
+            std::lock_guard<std::mutex> lock(gWindowMutex);
+            if (gWindow) {
+                Toupcam_put_Option(gHcam, TOUPCAM_OPTION_RGB, 2);
+                setWindowGeometry();
+            }
+        }
         int ret = Toupcam_StartPullModeWithCallback(gHcam, ucamCallback, nullptr);
         if (!SUCCEEDED(ret)) {
             Toupcam_Close(gHcam);
@@ -75,6 +190,59 @@ JNIEXPORT void JNICALL Java_com_droid_usbcam_CamLib_pullImage(JNIEnv *env, jobje
     if (gHcam) {
         void* buffer = env->GetDirectBufferAddress(directBuffer);
         Toupcam_PullImageV2(gHcam, buffer, 24, nullptr);
+        imagePulled();
+    }
+}
+
+/*
+ * on demand, after OnEvent(TOUPCAM_EVENT_IMAGE); false if none, or the buffer is smaller than the frame, RGB24.
+ * Whatever the result, the image state is reset, or no OnEvent(TOUPCAM_EVENT_IMAGE) would come again: with a buffer
+ * too small the frame stays in the deque and is notified again.
+ */
+JNIEXPORT jboolean JNICALL Java_com_droid_usbcam_CamLib_pullLatest(JNIEnv *env, jobject obj, jobject directBuffer) {
+    HRESULT hr = (HRESULT)0x80004005;     /* E_FAIL */
+    if (gHcam) {
+        void* buffer = env->GetDirectBufferAddress(directBuffer);
+        ToupcamFrameInfoV4 info = { 0 };
+        hr = Toupcam_PullImageV4(gHcam, nullptr, 0, 24, 0, &info);    /* the size only */
+        if (SUCCEEDED(hr)) {
+            if ((nullptr == buffer) || (env->GetDirectBufferCapacity(directBuffer) < (jlong)TDIBWIDTHBYTES(24 * info.v3.width) * info.v3.height))
+                hr = (HRESULT)0x80004005;
+            else
+                hr = Toupcam_PullImageV4(gHcam, buffer, 0, 24, 0, nullptr);
+        }
+    }
+    imagePulled();
+    return SUCCEEDED(hr) ? JNI_TRUE : JNI_FALSE;
+}
+
+/* null: back to pullImage, the camera back in RGB24 */
+JNIEXPORT void JNICALL Java_com_droid_usbcam_CamLib_setSurface(JNIEnv *env, jobject obj, jobject surface) {
+    ANativeWindow *window = surface ? ANativeWindow_fromSurface(env, surface) : nullptr;
+    bool attached;
+    {
+        std::lock_guard<std::mutex> lock(gWindowMutex);
+        attached = (nullptr != gWindow);
+    }
+    const bool restart = (gHcam != nullptr) && ((nullptr != window) || attached);
+    if (restart)
+        Toupcam_Stop(gHcam);  /* TOUPCAM_OPTION_RGB */
+    {
+        std::lock_guard<std::mutex> lock(gWindowMutex);
+        if (gWindow)
+            ANativeWindow_release(gWindow);
+        gWindow = window;
+        gWindowWidth = gWindowHeight = 0;
+        if (restart) {
+            Toupcam_put_Option(gHcam, TOUPCAM_OPTION_RGB, window ? 2 : 0);
+            if (window)
+                setWindowGeometry();
+        }
+    }
+    if (restart) {
+        int ret = Toupcam_StartPullModeWithCallback(gHcam, ucamCallback, nullptr);
+        if (!SUCCEEDED(ret))
+            LOGE("%s: StartPullModeWithCallback failed with ret = %d\n", __FUNCTION__, ret);
     }
 }
 
@@ -87,6 +255,11 @@ JNIEXPORT void JNICALL Java_com_droid_usbcam_CamLib_releaseCamera(JNIEnv *env, j
         Toupcam_Close(gHcam);
         gHcam = nullptr;
     }
+    std::lock_guard<std::mutex> lock(gWindowMutex);
+    if (gWindow) {
+        ANativeWindow_release(gWindow);
+        gWindow = nullptr;
+    }
 }
 
 JNIEXPORT jstring JNICALL Java_com_droid_usbcam_CamLib_getModelName(JNIEnv *env, jobject obj, jint vendorId, jint productId) {
@@ -102,6 +275,14 @@ jint JNI_OnLoad(JavaVM *vm, void *reserved) {
 }
 
 void JNI_OnUnload(JavaVM *vm, void *reserved) {
+    if (gEventLoop) {
+        {
+            std::lock_guard<std::mutex> lock(gEventMutex);
+            gEventLoop = false;
+        }
+        gEventCond.notify_one();
+        gEventThread.join();
+    }
     bool isAttached = false;
     JNIEnv *env = nullptr;
     if (vm->GetEnv((void**)&env, JNI_VERSION_1_2) < 0) {
@@ -0,0 +1,360 @@
+#ifndef __edfpyr_H__
+#define __edfpyr_H__
+
+/*
+    Extended depth of field by Laplacian pyramid fusion, maximum rule (the same idea as eImageproEdfM_Pyr_Max):
+    every plane is decomposed into a Laplacian pyramid, each detail coefficient of the result is taken from the plane
+    where |R| + |G| + |B| (|grey| for mono) of that coefficient is the largest, the coarsest level is the mean of all
+    planes.
+    Only the accumulated pyramid is kept, so the memory is fixed by the frame size (see bytes()) and does not grow
+    with the number of planes. The pyramid build, the selection and the collapse are split over the rows on
+    threads worker threads (0: one per core).
+    Along with the selection the engine records where the detail came from: readdepth gives, for every pixel, the
+    index of the plane that won its full resolution coefficient, readblockdepth gives for every block (EDFPYR_BLOCK
+    pixels square) the plane with the largest summed detail energy, which is the robust one for a focus surface fit.
+    channels 3: 24 bits per pixel, the channel order of the input is kept; channels 1: GREY8, or GREY16 for bits 9 ... 16
+    (16 bits little endian, the value right aligned as pulled with TOUPCAM_OPTION_BITDEPTH), at a third of the memory
+    and of the work of expanding a mono camera to RGB. The samples are 12 bits (8 + EDFPYR_FP fraction) whatever the input,
+    so depths beyond 12 bits lose their lowest bits in the fusion. Not thread safe: add and readdata from one thread.
+    The pyramid comes from the IpAllocator of the constructor (samples/ipalloc.h, NULL: the global one): with an
+    IpArena, an engine deleted and created again at the same size takes the same memory back.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include "../../samples/ipalloc.h"
+
+#define EDFPYR_FP       4       /* fractional bits of the fixed point pyramid samples */
+#define EDFPYR_MINSIZE  32      /* stop the pyramid when the coarsest level gets this small */
+#define EDFPYR_MAXLEVEL 8
+#define EDFPYR_BLOCK    32      /* block size of readblockdepth */
+
+class EdfPyramid {
+    typedef std::vector<short, IpStdAllocator<short> > Shorts;
+    typedef std::vector<unsigned short, IpStdAllocator<unsigned short> > UShorts;
+    struct Plane {
+        int w, h, ch;
+        Shorts v;                   /* ch interleaved channels */
+        explicit Plane(const IpAllocator* a = NULL) : w(0), h(0), ch(0), v(a) {}
+        short* row(int y) { return &v[(size_t)y * w * ch]; }
+        const short* row(int y) const { return &v[(size_t)y * w * ch]; }
+    };
+    const int           m_ch, m_bits;
+    const int           m_shift;    /* input to sample: << m_shift, >> -m_shift when negative */
+    int                 m_levels;
+    unsigned            m_threads;
+    unsigned            m_planes;
+    size_t              m_bytes;
+    std::vector<Plane>  m_gauss;    /* Gaussian pyramid of the current plane, reused for the collapse */
+    std::vector<Plane>  m_acc;      /* selected Laplacian coefficients, levels 0 .. m_levels - 2 */
+    std::vector<UShorts> m_energy;
+    std::vector<int, IpStdAllocator<int> > m_sum;   /* coarsest level, summed over the planes */
+    UShorts             m_depth;    /* winning plane of every level 0 coefficient */
+    int                 m_blocksX, m_blocksY;
+    std::vector<unsigned long long, IpStdAllocator<unsigned long long> > m_blockBest, m_blockCur;
+    UShorts             m_blockDepth;
+    std::mutex          m_mtx;
+
+    template <typename F> void parallel_rows(int h, F f)
+    {
+        const unsigned n = std::min<unsigned>(m_threads, (unsigned)(h + 15) / 16);
+        if (n <= 1)
+            f(0, h);
+        else
+        {
+            std::vector<std::thread> vecThread;
+            for (unsigned t = 0; t < n; ++t)
+                vecThread.push_back(std::thread(f, (int)(h * t / n), (int)(h * (t + 1) / n)));
+            for (size_t i = 0; i < vecThread.size(); ++i)
+                vecThread[i].join();
+        }
+    }
+
+    static inline int clampi(int v, int lo, int hi) { return (v < lo) ? lo : ((v > hi) ? hi : v); }
+
+    /* 5 tap binomial low pass and decimation by two */
+    void reduce(const Plane& s, Plane& d)
+    {
+        parallel_rows(d.h, [&](int y0, int y1)
+        {
+            std::vector<int> vert(s.w * s.ch);
+            static const int wt[5] = { 1, 4, 6, 4, 1 };
+            for (int y = y0; y < y1; ++y)
+            {
+                memset(&vert[0], 0, vert.size() * sizeof(int));
+                for (int k = 0; k < 5; ++k)
+                {
+                    const short* p = s.row(clampi(2 * y + k - 2, 0, s.h - 1));
+                    for (int i = 0; i < s.w * s.ch; ++i)
+                        vert[i] += wt[k] * p[i];
+                }
+                short* o = d.row(y);
+                for (int x = 0; x < d.w; ++x)
+                {
+                    for (int c = 0; c < s.ch; ++c)
+                    {
+                        int sum = 0;
+                        for (int k = 0; k < 5; ++k)
+                            sum += wt[k] * vert[clampi(2 * x + k - 2, 0, s.w - 1) * s.ch + c];
+                        o[x * s.ch + c] = (short)((sum + 128) >> 8);
+                    }
+                }
+            }
+        });
+    }
+
+    /* one row of the 2x upsampled level s, at the size w of the level below; vert is s.w * s.ch scratch */
+    static void expand_row(const Plane& s, int y, int w, int* vert, int* out)
+    {
+        const int r = y / 2;
+        const short* p0 = s.row(clampi(r - 1, 0, s.h - 1));
+        const short* p1 = s.row(std::min(r, s.h - 1));
+        const short* p2 = s.row(std::min(r + 1, s.h - 1));
+        if (y & 1)
+        {
+            for (int i = 0; i < s.w * s.ch; ++i)
+                vert[i] = 4 * p1[i] + 4 * p2[i];
+        }
+        else
+        {
+            for (int i = 0; i < s.w * s.ch; ++i)
+                vert[i] = p0[i] + 6 * p1[i] + p2[i];
+        }
+        for (int x = 0; x < w; ++x)
+        {
+            const int q = x / 2;
+            const int* a = &vert[clampi(q - 1, 0, s.w - 1) * s.ch];
+            const int* b = &vert[std::min(q, s.w - 1) * s.ch];
+            const int* e = &vert[std::min(q + 1, s.w - 1) * s.ch];
+            for (int c = 0; c < s.ch; ++c)
+                out[x * s.ch + c] = (((x & 1) ? (4 * b[c] + 4 * e[c]) : (a[c] + 6 * b[c] + e[c])) + 32) >> 6;
+        }
+    }
+public:
+    /* channels: 3 (RGB24) or 1 (grey); bits: 8, or 9 ... 16 for grey in 16 bits; alloc: of the pyramid, NULL: global */
+    EdfPyramid(int width, int height, unsigned threads, size_t budget, int channels = 3, int bits = 8, const IpAllocator* alloc = NULL)
+    : m_ch((1 == channels) ? 1 : 3), m_bits(((1 == channels) && (bits > 8) && (bits <= 16)) ? bits : 8), m_shift(EDFPYR_FP + 8 - m_bits)
+    , m_levels(1), m_threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())), m_planes(0), m_bytes(0)
+    , m_sum(alloc), m_depth(alloc)
+    , m_blocksX((width + EDFPYR_BLOCK - 1) / EDFPYR_BLOCK), m_blocksY((height + EDFPYR_BLOCK - 1) / EDFPYR_BLOCK)
+    , m_blockBest(alloc), m_blockCur(alloc), m_blockDepth(alloc)
+    {
+        int w = width, h = height;
+        while ((m_levels < EDFPYR_MAXLEVEL) && (std::min(w, h) >= 2 * EDFPYR_MINSIZE))
+        {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            ++m_levels;
+        }
+        w = width;
+        h = height;
+        for (int i = 0; i < m_levels; ++i)
+        {
+            const size_t n = (size_t)w * h;
+            m_bytes += n * m_ch * sizeof(short);                                    /* gauss */
+            if (i + 1 < m_levels)
+                m_bytes += n * m_ch * sizeof(short) + n * sizeof(unsigned short);   /* acc, energy */
+            else
+                m_bytes += n * m_ch * sizeof(int);                                  /* sum */
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+        m_bytes += (size_t)width * height * sizeof(unsigned short) + (size_t)m_blocksX * m_blocksY * (2 * sizeof(unsigned long long) + sizeof(unsigned short));
+        if (budget && (m_bytes > budget))
+            return;
+
+        m_gauss.resize(m_levels, Plane(alloc));
+        m_acc.resize(m_levels - 1, Plane(alloc));
+        m_energy.resize(m_levels - 1, UShorts(alloc));
+        w = width;
+        h = height;
+        for (int i = 0; i < m_levels; ++i)
+        {
+            m_gauss[i].w = w;
+            m_gauss[i].h = h;
+            m_gauss[i].ch = m_ch;
+            m_gauss[i].v.resize((size_t)w * h * m_ch);
+            if (i + 1 < m_levels)
+            {
+                m_acc[i] = m_gauss[i];
+                m_energy[i].resize((size_t)w * h);
+            }
+            else
+                m_sum.resize((size_t)w * h * m_ch);
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+        m_depth.resize((size_t)width * height);
+        m_blockBest.resize(m_blocksX * m_blocksY);
+        m_blockCur.resize(m_blocksX * m_blocksY);
+        m_blockDepth.resize(m_blocksX * m_blocksY);
+    }
+
+    bool valid() const { return !m_gauss.empty(); }
+    size_t bytes() const { return m_bytes; }    /* fixed working memory, whatever the number of planes */
+    int levels() const { return m_levels; }
+    int channels() const { return m_ch; }
+    int bits() const { return m_bits; }
+    int width(int level = 0) const { return m_gauss[level].w; }
+    int height(int level = 0) const { return m_gauss[level].h; }
+    unsigned planes() const { return m_planes; }
+    int blocksX() const { return m_blocksX; }
+    int blocksY() const { return m_blocksY; }
+    void reset() { m_planes = 0; }
+
+    /* one plane, width() x height() in the format of the constructor, stride in bytes */
+    void add(const void* data, int stride)
+    {
+        Plane& g0 = m_gauss[0];
+        parallel_rows(g0.h, [&](int y0, int y1)
+        {
+            for (int y = y0; y < y1; ++y)
+            {
+                const unsigned char* s = (const unsigned char*)data + (size_t)y * stride;
+                short* d = g0.row(y);
+                if (8 == m_bits)
+                {
+                    for (int i = 0; i < g0.w * m_ch; ++i)
+                        d[i] = (short)(s[i] << EDFPYR_FP);
+                }
+                else
+                {
+                    const unsigned short* s16 = (const unsigned short*)s;
+                    const int vmax = (1 << m_bits) - 1;
+                    for (int i = 0; i < g0.w; ++i)
+                    {
+                        const int v = std::min<int>(s16[i], vmax);
+                        d[i] = (short)((m_shift >= 0) ? (v << m_shift) : (v >> -m_shift));
+                    }
+                }
+            }
+        });
+        for (int i = 1; i < m_levels; ++i)
+            reduce(m_gauss[i - 1], m_gauss[i]);
+
+        const bool bFirst = (0 == m_planes);
+        std::fill(m_blockCur.begin(), m_blockCur.end(), 0ull);
+        for (int i = 0; i + 1 < m_levels; ++i)
+        {
+            const Plane& g = m_gauss[i];
+            Plane& acc = m_acc[i];
+            UShorts& energy = m_energy[i];
+            parallel_rows(g.h, [&](int y0, int y1)
+            {
+                std::vector<int> vert(m_gauss[i + 1].w * m_ch), up(g.w * m_ch);
+                std::vector<unsigned long long> block((0 == i) ? m_blocksX * m_blocksY : 0);
+                for (int y = y0; y < y1; ++y)
+                {
+                    expand_row(m_gauss[i + 1], y, g.w, &vert[0], &up[0]);
+                    const short* p = g.row(y);
+                    short* a = acc.row(y);
+                    unsigned short* e = &energy[(size_t)y * g.w];
+                    for (int x = 0; x < g.w; ++x, p += m_ch, a += m_ch)
+                    {
+                        int l[3], en = 0;
+                        for (int c = 0; c < m_ch; ++c)
+                        {
+                            l[c] = p[c] - up[x * m_ch + c];
+                            en += abs(l[c]);
+                        }
+                        if (bFirst || (en > e[x]))
+                        {
+                            e[x] = (unsigned short)std::min(en, 65535);
+                            for (int c = 0; c < m_ch; ++c)
+                                a[c] = (short)l[c];
+                            if (0 == i)
+                                m_depth[(size_t)y * g.w + x] = (unsigned short)m_planes;
+                        }
+                        if (0 == i)
+                            block[(y / EDFPYR_BLOCK) * m_blocksX + x / EDFPYR_BLOCK] += en;
+                    }
+                }
+                if (0 == i)
+                {
+                    std::lock_guard<std::mutex> lock(m_mtx);
+                    for (size_t k = 0; k < block.size(); ++k)
+                        m_blockCur[k] += block[k];
+                }
+            });
+        }
+        for (size_t k = 0; k < m_blockCur.size(); ++k)
+        {
+            if (bFirst || (m_blockCur[k] > m_blockBest[k]))
+            {
+                m_blockBest[k] = m_blockCur[k];
+                m_blockDepth[k] = (unsigned short)m_planes;
+            }
+        }
+
+        const Plane& top = m_gauss[m_levels - 1];
+        for (size_t i = 0; i < top.v.size(); ++i)
+            m_sum[i] = (bFirst ? 0 : m_sum[i]) + top.v[i];
+        ++m_planes;
+    }
+
+    /* plane index (0 based, in the order of add) of every pixel, width() x height(), stride in bytes */
+    void readdepth(unsigned short* data, int stride) const
+    {
+        for (int y = 0; y < m_gauss[0].h; ++y)
+            memcpy((char*)data + (size_t)y * stride, &m_depth[(size_t)y * m_gauss[0].w], m_gauss[0].w * sizeof(unsigned short));
+    }
+
+    /* plane index of every EDFPYR_BLOCK block, blocksX() x blocksY(), row major */
+    void readblockdepth(unsigned short* data) const
+    {
+        memcpy(data, &m_blockDepth[0], m_blockDepth.size() * sizeof(unsigned short));
+    }
+
+    /* collapse the fused pyramid down to level (0: full resolution, width(level) x height(level)) into the format of add */
+    void readdata(void* data, int stride, int level = 0)
+    {
+        if (0 == m_planes)
+            return;
+        Plane& top = m_gauss[m_levels - 1];
+        for (size_t i = 0; i < top.v.size(); ++i)
+            top.v[i] = (short)((m_sum[i] + (int)m_planes / 2) / (int)m_planes);
+        for (int i = m_levels - 2; i >= level; --i)
+        {
+            Plane& g = m_gauss[i];
+            const Plane& acc = m_acc[i];
+            parallel_rows(g.h, [&](int y0, int y1)
+            {
+                std::vector<int> vert(m_gauss[i + 1].w * m_ch), up(g.w * m_ch);
+                for (int y = y0; y < y1; ++y)
+                {
+                    expand_row(m_gauss[i + 1], y, g.w, &vert[0], &up[0]);
+                    const short* a = acc.row(y);
+                    short* d = g.row(y);
+                    for (int k = 0; k < g.w * m_ch; ++k)
+                        d[k] = (short)clampi(up[k] + a[k], -32768, 32767);
+                }
+            });
+        }
+        const Plane& g = m_gauss[level];
+        parallel_rows(g.h, [&](int y0, int y1)
+        {
+            for (int y = y0; y < y1; ++y)
+            {
+                const short* s = g.row(y);
+                unsigned char* d = (unsigned char*)data + (size_t)y * stride;
+                if (8 == m_bits)
+                {
+                    for (int k = 0; k < g.w * m_ch; ++k)
+                        d[k] = (unsigned char)clampi((s[k] + (1 << (EDFPYR_FP - 1))) >> EDFPYR_FP, 0, 255);
+                }
+                else
+                {
+                    unsigned short* d16 = (unsigned short*)d;
+                    const int vmax = (1 << m_bits) - 1;
+                    for (int k = 0; k < g.w; ++k)
+                        d16[k] = (unsigned short)clampi((m_shift > 0) ? ((s[k] + (1 << (m_shift - 1))) >> m_shift) : (s[k] << -m_shift), 0, vmax);
+                }
+            }
+        });
+    }
+};
+
+#endif
@@ -4,7 +4,7 @@
 MainWidget::MainWidget(QWidget* parent)
     : QWidget(parent), m_timer(new QTimer(this)), m_hcam(nullptr), m_edf(nullptr)
     , m_lbl_edf(nullptr), m_lbl_video(nullptr), m_lbl_frame(nullptr), m_imgWidth(0), m_imgHeight(0)
-    , m_pVideoData(nullptr), m_pEdfData(nullptr)
+    , m_bits(24), m_pVideoData(nullptr), m_pEdfData(nullptr), m_pyr(nullptr), m_arena(0), m_previewLevel(0), m_planes(0), m_dropped(0), m_bStop(false), m_count(0)
 {
     setMinimumSize(1024, 768);
 
@@ -18,12 +18,33 @@ MainWidget::MainWidget(QWidget* parent)
             Toupcam_put_AutoExpoEnable(m_hcam, state ? 1 : 0);
     });
 
+    m_cmb_engine = new QComboBox();
+    m_cmb_engine->addItem("imagepro edf");
+    m_cmb_engine->addItem("pyramid (multithreaded)");
+    m_spin_threads = new QSpinBox();
+    m_spin_threads->setRange(0, 64);
+    m_spin_threads->setPrefix("Threads: ");
+    m_spin_threads->setSpecialValueText("Threads: auto");
+    m_spin_budget = new QSpinBox();
+    m_spin_budget->setRange(0, 65536);
+    m_spin_budget->setSingleStep(256);
+    m_spin_budget->setPrefix("Memory limit: ");
+    m_spin_budget->setSuffix(" MB");
+    m_spin_budget->setSpecialValueText("Memory limit: none");
+    m_btn_save = new QPushButton("Save EDF + depth");
+    m_btn_save->setEnabled(false);
+    connect(m_btn_save, &QPushButton::clicked, this, &MainWidget::onBtnSave);
+
     QHBoxLayout* hlayout = new QHBoxLayout();
     {
         QVBoxLayout* vlayout = new QVBoxLayout();
         m_lbl_frame = new QLabel();
+        vlayout->addWidget(m_cmb_engine);
+        vlayout->addWidget(m_spin_threads);
+        vlayout->addWidget(m_spin_budget);
         vlayout->addWidget(m_btn_open);
         vlayout->addWidget(m_cbox_auto);
+        vlayout->addWidget(m_btn_save);
         vlayout->addWidget(m_lbl_frame);
         hlayout->addLayout(vlayout, 1);
     }
@@ -66,11 +87,33 @@ MainWidget::MainWidget(QWidget* parent)
             QMessageBox::warning(this, "Warning", "Edf generic error.");
     });
 
+    connect(this, &MainWidget::edfPreview, this, [this]()
+    {
+        /* this run in the UI thread */
+        if (m_pyr)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            QImage image(&m_preview[0], m_pyr->width(m_previewLevel), m_pyr->height(m_previewLevel), TDIBWIDTHBYTES(m_pyr->width(m_previewLevel) * m_bits),
+                         (8 == m_bits) ? QImage::Format_Grayscale8 : QImage::Format_RGB888);
+            QImage newimage = image.scaled(m_lbl_edf->width(), m_lbl_edf->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
+            m_lbl_edf->setPixmap(QPixmap::fromImage(newimage));
+        }
+    });
+
     connect(m_timer, &QTimer::timeout, this, [this]()
     {
         unsigned nFrame = 0, nTime = 0, nTotalFrame = 0;
         if (m_hcam && SUCCEEDED(Toupcam_get_FrameRate(m_hcam, &nFrame, &nTime, &nTotalFrame)) && (nTime > 0))
-            m_lbl_frame->setText(QString::asprintf("%u, fps = %.1f", nTotalFrame, nFrame * 1000.0 / nTime));
+        {
+            if (m_pyr)
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_lbl_frame->setText(QString::asprintf("%u, fps = %.1f\nplanes = %u, queued = %u, dropped = %u", nTotalFrame, nFrame * 1000.0 / nTime,
+                                                       m_planes, (unsigned)m_queue.size(), m_dropped));
+            }
+            else
+                m_lbl_frame->setText(QString::asprintf("%u, fps = %.1f", nTotalFrame, nFrame * 1000.0 / nTime));
+        }
     });
     m_timer->start(1000);
 }
@@ -87,6 +130,22 @@ void MainWidget::closeCamera()
         imagepro_edf_delete(m_edf);
         m_edf = nullptr;
     }
+    if (m_pyr)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStop = true;
+        }
+        m_cv.notify_all();
+        m_fuse.join();
+        m_queue.clear();
+        delete m_pyr;
+        m_pyr = nullptr;
+    }
+    m_cmb_engine->setEnabled(true);
+    m_spin_threads->setEnabled(true);
+    m_spin_budget->setEnabled(true);
+    m_btn_save->setEnabled(false);
     delete[] m_pVideoData;
     m_pVideoData = nullptr;
     delete[] m_pEdfData;
@@ -115,11 +174,42 @@ void MainWidget::onBtnOpen()
 			Toupcam_get_Size(m_hcam, &m_imgWidth, &m_imgHeight);
 			Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_BYTEORDER, 0); //Qimage use RGB byte order
             Toupcam_put_AutoExpoEnable(m_hcam, m_cbox_auto->isChecked() ? 1 : 0);
+            /* a mono camera is pulled and fused as GREY8 by the pyramid engine, imagepro takes RGB only */
+            m_bits = ((arr[0].model->flag & TOUPCAM_FLAG_MONO) && (0 != m_cmb_engine->currentIndex())) ? 8 : 24;
 	
-            m_pVideoData = new uchar[TDIBWIDTHBYTES(m_imgWidth * 24) * m_imgHeight];
-            m_pEdfData = new uchar[TDIBWIDTHBYTES(m_imgWidth * 24) * m_imgHeight];
-            m_edf = imagepro_edf_newV2(eImageproFormat_RGB24, eImageproEdfM_Pyr_Max, EdfCallback, EdfECallback, this);
-            imagepro_edf_start(m_edf);
+            m_pVideoData = new uchar[TDIBWIDTHBYTES(m_imgWidth * m_bits) * m_imgHeight];
+            m_pEdfData = new uchar[TDIBWIDTHBYTES(m_imgWidth * m_bits) * m_imgHeight];
+            if (0 == m_cmb_engine->currentIndex())
+            {
+                m_edf = imagepro_edf_newV2(eImageproFormat_RGB24, eImageproEdfM_Pyr_Max, EdfCallback, EdfECallback, this);
+                imagepro_edf_start(m_edf);
+            }
+            else
+            {
+                m_arena.setRetain((size_t)m_spin_budget->value() << 20);
+                m_pyr = new EdfPyramid(m_imgWidth, m_imgHeight, m_spin_threads->value(), (size_t)m_spin_budget->value() << 20, (8 == m_bits) ? 1 : 3, 8, m_arena.allocator());
+                if (!m_pyr->valid())
+                {
+                    delete m_pyr;
+                    m_pyr = nullptr;
+                    closeCamera();
+                    QMessageBox::warning(this, "Warning", "Edf out of memory.");
+                    return;
+                }
+                /* preview at the coarsest level that still covers the label */
+                m_previewLevel = 0;
+                while ((m_previewLevel + 1 < m_pyr->levels()) && (m_pyr->width(m_previewLevel + 1) >= m_lbl_edf->width()))
+                    ++m_previewLevel;
+                m_preview.assign(TDIBWIDTHBYTES(m_pyr->width(m_previewLevel) * m_bits) * m_pyr->height(m_previewLevel), 0);
+                m_dropped = 0;
+                m_planes = 0;
+                m_bStop = false;
+                m_fuse = std::thread(&MainWidget::fuseThread, this);
+                m_btn_save->setEnabled(true);
+            }
+            m_cmb_engine->setEnabled(false);
+            m_spin_threads->setEnabled(false);
+            m_spin_budget->setEnabled(false);
             if (FAILED(Toupcam_StartPullModeWithCallback(m_hcam, CameraCallBack, this)))
 			{
 				closeCamera();
@@ -146,9 +236,97 @@ void MainWidget::EdfECallback(void* ctx, eImageproEdfEvent evt)
     emit pthis->edfCallback(evt);
 }
 
+#define EDF_QUEUE   4   /* frames waiting for the fusion thread, a slower engine drops (and counts) the rest */
+
+void MainWidget::fuseThread()
+{
+    std::vector<uchar> frame, preview(m_preview.size());
+    const int stride = TDIBWIDTHBYTES(m_imgWidth * m_bits);
+    unsigned planes = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this] { return m_bStop || !m_queue.empty(); });
+            if (m_bStop)
+                break;
+            frame.swap(m_queue.front());
+            m_queue.pop_front();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_pyrMtx);
+            m_pyr->add(&frame[0], stride);
+            m_pyr->readdata(&preview[0], TDIBWIDTHBYTES(m_pyr->width(m_previewLevel) * m_bits), m_previewLevel);
+            planes = m_pyr->planes();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_preview.swap(preview);
+            m_planes = planes;
+        }
+        emit edfPreview();
+    }
+}
+
+/*
+    One pass over the stack gives both: the fused image, the winning plane of every pixel (16 bits grey, the value is
+    the plane index in the order the frames arrived) and the per block winner as a csv grid for the focus surface fit
+*/
+void MainWidget::onBtnSave()
+{
+    if (nullptr == m_pyr)
+        return;
+    QImage depth(m_imgWidth, m_imgHeight, QImage::Format_Grayscale16);
+    std::vector<unsigned short> block;
+    unsigned planes = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_pyrMtx);
+        planes = m_pyr->planes();
+        if (0 == planes)
+            return;
+        m_pyr->readdata(m_pEdfData, TDIBWIDTHBYTES(m_imgWidth * m_bits));
+        m_pyr->readdepth(reinterpret_cast<unsigned short*>(depth.bits()), depth.bytesPerLine());
+        block.resize(m_pyr->blocksX() * m_pyr->blocksY());
+        m_pyr->readblockdepth(&block[0]);
+    }
+
+    ++m_count;
+    QImage(m_pEdfData, m_imgWidth, m_imgHeight, (8 == m_bits) ? QImage::Format_Grayscale8 : QImage::Format_RGB888).save(QString::asprintf("edf_%u.png", m_count));
+    depth.save(QString::asprintf("edfdepth_%u.png", m_count));
+    FILE* fp = fopen(QString::asprintf("edfdepth_%u.csv", m_count).toLocal8Bit().constData(), "w");
+    if (fp)
+    {
+        fprintf(fp, "# %u planes, block %d x %d pixels, plane index of block (x, y)\n", planes, EDFPYR_BLOCK, EDFPYR_BLOCK);
+        for (int y = 0; y < m_pyr->blocksY(); ++y)
+        {
+            for (int x = 0; x < m_pyr->blocksX(); ++x)
+                fprintf(fp, (x + 1 < m_pyr->blocksX()) ? "%u," : "%u\n", block[y * m_pyr->blocksX() + x]);
+        }
+        fclose(fp);
+    }
+}
+
 void MainWidget::handleImageEvent()
 {
     ToupcamFrameInfoV4 info = { 0 };
+    if (m_pyr)
+    {
+        if (SUCCEEDED(Toupcam_PullImageV4(m_hcam, m_pVideoData, 0, m_bits, 0, &info)))
+        {
+            QImage image(m_pVideoData, info.v3.width, info.v3.height, (8 == m_bits) ? QImage::Format_Grayscale8 : QImage::Format_RGB888);
+            QImage newimage = image.scaled(m_lbl_video->width(), m_lbl_video->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
+            m_lbl_video->setPixmap(QPixmap::fromImage(newimage));
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (m_queue.size() >= EDF_QUEUE)
+                    ++m_dropped;
+                else
+                    m_queue.push_back(std::vector<uchar>(m_pVideoData, m_pVideoData + TDIBWIDTHBYTES(m_imgWidth * m_bits) * m_imgHeight));
+            }
+            m_cv.notify_one();
+        }
+        return;
+    }
     imagepro_edf_pullV4(m_edf, m_hcam, 1, m_pVideoData, 24, 0, &info);
     {
         QImage image(m_pVideoData, info.v3.width, info.v3.height, QImage::Format_RGB888);
@@ -9,15 +9,26 @@
 #include <QString>
 #include <QGridLayout>
 #include <QMessageBox>
+#include <QSpinBox>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
 #include <toupcam.h>
 #include <imagepro.h>
 #include <imagepro_toupcam.h>
+#include "edfpyr.h"
 
 class MainWidget : public QWidget
 {
     Q_OBJECT
     QCheckBox*      m_cbox_auto;
     QPushButton*    m_btn_open;
+    QComboBox*      m_cmb_engine;
+    QSpinBox*       m_spin_threads;
+    QSpinBox*       m_spin_budget;
+    QPushButton*    m_btn_save;
     QTimer*         m_timer;
     HToupcam        m_hcam;
     HImageproEdf    m_edf;
@@ -25,8 +36,23 @@ class MainWidget : public QWidget
     QLabel*         m_lbl_video;
     QLabel*         m_lbl_frame;
     int             m_imgWidth, m_imgHeight;
+    int             m_bits;         /* of the pull: 24, 8 for a mono camera on the open pyramid engine */
     uchar*          m_pVideoData;
     uchar*          m_pEdfData;
+    /* open pyramid engine: frames are fused on m_fuse, off the UI thread */
+    EdfPyramid*     m_pyr;
+    IpArena         m_arena;        /* of the pyramid: an open after a close at the same resolution takes it back */
+    std::thread     m_fuse;
+    std::mutex      m_mtx;
+    std::mutex      m_pyrMtx;       /* EdfPyramid is not thread safe, the save button reads it from the UI thread */
+    std::condition_variable m_cv;
+    std::deque<std::vector<uchar> > m_queue;
+    std::vector<uchar> m_preview;
+    int             m_previewLevel;
+    unsigned        m_planes;       /* of the pyramid with m_preview, under m_mtx: the UI does not read m_pyr while it fuses */
+    unsigned        m_dropped;
+    bool            m_bStop;
+    unsigned        m_count;
 public:
     MainWidget(QWidget* parent = nullptr);
 protected:
@@ -34,10 +60,13 @@ protected:
 signals:
     void cameraCallback(unsigned nEvent);
     void edfCallback(eImageproEdfEvent evt);
+    void edfPreview();
 private:
     void onBtnOpen();
     void handleImageEvent();
     void closeCamera();
+    void fuseThread();
+    void onBtnSave();
     static void __stdcall CameraCallBack(unsigned nEvent, void* pCallbackCtx);
     static void __cdecl EdfCallback(void* ctx, int result, void* outData, int stride, int outW, int outH, int outType);
     static void __cdecl EdfECallback(void* ctx, eImageproEdfEvent evt);
@@ -1,4 +1,4 @@
 QT += core gui widgets
 SOURCES += liveedf.cpp
-HEADERS += liveedf.h
+HEADERS += liveedf.h edfpyr.h ../../samples/ipalloc.h
 LIBS += -ltoupcam -limagepro
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <QSurfaceFormat>
+#include "glstack.h"
+
+static const char* s_vertex =
+    "const vec2 pos[4] = vec2[4](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0));\n"
+    "out vec2 uv;\n"
+    "void main() {\n"
+    "    uv = vec2(pos[gl_VertexID].x * 0.5 + 0.5, 0.5 - pos[gl_VertexID].y * 0.5);\n"
+    "    gl_Position = vec4(pos[gl_VertexID], 0.0, 1.0);\n"
+    "}\n";
+
+/* into the stack: row y of the stack is row y of the reference, the frame pixel (x, y) lands at (x + dx, y + dy) */
+static const char* s_add =
+    "uniform sampler2D frame;\n"
+    "uniform ivec2 d;\n"
+    "in vec2 uv;\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy) - d;\n"
+    "    if (any(lessThan(p, ivec2(0, 0))) || any(greaterThanEqual(p, textureSize(frame, 0))))\n"
+    "        discard;\n"
+    "    color = vec4(round(texelFetch(frame, p, 0).rgb * 255.0), 1.0);\n"
+    "}\n";
+
+static const char* s_show =
+    "uniform sampler2D stack;\n"
+    "uniform int sum;\n"
+    "in vec2 uv;\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "    vec4 s = texture(stack, uv);\n"
+    "    vec3 rgb = (0 != sum) ? (s.rgb / 255.0) : (s.rgb / (max(s.a, 1.0) * 255.0));\n"
+    "    color = vec4(min(rgb, vec3(1.0)), 1.0);\n"
+    "}\n";
+
+GLStack::GLStack(QWidget* parent)
+    : QOpenGLWidget(parent)
+    , m_addProgram(nullptr), m_showProgram(nullptr)
+    , m_frameTex(0), m_stackTex(0), m_fbo(0)
+    , m_width(0), m_height(0), m_bSum(false), m_bReset(false)
+    , m_dropped(0), m_added(0)
+{
+}
+
+GLStack::~GLStack()
+{
+    if (m_addProgram)
+    {
+        makeCurrent();
+        glDeleteFramebuffers(1, &m_fbo);
+        glDeleteTextures(1, &m_frameTex);
+        glDeleteTextures(1, &m_stackTex);
+        m_vao.destroy();
+        delete m_addProgram;
+        delete m_showProgram;
+        doneCurrent();
+    }
+}
+
+void GLStack::setDefaultFormat()
+{
+    QSurfaceFormat fmt = QSurfaceFormat::defaultFormat();
+    if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGL)
+    {
+        fmt.setVersion(3, 3);
+        fmt.setProfile(QSurfaceFormat::CoreProfile);
+    }
+    else
+        fmt.setVersion(3, 2);
+    fmt.setSwapInterval(1);
+    QSurfaceFormat::setDefaultFormat(fmt);
+}
+
+void GLStack::init(int width, int height, bool bSum)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_width = width;
+    m_height = height;
+    m_bSum = bSum;
+    m_bReset = true;
+    m_queue.clear();
+    m_dropped = 0;
+    m_added = 0;
+}
+
+void GLStack::sink(void* ctx, std::vector<unsigned char>* pFrame, int dx, int dy)
+{
+    GLStack* pthis = reinterpret_cast<GLStack*>(ctx);
+    {
+        std::lock_guard<std::mutex> lock(pthis->m_mtx);
+        if (pFrame && (pthis->m_queue.size() >= GLSTACK_QUEUE))
+        {
+            ++pthis->m_dropped;
+            return;
+        }
+        pthis->m_queue.push_back(Frame());
+        Frame& f = pthis->m_queue.back();
+        if (pFrame)
+            f.data.swap(*pFrame);   /* the frame of StackEngine, no copy */
+        f.dx = dx;
+        f.dy = dy;
+    }
+    /* this run in the accumulation thread of StackEngine, the GL work is done in the UI thread */
+    QMetaObject::invokeMethod(pthis, [pthis]() { pthis->update(); }, Qt::QueuedConnection);
+}
+
+void GLStack::initializeGL()
+{
+    initializeOpenGLFunctions();
+    const QByteArray version = context()->isOpenGLES() ? "#version 320 es\nprecision highp float;\nprecision highp int;\n" : "#version 330 core\n";
+    m_addProgram = new QOpenGLShaderProgram();
+    m_addProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, version + s_vertex);
+    m_addProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, version + s_add);
+    m_addProgram->link();
+    m_showProgram = new QOpenGLShaderProgram();
+    m_showProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, version + s_vertex);
+    m_showProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, version + s_show);
+    m_showProgram->link();
+    m_vao.create();
+    glGenTextures(1, &m_frameTex);
+    glGenTextures(1, &m_stackTex);
+    glGenFramebuffers(1, &m_fbo);
+}
+
+/* in paintGL(), the stack framebuffer bound */
+void GLStack::accumulate(const Frame& f)
+{
+    glBindTexture(GL_TEXTURE_2D, m_frameTex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);      /* rows of TDIBWIDTHBYTES */
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, f.data.data());
+    m_addProgram->bind();
+    m_addProgram->setUniformValue("frame", 0);
+    glUniform2i(m_addProgram->uniformLocation("d"), f.dx, f.dy);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    m_addProgram->release();
+    ++m_added;
+}
+
+QRect GLStack::imageRect() const
+{
+    if ((0 == m_width) || (0 == m_height))
+        return rect();
+    const double scale = std::min(width() / (double)m_width, height() / (double)m_height);
+    const int w = static_cast<int>(m_width * scale), h = static_cast<int>(m_height * scale);
+    return QRect((width() - w) / 2, (height() - h) / 2, w, h);
+}
+
+void GLStack::paintGL()
+{
+    std::deque<Frame> queue;
+    bool bReset;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        queue.swap(m_queue);
+        bReset = m_bReset;
+        m_bReset = false;
+    }
+    const GLuint screen = defaultFramebufferObject();
+    if (bReset && (m_width > 0) && (m_height > 0))
+    {
+        glBindTexture(GL_TEXTURE_2D, m_frameTex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        glBindTexture(GL_TEXTURE_2D, m_stackTex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);     /* float textures need not filter */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_stackTex, 0);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    if ((m_width > 0) && (m_height > 0) && !queue.empty())
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        glViewport(0, 0, m_width, m_height);
+        glActiveTexture(GL_TEXTURE0);
+        m_vao.bind();
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            if (queue[i].data.empty())
+            {
+                /* a new reference */
+                glDisable(GL_BLEND);
+                glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+                m_added = 0;
+                continue;
+            }
+            glEnable(GL_BLEND);
+            glBlendEquation(GL_FUNC_ADD);
+            glBlendFunc(GL_ONE, GL_ONE);
+            accumulate(queue[i]);
+        }
+        glDisable(GL_BLEND);
+        m_vao.release();
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, screen);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if ((m_width > 0) && (m_height > 0) && (m_added > 0))
+    {
+        const QRect rc = imageRect();
+        const qreal dpr = devicePixelRatioF();
+        glViewport(static_cast<GLint>(rc.x() * dpr), static_cast<GLint>((height() - rc.bottom() - 1) * dpr), static_cast<GLsizei>(rc.width() * dpr), static_cast<GLsizei>(rc.height() * dpr));
+        m_showProgram->bind();
+        m_showProgram->setUniformValue("stack", 0);
+        m_showProgram->setUniformValue("sum", m_bSum ? 1 : 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_stackTex);
+        m_vao.bind();
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        m_vao.release();
+        m_showProgram->release();
+    }
+}
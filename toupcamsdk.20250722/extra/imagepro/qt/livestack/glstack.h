@@ -0,0 +1,67 @@
+#ifndef __glstack_H__
+#define __glstack_H__
+
+/*
+    Live stack on the GPU (OpenGL, QOpenGLWidget): StackEngine aligns, this widget warps, accumulates and shows.
+    The frames come from the sink of StackEngine (sink(), on its accumulation thread, in order) and are queued, up to
+    GLSTACK_QUEUE; paintGL() uploads every queued frame to a texture and adds it at its offset into the stack, an
+    RGBA32F texture of the reference size behind a framebuffer object, with additive blending: rgb the sums, alpha
+    the count of frames that landed on the pixel, so the overlap is handled as by the accumulators of StackEngine.
+    The stack is never read back: the same texture is drawn to the widget, the mean (rgb / alpha) or the sum (STACK),
+    scaled by the GPU. stackTexture() hands it to any other renderer of the context.
+    A float accumulator meets the frames at 8 bits: the sums (of 0 ... 255) are exact up to 65793 frames a pixel,
+    beyond that the mean is still right to far below one step. The clip of StackMode_SIGMA stays with the CPU engine.
+    A frame which arrives with GLSTACK_QUEUE frames still queued (the GPU or the UI thread behind) is dropped and
+    counted. Needs OpenGL 3.3 core (setDefaultFormat() before QApplication), or OpenGL ES 3.2 (a float colour buffer).
+*/
+#include <QOpenGLWidget>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include "stackengine.h"
+
+#define GLSTACK_QUEUE   4
+
+class GLStack : public QOpenGLWidget, protected QOpenGLExtraFunctions
+{
+    struct Frame {
+        std::vector<unsigned char> data;
+        int dx, dy;
+    };
+    QOpenGLShaderProgram*       m_addProgram;
+    QOpenGLShaderProgram*       m_showProgram;
+    QOpenGLVertexArrayObject    m_vao;
+    GLuint          m_frameTex, m_stackTex, m_fbo;
+    int             m_width, m_height;  /* of the stack, 0 until init() */
+    bool            m_bSum, m_bReset;   /* m_bReset: init() since the last paint */
+    std::mutex      m_mtx;
+    std::deque<Frame> m_queue;          /* an empty data: a new reference, the stack starts over */
+    std::atomic<unsigned> m_dropped, m_added;
+public:
+    GLStack(QWidget* parent = nullptr);
+    ~GLStack();
+
+    static void setDefaultFormat();
+
+    /* before the first frame; bSum: StackMode_STACK, shows the sum clipped at 255 rather than the mean */
+    void init(int width, int height, bool bSum);
+    /* STACK_SINK of StackEngine, ctx: the GLStack */
+    static void sink(void* ctx, std::vector<unsigned char>* pFrame, int dx, int dy);
+
+    unsigned dropped() const { return m_dropped; }
+    unsigned added() const { return m_added; }
+    /* the RGBA32F stack, 0 before the widget is shown, valid in the context of the widget */
+    GLuint stackTexture() const { return m_stackTex; }
+protected:
+    void initializeGL() override;
+    void paintGL() override;
+private:
+    void accumulate(const Frame& f);
+    QRect imageRect() const;
+};
+
+#endif
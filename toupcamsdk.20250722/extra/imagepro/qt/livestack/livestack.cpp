@@ -1,9 +1,17 @@
 #include <QApplication>
+#include <QFileDialog>
+#include <QImage>
+#include <QStandardItemModel>
+#include <vector>
 #include "livestack.h"
 
 MainWidget::MainWidget(QWidget* parent)
-    : QWidget(parent), m_timer(new QTimer(this)), m_hcam(nullptr), m_stack(nullptr)
-    , m_lbl_stack(nullptr), m_lbl_video(nullptr), m_lbl_frame(nullptr), m_imgWidth(0), m_imgHeight(0)
+    : QWidget(parent), m_timer(new QTimer(this)), m_hcam(nullptr)
+#if defined(_WIN32)
+    , m_stack(nullptr)
+#endif
+    , m_engine(nullptr)
+    , m_lbl_stack(nullptr), m_gl_stack(nullptr), m_lbl_video(nullptr), m_lbl_frame(nullptr), m_imgWidth(0), m_imgHeight(0)
     , m_pVideoData(nullptr), m_pStackData(nullptr)
 {
     setMinimumSize(1024, 768);
@@ -18,11 +26,33 @@ MainWidget::MainWidget(QWidget* parent)
             Toupcam_put_AutoExpoEnable(m_hcam, state ? 1 : 0);
     });
 
+    m_cmb_engine = new QComboBox();
+#if defined(_WIN32)
+    m_cmb_engine->addItem("imagepro livestack", ENGINE_IMAGEPRO);
+#endif
+    m_cmb_engine->addItem("portable, threaded alignment", ENGINE_CPU);
+    m_cmb_engine->addItem("portable, GPU accumulation (OpenGL)", ENGINE_GPU);
+    m_cmb_mode = new QComboBox();
+    m_cmb_mode->addItem("Mean");
+    m_cmb_mode->addItem("Sigma-clipped mean");
+    m_cmb_mode->addItem("Sum");
+    m_cbox_align = new QCheckBox("Align");
+    m_cbox_align->setCheckState(Qt::Checked);
+    m_btn_save = new QPushButton("Save 16 bits");
+    m_btn_save->setEnabled(false);
+    connect(m_btn_save, &QPushButton::clicked, this, &MainWidget::onBtnSave);
+    connect(m_cmb_engine, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWidget::onEngineChanged);
+    onEngineChanged(m_cmb_engine->currentIndex());
+
     QHBoxLayout* hlayout = new QHBoxLayout();
     {
         QVBoxLayout* vlayout = new QVBoxLayout();
         m_lbl_frame = new QLabel();
+        vlayout->addWidget(m_cmb_engine);
+        vlayout->addWidget(m_cmb_mode);
+        vlayout->addWidget(m_cbox_align);
         vlayout->addWidget(m_btn_open);
+        vlayout->addWidget(m_btn_save);
         vlayout->addWidget(m_cbox_auto);
         vlayout->addWidget(m_lbl_frame);
         hlayout->addLayout(vlayout, 1);
@@ -33,6 +63,9 @@ MainWidget::MainWidget(QWidget* parent)
         vlayout->addWidget(m_lbl_video);
         m_lbl_stack = new QLabel();
         vlayout->addWidget(m_lbl_stack);
+        m_gl_stack = new GLStack();
+        m_gl_stack->hide();
+        vlayout->addWidget(m_gl_stack);
         hlayout->addLayout(vlayout, 4);
     }
     setLayout(hlayout);
@@ -60,18 +93,20 @@ MainWidget::MainWidget(QWidget* parent)
     connect(this, &MainWidget::stackCallback, this, [this](unsigned err)
     {
         /* this run in the UI thread */
-        if (eImageproLivestackErrorNONE == (eImageproLivestackError)err)
+        if (STACK_ERR_NONE == err)
         {
             std::unique_lock<std::mutex> lock(m_mtx);
+            if (m_pStackData)
             {
                 QImage image(m_pStackData, m_imgWidth, m_imgHeight, QImage::Format_RGB888);
                 QImage newimage = image.scaled(m_lbl_stack->width(), m_lbl_stack->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
                 m_lbl_stack->setPixmap(QPixmap::fromImage(newimage));
             }
         }
-        else if (eImageproLivestackErrorNOENOUGHMATCHES == (eImageproLivestackError)err)
+        else if (STACK_ERR_NOMATCH == err)
         {
-            QMessageBox::warning(this, "Warning", "Stack no enough match.");
+            if (nullptr == m_engine)
+                QMessageBox::warning(this, "Warning", "Stack no enough match.");
         }
         else
         {
@@ -83,7 +118,12 @@ MainWidget::MainWidget(QWidget* parent)
     {
         unsigned nFrame = 0, nTime = 0, nTotalFrame = 0;
         if (m_hcam && SUCCEEDED(Toupcam_get_FrameRate(m_hcam, &nFrame, &nTime, &nTotalFrame)) && (nTime > 0))
-            m_lbl_frame->setText(QString::asprintf("%u, fps = %.1f", nTotalFrame, nFrame * 1000.0 / nTime));
+        {
+            if (m_engine)
+                m_lbl_frame->setText(QString::asprintf("%u, fps = %.1f\nstacked = %u, dropped = %u, clipped = %llu", nTotalFrame, nFrame * 1000.0 / nTime, m_engine->stacked(), m_engine->dropped() + m_gl_stack->dropped(), m_engine->rejected()));
+            else
+                m_lbl_frame->setText(QString::asprintf("%u, fps = %.1f", nTotalFrame, nFrame * 1000.0 / nTime));
+        }
     });
     m_timer->start(1000);
 }
@@ -95,11 +135,19 @@ void MainWidget::closeCamera()
         Toupcam_Close(m_hcam);
         m_hcam = nullptr;
     }
+#if defined(_WIN32)
     if (m_stack)
     {
         imagepro_livestack_delete(m_stack);
         m_stack = nullptr;
     }
+#endif
+    delete m_engine;    /* joins the alignment and accumulation threads */
+    m_engine = nullptr;
+    m_cmb_engine->setEnabled(true);
+    onEngineChanged(m_cmb_engine->currentIndex());
+    m_cbox_align->setEnabled(true);
+    m_btn_save->setEnabled(false);
     delete[] m_pVideoData;
     m_pVideoData = nullptr;
     delete[] m_pStackData;
@@ -131,8 +179,37 @@ void MainWidget::onBtnOpen()
 	
             m_pVideoData = new uchar[TDIBWIDTHBYTES(m_imgWidth * 24) * m_imgHeight];
             m_pStackData = new uchar[TDIBWIDTHBYTES(m_imgWidth * 24) * m_imgHeight];
-            m_stack = imagepro_livestack_new(eImageproLivestackModeMEAN, eImageproLivestackTypePLANET, StackCallback, this);
-            imagepro_livestack_start(m_stack);
+            const int engine = m_cmb_engine->currentData().toInt();
+#if defined(_WIN32)
+            if (ENGINE_IMAGEPRO == engine)
+            {
+                m_stack = imagepro_livestack_new(eImageproLivestackModeMEAN, eImageproLivestackTypePLANET, StackCallback, this);
+                imagepro_livestack_setalign(m_stack, m_cbox_align->isChecked() ? 1 : 0);
+                imagepro_livestack_start(m_stack);
+            }
+            else
+#endif
+            if (ENGINE_GPU == engine)
+            {
+                /* StackEngine aligns, the GL widget warps and accumulates: the stack stays on the GPU */
+                const bool bSum = (2 == m_cmb_mode->currentIndex());
+                m_gl_stack->init(m_imgWidth, m_imgHeight, bSum);
+                m_engine = new StackEngine(bSum ? StackMode_STACK : StackMode_MEAN, m_cbox_align->isChecked(), m_imgWidth, m_imgHeight, TDIBWIDTHBYTES(m_imgWidth * 24), 0,
+                                           EngineCallback, this, STACK_SIGMA_KAPPA, GLStack::sink, m_gl_stack);
+                m_lbl_stack->hide();
+                m_gl_stack->show();
+            }
+            else
+            {
+                static const StackMode modes[] = { StackMode_MEAN, StackMode_SIGMA, StackMode_STACK };
+                m_engine = new StackEngine(modes[m_cmb_mode->currentIndex()], m_cbox_align->isChecked(), m_imgWidth, m_imgHeight, TDIBWIDTHBYTES(m_imgWidth * 24), 0, EngineCallback, this);
+                m_btn_save->setEnabled(true);
+                m_gl_stack->hide();
+                m_lbl_stack->show();
+            }
+            m_cmb_engine->setEnabled(false);
+            m_cmb_mode->setEnabled(false);
+            m_cbox_align->setEnabled(false);
             if (FAILED(Toupcam_StartPullModeWithCallback(m_hcam, CameraCallBack, this)))
 			{
 				closeCamera();
@@ -142,21 +219,67 @@ void MainWidget::onBtnOpen()
     }
 }
 
+/* the mode is for the portable engines, the clip for the one on the CPU */
+void MainWidget::onEngineChanged(int index)
+{
+    const int engine = m_cmb_engine->itemData(index).toInt();
+    m_cmb_mode->setEnabled(ENGINE_IMAGEPRO != engine);
+    QStandardItemModel* model = qobject_cast<QStandardItemModel*>(m_cmb_mode->model());
+    if (model)
+        model->item(1)->setEnabled(ENGINE_CPU == engine);
+    if ((ENGINE_GPU == engine) && (1 == m_cmb_mode->currentIndex()))
+        m_cmb_mode->setCurrentIndex(0);
+}
+
+/* the stack as it is, at 16 bits a channel (StackEngine::result), where the 8 bits of the display ran out long ago */
+void MainWidget::onBtnSave()
+{
+    if (nullptr == m_engine)
+        return;
+    const QString path = QFileDialog::getSaveFileName(this, "Save", "stack.png", "PNG (*.png)");
+    if (path.isEmpty() || (nullptr == m_engine))
+        return;
+    std::vector<unsigned short> rgb48((size_t)m_imgWidth * m_imgHeight * 3);
+    m_engine->result(rgb48.data(), 16);
+    QImage image(m_imgWidth, m_imgHeight, QImage::Format_RGBX64);
+    for (int y = 0; y < m_imgHeight; ++y)
+    {
+        const unsigned short* s = &rgb48[(size_t)y * m_imgWidth * 3];
+        quint64* d = reinterpret_cast<quint64*>(image.scanLine(y));
+        for (int x = 0; x < m_imgWidth; ++x, s += 3)
+            d[x] = (quint64)s[0] | ((quint64)s[1] << 16) | ((quint64)s[2] << 32) | (0xffffULL << 48);
+    }
+    if (!image.save(path))
+        QMessageBox::warning(this, "Warning", "Failed to save the stack.");
+}
+
 void MainWidget::CameraCallBack(unsigned nEvent, void* pCallbackCtx)
 {
     MainWidget* pthis = reinterpret_cast<MainWidget*>(pCallbackCtx);
     emit pthis->cameraCallback(nEvent);
 }
 
-void MainWidget::StackCallback(void* ctx, int width, int height, int type, eImageproLivestackError err, void* data)
+#if defined(_WIN32)
+void MainWidget::StackCallback(void* ctx, int width, int height, int /*type*/, eImageproLivestackError err, void* data)
 {
     MainWidget* pthis = reinterpret_cast<MainWidget*>(ctx);
-    pthis->TStackCallback(width, height, type, err, data);
+    if (eImageproLivestackErrorNONE == err)
+        pthis->TStackCallback(width, height, STACK_ERR_NONE, data);
+    else
+        pthis->TStackCallback(width, height, (eImageproLivestackErrorNOENOUGHMATCHES == err) ? STACK_ERR_NOMATCH : STACK_ERR_ERROR, data);
 }
+#endif
 
-void MainWidget::TStackCallback(int width, int height, int /*type*/, eImageproLivestackError err, void* data)
+/* this run in the accumulation thread of StackEngine */
+void MainWidget::EngineCallback(void* ctx, int width, int height, unsigned err, const void* data)
 {
-    if (eImageproLivestackErrorNONE == err)
+    MainWidget* pthis = reinterpret_cast<MainWidget*>(ctx);
+    pthis->TStackCallback(width, height, err, data);
+}
+
+void MainWidget::TStackCallback(int width, int height, unsigned err, const void* data)
+{
+    if (STACK_ERR_NONE == err)
     {
         std::unique_lock<std::mutex> lock(m_mtx);
         memcpy(m_pStackData, data, TDIBWIDTHBYTES(width * 24) * height);
@@ -173,13 +296,19 @@ void MainWidget::handleImageEvent()
         QImage newimage = image.scaled(m_lbl_video->width(), m_lbl_video->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
         m_lbl_video->setPixmap(QPixmap::fromImage(newimage));
 
-        imagepro_livestack_add(m_stack, m_pVideoData, info.v3.width, info.v3.height, 8);
+        if (m_engine)
+            m_engine->add(m_pVideoData);
+#if defined(_WIN32)
+        else
+            imagepro_livestack_add(m_stack, m_pVideoData, info.v3.width, info.v3.height, 8);
+#endif
     }
 }
 
 int main(int argc, char* argv[])
 {
     Toupcam_GigeEnable(nullptr, nullptr);
+    GLStack::setDefaultFormat();
     QApplication a(argc, argv);
     MainWidget w;
     w.show();
@@ -13,16 +13,30 @@
 #include <imagepro.h>
 #include <imagepro_toupcam.h>
 #include <mutex>
+#include "stackengine.h"
+#include "glstack.h"
+
+#define ENGINE_IMAGEPRO 0   /* HLivestack, Windows */
+#define ENGINE_CPU      1   /* StackEngine */
+#define ENGINE_GPU      2   /* StackEngine aligning, GLStack accumulating */
 
 class MainWidget : public QWidget
 {
     Q_OBJECT
     QCheckBox*      m_cbox_auto;
     QPushButton*    m_btn_open;
+    QComboBox*      m_cmb_engine;
+    QComboBox*      m_cmb_mode;         /* of the portable engine */
+    QCheckBox*      m_cbox_align;
+    QPushButton*    m_btn_save;
     QTimer*         m_timer;
     HToupcam        m_hcam;
+#if defined(_WIN32)
     HLivestack      m_stack;
+#endif
+    StackEngine*    m_engine;           /* portable stacking, the only one outside Windows */
     QLabel*         m_lbl_stack;
+    GLStack*        m_gl_stack;
     QLabel*         m_lbl_video;
     QLabel*         m_lbl_frame;
     int             m_imgWidth, m_imgHeight;
@@ -40,9 +54,14 @@ private:
     void onBtnOpen();
     void handleImageEvent();
     void closeCamera();
-    void TStackCallback(int width, int height, int type, eImageproLivestackError err, void* data);
+    void onBtnSave();
+    void onEngineChanged(int index);
+    void TStackCallback(int width, int height, unsigned err, const void* data);
     static void __stdcall CameraCallBack(unsigned nEvent, void* pCallbackCtx);
+#if defined(_WIN32)
     static void __cdecl StackCallback(void* ctx, int width, int height, int type, eImageproLivestackError err, void* data);
+#endif
+    static void EngineCallback(void* ctx, int width, int height, unsigned err, const void* data);
 };
 
 #endif
@@ -1,4 +1,5 @@
-QT += core gui widgets
-SOURCES += livestack.cpp
-HEADERS += livestack.h
+QT += core gui widgets opengl
+greaterThan(QT_MAJOR_VERSION, 5): QT += openglwidgets
+SOURCES += livestack.cpp glstack.cpp
+HEADERS += livestack.h stackengine.h glstack.h
 LIBS += -ltoupcam -limagepro
@@ -0,0 +1,503 @@
+#ifndef __stackengine_H__
+#define __stackengine_H__
+
+/*
+    Portable live stacking, for the platforms where imagepro has no HLivestack (it is Windows only).
+    add() only copies the frame and returns: the translation of every frame against the reference is found on a pool
+    of alignment threads (the hint search of gridstitch's stitchreg.h on a grey image downscaled to about
+    STACK_ALIGN_WIDTH, then refined to the pixel at full resolution),
+    the aligned frames are accumulated strictly in arrival order on one accumulation thread, which then calls back
+    with the stacked RGB24 image. A frame that arrives while STACK_PENDING frames per thread are still in flight is
+    dropped and counted, so the caller (a camera callback) is never blocked by the stacking.
+    mode MEAN: average of all frames, STACK: sum, clipped at 255, SIGMA: average with a sigma clip. The reference is
+    the first frame, or ref().
+    There is no limit on the number of frames (imagepro_livestack_setnum stops at IMAGEPRO_LIVESTACK_NUM_MAX): the
+    stack is kept as running accumulators, so the memory and the time a frame takes are the same for the thousandth
+    frame as for the first. MEAN / STACK: a 32 bits sum per channel and a count per pixel, exact up to 16 million
+    frames. SIGMA: the running mean and the sum of the squared deviations (Welford) per channel, in float, and the
+    count of the values kept: once STACK_SIGMA_MIN values are in, a value further than kappa standard deviations from
+    the mean of its channel (plus a floor of STACK_SIGMA_FLOOR, one step of the input, for the pixels which have not
+    moved yet) is rejected, one pass, no frame kept. The accumulation is SSE2 on x86 / x64, NEON on ARM, scalar
+    otherwise.
+    The callback hands out the stack as RGB24, result() at 16 bits (RGB48, the mean x 257) or as float (the mean, 0 ...
+    255, or the sum for STACK), which the 8 bits of the callback do not resolve after a few hundred frames.
+    Memory: 16 bytes a pixel for MEAN / STACK, 36 for SIGMA, and the RGB24 of the callback.
+    With a sink (pSink of the constructor), the aligned frames go, in order, to the sink instead of the accumulators, the engine is then the
+    alignment only and allocates no accumulator (glstack.h accumulates on the GPU). The sink is called on the
+    accumulation thread with the frame (RGB24, stride) and where it lands, and may take the buffer (swap it out); a
+    NULL frame is a new reference, the stack starts over. The frames which do not match are reported to the
+    callback as without a sink.
+*/
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define STACK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define STACK_NEON
+#endif
+#include "../../samples/gridstitch/stitchreg.h"
+
+#define STACK_ALIGN_WIDTH   512     /* alignment runs on a grey image about this wide */
+#define STACK_ALIGN_RADIUS  48      /* search radius in pixels of the alignment image */
+#define STACK_MIN_NCC       0.5     /* below this the frame is not stacked and the callback reports STACK_ERR_NOMATCH */
+#define STACK_PENDING       2
+#define STACK_SIGMA_KAPPA   3.0     /* default of the clip, in standard deviations */
+#define STACK_SIGMA_MIN     8       /* values in before the clip starts */
+#define STACK_SIGMA_FLOOR   1.0f    /* variance added to the one of every channel */
+
+#define STACK_ERR_NONE      0
+#define STACK_ERR_NOMATCH   1
+#define STACK_ERR_ERROR     2
+
+enum StackMode { StackMode_MEAN, StackMode_STACK, StackMode_SIGMA };
+
+typedef void (*STACK_CALLBACK)(void* ctx, int width, int height, unsigned err, const void* data);
+/* frame pixel (x, y) lands at (x + dx, y + dy) of the reference */
+typedef void (*STACK_SINK)(void* ctx, std::vector<unsigned char>* pFrame, int dx, int dy);
+
+/* a[i] += s[i], i = 0 ... n - 1 */
+static inline void StackAddRow(unsigned* a, const unsigned char* s, unsigned n)
+{
+    unsigned i = 0;
+#if defined(STACK_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+        __m128i* p = (__m128i*)(a + i);
+        _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(p + 1, _mm_add_epi32(_mm_loadu_si128(p + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(p + 2, _mm_add_epi32(_mm_loadu_si128(p + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(p + 3, _mm_add_epi32(_mm_loadu_si128(p + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+#elif defined(STACK_NEON)
+    for (; i + 16 <= n; i += 16)
+    {
+        const uint8x16_t v = vld1q_u8(s + i);
+        const uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(a + i, vaddw_u16(vld1q_u32(a + i), vget_low_u16(lo)));
+        vst1q_u32(a + i + 4, vaddw_u16(vld1q_u32(a + i + 4), vget_high_u16(lo)));
+        vst1q_u32(a + i + 8, vaddw_u16(vld1q_u32(a + i + 8), vget_low_u16(hi)));
+        vst1q_u32(a + i + 12, vaddw_u16(vld1q_u32(a + i + 12), vget_high_u16(hi)));
+    }
+#endif
+    for (; i < n; ++i)
+        a[i] += s[i];
+}
+
+/*
+    Welford with a clip, per value: d = x - mean, rejected when cnt >= cmin and d^2 (cnt - 1) > k2 (m2 + (cnt - 1) floor),
+    that is |d| > kappa sqrt(sigma^2 + floor); otherwise cnt += 1, mean += d / cnt, m2 += d (x - mean). Returns the rejected.
+*/
+static inline unsigned StackClipRow(float* mean, float* m2, float* cnt, const unsigned char* s, unsigned n, float k2, float cmin)
+{
+    unsigned i = 0, rejected = 0;
+#if defined(STACK_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 vk2 = _mm_set1_ps(k2), vmin = _mm_set1_ps(cmin), one = _mm_set1_ps(1.0f), vfloor = _mm_set1_ps(STACK_SIGMA_FLOOR);
+    for (; i + 4 <= n; i += 4)
+    {
+        int v4;
+        memcpy(&v4, s + i, 4);
+        const __m128 x = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero), zero));
+        const __m128 mu = _mm_loadu_ps(mean + i), q = _mm_loadu_ps(m2 + i), c = _mm_loadu_ps(cnt + i);
+        const __m128 d = _mm_sub_ps(x, mu), c1 = _mm_sub_ps(c, one);
+        const __m128 rej = _mm_and_ps(_mm_cmpge_ps(c, vmin), _mm_cmpgt_ps(_mm_mul_ps(_mm_mul_ps(d, d), c1), _mm_mul_ps(vk2, _mm_add_ps(q, _mm_mul_ps(c1, vfloor)))));
+        const __m128 cn = _mm_add_ps(c, _mm_andnot_ps(rej, one));
+        const __m128 mn = _mm_add_ps(mu, _mm_andnot_ps(rej, _mm_div_ps(d, cn)));
+        const __m128 qn = _mm_add_ps(q, _mm_andnot_ps(rej, _mm_mul_ps(d, _mm_sub_ps(x, mn))));
+        _mm_storeu_ps(mean + i, mn);
+        _mm_storeu_ps(m2 + i, qn);
+        _mm_storeu_ps(cnt + i, cn);
+        const int bits = _mm_movemask_ps(rej);
+        rejected += (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + ((bits >> 3) & 1);
+    }
+#elif defined(STACK_NEON)
+    const float32x4_t vk2 = vdupq_n_f32(k2), vmin = vdupq_n_f32(cmin), one = vdupq_n_f32(1.0f), vfloor = vdupq_n_f32(STACK_SIGMA_FLOOR);
+    for (; i + 8 <= n; i += 8)
+    {
+        const uint16x8_t v = vmovl_u8(vld1_u8(s + i));
+        for (unsigned h = 0; h < 2; ++h)
+        {
+            const float32x4_t x = vcvtq_f32_u32(vmovl_u16(h ? vget_high_u16(v) : vget_low_u16(v)));
+            float* pm = mean + i + 4 * h;
+            float* pq = m2 + i + 4 * h;
+            float* pc = cnt + i + 4 * h;
+            const float32x4_t mu = vld1q_f32(pm), q = vld1q_f32(pq), c = vld1q_f32(pc);
+            const float32x4_t d = vsubq_f32(x, mu), c1 = vsubq_f32(c, one);
+            const uint32x4_t rej = vandq_u32(vcgeq_f32(c, vmin), vcgtq_f32(vmulq_f32(vmulq_f32(d, d), c1), vmulq_f32(vk2, vaddq_f32(q, vmulq_f32(c1, vfloor)))));
+            const uint32x4_t acc = vmvnq_u32(rej);
+            const float32x4_t cn = vaddq_f32(c, vreinterpretq_f32_u32(vandq_u32(acc, vreinterpretq_u32_f32(one))));
+            float r[4], dd[4], cc[4];
+            vst1q_f32(dd, d);
+            vst1q_f32(cc, cn);
+            for (unsigned k = 0; k < 4; ++k)
+                r[k] = dd[k] / cc[k];     /* a true division, as the scalar path */
+            const float32x4_t mn = vaddq_f32(mu, vreinterpretq_f32_u32(vandq_u32(acc, vreinterpretq_u32_f32(vld1q_f32(r)))));
+            const float32x4_t qn = vaddq_f32(q, vreinterpretq_f32_u32(vandq_u32(acc, vreinterpretq_u32_f32(vmulq_f32(d, vsubq_f32(x, mn))))));
+            vst1q_f32(pm, mn);
+            vst1q_f32(pq, qn);
+            vst1q_f32(pc, cn);
+            uint32_t m[4];
+            vst1q_u32(m, rej);
+            rejected += (m[0] & 1) + (m[1] & 1) + (m[2] & 1) + (m[3] & 1);
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        const float x = s[i], d = x - mean[i], c1 = cnt[i] - 1.0f;
+        if ((cnt[i] >= cmin) && (d * d * c1 > k2 * (m2[i] + c1 * STACK_SIGMA_FLOOR)))
+        {
+            ++rejected;
+            continue;
+        }
+        cnt[i] += 1.0f;
+        mean[i] += d / cnt[i];
+        m2[i] += d * (x - mean[i]);
+    }
+    return rejected;
+}
+
+class StackEngine {
+    struct Frame {
+        unsigned seq;
+        std::vector<unsigned char> data;
+        int dx, dy;
+        bool ok;
+    };
+    const StackMode m_mode;
+    const bool m_bAlign;
+    const int m_width, m_height, m_stride, m_scale;
+    const float m_k2;
+    STACK_CALLBACK m_pFun;
+    void* m_ctx;
+    STACK_SINK m_pSink;
+    void* m_sinkCtx;
+
+    std::mutex m_mtx;
+    std::condition_variable m_cvAlign, m_cvAccum;
+    std::deque<std::unique_ptr<Frame> > m_todo;
+    std::map<unsigned, std::unique_ptr<Frame> > m_done;     /* aligned, waiting for their turn */
+    std::shared_ptr<GreyImage> m_ref, m_refFull;
+    std::unique_ptr<Frame> m_refFrame;                          /* ref() waiting for the accumulation thread */
+    unsigned m_seq, m_next, m_inflight;
+    bool m_bStop;
+    std::atomic<unsigned> m_dropped, m_stacked;
+    std::atomic<unsigned long long> m_rejected;
+    std::vector<std::thread> m_vecThread;
+
+    std::mutex m_accMtx;                                        /* the accumulators, between the accumulation and result() */
+    std::vector<unsigned> m_accum, m_count;                     /* MEAN / STACK: per channel, per pixel */
+    std::vector<float> m_mean, m_m2, m_n;                       /* SIGMA: per channel */
+    std::vector<unsigned char> m_out;
+
+    void grey(const unsigned char* data, GreyImage* pFull, GreyImage* pOut) const
+    {
+        reg_grey_from_rgb24(data, m_width, m_height, m_stride, pFull);
+        if (m_scale > 1)
+            reg_downscale(*pFull, m_scale, pOut);
+        else
+            *pOut = *pFull;
+    }
+
+    void alignThread()
+    {
+        while (true)
+        {
+            std::unique_ptr<Frame> f;
+            std::shared_ptr<GreyImage> ref, refFull;
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cvAlign.wait(lock, [this] { return m_bStop || !m_todo.empty(); });
+                if (m_bStop)
+                    return;
+                f.swap(m_todo.front());
+                m_todo.pop_front();
+                ref = m_ref;
+                refFull = m_refFull;
+            }
+            f->dx = f->dy = 0;
+            f->ok = true;
+            if (m_bAlign && ref)
+            {
+                GreyImage full, g;
+                grey(&f->data[0], &full, &g);
+                const RegResult r = reg_register_hint(*ref, g, 0, 0, STACK_ALIGN_RADIUS);
+                f->ok = (r.score >= STACK_MIN_NCC);
+                f->dx = r.dx * m_scale;
+                f->dy = r.dy * m_scale;
+                if (f->ok && (m_scale > 1))
+                {
+                    double best = -2.0;
+                    const int cx = f->dx, cy = f->dy;
+                    for (int y = cy - m_scale + 1; y < cy + m_scale; ++y)
+                    {
+                        for (int x = cx - m_scale + 1; x < cx + m_scale; ++x)
+                        {
+                            const double score = reg_ncc(*refFull, full, x, y, 2, REG_MIN_OVERLAP);
+                            if (score > best)
+                            {
+                                best = score;
+                                f->dx = x;
+                                f->dy = y;
+                            }
+                        }
+                    }
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_done[f->seq].swap(f);
+            }
+            m_cvAccum.notify_one();
+        }
+    }
+
+    /* channel i of the stack (pixel i / 3) as float: the mean, the sum for STACK; 0 where nothing landed */
+    float value(size_t i) const
+    {
+        if (StackMode_SIGMA == m_mode)
+            return (m_n[i] > 0) ? m_mean[i] : 0.0f;
+        const unsigned c = m_count[i / 3];
+        if (StackMode_STACK == m_mode)
+            return (float)m_accum[i];
+        return c ? (float)((double)m_accum[i] / c) : 0.0f;
+    }
+
+    /* frame pixel (x, y) lands at (x + dx, y + dy) of the reference */
+    void accumulate(const Frame& f)
+    {
+        const int x0 = std::max(0, f.dx), x1 = std::min(m_width, m_width + f.dx);
+        const int y0 = std::max(0, f.dy), y1 = std::min(m_height, m_height + f.dy);
+        std::lock_guard<std::mutex> lock(m_accMtx);
+        unsigned long long rejected = 0;
+        for (int y = y0; y < y1; ++y)
+        {
+            const unsigned char* s = &f.data[(size_t)(y - f.dy) * m_stride + (x0 - f.dx) * 3];
+            const size_t i = ((size_t)y * m_width + x0) * 3;
+            const unsigned n = (unsigned)(x1 - x0) * 3;
+            if (StackMode_SIGMA == m_mode)
+                rejected += StackClipRow(&m_mean[i], &m_m2[i], &m_n[i], s, n, m_k2, (float)STACK_SIGMA_MIN);
+            else
+            {
+                StackAddRow(&m_accum[i], s, n);
+                unsigned* c = &m_count[i / 3];
+                for (int x = x0; x < x1; ++x)
+                    ++*c++;
+            }
+        }
+        m_rejected += rejected;
+        for (int y = 0; y < m_height; ++y)
+        {
+            const size_t i = (size_t)y * m_width * 3;
+            unsigned char* o = &m_out[(size_t)y * m_stride];
+            if (StackMode_SIGMA == m_mode)
+            {
+                for (int k = 0; k < m_width * 3; ++k)
+                    o[k] = (unsigned char)std::min(value(i + k) + 0.5f, 255.0f);
+                continue;
+            }
+            const unsigned* a = &m_accum[i];
+            const unsigned* c = &m_count[(size_t)y * m_width];
+            for (int x = 0; x < m_width; ++x, a += 3, o += 3, ++c)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (StackMode_MEAN == m_mode)
+                        o[k] = (unsigned char)(*c ? (((unsigned long long)a[k] + *c / 2) / *c) : 0);
+                    else
+                        o[k] = (unsigned char)std::min(a[k], 255u);
+                }
+            }
+        }
+    }
+
+    void accumThread()
+    {
+        while (true)
+        {
+            std::unique_ptr<Frame> f, ref;
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cvAccum.wait(lock, [this] { return m_bStop || m_refFrame || (!m_done.empty() && (m_done.begin()->first == m_next)); });
+                if (m_bStop)
+                    return;
+                if (m_refFrame)
+                    ref.swap(m_refFrame);
+                else
+                {
+                    f.swap(m_done.begin()->second);
+                    m_done.erase(m_done.begin());
+                    ++m_next;
+                    --m_inflight;
+                }
+            }
+            if (ref && m_pSink)
+            {
+                m_stacked = 0;
+                m_pSink(m_sinkCtx, NULL, 0, 0);
+                continue;
+            }
+            if (ref)
+            {
+                /* restart the stack on the new reference */
+                std::lock_guard<std::mutex> lock(m_accMtx);
+                std::fill(m_accum.begin(), m_accum.end(), 0u);
+                std::fill(m_count.begin(), m_count.end(), 0u);
+                std::fill(m_mean.begin(), m_mean.end(), 0.0f);
+                std::fill(m_m2.begin(), m_m2.end(), 0.0f);
+                std::fill(m_n.begin(), m_n.end(), 0.0f);
+                m_stacked = 0;
+                m_rejected = 0;
+                continue;
+            }
+            if (!f->ok)
+            {
+                m_pFun(m_ctx, m_width, m_height, STACK_ERR_NOMATCH, NULL);
+                continue;
+            }
+            if (m_pSink)
+            {
+                ++m_stacked;
+                m_pSink(m_sinkCtx, &f->data, f->dx, f->dy);
+                continue;
+            }
+            accumulate(*f);
+            ++m_stacked;
+            m_pFun(m_ctx, m_width, m_height, STACK_ERR_NONE, &m_out[0]);
+        }
+    }
+public:
+    /* kappa: of the clip, SIGMA only; pSink: see above, the mode is then up to the sink */
+    StackEngine(StackMode mode, bool bAlign, int width, int height, int stride, unsigned threads, STACK_CALLBACK pFun, void* ctx, double kappa = STACK_SIGMA_KAPPA, STACK_SINK pSink = NULL, void* sinkCtx = NULL)
+    : m_mode(mode), m_bAlign(bAlign), m_width(width), m_height(height), m_stride(stride), m_scale(std::max(1, (width + STACK_ALIGN_WIDTH - 1) / STACK_ALIGN_WIDTH))
+    , m_k2((float)(kappa * kappa)), m_pFun(pFun), m_ctx(ctx), m_pSink(pSink), m_sinkCtx(sinkCtx), m_seq(0), m_next(0), m_inflight(0), m_bStop(false), m_dropped(0), m_stacked(0), m_rejected(0)
+    {
+        const size_t n = (size_t)width * height * 3;
+        if (NULL == pSink)
+        {
+            if (StackMode_SIGMA == mode)
+            {
+                m_mean.resize(n);
+                m_m2.resize(n);
+                m_n.resize(n);
+            }
+            else
+            {
+                m_accum.resize(n);
+                m_count.resize(n / 3);
+            }
+            m_out.resize((size_t)stride * height);
+        }
+        if (0 == threads)
+        {
+            const unsigned hc = std::thread::hardware_concurrency();   /* 0: not known */
+            threads = (hc > 1) ? hc - 1 : 1;
+        }
+        for (unsigned i = 0; i < threads; ++i)
+            m_vecThread.push_back(std::thread(&StackEngine::alignThread, this));
+        m_vecThread.push_back(std::thread(&StackEngine::accumThread, this));
+    }
+    ~StackEngine()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStop = true;
+        }
+        m_cvAlign.notify_all();
+        m_cvAccum.notify_all();
+        for (size_t i = 0; i < m_vecThread.size(); ++i)
+            m_vecThread[i].join();
+    }
+
+    unsigned dropped() const { return m_dropped; }
+    unsigned stacked() const { return m_stacked; }
+    /* SIGMA: the values the clip has rejected since the reference */
+    unsigned long long rejected() const { return m_rejected; }
+
+    /*
+        The stack at more than the 8 bits of the callback, any thread, any time: bits 16, RGB48 (the mean x 257, the sum
+        for STACK, clipped at 65535); bits 32, 3 floats a pixel (the mean, 0 ... 255, or the sum).
+        stride: bytes of a row of data, 0 for width x 6 (16) or width x 12 (32).
+    */
+    bool result(void* data, int bits, int stride = 0)
+    {
+        if (((16 != bits) && (32 != bits)) || m_pSink)
+            return false;
+        if (0 == stride)
+            stride = m_width * 3 * bits / 8;
+        std::lock_guard<std::mutex> lock(m_accMtx);
+        for (int y = 0; y < m_height; ++y)
+        {
+            const size_t i = (size_t)y * m_width * 3;
+            unsigned char* row = (unsigned char*)data + (size_t)y * stride;
+            if (32 == bits)
+            {
+                float* o = (float*)row;
+                for (int k = 0; k < m_width * 3; ++k)
+                    o[k] = value(i + k);
+            }
+            else
+            {
+                unsigned short* o = (unsigned short*)row;
+                const float scale = (StackMode_STACK == m_mode) ? 1.0f : 257.0f;
+                for (int k = 0; k < m_width * 3; ++k)
+                    o[k] = (unsigned short)std::min(value(i + k) * scale + 0.5f, 65535.0f);
+            }
+        }
+        return true;
+    }
+
+    /* copies the frame, never waits for the alignment or the accumulation */
+    void add(const void* data)
+    {
+        std::unique_ptr<Frame> f;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_inflight >= STACK_PENDING * (m_vecThread.size() - 1))
+            {
+                ++m_dropped;
+                return;
+            }
+            ++m_inflight;
+            f.reset(new Frame());
+            f->seq = m_seq++;
+        }
+        f->data.assign((const unsigned char*)data, (const unsigned char*)data + (size_t)m_stride * m_height);
+        if (m_bAlign && (0 == f->seq) && !m_ref)
+            ref(data);
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_todo.push_back(std::move(f));
+        }
+        m_cvAlign.notify_one();
+    }
+
+    /* new reference, the frames from now on are aligned to it and the stack starts over */
+    void ref(const void* data)
+    {
+        std::shared_ptr<GreyImage> full(new GreyImage()), g(new GreyImage());
+        grey((const unsigned char*)data, full.get(), g.get());
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_ref = g;
+            m_refFull = full;
+            m_refFrame.reset(new Frame());
+        }
+        m_cvAccum.notify_one();
+    }
+};
+
+#endif
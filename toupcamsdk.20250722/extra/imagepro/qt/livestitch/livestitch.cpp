@@ -1,21 +1,29 @@
 ﻿#include <QApplication>
 #include "livestitch.h"
+#include "../../samples/ipalloc.h"
 
-static void* ipmalloc(size_t size)
-{
-    return malloc(size);
-}
+/* the mosaics of imagepro_stitch_stop (IpMallocHook) come from an arena: a scan of the same extent as the last one
+   takes the same memory back instead of the heap growing a new hole of a few hundred MB at every scan */
+#define MOSAIC_RETAIN   ((size_t)1 << 30)
+
+#define CKPT_DIR        "livestitch.ckpt"   /* the checkpoint of the scan in progress, removed when it is stopped */
+#define CKPT_REG_SIZE   256                 /* a resumed session is first registered on frames reduced to this size */
+#define CKPT_MIN_SCORE  0.5                 /* ncc of a frame of a resumed session against the checkpoint */
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
     , m_hcam(nullptr), m_count(0)
     , m_imgWidth(0), m_imgHeight(0), m_pData(nullptr), m_handel(nullptr)/*, m_pDataedf(nullptr)*/
     , m_res(0), m_temp(TOUPCAM_TEMP_DEF), m_tint(TOUPCAM_TINT_DEF), m_bStitch(false), m_bcrop(true)
+    , m_mosaicW(0), m_mosaicH(0), m_precision(eImageproStitchP_Medium), m_tPull(0), m_tLastFrame(0)
+    , m_intervalAvg(0), m_procAvg(0), m_nPulled(0), m_nDone(0), m_nPoor(0)
+    , m_bResumed(false), m_bLocked(false), m_ckptOutW(0), m_ckptOutH(0)
 {
     qRegisterMetaType<eImageproStitchEvent>("eImageproStitchEvent");
     qRegisterMetaType<eImageproStitchQuality>("eImageproStitchQuality");
 
     setMinimumSize(1024, 768);
+    m_timer.start();
 
     QGroupBox* gbox_res = new QGroupBox("Resolution");
     m_cmb_res = new QComboBox();
@@ -25,15 +33,15 @@ MainWindow::MainWindow(QWidget* parent)
     gbox_res->setLayout(vlyt_res);
     connect(m_cmb_res, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this](int index)
     {
-        if (m_hcam) //step 1: stop camera
-            Toupcam_Stop(m_hcam);
-
         m_res = index;
         m_imgWidth = m_cur.model->res[index].width;
         m_imgHeight = m_cur.model->res[index].height;
 
-        if (m_hcam) //step 2: restart camera
+        // switch on the running stream first: m_pData already holds the largest resolution and handleImageEvent
+        // takes the size of each frame, so nothing is reallocated; stop and restart only if the camera refuses
+        if (m_hcam && FAILED(Toupcam_put_eSize(m_hcam, static_cast<unsigned>(m_res))))
         {
+            Toupcam_Stop(m_hcam);
             Toupcam_put_eSize(m_hcam, static_cast<unsigned>(m_res));
             startCamera();
         }
@@ -139,35 +147,46 @@ MainWindow::MainWindow(QWidget* parent)
             m_btn_stitch->setText("Start Stitch");
             m_bStitch = false;
             void* result = imagepro_stitch_stop(m_handel, 1, m_bcrop);
-            if (result)
+            if (result && !m_bResumed)
             {
+                // the mosaic follows its BITMAPINFOHEADER, RGB24 like the stitch handle, with the DIB row pitch:
+                // QImage reads it in place, no per-pixel copy
                 PBITMAPINFOHEADER bmpInfoHeader = reinterpret_cast<PBITMAPINFOHEADER>(result);
-                int bytesPerLine = TDIBWIDTHBYTES(bmpInfoHeader->biWidth * 24);
-                QImage image(bmpInfoHeader->biWidth, bmpInfoHeader->biHeight, QImage::Format_RGB888);
-                for (int y = 0; y < bmpInfoHeader->biHeight; ++y)
-                {
-                    for (int x = 0; x < bmpInfoHeader->biWidth; ++x)
-                    {
-                        uchar* pixel = image.scanLine(y) + x * 3;
-                        uchar* bmpPixel = static_cast<uchar*>(result) + y * bytesPerLine + x * 3;
-                        pixel[0] = bmpPixel[1];
-                        pixel[1] = bmpPixel[2];
-                        pixel[2] = bmpPixel[0];
-                    }
-                }
+                const int bytesPerLine = TDIBWIDTHBYTES(bmpInfoHeader->biWidth * 24);
+                const QImage image(static_cast<const uchar*>(result) + bmpInfoHeader->biSize, bmpInfoHeader->biWidth, std::abs(bmpInfoHeader->biHeight),
+                                   bytesPerLine, QImage::Format_RGB888);
                 image.save(QString::asprintf("Stitch_%u.jpg", ++m_count));
+                IpFree(result); // allocated by IpMallocHook
             }
+            else
+            {
+                // a resumed handle only holds what was stitched since the resume, the checkpoint holds the whole
+                // scan (not cropped); it is also the fallback when the handle returns nothing
+                if (result)
+                    IpFree(result);
+                const QImage image = m_ckpt.image();
+                if (!image.isNull())
+                    image.save(QString::asprintf("Stitch_%u.jpg", ++m_count));
+            }
+            m_ckpt.close();
+            StitchCheckpoint::remove(CKPT_DIR);
+            m_btn_resume->setEnabled(false);
             imagepro_stitch_delete(m_handel);
             m_handel = nullptr;
+            m_mosaic = QImage();
+            if (0 == m_cmb_precision->currentIndex())
+                tunePrecision();
         }
-        else
-        {
-            m_btn_stitch->setText("Stop Stitch");
-            m_cbox_auto->setChecked(false);
-            m_bStitch = true;
-            m_handel = imagepro_stitch_newV2(eImageproFormat_RGB24, true, m_imgWidth, m_imgHeight, 0, imageCallBack, imageSthCallBack, this);
-            imagepro_stitch_start(m_handel);
-        }
+        else if (!StitchCheckpoint::exists(CKPT_DIR)
+                 || (QMessageBox::Yes == QMessageBox::question(this, "Stitch", "Discard the unfinished scan of the checkpoint?")))
+            startStitch(false);
+    });
+    m_btn_resume = new QPushButton("Resume Stitch");
+    m_btn_resume->setEnabled(false);
+    connect(m_btn_resume, &QPushButton::clicked, this, [this]()
+    {
+        if (!m_bStitch)
+            startStitch(true);
     });
     m_cbox_crop = new QCheckBox("auto crop");
     m_cbox_crop->setEnabled(false);
@@ -175,6 +194,8 @@ MainWindow::MainWindow(QWidget* parent)
     {
         m_bcrop = state;
     });
+    m_cmb_precision = new QComboBox();
+    m_cmb_precision->addItems({ "Precision: auto (Medium)", "Precision: Lower", "Precision: Low", "Precision: Medium", "Precision: High", "Precision: Higher" });
     m_lbl_video2 = new QLabel();
 
     QVBoxLayout* vlyt_ctrl = new QVBoxLayout();
@@ -184,7 +205,9 @@ MainWindow::MainWindow(QWidget* parent)
     vlyt_ctrl->addWidget(m_btn_open);
     vlyt_ctrl->addWidget(m_btn_snap);
     vlyt_ctrl->addWidget(m_btn_stitch);
+    vlyt_ctrl->addWidget(m_btn_resume);
     vlyt_ctrl->addWidget(m_cbox_crop);
+    vlyt_ctrl->addWidget(m_cmb_precision);
     vlyt_ctrl->addWidget(m_lbl_video2, 1);
     vlyt_ctrl->addStretch();
     QWidget* wg_ctrl = new QWidget();
@@ -254,18 +277,20 @@ MainWindow::MainWindow(QWidget* parent)
 
         }
     });
-    connect(this, &MainWindow::imgCallback, this, [this](int outW, int outH, eImageproStitchQuality quality)
+    connect(this, &MainWindow::imgCallback, this, [this](int outW, int outH, int posX, int posY, int curW, int curH, eImageproStitchQuality quality, qint64 procNs)
     {
+        ++m_nDone;
+        m_procAvg = (1 == m_nDone) ? procNs : (m_procAvg * 0.9 + procNs * 0.1);
+        if (eImageproStitchQ_GOOD != quality)
+            ++m_nPoor;
         if (eImageproStitchQ_GOOD == quality)
         {
             m_lbl_quality->setText("GOOD");
-            std::vector<uchar> vec(TDIBWIDTHBYTES(outW * 24) * outH);
             if (m_handel)
             {
-                imagepro_stitch_readdata(m_handel, &vec[0], outW, outH);
-                QImage image(&vec[0], outW, outH, QImage::Format_RGB888);
-                QImage newimage = image.scaled(m_lbl_video->width(), m_lbl_video->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
-                m_lbl_video->setPixmap(QPixmap::fromImage(newimage));
+                checkpointFrame(outW, outH, posX, posY, curW, curH);
+                updateMosaic(outW, outH, posX, posY, curW, curH);
+                m_lbl_video->setPixmap(QPixmap::fromImage(m_mosaic));
             }
         }
         else if (eImageproStitchQ_CAUTION == quality)
@@ -283,6 +308,10 @@ void MainWindow::closeCamera()
 {
     imagepro_stitch_delete(m_handel);
     m_handel = nullptr;
+    m_mosaic = QImage();
+    m_ckpt.close();     /* the scan stays on disk, Resume Stitch takes it up again */
+    m_bStitch = false;
+    m_btn_stitch->setText("Start Stitch");
 
     if (m_hcam)
     {
@@ -302,6 +331,7 @@ void MainWindow::closeCamera()
     m_slider_tint->setEnabled(false);
     m_btn_snap->setEnabled(false);
     m_btn_stitch->setEnabled(false);
+    m_btn_resume->setEnabled(false);
     m_cmb_res->setEnabled(false);
     m_cmb_res->clear();
 }
@@ -313,12 +343,8 @@ void MainWindow::closeEvent(QCloseEvent*)
 
 void MainWindow::startCamera()
 {
-    if (m_pData)
-    {
-        delete[] m_pData;
-        m_pData = nullptr;
-    }
-    m_pData = new uchar[TDIBWIDTHBYTES(m_imgWidth * 24) * m_imgHeight];
+    if (nullptr == m_pData) // once per camera, for the largest resolution (index 0), whatever the resolution switches
+        m_pData = new uchar[TDIBWIDTHBYTES(m_cur.model->res[0].width * 24) * m_cur.model->res[0].height];
 
     unsigned uimax = 0, uimin = 0, uidef = 0;
     unsigned short usmax = 0, usmin = 0, usdef = 0;
@@ -341,12 +367,13 @@ void MainWindow::startCamera()
         m_btn_open->setText("Close");
         m_btn_snap->setEnabled(true);
         m_btn_stitch->setEnabled(true);
+        m_btn_resume->setEnabled(!m_bStitch && StitchCheckpoint::exists(CKPT_DIR));
 
         int bAuto = 0;
         Toupcam_get_AutoExpoEnable(m_hcam, &bAuto);
         m_cbox_auto->setChecked(1 == bAuto);
         m_cbox_crop->setChecked(1 == m_bcrop);
-        imagepro_init(ipmalloc);
+        imagepro_init(IpMallocHook);
     }
     else
     {
@@ -436,7 +463,7 @@ void MainWindow::imageCallBack(void* ctx, void* outData, int stride, int outW, i
                                int posX, int posY, eImageproStitchQuality quality, float sharpness, int bUpdate, int bSize)
 {
     MainWindow* pThis = reinterpret_cast<MainWindow*>(ctx);
-    emit pThis->imgCallback(outW, outH, quality);
+    emit pThis->imgCallback(outW, outH, posX, posY, curW, curH, quality, pThis->m_timer.nsecsElapsed() - pThis->m_tPull);
 }
 
 void MainWindow::imageSthCallBack(void* ctx, eImageproStitchEvent evt)
@@ -445,9 +472,177 @@ void MainWindow::imageSthCallBack(void* ctx, eImageproStitchEvent evt)
     emit pThis->imgSthCallback(evt);
 }
 
+/*
+    imagepro_stitch_readdata renders the roi of the mosaic into a w x h buffer, so the preview is read at the label
+    resolution instead of the full mosaic. When the mosaic keeps its size only the rectangle of the frame just
+    placed (posX, posY, curW, curH) is read back and patched into m_mosaic, the cost per frame stays the same however
+    large the mosaic gets; when it grows (or the label is resized) the preview is rebuilt once at the new scale.
+*/
+void MainWindow::updateMosaic(int outW, int outH, int posX, int posY, int curW, int curH)
+{
+    if ((outW <= 0) || (outH <= 0))
+        return;
+    const double scale = std::min(1.0, std::min(double(m_lbl_video->width()) / outW, double(m_lbl_video->height()) / outH));
+    const int pw = std::max(1, int(outW * scale)), ph = std::max(1, int(outH * scale));
+    if (m_mosaic.isNull() || (outW != m_mosaicW) || (outH != m_mosaicH) || (pw != m_mosaic.width()) || (ph != m_mosaic.height()))
+    {
+        m_mosaic = QImage(pw, ph, QImage::Format_RGB888);
+        m_mosaicW = outW;
+        m_mosaicH = outH;
+        imagepro_stitch_readdata(m_handel, m_mosaic.bits(), pw, ph);
+        return;
+    }
+
+    /* dirty rect in preview pixels, widened by one pixel for the rounding, then mapped back onto the mosaic */
+    const int x0 = std::max(0, int(posX * scale) - 1), y0 = std::max(0, int(posY * scale) - 1);
+    const int x1 = std::min(pw, int((posX + curW) * scale) + 2), y1 = std::min(ph, int((posY + curH) * scale) + 2);
+    if ((x1 <= x0) || (y1 <= y0))
+        return;
+    const int rw = x1 - x0, rh = y1 - y0;
+    const int roix = int(x0 / scale), roiy = int(y0 / scale);
+    const int roiw = std::min(outW - roix, int(rw / scale)), roih = std::min(outH - roiy, int(rh / scale));
+    std::vector<uchar> vec(TDIBWIDTHBYTES(rw * 24) * rh);
+    imagepro_stitch_readdata(m_handel, &vec[0], rw, rh, roix, roiy, roiw, roih);
+    for (int y = 0; y < rh; ++y)
+        memcpy(m_mosaic.scanLine(y0 + y) + x0 * 3, &vec[TDIBWIDTHBYTES(rw * 24) * y], rw * 3);
+}
+
+/*
+    A new stitch handle, on a new checkpoint, or on the checkpoint of the scan that was interrupted: the same
+    precision and frame size as before, and the frames go on into the same canvas once one is registered on it.
+    Without a checkpoint (e.g. the disk refuses it) the stitch still runs, it just cannot be resumed.
+*/
+void MainWindow::startStitch(bool bResume)
+{
+    if (bResume)
+    {
+        if (!m_ckpt.open(CKPT_DIR))
+        {
+            QMessageBox::warning(this, "Warning", "Failed to open the checkpoint.");
+            return;
+        }
+        if ((m_ckpt.frameWidth() != static_cast<int>(m_imgWidth)) || (m_ckpt.frameHeight() != static_cast<int>(m_imgHeight)))
+        {
+            QMessageBox::warning(this, "Warning", QString::asprintf("The scan was stitched at %d*%d.", m_ckpt.frameWidth(), m_ckpt.frameHeight()));
+            m_ckpt.close();
+            return;
+        }
+        m_precision = m_ckpt.precision();
+    }
+    else
+    {
+        if (m_cmb_precision->currentIndex() > 0)
+            m_precision = m_cmb_precision->currentIndex() - 1;
+        if (!m_ckpt.create(CKPT_DIR, m_imgWidth, m_imgHeight, m_precision))
+            m_lbl_quality->setText("failed to create the checkpoint " CKPT_DIR);
+    }
+    m_bResumed = bResume;
+    m_bLocked = !bResume;
+    m_origin = QPoint(0, 0);
+    m_ckptOutW = m_ckptOutH = 0;
+
+    m_btn_stitch->setText("Stop Stitch");
+    m_btn_resume->setEnabled(false);
+    m_cbox_auto->setChecked(false);
+    m_bStitch = true;
+    m_tLastFrame = 0;
+    m_intervalAvg = m_procAvg = 0;
+    m_nPulled = m_nDone = m_nPoor = 0;
+    m_handel = imagepro_stitch_newV3(eImageproFormat_RGB24, true, m_imgWidth, m_imgHeight, 0, static_cast<eImageproStitchPrecision>(m_precision),
+                                     eImageproStitchT_Medium, imageCallBack, imageSthCallBack, this);
+    imagepro_stitch_start(m_handel);
+}
+
+/*
+    The frame just placed at (posX, posY) of the mosaic of the handle is read back and copied into the checkpoint,
+    at m_origin + (posX, posY). The mosaic origin moves when the mosaic grows to the left or up, which only a frame
+    at its left (top) edge can cause, and m_origin follows by the growth.
+    A resumed handle starts an empty mosaic: its frames are registered against the checkpoint around the last
+    position, by phase correlation on frames reduced to CKPT_REG_SIZE first, then refined at full resolution, until
+    one matches; that gives m_origin. Until then nothing is written, the user is to bring the stage back to where the
+    scan stopped.
+*/
+void MainWindow::checkpointFrame(int outW, int outH, int posX, int posY, int curW, int curH)
+{
+    if (!m_ckpt.isOpen() || (curW <= 0) || (curH <= 0))
+        return;
+    if (m_ckptOutW > 0)
+    {
+        if ((0 == posX) && (outW > m_ckptOutW))
+            m_origin.rx() -= outW - m_ckptOutW;
+        if ((0 == posY) && (outH > m_ckptOutH))
+            m_origin.ry() -= outH - m_ckptOutH;
+    }
+    m_ckptOutW = outW;
+    m_ckptOutH = outH;
+
+    const int stride = TDIBWIDTHBYTES(curW * 24);
+    std::vector<uchar> vec(stride * curH);
+    imagepro_stitch_readdata(m_handel, &vec[0], curW, curH, posX, posY, curW, curH);
+    if (!m_bLocked)
+    {
+        /* the search area: the frame at the last position, +/- a quarter of the frame */
+        const int scale = std::max(1, (std::max(curW, curH) + CKPT_REG_SIZE - 1) / CKPT_REG_SIZE), radius = CKPT_REG_SIZE / 4;
+        const QPoint last = m_ckpt.last();
+        const int margin = radius * scale, aw = curW + 2 * margin, ah = curH + 2 * margin, astride = TDIBWIDTHBYTES(aw * 24);
+        std::vector<uchar> area(astride * ah);
+        m_ckpt.read(last.x() - margin, last.y() - margin, aw, ah, &area[0], astride);
+        GreyImage a, b, sa, sb;
+        reg_grey_from_rgb24(&area[0], aw, ah, astride, &a);
+        reg_grey_from_rgb24(&vec[0], curW, curH, stride, &b);
+        reg_downscale(a, scale, &sa);
+        reg_downscale(b, scale, &sb);
+        RegResult r = m_regPhase.reg(sa, sb, radius, radius, radius);
+        if (r.score >= CKPT_MIN_SCORE)
+            r = reg_register_hint(a, b, r.dx * scale, r.dy * scale, scale);
+        if (r.score < CKPT_MIN_SCORE)
+        {
+            m_lbl_quality->setText(QString::asprintf("RESUME: move back to the last position, ncc %.2f", std::max(0.0, r.score)));
+            return;
+        }
+        m_origin = QPoint(last.x() - margin + r.dx - posX, last.y() - margin + r.dy - posY);
+        m_bLocked = true;
+        m_lbl_quality->setText(QString::asprintf("RESUMED at frame %u", m_ckpt.frames()));
+    }
+    m_ckpt.write(m_origin.x() + posX, m_origin.y() + posY, curW, curH, &vec[0], stride);
+    m_ckpt.place(m_origin.x() + posX, m_origin.y() + posY);
+}
+
+/*
+    The precision is fixed when the stitch handle is created and a new handle would start an empty mosaic,
+    so the auto mode never switches in the middle of a scan (no frame is dropped or restitched): it measures
+    the session that just ended and picks the level for the next one.
+    Step down when the stitcher did not keep up with the frame rate, step up when it had plenty of headroom
+    or when too many frames came back below GOOD and there is still time to spend on them.
+*/
+void MainWindow::tunePrecision()
+{
+    if ((m_nDone < 10) || (m_intervalAvg <= 0))
+        return;
+    const double load = m_procAvg / m_intervalAvg;
+    const int old = m_precision;
+    if ((load > 0.8) || (m_nPulled > m_nDone + 2))
+        m_precision = std::max<int>(eImageproStitchP_Lower, m_precision - 1);
+    else if ((load < 0.25) || ((load < 0.5) && (m_nPoor * 5 > m_nDone)))
+        m_precision = std::min<int>(eImageproStitchP_Higher, m_precision + 1);
+    static const char* name[] = { "Lower", "Low", "Medium", "High", "Higher" };
+    m_cmb_precision->setItemText(0, QString::asprintf("Precision: auto (%s)", name[m_precision]));
+    if (old != m_precision)
+        m_lbl_quality->setText(QString::asprintf("load %.0f%%, precision %s -> %s", load * 100, name[old], name[m_precision]));
+}
+
 void MainWindow::handleImageEvent()
 {
     ToupcamFrameInfoV2 pInfo = {0};
+    if (m_bStitch && m_handel)
+    {
+        const qint64 now = m_timer.nsecsElapsed();
+        if (m_tLastFrame)
+            m_intervalAvg = (m_intervalAvg <= 0) ? (now - m_tLastFrame) : (m_intervalAvg * 0.9 + (now - m_tLastFrame) * 0.1);
+        m_tLastFrame = now;
+        m_tPull = now;
+        ++m_nPulled;
+    }
     imagepro_stitch_pull(m_handel, m_hcam, m_bStitch, m_pData, 24, 0, &pInfo);
     QImage image(m_pData, pInfo.width, pInfo.height, QImage::Format_RGB888);
     QImage newimage = image.scaled(m_lbl_video2->width(), m_lbl_video2->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
@@ -514,6 +709,8 @@ QVBoxLayout* MainWindow::makeLayout(QLabel* lbl_1, QSlider* sli_1, QLabel* val_1
 
 int main(int argc, char* argv[])
 {
+    IpArena arena(MOSAIC_RETAIN);
+    IpAllocSetGlobal(arena.allocator());
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
@@ -14,9 +14,16 @@
 #include <QVBoxLayout>
 #include <QMenu>
 #include <QMessageBox>
+#include <QImage>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <vector>
+#include <atomic>
 #include <toupcam.h>
 #include <imagepro.h>
 #include <qdebug.h>
+#include "stitchcheckpoint.h"
+#include "../../samples/gridstitch/stitchreg.h"
 
 class MainWindow : public QMainWindow
 {
@@ -26,6 +33,7 @@ class MainWindow : public QMainWindow
     QComboBox*      m_cmb_res;
     QCheckBox*      m_cbox_auto;
     QCheckBox*      m_cbox_crop;
+    QComboBox*      m_cmb_precision;
     QSlider*        m_slider_expoTime;
     QSlider*        m_slider_expoGain;
     QSlider*        m_slider_temp;
@@ -41,6 +49,7 @@ class MainWindow : public QMainWindow
     QPushButton*    m_btn_open;
     QPushButton*    m_btn_snap;
     QPushButton*    m_btn_stitch;
+    QPushButton*    m_btn_resume;
     unsigned        m_imgWidth;
     unsigned        m_imgHeight;
     uchar*          m_pData;
@@ -51,6 +60,25 @@ class MainWindow : public QMainWindow
     HImageproStitch m_handel;
     bool            m_bStitch;
     bool            m_bcrop;
+    QImage          m_mosaic;       /* preview of the whole mosaic, kept across callbacks and patched by dirty rect */
+    int             m_mosaicW;      /* mosaic size the preview was built for */
+    int             m_mosaicH;
+    int             m_precision;    /* eImageproStitchPrecision used for the next stitch handle */
+    QElapsedTimer   m_timer;
+    std::atomic<qint64> m_tPull;    /* ns, when the last frame was handed to imagepro_stitch_pull */
+    qint64          m_tLastFrame;
+    double          m_intervalAvg;  /* ns, frame interval while stitching */
+    double          m_procAvg;      /* ns, from imagepro_stitch_pull to its stitch callback */
+    unsigned        m_nPulled;
+    unsigned        m_nDone;
+    unsigned        m_nPoor;        /* callbacks with a quality below GOOD */
+    StitchCheckpoint m_ckpt;        /* open while stitching */
+    bool            m_bResumed;     /* the handle continues the mosaic of the checkpoint */
+    bool            m_bLocked;      /* m_origin is known */
+    RegPhase        m_regPhase;     /* registration of the resumed frames, its plan is kept from frame to frame */
+    QPoint          m_origin;       /* canvas position of the mosaic origin of the handle */
+    int             m_ckptOutW;     /* mosaic size at the last frame checkpointed */
+    int             m_ckptOutH;
 public:
     MainWindow(QWidget* parent = nullptr);
 protected:
@@ -58,12 +86,16 @@ protected:
 signals:
     void evtCallback(unsigned nEvent);
     void imgSthCallback(eImageproStitchEvent nEvent);
-    void imgCallback(int outW, int outH, eImageproStitchQuality quality);
+    void imgCallback(int outW, int outH, int posX, int posY, int curW, int curH, eImageproStitchQuality quality, qint64 procNs);
 private:
     void onBtnOpen();
     void onBtnSnap();
     void onBtnStitch();
+    void startStitch(bool bResume);
+    void checkpointFrame(int outW, int outH, int posX, int posY, int curW, int curH);
     void handleImageEvent();
+    void updateMosaic(int outW, int outH, int posX, int posY, int curW, int curH);
+    void tunePrecision();
     void handleExpoEvent();
     void handleTempTintEvent();
     void handleStillImageEvent();
@@ -1,5 +1,5 @@
 QT += core gui widgets
-SOURCES += livestitch.cpp
-HEADERS += livestitch.h
+SOURCES += livestitch.cpp stitchcheckpoint.cpp
+HEADERS += livestitch.h stitchcheckpoint.h ../../samples/ipalloc.h ../../samples/gridstitch/stitchreg.h
 LIBS += -L$$PWD/./ -ltoupcam -limagepro
 #CONFIG += console
@@ -0,0 +1,227 @@
+#include <QDir>
+#include <QSaveFile>
+#include <QDataStream>
+#include <cstring>
+#include <algorithm>
+#include "stitchcheckpoint.h"
+
+#define CKPT_MAGIC      0x54504b43u     /* "CKPT" */
+#define CKPT_VERSION    1
+
+/* floor division, the canvas coordinates go negative */
+static int tileOf(int v)
+{
+    return (v >= 0) ? (v / CKPT_TILE) : -((CKPT_TILE - 1 - v) / CKPT_TILE);
+}
+
+StitchCheckpoint::StitchCheckpoint()
+    : m_map(nullptr), m_slots(0), m_frameW(0), m_frameH(0), m_precision(0), m_frames(0)
+{
+}
+
+StitchCheckpoint::~StitchCheckpoint()
+{
+    close();
+}
+
+bool StitchCheckpoint::exists(const QString& dir)
+{
+    return QFile::exists(dir + "/state") && QFile::exists(dir + "/tiles");
+}
+
+void StitchCheckpoint::remove(const QString& dir)
+{
+    QDir(dir).removeRecursively();
+}
+
+bool StitchCheckpoint::create(const QString& dir, int frameW, int frameH, int precision)
+{
+    close();
+    remove(dir);
+    if (!QDir().mkpath(dir))
+        return false;
+    m_dir = dir;
+    m_index.clear();
+    m_bounds = QRect();
+    m_last = QPoint(0, 0);
+    m_frameW = frameW;
+    m_frameH = frameH;
+    m_precision = precision;
+    m_frames = 0;
+    m_slots = 0;
+    m_file.setFileName(dir + "/tiles");
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate) || !grow() || !saveState())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool StitchCheckpoint::open(const QString& dir)
+{
+    close();
+    QFile state(dir + "/state");
+    if (!state.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&state);
+    quint32 magic = 0, version = 0, count = 0;
+    in >> magic >> version;
+    if ((CKPT_MAGIC != magic) || (CKPT_VERSION != version))
+        return false;
+    qint32 frameW, frameH, precision;
+    quint32 frames;
+    in >> frameW >> frameH >> precision >> frames >> m_last >> m_bounds >> count;
+    m_index.clear();
+    for (quint32 i = 0; (i < count) && (QDataStream::Ok == in.status()); ++i)
+    {
+        qint32 tx, ty, slot;
+        in >> tx >> ty >> slot;
+        m_index.insert(key(tx, ty), slot);
+    }
+    if (QDataStream::Ok != in.status())
+        return false;
+    m_dir = dir;
+    m_frameW = frameW;
+    m_frameH = frameH;
+    m_precision = precision;
+    m_frames = frames;
+    m_file.setFileName(dir + "/tiles");
+    if (!m_file.open(QIODevice::ReadWrite))
+        return false;
+    m_slots = static_cast<int>(m_file.size() / CKPT_TILE_BYTES);
+    for (QHash<quint64, int>::const_iterator it = m_index.constBegin(); it != m_index.constEnd(); ++it)
+    {
+        if (it.value() >= m_slots)
+        {
+            m_file.close();
+            return false;   /* the index is ahead of the tiles: not ours */
+        }
+    }
+    m_map = m_file.map(0, static_cast<qint64>(m_slots) * CKPT_TILE_BYTES);
+    if (nullptr == m_map)
+    {
+        m_file.close();
+        return false;
+    }
+    m_sinceSave.start();
+    return true;
+}
+
+void StitchCheckpoint::close()
+{
+    if (m_map)
+    {
+        saveState();
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+/* CKPT_GROW slots more, new slots read as zero; the mapping moves */
+bool StitchCheckpoint::grow()
+{
+    if (m_map)
+    {
+        m_file.unmap(m_map);
+        m_map = nullptr;
+    }
+    const qint64 size = static_cast<qint64>(m_slots + CKPT_GROW) * CKPT_TILE_BYTES;
+    if (!m_file.resize(size))
+        return false;
+    m_map = m_file.map(0, size);
+    if (nullptr == m_map)
+        return false;
+    m_slots += CKPT_GROW;
+    return true;
+}
+
+bool StitchCheckpoint::saveState()
+{
+    QSaveFile state(m_dir + "/state");
+    if (!state.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&state);
+    out << quint32(CKPT_MAGIC) << quint32(CKPT_VERSION)
+        << qint32(m_frameW) << qint32(m_frameH) << qint32(m_precision) << quint32(m_frames) << m_last << m_bounds << quint32(m_index.size());
+    for (QHash<quint64, int>::const_iterator it = m_index.constBegin(); it != m_index.constEnd(); ++it)
+        out << qint32(static_cast<quint32>(it.key() >> 32)) << qint32(static_cast<quint32>(it.key())) << qint32(it.value());
+    m_sinceSave.start();
+    return state.commit();
+}
+
+/* RGB24 pixels of the tile, rows of CKPT_TILE * 3; nullptr when it does not exist (and !bCreate) */
+uchar* StitchCheckpoint::tile(int tx, int ty, bool bCreate)
+{
+    QHash<quint64, int>::const_iterator it = m_index.constFind(key(tx, ty));
+    if (it != m_index.constEnd())
+        return m_map + static_cast<size_t>(it.value()) * CKPT_TILE_BYTES;
+    if (!bCreate)
+        return nullptr;
+    const int slot = m_index.size();
+    if ((slot >= m_slots) && !grow())
+        return nullptr;
+    m_index.insert(key(tx, ty), slot);
+    return m_map + static_cast<size_t>(slot) * CKPT_TILE_BYTES;
+}
+
+void StitchCheckpoint::write(int x, int y, int w, int h, const uchar* pData, int stride)
+{
+    if ((nullptr == m_map) || (w <= 0) || (h <= 0))
+        return;
+    for (int ty = tileOf(y); ty <= tileOf(y + h - 1); ++ty)
+    {
+        for (int tx = tileOf(x); tx <= tileOf(x + w - 1); ++tx)
+        {
+            uchar* t = tile(tx, ty, true);
+            if (nullptr == t)
+                return;     /* the disk is full: the checkpoint stops there */
+            const int x0 = std::max(x, tx * CKPT_TILE), x1 = std::min(x + w, (tx + 1) * CKPT_TILE);
+            const int y0 = std::max(y, ty * CKPT_TILE), y1 = std::min(y + h, (ty + 1) * CKPT_TILE);
+            for (int cy = y0; cy < y1; ++cy)
+                memcpy(t + (static_cast<size_t>(cy - ty * CKPT_TILE) * CKPT_TILE + (x0 - tx * CKPT_TILE)) * 3, pData + static_cast<size_t>(cy - y) * stride + (x0 - x) * 3, (x1 - x0) * 3);
+        }
+    }
+    m_bounds |= QRect(x, y, w, h);
+}
+
+void StitchCheckpoint::read(int x, int y, int w, int h, uchar* pData, int stride)
+{
+    for (int ty = tileOf(y); (h > 0) && (ty <= tileOf(y + h - 1)); ++ty)
+    {
+        for (int tx = tileOf(x); (w > 0) && (tx <= tileOf(x + w - 1)); ++tx)
+        {
+            const uchar* t = m_map ? tile(tx, ty, false) : nullptr;
+            const int x0 = std::max(x, tx * CKPT_TILE), x1 = std::min(x + w, (tx + 1) * CKPT_TILE);
+            const int y0 = std::max(y, ty * CKPT_TILE), y1 = std::min(y + h, (ty + 1) * CKPT_TILE);
+            for (int cy = y0; cy < y1; ++cy)
+            {
+                uchar* d = pData + static_cast<size_t>(cy - y) * stride + (x0 - x) * 3;
+                if (t)
+                    memcpy(d, t + (static_cast<size_t>(cy - ty * CKPT_TILE) * CKPT_TILE + (x0 - tx * CKPT_TILE)) * 3, (x1 - x0) * 3);
+                else
+                    memset(d, 0, (x1 - x0) * 3);
+            }
+        }
+    }
+}
+
+void StitchCheckpoint::place(int x, int y)
+{
+    m_last = QPoint(x, y);
+    ++m_frames;
+    if (m_map && (m_sinceSave.elapsed() >= CKPT_STATE_MS))
+        saveState();
+}
+
+QImage StitchCheckpoint::image()
+{
+    if (m_bounds.isEmpty())
+        return QImage();
+    QImage img(m_bounds.width(), m_bounds.height(), QImage::Format_RGB888);
+    if (!img.isNull())
+        read(m_bounds.x(), m_bounds.y(), m_bounds.width(), m_bounds.height(), img.bits(), static_cast<int>(img.bytesPerLine()));
+    return img;
+}
@@ -0,0 +1,78 @@
+#ifndef __stitchcheckpoint_H__
+#define __stitchcheckpoint_H__
+
+/*
+    On-disk checkpoint of a live stitch, so that a scan survives a camera disconnect (or the program going away) and
+    resumes where it stopped, without acquiring again what is already stitched.
+    The stitch handle cannot be saved or seeded, so the checkpoint keeps its own copy of the mosaic: after every frame
+    placed, the rectangle of that frame is read back from the handle at full resolution and written into a sparse
+    canvas of CKPT_TILE x CKPT_TILE RGB24 tiles. The canvas has its own coordinates, which may go negative, and only
+    the tiles which have content exist. The tiles are slots of one file ("tiles"), memory mapped and grown by
+    CKPT_GROW slots at a time, so a frame costs a copy into the page cache and the system writes it back.
+    The rest ("state": frame size, precision, the last position, the tile index) is small and rewritten atomically
+    at most every CKPT_STATE_MS and when closed, so it never points to a half written index.
+    A resumed session is a new stitch handle with an empty mosaic; livestitch registers its first frames against the
+    canvas around the last position until one matches, and from there writes on into the same canvas.
+*/
+#include <QString>
+#include <QFile>
+#include <QHash>
+#include <QRect>
+#include <QPoint>
+#include <QImage>
+#include <QElapsedTimer>
+
+#define CKPT_TILE       256
+#define CKPT_TILE_BYTES (CKPT_TILE * CKPT_TILE * 3)
+#define CKPT_GROW       64      /* slots added to the tile file at a time */
+#define CKPT_STATE_MS   1000    /* least interval between two writes of the state */
+
+class StitchCheckpoint
+{
+    QString     m_dir;
+    QFile       m_file;
+    uchar*      m_map;          /* the whole tile file */
+    int         m_slots;        /* in the tile file */
+    QHash<quint64, int> m_index;/* tile (tx, ty) -> slot */
+    QRect       m_bounds;       /* of the content, in canvas coordinates */
+    QPoint      m_last;         /* canvas position of the last frame placed */
+    int         m_frameW, m_frameH, m_precision;
+    unsigned    m_frames;
+    QElapsedTimer m_sinceSave;
+
+    static quint64 key(int tx, int ty) { return (static_cast<quint64>(static_cast<quint32>(tx)) << 32) | static_cast<quint32>(ty); }
+    uchar* tile(int tx, int ty, bool bCreate);
+    bool grow();
+    bool saveState();
+public:
+    StitchCheckpoint();
+    ~StitchCheckpoint();
+
+    static bool exists(const QString& dir);
+    static void remove(const QString& dir);
+
+    /* a new checkpoint in dir, any older one is discarded */
+    bool create(const QString& dir, int frameW, int frameH, int precision);
+    /* an existing checkpoint, to resume */
+    bool open(const QString& dir);
+    /* the state written, the tile file unmapped; the checkpoint stays on disk */
+    void close();
+    bool isOpen() const { return nullptr != m_map; }
+
+    int frameWidth() const { return m_frameW; }
+    int frameHeight() const { return m_frameH; }
+    int precision() const { return m_precision; }
+    unsigned frames() const { return m_frames; }
+    QPoint last() const { return m_last; }
+    QRect bounds() const { return m_bounds; }
+
+    /* RGB24 rectangle at (x, y) of the canvas; read() gives black where nothing was written */
+    void write(int x, int y, int w, int h, const uchar* pData, int stride);
+    void read(int x, int y, int w, int h, uchar* pData, int stride);
+    /* a frame was written at (x, y): the position to resume from */
+    void place(int x, int y);
+    /* the whole mosaic, null when empty */
+    QImage image();
+};
+
+#endif
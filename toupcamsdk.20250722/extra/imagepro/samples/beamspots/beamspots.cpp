@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "../ipspots.h"
+
+/*
+    Beam analysis of several laser spots of the RAW frames, every frame (ipspots.h).
+    usage: beamspots [-b background] [-t] x,y,rx[,ry] [x,y,rx[,ry] ...]
+                x, y: centre of an aperture in pixels of the frame, rx, ry: its radii (ry: rx when left out), up to
+                IPSPOT_MAX; -b: subtracted from every pixel (default 0), -t: the apertures follow their spot
+    The camera is put in RAW mode at its full bit depth. The frames are pulled in the event callback and the spots
+    measured there, in parallel (IpSpotAnalyzer), the BeamPackets pushed into an IpSpotRing; a second thread, the
+    stand-in for the plot of the program, pops them all and prints every half second the latest result of each spot
+    and the rate of the results. 'x' + ENTER to exit.
+*/
+HToupcam g_hcam = NULL;
+std::vector<unsigned char> g_frame;
+unsigned g_bitdepth = 8;
+IpSpotAnalyzer* g_pAnalyzer = NULL;
+IpSpotRing<> g_ring;
+std::atomic<bool> g_bStop(false);
+double g_measureMs = 0.0;
+unsigned g_measured = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, &g_frame[0], 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            IpSpotFrame result;
+            const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            g_pAnalyzer->analyze(&g_frame[0], info.v3.width, info.v3.height, g_bitdepth, (size_t)info.v3.width * ((g_bitdepth > 8) ? 2 : 1), info.v3.seq, info.v3.timestamp, &result);
+            g_measureMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            ++g_measured;
+            g_ring.push(result);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+/* the consumer of the ring */
+static void PlotThread()
+{
+    IpSpotFrame latest, f;
+    memset(&latest, 0, sizeof(latest));
+    unsigned results = 0;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    while (!g_bStop)
+    {
+        while (g_ring.pop(&f))
+        {
+            latest = f;
+            ++results;
+        }
+        const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (sec >= 0.5)
+        {
+            if (results)
+            {
+                printf("seq %u, %.1f results/s\n", latest.seq, results / sec);
+                for (unsigned i = 0; i < latest.count; ++i)
+                {
+                    const BeamPacket& b = latest.spot[i];
+                    printf("  %u: centroid = (%.2f, %.2f), D4s = %.2f x %.2f, ellipticity = %.3f, energy = %.0f\n", i, b.centroidX, b.centroidY, b.beamWidthX, b.beamWidthY, b.ellipticity, b.allenergy);
+                }
+            }
+            results = 0;
+            t0 = std::chrono::steady_clock::now();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    IpSpotConfig spots[IPSPOT_MAX];
+    unsigned count = 0, background = 0;
+    int track = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-b")) && (i + 1 < argc))
+            background = (unsigned)atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-t"))
+            track = 1;
+        else if (count < IPSPOT_MAX)
+        {
+            double x = 0, y = 0, rx = 0, ry = 0;
+            const int n = sscanf(argv[i], "%lf,%lf,%lf,%lf", &x, &y, &rx, &ry);
+            if (n < 3)
+            {
+                printf("bad aperture: %s\n", argv[i]);
+                return -1;
+            }
+            memset(&spots[count], 0, sizeof(spots[count]));
+            spots[count].aperture.x = x;
+            spots[count].aperture.y = y;
+            spots[count].aperture.rx = rx;
+            spots[count].aperture.ry = (n > 3) ? ry : rx;
+            ++count;
+        }
+    }
+    if (0 == count)
+    {
+        printf("usage: %s [-b background] [-t] x,y,rx[,ry] [x,y,rx[,ry] ...]\n", argv[0]);
+        return -1;
+    }
+    for (unsigned i = 0; i < count; ++i)
+    {
+        spots[i].background = background;
+        spots[i].track = track;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int width = 0, height = 0, bitdepth = 0;
+    HRESULT hr;
+    if (Toupcam_get_MaxBitDepth(g_hcam) > 8)
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1);  /* 16 bits samples */
+    if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1)))
+        printf("failed to set RAW, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_FinalSize(g_hcam, &width, &height)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        if (SUCCEEDED(Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, &bitdepth)) && bitdepth)
+            g_bitdepth = Toupcam_get_MaxBitDepth(g_hcam);
+        printf("%d x %d, %u bits, %u spots\n", width, height, g_bitdepth, count);
+        g_frame.resize((size_t)width * height * ((g_bitdepth > 8) ? 2 : 1));
+        g_pAnalyzer = new IpSpotAnalyzer(count - 1);
+        g_pAnalyzer->set(spots, count);
+        std::thread plot(PlotThread);
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("'x' + ENTER to exit\n");
+            do {
+                char str[1024];
+                if ((NULL == fgets(str, 1023, stdin)) || ('x' == str[0]) || ('X' == str[0]))
+                    break;
+            } while (true);
+            Toupcam_Stop(g_hcam);
+            printf("frames = %u, %.3f ms per frame, dropped by the ring = %u\n", g_measured, g_measured ? (g_measureMs / g_measured) : 0.0, g_ring.dropped());
+        }
+        g_bStop = true;
+        plot.join();
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    delete g_pAnalyzer;
+    return 0;
+}
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include "../../qt/liveedf/edfpyr.h"
+
+/*
+    Offline extended depth of field of Z stacks saved as 24 bits BMP, with the pyramid engine of liveedf (edfpyr.h).
+        edfstack [-t threads] [-j decoders] [-p prefetch] [-d] <out.bmp> <z0.bmp> <z1.bmp> ...
+        edfstack [-t threads] [-j decoders] [-p prefetch] [-d] -b <stacks.txt>
+    stacks.txt: one stack per line, "out.bmp z0.bmp z1.bmp ...", the planes in Z order.
+    The planes of all stacks are decoded by the decoder threads at most prefetch planes ahead of the fusion, and fused
+    in Z order on threads worker threads, so the memory is the engine plus prefetch frames whatever the stack depth
+    or the number of stacks. -d also writes out.bmp.depth.csv, the winning plane index of every EDFPYR_BLOCK block.
+    The pyramids come from an arena (ipalloc.h) which keeps up to EDFSTACK_RETAIN of them: stacks of a few sizes in
+    turn take their pyramid back instead of allocating it again for every change of size.
+*/
+
+#define BMP_STRIDE(w)   ((((w) * 24) + 31) / 32 * 4)
+#define BMP_MAX_SIDE    65536   /* a larger header is taken as broken */
+#define EDFSTACK_RETAIN ((size_t)1 << 30)
+
+typedef struct {
+    std::string out;
+    std::vector<std::string> planes;
+} Stack;
+
+typedef struct {
+    size_t stack, plane;
+    bool ok;
+    int width, height;
+    std::vector<unsigned char> data;    /* BGR24, top-down, BMP_STRIDE */
+} Plane;
+
+static unsigned rd32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* 24 bits uncompressed BMP, bottom-up or top-down */
+static bool LoadBmp24(const char* filename, Plane* pPlane)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (NULL == fp)
+        return false;
+    unsigned char header[54];
+    bool ret = false;
+    int width = 0, height = 0;
+    if ((fread(header, 1, sizeof(header), fp) == sizeof(header)) && ('B' == header[0]) && ('M' == header[1]) && (24 == (header[28] | (header[29] << 8))))
+    {
+        width = (int)rd32(header + 18);
+        height = (int)rd32(header + 22);
+    }
+    if ((width > 0) && (width <= BMP_MAX_SIDE) && (0 != height) && (height >= -BMP_MAX_SIDE) && (height <= BMP_MAX_SIDE))
+    {
+        const unsigned offset = rd32(header + 10);
+        const int h = (height < 0) ? -height : height, stride = BMP_STRIDE(width);
+        pPlane->width = width;
+        pPlane->height = h;
+        pPlane->data.resize((size_t)stride * h);
+        if (0 == fseek(fp, offset, SEEK_SET))
+        {
+            ret = true;
+            for (int y = 0; (y < h) && ret; ++y)
+            {
+                const int row = (height < 0) ? y : (h - 1 - y);
+                ret = (fread(&pPlane->data[(size_t)row * stride], 1, stride, fp) == (size_t)stride);
+            }
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+static bool SaveBmp24(const char* filename, const unsigned char* data, int width, int height)
+{
+    FILE* fp = fopen(filename, "wb");
+    if (NULL == fp)
+        return false;
+    const unsigned stride = BMP_STRIDE(width), size = 54 + stride * height;
+    unsigned char header[54] = { 'B', 'M' };
+    memcpy(header + 2, &size, 4);
+    header[10] = 54;
+    header[14] = 40;
+    memcpy(header + 18, &width, 4);
+    const int h = -height;  /* top-down */
+    memcpy(header + 22, &h, 4);
+    header[26] = 1;
+    header[28] = 24;
+    fwrite(header, 1, sizeof(header), fp);
+    const bool ret = (fwrite(data, 1, (size_t)stride * height, fp) == (size_t)stride * height);
+    fclose(fp);
+    return ret;
+}
+
+static bool SaveBlockDepth(const char* filename, EdfPyramid& pyr)
+{
+    std::vector<unsigned short> block(pyr.blocksX() * pyr.blocksY());
+    pyr.readblockdepth(&block[0]);
+    FILE* fp = fopen(filename, "w");
+    if (NULL == fp)
+        return false;
+    fprintf(fp, "# %u planes, block %d x %d pixels, plane index of block (x, y)\n", pyr.planes(), EDFPYR_BLOCK, EDFPYR_BLOCK);
+    for (int y = 0; y < pyr.blocksY(); ++y)
+    {
+        for (int x = 0; x < pyr.blocksX(); ++x)
+            fprintf(fp, (x + 1 < pyr.blocksX()) ? "%u," : "%u\n", block[y * pyr.blocksX() + x]);
+    }
+    fclose(fp);
+    return true;
+}
+
+/*
+    The planes of all stacks form one sequence. Decoders take the next plane number, wait until it is less than
+    prefetch ahead of the fusion, decode it into its ring slot; the fusion consumes the slots strictly in order.
+*/
+class Prefetcher {
+    std::vector<std::pair<size_t, size_t> > m_seq;  /* (stack, plane) */
+    const std::vector<Stack>& m_stacks;
+    std::vector<std::unique_ptr<Plane> > m_ring;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    size_t m_consumed;
+    std::atomic<size_t> m_next;
+    std::vector<std::thread> m_vecThread;
+
+    void decoder()
+    {
+        size_t n;
+        while ((n = m_next++) < m_seq.size())
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cv.wait(lock, [&] { return n < m_consumed + m_ring.size(); });
+            }
+            std::unique_ptr<Plane> p(new Plane());
+            p->stack = m_seq[n].first;
+            p->plane = m_seq[n].second;
+            p->ok = LoadBmp24(m_stacks[p->stack].planes[p->plane].c_str(), p.get());
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_ring[n % m_ring.size()].swap(p);
+            }
+            m_cv.notify_all();
+        }
+    }
+public:
+    Prefetcher(const std::vector<Stack>& stacks, unsigned decoders, unsigned prefetch)
+    : m_stacks(stacks), m_ring(prefetch), m_consumed(0), m_next(0)
+    {
+        for (size_t i = 0; i < stacks.size(); ++i)
+        {
+            for (size_t j = 0; j < stacks[i].planes.size(); ++j)
+                m_seq.push_back(std::make_pair(i, j));
+        }
+        for (unsigned t = 0; t < decoders; ++t)
+            m_vecThread.push_back(std::thread(&Prefetcher::decoder, this));
+    }
+    ~Prefetcher()
+    {
+        for (size_t i = 0; i < m_vecThread.size(); ++i)
+            m_vecThread[i].join();
+    }
+
+    /* next plane in sequence order, NULL at the end */
+    std::unique_ptr<Plane> pop()
+    {
+        std::unique_ptr<Plane> p;
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (m_consumed >= m_seq.size())
+            return p;
+        std::unique_ptr<Plane>& slot = m_ring[m_consumed % m_ring.size()];
+        m_cv.wait(lock, [&] { return (bool)slot; });
+        p.swap(slot);
+        ++m_consumed;
+        lock.unlock();
+        m_cv.notify_all();
+        return p;
+    }
+};
+
+static bool ReadStacks(const char* filename, std::vector<Stack>& stacks)
+{
+    FILE* fp = fopen(filename, "r");
+    if (NULL == fp)
+    {
+        printf("failed to open %s\n", filename);
+        return false;
+    }
+    char line[65536];
+    while (fgets(line, sizeof(line), fp))
+    {
+        Stack s;
+        for (char* tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n"))
+        {
+            if (s.out.empty())
+                s.out = tok;
+            else
+                s.planes.push_back(tok);
+        }
+        if (!s.planes.empty())
+            stacks.push_back(s);
+    }
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned threads = 0, decoders = 2, prefetch = 4;
+    bool bDepth = false;
+    std::vector<Stack> stacks;
+    int i = 1;
+    for (; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-t")) && (i + 1 < argc))
+            threads = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-j")) && (i + 1 < argc))
+            decoders = std::max(1, atoi(argv[++i]));
+        else if ((0 == strcmp(argv[i], "-p")) && (i + 1 < argc))
+            prefetch = std::max(1, atoi(argv[++i]));
+        else if (0 == strcmp(argv[i], "-d"))
+            bDepth = true;
+        else if ((0 == strcmp(argv[i], "-b")) && (i + 1 < argc))
+        {
+            if (!ReadStacks(argv[++i], stacks))
+                return -1;
+        }
+        else
+            break;
+    }
+    if (i + 1 < argc)
+    {
+        Stack s;
+        s.out = argv[i];
+        for (++i; i < argc; ++i)
+            s.planes.push_back(argv[i]);
+        stacks.push_back(s);
+    }
+    if (stacks.empty())
+    {
+        printf("usage: %s [-t threads] [-j decoders] [-p prefetch] [-d] <out.bmp> <z0.bmp> <z1.bmp> ...\n", argv[0]);
+        printf("       %s [-t threads] [-j decoders] [-p prefetch] [-d] -b <stacks.txt>\n", argv[0]);
+        return -1;
+    }
+
+    Prefetcher prefetcher(stacks, decoders, prefetch);
+    IpArena arena(EDFSTACK_RETAIN);
+    std::unique_ptr<EdfPyramid> pyr;
+    std::vector<unsigned char> out;
+    unsigned failed = 0;
+    bool bBad = false;      /* the current stack lost a plane */
+    std::unique_ptr<Plane> p;
+    while ((p = prefetcher.pop()))
+    {
+        const Stack& s = stacks[p->stack];
+        if (0 == p->plane)
+            bBad = false;
+        if (bBad)
+            continue;
+        if (!p->ok)
+        {
+            printf("failed to load %s\n", s.planes[p->plane].c_str());
+            bBad = true;
+            ++failed;
+            continue;
+        }
+        if ((0 == p->plane) && ((!pyr) || (pyr->width() != p->width) || (pyr->height() != p->height)))
+        {
+            pyr.reset();    /* back to the arena first, for the next size to take it if it fits */
+            pyr.reset(new EdfPyramid(p->width, p->height, threads, 0, 3, 8, arena.allocator()));
+        }
+        else if (0 == p->plane)
+            pyr->reset();
+        else if ((pyr->width() != p->width) || (pyr->height() != p->height))
+        {
+            printf("size mismatch %s\n", s.planes[p->plane].c_str());
+            bBad = true;
+            ++failed;
+            continue;
+        }
+        pyr->add(&p->data[0], BMP_STRIDE(p->width));
+
+        if (p->plane + 1 == s.planes.size())
+        {
+            out.resize((size_t)BMP_STRIDE(p->width) * p->height);
+            pyr->readdata(&out[0], BMP_STRIDE(p->width));
+            if (!SaveBmp24(s.out.c_str(), &out[0], p->width, p->height))
+            {
+                printf("failed to save %s\n", s.out.c_str());
+                ++failed;
+            }
+            else
+            {
+                if (bDepth)
+                    SaveBlockDepth((s.out + ".depth.csv").c_str(), *pyr);
+                printf("%s: %u planes, %d x %d\n", s.out.c_str(), pyr->planes(), p->width, p->height);
+            }
+        }
+    }
+
+    /* cleanup */
+    pyr.reset();
+    unsigned long long hits = 0, misses = 0;
+    arena.stats(NULL, NULL, &hits, &misses);
+    printf("%u of %u stacks failed, pyramid blocks: %llu reused, %llu allocated\n", failed, (unsigned)stacks.size(), hits, misses);
+    return failed ? -1 : 0;
+}
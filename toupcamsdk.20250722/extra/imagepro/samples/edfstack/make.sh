@@ -0,0 +1,7 @@
+#!/bin/bash
+os=`uname -s`
+if [[ $os = "Linux" ]]; then
+	g++ -Wl,-rpath -Wl,'$ORIGIN' -L. -g -O2 -o edfstack edfstack.cpp -lpthread
+else
+	clang++ -Wl,-rpath -Wl,@executable_path -L. -g -O2 -o edfstack edfstack.cpp -lpthread
+fi
@@ -0,0 +1,551 @@
+#ifndef __blender_H__
+#define __blender_H__
+
+/*
+    Seam-aware blending of the mosaic into the canvas (tilecanvas.h), pulled canvas tile by canvas tile.
+    Every canvas tile is computed from the source tiles which overlap it (plus a halo for the multiband pyramid), so
+    the canvas tiles of a row are independent and are blended in parallel, then written to the canvas in order.
+    Only the source tiles under the current row of canvas tiles are in memory: a source tile is loaded when the first
+    canvas row needs it and released after the last one, whatever the size of the mosaic.
+    BLEND_FEATHER:      weighted average, the weight of a pixel is its distance to the border of its source tile,
+                        capped at 255
+    BLEND_MULTIBAND:    Laplacian pyramid blending over BLEND_LEVELS bands: every pixel belongs to one source tile (the
+                        label), the low frequencies are blended over a wide transition and the details over a narrow one,
+                        so exposure steps disappear without ghosting the features of the overlap
+    Seams (findSeams(), both modes): a minimum cost path through the overlap of every neighbour pair, by dynamic
+    programming on the colour difference of the two tiles, so the cut follows where they agree and avoids what moved or
+    went out of focus between the two shots. With seams the feather is limited to BLEND_SEAM_BAND pixels either side of
+    the cut, and the labels follow the cuts. Without seams the label is the tile whose border is farthest (the centre
+    line of the overlap).
+    The source tiles are BGR24, top-down, rows of TDIBWIDTHBYTES; the loader is called from several threads at once.
+*/
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include "tilecanvas.h"
+#include "tilecache.h"
+
+#define BLEND_FEATHER       0
+#define BLEND_MULTIBAND     1
+
+#define BLEND_LEVELS        5                       /* bands of the multiband pyramid */
+#define BLEND_HALO          (2 << BLEND_LEVELS)     /* pixels around a canvas tile for the pyramid, keeps the region a multiple of 2^BLEND_LEVELS */
+#define BLEND_SEAM_BAND     16                      /* half width of the feather across a seam */
+#define BLEND_SEAM_EDGE     32                      /* the cost of a cut rises towards the edges of the overlap ... */
+#define BLEND_SEAM_EDGE_COST 8                      /* ... by this much a pixel */
+
+typedef struct {
+    int x, y, w, h;     /* of the source tile on the canvas */
+} BlendRect;
+
+/* returns the BGR24 pixels of source tile index */
+typedef std::function<bool(int index, std::vector<unsigned char>& data)> BLEND_LOADER;
+
+class MosaicBlender {
+    /*
+        a cut between two overlapping neighbours
+        bVertical:  a is left of b, pos[k] is the first column of b on canvas row start + k
+        else:       a is above b, pos[k] is the first row of b on canvas column start + k
+    */
+    struct Seam {
+        int a, b;
+        bool bVertical;
+        int start;
+        std::vector<int> pos;
+    };
+    const int m_mode;
+    const std::vector<BlendRect> m_rect;
+    std::vector<Seam> m_seam;
+    std::vector<std::vector<int> > m_tileSeam;      /* the seams of each source tile */
+
+    static int stride(int w) { return (w * 24 + 31) / 32 * 4; }
+
+    /* overlap of two rectangles, false when empty */
+    static bool overlap(const BlendRect& a, const BlendRect& b, BlendRect* pOut)
+    {
+        pOut->x = std::max(a.x, b.x);
+        pOut->y = std::max(a.y, b.y);
+        pOut->w = std::min(a.x + a.w, b.x + b.w) - pOut->x;
+        pOut->h = std::min(a.y + a.h, b.y + b.h) - pOut->y;
+        return (pOut->w > 0) && (pOut->h > 0);
+    }
+
+    static void findSeam(const BlendRect& ra, const unsigned char* pA, const BlendRect& rb, const unsigned char* pB, const BlendRect& o, Seam& s)
+    {
+        /* along: the direction of the cut, across: the positions it can take */
+        const int along = s.bVertical ? o.h : o.w, across = s.bVertical ? o.w : o.h;
+        const int strideA = stride(ra.w), strideB = stride(rb.w);
+        std::vector<unsigned> cost(across), prev(across), cur(across);
+        std::vector<signed char> step((size_t)along * across);
+        for (int k = 0; k < along; ++k)
+        {
+            for (int c = 0; c < across; ++c)
+            {
+                const int x = s.bVertical ? (o.x + c) : (o.x + k), y = s.bVertical ? (o.y + k) : (o.y + c);
+                const unsigned char* a = pA + (size_t)(y - ra.y) * strideA + (x - ra.x) * 3;
+                const unsigned char* b = pB + (size_t)(y - rb.y) * strideB + (x - rb.x) * 3;
+                const int edge = std::min(c, across - 1 - c);
+                cost[c] = abs(a[0] - b[0]) + abs(a[1] - b[1]) + abs(a[2] - b[2]) + ((edge < BLEND_SEAM_EDGE) ? (BLEND_SEAM_EDGE - edge) * BLEND_SEAM_EDGE_COST : 0);
+            }
+            for (int c = 0; c < across; ++c)
+            {
+                signed char best = 0;
+                unsigned v = 0;
+                if (k > 0)
+                {
+                    v = prev[c];
+                    if ((c > 0) && (prev[c - 1] < v))
+                    {
+                        v = prev[c - 1];
+                        best = -1;
+                    }
+                    if ((c + 1 < across) && (prev[c + 1] < v))
+                    {
+                        v = prev[c + 1];
+                        best = 1;
+                    }
+                }
+                cur[c] = v + cost[c];
+                step[(size_t)k * across + c] = best;
+            }
+            prev.swap(cur);
+        }
+        int c = (int)(std::min_element(prev.begin(), prev.end()) - prev.begin());
+        s.start = s.bVertical ? o.y : o.x;
+        s.pos.resize(along);
+        for (int k = along - 1; k >= 0; --k)
+        {
+            s.pos[k] = (s.bVertical ? o.x : o.y) + c;
+            c += step[(size_t)k * across + c];
+        }
+    }
+
+    /*
+        how much source tile i wants the canvas pixel (x, y), which it covers: the distance to its border, limited by
+        the signed distance to its cuts (negative on the side of the neighbour)
+    */
+    float score(int i, int x, int y) const
+    {
+        const BlendRect& r = m_rect[i];
+        const int sx = x - r.x, sy = y - r.y;
+        float d = (float)std::min(std::min(sx + 1, r.w - sx), std::min(sy + 1, r.h - sy));
+        for (size_t k = 0; k < m_tileSeam[i].size(); ++k)
+        {
+            const Seam& s = m_seam[m_tileSeam[i][k]];
+            const int along = s.bVertical ? y : x, across = s.bVertical ? x : y;
+            if ((along < s.start) || (along >= s.start + (int)s.pos.size()))
+                continue;
+            const float t = across - s.pos[along - s.start] + 0.5f;
+            d = std::min(d, (s.a == i) ? -t : t);
+        }
+        return d;
+    }
+
+    /* the source tiles which intersect the rectangle */
+    void touching(int x, int y, int w, int h, std::vector<int>& vec) const
+    {
+        vec.clear();
+        for (size_t i = 0; i < m_rect.size(); ++i)
+        {
+            const BlendRect& r = m_rect[i];
+            if ((r.x < x + w) && (r.x + r.w > x) && (r.y < y + h) && (r.y + r.h > y))
+                vec.push_back((int)i);
+        }
+    }
+
+    /* source tile of the pixel, -1 where the mosaic has no content */
+    int label(const std::vector<int>& vecTile, const std::vector<const unsigned char*>& vecImage, int x, int y) const
+    {
+        int best = -1;
+        float v = 0;
+        for (size_t k = 0; k < vecTile.size(); ++k)
+        {
+            const int i = vecTile[k];
+            const BlendRect& r = m_rect[i];
+            if ((NULL == vecImage[i]) || (x < r.x) || (x >= r.x + r.w) || (y < r.y) || (y >= r.y + r.h))
+                continue;
+            const float s = score(i, x, y);
+            if ((best < 0) || (s > v))
+            {
+                best = i;
+                v = s;
+            }
+        }
+        return best;
+    }
+
+    void renderFeather(int x0, int y0, const std::vector<int>& vecTile, const std::vector<const unsigned char*>& vecImage, unsigned char* pOut) const
+    {
+        for (int y = y0; y < y0 + CANVAS_TILE; ++y)
+        {
+            for (int x = x0; x < x0 + CANVAS_TILE; ++x, pOut += 4)
+            {
+                float sum[3] = { 0, 0, 0 }, total = 0;
+                for (size_t k = 0; k < vecTile.size(); ++k)
+                {
+                    const int i = vecTile[k];
+                    const BlendRect& r = m_rect[i];
+                    if ((NULL == vecImage[i]) || (x < r.x) || (x >= r.x + r.w) || (y < r.y) || (y >= r.y + r.h))
+                        continue;
+                    const float w = std::min(std::min(score(i, x, y) + BLEND_SEAM_BAND, (float)std::min(std::min(x - r.x + 1, r.x + r.w - x), std::min(y - r.y + 1, r.y + r.h - y))), 255.0f);
+                    if (w <= 0)
+                        continue;
+                    const unsigned char* s = vecImage[i] + (size_t)(y - r.y) * stride(r.w) + (x - r.x) * 3;
+                    sum[0] += w * s[0];
+                    sum[1] += w * s[1];
+                    sum[2] += w * s[2];
+                    total += w;
+                }
+                if (total > 0)
+                {
+                    for (int c = 0; c < 3; ++c)
+                        pOut[c] = (unsigned char)(sum[c] / total + 0.5f);
+                    pOut[3] = (unsigned char)std::min(total, 255.0f);
+                }
+                else
+                {
+                    /* the corner of four cuts which all point away: the label */
+                    const int i = label(vecTile, vecImage, x, y);
+                    if (i < 0)
+                        memset(pOut, 0, 4);
+                    else
+                    {
+                        const BlendRect& r = m_rect[i];
+                        memcpy(pOut, vecImage[i] + (size_t)(y - r.y) * stride(r.w) + (x - r.x) * 3, 3);
+                        pOut[3] = 255;
+                    }
+                }
+            }
+        }
+    }
+
+    /* 5 taps binomial blur and decimation, borders clamped */
+    static void reduce(const std::vector<float>& in, int w, int h, int ch, std::vector<float>& out)
+    {
+        const int ow = w / 2, oh = h / 2;
+        std::vector<float> tmp((size_t)ow * h * ch);
+        for (int y = 0; y < h; ++y)
+        {
+            const float* s = &in[(size_t)y * w * ch];
+            float* d = &tmp[(size_t)y * ow * ch];
+            for (int x = 0; x < ow; ++x)
+            {
+                const int xm2 = std::max(2 * x - 2, 0), xm1 = std::max(2 * x - 1, 0), xp1 = std::min(2 * x + 1, w - 1), xp2 = std::min(2 * x + 2, w - 1);
+                for (int c = 0; c < ch; ++c)
+                    d[x * ch + c] = (s[xm2 * ch + c] + 4 * s[xm1 * ch + c] + 6 * s[2 * x * ch + c] + 4 * s[xp1 * ch + c] + s[xp2 * ch + c]) * (1.0f / 16);
+            }
+        }
+        out.resize((size_t)ow * oh * ch);
+        for (int y = 0; y < oh; ++y)
+        {
+            const float* r[5];
+            for (int t = 0; t < 5; ++t)
+                r[t] = &tmp[(size_t)std::min(std::max(2 * y - 2 + t, 0), h - 1) * ow * ch];
+            float* d = &out[(size_t)y * ow * ch];
+            for (int i = 0; i < ow * ch; ++i)
+                d[i] = (r[0][i] + 4 * r[1][i] + 6 * r[2][i] + 4 * r[3][i] + r[4][i]) * (1.0f / 16);
+        }
+    }
+
+    /* out (w x h) += the coarser level (w / 2 x h / 2) interpolated, the inverse of reduce() */
+    static void expandAdd(const std::vector<float>& in, int w, int h, int ch, std::vector<float>& out, float sign)
+    {
+        const int iw = w / 2, ih = h / 2;
+        std::vector<float> tmp((size_t)w * ih * ch);
+        for (int y = 0; y < ih; ++y)
+        {
+            const float* s = &in[(size_t)y * iw * ch];
+            float* d = &tmp[(size_t)y * w * ch];
+            for (int x = 0; x < iw; ++x)
+            {
+                const int xm1 = std::max(x - 1, 0), xp1 = std::min(x + 1, iw - 1);
+                for (int c = 0; c < ch; ++c)
+                {
+                    d[2 * x * ch + c] = (s[xm1 * ch + c] + 6 * s[x * ch + c] + s[xp1 * ch + c]) * (1.0f / 8);
+                    d[(2 * x + 1) * ch + c] = (s[x * ch + c] + s[xp1 * ch + c]) * 0.5f;
+                }
+            }
+        }
+        for (int y = 0; y < ih; ++y)
+        {
+            const float* r0 = &tmp[(size_t)std::max(y - 1, 0) * w * ch];
+            const float* r1 = &tmp[(size_t)y * w * ch];
+            const float* r2 = &tmp[(size_t)std::min(y + 1, ih - 1) * w * ch];
+            float* d0 = &out[(size_t)(2 * y) * w * ch];
+            float* d1 = d0 + (size_t)w * ch;
+            for (int i = 0; i < w * ch; ++i)
+            {
+                d0[i] += sign * (r0[i] + 6 * r1[i] + r2[i]) * (1.0f / 8);
+                d1[i] += sign * (r1[i] + r2[i]) * 0.5f;
+            }
+        }
+    }
+
+    void renderMultiband(int x0, int y0, const std::vector<int>& vecTile, const std::vector<const unsigned char*>& vecImage, unsigned char* pOut) const
+    {
+        const int size = CANVAS_TILE + 2 * BLEND_HALO, rx = x0 - BLEND_HALO, ry = y0 - BLEND_HALO;
+        std::vector<int> lab((size_t)size * size);
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+                lab[(size_t)y * size + x] = label(vecTile, vecImage, rx + x, ry + y);
+        }
+
+        /* acc[k]: the blended bands, rgb and the sum of the mask weights */
+        std::vector<std::vector<float> > acc(BLEND_LEVELS + 1), gauss(BLEND_LEVELS + 1), mask(BLEND_LEVELS + 1);
+        for (int k = 0; k <= BLEND_LEVELS; ++k)
+            acc[k].assign((size_t)(size >> k) * (size >> k) * 4, 0.0f);
+        for (size_t t = 0; t < vecTile.size(); ++t)
+        {
+            const int i = vecTile[t];
+            if (NULL == vecImage[i])
+                continue;
+            if (std::find(lab.begin(), lab.end(), i) == lab.end())
+                continue;
+            /* the tile over the whole region, its borders replicated, and its mask */
+            const BlendRect& r = m_rect[i];
+            const int st = stride(r.w);
+            gauss[0].resize((size_t)size * size * 3);
+            mask[0].resize((size_t)size * size);
+            for (int y = 0; y < size; ++y)
+            {
+                const unsigned char* s = vecImage[i] + (size_t)std::min(std::max(ry + y - r.y, 0), r.h - 1) * st;
+                float* d = &gauss[0][(size_t)y * size * 3];
+                for (int x = 0; x < size; ++x)
+                {
+                    const int sx = std::min(std::max(rx + x - r.x, 0), r.w - 1);
+                    d[x * 3] = s[sx * 3];
+                    d[x * 3 + 1] = s[sx * 3 + 1];
+                    d[x * 3 + 2] = s[sx * 3 + 2];
+                    mask[0][(size_t)y * size + x] = (lab[(size_t)y * size + x] == i) ? 1.0f : 0.0f;
+                }
+            }
+            for (int k = 0; k < BLEND_LEVELS; ++k)
+            {
+                reduce(gauss[k], size >> k, size >> k, 3, gauss[k + 1]);
+                reduce(mask[k], size >> k, size >> k, 1, mask[k + 1]);
+            }
+            for (int k = 0; k <= BLEND_LEVELS; ++k)
+            {
+                const int n = (size >> k) * (size >> k);
+                if (k < BLEND_LEVELS)
+                    expandAdd(gauss[k + 1], size >> k, size >> k, 3, gauss[k], -1.0f);    /* the Laplacian band */
+                const float* g = &gauss[k][0];
+                const float* m = &mask[k][0];
+                float* a = &acc[k][0];
+                for (int p = 0; p < n; ++p, g += 3, a += 4)
+                {
+                    a[0] += g[0] * m[p];
+                    a[1] += g[1] * m[p];
+                    a[2] += g[2] * m[p];
+                    a[3] += m[p];
+                }
+            }
+        }
+
+        /* normalize every band by its weights and collapse */
+        std::vector<std::vector<float> > band(BLEND_LEVELS + 1);
+        for (int k = 0; k <= BLEND_LEVELS; ++k)
+        {
+            const int n = (size >> k) * (size >> k);
+            band[k].resize((size_t)n * 3);
+            for (int p = 0; p < n; ++p)
+            {
+                const float* a = &acc[k][(size_t)p * 4];
+                const float inv = (a[3] > 1e-6f) ? (1.0f / a[3]) : 0.0f;
+                band[k][p * 3] = a[0] * inv;
+                band[k][p * 3 + 1] = a[1] * inv;
+                band[k][p * 3 + 2] = a[2] * inv;
+            }
+        }
+        for (int k = BLEND_LEVELS - 1; k >= 0; --k)
+            expandAdd(band[k + 1], size >> k, size >> k, 3, band[k], 1.0f);
+
+        for (int y = 0; y < CANVAS_TILE; ++y)
+        {
+            const size_t p0 = (size_t)(y + BLEND_HALO) * size + BLEND_HALO;
+            for (int x = 0; x < CANVAS_TILE; ++x, pOut += 4)
+            {
+                if (lab[p0 + x] < 0)
+                {
+                    memset(pOut, 0, 4);
+                    continue;
+                }
+                for (int c = 0; c < 3; ++c)
+                {
+                    const float v = band[0][(p0 + x) * 3 + c];
+                    pOut[c] = (unsigned char)((v <= 0.0f) ? 0 : ((v >= 255.0f) ? 255 : (int)(v + 0.5f)));
+                }
+                pOut[3] = 255;
+            }
+        }
+    }
+    /* the loader, and the tile has the size of its rectangle */
+    bool load(const BLEND_LOADER& loader, int index, std::vector<unsigned char>& data) const
+    {
+        return loader(index, data) && (data.size() >= (size_t)stride(m_rect[index].w) * m_rect[index].h);
+    }
+public:
+    /* vecRect: the source tiles on the canvas */
+    MosaicBlender(int mode, const std::vector<BlendRect>& vecRect)
+    : m_mode(mode), m_rect(vecRect), m_tileSeam(vecRect.size())
+    {
+    }
+
+    /*
+        cut the overlap of every neighbour pair, the pairs in parallel, each tile loaded once (tilecache.h); returns
+        the number of seams found
+    */
+    int findSeams(const std::vector<std::pair<int, int> >& vecPair, const BLEND_LOADER& loader, unsigned threads)
+    {
+        std::vector<Seam> vec(vecPair.size());
+        std::vector<unsigned> refs(m_rect.size(), 0);
+        for (size_t k = 0; k < vecPair.size(); ++k)
+        {
+            ++refs[vecPair[k].first];
+            ++refs[vecPair[k].second];
+        }
+        TileCache<std::vector<unsigned char> > cache(refs);
+        const auto get = [&](int index, std::vector<unsigned char>& data) { return load(loader, index, data); };
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> vecThread;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            vecThread.push_back(std::thread([&]()
+            {
+                size_t k;
+                while ((k = next++) < vecPair.size())
+                {
+                    Seam& s = vec[k];
+                    BlendRect o;
+                    int a = vecPair[k].first, b = vecPair[k].second;
+                    if (!overlap(m_rect[a], m_rect[b], &o))
+                    {
+                        cache.release(a);
+                        cache.release(b);
+                        continue;
+                    }
+                    /* a wide overlap is cut along its width: b below a */
+                    s.bVertical = (o.h >= o.w);
+                    if (s.bVertical ? (m_rect[a].x > m_rect[b].x) : (m_rect[a].y > m_rect[b].y))
+                        std::swap(a, b);
+                    s.a = a;
+                    s.b = b;
+                    const std::vector<unsigned char>* da = cache.get(a, get);
+                    const std::vector<unsigned char>* db = cache.get(b, get);
+                    if (da && db)
+                        findSeam(m_rect[a], &(*da)[0], m_rect[b], &(*db)[0], o, s);
+                    cache.release(a);
+                    cache.release(b);
+                }
+            }));
+        }
+        for (size_t i = 0; i < vecThread.size(); ++i)
+            vecThread[i].join();
+        for (size_t k = 0; k < vec.size(); ++k)
+        {
+            if (vec[k].pos.empty())
+                continue;
+            m_tileSeam[vec[k].a].push_back((int)m_seam.size());
+            m_tileSeam[vec[k].b].push_back((int)m_seam.size());
+            m_seam.push_back(Seam());
+            m_seam.back().a = vec[k].a;
+            m_seam.back().b = vec[k].b;
+            m_seam.back().bVertical = vec[k].bVertical;
+            m_seam.back().start = vec[k].start;
+            m_seam.back().pos.swap(vec[k].pos);
+        }
+        return (int)m_seam.size();
+    }
+
+    /* the whole canvas, one row of canvas tiles after the other; returns the number of source tiles which failed to load */
+    int blend(TileCanvas& canvas, const BLEND_LOADER& loader, unsigned threads)
+    {
+        const int halo = (BLEND_MULTIBAND == m_mode) ? BLEND_HALO : 0;
+        std::vector<std::vector<unsigned char> > vecData(m_rect.size());
+        std::vector<const unsigned char*> vecImage(m_rect.size(), (const unsigned char*)NULL);
+        std::vector<char> vecDone(m_rect.size(), 0);
+        std::vector<std::vector<unsigned char> > vecOut(canvas.tilesX());
+        int failed = 0;
+        for (int ty = 0; ty < canvas.tilesY(); ++ty)
+        {
+            /* the source tiles of this row: release those behind, load those which come in */
+            std::vector<int> vecRow, vecLoad;
+            touching(-halo, ty * CANVAS_TILE - halo, canvas.width() + 2 * halo, CANVAS_TILE + 2 * halo, vecRow);
+            for (size_t i = 0; i < m_rect.size(); ++i)
+            {
+                if (vecDone[i] && (std::find(vecRow.begin(), vecRow.end(), (int)i) == vecRow.end()))
+                {
+                    std::vector<unsigned char>().swap(vecData[i]);
+                    vecImage[i] = NULL;
+                }
+            }
+            for (size_t k = 0; k < vecRow.size(); ++k)
+            {
+                if (!vecDone[vecRow[k]])
+                    vecLoad.push_back(vecRow[k]);
+            }
+            {
+                std::atomic<size_t> next(0);
+                std::vector<std::thread> vecThread;
+                for (unsigned t = 0; t < threads; ++t)
+                {
+                    vecThread.push_back(std::thread([&]()
+                    {
+                        size_t k;
+                        while ((k = next++) < vecLoad.size())
+                        {
+                            const int i = vecLoad[k];
+                            if (load(loader, i, vecData[i]))
+                                vecImage[i] = &vecData[i][0];
+                        }
+                    }));
+                }
+                for (size_t i = 0; i < vecThread.size(); ++i)
+                    vecThread[i].join();
+            }
+            for (size_t k = 0; k < vecLoad.size(); ++k)
+            {
+                vecDone[vecLoad[k]] = 1;
+                if (NULL == vecImage[vecLoad[k]])
+                    ++failed;
+            }
+
+            /* the canvas tiles of the row in parallel, into their own buffers */
+            {
+                std::atomic<int> next(0);
+                std::vector<std::thread> vecThread;
+                for (unsigned t = 0; t < threads; ++t)
+                {
+                    vecThread.push_back(std::thread([&]()
+                    {
+                        int tx;
+                        std::vector<int> vecTile;
+                        while ((tx = next++) < canvas.tilesX())
+                        {
+                            vecOut[tx].resize(CANVAS_TILE_BYTES);
+                            touching(tx * CANVAS_TILE - halo, ty * CANVAS_TILE - halo, CANVAS_TILE + 2 * halo, CANVAS_TILE + 2 * halo, vecTile);
+                            if (vecTile.empty())
+                                memset(&vecOut[tx][0], 0, CANVAS_TILE_BYTES);
+                            else if (BLEND_MULTIBAND == m_mode)
+                                renderMultiband(tx * CANVAS_TILE, ty * CANVAS_TILE, vecTile, vecImage, &vecOut[tx][0]);
+                            else
+                                renderFeather(tx * CANVAS_TILE, ty * CANVAS_TILE, vecTile, vecImage, &vecOut[tx][0]);
+                        }
+                    }));
+                }
+                for (size_t i = 0; i < vecThread.size(); ++i)
+                    vecThread[i].join();
+            }
+            for (int tx = 0; tx < canvas.tilesX(); ++tx)
+                memcpy(canvas.tile(tx, ty, true), &vecOut[tx][0], CANVAS_TILE_BYTES);
+        }
+        return failed;
+    }
+};
+
+#endif
@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include "stitchreg.h"
+#include "tilecanvas.h"
+#include "blender.h"
+#include "tiffwriter.h"
+#include "zstackgrid.h"
+#include "tilecache.h"
+
+/*
+    Offline tile stitching for the area scans.
+    pair: register two tiles around the offset known from the stage
+        gridstitch pair <fixed.bmp> <moving.bmp> <hintX> <hintY> <radius>
+    grid: stitch a rows x cols scan, the list file has one tile per line in acquisition order, the tiles may differ
+          in size (a crop, another camera); every tile is decoded once by each pass (tilecache.h)
+        gridstitch grid <list.txt> <rows> <cols> <pitchX> <pitchY> <radius> <out.bmp> [serpentine = 1] [threads = 0] [budgetMB = 1024] [none|packbits|deflate]
+                        [feather|multiband] [seam = 0]
+        1. every horizontal and vertical neighbour pair is registered around the nominal pitch, in parallel, by phase
+           correlation of the overlap strip (RegPhase, sub-pixel), falling back to the search of reg_register_hint()
+           for the pairs where it scores below REG_MIN_SCORE
+        2. the tile positions are solved globally by weighted least squares (weight = NCC), with a weak pull to the
+           nominal grid so that pairs without texture do not make the solution drift
+        3. with seam = 1, the overlap of every neighbour pair is cut along its minimum difference path
+        4. the mosaic is blended (blender.h), feather or multiband, canvas tile by canvas tile in parallel, into an
+           out-of-core tiled canvas (tilecanvas.h) whose resident size is bounded by budgetMB, then streamed to a top-down
+           BMP, or to a pyramidal tiled BigTIFF (tiffwriter.h) when out ends with .tif
+    zgrid: the same for a scan of Z stacks, the list file has one stack per line, "z0.bmp z1.bmp ...", in acquisition
+           order; every stack is fused by EDF in memory and registered while the next one is fused (zstackgrid.h)
+        gridstitch zgrid <stacks.txt> <rows> <cols> <pitchX> <pitchY> <radius> <out.bmp> [the options of grid]
+*/
+
+typedef struct {
+    int width, height;
+    std::vector<unsigned char> data;    /* BGR24, top-down, TDIBWIDTHBYTES stride */
+} Bmp24;
+
+#define BMP_STRIDE(w)   ((((w) * 24) + 31) / 32 * 4)
+#define BMP_MAX_SIDE    65536   /* a larger header is taken as broken */
+
+static unsigned rd32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* the header of a 24 bits uncompressed BMP: where the pixels start, the width and the height, negative when top-down */
+static bool ReadBmp24Header(FILE* fp, unsigned* pOffset, int* pWidth, int* pHeight)
+{
+    unsigned char header[54];
+    if ((fread(header, 1, sizeof(header), fp) != sizeof(header)) || ('B' != header[0]) || ('M' != header[1]) || (24 != (header[28] | (header[29] << 8))))
+        return false;
+    *pOffset = rd32(header + 10);
+    *pWidth = (int)rd32(header + 18);
+    *pHeight = (int)rd32(header + 22);
+    return (*pWidth > 0) && (*pWidth <= BMP_MAX_SIDE) && (0 != *pHeight) && (*pHeight >= -BMP_MAX_SIDE) && (*pHeight <= BMP_MAX_SIDE);
+}
+
+/* the size of a tile from its header, without decoding it */
+static bool SizeBmp24(const char* filename, int* pWidth, int* pHeight)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (NULL == fp)
+        return false;
+    unsigned offset = 0;
+    int height = 0;
+    const bool ret = ReadBmp24Header(fp, &offset, pWidth, &height);
+    fclose(fp);
+    *pHeight = (height < 0) ? -height : height;
+    return ret;
+}
+
+/* 24 bits uncompressed BMP, bottom-up or top-down */
+static bool LoadBmp24(const char* filename, Bmp24* pBmp)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (NULL == fp)
+        return false;
+    unsigned offset = 0;
+    int width = 0, height = 0;
+    bool ret = false;
+    if (ReadBmp24Header(fp, &offset, &width, &height))
+    {
+        const int h = (height < 0) ? -height : height, stride = BMP_STRIDE(width);
+        pBmp->width = width;
+        pBmp->height = h;
+        pBmp->data.resize((size_t)stride * h);
+        if (0 == fseek(fp, offset, SEEK_SET))
+        {
+            ret = true;
+            for (int y = 0; (y < h) && ret; ++y)
+            {
+                const int row = (height < 0) ? y : (h - 1 - y);
+                ret = (fread(&pBmp->data[(size_t)row * stride], 1, stride, fp) == (size_t)stride);
+            }
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+static bool LoadGrey(const char* filename, GreyImage* pGrey)
+{
+    Bmp24 bmp;
+    if (!LoadBmp24(filename, &bmp))
+    {
+        printf("failed to load %s\n", filename);
+        return false;
+    }
+    reg_grey_from_rgb24(&bmp.data[0], bmp.width, bmp.height, BMP_STRIDE(bmp.width), pGrey);
+    return true;
+}
+
+static int DoPair(int argc, char** argv)
+{
+    if (argc < 7)
+    {
+        printf("usage: %s pair <fixed.bmp> <moving.bmp> <hintX> <hintY> <radius>\n", argv[0]);
+        return -1;
+    }
+    GreyImage a, b;
+    if (!LoadGrey(argv[2], &a) || !LoadGrey(argv[3], &b))
+        return -1;
+    RegPhase phase;
+    const RegResult p = phase.reg(a, b, atoi(argv[4]), atoi(argv[5]), atoi(argv[6]));
+    const RegResult r = reg_register_hint(a, b, atoi(argv[4]), atoi(argv[5]), atoi(argv[6]));
+    if (r.score <= REG_NO_MATCH)
+        printf("no overlap around the hint, or it is flat\n");
+    else
+    {
+        printf("search: offset = (%d, %d), correction = (%d, %d), ncc = %.3f\n", r.dx, r.dy, r.dx - atoi(argv[4]), r.dy - atoi(argv[5]), r.score);
+        printf("phase:  offset = (%.2f, %.2f), ncc = %.3f\n", p.fx, p.fy, p.score);
+    }
+    return 0;
+}
+
+/* every tile is decoded once, by the first of its pairs, and released after the last */
+static void RegisterPairs(const std::vector<std::string>& vecFile, std::vector<TilePair>& vecPair, int radius, unsigned threads)
+{
+    std::vector<unsigned> refs(vecFile.size(), 0);
+    for (size_t i = 0; i < vecPair.size(); ++i)
+    {
+        ++refs[vecPair[i].a];
+        ++refs[vecPair[i].b];
+    }
+    TileCache<GreyImage> cache(refs);
+    const auto load = [&](int index, GreyImage& grey)
+    {
+        return LoadGrey(vecFile[index].c_str(), &grey);
+    };
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> vecThread;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        vecThread.push_back(std::thread([&]()
+        {
+            size_t i;
+            RegPhase phase;     /* the plans of the thread, one per overlap geometry */
+            while ((i = next++) < vecPair.size())
+            {
+                TilePair& p = vecPair[i];
+                p.r.score = -1.0;
+                const GreyImage* a = cache.get(p.a, load);
+                const GreyImage* b = cache.get(p.b, load);
+                if (a && b)
+                    p.r = reg_register_pair(phase, *a, *b, p.hintX, p.hintY, radius);
+                cache.release(p.a);
+                cache.release(p.b);
+            }
+        }));
+    }
+    for (size_t i = 0; i < vecThread.size(); ++i)
+        vecThread[i].join();
+}
+
+/*
+    minimize sum w_ij * (p_j - p_i - d_ij)^2 + PRIOR_WEIGHT * sum (p_i - nominal_i)^2, one axis at a time, by conjugate gradient
+    on the normal equations; the matrix is the weighted graph Laplacian plus PRIOR_WEIGHT * I, so it is positive definite
+*/
+#define PRIOR_WEIGHT    0.01
+
+static void SolvePositions(int num, const std::vector<TilePair>& vecPair, const std::vector<double>& nominal, bool bY, std::vector<double>& pos)
+{
+    std::vector<double> b(num), x(nominal), r(num), p(num), ap(num);
+    for (int i = 0; i < num; ++i)
+        b[i] = PRIOR_WEIGHT * nominal[i];
+    for (size_t k = 0; k < vecPair.size(); ++k)
+    {
+        if (vecPair[k].r.score < REG_MIN_SCORE)
+            continue;
+        const double w = vecPair[k].r.score, d = bY ? vecPair[k].r.fy : vecPair[k].r.fx;
+        b[vecPair[k].b] += w * d;
+        b[vecPair[k].a] -= w * d;
+    }
+    auto mul = [&](const std::vector<double>& v, std::vector<double>& out)
+    {
+        for (int i = 0; i < num; ++i)
+            out[i] = PRIOR_WEIGHT * v[i];
+        for (size_t k = 0; k < vecPair.size(); ++k)
+        {
+            if (vecPair[k].r.score < REG_MIN_SCORE)
+                continue;
+            const double w = vecPair[k].r.score, diff = v[vecPair[k].b] - v[vecPair[k].a];
+            out[vecPair[k].b] += w * diff;
+            out[vecPair[k].a] -= w * diff;
+        }
+    };
+    mul(x, ap);
+    double rr = 0;
+    for (int i = 0; i < num; ++i)
+    {
+        r[i] = b[i] - ap[i];
+        p[i] = r[i];
+        rr += r[i] * r[i];
+    }
+    for (int it = 0; (it < 10 * num) && (rr > 1e-6); ++it)
+    {
+        mul(p, ap);
+        double pap = 0;
+        for (int i = 0; i < num; ++i)
+            pap += p[i] * ap[i];
+        const double alpha = rr / pap;
+        double rrnew = 0;
+        for (int i = 0; i < num; ++i)
+        {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * ap[i];
+            rrnew += r[i] * r[i];
+        }
+        for (int i = 0; i < num; ++i)
+            p[i] = r[i] + (rrnew / rr) * p[i];
+        rr = rrnew;
+    }
+    pos.swap(x);
+}
+
+/* vecW, vecH: the size of every tile, 0 for the tiles which are left out */
+static bool BlendAndSave(const BLEND_LOADER& loader, const std::vector<TilePair>& vecPair, const std::vector<int>& vecX, const std::vector<int>& vecY,
+                         const std::vector<int>& vecW, const std::vector<int>& vecH, size_t budget, const char* outfile, int compression, int mode, bool bSeam, unsigned threads)
+{
+    const int num = (int)vecX.size();
+    int minX = 0, minY = 0, maxX = 0, maxY = 0;
+    bool bAny = false;
+    for (int i = 0; i < num; ++i)
+    {
+        if ((vecW[i] <= 0) || (vecH[i] <= 0))
+            continue;
+        minX = bAny ? std::min(minX, vecX[i]) : vecX[i];
+        minY = bAny ? std::min(minY, vecY[i]) : vecY[i];
+        maxX = bAny ? std::max(maxX, vecX[i] + vecW[i]) : (vecX[i] + vecW[i]);
+        maxY = bAny ? std::max(maxY, vecY[i] + vecH[i]) : (vecY[i] + vecH[i]);
+        bAny = true;
+    }
+    if (!bAny)
+    {
+        printf("no tile to blend\n");
+        return false;
+    }
+    const int width = maxX - minX, height = maxY - minY, stride = BMP_STRIDE(width);
+    const std::string canvasfile = std::string(outfile) + ".canvas";
+    TileCanvas canvas(width, height, budget, canvasfile.c_str());
+    if (!canvas.valid())
+    {
+        printf("failed to create %s\n", canvasfile.c_str());
+        return false;
+    }
+
+    std::vector<BlendRect> vecRect(num);
+    for (int i = 0; i < num; ++i)
+    {
+        const BlendRect r = { vecX[i] - minX, vecY[i] - minY, std::max(vecW[i], 0), std::max(vecH[i], 0) };
+        vecRect[i] = r;
+    }
+    MosaicBlender blender(mode, vecRect);
+    if (bSeam)
+    {
+        std::vector<std::pair<int, int> > vecNeighbour;
+        for (size_t i = 0; i < vecPair.size(); ++i)
+            vecNeighbour.push_back(std::make_pair(vecPair[i].a, vecPair[i].b));
+        printf("%d seams in %u overlaps\n", blender.findSeams(vecNeighbour, loader, threads), (unsigned)vecNeighbour.size());
+    }
+    if (blender.blend(canvas, loader, threads) > 0)
+        printf("the tiles which failed to load are left out\n");
+
+    const size_t len = strlen(outfile);
+    if ((len > 4) && ((0 == strcmp(outfile + len - 4, ".tif")) || (0 == strcmp(outfile + len - 5, ".tiff"))))
+    {
+        TiffWriter writer;
+        if (!writer.write(outfile, canvas, compression, threads, budget))
+        {
+            printf("failed to write %s\n", outfile);
+            return false;
+        }
+        printf("save: %s, %d x %d, pyramidal tiled BigTIFF\n", outfile, width, height);
+        return true;
+    }
+
+    FILE* fp = fopen(outfile, "wb");
+    if (NULL == fp)
+    {
+        printf("failed to create %s\n", outfile);
+        return false;
+    }
+    {
+        unsigned char header[54] = { 'B', 'M' };
+        const unsigned long long size = 54ull + (unsigned long long)stride * height;
+        const unsigned v[] = { (unsigned)size, 0, 54, 40, (unsigned)width, (unsigned)(-height), 1 | (24 << 16), 0, (unsigned)(size - 54) };
+        memcpy(header + 2, v, sizeof(v));
+        fwrite(header, 1, sizeof(header), fp);
+    }
+    std::vector<unsigned char> row(stride);
+    for (int y = 0; y < height; ++y)
+    {
+        canvas.readRow(0, y, width, &row[0]);
+        fwrite(&row[0], 1, stride, fp);
+    }
+    fclose(fp);
+    printf("save: %s, %d x %d, canvas tiles read = %llu, written = %llu\n", outfile, width, height, canvas.readCount(), canvas.writeCount());
+    return true;
+}
+
+typedef struct {
+    const char* outfile;
+    bool bSerpentine;
+    unsigned threads;
+    size_t budget;
+    int compression, mode;
+    bool bSeam;
+} GridOptions;
+
+/* argv[8] ... argv[14] of grid and zgrid */
+static void ParseOptions(int argc, char** argv, GridOptions* pOpt)
+{
+    pOpt->outfile = argv[8];
+    pOpt->bSerpentine = (argc > 9) ? (0 != atoi(argv[9])) : true;
+    pOpt->threads = (argc > 10) ? atoi(argv[10]) : 0;
+    if (0 == pOpt->threads)
+        pOpt->threads = std::max(1u, std::thread::hardware_concurrency());
+    pOpt->budget = (size_t)((argc > 11) ? atoi(argv[11]) : 1024) << 20;
+    pOpt->compression = TIFF_COMPRESSION_PACKBITS;
+    if (argc > 12)
+    {
+        if (0 == strcmp(argv[12], "none"))
+            pOpt->compression = TIFF_COMPRESSION_NONE;
+#if defined(GRIDSTITCH_ZLIB)
+        else if (0 == strcmp(argv[12], "deflate"))
+            pOpt->compression = TIFF_COMPRESSION_DEFLATE;
+#endif
+    }
+    pOpt->mode = ((argc > 13) && (0 == strcmp(argv[13], "multiband"))) ? BLEND_MULTIBAND : BLEND_FEATHER;
+    pOpt->bSeam = (argc > 14) && (0 != atoi(argv[14]));
+}
+
+/* the lines of a text file which are not empty */
+static bool ReadLines(const char* filename, std::vector<std::string>& vecLine)
+{
+    FILE* fp = fopen(filename, "r");
+    if (NULL == fp)
+    {
+        printf("failed to open %s\n", filename);
+        return false;
+    }
+    char line[65536];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0])
+            vecLine.push_back(line);
+    }
+    fclose(fp);
+    return true;
+}
+
+/* steps 2 to 4 on the registered pairs */
+static bool SolveAndSave(const std::vector<TilePair>& vecPair, const std::vector<double>& nominalX, const std::vector<double>& nominalY, const BLEND_LOADER& loader,
+                         const std::vector<int>& vecW, const std::vector<int>& vecH, const GridOptions& opt)
+{
+    unsigned bad = 0;
+    for (size_t i = 0; i < vecPair.size(); ++i)
+    {
+        if (vecPair[i].r.score < REG_MIN_SCORE)
+            ++bad;
+    }
+    printf("%u pairs below ncc %.2f, they follow the nominal pitch\n", bad, REG_MIN_SCORE);
+
+    const int num = (int)nominalX.size();
+    std::vector<double> posX, posY;
+    SolvePositions(num, vecPair, nominalX, false, posX);
+    SolvePositions(num, vecPair, nominalY, true, posY);
+    std::vector<int> vecX(num), vecY(num);
+    for (int i = 0; i < num; ++i)
+    {
+        vecX[i] = (int)floor(posX[i] + 0.5);
+        vecY[i] = (int)floor(posY[i] + 0.5);
+    }
+    return BlendAndSave(loader, vecPair, vecX, vecY, vecW, vecH, opt.budget, opt.outfile, opt.compression, opt.mode, opt.bSeam, opt.threads);
+}
+
+static int DoGrid(int argc, char** argv)
+{
+    if (argc < 9)
+    {
+        printf("usage: %s grid <list.txt> <rows> <cols> <pitchX> <pitchY> <radius> <out.bmp> [serpentine = 1] [threads = 0] [budgetMB = 1024] [none|packbits|deflate] [feather|multiband] [seam = 0]\n", argv[0]);
+        return -1;
+    }
+    const int rows = atoi(argv[3]), cols = atoi(argv[4]), pitchX = atoi(argv[5]), pitchY = atoi(argv[6]), radius = atoi(argv[7]);
+    GridOptions opt;
+    ParseOptions(argc, argv, &opt);
+
+    std::vector<std::string> vecFile;
+    if (!ReadLines(argv[2], vecFile))
+        return -1;
+    if ((rows <= 0) || (cols <= 0) || ((int)vecFile.size() != rows * cols))
+    {
+        printf("%u tiles in the list, %d x %d expected\n", (unsigned)vecFile.size(), rows, cols);
+        return -1;
+    }
+    /* the tiles need not have the same size, a tile whose header cannot be read is left out */
+    std::vector<int> vecW(vecFile.size(), 0), vecH(vecFile.size(), 0);
+    for (size_t i = 0; i < vecFile.size(); ++i)
+    {
+        if (!SizeBmp24(vecFile[i].c_str(), &vecW[i], &vecH[i]) || (vecW[i] <= 0) || (vecH[i] <= 0))
+        {
+            printf("failed to load %s\n", vecFile[i].c_str());
+            vecW[i] = vecH[i] = 0;
+        }
+    }
+
+    std::vector<double> nominalX, nominalY;
+    std::vector<TilePair> vecPair;
+    reg_grid_pairs(rows, cols, pitchX, pitchY, opt.bSerpentine, vecPair, nominalX, nominalY);
+    printf("register %u pairs on %u threads\n", (unsigned)vecPair.size(), opt.threads);
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    RegisterPairs(vecFile, vecPair, radius, opt.threads);
+    printf("registered in %.2f s\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+
+    /* a tile which changed since its size was read is left out */
+    const BLEND_LOADER loader = [&](int index, std::vector<unsigned char>& data)
+    {
+        Bmp24 tile;
+        if (!LoadBmp24(vecFile[index].c_str(), &tile))
+        {
+            printf("failed to load %s\n", vecFile[index].c_str());
+            return false;
+        }
+        if ((tile.width != vecW[index]) || (tile.height != vecH[index]))
+        {
+            printf("size mismatch %s\n", vecFile[index].c_str());
+            return false;
+        }
+        data.swap(tile.data);
+        return true;
+    };
+    return SolveAndSave(vecPair, nominalX, nominalY, loader, vecW, vecH, opt) ? 0 : -1;
+}
+
+static int DoZGrid(int argc, char** argv)
+{
+    if (argc < 9)
+    {
+        printf("usage: %s zgrid <stacks.txt> <rows> <cols> <pitchX> <pitchY> <radius> <out.bmp> [serpentine = 1] [threads = 0] [budgetMB = 1024] [none|packbits|deflate] [feather|multiband] [seam = 0]\n", argv[0]);
+        return -1;
+    }
+    const int rows = atoi(argv[3]), cols = atoi(argv[4]), pitchX = atoi(argv[5]), pitchY = atoi(argv[6]), radius = atoi(argv[7]);
+    GridOptions opt;
+    ParseOptions(argc, argv, &opt);
+
+    std::vector<std::string> vecStack;
+    if (!ReadLines(argv[2], vecStack))
+        return -1;
+    if ((rows <= 0) || (cols <= 0) || ((int)vecStack.size() != rows * cols))
+    {
+        printf("%u stacks in the list, %d x %d expected\n", (unsigned)vecStack.size(), rows, cols);
+        return -1;
+    }
+
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    ZStackGrid pipe(rows, cols, pitchX, pitchY, radius, opt.bSerpentine, opt.threads);
+    unsigned planes = 0;
+    for (size_t i = 0; i < vecStack.size(); ++i)
+    {
+        bool bOk = true;
+        std::vector<char> line(vecStack[i].begin(), vecStack[i].end());
+        line.push_back(0);
+        for (char* tok = strtok(&line[0], " \t"); tok && bOk; tok = strtok(NULL, " \t"))
+        {
+            Bmp24 plane;
+            if (!LoadBmp24(tok, &plane))
+            {
+                printf("failed to load %s\n", tok);
+                bOk = false;
+            }
+            else if (!pipe.addPlane(&plane.data[0], plane.width, plane.height, BMP_STRIDE(plane.width)))
+            {
+                printf("size mismatch %s\n", tok);
+                bOk = false;
+            }
+            else
+                ++planes;
+        }
+        pipe.endTile(bOk);
+    }
+    pipe.finish();
+    printf("%u planes fused into %d tiles (%u left out) and registered in %.2f s\n", planes, pipe.tiles(), pipe.failed(),
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    if (pipe.width() <= 0)
+        return -1;
+
+    const BLEND_LOADER loader = [&](int index, std::vector<unsigned char>& data)
+    {
+        if (pipe.tile(index).empty())
+            return false;
+        data = pipe.tile(index);
+        return true;
+    };
+    const std::vector<int> vecW(pipe.tiles(), pipe.width()), vecH(pipe.tiles(), pipe.height());
+    return SolveAndSave(pipe.pairs(), pipe.nominalX(), pipe.nominalY(), loader, vecW, vecH, opt) ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc >= 2) && (0 == strcmp(argv[1], "pair")))
+        return DoPair(argc, argv);
+    if ((argc >= 2) && (0 == strcmp(argv[1], "grid")))
+        return DoGrid(argc, argv);
+    if ((argc >= 2) && (0 == strcmp(argv[1], "zgrid")))
+        return DoZGrid(argc, argv);
+    printf("usage: %s pair|grid|zgrid ...\n", argv[0]);
+    return -1;
+}
@@ -0,0 +1,601 @@
+#ifndef __stitchreg_H__
+#define __stitchreg_H__
+
+/*
+    Tile registration with a position hint.
+    The stage already knows where each tile was taken, so instead of searching the whole frame the offset is only
+    searched in a window of +/- radius pixels around the hint: coarse on a 1/REG_SCALE grey image, then refined at
+    full resolution. The score is the normalized cross correlation of the overlap, in [-1, 1].
+    RegPhase does the same by phase correlation of the overlap strip at the hint, one FFT instead of a search, with a
+    sub-pixel peak.
+*/
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define REG_SCALE           4       /* downscale of the coarse search */
+#define REG_REFINE          (REG_SCALE - 1)
+#define REG_MIN_OVERLAP     256     /* minimum pixels of overlap at the coarse level */
+#define REG_NO_MATCH        -1.0    /* the score of an offset which cannot be compared */
+#define REG_MIN_VARIANCE    1e-3    /* grey levels squared a pixel, below the overlap is flat */
+
+typedef struct {
+    int width, height;
+    std::vector<unsigned char> data;    /* tightly packed */
+} GreyImage;
+
+typedef struct {
+    int dx, dy;         /* position of the moving tile in the coordinates of the fixed tile */
+    double score;       /* NCC, -1 when there is no valid overlap */
+    double fx, fy;      /* the same position, sub-pixel where the method gives it */
+} RegResult;
+
+/* BGR24 (or RGB24) with row stride to grey, (R + 2G + B) / 4 */
+static inline void reg_grey_from_rgb24(const unsigned char* pData, int width, int height, int stride, GreyImage* pOut)
+{
+    pOut->width = width;
+    pOut->height = height;
+    pOut->data.resize((size_t)width * height);
+    for (int y = 0; y < height; ++y)
+    {
+        const unsigned char* s = pData + (size_t)y * stride;
+        unsigned char* d = &pOut->data[(size_t)y * width];
+        for (int x = 0; x < width; ++x, s += 3)
+            d[x] = (unsigned char)((s[0] + 2 * s[1] + s[2]) >> 2);
+    }
+}
+
+static inline void reg_downscale(const GreyImage& in, int scale, GreyImage* pOut)
+{
+    pOut->width = in.width / scale;
+    pOut->height = in.height / scale;
+    pOut->data.resize((size_t)pOut->width * pOut->height);
+    for (int y = 0; y < pOut->height; ++y)
+    {
+        for (int x = 0; x < pOut->width; ++x)
+        {
+            unsigned sum = 0;
+            for (int j = 0; j < scale; ++j)
+            {
+                const unsigned char* s = &in.data[(size_t)(y * scale + j) * in.width + x * scale];
+                for (int i = 0; i < scale; ++i)
+                    sum += s[i];
+            }
+            pOut->data[(size_t)y * pOut->width + x] = (unsigned char)(sum / (scale * scale));
+        }
+    }
+}
+
+/*
+    NCC of the overlap when b is placed at (dx, dy) in the coordinates of a; step subsamples the overlap.
+    REG_NO_MATCH when the overlap is too small, or flat in either tile: the correlation of a flat overlap is not
+    defined, and its rounding noise would pass for a score
+*/
+static inline double reg_ncc(const GreyImage& a, const GreyImage& b, int dx, int dy, int step, int minOverlap)
+{
+    const int x0 = (dx > 0) ? dx : 0, y0 = (dy > 0) ? dy : 0;
+    const int x1 = (dx + b.width < a.width) ? (dx + b.width) : a.width, y1 = (dy + b.height < a.height) ? (dy + b.height) : a.height;
+    if ((x1 - x0) * (y1 - y0) < minOverlap)
+        return REG_NO_MATCH;
+
+    double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+    unsigned n = 0;
+    for (int y = y0; y < y1; y += step)
+    {
+        const unsigned char* pa = &a.data[(size_t)y * a.width];
+        const unsigned char* pb = &b.data[0] + (ptrdiff_t)(y - dy) * b.width - dx;
+        for (int x = x0; x < x1; x += step)
+        {
+            const double va = pa[x], vb = pb[x];
+            sa += va;
+            sb += vb;
+            saa += va * va;
+            sbb += vb * vb;
+            sab += va * vb;
+            ++n;
+        }
+    }
+    if (0 == n)
+        return REG_NO_MATCH;
+    const double cov = sab - sa * sb / n, va = saa - sa * sa / n, vb = sbb - sb * sb / n;
+    if ((va <= REG_MIN_VARIANCE * n) || (vb <= REG_MIN_VARIANCE * n))
+        return REG_NO_MATCH;
+    return cov / sqrt(va * vb);
+}
+
+/* search (hintX, hintY) +/- radius, coarse first, then refine +/- REG_REFINE at full resolution */
+static inline RegResult reg_register_hint(const GreyImage& a, const GreyImage& b, int hintX, int hintY, int radius)
+{
+    RegResult ret = { hintX, hintY, -1.0 };
+    GreyImage ca, cb;
+    reg_downscale(a, REG_SCALE, &ca);
+    reg_downscale(b, REG_SCALE, &cb);
+    const int cr = (radius + REG_SCALE - 1) / REG_SCALE, chx = hintX / REG_SCALE, chy = hintY / REG_SCALE;
+    int bx = chx, by = chy;
+    double best = -2.0;
+    for (int dy = chy - cr; dy <= chy + cr; ++dy)
+    {
+        for (int dx = chx - cr; dx <= chx + cr; ++dx)
+        {
+            const double s = reg_ncc(ca, cb, dx, dy, 1, REG_MIN_OVERLAP);
+            if (s > best)
+            {
+                best = s;
+                bx = dx;
+                by = dy;
+            }
+        }
+    }
+    if (best <= -1.0)
+        return ret;
+
+    best = -2.0;
+    for (int dy = by * REG_SCALE - REG_REFINE; dy <= by * REG_SCALE + REG_REFINE; ++dy)
+    {
+        for (int dx = bx * REG_SCALE - REG_REFINE; dx <= bx * REG_SCALE + REG_REFINE; ++dx)
+        {
+            const double s = reg_ncc(a, b, dx, dy, 2, REG_MIN_OVERLAP * REG_SCALE * REG_SCALE);
+            if (s > best)
+            {
+                best = s;
+                ret.dx = dx;
+                ret.dy = dy;
+            }
+        }
+    }
+    ret.score = best;
+    ret.fx = ret.dx;
+    ret.fy = ret.dy;
+    return ret;
+}
+
+#define REG_PHASE_MAX       1024    /* longest side of the reduced strip, a longer overlap is cropped around its centre */
+#define REG_PHASE_EPS       1e-12f
+#define REG_PI              3.14159265358979323846
+#define REG_PHASE_PEAKS     8       /* local maxima of the correlation compared by NCC */
+
+/*
+    Phase correlation of the overlap strip: the overlap of the two tiles at the hint, grown by the radius as far as
+    each tile goes, is cut from both, reduced by REG_SCALE, mean removed, windowed (cosine edges) and zero padded to
+    powers of two so that a shift within the radius does not wrap, transformed, whitened (A conj(B) / |A conj(B)|^1/2)
+    and transformed back. The whitening is partial: the full one gives the noise of the bands without texture the
+    weight of the rest, and misses peaks. The local maxima within +/- radius, divided by the overlap of the windows,
+    are the candidate shifts; the best of them by NCC is refined as reg_register_hint() does. The cost does not grow
+    with the radius as the coarse search does (by its square), and the score is the same NCC, so the two mix.
+    The 2D FFT is radix 2 with the rows as vectors: a pass transforms all the columns at once, each butterfly combines
+    two whole rows (SSE2 / NEON), then the data is transposed and the same pass does the other axis.
+    The twiddles, bit reversals and windows are cached per region geometry (the few of a grid scan), so are the work
+    buffers: one RegPhase per thread.
+*/
+class RegPhase {
+    struct Plan {
+        int w, h, wb, hb, nx, ny;           /* regions of a and b, transform */
+        std::vector<float> winX, winY, winBX, winBY;
+        std::vector<float> cx, sx, cy, sy;  /* twiddles exp(-2 pi i k / n), k < n / 2 */
+        std::vector<int> revX, revY;
+    };
+    std::map<std::pair<long long, long long>, Plan> m_plan;
+    std::vector<float> m_re[2], m_im[2], m_tmp, m_ovX, m_ovY;
+
+    static int pow2(int v)
+    {
+        int n = 1;
+        while (n < v)
+            n <<= 1;
+        return n;
+    }
+
+    static void twiddles(int n, std::vector<float>& c, std::vector<float>& s, std::vector<int>& rev)
+    {
+        c.resize(n / 2);
+        s.resize(n / 2);
+        for (int k = 0; k < n / 2; ++k)
+        {
+            c[k] = (float)cos(2 * REG_PI * k / n);
+            s[k] = (float)-sin(2 * REG_PI * k / n);
+        }
+        rev.resize(n);
+        int bits = 0;
+        while ((1 << bits) < n)
+            ++bits;
+        for (int i = 0; i < n; ++i)
+        {
+            int r = 0;
+            for (int b = 0; b < bits; ++b)
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            rev[i] = r;
+        }
+    }
+
+    /* cosine taper over the first and the last taper of n, flat between; taper = n / 2 is Hann */
+    static void window(int n, int taper, std::vector<float>& win)
+    {
+        win.assign(n, 1.0f);
+        for (int i = 0; i < taper; ++i)
+            win[i] = win[n - 1 - i] = (float)(0.5 - 0.5 * cos(REG_PI * (i + 0.5) / taper));
+    }
+
+    /* the regions w x h of a and wb x hb of b, the shifts (lagX, lagY) +/- radius between them do not wrap */
+    const Plan& plan(int w, int h, int wb, int hb, int lagX, int lagY, int radius)
+    {
+        const int nx = pow2(std::max(wb + std::max(lagX + radius, 0), w - std::min(lagX - radius, 0)));
+        const int ny = pow2(std::max(hb + std::max(lagY + radius, 0), h - std::min(lagY - radius, 0)));
+        const std::pair<long long, long long> key(w | ((long long)h << 16) | ((long long)wb << 32) | ((long long)hb << 48), nx | ((long long)ny << 16));
+        std::map<std::pair<long long, long long>, Plan>::iterator it = m_plan.find(key);
+        if (it != m_plan.end())
+            return it->second;
+        Plan& p = m_plan[key];
+        p.w = w;
+        p.h = h;
+        p.wb = wb;
+        p.hb = hb;
+        p.nx = nx;
+        p.ny = ny;
+        window(w, w / 8, p.winX);
+        window(h, h / 8, p.winY);
+        window(wb, wb / 8, p.winBX);
+        window(hb, hb / 8, p.winBY);
+        twiddles(p.nx, p.cx, p.sx, p.revX);
+        twiddles(p.ny, p.cy, p.sy, p.revY);
+        return p;
+    }
+
+    /* q = p - w * q, p = p + w * q, over m floats of the rows */
+    static void butterfly(float* pr, float* pi, float* qr, float* qi, int m, float wr, float wi)
+    {
+        int x = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+        const __m128 vwr = _mm_set1_ps(wr), vwi = _mm_set1_ps(wi);
+        for (; x + 4 <= m; x += 4)
+        {
+            const __m128 ar = _mm_loadu_ps(pr + x), ai = _mm_loadu_ps(pi + x), br = _mm_loadu_ps(qr + x), bi = _mm_loadu_ps(qi + x);
+            const __m128 tr = _mm_sub_ps(_mm_mul_ps(vwr, br), _mm_mul_ps(vwi, bi)), ti = _mm_add_ps(_mm_mul_ps(vwr, bi), _mm_mul_ps(vwi, br));
+            _mm_storeu_ps(qr + x, _mm_sub_ps(ar, tr));
+            _mm_storeu_ps(qi + x, _mm_sub_ps(ai, ti));
+            _mm_storeu_ps(pr + x, _mm_add_ps(ar, tr));
+            _mm_storeu_ps(pi + x, _mm_add_ps(ai, ti));
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        const float32x4_t vwr = vdupq_n_f32(wr), vwi = vdupq_n_f32(wi);
+        for (; x + 4 <= m; x += 4)
+        {
+            const float32x4_t ar = vld1q_f32(pr + x), ai = vld1q_f32(pi + x), br = vld1q_f32(qr + x), bi = vld1q_f32(qi + x);
+            const float32x4_t tr = vmlsq_f32(vmulq_f32(vwr, br), vwi, bi), ti = vmlaq_f32(vmulq_f32(vwr, bi), vwi, br);
+            vst1q_f32(qr + x, vsubq_f32(ar, tr));
+            vst1q_f32(qi + x, vsubq_f32(ai, ti));
+            vst1q_f32(pr + x, vaddq_f32(ar, tr));
+            vst1q_f32(pi + x, vaddq_f32(ai, ti));
+        }
+#endif
+        for (; x < m; ++x)
+        {
+            const float tr = wr * qr[x] - wi * qi[x], ti = wr * qi[x] + wi * qr[x];
+            qr[x] = pr[x] - tr;
+            qi[x] = pi[x] - ti;
+            pr[x] += tr;
+            pi[x] += ti;
+        }
+    }
+
+    /* FFT of length n down the columns of an n x m array, all m columns at once; bInverse: unscaled */
+    static void columns(float* re, float* im, int n, int m, const std::vector<float>& c, const std::vector<float>& s, const std::vector<int>& rev, bool bInverse)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            const int j = rev[i];
+            if (j > i)
+            {
+                std::swap_ranges(re + (size_t)i * m, re + (size_t)(i + 1) * m, re + (size_t)j * m);
+                std::swap_ranges(im + (size_t)i * m, im + (size_t)(i + 1) * m, im + (size_t)j * m);
+            }
+        }
+        for (int len = 2; len <= n; len <<= 1)
+        {
+            const int half = len / 2, step = n / len;
+            for (int g = 0; g < n; g += len)
+            {
+                for (int k = 0; k < half; ++k)
+                {
+                    const size_t p = (size_t)(g + k) * m, q = (size_t)(g + k + half) * m;
+                    butterfly(re + p, im + p, re + q, im + q, m, c[k * step], bInverse ? -s[k * step] : s[k * step]);
+                }
+            }
+        }
+    }
+
+    /* rows x cols to cols x rows, in blocks for the cache */
+    void transpose(std::vector<float>& v, int rows, int cols)
+    {
+        m_tmp.resize(v.size());
+        for (int y0 = 0; y0 < rows; y0 += 32)
+        {
+            for (int x0 = 0; x0 < cols; x0 += 32)
+            {
+                for (int y = y0; (y < y0 + 32) && (y < rows); ++y)
+                {
+                    for (int x = x0; (x < x0 + 32) && (x < cols); ++x)
+                        m_tmp[(size_t)x * rows + y] = v[(size_t)y * cols + x];
+                }
+            }
+        }
+        v.swap(m_tmp);
+    }
+
+    /* w x h of img at (x0, y0), box reduced by REG_SCALE, mean removed, windowed, zero padded; then down the columns,
+       transposed, down the columns again */
+    void forward(const Plan& p, const GreyImage& img, int x0, int y0, int w, int h, const std::vector<float>& winX, const std::vector<float>& winY, int k)
+    {
+        std::vector<float>& re = m_re[k];
+        std::vector<float>& im = m_im[k];
+        re.assign((size_t)p.nx * p.ny, 0.0f);
+        im.assign((size_t)p.nx * p.ny, 0.0f);
+        double sum = 0;
+        for (int y = 0; y < h; ++y)
+        {
+            float* d = &re[(size_t)y * p.nx];
+            for (int j = 0; j < REG_SCALE; ++j)
+            {
+                const unsigned char* s = &img.data[(size_t)(y0 + y * REG_SCALE + j) * img.width + x0];
+                for (int x = 0; x < w; ++x, s += REG_SCALE)
+                {
+                    for (int i = 0; i < REG_SCALE; ++i)
+                        d[x] += s[i];
+                }
+            }
+            for (int x = 0; x < w; ++x)
+                sum += d[x];
+        }
+        const float mean = (float)(sum / ((double)w * h));
+        for (int y = 0; y < h; ++y)
+        {
+            float* d = &re[(size_t)y * p.nx];
+            for (int x = 0; x < w; ++x)
+                d[x] = (d[x] - mean) * winX[x] * winY[y];
+        }
+        columns(&re[0], &im[0], p.ny, p.nx, p.cy, p.sy, p.revY, false);
+        transpose(re, p.ny, p.nx);
+        transpose(im, p.ny, p.nx);
+        columns(&re[0], &im[0], p.nx, p.ny, p.cx, p.sx, p.revX, false);
+    }
+
+    /* weight of the overlap of the windows of a and b at the shifts lag - radius .. lag + radius, along one axis */
+    static void overlap(const std::vector<float>& wa, const std::vector<float>& wb, int lag, int radius, std::vector<float>& ov)
+    {
+        ov.assign(2 * radius + 1, 0.0f);
+        for (int t = 0; t <= 2 * radius; ++t)
+        {
+            const int l = lag - radius + t, i0 = std::max(0, l), i1 = std::min((int)wa.size(), (int)wb.size() + l);
+            for (int i = i0; i < i1; ++i)
+                ov[t] += wa[i] * wb[i - l];
+        }
+    }
+
+    /* vertex of the parabola through (-1, l), (0, c), (1, r), in [-0.5, 0.5] */
+    static double vertex(double l, double c, double r)
+    {
+        const double den = l - 2 * c + r;
+        return (den < 0) ? std::max(-0.5, std::min(0.5, 0.5 * (l - r) / den)) : 0.0;
+    }
+    /* the inverse transform at shift (tx, ty) */
+    float at(const Plan& p, int tx, int ty) const
+    {
+        return m_re[0][(size_t)((ty + p.ny) & (p.ny - 1)) * p.nx + ((tx + p.nx) & (p.nx - 1))];
+    }
+
+    /* NCC +/- REG_REFINE around (cx, cy) at full resolution, a best on the edge of the window moves it (a few times at
+       most); the sub-pixel offset is the vertex of parabolas through the NCC around the best, not subsampled there:
+       every second column of an edge aligned on the grid would tilt them */
+    static RegResult refine(const GreyImage& a, const GreyImage& b, int cx, int cy)
+    {
+        RegResult ret = { cx, cy, -1.0, (double)cx, (double)cy };
+        double score[2 * REG_REFINE + 1][2 * REG_REFINE + 1], best = -2.0;
+        int ix = REG_REFINE, iy = REG_REFINE;
+        for (int pass = 0; pass < REG_SCALE; ++pass)
+        {
+            best = -2.0;
+            for (int j = 0; j <= 2 * REG_REFINE; ++j)
+            {
+                for (int i = 0; i <= 2 * REG_REFINE; ++i)
+                {
+                    score[j][i] = reg_ncc(a, b, cx + i - REG_REFINE, cy + j - REG_REFINE, 2, REG_MIN_OVERLAP * REG_SCALE * REG_SCALE);
+                    if (score[j][i] > best)
+                    {
+                        best = score[j][i];
+                        ix = i;
+                        iy = j;
+                    }
+                }
+            }
+            if ((best <= -1.0) || ((ix > 0) && (ix < 2 * REG_REFINE) && (iy > 0) && (iy < 2 * REG_REFINE)))
+                break;
+            cx += ix - REG_REFINE;
+            cy += iy - REG_REFINE;
+            ix = iy = REG_REFINE;
+        }
+        if (best <= -1.0)
+            return ret;
+        ret.dx = cx + ix - REG_REFINE;
+        ret.dy = cy + iy - REG_REFINE;
+        ret.score = best;
+        const int minOverlap = REG_MIN_OVERLAP * REG_SCALE * REG_SCALE;
+        const double c = reg_ncc(a, b, ret.dx, ret.dy, 1, minOverlap);
+        ret.fx = ret.dx + vertex(reg_ncc(a, b, ret.dx - 1, ret.dy, 1, minOverlap), c, reg_ncc(a, b, ret.dx + 1, ret.dy, 1, minOverlap));
+        ret.fy = ret.dy + vertex(reg_ncc(a, b, ret.dx, ret.dy - 1, 1, minOverlap), c, reg_ncc(a, b, ret.dx, ret.dy + 1, 1, minOverlap));
+        return ret;
+    }
+public:
+    size_t plans() const { return m_plan.size(); }
+
+    /*
+        the arguments and the result of reg_register_hint(): the phase correlation replaces its coarse search, on the
+        strip reduced by REG_SCALE, the refine +/- REG_REFINE at full resolution is the same, plus a parabola through
+        the NCC around the best position for the sub-pixel offset
+    */
+    RegResult reg(const GreyImage& a, const GreyImage& b, int hintX, int hintY, int radius)
+    {
+        RegResult ret = { hintX, hintY, -1.0, (double)hintX, (double)hintY };
+        int x0 = (hintX > 0) ? hintX : 0, y0 = (hintY > 0) ? hintY : 0;
+        const int x1 = (hintX + b.width < a.width) ? (hintX + b.width) : a.width, y1 = (hintY + b.height < a.height) ? (hintY + b.height) : a.height;
+        int w = (x1 - x0) / REG_SCALE, h = (y1 - y0) / REG_SCALE;
+        if ((w < 8) || (h < 8) || (w * h < REG_MIN_OVERLAP))
+            return ret;
+        if (w > REG_PHASE_MAX)
+        {
+            x0 += (w - REG_PHASE_MAX) / 2 * REG_SCALE;
+            w = REG_PHASE_MAX;
+        }
+        if (h > REG_PHASE_MAX)
+        {
+            y0 += (h - REG_PHASE_MAX) / 2 * REG_SCALE;
+            h = REG_PHASE_MAX;
+        }
+        /* both regions are the strip grown by the radius, as far as the tile goes, so that the overlap at any shift
+           within the radius is whole in both; b at (x, y) of its region over a at (x + lagX, y + lagY) of its own is
+           the hint */
+        const int cr = (radius + REG_SCALE - 1) / REG_SCALE, bx = x0 - hintX, by = y0 - hintY;
+        const int ax0 = std::min(cr, x0 / REG_SCALE), ay0 = std::min(cr, y0 / REG_SCALE);
+        const int bx0 = std::min(cr, bx / REG_SCALE), by0 = std::min(cr, by / REG_SCALE);
+        const int wa = ax0 + w + std::min(cr, (a.width - x0) / REG_SCALE - w), ha = ay0 + h + std::min(cr, (a.height - y0) / REG_SCALE - h);
+        const int wb = bx0 + w + std::min(cr, (b.width - bx) / REG_SCALE - w), hb = by0 + h + std::min(cr, (b.height - by) / REG_SCALE - h);
+        const int lagX = ax0 - bx0, lagY = ay0 - by0;
+        const Plan& p = plan(wa, ha, wb, hb, lagX, lagY, cr);
+        forward(p, a, x0 - ax0 * REG_SCALE, y0 - ay0 * REG_SCALE, wa, ha, p.winX, p.winY, 0);
+        forward(p, b, bx - bx0 * REG_SCALE, by - by0 * REG_SCALE, wb, hb, p.winBX, p.winBY, 1);
+
+        /* whitened cross power spectrum, layout transposed (nx rows of ny) */
+        const size_t n = (size_t)p.nx * p.ny;
+        float* ar = &m_re[0][0];
+        float* ai = &m_im[0][0];
+        const float* br = &m_re[1][0];
+        const float* bi = &m_im[1][0];
+        for (size_t i = 0; i < n; ++i)
+        {
+            const float r = ar[i] * br[i] + ai[i] * bi[i], im = ai[i] * br[i] - ar[i] * bi[i];
+            const float inv = 1.0f / (sqrtf(sqrtf(r * r + im * im)) + REG_PHASE_EPS);
+            ar[i] = r * inv;
+            ai[i] = im * inv;
+        }
+        columns(ar, ai, p.nx, p.ny, p.cx, p.sx, p.revX, true);
+        transpose(m_re[0], p.nx, p.ny);
+        transpose(m_im[0], p.nx, p.ny);
+        columns(&m_re[0][0], &m_im[0][0], p.ny, p.nx, p.cy, p.sy, p.revY, true);
+
+        /* the highest local maxima within the radius, the shifts wrap around; the correlation grows with the overlap,
+           so it is divided by that of the windows, or a repetitive texture gives the peak to the shift with the largest
+           overlap; and a tile with little texture may give it to a shadow or vignetting, so the best few are refined */
+        overlap(p.winX, p.winBX, lagX, cr, m_ovX);
+        overlap(p.winY, p.winBY, lagY, cr, m_ovY);
+        float peak[REG_PHASE_PEAKS];
+        int px[REG_PHASE_PEAKS], py[REG_PHASE_PEAKS], num = 0;
+        for (int ty = lagY - cr; ty <= lagY + cr; ++ty)
+        {
+            for (int tx = lagX - cr; tx <= lagX + cr; ++tx)
+            {
+                const float c = at(p, tx, ty), ov = m_ovX[tx - lagX + cr] * m_ovY[ty - lagY + cr];
+                if ((ov < REG_MIN_OVERLAP) || (c <= at(p, tx - 1, ty)) || (c <= at(p, tx + 1, ty)) || (c <= at(p, tx, ty - 1)) || (c <= at(p, tx, ty + 1)))
+                    continue;
+                const float v = c / ov;
+                int k = REG_PHASE_PEAKS - 1;
+                if (num < REG_PHASE_PEAKS)
+                    k = num++;
+                else if (v <= peak[k])
+                    continue;
+                for (; (k > 0) && (peak[k - 1] < v); --k)
+                {
+                    peak[k] = peak[k - 1];
+                    px[k] = px[k - 1];
+                    py[k] = py[k - 1];
+                }
+                peak[k] = v;
+                px[k] = tx;
+                py[k] = ty;
+            }
+        }
+        /* the peaks to full resolution (sub-pixel coarse peak); the highest and the best of the rest by the NCC
+           subsampled by REG_SCALE are refined: either alone fails, the highest on a repetitive texture, the NCC
+           subsampled on a fine one */
+        int candX[REG_PHASE_PEAKS], candY[REG_PHASE_PEAKS], other = -1;
+        double best = -2.0;
+        for (int k = 0; k < num; ++k)
+        {
+            const float c = at(p, px[k], py[k]);
+            const double vx = vertex(at(p, px[k] - 1, py[k]), c, at(p, px[k] + 1, py[k]));
+            const double vy = vertex(at(p, px[k], py[k] - 1), c, at(p, px[k], py[k] + 1));
+            candX[k] = hintX + (int)floor((px[k] - lagX + vx) * REG_SCALE + 0.5);
+            candY[k] = hintY + (int)floor((py[k] - lagY + vy) * REG_SCALE + 0.5);
+            const double s = reg_ncc(a, b, candX[k], candY[k], REG_SCALE, REG_MIN_OVERLAP * REG_SCALE * REG_SCALE);
+            if (s > best)
+            {
+                best = s;
+                other = k;
+            }
+        }
+        if (num > 0)
+            ret = refine(a, b, candX[0], candY[0]);
+        if (other > 0)
+        {
+            const RegResult r = refine(a, b, candX[other], candY[other]);
+            if (r.score > ret.score)
+                ret = r;
+        }
+        return ret;
+    }
+};
+
+#define REG_MIN_SCORE       0.3     /* a pair below is taken as failed */
+
+typedef struct {
+    int a, b;           /* tile indexes, b is right of or below a */
+    int hintX, hintY;
+    RegResult r;
+} TilePair;
+
+/* phase correlation, the search of reg_register_hint() where it scores below REG_MIN_SCORE */
+static inline RegResult reg_register_pair(RegPhase& phase, const GreyImage& a, const GreyImage& b, int hintX, int hintY, int radius)
+{
+    const RegResult r = phase.reg(a, b, hintX, hintY, radius);
+    return (r.score < REG_MIN_SCORE) ? reg_register_hint(a, b, hintX, hintY, radius) : r;
+}
+
+/* index of the tile at (row, col) of a rows x cols scan in acquisition order */
+static inline int reg_tile_index(int row, int col, int cols, bool bSerpentine)
+{
+    return row * cols + ((bSerpentine && (row & 1)) ? (cols - 1 - col) : col);
+}
+
+/* the horizontal and vertical neighbour pairs of the scan, hinted by the pitch, and the nominal tile positions */
+static inline void reg_grid_pairs(int rows, int cols, int pitchX, int pitchY, bool bSerpentine, std::vector<TilePair>& vecPair, std::vector<double>& nominalX, std::vector<double>& nominalY)
+{
+    vecPair.clear();
+    nominalX.resize(rows * cols);
+    nominalY.resize(rows * cols);
+    for (int r = 0; r < rows; ++r)
+    {
+        for (int c = 0; c < cols; ++c)
+        {
+            const int idx = reg_tile_index(r, c, cols, bSerpentine);
+            nominalX[idx] = c * pitchX;
+            nominalY[idx] = r * pitchY;
+            if (c + 1 < cols)
+            {
+                TilePair p = { idx, reg_tile_index(r, c + 1, cols, bSerpentine), pitchX, 0 };
+                vecPair.push_back(p);
+            }
+            if (r + 1 < rows)
+            {
+                TilePair p = { idx, reg_tile_index(r + 1, c, cols, bSerpentine), 0, pitchY };
+                vecPair.push_back(p);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef __tiffwriter_H__
+#define __tiffwriter_H__
+
+/*
+    Streaming writer for a tiled, pyramidal BigTIFF (RGB, 8 bits per sample).
+    Level 0 is read from the TileCanvas tile by tile, every further level is a 2x2 box downscale of the previous one,
+    kept in its own out-of-core canvas, until the image fits in one tile. The tiles of one tile row are compressed in
+    parallel and written in order; each level is one IFD (NewSubfileType = 1 for the reduced levels), chained from
+    the full resolution.
+    compression: TIFF_COMPRESSION_NONE, TIFF_COMPRESSION_PACKBITS, or TIFF_COMPRESSION_DEFLATE when built with
+    -DGRIDSTITCH_ZLIB (and -lz).
+*/
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "tilecanvas.h"
+#if defined(GRIDSTITCH_ZLIB)
+#include <zlib.h>
+#endif
+
+#define TIFF_COMPRESSION_NONE       1
+#define TIFF_COMPRESSION_DEFLATE    8
+#define TIFF_COMPRESSION_PACKBITS   32773
+
+/* TIFF rule for PackBits: every row is packed on its own */
+static inline void tiff_packbits_row(const unsigned char* p, int n, std::vector<unsigned char>& out)
+{
+    int i = 0;
+    while (i < n)
+    {
+        int run = 1;
+        while ((i + run < n) && (run < 128) && (p[i + run] == p[i]))
+            ++run;
+        if (run >= 2)
+        {
+            out.push_back((unsigned char)(1 - run));
+            out.push_back(p[i]);
+            i += run;
+        }
+        else
+        {
+            int lit = 1;
+            while ((i + lit < n) && (lit < 128) && !((i + lit + 1 < n) && (p[i + lit] == p[i + lit + 1])))
+                ++lit;
+            out.push_back((unsigned char)(lit - 1));
+            out.insert(out.end(), p + i, p + i + lit);
+            i += lit;
+        }
+    }
+}
+
+static inline void tiff_compress_tile(const std::vector<unsigned char>& rgb, int compression, std::vector<unsigned char>& out)
+{
+    out.clear();
+    if (TIFF_COMPRESSION_PACKBITS == compression)
+    {
+        for (int y = 0; y < CANVAS_TILE; ++y)
+            tiff_packbits_row(&rgb[(size_t)y * CANVAS_TILE * 3], CANVAS_TILE * 3, out);
+    }
+#if defined(GRIDSTITCH_ZLIB)
+    else if (TIFF_COMPRESSION_DEFLATE == compression)
+    {
+        uLongf len = compressBound((uLong)rgb.size());
+        out.resize(len);
+        if (Z_OK == compress2(&out[0], &len, &rgb[0], (uLong)rgb.size(), 6))
+            out.resize(len);
+        else
+            out.clear();
+    }
+#endif
+    else
+        out = rgb;
+}
+
+class TiffWriter {
+    FILE* m_fp;
+    unsigned long long m_nextIfdPos;    /* where the offset of the next IFD has to be patched in */
+
+    void put16(unsigned short v) { fwrite(&v, 1, 2, m_fp); }
+    void put64(unsigned long long v) { fwrite(&v, 1, 8, m_fp); }
+    unsigned long long tell() { fflush(m_fp); return (unsigned long long)canvas_ftell(m_fp); }
+    void entry(unsigned short tag, unsigned short type, unsigned long long count, unsigned long long value)
+    {
+        put16(tag);
+        put16(type);
+        put64(count);
+        put64(value);
+    }
+
+    /* the canvases are little endian BGRW, TIFF wants RGB */
+    static void tile_rgb(TileCanvas& canvas, int tx, int ty, std::vector<unsigned char>& rgb)
+    {
+        const unsigned char* s = canvas.tile(tx, ty, false);
+        rgb.resize((size_t)CANVAS_TILE * CANVAS_TILE * 3);
+        for (size_t i = 0; i < (size_t)CANVAS_TILE * CANVAS_TILE; ++i, s += 4)
+        {
+            rgb[i * 3] = s[2];
+            rgb[i * 3 + 1] = s[1];
+            rgb[i * 3 + 2] = s[0];
+        }
+    }
+
+    bool writeLevel(TileCanvas& canvas, int level, int compression, unsigned threads)
+    {
+        const int num = canvas.tilesX() * canvas.tilesY();
+        std::vector<unsigned long long> vecOffset(num), vecCount(num);
+        std::vector<std::vector<unsigned char> > vecRgb(canvas.tilesX()), vecOut(canvas.tilesX());
+        for (int ty = 0; ty < canvas.tilesY(); ++ty)
+        {
+            /* the canvas is not thread safe: fetch the row first, compress in parallel, write in order */
+            for (int tx = 0; tx < canvas.tilesX(); ++tx)
+                tile_rgb(canvas, tx, ty, vecRgb[tx]);
+            std::atomic<int> next(0);
+            std::vector<std::thread> vecThread;
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                vecThread.push_back(std::thread([&]()
+                {
+                    int tx;
+                    while ((tx = next++) < canvas.tilesX())
+                        tiff_compress_tile(vecRgb[tx], compression, vecOut[tx]);
+                }));
+            }
+            for (size_t i = 0; i < vecThread.size(); ++i)
+                vecThread[i].join();
+            for (int tx = 0; tx < canvas.tilesX(); ++tx)
+            {
+                if (vecOut[tx].empty())
+                    return false;
+                vecOffset[ty * canvas.tilesX() + tx] = tell();
+                vecCount[ty * canvas.tilesX() + tx] = vecOut[tx].size();
+                fwrite(&vecOut[tx][0], 1, vecOut[tx].size(), m_fp);
+            }
+        }
+
+        const unsigned long long offsetPos = tell();
+        fwrite(&vecOffset[0], 8, num, m_fp);
+        const unsigned long long countPos = tell();
+        fwrite(&vecCount[0], 8, num, m_fp);
+        if (tell() & 1)
+            fputc(0, m_fp);
+
+        const unsigned long long ifd = tell();
+        canvas_fseek(m_fp, (long long)m_nextIfdPos, SEEK_SET);
+        put64(ifd);
+        canvas_fseek(m_fp, (long long)ifd, SEEK_SET);
+        /* entries must be sorted by tag */
+        put64(13);
+        entry(254, 4, 1, level ? 1 : 0);                                                    /* NewSubfileType */
+        entry(256, 4, 1, canvas.width());                                                   /* ImageWidth */
+        entry(257, 4, 1, canvas.height());                                                  /* ImageLength */
+        entry(258, 3, 3, 8ull | (8ull << 16) | (8ull << 32));                               /* BitsPerSample */
+        entry(259, 3, 1, compression);                                                      /* Compression */
+        entry(262, 3, 1, 2);                                                                /* PhotometricInterpretation: RGB */
+        entry(277, 3, 1, 3);                                                                /* SamplesPerPixel */
+        entry(284, 3, 1, 1);                                                                /* PlanarConfiguration: chunky */
+        entry(322, 3, 1, CANVAS_TILE);                                                      /* TileWidth */
+        entry(323, 3, 1, CANVAS_TILE);                                                      /* TileLength */
+        entry(324, 16, num, (1 == num) ? vecOffset[0] : offsetPos);                         /* TileOffsets, LONG8 */
+        entry(325, 16, num, (1 == num) ? vecCount[0] : countPos);                           /* TileByteCounts, LONG8 */
+        entry(339, 3, 3, 1ull | (1ull << 16) | (1ull << 32));                               /* SampleFormat: unsigned */
+        m_nextIfdPos = tell();
+        put64(0);
+        return true;
+    }
+public:
+    TiffWriter()
+    : m_fp(NULL), m_nextIfdPos(8)
+    {
+    }
+    ~TiffWriter()
+    {
+        if (m_fp)
+            fclose(m_fp);
+    }
+
+    bool write(const char* filename, TileCanvas& canvas, int compression, unsigned threads, size_t budget)
+    {
+        m_fp = fopen(filename, "w+b");
+        if (NULL == m_fp)
+            return false;
+        /* BigTIFF header: II, 43, bytesize of offsets 8, 0, offset of the first IFD (patched) */
+        fwrite("II", 1, 2, m_fp);
+        put16(43);
+        put16(8);
+        put16(0);
+        m_nextIfdPos = 8;
+        put64(0);
+
+        if (!writeLevel(canvas, 0, compression, threads))
+            return false;
+        TileCanvas* prev = &canvas;
+        bool ret = true;
+        for (int level = 1; ret && ((prev->tilesX() > 1) || (prev->tilesY() > 1)); ++level)
+        {
+            char name[32];
+            sprintf(name, ".level%d", level);
+            TileCanvas* cur = new TileCanvas((prev->width() + 1) / 2, (prev->height() + 1) / 2, budget, (std::string(filename) + name).c_str());
+            ret = cur->valid();
+            for (int ty = 0; ret && (ty < cur->tilesY()); ++ty)
+            {
+                for (int tx = 0; tx < cur->tilesX(); ++tx)
+                {
+                    /* each output tile is the 2x2 box average of four input tiles */
+                    for (int q = 0; q < 4; ++q)
+                    {
+                        const int sx = tx * 2 + (q & 1), sy = ty * 2 + (q >> 1);
+                        if ((sx >= prev->tilesX()) || (sy >= prev->tilesY()))
+                            continue;
+                        const unsigned char* s = prev->tile(sx, sy, false);
+                        unsigned char* d = cur->tile(tx, ty, true) + ((q >> 1) * (CANVAS_TILE / 2) * CANVAS_TILE + (q & 1) * (CANVAS_TILE / 2)) * 4;
+                        for (int y = 0; y < CANVAS_TILE / 2; ++y)
+                        {
+                            const unsigned char* s0 = s + (size_t)(2 * y) * CANVAS_TILE * 4;
+                            const unsigned char* s1 = s0 + CANVAS_TILE * 4;
+                            unsigned char* o = d + (size_t)y * CANVAS_TILE * 4;
+                            for (int x = 0; x < CANVAS_TILE / 2; ++x, s0 += 8, s1 += 8, o += 4)
+                            {
+                                for (int c = 0; c < 4; ++c)
+                                    o[c] = (unsigned char)((s0[c] + s0[c + 4] + s1[c] + s1[c + 4] + 2) >> 2);
+                            }
+                        }
+                    }
+                }
+            }
+            if (ret)
+                ret = writeLevel(*cur, level, compression, threads);
+            if (prev != &canvas)
+                delete prev;
+            prev = cur;
+        }
+        if (prev != &canvas)
+            delete prev;
+        fclose(m_fp);
+        m_fp = NULL;
+        return ret;
+    }
+};
+
+#endif
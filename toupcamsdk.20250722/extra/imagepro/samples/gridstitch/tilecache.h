@@ -0,0 +1,53 @@
+#ifndef __tilecache_H__
+#define __tilecache_H__
+
+/*
+    The decoded source tiles shared by the jobs of one pass (the neighbour pairs of the registration or of the seams).
+    A tile is decoded by the first job which needs it, the other jobs wait for that one, and it is released after the
+    last of the jobs which use it: refs, the number of jobs of every tile, is given to the constructor and every job
+    calls release() once per tile it used. So each tile is decoded once a pass, and with the pairs in scan order only
+    the tiles of the jobs in flight, about one row of the scan, are in memory.
+*/
+#include <vector>
+#include <mutex>
+
+template <typename T>
+class TileCache {
+    struct Entry {
+        std::mutex mtx;
+        int state;          /* 0: not decoded yet, 1: decoded, -1: failed */
+        unsigned refs;      /* the jobs still to release it */
+        T data;
+        Entry() : state(0), refs(0) {}
+    };
+    std::vector<Entry> m_entry;
+public:
+    explicit TileCache(const std::vector<unsigned>& refs)
+    : m_entry(refs.size())
+    {
+        for (size_t i = 0; i < refs.size(); ++i)
+            m_entry[i].refs = refs[i];
+    }
+
+    /* the tile, decoded by load(index, data) -> bool on the first call; NULL when that failed */
+    template <typename LOADER>
+    const T* get(int index, const LOADER& load)
+    {
+        Entry& e = m_entry[index];
+        std::lock_guard<std::mutex> lock(e.mtx);
+        if (0 == e.state)
+            e.state = load(index, e.data) ? 1 : -1;
+        return (e.state > 0) ? &e.data : NULL;
+    }
+
+    /* one job is done with the tile, whether get() succeeded or not */
+    void release(int index)
+    {
+        Entry& e = m_entry[index];
+        std::lock_guard<std::mutex> lock(e.mtx);
+        if (e.refs && (0 == --e.refs))
+            e.data = T();
+    }
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef __tilecanvas_H__
+#define __tilecanvas_H__
+
+/*
+    Out-of-core mosaic canvas.
+    The canvas is cut into CANVAS_TILE x CANVAS_TILE tiles of BGRW pixels (BGR and the blend weight, capped at 255,
+    0 where the mosaic has no content; the blending is in blender.h). Only as many tiles as fit in the memory budget are resident, the least recently used tile is
+    written back to a backing file when another one is needed. A tile which has never been written reads as empty,
+    so the backing file only grows where the mosaic has content.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define canvas_fseek    _fseeki64
+#define canvas_ftell    _ftelli64
+#else
+#define canvas_fseek    fseeko
+#define canvas_ftell    ftello
+#endif
+
+#define CANVAS_TILE         512
+#define CANVAS_TILE_BYTES   ((size_t)CANVAS_TILE * CANVAS_TILE * 4)
+
+class TileCanvas {
+    struct Slot {
+        int tile;
+        bool dirty;
+        std::vector<unsigned char> data;
+    };
+    const int m_width, m_height, m_tilesX, m_tilesY;
+    size_t m_maxResident;
+    std::list<Slot> m_lru;  /* front is the most recently used */
+    std::map<int, std::list<Slot>::iterator> m_map;
+    FILE* m_fp;
+    std::string m_file;
+    unsigned long long m_readCount, m_writeCount;
+
+    void writeBack(Slot& s)
+    {
+        if (s.dirty && m_fp)
+        {
+            canvas_fseek(m_fp, (long long)s.tile * CANVAS_TILE_BYTES, SEEK_SET);
+            fwrite(&s.data[0], 1, CANVAS_TILE_BYTES, m_fp);
+            ++m_writeCount;
+        }
+        s.dirty = false;
+    }
+public:
+    /* budget: bytes of resident tiles, backingFile: created (truncated) and removed again by the destructor */
+    TileCanvas(int width, int height, size_t budget, const char* backingFile)
+    : m_width(width), m_height(height), m_tilesX((width + CANVAS_TILE - 1) / CANVAS_TILE), m_tilesY((height + CANVAS_TILE - 1) / CANVAS_TILE)
+    , m_maxResident(budget / CANVAS_TILE_BYTES), m_fp(NULL), m_file(backingFile), m_readCount(0), m_writeCount(0)
+    {
+        if (m_maxResident < 4)
+            m_maxResident = 4;
+        m_fp = fopen(backingFile, "w+b");
+    }
+    ~TileCanvas()
+    {
+        if (m_fp)
+        {
+            fclose(m_fp);
+            remove(m_file.c_str());
+        }
+    }
+    bool valid() const { return (NULL != m_fp); }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int tilesX() const { return m_tilesX; }
+    int tilesY() const { return m_tilesY; }
+    unsigned long long readCount() const { return m_readCount; }
+    unsigned long long writeCount() const { return m_writeCount; }
+
+    /* BGRW pixels of the tile, row stride CANVAS_TILE * 4; valid until the next call */
+    unsigned char* tile(int tx, int ty, bool bWrite)
+    {
+        const int idx = ty * m_tilesX + tx;
+        std::map<int, std::list<Slot>::iterator>::iterator it = m_map.find(idx);
+        if (it != m_map.end())
+        {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+        }
+        else
+        {
+            if (m_lru.size() >= m_maxResident)
+            {
+                /* recycle the buffer of the least recently used tile */
+                writeBack(m_lru.back());
+                m_map.erase(m_lru.back().tile);
+                m_lru.splice(m_lru.begin(), m_lru, --m_lru.end());
+            }
+            else
+                m_lru.push_front(Slot());
+            Slot& s = m_lru.front();
+            s.tile = idx;
+            s.dirty = false;
+            s.data.resize(CANVAS_TILE_BYTES);
+            size_t n = 0;
+            if (0 == canvas_fseek(m_fp, (long long)idx * CANVAS_TILE_BYTES, SEEK_SET))
+                n = fread(&s.data[0], 1, CANVAS_TILE_BYTES, m_fp);
+            if (n < CANVAS_TILE_BYTES)
+                memset(&s.data[n], 0, CANVAS_TILE_BYTES - n);
+            else
+                ++m_readCount;
+            m_map[idx] = m_lru.begin();
+        }
+        if (bWrite)
+            m_lru.front().dirty = true;
+        return &m_lru.front().data[0];
+    }
+
+    /* BGR24 of one canvas row, w pixels from x */
+    void readRow(int x, int y, int w, unsigned char* pOut)
+    {
+        const int ty = y / CANVAS_TILE;
+        for (int cx = x; cx < x + w;)
+        {
+            const int tx = cx / CANVAS_TILE, n = ((tx + 1) * CANVAS_TILE < x + w) ? ((tx + 1) * CANVAS_TILE - cx) : (x + w - cx);
+            const unsigned char* s = tile(tx, ty, false) + ((size_t)(y - ty * CANVAS_TILE) * CANVAS_TILE + (cx - tx * CANVAS_TILE)) * 4;
+            for (int i = 0; i < n; ++i, s += 4, pOut += 3)
+            {
+                pOut[0] = s[0];
+                pOut[1] = s[1];
+                pOut[2] = s[2];
+            }
+            cx += n;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __zstackgrid_H__
+#define __zstackgrid_H__
+
+/*
+    Z stack x tile pipeline: every tile of an area scan is a Z stack, fused by extended depth of field and handed in
+    memory to the grid registration, so a 3D scan gives the fused mosaic without a stack or a fused tile on disk.
+    The planes of a tile are added in Z order (addPlane), then endTile(): the stack is collapsed to the fused tile
+    and queued to the registration thread, which registers it against its neighbours fused before (whichever of
+    left, right, above, below came first in the acquisition order), while the caller adds the planes of the next tile:
+    the EDF of tile N + 1 overlaps the registration of tile N. finish() waits for the last registrations.
+    The fusion is the pyramid engine of liveedf (edfpyr.h, the maximum rule of eImageproEdfM_Pyr_Max) on threads
+    workers; only the accumulated pyramid of the current tile is kept, whatever the depth of the stack. The fused tiles
+    stay in memory (BGR24, top-down, rows of TDIBWIDTHBYTES) for the blending, one plane per stack; their grey images
+    only until the pairs of the tile are registered.
+    The planes come from one thread (the acquisition), tile() and pairs() are for after finish().
+*/
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include "stitchreg.h"
+#include "../../qt/liveedf/edfpyr.h"
+
+class ZStackGrid {
+    const int m_radius;
+    const unsigned m_threads;
+    int m_width, m_height;              /* of the tiles, from the first plane */
+    std::vector<TilePair> m_vecPair;
+    std::vector<double> m_nominalX, m_nominalY;
+    std::vector<std::vector<int> > m_pairOf;            /* pairs of every tile */
+    std::vector<std::vector<unsigned char> > m_tile;    /* fused; empty: not (yet) */
+    std::vector<GreyImage> m_grey;
+    std::vector<int> m_pending;         /* pairs of every tile not registered yet */
+    std::vector<char> m_fused;          /* set by the registration thread when it takes the tile */
+    std::unique_ptr<EdfPyramid> m_pyr;
+    int m_cur;                          /* tile of the planes added, in acquisition order */
+    bool m_bBad;                        /* a plane of the current tile was rejected */
+    std::deque<int> m_queue;            /* fused tiles to register, -1: no more */
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+    unsigned m_failed;
+
+    static int stride(int width) { return ((width * 24) + 31) / 32 * 4; }
+
+    void registrar()
+    {
+        RegPhase phase;
+        for (;;)
+        {
+            int k;
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cv.wait(lock, [&] { return !m_queue.empty(); });
+                k = m_queue.front();
+                m_queue.pop_front();
+            }
+            if (k < 0)
+                return;
+            if (!m_tile[k].empty())
+                reg_grey_from_rgb24(&m_tile[k][0], m_width, m_height, stride(m_width), &m_grey[k]);
+            m_fused[k] = 1;
+            for (size_t i = 0; i < m_pairOf[k].size(); ++i)
+            {
+                TilePair& p = m_vecPair[m_pairOf[k][i]];
+                const int other = (p.a == k) ? p.b : p.a;
+                if (!m_fused[other])
+                    continue;   /* registered when that one comes */
+                if (!m_grey[p.a].data.empty() && !m_grey[p.b].data.empty())
+                    p.r = reg_register_pair(phase, m_grey[p.a], m_grey[p.b], p.hintX, p.hintY, m_radius);
+                if (0 == --m_pending[other])
+                    std::vector<unsigned char>().swap(m_grey[other].data);
+                --m_pending[k];
+            }
+            if (0 == m_pending[k])
+                std::vector<unsigned char>().swap(m_grey[k].data);
+        }
+    }
+
+    void push(int k)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_queue.push_back(k);
+        }
+        m_cv.notify_one();
+    }
+public:
+    /* the scan as in gridstitch grid; threads: of the EDF engine, 0: one per core */
+    ZStackGrid(int rows, int cols, int pitchX, int pitchY, int radius, bool bSerpentine, unsigned threads)
+    : m_radius(radius), m_threads(threads), m_width(0), m_height(0), m_cur(0), m_bBad(false), m_failed(0)
+    {
+        reg_grid_pairs(rows, cols, pitchX, pitchY, bSerpentine, m_vecPair, m_nominalX, m_nominalY);
+        const int num = rows * cols;
+        m_pairOf.resize(num);
+        m_tile.resize(num);
+        m_grey.resize(num);
+        m_pending.resize(num, 0);
+        m_fused.resize(num, 0);
+        for (size_t i = 0; i < m_vecPair.size(); ++i)
+        {
+            m_vecPair[i].r.score = -1.0;
+            m_pairOf[m_vecPair[i].a].push_back((int)i);
+            m_pairOf[m_vecPair[i].b].push_back((int)i);
+            ++m_pending[m_vecPair[i].a];
+            ++m_pending[m_vecPair[i].b];
+        }
+        m_thread = std::thread(&ZStackGrid::registrar, this);
+    }
+    ~ZStackGrid()
+    {
+        finish();
+    }
+
+    /* the next plane of the current tile, BGR24 top-down; false when its size is not that of the first plane of the scan
+       (or the engine is out of memory), the tile is then left out */
+    bool addPlane(const unsigned char* data, int width, int height, int stride)
+    {
+        if ((m_cur >= (int)m_tile.size()) || m_bBad)
+            return false;
+        if (!m_pyr)
+        {
+            m_width = width;
+            m_height = height;
+            m_pyr.reset(new EdfPyramid(width, height, m_threads, 0));
+        }
+        if ((width != m_width) || (height != m_height) || !m_pyr->valid())
+        {
+            m_bBad = true;
+            return false;
+        }
+        m_pyr->add(data, stride);
+        return true;
+    }
+
+    /* the stack of the current tile is complete: fused and queued to the registration, the next planes are of the next
+       tile; bOk = false leaves the tile out (a plane failed), its pairs follow the nominal pitch */
+    void endTile(bool bOk = true)
+    {
+        if (m_cur >= (int)m_tile.size())
+            return;
+        if (bOk && !m_bBad && m_pyr && m_pyr->planes())
+        {
+            m_tile[m_cur].resize((size_t)stride(m_width) * m_height);
+            m_pyr->readdata(&m_tile[m_cur][0], stride(m_width));
+        }
+        else
+            ++m_failed;
+        if (m_pyr)
+            m_pyr->reset();
+        m_bBad = false;
+        push(m_cur++);
+    }
+
+    /* the tiles not ended are left out; waits for the registration thread */
+    void finish()
+    {
+        if (!m_thread.joinable())
+            return;
+        while (m_cur < (int)m_tile.size())
+            endTile(false);
+        push(-1);
+        m_thread.join();
+        m_pyr.reset();
+    }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int tiles() const { return (int)m_tile.size(); }
+    int current() const { return m_cur; }
+    unsigned failed() const { return m_failed; }
+    const std::vector<TilePair>& pairs() const { return m_vecPair; }
+    const std::vector<double>& nominalX() const { return m_nominalX; }
+    const std::vector<double>& nominalY() const { return m_nominalY; }
+    /* the fused tile, empty when left out */
+    const std::vector<unsigned char>& tile(int index) const { return m_tile[index]; }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "hdrmerge.h"
+
+/*
+    Live HDR from the dual conversion gain readout of the cameras with TOUPCAM_FLAG_CGHDR.
+    usage: hdrmerge [tonemap strength = 8]
+    The camera is put in RAW mode with the deepest HDRxxHL pixel format it supports. The two conversion gains of an
+    exposure come as two consecutive frames, TOUPCAM_FRAMEINFO_FLAG_CG set on the high gain one; every such pair is
+    merged by HdrMerge (hdrmerge.h) with the K, B and threshold of the camera into a linear 16 bits RAW frame.
+    Press ENTER to save the next merged frame (hdrmerge_WxH_n.raw, 16 bits, and the tone mapped hdrmerge_WxH_n_8.raw).
+*/
+HToupcam g_hcam = NULL;
+int g_width = 0, g_height = 0;
+unsigned g_bitdepth = 12;
+int g_strength = 8;
+std::vector<unsigned char> g_buf[3];    /* pull, high, low */
+ToupcamFrameInfoV4 g_infoHigh, g_infoLow;
+bool g_bHigh = false, g_bLow = false;
+std::vector<unsigned short> g_merged;
+std::vector<unsigned char> g_tonemapped;
+HdrMerge* g_pMerge = NULL;
+unsigned g_pairs = 0, g_unpaired = 0, g_saved = 0;
+double g_mergeMs = 0.0;
+std::atomic<bool> g_bSave(false);
+
+static unsigned HdrBitDepth(int pixelFormat)
+{
+    switch (pixelFormat)
+    {
+    case TOUPCAM_PIXELFORMAT_HDR8HL: return 8;
+    case TOUPCAM_PIXELFORMAT_HDR10HL: return 10;
+    case TOUPCAM_PIXELFORMAT_HDR11HL: return 11;
+    case TOUPCAM_PIXELFORMAT_HDR12HL: return 12;
+    case TOUPCAM_PIXELFORMAT_HDR14HL: return 14;
+    default: return 0;
+    }
+}
+
+static void SaveRaw(const char* filename, const void* pData, size_t length)
+{
+    FILE* fp = fopen(filename, "wb");
+    if (fp)
+    {
+        fwrite(pData, 1, length, fp);
+        fclose(fp);
+    }
+}
+
+static void MergePair()
+{
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if (g_bitdepth > 8)
+        g_pMerge->merge((const unsigned short*)&g_buf[1][0], (const unsigned short*)&g_buf[2][0], g_width, g_height, g_width, &g_merged[0], g_width);
+    else
+        g_pMerge->merge(&g_buf[1][0], &g_buf[2][0], g_width, g_height, g_width, &g_merged[0], g_width);
+    g_mergeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    ++g_pairs;
+
+    if (g_bSave.exchange(false))
+    {
+        char filename[1024];
+        sprintf(filename, "hdrmerge_%dx%d_%u.raw", g_width, g_height, ++g_saved);
+        SaveRaw(filename, &g_merged[0], g_merged.size() * sizeof(unsigned short));
+        g_pMerge->tonemap(&g_merged[0], g_width, g_height, g_width, &g_tonemapped[0], g_width, g_strength);
+        sprintf(filename, "hdrmerge_%dx%d_%u_8.raw", g_width, g_height, g_saved);
+        SaveRaw(filename, &g_tonemapped[0], g_tonemapped.size());
+        printf("saved pair seq %u/%u: %s\n", g_infoHigh.v3.seq, g_infoLow.v3.seq, filename);
+    }
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, &g_buf[0][0], 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            /* keep the latest frame of each gain, merge when they are the two halves of one exposure */
+            if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_CG)
+            {
+                g_buf[0].swap(g_buf[1]);
+                g_infoHigh = info;
+                g_bHigh = true;
+            }
+            else
+            {
+                g_buf[0].swap(g_buf[2]);
+                g_infoLow = info;
+                g_bLow = true;
+            }
+            if (g_bHigh && g_bLow)
+            {
+                const unsigned d = (g_infoHigh.v3.seq > g_infoLow.v3.seq) ? (g_infoHigh.v3.seq - g_infoLow.v3.seq) : (g_infoLow.v3.seq - g_infoHigh.v3.seq);
+                if (1 == d)
+                {
+                    MergePair();
+                    g_bHigh = g_bLow = false;
+                }
+                else
+                    ++g_unpaired;
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+        g_strength = atoi(argv[1]);
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int pixelFormat = -1, n = 0;
+    if (SUCCEEDED(Toupcam_get_PixelFormatSupport(g_hcam, -1, &n)))
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            int fmt = 0;
+            if (SUCCEEDED(Toupcam_get_PixelFormatSupport(g_hcam, (char)i, &fmt)) && (HdrBitDepth(fmt) > ((pixelFormat < 0) ? 0 : HdrBitDepth(pixelFormat))))
+                pixelFormat = fmt;
+        }
+    }
+    HRESULT hr;
+    if (pixelFormat < 0)
+        printf("camera does not support the HDRxxHL pixel formats\n");
+    else if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1)) || FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_PIXEL_FORMAT, pixelFormat)))
+        printf("failed to set %s, hr = 0x%08x\n", Toupcam_get_PixelFormatName(pixelFormat), hr);
+    else if (FAILED(hr = Toupcam_get_FinalSize(g_hcam, &g_width, &g_height)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_bitdepth = HdrBitDepth(pixelFormat);
+        int kb = 0, threshold = 0;
+        Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_HDR_KB, &kb);
+        Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_HDR_THRESHOLD, &threshold);
+        const unsigned k = ((unsigned)kb >> 16) & 0xffff, b = (unsigned)kb & 0xffff;
+        printf("%s, %d x %d, K = %u, B = %u, threshold = %d\n", Toupcam_get_PixelFormatName(pixelFormat), g_width, g_height, k, b, threshold);
+        g_pMerge = new HdrMerge(g_bitdepth, k, b, (unsigned)threshold, 0);
+
+        const size_t frameBytes = (size_t)g_width * g_height * ((g_bitdepth > 8) ? 2 : 1);
+        for (int i = 0; i < 3; ++i)
+            g_buf[i].resize(frameBytes);
+        g_merged.resize((size_t)g_width * g_height);
+        g_tonemapped.resize((size_t)g_width * g_height);
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("press ENTER to save the next merged frame, 'x' to exit\n");
+            do {
+                char str[1024];
+                if (fgets(str, 1023, stdin))
+                {
+                    if (('x' == str[0]) || ('X' == str[0]))
+                        break;
+                    g_bSave = true;
+                }
+            } while (true);
+            Toupcam_Stop(g_hcam);
+            printf("pairs = %u, unpaired = %u, merge = %.2f ms per pair\n", g_pairs, g_unpaired, g_pairs ? (g_mergeMs / g_pairs) : 0.0);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    delete g_pMerge;
+    return 0;
+}
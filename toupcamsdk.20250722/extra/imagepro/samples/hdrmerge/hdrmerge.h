@@ -0,0 +1,118 @@
+#ifndef __hdrmerge_H__
+#define __hdrmerge_H__
+
+/*
+    Merge of the high and the low conversion gain readouts of one exposure (TOUPCAM_PIXELFORMAT_HDR8HL .. HDR14HL)
+    into one linear 16 bits image, with the same model as the HDR synthesis of the camera
+    (TOUPCAM_OPTION_HDR_KB, TOUPCAM_OPTION_HDR_THRESHOLD):
+        below the threshold T the high gain sample H is used as is,
+        above it the low gain sample L, brought to the high gain scale: L * K / 100 + B,
+    and in between, over the HDR_BLEND samples below T, the two are cross faded, so a gain mismatch does not show as
+    a contour. The result is scaled so the brightest value of the low gain, (2^bitdepth - 1) * K / 100 + B, is 65535.
+    The merge is per sample and does not care about the CFA, a RAW mosaic stays a mosaic (demosaic it afterwards).
+    tonemap() maps the linear result to 8 bits by a global logarithmic curve for the display.
+    The inner loops are branch free float arithmetic written for the auto vectorizer (SSE/AVX, NEON at -O2 -ftree-vectorize
+    or -O3), the rows are split over threads worker threads (0: one per core).
+*/
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#define HDR_K_DEF       1600    /* 16x, the usual ratio of the two conversion gains */
+#define HDR_BLEND       256     /* width of the cross fade below the threshold, in samples of the high gain */
+
+class HdrMerge {
+    unsigned m_bitdepth, m_threads;
+    float m_k, m_b, m_t0, m_invBlend, m_scale;
+    std::vector<unsigned char> m_tonemap;
+    int m_tonemapStrength;
+
+    template <typename F> void parallel_rows(int h, F f) const
+    {
+        const unsigned n = std::min<unsigned>(m_threads, (unsigned)(h + 15) / 16);
+        if (n <= 1)
+            f(0, h);
+        else
+        {
+            std::vector<std::thread> vecThread;
+            for (unsigned t = 0; t < n; ++t)
+                vecThread.push_back(std::thread(f, (int)(h * t / n), (int)(h * (t + 1) / n)));
+            for (size_t i = 0; i < vecThread.size(); ++i)
+                vecThread[i].join();
+        }
+    }
+
+    template <typename T> void merge_row(const T* pH, const T* pL, unsigned short* pOut, int width) const
+    {
+        const float k = m_k, b = m_b, t0 = m_t0, invBlend = m_invBlend, scale = m_scale;
+        for (int x = 0; x < width; ++x)
+        {
+            const float hf = pH[x], lf = pL[x] * k + b;
+            float w = (hf - t0) * invBlend;
+            w = (w < 0.0f) ? 0.0f : ((w > 1.0f) ? 1.0f : w);
+            pOut[x] = (unsigned short)((hf + (lf - hf) * w) * scale + 0.5f);
+        }
+    }
+public:
+    /* K and B as TOUPCAM_OPTION_HDR_KB (K in 1/100), threshold as TOUPCAM_OPTION_HDR_THRESHOLD, in samples of bitdepth */
+    HdrMerge(unsigned bitdepth, unsigned k, unsigned b, unsigned threshold, unsigned threads)
+    : m_bitdepth(bitdepth), m_threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())), m_tonemapStrength(0)
+    {
+        setkb(k, b, threshold);
+    }
+
+    void setkb(unsigned k, unsigned b, unsigned threshold)
+    {
+        const float maxval = (float)((1u << m_bitdepth) - 1);
+        if (0 == k)
+            k = HDR_K_DEF;
+        if ((0 == threshold) || (threshold > maxval))
+            threshold = (unsigned)maxval;
+        m_k = k / 100.0f;
+        m_b = (float)b;
+        const float blend = std::min<float>((float)HDR_BLEND * maxval / 4095.0f, (float)threshold);
+        m_t0 = threshold - blend;
+        m_invBlend = (blend > 0) ? (1.0f / blend) : 1e6f;
+        m_scale = 65535.0f / std::max(maxval, maxval * m_k + m_b);
+    }
+
+    /* samples of 8 bits (bitdepth 8) or 16 bits, strides in samples */
+    template <typename T> void merge(const T* pHigh, const T* pLow, int width, int height, int stride, unsigned short* pOut, int outStride) const
+    {
+        parallel_rows(height, [=](int y0, int y1)
+        {
+            for (int y = y0; y < y1; ++y)
+                merge_row(pHigh + (size_t)y * stride, pLow + (size_t)y * stride, pOut + (size_t)y * outStride, width);
+        });
+    }
+
+    /* y = log(1 + s x) / log(1 + s), s = 2^strength: 0 is linear, 10 lifts the shadows by about 100x */
+    void tonemap(const unsigned short* pIn, int width, int height, int stride, unsigned char* pOut, int outStride, int strength)
+    {
+        if (m_tonemap.empty() || (strength != m_tonemapStrength))
+        {
+            m_tonemap.resize(65536);
+            const double s = pow(2.0, strength), norm = (strength > 0) ? (1.0 / log(1.0 + s)) : 1.0;
+            for (int i = 0; i < 65536; ++i)
+            {
+                const double x = i / 65535.0;
+                m_tonemap[i] = (unsigned char)(255.0 * ((strength > 0) ? (log(1.0 + s * x) * norm) : x) + 0.5);
+            }
+            m_tonemapStrength = strength;
+        }
+        const unsigned char* lut = &m_tonemap[0];
+        parallel_rows(height, [=](int y0, int y1)
+        {
+            for (int y = y0; y < y1; ++y)
+            {
+                const unsigned short* p = pIn + (size_t)y * stride;
+                unsigned char* o = pOut + (size_t)y * outStride;
+                for (int x = 0; x < width; ++x)
+                    o[x] = lut[p[x]];
+            }
+        });
+    }
+};
+
+#endif
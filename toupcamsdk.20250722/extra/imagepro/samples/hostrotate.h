@@ -0,0 +1,190 @@
+#ifndef __hostrotate_H__
+#define __hostrotate_H__
+
+/*
+    Rotate (0, 90, 180, 270 clockwise) and flip in one pass, for images of any pixel size (1 ... 16 bytes: mono 8 / 16,
+    RGB24, RGBA32, RGB48, RGBA64), such as the output of a demosaic written directly in the orientation of the rig, or
+    tiles saved in the orientation of the camera. The flips are those of the readout (put_HFlip / put_VFlip), applied
+    to the source before the rotation, so rotate + flip is still one pass.
+    90 and 270 are transpositions: the output is cut into HOSTROTATE_TILE x HOSTROTATE_TILE tiles so that both the
+    rows read and the rows written stay in the cache; 8 x 8 blocks of 1, 2 and 4 byte pixels are transposed in SSE2
+    registers (x86), the others pixel by pixel. 0 and 180 are row copies (memcpy, or reversed).
+    The output is width x height for 0 and 180, height x width for 90 and 270; the pitches are in bytes, and the source
+    and the destination must not overlap.
+*/
+#include <string.h>
+#include <stddef.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define HOSTROTATE_SSE2
+#endif
+
+#define HOSTROTATE_TILE     64  /* output pixels, a multiple of 8 */
+
+#if defined(HOSTROTATE_SSE2)
+/* d[j][k] = s[k][j], j, k = 0 ... 7, pixels of 1, 2 or 4 bytes */
+static inline void HostRotateBlock1(const unsigned char* const s[8], unsigned char* const d[8])
+{
+    __m128i r[8];
+    for (int k = 0; k < 8; ++k)
+        r[k] = _mm_loadl_epi64((const __m128i*)s[k]);
+    const __m128i a0 = _mm_unpacklo_epi8(r[0], r[1]), a1 = _mm_unpacklo_epi8(r[2], r[3]);
+    const __m128i a2 = _mm_unpacklo_epi8(r[4], r[5]), a3 = _mm_unpacklo_epi8(r[6], r[7]);
+    const __m128i b0 = _mm_unpacklo_epi16(a0, a1), b1 = _mm_unpackhi_epi16(a0, a1);
+    const __m128i b2 = _mm_unpacklo_epi16(a2, a3), b3 = _mm_unpackhi_epi16(a2, a3);
+    const __m128i c[4] = { _mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2), _mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3) };
+    for (int j = 0; j < 4; ++j)
+    {
+        _mm_storel_epi64((__m128i*)d[2 * j], c[j]);
+        _mm_storel_epi64((__m128i*)d[2 * j + 1], _mm_srli_si128(c[j], 8));
+    }
+}
+
+static inline void HostRotateBlock2(const unsigned char* const s[8], unsigned char* const d[8])
+{
+    __m128i r[8];
+    for (int k = 0; k < 8; ++k)
+        r[k] = _mm_loadu_si128((const __m128i*)s[k]);
+    const __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    const __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    const __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    const __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    const __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    const __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    const __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    const __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+    _mm_storeu_si128((__m128i*)d[0], _mm_unpacklo_epi64(b0, b4));
+    _mm_storeu_si128((__m128i*)d[1], _mm_unpackhi_epi64(b0, b4));
+    _mm_storeu_si128((__m128i*)d[2], _mm_unpacklo_epi64(b1, b5));
+    _mm_storeu_si128((__m128i*)d[3], _mm_unpackhi_epi64(b1, b5));
+    _mm_storeu_si128((__m128i*)d[4], _mm_unpacklo_epi64(b2, b6));
+    _mm_storeu_si128((__m128i*)d[5], _mm_unpackhi_epi64(b2, b6));
+    _mm_storeu_si128((__m128i*)d[6], _mm_unpacklo_epi64(b3, b7));
+    _mm_storeu_si128((__m128i*)d[7], _mm_unpackhi_epi64(b3, b7));
+}
+
+/* as two 4 x 4 transpositions of 32 bits per half */
+static inline void HostRotateBlock4(const unsigned char* const s[8], unsigned char* const d[8])
+{
+    for (int h = 0; h < 2; ++h)         /* source rows 4h ... 4h + 3, destination columns 4h ... 4h + 3 */
+    {
+        for (int q = 0; q < 2; ++q)     /* source columns 4q ... 4q + 3, destination rows 4q ... 4q + 3 */
+        {
+            const __m128i r0 = _mm_loadu_si128((const __m128i*)(s[4 * h] + 16 * q)), r1 = _mm_loadu_si128((const __m128i*)(s[4 * h + 1] + 16 * q));
+            const __m128i r2 = _mm_loadu_si128((const __m128i*)(s[4 * h + 2] + 16 * q)), r3 = _mm_loadu_si128((const __m128i*)(s[4 * h + 3] + 16 * q));
+            const __m128i a0 = _mm_unpacklo_epi32(r0, r1), a1 = _mm_unpackhi_epi32(r0, r1);
+            const __m128i a2 = _mm_unpacklo_epi32(r2, r3), a3 = _mm_unpackhi_epi32(r2, r3);
+            _mm_storeu_si128((__m128i*)(d[4 * q] + 16 * h), _mm_unpacklo_epi64(a0, a2));
+            _mm_storeu_si128((__m128i*)(d[4 * q + 1] + 16 * h), _mm_unpackhi_epi64(a0, a2));
+            _mm_storeu_si128((__m128i*)(d[4 * q + 2] + 16 * h), _mm_unpacklo_epi64(a1, a3));
+            _mm_storeu_si128((__m128i*)(d[4 * q + 3] + 16 * h), _mm_unpackhi_epi64(a1, a3));
+        }
+    }
+}
+#endif
+
+/* angle: 0, 90, 180, 270 clockwise; bpp: bytes per pixel; returns false on another angle or bpp */
+static bool HostRotate(const void* src, size_t srcPitch, unsigned width, unsigned height, unsigned bpp, int angle, bool bHFlip, bool bVFlip,
+                       void* dst, size_t dstPitch)
+{
+    if ((bpp < 1) || (bpp > 16) || ((0 != angle) && (90 != angle) && (180 != angle) && (270 != angle)))
+        return false;
+    /* the output pixel (x, y) is the source pixel at p0 + x * dx + y * dy */
+    const ptrdiff_t pitch = (ptrdiff_t)srcPitch, pb = (ptrdiff_t)bpp;
+    const bool bSwap = (90 == angle) || (270 == angle);
+    const unsigned ow = bSwap ? height : width, oh = bSwap ? width : height;
+    bool bx = bHFlip, by = bVFlip;          /* source read backwards along x, along y */
+    if (180 == angle)
+    {
+        bx = !bx;
+        by = !by;
+    }
+    ptrdiff_t dx, dy;
+    if (90 == angle)                        /* output x runs up the source rows, output y along them */
+    {
+        by = !by;
+        dx = by ? -pitch : pitch;
+        dy = bx ? -pb : pb;
+    }
+    else if (270 == angle)                  /* output x runs down the source rows, output y backwards along them */
+    {
+        bx = !bx;
+        dx = by ? -pitch : pitch;
+        dy = bx ? -pb : pb;
+    }
+    else
+    {
+        dx = bx ? -pb : pb;
+        dy = by ? -pitch : pitch;
+    }
+    const unsigned char* p0 = (const unsigned char*)src + (bx ? (ptrdiff_t)(width - 1) * pb : 0) + (by ? (ptrdiff_t)(height - 1) * pitch : 0);
+
+    if (!bSwap)
+    {
+        for (unsigned y = 0; y < oh; ++y)
+        {
+            const unsigned char* s = p0 + (ptrdiff_t)y * dy;
+            unsigned char* d = (unsigned char*)dst + (size_t)y * dstPitch;
+            if (dx > 0)
+                memcpy(d, s, (size_t)ow * bpp);
+            else
+            {
+                for (unsigned x = 0; x < ow; ++x, s -= bpp, d += bpp)
+                    memcpy(d, s, bpp);
+            }
+        }
+        return true;
+    }
+
+    for (unsigned ty = 0; ty < oh; ty += HOSTROTATE_TILE)
+    {
+        const unsigned th = (oh - ty < HOSTROTATE_TILE) ? (oh - ty) : HOSTROTATE_TILE;
+        for (unsigned tx = 0; tx < ow; tx += HOSTROTATE_TILE)
+        {
+            const unsigned tw = (ow - tx < HOSTROTATE_TILE) ? (ow - tx) : HOSTROTATE_TILE;
+            unsigned y = 0;
+#if defined(HOSTROTATE_SSE2)
+            if ((1 == bpp) || (2 == bpp) || (4 == bpp))
+            {
+                /* blocks of 8 x 8: the 8 sources are 8 columns of output, each read forwards along a source row */
+                for (; y + 8 <= th; y += 8)
+                {
+                    unsigned x = 0;
+                    for (; x + 8 <= tw; x += 8)
+                    {
+                        const unsigned char* a = p0 + (ptrdiff_t)(tx + x) * dx + (ptrdiff_t)(ty + y) * dy;
+                        const unsigned char* s[8];
+                        unsigned char* d[8];
+                        for (int k = 0; k < 8; ++k)
+                            s[k] = a + k * dx - ((dy < 0) ? 7 * pb : 0);
+                        for (int j = 0; j < 8; ++j)
+                            d[j] = (unsigned char*)dst + (size_t)(ty + y + ((dy < 0) ? (7 - j) : j)) * dstPitch + (size_t)(tx + x) * bpp;
+                        if (1 == bpp)
+                            HostRotateBlock1(s, d);
+                        else if (2 == bpp)
+                            HostRotateBlock2(s, d);
+                        else
+                            HostRotateBlock4(s, d);
+                    }
+                    for (unsigned j = 0; j < 8; ++j)
+                    {
+                        unsigned char* d = (unsigned char*)dst + (size_t)(ty + y + j) * dstPitch;
+                        for (unsigned xx = x; xx < tw; ++xx)
+                            memcpy(d + (size_t)(tx + xx) * bpp, p0 + (ptrdiff_t)(tx + xx) * dx + (ptrdiff_t)(ty + y + j) * dy, bpp);
+                    }
+                }
+            }
+#endif
+            for (; y < th; ++y)
+            {
+                unsigned char* d = (unsigned char*)dst + (size_t)(ty + y) * dstPitch + (size_t)tx * bpp;
+                const unsigned char* s = p0 + (ptrdiff_t)tx * dx + (ptrdiff_t)(ty + y) * dy;
+                for (unsigned x = 0; x < tw; ++x, s += dx, d += bpp)
+                    memcpy(d, s, bpp);
+            }
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef __ipalloc_H__
+#define __ipalloc_H__
+
+/*
+    Allocator interface for the imagepro programs: aligned alloc, free and realloc with a user context, set globally
+    or given per object, and an arena which keeps the memory between sessions.
+    imagepro_init only takes a malloc: the memory imagepro hands over to the program (the mosaic of
+    imagepro_stitch_stop) is freed by the program, the library never frees it itself. IpMallocHook routes that
+    malloc to the global allocator, so such a result goes back with IpFree; the buffers the library keeps inside
+    (the stitch and EDF pyramids of its handles) are out of reach. The engines of these samples take an IpAllocator
+    (EdfPyramid of qt/liveedf/edfpyr.h, for its whole pyramid), NULL being the global one.
+    IpArena: the blocks freed are kept (up to the retain limit) and given out again to an allocation of the same size
+    class (at most IPALLOC_FIT larger), as the pyramids of one resolution come back at every start / stop, every stack
+    or every scan: after the first session the engines run without touching the heap, and a day of sessions does not
+    fragment it. Thread safe. An arena must outlive the blocks it gave out; trim() gives the kept blocks back to the heap.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+#if !defined(_WIN32) && !defined(__cdecl)
+#define __cdecl
+#endif
+
+#define IPALLOC_ALIGN   64      /* default alignment, a cache line; enough for AVX-512 */
+#define IPALLOC_FIT     8       /* a kept block serves requests down to 1 - 1 / IPALLOC_FIT of its size */
+
+typedef struct {
+    void* (__cdecl *pAlloc)(void* ctx, size_t size, size_t align);               /* align: power of 2, 0: IPALLOC_ALIGN */
+    void  (__cdecl *pFree)(void* ctx, void* p);                                 /* p may be NULL */
+    void* (__cdecl *pRealloc)(void* ctx, void* p, size_t size, size_t align);   /* the content is kept up to the smaller size */
+    void* ctx;
+} IpAllocator;
+
+/* heap blocks: the size and the address from malloc sit in front of the aligned pointer */
+typedef struct {
+    void* base;
+    size_t size;
+} IpBlock;
+
+inline void* __cdecl IpHeapAlloc(void*, size_t size, size_t align)
+{
+    if (0 == align)
+        align = IPALLOC_ALIGN;
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+    if (size > std::numeric_limits<size_t>::max() - align - sizeof(IpBlock))
+        return NULL;
+    void* base = malloc(size + align + sizeof(IpBlock));
+    if (NULL == base)
+        return NULL;
+    const uintptr_t p = ((uintptr_t)base + sizeof(IpBlock) + align - 1) & ~(uintptr_t)(align - 1);
+    IpBlock* b = (IpBlock*)p - 1;
+    b->base = base;
+    b->size = size;
+    return (void*)p;
+}
+
+inline void __cdecl IpHeapFree(void*, void* p)
+{
+    if (p)
+        free(((IpBlock*)p - 1)->base);
+}
+
+inline size_t IpHeapSize(const void* p)
+{
+    return p ? ((const IpBlock*)p - 1)->size : 0;
+}
+
+inline void* __cdecl IpHeapRealloc(void* ctx, void* p, size_t size, size_t align)
+{
+    if (NULL == p)
+        return IpHeapAlloc(ctx, size, align);
+    const size_t old = IpHeapSize(p);
+    if ((size <= old) && (0 == ((uintptr_t)p & ((align ? align : IPALLOC_ALIGN) - 1))))
+    {
+        ((IpBlock*)p - 1)->size = size;
+        return p;
+    }
+    void* q = IpHeapAlloc(ctx, size, align);
+    if (q)
+    {
+        memcpy(q, p, (old < size) ? old : size);
+        IpHeapFree(ctx, p);
+    }
+    return q;
+}
+
+/* the allocator of the heap, the default of the global one */
+inline const IpAllocator* IpAllocHeap()
+{
+    static const IpAllocator s_heap = { IpHeapAlloc, IpHeapFree, IpHeapRealloc, NULL };
+    return &s_heap;
+}
+
+/* one per program (an inline function: the same in every translation unit) */
+inline IpAllocator& IpAllocGlobal()
+{
+    static IpAllocator s_global = *IpAllocHeap();
+    return s_global;
+}
+
+/* before any allocation: the blocks must be freed by the allocator which gave them out; NULL: the heap */
+inline void IpAllocSetGlobal(const IpAllocator* a)
+{
+    IpAllocGlobal() = a ? *a : *IpAllocHeap();
+}
+
+inline void* IpAlloc(size_t size, size_t align = 0)
+{
+    const IpAllocator& a = IpAllocGlobal();
+    return a.pAlloc(a.ctx, size, align);
+}
+
+inline void IpFree(void* p)
+{
+    const IpAllocator& a = IpAllocGlobal();
+    a.pFree(a.ctx, p);
+}
+
+inline void* IpRealloc(void* p, size_t size, size_t align = 0)
+{
+    const IpAllocator& a = IpAllocGlobal();
+    return a.pRealloc(a.ctx, p, size, align);
+}
+
+/* imagepro_init(IpMallocHook): what imagepro hands over comes from the global allocator, free it with IpFree */
+inline void* __cdecl IpMallocHook(size_t size)
+{
+    return IpAlloc(size, 0);
+}
+
+/* for the containers of the standard library; NULL: the global allocator at the time of each allocation */
+template <typename T>
+class IpStdAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    const IpAllocator* m_a;
+
+    IpStdAllocator(const IpAllocator* a = NULL) : m_a(a) {}
+    template <typename U> IpStdAllocator(const IpStdAllocator<U>& other) : m_a(other.m_a) {}
+
+    T* allocate(size_t n)
+    {
+        const IpAllocator& a = m_a ? *m_a : IpAllocGlobal();
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+            throw std::bad_alloc();
+        T* p = (T*)a.pAlloc(a.ctx, n * sizeof(T), 0);
+        if (NULL == p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        const IpAllocator& a = m_a ? *m_a : IpAllocGlobal();
+        a.pFree(a.ctx, p);
+    }
+};
+
+template <typename T, typename U> bool operator==(const IpStdAllocator<T>& a, const IpStdAllocator<U>& b) { return a.m_a == b.m_a; }
+template <typename T, typename U> bool operator!=(const IpStdAllocator<T>& a, const IpStdAllocator<U>& b) { return a.m_a != b.m_a; }
+
+class IpArena {
+    const IpAllocator   m_upstream;
+    IpAllocator         m_self;
+    size_t              m_retain;       /* bytes kept at most */
+    size_t              m_kept, m_live;
+    unsigned long long  m_hits, m_misses;
+    std::multimap<size_t, void*> m_free;    /* capacity, block */
+    std::map<void*, size_t> m_used;         /* block, capacity */
+    std::mutex          m_mtx;
+
+    IpArena(const IpArena&);
+    IpArena& operator=(const IpArena&);
+
+    static void* __cdecl arenaAlloc(void* ctx, size_t size, size_t align) { return ((IpArena*)ctx)->alloc(size, align); }
+    static void __cdecl arenaFree(void* ctx, void* p) { ((IpArena*)ctx)->release(p); }
+    static void* __cdecl arenaRealloc(void* ctx, void* p, size_t size, size_t align) { return ((IpArena*)ctx)->realloc(p, size, align); }
+public:
+    /* retain: bytes of free blocks kept for reuse, the rest goes back to upstream (NULL: the heap) */
+    explicit IpArena(size_t retain, const IpAllocator* upstream = NULL)
+    : m_upstream(upstream ? *upstream : *IpAllocHeap()), m_retain(retain), m_kept(0), m_live(0), m_hits(0), m_misses(0)
+    {
+        m_self.pAlloc = arenaAlloc;
+        m_self.pFree = arenaFree;
+        m_self.pRealloc = arenaRealloc;
+        m_self.ctx = this;
+    }
+
+    ~IpArena() { trim(); }
+
+    const IpAllocator* allocator() const { return &m_self; }
+
+    void* alloc(size_t size, size_t align)
+    {
+        if (0 == align)
+            align = IPALLOC_ALIGN;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            const size_t most = size + size / (IPALLOC_FIT - 1);
+            for (std::multimap<size_t, void*>::iterator it = m_free.lower_bound(size); (it != m_free.end()) && (it->first <= most); ++it)
+            {
+                if (0 == ((uintptr_t)it->second & (align - 1)))
+                {
+                    void* p = it->second;
+                    m_used[p] = it->first;
+                    m_kept -= it->first;
+                    m_live += it->first;
+                    m_free.erase(it);
+                    ++m_hits;
+                    return p;
+                }
+            }
+            ++m_misses;
+        }
+        void* p = m_upstream.pAlloc(m_upstream.ctx, size, align);
+        if (p)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_used[p] = size;
+            m_live += size;
+        }
+        return p;
+    }
+
+    void release(void* p)
+    {
+        if (NULL == p)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            std::map<void*, size_t>::iterator it = m_used.find(p);
+            if (it == m_used.end())
+                return;         /* not one of ours */
+            const size_t size = it->second;
+            m_used.erase(it);
+            m_live -= size;
+            if (m_kept + size <= m_retain)
+            {
+                m_free.insert(std::make_pair(size, p));
+                m_kept += size;
+                return;
+            }
+        }
+        m_upstream.pFree(m_upstream.ctx, p);
+    }
+
+    void* realloc(void* p, size_t size, size_t align)
+    {
+        if (NULL == p)
+            return alloc(size, align);
+        size_t old = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            std::map<void*, size_t>::iterator it = m_used.find(p);
+            if (it == m_used.end())
+                return NULL;
+            old = it->second;
+        }
+        if ((size <= old) && (0 == ((uintptr_t)p & ((align ? align : IPALLOC_ALIGN) - 1))))
+            return p;           /* the capacity stays that of the block */
+        void* q = alloc(size, align);
+        if (q)
+        {
+            memcpy(q, p, (old < size) ? old : size);
+            release(p);
+        }
+        return q;
+    }
+
+    /* gives the kept blocks back to upstream */
+    void trim()
+    {
+        std::multimap<size_t, void*> blocks;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            blocks.swap(m_free);
+            m_kept = 0;
+        }
+        for (std::multimap<size_t, void*>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+            m_upstream.pFree(m_upstream.ctx, it->second);
+    }
+
+    void setRetain(size_t retain)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_retain = retain;
+            if (m_kept <= m_retain)
+                return;
+        }
+        trim();
+    }
+
+    /* bytes kept for reuse and given out, allocations served from the kept blocks and from upstream */
+    void stats(size_t* pKept, size_t* pLive, unsigned long long* pHits, unsigned long long* pMisses)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (pKept)
+            *pKept = m_kept;
+        if (pLive)
+            *pLive = m_live;
+        if (pHits)
+            *pHits = m_hits;
+        if (pMisses)
+            *pMisses = m_misses;
+    }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef __ipawb_H__
+#define __ipawb_H__
+
+/*
+    Continuous auto white balance of the RAW frames demosaiced on the host (ipkernel.h), from the sums by color the
+    demosaic gathers anyway (IpkChannelSums), and not from an analysis of its own, as Toupcam_AwbOnce or
+    TOUPCAM_OPTION_AWB_CONTINUOUS do in RGB mode, which is a further pass over the frame.
+        IpAwb awb;
+        awb.setRect(h);                     the region of Toupcam_get_AWBAuxRect, if any
+        for every frame:
+            IpkDemosaicDispatch(raw, 0, rgb, 0, w, h, bits, fourcc, IPK_BGR, true, awb.gains(), awb.begin());
+            awb.update();                   the gains of the next frame
+    One pass: the frame is demosaiced with the gains of the frames before, and the sums of its RAW samples in the
+    region (before any gain, the samples clipped excluded) are the gains of the next one: the grey world, green 1,
+    red and blue mean green / mean of their own. The sums are of the sensor, not of the result of the gains, so the
+    gains need no loop: they are right at the second frame, and damping (1: none) only smooths a scene which changes.
+    The gains are clamped to IPAWB_MIN_GAIN ... IPAWB_MAX_GAIN (1/4096); update() returns false and keeps them while
+    the region has fewer than IPAWB_MIN_COUNT samples of a color (dark, or clipped).
+    A frame demosaiced in bands on several threads (rawdemosaic) gives every band an IpkChannelSums of its own (a
+    copy of sums(), the rectangle moved into the band), and addSums() of them all before update(); the halo rows are
+    then counted twice, which leaves the means as they are but for a hair.
+    For a frame not demosaiced on the host, IpkRawSums reads the rows of the region only.
+*/
+#include <string.h>
+#include <math.h>
+#include "toupcam.h"
+#include "ipkernel.h"
+
+#define IPAWB_MIN_GAIN      1024        /* 0.25 */
+#define IPAWB_MAX_GAIN      16383       /* 4, the products of IpkWhiteBalance in an int at 16 bits */
+#define IPAWB_MIN_COUNT     64
+#define IPAWB_LIMIT         0.98        /* of full scale: brighter samples are clipped, not counted */
+
+class IpAwb {
+    IpkChannelSums m_sums;
+    IpkWhiteBalance m_wb;
+    double m_damping;
+public:
+    /* bits: of the RAW samples (Toupcam_get_RawFormat), for the limit of the clipped ones */
+    explicit IpAwb(unsigned bits = 8, double damping = 1.0)
+    : m_damping(damping)
+    {
+        memset(&m_sums, 0, sizeof(m_sums));
+        m_sums.limit = (unsigned)(((1u << bits) - 1) * IPAWB_LIMIT);
+        m_wb.gr = m_wb.gg = m_wb.gb = 4096;
+    }
+
+    void setRect(unsigned left, unsigned top, unsigned width, unsigned height)
+    {
+        m_sums.left = left;
+        m_sums.top = top;
+        m_sums.width = width;
+        m_sums.height = height;
+    }
+
+    /* Toupcam_get_AWBAuxRect of the camera, in the coordinates of the frame; the whole frame when there is none */
+    void setRect(HToupcam h)
+    {
+        RECT rc = { 0 };
+        if (SUCCEEDED(Toupcam_get_AWBAuxRect(h, &rc)) && (rc.right > rc.left) && (rc.bottom > rc.top))
+            setRect(rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top);
+        else
+            setRect(0, 0, 0, 0);
+    }
+
+    void setBits(unsigned bits)
+    {
+        m_sums.limit = (unsigned)(((1u << bits) - 1) * IPAWB_LIMIT);
+    }
+
+    /* the op of the demosaic, applies the gains */
+    const IpkWhiteBalance& gains() const { return m_wb; }
+
+    void setGains(int r, int g, int b)
+    {
+        m_wb.gr = r;
+        m_wb.gg = g;
+        m_wb.gb = b;
+    }
+
+    /* the sums cleared, for the pSums of the demosaic of the frame */
+    IpkChannelSums* begin()
+    {
+        memset(m_sums.sum, 0, sizeof(m_sums.sum));
+        memset(m_sums.count, 0, sizeof(m_sums.count));
+        return &m_sums;
+    }
+
+    /* the sums of a band, after begin() */
+    void addSums(const IpkChannelSums& s)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            m_sums.sum[c] += s.sum[c];
+            m_sums.count[c] += s.count[c];
+        }
+    }
+
+    const IpkChannelSums& sums() const { return m_sums; }
+
+    /* the gains of the sums since begin(); false: too few samples, the gains as they were */
+    bool update()
+    {
+        double mean[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            if ((m_sums.count[c] < IPAWB_MIN_COUNT) || (0 == m_sums.sum[c]))
+                return false;
+            mean[c] = (double)m_sums.sum[c] / m_sums.count[c];
+        }
+        const int target[3] = { clamp(4096.0 * mean[1] / mean[0]), 4096, clamp(4096.0 * mean[1] / mean[2]) };
+        int* gain[3] = { &m_wb.gr, &m_wb.gg, &m_wb.gb };
+        for (int c = 0; c < 3; ++c)
+            *gain[c] = (int)floor(*gain[c] + m_damping * (target[c] - *gain[c]) + 0.5);
+        return true;
+    }
+private:
+    static int clamp(double g)
+    {
+        return (g < IPAWB_MIN_GAIN) ? IPAWB_MIN_GAIN : ((g > IPAWB_MAX_GAIN) ? IPAWB_MAX_GAIN : (int)floor(g + 0.5));
+    }
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef __ipcoro_H__
+#define __ipcoro_H__
+
+/*
+    Stitch in the coroutines of camcoro.h (samples/camcoro.h): the feed and the mosaic as two co_await's in the
+    pipeline, instead of the IMAGEPRO_STITCH_CALLBACK / IMAGEPRO_STITCH_ECALLBACK pair and a hand-off to the thread which
+    draws.
+        CoStitch stitch;
+        stitch.open(loop, eImageproFormat_RGB24, 0, w, h, 1);
+        stitch.start();
+        for (;;)
+        {
+            CamFrame frame = co_await stitch.next_frame(cam, 1);        the frame, fed to the stitch on the way
+            ...
+            CoStitchUpdate u = co_await stitch.readdata(buf, bw, bh); the mosaic after the next stitch callback
+        }
+    next_frame() is Camera::next_frame by imagepro_stitch_pullV4 instead of Toupcam_PullImageV4: the same lease, the
+    frame having gone into the stitch (bFeed) as well. readdata() resumes on the executor given to open() at the next
+    IMAGEPRO_STITCH_CALLBACK, with its arguments (CoStitchUpdate), and there, on the executor, not on the thread of the
+    callback, reads the mosaic into data by imagepro_stitch_readdata (w, h, roi as it; data NULL: the update only).
+    An IMAGEPRO_STITCH_ECALLBACK of eImageproStitchE_ERROR / eImageproStitchE_NOMEM completes it with E_FAIL /
+    E_OUTOFMEMORY, close() (and the destructor) with CAMCORO_E_ABORT; the other events are the state of the stitch, as
+    event(), the latest one. One readdata() at a time (E_PENDING), next to one await of the camera.
+    CoStitch is the callback context of the stitch handle: it neither moves nor copies.
+*/
+#include <mutex>
+#include "camcoro.h"
+#include "imagepro.h"
+#include "imagepro_toupcam.h"
+
+typedef struct {
+    HRESULT                 hr;
+    int                     outW, outH;     /* the mosaic */
+    int                     curW, curH, curType;
+    int                     posX, posY;     /* of the current frame in the mosaic */
+    eImageproStitchQuality  quality;
+    float                   sharpness;
+    int                     bUpdate, bSize;
+} CoStitchUpdate;
+
+class CoStitch {
+    struct Reader;
+    HImageproStitch m_h;
+    std::mutex m_mtx;
+    Reader* m_reader;
+    eImageproStitchEvent m_event;
+    int m_bFeed;
+    void* m_ex;
+    void (*m_post)(void* ex, std::coroutine_handle<> h);
+
+    struct Reader {
+        CoStitch* stitch;
+        void* data;
+        int w, h, roix, roiy, roiw, roih;
+        std::coroutine_handle<> handle;
+        CoStitchUpdate result;
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            std::lock_guard<std::mutex> lock(stitch->m_mtx);
+            if ((nullptr == stitch->m_h) || stitch->m_reader)
+            {
+                result.hr = stitch->m_h ? (HRESULT)0x8000000a /* E_PENDING */ : (HRESULT)0x8000ffff /* E_UNEXPECTED */;
+                return false;
+            }
+            handle = h;
+            stitch->m_reader = this;
+            return true;
+        }
+
+        CoStitchUpdate await_resume()
+        {
+            if (SUCCEEDED(result.hr) && data)
+                imagepro_stitch_readdata(stitch->m_h, data, w, h, roix, roiy, roiw, roih);
+            return result;
+        }
+    };
+
+    /* state m_mtx held */
+    std::coroutine_handle<> complete(HRESULT hr)
+    {
+        std::coroutine_handle<> h;
+        if (m_reader)
+        {
+            m_reader->result.hr = hr;
+            h = m_reader->handle;
+            m_reader = nullptr;
+        }
+        return h;
+    }
+
+    static void __cdecl StitchCallback(void* ctx, void* /*outData*/, int /*stride*/, int outW, int outH, int curW, int curH, int curType,
+                                        int posX, int posY, eImageproStitchQuality quality, float sharpness, int bUpdate, int bSize)
+    {
+        CoStitch* p = (CoStitch*)ctx;
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard<std::mutex> lock(p->m_mtx);
+            if (p->m_reader)
+            {
+                CoStitchUpdate& u = p->m_reader->result;
+                u.outW = outW;
+                u.outH = outH;
+                u.curW = curW;
+                u.curH = curH;
+                u.curType = curType;
+                u.posX = posX;
+                u.posY = posY;
+                u.quality = quality;
+                u.sharpness = sharpness;
+                u.bUpdate = bUpdate;
+                u.bSize = bSize;
+                h = p->complete((HRESULT)0x00000000 /* S_OK */);
+            }
+        }
+        if (h)
+            p->m_post(p->m_ex, h);
+    }
+
+    static void __cdecl StitchECallback(void* ctx, eImageproStitchEvent evt)
+    {
+        CoStitch* p = (CoStitch*)ctx;
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard<std::mutex> lock(p->m_mtx);
+            p->m_event = evt;
+            if (eImageproStitchE_ERROR == evt)
+                h = p->complete((HRESULT)0x80004005 /* E_FAIL */);
+            else if (eImageproStitchE_NOMEM == evt)
+                h = p->complete((HRESULT)0x8007000e /* E_OUTOFMEMORY */);
+        }
+        if (h)
+            p->m_post(p->m_ex, h);
+    }
+
+    static HRESULT Pull(void* ctx, HToupcam h, void* pImageData, int bits, int rowPitch, ToupcamFrameInfoV4* pInfo)
+    {
+        CoStitch* p = (CoStitch*)ctx;
+        return imagepro_stitch_pullV4(p->m_h, h, p->m_bFeed, pImageData, bits, rowPitch, pInfo);
+    }
+public:
+    CoStitch()
+    : m_h(nullptr), m_reader(nullptr), m_event(eImageproStitchE_NONE), m_bFeed(1), m_ex(nullptr), m_post(nullptr)
+    {
+    }
+    CoStitch(const CoStitch&) = delete;
+    CoStitch& operator=(const CoStitch&) = delete;
+    ~CoStitch()
+    {
+        close();
+    }
+
+    /* as imagepro_stitch_newV3; ex outlives the stitch, as for Camera::start */
+    template <typename E>
+    HRESULT open(E& ex, eImageproFormat format, int bGlobalShutter, int videoW, int videoH, int background,
+                eImageproStitchPrecision precision = eImageproStitchP_Medium, eImageproStitchThreshold threshold = eImageproStitchT_Medium)
+    {
+        if (m_h)
+            return (HRESULT)0x8000ffff /* E_UNEXPECTED */;
+        m_ex = &ex;
+        m_post = [](void* p, std::coroutine_handle<> h) { static_cast<E*>(p)->post(h); };
+        m_event = eImageproStitchE_NONE;
+        m_h = imagepro_stitch_newV3(format, bGlobalShutter, videoW, videoH, background, precision, threshold, StitchCallback, StitchECallback, this);
+        return m_h ? (HRESULT)0x00000000 /* S_OK */ : (HRESULT)0x80004005 /* E_FAIL */;
+    }
+
+    void start()
+    {
+        if (m_h)
+            imagepro_stitch_start(m_h);
+    }
+
+    /* as imagepro_stitch_stop, a readdata() in progress completes with CAMCORO_E_ABORT */
+    void* stop(int normal, int crop)
+    {
+        if (nullptr == m_h)
+            return nullptr;
+        void* p = imagepro_stitch_stop(m_h, normal, crop);
+        abort();
+        return p;
+    }
+
+    void close()
+    {
+        if (m_h)
+        {
+            imagepro_stitch_delete(m_h);
+            abort();
+            m_h = nullptr;
+        }
+    }
+
+    HImageproStitch handle() const { return m_h; }
+
+    eImageproStitchEvent event()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_event;
+    }
+
+    /* cam started (Camera::start) on the same executor, or on one which hands the frame to it */
+    camcoro_detail::Waiter next_frame(const Camera& cam, int bFeed)
+    {
+        m_bFeed = bFeed;
+        return cam.next_frame(Pull, this);
+    }
+
+    Reader readdata(void* data, int w, int h, int roix = 0, int roiy = 0, int roiw = 0, int roih = 0)
+    {
+        Reader r = { this, data, w, h, roix, roiy, roiw, roih, nullptr, CoStitchUpdate() };
+        r.result.hr = (HRESULT)0x8000000a /* E_PENDING */;
+        return r;
+    }
+
+private:
+    void abort()
+    {
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            h = complete(CAMCORO_E_ABORT);
+        }
+        if (h)
+            m_post(m_ex, h);
+    }
+};
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef __ipkernel_H__
+#define __ipkernel_H__
+
+/*
+    Pixel kernels specialized at compile time, for the per pixel work of the program fused into the demosaic or the
+    conversion, instead of a second pass over the frame, and without the switches per pixel of a kernel which takes
+    the formats at run time (imagepro_demosaic(..., bitdepth, informat, outformat, method), RoiDemosaic).
+    IpkDemosaic<Phase, InT, InBits, OutFmt, OutT>(..., op)
+        bilinear demosaic (the LINEAR of imagepro_demosaic; the values of ROIDEMOSAIC_BILINEAR of roidemosaic.h, to the
+        bit, the samples mirrored outside the frame), of a Bayer frame of phase IPK_RGGB / BGGR / GRBG / GBRG, 8 bits
+        (InT unsigned char) or 10 ... 16 bits little endian (unsigned short, InBits significant), into IPK_BGR / BGRA /
+        RGB / RGBA (the outformat of imagepro_demosaic), 8 bits (OutT unsigned char, shifted right by InBits - 8) or
+        16 bits (unsigned short, as is). The color of every pixel, and therefore which neighbours make each of its
+        three values, follows from Phase and the parity of the pixel: a row is one loop over pairs of pixels whose
+        code is fixed by its template arguments, the edges (mirrored) peeled off, no branch inside.
+        8 bits input: the interior of the rows in blocks of 16 pixels, SSE2 on x86 / x64 (_mm_avg_epu8 is the
+        rounding of the pairs, 16 bits lanes the one of the quads), scalar otherwise; the same values either way.
+    IpkConvert<InFmt, InT, InBits, OutFmt, OutT>(..., op)
+        RGB to RGB of the same layouts, for the frames pulled as RGB24 / RGB32 / RGB48 / RGB64, BGR or RGB order.
+    op is the post-processing of the program, called once per pixel on the three values at the scale of the input
+    (0 ... (1 << InBits) - 1), before they are clamped to it, shifted and stored: any object with
+        void operator()(int& r, int& g, int& b) const
+    inlined into the loop (IpkIdentity: nothing, IpkWhiteBalance: gains in 1/4096). Alpha, when there is one, is opaque.
+    IpkDemosaicDispatch takes the arguments of imagepro_demosaic (bitdepth 8, 10, 12, 14, 16, informat FourCC,
+    outformat 0 ... 3; bOut8: 8 bits out of more), and an op, and calls the specialization of them from a constexpr
+    table built for that op (IPK_PHASES x IPK_DEPTHS x IPK_OUTFORMATS x 2 entries): one indirect call per frame.
+    pSums, when not NULL, adds the RAW samples of every channel inside its rectangle (IpkChannelSums, in the
+    coordinates of the buffer given) to its sums, as the rows go through the demosaic, still in the cache: the
+    statistics of an auto white balance without a pass of their own (ipawb.h). IpkRawSums is the same over the rows
+    of the rectangle only, for a frame which is not demosaiced on the host.
+    The pitches are in bytes, 0: packed (TDIBWIDTHBYTES is not applied); width and height at least 2.
+*/
+#include <stddef.h>
+#include <array>
+#include <utility>
+#include <type_traits>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define IPKERNEL_SSE2
+#endif
+#include "toupcam.h"
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+/* outformat of imagepro_demosaic, and InFmt of IpkConvert */
+#define IPK_BGR             0
+#define IPK_BGRA            1
+#define IPK_RGB             2
+#define IPK_RGBA            3
+#define IPK_OUTFORMATS      4
+
+/* Bayer phase: the colors of the 2 x 2 cell at (0, 0), in the order of the FourCC */
+#define IPK_RGGB            0
+#define IPK_BGGR            1
+#define IPK_GRBG            2
+#define IPK_GBRG            3
+#define IPK_PHASES          4
+
+#define IPK_DEPTHS          5   /* 8, 10, 12, 14, 16 */
+
+/* 0 R, 1 G, 2 B at (x & 1, y & 1) */
+static constexpr unsigned IpkColor(unsigned phase, unsigned x, unsigned y)
+{
+    return (((IPK_RGGB == phase) ? 0x94u : ((IPK_BGGR == phase) ? 0x16u : ((IPK_GRBG == phase) ? 0x61u : 0x49u))) >> (2 * ((x & 1) | ((y & 1) << 1)))) & 3;
+}
+
+/* which taps make the value of color c at a pixel of color k, kh the color of its horizontal neighbours, kv of the
+   vertical ones: 0 the pixel, 1 the horizontal pair, 2 the vertical pair, 3 the 4 of the cross, 4 the 4 diagonal */
+static constexpr int IpkSource(unsigned k, unsigned kh, unsigned kv, unsigned c)
+{
+    return (c == k) ? 0 : ((1 == k) ? ((c == kh) ? 1 : ((c == kv) ? 2 : -1)) : ((1 == c) ? 3 : 4));
+}
+
+template <unsigned Phase, unsigned px, unsigned py>
+struct IpkSite {
+    enum {
+        k = IpkColor(Phase, px, py),
+        kh = IpkColor(Phase, px + 1, py),
+        kv = IpkColor(Phase, px, py + 1),
+        sr = IpkSource(k, kh, kv, 0),
+        sg = IpkSource(k, kh, kv, 1),
+        sb = IpkSource(k, kh, kv, 2)
+    };
+};
+
+template <int S, typename InT>
+static inline int IpkTap(const InT* ru, const InT* r, const InT* rd, size_t xl, size_t x, size_t xr)
+{
+    return (0 == S) ? (int)r[x]
+        : ((1 == S) ? ((r[xl] + r[xr] + 1) >> 1)
+        : ((2 == S) ? ((ru[x] + rd[x] + 1) >> 1)
+        : ((3 == S) ? ((r[xl] + r[xr] + ru[x] + rd[x] + 2) >> 2)
+        : ((ru[xl] + ru[xr] + rd[xl] + rd[xr] + 2) >> 2))));
+}
+
+struct IpkIdentity {
+    void operator()(int&, int&, int&) const {}
+};
+
+/* r, g, b x gain / 4096 */
+struct IpkWhiteBalance {
+    int gr, gg, gb;
+    void operator()(int& r, int& g, int& b) const
+    {
+        r = (r * gr + 2048) >> 12;
+        g = (g * gg + 2048) >> 12;
+        b = (b * gb + 2048) >> 12;
+    }
+};
+
+/* sums of the RAW samples by color, 0 R, 1 G, 2 B; limit: the samples above are not counted (clipped), 0: none */
+typedef struct {
+    unsigned left, top, width, height;      /* 0 x 0: the whole buffer */
+    unsigned limit;
+    unsigned long long sum[3], count[3];
+} IpkChannelSums;
+
+/* the samples x0 ... x1 - 1 of row y into pSums; 32 bits a row and the parities apart, for the vectorizer (rows up to 65536 wide) */
+template <unsigned Phase, typename InT>
+static inline void IpkRowSums(const InT* r, unsigned y, unsigned x0, unsigned x1, IpkChannelSums* pSums)
+{
+    const unsigned lim = pSums->limit ? pSums->limit : ~0u;
+    unsigned s[2] = { 0, 0 }, c[2] = { 0, 0 };
+    unsigned x = x0;
+    if ((x & 1) && (x < x1))
+    {
+        const unsigned v = r[x++];
+        s[1] += (v <= lim) ? v : 0;
+        c[1] += (v <= lim) ? 1 : 0;
+    }
+    for (; x + 1 < x1; x += 2)
+    {
+        const unsigned v0 = r[x], v1 = r[x + 1];
+        s[0] += (v0 <= lim) ? v0 : 0;
+        c[0] += (v0 <= lim) ? 1 : 0;
+        s[1] += (v1 <= lim) ? v1 : 0;
+        c[1] += (v1 <= lim) ? 1 : 0;
+    }
+    if (x < x1)
+    {
+        const unsigned v = r[x];
+        s[0] += (v <= lim) ? v : 0;
+        c[0] += (v <= lim) ? 1 : 0;
+    }
+    for (unsigned px = 0; px < 2; ++px)
+    {
+        const unsigned k = IpkColor(Phase, px, y & 1);
+        pSums->sum[k] += s[px];
+        pSums->count[k] += c[px];
+    }
+}
+
+/* the rows of y in the rectangle of pSums, clipped to width x height; false: none */
+static inline bool IpkSumsRange(const IpkChannelSums* pSums, unsigned width, unsigned height, unsigned* x0, unsigned* x1, unsigned* y0, unsigned* y1)
+{
+    const bool bAll = (0 == pSums->width) || (0 == pSums->height);
+    *x0 = bAll ? 0 : ((pSums->left < width) ? pSums->left : width);
+    *y0 = bAll ? 0 : ((pSums->top < height) ? pSums->top : height);
+    *x1 = bAll ? width : ((pSums->width < width - *x0) ? (*x0 + pSums->width) : width);
+    *y1 = bAll ? height : ((pSums->height < height - *y0) ? (*y0 + pSums->height) : height);
+    return (*x0 < *x1) && (*y0 < *y1);
+}
+
+template <unsigned Fmt, typename T, unsigned Bits>
+struct IpkPixel {
+    enum {
+        channels = (Fmt & 1) ? 4 : 3,
+        ir = (Fmt & 2) ? 0 : 2,                         /* the offset of red, blue at 2 - ir */
+        vmax = (1 << Bits) - 1
+    };
+
+    static inline void load(const T* p, int& r, int& g, int& b)
+    {
+        r = p[ir];
+        g = p[1];
+        b = p[2 - ir];
+    }
+
+    /* shift: to 8 bits */
+    template <unsigned Shift>
+    static inline void store(T* p, int r, int g, int b)
+    {
+        p[ir] = (T)(((r < 0) ? 0 : ((r > vmax) ? vmax : r)) >> Shift);
+        p[1] = (T)(((g < 0) ? 0 : ((g > vmax) ? vmax : g)) >> Shift);
+        p[2 - ir] = (T)(((b < 0) ? 0 : ((b > vmax) ? vmax : b)) >> Shift);
+        if (4 == channels)
+            p[3] = (T)((1 == sizeof(T)) ? 255 : (vmax >> Shift));
+    }
+};
+
+template <unsigned Phase, typename InT, unsigned InBits, unsigned OutFmt, typename OutT, typename Op>
+class IpkDemosaicKernel {
+    static_assert((Phase < IPK_PHASES) && (OutFmt < IPK_OUTFORMATS), "bad phase or format");
+    static_assert(((1 == sizeof(InT)) && (8 == InBits)) || ((2 == sizeof(InT)) && (InBits > 8) && (InBits <= 16)), "bad input depth");
+    static_assert((1 == sizeof(OutT)) || ((2 == sizeof(OutT)) && (2 == sizeof(InT))), "bad output depth");
+    enum { C = IpkPixel<OutFmt, OutT, InBits>::channels, shift = (1 == sizeof(OutT)) ? (InBits - 8) : 0 };
+
+    template <unsigned px, unsigned py>
+    static inline void pixel(const InT* ru, const InT* r, const InT* rd, size_t xl, size_t x, size_t xr, OutT* o, const Op& op)
+    {
+        typedef IpkSite<Phase, px, py> S;
+        int vr = IpkTap<S::sr>(ru, r, rd, xl, x, xr), vg = IpkTap<S::sg>(ru, r, rd, xl, x, xr), vb = IpkTap<S::sb>(ru, r, rd, xl, x, xr);
+        op(vr, vg, vb);
+        IpkPixel<OutFmt, OutT, InBits>::template store<shift>(o, vr, vg, vb);
+    }
+
+    /* the interior from x (odd) on, as far as the SIMD blocks go; the next x, odd */
+    template <unsigned py, typename T>
+    static size_t blocks(const T*, const T*, const T*, OutT*, size_t x, size_t, const Op&)
+    {
+        return x;
+    }
+
+#if defined(IPKERNEL_SSE2)
+    static inline __m128i quad(__m128i a, __m128i b, __m128i c, __m128i d)
+    {
+        const __m128i z = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+        const __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, z), _mm_unpacklo_epi8(b, z)), _mm_add_epi16(_mm_unpacklo_epi8(c, z), _mm_unpacklo_epi8(d, z)));
+        const __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, z), _mm_unpackhi_epi8(b, z)), _mm_add_epi16(_mm_unpackhi_epi8(c, z), _mm_unpackhi_epi8(d, z)));
+        return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, two), 2), _mm_srli_epi16(_mm_add_epi16(hi, two), 2));
+    }
+
+    /* the lanes of v[se] where x is even (odd lanes, x odd at lane 0), of v[so] elsewhere */
+    static inline __m128i pick(const __m128i* v, int so, int se)
+    {
+        const __m128i m = _mm_set1_epi16((short)0xff00);
+        return _mm_or_si128(_mm_and_si128(m, v[se]), _mm_andnot_si128(m, v[so]));
+    }
+
+    template <unsigned py>
+    static size_t blocks(const unsigned char* ru, const unsigned char* r, const unsigned char* rd, OutT* o, size_t x, size_t w, const Op& op)
+    {
+        typedef IpkSite<Phase, 1, py> So;
+        typedef IpkSite<Phase, 0, py> Se;
+        for (; x + 17 <= w; x += 16)
+        {
+            const __m128i l = _mm_loadu_si128((const __m128i*)(r + x - 1)), rr = _mm_loadu_si128((const __m128i*)(r + x + 1));
+            const __m128i u = _mm_loadu_si128((const __m128i*)(ru + x)), d = _mm_loadu_si128((const __m128i*)(rd + x));
+            const __m128i v[5] = {
+                _mm_loadu_si128((const __m128i*)(r + x)),
+                _mm_avg_epu8(l, rr),
+                _mm_avg_epu8(u, d),
+                quad(l, rr, u, d),
+                quad(_mm_loadu_si128((const __m128i*)(ru + x - 1)), _mm_loadu_si128((const __m128i*)(ru + x + 1)),
+                     _mm_loadu_si128((const __m128i*)(rd + x - 1)), _mm_loadu_si128((const __m128i*)(rd + x + 1)))
+            };
+            unsigned char pr[16], pg[16], pb[16];
+            _mm_storeu_si128((__m128i*)pr, pick(v, So::sr, Se::sr));
+            _mm_storeu_si128((__m128i*)pg, pick(v, So::sg, Se::sg));
+            _mm_storeu_si128((__m128i*)pb, pick(v, So::sb, Se::sb));
+            OutT* p = o + C * x;
+            for (unsigned i = 0; i < 16; ++i, p += C)
+            {
+                int vr = pr[i], vg = pg[i], vb = pb[i];
+                op(vr, vg, vb);
+                IpkPixel<OutFmt, OutT, InBits>::template store<shift>(p, vr, vg, vb);
+            }
+        }
+        return x;
+    }
+#endif
+
+public:
+    /* row y of parity py, between ru and rd (mirrored by the caller) */
+    template <unsigned py>
+    static void row(const InT* ru, const InT* r, const InT* rd, OutT* o, size_t w, const Op& op)
+    {
+        pixel<0, py>(ru, r, rd, 1, 0, 1, o, op);
+        size_t x = blocks<py>(ru, r, rd, o, 1, w, op);
+        for (; x + 2 < w; x += 2)
+        {
+            pixel<1, py>(ru, r, rd, x - 1, x, x + 1, o + C * x, op);
+            pixel<0, py>(ru, r, rd, x, x + 1, x + 2, o + C * (x + 1), op);
+        }
+        if (x + 1 < w)
+        {
+            pixel<1, py>(ru, r, rd, x - 1, x, x + 1, o + C * x, op);
+            ++x;
+        }
+        /* x = w - 1 */
+        if (x & 1)
+            pixel<1, py>(ru, r, rd, x - 1, x, x - 1, o + C * x, op);
+        else
+            pixel<0, py>(ru, r, rd, x - 1, x, x - 1, o + C * x, op);
+    }
+};
+
+template <unsigned Phase, typename InT, unsigned InBits, unsigned OutFmt, typename OutT, typename Op>
+static void IpkDemosaic(const void* src, size_t srcPitch, void* dst, size_t dstPitch, unsigned width, unsigned height, const Op& op, IpkChannelSums* pSums = nullptr)
+{
+    typedef IpkDemosaicKernel<Phase, InT, InBits, OutFmt, OutT, Op> K;
+    if (0 == srcPitch)
+        srcPitch = (size_t)width * sizeof(InT);
+    if (0 == dstPitch)
+        dstPitch = (size_t)width * IpkPixel<OutFmt, OutT, InBits>::channels * sizeof(OutT);
+    unsigned sx0 = 0, sx1 = 0, sy0 = 0, sy1 = 0;
+    if (pSums && !IpkSumsRange(pSums, width, height, &sx0, &sx1, &sy0, &sy1))
+        pSums = nullptr;
+#define IPK_ROW(y)  ((const InT*)((const unsigned char*)src + (size_t)(y) * srcPitch))
+    for (unsigned y = 0; y < height; ++y)
+    {
+        const InT* ru = IPK_ROW((y > 0) ? (y - 1) : 1);
+        const InT* rd = IPK_ROW((y + 1 < height) ? (y + 1) : (height - 2));
+        OutT* o = (OutT*)((unsigned char*)dst + (size_t)y * dstPitch);
+        if (y & 1)
+            K::template row<1>(ru, IPK_ROW(y), rd, o, width, op);
+        else
+            K::template row<0>(ru, IPK_ROW(y), rd, o, width, op);
+        if (pSums && (y >= sy0) && (y < sy1))
+            IpkRowSums<Phase>(IPK_ROW(y), y, sx0, sx1, pSums);
+    }
+#undef IPK_ROW
+}
+
+template <unsigned Phase, typename InT, unsigned InBits, unsigned OutFmt, typename OutT>
+static void IpkDemosaic(const void* src, size_t srcPitch, void* dst, size_t dstPitch, unsigned width, unsigned height)
+{
+    IpkDemosaic<Phase, InT, InBits, OutFmt, OutT>(src, srcPitch, dst, dstPitch, width, height, IpkIdentity());
+}
+
+template <unsigned InFmt, typename InT, unsigned InBits, unsigned OutFmt, typename OutT, typename Op>
+static void IpkConvert(const void* src, size_t srcPitch, void* dst, size_t dstPitch, unsigned width, unsigned height, const Op& op)
+{
+    typedef IpkPixel<InFmt, InT, InBits> I;
+    typedef IpkPixel<OutFmt, OutT, InBits> O;
+    static_assert((1 == sizeof(OutT)) || (2 == sizeof(InT)), "bad output depth");
+    enum { shift = (1 == sizeof(OutT)) ? (InBits - 8) : 0 };
+    if (0 == srcPitch)
+        srcPitch = (size_t)width * I::channels * sizeof(InT);
+    if (0 == dstPitch)
+        dstPitch = (size_t)width * O::channels * sizeof(OutT);
+    for (unsigned y = 0; y < height; ++y)
+    {
+        const InT* s = (const InT*)((const unsigned char*)src + (size_t)y * srcPitch);
+        OutT* d = (OutT*)((unsigned char*)dst + (size_t)y * dstPitch);
+        for (unsigned x = 0; x < width; ++x, s += I::channels, d += O::channels)
+        {
+            int r, g, b;
+            I::load(s, r, g, b);
+            op(r, g, b);
+            O::template store<shift>(d, r, g, b);
+        }
+    }
+}
+
+template <typename Op>
+struct IpkDemosaicTable {
+    typedef void (*Fn)(const void* src, size_t srcPitch, void* dst, size_t dstPitch, unsigned width, unsigned height, const Op& op, IpkChannelSums* pSums);
+
+    /* I = phase + IPK_PHASES * (depth + IPK_DEPTHS * (outformat + IPK_OUTFORMATS * b16)) */
+    template <size_t I>
+    struct Entry {
+        enum {
+            phase = I % IPK_PHASES,
+            bits = 8 + 2 * ((I / IPK_PHASES) % IPK_DEPTHS),
+            outformat = (I / (IPK_PHASES * IPK_DEPTHS)) % IPK_OUTFORMATS,
+            b16 = (I / (IPK_PHASES * IPK_DEPTHS * IPK_OUTFORMATS)) && (bits > 8)
+        };
+        typedef typename std::conditional<(bits > 8), unsigned short, unsigned char>::type InT;
+        typedef typename std::conditional<b16, unsigned short, unsigned char>::type OutT;
+        static void run(const void* src, size_t srcPitch, void* dst, size_t dstPitch, unsigned width, unsigned height, const Op& op, IpkChannelSums* pSums)
+        {
+            IpkDemosaic<phase, InT, bits, outformat, OutT, Op>(src, srcPitch, dst, dstPitch, width, height, op, pSums);
+        }
+    };
+
+    template <size_t... I>
+    static constexpr std::array<Fn, sizeof...(I)> make(std::index_sequence<I...>)
+    {
+        return {{ &Entry<I>::run... }};
+    }
+};
+
+/* the phase of a FourCC of Toupcam_get_RawFormat, -1: not Bayer */
+static inline int IpkPhase(unsigned fourcc)
+{
+    switch (fourcc)
+    {
+    case MAKEFOURCC('R', 'G', 'G', 'B'): return IPK_RGGB;
+    case MAKEFOURCC('B', 'G', 'G', 'R'): return IPK_BGGR;
+    case MAKEFOURCC('G', 'R', 'B', 'G'): return IPK_GRBG;
+    case MAKEFOURCC('G', 'B', 'R', 'G'): return IPK_GBRG;
+    default: return -1;
+    }
+}
+
+/* as imagepro_demosaic with method LINEAR, plus pitches and op; 16 bits out of a bitdepth above 8 unless bOut8 */
+template <typename Op>
+static inline HRESULT IpkDemosaicDispatch(const void* inputImage, size_t inPitch, void* outputImage, size_t outPitch, unsigned width, unsigned height,
+                                   unsigned bitdepth, unsigned informat, unsigned outformat, bool bOut8, const Op& op, IpkChannelSums* pSums = nullptr)
+{
+    typedef IpkDemosaicTable<Op> T;
+    static constexpr std::array<typename T::Fn, IPK_PHASES * IPK_DEPTHS * IPK_OUTFORMATS * 2> table =
+        T::make(std::make_index_sequence<IPK_PHASES * IPK_DEPTHS * IPK_OUTFORMATS * 2>());
+    const int phase = IpkPhase(informat);
+    if ((nullptr == inputImage) || (nullptr == outputImage))
+        return (HRESULT)0x80004003; /* E_POINTER */
+    if ((phase < 0) || (bitdepth < 8) || (bitdepth > 16) || (bitdepth & 1) || (outformat >= IPK_OUTFORMATS) || (width < 2) || (height < 2))
+        return (HRESULT)0x80070057; /* E_INVALIDARG */
+    table[phase + IPK_PHASES * ((bitdepth - 8) / 2 + IPK_DEPTHS * (outformat + IPK_OUTFORMATS * (bOut8 ? 0 : 1)))](inputImage, inPitch, outputImage, outPitch, width, height, op, pSums);
+    return 0;
+}
+
+static inline HRESULT IpkDemosaicDispatch(const void* inputImage, size_t inPitch, void* outputImage, size_t outPitch, unsigned width, unsigned height,
+                                          unsigned bitdepth, unsigned informat, unsigned outformat, bool bOut8 = false)
+{
+    return IpkDemosaicDispatch(inputImage, inPitch, outputImage, outPitch, width, height, bitdepth, informat, outformat, bOut8, IpkIdentity());
+}
+
+/* the sums of the RAW samples in the rectangle of pSums, without a demosaic: only its rows are read */
+static inline HRESULT IpkRawSums(const void* inputImage, size_t inPitch, unsigned width, unsigned height, unsigned bitdepth, unsigned informat, IpkChannelSums* pSums)
+{
+    const int phase = IpkPhase(informat);
+    if ((nullptr == inputImage) || (nullptr == pSums))
+        return (HRESULT)0x80004003; /* E_POINTER */
+    if ((phase < 0) || (bitdepth < 8) || (bitdepth > 16))
+        return (HRESULT)0x80070057; /* E_INVALIDARG */
+    if (0 == inPitch)
+        inPitch = (size_t)width * ((bitdepth > 8) ? 2 : 1);
+    unsigned x0, x1, y0, y1;
+    if (IpkSumsRange(pSums, width, height, &x0, &x1, &y0, &y1))
+    {
+        for (unsigned y = y0; y < y1; ++y)
+        {
+            const unsigned char* r = (const unsigned char*)inputImage + (size_t)y * inPitch;
+            /* the phase as template argument: the color of a parity is a constant of the loop */
+            if (bitdepth > 8)
+            {
+                switch (phase)
+                {
+                case IPK_RGGB: IpkRowSums<IPK_RGGB>((const unsigned short*)r, y, x0, x1, pSums); break;
+                case IPK_BGGR: IpkRowSums<IPK_BGGR>((const unsigned short*)r, y, x0, x1, pSums); break;
+                case IPK_GRBG: IpkRowSums<IPK_GRBG>((const unsigned short*)r, y, x0, x1, pSums); break;
+                default: IpkRowSums<IPK_GBRG>((const unsigned short*)r, y, x0, x1, pSums); break;
+                }
+            }
+            else
+            {
+                switch (phase)
+                {
+                case IPK_RGGB: IpkRowSums<IPK_RGGB>(r, y, x0, x1, pSums); break;
+                case IPK_BGGR: IpkRowSums<IPK_BGGR>(r, y, x0, x1, pSums); break;
+                case IPK_GRBG: IpkRowSums<IPK_GRBG>(r, y, x0, x1, pSums); break;
+                default: IpkRowSums<IPK_GBRG>(r, y, x0, x1, pSums); break;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "../ipwriter.h"
+
+/*
+    One frame of the camera to PNG or TIFF with its metadata (ipwriter.h).
+    usage: ipsave [-l level] [-t threads] [-w] [-s x,y,z] [-c] file.png | file.tif
+                -l: 0 ... 9 (default IPWRITER_LEVEL), -t: the compression threads (default 0, all the cores),
+                -w: 48 bits color, the full bit depth of the camera, -s: the stage position, written as
+                StageX / StageY / StageZ, -c: the file written a second time, one thread at level 6, to compare
+           ipsave -u file key=value [key=value ...]
+                the metadata of file replaced, the pixels untouched, then printed
+    The camera runs with the event callback; the first frame pulled is written with Exposure, Gain, Timestamp and Seq.
+*/
+HToupcam g_hcam = NULL;
+std::vector<unsigned char> g_frame;
+ToupcamFrameInfoV3 g_info = { 0 };
+int g_bits = 24;
+std::atomic<int> g_state(0);    /* 0: waiting, 1: frame, -1: error */
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if ((TOUPCAM_EVENT_IMAGE == nEvent) && (0 == g_state))
+    {
+        const HRESULT hr = Toupcam_PullImageV3(g_hcam, &g_frame[0], 0, g_bits, 0, &g_info);
+        if (FAILED(hr))
+        {
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+            g_state = -1;
+        }
+        else
+            g_state = 1;
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+        g_state = -1;
+    }
+}
+
+static void PrintMetadata(const char* filename)
+{
+    IpWriterMeta meta;
+    const HRESULT hr = IpReadMetadata(filename, meta);
+    if (FAILED(hr))
+        printf("failed to read metadata, hr = 0x%08x\n", hr);
+    for (size_t i = 0; i < meta.items.size(); ++i)
+        printf("  %s = %s\n", meta.items[i].first.c_str(), meta.items[i].second.c_str());
+}
+
+static int UpdateMetadata(int argc, char** argv)
+{
+    const char* filename = argv[0];
+    IpWriterMeta meta;
+    IpReadMetadata(filename, meta);
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* eq = strchr(argv[i], '=');
+        if ((NULL == eq) || (eq == argv[i]))
+        {
+            printf("bad metadata: %s\n", argv[i]);
+            return -1;
+        }
+        meta.set(std::string(argv[i], eq - argv[i]).c_str(), std::string(eq + 1));
+    }
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    const HRESULT hr = IpWriteMetadata(filename, meta);
+    if (FAILED(hr))
+    {
+        printf("failed to write metadata, hr = 0x%08x\n", hr);
+        return -1;
+    }
+    printf("%s: metadata written in %.1f ms\n", filename, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    PrintMetadata(filename);
+    return 0;
+}
+
+static long FileSize(const char* filename)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (NULL == fp)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    const long n = ftell(fp);
+    fclose(fp);
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc >= 4) && (0 == strcmp(argv[1], "-u")))
+        return UpdateMetadata(argc - 2, argv + 2);
+
+    int level = IPWRITER_LEVEL, compare = 0, stage = 0;
+    unsigned threads = 0;
+    double x = 0, y = 0, z = 0;
+    const char* filename = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-l")) && (i + 1 < argc))
+            level = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-t")) && (i + 1 < argc))
+            threads = (unsigned)atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-w"))
+            g_bits = 48;
+        else if ((0 == strcmp(argv[i], "-s")) && (i + 1 < argc))
+        {
+            if (3 != sscanf(argv[++i], "%lf,%lf,%lf", &x, &y, &z))
+            {
+                printf("bad stage position: %s\n", argv[i]);
+                return -1;
+            }
+            stage = 1;
+        }
+        else if (0 == strcmp(argv[i], "-c"))
+            compare = 1;
+        else
+            filename = argv[i];
+    }
+    if ((NULL == filename) || (level < 0) || (level > 9))
+    {
+        printf("usage: %s [-l level] [-t threads] [-w] [-s x,y,z] [-c] file.png | file.tif\n", argv[0]);
+        printf("       %s -u file key=value [key=value ...]\n", argv[0]);
+        return -1;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int width = 0, height = 0;
+    HRESULT hr;
+    if ((48 == g_bits) && (Toupcam_get_MaxBitDepth(g_hcam) > 8))
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1);
+    if (FAILED(hr = Toupcam_get_Size(g_hcam, &width, &height)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_frame.resize(TDIBWIDTHBYTES(width * g_bits) * height);
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            for (int i = 0; (0 == g_state) && (i < 1000); ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (0 == g_state)
+                printf("no frame in 10 seconds\n");
+            if (1 == g_state)
+            {
+                IpWriterMeta meta;
+                meta.camera(g_hcam);
+                meta.frame(g_info);
+                if (stage)
+                    meta.stage(x, y, z);
+                Toupcam_Stop(g_hcam);
+
+                /* the frame as pulled: BGR, bottom-up, DIB pitch */
+                const IpWriterImage img = { g_info.width, g_info.height, (unsigned)g_bits, 0, 1, 0 };
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                hr = IpWriteImage(filename, &g_frame[0], img, &meta, level, threads);
+                const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                if (FAILED(hr))
+                    printf("failed to write image, hr = 0x%08x\n", hr);
+                else
+                {
+                    printf("%s: %u x %u, %d bits, level %d, %.1f ms, %ld bytes\n", filename, img.width, img.height, g_bits, level, ms, FileSize(filename));
+                    PrintMetadata(filename);
+                    if (compare)
+                    {
+                        t0 = std::chrono::steady_clock::now();
+                        hr = IpWriteImage(filename, &g_frame[0], img, &meta, 6, 1);
+                        if (FAILED(hr))
+                            printf("failed to write image, hr = 0x%08x\n", hr);
+                        else
+                            printf("one thread, level 6: %.1f ms, %ld bytes\n", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count(), FileSize(filename));
+                    }
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    return 0;
+}
@@ -0,0 +1,361 @@
+#ifndef __ipspots_H__
+#define __ipspots_H__
+
+/*
+    Beam analysis of several spots of one frame, on a par with imagepro_spot_pull but for IPSPOT_MAX spots at once,
+    in parallel, on the RAW frame as pulled: no demosaic, 8 bits or 16 bits little endian (TOUPCAM_OPTION_BITDEPTH = 1).
+    imagepro_spot_pull gives one BeamPacket a frame, for one aperture; a laser alignment station watches several
+    beams of one image. IpSpotAnalyzer takes the apertures (ApertureSt: centre and radii of an ellipse, in pixels of
+    the frame) and for every frame fills one BeamPacket a spot, the same fields, as of ISO 11146:
+        allenergy       sum over the aperture of max(pixel - background, 0)
+        centroidX, Y    first moments over allenergy
+        beamWidthX, Y   D4sigma: 4 x the square root of the second central moment
+        ellipticity     min(beamWidthX, beamWidthY) / max(beamWidthX, beamWidthY), 1 for a round beam
+        aperture        the aperture the moments were taken over
+    The spots are spread over a pool of threads (threads, plus the calling one), one spot a job. A row of an aperture
+    is the chord of the ellipse on that row; its three sums (value, x value, x^2 value, x from the centre of the
+    aperture) are SSE2 on x86 / x64, NEON on ARM, scalar otherwise, in float lanes summed into double per row. A Bayer
+    frame is taken as is: a laser of one colour lights the pixels of its filter, the others add their small share.
+    track: the aperture of the spot follows its centroid from frame to frame, for a beam which drifts.
+    IpSpotRing hands the results from the thread of the camera to the one which plots, lock free, one producer and
+    one consumer: push() never waits (false, and dropped() counts it, when the consumer is RING frames behind), pop()
+    takes the oldest. Every IpSpotFrame holds seq and timestamp of the frame and its count spots.
+*/
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define IPSPOTS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IPSPOTS_NEON
+#endif
+#if !defined(_WIN32) && !defined(__cdecl)
+#define __cdecl
+#endif
+#include "toupcam.h"
+#include "imagepro.h"
+
+#define IPSPOT_MAX      16
+
+typedef struct {
+    ApertureSt          aperture;
+    unsigned            background;     /* subtracted from every pixel, the black level or the measured floor */
+    int                 track;          /* the aperture follows the centroid */
+} IpSpotConfig;
+
+typedef struct {
+    unsigned            seq;            /* of ToupcamFrameInfoV3 */
+    unsigned long long  timestamp;
+    unsigned            count;          /* spots */
+    BeamPacket          spot[IPSPOT_MAX];
+} IpSpotFrame;
+
+/* sums over p[0 ... n - 1] of v, x v and x^2 v, v = max(p - bg, 0), x = x0 + index */
+template <typename T>
+static void IpSpotRow(const T* p, unsigned n, float x0, unsigned bg, double* s0, double* s1, double* s2)
+{
+    unsigned i = 0;
+    float t0 = 0.0f, t1 = 0.0f, t2 = 0.0f;
+#if defined(IPSPOTS_SSE2)
+    const __m128i zero = _mm_setzero_si128(), vbg = _mm_set1_epi16((short)std::min(bg, 65535u));
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps();
+    __m128 x = _mm_add_ps(_mm_set1_ps(x0), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+    const __m128 four = _mm_set1_ps(4.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v;
+        if (1 == sizeof(T))
+            v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + i)), zero);
+        else
+            v = _mm_loadu_si128((const __m128i*)(p + i));
+        v = _mm_subs_epu16(v, vbg);
+        for (unsigned h = 0; h < 2; ++h)
+        {
+            const __m128 f = _mm_cvtepi32_ps(h ? _mm_unpackhi_epi16(v, zero) : _mm_unpacklo_epi16(v, zero));
+            const __m128 fx = _mm_mul_ps(f, x);
+            a0 = _mm_add_ps(a0, f);
+            a1 = _mm_add_ps(a1, fx);
+            a2 = _mm_add_ps(a2, _mm_mul_ps(fx, x));
+            x = _mm_add_ps(x, four);
+        }
+    }
+    float r[4];
+    _mm_storeu_ps(r, a0);
+    t0 = (r[0] + r[1]) + (r[2] + r[3]);
+    _mm_storeu_ps(r, a1);
+    t1 = (r[0] + r[1]) + (r[2] + r[3]);
+    _mm_storeu_ps(r, a2);
+    t2 = (r[0] + r[1]) + (r[2] + r[3]);
+#elif defined(IPSPOTS_NEON)
+    const uint16x8_t vbg = vdupq_n_u16((unsigned short)std::min(bg, 65535u));
+    float32x4_t a0 = vdupq_n_f32(0.0f), a1 = a0, a2 = a0;
+    static const float s_idx[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    float32x4_t x = vaddq_f32(vdupq_n_f32(x0), vld1q_f32(s_idx));
+    const float32x4_t four = vdupq_n_f32(4.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t v;
+        if (1 == sizeof(T))
+            v = vmovl_u8(vld1_u8((const uint8_t*)(p + i)));
+        else
+            v = vld1q_u16((const uint16_t*)(p + i));
+        v = vqsubq_u16(v, vbg);
+        for (unsigned h = 0; h < 2; ++h)
+        {
+            const float32x4_t f = vcvtq_f32_u32(vmovl_u16(h ? vget_high_u16(v) : vget_low_u16(v)));
+            const float32x4_t fx = vmulq_f32(f, x);
+            a0 = vaddq_f32(a0, f);
+            a1 = vaddq_f32(a1, fx);
+            a2 = vaddq_f32(a2, vmulq_f32(fx, x));
+            x = vaddq_f32(x, four);
+        }
+    }
+    float r[4];
+    vst1q_f32(r, a0);
+    t0 = (r[0] + r[1]) + (r[2] + r[3]);
+    vst1q_f32(r, a1);
+    t1 = (r[0] + r[1]) + (r[2] + r[3]);
+    vst1q_f32(r, a2);
+    t2 = (r[0] + r[1]) + (r[2] + r[3]);
+#endif
+    for (; i < n; ++i)
+    {
+        const float f = (p[i] > bg) ? (float)(p[i] - bg) : 0.0f, x = x0 + (float)i;
+        t0 += f;
+        t1 += f * x;
+        t2 += f * x * x;
+    }
+    *s0 += t0;
+    *s1 += t1;
+    *s2 += t2;
+}
+
+/* the moments of one aperture of a frame, width x height, rows of pitch bytes */
+template <typename T>
+static BeamPacket IpSpotMeasure(const void* frame, unsigned width, unsigned height, size_t pitch, const ApertureSt& ap, unsigned bg)
+{
+    BeamPacket b;
+    memset(&b, 0, sizeof(b));
+    b.aperture = ap;
+    if ((ap.rx <= 0) || (ap.ry <= 0))
+        return b;
+    const int y0 = std::max(0, (int)ceil(ap.y - ap.ry)), y1 = std::min((int)height - 1, (int)floor(ap.y + ap.ry));
+    double e = 0.0, sx = 0.0, sxx = 0.0, sy = 0.0, syy = 0.0;
+    for (int y = y0; y <= y1; ++y)
+    {
+        const double dy = (y - ap.y) / ap.ry;
+        if (dy * dy > 1.0)
+            continue;
+        const double half = ap.rx * sqrt(1.0 - dy * dy);
+        const int x0 = std::max(0, (int)ceil(ap.x - half)), x1 = std::min((int)width - 1, (int)floor(ap.x + half));
+        if (x1 < x0)
+            continue;
+        double r0 = 0.0, r1 = 0.0, r2 = 0.0;
+        const T* row = (const T*)((const unsigned char*)frame + (size_t)y * pitch);
+        IpSpotRow(row + x0, (unsigned)(x1 - x0 + 1), (float)(x0 - ap.x), bg, &r0, &r1, &r2);
+        const double yc = y - ap.y;
+        e += r0;
+        sx += r1;
+        sxx += r2;
+        sy += r0 * yc;
+        syy += r0 * yc * yc;
+    }
+    b.allenergy = e;
+    if (e <= 0.0)
+        return b;
+    const double mx = sx / e, my = sy / e;
+    b.centroidX = ap.x + mx;
+    b.centroidY = ap.y + my;
+    b.beamWidthX = 4.0 * sqrt(std::max(0.0, sxx / e - mx * mx));
+    b.beamWidthY = 4.0 * sqrt(std::max(0.0, syy / e - my * my));
+    const double wmax = std::max(b.beamWidthX, b.beamWidthY);
+    b.ellipticity = (wmax > 0.0) ? std::min(b.beamWidthX, b.beamWidthY) / wmax : 1.0;
+    return b;
+}
+
+class IpSpotAnalyzer {
+    struct Job {
+        const void* frame;
+        unsigned width, height, bits;
+        size_t pitch;
+        IpSpotFrame* out;
+    };
+    std::vector<IpSpotConfig> m_spot;
+    std::vector<std::thread> m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cvWork, m_cvDone;
+    Job m_job;
+    unsigned m_next, m_finished, m_active, m_gen;
+    bool m_bStop;
+
+    IpSpotAnalyzer(const IpSpotAnalyzer&);
+    IpSpotAnalyzer& operator=(const IpSpotAnalyzer&);
+
+    BeamPacket measure(const IpSpotConfig& c) const
+    {
+        if (m_job.bits > 8)
+            return IpSpotMeasure<unsigned short>(m_job.frame, m_job.width, m_job.height, m_job.pitch, c.aperture, c.background);
+        return IpSpotMeasure<unsigned char>(m_job.frame, m_job.width, m_job.height, m_job.pitch, c.aperture, c.background);
+    }
+
+    /* the spots of the current job, until none is left; m_mtx held on entry and on return */
+    void drain(std::unique_lock<std::mutex>& lock)
+    {
+        ++m_active;
+        while (m_next < m_spot.size())
+        {
+            const unsigned i = m_next++;
+            const IpSpotConfig c = m_spot[i];
+            lock.unlock();
+            const BeamPacket b = measure(c);
+            m_job.out->spot[i] = b;
+            lock.lock();
+            if (c.track && (b.allenergy > 0.0))
+            {
+                m_spot[i].aperture.x = b.centroidX;
+                m_spot[i].aperture.y = b.centroidY;
+            }
+            ++m_finished;
+        }
+        if ((0 == --m_active) && (m_finished == m_spot.size()))
+            m_cvDone.notify_all();
+    }
+
+    void worker()
+    {
+        unsigned gen = 0;
+        std::unique_lock<std::mutex> lock(m_mtx);
+        while (true)
+        {
+            m_cvWork.wait(lock, [this, gen]() { return m_bStop || (m_gen != gen); });
+            if (m_bStop)
+                return;
+            gen = m_gen;
+            drain(lock);
+        }
+    }
+public:
+    /* threads: the workers besides the calling thread, 0: spots - 1 up to the cores, set() decides */
+    explicit IpSpotAnalyzer(unsigned threads = 0)
+    : m_next(0), m_finished(0), m_active(0), m_gen(0), m_bStop(false)
+    {
+        memset(&m_job, 0, sizeof(m_job));
+        if (0 == threads)
+            threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        for (unsigned i = 0; i < std::min(threads, (unsigned)IPSPOT_MAX - 1); ++i)
+            m_thread.push_back(std::thread(&IpSpotAnalyzer::worker, this));
+    }
+
+    ~IpSpotAnalyzer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStop = true;
+        }
+        m_cvWork.notify_all();
+        for (size_t i = 0; i < m_thread.size(); ++i)
+            m_thread[i].join();
+    }
+
+    /* any time, from the next frame on; count <= IPSPOT_MAX */
+    bool set(const IpSpotConfig* spots, unsigned count)
+    {
+        if (count > IPSPOT_MAX)
+            return false;
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvDone.wait(lock, [this]() { return 0 == m_active; });    /* no spot being measured */
+        m_spot.assign(spots, spots + count);
+        return true;
+    }
+
+    /* the apertures as they are now, moved by track */
+    unsigned get(IpSpotConfig* spots)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        std::copy(m_spot.begin(), m_spot.end(), spots);
+        return (unsigned)m_spot.size();
+    }
+
+    /* bits: 8 or the bit depth of the 16 bits samples; pitch: bytes of a row; seq, timestamp go to out as they are */
+    void analyze(const void* frame, unsigned width, unsigned height, unsigned bits, size_t pitch, unsigned seq, unsigned long long timestamp, IpSpotFrame* out)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        out->seq = seq;
+        out->timestamp = timestamp;
+        out->count = (unsigned)m_spot.size();
+        if (m_spot.empty())
+            return;
+        /* a worker of the previous frame may still be on its way out of drain() */
+        m_cvDone.wait(lock, [this]() { return 0 == m_active; });
+        m_job.frame = frame;
+        m_job.width = width;
+        m_job.height = height;
+        m_job.bits = bits;
+        m_job.pitch = pitch;
+        m_job.out = out;
+        m_next = m_finished = 0;
+        ++m_gen;
+        if (m_spot.size() > 1)
+            m_cvWork.notify_all();
+        drain(lock);
+        m_cvDone.wait(lock, [this]() { return (m_finished == m_spot.size()) && (0 == m_active); });
+    }
+};
+
+/* single producer, single consumer; RING: power of 2 */
+template <unsigned RING = 64>
+class IpSpotRing {
+    IpSpotFrame m_slot[RING];
+    std::atomic<unsigned> m_head, m_tail;   /* m_head: written by push(), m_tail: by pop() */
+    std::atomic<unsigned> m_dropped;
+public:
+    IpSpotRing()
+    : m_head(0), m_tail(0), m_dropped(0)
+    {
+    }
+
+    /* the producer */
+    bool push(const IpSpotFrame& f)
+    {
+        const unsigned head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) >= RING)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        IpSpotFrame& s = m_slot[head & (RING - 1)];
+        s.seq = f.seq;
+        s.timestamp = f.timestamp;
+        s.count = f.count;
+        memcpy(s.spot, f.spot, sizeof(BeamPacket) * f.count);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* the consumer */
+    bool pop(IpSpotFrame* pFrame)
+    {
+        const unsigned tail = m_tail.load(std::memory_order_relaxed);
+        if (m_head.load(std::memory_order_acquire) == tail)
+            return false;
+        const IpSpotFrame& s = m_slot[tail & (RING - 1)];
+        pFrame->seq = s.seq;
+        pFrame->timestamp = s.timestamp;
+        pFrame->count = s.count;
+        memcpy(pFrame->spot, s.spot, sizeof(BeamPacket) * s.count);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    unsigned dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+};
+
+#endif
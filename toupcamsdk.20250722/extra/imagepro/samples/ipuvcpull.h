@@ -0,0 +1,135 @@
+#ifndef __ipuvcpull_H__
+#define __ipuvcpull_H__
+
+/*
+    The pulls of the UVC class cameras into stitch / EDF, on a par with imagepro_stitch_pullV4 / imagepro_edf_pullV4:
+    frame info, and frames leased from a pool instead of one buffer the program copies out of.
+    imagepro_stitch_pullham / imagepro_edf_pullham (and the pullsam pair) take a bare frame buffer: Uvcham and Uvcsam
+    report no frame info, and the program which still wants the frame (to show it, save it) after the pull either
+    copies it out or holds both the pull and its own work on one buffer. IpUvcPuller wraps any of the four: pull() takes
+    a free slot of the pool, hands it to the pull as its frame buffer and returns it leased, with the info, until
+    release(). The frame is written once, by the pull; the next pulls go to the other slots while the program works on
+    it, on whatever thread.
+    The info has the fields of ToupcamFrameInfoV3 the stitch / EDF programs use, same names: width and height as
+    given to the pull, seq counted by the puller (the pulls which succeeded, from 1) and a time stamp read on the host
+    right after the pull, steady clock, in microseconds (there is no device time stamp on this path, the difference
+    of two is still the frame interval to within the jitter of the pulling thread).
+    pull() returns E_OUTOFMEMORY while all the slots are leased, the frame stays with the camera.
+        IpUvcPuller<HImageproStitch, HUvcham> puller(imagepro_stitch_pullham, 3, TDIBWIDTHBYTES(24 * w) * h);
+        IpUvcFrame frame;
+        if (SUCCEEDED(puller.pull(stitch, hcam, 1, w, h, &frame)))
+        {
+            ... frame.data, frame.info.seq, frame.info.timestamp ...
+            puller.release(frame);
+        }
+    The slots come from the allocator of ipalloc.h (NULL: the global one), IPALLOC_ALIGN aligned.
+*/
+#include <string.h>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "ipalloc.h"
+
+typedef struct {
+    unsigned            width;
+    unsigned            height;
+    unsigned            flag;       /* always 0: no flags on this path */
+    unsigned            seq;        /* the pulls which succeeded, from 1 */
+    unsigned long long  timestamp;  /* microsecond, host steady clock at the end of the pull */
+} ImageproUvcFrameInfo;
+
+typedef struct {
+    void*                   data;   /* the frame, as the pull wrote it, valid until release() */
+    int                     index;  /* of the slot */
+    ImageproUvcFrameInfo    info;
+} IpUvcFrame;
+
+template <typename E, typename H>
+class IpUvcPuller {
+public:
+    /* the signature of imagepro_stitch_pullham / imagepro_edf_pullham / imagepro_stitch_pullsam / imagepro_edf_pullsam */
+    typedef HRESULT (__cdecl *PULL)(E handle, H h, int bFeed, int width, int height, void* pFrameBuffer);
+private:
+    PULL                m_pull;
+    const IpAllocator*  m_a;
+    size_t              m_frameBytes;
+    std::vector<void*>  m_slot;
+    std::vector<int>    m_free;
+    unsigned            m_seq;
+    std::mutex          m_mtx;
+
+    IpUvcPuller(const IpUvcPuller&);
+    IpUvcPuller& operator=(const IpUvcPuller&);
+public:
+    /* frameBytes: the largest frame the pull writes; slots: the frames the program holds at once, plus one */
+    IpUvcPuller(PULL pull, unsigned slots, size_t frameBytes, const IpAllocator* a = NULL)
+    : m_pull(pull), m_a(a), m_frameBytes(frameBytes), m_seq(0)
+    {
+        const IpAllocator& al = m_a ? *m_a : IpAllocGlobal();
+        for (unsigned i = 0; i < slots; ++i)
+        {
+            void* p = al.pAlloc(al.ctx, frameBytes, 0);
+            if (NULL == p)
+                break;
+            m_slot.push_back(p);
+            m_free.push_back((int)i);
+        }
+    }
+
+    ~IpUvcPuller()
+    {
+        const IpAllocator& al = m_a ? *m_a : IpAllocGlobal();
+        for (size_t i = 0; i < m_slot.size(); ++i)
+            al.pFree(al.ctx, m_slot[i]);
+    }
+
+    /* the slots allocated, fewer than asked for when out of memory */
+    unsigned slots() const { return (unsigned)m_slot.size(); }
+    size_t frameBytes() const { return m_frameBytes; }
+
+    HRESULT pull(E handle, H h, int bFeed, int width, int height, IpUvcFrame* pFrame)
+    {
+        if ((NULL == pFrame) || (width <= 0) || (height <= 0))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        int index = -1;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_free.empty())
+                return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+            index = m_free.back();
+            m_free.pop_back();
+        }
+        const HRESULT hr = m_pull(handle, h, bFeed, width, height, m_slot[index]);
+        const unsigned long long now = (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (FAILED(hr))
+        {
+            m_free.push_back(index);
+            return hr;
+        }
+        memset(pFrame, 0, sizeof(*pFrame));
+        pFrame->data = m_slot[index];
+        pFrame->index = index;
+        pFrame->info.width = (unsigned)width;
+        pFrame->info.height = (unsigned)height;
+        pFrame->info.seq = ++m_seq;
+        pFrame->info.timestamp = now;
+        return hr;
+    }
+
+    void release(const IpUvcFrame& frame)
+    {
+        if ((frame.index < 0) || (frame.index >= (int)m_slot.size()))
+            return;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_free.push_back(frame.index);
+    }
+
+    unsigned leased()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return (unsigned)(m_slot.size() - m_free.size());
+    }
+};
+
+#endif
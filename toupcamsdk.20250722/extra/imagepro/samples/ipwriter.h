@@ -0,0 +1,935 @@
+#ifndef __ipwriter_H__
+#define __ipwriter_H__
+
+/*
+    PNG and TIFF writer for the captures, compressed in parallel, with the metadata of the capture in the file.
+    One deflate stream over a 25 MP frame is seconds on one core (SaveImageByWIC, savebitmap, libpng at its default
+    level); here the image is cut into chunks of rows (IPWRITER_CHUNK bytes) compressed at once by threads workers:
+        PNG     the filtered rows of every chunk are one run of raw deflate, primed with the 32 KB of filtered data
+                before it (deflateSetDictionary, so the ratio is that of one stream to within a fraction of a percent),
+                ended by Z_SYNC_FLUSH on a byte boundary; the runs one after the other, between the zlib header and the
+                Adler-32 of the whole (combined from those of the runs), are the IDAT stream, one IDAT a run. Filter:
+                Up at the fast levels (1 ... 3), at 4 and above the one of the smallest sum of the row (as libpng)
+        TIFF    one strip a chunk, Adobe deflate with the horizontal predictor (Predictor = 2), little endian,
+                uncompressed at level 0
+    level: 0 (stored) ... 9, IPWRITER_LEVEL by default; 1 is within about 10% of the size of 6 on camera frames, at a
+    fraction of its time. Without zlib (IPWRITER_ZLIB not defined; with it, -lz) PNG is stored and TIFF PackBits.
+    The image is as pulled: 8 or 16 bits mono, 24 or 48 bits color (RGB24 / RGB48), BGR order unless bRGB
+    (TOUPCAM_OPTION_BYTEORDER), bottom-up as a DIB when bBottomUp, pitch bytes from one row to the next
+    (0: TDIBWIDTHBYTES(width * bits)); 16 bits samples are little endian, the value as given (no shift to 16 bits).
+    IpWriterMeta holds the metadata, key = value, written as one tEXt chunk a key (PNG, before the IDAT), or as the
+    lines "key=value" of ImageDescription (TIFF); camera() adds Exposure (us) and Gain (%), frame() Timestamp (us) and
+    Seq of the frame info, stage() StageX / StageY / StageZ in the units of the stage. IpWriteMetadata replaces the
+    metadata of a file written here without decoding or compressing the pixels again: the PNG is copied chunk by chunk
+    (the IDAT as they are) into a temporary file renamed over it, the TIFF gets a new IFD at its end. IpReadMetadata
+    reads it back.
+    The workers are threads started for the one call (0: hardware_concurrency); an async saver gives each image the
+    share of its pool not busy with the others (asyncsave.h with ASYNCSAVE_IPWRITER).
+    The results are HRESULT: E_INVALIDARG (format, size; TIFF above 4 GB), E_OUTOFMEMORY, E_FAIL (file).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <utility>
+#if defined(IPWRITER_ZLIB)
+#include <zlib.h>
+#endif
+#include "toupcam.h"
+
+#define IPWRITER_LEVEL      1
+#define IPWRITER_CHUNK      (256 * 1024)    /* bytes of pixels, about, a chunk of rows */
+
+typedef struct {
+    unsigned    width, height;
+    unsigned    bits;       /* 8, 16: mono; 24, 48: color */
+    int         bRGB;       /* color: red first; 0: blue first (the default byte order, as a DIB) */
+    int         bBottomUp;  /* the first row in memory is the bottom one */
+    size_t      pitch;      /* 0: TDIBWIDTHBYTES(width * bits) */
+} IpWriterImage;
+
+class IpWriterMeta {
+public:
+    std::vector<std::pair<std::string, std::string>> items;
+
+    /* replaces the value of key, if any; keys of 1 ... 79 characters, no '=' (TIFF) or line feed */
+    void set(const char* key, const std::string& value)
+    {
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if (items[i].first == key)
+            {
+                items[i].second = value;
+                return;
+            }
+        }
+        items.push_back(std::make_pair(std::string(key), value));
+    }
+
+    void set(const char* key, double value)
+    {
+        char str[64];
+        snprintf(str, sizeof(str), "%.9g", value);
+        set(key, std::string(str));
+    }
+
+    void set(const char* key, unsigned long long value)
+    {
+        char str[32];
+        snprintf(str, sizeof(str), "%llu", value);
+        set(key, std::string(str));
+    }
+
+    const std::string* get(const char* key) const
+    {
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if (items[i].first == key)
+                return &items[i].second;
+        }
+        return nullptr;
+    }
+
+    /* Exposure, microseconds, Gain, percent, as the camera has them now */
+    void camera(HToupcam h)
+    {
+        unsigned nTime = 0;
+        unsigned short nGain = 0;
+        if (SUCCEEDED(Toupcam_get_ExpoTime(h, &nTime)))
+            set("Exposure", (unsigned long long)nTime);
+        if (SUCCEEDED(Toupcam_get_ExpoAGain(h, &nGain)))
+            set("Gain", (unsigned long long)nGain);
+    }
+
+    void frame(const ToupcamFrameInfoV3& info)
+    {
+        set("Timestamp", info.timestamp);
+        set("Seq", (unsigned long long)info.seq);
+    }
+
+    void stage(double x, double y, double z)
+    {
+        set("StageX", x);
+        set("StageY", y);
+        set("StageZ", z);
+    }
+};
+
+static inline unsigned IpWriterCrc32(unsigned crc, const unsigned char* p, size_t n)
+{
+    struct Table {
+        unsigned t[256];
+        Table()
+        {
+            for (unsigned i = 0; i < 256; ++i)
+            {
+                unsigned c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+                t[i] = c;
+            }
+        }
+    };
+    static const Table table;
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i)
+        crc = table.t[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#define IPWRITER_ADLER_BASE     65521u
+
+static inline unsigned IpWriterAdler32(unsigned adler, const unsigned char* p, size_t n)
+{
+    unsigned a = adler & 0xffff, b = adler >> 16;
+    while (n)
+    {
+        size_t k = (n < 5552) ? n : 5552;   /* no overflow of b before the modulo */
+        n -= k;
+        while (k--)
+        {
+            a += *p++;
+            b += a;
+        }
+        a %= IPWRITER_ADLER_BASE;
+        b %= IPWRITER_ADLER_BASE;
+    }
+    return a | (b << 16);
+}
+
+/* the Adler-32 of A then B, of those of A and B (len2: of B), as adler32_combine */
+static inline unsigned IpWriterAdler32Combine(unsigned adler1, unsigned adler2, unsigned long long len2)
+{
+    const unsigned rem = (unsigned)(len2 % IPWRITER_ADLER_BASE);
+    unsigned sum1 = adler1 & 0xffff;
+    unsigned sum2 = (unsigned)(((unsigned long long)rem * sum1) % IPWRITER_ADLER_BASE);
+    sum1 += (adler2 & 0xffff) + IPWRITER_ADLER_BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + IPWRITER_ADLER_BASE - rem;
+    if (sum1 >= IPWRITER_ADLER_BASE)
+        sum1 -= IPWRITER_ADLER_BASE;
+    if (sum1 >= IPWRITER_ADLER_BASE)
+        sum1 -= IPWRITER_ADLER_BASE;
+    if (sum2 >= 2 * IPWRITER_ADLER_BASE)
+        sum2 -= 2 * IPWRITER_ADLER_BASE;
+    if (sum2 >= IPWRITER_ADLER_BASE)
+        sum2 -= IPWRITER_ADLER_BASE;
+    return sum1 | (sum2 << 16);
+}
+
+/* fn(i) for i = 0 ... n - 1, on threads (0: hardware_concurrency) including the calling one */
+template <typename F>
+static void IpWriterParallel(size_t n, unsigned threads, const F& fn)
+{
+    if (0 == threads)
+        threads = std::thread::hardware_concurrency();
+    if (threads > n)
+        threads = (unsigned)n;
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < n; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> vecThread;
+    for (unsigned i = 1; i < threads; ++i)
+        vecThread.push_back(std::thread(worker));
+    worker();
+    for (size_t i = 0; i < vecThread.size(); ++i)
+        vecThread[i].join();
+}
+
+/* the rows top-down, samples in file order: red first, 16 bits big endian (PNG) or little endian (TIFF) */
+class IpWriterRows {
+    const unsigned char* m_data;
+    const IpWriterImage& m_img;
+    const size_t m_pitch, m_bytes;
+    const unsigned m_spp, m_bps;
+    const bool m_bBigEndian;
+public:
+    IpWriterRows(const void* data, const IpWriterImage& img, bool bBigEndian)
+    : m_data((const unsigned char*)data), m_img(img), m_pitch(img.pitch ? img.pitch : TDIBWIDTHBYTES(img.width * img.bits)),
+      m_bytes((size_t)img.width * img.bits / 8), m_spp((img.bits % 24) ? 1 : 3), m_bps((16 == img.bits || 48 == img.bits) ? 2 : 1),
+      m_bBigEndian(bBigEndian)
+    {
+    }
+
+    size_t bytes() const { return m_bytes; }
+    unsigned spp() const { return m_spp; }
+    unsigned bps() const { return m_bps; }
+
+    /* row y, into buf (bytes()) unless it is in file order already */
+    const unsigned char* row(unsigned y, unsigned char* buf) const
+    {
+        const unsigned char* s = m_data + (size_t)(m_img.bBottomUp ? (m_img.height - 1 - y) : y) * m_pitch;
+        const bool bSwapRB = (3 == m_spp) && (!m_img.bRGB), bSwapBytes = (2 == m_bps) && m_bBigEndian;
+        if ((!bSwapRB) && (!bSwapBytes))
+            return s;
+        if (1 == m_bps)
+        {
+            for (size_t i = 0; i < m_bytes; i += 3)
+            {
+                buf[i] = s[i + 2];
+                buf[i + 1] = s[i + 1];
+                buf[i + 2] = s[i];
+            }
+        }
+        else
+        {
+            const unsigned px = 2 * m_spp;
+            for (size_t i = 0; i < m_bytes; i += px)
+            {
+                for (unsigned c = 0; c < m_spp; ++c)
+                {
+                    const unsigned sc = bSwapRB ? (m_spp - 1 - c) : c;
+                    const unsigned char lo = s[i + 2 * sc], hi = s[i + 2 * sc + 1];
+                    buf[i + 2 * c] = bSwapBytes ? hi : lo;
+                    buf[i + 2 * c + 1] = bSwapBytes ? lo : hi;
+                }
+            }
+        }
+        return buf;
+    }
+};
+
+static inline bool IpWriterCheck(const IpWriterImage& img)
+{
+    return (img.width > 0) && (img.height > 0) && ((8 == img.bits) || (16 == img.bits) || (24 == img.bits) || (48 == img.bits))
+        && ((0 == img.pitch) || (img.pitch >= (size_t)img.width * img.bits / 8));
+}
+
+static inline void IpWriterBe32(unsigned char* p, unsigned v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static inline bool IpWriterPngChunk(FILE* fp, const char* type, const unsigned char* data, size_t len)
+{
+    unsigned char head[8], tail[4];
+    IpWriterBe32(head, (unsigned)len);
+    memcpy(head + 4, type, 4);
+    IpWriterBe32(tail, IpWriterCrc32(IpWriterCrc32(0, head + 4, 4), data, len));
+    return (8 == fwrite(head, 1, 8, fp)) && ((0 == len) || (len == fwrite(data, 1, len, fp))) && (4 == fwrite(tail, 1, 4, fp));
+}
+
+static inline bool IpWriterPngText(FILE* fp, const IpWriterMeta* meta)
+{
+    if (meta)
+    {
+        for (size_t i = 0; i < meta->items.size(); ++i)
+        {
+            std::string s = meta->items[i].first;
+            s.push_back('\0');
+            s += meta->items[i].second;
+            if (!IpWriterPngChunk(fp, "tEXt", (const unsigned char*)s.data(), s.size()))
+                return false;
+        }
+    }
+    return true;
+}
+
+/* filter 0 None, 1 Sub, 2 Up, 3 Average, 4 Paeth of row cur (n bytes, bpp bytes a pixel, prev the row above) */
+static inline void IpWriterPngFilter(int filter, const unsigned char* cur, const unsigned char* prev, size_t n, unsigned bpp, unsigned char* out)
+{
+    out[0] = (unsigned char)filter;
+    ++out;
+    switch (filter)
+    {
+    case 1:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = (unsigned char)(cur[i] - ((i >= bpp) ? cur[i - bpp] : 0));
+        break;
+    case 2:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = (unsigned char)(cur[i] - prev[i]);
+        break;
+    case 3:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = (unsigned char)(cur[i] - ((((i >= bpp) ? cur[i - bpp] : 0) + prev[i]) >> 1));
+        break;
+    case 4:
+        for (size_t i = 0; i < n; ++i)
+        {
+            const int a = (i >= bpp) ? cur[i - bpp] : 0, b = prev[i], c = (i >= bpp) ? prev[i - bpp] : 0;
+            const int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+            out[i] = (unsigned char)(cur[i] - (((pa <= pb) && (pa <= pc)) ? a : ((pb <= pc) ? b : c)));
+        }
+        break;
+    default:
+        memcpy(out, cur, n);
+        break;
+    }
+}
+
+/* rows y0 ... y1 - 1 filtered into out ((1 + n) a row); adaptive: of the 5, the smallest sum of |signed byte| */
+static inline void IpWriterPngRows(const IpWriterRows& rows, unsigned y0, unsigned y1, int filter, unsigned char* out)
+{
+    const size_t n = rows.bytes();
+    const unsigned bpp = rows.spp() * rows.bps();
+    std::vector<unsigned char> buf(2 * n), zero(n, 0), trial((filter < 0) ? (n + 1) : 0);
+    const unsigned char* prev = (y0 > 0) ? rows.row(y0 - 1, &buf[(y0 - 1) % 2 * n]) : &zero[0];
+    for (unsigned y = y0; y < y1; ++y, out += n + 1)
+    {
+        const unsigned char* cur = rows.row(y, &buf[y % 2 * n]);
+        if (filter >= 0)
+            IpWriterPngFilter(filter, cur, prev, n, bpp, out);
+        else
+        {
+            unsigned long long best = ~0ULL;
+            for (int f = 0; f < 5; ++f)
+            {
+                IpWriterPngFilter(f, cur, prev, n, bpp, &trial[0]);
+                unsigned long long sum = 0;
+                for (size_t i = 1; i <= n; ++i)
+                    sum += (trial[i] < 128) ? trial[i] : (256 - trial[i]);
+                if (sum < best)
+                {
+                    best = sum;
+                    memcpy(out, &trial[0], n + 1);
+                }
+            }
+        }
+        prev = cur;
+    }
+}
+
+/* stored blocks: no zlib, or level 0 */
+static inline void IpWriterStored(const unsigned char* p, size_t n, bool bFinal, std::vector<unsigned char>& out)
+{
+    do {
+        const size_t k = (n < 65535) ? n : 65535;
+        n -= k;
+        out.push_back((bFinal && (0 == n)) ? 1 : 0);
+        out.push_back((unsigned char)k);
+        out.push_back((unsigned char)(k >> 8));
+        out.push_back((unsigned char)~k);
+        out.push_back((unsigned char)(~k >> 8));
+        out.insert(out.end(), p, p + k);
+        p += k;
+    } while (n);
+}
+
+/* raw deflate of p, primed with dict, ended on a byte boundary (or final) */
+static inline bool IpWriterDeflate(const unsigned char* dict, size_t nDict, const unsigned char* p, size_t n, int level, bool bFinal, std::vector<unsigned char>& out)
+{
+    out.clear();
+#if defined(IPWRITER_ZLIB)
+    if (level > 0)
+    {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (Z_OK != deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY))
+            return false;
+        if (nDict)
+            deflateSetDictionary(&zs, dict, (uInt)nDict);
+        out.resize(deflateBound(&zs, (uLong)n) + 16);
+        zs.next_in = (Bytef*)p;
+        zs.avail_in = (uInt)n;
+        zs.next_out = &out[0];
+        zs.avail_out = (uInt)out.size();
+        const int ret = deflate(&zs, bFinal ? Z_FINISH : Z_SYNC_FLUSH);
+        out.resize(out.size() - zs.avail_out);
+        deflateEnd(&zs);
+        return (bFinal ? (Z_STREAM_END == ret) : (Z_OK == ret)) && (0 == zs.avail_in);
+    }
+#else
+    (void)dict;
+    (void)nDict;
+    (void)level;
+#endif
+    IpWriterStored(p, n, bFinal, out);
+    return true;
+}
+
+/* the file to be written, as the filename is given */
+#if defined(_WIN32)
+static inline FILE* IpWriterCreate(const wchar_t* filename) { return _wfopen(filename, L"wb"); }
+#endif
+static inline FILE* IpWriterCreate(const char* filename) { return fopen(filename, "wb"); }
+
+template <typename C>
+static HRESULT IpWritePng(const C* filename, const void* data, const IpWriterImage& img, const IpWriterMeta* meta = nullptr, int level = IPWRITER_LEVEL, unsigned threads = 0)
+{
+    if ((nullptr == data) || !IpWriterCheck(img) || (level < 0) || (level > 9))
+        return (HRESULT)0x80070057; /* E_INVALIDARG */
+    const IpWriterRows rows(data, img, true);
+    const size_t stride = rows.bytes() + 1;
+    const unsigned chunkRows = (unsigned)((stride >= IPWRITER_CHUNK) ? 1 : (IPWRITER_CHUNK / stride));
+    const unsigned nChunk = (img.height + chunkRows - 1) / chunkRows;
+    const unsigned dictRows = (unsigned)((32768 + stride - 1) / stride);
+    const int filter = (0 == level) ? 0 : ((level <= 3) ? 2 : -1);
+
+    struct Chunk {
+        std::vector<unsigned char> out;
+        unsigned adler;
+        size_t len;
+        bool bOk;
+    };
+    std::vector<Chunk> chunk(nChunk);
+    IpWriterParallel(nChunk, threads, [&](size_t i) {
+        Chunk& c = chunk[i];
+        const unsigned y0 = (unsigned)i * chunkRows, y1 = (y0 + chunkRows < img.height) ? (y0 + chunkRows) : img.height;
+        const unsigned d0 = (0 == level) ? y0 : ((y0 < dictRows) ? 0 : (y0 - dictRows));
+        std::vector<unsigned char> buf;
+        try {
+            buf.resize((size_t)(y1 - d0) * stride);
+        }
+        catch (...) {
+            c.bOk = false;
+            return;
+        }
+        /* the rows before y0 again: the dictionary is the filtered data, filtered as its own chunk filters it */
+        IpWriterPngRows(rows, d0, y1, filter, &buf[0]);
+        const size_t nDict = (size_t)(y0 - d0) * stride, nUse = (nDict > 32768) ? 32768 : nDict;
+        c.len = buf.size() - nDict;
+        c.adler = IpWriterAdler32(1, &buf[nDict], c.len);
+        c.bOk = IpWriterDeflate(&buf[nDict - nUse], nUse, &buf[nDict], c.len, level, i + 1 == nChunk, c.out);
+    });
+
+    FILE* fp = IpWriterCreate(filename);
+    if (nullptr == fp)
+        return (HRESULT)0x80004005; /* E_FAIL */
+    static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char ihdr[13];
+    IpWriterBe32(ihdr, img.width);
+    IpWriterBe32(ihdr + 4, img.height);
+    ihdr[8] = (unsigned char)(8 * rows.bps());
+    ihdr[9] = (3 == rows.spp()) ? 2 : 0;    /* truecolor, greyscale */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    bool bOk = (8 == fwrite(sig, 1, 8, fp)) && IpWriterPngChunk(fp, "IHDR", ihdr, 13) && IpWriterPngText(fp, meta);
+    unsigned adler = 1;
+    for (unsigned i = 0; bOk && (i < nChunk); ++i)
+    {
+        Chunk& c = chunk[i];
+        bOk = c.bOk;
+        if (!bOk)
+            break;
+        adler = (0 == i) ? c.adler : IpWriterAdler32Combine(adler, c.adler, c.len);
+        if (0 == i)
+        {
+            const unsigned char zh[2] = { 0x78, (unsigned char)((level <= 1) ? 0x01 : ((level <= 5) ? 0x5e : ((6 == level) ? 0x9c : 0xda))) };
+            c.out.insert(c.out.begin(), zh, zh + 2);
+        }
+        if (i + 1 == nChunk)
+        {
+            unsigned char a[4];
+            IpWriterBe32(a, adler);
+            c.out.insert(c.out.end(), a, a + 4);
+        }
+        bOk = IpWriterPngChunk(fp, "IDAT", &c.out[0], c.out.size());
+        std::vector<unsigned char>().swap(c.out);
+    }
+    bOk = bOk && IpWriterPngChunk(fp, "IEND", nullptr, 0);
+    if (0 != fclose(fp))
+        bOk = false;
+    return bOk ? 0 : (HRESULT)0x80004005; /* E_FAIL */
+}
+
+#define IPWRITER_TIFF_NONE          1
+#define IPWRITER_TIFF_DEFLATE       8
+#define IPWRITER_TIFF_PACKBITS      32773
+
+/* TIFF rule for PackBits: every row is packed on its own */
+static inline void IpWriterPackBits(const unsigned char* p, size_t n, std::vector<unsigned char>& out)
+{
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t run = 1;
+        while ((i + run < n) && (run < 128) && (p[i + run] == p[i]))
+            ++run;
+        if (run >= 2)
+        {
+            out.push_back((unsigned char)(1 - (int)run));
+            out.push_back(p[i]);
+            i += run;
+        }
+        else
+        {
+            size_t lit = 1;
+            while ((i + lit < n) && (lit < 128) && !((i + lit + 1 < n) && (p[i + lit] == p[i + lit + 1])))
+                ++lit;
+            out.push_back((unsigned char)(lit - 1));
+            out.insert(out.end(), p + i, p + i + lit);
+            i += lit;
+        }
+    }
+}
+
+struct IpWriterTiffEntry {
+    unsigned short tag, type;
+    unsigned count, value;      /* value: or the offset of the values of more than 4 bytes */
+};
+
+static inline void IpWriterLe16(unsigned char* p, unsigned v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static inline void IpWriterLe32(unsigned char* p, unsigned v)
+{
+    IpWriterLe16(p, v);
+    IpWriterLe16(p + 2, v >> 16);
+}
+
+static inline unsigned IpWriterGetLe32(const unsigned char* p)
+{
+    return p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* the text of ImageDescription, NUL terminated, at the current end of fp (even); false: failed */
+static inline bool IpWriterTiffText(FILE* fp, const IpWriterMeta* meta, IpWriterTiffEntry& e)
+{
+    std::string s;
+    if (meta)
+    {
+        for (size_t i = 0; i < meta->items.size(); ++i)
+            s += meta->items[i].first + "=" + meta->items[i].second + "\n";
+    }
+    s.push_back('\0');
+    if (s.size() & 1)
+        s.push_back('\0');
+    e.tag = 270;
+    e.type = 2;
+    e.count = (unsigned)s.size();
+    e.value = (unsigned)ftell(fp);
+    return s.size() == fwrite(s.data(), 1, s.size(), fp);
+}
+
+/* entries in the order of the tags, then the offset of the next IFD (0); the offset of the IFD patched into the header */
+static inline bool IpWriterTiffIfd(FILE* fp, const std::vector<IpWriterTiffEntry>& ent, unsigned next)
+{
+    if (ftell(fp) & 1)
+        fputc(0, fp);
+    const long pos = ftell(fp);
+    std::vector<unsigned char> b(2 + 12 * ent.size() + 4);
+    IpWriterLe16(&b[0], (unsigned)ent.size());
+    for (size_t i = 0; i < ent.size(); ++i)
+    {
+        unsigned char* p = &b[2 + 12 * i];
+        IpWriterLe16(p, ent[i].tag);
+        IpWriterLe16(p + 2, ent[i].type);
+        IpWriterLe32(p + 4, ent[i].count);
+        if ((3 == ent[i].type) && (1 == ent[i].count))
+        {
+            IpWriterLe16(p + 8, ent[i].value);
+            IpWriterLe16(p + 10, 0);
+        }
+        else
+            IpWriterLe32(p + 8, ent[i].value);
+    }
+    IpWriterLe32(&b[b.size() - 4], next);
+    unsigned char off[4];
+    IpWriterLe32(off, (unsigned)pos);
+    return (b.size() == fwrite(&b[0], 1, b.size(), fp)) && (0 == fseek(fp, 4, SEEK_SET)) && (4 == fwrite(off, 1, 4, fp));
+}
+
+template <typename C>
+static HRESULT IpWriteTiff(const C* filename, const void* data, const IpWriterImage& img, const IpWriterMeta* meta = nullptr, int level = IPWRITER_LEVEL, unsigned threads = 0)
+{
+    if ((nullptr == data) || !IpWriterCheck(img) || (level < 0) || (level > 9))
+        return (HRESULT)0x80070057; /* E_INVALIDARG */
+    const IpWriterRows rows(data, img, false);
+    const size_t n = rows.bytes();
+    const unsigned spp = rows.spp(), bps = rows.bps();
+#if defined(IPWRITER_ZLIB)
+    const unsigned compression = level ? IPWRITER_TIFF_DEFLATE : IPWRITER_TIFF_NONE;
+#else
+    const unsigned compression = level ? IPWRITER_TIFF_PACKBITS : IPWRITER_TIFF_NONE;
+#endif
+    if ((IPWRITER_TIFF_NONE == compression) && ((unsigned long long)n * img.height > 0xf0000000ULL))
+        return (HRESULT)0x80070057; /* E_INVALIDARG, beyond classic TIFF */
+    const unsigned stripRows = (unsigned)((n >= IPWRITER_CHUNK) ? 1 : (IPWRITER_CHUNK / n));
+    const unsigned nStrip = (img.height + stripRows - 1) / stripRows;
+
+    std::vector<std::vector<unsigned char>> strip(nStrip);
+    std::vector<char> vecOk(nStrip, 0);
+    IpWriterParallel(nStrip, threads, [&](size_t i) {
+        const unsigned y0 = (unsigned)i * stripRows, y1 = (y0 + stripRows < img.height) ? (y0 + stripRows) : img.height;
+        std::vector<unsigned char>& out = strip[i];
+        try {
+            std::vector<unsigned char> buf(n), raw;
+            if (IPWRITER_TIFF_PACKBITS != compression)
+                raw.resize((size_t)(y1 - y0) * n);
+            for (unsigned y = y0; y < y1; ++y)
+            {
+                const unsigned char* r = rows.row(y, &buf[0]);
+                if (IPWRITER_TIFF_PACKBITS == compression)
+                    IpWriterPackBits(r, n, out);
+                else if (IPWRITER_TIFF_NONE == compression)
+                    memcpy(&raw[(size_t)(y - y0) * n], r, n);
+                else if (1 == bps)
+                {
+                    /* Predictor 2: the difference to the sample of the pixel on the left */
+                    unsigned char* d = &raw[(size_t)(y - y0) * n];
+                    for (size_t k = 0; k < spp; ++k)
+                        d[k] = r[k];
+                    for (size_t k = spp; k < n; ++k)
+                        d[k] = (unsigned char)(r[k] - r[k - spp]);
+                }
+                else
+                {
+                    unsigned char* d = &raw[(size_t)(y - y0) * n];
+                    const size_t step = 2 * spp;
+                    for (size_t k = 0; k < n; k += 2)
+                    {
+                        const unsigned v = r[k] | ((unsigned)r[k + 1] << 8), l = (k >= step) ? (r[k - step] | ((unsigned)r[k - step + 1] << 8)) : 0;
+                        IpWriterLe16(d + k, (v - l) & 0xffff);
+                    }
+                }
+            }
+            if (IPWRITER_TIFF_NONE == compression)
+                out.swap(raw);
+            else if (IPWRITER_TIFF_DEFLATE == compression)
+            {
+                std::vector<unsigned char> z;
+                if (!IpWriterDeflate(nullptr, 0, &raw[0], raw.size(), level, true, z))
+                    return;
+                /* zlib stream: header, data, Adler-32 */
+                out.reserve(z.size() + 6);
+                out.push_back(0x78);
+                out.push_back((unsigned char)((level <= 1) ? 0x01 : ((level <= 5) ? 0x5e : ((6 == level) ? 0x9c : 0xda))));
+                out.insert(out.end(), z.begin(), z.end());
+                unsigned char a[4];
+                IpWriterBe32(a, IpWriterAdler32(1, &raw[0], raw.size()));
+                out.insert(out.end(), a, a + 4);
+            }
+            vecOk[i] = 1;
+        }
+        catch (...) {
+        }
+    });
+    unsigned long long total = 8;
+    for (unsigned i = 0; i < nStrip; ++i)
+    {
+        if (!vecOk[i])
+            return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+        total += strip[i].size();
+    }
+    if (total > 0xf0000000ULL)
+        return (HRESULT)0x80070057; /* E_INVALIDARG, beyond classic TIFF */
+
+    FILE* fp = IpWriterCreate(filename);
+    if (nullptr == fp)
+        return (HRESULT)0x80004005; /* E_FAIL */
+    static const unsigned char header[8] = { 'I', 'I', 42, 0, 0, 0, 0, 0 };
+    bool bOk = (8 == fwrite(header, 1, 8, fp));
+    std::vector<unsigned char> offsets(4 * nStrip), counts(4 * nStrip);
+    for (unsigned i = 0; bOk && (i < nStrip); ++i)
+    {
+        IpWriterLe32(&offsets[4 * i], (unsigned)ftell(fp));
+        IpWriterLe32(&counts[4 * i], (unsigned)strip[i].size());
+        bOk = strip[i].empty() || (strip[i].size() == fwrite(&strip[i][0], 1, strip[i].size(), fp));
+        std::vector<unsigned char>().swap(strip[i]);
+    }
+    /* the values of more than 4 bytes */
+    if (ftell(fp) & 1)
+        fputc(0, fp);
+    const unsigned bpsPos = (unsigned)ftell(fp);
+    unsigned char bpsVal[6];
+    for (unsigned c = 0; c < 3; ++c)
+        IpWriterLe16(bpsVal + 2 * c, 8 * bps);
+    if (3 == spp)
+        bOk = bOk && (6 == fwrite(bpsVal, 1, 6, fp));
+    if (ftell(fp) & 1)
+        fputc(0, fp);
+    const unsigned offPos = (unsigned)ftell(fp);
+    bOk = bOk && ((nStrip < 2) || (offsets.size() == fwrite(&offsets[0], 1, offsets.size(), fp)));
+    const unsigned cntPos = (unsigned)ftell(fp);
+    bOk = bOk && ((nStrip < 2) || (counts.size() == fwrite(&counts[0], 1, counts.size(), fp)));
+    IpWriterTiffEntry desc;
+    bOk = bOk && IpWriterTiffText(fp, meta, desc);
+
+    std::vector<IpWriterTiffEntry> ent;
+    ent.push_back({ 256, 4, 1, img.width });
+    ent.push_back({ 257, 4, 1, img.height });
+    ent.push_back({ 258, 3, spp, (3 == spp) ? bpsPos : 8 * bps });
+    ent.push_back({ 259, 3, 1, compression });
+    ent.push_back({ 262, 3, 1, (3 == spp) ? 2u : 1u });       /* RGB, BlackIsZero */
+    ent.push_back(desc);
+    ent.push_back({ 273, 4, nStrip, (nStrip < 2) ? IpWriterGetLe32(&offsets[0]) : offPos });
+    ent.push_back({ 277, 3, 1, spp });
+    ent.push_back({ 278, 4, 1, stripRows });
+    ent.push_back({ 279, 4, nStrip, (nStrip < 2) ? IpWriterGetLe32(&counts[0]) : cntPos });
+    ent.push_back({ 284, 3, 1, 1 });                          /* chunky */
+    if (IPWRITER_TIFF_DEFLATE == compression)
+        ent.push_back({ 317, 3, 1, 2 });                      /* horizontal differencing */
+    bOk = bOk && IpWriterTiffIfd(fp, ent, 0);
+    if (0 != fclose(fp))
+        bOk = false;
+    return bOk ? 0 : (HRESULT)0x80004005; /* E_FAIL */
+}
+
+template <typename C>
+static bool IpWriterIsTiff(const C* filename)
+{
+    size_t n = 0;
+    while (filename[n])
+        ++n;
+    const C* e = filename + n;
+    while ((e > filename) && ('.' != e[-1]))
+        --e;
+    const char* t[2] = { "tif", "tiff" };
+    for (int k = 0; k < 2; ++k)
+    {
+        size_t i = 0;
+        while (t[k][i] && e[i] && ((e[i] | 0x20) == t[k][i]))
+            ++i;
+        if ((0 == t[k][i]) && (0 == e[i]))
+            return true;
+    }
+    return false;
+}
+
+/* .tif / .tiff: TIFF, any other: PNG */
+template <typename C>
+static HRESULT IpWriteImage(const C* filename, const void* data, const IpWriterImage& img, const IpWriterMeta* meta = nullptr, int level = IPWRITER_LEVEL, unsigned threads = 0)
+{
+    if (IpWriterIsTiff(filename))
+        return IpWriteTiff(filename, data, img, meta, level, threads);
+    return IpWritePng(filename, data, img, meta, level, threads);
+}
+
+static inline bool IpWriterReadFile(FILE* fp, std::vector<unsigned char>& buf)
+{
+    if ((0 != fseek(fp, 0, SEEK_END)) || (ftell(fp) < 0))
+        return false;
+    buf.resize((size_t)ftell(fp));
+    return (0 == fseek(fp, 0, SEEK_SET)) && (buf.empty() || (buf.size() == fread(&buf[0], 1, buf.size(), fp)));
+}
+
+/* the PNG chunks of buf, fn(pos, type, len) with pos at the length; false: not a PNG */
+template <typename F>
+static bool IpWriterPngWalk(const std::vector<unsigned char>& buf, const F& fn)
+{
+    static const unsigned char sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if ((buf.size() < 8) || (0 != memcmp(&buf[0], sig, 8)))
+        return false;
+    size_t pos = 8;
+    while (pos + 12 <= buf.size())
+    {
+        const size_t len = ((size_t)buf[pos] << 24) | ((size_t)buf[pos + 1] << 16) | ((size_t)buf[pos + 2] << 8) | buf[pos + 3];
+        if (pos + 12 + len > buf.size())
+            return false;
+        fn(pos, (const char*)&buf[pos + 4], len);
+        pos += 12 + len;
+    }
+    return pos == buf.size();
+}
+
+/* the first IFD of a little endian TIFF: the entries, and the offset of the next IFD */
+static inline bool IpWriterTiffRead(FILE* fp, std::vector<IpWriterTiffEntry>& ent, unsigned& next)
+{
+    unsigned char h[8], b[12];
+    if ((0 != fseek(fp, 0, SEEK_SET)) || (8 != fread(h, 1, 8, fp)) || ('I' != h[0]) || ('I' != h[1]) || (42 != h[2]) || (0 != h[3]))
+        return false;
+    if ((0 != fseek(fp, (long)IpWriterGetLe32(h + 4), SEEK_SET)) || (2 != fread(b, 1, 2, fp)))
+        return false;
+    const unsigned count = b[0] | (b[1] << 8);
+    ent.resize(count);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (12 != fread(b, 1, 12, fp))
+            return false;
+        ent[i].tag = (unsigned short)(b[0] | (b[1] << 8));
+        ent[i].type = (unsigned short)(b[2] | (b[3] << 8));
+        ent[i].count = IpWriterGetLe32(b + 4);
+        ent[i].value = ((3 == ent[i].type) && (1 == ent[i].count)) ? (unsigned)(b[8] | (b[9] << 8)) : IpWriterGetLe32(b + 8);
+    }
+    if (4 != fread(b, 1, 4, fp))
+        return false;
+    next = IpWriterGetLe32(b);
+    return true;
+}
+
+static inline void IpWriterParseText(const std::string& s, IpWriterMeta& meta)
+{
+    size_t pos = 0;
+    while (pos < s.size())
+    {
+        size_t end = s.find('\n', pos);
+        if (std::string::npos == end)
+            end = s.size();
+        const size_t eq = s.find('=', pos);
+        if ((std::string::npos != eq) && (eq < end))
+            meta.set(s.substr(pos, eq - pos).c_str(), s.substr(eq + 1, end - eq - 1));
+        pos = end + 1;
+    }
+}
+
+/* the metadata of a PNG (tEXt) or a TIFF (ImageDescription) */
+static HRESULT IpReadMetadata(const char* filename, IpWriterMeta& meta)
+{
+    meta.items.clear();
+    FILE* fp = fopen(filename, "rb");
+    if (nullptr == fp)
+        return (HRESULT)0x80004005; /* E_FAIL */
+    bool bOk;
+    if (IpWriterIsTiff(filename))
+    {
+        std::vector<IpWriterTiffEntry> ent;
+        unsigned next;
+        bOk = IpWriterTiffRead(fp, ent, next);
+        for (size_t i = 0; bOk && (i < ent.size()); ++i)
+        {
+            if ((270 == ent[i].tag) && (2 == ent[i].type))
+            {
+                std::string s(ent[i].count, '\0');
+                if (ent[i].count <= 4)
+                    memcpy(&s[0], &ent[i].value, ent[i].count);
+                else
+                    bOk = (0 == fseek(fp, (long)ent[i].value, SEEK_SET)) && (s.size() == fread(&s[0], 1, s.size(), fp));
+                IpWriterParseText(s.c_str(), meta);
+            }
+        }
+    }
+    else
+    {
+        std::vector<unsigned char> buf;
+        bOk = IpWriterReadFile(fp, buf) && IpWriterPngWalk(buf, [&](size_t pos, const char* type, size_t len) {
+            if (0 == memcmp(type, "tEXt", 4))
+            {
+                const char* p = (const char*)&buf[pos + 8];
+                const size_t k = strnlen(p, len);
+                if (k < len)
+                    meta.set(std::string(p, k).c_str(), std::string(p + k + 1, len - k - 1));
+            }
+        });
+    }
+    fclose(fp);
+    return bOk ? 0 : (HRESULT)0x80004005; /* E_FAIL */
+}
+
+/* replaces all the metadata, the pixels copied as they are */
+static HRESULT IpWriteMetadata(const char* filename, const IpWriterMeta& meta)
+{
+    if (IpWriterIsTiff(filename))
+    {
+        FILE* fp = fopen(filename, "r+b");
+        if (nullptr == fp)
+            return (HRESULT)0x80004005; /* E_FAIL */
+        std::vector<IpWriterTiffEntry> ent;
+        unsigned next = 0;
+        IpWriterTiffEntry desc;
+        bool bOk = IpWriterTiffRead(fp, ent, next) && (0 == fseek(fp, 0, SEEK_END));
+        if (ftell(fp) & 1)
+            fputc(0, fp);
+        bOk = bOk && IpWriterTiffText(fp, &meta, desc);
+        if (bOk)
+        {
+            size_t i = 0;
+            while ((i < ent.size()) && (ent[i].tag < 270))
+                ++i;
+            if ((i < ent.size()) && (270 == ent[i].tag))
+                ent[i] = desc;
+            else
+                ent.insert(ent.begin() + i, desc);
+            /* the old IFD and text stay in the file, unreferenced */
+            bOk = (0 == fseek(fp, 0, SEEK_END)) && IpWriterTiffIfd(fp, ent, next);
+        }
+        if (0 != fclose(fp))
+            bOk = false;
+        return bOk ? 0 : (HRESULT)0x80004005; /* E_FAIL */
+    }
+
+    std::vector<unsigned char> buf;
+    FILE* fp = fopen(filename, "rb");
+    if (nullptr == fp)
+        return (HRESULT)0x80004005; /* E_FAIL */
+    const bool bRead = IpWriterReadFile(fp, buf);
+    fclose(fp);
+    if (!bRead)
+        return (HRESULT)0x80004005; /* E_FAIL */
+    const std::string tmp = std::string(filename) + ".tmp";
+    fp = fopen(tmp.c_str(), "wb");
+    if (nullptr == fp)
+        return (HRESULT)0x80004005; /* E_FAIL */
+    bool bOk = (8 == fwrite(&buf[0], 1, 8, fp)), bText = false;
+    bOk = IpWriterPngWalk(buf, [&](size_t pos, const char* type, size_t len) {
+        if (0 == memcmp(type, "tEXt", 4))
+            return;
+        if ((!bText) && (0 == memcmp(type, "IDAT", 4)))
+        {
+            bText = true;
+            bOk = bOk && IpWriterPngText(fp, &meta);
+        }
+        bOk = bOk && (len + 12 == fwrite(&buf[pos], 1, len + 12, fp));
+    }) && bOk && bText;
+    if (0 != fclose(fp))
+        bOk = false;
+    if (bOk)
+    {
+        remove(filename);
+        bOk = (0 == rename(tmp.c_str(), filename));
+    }
+    else
+        remove(tmp.c_str());
+    return bOk ? 0 : (HRESULT)0x80004005; /* E_FAIL */
+}
+
+#endif
@@ -0,0 +1,605 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+#include "imagepro.h"
+#include "imagepro_toupcam.h"
+#include "../ipkernel.h"
+#include "../../../../samples/rawpack.h"
+#include "../../../../samples/demorawrec/rawcodec.h"
+#include "../../../../samples/simcam/simcam.h"
+
+/*
+    Performance regression suite of the SDK and imagepro: fixed workloads on the frames of the first camera, timed,
+    one line each, compared with the results of an earlier run, so that a release of the SDK (or a change of the
+    program, or of the machine) which is slower shows before it is deployed.
+    usage: perfsuite [-n reps = 10] [-b baseline.txt] [-t tolerance % = 10] [-f] [workload prefix ...]
+    The workloads, in the order they run (with prefixes on the command line, only these starting with one of them):
+        pull.raw            Toupcam_PullImageV4 in RAW mode at the full bit depth: the copy out of the SDK
+        pull.rgb24          Toupcam_PullImageV4 at 24 bits, in 8 bits mode
+        stitch              imagepro_stitch_newV3 RGB24, medium precision and threshold: from imagepro_stitch_pullV4 to
+                            the stitch callback of the frame, the stage (simcam.h) moved by 1 / STITCH_STEP of the
+                            width between two frames
+        edf.max, edf.weighted   imagepro_edf_newV2 RGB24, Pyr_Max / Pyr_Weighted: from imagepro_edf_pullV4 to the EDF
+                            callback, the stage stepped through EDF_PLANES planes EDF_STEP apart in Z
+        pull.rgb48          Toupcam_PullImageV4 at 48 bits (TOUPCAM_OPTION_RGB 1), a camera of more than 8 bits
+        demosaic.linear, demosaic.vng, demosaic.ea      imagepro_demosaic of the whole RAW frame to BGR
+        demosaic.host       the same by IpkDemosaicDispatch (ipkernel.h): the code of this tree, which does not change
+                            with the SDK, the control: when it moves too, the machine did (clock, load, heat)
+        resize.area.half, resize.linear.half, resize.cubic.double   imagepro_resizeV2 of the RGB24 frame
+        record.pack         RawPackFrame (rawpack.h) of the RAW frame, as demorawrec pack = 1
+        record.rsc1         RawCodec::compress (rawcodec.h) of the RAW frame on all the threads, as demorawrec compress
+    The camera phases come first, the frames of a phase are pulled in it as they arrive (the wait for a frame is not
+    timed); the work on the host runs with the camera stopped, on the last frames of the phases, so that nothing else
+    competes for the CPU. Every workload runs PERFSUITE_WARMUP times before reps timed runs, and prints one line: the
+    name, the median and the minimum in milliseconds, the MB/s of input at the median and the runs timed:
+        demosaic.vng    41.237  40.880  366.8   10
+    or the name and "skipped" (the camera cannot: no RGB48, a mono sensor) or "failed 0x80004005". Everything else
+    printed starts with # (the versions, the camera, the messages, the comparison), so the output as such is a
+    results file, the baseline of a later run: perfsuite > baseline.txt.
+    -b: every workload against the line of the same name in the baseline; a median slower by more than the tolerance,
+    and by more than PERFSUITE_FLOOR ms, is a regression. The exit code is 1 when there is any, 2 when the inputs
+    differ (the "# input" lines: camera, resolution, RAW format; -f compares all the same). Workloads on one side
+    only are listed, not counted.
+    Linked with simcam (samples/simcam) no hardware is needed and the inputs are the same run after run: SIMCAM is set
+    to PERFSUITE_SIMCAM when it is not set, SIMCAM=replay=file.rawseq,rate=0 replays a recording of demorawrec instead.
+    The pulls then time the copy of simcam: the pull workloads of an SDK need the SDK and a camera, the others time
+    the same code with either. perfsuite.sh builds simcam and the suite and compares with baseline.txt.
+*/
+#define PERFSUITE_REPS      10
+#define PERFSUITE_WARMUP    2
+#define PERFSUITE_TOLERANCE 10      /* % */
+#define PERFSUITE_FLOOR     0.05    /* ms, a difference below is noise */
+#define PERFSUITE_TIMEOUT   5000    /* ms, for a frame, for a callback */
+#define PERFSUITE_SIMCAM    "w=2592,h=1944,format=raw12,fps=15,noise=2,seed=1"  /* a low rate: less of simcam rendering during the pulls */
+#define STITCH_STEP         16
+#define EDF_PLANES          8
+#define EDF_STEP            5000    /* nm, one level of blur of simcam at its dof */
+
+typedef struct {
+    std::string name;
+    HRESULT hr;
+    bool bSkipped;
+    double median, minimum, mbps;
+    unsigned reps;
+} Result;
+
+HToupcam g_hcam = NULL;
+std::mutex g_mtx;
+std::condition_variable g_cond;
+unsigned g_images = 0, g_callbacks = 0;  /* events, under g_mtx */
+
+static void* ipmalloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void*)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        ++g_images;
+        g_cond.notify_all();
+    }
+}
+
+static void Processed()
+{
+    std::lock_guard<std::mutex> lock(g_mtx);
+    ++g_callbacks;
+    g_cond.notify_all();
+}
+
+static void __cdecl StitchCallback(void*, void*, int, int, int, int, int, int, int, int, eImageproStitchQuality, float, int, int)
+{
+    Processed();
+}
+
+static void __cdecl StitchECallback(void*, eImageproStitchEvent evt)
+{
+    if ((eImageproStitchE_ERROR == evt) || (eImageproStitchE_NOMEM == evt))
+        printf("# stitch event %d\n", (int)evt);
+}
+
+static void __cdecl EdfCallback(void*, int, void*, int, int, int, int)
+{
+    Processed();
+}
+
+static void __cdecl EdfECallback(void*, eImageproEdfEvent evt)
+{
+    if (eImageproEdf_NONE != evt)
+        printf("# edf event %d\n", (int)evt);
+}
+
+/* until *pCount is past count; false: timeout */
+static bool WaitEvent(const unsigned* pCount, unsigned count)
+{
+    std::unique_lock<std::mutex> lock(g_mtx);
+    return g_cond.wait_for(lock, std::chrono::milliseconds(PERFSUITE_TIMEOUT), [pCount, count]() { return *pCount != count; });
+}
+
+static unsigned Count(const unsigned* pCount)
+{
+    std::lock_guard<std::mutex> lock(g_mtx);
+    return *pCount;
+}
+
+/* the next frame by pull(), timed from the frame there to the end of pull(), or of the callback it leads to when bCallback */
+static HRESULT TimedPull(const std::function<HRESULT()>& pull, bool bCallback, double* pMs)
+{
+    static unsigned seen = 0;
+    HRESULT hr;
+    do
+    {
+        if ((Count(&g_images) == seen) && !WaitEvent(&g_images, seen))
+            return (HRESULT)0x8001011f; /* E_TIMEOUT */
+        seen = Count(&g_images);
+        const unsigned callbacks = Count(&g_callbacks);
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        hr = pull();
+        if (SUCCEEDED(hr) && bCallback && (Count(&g_callbacks) == callbacks) && !WaitEvent(&g_callbacks, callbacks))
+            return (HRESULT)0x8001011f; /* E_TIMEOUT */
+        *pMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    } while ((HRESULT)0x8000000a == hr);    /* E_PENDING: the events of frames already dropped */
+    return hr;
+}
+
+static HRESULT Timed(const std::function<HRESULT()>& work, double* pMs)
+{
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    const HRESULT hr = work();
+    *pMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return hr;
+}
+
+class Suite {
+    std::vector<std::string> m_prefix;
+    unsigned m_reps;
+    std::vector<Result> m_results;
+
+    void report(const Result& r)
+    {
+        if (r.bSkipped)
+            printf("%-24s skipped\n", r.name.c_str());
+        else if (FAILED(r.hr))
+            printf("%-24s failed 0x%08x\n", r.name.c_str(), r.hr);
+        else
+            printf("%-24s %.3f\t%.3f\t%.1f\t%u\n", r.name.c_str(), r.median, r.minimum, r.mbps, r.reps);
+        fflush(stdout);
+        m_results.push_back(r);
+    }
+public:
+    Suite(const std::vector<std::string>& prefix, unsigned reps)
+    : m_prefix(prefix), m_reps(reps)
+    {
+    }
+
+    bool enabled(const char* name) const
+    {
+        if (m_prefix.empty())
+            return true;
+        for (size_t i = 0; i < m_prefix.size(); ++i)
+        {
+            if (0 == strncmp(name, m_prefix[i].c_str(), m_prefix[i].size()))
+                return true;
+        }
+        return false;
+    }
+
+    /* bytes: of input, per run; run: one run, its time in *pMs */
+    void run(const char* name, double bytes, const std::function<HRESULT(double*)>& run)
+    {
+        if (!enabled(name))
+            return;
+        Result r;
+        r.name = name;
+        r.hr = 0;
+        r.bSkipped = false;
+        std::vector<double> ms;
+        for (unsigned i = 0; (i < PERFSUITE_WARMUP + m_reps) && SUCCEEDED(r.hr); ++i)
+        {
+            double t = 0;
+            r.hr = run(&t);
+            if (i >= PERFSUITE_WARMUP)
+                ms.push_back(t);
+        }
+        if (SUCCEEDED(r.hr))
+        {
+            std::sort(ms.begin(), ms.end());
+            const size_t n = ms.size();
+            r.median = (n & 1) ? ms[n / 2] : (ms[n / 2 - 1] + ms[n / 2]) / 2;
+            r.minimum = ms[0];
+            r.mbps = (r.median > 0) ? bytes / 1e3 / r.median : 0.0;
+            r.reps = (unsigned)n;
+        }
+        report(r);
+    }
+
+    void skip(const char* name)
+    {
+        if (!enabled(name))
+            return;
+        Result r;
+        r.name = name;
+        r.hr = 0;
+        r.bSkipped = true;
+        r.median = r.minimum = r.mbps = 0;
+        r.reps = 0;
+        report(r);
+    }
+
+    const std::vector<Result>& results() const { return m_results; }
+};
+
+/* a results file: the workloads timed (not these skipped or failed), and its "# input" line */
+static bool LoadResults(const char* filename, std::vector<Result>* pResults, std::string* pInput)
+{
+    FILE* fp = fopen(filename, "r");
+    if (NULL == fp)
+        return false;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (0 == strncmp(line, "# input ", 8))
+            *pInput = line + 8;
+        else if ('#' != line[0])
+        {
+            char name[256];
+            Result r;
+            if (5 == sscanf(line, "%255s %lf %lf %lf %u", name, &r.median, &r.minimum, &r.mbps, &r.reps))
+            {
+                r.name = name;
+                r.hr = 0;
+                r.bSkipped = false;
+                pResults->push_back(r);
+            }
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+/* 0: no regression, 1: a regression; baseline: the workloads timed in it */
+static int Compare(const Suite& suite, const std::vector<Result>& baseline, double tolerance)
+{
+    const std::vector<Result>& current = suite.results();
+    unsigned compared = 0, regressions = 0;
+    for (size_t i = 0; i < current.size(); ++i)
+    {
+        const Result& c = current[i];
+        const Result* b = NULL;
+        for (size_t j = 0; (j < baseline.size()) && (NULL == b); ++j)
+        {
+            if (baseline[j].name == c.name)
+                b = &baseline[j];
+        }
+        if (NULL == b)
+        {
+            /* skipped on both sides: the camera cannot */
+            if (!c.bSkipped)
+                printf("# %-22s %s, not in the baseline\n", c.name.c_str(), FAILED(c.hr) ? "failed" : "new");
+        }
+        else if (SUCCEEDED(c.hr) && !c.bSkipped)
+        {
+            const bool bSlower = (c.median > b->median * (1 + tolerance / 100)) && (c.median - b->median > PERFSUITE_FLOOR);
+            printf("# %-22s %.3f ms, baseline %.3f ms, %+.1f%%%s\n", c.name.c_str(), c.median, b->median,
+                (b->median > 0) ? (c.median / b->median - 1) * 100 : 0.0, bSlower ? ", REGRESSION" : "");
+            ++compared;
+            if (bSlower)
+                ++regressions;
+        }
+        else
+        {
+            /* timed in the baseline, not now: a regression of its own */
+            printf("# %-22s %s now, baseline %.3f ms, REGRESSION\n", c.name.c_str(), c.bSkipped ? "skipped" : "failed", b->median);
+            ++compared;
+            ++regressions;
+        }
+    }
+    for (size_t j = 0; j < baseline.size(); ++j)
+    {
+        bool bFound = false;
+        for (size_t i = 0; (i < current.size()) && !bFound; ++i)
+            bFound = (current[i].name == baseline[j].name);
+        if (!bFound && suite.enabled(baseline[j].name.c_str()))
+            printf("# %-22s not run\n", baseline[j].name.c_str());
+    }
+    printf("# %u compared, %u regressions, tolerance %.1f%%\n", compared, regressions, tolerance);
+    return regressions ? 1 : 0;
+}
+
+static std::string FourccName(unsigned fourcc)
+{
+    char s[5] = { (char)(fourcc & 0xff), (char)((fourcc >> 8) & 0xff), (char)((fourcc >> 16) & 0xff), (char)((fourcc >> 24) & 0xff), '\0' };
+    for (int i = 0; i < 4; ++i)
+    {
+        if ((s[i] < 0x20) || (s[i] > 0x7e))
+            s[i] = '?';
+    }
+    return s;
+}
+
+/* Toupcam_Stop, the options, Toupcam_StartPullModeWithCallback */
+static HRESULT Restart(int raw, int bitdepth, int rgb)
+{
+    Toupcam_Stop(g_hcam);
+    HRESULT hr;
+    if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, raw)))
+        return hr;
+    if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, bitdepth)))
+        return hr;
+    if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RGB, rgb)))
+        return hr;
+    return Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+}
+
+/* pulls rgb24 of the running camera into stitch or EDF (imagepro_xxx_pullV4) until the callback of each, moving the stage */
+static void RunFed(Suite& suite, const char* name, unsigned width, unsigned height, std::vector<unsigned char>& rgb24, bool bStitch, int method)
+{
+    if (!suite.enabled(name))
+        return;
+    HImageproStitch stitch = NULL;
+    HImageproEdf edf = NULL;
+    if (bStitch)
+        stitch = imagepro_stitch_newV3(eImageproFormat_RGB24, 0, width, height, 0, eImageproStitchP_Medium, eImageproStitchT_Medium, StitchCallback, StitchECallback, NULL);
+    else
+        edf = imagepro_edf_newV2(eImageproFormat_RGB24, (eImageproEdfMethod)method, EdfCallback, EdfECallback, NULL);
+    if ((NULL == stitch) && (NULL == edf))
+    {
+        suite.run(name, 0, [](double*) { return (HRESULT)0x80004005; /* E_FAIL */ });
+        return;
+    }
+    if (stitch)
+        imagepro_stitch_start(stitch);
+    else
+        imagepro_edf_start(edf);
+    int x = 0, z = 0;
+    Toupcam_get_Option(g_hcam, SIMCAM_OPTION_STAGE_X, &x);
+    Toupcam_get_Option(g_hcam, SIMCAM_OPTION_STAGE_Z, &z);
+    unsigned n = 0;
+    suite.run(name, (double)TDIBWIDTHBYTES(width * 24) * height, [&](double* pMs) {
+        /* a real camera has no such options, E_NOTIMPL: the scene stands still */
+        if (stitch)
+            Toupcam_put_Option(g_hcam, SIMCAM_OPTION_STAGE_X, x + (int)(++n * width * 1000 / STITCH_STEP));
+        else
+            Toupcam_put_Option(g_hcam, SIMCAM_OPTION_STAGE_Z, z + ((int)(n++ % EDF_PLANES) - EDF_PLANES / 2) * EDF_STEP);
+        return TimedPull([&]() {
+            ToupcamFrameInfoV4 info = { 0 };
+            return stitch ? imagepro_stitch_pullV4(stitch, g_hcam, 1, &rgb24[0], 24, 0, &info) : imagepro_edf_pullV4(edf, g_hcam, 1, &rgb24[0], 24, 0, &info);
+        }, true, pMs);
+    });
+    if (stitch)
+    {
+        void* result = imagepro_stitch_stop(stitch, 1, 0);
+        if (result)
+            free(result);   /* ipmalloc */
+        imagepro_stitch_delete(stitch);
+    }
+    else
+    {
+        imagepro_edf_stop(edf);
+        imagepro_edf_delete(edf);
+    }
+    Toupcam_put_Option(g_hcam, SIMCAM_OPTION_STAGE_X, x);
+    Toupcam_put_Option(g_hcam, SIMCAM_OPTION_STAGE_Z, z);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned reps = PERFSUITE_REPS;
+    double tolerance = PERFSUITE_TOLERANCE;
+    const char* baseline = NULL;
+    bool bForce = false;
+    std::vector<std::string> prefix;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-n")) && (i + 1 < argc))
+            reps = (unsigned)atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-b")) && (i + 1 < argc))
+            baseline = argv[++i];
+        else if ((0 == strcmp(argv[i], "-t")) && (i + 1 < argc))
+            tolerance = atof(argv[++i]);
+        else if (0 == strcmp(argv[i], "-f"))
+            bForce = true;
+        else if ('-' != argv[i][0])
+            prefix.push_back(argv[i]);
+        else
+            reps = 0;
+    }
+    if (0 == reps)
+    {
+        printf("usage: %s [-n reps = %d] [-b baseline.txt] [-t tolerance %% = %d] [-f] [workload prefix ...]\n", argv[0], PERFSUITE_REPS, PERFSUITE_TOLERANCE);
+        return -1;
+    }
+    std::vector<Result> vecBaseline;
+    std::string baseInput;
+    if (baseline && !LoadResults(baseline, &vecBaseline, &baseInput))
+    {
+        printf("# failed to open %s\n", baseline);
+        return -1;
+    }
+    if (NULL == getenv("SIMCAM"))
+    {
+#if defined(_WIN32)
+        _putenv_s("SIMCAM", PERFSUITE_SIMCAM);
+#else
+        setenv("SIMCAM", PERFSUITE_SIMCAM, 0);
+#endif
+    }
+
+    ToupcamDeviceV2 arr[TOUPCAM_MAX] = { 0 };
+    if ((Toupcam_EnumV2(arr) <= 0) || (NULL == (g_hcam = Toupcam_Open(arr[0].id))))
+    {
+        printf("# no camera found or open failed\n");
+        return -1;
+    }
+    imagepro_init(ipmalloc);
+    const int maxBits = Toupcam_get_MaxBitDepth(g_hcam);
+    unsigned fourcc = 0, bits = 8;
+    int width = 0, height = 0;
+    HRESULT hr;
+    if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1)) || FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, (maxBits > 8) ? 1 : 0)))
+        printf("# failed to set RAW, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_RawFormat(g_hcam, &fourcc, &bits)))
+        printf("# failed to get RAW format, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_FinalSize(g_hcam, &width, &height)))
+        printf("# failed to get size, hr = 0x%08x\n", hr);
+    if (FAILED(hr))
+    {
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+
+    char input[512];
+#if defined(_WIN32)
+    sprintf(input, "%ls %d x %d %s %u bits", arr[0].model->name, width, height, FourccName(fourcc).c_str(), bits);
+    printf("# perfsuite, reps %u, warmup %d\n", reps, PERFSUITE_WARMUP);
+    printf("# sdk %ls\n", Toupcam_Version());
+#else
+    sprintf(input, "%s %d x %d %s %u bits", arr[0].model->name, width, height, FourccName(fourcc).c_str(), bits);
+    printf("# perfsuite, reps %u, warmup %d\n", reps, PERFSUITE_WARMUP);
+    printf("# sdk %s\n", Toupcam_Version());
+#endif
+    printf("# input %s\n", input);
+    printf("# threads %u\n", std::thread::hardware_concurrency());
+    if (baseline && (baseInput != input))
+    {
+        printf("# the baseline is of another input: %s\n", baseInput.c_str());
+        if (!bForce)
+        {
+            Toupcam_Close(g_hcam);
+            return 2;
+        }
+    }
+
+    Suite suite(prefix, reps);
+    const size_t rawBytes = (size_t)width * height * ((bits > 8) ? 2 : 1);
+    const size_t stride24 = TDIBWIDTHBYTES(width * 24), stride48 = TDIBWIDTHBYTES(width * 48);
+    std::vector<unsigned char> raw(rawBytes), rgb24(stride24 * height), rgb48(stride48 * height);
+    bool bRaw = false, bRgb = false;
+    ToupcamFrameInfoV4 info = { 0 };
+    double t = 0;
+
+    /* RAW */
+    if (FAILED(hr = Restart(1, (bits > 8) ? 1 : 0, 0)))
+        printf("# failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        const std::function<HRESULT()> pull = [&]() { return Toupcam_PullImageV4(g_hcam, &raw[0], 0, 0, 0, &info); };
+        bRaw = SUCCEEDED(TimedPull(pull, false, &t));
+        suite.run("pull.raw", (double)rawBytes, [&](double* pMs) { return TimedPull(pull, false, pMs); });
+    }
+
+    /* RGB24, 8 bits mode; stitch and EDF */
+    if (FAILED(hr = Restart(0, 0, 0)))
+        printf("# failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        const std::function<HRESULT()> pull = [&]() { return Toupcam_PullImageV4(g_hcam, &rgb24[0], 0, 24, 0, &info); };
+        bRgb = SUCCEEDED(TimedPull(pull, false, &t));
+        suite.run("pull.rgb24", (double)stride24 * height, [&](double* pMs) { return TimedPull(pull, false, pMs); });
+        std::vector<unsigned char> fed(rgb24.size());
+        RunFed(suite, "stitch", width, height, fed, true, 0);
+        RunFed(suite, "edf.max", width, height, fed, false, eImageproEdfM_Pyr_Max);
+        RunFed(suite, "edf.weighted", width, height, fed, false, eImageproEdfM_Pyr_Weighted);
+    }
+
+    /* RGB48 */
+    if ((maxBits <= 8) || FAILED(hr = Restart(0, 1, 1)))
+        suite.skip("pull.rgb48");
+    else
+    {
+        const std::function<HRESULT()> pull = [&]() { return Toupcam_PullImageV4(g_hcam, &rgb48[0], 0, 48, 0, &info); };
+        suite.run("pull.rgb48", (double)stride48 * height, [&](double* pMs) { return TimedPull(pull, false, pMs); });
+    }
+    Toupcam_Stop(g_hcam);
+
+    /* on the host */
+    static const char* demosaic[] = { "demosaic.linear", "demosaic.vng", "demosaic.ea" };
+    const unsigned outBytes = 3 * ((bits > 8) ? 2 : 1);
+    std::vector<unsigned char> bgr((size_t)width * height * outBytes);
+    for (unsigned m = 0; m < 3; ++m)
+    {
+        if (!bRaw || (IpkPhase(fourcc) < 0))
+            suite.skip(demosaic[m]);
+        else
+            suite.run(demosaic[m], (double)rawBytes, [&](double* pMs) { return Timed([&]() { return imagepro_demosaic(&raw[0], &bgr[0], width, height, bits, fourcc, IPK_BGR, m); }, pMs); });
+    }
+    if (!bRaw || (IpkPhase(fourcc) < 0))
+        suite.skip("demosaic.host");
+    else
+        suite.run("demosaic.host", (double)rawBytes, [&](double* pMs) { return Timed([&]() { return IpkDemosaicDispatch(&raw[0], 0, &bgr[0], 0, width, height, bits, fourcc, IPK_BGR); }, pMs); });
+
+    static const struct { const char* name; int num, den, method; } resize[] = {
+        { "resize.area.half", 1, 2, 3 }, { "resize.linear.half", 1, 2, 1 }, { "resize.cubic.double", 2, 1, 2 }
+    };
+    for (unsigned i = 0; i < sizeof(resize) / sizeof(resize[0]); ++i)
+    {
+        if (!bRgb)
+        {
+            suite.skip(resize[i].name);
+            continue;
+        }
+        if (!suite.enabled(resize[i].name))
+            continue;
+        BITMAPINFOHEADER hdrSrc, hdrDst;
+        memset(&hdrSrc, 0, sizeof(hdrSrc));
+        hdrSrc.biSize = sizeof(BITMAPINFOHEADER);
+        hdrSrc.biPlanes = 1;
+        hdrSrc.biBitCount = 24;
+        hdrSrc.biWidth = width;
+        hdrSrc.biHeight = height;
+        hdrSrc.biSizeImage = (unsigned)(stride24 * height);
+        hdrDst = hdrSrc;
+        hdrDst.biWidth = width * resize[i].num / resize[i].den;
+        hdrDst.biHeight = height * resize[i].num / resize[i].den;
+        const int dstStep = TDIBWIDTHBYTES(hdrDst.biWidth * 24);
+        hdrDst.biSizeImage = dstStep * hdrDst.biHeight;
+        std::vector<unsigned char> dst(hdrDst.biSizeImage);
+        suite.run(resize[i].name, (double)stride24 * height, [&](double* pMs) {
+            return Timed([&]() { return imagepro_resizeV2(&hdrSrc, (int)stride24, &rgb24[0], &hdrDst, dstStep, &dst[0], resize[i].method); }, pMs);
+        });
+    }
+
+    if (!bRaw || ((10 != bits) && (12 != bits)))
+        suite.skip("record.pack");
+    else
+    {
+        std::vector<unsigned char> packed(RawPackRowBytes(width, bits) * height);
+        suite.run("record.pack", (double)rawBytes, [&](double* pMs) {
+            return Timed([&]() { RawPackFrame(&packed[0], (const unsigned short*)&raw[0], width, height, bits); return (HRESULT)0; }, pMs);
+        });
+    }
+    if (!bRaw)
+        suite.skip("record.rsc1");
+    else if (suite.enabled("record.rsc1"))
+    {
+        const unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        RawCodec codec(threads - 1);
+        std::vector<unsigned char> coded(RawCodec::bound(width, height, (bits > 8) ? 2 : 1));
+        suite.run("record.rsc1", (double)rawBytes, [&](double* pMs) {
+            return Timed([&]() {
+                return codec.compress(&raw[0], width, height, (bits > 8) ? 2 : 1, (IpkPhase(fourcc) < 0) ? 1 : 2, &coded[0], coded.size()) ? (HRESULT)0 : (HRESULT)0x80004005; /* E_FAIL */
+            }, pMs);
+        });
+    }
+
+    int ret = 0;
+    if (baseline)
+        ret = Compare(suite, vecBaseline, tolerance);
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    return ret;
+}
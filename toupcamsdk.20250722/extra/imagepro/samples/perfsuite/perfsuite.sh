@@ -0,0 +1,24 @@
+#!/bin/bash
+# The check of an SDK before it is deployed: builds simcam (samples/simcam) and perfsuite, runs the suite against
+# baseline.txt and exits with its code (1: a regression); without baseline.txt the run writes it. The arguments go
+# to perfsuite (-n, -t, workload prefixes). results.txt keeps the last run.
+# toupcam.h, imagepro.h, imagepro_toupcam.h and libimagepro of the SDK under test are next to it, as for make.sh;
+# PERFSUITE_SDK=1: the libtoupcam of the SDK, next to it too, and a camera, instead of simcam.
+cd `dirname $0` || exit 1
+os=`uname -s`
+if [[ $os = "Linux" ]]; then
+	lib=libtoupcam.so
+else
+	lib=libtoupcam.dylib
+fi
+if [[ -z $PERFSUITE_SDK ]]; then
+	(cd ../../../../samples/simcam && bash make.sh) || exit 1
+	cp ../../../../samples/simcam/$lib . || exit 1
+fi
+bash make.sh || exit 1
+if [[ -f baseline.txt ]]; then
+	./perfsuite -b baseline.txt "$@" | tee results.txt
+	exit ${PIPESTATUS[0]}
+fi
+./perfsuite "$@" | tee baseline.txt
+exit ${PIPESTATUS[0]}
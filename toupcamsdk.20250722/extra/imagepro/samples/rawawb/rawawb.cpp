@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "../ipawb.h"
+
+/*
+    Continuous auto white balance of the RAW frames, in the demosaic on the host (ipawb.h, ipkernel.h).
+    usage: rawawb [-n frames = 30] [-d damping = 1]
+    The camera is put in RAW mode at its full bit depth; every frame is pulled in the event callback, demosaiced to
+    BGR24 with the gains of the frames before, its sums by color gathered on the way, the gains of the next frame
+    computed from them. The gains of every frame are printed, then the time of the demosaic with the sums against the
+    demosaic alone and against a separate pass of statistics (IpkRawSums over the whole frame).
+    The region is that of Toupcam_get_AWBAuxRect, the whole frame when the camera has none.
+*/
+HToupcam g_hcam = NULL;
+std::vector<unsigned char> g_raw, g_bgr;
+unsigned g_fourcc = 0, g_bits = 8;
+IpAwb g_awb;
+std::atomic<int> g_frames(0);
+int g_total = 30;
+double g_ms = 0.0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if ((TOUPCAM_EVENT_IMAGE == nEvent) && (g_frames < g_total))
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        HRESULT hr = Toupcam_PullImageV4(g_hcam, &g_raw[0], 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const IpkWhiteBalance wb = g_awb.gains();
+            const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            hr = IpkDemosaicDispatch(&g_raw[0], 0, &g_bgr[0], 0, info.v3.width, info.v3.height, g_bits, g_fourcc, IPK_BGR, true, wb, g_awb.begin());
+            g_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            if (FAILED(hr))
+                printf("failed to demosaic, hr = 0x%08x\n", hr);
+            else
+            {
+                const bool bUpdate = g_awb.update();
+                const IpkChannelSums& s = g_awb.sums();
+                printf("frame %d: gains %.3f %.3f %.3f, means R %.1f G %.1f B %.1f%s\n", (int)g_frames + 1, wb.gr / 4096.0, wb.gg / 4096.0, wb.gb / 4096.0,
+                    s.count[0] ? (double)s.sum[0] / s.count[0] : 0.0, s.count[1] ? (double)s.sum[1] / s.count[1] : 0.0, s.count[2] ? (double)s.sum[2] / s.count[2] : 0.0, bUpdate ? "" : ", too dark or clipped");
+            }
+        }
+        ++g_frames;
+    }
+    else if (TOUPCAM_EVENT_IMAGE != nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double damping = 1.0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-n")) && (i + 1 < argc))
+            g_total = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-d")) && (i + 1 < argc))
+            damping = atof(argv[++i]);
+        else
+        {
+            printf("usage: %s [-n frames = 30] [-d damping = 1]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int width = 0, height = 0;
+    unsigned bpp = 0;
+    HRESULT hr;
+    if (Toupcam_get_MaxBitDepth(g_hcam) > 8)
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1);
+    if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1)))
+        printf("failed to set RAW, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_RawFormat(g_hcam, &g_fourcc, &bpp)))
+        printf("failed to get RAW format, hr = 0x%08x\n", hr);
+    else if (IpkPhase(g_fourcc) < 0)
+        printf("not a Bayer sensor\n");
+    else if (FAILED(hr = Toupcam_get_FinalSize(g_hcam, &width, &height)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_bits = bpp;
+        g_awb = IpAwb(g_bits, damping);
+        g_awb.setRect(g_hcam);
+        printf("%d x %d, %u bits, region %u, %u, %u x %u\n", width, height, g_bits, g_awb.sums().left, g_awb.sums().top, g_awb.sums().width, g_awb.sums().height);
+        g_raw.resize((size_t)width * height * ((g_bits > 8) ? 2 : 1));
+        g_bgr.resize((size_t)width * height * 3);
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            for (int i = 0; (g_frames < g_total) && (i < 100 * g_total + 1000); ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            Toupcam_Stop(g_hcam);
+            if (g_frames)
+            {
+                /* the last frame again: the demosaic alone, then the separate pass it saves */
+                const int n = 5;
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                for (int i = 0; i < n; ++i)
+                    IpkDemosaicDispatch(&g_raw[0], 0, &g_bgr[0], 0, width, height, g_bits, g_fourcc, IPK_BGR, true, g_awb.gains());
+                const double msAlone = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / n;
+                t0 = std::chrono::steady_clock::now();
+                for (int i = 0; i < n; ++i)
+                {
+                    IpAwb pass(g_bits);
+                    pass.setRect(g_awb.sums().left, g_awb.sums().top, g_awb.sums().width, g_awb.sums().height);
+                    IpkRawSums(&g_raw[0], 0, width, height, g_bits, g_fourcc, pass.begin());
+                }
+                const double msPass = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / n;
+                printf("demosaic with the sums %.2f ms, alone %.2f ms, a separate pass %.2f ms\n", g_ms / g_frames, msAlone, msPass);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    return 0;
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <vector>
+#include "toupcam.h"
+#include "imagepro.h"
+#include "../hostrotate.h"
+#include "../ipkernel.h"
+#include "../../../../samples/rawpack.h"
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+/*
+    Demosaic the .raw files written by demoraw/demostillraw ("prefix_WxH_n.raw") with imagepro_demosaic.
+    The frame is cut into horizontal bands which are demosaiced in parallel: every band starts on an even row (so the
+    Bayer phase, and therefore the FourCC, is the same as the full frame) and carries HALO_ROWS of context above and
+    below, so VNG/EA see the same neighbourhood as in a whole-frame call. Only the core rows of each band are copied
+    to the output, which may have any row stride. With -r the copy is the rotation (hostrotate.h): each band is
+    written straight into its place in the rotated output, there is no second pass over the frame.
+    With -p the files are 10 / 12 bits RAW packed (samples/rawpack.h, the layout of demorawrec pack = 1): each band
+    unpacks its own rows, halo included, into 16 bits right before its imagepro_demosaic, so the unpacking runs in
+    parallel with the bands and there is no 16 bits copy of the whole frame.
+
+    With several files, the batch runs as a pipeline: one reader thread, a pool of demosaic workers and one writer
+    thread, connected by bounded queues so a slow disk or slow workers hold the other stages back instead of
+    filling the memory. Each file is reported by a completion callback as soon as it is written.
+    -m 3 is LINEAR on the host, by the kernels of ipkernel.h specialized for the FourCC, bit depth and output format of
+    the batch (IpkDemosaicDispatch), on the same bands and into the same layout (16 bits a channel above 8 bits).
+*/
+#define HALO_ROWS       8       /* even */
+#define BAND_MIN_ROWS   64
+#define METHOD_HOST     3       /* ipkernel.h */
+
+/* bytes per output pixel for outformat BGR(0), BGRA(1), RGB(2), RGBA(3) */
+static unsigned OutPixelBytes(unsigned bitdepth, unsigned outformat)
+{
+    return ((outformat & 1) ? 4 : 3) * ((bitdepth > 8) ? 2 : 1);
+}
+
+/*
+    threads: 0 => std::thread::hardware_concurrency()
+    outStride: bytes per output row, 0 => tightly packed
+    rotate: 0, 90, 180, 270 clockwise, the output is height x width for 90 and 270
+    packing: 0, or 10 / 12: inputImage is packed (rawpack.h), bitdepth is then 10 / 12 too
+*/
+static HRESULT demosaic_tiled(const void* inputImage, void* outputImage, unsigned width, unsigned height, unsigned bitdepth, unsigned informat,
+                              unsigned outformat, unsigned method, int outStride, unsigned threads, int rotate = 0, unsigned packing = 0)
+{
+    const unsigned inBytes = (bitdepth > 8) ? 2 : 1, outBytes = OutPixelBytes(bitdepth, outformat);
+    if (0 == outStride)
+        outStride = (((90 == rotate) || (270 == rotate)) ? height : width) * outBytes;
+    if (0 == threads)
+        threads = std::thread::hardware_concurrency();
+    unsigned bandRows = (height + (threads ? threads : 1) - 1) / (threads ? threads : 1);
+    if (bandRows < BAND_MIN_ROWS)
+        bandRows = BAND_MIN_ROWS;
+    bandRows = (bandRows + 1) & ~1u;
+
+    std::vector<std::thread> vecThread;
+    std::vector<HRESULT> vecResult((height + bandRows - 1) / bandRows, 0);
+    for (unsigned band = 0; band < vecResult.size(); ++band)
+    {
+        vecThread.push_back(std::thread([=, &vecResult]()
+        {
+            const unsigned y0 = band * bandRows, y1 = (y0 + bandRows < height) ? (y0 + bandRows) : height;
+            const unsigned ys = (y0 > HALO_ROWS) ? (y0 - HALO_ROWS) : 0, ye = (y1 + HALO_ROWS < height) ? (y1 + HALO_ROWS) : height;
+            std::vector<unsigned char> vecOut((size_t)width * (ye - ys) * outBytes);
+            std::vector<unsigned short> vecUnpacked;
+            const void* pBand = (const unsigned char*)inputImage + (size_t)ys * width * inBytes;
+            if (packing)
+            {
+                vecUnpacked.resize((size_t)width * (ye - ys));
+                RawUnpackRows(&vecUnpacked[0], inputImage, width, ys, ye - ys, packing);
+                pBand = &vecUnpacked[0];
+            }
+            if (METHOD_HOST == method)
+                vecResult[band] = IpkDemosaicDispatch(pBand, 0, &vecOut[0], 0, width, ye - ys, bitdepth, informat, outformat);
+            else
+                vecResult[band] = imagepro_demosaic(pBand, &vecOut[0], width, ye - ys, bitdepth, informat, outformat, method);
+            if (SUCCEEDED(vecResult[band]) && (0 == rotate))
+            {
+                for (unsigned y = y0; y < y1; ++y)
+                    memcpy((unsigned char*)outputImage + (size_t)y * outStride, &vecOut[(size_t)(y - ys) * width * outBytes], width * outBytes);
+            }
+            else if (SUCCEEDED(vecResult[band]))
+            {
+                /* top left of the band in the rotated output: rows y0 ... y1 become columns (90, 270) or rows (180) */
+                const size_t x = (90 == rotate) ? (height - y1) : ((270 == rotate) ? y0 : 0), y = (180 == rotate) ? (height - y1) : 0;
+                HostRotate(&vecOut[(size_t)(y0 - ys) * width * outBytes], width * outBytes, width, y1 - y0, outBytes, rotate, false, false,
+                           (unsigned char*)outputImage + y * outStride + x * outBytes, outStride);
+            }
+        }));
+    }
+    for (size_t i = 0; i < vecThread.size(); ++i)
+        vecThread[i].join();
+    for (size_t i = 0; i < vecResult.size(); ++i)
+    {
+        if (FAILED(vecResult[i]))
+            return vecResult[i];
+    }
+    return 0;
+}
+
+static bool ParseResolution(const char* name, unsigned* width, unsigned* height)
+{
+    const char* p = strrchr(name, '_');
+    while (p && (p > name))
+    {
+        const char* q = p - 1;
+        while ((q > name) && ('_' != *q))
+            --q;
+        if (2 == sscanf(q + 1, "%ux%u", width, height))
+            return (*width > 0) && (*height > 0);
+        p = q;
+    }
+    return false;
+}
+
+static void SaveBmp24(const char* filename, const void* pData, unsigned width, unsigned height)
+{
+    FILE* fp = fopen(filename, "wb");
+    if (fp)
+    {
+        const unsigned stride = TDIBWIDTHBYTES(width * 24);
+        unsigned char fheader[14] = { 'B', 'M' };
+        BITMAPINFOHEADER header = { 0 };
+        header.biSize = sizeof(header);
+        header.biWidth = width;
+        header.biHeight = -(int)height; /* top-down */
+        header.biPlanes = 1;
+        header.biBitCount = 24;
+        header.biSizeImage = stride * height;
+        const unsigned size = 14 + sizeof(header) + header.biSizeImage, offset = 14 + sizeof(header);
+        memcpy(fheader + 2, &size, 4);
+        memcpy(fheader + 10, &offset, 4);
+        fwrite(fheader, 1, sizeof(fheader), fp);
+        fwrite(&header, 1, sizeof(header), fp);
+        fwrite(pData, 1, header.biSizeImage, fp);
+        fclose(fp);
+    }
+}
+
+static void SaveOutput(const char* rawname, const void* pData, unsigned width, unsigned height, unsigned bitdepth)
+{
+    char filename[1024];
+    sprintf(filename, "%s.%s", rawname, (bitdepth > 8) ? "bgr48" : "bmp");
+    if (bitdepth > 8)
+    {
+        FILE* fp = fopen(filename, "wb");
+        if (fp)
+        {
+            fwrite(pData, 1, (size_t)TDIBWIDTHBYTES(width * 48) * height, fp);
+            fclose(fp);
+        }
+    }
+    else
+        SaveBmp24(filename, pData, width, height);
+}
+
+/* blocking queue with a capacity, close() wakes everybody and makes pop() fail once the queue is empty */
+template<typename T>
+class BoundedQueue {
+    std::deque<T> m_deque;
+    std::mutex m_mtx;
+    std::condition_variable m_cvPush, m_cvPop;
+    const size_t m_capacity;
+    bool m_bClosed;
+public:
+    explicit BoundedQueue(size_t capacity)
+    : m_capacity(capacity), m_bClosed(false)
+    {
+    }
+    void push(T v)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvPush.wait(lock, [this] { return m_deque.size() < m_capacity; });
+        m_deque.push_back(std::move(v));
+        m_cvPop.notify_one();
+    }
+    bool pop(T& v)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvPop.wait(lock, [this] { return m_bClosed || !m_deque.empty(); });
+        if (m_deque.empty())
+            return false;
+        v = std::move(m_deque.front());
+        m_deque.pop_front();
+        m_cvPush.notify_one();
+        return true;
+    }
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_bClosed = true;
+        m_cvPop.notify_all();
+    }
+};
+
+typedef struct {
+    size_t index;
+    std::string name;
+    unsigned width, height;
+    std::vector<unsigned char> raw, out;
+    HRESULT hr;
+} BatchItem;
+
+typedef void (*BATCH_CALLBACK)(void* ctx, size_t index, size_t total, const char* name, HRESULT hr);
+
+/*
+    jobs: number of files demosaiced at the same time, every job uses threads / jobs bands
+    queueLength: capacity of each stage queue, this bounds the memory to about (2 * queueLength + jobs) frames
+*/
+static void demosaic_batch(const std::vector<std::string>& vecFile, unsigned bitdepth, unsigned fourcc, unsigned method,
+                           unsigned jobs, unsigned threads, unsigned queueLength, int rotate, unsigned packing, BATCH_CALLBACK pFun, void* ctx)
+{
+    const bool bSwap = (90 == rotate) || (270 == rotate);
+    if (0 == threads)
+        threads = std::thread::hardware_concurrency();
+    if (0 == jobs)
+        jobs = (threads > 1) ? (threads / 2) : 1;
+    const unsigned bandThreads = (threads > jobs) ? (threads / jobs) : 1;
+    BoundedQueue<BatchItem*> qRead(queueLength), qWrite(queueLength);
+
+    std::thread reader([&]()
+    {
+        for (size_t i = 0; i < vecFile.size(); ++i)
+        {
+            BatchItem* item = new BatchItem();
+            item->index = i;
+            item->name = vecFile[i];
+            item->width = item->height = 0;
+            item->hr = (HRESULT)0x80070057; /* E_INVALIDARG */
+            if (ParseResolution(vecFile[i].c_str(), &item->width, &item->height))
+            {
+                if (packing)
+                    item->raw.resize(RawPackRowBytes(item->width, packing) * item->height);
+                else
+                    item->raw.resize((size_t)item->width * item->height * ((bitdepth > 8) ? 2 : 1));
+                FILE* fp = fopen(vecFile[i].c_str(), "rb");
+                if (fp)
+                {
+                    if (fread(&item->raw[0], 1, item->raw.size(), fp) == item->raw.size())
+                        item->hr = 0;
+                    fclose(fp);
+                }
+            }
+            qRead.push(item);
+        }
+        qRead.close();
+    });
+
+    std::vector<std::thread> vecWorker;
+    for (unsigned i = 0; i < jobs; ++i)
+    {
+        vecWorker.push_back(std::thread([&]()
+        {
+            BatchItem* item;
+            while (qRead.pop(item))
+            {
+                if (SUCCEEDED(item->hr))
+                {
+                    const int stride = TDIBWIDTHBYTES((bSwap ? item->height : item->width) * 8 * OutPixelBytes(bitdepth, 0));
+                    item->out.resize((size_t)stride * (bSwap ? item->width : item->height));
+                    item->hr = demosaic_tiled(&item->raw[0], &item->out[0], item->width, item->height, bitdepth, fourcc, 0, method, stride, bandThreads, rotate, packing);
+                }
+                std::vector<unsigned char>().swap(item->raw);
+                qWrite.push(item);
+            }
+        }));
+    }
+
+    std::thread writer([&]()
+    {
+        BatchItem* item;
+        while (qWrite.pop(item))
+        {
+            if (SUCCEEDED(item->hr))
+                SaveOutput(item->name.c_str(), &item->out[0], bSwap ? item->height : item->width, bSwap ? item->width : item->height, bitdepth);
+            if (pFun)
+                pFun(ctx, item->index, vecFile.size(), item->name.c_str(), item->hr);
+            delete item;
+        }
+    });
+
+    reader.join();
+    for (size_t i = 0; i < vecWorker.size(); ++i)
+        vecWorker[i].join();
+    qWrite.close();
+    writer.join();
+}
+
+static void BatchCallback(void* ctx, size_t, size_t total, const char* name, HRESULT hr)
+{
+    unsigned* pDone = (unsigned*)ctx;
+    if (FAILED(hr))
+        printf("[%u/%u] %s failed, hr = 0x%08x\n", ++(*pDone), (unsigned)total, name, hr);
+    else
+        printf("[%u/%u] %s ok\n", ++(*pDone), (unsigned)total, name);
+}
+
+static void* ipmalloc(size_t size)
+{
+    return malloc(size);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned fourcc = 0, bitdepth = 8, method = 0, threads = 0, jobs = 0;
+    int rotate = 0;
+    bool bPacked = false;
+    std::vector<std::string> vecFile;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-f")) && (i + 1 < argc) && (4 == strlen(argv[i + 1])))
+        {
+            fourcc = MAKEFOURCC(argv[i + 1][0], argv[i + 1][1], argv[i + 1][2], argv[i + 1][3]);
+            ++i;
+        }
+        else if ((0 == strcmp(argv[i], "-b")) && (i + 1 < argc))
+            bitdepth = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-m")) && (i + 1 < argc))
+            method = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-t")) && (i + 1 < argc))
+            threads = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-j")) && (i + 1 < argc))
+            jobs = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-r")) && (i + 1 < argc))
+            rotate = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-p"))
+            bPacked = true;
+        else
+            vecFile.push_back(argv[i]);
+    }
+    if ((0 == fourcc) || vecFile.empty() || ((0 != rotate) && (90 != rotate) && (180 != rotate) && (270 != rotate)) || (bPacked && (10 != bitdepth) && (12 != bitdepth)))
+    {
+        printf("usage: %s -f <RGGB|BGGR|GRBG|GBRG> [-b bitdepth = 8] [-m method: 0 LINEAR, 1 VNG, 2 EA, 3 LINEAR on the host] [-t threads = 0] [-j jobs = 0] [-r rotate: 0, 90, 180, 270] [-p: packed, -b 10 or 12] prefix_WxH_n.raw ...\n", argv[0]);
+        return -1;
+    }
+
+    imagepro_init(ipmalloc);
+    unsigned done = 0;
+    /* a single file gets all the threads as bands, several files are spread over jobs */
+    demosaic_batch(vecFile, bitdepth, fourcc, method, (1 == vecFile.size()) ? 1 : jobs, threads, 4, rotate, bPacked ? bitdepth : 0, BatchCallback, &done);
+    return 0;
+}
@@ -0,0 +1,140 @@
+#ifndef __pyramid_H__
+#define __pyramid_H__
+
+/*
+    Pyramid of 2x decimations (AREA, the rounded mean of every 2 x 2 block; an odd last column or row is averaged with
+    itself), for the tiled TIFF writer, the stitch preview and the thumbnails, as one pass over the source instead of an
+    imagepro_resizeV2 from the full resolution per level: the rows cascade down as soon as they are complete, every
+    source row is read once, and what a level needs of the one above is the one row waiting for its pair, which
+    stays in the cache. The source rows may also be pushed one at a time (push_row, then finish), as a canvas or a
+    camera delivers them, so the full resolution never has to be in memory at once.
+    channels 1, 3, 4 (mono8/mono16, RGB24/RGB48, RGBA32/RGBA64) of 1 or 2 bytes; level(0) is the half size one.
+*/
+#include <string.h>
+#include <vector>
+
+typedef struct {
+    int width, height, step;        /* step: bytes per row, tightly packed */
+    std::vector<unsigned char> data;
+} PyramidLevel;
+
+class Pyramid {
+    int m_width, m_height, m_channels, m_bytes;
+    std::vector<PyramidLevel> m_level;
+    std::vector<const unsigned char*> m_pending;    /* per input (the source, then each level): the row waiting for its pair */
+    std::vector<int> m_rows;                        /* per input: the rows received */
+    std::vector<unsigned char> m_srcRow;            /* push_row: the copy of the pending source row */
+
+    template <typename T, int CH> static void reduce(const unsigned char* pA, const unsigned char* pB, int inW, unsigned char* pOut, int outW)
+    {
+        const T* a = (const T*)pA;
+        const T* b = (const T*)pB;
+        T* o = (T*)pOut;
+        const int pairs = inW / 2;
+        for (int x = 0; x < pairs; ++x)
+        {
+            for (int c = 0; c < CH; ++c)
+            {
+                const unsigned s = a[2 * x * CH + c] + a[(2 * x + 1) * CH + c] + b[2 * x * CH + c] + b[(2 * x + 1) * CH + c];
+                o[x * CH + c] = (T)((s + 2) >> 2);
+            }
+        }
+        if (outW > pairs)   /* odd width */
+        {
+            for (int c = 0; c < CH; ++c)
+                o[pairs * CH + c] = (T)((a[2 * pairs * CH + c] + b[2 * pairs * CH + c] + 1) >> 1);
+        }
+    }
+
+    void reduce(const unsigned char* pA, const unsigned char* pB, int inW, unsigned char* pOut, int outW) const
+    {
+        switch (m_channels * 10 + m_bytes)
+        {
+        case 11: reduce<unsigned char, 1>(pA, pB, inW, pOut, outW); break;
+        case 31: reduce<unsigned char, 3>(pA, pB, inW, pOut, outW); break;
+        case 41: reduce<unsigned char, 4>(pA, pB, inW, pOut, outW); break;
+        case 12: reduce<unsigned short, 1>(pA, pB, inW, pOut, outW); break;
+        case 32: reduce<unsigned short, 3>(pA, pB, inW, pOut, outW); break;
+        default: reduce<unsigned short, 4>(pA, pB, inW, pOut, outW); break;
+        }
+    }
+
+    int inputWidth(size_t input) const { return input ? m_level[input - 1].width : m_width; }
+
+    /* a row of input (0: the source, n: level n - 1), which stays valid until the next one of that input */
+    void feed(size_t input, const unsigned char* pRow)
+    {
+        if (input >= m_level.size())
+            return;
+        if (0 == (m_rows[input]++ & 1))
+        {
+            m_pending[input] = pRow;
+            return;
+        }
+        PyramidLevel& l = m_level[input];
+        unsigned char* pOut = &l.data[(size_t)(m_rows[input] / 2 - 1) * l.step];
+        reduce(m_pending[input], pRow, inputWidth(input), pOut, l.width);
+        m_pending[input] = nullptr;
+        feed(input + 1, pOut);
+    }
+public:
+    /* levels: 0 => down to 1 x 1 */
+    Pyramid(int width, int height, int channels, int bytes, int levels = 0)
+    : m_width(width), m_height(height), m_channels(channels), m_bytes(bytes)
+    {
+        int w = width, h = height;
+        while ((w > 1) || (h > 1))
+        {
+            if ((levels > 0) && ((int)m_level.size() >= levels))
+                break;
+            PyramidLevel l;
+            l.width = w = (w + 1) / 2;
+            l.height = h = (h + 1) / 2;
+            l.step = w * channels * bytes;
+            l.data.resize((size_t)l.step * h);
+            m_level.push_back(l);
+        }
+        m_pending.assign(m_level.size(), nullptr);
+        m_rows.assign(m_level.size(), 0);
+        m_srcRow.resize((size_t)width * channels * bytes);
+    }
+
+    int levels() const { return (int)m_level.size(); }
+    const PyramidLevel& level(int i) const { return m_level[i]; }
+
+    /* one source row, then the next, ..., then finish() */
+    void push_row(const void* pRow)
+    {
+        const unsigned char* p = (const unsigned char*)pRow;
+        if (m_level.size() && (0 == (m_rows[0] & 1)))
+        {
+            memcpy(&m_srcRow[0], p, m_srcRow.size());
+            p = &m_srcRow[0];
+        }
+        feed(0, p);
+    }
+
+    /* the odd last rows are averaged with themselves, from the top level down */
+    void finish()
+    {
+        for (size_t i = 0; i < m_level.size(); ++i)
+        {
+            if (m_rows[i] & 1)
+                feed(i, m_pending[i]);
+        }
+        m_pending.assign(m_level.size(), nullptr);
+        m_rows.assign(m_level.size(), 0);
+    }
+
+    /* srcStep: bytes per row, 0 => tightly packed */
+    void build(const void* pSrc, int srcStep)
+    {
+        if (0 == srcStep)
+            srcStep = m_width * m_channels * m_bytes;
+        for (int y = 0; y < m_height; ++y)
+            feed(0, (const unsigned char*)pSrc + (size_t)y * srcStep);
+        finish();
+    }
+};
+
+#endif
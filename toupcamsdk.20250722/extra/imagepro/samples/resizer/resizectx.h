@@ -0,0 +1,244 @@
+#ifndef __resizectx_H__
+#define __resizectx_H__
+
+/*
+    Resize context: the geometry, the format and the method are fixed at construction, where the filter of each axis
+    is computed once, so resizing every frame to the preview size (or every tile to a thumbnail) only runs the filters.
+    Same methods as imagepro_resizeV2 (NN, LINEAR, CUBIC, AREA, LANCZOS4; AUTO = AREA to shrink, CUBIC to enlarge),
+    channels 1, 3 or 4 (mono, RGB24/RGB48, RGBA32/RGBA64) of 1 or 2 bytes; the border pixels are replicated.
+    Separable: every source row is filtered horizontally once, into a ring of the rows the vertical taps of the
+    current output row need, and an output row is then a weighted sum of whole rows. The inner loops are plain float
+    loops written for the auto vectorizer (SSE/AVX, NEON at -O2 -ftree-vectorize or -O3); the output rows are split over
+    threads worker threads (0: one per core), each band with a ring of its own.
+*/
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#define RESIZE_AUTO         -1
+#define RESIZE_NN           0
+#define RESIZE_LINEAR       1
+#define RESIZE_CUBIC        2
+#define RESIZE_AREA         3
+#define RESIZE_LANCZOS4     4
+
+class ResizeCtx {
+    struct Axis {
+        int taps;
+        std::vector<int> start;     /* per output coordinate: the first source one, start + taps <= source size */
+        std::vector<float> weight;  /* per output coordinate: taps weights, summing to 1 */
+    };
+    int m_srcW, m_srcH, m_dstW, m_dstH, m_channels, m_bytes;
+    unsigned m_threads;
+    Axis m_x, m_y;
+
+    static double kernel(int method, double t)
+    {
+        t = fabs(t);
+        if (RESIZE_CUBIC == method)
+        {
+            const double a = -0.75;
+            if (t < 1.0)
+                return ((a + 2.0) * t - (a + 3.0)) * t * t + 1.0;
+            if (t < 2.0)
+                return ((a * t - 5.0 * a) * t + 8.0 * a) * t - 4.0 * a;
+            return 0.0;
+        }
+        if (RESIZE_LANCZOS4 == method)
+        {
+            if (t < 1e-9)
+                return 1.0;
+            if (t >= 4.0)
+                return 0.0;
+            const double pi = 3.14159265358979323846;
+            return 4.0 * sin(pi * t) * sin(pi * t / 4.0) / (pi * pi * t * t);
+        }
+        return (t < 1.0) ? 1.0 - t : 0.0;   /* LINEAR */
+    }
+
+    static void build(Axis& a, int src, int dst, int method)
+    {
+        const double scale = (double)src / dst;
+        int taps;
+        std::vector<int> start(dst);
+        std::vector<double> w;
+        if (RESIZE_NN == method)
+        {
+            taps = 1;
+            w.assign(dst, 1.0);
+            for (int i = 0; i < dst; ++i)
+                start[i] = std::min((int)floor((i + 0.5) * scale), src - 1);
+        }
+        else if ((RESIZE_AREA == method) && (scale > 1.0))
+        {
+            /* the overlap of the output pixel [i * scale, (i + 1) * scale) with each source one */
+            taps = (int)ceil(scale) + 1;
+            w.assign((size_t)dst * taps, 0.0);
+            for (int i = 0; i < dst; ++i)
+            {
+                const double x0 = i * scale, x1 = x0 + scale;
+                start[i] = (int)floor(x0);
+                for (int k = 0; k < taps; ++k)
+                {
+                    const int j = start[i] + k;
+                    w[(size_t)i * taps + k] = std::max(0.0, std::min(x1, j + 1.0) - std::max(x0, (double)j)) / scale;
+                }
+            }
+        }
+        else
+        {
+            if (RESIZE_AREA == method)
+                method = RESIZE_LINEAR;     /* enlarging */
+            const int radius = (RESIZE_CUBIC == method) ? 2 : ((RESIZE_LANCZOS4 == method) ? 4 : 1);
+            taps = 2 * radius;
+            w.assign((size_t)dst * taps, 0.0);
+            for (int i = 0; i < dst; ++i)
+            {
+                const double center = (i + 0.5) * scale - 0.5;
+                start[i] = (int)floor(center) - radius + 1;
+                for (int k = 0; k < taps; ++k)
+                    w[(size_t)i * taps + k] = kernel(method, center - (start[i] + k));
+            }
+        }
+
+        /* fold the taps outside of the source onto the border pixels, a window of no more than the source size */
+        a.taps = std::min(taps, src);
+        a.start.resize(dst);
+        a.weight.assign((size_t)dst * a.taps, 0.0f);
+        for (int i = 0; i < dst; ++i)
+        {
+            const double* wi = &w[(size_t)i * taps];
+            double sum = 0.0;
+            for (int k = 0; k < taps; ++k)
+                sum += wi[k];
+            a.start[i] = std::max(0, std::min(start[i], src - a.taps));
+            for (int k = 0; k < taps; ++k)
+            {
+                const int j = std::max(0, std::min(start[i] + k, src - 1));
+                a.weight[(size_t)i * a.taps + (j - a.start[i])] += (float)(wi[k] / sum);
+            }
+        }
+    }
+
+    template <typename F> void parallel_rows(int h, F f) const
+    {
+        const unsigned n = std::min<unsigned>(m_threads, (unsigned)(h + 15) / 16);
+        if (n <= 1)
+            f(0, h);
+        else
+        {
+            std::vector<std::thread> vecThread;
+            for (unsigned t = 0; t < n; ++t)
+                vecThread.push_back(std::thread(f, (int)(h * t / n), (int)(h * (t + 1) / n)));
+            for (size_t i = 0; i < vecThread.size(); ++i)
+                vecThread[i].join();
+        }
+    }
+
+    template <typename T, int CH> void horizontal(const T* pSrc, float* pOut) const
+    {
+        const int taps = m_x.taps;
+        for (int x = 0; x < m_dstW; ++x)
+        {
+            const T* p = pSrc + (size_t)m_x.start[x] * CH;
+            const float* w = &m_x.weight[(size_t)x * taps];
+            float sum[CH] = { 0 };
+            for (int k = 0; k < taps; ++k)
+            {
+                for (int c = 0; c < CH; ++c)
+                    sum[c] += w[k] * p[k * CH + c];
+            }
+            for (int c = 0; c < CH; ++c)
+                pOut[x * CH + c] = sum[c];
+        }
+    }
+
+    template <typename T, int CH> void rows(const unsigned char* pSrc, int srcStep, unsigned char* pDst, int dstStep, int y0, int y1) const
+    {
+        const int len = m_dstW * CH, taps = m_y.taps;
+        const float maxval = (sizeof(T) > 1) ? 65535.0f : 255.0f;
+        std::vector<float> ring((size_t)taps * len), acc(len);
+        std::vector<int> ringRow(taps, -1);     /* the source row in each slot */
+        for (int y = y0; y < y1; ++y)
+        {
+            const float* w = &m_y.weight[(size_t)y * taps];
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (int k = 0; k < taps; ++k)
+            {
+                const int j = m_y.start[y] + k, slot = j % taps;
+                float* h = &ring[(size_t)slot * len];
+                if (ringRow[slot] != j)
+                {
+                    horizontal<T, CH>((const T*)(pSrc + (size_t)j * srcStep), h);
+                    ringRow[slot] = j;
+                }
+                const float wk = w[k];
+                if (wk != 0.0f)
+                {
+                    float* a = &acc[0];
+                    for (int i = 0; i < len; ++i)
+                        a[i] += wk * h[i];
+                }
+            }
+            T* pOut = (T*)(pDst + (size_t)y * dstStep);
+            const float* a = &acc[0];
+            for (int i = 0; i < len; ++i)
+            {
+                const float v = a[i] + 0.5f;
+                pOut[i] = (T)((v < 0.0f) ? 0.0f : ((v > maxval) ? maxval : v));
+            }
+        }
+    }
+
+    template <typename T, int CH> void run_typed(const void* pSrc, int srcStep, void* pDst, int dstStep) const
+    {
+        parallel_rows(m_dstH, [&](int y0, int y1) {
+            rows<T, CH>((const unsigned char*)pSrc, srcStep, (unsigned char*)pDst, dstStep, y0, y1);
+        });
+    }
+public:
+    /* channels: 1, 3, 4; bytes: 1 or 2 per channel; method: RESIZE_XXX; threads: 0 => one per core */
+    ResizeCtx(int srcW, int srcH, int dstW, int dstH, int channels, int bytes, int method, unsigned threads = 0)
+    : m_srcW(srcW), m_srcH(srcH), m_dstW(dstW), m_dstH(dstH), m_channels(channels), m_bytes(bytes)
+    , m_threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+    {
+        if (RESIZE_AUTO == method)
+            method = ((dstW < srcW) || (dstH < srcH)) ? RESIZE_AREA : RESIZE_CUBIC;
+        if ((srcW > 0) && (srcH > 0) && (dstW > 0) && (dstH > 0))
+        {
+            build(m_x, srcW, dstW, method);
+            build(m_y, srcH, dstH, method);
+        }
+    }
+
+    bool valid() const
+    {
+        return (m_srcW > 0) && (m_srcH > 0) && (m_dstW > 0) && (m_dstH > 0) && ((1 == m_bytes) || (2 == m_bytes))
+            && ((1 == m_channels) || (3 == m_channels) || (4 == m_channels));
+    }
+
+    /* srcStep, dstStep: bytes per row, 0 => tightly packed */
+    bool run(const void* pSrc, int srcStep, void* pDst, int dstStep) const
+    {
+        if ((!valid()) || (nullptr == pSrc) || (nullptr == pDst))
+            return false;
+        if (0 == srcStep)
+            srcStep = m_srcW * m_channels * m_bytes;
+        if (0 == dstStep)
+            dstStep = m_dstW * m_channels * m_bytes;
+        switch (m_channels * 10 + m_bytes)
+        {
+        case 11: run_typed<unsigned char, 1>(pSrc, srcStep, pDst, dstStep); break;
+        case 31: run_typed<unsigned char, 3>(pSrc, srcStep, pDst, dstStep); break;
+        case 41: run_typed<unsigned char, 4>(pSrc, srcStep, pDst, dstStep); break;
+        case 12: run_typed<unsigned short, 1>(pSrc, srcStep, pDst, dstStep); break;
+        case 32: run_typed<unsigned short, 3>(pSrc, srcStep, pDst, dstStep); break;
+        default: run_typed<unsigned short, 4>(pSrc, srcStep, pDst, dstStep); break;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "toupcam.h"
+#include "imagepro.h"
+#include "resizectx.h"
+#include "pyramid.h"
+
+/*
+    Resize of the same geometry over and over, as the preview of every frame or the thumbnail of every tile:
+    imagepro_resizeV2, which sets its interpolation up on every call, against a ResizeCtx (resizectx.h) built once.
+    The source is a synthetic RGB24 / RGB48 frame (gradients and a fine checkerboard, so the filters show); the
+    time per resize of both and the mean / max difference between their results are printed.
+    -p: the pyramid of the source (pyramid.h, one pass) against an imagepro_resizeV2 AREA from the source per level.
+*/
+static void* ipmalloc(size_t size)
+{
+    return malloc(size);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+template <typename T> static void synthesize(unsigned char* pData, int step, int w, int h, unsigned maxval)
+{
+    for (int y = 0; y < h; ++y)
+    {
+        T* p = (T*)(pData + (size_t)y * step);
+        for (int x = 0; x < w; ++x, p += 3)
+        {
+            p[0] = (T)((unsigned long long)maxval * x / w);
+            p[1] = (T)((unsigned long long)maxval * y / h);
+            p[2] = (T)((((x >> 2) ^ (y >> 2)) & 1) ? maxval : 0);
+        }
+    }
+}
+
+static void diff(const unsigned char* p1, int step1, const unsigned char* p2, int step2, int len, int h, int bytes, double& sum, unsigned& maxdiff)
+{
+    sum = 0.0;
+    maxdiff = 0;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int i = 0; i < len; ++i)
+        {
+            const unsigned a = (2 == bytes) ? ((const unsigned short*)&p1[(size_t)y * step1])[i] : p1[(size_t)y * step1 + i];
+            const unsigned b = (2 == bytes) ? ((const unsigned short*)&p2[(size_t)y * step2])[i] : p2[(size_t)y * step2 + i];
+            const unsigned d = (a > b) ? (a - b) : (b - a);
+            sum += d;
+            maxdiff = std::max(maxdiff, d);
+        }
+    }
+    sum /= (double)len * h;
+}
+
+static int pyramid(std::vector<unsigned char>& src, int srcStep, int srcW, int srcH, int bytes, int repeat)
+{
+    Pyramid pyr(srcW, srcH, 3, bytes);
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < repeat; ++i)
+        pyr.build(&src[0], srcStep);
+    const double tPyramid = ms(t0) / repeat;
+
+    BITMAPINFOHEADER hdrSrc = { 0 };
+    hdrSrc.biSize = sizeof(BITMAPINFOHEADER);
+    hdrSrc.biPlanes = 1;
+    hdrSrc.biBitCount = (unsigned short)(24 * bytes);
+    hdrSrc.biWidth = srcW;
+    hdrSrc.biHeight = srcH;
+    hdrSrc.biSizeImage = srcStep * srcH;
+    std::vector<std::vector<unsigned char>> vecDst(pyr.levels());
+    t0 = Clock::now();
+    HRESULT hr = 0;
+    for (int i = 0; (i < repeat) && SUCCEEDED(hr); ++i)
+    {
+        for (int j = 0; (j < pyr.levels()) && SUCCEEDED(hr); ++j)
+        {
+            const PyramidLevel& l = pyr.level(j);
+            BITMAPINFOHEADER hdrDst = hdrSrc;
+            hdrDst.biWidth = l.width;
+            hdrDst.biHeight = l.height;
+            hdrDst.biSizeImage = TDIBWIDTHBYTES(l.width * 24 * bytes) * l.height;
+            vecDst[j].resize(hdrDst.biSizeImage);
+            hr = imagepro_resizeV2(&hdrSrc, srcStep, &src[0], &hdrDst, TDIBWIDTHBYTES(l.width * 24 * bytes), &vecDst[j][0], RESIZE_AREA);
+        }
+    }
+    const double tImagepro = ms(t0) / repeat;
+    if (FAILED(hr))
+    {
+        printf("failed to imagepro_resizeV2, hr = 0x%08x\n", hr);
+        return -1;
+    }
+
+    printf("%d x %d, RGB%d, %d levels\n", srcW, srcH, 24 * bytes, pyr.levels());
+    printf("imagepro_resizeV2 per level: %.2f ms\n", tImagepro);
+    printf("Pyramid: %.2f ms, %.1fx\n", tPyramid, (tPyramid > 0.0) ? tImagepro / tPyramid : 0.0);
+    for (int j = 0; j < pyr.levels(); ++j)
+    {
+        const PyramidLevel& l = pyr.level(j);
+        double mean;
+        unsigned maxdiff;
+        diff(&vecDst[j][0], TDIBWIDTHBYTES(l.width * 24 * bytes), &l.data[0], l.step, l.width * 3, l.height, bytes, mean, maxdiff);
+        printf("level %d, %d x %d: difference mean %.3f, max %u\n", j + 1, l.width, l.height, mean, maxdiff);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int srcW = 4096, srcH = 3000, dstW = 1280, dstH = 938, method = RESIZE_AREA, bytes = 1, repeat = 20;
+    unsigned threads = 0;
+    bool bPyramid = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-s")) && (i + 1 < argc))
+            sscanf(argv[++i], "%dx%d", &srcW, &srcH);
+        else if ((0 == strcmp(argv[i], "-d")) && (i + 1 < argc))
+            sscanf(argv[++i], "%dx%d", &dstW, &dstH);
+        else if ((0 == strcmp(argv[i], "-m")) && (i + 1 < argc))
+            method = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-16"))
+            bytes = 2;
+        else if ((0 == strcmp(argv[i], "-t")) && (i + 1 < argc))
+            threads = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-n")) && (i + 1 < argc))
+            repeat = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-p"))
+            bPyramid = true;
+        else
+        {
+            printf("usage: %s [-s WxH = 4096x3000] [-d WxH = 1280x938] [-m method: -1 AUTO, 0 NN, 1 LINEAR, 2 CUBIC, 3 AREA, 4 LANCZOS4] [-16] [-t threads = 0] [-n repeat = 20] [-p]\n", argv[0]);
+            return -1;
+        }
+    }
+    if ((srcW <= 0) || (srcH <= 0) || (dstW <= 0) || (dstH <= 0) || (repeat <= 0))
+    {
+        printf("bad size\n");
+        return -1;
+    }
+
+    imagepro_init(ipmalloc);
+    const int srcStep = TDIBWIDTHBYTES(srcW * 24 * bytes), dstStep = TDIBWIDTHBYTES(dstW * 24 * bytes);
+    std::vector<unsigned char> src((size_t)srcStep * srcH), dst1((size_t)dstStep * dstH), dst2((size_t)dstStep * dstH);
+    if (2 == bytes)
+        synthesize<unsigned short>(&src[0], srcStep, srcW, srcH, 65535);
+    else
+        synthesize<unsigned char>(&src[0], srcStep, srcW, srcH, 255);
+    if (bPyramid)
+        return pyramid(src, srcStep, srcW, srcH, bytes, repeat);
+
+    BITMAPINFOHEADER hdrSrc = { 0 }, hdrDst = { 0 };
+    hdrSrc.biSize = hdrDst.biSize = sizeof(BITMAPINFOHEADER);
+    hdrSrc.biPlanes = hdrDst.biPlanes = 1;
+    hdrSrc.biBitCount = hdrDst.biBitCount = (unsigned short)(24 * bytes);
+    hdrSrc.biWidth = srcW;
+    hdrSrc.biHeight = srcH;
+    hdrSrc.biSizeImage = srcStep * srcH;
+    hdrDst.biWidth = dstW;
+    hdrDst.biHeight = dstH;
+    hdrDst.biSizeImage = dstStep * dstH;
+
+    Clock::time_point t0 = Clock::now();
+    HRESULT hr = 0;
+    for (int i = 0; (i < repeat) && SUCCEEDED(hr); ++i)
+        hr = imagepro_resizeV2(&hdrSrc, srcStep, &src[0], &hdrDst, dstStep, &dst1[0], method);
+    const double tImagepro = ms(t0) / repeat;
+    if (FAILED(hr))
+        printf("failed to imagepro_resizeV2, hr = 0x%08x\n", hr);
+
+    t0 = Clock::now();
+    ResizeCtx ctx(srcW, srcH, dstW, dstH, 3, bytes, method, threads);
+    const double tBuild = ms(t0);
+    t0 = Clock::now();
+    for (int i = 0; i < repeat; ++i)
+        ctx.run(&src[0], srcStep, &dst2[0], dstStep);
+    const double tCtx = ms(t0) / repeat;
+
+    double mean;
+    unsigned maxdiff;
+    diff(&dst1[0], dstStep, &dst2[0], dstStep, dstW * 3, dstH, bytes, mean, maxdiff);
+    printf("%d x %d => %d x %d, RGB%d, method %d\n", srcW, srcH, dstW, dstH, 24 * bytes, method);
+    printf("imagepro_resizeV2: %.2f ms\n", tImagepro);
+    printf("ResizeCtx: %.2f ms (%.2f ms to build), %.1fx\n", tCtx, tBuild, (tCtx > 0.0) ? tImagepro / tCtx : 0.0);
+    printf("difference: mean %.3f, max %u\n", mean, maxdiff);
+    return 0;
+}
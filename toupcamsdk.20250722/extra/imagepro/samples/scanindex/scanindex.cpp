@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "../../../../samples/focusmetric.h"
+#include "../tileindex.h"
+
+/*
+    Tile index of an area scan (tileindex.h): built offline from the tiles of a scan, or browsed.
+    build: the index of the tiles tile_<row>_<column>.rgb of the current directory (demoscanexec: RGB24 rows as pulled,
+           bottom up), on threads threads; the stage positions are not in the files, they are left 0 (demoscanexec -i
+           writes the index during the scan, with them)
+        scanindex build <index> <columns> <rows> <width> <height> [threads = 2]
+    show: the records of the index, then, with level, the thumbnails of that level of the whole scan as one contact
+          sheet, a binary PPM; only the pages of that level are read
+        scanindex show <index> [level out.ppm]
+*/
+static int DoBuild(int argc, char** argv)
+{
+    if (argc < 7)
+    {
+        printf("usage: %s build <index> <columns> <rows> <width> <height> [threads = 2]\n", argv[0]);
+        return -1;
+    }
+    const unsigned columns = atoi(argv[3]), rows = atoi(argv[4]), width = atoi(argv[5]), height = atoi(argv[6]);
+    const unsigned threads = (argc > 7) ? atoi(argv[7]) : 2;
+    TileIndexWriter writer;
+    HRESULT hr = writer.create(argv[2], columns, rows, width, height);
+    if (FAILED(hr))
+    {
+        printf("failed to create %s, hr = 0x%08x\n", argv[2], hr);
+        return -1;
+    }
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::atomic<unsigned> next(0), done(0);
+    std::vector<std::thread> vec;
+    for (unsigned t = 0; t < (threads ? threads : 1); ++t)
+    {
+        vec.push_back(std::thread([&]() {
+            const size_t size = (size_t)TDIBWIDTHBYTES(width * 24) * height;
+            std::vector<unsigned char> data(size);
+            for (unsigned i = next++; i < columns * rows; i = next++)
+            {
+                TileIndexRecord rec;
+                memset(&rec, 0, sizeof(rec));
+                rec.row = i / columns;
+                rec.column = i % columns;
+                rec.info.v3.width = width;
+                rec.info.v3.height = height;
+                sprintf(rec.name, "tile_%03u_%03u.rgb", rec.row, rec.column);
+                FILE* fp = fopen(rec.name, "rb");
+                if (NULL == fp)
+                    continue;
+                const bool bRead = (fread(&data[0], 1, size, fp) == size);
+                fclose(fp);
+                if (!bRead)
+                    printf("%s: short\n", rec.name);
+                else
+                {
+                    FocusMetric focus;
+                    rec.focus = focus.value(rec.info, &data[0], false);
+                    rec.focusSource = focus.source();
+                    HRESULT hr = writer.add(rec, &data[0], 0, true);
+                    if (FAILED(hr))
+                        printf("failed to index %s, hr = 0x%08x\n", rec.name, hr);
+                    else
+                        ++done;
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < vec.size(); ++i)
+        vec[i].join();
+    writer.close();
+    printf("%u of %u tiles, %.1f ms\n", (unsigned)done, columns * rows, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    return 0;
+}
+
+static int DoShow(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s show <index> [level out.ppm]\n", argv[0]);
+        return -1;
+    }
+    TileIndexReader reader;
+    if (!reader.open(argv[2]))
+    {
+        printf("failed to open %s\n", argv[2]);
+        return -1;
+    }
+    const TileIndexHeader& hdr = reader.header();
+    printf("%u x %u tiles of %u x %u, %u levels:", hdr.columns, hdr.rows, hdr.tileWidth, hdr.tileHeight, hdr.levels);
+    for (unsigned l = 0; l < hdr.levels; ++l)
+        printf(" %u x %u", hdr.level[l].width, hdr.level[l].height);
+    printf("\n");
+    for (unsigned r = 0; r < hdr.rows; ++r)
+    {
+        for (unsigned c = 0; c < hdr.columns; ++c)
+        {
+            const TileIndexRecord* pRec = reader.record(r, c);
+            if (NULL == pRec)
+                printf("%3u %3u: missing\n", r, c);
+            else
+                printf("%3u %3u: %s, stage %.3f %.3f %.3f, focus %.1f (%s), seq %u, expo %u us, gain %u%%\n", r, c, pRec->name, pRec->x, pRec->y, pRec->z,
+                    pRec->focus, (FOCUSMETRIC_CAMERA == pRec->focusSource) ? "camera" : ((FOCUSMETRIC_HOST == pRec->focusSource) ? "host" : "none"),
+                    pRec->info.v3.seq, pRec->info.v3.expotime, pRec->info.v3.expogain);
+        }
+    }
+    if ((argc > 4) && (3 == hdr.channels) && (1 == hdr.bytes))
+    {
+        const unsigned level = atoi(argv[3]);
+        if (level >= hdr.levels)
+        {
+            printf("no level %u\n", level);
+            return -1;
+        }
+        const TileIndexLevel& l = hdr.level[level];
+        reader.willneed(level, 0, hdr.rows);
+        const unsigned sheetW = l.width * hdr.columns, sheetH = l.height * hdr.rows;
+        std::vector<unsigned char> sheet((size_t)sheetW * sheetH * 3);
+        for (unsigned r = 0; r < hdr.rows; ++r)
+        {
+            for (unsigned c = 0; c < hdr.columns; ++c)
+            {
+                const unsigned char* p = (const unsigned char*)reader.thumb(level, r, c);
+                if (NULL == p)
+                    continue;
+                for (unsigned y = 0; y < l.height; ++y)
+                {
+                    const unsigned char* s = p + (size_t)y * l.step;
+                    unsigned char* d = &sheet[(((size_t)r * l.height + y) * sheetW + (size_t)c * l.width) * 3];
+                    for (unsigned x = 0; x < l.width; ++x, s += 3, d += 3)
+                    {
+#if defined(_WIN32)
+                        d[0] = s[2];    /* BGR as pulled on Windows */
+                        d[1] = s[1];
+                        d[2] = s[0];
+#else
+                        d[0] = s[0];
+                        d[1] = s[1];
+                        d[2] = s[2];
+#endif
+                    }
+                }
+            }
+        }
+        FILE* fp = fopen(argv[4], "wb");
+        if (NULL == fp)
+        {
+            printf("failed to create %s\n", argv[4]);
+            return -1;
+        }
+        fprintf(fp, "P6\n%u %u\n255\n", sheetW, sheetH);
+        fwrite(&sheet[0], 1, sheet.size(), fp);
+        fclose(fp);
+        printf("%s: %u x %u\n", argv[4], sheetW, sheetH);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc > 1) && (0 == strcmp(argv[1], "build")))
+        return DoBuild(argc, argv);
+    if ((argc > 1) && (0 == strcmp(argv[1], "show")))
+        return DoShow(argc, argv);
+    printf("usage: %s build <index> <columns> <rows> <width> <height> [threads = 2]\n"
+           "       %s show <index> [level out.ppm]\n", argv[0], argv[0]);
+    return -1;
+}
@@ -0,0 +1,416 @@
+#ifndef __tileindex_H__
+#define __tileindex_H__
+
+/*
+    Tile index of an area scan: one memory mapped file, written alongside the saver, with the metadata of every tile
+    (grid position, stage X Y Z, ToupcamFrameInfoV4, focus value) and its thumbnails, a few levels of the 2x AREA
+    pyramid (resizer/pyramid.h), so that a browser or the offline stitcher starts at once from the index instead of
+    opening thousands of full size files, and pages the thumbnails in as they are looked at.
+    Layout, the size fixed by create() (columns x rows tiles of tileWidth x tileHeight), integers little endian:
+        offset 0                    TileIndexHeader
+        header.recordOffset         columns x rows TileIndexRecord, tile (row, column) at row * columns + column
+        header.level[l].offset      the thumbnails of level l of every tile, in the same order, header.level[l].slot
+                                    bytes apart, rows top down, tightly packed (step), pixels as the tiles (RGB24:
+                                    the byte order as pulled)
+    The levels are the ones of the pyramid of a tile from the first no larger than TILEINDEX_THUMB, at most
+    TILEINDEX_LEVELS of them, the largest first; every level starts on a page (TILEINDEX_ALIGN), so the smallest
+    level of the whole scan is a few pages and an overview of thousands of tiles reads only those.
+    TileIndexWriter::add() can be called from several threads at once (the save workers): a tile writes to its own
+    record and slots only, the pyramids are a pool. The state of a record is written last (TILEINDEX_DONE), so a
+    reader of the index while the scan still runs skips the tiles not there yet; a tile taken again (a second pass)
+    is written over, its state cleared first.
+    The file is sparse until the tiles come in; the pages are written back by the system, close() flushes them.
+    TileIndexReader maps the file read only: record() and thumb() are pointers into the mapping, valid until close();
+    willneed() asks the system to read a range of tiles of a level ahead.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "toupcam.h"
+#include "resizer/pyramid.h"
+
+#define TILEINDEX_MAGIC     "TTILEIX1"
+#define TILEINDEX_ALIGN     4096
+#define TILEINDEX_LEVELS    6
+#define TILEINDEX_THUMB     256     /* width and height of the largest level stored, at most */
+
+#define TILEINDEX_EMPTY     0
+#define TILEINDEX_DONE      1
+
+typedef struct {
+    uint32_t width, height, step;   /* step: bytes per row */
+    uint32_t slot;                  /* bytes between the thumbnails of two tiles */
+    uint64_t offset;
+} TileIndexLevel;
+
+typedef struct {
+    char magic[8];
+    uint32_t columns, rows;
+    uint32_t tileWidth, tileHeight;
+    uint32_t channels, bytes;       /* of a pixel of the tiles and of the thumbnails: 3, 1 for RGB24 */
+    uint32_t levels;
+    uint32_t recordSize;            /* sizeof(TileIndexRecord) */
+    uint64_t recordOffset;
+    uint64_t fileSize;
+    TileIndexLevel level[TILEINDEX_LEVELS];
+} TileIndexHeader;
+
+typedef struct {
+    uint32_t state;                 /* TILEINDEX_EMPTY, TILEINDEX_DONE */
+    uint32_t row, column;
+    int32_t focusSource;            /* FOCUSMETRIC_CAMERA, FOCUSMETRIC_HOST (focusmetric.h), 0: none */
+    double x, y, z;                 /* stage, mm */
+    double focus;
+    ToupcamFrameInfoV4 info;
+    char name[64];                  /* the file of the full tile, relative to the index; "": none */
+} TileIndexRecord;
+
+/* the file mapping of the writer and of the reader */
+class TileIndexMap {
+protected:
+    unsigned char* m_ptr;
+    unsigned long long m_size;
+#if defined(_WIN32)
+    HANDLE m_hFile, m_hMap;
+#else
+    int m_fd;
+#endif
+
+    TileIndexMap()
+    : m_ptr(NULL), m_size(0)
+#if defined(_WIN32)
+    , m_hFile(INVALID_HANDLE_VALUE), m_hMap(NULL)
+#else
+    , m_fd(-1)
+#endif
+    {
+    }
+    ~TileIndexMap()
+    {
+        unmap(false);
+    }
+
+    /* size: create the file of size bytes, read write; 0: open it read only */
+    bool map(const char* filename, unsigned long long size)
+    {
+#if defined(_WIN32)
+        m_hFile = CreateFileA(filename, size ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ | (size ? 0 : FILE_SHARE_WRITE), NULL,
+            size ? CREATE_ALWAYS : OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+        if (INVALID_HANDLE_VALUE == m_hFile)
+            return false;
+        if (0 == size)
+        {
+            LARGE_INTEGER li;
+            if (!GetFileSizeEx(m_hFile, &li) || (0 == li.QuadPart))
+                return false;
+            m_size = li.QuadPart;
+        }
+        else
+        {
+            DWORD dw;
+            DeviceIoControl(m_hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dw, NULL);
+            m_size = size;
+        }
+        m_hMap = CreateFileMappingA(m_hFile, NULL, size ? PAGE_READWRITE : PAGE_READONLY, (DWORD)(m_size >> 32), (DWORD)m_size, NULL);
+        if (m_hMap)
+            m_ptr = (unsigned char*)MapViewOfFile(m_hMap, size ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+#else
+        m_fd = size ? ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(filename, O_RDONLY);
+        if (m_fd < 0)
+            return false;
+        if (size)
+        {
+            if (0 != ftruncate(m_fd, (off_t)size))
+                return false;
+            m_size = size;
+        }
+        else
+        {
+            struct stat st;
+            if ((0 != fstat(m_fd, &st)) || (0 == st.st_size))
+                return false;
+            m_size = st.st_size;
+        }
+        void* p = mmap(NULL, (size_t)m_size, size ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_fd, 0);
+        if (MAP_FAILED != p)
+        {
+            m_ptr = (unsigned char*)p;
+            madvise(p, (size_t)m_size, MADV_RANDOM);
+        }
+#endif
+        return (NULL != m_ptr);
+    }
+
+    /* bFlush: write the dirty pages back before */
+    void unmap(bool bFlush)
+    {
+#if defined(_WIN32)
+        if (m_ptr)
+        {
+            if (bFlush)
+                FlushViewOfFile(m_ptr, 0);
+            UnmapViewOfFile(m_ptr);
+        }
+        if (m_hMap)
+            CloseHandle(m_hMap);
+        if (INVALID_HANDLE_VALUE != m_hFile)
+        {
+            if (bFlush)
+                FlushFileBuffers(m_hFile);
+            CloseHandle(m_hFile);
+        }
+        m_hFile = INVALID_HANDLE_VALUE;
+        m_hMap = NULL;
+#else
+        if (m_ptr)
+        {
+            if (bFlush)
+                msync(m_ptr, (size_t)m_size, MS_SYNC);
+            munmap(m_ptr, (size_t)m_size);
+        }
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+#endif
+        m_ptr = NULL;
+        m_size = 0;
+    }
+
+    static unsigned long long roundup(unsigned long long n, unsigned long long align)
+    {
+        return (n + align - 1) / align * align;
+    }
+};
+
+class TileIndexWriter : public TileIndexMap {
+    TileIndexHeader m_header;
+    unsigned m_first;                       /* the pyramid level of header.level[0] */
+    std::mutex m_mtx;
+    std::vector<Pyramid*> m_pool;           /* the pyramids not in use */
+
+    TileIndexRecord* record(unsigned row, unsigned column) const
+    {
+        return reinterpret_cast<TileIndexRecord*>(m_ptr + m_header.recordOffset) + (size_t)row * m_header.columns + column;
+    }
+
+    Pyramid* take()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_pool.empty())
+            {
+                Pyramid* p = m_pool.back();
+                m_pool.pop_back();
+                return p;
+            }
+        }
+        return new Pyramid(m_header.tileWidth, m_header.tileHeight, m_header.channels, m_header.bytes, m_first + m_header.levels);
+    }
+
+    void give(Pyramid* p)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_pool.push_back(p);
+    }
+public:
+    TileIndexWriter()
+    : m_first(0)
+    {
+        memset(&m_header, 0, sizeof(m_header));
+    }
+    ~TileIndexWriter()
+    {
+        close();
+    }
+
+    /* channels 1, 3, 4 of bytes 1, 2 (Pyramid), as the tiles are pulled */
+    HRESULT create(const char* filename, unsigned columns, unsigned rows, unsigned tileWidth, unsigned tileHeight, unsigned channels = 3, unsigned bytes = 1)
+    {
+        close();
+        if ((NULL == filename) || (0 == columns) || (0 == rows) || (0 == tileWidth) || (0 == tileHeight) || ((1 != channels) && (3 != channels) && (4 != channels)) || ((1 != bytes) && (2 != bytes)))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        memset(&m_header, 0, sizeof(m_header));
+        memcpy(m_header.magic, TILEINDEX_MAGIC, sizeof(m_header.magic));
+        m_header.columns = columns;
+        m_header.rows = rows;
+        m_header.tileWidth = tileWidth;
+        m_header.tileHeight = tileHeight;
+        m_header.channels = channels;
+        m_header.bytes = bytes;
+        m_header.recordSize = sizeof(TileIndexRecord);
+        m_header.recordOffset = TILEINDEX_ALIGN;
+        const unsigned long long tiles = (unsigned long long)columns * rows;
+        unsigned long long offset = roundup(m_header.recordOffset + tiles * sizeof(TileIndexRecord), TILEINDEX_ALIGN);
+        /* the levels of the pyramid, (w + 1) / 2 each */
+        unsigned w = tileWidth, h = tileHeight;
+        m_first = 0;
+        while ((w > 1) || (h > 1))
+        {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+            if ((w > TILEINDEX_THUMB) || (h > TILEINDEX_THUMB))
+                ++m_first;
+            else if (m_header.levels < TILEINDEX_LEVELS)
+            {
+                TileIndexLevel& l = m_header.level[m_header.levels++];
+                l.width = w;
+                l.height = h;
+                l.step = w * channels * bytes;
+                l.slot = (uint32_t)roundup((unsigned long long)l.step * h, 64);
+                l.offset = offset;
+                offset = roundup(offset + tiles * l.slot, TILEINDEX_ALIGN);
+            }
+        }
+        m_header.fileSize = offset;
+        if (!map(filename, offset))
+        {
+            unmap(false);
+            return (HRESULT)0x80004005; /* E_FAIL */
+        }
+        memcpy(m_ptr, &m_header, sizeof(m_header));
+        return 0;
+    }
+
+    const TileIndexHeader& header() const { return m_header; }
+
+    /*
+        rec: the metadata of the tile (state is ignored), rec.row and rec.column its place;
+        data: the tile as pulled, info.v3.width x info.v3.height = tileWidth x tileHeight, rows pitch bytes apart
+        (0: TDIBWIDTHBYTES of the pixels), bBottomUp: the first row in data is the bottom one (RGB24 by default)
+    */
+    HRESULT add(const TileIndexRecord& rec, const void* data, size_t pitch, bool bBottomUp)
+    {
+        if ((NULL == m_ptr) || (NULL == data))
+            return (HRESULT)0x80004003; /* E_POINTER */
+        if ((rec.row >= m_header.rows) || (rec.column >= m_header.columns) || (rec.info.v3.width != m_header.tileWidth) || (rec.info.v3.height != m_header.tileHeight))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        if (0 == pitch)
+            pitch = TDIBWIDTHBYTES(m_header.tileWidth * m_header.channels * m_header.bytes * 8);
+        TileIndexRecord* pRec = record(rec.row, rec.column);
+        reinterpret_cast<std::atomic<uint32_t>*>(&pRec->state)->store(TILEINDEX_EMPTY, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        Pyramid* pyr = take();
+        const unsigned char* p = (const unsigned char*)data;
+        for (unsigned y = 0; y < m_header.tileHeight; ++y)
+            pyr->push_row(p + (size_t)(bBottomUp ? (m_header.tileHeight - 1 - y) : y) * pitch);
+        pyr->finish();
+        const size_t i = (size_t)rec.row * m_header.columns + rec.column;
+        for (unsigned k = 0; k < m_header.levels; ++k)
+        {
+            const TileIndexLevel& l = m_header.level[k];
+            const PyramidLevel& src = pyr->level(m_first + k);
+            memcpy(m_ptr + l.offset + i * l.slot, &src.data[0], (size_t)l.step * l.height);
+        }
+        give(pyr);
+
+        TileIndexRecord r = rec;
+        r.state = TILEINDEX_EMPTY;
+        r.name[sizeof(r.name) - 1] = '\0';
+        memcpy(pRec, &r, sizeof(r));
+        std::atomic_thread_fence(std::memory_order_release);
+        reinterpret_cast<std::atomic<uint32_t>*>(&pRec->state)->store(TILEINDEX_DONE, std::memory_order_relaxed);
+        return 0;
+    }
+
+    void close()
+    {
+        unmap(NULL != m_ptr);
+        for (size_t i = 0; i < m_pool.size(); ++i)
+            delete m_pool[i];
+        m_pool.clear();
+    }
+};
+
+class TileIndexReader : public TileIndexMap {
+    TileIndexHeader m_header;
+public:
+    TileIndexReader()
+    {
+        memset(&m_header, 0, sizeof(m_header));
+    }
+    ~TileIndexReader()
+    {
+        close();
+    }
+
+    bool open(const char* filename)
+    {
+        close();
+        if (!map(filename, 0) || (m_size < sizeof(TileIndexHeader)))
+        {
+            close();
+            return false;
+        }
+        memcpy(&m_header, m_ptr, sizeof(m_header));
+        if ((0 != memcmp(m_header.magic, TILEINDEX_MAGIC, sizeof(m_header.magic))) || (sizeof(TileIndexRecord) != m_header.recordSize)
+            || (m_header.fileSize > m_size) || (m_header.levels > TILEINDEX_LEVELS))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        unmap(false);
+        memset(&m_header, 0, sizeof(m_header));
+    }
+
+    const TileIndexHeader& header() const { return m_header; }
+
+    /* NULL: out of the grid or not written (yet) */
+    const TileIndexRecord* record(unsigned row, unsigned column) const
+    {
+        if ((row >= m_header.rows) || (column >= m_header.columns))
+            return NULL;
+        const TileIndexRecord* pRec = reinterpret_cast<const TileIndexRecord*>(m_ptr + m_header.recordOffset) + (size_t)row * m_header.columns + column;
+        if (TILEINDEX_DONE != reinterpret_cast<const std::atomic<uint32_t>*>(&pRec->state)->load(std::memory_order_acquire))
+            return NULL;
+        return pRec;
+    }
+
+    /* zero copy: the thumbnail of level (0: the largest) of the tile, header().level[level].step per row; NULL as record() */
+    const void* thumb(unsigned level, unsigned row, unsigned column) const
+    {
+        if ((level >= m_header.levels) || (NULL == record(row, column)))
+            return NULL;
+        const TileIndexLevel& l = m_header.level[level];
+        return m_ptr + l.offset + ((size_t)row * m_header.columns + column) * l.slot;
+    }
+
+    /* start reading the thumbnails of level of the grid rows [firstRow, firstRow + rows) in the background */
+    void willneed(unsigned level, unsigned firstRow, unsigned rows) const
+    {
+        if ((level >= m_header.levels) || (firstRow >= m_header.rows) || (0 == rows))
+            return;
+        if (rows > m_header.rows - firstRow)
+            rows = m_header.rows - firstRow;
+        const TileIndexLevel& l = m_header.level[level];
+        const unsigned long long begin = l.offset + (unsigned long long)firstRow * m_header.columns * l.slot;
+        const unsigned long long offset = begin / TILEINDEX_ALIGN * TILEINDEX_ALIGN;
+        const unsigned long long length = begin + (unsigned long long)rows * m_header.columns * l.slot - offset;
+#if defined(_WIN32)
+#if (_WIN32_WINNT >= 0x0602)
+        WIN32_MEMORY_RANGE_ENTRY entry;
+        entry.VirtualAddress = (PVOID)(m_ptr + offset);
+        entry.NumberOfBytes = (SIZE_T)length;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+#endif
+#else
+        madvise(m_ptr + offset, (size_t)length, MADV_WILLNEED);
+#endif
+    }
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef __toupcam_labview_h__
 #define __toupcam_labview_h__
 
+#include <stdint.h>
 #include "extcode.h"
 
 #ifdef TOUPCAM_LABVIEW_EXPORTS
@@ -16,6 +17,39 @@ extern "C" {
 
 TOUPCAM_LABVIEW_API(HRESULT) Start(HToupcam h, LVUserEventRef* rwer);
 
+/*
+    Zero copy delivery: the frames are pulled straight into buffers the LabVIEW program owns, such as the pixels of IMAQ
+    images (IMAQ GetImagePixelPtr: the pixel pointer, and the line width times the bytes a pixel for the row pitch), and
+    the user event carries only which buffer was filled. Start() posts the event and leaves the frame to be pulled
+    into a LabVIEW array afterwards, and PostLVUserEvent deep copies an array carried by the event too; at 20 MP and
+    more those copies are what limits the frame rate.
+        AddBuffer           before StartBuffered, once a buffer; pData is a pointer sized integer, the index is returned;
+                            more while running are checked against the resolution and bits of StartBuffered
+        StartBuffered       in place of Start; the event data is a ToupcamLabviewFrame
+        ReleaseBuffer       when the program is done with the frame in the buffer (the image is displayed, processed,
+                            copied), the buffer is then filled again; a frame which came while all the buffers were
+                            held is pulled into it at once
+        ClearBuffers        after Toupcam_Stop / Toupcam_Close, before the buffers are disposed of
+    The cluster of the event: U64 timestamp, U32 event, I32 index, U32 width, height, flag, seq, expotime, held.
+*/
+typedef struct {
+    uInt64  timestamp;      /* microsecond */
+    uInt32  event;          /* TOUPCAM_EVENT_xxxx, the other events come as well, with index -1 */
+    int32   index;          /* of the buffer, as returned by AddBuffer */
+    uInt32  width;
+    uInt32  height;
+    uInt32  flag;           /* TOUPCAM_FRAMEINFO_FLAG_xxxx */
+    uInt32  seq;
+    uInt32  expotime;
+    uInt32  held;           /* buffers the program holds, this one included: AddBuffer more when it nears them all */
+} ToupcamLabviewFrame;
+
+TOUPCAM_LABVIEW_API(HRESULT) AddBuffer(HToupcam h, uintptr_t pData, int32 rowPitch, int32 nBytes, int32* pIndex);
+/* bits: 24 (RGB24), 32 (RGB32), 48 (RGB48), 8 (grey8), 16 (grey16) or 64 (RGB64), as Toupcam_PullImageV4 */
+TOUPCAM_LABVIEW_API(HRESULT) StartBuffered(HToupcam h, LVUserEventRef* rwer, int32 bits);
+TOUPCAM_LABVIEW_API(HRESULT) ReleaseBuffer(HToupcam h, int32 index);
+TOUPCAM_LABVIEW_API(HRESULT) ClearBuffers(HToupcam h);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,195 @@
+/*
+    AddBuffer / StartBuffered / ReleaseBuffer / ClearBuffers of toupcam_labview.h: the frames are pulled into the
+    buffers of the LabVIEW program and the user event only says which one, see there.
+    A buffer is free, or held by the program from the event which announced it until ReleaseBuffer. A frame which comes
+    while the program holds them all stays in the SDK (the backend deque, TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, bounds
+    how many) and ReleaseBuffer pulls it at once, on the thread of the caller; the order of the frames is kept.
+*/
+#include <string.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include "toupcam.h"
+#define TOUPCAM_LABVIEW_EXPORTS
+#include "../inc/toupcam_labview.h"
+
+namespace {
+
+struct Buffered {
+    struct Buffer {
+        void*       pData;
+        int32       rowPitch;
+        int32       nBytes;
+        bool        bHeld;
+    };
+    HToupcam            hcam;
+    LVUserEventRef      rwer;
+    int32               bits;
+    int                 width, height;      /* of StartBuffered, 0: not started */
+    std::vector<Buffer> buffers;
+    unsigned            nHeld, nPending;    /* frames still in the SDK for want of a free buffer */
+    std::mutex          mtx;
+
+    Buffered(HToupcam h)
+    : hcam(h), rwer(0), bits(24), width(0), height(0), nHeld(0), nPending(0)
+    {
+    }
+
+    /* the buffer holds a frame of w x hgt at bits, the SDK would write past a smaller one */
+    static bool fits(const Buffer& b, int w, int hgt, int32 bits)
+    {
+        const int pitch = (b.rowPitch > 0) ? b.rowPitch : ((-1 == b.rowPitch) ? (w * bits / 8) : TDIBWIDTHBYTES(w * bits));
+        return (long long)pitch * hgt <= b.nBytes;
+    }
+
+    /* under mtx: a pending frame into a free buffer, false when there is no frame or no buffer */
+    bool fill()
+    {
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            Buffer& b = buffers[i];
+            if (b.bHeld)
+                continue;
+            ToupcamFrameInfoV4 info;
+            memset(&info, 0, sizeof(info));
+            if (FAILED(Toupcam_PullImageV4(hcam, b.pData, 0, bits, b.rowPitch, &info)))
+            {
+                nPending = 0;   /* the SDK has no more: those were dropped by the deque in the meantime */
+                return false;
+            }
+            b.bHeld = true;
+            ++nHeld;
+            ToupcamLabviewFrame frame;
+            memset(&frame, 0, sizeof(frame));
+            frame.timestamp = info.v3.timestamp;
+            frame.event = TOUPCAM_EVENT_IMAGE;
+            frame.index = (int32)i;
+            frame.width = info.v3.width;
+            frame.height = info.v3.height;
+            frame.flag = info.v3.flag;
+            frame.seq = info.v3.seq;
+            frame.expotime = info.v3.expotime;
+            frame.held = nHeld;
+            PostLVUserEvent(rwer, &frame);
+            return true;
+        }
+        return false;
+    }
+};
+
+std::mutex g_mtx;
+std::map<HToupcam, Buffered*> g_buffered;
+
+Buffered* find(HToupcam h, bool bCreate)
+{
+    std::lock_guard<std::mutex> lock(g_mtx);
+    std::map<HToupcam, Buffered*>::iterator it = g_buffered.find(h);
+    if (it != g_buffered.end())
+        return it->second;
+    if (!bCreate)
+        return NULL;
+    Buffered* p = new Buffered(h);
+    g_buffered[h] = p;
+    return p;
+}
+
+void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    Buffered* p = (Buffered*)pCallbackCtx;
+    std::lock_guard<std::mutex> lock(p->mtx);
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ++p->nPending;
+        if (p->fill())
+            --p->nPending;
+    }
+    else
+    {
+        ToupcamLabviewFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.event = nEvent;
+        frame.index = -1;
+        frame.held = p->nHeld;
+        PostLVUserEvent(p->rwer, &frame);
+    }
+}
+
+}
+
+TOUPCAM_LABVIEW_API(HRESULT) AddBuffer(HToupcam h, uintptr_t pData, int32 rowPitch, int32 nBytes, int32* pIndex)
+{
+    if ((NULL == h) || (0 == pData) || (nBytes <= 0))
+        return E_INVALIDARG;
+    Buffered* p = find(h, true);
+    std::lock_guard<std::mutex> lock(p->mtx);
+    Buffered::Buffer b = { (void*)pData, rowPitch, nBytes, false };
+    if (p->width && !Buffered::fits(b, p->width, p->height, p->bits))
+        return E_INVALIDARG;    /* started: the resolution and format of StartBuffered */
+    p->buffers.push_back(b);
+    if (pIndex)
+        *pIndex = (int32)(p->buffers.size() - 1);
+    return S_OK;
+}
+
+TOUPCAM_LABVIEW_API(HRESULT) StartBuffered(HToupcam h, LVUserEventRef* rwer, int32 bits)
+{
+    if ((NULL == h) || (NULL == rwer))
+        return E_INVALIDARG;
+    Buffered* p = find(h, false);
+    if ((NULL == p) || p->buffers.empty())
+        return E_UNEXPECTED;    /* AddBuffer first */
+    int w = 0, hgt = 0;
+    HRESULT hr = Toupcam_get_Size(h, &w, &hgt);
+    if (FAILED(hr))
+        return hr;
+    {
+        std::lock_guard<std::mutex> lock(p->mtx);
+        for (size_t i = 0; i < p->buffers.size(); ++i)
+        {
+            if (!Buffered::fits(p->buffers[i], w, hgt, bits))
+                return E_INVALIDARG;
+        }
+        p->rwer = *rwer;
+        p->bits = bits;
+        p->width = w;
+        p->height = hgt;
+        p->nPending = 0;
+        p->nHeld = 0;
+        for (size_t i = 0; i < p->buffers.size(); ++i)
+            p->buffers[i].bHeld = false;
+    }
+    return Toupcam_StartPullModeWithCallback(h, EventCallback, p);
+}
+
+TOUPCAM_LABVIEW_API(HRESULT) ReleaseBuffer(HToupcam h, int32 index)
+{
+    Buffered* p = find(h, false);
+    if (NULL == p)
+        return E_INVALIDARG;
+    std::lock_guard<std::mutex> lock(p->mtx);
+    if ((index < 0) || (index >= (int32)p->buffers.size()))
+        return E_INVALIDARG;
+    if (!p->buffers[index].bHeld)
+        return S_FALSE;
+    p->buffers[index].bHeld = false;
+    --p->nHeld;
+    if (p->nPending && p->fill())
+        --p->nPending;
+    return S_OK;
+}
+
+/* the camera stopped, so no callback is running any more */
+TOUPCAM_LABVIEW_API(HRESULT) ClearBuffers(HToupcam h)
+{
+    Buffered* p = NULL;
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        std::map<HToupcam, Buffered*>::iterator it = g_buffered.find(h);
+        if (it == g_buffered.end())
+            return S_FALSE;
+        p = it->second;
+        g_buffered.erase(it);
+    }
+    delete p;
+    return S_OK;
+}
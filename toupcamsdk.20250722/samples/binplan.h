@@ -0,0 +1,432 @@
+#ifndef __binplan_H__
+#define __binplan_H__
+
+/*
+    The readout and binning configuration with the best frame rate for a target: a final size of at least width x
+    height, at least fps frames per second and a signal to noise ratio of at least snr.
+    The knobs, as offered by the model:
+        resolution          Toupcam_put_eSize, with Toupcam_put_Mode bin or skip (TOUPCAM_FLAG_BINSKIP_SUPPORTED)
+        sensor binning      Toupcam_put_Binning, every value of Toupcam_get_BinningValue with every method of
+                            Toupcam_get_BinningMethod
+        SDK binning         TOUPCAM_OPTION_BINNING 0x80 | n, average, on the host
+        conversion gain     TOUPCAM_OPTION_CG 0 or 1 (TOUPCAM_FLAG_CG, TOUPCAM_FLAG_CGHDR)
+        low noise mode      TOUPCAM_OPTION_LOW_NOISE (TOUPCAM_FLAG_LOW_NOISE)
+    profile() measures each knob once against the base (the full resolution, bin mode, 1x1, no SDK binning, LCG,
+    low noise off): the frame rate from the timestamps of BINPLAN_FRAMES frames, and the SNR as the mean over the
+    temporal noise, that is the standard deviation of the difference of two frames over sqrt(2), in the center
+    BINPLAN_WINDOW x BINPLAN_WINDOW of the frame. The SDK binning is measured at 2 x 2 only: the gain of n x n is
+    taken as 2 x 2 to the power log2(n), 1 for noise which is independent from pixel to pixel, less for the rest.
+    So a profile is 1 + 2 x (resolutions - 1) + (values - 1) x methods + 3 runs of BINPLAN_FRAMES + BINPLAN_SETTLE
+    frames at most, a few seconds, and measures no combination.
+    plan() predicts every combination from the profile (the ratios of the frame rate and of the SNR to the base,
+    multiplied), with the SDK binning the largest n which keeps the size of the target; of the combinations which meet
+    it the fastest wins (within BINPLAN_TIE of the frame rate, the higher SNR), none meeting it the one of the smallest
+    shortfall (the larger of fps / target and snr / target at its worst). The prediction is then measured, and the next ones up to
+    BINPLAN_VERIFY, until one meets the target for real: a model may refuse a combination (a sensor binning at a lower
+    resolution), or two knobs may not multiply (the frame rate limited by the exposure time).
+    The scene must not change during the profile (a static field, mid grey: a saturated run, more than
+    BINPLAN_SATURATED of the full scale, counts as SNR 0, such as Add at an exposure set for 1x1). The exposure
+    time and the gain are taken as they are, the auto exposure is off meanwhile and back as it was after.
+    The camera must be stopped: profile() and plan() start and stop it (Toupcam_StartPullModeWithCallback without a
+    callback, Toupcam_WaitImageV4) and leave it stopped, plan() with the winning configuration applied.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "toupcam.h"
+
+#define BINPLAN_FRAMES      8       /* measured per run */
+#define BINPLAN_SETTLE      2       /* dropped after the start */
+#define BINPLAN_WINDOW      256     /* of the statistics, in the center */
+#define BINPLAN_VERIFY      4       /* predictions measured at most */
+#define BINPLAN_SATURATED   0.9
+#define BINPLAN_TIE         0.05    /* frame rates this close are the same, the SNR decides */
+#define BINPLAN_TIMEOUT     5000    /* ms, of one frame */
+
+typedef struct {
+    unsigned res;               /* Toupcam_put_eSize */
+    int skip;                   /* Toupcam_put_Mode, -1: not offered */
+    std::string hwValue, hwMethod;  /* Toupcam_put_Binning, empty: not offered */
+    int swBin;                  /* TOUPCAM_OPTION_BINNING, 1 or 0x80 | n */
+    int cg, lowNoise;           /* TOUPCAM_OPTION_CG, TOUPCAM_OPTION_LOW_NOISE, -1: not offered */
+    /* measured, or predicted by plan() */
+    unsigned width, height;     /* final */
+    double fps, snr, mean;      /* mean: of the frames measured, 0 ... 1 of the full scale */
+    bool measured;
+} BinConfig;
+
+typedef struct {
+    unsigned width, height;     /* final size, at least */
+    double fps;                 /* at least */
+    double snr;                 /* mean / temporal noise, at least */
+} BinTarget;
+
+class BinPlan {
+    HToupcam m_h;
+    struct Res { unsigned width, height; };
+    std::vector<Res> m_res;
+    std::vector<std::string> m_hwValue, m_hwMethod;
+    bool m_bSkip, m_bCg, m_bLowNoise;
+    BinConfig m_base;
+    std::vector<BinConfig> m_runs;      /* the base first, then one knob each */
+    std::vector<unsigned char> m_buf[2];
+
+    static unsigned hwFactor(const std::string& value)
+    {
+        const unsigned n = (unsigned)atoi(value.c_str());  /* "2x2" */
+        return n ? n : 1;
+    }
+
+    double fpsRatio(const BinConfig* p) const { return (p && (m_base.fps > 0)) ? (p->fps / m_base.fps) : 0.0; }
+    double snrRatio(const BinConfig* p) const { return (p && (m_base.snr > 0)) ? (p->snr / m_base.snr) : 0.0; }
+
+    /* the shortfall to the target, >= 1 when met */
+    static double score(const BinConfig& c, const BinTarget& t)
+    {
+        const double f = (t.fps > 0) ? (c.fps / t.fps) : 1e9, s = (t.snr > 0) ? (c.snr / t.snr) : 1e9;
+        return (f < s) ? f : s;
+    }
+    static bool better(const BinConfig& a, const BinConfig& b, const BinTarget& t)
+    {
+        const double sa = score(a, t), sb = score(b, t);
+        if ((sa >= 1) != (sb >= 1))
+            return sa >= 1;
+        if (sa < 1)
+            return sa > sb;
+        if (fabs(a.fps - b.fps) > BINPLAN_TIE * std::max(a.fps, b.fps))
+            return a.fps > b.fps;
+        return a.snr > b.snr;
+    }
+
+    HRESULT run(BinConfig& c)
+    {
+        HRESULT hr = apply(m_h, c);
+        if (FAILED(hr))
+            return hr;
+        int raw = 0, bitdepth = 0;
+        Toupcam_get_Option(m_h, TOUPCAM_OPTION_RAW, &raw);
+        Toupcam_get_Option(m_h, TOUPCAM_OPTION_BITDEPTH, &bitdepth);
+        unsigned fourcc = 0, rawBits = 8;
+        if (raw)
+            Toupcam_get_RawFormat(m_h, &fourcc, &rawBits);
+        const unsigned bpp = (raw && bitdepth && (rawBits > 8)) ? 2 : 1;
+        const double full = (2 == bpp) ? (double)((1 << rawBits) - 1) : 255.0;
+        const size_t bytes = (size_t)m_res[0].width * m_res[0].height * bpp;
+        m_buf[0].resize(bytes);
+        m_buf[1].resize(bytes);
+        if (FAILED(hr = Toupcam_StartPullModeWithCallback(m_h, NULL, NULL)))
+            return hr;
+        unsigned long long t0 = 0, t1 = 0;
+        double sumMean = 0, sumVar = 0;
+        unsigned pairs = 0;
+        for (unsigned i = 0; i < BINPLAN_SETTLE + BINPLAN_FRAMES; ++i)
+        {
+            ToupcamFrameInfoV4 info;
+            memset(&info, 0, sizeof(info));
+            unsigned char* p = &m_buf[i & 1][0];
+            if (FAILED(hr = Toupcam_WaitImageV4(m_h, BINPLAN_TIMEOUT, p, 0, 8, -1, &info)))
+                break;
+            if (i < BINPLAN_SETTLE)
+                continue;
+            c.width = info.v3.width;
+            c.height = info.v3.height;
+            if (BINPLAN_SETTLE == i)
+                t0 = info.v3.timestamp;
+            t1 = info.v3.timestamp;
+            if (i > BINPLAN_SETTLE)
+            {
+                /* the center, the same pixels of this frame and the one before */
+                const unsigned ww = std::min<unsigned>(BINPLAN_WINDOW, c.width), wh = std::min<unsigned>(BINPLAN_WINDOW, c.height);
+                const unsigned x0 = (c.width - ww) / 2 & ~1u, y0 = (c.height - wh) / 2 & ~1u;
+                const unsigned char* q = &m_buf[(i + 1) & 1][0];
+                double s = 0, d = 0, dd = 0;
+                for (unsigned y = y0; y < y0 + wh; ++y)
+                {
+                    for (unsigned x = x0; x < x0 + ww; ++x)
+                    {
+                        const size_t k = (size_t)y * c.width + x;
+                        const double a = (2 == bpp) ? ((const unsigned short*)p)[k] : p[k];
+                        const double b = (2 == bpp) ? ((const unsigned short*)q)[k] : q[k];
+                        s += a + b;
+                        d += a - b;
+                        dd += (a - b) * (a - b);
+                    }
+                }
+                const double n = (double)ww * wh;
+                sumMean += s / (2 * n);
+                sumVar += (dd / n - (d / n) * (d / n)) / 2;
+                ++pairs;
+            }
+        }
+        Toupcam_Stop(m_h);
+        if (FAILED(hr))
+            return hr;
+        c.mean = pairs ? (sumMean / pairs / full) : 0;
+        const double sigma = pairs ? sqrt(sumVar / pairs) : 0;
+        c.fps = (t1 > t0) ? ((BINPLAN_FRAMES - 1) * 1e6 / (double)(t1 - t0)) : 0;
+        c.snr = ((c.mean > BINPLAN_SATURATED) || (sigma <= 0)) ? 0 : (c.mean * full / sigma);
+        c.measured = true;
+        return 0;   /* S_OK */
+    }
+public:
+    BinPlan()
+    : m_h(NULL), m_bSkip(false), m_bCg(false), m_bLowNoise(false)
+    {
+    }
+
+    /* the camera stopped; the knobs of the model and the runs of the profile */
+    HRESULT profile(HToupcam h)
+    {
+        if (NULL == h)
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        m_h = h;
+        m_res.clear();
+        m_hwValue.clear();
+        m_hwMethod.clear();
+        m_runs.clear();
+        const unsigned long long flag = Toupcam_query_Model(h)->flag;
+        m_bSkip = (0 != (flag & TOUPCAM_FLAG_BINSKIP_SUPPORTED));
+        m_bCg = (0 != (flag & (TOUPCAM_FLAG_CG | TOUPCAM_FLAG_CGHDR)));
+        m_bLowNoise = (0 != (flag & TOUPCAM_FLAG_LOW_NOISE));
+        const HRESULT nRes = Toupcam_get_ResolutionNumber(h);
+        for (int i = 0; i < (int)nRes; ++i)
+        {
+            int w = 0, hh = 0;
+            if (SUCCEEDED(Toupcam_get_Resolution(h, i, &w, &hh)))
+            {
+                const Res r = { (unsigned)w, (unsigned)hh };
+                m_res.push_back(r);
+            }
+        }
+        if (m_res.empty())
+            return (HRESULT)0x8000ffff; /* E_UNEXPECTED */
+        /* the values and the methods as two lists, every method with every value */
+        const HRESULT nBin = Toupcam_get_BinningNumber(h);
+        for (int i = 0; i < (int)nBin; ++i)
+        {
+            const char* p = NULL;
+            if (SUCCEEDED(Toupcam_get_BinningValue(h, i, &p)) && p && (m_hwValue.end() == std::find(m_hwValue.begin(), m_hwValue.end(), p)))
+                m_hwValue.push_back(p);
+            p = NULL;
+            if (SUCCEEDED(Toupcam_get_BinningMethod(h, i, &p)) && p && (m_hwMethod.end() == std::find(m_hwMethod.begin(), m_hwMethod.end(), p)))
+                m_hwMethod.push_back(p);
+        }
+        if (m_hwMethod.empty())
+            m_hwValue.clear();
+
+        m_base.res = 0;
+        m_base.skip = m_bSkip ? 0 : -1;
+        m_base.hwValue = m_hwValue.empty() ? "" : "1x1";
+        m_base.hwMethod = m_hwValue.empty() ? "" : m_hwMethod[0];
+        m_base.swBin = 1;
+        m_base.cg = m_bCg ? 0 : -1;
+        m_base.lowNoise = m_bLowNoise ? 0 : -1;
+        m_base.width = m_res[0].width;
+        m_base.height = m_res[0].height;
+        m_base.fps = m_base.snr = m_base.mean = 0;
+        m_base.measured = false;
+
+        int ae = 0;
+        Toupcam_get_AutoExpoEnable(h, &ae);
+        if (ae)
+            Toupcam_put_AutoExpoEnable(h, 0);
+        std::vector<BinConfig> runs(1, m_base);
+        for (unsigned r = 1; r < m_res.size(); ++r)
+        {
+            for (int skip = 0; skip <= (m_bSkip ? 1 : 0); ++skip)
+            {
+                BinConfig c = m_base;
+                c.res = r;
+                c.skip = m_bSkip ? skip : -1;
+                runs.push_back(c);
+            }
+        }
+        for (size_t v = 0; v < m_hwValue.size(); ++v)
+        {
+            for (size_t m = 0; (hwFactor(m_hwValue[v]) > 1) && (m < m_hwMethod.size()); ++m)
+            {
+                BinConfig c = m_base;
+                c.hwValue = m_hwValue[v];
+                c.hwMethod = m_hwMethod[m];
+                runs.push_back(c);
+            }
+        }
+        BinConfig c = m_base;
+        c.swBin = 0x82;
+        runs.push_back(c);
+        if (m_bCg)
+        {
+            c = m_base;
+            c.cg = 1;
+            runs.push_back(c);
+        }
+        if (m_bLowNoise)
+        {
+            c = m_base;
+            c.lowNoise = 1;
+            runs.push_back(c);
+        }
+
+        HRESULT hr = 0;    /* S_OK */
+        for (size_t i = 0; i < runs.size(); ++i)
+        {
+            const HRESULT hrRun = run(runs[i]);
+            if (0 == i)
+                hr = hrRun;     /* without the base there is nothing to compare with */
+            if (SUCCEEDED(hrRun))
+                m_runs.push_back(runs[i]);
+            if (FAILED(hr))
+                break;
+        }
+        if (SUCCEEDED(hr))
+            m_base = m_runs[0];
+        if (ae)
+            Toupcam_put_AutoExpoEnable(h, ae);
+        return hr;
+    }
+
+    const std::vector<BinConfig>& runs() const { return m_runs; }
+
+    /* every combination of the knobs measured, predicted from the profile, the best for the target first */
+    std::vector<BinConfig> predict(const BinTarget& t) const
+    {
+        std::vector<BinConfig> out;
+        if (m_runs.empty() || (m_base.fps <= 0) || (m_base.snr <= 0))
+            return out;
+        /* each run but the base has one knob off the base */
+        std::vector<const BinConfig*> reads(1, &m_base), hws(1, &m_base);
+        const BinConfig *pSw = NULL, *pCg = NULL, *pLn = NULL;
+        for (size_t i = 1; i < m_runs.size(); ++i)
+        {
+            const BinConfig& r = m_runs[i];
+            if ((r.res != m_base.res) || (r.skip != m_base.skip))
+                reads.push_back(&r);
+            else if ((r.hwValue != m_base.hwValue) || (r.hwMethod != m_base.hwMethod))
+                hws.push_back(&r);
+            else if (r.swBin != m_base.swBin)
+                pSw = &r;
+            else if (r.cg != m_base.cg)
+                pCg = &r;
+            else if (r.lowNoise != m_base.lowNoise)
+                pLn = &r;
+        }
+        const double swFps = pSw ? fpsRatio(pSw) : 1.0;
+        const double swExp = (pSw && (snrRatio(pSw) > 1)) ? std::min(1.0, log(snrRatio(pSw)) / log(2.0)) : 0.0;
+        for (size_t r = 0; r < reads.size(); ++r)
+        {
+            for (size_t b = 0; b < hws.size(); ++b)
+            {
+                for (int cg = 0; cg <= (pCg ? 1 : 0); ++cg)
+                {
+                    for (int ln = 0; ln <= (pLn ? 1 : 0); ++ln)
+                    {
+                        BinConfig c = *reads[r];
+                        c.hwValue = hws[b]->hwValue;
+                        c.hwMethod = hws[b]->hwMethod;
+                        c.cg = cg ? 1 : m_base.cg;
+                        c.lowNoise = ln ? 1 : m_base.lowNoise;
+                        c.measured = false;
+                        const unsigned n = hwFactor(c.hwValue);
+                        const unsigned w = m_res[c.res].width / n, h = m_res[c.res].height / n;
+                        if ((w < t.width) || (h < t.height))
+                            continue;
+                        unsigned s = 1;     /* of the SDK: the largest which keeps the size */
+                        while ((s < 8) && (w / (s + 1) >= t.width) && (h / (s + 1) >= t.height))
+                            ++s;
+                        c.swBin = (s > 1) ? (int)(0x80 | s) : 1;
+                        c.width = (w / s) & ~1u;
+                        c.height = (h / s) & ~1u;
+                        c.fps = m_base.fps * (r ? fpsRatio(reads[r]) : 1) * (b ? fpsRatio(hws[b]) : 1)
+                              * (cg ? fpsRatio(pCg) : 1) * (ln ? fpsRatio(pLn) : 1) * ((s > 1) ? swFps : 1);
+                        c.snr = m_base.snr * (r ? snrRatio(reads[r]) : 1) * (b ? snrRatio(hws[b]) : 1)
+                              * (cg ? snrRatio(pCg) : 1) * (ln ? snrRatio(pLn) : 1) * pow((double)s, swExp);
+                        c.mean = b ? hws[b]->mean : reads[r]->mean;
+                        out.push_back(c);
+                    }
+                }
+            }
+        }
+        std::stable_sort(out.begin(), out.end(), [&t](const BinConfig& a, const BinConfig& b) { return better(a, b, t); });
+        return out;
+    }
+
+    /*
+        after profile(): the best configuration for the target, measured, applied to the camera (stopped);
+        S_OK: it meets the target, S_FALSE: the nearest there is, E_UNEXPECTED: no profile or nothing of the size
+    */
+    HRESULT plan(const BinTarget& t, BinConfig* pBest)
+    {
+        const std::vector<BinConfig> cand = predict(t);
+        if (cand.empty())
+            return (HRESULT)0x8000ffff; /* E_UNEXPECTED */
+        int ae = 0;
+        Toupcam_get_AutoExpoEnable(m_h, &ae);
+        if (ae)
+            Toupcam_put_AutoExpoEnable(m_h, 0);
+        bool bFound = false;
+        BinConfig best = cand[0];
+        for (size_t i = 0; (i < cand.size()) && (i < BINPLAN_VERIFY); ++i)
+        {
+            BinConfig c = cand[i];
+            if (FAILED(run(c)))
+                continue;               /* refused by the model */
+            if ((!bFound) || better(c, best, t))
+                best = c;
+            bFound = true;
+            if (score(c, t) >= 1)
+                break;
+        }
+        if (ae)
+            Toupcam_put_AutoExpoEnable(m_h, ae);
+        if (!bFound)
+            return (HRESULT)0x8000ffff; /* E_UNEXPECTED */
+        *pBest = best;
+        const HRESULT hr = apply(m_h, best);
+        if (FAILED(hr))
+            return hr;
+        return (score(best, t) >= 1) ? 0 : 1;   /* S_OK, S_FALSE */
+    }
+
+    /* the camera stopped; the knobs not offered (-1, empty) are left as they are */
+    static HRESULT apply(HToupcam h, const BinConfig& c)
+    {
+        HRESULT hr = Toupcam_put_eSize(h, c.res);
+        if (SUCCEEDED(hr) && (c.skip >= 0))
+            hr = Toupcam_put_Mode(h, c.skip);
+        if (SUCCEEDED(hr) && !c.hwValue.empty())
+            hr = Toupcam_put_Binning(h, c.hwValue.c_str(), c.hwMethod.c_str());
+        if (SUCCEEDED(hr))
+            hr = Toupcam_put_Option(h, TOUPCAM_OPTION_BINNING, c.swBin);
+        if (SUCCEEDED(hr) && (c.cg >= 0))
+            hr = Toupcam_put_Option(h, TOUPCAM_OPTION_CG, c.cg);
+        if (SUCCEEDED(hr) && (c.lowNoise >= 0))
+            hr = Toupcam_put_Option(h, TOUPCAM_OPTION_LOW_NOISE, c.lowNoise);
+        return hr;
+    }
+
+    /* such as "res 1 skip, 2x2 Average, sdk 2x2, HCG, low noise" */
+    static std::string name(const BinConfig& c)
+    {
+        char str[160];
+        snprintf(str, sizeof(str), "res %u%s", c.res, (c.skip > 0) ? " skip" : ((0 == c.skip) ? " bin" : ""));
+        std::string s = str;
+        if (!c.hwValue.empty() && (hwFactor(c.hwValue) > 1))
+            s += ", " + c.hwValue + " " + c.hwMethod;
+        if (c.swBin & 0x0e)
+        {
+            snprintf(str, sizeof(str), ", sdk %ux%u", c.swBin & 0x0f, c.swBin & 0x0f);
+            s += str;
+        }
+        if (c.cg > 0)
+            s += ", HCG";
+        if (c.lowNoise > 0)
+            s += ", low noise";
+        return s;
+    }
+};
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef __calibset_H__
+#define __calibset_H__
+
+/*
+    Calibration sets per objective: white balance (RGB gains or temperature / tint, whichever mode the camera is in),
+    initial white balance gains, color matrix and flat field, kept by name so that a change of objective is one
+    activate() instead of a Toupcam_AwbOnce and a Toupcam_FfcOnce which take several frames to converge each.
+    capture() reads the white balance of the camera as it is (after an AwbOnce done once for that objective) and
+    exports its flat field (Toupcam_FfcExport) to a file, which activate() imports again (Toupcam_FfcImport); the
+    color matrix and the initial gains have no getter, they are set in the CalibSet by the caller. activate():
+        - sends only the parts which differ from the set active before (the camera keeps the rest),
+        - reverts a part the new set does not have to the model default (put_ColorMatrix / put_InitWBGain NULL,
+          TOUPCAM_OPTION_FFC 0) when the old set had it,
+        - on a failure puts the old set back, so the camera is left with one set, not a mix of two.
+    The sets are plain structs: save() / load() keep them in a file, saveEeprom() / loadEeprom() in the EEPROM of the
+    camera at the application's address (TOUPCAM_OPTION_EEPROM_SIZE), both as CalibSetHeader then the CalibSet array.
+    The flat field file itself stays on the host.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include "toupcam.h"
+
+#define CALIBSET_WBGAIN     0x01    /* wbGain, Toupcam_put_WhiteBalanceGain */
+#define CALIBSET_TEMPTINT   0x02    /* temp, tint, Toupcam_put_TempTint */
+#define CALIBSET_INITWB     0x04    /* initWB, Toupcam_put_InitWBGain */
+#define CALIBSET_MATRIX     0x08    /* matrix, Toupcam_put_ColorMatrix */
+#define CALIBSET_FFC        0x10    /* ffcFile, Toupcam_FfcImport */
+
+#define CALIBSET_NAME       32
+#define CALIBSET_PATH       160
+#define CALIBSET_MAGIC      "TCALSET1"
+
+typedef struct {
+    char name[CALIBSET_NAME];
+    unsigned flags;                 /* CALIBSET_xxx: the parts the set has */
+    int wbGain[3];
+    int temp, tint;
+    unsigned short initWB[3];
+    double matrix[9];
+    char ffcFile[CALIBSET_PATH];
+} CalibSet;
+
+typedef struct {
+    char magic[8];
+    unsigned count;
+    unsigned size;                  /* sizeof(CalibSet) */
+} CalibSetHeader;
+
+class CalibCache {
+    std::vector<CalibSet> m_sets;
+    int m_active;                   /* index in m_sets, -1: unknown */
+
+#if defined(_WIN32)
+    static HRESULT ffc(HToupcam h, const char* path, bool bImport)
+    {
+        wchar_t wpath[CALIBSET_PATH];
+        mbstowcs(wpath, path, CALIBSET_PATH);
+        wpath[CALIBSET_PATH - 1] = 0;
+        return bImport ? Toupcam_FfcImport(h, wpath) : Toupcam_FfcExport(h, wpath);
+    }
+#else
+    static HRESULT ffc(HToupcam h, const char* path, bool bImport)
+    {
+        return bImport ? Toupcam_FfcImport(h, path) : Toupcam_FfcExport(h, path);
+    }
+#endif
+
+    /* the parts of s which differ from prev (all of them with no prev); pSent: how many calls */
+    static HRESULT apply(HToupcam h, const CalibSet& s, const CalibSet* prev, unsigned* pSent)
+    {
+        const unsigned pf = prev ? prev->flags : 0;
+        unsigned sent = 0;
+        HRESULT hr = 0;
+        if ((s.flags & CALIBSET_INITWB) && ((!(pf & CALIBSET_INITWB)) || memcmp(s.initWB, prev->initWB, sizeof(s.initWB))))
+        {
+            unsigned short v[3] = { s.initWB[0], s.initWB[1], s.initWB[2] };
+            hr = Toupcam_put_InitWBGain(h, v);
+            ++sent;
+        }
+        else if ((pf & CALIBSET_INITWB) && (!(s.flags & CALIBSET_INITWB)))
+        {
+            hr = Toupcam_put_InitWBGain(h, NULL);
+            ++sent;
+        }
+        if (SUCCEEDED(hr) && (s.flags & CALIBSET_WBGAIN) && ((!(pf & CALIBSET_WBGAIN)) || memcmp(s.wbGain, prev->wbGain, sizeof(s.wbGain))))
+        {
+            int v[3] = { s.wbGain[0], s.wbGain[1], s.wbGain[2] };
+            hr = Toupcam_put_WhiteBalanceGain(h, v);
+            ++sent;
+        }
+        if (SUCCEEDED(hr) && (s.flags & CALIBSET_TEMPTINT) && ((!(pf & CALIBSET_TEMPTINT)) || (s.temp != prev->temp) || (s.tint != prev->tint)))
+        {
+            hr = Toupcam_put_TempTint(h, s.temp, s.tint);
+            ++sent;
+        }
+        if (SUCCEEDED(hr) && (s.flags & CALIBSET_MATRIX) && ((!(pf & CALIBSET_MATRIX)) || memcmp(s.matrix, prev->matrix, sizeof(s.matrix))))
+        {
+            hr = Toupcam_put_ColorMatrix(h, s.matrix);
+            ++sent;
+        }
+        else if (SUCCEEDED(hr) && (pf & CALIBSET_MATRIX) && (!(s.flags & CALIBSET_MATRIX)))
+        {
+            hr = Toupcam_put_ColorMatrix(h, NULL);
+            ++sent;
+        }
+        if (SUCCEEDED(hr) && (s.flags & CALIBSET_FFC) && ((!(pf & CALIBSET_FFC)) || strcmp(s.ffcFile, prev->ffcFile)))
+        {
+            hr = ffc(h, s.ffcFile, true);
+            if (SUCCEEDED(hr))
+                hr = Toupcam_put_Option(h, TOUPCAM_OPTION_FFC, 1);
+            sent += 2;
+        }
+        else if (SUCCEEDED(hr) && (pf & CALIBSET_FFC) && (!(s.flags & CALIBSET_FFC)))
+        {
+            hr = Toupcam_put_Option(h, TOUPCAM_OPTION_FFC, 0);
+            ++sent;
+        }
+        if (pSent)
+            *pSent = sent;
+        return hr;
+    }
+
+    bool parse(const unsigned char* p, size_t length)
+    {
+        CalibSetHeader header;
+        if (length < sizeof(header))
+            return false;
+        memcpy(&header, p, sizeof(header));
+        if ((0 != memcmp(header.magic, CALIBSET_MAGIC, sizeof(header.magic))) || (header.size != sizeof(CalibSet)) || (sizeof(header) + (size_t)header.count * sizeof(CalibSet) > length))
+            return false;
+        m_sets.resize(header.count);
+        if (header.count)
+            memcpy(&m_sets[0], p + sizeof(header), header.count * sizeof(CalibSet));
+        m_active = -1;
+        return true;
+    }
+
+    std::vector<unsigned char> serialize() const
+    {
+        CalibSetHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CALIBSET_MAGIC, sizeof(header.magic));
+        header.count = (unsigned)m_sets.size();
+        header.size = sizeof(CalibSet);
+        std::vector<unsigned char> blob(sizeof(header) + m_sets.size() * sizeof(CalibSet));
+        memcpy(&blob[0], &header, sizeof(header));
+        if (!m_sets.empty())
+            memcpy(&blob[sizeof(header)], &m_sets[0], m_sets.size() * sizeof(CalibSet));
+        return blob;
+    }
+public:
+    CalibCache()
+    : m_active(-1)
+    {
+    }
+
+    size_t size() const { return m_sets.size(); }
+    const CalibSet& set(size_t i) const { return m_sets[i]; }
+
+    CalibSet* find(const char* name)
+    {
+        for (size_t i = 0; i < m_sets.size(); ++i)
+        {
+            if (0 == strncmp(m_sets[i].name, name, CALIBSET_NAME))
+                return &m_sets[i];
+        }
+        return NULL;
+    }
+
+    /* add s, or replace the set of the same name */
+    void put(const CalibSet& s)
+    {
+        CalibSet* p = find(s.name);
+        if (p)
+        {
+            if ((m_active >= 0) && (p == &m_sets[m_active]))
+                m_active = -1;  /* what is on the camera is no longer what the set says */
+            *p = s;
+        }
+        else
+            m_sets.push_back(s);
+    }
+
+    /*
+        the white balance of the camera, and its flat field exported to ffcFile (NULL: none), as the set name;
+        the color matrix and the initial gains of a set of the same name are kept
+    */
+    HRESULT capture(HToupcam h, const char* name, const char* ffcFile)
+    {
+        CalibSet s;
+        memset(&s, 0, sizeof(s));
+        const CalibSet* old = find(name);
+        if (old)
+            s = *old;
+        strncpy(s.name, name, CALIBSET_NAME - 1);
+        s.flags &= CALIBSET_INITWB | CALIBSET_MATRIX;
+        if (0 == (Toupcam_query_Model(h)->flag & TOUPCAM_FLAG_MONO))
+        {
+            if (SUCCEEDED(Toupcam_get_WhiteBalanceGain(h, s.wbGain)))
+                s.flags |= CALIBSET_WBGAIN;
+            else if (SUCCEEDED(Toupcam_get_TempTint(h, &s.temp, &s.tint)))
+                s.flags |= CALIBSET_TEMPTINT;
+        }
+        if (ffcFile)
+        {
+            const HRESULT hr = ffc(h, ffcFile, false);
+            if (FAILED(hr))
+                return hr;
+            strncpy(s.ffcFile, ffcFile, CALIBSET_PATH - 1);
+            s.flags |= CALIBSET_FFC;
+        }
+        put(s);
+        return 0;
+    }
+
+    /* the set name on the camera; pSent: the number of calls it took, 0 when it was already active */
+    HRESULT activate(HToupcam h, const char* name, unsigned* pSent = NULL)
+    {
+        const CalibSet* s = find(name);
+        if (NULL == s)
+            return (HRESULT)0x80070057;
+        const CalibSet* prev = (m_active >= 0) ? &m_sets[m_active] : NULL;
+        const HRESULT hr = apply(h, *s, prev, pSent);
+        if (SUCCEEDED(hr))
+            m_active = (int)(s - &m_sets[0]);
+        else if (prev)
+            apply(h, *prev, s, NULL);   /* back to the old set, what may have changed */
+        else
+            m_active = -1;
+        return hr;
+    }
+
+    const char* active() const { return (m_active >= 0) ? m_sets[m_active].name : NULL; }
+
+    /* the camera was set behind the back of the cache (AwbOnce, Toupcam_Open): the next activate() sends everything */
+    void invalidate() { m_active = -1; }
+
+    bool save(const char* filename) const
+    {
+        FILE* fp = fopen(filename, "wb");
+        if (NULL == fp)
+            return false;
+        const std::vector<unsigned char> blob = serialize();
+        const bool ret = (fwrite(&blob[0], 1, blob.size(), fp) == blob.size());
+        fclose(fp);
+        return ret;
+    }
+
+    bool load(const char* filename)
+    {
+        FILE* fp = fopen(filename, "rb");
+        if (NULL == fp)
+            return false;
+        std::vector<unsigned char> blob;
+        unsigned char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            blob.insert(blob.end(), buf, buf + n);
+        fclose(fp);
+        return (!blob.empty()) && parse(&blob[0], blob.size());
+    }
+
+    HRESULT saveEeprom(HToupcam h, unsigned addr) const
+    {
+        int size = 0;
+        HRESULT hr = Toupcam_get_Option(h, TOUPCAM_OPTION_EEPROM_SIZE, &size);
+        if (FAILED(hr))
+            return hr;
+        const std::vector<unsigned char> blob = serialize();
+        if ((unsigned long long)addr + blob.size() > (unsigned)size)
+            return (HRESULT)0x80070057;
+        hr = Toupcam_write_EEPROM(h, addr, &blob[0], (unsigned)blob.size());
+        if (SUCCEEDED(hr) && ((unsigned)hr != blob.size()))
+            hr = (HRESULT)0x80004005;
+        return FAILED(hr) ? hr : 0;
+    }
+
+    HRESULT loadEeprom(HToupcam h, unsigned addr)
+    {
+        CalibSetHeader header;
+        HRESULT hr = Toupcam_read_EEPROM(h, addr, (unsigned char*)&header, sizeof(header));
+        if (FAILED(hr))
+            return hr;
+        if (((unsigned)hr != sizeof(header)) || (0 != memcmp(header.magic, CALIBSET_MAGIC, sizeof(header.magic))) || (header.size != sizeof(CalibSet)))
+            return (HRESULT)0x80004005;    /* nothing there */
+        std::vector<unsigned char> blob(sizeof(header) + (size_t)header.count * sizeof(CalibSet));
+        hr = Toupcam_read_EEPROM(h, addr, &blob[0], (unsigned)blob.size());
+        if (FAILED(hr))
+            return hr;
+        if (((unsigned)hr != blob.size()) || (!parse(&blob[0], blob.size())))
+            return (HRESULT)0x80004005;
+        return 0;
+    }
+};
+
+#endif
@@ -0,0 +1,391 @@
+#ifndef __camblob_H__
+#define __camblob_H__
+
+/*
+    Bulk transfer of a blob (a dark library, flat fields, calibration sets: megabytes) to and from the flash
+    (Toupcam_rwc_Flash) or the EEPROM (Toupcam_read_EEPROM / Toupcam_write_EEPROM) of the camera, synchronous or on a
+    thread of its own with a progress callback, so that the UI is not blocked while a calibration is stored or restored.
+    On the camera the blob is CamBlobHeader (magic, length, CRC-32 of the data, tag of the caller), then the data,
+    padded to the read / write block. The first chunk, with the header, is written last, and read() checks the CRC:
+    a blob torn by a write which did not complete (unplugged, cancelled) is an error rather than a calibration of
+    garbage.
+    The control channel takes one call at a time and the calls do not return before the transfer is done, so the
+    transfer is a sequence of calls as large as the camera takes (CAMBLOB_CHUNK, rounded down to the read / write block
+    of the flash; CAMBLOB_EEPROM_CHUNK for the EEPROM) rather than the small ones of a dialog: the cost per call is
+    paid every CAMBLOB_CHUNK bytes, the CRC is updated with every chunk as it arrives or leaves, still in the cache,
+    instead of a pass of its own, and a flash write is one erase of the whole range, then the chunks, the status
+    polled every CAMBLOB_POLL_MS between them.
+    Flash: addr a multiple of the erase block (TOUPCAM_FLASH_EBLOCK); EEPROM: any addr, TOUPCAM_OPTION_EEPROM_SIZE.
+    Async: both callbacks are called on the thread of the transfer, done() once at the end, with the result; data()
+    and tag() of a read are valid from done() on. cancel() stops at the next chunk (E_ABORT); wait() joins the thread.
+    One transfer at a time per CamBlob (E_PENDING while busy).
+*/
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+
+#define CAMBLOB_EEPROM          0
+#define CAMBLOB_FLASH           1
+
+#define CAMBLOB_MAGIC           "TCAMBLB1"
+#define CAMBLOB_CHUNK           (256 * 1024)    /* bytes per call of the flash at most */
+#define CAMBLOB_EEPROM_CHUNK    4096            /* bytes per call of the EEPROM */
+#define CAMBLOB_FLASHWAIT       10000           /* ms, for an erase or a write of the flash */
+#define CAMBLOB_POLL_MS         1
+
+typedef struct {
+    char magic[8];
+    unsigned length;            /* bytes of data after the header */
+    unsigned crc;               /* CRC-32 (IEEE 802.3, as zlib) of the data */
+    unsigned tag;               /* the caller's: the kind and the version of the data */
+    unsigned size;              /* sizeof(CamBlobHeader) */
+} CamBlobHeader;
+
+/* done, total: bytes of the blob on the camera (header and padding included) */
+typedef void (*CAMBLOB_PROGRESS)(void* ctx, unsigned long long done, unsigned long long total);
+typedef void (*CAMBLOB_DONE)(void* ctx, HRESULT hr);
+
+static inline unsigned CamBlobCrc32(unsigned crc, const void* data, size_t len)
+{
+    struct Table {
+        unsigned v[256];
+        Table()
+        {
+            for (unsigned i = 0; i < 256; ++i)
+            {
+                unsigned c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+                v[i] = c;
+            }
+        }
+    };
+    static const Table t;
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+        crc = t.v[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+class CamBlob {
+    struct Geometry {
+        unsigned long long total;   /* bytes of the flash / EEPROM */
+        unsigned eBlock, rwBlock, chunk;
+    };
+
+    HToupcam m_hcam;
+    int m_target;
+    unsigned m_addr;
+    bool m_bWrite;
+    std::vector<unsigned char> m_data;
+    unsigned m_tag;
+    CAMBLOB_PROGRESS m_cbProgress;
+    CAMBLOB_DONE m_cbDone;
+    void* m_ctx;
+    std::thread m_thread;
+    std::atomic<bool> m_bBusy, m_bCancel;
+    HRESULT m_hr;
+
+    static unsigned long long roundup(unsigned long long n, unsigned align)
+    {
+        return (n + align - 1) / align * align;
+    }
+
+    HRESULT geometry(Geometry* pGeo) const
+    {
+        if (CAMBLOB_FLASH == m_target)
+        {
+            const HRESULT total = Toupcam_rwc_Flash(m_hcam, TOUPCAM_FLASH_SIZE, 0, 0, NULL), eBlock = Toupcam_rwc_Flash(m_hcam, TOUPCAM_FLASH_EBLOCK, 0, 0, NULL);
+            const HRESULT rwBlock = Toupcam_rwc_Flash(m_hcam, TOUPCAM_FLASH_RWBLOCK, 0, 0, NULL);
+            if (FAILED(total) || FAILED(eBlock) || FAILED(rwBlock))
+                return FAILED(total) ? total : (FAILED(eBlock) ? eBlock : rwBlock);
+            if ((total <= 0) || (eBlock <= 0) || (rwBlock <= 0))
+                return (HRESULT)0x80004001; /* E_NOTIMPL */
+            pGeo->total = (unsigned)total;
+            pGeo->eBlock = (unsigned)eBlock;
+            pGeo->rwBlock = (unsigned)rwBlock;
+            pGeo->chunk = (CAMBLOB_CHUNK > rwBlock) ? (CAMBLOB_CHUNK / rwBlock * rwBlock) : rwBlock;
+            if (pGeo->chunk < sizeof(CamBlobHeader))
+                pGeo->chunk = (unsigned)roundup(sizeof(CamBlobHeader), (unsigned)rwBlock);  /* the header in one chunk */
+        }
+        else
+        {
+            int size = 0;
+            const HRESULT hr = Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_EEPROM_SIZE, &size);
+            if (FAILED(hr))
+                return hr;
+            if (size <= 0)
+                return (HRESULT)0x80004001; /* E_NOTIMPL */
+            pGeo->total = (unsigned)size;
+            pGeo->eBlock = pGeo->rwBlock = 1;
+            pGeo->chunk = CAMBLOB_EEPROM_CHUNK;
+        }
+        return 0;
+    }
+
+    HRESULT flashWait() const
+    {
+        for (int t = 0; t < CAMBLOB_FLASHWAIT; t += CAMBLOB_POLL_MS)
+        {
+            const HRESULT hr = Toupcam_rwc_Flash(m_hcam, TOUPCAM_FLASH_STATUS, 0, 0, NULL);
+            if (FAILED(hr) || (0 == hr))
+                return hr;
+            std::this_thread::sleep_for(std::chrono::milliseconds(CAMBLOB_POLL_MS));
+        }
+        return (HRESULT)0x80004005; /* E_FAIL */
+    }
+
+    /* one call: len bytes at addr, exactly */
+    HRESULT io(bool bWrite, unsigned addr, unsigned char* p, unsigned len) const
+    {
+        HRESULT hr;
+        if (CAMBLOB_FLASH == m_target)
+        {
+            hr = Toupcam_rwc_Flash(m_hcam, bWrite ? TOUPCAM_FLASH_WRITE : TOUPCAM_FLASH_READ, addr, len, p);
+            if (SUCCEEDED(hr) && bWrite)
+                return flashWait();
+        }
+        else if (bWrite)
+            hr = Toupcam_write_EEPROM(m_hcam, addr, p, len);
+        else
+            hr = Toupcam_read_EEPROM(m_hcam, addr, p, len);
+        if (FAILED(hr))
+            return hr;
+        return ((unsigned)hr == len) ? 0 : (HRESULT)0x80004005; /* E_FAIL */
+    }
+
+    void progress(unsigned long long done, unsigned long long total) const
+    {
+        if (m_cbProgress)
+            m_cbProgress(m_ctx, done, total);
+    }
+
+    /* bytes [off, off + len) of the blob of a write, header left 0, into p; returns the bytes of data, at p */
+    size_t assemble(unsigned long long off, unsigned char* p, size_t len) const
+    {
+        memset(p, 0, len);
+        const unsigned long long hsize = sizeof(CamBlobHeader);
+        const unsigned long long d0 = (off > hsize) ? (off - hsize) : 0, skip = (off > hsize) ? 0 : (hsize - off);
+        if ((skip >= len) || (d0 >= m_data.size()))
+            return 0;
+        const size_t n = (size_t)((m_data.size() - d0 < len - skip) ? (m_data.size() - d0) : (len - skip));
+        memcpy(p + skip, &m_data[(size_t)d0], n);
+        return n;
+    }
+
+    HRESULT doWrite()
+    {
+        Geometry geo;
+        HRESULT hr = geometry(&geo);
+        if (FAILED(hr))
+            return hr;
+        CamBlobHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CAMBLOB_MAGIC, sizeof(header.magic));
+        header.length = (unsigned)m_data.size();
+        header.tag = m_tag;
+        header.size = sizeof(header);
+        const unsigned long long total = roundup(sizeof(header) + m_data.size(), geo.rwBlock);
+        const unsigned long long erase = roundup(total, geo.eBlock);
+        if ((m_addr % geo.eBlock) || (m_addr + erase > geo.total))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        if (CAMBLOB_FLASH == m_target)
+        {
+            hr = Toupcam_rwc_Flash(m_hcam, TOUPCAM_FLASH_ERASE, m_addr, (unsigned)erase, NULL);
+            if (SUCCEEDED(hr))
+                hr = flashWait();
+            if (FAILED(hr))
+                return hr;
+        }
+        /*
+            the blob as on the camera, header, data, zeros, assembled a chunk at a time; the CRC is known only at the
+            end, so the first chunk, with the header, is written last
+        */
+        std::vector<unsigned char> head((size_t)((geo.chunk < total) ? geo.chunk : total)), buf(head.size());
+        unsigned crc = CamBlobCrc32(0, head.data() + sizeof(header), assemble(0, &head[0], head.size()));
+        unsigned long long done = 0;
+        for (unsigned long long off = head.size(); off < total; off += buf.size())
+        {
+            if (m_bCancel)
+                return (HRESULT)0x80004004; /* E_ABORT */
+            const size_t len = (size_t)((total - off < buf.size()) ? (total - off) : buf.size());
+            crc = CamBlobCrc32(crc, &buf[0], assemble(off, &buf[0], len));
+            hr = io(true, m_addr + (unsigned)off, &buf[0], (unsigned)len);
+            if (FAILED(hr))
+                return hr;
+            progress(done += len, total);
+        }
+        if (m_bCancel)
+            return (HRESULT)0x80004004; /* E_ABORT */
+        header.crc = crc;
+        memcpy(&head[0], &header, sizeof(header));
+        hr = io(true, m_addr, &head[0], (unsigned)head.size());
+        if (SUCCEEDED(hr))
+            progress(total, total);
+        return hr;
+    }
+
+    HRESULT doRead()
+    {
+        Geometry geo;
+        HRESULT hr = geometry(&geo);
+        if (FAILED(hr))
+            return hr;
+        m_data.clear();
+        m_tag = 0;
+        const unsigned first = (unsigned)roundup(sizeof(CamBlobHeader), geo.rwBlock);
+        if (m_addr + (unsigned long long)first > geo.total)
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        std::vector<unsigned char> buf(first);
+        hr = io(false, m_addr, &buf[0], first);
+        if (FAILED(hr))
+            return hr;
+        CamBlobHeader header;
+        memcpy(&header, &buf[0], sizeof(header));
+        if ((0 != memcmp(header.magic, CAMBLOB_MAGIC, sizeof(header.magic))) || (sizeof(header) != header.size))
+            return (HRESULT)0x80004005; /* E_FAIL: nothing there */
+        const unsigned long long total = roundup(sizeof(header) + (unsigned long long)header.length, geo.rwBlock);
+        if (m_addr + total > geo.total)
+            return (HRESULT)0x80004005; /* E_FAIL: not a blob of ours */
+        m_data.resize(header.length);
+        /* the data in the first read, then the rest a chunk at a time */
+        const size_t head = ((first - sizeof(header)) < header.length) ? (first - sizeof(header)) : header.length;
+        if (head)
+            memcpy(&m_data[0], &buf[sizeof(header)], head);
+        unsigned crc = CamBlobCrc32(0, buf.data() + sizeof(header), head);
+        progress(first, total);
+        buf.resize((size_t)((geo.chunk < total) ? geo.chunk : total));
+        for (unsigned long long off = first; off < total; off += buf.size())
+        {
+            if (m_bCancel)
+                return (HRESULT)0x80004004; /* E_ABORT */
+            const size_t len = (size_t)((total - off < buf.size()) ? (total - off) : buf.size());
+            hr = io(false, m_addr + (unsigned)off, &buf[0], (unsigned)len);
+            if (FAILED(hr))
+                return hr;
+            const unsigned long long d0 = off - sizeof(header);
+            const size_t n = (d0 >= header.length) ? 0 : (size_t)((header.length - d0 < len) ? (header.length - d0) : len);
+            if (n)
+            {
+                memcpy(&m_data[(size_t)d0], &buf[0], n);
+                crc = CamBlobCrc32(crc, &buf[0], n);
+            }
+            progress(off + len, total);
+        }
+        if (crc != header.crc)
+        {
+            m_data.clear();
+            return (HRESULT)0x80070017; /* HRESULT_FROM_WIN32(ERROR_CRC) */
+        }
+        m_tag = header.tag;
+        return 0;
+    }
+
+    HRESULT start(HToupcam h, int target, unsigned addr, bool bWrite, CAMBLOB_PROGRESS funProgress, CAMBLOB_DONE funDone, void* ctx, bool bAsync)
+    {
+        if ((NULL == h) || ((CAMBLOB_FLASH != target) && (CAMBLOB_EEPROM != target)))
+        {
+            m_bBusy = false;
+            return (NULL == h) ? (HRESULT)0x80004003 : (HRESULT)0x80070057; /* E_POINTER, E_INVALIDARG */
+        }
+        m_hcam = h;
+        m_target = target;
+        m_addr = addr;
+        m_bWrite = bWrite;
+        m_cbProgress = funProgress;
+        m_cbDone = funDone;
+        m_ctx = ctx;
+        m_bCancel = false;
+        if (!bAsync)
+        {
+            m_hr = bWrite ? doWrite() : doRead();
+            m_bBusy = false;
+            return m_hr;
+        }
+        m_thread = std::thread([this]() {
+            m_hr = m_bWrite ? doWrite() : doRead();
+            if (m_cbDone)
+                m_cbDone(m_ctx, m_hr);
+            m_bBusy = false;
+        });
+        return 0;
+    }
+
+    /* false: a transfer is running; otherwise the one before is joined and this one is marked busy */
+    bool acquire()
+    {
+        bool expected = false;
+        if (!m_bBusy.compare_exchange_strong(expected, true))
+            return false;
+        if (m_thread.joinable())
+            m_thread.join();
+        return true;
+    }
+public:
+    CamBlob()
+    : m_hcam(NULL), m_target(CAMBLOB_FLASH), m_addr(0), m_bWrite(false), m_tag(0), m_cbProgress(NULL), m_cbDone(NULL), m_ctx(NULL)
+    , m_bBusy(false), m_bCancel(false), m_hr(0)
+    {
+    }
+    ~CamBlob()
+    {
+        cancel();
+        wait();
+    }
+
+    /* synchronous, on the caller's thread; funProgress: after every chunk */
+    HRESULT write(HToupcam h, int target, unsigned addr, const void* data, unsigned length, unsigned tag = 0, CAMBLOB_PROGRESS funProgress = NULL, void* ctx = NULL)
+    {
+        if (!acquire())
+            return (HRESULT)0x8000000a; /* E_PENDING */
+        m_data.assign((const unsigned char*)data, (const unsigned char*)data + length);
+        m_tag = tag;
+        return start(h, target, addr, true, funProgress, NULL, ctx, false);
+    }
+
+    /* synchronous; data(), tag() */
+    HRESULT read(HToupcam h, int target, unsigned addr, CAMBLOB_PROGRESS funProgress = NULL, void* ctx = NULL)
+    {
+        if (!acquire())
+            return (HRESULT)0x8000000a; /* E_PENDING */
+        return start(h, target, addr, false, funProgress, NULL, ctx, false);
+    }
+
+    /* the data are copied, the caller's buffer is free on return */
+    HRESULT writeAsync(HToupcam h, int target, unsigned addr, const void* data, unsigned length, unsigned tag, CAMBLOB_PROGRESS funProgress, CAMBLOB_DONE funDone, void* ctx)
+    {
+        if (!acquire())
+            return (HRESULT)0x8000000a; /* E_PENDING */
+        m_data.assign((const unsigned char*)data, (const unsigned char*)data + length);
+        m_tag = tag;
+        return start(h, target, addr, true, funProgress, funDone, ctx, true);
+    }
+
+    HRESULT readAsync(HToupcam h, int target, unsigned addr, CAMBLOB_PROGRESS funProgress, CAMBLOB_DONE funDone, void* ctx)
+    {
+        if (!acquire())
+            return (HRESULT)0x8000000a; /* E_PENDING */
+        return start(h, target, addr, false, funProgress, funDone, ctx, true);
+    }
+
+    bool busy() const { return m_bBusy; }
+    void cancel() { m_bCancel = true; }
+
+    /* joins the async transfer, returns its result; not from the callbacks */
+    HRESULT wait()
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+        return m_hr;
+    }
+
+    /* of the last read, once done */
+    const std::vector<unsigned char>& data() const { return m_data; }
+    unsigned tag() const { return m_tag; }
+};
+
+#endif
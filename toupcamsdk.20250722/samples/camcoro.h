@@ -0,0 +1,507 @@
+#ifndef __camcoro_H__
+#define __camcoro_H__
+
+/*
+    C++20 coroutines over the C API: a pipeline written as straight code, co_await cam.next_frame() in a loop,
+    instead of an event callback, a static trampoline and a hand-made hand-off (PostMessage, a queue and a condition)
+    for every program.
+    Camera owns the handle (RAII, movable, Toupcam_Close in the destructor). start() takes an executor, any object with
+    void post(std::coroutine_handle<> h) which resumes h on a thread of its own choosing (CamLoop below is the plain
+    run loop of one thread; a UI posts the handle to its message loop, a pool to its queue), allocates the frame slots
+    and starts pull mode with callback, the only trampoline, here.
+        co_await cam.next_frame()   the oldest frame not pulled yet, at once if there is one (TOUPCAM_EVENT_IMAGE came
+                                    already), else resumed on the executor when it comes; every frame, in order
+        co_await cam.trigger_sync() Toupcam_Trigger(h, 1) and the frame of that trigger, as Toupcam_TriggerSyncV4 without
+                                    blocking a thread; frames pulled before it are dropped
+    Both give a CamFrame: hr(), and on success a lease of a slot, data() / stride() / info(), read in place, until
+    the CamFrame is destroyed (or release()), which gives the slot back; no copy, no heap allocation per frame (the
+    coroutine frame of the pipeline is allocated once, when it is called). With all the slots leased the await
+    completes at once with E_OUTOFMEMORY, the frame staying in the SDK: slots = the frames the pipeline holds at once + 1.
+    The event callback thread only pulls and posts; the pipeline runs on the executor. One await at a time per camera
+    (E_PENDING for a second one, as Toupcam_TriggerSyncV4). An await in progress completes with the error of
+    TOUPCAM_EVENT_TRIGGERFAIL (E_FAIL), TOUPCAM_EVENT_ERROR (E_FAIL), TOUPCAM_EVENT_DISCONNECTED (E_GEN_FAILURE),
+    TOUPCAM_EVENT_NOFRAMETIMEOUT / NOPACKETTIMEOUT (E_TIMEOUT), or of stop() (E_ABORT, as the destructor does).
+    The slots hold the largest frame of the model (resolution 0, either orientation) at bits, on the default row pitch
+    (TDIBWIDTHBYTES) unless rowPitch is given; the leases keep them valid after the Camera is gone.
+    next_frame(pull, ctx) pulls by another function of the shape of Toupcam_PullImageV4, such as a feed of
+    imagepro_stitch_pullV4 (extra/imagepro/samples/ipcoro.h: co_await stitch.readdata() is the mosaic after it).
+    CamTask is the return type of a pipeline: it starts at once, runs to its first co_await on the calling thread.
+*/
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "toupcam.h"
+
+#define CAMCORO_E_ABORT     (HRESULT)0x80004004 /* E_ABORT */
+
+/* the executor of one thread: post() from any thread, run() resumes on the thread which calls it */
+class CamLoop {
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::deque<std::coroutine_handle<>> m_queue;
+    bool m_bStop;
+public:
+    CamLoop()
+    : m_bStop(false)
+    {
+    }
+
+    void post(std::coroutine_handle<> h)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_queue.push_back(h);
+        }
+        m_cv.notify_one();
+    }
+
+    /* until stop(), what was posted before it is still resumed */
+    void run()
+    {
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this] { return m_bStop || (!m_queue.empty()); });
+            if (m_queue.empty())
+                return;
+            std::coroutine_handle<> h = m_queue.front();
+            m_queue.pop_front();
+            lock.unlock();
+            h.resume();
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStop = true;
+        }
+        m_cv.notify_all();
+    }
+};
+
+/* a coroutine started at once and left suspended at its end, destroyed with the CamTask */
+class CamTask {
+public:
+    struct promise_type {
+        CamTask get_return_object() { return CamTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+private:
+    std::coroutine_handle<promise_type> m_h;
+    explicit CamTask(std::coroutine_handle<promise_type> h)
+    : m_h(h)
+    {
+    }
+public:
+    CamTask(CamTask&& other) noexcept
+    : m_h(other.m_h)
+    {
+        other.m_h = nullptr;
+    }
+    CamTask& operator=(CamTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_h)
+                m_h.destroy();
+            m_h = other.m_h;
+            other.m_h = nullptr;
+        }
+        return *this;
+    }
+    CamTask(const CamTask&) = delete;
+    CamTask& operator=(const CamTask&) = delete;
+    ~CamTask()
+    {
+        if (m_h)
+            m_h.destroy();
+    }
+
+    /* destroy it only done, or while it is suspended on an await which will not complete */
+    bool done() const
+    {
+        return (!m_h) || m_h.done();
+    }
+};
+
+/* of the shape of Toupcam_PullImageV4, bStill = 0 */
+typedef HRESULT (*CAMCORO_PULL)(void* ctx, HToupcam h, void* pImageData, int bits, int rowPitch, ToupcamFrameInfoV4* pInfo);
+
+class Camera;
+
+namespace camcoro_detail {
+    struct Slot {
+        std::vector<unsigned char> buf;
+        ToupcamFrameInfoV4 info;
+        Slot* next;
+    };
+    struct Waiter;
+    struct State {
+        HToupcam h;
+        std::mutex mtx;
+        std::vector<Slot> slot;
+        Slot* free;                 /* the list of the slots not leased */
+        int bits, rowPitch;
+        unsigned nReady;            /* TOUPCAM_EVENT_IMAGE not pulled yet */
+        Waiter* waiter;
+        void* ex;
+        void (*post)(void* ex, std::coroutine_handle<> h);
+    };
+}
+
+/* the result of an await: a slot leased until destroyed, or an error */
+class CamFrame {
+    friend class Camera;
+    friend struct camcoro_detail::Waiter;
+    std::shared_ptr<camcoro_detail::State> m_state;
+    camcoro_detail::Slot* m_slot;
+    HRESULT m_hr;
+    int m_stride;
+public:
+    CamFrame()
+    : m_slot(nullptr), m_hr((HRESULT)0x8000000a /* E_PENDING */), m_stride(0)
+    {
+    }
+    CamFrame(CamFrame&& other) noexcept
+    : m_state(std::move(other.m_state)), m_slot(other.m_slot), m_hr(other.m_hr), m_stride(other.m_stride)
+    {
+        other.m_slot = nullptr;
+    }
+    CamFrame& operator=(CamFrame&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            m_state = std::move(other.m_state);
+            m_slot = other.m_slot;
+            m_hr = other.m_hr;
+            m_stride = other.m_stride;
+            other.m_slot = nullptr;
+        }
+        return *this;
+    }
+    CamFrame(const CamFrame&) = delete;
+    CamFrame& operator=(const CamFrame&) = delete;
+    ~CamFrame()
+    {
+        release();
+    }
+
+    HRESULT hr() const { return m_hr; }
+    explicit operator bool() const { return (nullptr != m_slot); }
+    const void* data() const { return m_slot ? &m_slot->buf[0] : nullptr; }
+    int stride() const { return m_stride; }
+    const ToupcamFrameInfoV4& info() const { return m_slot->info; }
+
+    /* the slot back to the camera, before the destructor */
+    void release()
+    {
+        if (m_slot)
+        {
+            std::lock_guard<std::mutex> lock(m_state->mtx);
+            m_slot->next = m_state->free;
+            m_state->free = m_slot;
+            m_slot = nullptr;
+        }
+    }
+};
+
+namespace camcoro_detail {
+    struct Waiter {
+        std::shared_ptr<State> state;
+        bool bTrigger;
+        CAMCORO_PULL pull;
+        void* pullCtx;
+        std::coroutine_handle<> handle;
+        CamFrame result;
+
+        /* state->mtx held; false: nothing pulled, wait for the next TOUPCAM_EVENT_IMAGE */
+        bool pullInto(CamFrame& frame)
+        {
+            Slot* s = state->free;
+            if (nullptr == s)
+            {
+                frame.m_hr = (HRESULT)0x8007000e /* E_OUTOFMEMORY */;
+                return true;
+            }
+            const HRESULT hr = pull(pullCtx, state->h, &s->buf[0], state->bits, state->rowPitch, &s->info);
+            if ((HRESULT)0x8000000a /* E_PENDING */ == hr)
+            {
+                state->nReady = 0;
+                return false;
+            }
+            if (state->nReady)
+                --state->nReady;
+            frame.m_hr = hr;
+            if (SUCCEEDED(hr))
+            {
+                state->free = s->next;
+                frame.m_state = state;
+                frame.m_slot = s;
+                frame.m_stride = state->rowPitch ? state->rowPitch : (int)TDIBWIDTHBYTES(s->info.v3.width * state->bits);
+            }
+            return true;
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            {
+                std::lock_guard<std::mutex> lock(state->mtx);
+                if (state->waiter)
+                {
+                    result.m_hr = (HRESULT)0x8000000a /* E_PENDING */;
+                    return false;
+                }
+                if (bTrigger)
+                {
+                    /* the frames of before are not the one of this trigger */
+                    while (state->nReady)
+                    {
+                        CamFrame stale;
+                        if (!pullInto(stale) || ((HRESULT)0x8007000e /* E_OUTOFMEMORY */ == stale.m_hr))
+                            break;
+                        if (stale.m_slot)
+                        {
+                            stale.m_slot->next = state->free;
+                            state->free = stale.m_slot;
+                            stale.m_slot = nullptr;
+                        }
+                    }
+                }
+                else if (state->nReady && pullInto(result))
+                    return false;
+                handle = h;
+                state->waiter = this;
+            }
+            if (bTrigger)
+            {
+                /* not under state->mtx: the event callback may be waiting for it inside the SDK;
+                   from here on this may be resumed and gone, st keeps the state */
+                std::shared_ptr<State> st = state;
+                const HRESULT hr = Toupcam_Trigger(st->h, 1);
+                if (FAILED(hr))
+                {
+                    std::lock_guard<std::mutex> lock(st->mtx);
+                    if (this == st->waiter)
+                    {
+                        st->waiter = nullptr;
+                        result.m_hr = hr;
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        CamFrame await_resume()
+        {
+            return std::move(result);
+        }
+    };
+
+    inline HRESULT PullImage(void* /*ctx*/, HToupcam h, void* pImageData, int bits, int rowPitch, ToupcamFrameInfoV4* pInfo)
+    {
+        return Toupcam_PullImageV4(h, pImageData, 0, bits, rowPitch, pInfo);
+    }
+}
+
+class Camera {
+    HToupcam m_h;
+    std::shared_ptr<camcoro_detail::State> m_state;
+
+    static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+    {
+        camcoro_detail::State* s = (camcoro_detail::State*)pCallbackCtx;
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard<std::mutex> lock(s->mtx);
+            if (TOUPCAM_EVENT_IMAGE == nEvent)
+            {
+                ++s->nReady;
+                if (s->waiter && s->waiter->pullInto(s->waiter->result))
+                {
+                    h = s->waiter->handle;
+                    s->waiter = nullptr;
+                }
+            }
+            else if (s->waiter)
+            {
+                HRESULT hr = (HRESULT)0x00000000 /* S_OK */;
+                switch (nEvent)
+                {
+                case TOUPCAM_EVENT_TRIGGERFAIL:
+                case TOUPCAM_EVENT_ERROR:
+                    hr = (HRESULT)0x80004005 /* E_FAIL */;
+                    break;
+                case TOUPCAM_EVENT_DISCONNECTED:
+                    hr = (HRESULT)0x8007001f /* E_GEN_FAILURE */;
+                    break;
+                case TOUPCAM_EVENT_NOFRAMETIMEOUT:
+                case TOUPCAM_EVENT_NOPACKETTIMEOUT:
+                    hr = (HRESULT)0x8001011f /* E_TIMEOUT */;
+                    break;
+                default:
+                    break;
+                }
+                if (FAILED(hr))
+                {
+                    s->waiter->result.m_hr = hr;
+                    h = s->waiter->handle;
+                    s->waiter = nullptr;
+                }
+            }
+        }
+        if (h)
+            s->post(s->ex, h);
+    }
+
+    camcoro_detail::Waiter await(bool bTrigger, CAMCORO_PULL pull, void* ctx) const
+    {
+        return camcoro_detail::Waiter{ m_state, bTrigger, pull, ctx, nullptr, CamFrame() };
+    }
+public:
+    Camera()
+    : m_h(nullptr)
+    {
+    }
+
+    /* takes the handle, Toupcam_Close'd by the destructor */
+    explicit Camera(HToupcam h)
+    : m_h(h)
+    {
+    }
+
+#if defined(_WIN32)
+    static Camera open(const wchar_t* camId = nullptr)
+#else
+    static Camera open(const char* camId = nullptr)
+#endif
+    {
+        return Camera(Toupcam_Open(camId));
+    }
+
+    Camera(Camera&& other) noexcept
+    : m_h(other.m_h), m_state(std::move(other.m_state))
+    {
+        other.m_h = nullptr;
+    }
+    Camera& operator=(Camera&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            m_h = other.m_h;
+            m_state = std::move(other.m_state);
+            other.m_h = nullptr;
+        }
+        return *this;
+    }
+    Camera(const Camera&) = delete;
+    Camera& operator=(const Camera&) = delete;
+    ~Camera()
+    {
+        close();
+    }
+
+    explicit operator bool() const { return (nullptr != m_h); }
+    HToupcam handle() const { return m_h; }
+
+    /* ex outlives the camera; bits as Toupcam_PullImageV4, rowPitch 0: TDIBWIDTHBYTES */
+    template <typename E>
+    HRESULT start(E& ex, int bits = 24, unsigned slots = 3, int rowPitch = 0)
+    {
+        if ((nullptr == m_h) || m_state)
+            return (HRESULT)0x8000ffff /* E_UNEXPECTED */;
+        const ToupcamModelV2* model = Toupcam_query_Model(m_h);
+        if ((nullptr == model) || (0 == slots))
+            return (HRESULT)0x80070057 /* E_INVALIDARG */;
+        const unsigned w = model->res[0].width, h = model->res[0].height;
+        size_t size;
+        if (rowPitch > 0)
+            size = (size_t)rowPitch * ((w > h) ? w : h);
+        else
+        {
+            const size_t a = (size_t)TDIBWIDTHBYTES(w * bits) * h, b = (size_t)TDIBWIDTHBYTES(h * bits) * w;
+            size = (a > b) ? a : b;
+        }
+        std::shared_ptr<camcoro_detail::State> s = std::make_shared<camcoro_detail::State>();
+        s->h = m_h;
+        s->slot.resize(slots);
+        s->free = nullptr;
+        for (unsigned i = 0; i < slots; ++i)
+        {
+            s->slot[i].buf.resize(size);
+            s->slot[i].next = s->free;
+            s->free = &s->slot[i];
+        }
+        s->bits = bits;
+        s->rowPitch = rowPitch;
+        s->nReady = 0;
+        s->waiter = nullptr;
+        s->ex = &ex;
+        s->post = [](void* p, std::coroutine_handle<> h) { static_cast<E*>(p)->post(h); };
+        const HRESULT hr = Toupcam_StartPullModeWithCallback(m_h, EventCallback, s.get());
+        if (SUCCEEDED(hr))
+            m_state = s;
+        return hr;
+    }
+
+    /* no more frames; an await in progress completes with CAMCORO_E_ABORT on the executor, start() again after */
+    void stop()
+    {
+        if (!m_state)
+            return;
+        Toupcam_Stop(m_h);
+        std::coroutine_handle<> h;
+        {
+            std::lock_guard<std::mutex> lock(m_state->mtx);
+            if (m_state->waiter)
+            {
+                m_state->waiter->result.m_hr = CAMCORO_E_ABORT;
+                h = m_state->waiter->handle;
+                m_state->waiter = nullptr;
+            }
+        }
+        if (h)
+            m_state->post(m_state->ex, h);
+        m_state.reset();
+    }
+
+    void close()
+    {
+        if (m_h)
+        {
+            stop();
+            Toupcam_Close(m_h);
+            m_h = nullptr;
+        }
+    }
+
+    camcoro_detail::Waiter next_frame() const
+    {
+        return await(false, camcoro_detail::PullImage, nullptr);
+    }
+
+    camcoro_detail::Waiter next_frame(CAMCORO_PULL pull, void* ctx) const
+    {
+        return await(false, pull, ctx);
+    }
+
+    camcoro_detail::Waiter trigger_sync() const
+    {
+        return await(true, camcoro_detail::PullImage, nullptr);
+    }
+};
+
+#endif
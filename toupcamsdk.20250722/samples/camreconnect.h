@@ -0,0 +1,286 @@
+#ifndef __camreconnect_H__
+#define __camreconnect_H__
+
+/*
+    Automatic recovery of a camera which went away (USB cable, hub reset, power of a GigE switch): on
+    TOUPCAM_EVENT_DISCONNECTED the handle is closed, the camera of the same serial number is opened again as soon as it
+    is back ("sn:..." of Toupcam_Open), the settings of the session are replayed in one batch and the stream is
+    started again, without the program closing, reallocating or setting anything by hand.
+    The settings go through apply(): they are applied like any OptionBatch (optbatch.h) and kept, the last value of
+    each, so the replay after a reconnection is one OptionBatch sent before the start (nothing to stop and restart).
+    The options of the deques (TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH, ...) are settings like the others, so the new
+    handle has the deques of the old one; the buffers of the program stay as they are, the frames have the same size.
+    The reopening is tried when the system reports a device change (notify(), CAMRECONNECT_SETTLE_MS after it, as the
+    SDK recommends) and every CAMRECONNECT_POLL_MS between: Toupcam_HotPlug calls notify() on Linux and macOS when
+    bHotPlug; on Windows forward WM_DEVICECHANGE, for GigE the callback of Toupcam_GigeEnable.
+    The events of the camera go to the callback of the program as they come, and two of this class:
+        CAMRECONNECT_EVENT_RECONNECTED  streaming again, downtime() is the time from the disconnection
+        CAMRECONNECT_EVENT_RETRY        the camera is back but the settings or the start failed: closed, tried again
+    The recovery runs on a thread of its own: Toupcam_Close cannot be called from the event callback. handle() is the
+    handle of the events being delivered, NULL while it is being reopened; from other threads, hold it only between
+    two events.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+#include "optbatch.h"
+
+#define CAMRECONNECT_EVENT_RECONNECTED  0x7f01
+#define CAMRECONNECT_EVENT_RETRY        0x7f02
+#define CAMRECONNECT_POLL_MS            500
+#define CAMRECONNECT_SETTLE_MS          200
+
+class CamReconnect {
+    typedef std::chrono::steady_clock Clock;
+
+    HToupcam m_hcam;
+    std::string m_sn;
+    PTOUPCAM_EVENT_CALLBACK m_funEvent;
+    void* m_ctxEvent;
+    OptionShadow m_shadow;              /* under m_mtxApply, with the transfers of the settings */
+    std::mutex m_mtxApply;
+    std::vector<OptItem> m_settings;    /* the last value of each */
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+    bool m_bLost, m_bQuit, m_bChanged, m_bHotPlug;
+    Clock::time_point m_tLost;
+    double m_downtime;                  /* ms, of the last reconnection */
+    unsigned m_nReconnects;
+
+    CamReconnect(const CamReconnect&);
+    CamReconnect& operator=(const CamReconnect&);
+
+    static void __stdcall EventCallback(unsigned nEvent, void* ctx)
+    {
+        CamReconnect* p = static_cast<CamReconnect*>(ctx);
+        if (TOUPCAM_EVENT_DISCONNECTED == nEvent)
+        {
+            std::lock_guard<std::mutex> lock(p->m_mtx);
+            if (!p->m_bLost)
+            {
+                p->m_bLost = true;
+                p->m_tLost = Clock::now();
+                p->m_cv.notify_all();
+            }
+        }
+        if (p->m_funEvent)
+            p->m_funEvent(nEvent, p->m_ctxEvent);
+    }
+
+    static void __stdcall HotPlugCallback(void* ctx)
+    {
+        static_cast<CamReconnect*>(ctx)->notify();
+    }
+
+    void keep(const OptItem& item)
+    {
+        for (size_t i = 0; i < m_settings.size(); ++i)
+        {
+            if ((m_settings[i].kind == item.kind) && (m_settings[i].id == item.id))
+            {
+                m_settings[i] = item;
+                return;
+            }
+        }
+        m_settings.push_back(item);
+    }
+
+    static void add(OptionBatch& batch, const OptItem& t)
+    {
+        switch (t.kind)
+        {
+        case OPTBATCH_OPTION: batch.option(t.id, t.v[0]); break;
+        case OPTBATCH_ESIZE: batch.eSize((unsigned)t.v[0]); break;
+        case OPTBATCH_ROI: batch.roi((unsigned)t.v[0], (unsigned)t.v[1], (unsigned)t.v[2], (unsigned)t.v[3]); break;
+        case OPTBATCH_EXPOTIME: batch.expoTime((unsigned)t.v[0]); break;
+        case OPTBATCH_EXPOGAIN: batch.expoGain((unsigned short)t.v[0]); break;
+        case OPTBATCH_SPEED: batch.speed((unsigned short)t.v[0]); break;
+        case OPTBATCH_AUTOEXPO: batch.autoExpo(t.v[0]); break;
+        }
+    }
+
+    /* the settings of the session onto a new handle */
+    HRESULT replay(HToupcam h)
+    {
+        OptionBatch batch;
+        std::vector<OptItem> vec;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            vec = m_settings;
+        }
+        for (size_t i = 0; i < vec.size(); ++i)
+            add(batch, vec[i]);
+        std::lock_guard<std::mutex> lock(m_mtxApply);
+        m_shadow.clear();
+        return batch.apply(h, m_shadow, false, std::function<HRESULT()>());
+    }
+
+    void recovery()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        for (;;)
+        {
+            m_cv.wait(lock, [this] { return m_bQuit || m_bLost; });
+            if (m_bQuit)
+                return;
+            HToupcam old = m_hcam;
+            lock.unlock();
+            Toupcam_Close(old);     /* waits for the event callback to return */
+            lock.lock();
+            m_hcam = NULL;
+            bool bRetry = false;
+            while (!m_bQuit)
+            {
+                /* a device change, settled, or the next poll */
+                m_cv.wait_for(lock, std::chrono::milliseconds(CAMRECONNECT_POLL_MS), [this] { return m_bQuit || m_bChanged; });
+                if (m_bQuit)
+                    return;
+                const bool bChanged = m_bChanged;
+                m_bChanged = false;
+                if (bChanged)
+                    m_cv.wait_for(lock, std::chrono::milliseconds(CAMRECONNECT_SETTLE_MS), [this] { return m_bQuit; });
+                const std::string id = "sn:" + m_sn;
+                lock.unlock();
+                HToupcam h = Toupcam_Open(id.c_str());
+                if (NULL == h)
+                {
+                    lock.lock();
+                    continue;   /* not back yet */
+                }
+                HRESULT hr = replay(h);
+                if (SUCCEEDED(hr))
+                {
+                    /* the handle of the events from the first one on */
+                    lock.lock();
+                    m_hcam = h;
+                    m_bLost = false;
+                    lock.unlock();
+                    hr = Toupcam_StartPullModeWithCallback(h, EventCallback, this);
+                }
+                lock.lock();
+                if (SUCCEEDED(hr))
+                {
+                    m_downtime = std::chrono::duration<double, std::milli>(Clock::now() - m_tLost).count();
+                    ++m_nReconnects;
+                    break;
+                }
+                m_hcam = NULL;
+                m_bLost = true;
+                lock.unlock();
+                Toupcam_Close(h);
+                if (!bRetry && m_funEvent)
+                    m_funEvent(CAMRECONNECT_EVENT_RETRY, m_ctxEvent);
+                bRetry = true;
+                lock.lock();
+            }
+            if (m_bQuit)
+                return;
+            lock.unlock();
+            if (m_funEvent)
+                m_funEvent(CAMRECONNECT_EVENT_RECONNECTED, m_ctxEvent);
+            lock.lock();
+        }
+    }
+public:
+    CamReconnect()
+    : m_hcam(NULL), m_funEvent(NULL), m_ctxEvent(NULL), m_bLost(false), m_bQuit(false), m_bChanged(false), m_bHotPlug(false),
+    m_downtime(0.0), m_nReconnects(0)
+    {
+    }
+
+    ~CamReconnect() { close(); }
+
+    /* camId as Toupcam_Open, NULL: the first camera; bHotPlug: Toupcam_HotPlug (Linux, macOS) calls notify() */
+    HRESULT open(const char* camId, bool bHotPlug = true)
+    {
+        m_hcam = Toupcam_Open(camId);
+        if (NULL == m_hcam)
+            return (HRESULT)0x80004005; /* E_FAIL */
+        char sn[32] = { 0 };
+        const HRESULT hr = Toupcam_get_SerialNumber(m_hcam, sn);
+        if (FAILED(hr))
+        {
+            Toupcam_Close(m_hcam);
+            m_hcam = NULL;
+            return hr;
+        }
+        m_sn = sn;
+#if !defined(_WIN32) && !defined(__ANDROID__)
+        if (bHotPlug)
+            Toupcam_HotPlug(HotPlugCallback, this);
+        m_bHotPlug = bHotPlug;
+#endif
+        return 0;   /* S_OK */
+    }
+
+    /* Toupcam_StartPullModeWithCallback, and the recovery from then on */
+    HRESULT start(PTOUPCAM_EVENT_CALLBACK funEvent, void* ctxEvent)
+    {
+        m_funEvent = funEvent;
+        m_ctxEvent = ctxEvent;
+        const HRESULT hr = Toupcam_StartPullModeWithCallback(m_hcam, EventCallback, this);
+        if (SUCCEEDED(hr) && (!m_thread.joinable()))
+            m_thread = std::thread(&CamReconnect::recovery, this);
+        return hr;
+    }
+
+    /* the settings, applied now and replayed after every reconnection; the batch as OptionBatch::apply */
+    HRESULT apply(OptionBatch& batch, bool bRunning, const std::function<HRESULT()>& restart, size_t* pIndex = NULL, unsigned* pApplied = NULL)
+    {
+        std::lock_guard<std::mutex> lockApply(m_mtxApply);
+        HToupcam h = handle();
+        if ((NULL == h) || lost())
+            return (HRESULT)0x8000ffff; /* E_UNEXPECTED: reconnecting */
+        const HRESULT hr = batch.apply(h, m_shadow, bRunning, restart, pIndex, pApplied);
+        if (SUCCEEDED(hr))
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            for (size_t i = 0; i < batch.size(); ++i)
+                keep(batch.item(i));
+        }
+        return hr;
+    }
+
+    /* a device arrived or went away: tried CAMRECONNECT_SETTLE_MS later */
+    void notify()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_bChanged = true;
+        m_cv.notify_all();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bQuit = true;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+#if !defined(_WIN32) && !defined(__ANDROID__)
+        if (m_bHotPlug)
+            Toupcam_HotPlug(NULL, NULL);
+        m_bHotPlug = false;
+#endif
+        if (m_hcam)
+            Toupcam_Close(m_hcam);
+        m_hcam = NULL;
+    }
+
+    HToupcam handle() { std::lock_guard<std::mutex> lock(m_mtx); return m_hcam; }
+    const char* serial() const { return m_sn.c_str(); }
+    bool lost() { std::lock_guard<std::mutex> lock(m_mtx); return m_bLost; }
+    unsigned reconnects() { std::lock_guard<std::mutex> lock(m_mtx); return m_nReconnects; }
+    /* ms from TOUPCAM_EVENT_DISCONNECTED to the stream started again, of the last reconnection */
+    double downtime() { std::lock_guard<std::mutex> lock(m_mtx); return m_downtime; }
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef __camstandby_H__
+#define __camstandby_H__
+
+/*
+    Standby between the points of a long timelapse, and the wake with a known time to the first valid frame.
+    Streaming for tens of minutes between two points wastes power and heats the sensor; closing and opening the
+    camera again costs the enumeration, the settings and the start. Here the handle, its settings and its buffers stay,
+    only the stream goes down, at one of three levels:
+        CAMSTANDBY_PAUSE    Toupcam_Pause: no frames, the sensor configuration as is; the fastest wake
+        CAMSTANDBY_LOWPOWER Toupcam_Pause and TOUPCAM_OPTION_LOW_POWERCONSUMPTION, where the camera has it (otherwise
+                            standby() says CAMSTANDBY_PAUSE was reached)
+        CAMSTANDBY_STOP     Toupcam_Stop, woken by the start of the program (restart): the sensor is idle, the handle
+                            and its settings stay; the slowest wake of the three
+    Toupcam_Enable (demopower) powers the camera down completely, but the handle is gone with it: the way back is
+    the one of a disconnection (camreconnect.h), seconds, not a standby.
+    wake() resumes the stream and starts the clock; the frames cached before the standby are flushed
+    (TOUPCAM_OPTION_FLUSH 3) and the first skip frames after the wake are not valid (the exposure of the first one may
+    have started while the sensor came up). onFrame(), from the event callback for every frame pulled, tells the valid
+    ones; the time from wake() to the first valid frame is measured on every wake, and leadTime() is the worst of the
+    last CAMSTANDBY_HISTORY plus CAMSTANDBY_MARGIN: the scheduler wakes the camera that long before the point and has
+    a valid frame at the point.
+    The auto exposure does not run in standby: its exposure stays as it was, which suits a scene under constant light;
+    with changing light add the frames the auto exposure needs to skip.
+*/
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include "toupcam.h"
+
+#define CAMSTANDBY_PAUSE        0
+#define CAMSTANDBY_LOWPOWER     1
+#define CAMSTANDBY_STOP         2
+#define CAMSTANDBY_HISTORY      16      /* wakes kept for leadTime() */
+#define CAMSTANDBY_MARGIN       0.2     /* of the worst wake, for leadTime() */
+
+class CamStandby {
+    typedef std::chrono::steady_clock Clock;
+
+    HToupcam m_hcam;
+    const unsigned m_skip;
+    std::function<HRESULT()> m_restart;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    int m_level;                /* reached, -1: streaming */
+    bool m_bStandby, m_bWaking;
+    unsigned m_seen;            /* frames since the wake */
+    Clock::time_point m_tWake;
+    std::deque<double> m_history;   /* ms, wake to the first valid frame */
+
+    CamStandby(const CamStandby&);
+    CamStandby& operator=(const CamStandby&);
+public:
+    /* skip: frames not valid after a wake; restart: the start of the program (Toupcam_StartXXXX), for CAMSTANDBY_STOP */
+    CamStandby(HToupcam h, unsigned skip, const std::function<HRESULT()>& restart)
+    : m_hcam(h), m_skip(skip), m_restart(restart), m_level(-1), m_bStandby(false), m_bWaking(false), m_seen(0)
+    {
+    }
+
+    /* the stream down; pLevel: the level reached */
+    HRESULT standby(int level, int* pLevel = NULL)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_bStandby)
+                return 1;       /* S_FALSE */
+            m_bStandby = true;  /* the frames in flight are not valid any more */
+            m_bWaking = false;
+        }
+        HRESULT hr;
+        int reached = level;
+        if (CAMSTANDBY_STOP == level)
+            hr = Toupcam_Stop(m_hcam);
+        else
+        {
+            hr = Toupcam_Pause(m_hcam, 1);
+            if (SUCCEEDED(hr) && (CAMSTANDBY_LOWPOWER == level) && FAILED(Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_LOW_POWERCONSUMPTION, 1)))
+                reached = CAMSTANDBY_PAUSE;
+        }
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (FAILED(hr))
+        {
+            m_bStandby = false;
+            return hr;
+        }
+        m_level = reached;
+        if (pLevel)
+            *pLevel = reached;
+        return hr;
+    }
+
+    /* back to streaming, the time to the first valid frame from now; waitValid() waits for it */
+    HRESULT wake()
+    {
+        int level;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_bStandby)
+                return 1;       /* S_FALSE */
+            level = m_level;
+            m_tWake = Clock::now();
+            m_seen = 0;
+        }
+        if (CAMSTANDBY_LOWPOWER == level)
+            Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_LOW_POWERCONSUMPTION, 0);
+        Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_FLUSH, 3);   /* where the camera has it */
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStandby = false;
+            m_bWaking = true;
+            m_level = -1;
+        }
+        HRESULT hr;
+        if (CAMSTANDBY_STOP == level)
+            hr = m_restart ? m_restart() : (HRESULT)0x8000ffff;    /* E_UNEXPECTED */
+        else
+            hr = Toupcam_Pause(m_hcam, 0);
+        if (FAILED(hr))
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStandby = true;
+            m_bWaking = false;
+            m_level = level;
+        }
+        return hr;
+    }
+
+    /* every frame pulled, from the event callback: false in standby and for the first skip frames after a wake */
+    bool onFrame()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_bStandby)
+            return false;
+        if (!m_bWaking)
+            return true;
+        if (++m_seen <= m_skip)
+            return false;
+        m_bWaking = false;
+        m_history.push_back(std::chrono::duration<double, std::milli>(Clock::now() - m_tWake).count());
+        if (m_history.size() > CAMSTANDBY_HISTORY)
+            m_history.pop_front();
+        m_cv.notify_all();
+        return true;
+    }
+
+    /* false: no valid frame within ms of now */
+    bool waitValid(unsigned ms)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        return m_cv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return (!m_bStandby) && (!m_bWaking); });
+    }
+
+    bool inStandby() { std::lock_guard<std::mutex> lock(m_mtx); return m_bStandby; }
+    /* ms, wake to the first valid frame: the last one, and the lead to wake with (0 before the first wake) */
+    double lastWake() { std::lock_guard<std::mutex> lock(m_mtx); return m_history.empty() ? 0.0 : m_history.back(); }
+    double leadTime()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_history.empty() ? 0.0 : (*std::max_element(m_history.begin(), m_history.end()) * (1.0 + CAMSTANDBY_MARGIN));
+    }
+};
+
+#endif
@@ -0,0 +1,392 @@
+#ifndef __camuart_H__
+#define __camuart_H__
+
+/*
+    The UART of the camera (GPIO0 / GPIO1, Toupcam_write_UART / Toupcam_read_UART) as the serial link of a stage
+    controller: the RAMPS board wired to the camera instead of to a USB serial port of the host, one USB device for
+    the frames and the G-code, and the bytes of both directions timestamped on the clock the frames are put on
+    (HostMicroseconds() of stagetrack.h, the steady clock), so a move, its "ok" and the frames exposed meanwhile are on
+    one timebase.
+    Toupcam_read_UART does not wait, it returns what the camera has received (0 bytes: nothing), and
+    Toupcam_write_UART is one control transfer: both run on a thread of their own here. write() queues and returns;
+    the thread sends the queue in chunks of CAMUART_CHUNK bytes and polls the receive side every CAMUART_POLL_MS
+    between. The bytes received are kept (CAMUART_RX_MAX at most, the oldest dropped: overruns()) for read(), with the
+    host time they were read at.
+    Every complete line, sent or received, goes to the line callback with its host time: for a line sent the return
+    of the Toupcam_write_UART which carried its '\n', for a line received the read which brought its '\n'. A receive
+    timestamp is late by up to one poll plus one control transfer, a transmit one by the transfer to the controller at
+    the baud rate (about 1 ms per 11 characters at 115200).
+    stream() makes the link a pair of FILE* for GcodeStream (gcodestream.h), over two pipes: the lines GcodeStream
+    writes are queued as by write(), the bytes received go to its reader instead of to read(). Those FILE* belong to
+    this class: close() closes them, after GcodeStream::close().
+    The settings of the UART (TOUPCAM_IOCONTROLTYPE_SET_UART_XXX) are put by open(): 9600 ... 115200 baud, line mode
+    0 is TX GPIO0 / RX GPIO1, 1 the other way round; the GPIOs are then no longer available for triggers.
+*/
+#include <string.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+#include "toupcam.h"
+#include "stagetrack.h"
+
+#define CAMUART_CHUNK       64          /* bytes per Toupcam_write_UART / Toupcam_read_UART */
+#define CAMUART_POLL_MS     1
+#define CAMUART_RX_MAX      65536       /* bytes kept for read() */
+#define CAMUART_LINE_MAX    256         /* longer lines are delivered in pieces */
+#define CAMUART_TX          0
+#define CAMUART_RX          1
+
+/* on the thread of the UART: dir CAMUART_TX or CAMUART_RX, t host microseconds, line without "\r\n" */
+typedef void (*CAMUART_LINE)(void* ctx, int dir, long long t, const char* line);
+
+class CamUart {
+    struct Chunk {
+        long long t;
+        std::string data;
+    };
+
+    HToupcam m_hcam;
+    CAMUART_LINE m_cbLine;
+    void* m_ctxLine;
+    std::string m_tx;                   /* queued, not sent yet */
+    unsigned long long m_queued, m_sent, m_received;
+    std::deque<Chunk> m_rx;
+    size_t m_rxBytes;
+    unsigned m_overruns, m_errors;
+    HRESULT m_hrLast;
+    bool m_bQuit;
+    std::string m_line[2];              /* of the thread: the line being assembled, per direction */
+    int m_fdTx[2], m_fdRx[2];           /* stream(): the pipes, -1: none */
+    FILE* m_fout;
+    FILE* m_fin;
+    std::thread m_thread, m_pump;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+
+    CamUart(const CamUart&);
+    CamUart& operator=(const CamUart&);
+
+    static int baudIndex(unsigned baud)
+    {
+        static const unsigned rate[] = { 9600, 19200, 38400, 57600, 115200 };
+        for (int i = 0; i < 5; ++i)
+        {
+            if (rate[i] == baud)
+                return i;
+        }
+        return -1;
+    }
+
+    static int pipeOpen(int fd[2])
+    {
+#if defined(_WIN32)
+        return _pipe(fd, 4096, _O_BINARY);
+#else
+        return pipe(fd);
+#endif
+    }
+
+    static int fdRead(int fd, void* buf, unsigned len)
+    {
+#if defined(_WIN32)
+        return _read(fd, buf, len);
+#else
+        return (int)::read(fd, buf, len);
+#endif
+    }
+
+    static int fdWrite(int fd, const void* buf, unsigned len)
+    {
+#if defined(_WIN32)
+        return _write(fd, buf, len);
+#else
+        return (int)::write(fd, buf, len);
+#endif
+    }
+
+    static void fdClose(int& fd)
+    {
+        if (fd >= 0)
+        {
+#if defined(_WIN32)
+            _close(fd);
+#else
+            ::close(fd);
+#endif
+        }
+        fd = -1;
+    }
+
+    /* on the thread, no lock: the complete lines of the bytes of one transfer */
+    void lines(int dir, long long t, const unsigned char* data, unsigned len)
+    {
+        std::string& l = m_line[dir];
+        for (unsigned i = 0; i < len; ++i)
+        {
+            const char c = (char)data[i];
+            if ('\n' == c)
+            {
+                if (m_cbLine)
+                    m_cbLine(m_ctxLine, dir, t, l.c_str());
+                l.clear();
+            }
+            else if ('\r' != c)
+            {
+                l += c;
+                if (l.size() >= CAMUART_LINE_MAX)
+                {
+                    if (m_cbLine)
+                        m_cbLine(m_ctxLine, dir, t, l.c_str());
+                    l.clear();
+                }
+            }
+        }
+    }
+
+    void worker()
+    {
+        unsigned char buf[CAMUART_CHUNK];
+        std::unique_lock<std::mutex> lock(m_mtx);
+        while (!m_bQuit)
+        {
+            bool bBusy = false;
+            if (!m_tx.empty())
+            {
+                const unsigned n = (unsigned)((m_tx.size() < CAMUART_CHUNK) ? m_tx.size() : CAMUART_CHUNK);
+                memcpy(buf, m_tx.data(), n);
+                lock.unlock();
+                const HRESULT hr = Toupcam_write_UART(m_hcam, buf, n);
+                const long long t = HostMicroseconds();
+                if (SUCCEEDED(hr))
+                    lines(CAMUART_TX, t, buf, n);
+                lock.lock();
+                if (FAILED(hr))
+                {
+                    ++m_errors;
+                    m_hrLast = hr;
+                }
+                m_tx.erase(0, n);   /* failed: dropped, not retried forever */
+                m_sent += n;
+                m_cv.notify_all();
+                bBusy = true;
+            }
+            const int fdRx = m_fdRx[1];
+            lock.unlock();
+            const HRESULT hr = Toupcam_read_UART(m_hcam, buf, sizeof(buf));
+            const long long t = HostMicroseconds();
+            if (hr > 0)
+            {
+                lines(CAMUART_RX, t, buf, (unsigned)hr);
+                if (fdRx >= 0)
+                    fdWrite(fdRx, buf, (unsigned)hr);
+            }
+            lock.lock();
+            if (FAILED(hr))
+            {
+                ++m_errors;
+                m_hrLast = hr;
+            }
+            else if (hr > 0)
+            {
+                m_received += (unsigned)hr;
+                if (fdRx < 0)
+                {
+                    Chunk c;
+                    c.t = t;
+                    c.data.assign((const char*)buf, (size_t)hr);
+                    m_rx.push_back(c);
+                    m_rxBytes += (size_t)hr;
+                    while (m_rxBytes > CAMUART_RX_MAX)
+                    {
+                        m_rxBytes -= m_rx.front().data.size();
+                        m_rx.pop_front();
+                        ++m_overruns;
+                    }
+                }
+                m_cv.notify_all();
+                if (hr >= (HRESULT)sizeof(buf))
+                    bBusy = true;   /* more may be waiting */
+            }
+            if ((!bBusy) && m_tx.empty() && (!m_bQuit))
+                m_cv.wait_for(lock, std::chrono::milliseconds(CAMUART_POLL_MS));
+        }
+    }
+
+    /* stream(): what GcodeStream writes, into the queue */
+    void pump()
+    {
+        char buf[CAMUART_CHUNK];
+        int n;
+        while ((n = fdRead(m_fdTx[0], buf, sizeof(buf))) > 0)
+            write(buf, (unsigned)n);
+    }
+public:
+    CamUart()
+    : m_hcam(NULL), m_cbLine(NULL), m_ctxLine(NULL), m_queued(0), m_sent(0), m_received(0), m_rxBytes(0), m_overruns(0), m_errors(0),
+    m_hrLast(0), m_bQuit(false), m_fout(NULL), m_fin(NULL)
+    {
+        m_fdTx[0] = m_fdTx[1] = m_fdRx[0] = m_fdRx[1] = -1;
+    }
+
+    ~CamUart() { close(); }
+
+    /* before open() */
+    void setLineCallback(CAMUART_LINE cb, void* ctx)
+    {
+        m_cbLine = cb;
+        m_ctxLine = ctx;
+    }
+
+    /* baud 9600, 19200, 38400, 57600 or 115200; lineMode 0: TX GPIO0 / RX GPIO1, 1: TX GPIO1 / RX GPIO0 */
+    HRESULT open(HToupcam h, unsigned baud, int lineMode = 0)
+    {
+        const int index = baudIndex(baud);
+        if ((NULL == h) || (index < 0) || m_thread.joinable())
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        HRESULT hr = Toupcam_IoControl(h, 0, TOUPCAM_IOCONTROLTYPE_SET_UART_BAUDRATE, index, NULL);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_IoControl(h, 0, TOUPCAM_IOCONTROLTYPE_SET_UART_LINEMODE, lineMode, NULL);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_IoControl(h, 0, TOUPCAM_IOCONTROLTYPE_SET_UART_ENABLE, 1, NULL);
+        if (FAILED(hr))
+            return hr;
+        unsigned char buf[CAMUART_CHUNK];
+        while (Toupcam_read_UART(h, buf, sizeof(buf)) > 0)
+            ;   /* what came before the open */
+        m_hcam = h;
+        m_tx.clear();
+        m_rx.clear();
+        m_queued = m_sent = m_received = 0;
+        m_rxBytes = 0;
+        m_overruns = m_errors = 0;
+        m_bQuit = false;
+        m_line[0].clear();
+        m_line[1].clear();
+        m_thread = std::thread(&CamUart::worker, this);
+        return 0;   /* S_OK */
+    }
+
+    /* the two FILE* of GcodeStream::open(fout, fin), once, after open() */
+    bool stream(FILE** pOut, FILE** pIn)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if ((!m_thread.joinable()) || m_fout)
+            return false;
+        if (pipeOpen(m_fdTx))
+            return false;
+        if (pipeOpen(m_fdRx))
+        {
+            fdClose(m_fdTx[0]);
+            fdClose(m_fdTx[1]);
+            return false;
+        }
+#if defined(_WIN32)
+        m_fout = _fdopen(m_fdTx[1], "w");
+        m_fin = _fdopen(m_fdRx[0], "r");
+#else
+        m_fout = fdopen(m_fdTx[1], "w");
+        m_fin = fdopen(m_fdRx[0], "r");
+#endif
+        m_fdTx[1] = m_fdRx[0] = -1;     /* the FILE* own them */
+        m_pump = std::thread(&CamUart::pump, this);
+        *pOut = m_fout;
+        *pIn = m_fin;
+        return true;
+    }
+
+    /* queued, returns at once; pTicket: for flush() */
+    HRESULT write(const void* data, unsigned len, unsigned long long* pTicket = NULL)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!m_thread.joinable())
+            return (HRESULT)0x8000ffff; /* E_UNEXPECTED */
+        m_tx.append((const char*)data, len);
+        m_queued += len;
+        if (pTicket)
+            *pTicket = m_queued;
+        m_cv.notify_all();
+        return 0;   /* S_OK */
+    }
+
+    /* the bytes up to ticket (0: all the bytes queued) went out; false: not within ms */
+    bool flush(unsigned ms, unsigned long long ticket = 0)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        const unsigned long long end = ticket ? ticket : m_queued;
+        return m_cv.wait_for(lock, std::chrono::milliseconds(ms), [this, end] { return m_sent >= end; });
+    }
+
+    /* up to len bytes received, waits up to ms for the first one; pTime: host time of the first byte returned */
+    unsigned read(void* buf, unsigned len, long long* pTime = NULL, unsigned ms = 0)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (ms)
+            m_cv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return (!m_rx.empty()) || m_bQuit; });
+        unsigned n = 0;
+        if ((!m_rx.empty()) && pTime)
+            *pTime = m_rx.front().t;
+        while ((n < len) && (!m_rx.empty()))
+        {
+            Chunk& c = m_rx.front();
+            const unsigned k = (unsigned)((c.data.size() < len - n) ? c.data.size() : len - n);
+            memcpy((char*)buf + n, c.data.data(), k);
+            n += k;
+            m_rxBytes -= k;
+            if (k == c.data.size())
+                m_rx.pop_front();
+            else
+                c.data.erase(0, k);
+        }
+        return n;
+    }
+
+    /*
+        the queue sent (up to ms), the thread ended, the UART disabled; with stream(): after GcodeStream::close(),
+        its FILE* are closed here
+    */
+    void close(unsigned ms = 1000)
+    {
+        if (m_fout)
+        {
+            fclose(m_fout);     /* the pump reads the rest, then the end of the pipe */
+            m_fout = NULL;
+        }
+        if (m_pump.joinable())
+            m_pump.join();
+        if (!m_thread.joinable())
+            return;
+        flush(ms);
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bQuit = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+        fdClose(m_fdRx[1]);
+        if (m_fin)
+        {
+            fclose(m_fin);
+            m_fin = NULL;
+        }
+        fdClose(m_fdTx[0]);
+        Toupcam_IoControl(m_hcam, 0, TOUPCAM_IOCONTROLTYPE_SET_UART_ENABLE, 0, NULL);
+        m_hcam = NULL;
+    }
+
+    unsigned long long sent() { std::lock_guard<std::mutex> lock(m_mtx); return m_sent; }
+    unsigned long long received() { std::lock_guard<std::mutex> lock(m_mtx); return m_received; }
+    unsigned overruns() { std::lock_guard<std::mutex> lock(m_mtx); return m_overruns; }
+    unsigned errors() { std::lock_guard<std::mutex> lock(m_mtx); return m_errors; }
+    HRESULT lastError() { std::lock_guard<std::mutex> lock(m_mtx); return m_hrLast; }
+};
+
+#endif
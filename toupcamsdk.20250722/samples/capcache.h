@@ -0,0 +1,210 @@
+#ifndef __capcache_H__
+#define __capcache_H__
+
+/*
+    Capabilities and last settings of the cameras, cached in a file per serial number + firmware version, so that an
+    open is Toupcam_Open, two queries for the key, the settings of the last session and Toupcam_StartXXXX: the probes of
+    the capabilities (resolutions, pixel formats, exposure / gain ranges, speed, bit depth), a control transfer each,
+    are neither needed to stream nor to fill a user interface, they are run after the first frame to refresh the cache.
+    A new firmware may change the capabilities, so it has its own entry.
+    File: one camera per line, fields separated by spaces, see load() / save(); a line which does not parse is dropped.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "toupcam.h"
+
+#define CAPCACHE_MAX_RES        16
+#define CAPCACHE_MAX_FMT        32
+
+typedef struct {
+    char            sn[32], fw[16];
+    /* capabilities */
+    unsigned        nRes, resWidth[CAPCACHE_MAX_RES], resHeight[CAPCACHE_MAX_RES];
+    unsigned        nFmt;
+    int             fmt[CAPCACHE_MAX_FMT];
+    unsigned        expoMin, expoMax, expoDef;
+    unsigned short  gainMin, gainMax, gainDef;
+    unsigned        maxSpeed, maxBitDepth;
+    int             mono;
+    /* settings at the end of the last session */
+    unsigned        eSize, expoTime;
+    unsigned short  expoGain, speed;
+    int             autoExpo, pixelFormat;
+} CamCaps;
+
+class CapCache {
+    std::vector<CamCaps> m_caps;
+
+    static bool sameCaps(const CamCaps& a, const CamCaps& b)
+    {
+        return (a.nRes == b.nRes) && (0 == memcmp(a.resWidth, b.resWidth, sizeof(a.resWidth[0]) * a.nRes))
+            && (0 == memcmp(a.resHeight, b.resHeight, sizeof(a.resHeight[0]) * a.nRes))
+            && (a.nFmt == b.nFmt) && (0 == memcmp(a.fmt, b.fmt, sizeof(a.fmt[0]) * a.nFmt))
+            && (a.expoMin == b.expoMin) && (a.expoMax == b.expoMax) && (a.expoDef == b.expoDef)
+            && (a.gainMin == b.gainMin) && (a.gainMax == b.gainMax) && (a.gainDef == b.gainDef)
+            && (a.maxSpeed == b.maxSpeed) && (a.maxBitDepth == b.maxBitDepth) && (a.mono == b.mono);
+    }
+public:
+    bool load(const char* path)
+    {
+        m_caps.clear();
+        FILE* fp = fopen(path, "r");
+        if (NULL == fp)
+            return false;
+        char line[1024];
+        while (fgets(line, sizeof(line), fp))
+        {
+            CamCaps c;
+            memset(&c, 0, sizeof(c));
+            int n = 0;
+            char* p = line;
+            if ((sscanf(p, "%31s %15s %u%n", c.sn, c.fw, &c.nRes, &n) != 3) || (c.nRes > CAPCACHE_MAX_RES))
+                continue;
+            p += n;
+            bool bok = true;
+            for (unsigned i = 0; bok && (i < c.nRes); ++i, p += n)
+                bok = (2 == sscanf(p, "%u %u%n", &c.resWidth[i], &c.resHeight[i], &n));
+            bok = bok && (1 == sscanf(p, "%u%n", &c.nFmt, &n)) && (c.nFmt <= CAPCACHE_MAX_FMT);
+            if (bok)
+                p += n;
+            for (unsigned i = 0; bok && (i < c.nFmt); ++i, p += n)
+                bok = (1 == sscanf(p, "%d%n", &c.fmt[i], &n));
+            bok = bok && (15 == sscanf(p, "%u %u %u %hu %hu %hu %u %u %d %u %u %hu %hu %d %d", &c.expoMin, &c.expoMax, &c.expoDef,
+                &c.gainMin, &c.gainMax, &c.gainDef, &c.maxSpeed, &c.maxBitDepth, &c.mono,
+                &c.eSize, &c.expoTime, &c.expoGain, &c.speed, &c.autoExpo, &c.pixelFormat));
+            if (bok)
+                m_caps.push_back(c);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    bool save(const char* path) const
+    {
+        FILE* fp = fopen(path, "w");
+        if (NULL == fp)
+            return false;
+        for (size_t k = 0; k < m_caps.size(); ++k)
+        {
+            const CamCaps& c = m_caps[k];
+            fprintf(fp, "%s %s %u", c.sn, c.fw, c.nRes);
+            for (unsigned i = 0; i < c.nRes; ++i)
+                fprintf(fp, " %u %u", c.resWidth[i], c.resHeight[i]);
+            fprintf(fp, " %u", c.nFmt);
+            for (unsigned i = 0; i < c.nFmt; ++i)
+                fprintf(fp, " %d", c.fmt[i]);
+            fprintf(fp, " %u %u %u %hu %hu %hu %u %u %d %u %u %hu %hu %d %d\n", c.expoMin, c.expoMax, c.expoDef,
+                c.gainMin, c.gainMax, c.gainDef, c.maxSpeed, c.maxBitDepth, c.mono,
+                c.eSize, c.expoTime, c.expoGain, c.speed, c.autoExpo, c.pixelFormat);
+        }
+        fclose(fp);
+        return true;
+    }
+
+    const CamCaps* find(const char* sn, const char* fw) const
+    {
+        for (size_t k = 0; k < m_caps.size(); ++k)
+        {
+            if ((0 == strcmp(m_caps[k].sn, sn)) && (0 == strcmp(m_caps[k].fw, fw)))
+                return &m_caps[k];
+        }
+        return NULL;
+    }
+
+    /* add or replace; true if the capabilities of the entry changed */
+    bool put(const CamCaps& c)
+    {
+        for (size_t k = 0; k < m_caps.size(); ++k)
+        {
+            if ((0 == strcmp(m_caps[k].sn, c.sn)) && (0 == strcmp(m_caps[k].fw, c.fw)))
+            {
+                const bool bChanged = !sameCaps(m_caps[k], c);
+                m_caps[k] = c;
+                return bChanged;
+            }
+        }
+        m_caps.push_back(c);
+        return true;
+    }
+
+    static HRESULT key(HToupcam h, CamCaps* pCaps)
+    {
+        memset(pCaps, 0, sizeof(CamCaps));
+        HRESULT hr = Toupcam_get_SerialNumber(h, pCaps->sn);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_get_FwVersion(h, pCaps->fw);
+        /* the file is split at spaces */
+        for (char* p = pCaps->sn; *p; ++p)
+            *p = (*p <= ' ') ? '_' : *p;
+        for (char* p = pCaps->fw; *p; ++p)
+            *p = (*p <= ' ') ? '_' : *p;
+        return hr;
+    }
+
+    /* the slow part, any time after Toupcam_Open, while streaming too */
+    static void probe(HToupcam h, CamCaps* pCaps)
+    {
+        const int nRes = Toupcam_get_ResolutionNumber(h);
+        pCaps->nRes = 0;
+        for (int i = 0; (i < nRes) && (i < CAPCACHE_MAX_RES); ++i)
+        {
+            int w = 0, hh = 0;
+            if (SUCCEEDED(Toupcam_get_Resolution(h, i, &w, &hh)))
+            {
+                pCaps->resWidth[pCaps->nRes] = w;
+                pCaps->resHeight[pCaps->nRes++] = hh;
+            }
+        }
+        int nFmt = 0;
+        pCaps->nFmt = 0;
+        if (SUCCEEDED(Toupcam_get_PixelFormatSupport(h, -1, &nFmt)))
+        {
+            for (int i = 0; (i < nFmt) && (i < CAPCACHE_MAX_FMT); ++i)
+            {
+                if (SUCCEEDED(Toupcam_get_PixelFormatSupport(h, (char)i, &pCaps->fmt[pCaps->nFmt])))
+                    ++pCaps->nFmt;
+            }
+        }
+        Toupcam_get_ExpTimeRange(h, &pCaps->expoMin, &pCaps->expoMax, &pCaps->expoDef);
+        Toupcam_get_ExpoAGainRange(h, &pCaps->gainMin, &pCaps->gainMax, &pCaps->gainDef);
+        pCaps->maxSpeed = Toupcam_get_MaxSpeed(h);
+        pCaps->maxBitDepth = Toupcam_get_MaxBitDepth(h);
+        pCaps->mono = (0 == Toupcam_get_MonoMode(h)) ? 1 : 0;
+    }
+
+    /* before Toupcam_Close */
+    static void saveSettings(HToupcam h, CamCaps* pCaps)
+    {
+        Toupcam_get_eSize(h, &pCaps->eSize);
+        Toupcam_get_ExpoTime(h, &pCaps->expoTime);
+        Toupcam_get_ExpoAGain(h, &pCaps->expoGain);
+        Toupcam_get_Speed(h, &pCaps->speed);
+        Toupcam_get_AutoExpoEnable(h, &pCaps->autoExpo);
+        Toupcam_get_Option(h, TOUPCAM_OPTION_PIXEL_FORMAT, &pCaps->pixelFormat);
+    }
+
+    /* before Toupcam_StartXXXX; the first failure, the others are still applied */
+    static HRESULT applySettings(HToupcam h, const CamCaps& c)
+    {
+        HRESULT hr = 0, r;
+        if (FAILED(r = Toupcam_put_eSize(h, c.eSize)))
+            hr = r;
+        if (FAILED(r = Toupcam_put_Option(h, TOUPCAM_OPTION_PIXEL_FORMAT, c.pixelFormat)) && SUCCEEDED(hr))
+            hr = r;
+        if (FAILED(r = Toupcam_put_Speed(h, c.speed)) && SUCCEEDED(hr))
+            hr = r;
+        if (FAILED(r = Toupcam_put_AutoExpoEnable(h, c.autoExpo)) && SUCCEEDED(hr))
+            hr = r;
+        if (!c.autoExpo)
+        {
+            if (FAILED(r = Toupcam_put_ExpoTime(h, c.expoTime)) && SUCCEEDED(hr))
+                hr = r;
+            if (FAILED(r = Toupcam_put_ExpoAGain(h, c.expoGain)) && SUCCEEDED(hr))
+                hr = r;
+        }
+        return hr;
+    }
+};
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef __clocksync_H__
+#define __clocksync_H__
+
+/*
+    The camera clock on the host clock, with its drift, from the frames alone.
+    The timestamp of a frame (ToupcamFrameInfoV3.timestamp, TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP) counts microseconds of
+    the camera, from its start or from TOUPCAM_OPTION_RESET_SEQ_TIMESTAMP; only the GPS models also put UTC in the
+    frame (utcstart / utcend, TOUPCAM_FRAMEINFO_FLAG_GPS). ClockSync maps the timestamp to HostMicroseconds() of
+    stagetrack.h, the steady clock the stage samples, the UART and the other cameras are put on, without a call to
+    the camera: every frame gives a point, arrival - timestamp, which is the offset of the clocks plus the transfer of
+    that frame. The fastest frames lie on a line, the offset and the drift (the two crystals differ by tens of ppm:
+    FrameClock of stagetrack.h, which takes the minimum alone, goes off by tens of us per second): the minimum of
+    each CLOCKSYNC_WINDOW_US of host time is a point of the fit, a least squares line over the last CLOCKSYNC_WINDOWS
+    of them, refitted without the points more than CLOCKSYNC_OUTLIER_US above it (windows where every frame was late:
+    a busy host, a full link). Before CLOCKSYNC_MIN_WINDOWS points there is the offset only.
+    toHost() converts a timestamp, rms() is the spread of the windows about the line, the alignment to expect between
+    two cameras (or a camera and the stage) once both are locked; the transfer of the fastest frame, which the host
+    cannot see, is CLOCKSYNC_LATENCY_US, the same for every camera of a model.
+    A timestamp going back (TOUPCAM_OPTION_RESET_SEQ_TIMESTAMP, a restart with TOUPCAM_OPTION_MODE_SEQ_TIMESTAMP 0)
+    starts the fit again and increments epoch(); the timestamps of before are no longer converted right.
+    frameTime() is the host time of the middle of the exposure of a frame, from utcstart / utcend where the camera has
+    GPS (UTC on the host by the system clock, as good as its NTP), from the fit otherwise. The API has no control of
+    IEEE 1588: a GigE camera whose clock is disciplined by PTP shows the drift of the host against the grandmaster,
+    and aligns with the other PTP cameras by the same fit.
+    frame() from the thread pulling the frames (the event callback), with the host time of TOUPCAM_EVENT_IMAGE taken
+    first; toHost() and the rest from any thread.
+*/
+#include <math.h>
+#include <mutex>
+#include <chrono>
+#include "toupcam.h"
+#include "stagetrack.h"
+
+#define CLOCKSYNC_WINDOW_US     1000000 /* host time of one point */
+#define CLOCKSYNC_WINDOWS       60      /* points of the fit, a minute */
+#define CLOCKSYNC_MIN_WINDOWS   4       /* points before the drift is fitted */
+#define CLOCKSYNC_OUTLIER_US    100     /* above the line: left out of the fit */
+#define CLOCKSYNC_LATENCY_US    0       /* calibrate: end of exposure to TOUPCAM_EVENT_IMAGE of the fastest frame */
+
+/* ClockSync::state() */
+#define CLOCKSYNC_NONE          0       /* no timestamp yet */
+#define CLOCKSYNC_OFFSET        1       /* the minimum so far, no drift */
+#define CLOCKSYNC_LOCKED        2       /* offset and drift fitted */
+
+class ClockSync {
+    struct Point {
+        long long ts, d;        /* camera us, host - camera us */
+    };
+    Point m_pt[CLOCKSYNC_WINDOWS];
+    unsigned m_head, m_count;   /* m_head: next slot to write */
+    Point m_win;                /* the minimum of the open window */
+    long long m_winStart;       /* host us */
+    bool m_bWin;
+    unsigned long long m_last;  /* the last timestamp */
+    bool m_bLast;
+    int m_state;
+    double m_ref, m_offset, m_slope, m_rms;     /* host - camera = m_offset + m_slope * (ts - m_ref) */
+    unsigned m_used, m_epoch;
+    mutable std::mutex m_mtx;
+
+    const Point& point(unsigned i) const    /* 0 = the oldest */
+    {
+        return m_pt[(m_head + CLOCKSYNC_WINDOWS - m_count + i) % CLOCKSYNC_WINDOWS];
+    }
+
+    /* least squares over the points within limit above the last line (all of them, limit < 0); false: fewer than 2 */
+    bool line(double limit, double ref, double* pOffset, double* pSlope, double* pRms, unsigned* pUsed) const
+    {
+        double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+        unsigned n = 0;
+        for (unsigned i = 0; i < m_count; ++i)
+        {
+            const Point& p = point(i);
+            const double x = p.ts - ref, y = (double)p.d;
+            if ((limit >= 0.0) && (y - (m_offset + m_slope * x) > limit))
+                continue;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+            ++n;
+        }
+        const double den = n * sxx - sx * sx;
+        if ((n < 2) || (den <= 0.0))
+            return false;
+        *pSlope = (n * sxy - sx * sy) / den;
+        *pOffset = (sy - *pSlope * sx) / n;
+        double ss = 0.0;
+        for (unsigned i = 0; i < m_count; ++i)
+        {
+            const Point& p = point(i);
+            const double x = p.ts - ref, r = p.d - (*pOffset + *pSlope * x);
+            if ((limit < 0.0) || (p.d - (m_offset + m_slope * x) <= limit))
+                ss += r * r;
+        }
+        *pRms = sqrt(ss / n);
+        *pUsed = n;
+        return true;
+    }
+
+    /* m_mtx held */
+    void fit()
+    {
+        if (m_count < CLOCKSYNC_MIN_WINDOWS)
+        {
+            long long d = m_win.d;
+            for (unsigned i = 0; i < m_count; ++i)
+            {
+                if (point(i).d < d)
+                    d = point(i).d;
+            }
+            m_ref = (double)m_win.ts;
+            m_offset = (double)d;
+            m_slope = m_rms = 0.0;
+            m_used = m_count;
+            m_state = CLOCKSYNC_OFFSET;
+            return;
+        }
+        const double ref = (double)point(m_count - 1).ts;
+        double offset, slope, rms;
+        unsigned used;
+        if (!line(-1.0, ref, &offset, &slope, &rms, &used))
+            return;
+        m_ref = ref;
+        m_offset = offset;
+        m_slope = slope;
+        /* again without the late windows, if enough are left */
+        if (line(CLOCKSYNC_OUTLIER_US, ref, &offset, &slope, &rms, &used) && (used >= CLOCKSYNC_MIN_WINDOWS))
+        {
+            m_offset = offset;
+            m_slope = slope;
+        }
+        m_rms = rms;
+        m_used = used;
+        m_state = CLOCKSYNC_LOCKED;
+    }
+
+    /* m_mtx held */
+    void clear()
+    {
+        m_head = m_count = 0;
+        m_winStart = 0;
+        m_bWin = m_bLast = false;
+        m_last = 0;
+        m_state = CLOCKSYNC_NONE;
+        m_ref = m_offset = m_slope = m_rms = 0.0;
+        m_used = 0;
+    }
+
+    /* m_mtx held */
+    long long convert(unsigned long long timestamp) const
+    {
+        const double ts = (double)timestamp;
+        return (long long)floor(ts + m_offset + m_slope * (ts - m_ref) - CLOCKSYNC_LATENCY_US + 0.5);
+    }
+public:
+    ClockSync()
+    : m_epoch(0)
+    {
+        reset();
+    }
+
+    /* the fit dropped; a new camera, or one whose timestamp was reset */
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        clear();
+    }
+
+    /* every frame pulled, tArrival: HostMicroseconds() of its TOUPCAM_EVENT_IMAGE */
+    void frame(const ToupcamFrameInfoV3& info, long long tArrival)
+    {
+        if (0 == (info.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP))
+            return;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_bLast && (info.timestamp < m_last))
+        {
+            clear();
+            ++m_epoch;
+        }
+        m_last = info.timestamp;
+        m_bLast = true;
+        const long long d = tArrival - (long long)info.timestamp;
+        if (m_bWin && (tArrival - m_winStart >= CLOCKSYNC_WINDOW_US))
+        {
+            m_pt[m_head] = m_win;
+            m_head = (m_head + 1) % CLOCKSYNC_WINDOWS;
+            if (m_count < CLOCKSYNC_WINDOWS)
+                ++m_count;
+            m_bWin = false;
+            fit();
+        }
+        if ((!m_bWin) || (d < m_win.d))
+        {
+            m_win.ts = (long long)info.timestamp;
+            m_win.d = d;
+        }
+        if (!m_bWin)
+        {
+            m_winStart = tArrival;
+            m_bWin = true;
+        }
+        /* until the drift is fitted, the minimum so far */
+        if (m_state != CLOCKSYNC_LOCKED)
+            fit();
+    }
+
+    /* host us of a timestamp of the current epoch, -1 before the first frame */
+    long long toHost(unsigned long long timestamp) const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return (CLOCKSYNC_NONE == m_state) ? -1 : convert(timestamp);
+    }
+
+    /* the timestamp the camera has at host us */
+    unsigned long long toCamera(long long host) const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        const double ts = (host + CLOCKSYNC_LATENCY_US - m_offset + m_slope * m_ref) / (1.0 + m_slope);
+        return (ts > 0.0) ? (unsigned long long)(ts + 0.5) : 0;
+    }
+
+    /* host us of the middle of the exposure, tArrival as for frame(), which it calls */
+    long long frameTime(const ToupcamFrameInfoV4& info, long long tArrival)
+    {
+        frame(info.v3, tArrival);
+        if ((info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_GPS) && info.gps.utcstart && (info.gps.utcend >= info.gps.utcstart))
+        {
+            const long long utc = (long long)((info.gps.utcstart + (info.gps.utcend - info.gps.utcstart) / 2) / 1000);
+            const long long now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            return utc + (HostMicroseconds() - now);
+        }
+        long long t = tArrival;
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            t = convert(info.v3.timestamp);
+        }
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_EXPOTIME)
+            t -= info.v3.expotime / 2;  /* the timestamp is taken as the end of the exposure */
+        return t;
+    }
+
+    int state() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_state;
+    }
+
+    /* host - camera, us, now */
+    double offset() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_offset + m_slope * ((double)m_last - m_ref);
+    }
+
+    /* of the camera clock against the host, ppm: > 0 runs fast */
+    double drift() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return -m_slope / (1.0 + m_slope) * 1e6;
+    }
+
+    /* us, of the points fitted */
+    double rms() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_rms;
+    }
+
+    /* points in the fit, the late windows left out */
+    unsigned used() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_used;
+    }
+
+    unsigned epoch() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_epoch;
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef __cvfilter_H__
+#define __cvfilter_H__
+
+/*
+    Denoise and sharpening of the RGB24 frames on the GPU (OpenCV CUDA) instead of the CPU of the SDK.
+    TOUPCAM_OPTION_DENOISE and TOUPCAM_OPTION_SHARPENING run in the pipeline of the SDK, on the host CPU, for every
+    pixel: at 25 MP they set the frame rate. CvFilter takes the two values as the SDK has them and, with a CUDA device,
+    sets both options to 0 and applies the filters itself to the frames uploaded by CvPinnedPool (cvpinned.h), queued
+    on the stream of the caller:
+    denoise [1, 100]    edge preserving, cv::cuda::bilateralFilter: sigma color = 0.6 x strength (levels of 8 bits),
+                        sigma space = 1 + strength / 25, the kernel 2 x ceil(2 x sigma space) + 1
+    sharpening          unsharp mask, (threshold << 24) | (radius << 16) | strength as TOUPCAM_OPTION_SHARPENING:
+                        out = in + strength / 100 x (in - gauss(in)), gauss of sigma radius / 2 on 2 x radius + 1,
+                        only where the grey of |in - gauss(in)| > threshold
+    The curves of the SDK are not documented, these are of the same kind, not the same numbers: set the strengths by eye.
+    Without a CUDA device, for a format other than RGB24 (bits 24), or after an exception of the GPU (out of device
+    memory, a lost device), CvFilter puts the values back into the SDK and gpu() is false: the frames come already
+    filtered by the CPU and apply() passes them through, so the caller has the one path either way.
+    In the option of the SDK the filters run on the stills too (Toupcam_Snap): so do they here, pass the still to apply().
+    The intermediate GpuMat are members, sized on the first frame, so a stream allocates no device memory.
+*/
+#include <math.h>
+#include "opencv2/core.hpp"
+#include "opencv2/core/cuda.hpp"
+#include "opencv2/cudaarithm.hpp"
+#include "opencv2/cudaimgproc.hpp"
+#include "opencv2/cudafilters.hpp"
+#include "toupcam.h"
+
+class CvFilter {
+    HToupcam m_hcam;
+    int m_denoise;
+    unsigned m_sharpening;
+    bool m_bGpu;
+    cv::Ptr<cv::cuda::Filter> m_gauss;
+    cv::cuda::GpuMat m_denoised, m_bgra, m_blur, m_sharp, m_diff, m_grey, m_mask, m_masked, m_out;
+
+    void fallback()
+    {
+        if (m_bGpu && m_hcam)
+        {
+            Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_DENOISE, m_denoise);
+            Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_SHARPENING, (int)m_sharpening);
+        }
+        m_bGpu = false;
+        m_gauss.release();
+    }
+public:
+    CvFilter()
+    : m_hcam(NULL), m_denoise(0), m_sharpening(0), m_bGpu(false)
+    {
+    }
+
+    /* denoise, sharpening: the values of TOUPCAM_OPTION_DENOISE and TOUPCAM_OPTION_SHARPENING; bits: of the pull */
+    HRESULT init(HToupcam h, int denoise, unsigned sharpening, int bits = 24)
+    {
+        if ((NULL == h) || (denoise < 0) || (denoise > 100) || ((sharpening & 0xffff) > 500) || (((sharpening >> 16) & 0xff) > 10))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        m_hcam = h;
+        m_denoise = denoise;
+        m_sharpening = sharpening;
+        m_bGpu = (24 == bits) && (cv::cuda::getCudaEnabledDeviceCount() > 0);
+        if (m_bGpu)
+        {
+            const unsigned strength = sharpening & 0xffff, radius = ((sharpening >> 16) & 0xff) ? ((sharpening >> 16) & 0xff) : 1;
+            try
+            {
+                if (strength)
+                    m_gauss = cv::cuda::createGaussianFilter(CV_8UC4, CV_8UC4, cv::Size(2 * radius + 1, 2 * radius + 1), radius / 2.0);
+            }
+            catch (const cv::Exception&)
+            {
+                m_bGpu = false;
+            }
+        }
+        HRESULT hr = Toupcam_put_Option(h, TOUPCAM_OPTION_DENOISE, m_bGpu ? 0 : denoise);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_put_Option(h, TOUPCAM_OPTION_SHARPENING, m_bGpu ? 0 : (int)sharpening);
+        return hr;
+    }
+
+    bool gpu() const { return m_bGpu; }
+
+    /*
+        src: a frame of CvPinnedPool, BGR or RGB 8 bits; dst: the filtered frame, src itself when there is nothing to do
+        on the GPU, otherwise a member valid until the next apply(). Queued on stream, the caller waits for it (or
+        releases the slot of src on it). false: the GPU failed, dst is src unfiltered and the SDK filters the next frames.
+    */
+    bool apply(const cv::cuda::GpuMat& src, cv::cuda::GpuMat& dst, cv::cuda::Stream& stream)
+    {
+        dst = src;
+        if (!m_bGpu)
+            return true;
+        const unsigned strength = m_sharpening & 0xffff, threshold = m_sharpening >> 24;
+        try
+        {
+            if (m_denoise > 0)
+            {
+                const float sigmaSpace = 1.0f + m_denoise / 25.0f;
+                cv::cuda::bilateralFilter(src, m_denoised, 2 * (int)ceil(2.0 * sigmaSpace) + 1, 0.6f * m_denoise, sigmaSpace, cv::BORDER_DEFAULT, stream);
+                dst = m_denoised;
+            }
+            if (strength)
+            {
+                /* the Gaussian of CUDA takes 1 or 4 channels */
+                cv::cuda::cvtColor(dst, m_bgra, cv::COLOR_BGR2BGRA, 0, stream);
+                m_gauss->apply(m_bgra, m_blur, stream);
+                cv::cuda::addWeighted(m_bgra, 1.0 + strength / 100.0, m_blur, -(strength / 100.0), 0, m_sharp, -1, stream);
+                const cv::cuda::GpuMat* sharp = &m_sharp;
+                if (threshold)
+                {
+                    cv::cuda::absdiff(m_bgra, m_blur, m_diff, stream);
+                    cv::cuda::cvtColor(m_diff, m_grey, cv::COLOR_BGRA2GRAY, 0, stream);
+                    cv::cuda::threshold(m_grey, m_mask, threshold, 255, cv::THRESH_BINARY, stream);
+                    m_bgra.copyTo(m_masked, stream);
+                    m_sharp.copyTo(m_masked, m_mask, stream);
+                    sharp = &m_masked;
+                }
+                cv::cuda::cvtColor(*sharp, m_out, cv::COLOR_BGRA2BGR, 0, stream);
+                dst = m_out;
+            }
+            return true;
+        }
+        catch (const cv::Exception&)
+        {
+            dst = src;
+            fallback();
+            return false;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef __cvpinned_H__
+#define __cvpinned_H__
+
+/*
+    Frames pulled straight into CUDA page-locked memory and uploaded to a cv::cuda::GpuMat on a stream of the program.
+    The usual path (demoopencv4) pulls into malloc'd memory: an upload from pageable memory is staged by the driver
+    through a pinned buffer of its own, one more copy, and it is synchronous whatever the stream. Pulled into pinned
+    memory (cv::cuda::HostMem PAGE_LOCKED, from cudaHostAlloc), the upload is one DMA, asynchronous on the stream,
+    and the next frame can be pulled while the previous one is still on its way to the GPU.
+    CvPinnedPool holds the slots, each a pinned host buffer and a device buffer of the largest resolution, allocated
+    once in init(). pull() takes a free slot, pulls the frame into its host buffer (Toupcam_WaitImageV4 with the row
+    pitch of the HostMem), and with a stream starts the upload (GpuMat::upload, that is cudaMemcpy2DAsync) and records
+    an event after it. The frame comes with both the host Mat and the GpuMat, of the size of the frame.
+    release() hands the slot back; with the stream the GPU work on frame.gpu was queued on, the slot is reused only
+    once that work is done (an event recorded there), so a kernel still reading the device buffer is never
+    overwritten. pull() returns E_OUTOFMEMORY while no slot is free: the frame stays in the SDK.
+    OpenCV without CUDA (or no device): init() falls back to ordinary memory and pull() only fills the host Mat;
+    pinned() tells which. RGB24 (bits 24, CV_8UC3), RGB48 (48, CV_16UC3), grey (8, CV_8UC1, or 16, CV_16UC1).
+*/
+#include <string.h>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "opencv2/core/cuda.hpp"
+#include "toupcam.h"
+
+typedef struct {
+    cv::Mat host;                   /* the frame in pinned memory, valid until release() */
+    cv::cuda::GpuMat gpu;           /* empty without a stream (or without CUDA) */
+    ToupcamFrameInfoV4 info;
+    int index;                      /* of the slot */
+} CvPinnedFrame;
+
+class CvPinnedPool {
+    struct Slot {
+        cv::cuda::HostMem host;
+        cv::Mat plain;              /* no CUDA */
+        cv::cuda::GpuMat dev;
+        cv::Ptr<cv::cuda::Event> done;  /* recorded after the last GPU work on the slot; an Event needs CUDA to construct */
+        bool busy;
+    };
+    HToupcam m_hcam;
+    int m_bits, m_type;
+    bool m_bPinned;
+    std::vector<Slot> m_slot;
+
+    static int cvType(int bits)
+    {
+        switch (bits)
+        {
+        case 8: return CV_8UC1;
+        case 16: return CV_16UC1;
+        case 48: return CV_16UC3;
+        default: return CV_8UC3;
+        }
+    }
+public:
+    CvPinnedPool()
+    : m_hcam(NULL), m_bits(24), m_type(CV_8UC3), m_bPinned(false)
+    {
+    }
+
+    /* slots: the frames in flight at once (pulled, uploading, processed), 3 or so */
+    HRESULT init(HToupcam h, unsigned slots, int bits = 24)
+    {
+        if ((NULL == h) || (0 == slots) || ((8 != bits) && (16 != bits) && (24 != bits) && (48 != bits)))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        int w = 0, hgt = 0;
+        HRESULT hr = Toupcam_get_Resolution(h, 0, &w, &hgt);
+        if (FAILED(hr))
+            return hr;
+        m_hcam = h;
+        m_bits = bits;
+        m_type = cvType(bits);
+        m_slot.clear();
+        m_slot.resize(slots);
+        m_bPinned = (cv::cuda::getCudaEnabledDeviceCount() > 0);
+        try
+        {
+            for (size_t i = 0; i < m_slot.size(); ++i)
+            {
+                m_slot[i].busy = false;
+                if (m_bPinned)
+                {
+                    m_slot[i].host.create(hgt, w, m_type);
+                    m_slot[i].dev.create(hgt, w, m_type);
+                    m_slot[i].done = cv::makePtr<cv::cuda::Event>(cv::cuda::Event::DISABLE_TIMING);
+                }
+                else
+                    m_slot[i].plain.create(hgt, w, m_type);
+            }
+        }
+        catch (const cv::Exception&)
+        {
+            m_slot.clear();
+            return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+        }
+        return 0;   /* S_OK */
+    }
+
+    bool pinned() const { return m_bPinned; }
+
+    /*
+        nWaitMS: 0 for a frame which is there already (on TOUPCAM_EVENT_IMAGE), as Toupcam_WaitImageV4 otherwise;
+        pStream: start the upload on it, NULL for the host frame only
+    */
+    HRESULT pull(unsigned nWaitMS, CvPinnedFrame* pFrame, cv::cuda::Stream* pStream = NULL)
+    {
+        int index = -1;
+        for (size_t i = 0; i < m_slot.size(); ++i)
+        {
+            if ((!m_slot[i].busy) && ((!m_bPinned) || m_slot[i].done->queryIfComplete()))
+            {
+                index = (int)i;
+                break;
+            }
+        }
+        if (index < 0)
+            return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+        Slot& s = m_slot[index];
+        cv::Mat whole = m_bPinned ? s.host.createMatHeader() : s.plain;
+        ToupcamFrameInfoV4 info;
+        memset(&info, 0, sizeof(info));
+        const HRESULT hr = Toupcam_WaitImageV4(m_hcam, nWaitMS, whole.data, 0, m_bits, (int)whole.step, &info);
+        if (FAILED(hr))
+            return hr;
+        const cv::Rect roi(0, 0, (int)info.v3.width, (int)info.v3.height);
+        pFrame->host = whole(roi);
+        pFrame->gpu = cv::cuda::GpuMat();
+        pFrame->info = info;
+        pFrame->index = index;
+        s.busy = true;
+        if (m_bPinned && pStream)
+        {
+            pFrame->gpu = s.dev(roi);
+            pFrame->gpu.upload(pFrame->host, *pStream);
+            s.done->record(*pStream);
+        }
+        return hr;
+    }
+
+    /* pStream: where the work on frame.gpu was queued, the slot waits for it; NULL: the work is over (or there was none) */
+    void release(const CvPinnedFrame& frame, cv::cuda::Stream* pStream = NULL)
+    {
+        if ((frame.index < 0) || (frame.index >= (int)m_slot.size()))
+            return;
+        Slot& s = m_slot[frame.index];
+        if (m_bPinned && pStream)
+            s.done->record(*pStream);
+        s.busy = false;
+    }
+};
+
+#endif
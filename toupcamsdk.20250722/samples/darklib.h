@@ -0,0 +1,297 @@
+#ifndef __darklib_H__
+#define __darklib_H__
+
+/*
+    Library of dark frames indexed by exposure time, gain and sensor temperature, for the host dark field correction
+    (hostffc.h): the darks are taken once, for the exposures of the protocol (brightfield, fluorescence) and the set
+    points of the cooler, and the dark of any other condition is interpolated from them, so a change of exposure or
+    of TEC target takes no new dark acquisition. TOUPCAM_OPTION_DFC / Toupcam_DfcImport hold one dark in a format
+    private to the camera, which cannot be interpolated; get() gives the frame for HostFfc::putDark instead.
+    get(): the gain is the nearest one of the library (the dark does not follow the gain linearly), then at the two
+    temperatures around the one asked (the nearest when it is outside), the dark is linear in the exposure time between
+    the two exposures around the one asked, extrapolated from the two nearest beyond them (offset + dark current per
+    second); the two temperatures are then interpolated linearly, the result is clamped to 0 ... 65535.
+    The library lives in RAM; save() / load() keep it in a file, saveFlash() / loadFlash() in the flash of the camera
+    (Toupcam_rwc_Flash, as far as it fits; see TOUPCAM_FLASH_SIZE), both in the same layout: DarkLibHeader, then for
+    every entry its DarkLibKey and width x height samples of 16 bits. In the flash the layout is the data of a CamBlob
+    (camblob.h: large chunks, progress, CRC), tag DARKLIB_TAG; loadFlash() still reads a library saved bare, before.
+    blob() / parse() are the layout in memory, for a CamBlob driven by the caller (readAsync at open, say).
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include "toupcam.h"
+#include "camblob.h"
+
+#define DARKLIB_MAGIC       "TDARKLIB"
+#define DARKLIB_TAG         0x4b524144  /* "DARK", CamBlobHeader::tag */
+
+typedef struct {
+    unsigned expoTime;          /* microseconds, ToupcamFrameInfoV3::expotime */
+    unsigned short expoGain;    /* percent, ToupcamFrameInfoV3::expogain */
+    short temperature;          /* 0.1 degree Celsius, Toupcam_get_Temperature; 0 without a sensor */
+} DarkLibKey;
+
+typedef struct {
+    char magic[8];
+    unsigned width, height;
+    unsigned bitdepth;
+    unsigned entries;
+} DarkLibHeader;
+
+class DarkLib {
+    struct Entry {
+        DarkLibKey key;
+        std::vector<unsigned short> dark;
+    };
+    unsigned m_width, m_height, m_bitdepth;
+    std::vector<Entry> m_entries;
+
+    size_t count() const { return (size_t)m_width * m_height; }
+
+    /* weights of the entries at gain and temperature t for the exposure e: between the two around it, or the two nearest */
+    void exposureWeights(unsigned short gain, short t, double e, double w, std::vector<std::pair<size_t, double> >& out) const
+    {
+        std::vector<size_t> idx;
+        for (size_t i = 0; i < m_entries.size(); ++i)
+        {
+            if ((m_entries[i].key.expoGain == gain) && (m_entries[i].key.temperature == t))
+                idx.push_back(i);
+        }
+        std::sort(idx.begin(), idx.end(), [this](size_t a, size_t b) { return m_entries[a].key.expoTime < m_entries[b].key.expoTime; });
+        if (1 == idx.size())
+        {
+            out.push_back(std::make_pair(idx[0], w));
+            return;
+        }
+        size_t k = 1;
+        while ((k + 1 < idx.size()) && (m_entries[idx[k]].key.expoTime < e))
+            ++k;
+        const double e0 = m_entries[idx[k - 1]].key.expoTime, e1 = m_entries[idx[k]].key.expoTime;
+        const double f = (e - e0) / (e1 - e0);
+        out.push_back(std::make_pair(idx[k - 1], w * (1 - f)));
+        out.push_back(std::make_pair(idx[k], w * f));
+    }
+
+    std::vector<unsigned char> serialize() const
+    {
+        DarkLibHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, DARKLIB_MAGIC, sizeof(header.magic));
+        header.width = m_width;
+        header.height = m_height;
+        header.bitdepth = m_bitdepth;
+        header.entries = (unsigned)m_entries.size();
+        const size_t bytes = count() * sizeof(unsigned short);
+        std::vector<unsigned char> blob(sizeof(header) + m_entries.size() * (sizeof(DarkLibKey) + bytes));
+        memcpy(&blob[0], &header, sizeof(header));
+        unsigned char* p = &blob[sizeof(header)];
+        for (size_t i = 0; i < m_entries.size(); ++i)
+        {
+            memcpy(p, &m_entries[i].key, sizeof(DarkLibKey));
+            memcpy(p + sizeof(DarkLibKey), &m_entries[i].dark[0], bytes);
+            p += sizeof(DarkLibKey) + bytes;
+        }
+        return blob;
+    }
+
+    /* size of the whole library from its header, 0 if it is not one */
+    static size_t blobSize(const DarkLibHeader& header)
+    {
+        if (0 != memcmp(header.magic, DARKLIB_MAGIC, sizeof(header.magic)))
+            return 0;
+        return sizeof(header) + (size_t)header.entries * (sizeof(DarkLibKey) + (size_t)header.width * header.height * sizeof(unsigned short));
+    }
+
+    bool parse(const unsigned char* p, size_t length)
+    {
+        DarkLibHeader header;
+        if (length < sizeof(header))
+            return false;
+        memcpy(&header, p, sizeof(header));
+        const size_t size = blobSize(header);
+        if ((0 == size) || (size > length))
+            return false;
+        init(header.width, header.height, header.bitdepth);
+        const size_t bytes = count() * sizeof(unsigned short);
+        p += sizeof(header);
+        for (unsigned i = 0; i < header.entries; ++i)
+        {
+            Entry e;
+            memcpy(&e.key, p, sizeof(DarkLibKey));
+            e.dark.resize(count());
+            memcpy(&e.dark[0], p + sizeof(DarkLibKey), bytes);
+            m_entries.push_back(e);
+            p += sizeof(DarkLibKey) + bytes;
+        }
+        return true;
+    }
+public:
+    DarkLib()
+    : m_width(0), m_height(0), m_bitdepth(8)
+    {
+    }
+
+    /* an empty library for frames of this size, bitdepth as in HostFfc */
+    void init(unsigned width, unsigned height, unsigned bitdepth)
+    {
+        m_width = width;
+        m_height = height;
+        m_bitdepth = bitdepth;
+        m_entries.clear();
+    }
+
+    unsigned width() const { return m_width; }
+    unsigned height() const { return m_height; }
+    unsigned bitdepth() const { return m_bitdepth; }
+    size_t size() const { return m_entries.size(); }
+    const DarkLibKey& key(size_t i) const { return m_entries[i].key; }
+
+    /* add the dark of key, HostFfc::dark, or replace the one of the same key */
+    void put(const DarkLibKey& key, const unsigned short* dark)
+    {
+        size_t i = 0;
+        while ((i < m_entries.size()) && ((m_entries[i].key.expoTime != key.expoTime) || (m_entries[i].key.expoGain != key.expoGain) || (m_entries[i].key.temperature != key.temperature)))
+            ++i;
+        if (i == m_entries.size())
+            m_entries.push_back(Entry());
+        m_entries[i].key = key;
+        m_entries[i].dark.assign(dark, dark + count());
+    }
+
+    /* the dark of key for HostFfc::putDark, width() x height(); false when the library is empty */
+    bool get(const DarkLibKey& key, unsigned short* dark) const
+    {
+        if (m_entries.empty())
+            return false;
+        unsigned short gain = m_entries[0].key.expoGain;
+        for (size_t i = 1; i < m_entries.size(); ++i)
+        {
+            if (abs((int)m_entries[i].key.expoGain - key.expoGain) < abs((int)gain - key.expoGain))
+                gain = m_entries[i].key.expoGain;
+        }
+        /* the temperatures around key at this gain, t0 <= key <= t1, or the nearest one twice */
+        bool b0 = false, b1 = false;
+        short t0 = 0, t1 = 0;
+        for (size_t i = 0; i < m_entries.size(); ++i)
+        {
+            const short t = m_entries[i].key.temperature;
+            if (m_entries[i].key.expoGain != gain)
+                continue;
+            if ((t <= key.temperature) && ((!b0) || (t > t0)))
+            {
+                t0 = t;
+                b0 = true;
+            }
+            if ((t >= key.temperature) && ((!b1) || (t < t1)))
+            {
+                t1 = t;
+                b1 = true;
+            }
+        }
+        if (!b0)
+            t0 = t1;
+        else if (!b1)
+            t1 = t0;
+        std::vector<std::pair<size_t, double> > w;
+        const double f = (t1 > t0) ? ((double)(key.temperature - t0) / (t1 - t0)) : 0.0;
+        exposureWeights(gain, t0, key.expoTime, 1 - f, w);
+        if (t1 != t0)
+            exposureWeights(gain, t1, key.expoTime, f, w);
+
+        for (size_t i = 0; i < count(); ++i)
+        {
+            double v = 0.5;
+            for (size_t k = 0; k < w.size(); ++k)
+                v += w[k].second * m_entries[w[k].first].dark[i];
+            dark[i] = (unsigned short)std::min(65535.0, std::max(0.0, v));
+        }
+        return true;
+    }
+
+    bool save(const char* filename) const
+    {
+        FILE* fp = fopen(filename, "wb");
+        if (NULL == fp)
+            return false;
+        const std::vector<unsigned char> blob = serialize();
+        const bool ret = (fwrite(&blob[0], 1, blob.size(), fp) == blob.size());
+        fclose(fp);
+        return ret;
+    }
+
+    bool load(const char* filename)
+    {
+        FILE* fp = fopen(filename, "rb");
+        if (NULL == fp)
+            return false;
+        std::vector<unsigned char> blob;
+        unsigned char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            blob.insert(blob.end(), buf, buf + n);
+        fclose(fp);
+        return (!blob.empty()) && parse(&blob[0], blob.size());
+    }
+
+    /* the layout of save(), in memory */
+    std::vector<unsigned char> blob() const { return serialize(); }
+
+    bool parse(const std::vector<unsigned char>& blob)
+    {
+        return (!blob.empty()) && parse(&blob[0], blob.size());
+    }
+
+    /* the library at addr of the flash (a multiple of the erase block), a CamBlob; funProgress: after every chunk */
+    HRESULT saveFlash(HToupcam h, unsigned addr, CAMBLOB_PROGRESS funProgress = NULL, void* ctx = NULL) const
+    {
+        const std::vector<unsigned char> data = serialize();
+        CamBlob xfer;
+        return xfer.write(h, CAMBLOB_FLASH, addr, &data[0], (unsigned)data.size(), DARKLIB_TAG, funProgress, ctx);
+    }
+
+    HRESULT loadFlash(HToupcam h, unsigned addr, CAMBLOB_PROGRESS funProgress = NULL, void* ctx = NULL)
+    {
+        CamBlob xfer;
+        HRESULT hr = xfer.read(h, CAMBLOB_FLASH, addr, funProgress, ctx);
+        if (SUCCEEDED(hr))
+            return ((DARKLIB_TAG == xfer.tag()) && parse(xfer.data())) ? 0 : (HRESULT)0x80004005;
+        if ((HRESULT)0x80004005 != hr)
+            return hr;      /* a CamBlob torn, or the flash */
+        return loadFlashBare(h, addr);
+    }
+private:
+    /* a library saved bare, before the CamBlob */
+    HRESULT loadFlashBare(HToupcam h, unsigned addr)
+    {
+        const HRESULT rwBlock = Toupcam_rwc_Flash(h, TOUPCAM_FLASH_RWBLOCK, 0, 0, NULL);
+        if (FAILED(rwBlock) || (rwBlock <= 0))
+            return FAILED(rwBlock) ? rwBlock : (HRESULT)0x80004001;
+        const size_t first = (sizeof(DarkLibHeader) + rwBlock - 1) / rwBlock * rwBlock;
+        std::vector<unsigned char> blob(first);
+        HRESULT hr = Toupcam_rwc_Flash(h, TOUPCAM_FLASH_READ, addr, (unsigned)first, &blob[0]);
+        if (FAILED(hr))
+            return hr;
+        if ((size_t)hr != first)
+            return (HRESULT)0x80004005;
+        DarkLibHeader header;
+        memcpy(&header, &blob[0], sizeof(header));
+        const size_t size = blobSize(header);
+        if (0 == size)
+            return (HRESULT)0x80004005;    /* nothing there */
+        blob.resize((size + rwBlock - 1) / rwBlock * rwBlock);
+        if (blob.size() > first)
+        {
+            hr = Toupcam_rwc_Flash(h, TOUPCAM_FLASH_READ, addr + (unsigned)first, (unsigned)(blob.size() - first), &blob[first]);
+            if (FAILED(hr))
+                return hr;
+            if ((size_t)hr != blob.size() - first)
+                return (HRESULT)0x80004005;
+        }
+        return parse(&blob[0], blob.size()) ? 0 : (HRESULT)0x80004005;
+    }
+};
+
+#endif
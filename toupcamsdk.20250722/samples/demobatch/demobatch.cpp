@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "toupcam.h"
+
+#define BATCH_MAX       16      /* also used as TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH */
+
+HToupcam g_hcam = NULL;
+void* g_pImageData[BATCH_MAX] = { 0 };
+unsigned g_total = 0, g_batch = 0;
+
+static std::mutex g_mtx;
+static std::condition_variable g_cv;
+static bool g_bPending = false, g_bStop = false;
+
+/*
+    Drain every frame which is ready in the backend deque in one go.
+    Returns the number of frames pulled into pBuf[0 .. n-1] / pInfo[0 .. n-1]; stops at E_PENDING (the deque is empty) or after num frames.
+*/
+static unsigned PullImagesV4(HToupcam h, void* pBuf[], int bits, ToupcamFrameInfoV4 pInfo[], unsigned num)
+{
+    unsigned n = 0;
+    while (n < num)
+    {
+        const HRESULT hr = Toupcam_PullImageV4(h, pBuf[n], 0, bits, 0, &pInfo[n]);
+        if (FAILED(hr))
+        {
+            if (hr != (HRESULT)0x8000000a) /* E_PENDING: no more frame in the deque */
+                printf("failed to pull image, hr = 0x%08x\n", hr);
+            break;
+        }
+        ++n;
+    }
+    return n;
+}
+
+/* the callback only wakes the consumer, many TOUPCAM_EVENT_IMAGE collapse into one wakeup when the consumer is busy */
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            g_bPending = true;
+        }
+        g_cv.notify_one();
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static void ConsumerThread()
+{
+    ToupcamFrameInfoV4 info[BATCH_MAX];
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(g_mtx);
+            g_cv.wait(lock, [] { return g_bStop || g_bPending; });
+            if (g_bStop)
+                break;
+            g_bPending = false;
+        }
+
+        unsigned n;
+        while ((n = PullImagesV4(g_hcam, g_pImageData, 24, info, BATCH_MAX)) > 0)
+        {
+            /* After we get the image data, we can do anything for the data we want to do */
+            g_total += n;
+            ++g_batch;
+            int full = 0;
+            Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_BACKEND_FULL, &full);
+            printf("pull %u image(s) ok, seq = %u .. %u, total = %u, batches = %u, backend full = %d\n", n, info[0].v3.seq, info[n - 1].v3.seq, g_total, g_batch, full);
+            if (n < BATCH_MAX)
+                break;
+        }
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        bool bOk = true;
+        for (int i = 0; (i < BATCH_MAX) && bOk; ++i)
+        {
+            g_pImageData[i] = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+            bOk = (NULL != g_pImageData[i]);
+        }
+        if (!bOk)
+            printf("failed to malloc\n");
+        else
+        {
+            /* a deeper backend deque gives the consumer room to fall behind and catch up in one batch */
+            hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, BATCH_MAX);
+            if (FAILED(hr))
+                printf("failed to set backend deque length, hr = 0x%08x\n", hr);
+            std::thread consumer(ConsumerThread);
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("press ENTER to exit\n");
+                getc(stdin);
+            }
+            {
+                std::lock_guard<std::mutex> lock(g_mtx);
+                g_bStop = true;
+            }
+            g_cv.notify_one();
+            consumer.join();
+        }
+    }
+    
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    for (int i = 0; i < BATCH_MAX; ++i)
+    {
+        if (g_pImageData[i])
+            free(g_pImageData[i]);
+    }
+    return 0;
+}
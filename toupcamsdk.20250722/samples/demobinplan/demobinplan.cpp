@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "toupcam.h"
+#include "../binplan.h"
+
+/*
+    The readout and binning for a target (samples/binplan.h): the profile of the model is measured, every
+    combination predicted, the best for the target measured and applied.
+    usage: demobinplan [width = 640] [height = 480] [fps = 30] [snr = 40]
+    In front of a static, evenly lit field at a fixed exposure. Prints the runs of the profile, the first predictions
+    and the configuration chosen.
+*/
+static void Print(const char* what, const BinConfig& c)
+{
+    printf("%-10s %-40s %5u x %-5u %7.1f fps  snr %6.1f  mean %3.0f%%\n", what, BinPlan::name(c).c_str(), c.width, c.height, c.fps, c.snr, c.mean * 100);
+}
+
+int main(int argc, char* argv[])
+{
+    BinTarget target;
+    target.width = (argc > 1) ? (unsigned)atoi(argv[1]) : 640;
+    target.height = (argc > 2) ? (unsigned)atoi(argv[2]) : 480;
+    target.fps = (argc > 3) ? atof(argv[3]) : 30;
+    target.snr = (argc > 4) ? atof(argv[4]) : 40;
+    HToupcam hcam = Toupcam_Open(NULL);
+    if (NULL == hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    BinPlan plan;
+    HRESULT hr = plan.profile(hcam);
+    if (FAILED(hr))
+        printf("failed to measure the profile, hr = 0x%08x\n", hr);
+    else
+    {
+        for (size_t i = 0; i < plan.runs().size(); ++i)
+            Print(i ? "profile" : "base", plan.runs()[i]);
+        const std::vector<BinConfig> cand = plan.predict(target);
+        for (size_t i = 0; (i < cand.size()) && (i < 5); ++i)
+            Print("predicted", cand[i]);
+        BinConfig best;
+        hr = plan.plan(target, &best);
+        if (FAILED(hr))
+            printf("failed to plan for %u x %u, %.1f fps, snr %.1f, hr = 0x%08x\n", target.width, target.height, target.fps, target.snr, hr);
+        else
+        {
+            Print((0 == hr) ? "chosen" : "nearest", best);
+            if (0 != hr)    /* S_FALSE */
+                printf("no configuration meets %.1f fps and snr %.1f at %u x %u\n", target.fps, target.snr, target.width, target.height);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(hcam);
+    return 0;
+}
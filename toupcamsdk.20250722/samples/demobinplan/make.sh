@@ -0,0 +1,7 @@
+#!/bin/bash
+os=`uname -s`
+if [[ $os = "Linux" ]]; then
+	g++ -Wl,-rpath -Wl,'$ORIGIN' -L. -g -o demobinplan demobinplan.cpp -ltoupcam
+else
+	clang++ -Wl,-rpath -Wl,@executable_path -L. -g -o demobinplan demobinplan.cpp -ltoupcam
+fi
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "stillburst.h"
+
+/*
+    Burst still capture, such as the planes of a Z stack.
+    usage: demoburst [number = 50] [still resolution index = 0] [raw]
+    All the buffers of the burst are reserved before it is snapped, the stills are pulled into them from the event
+    callback and saved on the drain thread of StillBurst while the rest of the burst is still being captured.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+StillBurst* g_pBurst = NULL;
+
+static void BurstCallback(void* ctx, unsigned index, const void* data, unsigned length, const ToupcamFrameInfoV4* pInfo)
+{
+    char filename[1024];
+    sprintf(filename, "demoburst_%ux%u_%03u.raw", pInfo->v3.width, pInfo->v3.height, index);
+    FILE* fp = fopen(filename, "wb");
+    if (NULL == fp)
+        printf("failed to create %s\n", filename);
+    else
+    {
+        fwrite(data, 1, length, fp);
+        fclose(fp);
+        printf("still %u, seq = %u, timestamp = %llu, save: %s\n", index, pInfo->v3.seq, pInfo->v3.timestamp, filename);
+    }
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, NULL);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+    }
+    else if (TOUPCAM_EVENT_STILLIMAGE == nEvent)
+    {
+        if (!g_pBurst->onStill())
+            printf("still image not in the burst\n");
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned nNumber = (argc > 1) ? (unsigned)atoi(argv[1]) : 50;
+    const unsigned nResolutionIndex = (argc > 2) ? (unsigned)atoi(argv[2]) : 0;
+    const bool bRaw = (argc > 3) && (0 == strcmp(argv[3], "raw"));
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (0 == Toupcam_query_Model(g_hcam)->still)
+    {
+        printf("camera does not support still image\n");
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+
+    if (bRaw)
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    if (StillBurst::enableDDR(g_hcam))
+        printf("DDR frame buffer: full capacity\n");
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        g_pBurst = new StillBurst(g_hcam, BurstCallback, NULL);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else if (FAILED(hr = g_pBurst->reserve(nResolutionIndex, nNumber)))
+            printf("failed to reserve the burst, hr = 0x%08x\n", hr);
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("press ENTER to snap a burst of %u\n", nNumber);
+                getc(stdin);
+                const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                hr = g_pBurst->start();
+                if (FAILED(hr))
+                    printf("failed to snap, hr = 0x%08x\n", hr);
+                else
+                {
+                    if (!g_pBurst->wait(nNumber * 10000))
+                        printf("burst timeout\n");
+                    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                    printf("captured = %u, saved = %u, lost = %u, %.2f s\n", g_pBurst->captured(), g_pBurst->drained(), g_pBurst->lost(), sec);
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);  /* no more callback after this */
+    delete g_pBurst;
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,162 @@
+#ifndef __stillburst_H__
+#define __stillburst_H__
+
+/*
+    Burst of still images (Toupcam_SnapN, or Toupcam_SnapR in RAW mode) into buffers reserved up front.
+    reserve() allocates all the buffers of the burst before the first one is snapped, so onStill(), called from the
+    TOUPCAM_EVENT_STILLIMAGE event, only pulls into the next buffer (no peek, no malloc) and returns. The filled
+    buffers are handed to BURST_CALLBACK on a drain thread, so saving the burst overlaps its capture instead of
+    pacing it.
+    On the cameras with DDR (TOUPCAM_FLAG_DDR) enableDDR() lets the DDR cache frames to full capacity, so the sensor
+    runs at full speed and the stills wait in the camera while the host drains them; call it before the camera starts.
+*/
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "toupcam.h"
+
+/* called on the drain thread, data is valid until the callback returns */
+typedef void (*BURST_CALLBACK)(void* ctx, unsigned index, const void* data, unsigned length, const ToupcamFrameInfoV4* pInfo);
+
+class StillBurst {
+    HToupcam m_hcam;
+    BURST_CALLBACK m_pFun;
+    void* m_ctx;
+    bool m_bRaw;
+    unsigned m_nResolutionIndex, m_nBytes;
+    std::vector<std::vector<unsigned char> > m_vecBuf;
+    std::vector<ToupcamFrameInfoV4> m_vecInfo;
+    std::deque<unsigned> m_ready;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+    std::atomic<unsigned> m_nCaptured, m_nDrained, m_nLost;
+    bool m_bStop;
+
+    void drainThread()
+    {
+        while (true)
+        {
+            unsigned index;
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cv.wait(lock, [this] { return m_bStop || !m_ready.empty(); });
+                if (m_ready.empty())
+                    return;
+                index = m_ready.front();
+                m_ready.pop_front();
+            }
+            m_pFun(m_ctx, index, &m_vecBuf[index][0], m_nBytes, &m_vecInfo[index]);
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                ++m_nDrained;
+            }
+            m_cv.notify_all();
+        }
+    }
+public:
+    StillBurst(HToupcam h, BURST_CALLBACK pFun, void* ctx)
+    : m_hcam(h), m_pFun(pFun), m_ctx(ctx), m_bRaw(false), m_nResolutionIndex(0), m_nBytes(0)
+    , m_nCaptured(0), m_nDrained(0), m_nLost(0), m_bStop(false)
+    {
+        m_thread = std::thread(&StillBurst::drainThread, this);
+    }
+    ~StillBurst()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStop = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+    static bool enableDDR(HToupcam h)
+    {
+        const ToupcamModelV2* pModel = Toupcam_query_Model(h);
+        if ((NULL == pModel) || (0 == (pModel->flag & TOUPCAM_FLAG_DDR)))
+            return false;
+        return SUCCEEDED(Toupcam_put_Option(h, TOUPCAM_OPTION_DDR_DEPTH, -1));
+    }
+
+    /* the still resolution and the mode (RGB24 or RAW) are those in effect when the burst is reserved */
+    HRESULT reserve(unsigned nResolutionIndex, unsigned nNumber)
+    {
+        int width = 0, height = 0, raw = 0;
+        HRESULT hr = Toupcam_get_StillResolution(m_hcam, nResolutionIndex, &width, &height);
+        if (FAILED(hr))
+            return hr;
+        Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_RAW, &raw);
+        m_bRaw = (0 != raw);
+        if (m_bRaw)
+        {
+            unsigned nFourCC = 0, bitsperpixel = 8;
+            Toupcam_get_RawFormat(m_hcam, &nFourCC, &bitsperpixel);
+            m_nBytes = width * height * ((bitsperpixel > 8) ? 2 : 1);
+        }
+        else
+            m_nBytes = TDIBWIDTHBYTES(width * 24) * height;
+
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_nDrained != m_nCaptured)
+            return 0x8000000a; /* E_PENDING, the last burst is still being drained */
+        m_nResolutionIndex = nResolutionIndex;
+        m_vecBuf.resize(nNumber);
+        for (unsigned i = 0; i < nNumber; ++i)
+            m_vecBuf[i].resize(m_nBytes);   /* touched now, not in the middle of the burst */
+        m_vecInfo.assign(nNumber, ToupcamFrameInfoV4());
+        m_nCaptured = m_nDrained = m_nLost = 0;
+        return 0;  /* S_OK */
+    }
+
+    HRESULT start()
+    {
+        const unsigned nNumber = (unsigned)m_vecBuf.size();
+        return m_bRaw ? Toupcam_SnapR(m_hcam, m_nResolutionIndex, nNumber) : Toupcam_SnapN(m_hcam, m_nResolutionIndex, nNumber);
+    }
+
+    /* call on TOUPCAM_EVENT_STILLIMAGE, false when the still does not belong to the burst (or it is already full) */
+    bool onStill()
+    {
+        const unsigned index = m_nCaptured;
+        if (index >= m_vecBuf.size())
+            return false;
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(m_hcam, &m_vecBuf[index][0], 1, m_bRaw ? 0 : 24, 0, &info);
+        if (FAILED(hr))
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                ++m_nLost;
+            }
+            m_cv.notify_all();
+            return false;
+        }
+        m_vecInfo[index] = info;
+        ++m_nCaptured;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_ready.push_back(index);
+        }
+        m_cv.notify_all();
+        return true;
+    }
+
+    /* until all the stills of the burst are captured and drained, or nTimeoutMs */
+    bool wait(unsigned nTimeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        return m_cv.wait_for(lock, std::chrono::milliseconds(nTimeoutMs), [this] { return m_nDrained + m_nLost >= m_vecBuf.size(); });
+    }
+
+    unsigned captured() const { return m_nCaptured; }
+    unsigned drained() const { return m_nDrained; }
+    unsigned lost() const { return m_nLost; }
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "toupcam.h"
+#include "../calibset.h"
+
+/*
+    One call switch of the calibration (white balance, color matrix, flat field) on a change of objective (calibset.h).
+    usage: democalibset <sets file>
+    commands, one per line while the camera is running:
+        c <name>            capture: the white balance of the camera and its flat field (exported to <name>.ffc)
+                            as the set name (do an AwbOnce / FfcOnce for the objective first: a, f)
+        a                   Toupcam_AwbOnce
+        f                   Toupcam_FfcOnce
+        <name>              switch to the set name, the time it took and the number of calls sent are printed
+        l                   list the sets
+        e <save | load> [addr = 0]
+                            copy the sets to / from the EEPROM of the camera
+        ENTER               save the sets file and exit
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned g_total = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+            ++g_total;
+    }
+}
+
+static void DoCommand(CalibCache& cache, char* line)
+{
+    char name[CALIBSET_NAME] = { 0 }, action[8] = { 0 };
+    unsigned addr = 0;
+    HRESULT hr;
+    if (('c' == line[0]) && (' ' == line[1]) && (1 == sscanf(line + 2, "%31s", name)))
+    {
+        char ffcfile[CALIBSET_PATH];
+        sprintf(ffcfile, "%s.ffc", name);
+        if (FAILED(hr = cache.capture(g_hcam, name, ffcfile)))
+            printf("failed to capture %s, hr = 0x%08x\n", name, hr);
+        else
+        {
+            cache.invalidate();     /* the camera has it, but it was not sent by the cache */
+            printf("%s: flags = 0x%02x\n", name, cache.find(name)->flags);
+        }
+    }
+    else if (0 == strcmp(line, "a"))
+    {
+        if (FAILED(hr = Toupcam_AwbOnce(g_hcam, NULL, NULL)))
+            printf("failed to auto white balance, hr = 0x%08x\n", hr);
+        cache.invalidate();
+    }
+    else if (0 == strcmp(line, "f"))
+    {
+        if (FAILED(hr = Toupcam_FfcOnce(g_hcam)))
+            printf("failed to flat field, hr = 0x%08x\n", hr);
+        cache.invalidate();
+    }
+    else if (0 == strcmp(line, "l"))
+    {
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            const CalibSet& s = cache.set(i);
+            printf("%s%s: flags = 0x%02x", s.name, (cache.active() && (0 == strcmp(cache.active(), s.name))) ? " *" : "", s.flags);
+            if (s.flags & CALIBSET_WBGAIN)
+                printf(", gain = %d, %d, %d", s.wbGain[0], s.wbGain[1], s.wbGain[2]);
+            if (s.flags & CALIBSET_TEMPTINT)
+                printf(", temp = %d, tint = %d", s.temp, s.tint);
+            if (s.flags & CALIBSET_FFC)
+                printf(", %s", s.ffcFile);
+            printf("\n");
+        }
+    }
+    else if (('e' == line[0]) && (' ' == line[1]) && (sscanf(line + 2, "%7s %i", action, &addr) >= 1))
+    {
+        if (0 == strcmp(action, "save"))
+            hr = cache.saveEeprom(g_hcam, addr);
+        else if (0 == strcmp(action, "load"))
+            hr = cache.loadEeprom(g_hcam, addr);
+        else
+            hr = (HRESULT)0x80070057;
+        if (FAILED(hr))
+            printf("failed to %s eeprom, hr = 0x%08x\n", action, hr);
+        else
+            printf("eeprom %s ok, %u sets\n", action, (unsigned)cache.size());
+    }
+    else
+    {
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        unsigned sent = 0;
+        if (FAILED(hr = cache.activate(g_hcam, line, &sent)))
+            printf("failed to switch to %s, hr = 0x%08x\n", line, hr);
+        else
+            printf("%s: %u calls, %.2f ms, frame %u\n", line, sent, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count(), g_total);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        printf("usage: %s <sets file>\n", argv[0]);
+        return -1;
+    }
+    CalibCache cache;
+    if (cache.load(argv[1]))
+        printf("%s: %u sets\n", argv[1], (unsigned)cache.size());
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                char line[256];
+                printf("c <name>: capture, a: awb, f: ffc, <name>: switch, l: list, e save|load [addr], ENTER: exit\n");
+                while (fgets(line, sizeof(line), stdin))
+                {
+                    line[strcspn(line, "\r\n")] = 0;
+                    if (0 == line[0])
+                        break;
+                    DoCommand(cache, line);
+                }
+                if (!cache.save(argv[1]))
+                    printf("failed to save %s\n", argv[1]);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "../camblob.h"
+
+/*
+    Bulk transfer of a file to / from the flash or the EEPROM of the camera (camblob.h), on the thread of the
+    transfer: the main thread only shows the progress meanwhile, as a UI would, and the time per MB at the end.
+    usage: democamblob <flash | eeprom> info
+           democamblob <flash | eeprom> save <file> [addr = 0]      the file to the camera, CRC and header with it
+           democamblob <flash | eeprom> load <file> [addr = 0]      back into file, the CRC checked
+*/
+HToupcam g_hcam = NULL;
+std::atomic<unsigned long long> g_done(0), g_total(0);
+
+static void BlobProgress(void* ctx, unsigned long long done, unsigned long long total)
+{
+    g_done = done;
+    g_total = total;
+}
+
+static void BlobDone(void* ctx, HRESULT hr)
+{
+    printf("\ntransfer done, hr = 0x%08x\n", hr);
+}
+
+static int DoInfo(int target)
+{
+    if (CAMBLOB_FLASH == target)
+    {
+        printf("flash: size %d, erase block %d, read / write block %d\n", Toupcam_rwc_Flash(g_hcam, TOUPCAM_FLASH_SIZE, 0, 0, NULL),
+            Toupcam_rwc_Flash(g_hcam, TOUPCAM_FLASH_EBLOCK, 0, 0, NULL), Toupcam_rwc_Flash(g_hcam, TOUPCAM_FLASH_RWBLOCK, 0, 0, NULL));
+    }
+    else
+    {
+        int size = 0;
+        HRESULT hr = Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_EEPROM_SIZE, &size);
+        if (FAILED(hr))
+            printf("failed to get EEPROM size, hr = 0x%08x\n", hr);
+        else
+            printf("EEPROM: size %d\n", size);
+    }
+    return 0;
+}
+
+static int DoTransfer(int target, bool bSave, const char* filename, unsigned addr)
+{
+    std::vector<unsigned char> data;
+    if (bSave)
+    {
+        FILE* fp = fopen(filename, "rb");
+        if (NULL == fp)
+        {
+            printf("failed to open %s\n", filename);
+            return -1;
+        }
+        unsigned char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            data.insert(data.end(), buf, buf + n);
+        fclose(fp);
+    }
+
+    CamBlob xfer;
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    HRESULT hr = bSave ? xfer.writeAsync(g_hcam, target, addr, data.empty() ? NULL : &data[0], (unsigned)data.size(), 0, BlobProgress, BlobDone, NULL)
+                       : xfer.readAsync(g_hcam, target, addr, BlobProgress, BlobDone, NULL);
+    if (FAILED(hr))
+    {
+        printf("failed to start transfer, hr = 0x%08x\n", hr);
+        return -1;
+    }
+    while (xfer.busy())
+    {
+        printf("\r%llu / %llu KB", (unsigned long long)g_done >> 10, (unsigned long long)g_total >> 10);
+        fflush(stdout);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    hr = xfer.wait();
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    if (FAILED(hr))
+    {
+        printf("failed to %s, hr = 0x%08x\n", bSave ? "save" : "load", hr);
+        return -1;
+    }
+    const size_t bytes = bSave ? data.size() : xfer.data().size();
+    printf("%s %u bytes, %.1f ms, %.1f ms per MB\n", bSave ? "saved" : "loaded", (unsigned)bytes, ms, bytes ? ms * 1048576.0 / bytes : 0.0);
+    if (!bSave)
+    {
+        FILE* fp = fopen(filename, "wb");
+        if (NULL == fp)
+        {
+            printf("failed to create %s\n", filename);
+            return -1;
+        }
+        if (bytes)
+            fwrite(&xfer.data()[0], 1, bytes, fp);
+        fclose(fp);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const int target = (argc > 1) ? ((0 == strcmp(argv[1], "flash")) ? CAMBLOB_FLASH : ((0 == strcmp(argv[1], "eeprom")) ? CAMBLOB_EEPROM : -1)) : -1;
+    const bool bInfo = (argc > 2) && (0 == strcmp(argv[2], "info"));
+    const bool bSave = (argc > 3) && (0 == strcmp(argv[2], "save"));
+    const bool bLoad = (argc > 3) && (0 == strcmp(argv[2], "load"));
+    if ((target < 0) || (!bInfo && !bSave && !bLoad))
+    {
+        printf("usage: %s <flash | eeprom> info\n"
+               "       %s <flash | eeprom> save <file> [addr = 0]\n"
+               "       %s <flash | eeprom> load <file> [addr = 0]\n", argv[0], argv[0], argv[0]);
+        return -1;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    const int ret = bInfo ? DoInfo(target) : DoTransfer(target, bSave, argv[3], (argc > 4) ? (unsigned)strtoul(argv[4], NULL, 0) : 0);
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    return ret;
+}
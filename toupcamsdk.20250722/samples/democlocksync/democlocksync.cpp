@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "toupcam.h"
+#include "../clocksync.h"
+
+/*
+    The clocks of all the cameras on the host clock (../clocksync.h).
+    usage: democlocksync [seconds = 30] [reset = 0]
+    Every 2 seconds, per camera: the state of the fit, the points used, the offset host - camera, the drift of the
+    camera clock, the rms of the points about the line; the transit, arrival - toHost(timestamp) of the frames of the
+    interval, which is at least 0 with a right offset and spread by the transfer only; the anchor, the move of the
+    host time of the first timestamp since the fit locked, which stays within the rms with a right drift.
+    reset: at that second TOUPCAM_OPTION_RESET_SEQ_TIMESTAMP 2 on the first camera, a new epoch for its fit.
+*/
+struct CamCtx {
+    HToupcam hcam;
+    void* data;
+    ClockSync sync;
+    std::mutex mtx;
+    unsigned frames, epoch;
+    long long transitMin, transitMax;
+    unsigned long long first;   /* the first timestamp of the epoch */
+    bool bFirst;
+    long long anchor;           /* toHost(first) when the fit locked */
+    bool bAnchor;
+};
+
+ToupcamDeviceV2 g_dev[TOUPCAM_MAX] = { 0 };
+CamCtx g_ctx[TOUPCAM_MAX];
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    const long long tArrival = HostMicroseconds();
+    CamCtx* pctx = (CamCtx*)pCallbackCtx;
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(pctx->hcam, pctx->data, 0, 8, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP)
+        {
+            pctx->sync.frame(info.v3, tArrival);
+            const long long transit = tArrival - pctx->sync.toHost(info.v3.timestamp);
+            std::lock_guard<std::mutex> lock(pctx->mtx);
+            if ((!pctx->bFirst) || (pctx->epoch != pctx->sync.epoch()))
+            {
+                pctx->epoch = pctx->sync.epoch();
+                pctx->first = info.v3.timestamp;
+                pctx->bFirst = true;
+                pctx->bAnchor = false;
+            }
+            if (0 == pctx->frames++)
+                pctx->transitMin = pctx->transitMax = transit;
+            else if (transit < pctx->transitMin)
+                pctx->transitMin = transit;
+            else if (transit > pctx->transitMax)
+                pctx->transitMax = transit;
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const int seconds = (argc > 1) ? atoi(argv[1]) : 30;
+    const int resetAt = (argc > 2) ? atoi(argv[2]) : 0;
+
+    const unsigned num = Toupcam_EnumV2(g_dev);
+    if (0 == num)
+    {
+        printf("no camera found\n");
+        return -1;
+    }
+    unsigned started = 0;
+    for (unsigned i = 0; i < num; ++i)
+    {
+        CamCtx& ctx = g_ctx[i];
+        ctx.data = NULL;
+        ctx.frames = ctx.epoch = 0;
+        ctx.bFirst = ctx.bAnchor = false;
+        ctx.hcam = Toupcam_Open(g_dev[i].id);
+        if (NULL == ctx.hcam)
+        {
+            printf("camera %u: open failed\n", i);
+            continue;
+        }
+        int nWidth = 0, nHeight = 0;
+        HRESULT hr = Toupcam_get_Size(ctx.hcam, &nWidth, &nHeight);
+        if (FAILED(hr))
+            printf("camera %u: failed to get size, hr = 0x%08x\n", i, hr);
+        else if (NULL == (ctx.data = malloc(nWidth * nHeight)))
+            printf("camera %u: failed to malloc\n", i);
+        else if (FAILED(hr = Toupcam_StartPullModeWithCallback(ctx.hcam, EventCallback, &ctx)))
+            printf("camera %u: failed to start camera, hr = 0x%08x\n", i, hr);
+        else
+            ++started;
+    }
+
+    static const char* state[] = { "none", "offset", "locked" };
+    for (int t = 2; started && (t <= seconds); t += 2)
+    {
+        if ((resetAt > t - 2) && (resetAt <= t))
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(resetAt - (t - 2)));
+            HRESULT hr = Toupcam_put_Option(g_ctx[0].hcam, TOUPCAM_OPTION_RESET_SEQ_TIMESTAMP, 2);
+            if (FAILED(hr))
+                printf("failed to reset the timestamp, hr = 0x%08x\n", hr);
+            std::this_thread::sleep_for(std::chrono::seconds(t - resetAt));
+        }
+        else
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        for (unsigned i = 0; i < num; ++i)
+        {
+            CamCtx& ctx = g_ctx[i];
+            if (NULL == ctx.data)
+                continue;
+            const int st = ctx.sync.state();
+            std::lock_guard<std::mutex> lock(ctx.mtx);
+            long long wander = 0;
+            if (ctx.bFirst && (CLOCKSYNC_LOCKED == st))
+            {
+                const long long anchor = ctx.sync.toHost(ctx.first);
+                if (!ctx.bAnchor)
+                {
+                    ctx.anchor = anchor;
+                    ctx.bAnchor = true;
+                }
+                wander = anchor - ctx.anchor;
+            }
+            printf("%3d s camera %u: %-6s epoch %u, %2u points, offset %.3f ms, drift %+7.2f ppm, rms %5.1f us; %4u frames, transit %lld ... %lld us, anchor %+lld us\n",
+                t, i, state[st], ctx.sync.epoch(), ctx.sync.used(), ctx.sync.offset() / 1000.0, ctx.sync.drift(), ctx.sync.rms(),
+                ctx.frames, ctx.frames ? ctx.transitMin : 0, ctx.frames ? ctx.transitMax : 0, wander);
+            ctx.frames = 0;
+        }
+    }
+
+    /* cleanup */
+    for (unsigned i = 0; i < num; ++i)
+    {
+        Toupcam_Close(g_ctx[i].hcam);
+        if (g_ctx[i].data)
+            free(g_ctx[i].data);
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../camcoro.h"
+
+/*
+    The pipeline of camcoro.h: a coroutine on the run loop of the main thread, no event callback of its own.
+        democoro [n = 10]           n frames of the video stream, co_await cam.next_frame()
+        democoro trigger [n = 10]   n software triggers, co_await cam.trigger_sync() each
+*/
+static CamTask Pipeline(Camera& cam, CamLoop& loop, bool bTrigger, int n)
+{
+    unsigned long long last = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        CamFrame frame;
+        if (bTrigger)
+            frame = co_await cam.trigger_sync();
+        else
+            frame = co_await cam.next_frame();
+        if (!frame)
+        {
+            printf("failed to %s, hr = 0x%08x\n", bTrigger ? "trigger" : "pull image", frame.hr());
+            break;
+        }
+        /* the frame is read in place, until frame goes out of scope */
+        const unsigned char* p = (const unsigned char*)frame.data();
+        const ToupcamFrameInfoV4& info = frame.info();
+        printf("%s %d: seq = %u, %u x %u, stride = %d, first pixel = %u, interval = %llu us\n", bTrigger ? "trigger" : "frame", i + 1,
+            info.v3.seq, info.v3.width, info.v3.height, frame.stride(), p[0], last ? (info.v3.timestamp - last) : 0ULL);
+        last = info.v3.timestamp;
+    }
+    loop.stop();
+}
+
+int main(int argc, char* argv[])
+{
+    bool bTrigger = false;
+    int n = 10;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "trigger"))
+            bTrigger = true;
+        else
+            n = atoi(argv[i]);
+    }
+
+    Camera cam = Camera::open();
+    if (!cam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (bTrigger)
+    {
+        Toupcam_put_Option(cam.handle(), TOUPCAM_OPTION_TRIGGER, 1);
+        Toupcam_IoControl(cam.handle(), 0, TOUPCAM_IOCONTROLTYPE_SET_TRIGGERSOURCE, 5, NULL);
+    }
+
+    CamLoop loop;
+    HRESULT hr = cam.start(loop);
+    if (FAILED(hr))
+    {
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+        return -1;
+    }
+
+    CamTask task = Pipeline(cam, loop, bTrigger, n);
+    loop.run();
+
+    /* cleanup */
+    cam.close();
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "toupcam.h"
+#include "../hostffc.h"
+#include "../darklib.h"
+
+/*
+    Dark frame library (darklib.h) for the host dark field correction (hostffc.h).
+    usage: demodarklib capture <lib> <frames> <expo us> [expo us ...]   with the light path closed: the mean of frames
+                                                                        RAW frames at every exposure, at the gain and
+                                                                        temperature of the camera, added to lib
+           demodarklib live <lib>                                       correct the live RAW frames, the dark follows
+                                                                        the exposure, the gain and the temperature of
+                                                                        every frame; type an exposure (us) + ENTER to
+                                                                        change it, ENTER alone to exit
+           demodarklib flash <save | load> <lib> [addr = 0]             copy lib to / from the flash of the camera
+*/
+#define SETTLE_FRAMES       2       /* skipped after a change of exposure, exposed partly before it */
+
+HToupcam g_hcam = NULL;
+void* g_pRawData = NULL;
+HostFfc g_ffc;
+DarkLib g_lib;
+std::mutex g_mtx;
+std::condition_variable g_cv;
+unsigned g_target = 0, g_need = 0, g_skip = 0;  /* capture */
+unsigned short g_gain = 0;
+std::atomic<int> g_temperature(0);              /* 0.1 degree Celsius, polled */
+DarkLibKey g_key = { 0 };                       /* live: the dark in use */
+std::vector<unsigned short> g_dark;
+unsigned g_total = 0;
+
+static short Temperature()
+{
+    short t = 0;
+    Toupcam_get_Temperature(g_hcam, &t);
+    return t;
+}
+
+static double Mean(const void* pData, unsigned count, bool b16)
+{
+    unsigned long long sum = 0;
+    for (unsigned i = 0; i < count; ++i)
+        sum += b16 ? ((const unsigned short*)pData)[i] : ((const unsigned char*)pData)[i];
+    return count ? (double)sum / count : 0.0;
+}
+
+static void __stdcall CaptureCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pRawData, 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            if ((0 == g_need) || (info.v3.expotime != g_target))
+                return;
+            if (g_skip)
+                --g_skip;
+            else
+            {
+                g_ffc.addDark(g_pRawData);
+                g_gain = info.v3.expogain;
+                if (0 == --g_need)
+                    g_cv.notify_one();
+            }
+        }
+    }
+}
+
+static void __stdcall LiveCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pRawData, 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const DarkLibKey key = { info.v3.expotime, info.v3.expogain, (short)g_temperature.load() };
+            if ((key.expoTime != g_key.expoTime) || (key.expoGain != g_key.expoGain) || (key.temperature != g_key.temperature))
+            {
+                const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                g_lib.get(key, &g_dark[0]);
+                g_ffc.putDark(&g_dark[0]);
+                g_key = key;
+                printf("dark for %u us, gain %u%%, %.1f C: %.2f ms\n", key.expoTime, key.expoGain, key.temperature / 10.0,
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+            }
+            const bool b16 = g_ffc.bitdepth() > 8;
+            const double raw = (0 == (g_total % 50)) ? Mean(g_pRawData, info.v3.width * info.v3.height, b16) : 0;
+            g_ffc.apply(g_pRawData, g_pRawData);
+            if (0 == (g_total++ % 50))
+                printf("frame %u: mean = %.1f, corrected = %.1f\n", g_total, raw, Mean(g_pRawData, info.v3.width * info.v3.height, b16));
+        }
+    }
+}
+
+static int DoCapture(int argc, char** argv, unsigned width, unsigned height, unsigned fourcc, unsigned bitdepth)
+{
+    const unsigned frames = (unsigned)atoi(argv[3]);
+    if ((!g_lib.load(argv[2])) || (g_lib.width() != width) || (g_lib.height() != height) || (g_lib.bitdepth() != bitdepth))
+        g_lib.init(width, height, bitdepth);
+    Toupcam_put_AutoExpoEnable(g_hcam, 0);
+    HRESULT hr = Toupcam_StartPullModeWithCallback(g_hcam, CaptureCallback, NULL);
+    if (FAILED(hr))
+    {
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+        return -1;
+    }
+    for (int k = 4; k < argc; ++k)
+    {
+        unsigned expo = (unsigned)atoi(argv[k]);
+        if (FAILED(hr = Toupcam_put_ExpoTime(g_hcam, expo)))
+        {
+            printf("failed to set exposure time %u, hr = 0x%08x\n", expo, hr);
+            continue;
+        }
+        /* the frames report the exposure time the sensor rounded it to */
+        Toupcam_get_RealExpoTime(g_hcam, &expo);
+        std::unique_lock<std::mutex> lock(g_mtx);
+        g_ffc.init(width, height, bitdepth, fourcc);
+        g_target = expo;
+        g_skip = SETTLE_FRAMES;
+        g_need = frames;
+        if (!g_cv.wait_for(lock, std::chrono::milliseconds(expo / 1000 * (frames + SETTLE_FRAMES) * 2 + 5000), [] { return 0 == g_need; }))
+        {
+            g_need = 0;
+            printf("%u us: timeout\n", expo);
+            continue;
+        }
+        g_ffc.finish();
+        const DarkLibKey key = { expo, g_gain, Temperature() };
+        g_lib.put(key, g_ffc.dark());
+        printf("%u us, gain %u%%, %.1f C: %u frames, mean = %.1f\n", key.expoTime, key.expoGain, key.temperature / 10.0, frames, Mean(g_ffc.dark(), width * height, true));
+    }
+    Toupcam_Stop(g_hcam);
+    if (!g_lib.save(argv[2]))
+    {
+        printf("failed to save %s\n", argv[2]);
+        return -1;
+    }
+    printf("%s: %u entries\n", argv[2], (unsigned)g_lib.size());
+    return 0;
+}
+
+static int DoLive(char** argv, unsigned width, unsigned height, unsigned fourcc, unsigned bitdepth)
+{
+    if (!g_lib.load(argv[2]) || (0 == g_lib.size()))
+    {
+        printf("failed to load %s\n", argv[2]);
+        return -1;
+    }
+    if ((g_lib.width() != width) || (g_lib.height() != height) || (g_lib.bitdepth() != bitdepth))
+    {
+        printf("%s: %u x %u, %u bits, the camera is %u x %u, %u bits\n", argv[2], g_lib.width(), g_lib.height(), g_lib.bitdepth(), width, height, bitdepth);
+        return -1;
+    }
+    g_ffc.init(width, height, bitdepth, fourcc);
+    g_dark.resize((size_t)width * height);
+    g_temperature = Temperature();
+    Toupcam_put_AutoExpoEnable(g_hcam, 0);
+    const HRESULT hr = Toupcam_StartPullModeWithCallback(g_hcam, LiveCallback, NULL);
+    if (FAILED(hr))
+    {
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+        return -1;
+    }
+    std::atomic<bool> bStop(false);
+    std::thread poll([&bStop]()
+    {
+        while (!bStop)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            g_temperature = Temperature();
+        }
+    });
+    char line[64];
+    printf("%u entries, type an exposure time (us) to change it, ENTER to exit\n", (unsigned)g_lib.size());
+    while (fgets(line, sizeof(line), stdin) && atoi(line))
+        Toupcam_put_ExpoTime(g_hcam, (unsigned)atoi(line));
+    bStop = true;
+    poll.join();
+    Toupcam_Stop(g_hcam);
+    return 0;
+}
+
+static void FlashProgress(void* ctx, unsigned long long done, unsigned long long total)
+{
+    printf("\r%llu / %llu KB", done >> 10, total >> 10);
+    fflush(stdout);
+}
+
+static int DoFlash(int argc, char** argv)
+{
+    const unsigned addr = (argc > 4) ? (unsigned)strtoul(argv[4], NULL, 0) : 0;
+    HRESULT hr;
+    if (0 == strcmp(argv[2], "save"))
+    {
+        if (!g_lib.load(argv[3]))
+        {
+            printf("failed to load %s\n", argv[3]);
+            return -1;
+        }
+        hr = g_lib.saveFlash(g_hcam, addr, FlashProgress);
+        printf("\n");
+    }
+    else
+    {
+        hr = g_lib.loadFlash(g_hcam, addr, FlashProgress);
+        printf("\n");
+        if (SUCCEEDED(hr) && !g_lib.save(argv[3]))
+        {
+            printf("failed to save %s\n", argv[3]);
+            return -1;
+        }
+    }
+    if (FAILED(hr))
+    {
+        printf("failed to %s flash, hr = 0x%08x\n", argv[2], hr);
+        return -1;
+    }
+    printf("flash %s ok, %u entries\n", argv[2], (unsigned)g_lib.size());
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const bool bCapture = (argc >= 5) && (0 == strcmp(argv[1], "capture")) && (atoi(argv[3]) > 0);
+    const bool bLive = (3 == argc) && (0 == strcmp(argv[1], "live"));
+    const bool bFlash = (argc >= 4) && (0 == strcmp(argv[1], "flash")) && ((0 == strcmp(argv[2], "save")) || (0 == strcmp(argv[2], "load")));
+    if (!bCapture && !bLive && !bFlash)
+    {
+        printf("usage: %s capture <lib> <frames> <expo us> [expo us ...]\n", argv[0]);
+        printf("       %s live <lib>\n", argv[0]);
+        printf("       %s flash <save | load> <lib> [addr = 0]\n", argv[0]);
+        return -1;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int ret = -1;
+    int nWidth = 0, nHeight = 0;
+    unsigned fourcc = 0, bitdepth = 8;
+    HRESULT hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    if (FAILED(hr))
+        printf("failed to set raw mode, hr = 0x%08x\n", hr);
+    else if ((Toupcam_get_MaxBitDepth(g_hcam) > 8) && FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1)))
+        printf("failed to set bit depth, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight)) || FAILED(hr = Toupcam_get_RawFormat(g_hcam, &fourcc, &bitdepth)))
+        printf("failed to get size or raw format, hr = 0x%08x\n", hr);
+    else if (bFlash)
+        ret = DoFlash(argc, argv);
+    else if (NULL == (g_pRawData = malloc(nWidth * nHeight * ((bitdepth > 8) ? 2 : 1))))
+        printf("failed to malloc\n");
+    else if (bCapture)
+        ret = DoCapture(argc, argv, nWidth, nHeight, fourcc, bitdepth);
+    else
+        ret = DoLive(argv, nWidth, nHeight, fourcc, bitdepth);
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pRawData)
+        free(g_pRawData);
+    return ret;
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "../dequesize.h"
+
+/*
+    Deque lengths sized within a memory budget (samples/dequesize.h).
+    One consumer thread processes each frame for a few milliseconds, with a long stall every STALL_EVERY frames, as a
+    program which writes to a slow disk or redraws a big window now and then. A first run with the default deque
+    lengths measures the consumer; then the camera stops, gets the planned lengths and runs again. The frames
+    dropped (TOUPCAM_OPTION_BACKEND_FULL, TOUPCAM_OPTION_NUMBER_DROP_FRAME) of both runs tell the difference.
+    usage: demodequesize [budget MB, default 256] [seconds per run, default 10] [stall ms, default 300]
+*/
+#define WORK_MS         10
+#define STALL_EVERY     50
+
+HToupcam g_hcam = NULL;
+std::mutex g_lock;
+std::condition_variable g_cv;
+unsigned g_pending = 0;
+bool g_bQuit = false;
+unsigned g_stallMs = 300;
+std::atomic<unsigned> g_consumed(0);
+DequeSizer g_sizer;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        ++g_pending;
+        g_cv.notify_one();
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static void Consumer(std::vector<unsigned char>* buf)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(g_lock);
+            g_cv.wait(lock, [] { return g_bQuit || g_pending; });
+            if (g_bQuit)
+                break;
+            --g_pending;
+        }
+        ToupcamFrameInfoV4 info = { 0 };
+        if (FAILED(Toupcam_PullImageV4(g_hcam, &(*buf)[0], 0, 24, 0, &info)))
+            continue;           /* dropped in the meantime */
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        /* the processing of the program */
+        const unsigned n = ++g_consumed;
+        std::this_thread::sleep_for(std::chrono::milliseconds((0 == n % STALL_EVERY) ? g_stallMs : WORK_MS));
+        g_sizer.sample(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+}
+
+static int Dropped()
+{
+    int full = 0, drop = 0;
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_BACKEND_FULL, &full);
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_NUMBER_DROP_FRAME, &drop);
+    return (full > drop) ? full : drop;
+}
+
+/* one run; returns the frame rate of the camera */
+static double Run(const char* name, unsigned seconds, void* pCallbackCtx)
+{
+    int front = 0, back = 0;
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH, &front);
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, &back);
+    const HRESULT hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, pCallbackCtx);
+    if (FAILED(hr))
+    {
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+        return 0.0;
+    }
+    const int dropped0 = Dropped();
+    const unsigned consumed0 = g_consumed;
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    unsigned nFrame = 0, nTime = 0, nTotal = 0;
+    Toupcam_get_FrameRate(g_hcam, &nFrame, &nTime, &nTotal);
+    const int dropped = Dropped() - dropped0;
+    Toupcam_Stop(g_hcam);
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        g_pending = 0;
+    }
+    printf("%s: deques %d + %d, consumed %u, dropped %d\n", name, front, back, g_consumed - consumed0, dropped);
+    return nTime ? (nFrame * 1000.0 / nTime) : 0.0;
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned budgetMB = (argc > 1) ? (unsigned)atoi(argv[1]) : 256;
+    const unsigned seconds = (argc > 2) ? (unsigned)atoi(argv[2]) : 10;
+    if (argc > 3)
+        g_stallMs = (unsigned)atoi(argv[3]);
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    std::vector<unsigned char> buf(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+    std::thread consumer(Consumer, &buf);
+
+    const double fps = Run("defaults", seconds, NULL);
+    DequePlan plan = { 0 };
+    hr = g_sizer.plan(g_hcam, budgetMB, (fps > 0.0) ? fps : 1.0, &plan);
+    if (FAILED(hr) && (0 == plan.frontFrame))
+        printf("failed to plan the deques, hr = 0x%08x\n", hr);
+    else
+    {
+        if (FAILED(hr))
+            printf("budget of %u MB below the minimum, hr = 0x%08x\n", budgetMB, hr);
+        printf("p99 %.1f ms at %.1f fps: need %u, frontend %u x %llu KB, backend %u x %llu KB, total %llu MB of %u MB%s\n",
+            plan.p99ms, plan.fps, plan.need, plan.frontLength, plan.frontFrame >> 10, plan.backLength, plan.backFrame >> 10,
+            plan.bytes >> 20, budgetMB, plan.overload ? ", consumer too slow on average" : "");
+        hr = DequeSizer::apply(g_hcam, &plan);
+        if (FAILED(hr))
+            printf("failed to set the deque lengths, hr = 0x%08x\n", hr);
+        else
+            Run("planned", seconds, NULL);
+    }
+
+    /* cleanup */
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        g_bQuit = true;
+        g_cv.notify_one();
+    }
+    consumer.join();
+    Toupcam_Close(g_hcam);
+    return 0;
+}
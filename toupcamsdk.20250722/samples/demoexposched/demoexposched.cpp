@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "toupcam.h"
+#include "../exposched.h"
+
+/*
+    Software bracketing without a wasted frame (../exposched.h): the exposure times are cycled one per frame, each
+    scheduled on a frame seq, and every frame is counted for the exposure its tag says it carries.
+    usage: demoexposched [frames = 300] [exposure time, us ...]   (default 5000 10000 20000)
+    The mean of a frame over its exposure time is the same for every exposure of the list if the tags are right (a
+    static scene, none saturated); the report gives it per exposure, with the frames on their target and the lag.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+
+struct Bracket {
+    unsigned expoTime, frames;
+    double sum;         /* of the means */
+};
+
+int main(int argc, char* argv[])
+{
+    const unsigned total = (argc > 1) ? (unsigned)atoi(argv[1]) : 300;
+    std::vector<Bracket> vec;
+    for (int i = 2; i < argc; ++i)
+    {
+        const Bracket b = { (unsigned)atoi(argv[i]), 0, 0.0 };
+        vec.push_back(b);
+    }
+    if (vec.empty())
+    {
+        const Bracket b[] = { { 5000, 0, 0.0 }, { 10000, 0, 0.0 }, { 20000, 0, 0.0 } };
+        vec.assign(b, b + 3);
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_put_AutoExpoEnable(g_hcam, 0);
+    if (FAILED(hr))
+        printf("failed to disable auto exposure, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (NULL == (g_pImageData = malloc(nWidth * nHeight)))
+        printf("failed to malloc\n");
+    else
+    {
+        ExpoSchedule sched;
+        sched.init(g_hcam);
+        unsigned next = 0, target = 0, untagged = 0, onTarget = 0, requests = 0;
+        /* the first exposure on the first frame */
+        if (FAILED(hr = sched.schedule(target, vec[0].expoTime, 0, 0)))
+            printf("failed to schedule, hr = 0x%08x\n", hr);
+        else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, NULL, NULL)))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            next = 1 % vec.size();
+            requests = 1;
+            for (unsigned n = 0; n < total; ++n)
+            {
+                ToupcamFrameInfoV4 info = { 0 };
+                hr = Toupcam_WaitImageV4(g_hcam, 5000, g_pImageData, 0, 8, 0, &info);
+                if (FAILED(hr))
+                {
+                    printf("failed to pull image, hr = 0x%08x\n", hr);
+                    break;
+                }
+                ExpoTag tag;
+                if (FAILED(hr = sched.frame(info.v3, &tag)))
+                    printf("failed to put the exposure, hr = 0x%08x\n", hr);
+                if (tag.flag & EXPOSCHED_CARRIES)
+                {
+                    unsigned long long sum = 0;
+                    for (int i = 0; i < nWidth * nHeight; ++i)
+                        sum += ((const unsigned char*)g_pImageData)[i];
+                    Bracket& b = vec[tag.user];
+                    ++b.frames;
+                    b.sum += (double)sum / ((double)nWidth * nHeight);
+                    if (tag.flag & EXPOSCHED_ON_TARGET)
+                        ++onTarget;
+                }
+                else
+                    ++untagged;
+                /* the next exposure on the first frame the schedule can still reach */
+                target = (sched.earliest() + 1 > target + 1) ? (sched.earliest() + 1) : (target + 1);
+                if (SUCCEEDED(hr = sched.schedule(target, vec[next].expoTime, 0, next)))
+                {
+                    next = (next + 1) % vec.size();
+                    ++requests;
+                }
+                else
+                    printf("failed to schedule, hr = 0x%08x\n", hr);
+            }
+            Toupcam_Stop(g_hcam);
+
+            printf("%u frames, %u requests, %u on their target, %u untagged, %u missed, lag %u frames\n",
+                total, requests, onTarget, untagged, sched.missed(), sched.lag());
+            for (size_t i = 0; i < vec.size(); ++i)
+            {
+                const double mean = vec[i].frames ? (vec[i].sum / vec[i].frames) : 0.0;
+                printf("%8u us: %4u frames, mean %6.2f, mean / ms %6.3f\n", vec[i].expoTime, vec[i].frames, mean, mean * 1000.0 / vec[i].expoTime);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
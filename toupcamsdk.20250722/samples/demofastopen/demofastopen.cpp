@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include "toupcam.h"
+#include "../capcache.h"
+
+/*
+    Launch to first frame with the capabilities and the settings of the last session from a cache (capcache.h):
+        open        Toupcam_Open(NULL), the first camera, without an enumeration of its own
+        key         serial number + firmware version
+        settings    those of the last session when the cache has the camera, the defaults otherwise
+        start       Toupcam_StartPullModeWithCallback
+    The capabilities are printed from the cache at once (what a user interface would fill its lists with), then probed
+    once the first frame has arrived, and the cache is rewritten when they have changed or the camera was not in it.
+    The settings are saved at exit, so the next run starts streaming the same way.
+*/
+#define CAPCACHE_FILE           "capcache.txt"
+#define FIRST_FRAME_TIMEOUT     5000    /* ms */
+
+typedef std::chrono::steady_clock Clock;
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned g_total = 0;
+Clock::time_point g_tLaunch;
+std::atomic<long long> g_firstFrame(-1);    /* us since launch */
+
+static long long elapsed()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - g_tLaunch).count();
+}
+
+static void printCaps(const char* title, const CamCaps& c)
+{
+    printf("%s: %s, fw %s, %s, max bit depth %u, max speed %u\n", title, c.sn, c.fw, c.mono ? "mono" : "color", c.maxBitDepth, c.maxSpeed);
+    for (unsigned i = 0; i < c.nRes; ++i)
+        printf("    resolution %u: %u x %u\n", i, c.resWidth[i], c.resHeight[i]);
+    printf("    %u pixel formats, exposure %u - %u us, gain %hu - %hu\n", c.nFmt, c.expoMin, c.expoMax, c.gainMin, c.gainMax);
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (1 == ++g_total)
+            g_firstFrame = elapsed();
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int, char**)
+{
+    g_tLaunch = Clock::now();
+    CapCache cache;
+    cache.load(CAPCACHE_FILE);
+
+    g_hcam = Toupcam_Open(NULL);
+    const long long tOpen = elapsed();
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    CamCaps caps;
+    bool bProbed = false;
+    HRESULT hr = CapCache::key(g_hcam, &caps);
+    if (FAILED(hr))
+        printf("failed to get serial number or firmware version, hr = 0x%08x\n", hr);
+    const CamCaps* pCached = SUCCEEDED(hr) ? cache.find(caps.sn, caps.fw) : NULL;
+    if (pCached)
+    {
+        caps = *pCached;
+        printCaps("cached", caps);
+        hr = CapCache::applySettings(g_hcam, caps);
+        if (FAILED(hr))
+            printf("failed to apply the cached settings, hr = 0x%08x\n", hr);
+    }
+    else
+        printf("%s not in %s, default settings\n", caps.sn, CAPCACHE_FILE);
+    const long long tSettings = elapsed();
+
+    int nWidth = 0, nHeight = 0;
+    hr = Toupcam_get_FinalSize(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            const long long tStart = elapsed();
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                while ((g_firstFrame < 0) && (elapsed() < FIRST_FRAME_TIMEOUT * 1000LL))
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                printf("open %.1f ms, settings %.1f ms, start %.1f ms, first frame %.1f ms (%s)\n", tOpen / 1000.0, tSettings / 1000.0,
+                    tStart / 1000.0, g_firstFrame / 1000.0, pCached ? "cached" : "not cached");
+
+                /* off the critical path: the frames keep coming meanwhile */
+                const long long tProbe = elapsed();
+                CapCache::probe(g_hcam, &caps);
+                bProbed = (caps.sn[0] != '\0');
+                printf("probe %.1f ms\n", (elapsed() - tProbe) / 1000.0);
+                if (bProbed && cache.put(caps))
+                {
+                    printCaps(pCached ? "changed" : "probed", caps);
+                    cache.save(CAPCACHE_FILE);
+                }
+
+                printf("press ENTER to exit\n");
+                getc(stdin);
+                printf("%u frames\n", g_total);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Stop(g_hcam);
+    if (bProbed)    /* never an entry without the capabilities */
+    {
+        CapCache::saveSettings(g_hcam, &caps);
+        cache.put(caps);
+        if (!cache.save(CAPCACHE_FILE))
+            printf("failed to save %s\n", CAPCACHE_FILE);
+    }
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
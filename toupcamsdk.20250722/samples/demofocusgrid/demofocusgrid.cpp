@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include "toupcam.h"
+#include "../hostfocus.h"
+
+/*
+    Focus map of the field: the focus metric (hostfocus.h) of n x n patches of every frame, in one batch.
+    usage: demofocusgrid [n = 3] [laplacian | tenengrad | brenner | normvar] [raw]
+    The patches are the middle half of each cell of the grid. Every REPORT_INTERVAL frames the map is printed with the
+    time the batch took, which is what a per-area focus plane correction pays for each Z step.
+*/
+#define REPORT_INTERVAL     10      /* frames */
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+bool g_bRaw = false;
+int g_metric = HOSTFOCUS_TENENGRAD;
+unsigned g_grid = 3, g_total = 0;
+std::vector<HostFocusRoi> g_rois;
+std::vector<double> g_values;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, g_bRaw ? 0 : 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (0 == ++g_total % REPORT_INTERVAL)
+        {
+            if (g_rois.empty())     /* the size of the frames, not known before the first one */
+            {
+                for (unsigned i = 0; i < g_grid * g_grid; ++i)
+                {
+                    const unsigned cw = info.v3.width / g_grid, ch = info.v3.height / g_grid;
+                    const HostFocusRoi roi = { (i % g_grid) * cw + cw / 4, (i / g_grid) * ch + ch / 4, cw / 2, ch / 2 };
+                    g_rois.push_back(roi);
+                }
+                g_values.resize(g_rois.size());
+            }
+            const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            if (g_bRaw)
+                HostFocusMetricBatch(g_metric, HOSTFOCUS_BAYER8, g_pImageData, info.v3.width, &g_rois[0], (unsigned)g_rois.size(), &g_values[0]);
+            else
+                HostFocusMetricBatch(g_metric, HOSTFOCUS_RGB24, g_pImageData, TDIBWIDTHBYTES(info.v3.width * 24), &g_rois[0], (unsigned)g_rois.size(), &g_values[0]);
+            const long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+            printf("seq = %u, %u patches in %lld us\n", info.v3.seq, (unsigned)g_rois.size(), us);
+            for (unsigned y = 0; y < g_grid; ++y)
+            {
+                for (unsigned x = 0; x < g_grid; ++x)
+                    printf(" %12.2f", g_values[y * g_grid + x]);
+                printf("\n");
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+        g_grid = std::max(1, atoi(argv[1]));
+    if (argc > 2)
+    {
+        const char* names[] = { "laplacian", "tenengrad", "brenner", "normvar" };
+        g_metric = -1;
+        for (int i = 0; i < 4; ++i)
+        {
+            if (0 == strcmp(argv[2], names[i]))
+                g_metric = i;
+        }
+        if (g_metric < 0)
+        {
+            printf("usage: %s [n] [laplacian | tenengrad | brenner | normvar] [raw]\n", argv[0]);
+            return -1;
+        }
+    }
+    g_bRaw = (argc > 3) && (0 == strcmp(argv[3], "raw"));
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    if (g_bRaw)
+    {
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 0);
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("press ENTER to exit\n");
+                getc(stdin);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
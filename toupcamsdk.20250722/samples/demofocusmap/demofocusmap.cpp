@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "../focusmetric.h"
+#include "../focusmap.h"
+
+/*
+    Area scan which searches the focus only where the focus map (focusmap.h) cannot predict it.
+    usage: demofocusmap <tiles> <zmin> <zmax> [maxsigma = 0.005 mm] [port]
+    tiles: a text file, one "x y" (mm) per tile, in the order of the scan. For every tile the stage goes to x, y and the
+    predicted z, the focus value there is measured and, if needSearch(), a fine FocusSweep (focusmetric.h) runs around
+    the prediction (+/- 3 sigma, at least SEARCH_MIN mm), or over [zmin, zmax] when there is no plane yet; the result
+    goes into the map. The moves are G-code on the port, as in demozsweep: default stdout / stdin.
+*/
+#define SETTLE_FRAMES       2
+#define SEARCH_STEPS        7
+#define SEARCH_PASSES       2
+#define SEARCH_MIN          0.01    /* mm */
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+FocusMetric g_metric;
+unsigned g_total = 0;
+double g_value = 0.0;
+std::mutex g_mtx;
+std::condition_variable g_cv;
+FILE* g_fout = NULL;
+FILE* g_fin = NULL;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const double v = g_metric.value(info, g_pImageData, false);
+            std::lock_guard<std::mutex> lock(g_mtx);
+            g_value = v;
+            ++g_total;
+            g_cv.notify_all();
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static bool Command(const char* cmd)
+{
+    fprintf(g_fout, "%s\nM400\n", cmd);
+    fflush(g_fout);
+    char line[256];
+    for (int n = 0; n < 2; )
+    {
+        if (NULL == fgets(line, sizeof(line), g_fin))
+            return false;
+        if (0 == strncmp(line, "ok", 2))
+            ++n;
+    }
+    return true;
+}
+
+/* focus value of the first frame exposed after the last move */
+static bool FocusValue(double* pValue)
+{
+    std::unique_lock<std::mutex> lock(g_mtx);
+    const unsigned n = g_total + SETTLE_FRAMES + 1;
+    if (!g_cv.wait_for(lock, std::chrono::seconds(10), [n] { return g_total >= n; }))
+        return false;
+    *pValue = g_value;
+    return true;
+}
+
+static bool Measure(void* ctx, double z, double* pValue)
+{
+    char cmd[64];
+    sprintf(cmd, "G0 Z%.4f", z);
+    return Command(cmd) && FocusValue(pValue);
+}
+
+static bool ScanTile(FocusMap& map, double x, double y, double zMin, double zMax, double maxSigma, bool* pbSearched)
+{
+    const FocusPrediction p = map.predict(x, y);
+    char cmd[96];
+    sprintf(cmd, "G0 X%.4f Y%.4f Z%.4f", x, y, (p.n > 0) ? p.z : (zMin + zMax) / 2);
+    double fv = -1.0;
+    if (!Command(cmd))
+        return false;
+    if ((p.n > 0) && (!FocusValue(&fv)))
+        return false;
+    *pbSearched = FocusMap::needSearch(p, maxSigma, fv);
+    double best = p.z;
+    if (*pbSearched)
+    {
+        double lo = zMin, hi = zMax;
+        if (p.bPlane)
+        {
+            const double range = std::max(SEARCH_MIN, 3 * p.sigma);
+            lo = std::max(zMin, p.z - range);
+            hi = std::min(zMax, p.z + range);
+        }
+        if (!FocusSweep(lo, hi, SEARCH_STEPS, SEARCH_PASSES, Measure, NULL, &best) || (!Measure(NULL, best, &fv)))
+            return false;
+        map.add(x, y, best, fv);
+    }
+    printf("tile %.4f, %.4f: z = %.4f, sigma = %.4f, focus value = %.1f%s\n", x, y, best, p.sigma, fv, *pbSearched ? ", searched" : "");
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        printf("usage: %s <tiles> <zmin> <zmax> [maxsigma] [port]\n", argv[0]);
+        return -1;
+    }
+    FILE* fpTiles = fopen(argv[1], "r");
+    if (NULL == fpTiles)
+    {
+        printf("failed to open %s\n", argv[1]);
+        return -1;
+    }
+    const double zMin = atof(argv[2]), zMax = atof(argv[3]);
+    const double maxSigma = (argc > 4) ? atof(argv[4]) : 0.005;
+    g_fout = stdout;
+    g_fin = stdin;
+    if (argc > 5)
+    {
+        /* one FILE per direction: a "r+" FILE may not turn from reading to writing without a seek, which a tty cannot do */
+        g_fout = fopen(argv[5], "w");
+        g_fin = g_fout ? fopen(argv[5], "r") : NULL;
+        if (NULL == g_fin)
+        {
+            printf("failed to open %s\n", argv[5]);
+            if (g_fout)
+                fclose(g_fout);
+            fclose(fpTiles);
+            return -1;
+        }
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        fclose(fpTiles);
+        return -1;
+    }
+
+    unsigned nTiles = 0, nSearched = 0;
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            g_metric.setRoi(g_hcam, nWidth / 4, nHeight / 4, nWidth / 2, nHeight / 2);
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                FocusMap map;
+                double x, y;
+                while (2 == fscanf(fpTiles, "%lf %lf", &x, &y))
+                {
+                    bool bSearched = false;
+                    if (!ScanTile(map, x, y, zMin, zMax, maxSigma, &bSearched))
+                    {
+                        printf("failed at tile %.4f, %.4f\n", x, y);
+                        break;
+                    }
+                    ++nTiles;
+                    if (bSearched)
+                        ++nSearched;
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    printf("tiles = %u, searched = %u\n", nTiles, nSearched);
+    fclose(fpTiles);
+    if (g_pImageData)
+        free(g_pImageData);
+    if (g_fout && (g_fout != stdout))
+        fclose(g_fout);
+    if (g_fin && (g_fin != stdin))
+        fclose(g_fin);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../focusqueue.h"
+
+/*
+    Z-stack with the focus motor of the lens, back to back, from the event callback (focusqueue.h).
+    usage: demofocusstack <from> <to> <step> [dwell = 1] [tolerance = 0]
+    Positions from, from + step, ... to of the focus motor, dwell frames at each, saved as
+    demofocusstack_<position>_<n>.raw (RGB24).
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+FocusQueue* g_pQueue = NULL;
+
+static void StackCallback(void* ctx, unsigned index, int pos, bool bReached, unsigned n, const void* data, const ToupcamFrameInfoV4& info)
+{
+    char filename[1024];
+    sprintf(filename, "demofocusstack_%d_%u.raw", pos, n);
+    FILE* fp = fopen(filename, "wb");
+    if (fp)
+    {
+        fwrite(data, 1, TDIBWIDTHBYTES(info.v3.width * 24) * info.v3.height, fp);
+        fclose(fp);
+    }
+    if (0 == n)
+        printf("position %u: %d %s at seq = %u\n", index, pos, bReached ? "reached" : "stopped short", info.v3.seq);
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const bool bDone = g_pQueue->done();
+            g_pQueue->onImage(g_pImageData, info);
+            if ((!bDone) && g_pQueue->done())
+                printf("stack done, press ENTER to exit\n");
+        }
+    }
+    else if (TOUPCAM_EVENT_FOCUSPOS == nEvent)
+    {
+        g_pQueue->onEvent(nEvent);
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        printf("usage: %s <from> <to> <step> [dwell] [tolerance]\n", argv[0]);
+        return -1;
+    }
+    const int from = atoi(argv[1]), to = atoi(argv[2]), step = abs(atoi(argv[3]));
+    const unsigned dwell = (argc > 4) ? (unsigned)atoi(argv[4]) : 1;
+    const int tolerance = (argc > 5) ? atoi(argv[5]) : 0;
+    if (0 == step)
+    {
+        printf("step must not be 0\n");
+        return -1;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    FocusQueue queue(g_hcam, StackCallback, NULL, tolerance);
+    for (int pos = from; (from <= to) ? (pos <= to) : (pos >= to); pos += (from <= to) ? step : -step)
+        queue.push(pos, dwell);
+    g_pQueue = &queue;
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else if (FAILED(hr = Toupcam_put_AFMode(g_hcam, ToupcamAFMode_MANUAL, 0, 0, 0)))
+            printf("failed to set manual focus, hr = 0x%08x\n", hr);
+        else
+        {
+            queue.start();  /* before the first frame, the callback is the only one to touch it afterwards */
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("press ENTER to exit\n");
+                getc(stdin);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+#include "../fpsgov.h"
+
+/*
+    The frame rate governor (samples/fpsgov.h) against a consumer whose processing time changes while it runs.
+    The event callback only counts the frames; one consumer thread pulls them and "processes" each for the given number
+    of milliseconds, twice as long in the middle third of the run, to show the governor taking the frame rate down
+    and up again. Each second: the frame rate asked for, the frame rate of the camera and of the consumer, the
+    capacity the governor measured, the bandwidth, and the frames dropped so far (which should stay at the few of
+    the first intervals).
+    usage: demofpsgov [processing ms per frame, default 40] [seconds, default 30]
+*/
+HToupcam g_hcam = NULL;
+std::mutex g_lock;
+std::condition_variable g_cv;
+unsigned g_pending = 0;
+bool g_bQuit = false;
+std::atomic<unsigned> g_consumed(0);
+std::atomic<unsigned> g_workMs(40);
+FpsGovernor g_gov;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        ++g_pending;
+        g_cv.notify_one();
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static void Consumer(std::vector<unsigned char>* buf)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(g_lock);
+            g_cv.wait(lock, [] { return g_bQuit || g_pending; });
+            if (g_bQuit)
+                break;
+            --g_pending;
+        }
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, &(*buf)[0], 0, 24, 0, &info);
+        if (FAILED(hr))
+            continue;           /* the frame the event was for has been dropped already */
+        /* the processing of the program */
+        std::this_thread::sleep_for(std::chrono::milliseconds(g_workMs.load()));
+        g_gov.done(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        ++g_consumed;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned workMs = (argc > 1) ? (unsigned)atoi(argv[1]) : 40;
+    const unsigned seconds = (argc > 2) ? (unsigned)atoi(argv[2]) : 30;
+    g_workMs = workMs;
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    std::vector<unsigned char> buf(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+
+    hr = g_gov.init(g_hcam);
+    if (FAILED(hr))
+    {
+        printf("failed to init the frame rate governor, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    std::thread consumer(Consumer, &buf);
+    hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+    if (FAILED(hr))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("processing %u ms per frame, %u ms from %u s to %u s, max %.1f fps\n", workMs, workMs * 2, seconds / 3, seconds * 2 / 3, g_gov.maxfps());
+        unsigned lastConsumed = 0;
+        for (unsigned t = 0; t < seconds * 10; ++t)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            g_workMs = ((t >= seconds * 10 / 3) && (t < seconds * 20 / 3)) ? workMs * 2 : workMs;
+            if (g_gov.tick())
+                printf("  rate -> %.1f fps\n", g_gov.fps());
+            if (9 == t % 10)
+            {
+                unsigned nFrame = 0, nTime = 0, nTotal = 0;
+                Toupcam_get_FrameRate(g_hcam, &nFrame, &nTime, &nTotal);
+                const unsigned consumed = g_consumed;
+                printf("%3u s: target %5.1f fps, camera %5.1f fps, consumer %3u fps, capacity %5.1f fps, bandwidth %3d, dropped %u\n",
+                    (t + 1) / 10, g_gov.fps(), nTime ? (nFrame * 1000.0 / nTime) : 0.0, consumed - lastConsumed,
+                    g_gov.capacity(), g_gov.bandwidth(), g_gov.drops());
+                lastConsumed = consumed;
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        g_bQuit = true;
+        g_cv.notify_one();
+    }
+    consumer.join();
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "toupcam.h"
+#include "../framebus.h"
+
+/*
+    One camera, several processes: "demoframebus publish" opens the camera and pulls every frame into the shared
+    memory ring of framebus.h; "demoframebus read", started as many times as wanted, attaches to it and works on the
+    frames in place (here: the mean of the frame). A reader too slow for the ring loses frames, the publisher and the
+    other readers are not affected.
+*/
+#define BUS_NAME    "toupcam_framebus"
+#define BUS_SLOTS   8
+
+HToupcam g_hcam = NULL;
+FrameBusWriter g_bus;
+unsigned g_total = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        void* pData = g_bus.begin();
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, pData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            g_bus.commit(info, TDIBWIDTHBYTES(24 * info.v3.width) * info.v3.height);
+            if (0 == (++g_total % 100))
+                printf("published %u frames, res = %u x %u\n", g_total, info.v3.width, info.v3.height);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static int Publish()
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_FinalSize(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (!g_bus.create(BUS_NAME, BUS_SLOTS, TDIBWIDTHBYTES(24 * nWidth) * nHeight))
+        printf("failed to create the frame bus %s\n", BUS_NAME);
+    else
+    {
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("publishing to %s, press ENTER to exit\n", BUS_NAME);
+            getc(stdin);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    g_bus.close();
+    return 0;
+}
+
+static int Read()
+{
+    FrameBusReader bus;
+    if (!bus.open(BUS_NAME))
+    {
+        printf("failed to attach to %s, is the publisher running?\n", BUS_NAME);
+        return -1;
+    }
+    printf("reading from %s, press Ctrl+C to exit\n", BUS_NAME);
+    while (1)
+    {
+        ToupcamFrameInfoV4 info;
+        uint32_t size = 0;
+        const unsigned char* p = (const unsigned char*)bus.acquire(1000, &info, &size);
+        if (NULL == p)
+        {
+            printf("no frame\n");
+            continue;
+        }
+        /* the frame is used where it is, no copy */
+        unsigned long long sum = 0;
+        for (uint32_t i = 0; i < size; ++i)
+            sum += p[i];
+        const bool bIntact = bus.release();
+        if (bIntact && (0 == (bus.received % 100)))
+            printf("seq = %u, %u x %u, mean = %.1f, received = %u, lost = %u, torn = %u\n", info.v3.seq, info.v3.width, info.v3.height,
+                size ? (double)sum / size : 0.0, bus.received, bus.lost, bus.torn);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc > 1) && (0 == strcmp(argv[1], "publish")))
+        return Publish();
+    if ((argc > 1) && (0 == strcmp(argv[1], "read")))
+        return Read();
+    printf("usage: %s publish|read\n", argv[0]);
+    return -1;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include "toupcam.h"
+#include "../framepool.h"
+
+/*
+    Frames processed by a pool of workers (samples/framepool.h), the results in order.
+    The event callback pulls each frame into a slot of the pool; a worker computes the mean luminance of the frame and
+    then holds it for the given time, standing for an encoder or a correction which takes several frame times. The
+    sink checks that the results come in the order of seq and counts them. Each second: the frame rate of the camera,
+    the results per second out of the sink, the frames dropped for want of a free slot, and the results out of order
+    (always 0). With workers x frame time below the processing time the pool runs out of slots and drops; one more
+    worker and it keeps up.
+    usage: demoframepool [workers, default 4] [processing ms per frame, default 100] [seconds, default 10]
+*/
+struct Result {
+    double mean;
+};
+
+typedef FramePool<Result> Pool;
+
+HToupcam g_hcam = NULL;
+Pool* g_pool = NULL;
+std::vector<unsigned char> g_scratch;   /* the frames dropped are pulled into it */
+unsigned g_workMs = 100;
+unsigned g_lastSeq = 0, g_nOutOfOrder = 0;
+bool g_bFirst = true;
+double g_mean = 0.0;
+
+static void Process(void* ctx, unsigned worker, Pool::Slot* slot)
+{
+    const unsigned stride = TDIBWIDTHBYTES(24 * slot->info.v3.width);
+    unsigned long long sum = 0;
+    for (unsigned y = 0; y < slot->info.v3.height; ++y)
+    {
+        const unsigned char* p = &slot->buf[0] + (size_t)y * stride;
+        for (unsigned x = 0; x < slot->info.v3.width * 3; ++x)
+            sum += p[x];
+    }
+    slot->result.mean = (double)sum / ((unsigned long long)slot->info.v3.width * slot->info.v3.height * 3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(g_workMs));
+}
+
+/* one at a time: no lock for the globals it updates */
+static void Sink(void* ctx, Pool::Slot* slot)
+{
+    if ((!g_bFirst) && ((int)(slot->info.v3.seq - g_lastSeq) <= 0))
+        ++g_nOutOfOrder;
+    g_bFirst = false;
+    g_lastSeq = slot->info.v3.seq;
+    g_mean = slot->result.mean;
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        Pool::Slot* slot = g_pool->acquire();
+        if (NULL == slot)
+            Toupcam_PullImageV4(g_hcam, &g_scratch[0], 0, 24, 0, &info);
+        else if (SUCCEEDED(Toupcam_PullImageV4(g_hcam, &slot->buf[0], 0, 24, 0, &info)))
+            g_pool->submit(slot, info);
+        else
+            g_pool->cancel(slot);
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned workers = (argc > 1) ? (unsigned)atoi(argv[1]) : 4;
+    g_workMs = (argc > 2) ? (unsigned)atoi(argv[2]) : 100;
+    const unsigned seconds = (argc > 3) ? (unsigned)atoi(argv[3]) : 10;
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    const size_t frameBytes = (size_t)TDIBWIDTHBYTES(24 * nWidth) * nHeight;
+    g_scratch.resize(frameBytes);
+    g_pool = new Pool(workers, workers + 2, frameBytes, Process, Sink, NULL);
+
+    hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+    if (FAILED(hr))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("%u workers, processing %u ms per frame\n", g_pool->workers(), g_workMs);
+        unsigned lastDelivered = 0;
+        for (unsigned t = 1; t <= seconds; ++t)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            unsigned nFrame = 0, nTime = 0, nTotal = 0;
+            Toupcam_get_FrameRate(g_hcam, &nFrame, &nTime, &nTotal);
+            const unsigned delivered = g_pool->delivered();
+            printf("%3u s: camera %5.1f fps, results %3u/s, dropped %u, out of order %u, mean %.1f\n",
+                t, nTime ? (nFrame * 1000.0 / nTime) : 0.0, delivered - lastDelivered, g_pool->dropped(), g_nOutOfOrder, g_mean);
+            lastDelivered = delivered;
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    g_pool->stop();
+    printf("submitted %u, delivered %u, dropped %u, out of order %u, at most %u frames in the pool, latency up to %.0f ms\n",
+        g_pool->submitted(), g_pool->delivered(), g_pool->dropped(), g_nOutOfOrder, g_pool->peak(), g_pool->maxLatency());
+    delete g_pool;
+    return 0;
+}
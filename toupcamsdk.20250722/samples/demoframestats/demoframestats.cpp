@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <conio.h>
+#else
+#include <curses.h>
+#endif
+#include "toupcam.h"
+#include "../framestats.h"
+
+/*
+    Histogram, saturation and region statistics of every RAW frame, computed in the callback right after the pull
+    (framestats.h), and printed with the frame info. Five regions: the centre and the four corners, 1/8 of the frame
+    each, which is what a flat field or an exposure check looks at.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned g_total = 0, g_bytesPerPixel = 1;
+FrameStatsEngine g_engine;
+FrameStats g_stats;
+
+static void PrintStats(const ToupcamFrameInfoV4& info, const FrameStats& stats)
+{
+    printf("frame %u, %u x %u, mean = %.1f, median = %u, p99 = %u, saturated = %.3f%%\n", ++g_total, info.v3.width, info.v3.height,
+        stats.mean, stats.percentile(0.5), stats.percentile(0.99), stats.total ? stats.saturated * 100.0 / stats.total : 0.0);
+    for (unsigned i = 0; i < stats.nRect; ++i)
+        printf("    roi %u: mean = %.1f, std = %.2f, min = %u, max = %u\n", i, stats.rect[i].mean, stats.rect[i].stddev, stats.rect[i].min, stats.rect[i].max);
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            g_engine.compute(g_pImageData, g_bytesPerPixel, 0, info, &g_stats);
+            PrintStats(info, g_stats);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int, char**)
+{
+    Toupcam_GigeEnable(NULL, NULL); /* Enable GigE */
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    HRESULT hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    if (FAILED(hr))
+        printf("failed to put option raw, hr = 0x%08x\n", hr);
+    else
+    {
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1); /* the full bit depth of the sensor, if it has more than 8 */
+        unsigned nFourCC = 0, bits = 8;
+        Toupcam_get_RawFormat(g_hcam, &nFourCC, &bits);
+        g_bytesPerPixel = (bits > 8) ? 2 : 1;
+        g_engine.setBits(bits);
+
+        int nWidth = 0, nHeight = 0;
+        hr = Toupcam_get_FinalSize(g_hcam, &nWidth, &nHeight);
+        if (FAILED(hr))
+            printf("failed to get size, hr = 0x%08x\n", hr);
+        else
+        {
+            const unsigned fw = nWidth, fh = nHeight, w = fw / 8, h = fh / 8;
+            const FrameRect rects[] = {
+                { (fw - w) / 2, (fh - h) / 2, w, h },
+                { 0, 0, w, h },
+                { fw - w, 0, w, h },
+                { 0, fh - h, w, h },
+                { fw - w, fh - h, w, h }
+            };
+            g_engine.setRects(rects, sizeof(rects) / sizeof(rects[0]));
+            g_pImageData = malloc(nWidth * nHeight * g_bytesPerPixel);
+            if (NULL == g_pImageData)
+                printf("failed to malloc\n");
+            else
+            {
+                printf("raw, %u bits\n", bits);
+                hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+                if (FAILED(hr))
+                    printf("failed to start camera, hr = 0x%08x\n", hr);
+                else
+                {
+                    printf("press any key to exit\n");
+                    getch();
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
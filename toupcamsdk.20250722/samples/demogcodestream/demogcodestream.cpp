@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "../gcodestream.h"
+
+/*
+    Streams a G-code file to a Marlin controller with the window of gcodestream.h.
+    usage: demogcodestream <file.gcode> <port> [rx = 128] [bufsize = 4] [report = 0]
+    rx, bufsize: RX_BUFFER_SIZE and BUFSIZE of the controller build; bufsize 1 is one line then its "ok", the old way,
+    for comparison. report: every report lines an M114 goes into the stream and the position is printed. At the end
+    the stream is synced (M400) and the time, the lines and the errors are printed.
+*/
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <file.gcode> <port> [rx] [bufsize] [report]\n", argv[0]);
+        return -1;
+    }
+    FILE* fp = fopen(argv[1], "r");
+    if (NULL == fp)
+    {
+        printf("failed to open %s\n", argv[1]);
+        return -1;
+    }
+    const unsigned report = (argc > 5) ? (unsigned)atoi(argv[5]) : 0;
+    GcodeStream stream;
+    stream.put((argc > 3) ? (unsigned)atoi(argv[3]) : GCODESTREAM_RX_BUFFER, (argc > 4) ? (unsigned)atoi(argv[4]) : GCODESTREAM_BUFSIZE);
+    if (!stream.open(argv[2]))
+    {
+        printf("failed to open %s\n", argv[2]);
+        fclose(fp);
+        return -1;
+    }
+
+    int ret = 0;
+    unsigned lines = 0;
+    char line[256];
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (!stream.send(line))
+        {
+            printf("failed to send line %u: %s, %s\n", lines + 1, line, stream.lastError().c_str());
+            ret = -1;
+            break;
+        }
+        ++lines;
+        if (report && (0 == lines % report))
+        {
+            double x = 0, y = 0, z = 0;
+            if (stream.position(&x, &y, &z))
+                printf("line %u: X %.3f, Y %.3f, Z %.3f\n", lines, x, y, z);
+        }
+    }
+    if ((0 == ret) && !stream.sync())
+    {
+        printf("failed to sync, %s\n", stream.lastError().c_str());
+        ret = -1;
+    }
+    printf("%u lines, %.2f s, %u errors\n", lines, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(), stream.errors());
+
+    /* cleanup */
+    stream.close();
+    fclose(fp);
+    return ret;
+}
@@ -0,0 +1,396 @@
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <iphlpapi.h>
+#else
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "toupcam.h"
+
+/*
+    Streaming auto-tune of a GigE camera: the defaults of TOUPCAM_OPTION_GVSP_WAIT_PERCENT, GVCP_TIMEOUT and GVCP_RETRY
+    suit a 1 Gigabit link, on 2.5/5/10 Gigabit cameras under load they may end in resend storms and dropped frames.
+    The packet size is negotiated by the SDK and not exposed, so the host interfaces and their MTU are listed first: a
+    10 Gigabit camera behind an interface without jumbo frames (MTU < 9000) will not reach its rate whatever the tune.
+    The settings are then searched in stages, each trial streaming for TRIAL_MS after a warm-up:
+        1. GVSP wait percent, at the full bandwidth and the default GVCP
+        2. GVCP timeout / retry, with the best wait percent
+        3. if still lossy, the bandwidth (TOUPCAM_OPTION_BANDWIDTH, on TOUPCAM_FLAG_PRECISE_FRAMERATE cameras) is lowered
+    A trial is sustainable when the lost frames (sequence gaps + TOUPCAM_OPTION_NUMBER_DROP_FRAME) stay below LOSS_MAX
+    and no error event came; the best one is the sustainable one with the highest MB/s, then the lowest p99 latency
+    (the transit of demolatency: the time from the camera timestamp to the image event above the fastest frame).
+    This is a one-shot probe: the settings belong to the handle and end with Toupcam_Close, so the result is saved per
+    serial number to gigetune.txt for the application to apply after every Toupcam_Open; "demogigetune -a" does that,
+    it only applies the saved settings and measures them once.
+*/
+#define TRIAL_MS        3000
+#define WARMUP_MS       500
+#define LOSS_MAX        0.001
+#define TUNE_FILE       "gigetune.txt"
+
+typedef struct {
+    int bandwidth, waitPercent, gvcpTimeout, gvcpRetry;    /* bandwidth 0: not supported, left as it is */
+} GigeSetting;
+
+typedef struct {
+    unsigned frames, lost, errors;
+    double fps, mbps, loss;
+    long long p99;      /* us, -1: no timestamp */
+} TrialResult;
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+static std::atomic<bool> g_bCount(false);
+static std::atomic<unsigned> g_frames(0), g_gaps(0), g_errors(0);
+static std::atomic<unsigned long long> g_bytes(0);
+static unsigned g_lastSeq = 0, g_bytesPerPixel = 1;
+static bool g_bSeq = false;
+static std::mutex g_mtx;
+static std::vector<long long> g_transit;    /* event - camera timestamp, us */
+
+static long long HostMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* the largest MTU of the interfaces which are up */
+static unsigned ListInterfaces()
+{
+    unsigned maxMtu = 0;
+#if defined(_WIN32)
+    ULONG len = 16 * 1024;
+    std::vector<unsigned char> buf(len);
+    ULONG ret = GetAdaptersAddresses(AF_INET, GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER, NULL, (PIP_ADAPTER_ADDRESSES)&buf[0], &len);
+    if (ERROR_BUFFER_OVERFLOW == ret)
+    {
+        buf.resize(len);
+        ret = GetAdaptersAddresses(AF_INET, GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER, NULL, (PIP_ADAPTER_ADDRESSES)&buf[0], &len);
+    }
+    if (NO_ERROR != ret)
+        printf("failed to GetAdaptersAddresses, ret = %lu\n", ret);
+    else
+    {
+        for (PIP_ADAPTER_ADDRESSES p = (PIP_ADAPTER_ADDRESSES)&buf[0]; p; p = p->Next)
+        {
+            if ((IfOperStatusUp != p->OperStatus) || (IF_TYPE_SOFTWARE_LOOPBACK == p->IfType))
+                continue;
+            wprintf(L"interface: %s, MTU = %lu, link = %llu Mbps\n", p->FriendlyName, p->Mtu, p->TransmitLinkSpeed / 1000000);
+            maxMtu = std::max(maxMtu, (unsigned)p->Mtu);
+        }
+    }
+#else
+    struct ifaddrs* ifa = NULL;
+    if (getifaddrs(&ifa))
+        printf("failed to getifaddrs\n");
+    else
+    {
+        const int s = socket(AF_INET, SOCK_DGRAM, 0);
+        for (struct ifaddrs* p = ifa; p; p = p->ifa_next)
+        {
+            if ((NULL == p->ifa_addr) || (AF_INET != p->ifa_addr->sa_family) || (0 == (p->ifa_flags & IFF_UP)) || (p->ifa_flags & IFF_LOOPBACK))
+                continue;
+            struct ifreq ifr;
+            memset(&ifr, 0, sizeof(ifr));
+            strncpy(ifr.ifr_name, p->ifa_name, IFNAMSIZ - 1);
+            if ((s >= 0) && (0 == ioctl(s, SIOCGIFMTU, &ifr)))
+            {
+                printf("interface: %s, MTU = %d\n", p->ifa_name, ifr.ifr_mtu);
+                maxMtu = std::max(maxMtu, (unsigned)ifr.ifr_mtu);
+            }
+        }
+        if (s >= 0)
+            close(s);
+        freeifaddrs(ifa);
+    }
+#endif
+    return maxMtu;
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const long long tEvent = HostMicroseconds();
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 0, 0, &info);
+        if (FAILED(hr))
+            ++g_errors;
+        else
+        {
+            if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_SEQ)
+            {
+                if (g_bSeq && g_bCount && (info.v3.seq > g_lastSeq + 1))
+                    g_gaps += info.v3.seq - g_lastSeq - 1;
+                g_lastSeq = info.v3.seq;
+                g_bSeq = true;
+            }
+            if (g_bCount)
+            {
+                ++g_frames;
+                g_bytes += info.v3.width * info.v3.height * g_bytesPerPixel;
+                if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP)
+                {
+                    std::lock_guard<std::mutex> lock(g_mtx);
+                    g_transit.push_back(tEvent - (long long)info.v3.timestamp);
+                }
+            }
+        }
+    }
+    else if ((TOUPCAM_EVENT_ERROR == nEvent) || (TOUPCAM_EVENT_NOPACKETTIMEOUT == nEvent) || (TOUPCAM_EVENT_DISCONNECTED == nEvent))
+    {
+        if (g_bCount)
+            ++g_errors;
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static void Apply(const GigeSetting& s)
+{
+    if (s.bandwidth)
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BANDWIDTH, s.bandwidth);
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_GVSP_WAIT_PERCENT, s.waitPercent);
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_GVCP_TIMEOUT, s.gvcpTimeout);
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_GVCP_RETRY, s.gvcpRetry);
+}
+
+static HRESULT Trial(const GigeSetting& s, TrialResult* pResult)
+{
+    memset(pResult, 0, sizeof(TrialResult));
+    Apply(s);
+    g_bCount = false;
+    g_bSeq = false;
+    HRESULT hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+    if (FAILED(hr))
+    {
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+        return hr;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(WARMUP_MS));
+    int drop0 = 0, drop1 = 0;
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_NUMBER_DROP_FRAME, &drop0);
+    g_frames = g_gaps = g_errors = 0;
+    g_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        g_transit.clear();
+    }
+    const long long t0 = HostMicroseconds();
+    g_bCount = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(TRIAL_MS));
+    g_bCount = false;
+    const double sec = (HostMicroseconds() - t0) / 1000000.0;
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_NUMBER_DROP_FRAME, &drop1);
+    Toupcam_Stop(g_hcam);
+
+    pResult->frames = g_frames;
+    pResult->lost = g_gaps + ((drop1 > drop0) ? (drop1 - drop0) : 0);
+    pResult->errors = g_errors;
+    pResult->fps = pResult->frames / sec;
+    pResult->mbps = g_bytes / sec / 1048576.0;
+    pResult->loss = (pResult->frames + pResult->lost) ? (double)pResult->lost / (pResult->frames + pResult->lost) : 1.0;
+    pResult->p99 = -1;
+    std::lock_guard<std::mutex> lock(g_mtx);
+    if (g_transit.size())
+    {
+        std::sort(g_transit.begin(), g_transit.end());
+        pResult->p99 = g_transit[g_transit.size() * 99 / 100] - g_transit[0];
+    }
+    printf("bandwidth = %d, wait = %d%%, gvcp = %d ms x %d: %.1f fps, %.1f MB/s, lost = %u (%.3f%%), errors = %u, p99 = %lld us\n",
+        s.bandwidth, s.waitPercent, s.gvcpTimeout, s.gvcpRetry, pResult->fps, pResult->mbps, pResult->lost, pResult->loss * 100.0, pResult->errors, pResult->p99);
+    return 0;
+}
+
+static bool Sustainable(const TrialResult& r)
+{
+    return (r.frames > 0) && (r.loss < LOSS_MAX) && (0 == r.errors);
+}
+
+/* is a better than b */
+static bool Better(const TrialResult& a, const TrialResult& b)
+{
+    if (Sustainable(a) != Sustainable(b))
+        return Sustainable(a);
+    if (!Sustainable(a))
+        return a.loss < b.loss;
+    if (a.mbps > b.mbps * 1.02)     /* within 2%, the same rate */
+        return true;
+    if (b.mbps > a.mbps * 1.02)
+        return false;
+    return (a.p99 >= 0) && ((b.p99 < 0) || (a.p99 < b.p99));
+}
+
+static bool LoadSetting(const char* sn, GigeSetting* pSetting)
+{
+    FILE* fp = fopen(TUNE_FILE, "r");
+    if (NULL == fp)
+        return false;
+    bool bFound = false;
+    char line[256], s[32];
+    GigeSetting g;
+    while ((!bFound) && fgets(line, sizeof(line), fp))
+    {
+        if ((5 == sscanf(line, "%31s %d %d %d %d", s, &g.bandwidth, &g.waitPercent, &g.gvcpTimeout, &g.gvcpRetry)) && (0 == strcmp(s, sn)))
+        {
+            *pSetting = g;
+            bFound = true;
+        }
+    }
+    fclose(fp);
+    return bFound;
+}
+
+/* replace the line of the camera, keep the others */
+static bool SaveSetting(const char* sn, const GigeSetting& g, const TrialResult& r)
+{
+    std::vector<std::string> vecLine;
+    FILE* fp = fopen(TUNE_FILE, "r");
+    if (fp)
+    {
+        char line[256], s[32];
+        while (fgets(line, sizeof(line), fp))
+        {
+            if ((1 == sscanf(line, "%31s", s)) && strcmp(s, sn))
+                vecLine.push_back(line);
+        }
+        fclose(fp);
+    }
+    fp = fopen(TUNE_FILE, "w");
+    if (NULL == fp)
+        return false;
+    for (size_t i = 0; i < vecLine.size(); ++i)
+        fputs(vecLine[i].c_str(), fp);
+    fprintf(fp, "%s %d %d %d %d %.1f\n", sn, g.bandwidth, g.waitPercent, g.gvcpTimeout, g.gvcpRetry, r.mbps);
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const bool bApplyOnly = (argc > 1) && (0 == strcmp(argv[1], "-a"));
+    const unsigned mtu = ListInterfaces();
+
+    Toupcam_GigeEnable(NULL, NULL); /* Enable GigE */
+    for (int i = 0; (i < 10) && (NULL == g_hcam); ++i)
+    {
+        g_hcam = Toupcam_Open(NULL);
+        if (NULL == g_hcam)
+        {
+            printf("wait to find camera\n");
+#if defined(_WIN32)
+            Sleep(1000);
+#else
+            sleep(1);
+#endif
+        }
+    }
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    char sn[32] = { 0 };
+    Toupcam_get_SerialNumber(g_hcam, sn);
+    const unsigned long long flag = Toupcam_query_Model(g_hcam)->flag;
+    const char* link = (flag & TOUPCAM_FLAG_10GIGE) ? "10G" : ((flag & TOUPCAM_FLAG_5GIGE) ? "5G" : ((flag & TOUPCAM_FLAG_25GIGE) ? "2.5G" : ((flag & TOUPCAM_FLAG_GIGE) ? "1G" : NULL)));
+    if (NULL == link)
+    {
+        printf("%s is not a GigE camera\n", sn);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    printf("camera: %s, %s\n", sn, link);
+    if ((flag & (TOUPCAM_FLAG_10GIGE | TOUPCAM_FLAG_5GIGE)) && (mtu < 9000))
+        printf("warning: no interface with jumbo frames (MTU = %u), the rate of a %s camera is limited by the host\n", mtu, link);
+
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    int bitDepth = 0;
+    if (SUCCEEDED(Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, &bitDepth)) && bitDepth)
+        g_bytesPerPixel = 2;
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_FinalSize(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(nWidth * nHeight * 2);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+    }
+
+    GigeSetting best = { 0 };
+    best.bandwidth = (flag & TOUPCAM_FLAG_PRECISE_FRAMERATE) ? 100 : 0;
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_GVSP_WAIT_PERCENT, &best.waitPercent);
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_GVCP_TIMEOUT, &best.gvcpTimeout);
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_GVCP_RETRY, &best.gvcpRetry);
+    TrialResult bestResult;
+    if (g_pImageData && bApplyOnly)
+    {
+        if (!LoadSetting(sn, &best))
+            printf("no saved setting of %s, measure the current one\n", sn);
+        Trial(best, &bestResult);
+    }
+    else if (g_pImageData && SUCCEEDED(Trial(best, &bestResult)))
+    {
+        static const int arrWait[] = { 0, 1, 5, 20, 50 };
+        static const int arrGvcp[][2] = { { 15, 4 }, { 30, 4 }, { 30, 6 }, { 50, 8 } };
+        TrialResult r;
+        GigeSetting s = best;
+        for (size_t i = 0; i < sizeof(arrWait) / sizeof(arrWait[0]); ++i)
+        {
+            s.waitPercent = arrWait[i];
+            if (SUCCEEDED(Trial(s, &r)) && Better(r, bestResult))
+            {
+                best = s;
+                bestResult = r;
+            }
+        }
+        s = best;
+        for (size_t i = 0; i < sizeof(arrGvcp) / sizeof(arrGvcp[0]); ++i)
+        {
+            s.gvcpTimeout = arrGvcp[i][0];
+            s.gvcpRetry = arrGvcp[i][1];
+            if (SUCCEEDED(Trial(s, &r)) && Better(r, bestResult))
+            {
+                best = s;
+                bestResult = r;
+            }
+        }
+        s = best;
+        while ((!Sustainable(bestResult)) && (s.bandwidth > 40))
+        {
+            s.bandwidth -= 10;
+            if (SUCCEEDED(Trial(s, &r)) && Better(r, bestResult))
+            {
+                best = s;
+                bestResult = r;
+            }
+        }
+
+        printf("best: bandwidth = %d, wait = %d%%, gvcp = %d ms x %d, %.1f MB/s, %s\n", best.bandwidth, best.waitPercent, best.gvcpTimeout, best.gvcpRetry,
+            bestResult.mbps, Sustainable(bestResult) ? "sustainable" : "still lossy, check the interface, the cable and the switch");
+        if (!SaveSetting(sn, best, bestResult))
+            printf("failed to save %s\n", TUNE_FILE);
+        else
+            printf("saved to %s, the camera is closed now: apply it after Toupcam_Open (demogigetune -a)\n", TUNE_FILE);
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "opencv2/imgcodecs.hpp"
+#include "toupcam.h"
+#include "../cvpinned.h"
+#include "../cvfilter.h"
+
+/*
+    Denoise and sharpening on the GPU (../cvfilter.h) for the frames pulled into page-locked memory (../cvpinned.h).
+    usage: demogpufilter [denoise = 50] [sharpening strength = 100] [radius = 2] [threshold = 0]
+    The values are the ones of TOUPCAM_OPTION_DENOISE and TOUPCAM_OPTION_SHARPENING; without CUDA the SDK applies them on
+    the CPU, as it would with the options. Every 30 frames the frame rate and the time of the filters on the GPU.
+*/
+HToupcam g_hcam = NULL;
+CvPinnedPool g_pool;
+CvFilter g_filter;
+cv::cuda::Stream* g_pStream = NULL;  /* made in main: without CUDA, a Stream throws as it is constructed */
+unsigned g_total = 0, g_busy = 0;
+double g_ms = 0;
+std::chrono::steady_clock::time_point g_tStart;
+bool g_bSave = false;
+
+static void removeln(char* str)
+{
+    char* endstr = strchr(str, '\n');
+    if (endstr)
+        *endstr = '\0';
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        CvPinnedFrame frame;
+        const HRESULT hr = g_pool.pull(0, &frame, g_pStream);
+        if (0x8007000e == (unsigned)hr) /* all the slots still in use by the GPU: leave the frame in the SDK */
+            ++g_busy;
+        else if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            if (0 == g_total++)
+                g_tStart = std::chrono::steady_clock::now();
+            try
+            {
+                const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                cv::Mat host;
+                if (g_pStream)
+                {
+                    cv::cuda::GpuMat out;
+                    g_filter.apply(frame.gpu, out, *g_pStream);
+                    if (g_bSave)
+                        out.download(host, *g_pStream);
+                    g_pool.release(frame, g_pStream);
+                    g_pStream->waitForCompletion();
+                }
+                else
+                {
+                    /* filtered by the SDK already */
+                    if (g_bSave)
+                        host = frame.host.clone();
+                    g_pool.release(frame);
+                }
+                g_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                if (0 == g_total % 30)
+                {
+                    const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - g_tStart).count();
+                    printf("frame %u: %u x %u, %.1f fps, %s %.2f ms per frame, busy = %u\n", g_total, frame.info.v3.width, frame.info.v3.height,
+                        (g_total - 1) / s, g_filter.gpu() ? "gpu" : "sdk (cpu)", g_ms / g_total, g_busy);
+                }
+                if (g_bSave)
+                {
+                    char path[128];
+                    sprintf(path, "Image_%d.bmp", g_total);
+                    cv::imwrite(path, host);
+                    printf("succesd to save image\n");
+                    g_bSave = false;
+                }
+            }
+            catch (cv::Exception& ex)
+            {
+                g_pool.release(frame);
+                printf("Exception in processing: %s\n", ex.what());
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const int denoise = (argc > 1) ? atoi(argv[1]) : 50;
+    const unsigned strength = (argc > 2) ? (unsigned)atoi(argv[2]) : 100;
+    const unsigned radius = (argc > 3) ? (unsigned)atoi(argv[3]) : 2;
+    const unsigned threshold = (argc > 4) ? (unsigned)atoi(argv[4]) : 0;
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (cv::cuda::getCudaEnabledDeviceCount() > 0)
+        g_pStream = new cv::cuda::Stream();
+    else
+        printf("no CUDA device, or OpenCV built without CUDA: the SDK filters on the CPU\n");
+    HRESULT hr = g_pool.init(g_hcam, 3, 24);
+    if (FAILED(hr))
+        printf("failed to allocate pinned memory, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = g_filter.init(g_hcam, denoise, (threshold << 24) | (radius << 16) | strength)))
+        printf("failed to set the filters, hr = 0x%08x\n", hr);
+    else
+    {
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            char str[1024];
+            do {
+                printf("Please input [s/S] to save image ([x/X] to exit):\n");
+                if (fgets(str, 1023, stdin))
+                {
+                    removeln(str);
+                    if ('s' == str[0] || 'S' == str[0])
+                        g_bSave = true;
+                    else if ('x' == str[0] || 'X' == str[0])
+                        break;
+                }
+            } while (true);
+        }
+    }
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    delete g_pStream;
+    return 0;
+}
@@ -0,0 +1,232 @@
+#ifndef __camgroup_H__
+#define __camgroup_H__
+
+/*
+    A group of cameras acquired together, such as brightfield + fluorescence on the same stage.
+    open() opens the cameras, start() starts them back to back, each with its own event callback and pull buffer; the
+    frames are matched into framesets and every complete frameset is delivered through one GROUP_CALLBACK.
+    Matching: each frame gets a time on the host clock. With TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP it is the camera timestamp
+    plus the offset of that camera clock to the host clock, estimated as the minimum of (arrival - timestamp) seen so far
+    (the same estimate as demolatency), otherwise the arrival time. A frameset is the latest frame of every camera when
+    they all lie within the tolerance; a frame older than the newest one by more than the tolerance is never matched
+    and is counted in unmatched().
+    Free running cameras are matched to the nearest frame; for frames taken at the same instant, put the cameras in
+    software trigger mode and call triggerAt(), which programs TOUPCAM_OPTION_TIMED_TRIGGER_LOW/HIGH on all of them,
+    on the cameras which support the timed trigger (synchronized clocks, such as the GigE cameras with PTP).
+    balanceBandwidth() shares TOUPCAM_OPTION_BANDWIDTH between the cameras with TOUPCAM_FLAG_PRECISE_FRAMERATE; use it
+    when they sit on the same USB controller, the SDK does not tell which controller a camera is on.
+*/
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "toupcam.h"
+
+/* called on the callback thread of the camera which completed the frameset, data[i] is valid until it returns */
+typedef void (*GROUP_CALLBACK)(void* ctx, unsigned n, const void* const* data, const ToupcamFrameInfoV4* pInfo);
+
+class CamGroup {
+    struct Member {
+        CamGroup* group;
+        HToupcam hcam;
+        std::vector<unsigned char> buf[3];  /* pull, pending, delivered */
+        ToupcamFrameInfoV4 info, infoPending;
+        long long offset, time;             /* host microseconds */
+        bool bOffset, bPending;
+    };
+    GROUP_CALLBACK m_pFun;
+    void* m_ctx;
+    long long m_tolerance;
+    std::vector<Member*> m_member;
+    std::vector<const void*> m_data;
+    std::vector<ToupcamFrameInfoV4> m_info;
+    std::mutex m_mtx, m_mtxDeliver;         /* always in this order */
+    std::atomic<unsigned> m_nFramesets, m_nUnmatched;
+
+    static long long HostMicroseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+    {
+        Member* pMember = (Member*)pCallbackCtx;
+        if (TOUPCAM_EVENT_IMAGE == nEvent)
+            pMember->group->onImage(pMember);
+    }
+
+    void onImage(Member* pMember)
+    {
+        const long long tArrival = HostMicroseconds();
+        ToupcamFrameInfoV4 info = { 0 };
+        if (FAILED(Toupcam_PullImageV4(pMember->hcam, &pMember->buf[0][0], 0, 24, 0, &info)))
+            return;
+
+        std::unique_lock<std::mutex> lock(m_mtx);
+        long long t = tArrival;
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP)
+        {
+            const long long diff = tArrival - (long long)info.v3.timestamp;
+            if ((!pMember->bOffset) || (diff < pMember->offset))
+            {
+                pMember->offset = diff;
+                pMember->bOffset = true;
+            }
+            t = (long long)info.v3.timestamp + pMember->offset;
+        }
+        if (pMember->bPending)
+            ++m_nUnmatched;     /* replaced before it found its frameset */
+        pMember->buf[0].swap(pMember->buf[1]);
+        pMember->infoPending = info;
+        pMember->time = t;
+        pMember->bPending = true;
+
+        long long tMin = t, tMax = t;
+        for (size_t i = 0; i < m_member.size(); ++i)
+        {
+            if (!m_member[i]->bPending)
+                return;
+            tMin = std::min(tMin, m_member[i]->time);
+            tMax = std::max(tMax, m_member[i]->time);
+        }
+        if (tMax - tMin > m_tolerance)
+        {
+            for (size_t i = 0; i < m_member.size(); ++i)
+            {
+                if (tMax - m_member[i]->time > m_tolerance)
+                {
+                    m_member[i]->bPending = false;
+                    ++m_nUnmatched;
+                }
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> lockDeliver(m_mtxDeliver);
+        for (size_t i = 0; i < m_member.size(); ++i)
+        {
+            Member* p = m_member[i];
+            p->buf[1].swap(p->buf[2]);
+            p->info = p->infoPending;
+            p->bPending = false;
+            m_data[i] = &p->buf[2][0];
+            m_info[i] = p->info;
+        }
+        ++m_nFramesets;
+        lock.unlock();  /* the other cameras go on pulling while the frameset is delivered */
+        m_pFun(m_ctx, (unsigned)m_member.size(), &m_data[0], &m_info[0]);
+    }
+public:
+    CamGroup(GROUP_CALLBACK pFun, void* ctx, unsigned toleranceMs)
+    : m_pFun(pFun), m_ctx(ctx), m_tolerance((long long)toleranceMs * 1000), m_nFramesets(0), m_nUnmatched(0)
+    {
+    }
+    ~CamGroup()
+    {
+        close();
+    }
+
+    /* ids of Toupcam_EnumV2, NULL = all the cameras enumerated; returns the number of cameras opened */
+    unsigned open(const char* const* ids, unsigned n)
+    {
+        ToupcamDeviceV2 arr[TOUPCAM_MAX] = { 0 };
+        if (NULL == ids)
+            n = Toupcam_EnumV2(arr);
+        for (unsigned i = 0; i < n; ++i)
+        {
+            HToupcam h = Toupcam_Open(ids ? ids[i] : arr[i].id);
+            if (h)
+            {
+                Member* p = new Member();
+                p->group = this;
+                p->hcam = h;
+                p->offset = p->time = 0;
+                p->bOffset = p->bPending = false;
+                m_member.push_back(p);
+            }
+        }
+        m_data.resize(m_member.size());
+        m_info.resize(m_member.size());
+        return (unsigned)m_member.size();
+    }
+
+    void close()
+    {
+        for (size_t i = 0; i < m_member.size(); ++i)
+            Toupcam_Close(m_member[i]->hcam);   /* no more callback after this */
+        for (size_t i = 0; i < m_member.size(); ++i)
+            delete m_member[i];
+        m_member.clear();
+    }
+
+    unsigned count() const { return (unsigned)m_member.size(); }
+    HToupcam handle(unsigned index) const { return m_member[index]->hcam; }
+
+    /* returns the number of cameras whose bandwidth was set */
+    unsigned balanceBandwidth()
+    {
+        std::vector<HToupcam> precise;
+        for (size_t i = 0; i < m_member.size(); ++i)
+        {
+            if (Toupcam_query_Model(m_member[i]->hcam)->flag & TOUPCAM_FLAG_PRECISE_FRAMERATE)
+                precise.push_back(m_member[i]->hcam);
+        }
+        unsigned n = 0;
+        for (size_t i = 0; i < precise.size(); ++i)
+        {
+            if (SUCCEEDED(Toupcam_put_Option(precise[i], TOUPCAM_OPTION_BANDWIDTH, std::max(1, 100 / (int)precise.size()))))
+                ++n;
+        }
+        return n;
+    }
+
+    /* starts all the cameras, stops them all if any of them fails */
+    HRESULT start()
+    {
+        for (size_t i = 0; i < m_member.size(); ++i)
+        {
+            Member* p = m_member[i];
+            int width = 0, height = 0;
+            HRESULT hr = Toupcam_get_Size(p->hcam, &width, &height);
+            if (SUCCEEDED(hr))
+            {
+                for (int j = 0; j < 3; ++j)
+                    p->buf[j].resize(TDIBWIDTHBYTES(24 * width) * height);
+                hr = Toupcam_StartPullModeWithCallback(p->hcam, EventCallback, p);
+            }
+            if (FAILED(hr))
+            {
+                stop();
+                return hr;
+            }
+        }
+        return 0;  /* S_OK */
+    }
+
+    void stop()
+    {
+        for (size_t i = 0; i < m_member.size(); ++i)
+            Toupcam_Stop(m_member[i]->hcam);
+    }
+
+    /* nanoseconds since the epoch, on the cameras in trigger mode */
+    HRESULT triggerAt(unsigned long long ns)
+    {
+        for (size_t i = 0; i < m_member.size(); ++i)
+        {
+            HRESULT hr = Toupcam_put_Option(m_member[i]->hcam, TOUPCAM_OPTION_TIMED_TRIGGER_LOW, (int)(ns & 0xffffffff));
+            if (SUCCEEDED(hr))
+                hr = Toupcam_put_Option(m_member[i]->hcam, TOUPCAM_OPTION_TIMED_TRIGGER_HIGH, (int)(ns >> 32));
+            if (FAILED(hr))
+                return hr;
+        }
+        return 0;  /* S_OK */
+    }
+
+    unsigned framesets() const { return m_nFramesets; }
+    unsigned unmatched() const { return m_nUnmatched; }
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "camgroup.h"
+
+/*
+    Acquisition with a group of cameras, matched into framesets.
+    usage: demogroup [tolerance ms = 5] [share] [timed]
+    All the cameras enumerated are opened as one CamGroup (camgroup.h) and started together; "share" splits the USB
+    bandwidth between them (cameras on the same controller), "timed" puts them in software trigger mode and every
+    ENTER schedules one frameset TIMED_DELAY_MS ahead with the timed trigger, otherwise they run free and are matched
+    to the nearest frame.
+*/
+#define TIMED_DELAY_MS      100
+
+CamGroup* g_pGroup = NULL;
+
+static void GroupCallback(void* ctx, unsigned n, const void* const* data, const ToupcamFrameInfoV4* pInfo)
+{
+    /* After we get the frameset, we can do anything for the data we want to do */
+    printf("frameset %u:", g_pGroup->framesets());
+    for (unsigned i = 0; i < n; ++i)
+        printf(" [seq = %u, timestamp = %llu, %u x %u]", pInfo[i].v3.seq, pInfo[i].v3.timestamp, pInfo[i].v3.width, pInfo[i].v3.height);
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned toleranceMs = (argc > 1) ? (unsigned)atoi(argv[1]) : 5;
+    bool bShare = false, bTimed = false;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "share"))
+            bShare = true;
+        else if (0 == strcmp(argv[i], "timed"))
+            bTimed = true;
+    }
+
+    g_pGroup = new CamGroup(GroupCallback, NULL, toleranceMs);
+    const unsigned num = g_pGroup->open(NULL, 0);
+    if (0 == num)
+        printf("no camera found or open failed\n");
+    else
+    {
+        printf("%u cameras\n", num);
+        if (bShare)
+            printf("bandwidth shared by %u cameras\n", g_pGroup->balanceBandwidth());
+        if (bTimed)
+        {
+            for (unsigned i = 0; i < num; ++i)
+                Toupcam_put_Option(g_pGroup->handle(i), TOUPCAM_OPTION_TRIGGER, 1);
+        }
+        HRESULT hr = g_pGroup->start();
+        if (FAILED(hr))
+            printf("failed to start the cameras, hr = 0x%08x\n", hr);
+        else
+        {
+            printf(bTimed ? "press ENTER to take a frameset, 'x' to exit\n" : "press 'x' and ENTER to exit\n");
+            do {
+                char str[1024];
+                if (fgets(str, 1023, stdin))
+                {
+                    if (('x' == str[0]) || ('X' == str[0]))
+                        break;
+                    if (bTimed)
+                    {
+                        const unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count() + TIMED_DELAY_MS * 1000000ULL;
+                        hr = g_pGroup->triggerAt(ns);
+                        if (FAILED(hr))
+                            printf("failed to set the timed trigger, hr = 0x%08x\n", hr);
+                    }
+                }
+            } while (true);
+            g_pGroup->stop();
+            printf("framesets = %u, unmatched frames = %u\n", g_pGroup->framesets(), g_pGroup->unmatched());
+        }
+    }
+
+    /* cleanup */
+    delete g_pGroup;    /* closes the cameras */
+    return 0;
+}
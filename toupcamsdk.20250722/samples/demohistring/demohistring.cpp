@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include "toupcam.h"
+#include "../histring.h"
+
+/*
+    Continuous histograms through HistRing (samples/histring.h): TOUPCAM_OPTION_HISTOGRAM = 1 and one
+    Toupcam_GetHistogramV2, then the SDK calls back with the histogram of each frame. The main thread stands for the
+    UI: it takes the newest histogram every 33 ms (a repaint at 30 Hz) with latest() and once a second prints the
+    histograms pushed and dropped, the seq of the newest against the last frame pulled, its mean and 16 bars of its
+    first channel.
+    usage: demohistring [seconds = 10]
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+HistRing g_ring;
+std::atomic<unsigned> g_nFrame(0), g_nSeq(0);
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            g_ring.frame(info.v3.seq);
+            g_nSeq = info.v3.seq;
+            ++g_nFrame;
+        }
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static void Print(const HistSlot* p)
+{
+    double sum = 0, mean = 0;
+    unsigned bar[16] = { 0 }, peak = 1;
+    for (unsigned i = 0; i < p->bins; ++i)
+    {
+        sum += p->hist[i];
+        mean += (double)i * p->hist[i];
+        bar[i * 16 / p->bins] += p->hist[i];
+    }
+    for (unsigned i = 0; i < 16; ++i)
+    {
+        if (bar[i] > peak)
+            peak = bar[i];
+    }
+    char text[17] = { 0 };
+    for (unsigned i = 0; i < 16; ++i)
+        text[i] = " .:-=+*#"[bar[i] * 7 / peak];
+    printf("pushed %u, dropped %u, seq %u (last frame %u), %u x %u bins, mean %.1f |%s|\n",
+        g_ring.pushed(), g_ring.dropped(), p->seq, g_nSeq.load(), p->channels, p->bins, (sum > 0) ? mean / sum : 0.0, text);
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned seconds = (argc > 1) ? (unsigned)atoi(argv[1]) : 10;
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_HISTOGRAM, 1);
+        if (FAILED(hr))
+            printf("failed to enable the continuous histogram, hr = 0x%08x\n", hr);
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            hr = Toupcam_GetHistogramV2(g_hcam, HistRing::callback, &g_ring);
+            if (FAILED(hr))
+                printf("failed to get histogram, hr = 0x%08x\n", hr);
+            else
+            {
+                unsigned nFresh = 0, nStale = 0;
+                for (unsigned i = 1; i <= seconds * 30; ++i)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(33));
+                    bool bFresh = false;
+                    const HistSlot* p = g_ring.latest(&bFresh);
+                    if (bFresh)
+                        ++nFresh;
+                    else
+                        ++nStale;
+                    if (p && (0 == i % 30))
+                        Print(p);
+                }
+                printf("repaints: %u with a new histogram, %u without\n", nFresh, nStale);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    printf("frames %u, histograms pushed %u, dropped %u\n", g_nFrame.load(), g_ring.pushed(), g_ring.dropped());
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "toupcam.h"
+#include "../hostbin.h"
+
+/*
+    Host binning of the RAW frames (hostbin.h), for low light imaging at a low resolution.
+    usage: demohostbin [n = 2] [sum | avg]
+    The camera is put in RAW mode at its highest bit depth; every frame is binned n x n (Bayer: by color, the output
+    keeps the pattern) into 16 bits, the time of the binning, the mean of the output and the bytes saved are printed.
+*/
+HToupcam g_hcam = NULL;
+void* g_pRawData = NULL;
+unsigned short* g_pBinned = NULL;
+std::vector<unsigned> g_acc;
+int g_format = HOSTBIN_BAYER8, g_method = HOSTBIN_SUM;
+unsigned g_n = 2, g_total = 0;
+double g_ms = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pRawData, 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const bool b16 = (HOSTBIN_MONO16 == g_format) || (HOSTBIN_BAYER16 == g_format);
+            const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            unsigned w = 0, h = 0;
+            if (!HostBin(g_format, g_pRawData, info.v3.width * (b16 ? 2 : 1), info.v3.width, info.v3.height, g_n, g_method, g_pBinned, info.v3.width / g_n * 2, g_acc, &w, &h))
+                printf("failed to bin %u x %u by %u\n", info.v3.width, info.v3.height, g_n);
+            else
+            {
+                g_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                if (0 == (++g_total % 50))
+                {
+                    unsigned long long sum = 0;
+                    for (unsigned j = 0; j < h; ++j)
+                    {
+                        const unsigned short* p = g_pBinned + j * (info.v3.width / g_n);
+                        for (unsigned i = 0; i < w; ++i)
+                            sum += p[i];
+                    }
+                    printf("%u x %u -> %u x %u, %.2f ms per frame, mean = %.1f, %.1f x fewer bytes\n", info.v3.width, info.v3.height, w, h, g_ms / g_total,
+                        (double)sum / ((double)w * h), (double)info.v3.width * info.v3.height * (b16 ? 2 : 1) / ((double)w * h * 2));
+                }
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+        g_n = (unsigned)atoi(argv[1]);
+    if ((argc > 2) && (0 == strcmp(argv[2], "avg")))
+        g_method = HOSTBIN_AVERAGE;
+    if ((g_n < 2) || (g_n > 8))
+    {
+        printf("usage: %s [n = 2 ... 8] [sum | avg]\n", argv[0]);
+        return -1;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    const bool bMono = (Toupcam_query_Model(g_hcam)->flag & TOUPCAM_FLAG_MONO) ? true : false;
+    const bool b16 = Toupcam_get_MaxBitDepth(g_hcam) > 8;
+    g_format = bMono ? (b16 ? HOSTBIN_MONO16 : HOSTBIN_MONO8) : (b16 ? HOSTBIN_BAYER16 : HOSTBIN_BAYER8);
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    if (FAILED(hr))
+        printf("failed to set raw mode, hr = 0x%08x\n", hr);
+    else if (b16 && FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1)))
+        printf("failed to set bit depth, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pRawData = malloc(nWidth * nHeight * (b16 ? 2 : 1));
+        g_pBinned = (unsigned short*)malloc((nWidth / g_n) * (nHeight / g_n) * 2);
+        if ((NULL == g_pRawData) || (NULL == g_pBinned))
+            printf("failed to malloc\n");
+        else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL)))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("%s %u bits, binning %u x %u, %s, press ENTER to exit\n", bMono ? "mono" : "bayer", Toupcam_get_MaxBitDepth(g_hcam), g_n, g_n,
+                (HOSTBIN_AVERAGE == g_method) ? "average" : "sum");
+            getc(stdin);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pRawData)
+        free(g_pRawData);
+    if (g_pBinned)
+        free(g_pBinned);
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include "../demorawrec/rawseq.h"
+#include "../hostffc.h"
+
+/*
+    Dark field and flat field correction of the RAW sequences of demorawrec, off line (hostffc.h).
+    usage: demohostffc build [-s sigma] [-t threads] <ref.ffc> <dark.rawseq> [flat.rawseq]
+                dark: mean of the frames of dark.rawseq, gain: from the frames of flat.rawseq; -s: reject the values
+                further than sigma standard deviations from the mean of their pixel, in a second pass over the files
+           demohostffc apply <ref.ffc> <in.rawseq> <out.rawseq> [threads]
+                corrected copy of in, same frame info; a compressed in gives an uncompressed out
+    The references are built from running sums (hostffc.h), one frame at a time, so the number of frames is not
+    limited by the memory.
+    The recordings of the references and of the data must have the same size and bit depth, and the same exposure
+    and gain as long as the dark frames are concerned. The frames of in are read from the mapping PREFETCH_FRAMES
+    ahead, corrected on threads worker threads straight into the slot buffer of out and written with their record;
+    the throughput is printed at the end.
+*/
+#define PREFETCH_FRAMES     8
+
+/* argv[0]: the dark frames, argv[1]: the flat frames, if any */
+static bool AddFrames(HostFfc& ffc, int argc, char** argv, bool bFirst, unsigned threads, double sigma)
+{
+    for (int k = 0; k < argc; ++k)
+    {
+        RawSeqReader reader;
+        if (!reader.open(argv[k], true))
+        {
+            printf("failed to open %s or its index\n", argv[k]);
+            return false;
+        }
+        const RawSeqHeader& header = reader.header();
+        if (bFirst && (0 == k))
+            ffc.init(header.width, header.height, header.bitdepth, header.fourcc, threads, sigma);
+        else if ((header.width != ffc.width()) || (header.height != ffc.height()) || (header.bitdepth != ffc.bitdepth()))
+        {
+            printf("%s: %u x %u, %u bits, the dark frames are %u x %u, %u bits\n", argv[k], header.width, header.height, header.bitdepth, ffc.width(), ffc.height(), ffc.bitdepth());
+            return false;
+        }
+        std::vector<unsigned short> unpacked((header.packing || header.compression) ? (size_t)header.width * header.height : 0);
+        RawCodec codec(header.compression ? threads : 0);
+        reader.willneed(0, PREFETCH_FRAMES);
+        for (unsigned i = 0; i < reader.frames(); ++i)
+        {
+            reader.willneed(i + PREFETCH_FRAMES, 1);
+            const void* pData = reader.frame16(i, unpacked.data(), NULL, &codec);
+            if (NULL == pData)
+            {
+                printf("%s: frame %u does not decode\n", argv[k], i);
+                return false;
+            }
+            if (0 == k)
+                ffc.addDark(pData);
+            else
+                ffc.addFlat(pData);
+            reader.dontneed(i, 1);
+        }
+        printf("%s: %u %s frames%s\n", argv[k], reader.frames(), (0 == k) ? "dark" : "flat", bFirst ? "" : ", sigma clip");
+    }
+    return true;
+}
+
+static int DoBuild(int argc, char** argv)
+{
+    unsigned threads = 0;
+    double sigma = 0;
+    int i = 2;
+    for (; i + 1 < argc; i += 2)
+    {
+        if (0 == strcmp(argv[i], "-s"))
+            sigma = atof(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-t"))
+            threads = (unsigned)atoi(argv[i + 1]);
+        else
+            break;
+    }
+    if ((argc - i < 2) || (argc - i > 3))
+    {
+        printf("usage: %s build [-s sigma] [-t threads] <ref.ffc> <dark.rawseq> [flat.rawseq]\n", argv[0]);
+        return -1;
+    }
+    HostFfc ffc;
+    if (!AddFrames(ffc, argc - i - 1, argv + i + 1, true, threads, sigma))
+        return -1;
+    if (ffc.secondPass() && !AddFrames(ffc, argc - i - 1, argv + i + 1, false, threads, sigma))
+        return -1;
+    ffc.finish();
+    if (!ffc.save(argv[i]))
+    {
+        printf("failed to save %s\n", argv[i]);
+        return -1;
+    }
+    printf("%s: %u x %u, %u bits, %u dark frames, %u flat frames\n", argv[i], ffc.width(), ffc.height(), ffc.bitdepth(), ffc.darkFrames(), ffc.flatFrames());
+    return 0;
+}
+
+static int DoApply(int argc, char** argv)
+{
+    const unsigned threads = (argc > 5) ? (unsigned)atoi(argv[5]) : 0;
+    HostFfc ffc;
+    if (!ffc.load(argv[2], threads))
+    {
+        printf("failed to load %s\n", argv[2]);
+        return -1;
+    }
+    RawSeqReader reader;
+    if (!reader.open(argv[3], true))
+    {
+        printf("failed to open %s or its index\n", argv[3]);
+        return -1;
+    }
+    RawSeqHeader header = reader.header();
+    if ((header.width != ffc.width()) || (header.height != ffc.height()) || (header.bitdepth != ffc.bitdepth()))
+    {
+        printf("%s: %u x %u, %u bits, the references are %u x %u, %u bits\n", argv[3], header.width, header.height, header.bitdepth, ffc.width(), ffc.height(), ffc.bitdepth());
+        return -1;
+    }
+
+    char idxname[1024];
+    sprintf(idxname, "%s.idx", argv[4]);
+    FILE* fp = fopen(argv[4], "wb");
+    FILE* fidx = fopen(idxname, "wb");
+    /* a packed recording is corrected in 16 bits and packed again, out is packed as in; a compressed one is decoded
+       and written as it comes out of the correction, in slots */
+    const bool bCompressed = (0 != header.compression);
+    RawCodec codec(bCompressed ? threads : 0);
+    if (bCompressed)
+    {
+        header.compression = 0;
+        header.slot = (RawSeqFrameBytes(header) + RAWSEQ_ALIGN - 1) / RAWSEQ_ALIGN * RAWSEQ_ALIGN;
+    }
+    std::vector<unsigned char> slot((size_t)header.slot, 0);
+    std::vector<unsigned short> unpacked((header.packing || bCompressed) ? (size_t)header.width * header.height : 0), corrected(header.packing ? unpacked.size() : 0);
+    int ret = 0;
+    if ((NULL == fp) || (NULL == fidx))
+    {
+        printf("failed to create %s or its index\n", argv[4]);
+        ret = -1;
+    }
+    else
+    {
+        memcpy(header.magic, RAWSEQ_MAGIC, sizeof(header.magic));     /* in may be a TRAWSEQ1 */
+        header.frames = reader.frames();
+        std::vector<unsigned char> block(RAWSEQ_ALIGN, 0);
+        memcpy(&block[0], &header, sizeof(header));
+        fwrite(&block[0], 1, block.size(), fp);
+        fwrite(&header, 1, sizeof(header), fidx);
+
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        unsigned long long bytes = 0;
+        reader.willneed(0, PREFETCH_FRAMES);
+        for (unsigned i = 0; (i < reader.frames()) && (0 == ret); ++i)
+        {
+            reader.willneed(i + PREFETCH_FRAMES, 1);
+            RawSeqRecord rec = *reader.record(i);
+            const void* pData = reader.frame16(i, unpacked.data(), NULL, &codec);
+            if (NULL == pData)
+            {
+                printf("frame %u does not decode\n", i);
+                ret = -1;
+                break;
+            }
+            if (header.packing)
+            {
+                ffc.apply(pData, &corrected[0]);
+                RawPackFrame(&slot[0], &corrected[0], header.width, header.height, header.packing);
+            }
+            else
+                ffc.apply(pData, &slot[0]);
+            rec.length = (unsigned)RawSeqFrameBytes(header);
+            rec.index = i;
+            rec.offset = RAWSEQ_ALIGN + i * header.slot;
+            if ((fwrite(&slot[0], 1, slot.size(), fp) != slot.size()) || (fwrite(&rec, 1, sizeof(rec), fidx) != sizeof(rec)))
+            {
+                printf("failed to write frame %u\n", i);
+                ret = -1;
+            }
+            bytes += rec.length;
+            reader.dontneed(i, 1);
+        }
+        const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (sec > 0)
+            printf("%u frames, %.1f MB/s\n", reader.frames(), bytes / sec / 1048576.0);
+    }
+
+    /* cleanup */
+    if (fp)
+        fclose(fp);
+    if (fidx)
+        fclose(fidx);
+    reader.close();
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc >= 4) && (0 == strcmp(argv[1], "build")))
+        return DoBuild(argc, argv);
+    if ((argc >= 5) && (argc <= 6) && (0 == strcmp(argv[1], "apply")))
+        return DoApply(argc, argv);
+    printf("usage: %s build [-s sigma] [-t threads] <ref.ffc> <dark.rawseq> [flat.rawseq]\n", argv[0]);
+    printf("       %s apply <ref.ffc> <in.rawseq> <out.rawseq> [threads]\n", argv[0]);
+    return -1;
+}
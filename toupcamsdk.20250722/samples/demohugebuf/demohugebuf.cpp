@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include "toupcam.h"
+#include "../hugebuf.h"
+
+/*
+    Pull into a buffer of ordinary pages and into one of huge pages (samples/hugebuf.h), frame by frame in turn, and
+    compare the time Toupcam_PullImageV4 takes (the conversion to RGB24 and the copy write the whole buffer).
+    The difference grows with the size of the frame: try the largest resolution of the camera.
+    usage: demohugebuf [frames, default 200]
+*/
+HToupcam g_hcam = NULL;
+HugeBuffer g_normal(false), g_huge(true);
+unsigned g_frames = 200;
+std::atomic<unsigned> g_total(0);
+double g_us[2] = { 0 };
+unsigned g_count[2] = { 0 };
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const unsigned k = g_total & 1;
+        HugeBuffer& buf = k ? g_huge : g_normal;
+        ToupcamFrameInfoV4 info = { 0 };
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, buf.data(), 0, 24, 0, &info);
+        const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (++g_total > 2)    /* the first of each warms the pages up */
+        {
+            g_us[k] += us;
+            ++g_count[k];
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+        g_frames = (unsigned)atoi(argv[1]);
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        const size_t size = TDIBWIDTHBYTES(24 * nWidth) * nHeight;
+        if ((!g_normal.resize(size)) || (!g_huge.resize(size)))
+            printf("failed to allocate\n");
+        else
+        {
+            printf("%d x %d, %zu KB per frame, %s against %s\n", nWidth, nHeight, size >> 10, HugeBufName(g_huge.kind()), HugeBufName(g_normal.kind()));
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                while (g_total < g_frames)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                Toupcam_Stop(g_hcam);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    for (unsigned k = 0; k < 2; ++k)
+    {
+        if (g_count[k])
+            printf("%s: %u pulls, %.0f us on average\n", HugeBufName(k ? g_huge.kind() : HUGEBUF_NORMAL), g_count[k], g_us[k] / g_count[k]);
+    }
+    return 0;
+}
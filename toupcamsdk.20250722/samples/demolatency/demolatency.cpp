@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "toupcam.h"
+
+/*
+    Per-frame latency instrumentation from the host side.
+    The SDK stages (USB receipt, frontend deque, ISP, backend deque) are internal, but each frame carries the
+    camera timestamp (TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP, microsecond). For every frame we take two host timestamps:
+        event:  TOUPCAM_EVENT_IMAGE arrives
+        pulled: Toupcam_PullImageV4 returns
+    The camera clock and the host clock have an unknown offset, so the offset is estimated as the minimum of
+    (event - timestamp) seen so far; "transit" is the latency above that minimum, i.e. the time a frame spent queued
+    or being processed in the SDK more than the fastest frame did. "pull" is the copy/convert time of our own pull call.
+*/
+#define HIST_BUCKET_US      500     /* width of one histogram bucket */
+#define HIST_NUM            64      /* the last bucket collects everything above */
+#define REPORT_INTERVAL     100     /* frames */
+
+typedef struct {
+    unsigned count[HIST_NUM];
+    unsigned long long total, sum, max;
+} Histogram;
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned g_total = 0;
+long long g_offset = 0;
+bool g_bOffset = false;
+Histogram g_transit = { { 0 } }, g_pull = { { 0 } };
+
+static long long HostMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void HistogramAdd(Histogram* h, unsigned long long us)
+{
+    const unsigned idx = (unsigned)(us / HIST_BUCKET_US);
+    ++h->count[(idx < HIST_NUM) ? idx : (HIST_NUM - 1)];
+    ++h->total;
+    h->sum += us;
+    if (us > h->max)
+        h->max = us;
+}
+
+/* value below which the given fraction of the samples fall, at bucket resolution */
+static unsigned long long HistogramPercentile(const Histogram* h, double p)
+{
+    unsigned long long acc = 0;
+    for (unsigned i = 0; i < HIST_NUM; ++i)
+    {
+        acc += h->count[i];
+        if (acc >= h->total * p)
+            return (unsigned long long)(i + 1) * HIST_BUCKET_US;
+    }
+    return h->max;
+}
+
+static void HistogramPrint(const char* name, const Histogram* h)
+{
+    if (0 == h->total)
+        return;
+    printf("%s: n = %llu, avg = %llu us, p50 = %llu us, p90 = %llu us, p99 = %llu us, max = %llu us\n", name, h->total, h->sum / h->total,
+        HistogramPercentile(h, 0.5), HistogramPercentile(h, 0.9), HistogramPercentile(h, 0.99), h->max);
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const long long tEvent = HostMicroseconds();
+        int backend = 0;
+        Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT, &backend);
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        const long long tPulled = HostMicroseconds();
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            ++g_total;
+            HistogramAdd(&g_pull, tPulled - tEvent);
+            if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP)
+            {
+                const long long diff = tEvent - (long long)info.v3.timestamp;
+                if ((!g_bOffset) || (diff < g_offset))
+                {
+                    g_offset = diff;
+                    g_bOffset = true;
+                }
+                HistogramAdd(&g_transit, diff - g_offset);
+            }
+            /* After we get the image data, we can do anything for the data we want to do */
+            if (0 == g_total % REPORT_INTERVAL)
+            {
+                printf("total = %u, seq = %u, backend deque = %d\n", g_total, info.v3.seq, backend);
+                HistogramPrint("transit", &g_transit);
+                HistogramPrint("pull", &g_pull);
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("press ENTER to exit\n");
+                getc(stdin);
+            }
+        }
+    }
+    
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    HistogramPrint("transit", &g_transit);
+    HistogramPrint("pull", &g_pull);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "toupcam.h"
+
+/*
+    Frame lease on top of push mode.
+    Toupcam_PullImageV4 always copies the frame into a caller buffer. In push mode the data callback
+    receives a pointer into the SDK's own buffer, so we "lease" that pointer to a consumer thread:
+    AcquireFrame hands out a read-only pointer plus the frame info, the SDK callback thread is held
+    until ReleaseFrame, and the consumer (AF metric, saver, ...) reads the pixels in place. While a
+    lease is held, new frames wait in the SDK deque (TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH) instead of
+    being copied.
+*/
+typedef struct {
+    const void* pData;          /* read-only, valid until ReleaseFrame */
+    ToupcamFrameInfoV4 info;    /* only info.v3 is filled in push mode */
+    int stride;
+} FrameLease;
+
+HToupcam g_hcam = NULL;
+unsigned g_total = 0;
+
+static std::mutex g_mtx;
+static std::condition_variable g_cv;
+static const void* g_pLeaseData = NULL;
+static ToupcamFrameInfoV3 g_leaseInfo = { 0 };
+static bool g_bLeased = false, g_bStop = false;
+
+/* returns false on timeout or stop */
+static bool AcquireFrame(FrameLease* pLease, unsigned nWaitMS)
+{
+    std::unique_lock<std::mutex> lock(g_mtx);
+    if (!g_cv.wait_for(lock, std::chrono::milliseconds(nWaitMS), [] { return g_bStop || (g_pLeaseData && !g_bLeased); }))
+        return false;
+    if (g_bStop)
+        return false;
+    g_bLeased = true;
+    memset(pLease, 0, sizeof(FrameLease));
+    pLease->pData = g_pLeaseData;
+    pLease->info.v3 = g_leaseInfo;
+    pLease->stride = TDIBWIDTHBYTES(24 * g_leaseInfo.width);
+    return true;
+}
+
+static void ReleaseFrame(FrameLease* pLease)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        g_pLeaseData = NULL;
+        g_bLeased = false;
+    }
+    pLease->pData = NULL;
+    g_cv.notify_all();
+}
+
+static void __stdcall DataCallback(const void* pData, const ToupcamFrameInfoV3* pInfo, int bSnap, void* pCallbackCtx)
+{
+    if ((NULL == pData) || bSnap)
+        return;
+    std::unique_lock<std::mutex> lock(g_mtx);
+    if (g_bStop)
+        return;
+    g_pLeaseData = pData;
+    g_leaseInfo = *pInfo;
+    g_cv.notify_all();
+    /* pData belongs to the SDK and is only valid inside this callback, so hold it here until the consumer is done */
+    g_cv.wait(lock, [] { return g_bStop || (NULL == g_pLeaseData); });
+    g_pLeaseData = NULL;
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    printf("event callback: 0x%04x\n", nEvent);
+}
+
+static void ConsumerThread()
+{
+    FrameLease lease;
+    while (true)
+    {
+        if (!AcquireFrame(&lease, 1000))
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            if (g_bStop)
+                break;
+            printf("acquire frame timeout\n");
+            continue;
+        }
+
+        /* After we get the image data, we can do anything for the data we want to do */
+        /* for example, an average green value of the centre row read in place without any copy */
+        const unsigned char* pRow = (const unsigned char*)lease.pData + lease.stride * (lease.info.v3.height / 2);
+        unsigned long long sum = 0;
+        for (unsigned x = 0; x < lease.info.v3.width; ++x)
+            sum += pRow[x * 3 + 1];
+        printf("lease frame ok, total = %u, res = %u x %u, seq = %u, centre row green = %u\n", ++g_total, lease.info.v3.width, lease.info.v3.height, lease.info.v3.seq, (unsigned)(sum / (lease.info.v3.width ? lease.info.v3.width : 1)));
+        ReleaseFrame(&lease);
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    std::thread consumer(ConsumerThread);
+    HRESULT hr = Toupcam_StartPushModeV4(g_hcam, DataCallback, NULL, EventCallback, NULL);
+    if (FAILED(hr))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("press ENTER to exit\n");
+        getc(stdin);
+    }
+
+    /* cleanup */
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        g_bStop = true;
+    }
+    g_cv.notify_all();
+    consumer.join();
+    Toupcam_Close(g_hcam);
+    return 0;
+}
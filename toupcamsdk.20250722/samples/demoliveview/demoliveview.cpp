@@ -0,0 +1,356 @@
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "toupcam.h"
+#include "../latestframe.h"
+#include "jpegenc.h"
+
+/*
+    Live view of a scan from another room: an HTTP server of the preview as MJPEG (multipart/x-mixed-replace), which any
+    browser shows at http://host:8080/ and which VLC / ffplay open at /stream; /snapshot is the current JPEG.
+    Acquisition is never held up by the viewers:
+        event callback  pulls into a LatestFrame (latestframe.h) and is done, the frames nobody took are overwritten
+        encoder thread  takes the latest frame, shrinks it by a whole factor to at most -w pixels wide (the mean of each
+                        factor x factor block), encodes it once (jpegenc.h) and publishes it as a shared_ptr
+        client threads  one per viewer: send the newest published JPEG, then wait for a newer one
+    So every frame is encoded once whatever the number of viewers, the viewers share it by reference, and the frame
+    rate of each adapts to its own link: a slow client simply gets fewer frames, the frames published while it was
+    sending are skipped for it alone. /stream?fps=n caps the rate of one viewer; -fps caps the encoder.
+*/
+#if !defined(_WIN32)
+typedef int SOCKET;
+#define INVALID_SOCKET  (-1)
+inline int closesocket(SOCKET s) { return ::close(s); }
+#define SEND_FLAGS      MSG_NOSIGNAL
+#else
+#define SEND_FLAGS      0
+#endif
+
+typedef struct {
+    std::vector<unsigned char> data;
+    ToupcamFrameInfoV4 info;
+} Slot;
+
+typedef std::shared_ptr<const std::vector<unsigned char>> JpegPtr;
+
+HToupcam g_hcam = NULL;
+LatestFrame<Slot> g_latest;
+static std::mutex g_mtx;
+static std::condition_variable g_cvFrame, g_cvJpeg;  /* a frame to encode; a JPEG published */
+static JpegPtr g_jpeg;
+static unsigned g_jpegSeq = 0;
+static std::atomic<bool> g_bStop(false);
+static std::atomic<unsigned> g_clients(0), g_encoded(0);
+static int g_previewWidth = 1280, g_quality = 75, g_maxFps = 15;
+static std::mutex g_mtxClient;
+static std::vector<SOCKET> g_vecClient;         /* to shut the clients down on exit */
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        Slot& s = g_latest.back();
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, &s.data[0], 0, 24, -1, &s.info);  /* -1: rows without padding */
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            /* After we get the image data, the application does what it does, the preview is a side line */
+            g_latest.publish();
+            g_cvFrame.notify_one();
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static void EncoderThread()
+{
+    JpegEncoder enc(g_quality);
+    std::vector<unsigned char> small;
+    std::chrono::steady_clock::time_point last;
+    while (!g_bStop)
+    {
+        {
+            std::unique_lock<std::mutex> lock(g_mtx);
+            g_cvFrame.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        if (g_maxFps > 0)
+            std::this_thread::sleep_until(last + std::chrono::microseconds(1000000 / g_maxFps));
+        if (!g_latest.update())
+            continue;
+        last = std::chrono::steady_clock::now();
+        const Slot& s = g_latest.front();
+        const int w = s.info.v3.width, h = s.info.v3.height, f = (w + g_previewWidth - 1) / g_previewWidth;
+        const unsigned char* p = &s.data[0];
+        int sw = w, sh = h;
+        if (f > 1)
+        {
+            sw = w / f;
+            sh = h / f;
+            small.resize((size_t)sw * sh * 3);
+            for (int y = 0; y < sh; ++y)
+            {
+                unsigned char* d = &small[(size_t)y * sw * 3];
+                for (int x = 0; x < sw; ++x)
+                {
+                    unsigned sum[3] = { 0, 0, 0 };
+                    for (int j = 0; j < f; ++j)
+                    {
+                        const unsigned char* q = p + ((size_t)(y * f + j) * w + x * f) * 3;
+                        for (int i = 0; i < f * 3; i += 3)
+                        {
+                            sum[0] += q[i];
+                            sum[1] += q[i + 1];
+                            sum[2] += q[i + 2];
+                        }
+                    }
+                    for (int c = 0; c < 3; ++c)
+                        d[x * 3 + c] = (unsigned char)((sum[c] + f * f / 2) / (f * f));
+                }
+            }
+            p = &small[0];
+        }
+        std::shared_ptr<std::vector<unsigned char>> jpeg = std::make_shared<std::vector<unsigned char>>();
+        enc.encode(p, sw, sh, sw * 3, *jpeg);
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            g_jpeg = jpeg;
+            ++g_jpegSeq;
+        }
+        ++g_encoded;
+        g_cvJpeg.notify_all();
+    }
+}
+
+static bool SendAll(SOCKET s, const void* p, size_t len)
+{
+    const char* c = (const char*)p;
+    while (len)
+    {
+        const int n = (int)send(s, c, (int)((len > 65536) ? 65536 : len), SEND_FLAGS);
+        if (n <= 0)
+            return false;
+        c += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool SendString(SOCKET s, const std::string& str)
+{
+    return SendAll(s, str.c_str(), str.size());
+}
+
+/* the newest JPEG after seq, false on exit */
+static bool WaitJpeg(unsigned& seq, JpegPtr& jpeg)
+{
+    std::unique_lock<std::mutex> lock(g_mtx);
+    while ((!g_bStop) && ((!g_jpeg) || (g_jpegSeq == seq)))
+        g_cvJpeg.wait_for(lock, std::chrono::milliseconds(500));
+    if (g_bStop)
+        return false;
+    jpeg = g_jpeg;
+    seq = g_jpegSeq;
+    return true;
+}
+
+static void ClientThread(SOCKET s)
+{
+    char req[2048];
+    const int n = (int)recv(s, req, sizeof(req) - 1, 0);
+    std::string path;
+    if (n > 0)
+    {
+        req[n] = 0;
+        char method[16], uri[1024];
+        if (2 == sscanf(req, "%15s %1023s", method, uri))
+            path = uri;
+    }
+    unsigned seq = 0;
+    JpegPtr jpeg;
+    char hdr[256];
+    if (0 == path.compare(0, 7, "/stream"))
+    {
+        const size_t q = path.find("fps=");
+        const int fps = (std::string::npos == q) ? 0 : atoi(path.c_str() + q + 4);
+        std::chrono::steady_clock::time_point last;
+        bool bok = SendString(s, "HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nConnection: close\r\nContent-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n");
+        while (bok)
+        {
+            if (fps > 0)
+                std::this_thread::sleep_until(last + std::chrono::microseconds(1000000 / fps));
+            if (!WaitJpeg(seq, jpeg))
+                break;
+            last = std::chrono::steady_clock::now();
+            sprintf(hdr, "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", (unsigned)jpeg->size());
+            bok = SendString(s, hdr) && SendAll(s, &(*jpeg)[0], jpeg->size()) && SendString(s, "\r\n");
+        }
+    }
+    else if (0 == path.compare(0, 9, "/snapshot"))
+    {
+        if (WaitJpeg(seq, jpeg))
+        {
+            sprintf(hdr, "HTTP/1.0 200 OK\r\nCache-Control: no-cache\r\nConnection: close\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", (unsigned)jpeg->size());
+            if (SendString(s, hdr))
+                SendAll(s, &(*jpeg)[0], jpeg->size());
+        }
+    }
+    else if ("/" == path)
+        SendString(s, "HTTP/1.0 200 OK\r\nConnection: close\r\nContent-Type: text/html\r\n\r\n<html><body style=\"margin:0;background:#000\"><img src=\"/stream\" style=\"max-width:100%\"></body></html>");
+    else
+        SendString(s, "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n");
+
+    {
+        std::lock_guard<std::mutex> lock(g_mtxClient);
+        for (size_t i = 0; i < g_vecClient.size(); ++i)
+        {
+            if (g_vecClient[i] == s)
+            {
+                g_vecClient.erase(g_vecClient.begin() + i);
+                break;
+            }
+        }
+    }
+    closesocket(s);
+    --g_clients;
+}
+
+static void ServerThread(SOCKET listener)
+{
+    while (!g_bStop)
+    {
+        const SOCKET s = accept(listener, NULL, NULL);
+        if (INVALID_SOCKET == s)
+            continue;
+        if (g_bStop)
+        {
+            closesocket(s);
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(g_mtxClient);
+            g_vecClient.push_back(s);
+        }
+        ++g_clients;    /* before the thread runs, the exit waits for it */
+        std::thread(ClientThread, s).detach();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned short port = 8080;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((0 == strcmp(argv[i], "-p")) && (i + 1 < argc))
+            port = (unsigned short)atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-w")) && (i + 1 < argc))
+            g_previewWidth = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-q")) && (i + 1 < argc))
+            g_quality = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-fps")) && (i + 1 < argc))
+            g_maxFps = atoi(argv[++i]);
+        else
+        {
+            printf("usage: %s [-p port = 8080] [-w preview width = 1280] [-q JPEG quality = 75] [-fps max = 15, 0: every frame]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (g_previewWidth < 16)
+        g_previewWidth = 16;
+#if defined(_WIN32)
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BYTEORDER, 0);   /* RGB */
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_UPSIDE_DOWN, 0); /* top-down rows */
+
+    SOCKET listener = INVALID_SOCKET;
+    std::thread encoder, server;
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_FinalSize(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        for (unsigned i = 0; i < 3; ++i)
+            g_latest.slot(i).data.resize((size_t)nWidth * nHeight * 3);
+        listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        const int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if ((INVALID_SOCKET == listener) || (bind(listener, (const sockaddr*)&addr, sizeof(addr)) < 0) || (listen(listener, 8) < 0))
+            printf("failed to listen on port %hu\n", port);
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                encoder = std::thread(EncoderThread);
+                server = std::thread(ServerThread, listener);
+                printf("http://localhost:%hu/, press ENTER to exit\n", port);
+                getc(stdin);
+                printf("frames = %u, encoded = %u, clients = %u\n", g_latest.published(), (unsigned)g_encoded, (unsigned)g_clients);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    g_bStop = true;
+    g_cvFrame.notify_all();
+    g_cvJpeg.notify_all();
+    if (encoder.joinable())
+        encoder.join();
+    if (INVALID_SOCKET != listener)
+    {
+#if defined(_WIN32)
+        closesocket(listener);  /* accept returns */
+#else
+        shutdown(listener, SHUT_RDWR);
+        closesocket(listener);
+#endif
+    }
+    if (server.joinable())
+        server.join();
+    {
+        std::lock_guard<std::mutex> lock(g_mtxClient);
+        for (size_t i = 0; i < g_vecClient.size(); ++i)
+            shutdown(g_vecClient[i], 2);    /* SD_BOTH / SHUT_RDWR: a blocked send returns */
+    }
+    while (g_clients)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return 0;
+}
@@ -0,0 +1,298 @@
+#ifndef __jpegenc_H__
+#define __jpegenc_H__
+
+/*
+    Baseline JPEG encoder (JFIF, YCbCr 4:2:0, the standard Huffman tables of ITU T.81 Annex K), enough for a preview
+    stream without a codec library: the quantization tables are scaled for the quality once, at construction, and
+    encode() is then one pass over the image, 16 x 16 pixels at a time, the border pixels replicated.
+    Input: RGB24, R first (TOUPCAM_OPTION_BYTEORDER = 0), top-down rows of step bytes.
+*/
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+class JpegEncoder {
+    struct Huffman {
+        unsigned short code[256];
+        unsigned char len[256];
+    };
+    unsigned char m_qY[64], m_qC[64];       /* zigzag order, as written to DQT */
+    float m_divY[64], m_divC[64];           /* natural order */
+    float m_cos[8][8];
+    Huffman m_dcY, m_acY, m_dcC, m_acC;
+    std::vector<unsigned char>* m_pOut;
+    unsigned m_bitBuf, m_bitCnt;
+
+    static const unsigned char* zigzag()
+    {
+        static const unsigned char z[64] = {
+            0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+            35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+        };
+        return z;
+    }
+    static const unsigned char* dcBits(bool chroma)
+    {
+        static const unsigned char y[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+        static const unsigned char c[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+        return chroma ? c : y;
+    }
+    static const unsigned char* dcVal()
+    {
+        static const unsigned char v[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+        return v;
+    }
+    static const unsigned char* acBits(bool chroma)
+    {
+        static const unsigned char y[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+        static const unsigned char c[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+        return chroma ? c : y;
+    }
+    static const unsigned char* acVal(bool chroma)
+    {
+        static const unsigned char y[162] = {
+            0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+            0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+            0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+            0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+            0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+            0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+            0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+        };
+        static const unsigned char c[162] = {
+            0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+            0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+            0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+            0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+            0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+            0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+            0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+        };
+        return chroma ? c : y;
+    }
+
+    /* the canonical codes of T.81 Annex C */
+    static void build(Huffman& h, const unsigned char* bits, const unsigned char* val)
+    {
+        memset(&h, 0, sizeof(h));
+        unsigned code = 0, k = 0;
+        for (int l = 1; l <= 16; ++l, code <<= 1)
+        {
+            for (unsigned i = 0; i < bits[l - 1]; ++i, ++code, ++k)
+            {
+                h.code[val[k]] = (unsigned short)code;
+                h.len[val[k]] = (unsigned char)l;
+            }
+        }
+    }
+
+    void byte(unsigned char b) { m_pOut->push_back(b); }
+    void word(unsigned w) { byte((unsigned char)(w >> 8)); byte((unsigned char)w); }
+
+    void bits(unsigned code, unsigned len)
+    {
+        m_bitBuf = (m_bitBuf << len) | code;
+        m_bitCnt += len;
+        while (m_bitCnt >= 8)
+        {
+            const unsigned char b = (unsigned char)(m_bitBuf >> (m_bitCnt - 8));
+            byte(b);
+            if (0xff == b)
+                byte(0);    /* stuffing */
+            m_bitCnt -= 8;
+        }
+        m_bitBuf &= (1u << m_bitCnt) - 1;
+    }
+
+    /* the size category and the low bits of a coefficient */
+    static void category(int v, unsigned& nbits, unsigned& code)
+    {
+        unsigned a = (v < 0) ? -v : v;
+        nbits = 0;
+        while (a)
+        {
+            ++nbits;
+            a >>= 1;
+        }
+        code = (v < 0) ? (unsigned)(v + (1 << nbits) - 1) : (unsigned)v;
+    }
+
+    /* block: level shifted samples, natural order */
+    void block(const float* px, const float* div, int& prevDC, const Huffman& dc, const Huffman& ac)
+    {
+        float tmp[64];
+        for (int u = 0; u < 8; ++u)
+        {
+            for (int x = 0; x < 8; ++x)
+            {
+                float s = 0.0f;
+                for (int y = 0; y < 8; ++y)
+                    s += m_cos[u][y] * px[y * 8 + x];
+                tmp[u * 8 + x] = s;
+            }
+        }
+        int q[64];
+        const unsigned char* z = zigzag();
+        for (int k = 0; k < 64; ++k)
+        {
+            const int u = z[k] >> 3, v = z[k] & 7;
+            float s = 0.0f;
+            for (int x = 0; x < 8; ++x)
+                s += m_cos[v][x] * tmp[u * 8 + x];
+            const float f = s / div[z[k]];
+            q[k] = (int)((f < 0.0f) ? (f - 0.5f) : (f + 0.5f));
+        }
+
+        unsigned nbits, code;
+        category(q[0] - prevDC, nbits, code);
+        prevDC = q[0];
+        bits(dc.code[nbits], dc.len[nbits]);
+        if (nbits)
+            bits(code, nbits);
+        int last = 63;
+        while ((last > 0) && (0 == q[last]))
+            --last;
+        int run = 0;
+        for (int k = 1; k <= last; ++k)
+        {
+            if (0 == q[k])
+            {
+                ++run;
+                continue;
+            }
+            while (run >= 16)
+            {
+                bits(ac.code[0xf0], ac.len[0xf0]);  /* ZRL */
+                run -= 16;
+            }
+            category(q[k], nbits, code);
+            const unsigned rs = (run << 4) | nbits;
+            bits(ac.code[rs], ac.len[rs]);
+            bits(code, nbits);
+            run = 0;
+        }
+        if (last < 63)
+            bits(ac.code[0], ac.len[0]);    /* EOB */
+    }
+
+    void dqt(unsigned char id, const unsigned char* q)
+    {
+        word(0xffdb);
+        word(67);
+        byte(id);
+        for (int k = 0; k < 64; ++k)
+            byte(q[k]);
+    }
+
+    void dht(unsigned char cls, const unsigned char* b, const unsigned char* v)
+    {
+        unsigned n = 0;
+        for (int i = 0; i < 16; ++i)
+            n += b[i];
+        word(0xffc4);
+        word(19 + n);
+        byte(cls);
+        for (int i = 0; i < 16; ++i)
+            byte(b[i]);
+        for (unsigned i = 0; i < n; ++i)
+            byte(v[i]);
+    }
+public:
+    /* quality: 1 ~ 100 */
+    explicit JpegEncoder(int quality = 75)
+    : m_pOut(NULL), m_bitBuf(0), m_bitCnt(0)
+    {
+        static const unsigned char stdY[64] = {
+            16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+            18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+        };
+        static const unsigned char stdC[64] = {
+            17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+            99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+        };
+        quality = (quality < 1) ? 1 : ((quality > 100) ? 100 : quality);
+        const int scale = (quality < 50) ? (5000 / quality) : (200 - 2 * quality);
+        const unsigned char* z = zigzag();
+        for (int k = 0; k < 64; ++k)
+        {
+            int y = (stdY[z[k]] * scale + 50) / 100, c = (stdC[z[k]] * scale + 50) / 100;
+            y = (y < 1) ? 1 : ((y > 255) ? 255 : y);
+            c = (c < 1) ? 1 : ((c > 255) ? 255 : c);
+            m_qY[k] = (unsigned char)y;
+            m_qC[k] = (unsigned char)c;
+            m_divY[z[k]] = (float)y;
+            m_divC[z[k]] = (float)c;
+        }
+        for (int u = 0; u < 8; ++u)
+        {
+            for (int x = 0; x < 8; ++x)
+                m_cos[u][x] = (float)(((0 == u) ? sqrt(0.125) : 0.5) * cos((2 * x + 1) * u * 3.14159265358979323846 / 16));
+        }
+        build(m_dcY, dcBits(false), dcVal());
+        build(m_dcC, dcBits(true), dcVal());
+        build(m_acY, acBits(false), acVal(false));
+        build(m_acC, acBits(true), acVal(true));
+    }
+
+    /* replaces out */
+    void encode(const unsigned char* pRGB, int width, int height, int step, std::vector<unsigned char>& out)
+    {
+        out.clear();
+        out.reserve((size_t)width * height / 4);
+        m_pOut = &out;
+        m_bitBuf = m_bitCnt = 0;
+
+        static const unsigned char jfif[] = { 0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+        out.insert(out.end(), jfif, jfif + sizeof(jfif));
+        dqt(0, m_qY);
+        dqt(1, m_qC);
+        word(0xffc0);   /* SOF0 */
+        word(17);
+        byte(8);
+        word(height);
+        word(width);
+        byte(3);
+        static const unsigned char comp[9] = { 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 };
+        out.insert(out.end(), comp, comp + sizeof(comp));
+        dht(0x00, dcBits(false), dcVal());
+        dht(0x10, acBits(false), acVal(false));
+        dht(0x01, dcBits(true), dcVal());
+        dht(0x11, acBits(true), acVal(true));
+        static const unsigned char sos[] = { 0xff, 0xda, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+        out.insert(out.end(), sos, sos + sizeof(sos));
+
+        float Y[4][64], Cb[64], Cr[64];
+        int dcY = 0, dcCb = 0, dcCr = 0;
+        for (int my = 0; my < height; my += 16)
+        {
+            for (int mx = 0; mx < width; mx += 16)
+            {
+                memset(Cb, 0, sizeof(Cb));
+                memset(Cr, 0, sizeof(Cr));
+                for (int y = 0; y < 16; ++y)
+                {
+                    const int sy = (my + y < height) ? (my + y) : (height - 1);
+                    const unsigned char* row = pRGB + (size_t)sy * step;
+                    for (int x = 0; x < 16; ++x)
+                    {
+                        const int sx = (mx + x < width) ? (mx + x) : (width - 1);
+                        const float r = row[sx * 3], g = row[sx * 3 + 1], b = row[sx * 3 + 2];
+                        Y[(y / 8) * 2 + x / 8][(y & 7) * 8 + (x & 7)] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+                        Cb[(y / 2) * 8 + x / 2] += 0.25f * (-0.168736f * r - 0.331264f * g + 0.5f * b);
+                        Cr[(y / 2) * 8 + x / 2] += 0.25f * (0.5f * r - 0.418688f * g - 0.081312f * b);
+                    }
+                }
+                for (int i = 0; i < 4; ++i)
+                    block(Y[i], m_divY, dcY, m_dcY, m_acY);
+                block(Cb, m_divC, dcCb, m_dcC, m_acC);
+                block(Cr, m_divC, dcCr, m_dcC, m_acC);
+            }
+        }
+        if (m_bitCnt)
+            bits((1u << (8 - m_bitCnt)) - 1, 8 - m_bitCnt);     /* pad with 1 bits */
+        word(0xffd9);
+        m_pOut = NULL;
+    }
+};
+
+#endif
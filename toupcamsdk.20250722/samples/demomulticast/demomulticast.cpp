@@ -0,0 +1,156 @@
+#include "framecast.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "toupcam.h"
+
+/*
+    One host acquires, the others look: "demomulticast send" opens the camera and sends every frame it pulls to a
+    multicast group (framecast.h), "demomulticast listen" on any number of hosts joins the group and pulls the
+    frames from a deque of its own, for the live stitching or the EDF of a second workstation; the sender can record
+    as usual, the listeners neither slow it down nor touch the camera.
+    -raw sends the raw frames (1 or 2 bytes per pixel instead of 3), a third of the bandwidth of RGB24; the
+    listener then demosaics as it likes. -payload 8000 with jumbo frames on the whole path cuts the datagrams by 5.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+FrameCastSender g_sender;
+bool g_bRaw = false;
+unsigned g_rawBits = 8, g_total = 0, g_failed = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, g_bRaw ? 0 : 24, -1, &info);  /* -1: rows without padding */
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const unsigned bits = g_bRaw ? g_rawBits : 24, size = info.v3.width * info.v3.height * ((bits + 7) / 8);
+            if (!g_sender.send(info.v3.timestamp, info.v3.width, info.v3.height, (uint16_t)bits, g_bRaw ? FRAMECAST_FLAG_RAW : 0, g_pImageData, size))
+                ++g_failed;
+            if (0 == (++g_total % 100))
+                printf("sent %u frames, %u with a datagram failed, res = %u x %u\n", g_total, g_failed, info.v3.width, info.v3.height);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static int Send(const char* group, unsigned short port, const char* iface, unsigned payload)
+{
+    Toupcam_GigeEnable(NULL, NULL);
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (g_bRaw)
+    {
+        int bitDepth = 0;
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+        if (SUCCEEDED(Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, &bitDepth)) && bitDepth)
+            g_rawBits = 16;
+    }
+    g_sender.payload = payload;
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_FinalSize(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (!g_sender.open(group, port, iface))
+        printf("failed to open the socket\n");
+    else
+    {
+        g_pImageData = malloc(nWidth * nHeight * 3);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("sending to %s:%hu, press ENTER to exit\n", group, port);
+                getc(stdin);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    g_sender.close();
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
+
+static int Listen(const char* group, unsigned short port, const char* iface, unsigned length)
+{
+    FrameCastReceiver receiver;
+    if (!receiver.open(group, port, iface, length))
+    {
+        printf("failed to join %s:%hu\n", group, port);
+        return -1;
+    }
+    printf("listening to %s:%hu, press Ctrl+C to exit\n", group, port);
+    FrameCastFrame frame;
+    unsigned total = 0;
+    while (1)
+    {
+        if (!receiver.pull(frame, 1000))
+        {
+            printf("no frame\n");
+            continue;
+        }
+        /* After we get the image data, we can do anything for the data we want to do */
+        if (0 == (++total % 100))
+            printf("seq = %u, %u x %u, %u bits%s, received = %u, incomplete = %u, dropped = %u\n", frame.seq, frame.width, frame.height, frame.bits,
+                (frame.flag & FRAMECAST_FLAG_RAW) ? " raw" : "", (unsigned)receiver.received, (unsigned)receiver.incomplete, (unsigned)receiver.dropped);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* group = "239.255.0.1";
+    const char* iface = NULL;
+    unsigned short port = 50000;
+    unsigned payload = FRAMECAST_PAYLOAD, length = 4;
+    bool bSend = false, bListen = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], "send"))
+            bSend = true;
+        else if (0 == strcmp(argv[i], "listen"))
+            bListen = true;
+        else if (0 == strcmp(argv[i], "-raw"))
+            g_bRaw = true;
+        else if ((0 == strcmp(argv[i], "-g")) && (i + 1 < argc))
+            group = argv[++i];
+        else if ((0 == strcmp(argv[i], "-p")) && (i + 1 < argc))
+            port = (unsigned short)atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-i")) && (i + 1 < argc))
+            iface = argv[++i];
+        else if ((0 == strcmp(argv[i], "-payload")) && (i + 1 < argc))
+            payload = atoi(argv[++i]);
+        else if ((0 == strcmp(argv[i], "-q")) && (i + 1 < argc))
+            length = atoi(argv[++i]);
+    }
+    if ((bSend == bListen) || (payload < 256) || (payload > 65000))
+    {
+        printf("usage: %s send|listen [-g group = 239.255.0.1] [-p port = 50000] [-i interface address] [-raw] [-payload bytes = %u] [-q deque length = 4]\n", argv[0], FRAMECAST_PAYLOAD);
+        return -1;
+    }
+    if (!framecast_init())
+    {
+        printf("failed to init the sockets\n");
+        return -1;
+    }
+    return bSend ? Send(group, port, iface, payload) : Listen(group, port, iface, length);
+}
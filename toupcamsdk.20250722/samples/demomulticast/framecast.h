@@ -0,0 +1,310 @@
+#ifndef __framecast_H__
+#define __framecast_H__
+
+/*
+    Frames of one camera to several hosts over UDP multicast: the camera is opened by one host only (Toupcam_Open is
+    exclusive and the SDK has no listener mode of GVSP), which pulls every frame as usual and sends it once to a
+    multicast group; the switch copies it to every host which joined the group, so another listener costs the
+    sender nothing. The listeners are read-only by construction, they have no way back to the camera.
+    A frame is cut into datagrams of at most FrameCastSender::payload bytes (default FRAMECAST_PAYLOAD, fits a 1500 MTU;
+    up to about 8900 with jumbo frames), each with a FrameCastHeader. There is no resend: a frame with a datagram
+    missing when the next one begins is dropped and counted (incomplete), so the receive buffer of the listener
+    (FRAMECAST_RCVBUF) and the network determine how many frames make it. Each FrameCastReceiver reassembles into a
+    deque of its own, of the length given, and the oldest frame is dropped when the application pulls too slowly.
+    Fields in host byte order: the hosts are assumed to share it, a header with another magic is ignored.
+*/
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+typedef int SOCKET;
+#define INVALID_SOCKET  (-1)
+inline int closesocket(SOCKET s) { return ::close(s); }
+#endif
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#define FRAMECAST_MAGIC     0x54534346  /* 'FCST' */
+#define FRAMECAST_PAYLOAD   1400
+#define FRAMECAST_RCVBUF    (16 * 1024 * 1024)
+
+#define FRAMECAST_FLAG_RAW  0x01        /* bits is the raw bit depth, 8 or 16 bits per pixel */
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;           /* counted by the sender (ToupcamFrameInfoV3.seq is always 0 without TOUPCAM_FLAG_SEQ) */
+    uint32_t frag, fragCount;
+    uint32_t fragSize;      /* payload of every datagram but the last */
+    uint32_t size;          /* of the frame */
+    uint32_t width, height;
+    uint16_t bits, flag;
+    uint64_t timestamp;     /* ToupcamFrameInfoV3.timestamp */
+} FrameCastHeader;
+#pragma pack(pop)
+
+typedef struct {
+    uint32_t seq, width, height, bits, flag;
+    uint64_t timestamp;
+    std::vector<unsigned char> data;
+} FrameCastFrame;
+
+/* once per process, Winsock */
+inline bool framecast_init()
+{
+#if defined(_WIN32)
+    WSADATA wsa;
+    return (0 == WSAStartup(MAKEWORD(2, 2), &wsa));
+#else
+    return true;
+#endif
+}
+
+class FrameCastSender {
+    SOCKET m_sock;
+    sockaddr_in m_addr;
+    std::vector<unsigned char> m_packet;
+    uint32_t m_seq;         /* from the clock: a sender started again does not look like late datagrams of the last one */
+public:
+    unsigned payload;
+
+    FrameCastSender()
+    : m_sock(INVALID_SOCKET), m_seq((uint32_t)std::chrono::steady_clock::now().time_since_epoch().count()), payload(FRAMECAST_PAYLOAD)
+    {
+        memset(&m_addr, 0, sizeof(m_addr));
+    }
+
+    ~FrameCastSender() { close(); }
+
+    /* group: such as 239.255.0.1; iface: the address of the interface to send on, NULL => the default route */
+    bool open(const char* group, unsigned short port, const char* iface = NULL, int ttl = 1)
+    {
+        m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (INVALID_SOCKET == m_sock)
+            return false;
+        m_addr.sin_family = AF_INET;
+        m_addr.sin_port = htons(port);
+        inet_pton(AF_INET, group, &m_addr.sin_addr);
+        setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(ttl));
+        if (iface)
+        {
+            in_addr a;
+            inet_pton(AF_INET, iface, &a);
+            setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&a, sizeof(a));
+        }
+        const int sndbuf = FRAMECAST_RCVBUF;
+        setsockopt(m_sock, SOL_SOCKET, SO_SNDBUF, (const char*)&sndbuf, sizeof(sndbuf));
+        return true;
+    }
+
+    void close()
+    {
+        if (INVALID_SOCKET != m_sock)
+        {
+            closesocket(m_sock);
+            m_sock = INVALID_SOCKET;
+        }
+    }
+
+    /* false if a datagram could not be sent; the frame gets the next seq whatever */
+    bool send(uint64_t timestamp, uint32_t width, uint32_t height, uint16_t bits, uint16_t flag, const void* pData, uint32_t size)
+    {
+        if (INVALID_SOCKET == m_sock)
+            return false;
+        m_packet.resize(sizeof(FrameCastHeader) + payload);
+        FrameCastHeader* h = (FrameCastHeader*)&m_packet[0];
+        h->magic = FRAMECAST_MAGIC;
+        h->seq = ++m_seq;
+        h->fragCount = (size + payload - 1) / payload;
+        h->fragSize = payload;
+        h->size = size;
+        h->width = width;
+        h->height = height;
+        h->bits = bits;
+        h->flag = flag;
+        h->timestamp = timestamp;
+        bool bok = true;
+        for (uint32_t i = 0; i < h->fragCount; ++i)
+        {
+            const uint32_t offset = i * payload, len = (size - offset < payload) ? (size - offset) : payload;
+            h->frag = i;
+            memcpy(&m_packet[sizeof(FrameCastHeader)], (const unsigned char*)pData + offset, len);
+            if (sendto(m_sock, (const char*)&m_packet[0], (int)(sizeof(FrameCastHeader) + len), 0, (const sockaddr*)&m_addr, sizeof(m_addr)) < 0)
+                bok = false;
+        }
+        return bok;
+    }
+};
+
+class FrameCastReceiver {
+    SOCKET m_sock;
+    std::thread m_thread;
+    std::atomic<bool> m_bStop;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::deque<FrameCastFrame> m_deque;
+    size_t m_length;
+    FrameCastFrame m_cur;               /* being assembled */
+    std::vector<unsigned char> m_got;   /* per fragment of m_cur */
+    uint32_t m_gotCount, m_fragSize;    /* of m_cur */
+    bool m_bCur;                        /* m_cur is being assembled, else m_cur.seq is the last one completed */
+    bool m_bSeen;
+
+    void complete()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_deque.size() >= m_length)
+        {
+            m_deque.pop_front();
+            ++dropped;
+        }
+        m_deque.push_back(FrameCastFrame());
+        m_deque.back().data.swap(m_cur.data);
+        FrameCastFrame& f = m_deque.back();
+        f.seq = m_cur.seq;
+        f.width = m_cur.width;
+        f.height = m_cur.height;
+        f.bits = m_cur.bits;
+        f.flag = m_cur.flag;
+        f.timestamp = m_cur.timestamp;
+        ++received;
+        m_cv.notify_one();
+    }
+
+    void run()
+    {
+        std::vector<unsigned char> packet(65536);
+        while (!m_bStop)
+        {
+            const int n = (int)recv(m_sock, (char*)&packet[0], (int)packet.size(), 0);
+            if (n < (int)sizeof(FrameCastHeader))
+                continue;   /* timeout, to look at m_bStop */
+            const FrameCastHeader* h = (const FrameCastHeader*)&packet[0];
+            const uint32_t len = n - sizeof(FrameCastHeader);
+            if ((FRAMECAST_MAGIC != h->magic) || (0 == h->fragSize) || (h->frag >= h->fragCount)
+                || ((uint64_t)h->frag * h->fragSize + len > h->size) || (h->fragCount != (h->size + h->fragSize - 1) / h->fragSize))
+                continue;
+            if ((!m_bCur) || (h->seq != m_cur.seq))
+            {
+                const int32_t d = (int32_t)(h->seq - m_cur.seq);
+                if (m_bSeen && (d <= 0) && (d > -1000))
+                    continue;   /* a late datagram of a frame already done or given up; far behind: the camera restarted */
+                if (m_bCur)
+                    ++incomplete;
+                m_bCur = m_bSeen = true;
+                m_cur.seq = h->seq;
+                m_cur.width = h->width;
+                m_cur.height = h->height;
+                m_cur.bits = h->bits;
+                m_cur.flag = h->flag;
+                m_cur.timestamp = h->timestamp;
+                m_cur.data.resize(h->size);
+                m_got.assign(h->fragCount, 0);
+                m_gotCount = 0;
+                m_fragSize = h->fragSize;
+            }
+            else if ((h->size != m_cur.data.size()) || (h->fragCount != m_got.size()) || (h->fragSize != m_fragSize))
+                continue;   /* the seq of the frame, not its layout: another sender on the group, or a damaged datagram */
+            if (m_got[h->frag])
+                continue;
+            m_got[h->frag] = 1;
+            memcpy(&m_cur.data[(size_t)h->frag * h->fragSize], &packet[sizeof(FrameCastHeader)], len);
+            if (++m_gotCount == h->fragCount)
+            {
+                complete();
+                m_bCur = false;
+            }
+        }
+    }
+public:
+    std::atomic<unsigned> received, incomplete, dropped;
+
+    FrameCastReceiver()
+    : m_sock(INVALID_SOCKET), m_bStop(false), m_length(4), m_gotCount(0), m_fragSize(0), m_bCur(false), m_bSeen(false), received(0), incomplete(0), dropped(0)
+    {
+    }
+
+    ~FrameCastReceiver() { close(); }
+
+    /* iface: the address of the interface to join on, NULL => any; length: of the deque */
+    bool open(const char* group, unsigned short port, const char* iface = NULL, size_t length = 4)
+    {
+        m_length = length ? length : 1;
+        m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (INVALID_SOCKET == m_sock)
+            return false;
+        const int reuse = 1, rcvbuf = FRAMECAST_RCVBUF;
+        setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));   /* several listeners on one host */
+        setsockopt(m_sock, SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf));
+#if defined(_WIN32)
+        const DWORD timeout = 200;
+#else
+        const timeval timeout = { 0, 200000 };
+#endif
+        setsockopt(m_sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        ip_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        inet_pton(AF_INET, group, &mreq.imr_multiaddr);
+        if (iface)
+            inet_pton(AF_INET, iface, &mreq.imr_interface);
+        else
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if ((bind(m_sock, (const sockaddr*)&addr, sizeof(addr)) < 0)
+            || (setsockopt(m_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) < 0))
+        {
+            closesocket(m_sock);
+            m_sock = INVALID_SOCKET;
+            return false;
+        }
+        m_bStop = false;
+        m_thread = std::thread(&FrameCastReceiver::run, this);
+        return true;
+    }
+
+    void close()
+    {
+        m_bStop = true;
+        if (m_thread.joinable())
+            m_thread.join();
+        if (INVALID_SOCKET != m_sock)
+        {
+            closesocket(m_sock);
+            m_sock = INVALID_SOCKET;
+        }
+    }
+
+    /* the oldest frame of the deque; false if none came within waitMs */
+    bool pull(FrameCastFrame& frame, unsigned waitMs)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (!m_cv.wait_for(lock, std::chrono::milliseconds(waitMs), [this] { return !m_deque.empty(); }))
+            return false;
+        frame.data.swap(m_deque.front().data);
+        frame.seq = m_deque.front().seq;
+        frame.width = m_deque.front().width;
+        frame.height = m_deque.front().height;
+        frame.bits = m_deque.front().bits;
+        frame.flag = m_deque.front().flag;
+        frame.timestamp = m_deque.front().timestamp;
+        m_deque.pop_front();
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#if defined(_WIN32)
+#include <tchar.h>
+#endif
+#include "toupcam.h"
+#include "../numaplace.h"
+
+/*
+    demomulti with NUMA placement (samples/numaplace.h): every camera is located on its node, its pull buffer is
+    allocated there, and it is started with its SDK threads and deques on the CPUs and the memory of that node.
+    usage: demonuma [seconds, default 10] [index=hint ...]
+        hint: the node ("1=0"), the network interface of a GigE camera ("2=eth3") or a path in /sys ("0=/sys/bus/pci/
+        devices/0000:40:00.3"), for the cameras which the USB lookup cannot place
+*/
+#if !defined(_WIN32)
+#define _tprintf    printf
+#define _T(x)       x
+#endif
+
+ToupcamDeviceV2 g_dev[TOUPCAM_MAX] = { 0 };
+struct ctxCam {
+    ToupcamDeviceV2* dev;
+    HToupcam hcam;
+    void* data;
+    size_t size;
+    NumaPlacement place;
+    unsigned total;
+} g_ctx[TOUPCAM_MAX] = { 0 };
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    ctxCam* pctx = (ctxCam*)pCallbackCtx;
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(pctx->hcam, pctx->data, 0, 24, 0, &info);
+        if (FAILED(hr))
+            _tprintf(_T("%s: failed to pull image, hr = 0x%08x\n"), pctx->dev->displayname, hr);
+        else
+            ++(pctx->total);
+    }
+    else
+    {
+        _tprintf(_T("%s: event callback: 0x%04x\n"), pctx->dev->displayname, nEvent);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned seconds = (argc > 1) ? (unsigned)atoi(argv[1]) : 10;
+    const char* hint[TOUPCAM_MAX] = { 0 };
+    for (int i = 2; i < argc; ++i)
+    {
+        const char* eq = strchr(argv[i], '=');
+        const int index = atoi(argv[i]);
+        if (eq && (index >= 0) && (index < TOUPCAM_MAX))
+            hint[index] = eq + 1;
+    }
+
+    unsigned num = Toupcam_EnumV2(g_dev);
+    if (0 == num)
+    {
+        _tprintf(_T("no camera found\n"));
+        return -1;
+    }
+    printf("%d NUMA node(s)\n", NumaNodeCount());
+
+    for (unsigned i = 0; i < num; ++i)
+    {
+        g_ctx[i].dev = &g_dev[i];
+        g_ctx[i].hcam = Toupcam_Open(g_dev[i].id);
+        if (NULL == g_ctx[i].hcam)
+        {
+            _tprintf(_T("%s: open failed\n"), g_ctx[i].dev->displayname);
+            continue;
+        }
+        NumaLocate(g_dev[i], g_ctx[i].hcam, hint[i], &g_ctx[i].place);
+
+        int nWidth = 0, nHeight = 0;
+        HRESULT hr = Toupcam_get_Size(g_ctx[i].hcam, &nWidth, &nHeight);
+        if (FAILED(hr))
+            _tprintf(_T("%s: failed to get size, hr = 0x%08x\n"), g_ctx[i].dev->displayname, hr);
+        else
+        {
+            g_ctx[i].size = TDIBWIDTHBYTES(24 * nWidth) * nHeight;
+            g_ctx[i].data = NumaAlloc(g_ctx[i].size, g_ctx[i].place.node);
+            if (NULL == g_ctx[i].data)
+                _tprintf(_T("%s: failed to allocate\n"), g_ctx[i].dev->displayname);
+            else
+            {
+                hr = NumaStartPullModeWithCallback(g_ctx[i].hcam, &g_ctx[i].place, EventCallback, (void*)&g_ctx[i]);
+                if (FAILED(hr))
+                    _tprintf(_T("%s: failed to start camera, hr = 0x%08x\n"), g_ctx[i].dev->displayname, hr);
+                else
+                {
+                    _tprintf(_T("%s: "), g_ctx[i].dev->displayname);
+                    printf("node %d (%s), cpus 0x%llx, %u threads pinned\n", g_ctx[i].place.node, g_ctx[i].place.how, g_ctx[i].place.cpus, g_ctx[i].place.pinned);
+                }
+            }
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    for (unsigned i = 0; i < num; ++i)
+    {
+        if (g_ctx[i].hcam)
+            _tprintf(_T("%s: %u frames, %.1f fps\n"), g_ctx[i].dev->displayname, g_ctx[i].total, seconds ? g_ctx[i].total / (double)seconds : 0.0);
+    }
+
+    /* cleanup */
+    for (unsigned i = 0; i < num; ++i)
+    {
+        if (g_ctx[i].hcam)
+        {
+            Toupcam_Close(g_ctx[i].hcam);
+            g_ctx[i].hcam = NULL;
+        }
+        NumaFree(g_ctx[i].data, g_ctx[i].size);
+        g_ctx[i].data = NULL;
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+#include "../oneshotae.h"
+
+/*
+    One shot auto exposure (oneshotae.h) against the auto exposure loop of the SDK, in frames.
+    usage: demooneshotae
+    commands, one per line while the camera is running:
+        m           meter: the histogram of the next frame, the exposure solved from it and applied, again while the
+                    frame was clipped or black; the number of frames up to the first one correctly exposed
+        a           the auto exposure once mode of the SDK (Toupcam_put_AutoExpoEnable 2), the number of frames up to
+                    TOUPCAM_EVENT_AUTOEXPO_CONV
+        <us>        exposure time, auto exposure off, to start from somewhere else
+        ENTER       exit
+*/
+#define MAX_METER   4           /* metering frames of one "m" */
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+OneShotAE g_ae;
+std::mutex g_mtx;
+std::condition_variable g_cv;
+std::vector<unsigned> g_hist;
+unsigned g_histFlag = 0;
+bool g_bHist = false;
+unsigned g_frames = 0;          /* since the command */
+unsigned g_expoTime = 0;        /* of the last frame */
+unsigned short g_expoGain = 0;
+int g_mode = 0;                 /* 1: waiting for the one shot exposure, 2: waiting for the SDK */
+unsigned g_done = 0;            /* frames it took, 0: not yet */
+
+static void __stdcall HistogramCallback(const unsigned* aHist, unsigned nFlag, void* ctxHistogramV2)
+{
+    unsigned size = 1u << (nFlag & 0x0f);
+    if (0 == (nFlag & 0x00008000))
+        size *= 3;
+    std::lock_guard<std::mutex> lock(g_mtx);
+    g_hist.assign(aHist, aHist + size);
+    g_histFlag = nFlag;
+    g_bHist = true;
+    g_cv.notify_all();
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            ++g_frames;
+            g_expoTime = info.v3.expotime;
+            g_expoGain = info.v3.expogain;
+            if ((1 == g_mode) && g_ae.exposed(info))
+            {
+                g_done = g_frames;
+                g_mode = 0;
+                g_cv.notify_all();
+            }
+        }
+    }
+    else if (TOUPCAM_EVENT_AUTOEXPO_CONV == nEvent)
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        if (2 == g_mode)
+        {
+            g_done = g_frames;
+            g_mode = 0;
+            g_cv.notify_all();
+        }
+    }
+}
+
+static void Meter()
+{
+    std::unique_lock<std::mutex> lock(g_mtx);
+    g_frames = 0;
+    for (int k = 0; k < MAX_METER; ++k)
+    {
+        g_bHist = false;
+        lock.unlock();
+        HRESULT hr = Toupcam_GetHistogramV2(g_hcam, HistogramCallback, NULL);
+        lock.lock();
+        if (FAILED(hr))
+        {
+            printf("failed to get histogram, hr = 0x%08x\n", hr);
+            return;
+        }
+        if (!g_cv.wait_for(lock, std::chrono::seconds(5), [] { return g_bHist; }))
+        {
+            printf("histogram: timeout\n");
+            return;
+        }
+        unsigned expoTime = 0;
+        unsigned short expoGain = 0;
+        const bool exact = g_ae.solve(&g_hist[0], g_histFlag, g_expoTime, g_expoGain, &expoTime, &expoGain);
+        printf("metered at %u us, %u%%: %u us, %u%%%s\n", g_expoTime, g_expoGain, expoTime, expoGain, exact ? "" : ", clipped, again");
+        g_done = 0;
+        lock.unlock();
+        hr = g_ae.apply(g_hcam, expoTime, expoGain);
+        lock.lock();
+        if (FAILED(hr))
+        {
+            printf("failed to set exposure, hr = 0x%08x\n", hr);
+            return;
+        }
+        g_mode = 1;     /* only now: exposed() compares with what apply() read back */
+        if (!g_cv.wait_for(lock, std::chrono::milliseconds(expoTime / 1000 * 4 + 5000), [] { return 0 == g_mode; }))
+        {
+            g_mode = 0;
+            printf("no frame at %u us, %u%%: timeout\n", g_ae.expoTime(), g_ae.expoGain());
+            return;
+        }
+        if (exact)
+            break;
+    }
+    printf("one shot: exposed at frame %u\n", g_done);
+}
+
+static void AutoOnce()
+{
+    std::unique_lock<std::mutex> lock(g_mtx);
+    g_frames = 0;
+    g_done = 0;
+    g_mode = 2;
+    lock.unlock();
+    const HRESULT hr = Toupcam_put_AutoExpoEnable(g_hcam, 2);
+    lock.lock();
+    if (FAILED(hr))
+    {
+        g_mode = 0;
+        printf("failed to enable auto exposure, hr = 0x%08x\n", hr);
+    }
+    else if (!g_cv.wait_for(lock, std::chrono::seconds(30), [] { return 0 == g_mode; }))
+    {
+        g_mode = 0;
+        printf("auto exposure: timeout\n");
+    }
+    else
+        printf("auto exposure once: converged at frame %u\n", g_done);
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = g_ae.init(g_hcam)))
+        printf("failed to get auto exposure range, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            Toupcam_put_AutoExpoEnable(g_hcam, 0);
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                char line[64];
+                printf("target = %u, m: one shot, a: auto exposure once, <us>: exposure time, ENTER: exit\n", g_ae.target());
+                while (fgets(line, sizeof(line), stdin))
+                {
+                    if (('\n' == line[0]) || ('\r' == line[0]))
+                        break;
+                    if ('m' == line[0])
+                        Meter();
+                    else if ('a' == line[0])
+                        AutoOnce();
+                    else if (atoi(line) > 0)
+                    {
+                        Toupcam_put_AutoExpoEnable(g_hcam, 0);
+                        Toupcam_put_ExpoTime(g_hcam, (unsigned)atoi(line));
+                    }
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,111 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/cudaarithm.hpp"
+#include "opencv2/cudaimgproc.hpp"
+#include "toupcam.h"
+#include "../cvpinned.h"
+
+HToupcam g_hcam = NULL;
+CvPinnedPool g_pool;
+cv::cuda::Stream* g_pStream = NULL;  /* made in main: without CUDA, a Stream throws as it is constructed */
+cv::cuda::GpuMat g_grey;
+cv::cuda::HostMem g_stat;       /* mean and standard deviation of the grey frame, written by the GPU */
+unsigned g_total = 0, g_busy = 0;
+bool g_bSave = false;
+
+static void removeln(char* str)
+{
+    char* endstr = strchr(str, '\n');
+    if (endstr)
+        *endstr = '\0';
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        CvPinnedFrame frame;
+        /* the frame lands in page-locked memory and the upload is already queued on g_stream, one DMA */
+        const HRESULT hr = g_pool.pull(0, &frame, g_pStream);
+        if (0x8007000e == (unsigned)hr) /* all the slots still in use by the GPU: leave the frame in the SDK */
+            ++g_busy;
+        else if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            ++g_total;
+            try
+            {
+                /* the bytes are BGR, as TOUPCAM_OPTION_BYTEORDER has it by default */
+                cv::cuda::cvtColor(frame.gpu, g_grey, cv::COLOR_BGR2GRAY, 0, *g_pStream);
+                cv::cuda::meanStdDev(g_grey, g_stat, *g_pStream);
+                /* the slot comes back once the GPU is done with it, not before */
+                g_pool.release(frame, g_pStream);
+                g_pStream->waitForCompletion();
+                const double* stat = (const double*)g_stat.data;
+                if (0 == g_total % 30)
+                    printf("frame %u: %u x %u, mean = %.1f, contrast = %.1f, busy = %u\n", g_total, frame.info.v3.width, frame.info.v3.height, stat[0], stat[1], g_busy);
+                if (g_bSave)
+                {
+                    cv::Mat grey;
+                    g_grey.download(grey);
+                    char path[128];
+                    sprintf(path, "Image_%d.bmp", g_total);
+                    cv::imwrite(path, grey);
+                    printf("succesd to save image\n");
+                    g_bSave = false;
+                }
+            }
+            catch (cv::Exception& ex)
+            {
+                g_pool.release(frame);
+                printf("Exception in processing: %s\n", ex.what());
+            }
+        }
+    }
+}
+
+int main(int, char**)
+{
+    if (cv::cuda::getCudaEnabledDeviceCount() <= 0)
+    {
+        printf("no CUDA device, or OpenCV built without CUDA\n");
+        return -1;
+    }
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    g_pStream = new cv::cuda::Stream();
+    HRESULT hr = g_pool.init(g_hcam, 3, 24);
+    if (FAILED(hr))
+        printf("failed to allocate pinned memory, hr = 0x%08x\n", hr);
+    else
+    {
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            char str[1024];
+            do {
+                printf("Please input [s/S] to save image ([x/X] to exit):\n");
+                if (fgets(str, 1023, stdin))
+                {
+                    removeln(str);
+                    if ('s' == str[0] || 'S' == str[0])
+                        g_bSave = true;
+                    else if ('x' == str[0] || 'X' == str[0])
+                        break;
+                }
+            } while (true);
+        }
+    }
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    delete g_pStream;
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "threadpin.h"
+
+/*
+    Keeps the acquisition away from the rest of the machine.
+    usage: demopin [sdk mask] [callback mask] [app mask] [rt]        masks in hex, such as 0x0f, 0 = leave as it is
+    The threads the SDK creates when the camera starts (grab, processing) are pinned to the sdk mask, the dedicated
+    callback thread (TOUPCAM_OPTION_CALLBACK_THREAD) pins itself to the callback mask on its first event, and the main
+    thread, which stands for the UI and the encoding of a real application, to the app mask. With "rt" the grab thread
+    (TOUPCAM_OPTION_THREAD_PRIORITY) and the callback thread run SCHED_FIFO (Linux, macOS) or under MMCSS (Windows).
+    Every REPORT_INTERVAL frames the drop counter of the SDK (TOUPCAM_OPTION_NUMBER_DROP_FRAME) is printed, to compare
+    the settings under load.
+*/
+#define REPORT_INTERVAL     100     /* frames */
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned long long g_callbackMask = 0;
+bool g_bRealtime = false, g_bPinned = false;
+unsigned g_total = 0;
+std::atomic<bool> g_bSdkPinned(false);  /* the callback thread is one of the new threads, it repins itself only after them */
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if ((!g_bPinned) && g_bSdkPinned)
+    {
+        g_bPinned = true;   /* always the same thread, the dedicated callback thread */
+        if (!PinSelf(g_callbackMask))
+            printf("failed to pin the callback thread\n");
+        if (g_bRealtime && (!SetRealtime()))
+            printf("failed to make the callback thread realtime\n");
+    }
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (0 == ++g_total % REPORT_INTERVAL)
+        {
+            int nDrop = 0;
+            Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_NUMBER_DROP_FRAME, &nDrop);
+            printf("total = %u, seq = %u, dropped = %d\n", g_total, info.v3.seq, nDrop);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned long long sdkMask = (argc > 1) ? strtoull(argv[1], NULL, 16) : 0;
+    g_callbackMask = (argc > 2) ? strtoull(argv[2], NULL, 16) : 0;
+    const unsigned long long appMask = (argc > 3) ? strtoull(argv[3], NULL, 16) : 0;
+    g_bRealtime = (argc > 4) && (0 == strcmp(argv[4], "rt"));
+    if (!PinSelf(appMask))
+        printf("failed to pin the main thread\n");
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_CALLBACK_THREAD, 1);
+    HRESULT hr;
+    if (g_bRealtime && FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_THREAD_PRIORITY, RealtimePriorityOption())))
+        printf("failed to set the grab thread priority, hr = 0x%08x\n", hr);
+    int nWidth = 0, nHeight = 0;
+    hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            const ThreadPinList before = ThreadList();
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                if (sdkMask)
+                    printf("%u threads of the sdk pinned to 0x%llx\n", PinNewThreads(before, sdkMask), sdkMask);
+                g_bSdkPinned = true;
+                printf("press ENTER to exit\n");
+                getc(stdin);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
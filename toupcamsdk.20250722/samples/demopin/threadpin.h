@@ -0,0 +1,150 @@
+#ifndef __threadpin_H__
+#define __threadpin_H__
+
+/*
+    CPU affinity and realtime scheduling for the threads of an acquisition process.
+    The SDK creates its threads (USB grab, image processing, dedicated callback thread) when the camera starts and
+    offers no handle to them, so they are found by difference: ThreadList() before Toupcam_StartXXX, then
+    PinNewThreads() after it pins every thread of the process which did not exist before. The callback thread can
+    also pin itself from within the callback (PinSelf on the first event), which is how it gets a mask of its
+    own apart from the other threads of the SDK.
+    SetRealtime() moves the calling thread to SCHED_FIFO (Linux, macOS: needs CAP_SYS_NICE or root) or registers
+    it to MMCSS "Capture" (Windows). RealtimePriorityOption() is the value of TOUPCAM_OPTION_THREAD_PRIORITY which
+    does the same to the grab thread of the SDK.
+    Masks are 64 bits, bit n = logical processor n; 0 means "leave it as it is". macOS has no affinity API: all the
+    affinity functions return false or 0 there.
+*/
+#include <vector>
+#if defined(_WIN32)
+#include <windows.h>
+#include <tlhelp32.h>
+#include <avrt.h>
+#pragma comment(lib, "avrt.lib")
+#else
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+#include "toupcam.h"
+
+#define THREADPIN_RT_PRIORITY   50      /* SCHED_FIFO priority, in the middle of [1, 99], below the kernel threads of the USB host controller */
+
+typedef std::vector<unsigned long> ThreadPinList;
+
+/* ids of all the threads of the process */
+static inline ThreadPinList ThreadList()
+{
+    ThreadPinList list;
+#if defined(_WIN32)
+    HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (INVALID_HANDLE_VALUE != hSnap)
+    {
+        THREADENTRY32 te = { sizeof(te) };
+        const DWORD pid = GetCurrentProcessId();
+        for (BOOL b = Thread32First(hSnap, &te); b; b = Thread32Next(hSnap, &te))
+        {
+            if (te.th32OwnerProcessID == pid)
+                list.push_back(te.th32ThreadID);
+        }
+        CloseHandle(hSnap);
+    }
+#elif defined(__linux__)
+    DIR* dir = opendir("/proc/self/task");
+    if (dir)
+    {
+        while (struct dirent* ent = readdir(dir))
+        {
+            if (ent->d_name[0] != '.')
+                list.push_back(strtoul(ent->d_name, NULL, 10));
+        }
+        closedir(dir);
+    }
+#endif
+    return list;
+}
+
+static inline bool PinThread(unsigned long tid, unsigned long long mask)
+{
+    if (0 == mask)
+        return true;
+#if defined(_WIN32)
+    HANDLE hThread = OpenThread(THREAD_SET_INFORMATION | THREAD_QUERY_INFORMATION, FALSE, tid);
+    if (NULL == hThread)
+        return false;
+    const bool ret = (0 != SetThreadAffinityMask(hThread, (DWORD_PTR)mask));
+    CloseHandle(hThread);
+    return ret;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned i = 0; i < 64; ++i)
+    {
+        if (mask & (1ULL << i))
+            CPU_SET(i, &set);
+    }
+    return (0 == sched_setaffinity((pid_t)tid, sizeof(set), &set));
+#else
+    return false;
+#endif
+}
+
+/* the calling thread */
+static inline bool PinSelf(unsigned long long mask)
+{
+#if defined(_WIN32)
+    return PinThread(GetCurrentThreadId(), mask);
+#elif defined(__linux__)
+    return PinThread((unsigned long)syscall(SYS_gettid), mask);
+#else
+    return (0 == mask);
+#endif
+}
+
+/* pins the threads of the process which are not in before, returns how many */
+static inline unsigned PinNewThreads(const ThreadPinList& before, unsigned long long mask)
+{
+    const ThreadPinList now = ThreadList();
+    unsigned n = 0;
+    for (size_t i = 0; i < now.size(); ++i)
+    {
+        bool bOld = false;
+        for (size_t j = 0; (j < before.size()) && (!bOld); ++j)
+            bOld = (before[j] == now[i]);
+        if ((!bOld) && PinThread(now[i], mask))
+            ++n;
+    }
+    return n;
+}
+
+/* the calling thread, for as long as it lives */
+static inline bool SetRealtime()
+{
+#if defined(_WIN32)
+    DWORD taskIndex = 0;
+    HANDLE hTask = AvSetMmThreadCharacteristicsW(L"Capture", &taskIndex);
+    if (NULL == hTask)
+        return false;
+    AvSetMmThreadPriority(hTask, AVRT_PRIORITY_HIGH);
+    return true;
+#else
+    sched_param param = { 0 };
+    param.sched_priority = THREADPIN_RT_PRIORITY;
+    return (0 == pthread_setschedparam(pthread_self(), SCHED_FIFO, &param));
+#endif
+}
+
+static inline int RealtimePriorityOption()
+{
+#if defined(_WIN32)
+    return 3;   /* THREAD_PRIORITY_TIME_CRITICAL */
+#else
+    return (SCHED_FIFO << 16) | THREADPIN_RT_PRIORITY;
+#endif
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef __bwplan_H__
+#define __bwplan_H__
+
+/*
+    Bandwidth budget of several cameras on one host.
+    Each BwCamera says which link it is on (cameras with the same link share it, such as the cameras behind one root
+    hub or one NIC) and the frame rate it wants. BwPlan() computes what goes on the wire for every camera (final
+    size x bits per pixel of its pixel format x frame rate), compares the sum of every link with the capacity of that
+    link, and when a link is oversubscribed scales the frame rates of all its cameras by the same factor. The capacity
+    of a link is the one of the slowest camera on it, from its transport flags: a USB3.0 camera on a USB2.0 port
+    (TOUPCAM_FLAG_USB30_OVER_USB20) counts as USB2.0, a USB3.2 camera on a USB3.0 port (TOUPCAM_FLAG_USB32_OVER_USB30)
+    as USB3.0.
+    BwApply() sets TOUPCAM_OPTION_PRECISE_FRAMERATE and TOUPCAM_OPTION_BANDWIDTH (its share of the link) on the
+    cameras with TOUPCAM_FLAG_PRECISE_FRAMERATE, TOUPCAM_OPTION_FRAMERATE on the others; BwMeasure() reads back
+    the frame rate of the camera, to be compared with the prediction.
+    The capacities are the payload a link sustains in practice, not the signalling rate; the SDK does not report
+    the topology, so which cameras share a link is up to the caller.
+*/
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "toupcam.h"
+
+#define BWPLAN_MARGIN       0.9     /* fraction of the link capacity handed out */
+
+typedef struct {
+    HToupcam hcam;
+    unsigned link;          /* cameras with the same link share its capacity */
+    double fps;             /* wanted */
+    /* filled by BwPlan */
+    double capacity;        /* MB/s, of this camera's transport */
+    double bytesPerFrame;
+    double plannedFps;
+    double plannedMBps;
+    int bandwidth;          /* percent of the budget of the link, for TOUPCAM_OPTION_BANDWIDTH */
+} BwCamera;
+
+/* bits per pixel on the wire */
+static unsigned BwPixelBits(int pixelFormat)
+{
+    switch (pixelFormat)
+    {
+    case TOUPCAM_PIXELFORMAT_RAW8:
+    case TOUPCAM_PIXELFORMAT_GMCY8:
+        return 8;
+    case TOUPCAM_PIXELFORMAT_RAW10PACK:
+        return 10;
+    case TOUPCAM_PIXELFORMAT_RAW12PACK:
+    case TOUPCAM_PIXELFORMAT_YUV411:
+        return 12;
+    case TOUPCAM_PIXELFORMAT_YUV444:
+    case TOUPCAM_PIXELFORMAT_RGB888:
+        return 24;
+    case TOUPCAM_PIXELFORMAT_HDR8HL:
+        return 16;  /* two conversion gains for every exposure */
+    case TOUPCAM_PIXELFORMAT_HDR10HL:
+    case TOUPCAM_PIXELFORMAT_HDR11HL:
+    case TOUPCAM_PIXELFORMAT_HDR12HL:
+    case TOUPCAM_PIXELFORMAT_HDR14HL:
+        return 32;
+    default:
+        return 16;  /* RAW10 ... RAW16, GMCY12, VUYY, UYVY */
+    }
+}
+
+/* MB/s */
+static double BwLinkCapacity(HToupcam h)
+{
+    const unsigned long long flag = Toupcam_query_Model(h)->flag;
+    if (flag & TOUPCAM_FLAG_10GIGE)
+        return 1150.0;
+    if (flag & TOUPCAM_FLAG_GIGE)
+        return 115.0;
+    if (flag & (TOUPCAM_FLAG_CAMERALINK | TOUPCAM_FLAG_CXP))
+        return 2000.0;
+    /* the port first: a USB3.2 camera on a USB2.0 port does not report USB32_OVER_USB30 */
+    if (flag & TOUPCAM_FLAG_USB30_OVER_USB20)
+        return 40.0;
+    if ((flag & TOUPCAM_FLAG_USB32) && (0 == (flag & TOUPCAM_FLAG_USB32_OVER_USB30)))
+        return 760.0;
+    if (flag & (TOUPCAM_FLAG_USB30 | TOUPCAM_FLAG_USB32))
+        return 380.0;
+    return 40.0;    /* USB2.0 */
+}
+
+static void BwPlan(std::vector<BwCamera>& cams)
+{
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        int width = 0, height = 0, pixelFormat = TOUPCAM_PIXELFORMAT_RAW8;
+        Toupcam_get_FinalSize(cams[i].hcam, &width, &height);
+        Toupcam_get_Option(cams[i].hcam, TOUPCAM_OPTION_PIXEL_FORMAT, &pixelFormat);
+        cams[i].capacity = BwLinkCapacity(cams[i].hcam);
+        cams[i].bytesPerFrame = (double)width * height * BwPixelBits(pixelFormat) / 8;
+    }
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        double demand = 0.0, capacity = cams[i].capacity;
+        for (size_t j = 0; j < cams.size(); ++j)
+        {
+            if (cams[j].link == cams[i].link)
+            {
+                demand += cams[j].bytesPerFrame * cams[j].fps / 1048576.0;
+                capacity = std::min(capacity, cams[j].capacity);
+            }
+        }
+        const double budget = capacity * BWPLAN_MARGIN;
+        const double scale = (demand > budget) ? (budget / demand) : 1.0;
+        cams[i].plannedFps = cams[i].fps * scale;
+        cams[i].plannedMBps = cams[i].bytesPerFrame * cams[i].plannedFps / 1048576.0;
+        cams[i].bandwidth = std::max(TOUPCAM_BANDWIDTH_MIN, std::min(TOUPCAM_BANDWIDTH_MAX, (int)ceil(cams[i].plannedMBps * 100.0 / budget)));
+    }
+}
+
+/* returns the first failure, the other cameras are still set */
+static HRESULT BwApply(const std::vector<BwCamera>& cams)
+{
+    HRESULT ret = 0;  /* S_OK */
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        HRESULT hr;
+        if (Toupcam_query_Model(cams[i].hcam)->flag & TOUPCAM_FLAG_PRECISE_FRAMERATE)
+        {
+            int maxFps = 0;
+            Toupcam_get_Option(cams[i].hcam, TOUPCAM_OPTION_MAX_PRECISE_FRAMERATE, &maxFps);
+            const int fps = (int)(cams[i].plannedFps * 10);
+            hr = Toupcam_put_Option(cams[i].hcam, TOUPCAM_OPTION_BANDWIDTH, cams[i].bandwidth);
+            if (SUCCEEDED(hr))
+                hr = Toupcam_put_Option(cams[i].hcam, TOUPCAM_OPTION_PRECISE_FRAMERATE, (maxFps > 0) ? std::min(fps, maxFps) : fps);
+        }
+        else
+            hr = Toupcam_put_Option(cams[i].hcam, TOUPCAM_OPTION_FRAMERATE, std::max(1, (int)cams[i].plannedFps));
+        if (FAILED(hr) && SUCCEEDED(ret))
+            ret = hr;
+    }
+    return ret;
+}
+
+/* fps of the camera since the last call, 0 when not known yet */
+static double BwMeasure(const BwCamera& cam)
+{
+    unsigned nFrame = 0, nTime = 0, nTotalFrame = 0;
+    if (SUCCEEDED(Toupcam_get_FrameRate(cam.hcam, &nFrame, &nTime, &nTotalFrame)) && (nTime > 0))
+        return nFrame * 1000.0 / nTime;
+    return 0.0;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "bwplan.h"
+
+/*
+    Bandwidth plan of all the cameras enumerated.
+    usage: demoplan [fps = 30] [separate]
+    By default all the cameras are taken as sharing one link (one root hub), "separate" gives every camera a link of
+    its own. The plan of bwplan.h is printed and applied, then each ENTER prints the measured frame rate and throughput
+    of every camera next to the predicted ones.
+*/
+ToupcamDeviceV2 g_dev[TOUPCAM_MAX] = { 0 };
+struct ctxCam {
+    HToupcam hcam;
+    void* data;
+} g_ctx[TOUPCAM_MAX] = { 0 };
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    ctxCam* pctx = (ctxCam*)pCallbackCtx;
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const HRESULT hr = Toupcam_PullImageV4(pctx->hcam, pctx->data, 0, 24, 0, NULL);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const double fps = (argc > 1) ? atof(argv[1]) : 30.0;
+    const bool bSeparate = (argc > 2) && (0 == strcmp(argv[2], "separate"));
+    const unsigned num = Toupcam_EnumV2(g_dev);
+    if (0 == num)
+    {
+        printf("no camera found\n");
+        return -1;
+    }
+
+    std::vector<BwCamera> cams;
+    for (unsigned i = 0; i < num; ++i)
+    {
+        g_ctx[i].hcam = Toupcam_Open(g_dev[i].id);
+        if (NULL == g_ctx[i].hcam)
+            printf("%s: open failed\n", g_dev[i].id);
+        else
+        {
+            BwCamera cam = { 0 };
+            cam.hcam = g_ctx[i].hcam;
+            cam.link = bSeparate ? i : 0;
+            cam.fps = fps;
+            cams.push_back(cam);
+        }
+    }
+
+    BwPlan(cams);
+    for (size_t i = 0; i < cams.size(); ++i)
+        printf("%u: link %u (%.0f MB/s), %.2f MB per frame, %.1f fps => %.1f fps, %.1f MB/s, bandwidth %d%%\n", (unsigned)i, cams[i].link, cams[i].capacity,
+            cams[i].bytesPerFrame / 1048576.0, cams[i].fps, cams[i].plannedFps, cams[i].plannedMBps, cams[i].bandwidth);
+    HRESULT hr = BwApply(cams);
+    if (FAILED(hr))
+        printf("failed to apply the plan, hr = 0x%08x\n", hr);
+
+    for (unsigned i = 0; i < num; ++i)
+    {
+        if (g_ctx[i].hcam)
+        {
+            int nWidth = 0, nHeight = 0;
+            hr = Toupcam_get_Size(g_ctx[i].hcam, &nWidth, &nHeight);
+            if (SUCCEEDED(hr))
+            {
+                g_ctx[i].data = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+                if (NULL == g_ctx[i].data)
+                    printf("failed to malloc\n");
+                else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_ctx[i].hcam, EventCallback, &g_ctx[i])))
+                    printf("failed to start camera, hr = 0x%08x\n", hr);
+            }
+        }
+    }
+
+    printf("press ENTER to measure, 'x' to exit\n");
+    do {
+        char str[1024];
+        if (fgets(str, 1023, stdin))
+        {
+            if (('x' == str[0]) || ('X' == str[0]))
+                break;
+            for (size_t i = 0; i < cams.size(); ++i)
+            {
+                const double measured = BwMeasure(cams[i]);
+                printf("%u: predicted %.1f fps, %.1f MB/s, measured %.1f fps, %.1f MB/s\n", (unsigned)i, cams[i].plannedFps, cams[i].plannedMBps,
+                    measured, cams[i].bytesPerFrame * measured / 1048576.0);
+            }
+        }
+    } while (true);
+
+    /* cleanup */
+    for (unsigned i = 0; i < num; ++i)
+    {
+        Toupcam_Close(g_ctx[i].hcam);
+        if (g_ctx[i].data)
+            free(g_ctx[i].data);
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "toupcam.h"
+#include "../capcache.h"
+#include "../optbatch.h"
+
+/*
+    Profile switching between two objectives while streaming, by one OptionBatch (optbatch.h) per profile:
+    10x: the full frame, short exposure, unity gain, the fastest speed; 40x: a centered half-size ROI, 4 x the
+    exposure, 2 x the gain. Press 1 / 2 to switch, the time of the switch and the number of settings actually sent
+    are printed; 'f' switches to a profile with another pixel format, which needs one stop / start. The first
+    switch sends everything, the next ones only what differs between the profiles.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned g_total = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (0 == (++g_total % 50))
+            printf("pull image ok, total = %u, res = %u x %u\n", g_total, info.v3.width, info.v3.height);
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static HRESULT Start()
+{
+    return Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    CamCaps caps;
+    CapCache::key(g_hcam, &caps);
+    CapCache::probe(g_hcam, &caps);
+    const unsigned w = caps.nRes ? caps.resWidth[0] : 0, h = caps.nRes ? caps.resHeight[0] : 0;
+    const unsigned expo = std::max(caps.expoMin, std::min(caps.expoMax, 10000u));
+    int pixelFormat = 0;
+    Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_PIXEL_FORMAT, &pixelFormat);
+    OptionBatch profile[3];
+    profile[0].eSize(0).roi(0, 0, 0, 0).autoExpo(0).expoTime(expo).expoGain(caps.gainMin).speed((unsigned short)caps.maxSpeed)
+        .option(TOUPCAM_OPTION_PIXEL_FORMAT, pixelFormat);
+    profile[1].eSize(0).roi(w / 4 & ~1u, h / 4 & ~1u, w / 2 & ~1u, h / 2 & ~1u).autoExpo(0).expoTime(std::min(caps.expoMax, expo * 4))
+        .expoGain((unsigned short)std::min<unsigned>(caps.gainMax, caps.gainMin * 2)).speed((unsigned short)caps.maxSpeed)
+        .option(TOUPCAM_OPTION_PIXEL_FORMAT, pixelFormat);
+    profile[2] = profile[0];
+    for (unsigned i = 0; i < caps.nFmt; ++i)
+    {
+        if (caps.fmt[i] != pixelFormat)
+        {
+            profile[2].option(TOUPCAM_OPTION_PIXEL_FORMAT, caps.fmt[i]);    /* the last value of a setting wins */
+            break;
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        size_t idx = 0;
+        if (FAILED(profile[i].validate(caps, &idx)))
+            printf("profile %d: setting %u is out of range\n", i + 1, (unsigned)idx);
+    }
+
+    OptionShadow shadow;
+    HRESULT hr = profile[0].apply(g_hcam, shadow, false, Start);
+    if (FAILED(hr))
+        printf("failed to apply the profile, hr = 0x%08x\n", hr);
+    int nWidth = 0, nHeight = 0;
+    if (FAILED(hr = Toupcam_get_Resolution(g_hcam, 0, &nWidth, &nHeight)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (NULL == (g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight * 2)))    /* * 2: the 16 bits formats */
+        printf("failed to malloc\n");
+    else if (FAILED(hr = Start()))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("1 / 2: objective 10x / 40x, f: 10x with another pixel format, x: exit\n");
+        int c;
+        while (((c = getc(stdin)) != EOF) && (c != 'x'))
+        {
+            const int i = ('1' == c) ? 0 : (('2' == c) ? 1 : (('f' == c) ? 2 : -1));
+            if (i < 0)
+                continue;
+            const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            size_t idx = 0;
+            unsigned applied = 0;
+            hr = profile[i].apply(g_hcam, shadow, true, Start, &idx, &applied);
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            if (FAILED(hr))
+                printf("failed to apply setting %u of profile %d, hr = 0x%08x, the previous values are back\n", (unsigned)idx, i + 1, hr);
+            else
+                printf("profile %d: %u of %u settings sent, %.1f ms\n", i + 1, applied, (unsigned)profile[i].size(), ms);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
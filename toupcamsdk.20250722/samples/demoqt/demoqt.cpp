@@ -1,3 +1,4 @@
+#include <math.h>
 #include <QApplication>
 #include "demoqt.h"
 
@@ -5,7 +6,8 @@ MainWidget::MainWidget(QWidget* parent)
     : QWidget(parent)
     , m_hcam(nullptr)
     , m_timer(new QTimer(this))
-    , m_imgWidth(0), m_imgHeight(0), m_pData(nullptr)
+    , m_imgWidth(0), m_imgHeight(0)
+    , m_bImagePending(false)
     , m_res(0), m_temp(TOUPCAM_TEMP_DEF), m_tint(TOUPCAM_TINT_DEF), m_count(0)
 {
     setMinimumSize(1024, 768);
@@ -120,6 +122,49 @@ MainWidget::MainWidget(QWidget* parent)
         gboxwb->setLayout(v);
     }
 
+    QGroupBox* gboxdisp = new QGroupBox("Display");
+    {
+        /* on the GPU (GLPreview), the frames pulled and snapped stay as they are */
+        m_cbox_levels = new QCheckBox("Auto levels");
+        connect(m_cbox_levels, &QCheckBox::stateChanged, this, [this](int state)
+        {
+            m_video->setLevelsAuto(0 != state);
+        });
+        m_lbl_gamma = new QLabel("1.00");
+        m_slider_gamma = new QSlider(Qt::Horizontal);
+        m_slider_gamma->setRange(20, 300);  // gamma x 100
+        m_slider_gamma->setValue(100);
+        connect(m_slider_gamma, &QSlider::valueChanged, this, [this](int value)
+        {
+            m_lbl_gamma->setText(QString::asprintf("%.2f", value / 100.0));
+            for (int i = 0; i < 256; ++i)
+                m_curve[i] = static_cast<uchar>(255.0 * pow(i / 255.0, 100.0 / value) + 0.5);
+            m_video->setCurve((100 == value) ? nullptr : m_curve);
+        });
+        m_cmb_pseudo = new QComboBox();
+        static const struct { const char* name; int map; } pseudo[] = {
+            { "No pseudo colour", 0 }, { "Jet", 7 }, { "Hot", 14 }, { "Cool", 11 }, { "HSV", 12 },
+            { "Spring", 2 }, { "Summer", 3 }, { "Autumn", 4 }, { "Winter", 5 }
+        };
+        for (size_t i = 0; i < sizeof(pseudo) / sizeof(pseudo[0]); ++i)
+            m_cmb_pseudo->addItem(pseudo[i].name, pseudo[i].map);
+        connect(m_cmb_pseudo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this](int index)
+        {
+            m_video->setPseudoColor(m_cmb_pseudo->itemData(index).toInt());
+        });
+
+        QHBoxLayout* h = new QHBoxLayout();
+        h->addWidget(new QLabel("Gamma:"));
+        h->addStretch();
+        h->addWidget(m_lbl_gamma);
+        QVBoxLayout* v = new QVBoxLayout();
+        v->addWidget(m_cbox_levels);
+        v->addLayout(h);
+        v->addWidget(m_slider_gamma);
+        v->addWidget(m_cmb_pseudo);
+        gboxdisp->setLayout(v);
+    }
+
     {
         m_btn_open = new QPushButton("Open");
         connect(m_btn_open, &QPushButton::clicked, this, &MainWidget::onBtnOpen);
@@ -131,6 +176,7 @@ MainWidget::MainWidget(QWidget* parent)
         v->addWidget(gboxres);
         v->addWidget(gboxexp);
         v->addWidget(gboxwb);
+        v->addWidget(gboxdisp);
         v->addWidget(m_btn_open);
         v->addWidget(m_btn_snap);
         v->addStretch();
@@ -139,10 +185,10 @@ MainWidget::MainWidget(QWidget* parent)
 
     {
         m_lbl_frame = new QLabel();
-        m_lbl_video = new QLabel();
+        m_video = new GLPreview();
 
         QVBoxLayout* v = new QVBoxLayout();
-        v->addWidget(m_lbl_video, 1);
+        v->addWidget(m_video, 1);
         v->addWidget(m_lbl_frame);
         gmain->addLayout(v, 0, 1);
     }
@@ -192,8 +238,6 @@ void MainWidget::closeCamera()
         Toupcam_Close(m_hcam);
         m_hcam = nullptr;
     }
-    delete[] m_pData;
-    m_pData = nullptr;
 
     m_btn_open->setText("Open");
     m_timer->stop();
@@ -216,12 +260,11 @@ void MainWidget::closeEvent(QCloseEvent*)
 
 void MainWidget::startCamera()
 {
-    if (m_pData)
+    for (unsigned i = 0; i < 3; ++i)   /* the camera is stopped, nobody else touches the slots */
     {
-        delete[] m_pData;
-        m_pData = nullptr;
+        m_preview.slot(i).data.resize(TDIBWIDTHBYTES(m_imgWidth * 24) * m_imgHeight);
+        m_preview.slot(i).width = m_preview.slot(i).height = 0;
     }
-    m_pData = new uchar[TDIBWIDTHBYTES(m_imgWidth * 24) * m_imgHeight];
     unsigned uimax = 0, uimin = 0, uidef = 0;
     unsigned short usmax = 0, usmin = 0, usdef = 0;
     Toupcam_get_ExpTimeRange(m_hcam, &uimin, &uimax, &uidef);
@@ -320,9 +363,10 @@ void MainWidget::onBtnSnap()
     {
         if (0 == m_cur.model->still)    // not support still image capture
         {
-            if (m_pData)
+            const PreviewFrame& frame = m_preview.front(); // the frame on the screen, owned by the UI thread
+            if (frame.width && frame.height)
             {
-                QImage image(m_pData, m_imgWidth, m_imgHeight, QImage::Format_RGB888);
+                QImage image(&frame.data[0], frame.width, frame.height, TDIBWIDTHBYTES(frame.width * 24), QImage::Format_RGB888);
                 image.save(QString::asprintf("demoqt_%u.jpg", ++m_count));
             }
         }
@@ -344,17 +388,38 @@ void MainWidget::onBtnSnap()
 void MainWidget::eventCallBack(unsigned nEvent, void* pCallbackCtx)
 {
     MainWidget* pThis = reinterpret_cast<MainWidget*>(pCallbackCtx);
-    emit pThis->evtCallback(nEvent);
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        pThis->pullImage();
+        /* the UI thread shows the latest preview anyway, one queued image event is enough however many frames arrive meanwhile */
+        if (!pThis->m_bImagePending.exchange(true))
+            emit pThis->evtCallback(nEvent);
+    }
+    else
+        emit pThis->evtCallback(nEvent);
+}
+
+/* this run in the callback thread: pull into the back slot, no copy and no scaling on the CPU */
+void MainWidget::pullImage()
+{
+    ToupcamFrameInfoV4 info = { 0 };
+    PreviewFrame& frame = m_preview.back();
+    if (SUCCEEDED(Toupcam_PullImageV4(m_hcam, &frame.data[0], 0, 24, 0, &info)))
+    {
+        frame.width = info.v3.width;
+        frame.height = info.v3.height;
+        m_preview.publish();
+    }
 }
 
 void MainWidget::handleImageEvent()
 {
-    unsigned width = 0, height = 0;
-    if (SUCCEEDED(Toupcam_PullImage(m_hcam, m_pData, 24, &width, &height)))
+    m_bImagePending = false;    /* before update(), so a frame published from now on queues a new event */
+    if (m_preview.update())
     {
-        QImage image(m_pData, width, height, QImage::Format_RGB888);
-        QImage newimage = image.scaled(m_lbl_video->width(), m_lbl_video->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
-        m_lbl_video->setPixmap(QPixmap::fromImage(newimage));
+        const PreviewFrame& frame = m_preview.front();
+        if (frame.width && frame.height)
+            m_video->showFrame(&frame.data[0], frame.width, frame.height, TDIBWIDTHBYTES(frame.width * 24));
     }
 }
 
@@ -429,6 +494,7 @@ QVBoxLayout* MainWidget::makeLayout(QLabel* lbl1, QSlider* sli1, QLabel* val1, Q
 int main(int argc, char* argv[])
 {
     Toupcam_GigeEnable(nullptr, nullptr);
+    GLPreview::setDefaultFormat();
     QApplication a(argc, argv);
     MainWidget mw;
     mw.show();
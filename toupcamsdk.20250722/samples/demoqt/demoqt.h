@@ -13,7 +13,19 @@
 #include <QVBoxLayout>
 #include <QMenu>
 #include <QMessageBox>
+#include <algorithm>
+#include <atomic>
+#include <vector>
 #include <toupcam.h>
+#include "../latestframe.h"
+#include "../glpreview.h"
+
+/* a frame pulled in the callback thread, shown (uploaded and scaled by the GPU) and snapped by the UI thread */
+struct PreviewFrame
+{
+    std::vector<uchar> data;
+    unsigned width = 0, height = 0;
+};
 
 class MainWidget : public QWidget
 {
@@ -30,15 +42,21 @@ class MainWidget : public QWidget
     QLabel*         m_lbl_expoGain;
     QLabel*         m_lbl_temp;
     QLabel*         m_lbl_tint;
-    QLabel*         m_lbl_video;
+    GLPreview*      m_video;
     QLabel*         m_lbl_frame;
     QPushButton*    m_btn_autoWB;
+    QCheckBox*      m_cbox_levels;
+    QSlider*        m_slider_gamma;
+    QLabel*         m_lbl_gamma;
+    QComboBox*      m_cmb_pseudo;
+    uchar           m_curve[256];       // of the display: the SDK stays linear, the GPU applies it
     QPushButton*    m_btn_open;
     QPushButton*    m_btn_snap;
     QTimer*         m_timer;
     unsigned        m_imgWidth;
     unsigned        m_imgHeight;
-    uchar*          m_pData;
+    LatestFrame<PreviewFrame> m_preview;    // callback thread to UI thread, lock-free
+    std::atomic<bool> m_bImagePending;      // an image event is queued to the UI thread, don't queue another one
     int             m_res;
     int             m_temp;
     int             m_tint;
@@ -53,6 +71,7 @@ private:
     void onBtnOpen();
     void onBtnSnap();
     void handleImageEvent();
+    void pullImage();
     void handleExpoEvent();
     void handleTempTintEvent();
     void handleStillImageEvent();
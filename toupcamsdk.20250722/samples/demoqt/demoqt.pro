@@ -1,4 +1,5 @@
-QT += core gui widgets
-SOURCES += demoqt.cpp
-HEADERS += demoqt.h
+QT += core gui widgets opengl
+greaterThan(QT_MAJOR_VERSION, 5): QT += openglwidgets
+SOURCES += demoqt.cpp ../glpreview.cpp
+HEADERS += demoqt.h ../latestframe.h ../glpreview.h
 LIBS += -ltoupcam
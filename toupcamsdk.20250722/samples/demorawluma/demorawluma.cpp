@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "toupcam.h"
+#include "../rawluma.h"
+#include "../hostfocus.h"
+
+/*
+    Grey for autofocus without demosaic (rawluma.h), on a color camera.
+    usage: demorawluma [half | green | full | sdk]
+    half, green, full: the frame is pulled as RAW 8 bits and turned into grey by RAWLUMA_HALF_SUM, RAWLUMA_HALF_GREEN or
+    RAWLUMA_FULL_GREEN; sdk: Toupcam_put_Chrome(h, 1) and a pull of 8 bits grey, for comparison. The time of the pull
+    and the conversion and the focus value (Tenengrad of the center quarter) are printed.
+*/
+HToupcam g_hcam = NULL;
+void* g_pRawData = NULL;
+void* g_pGrey = NULL;
+int g_mode = RAWLUMA_HALF_SUM;
+bool g_bSdk = false;
+unsigned g_fourcc = 0, g_total = 0;
+double g_ms = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_bSdk ? g_pGrey : g_pRawData, 0, g_bSdk ? 8 : 0, -1, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            unsigned w = info.v3.width, h = info.v3.height;
+            if (!g_bSdk)
+            {
+                RawLuma(g_mode, g_fourcc, 8, g_pRawData, w, w, h, 8, 0, g_pGrey, w);   /* the grey rows keep the pitch of the frame */
+                if (RAWLUMA_FULL_GREEN != g_mode)
+                {
+                    w /= 2;
+                    h /= 2;
+                }
+            }
+            g_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            if (0 == (++g_total % 50))
+            {
+                const HostFocusRoi roi = { w / 4, h / 4, w / 2, h / 2 };
+                printf("grey %u x %u, %.2f ms per frame, focus = %.1f\n", w, h, g_ms / g_total, HostFocusMetric(HOSTFOCUS_TENENGRAD, HOSTFOCUS_MONO8, g_pGrey, info.v3.width, roi));
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        if (0 == strcmp(argv[1], "green"))
+            g_mode = RAWLUMA_HALF_GREEN;
+        else if (0 == strcmp(argv[1], "full"))
+            g_mode = RAWLUMA_FULL_GREEN;
+        else if (0 == strcmp(argv[1], "sdk"))
+            g_bSdk = true;
+        else if (0 != strcmp(argv[1], "half"))
+        {
+            printf("usage: %s [half | green | full | sdk]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (Toupcam_query_Model(g_hcam)->flag & TOUPCAM_FLAG_MONO)
+        printf("mono camera, the RAW frame is already grey\n");
+
+    int nWidth = 0, nHeight = 0;
+    unsigned bitsperpixel = 0;
+    HRESULT hr = g_bSdk ? Toupcam_put_Chrome(g_hcam, 1) : Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    if (FAILED(hr))
+        printf("failed to set %s mode, hr = 0x%08x\n", g_bSdk ? "chrome" : "raw", hr);
+    else if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 0)))
+        printf("failed to set bit depth, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_RawFormat(g_hcam, &g_fourcc, &bitsperpixel)))
+        printf("failed to get raw format, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pRawData = malloc(nWidth * nHeight);
+        g_pGrey = malloc(nWidth * nHeight);
+        if ((NULL == g_pRawData) || (NULL == g_pGrey))
+            printf("failed to malloc\n");
+        else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL)))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("press ENTER to exit\n");
+            getc(stdin);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pRawData)
+        free(g_pRawData);
+    if (g_pGrey)
+        free(g_pGrey);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include "../demorawrec/rawseq.h"
+
+/*
+    Reads back a RAW sequence of demorawrec through the memory mapped RawSeqReader.
+    usage: demorawread <file.rawseq>                    scan all the frames in order, print their frame info
+           demorawread <file.rawseq> <n> <out.raw>      export frame n
+    A packed recording (demorawrec pack = 1) is unpacked on read (rawpack.h), a compressed one (compress = n) decoded
+    (rawcodec.h) on all the cores, the scan prints the frames decoded a second against the frame rate of the
+    recording; the export is the samples as pulled either way.
+    The scan keeps PREFETCH_FRAMES frames ahead requested from the disk (willneed) and releases the frames behind
+    it (dontneed), it touches every frame in place (mean of the samples) without copying it.
+*/
+#define PREFETCH_FRAMES     8
+
+static double FrameMean(const void* pData, const RawSeqHeader& header)
+{
+    const size_t count = (size_t)header.width * header.height;
+    unsigned long long sum = 0;
+    if (header.bitdepth > 8)
+    {
+        const unsigned short* p = (const unsigned short*)pData;
+        for (size_t i = 0; i < count; ++i)
+            sum += p[i];
+    }
+    else
+    {
+        const unsigned char* p = (const unsigned char*)pData;
+        for (size_t i = 0; i < count; ++i)
+            sum += p[i];
+    }
+    return count ? (double)sum / count : 0.0;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc != 2) && (argc != 4))
+    {
+        printf("usage: %s <file.rawseq> [<n> <out.raw>]\n", argv[0]);
+        return -1;
+    }
+
+    RawSeqReader reader;
+    if (!reader.open(argv[1], 2 == argc))
+    {
+        printf("failed to open %s or its index\n", argv[1]);
+        return -1;
+    }
+    const RawSeqHeader& header = reader.header();
+    printf("%u x %u, %u bits%s, fourcc 0x%08x, %u frames, %u dropped while recording\n", header.width, header.height, header.bitdepth, header.compression ? " compressed" : (header.packing ? " packed" : ""), header.fourcc, reader.frames(), header.dropped);
+
+    const bool bStored = header.packing || header.compression;  /* not as pulled: frame16 writes into unpacked */
+    const size_t frameBytes = (size_t)header.width * header.height * ((header.bitdepth > 8) ? 2 : 1);
+    std::vector<unsigned short> unpacked(bStored ? (size_t)header.width * header.height : 0);
+    const unsigned cores = std::thread::hardware_concurrency();
+    RawCodec codec((header.compression && (cores > 1)) ? (cores - 1) : 0);
+    int ret = 0;
+    if (4 == argc)
+    {
+        const unsigned n = (unsigned)atoi(argv[2]);
+        const ToupcamFrameInfoV4* pInfo = NULL;
+        const void* pData = reader.frame16(n, unpacked.data(), &pInfo, &codec);
+        FILE* fp = NULL;
+        if (NULL == pData)
+        {
+            printf("no frame %u\n", n);
+            ret = -1;
+        }
+        else if (NULL == (fp = fopen(argv[3], "wb")))
+        {
+            printf("failed to create %s\n", argv[3]);
+            ret = -1;
+        }
+        else
+        {
+            fwrite(pData, 1, bStored ? frameBytes : reader.record(n)->length, fp);
+            fclose(fp);
+            printf("frame %u: seq = %u, timestamp = %llu, expotime = %u, expogain = %u, saved to %s\n", n, pInfo->v3.seq, pInfo->v3.timestamp, pInfo->v3.expotime, pInfo->v3.expogain, argv[3]);
+        }
+    }
+    else
+    {
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        unsigned long long bytes = 0;
+        reader.willneed(0, PREFETCH_FRAMES);
+        for (unsigned i = 0; i < reader.frames(); ++i)
+        {
+            reader.willneed(i + PREFETCH_FRAMES, 1);
+            const ToupcamFrameInfoV4* pInfo = NULL;
+            const void* pData = reader.frame16(i, unpacked.data(), &pInfo, &codec);
+            if (NULL == pData)
+            {
+                printf("%u: damaged, does not decode\n", i);
+                ret = -1;
+                continue;
+            }
+            printf("%u: seq = %u, timestamp = %llu, expotime = %u, expogain = %u, mean = %.1f\n", i, pInfo->v3.seq, pInfo->v3.timestamp, pInfo->v3.expotime, pInfo->v3.expogain, FrameMean(pData, header));
+            bytes += reader.record(i)->length;
+            reader.dontneed(i, 1);
+        }
+        const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (sec > 0)
+            printf("%u frames, %.1f MB/s, %.1f fps\n", reader.frames(), bytes / sec / 1048576.0, reader.frames() / sec);
+    }
+
+    /* cleanup */
+    reader.close();
+    return ret;
+}
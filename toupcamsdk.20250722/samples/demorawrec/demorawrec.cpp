@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include "rawseq.h"
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+/*
+    Lossless RAW sequence recorder.
+    usage: demorawrec [frames = 1000] [file = demorawrec.rawseq] [pack = 0] [compress = 0]
+    The container is preallocated for the given number of frames and opened unbuffered (O_DIRECT on Linux,
+    F_NOCACHE on macOS, FILE_FLAG_NO_BUFFERING on Windows), so a long recording does not fill the page cache.
+    The camera callback pulls every RAW frame straight into a free buffer of a ring of sector aligned buffers and
+    returns; a writer thread writes the buffers at fixed offsets and appends one record per frame to the sidecar
+    index (file.idx). When the writer falls behind and the ring is full, the frame is pulled into a scratch buffer
+    and counted as dropped.
+    pack = 1: a 10 or 12 bits sensor is recorded packed (rawpack.h), by the writer thread, 37.5% / 25% fewer bytes
+    to the disk; the camera is asked for TOUPCAM_PIXELFORMAT_RAW10PACK / RAW12PACK too, when it has it, for the same
+    saving on the link (the pull still hands out 16 bits samples).
+    compress = n: the frames are coded losslessly (rawcodec.h) by the writer on n threads (with itself), each takes
+    the sectors it needs, the index keeps its ToupcamFrameInfoV4; in place of pack, typically half of the bytes again.
+    The container and the index are described in rawseq.h, demorawread reads them back.
+*/
+#define RING_NUM        16
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;              /* scratch for the frames that do not fit in the ring */
+void* g_ring[RING_NUM] = { NULL };
+ToupcamFrameInfoV4 g_ringInfo[RING_NUM];
+std::atomic<unsigned> g_head(0), g_tail(0);     /* written by the callback / by the writer thread only */
+std::atomic<unsigned> g_dropped(0), g_maxDepth(0);
+std::atomic<bool> g_bStop(false);
+unsigned g_total = 0, g_frameBytes = 0;   /* as pulled */
+
+static void* AlignedAlloc(size_t size)
+{
+#if defined(_WIN32)
+    return _aligned_malloc(size, RAWSEQ_ALIGN);
+#else
+    void* p = NULL;
+    return (0 == posix_memalign(&p, RAWSEQ_ALIGN, size)) ? p : NULL;
+#endif
+}
+
+static void AlignedFree(void* p)
+{
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+#if defined(_WIN32)
+typedef HANDLE  DIRECTFILE;
+#define DIRECTFILE_INVALID  INVALID_HANDLE_VALUE
+#else
+typedef int     DIRECTFILE;
+#define DIRECTFILE_INVALID  (-1)
+#endif
+
+/* create and preallocate, so that the writes never have to extend the file */
+static DIRECTFILE DirectCreate(const char* filename, unsigned long long size)
+{
+#if defined(_WIN32)
+    HANDLE hFile = CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, NULL);
+    if (INVALID_HANDLE_VALUE != hFile)
+    {
+        LARGE_INTEGER li;
+        li.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) || !SetEndOfFile(hFile))
+            printf("failed to preallocate %s\n", filename);
+    }
+    return hFile;
+#else
+#if defined(__APPLE__)
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0)
+    {
+        fcntl(fd, F_NOCACHE, 1);
+        fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t)size, 0 };
+        if ((-1 == fcntl(fd, F_PREALLOCATE, &store)) || (0 != ftruncate(fd, (off_t)size)))
+            printf("failed to preallocate %s\n", filename);
+    }
+#else
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if ((fd >= 0) && (0 != posix_fallocate(fd, 0, (off_t)size)))
+        printf("failed to preallocate %s\n", filename);
+#endif
+    return fd;
+#endif
+}
+
+/* pData, length and offset are multiples of RAWSEQ_ALIGN */
+static bool DirectWrite(DIRECTFILE f, const void* pData, unsigned length, unsigned long long offset)
+{
+#if defined(_WIN32)
+    OVERLAPPED ov = { 0 };
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD dwWritten = 0;
+    return WriteFile(f, pData, length, &dwWritten, &ov) && (dwWritten == length);
+#else
+    return pwrite(f, pData, length, (off_t)offset) == (ssize_t)length;
+#endif
+}
+
+/* give back the preallocated space that was not used */
+static void DirectClose(DIRECTFILE f, unsigned long long size)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)size;
+    if (SetFilePointerEx(f, li, NULL, FILE_BEGIN))
+        SetEndOfFile(f);
+    CloseHandle(f);
+#else
+    if (0 != ftruncate(f, (off_t)size))
+        printf("failed to truncate\n");
+    close(f);
+#endif
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const unsigned head = g_head.load(std::memory_order_relaxed);
+        const unsigned depth = head - g_tail.load(std::memory_order_acquire);
+        const bool bFull = (depth >= RING_NUM);
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, bFull ? g_pImageData : g_ring[head % RING_NUM], 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            ++g_total;
+            if (bFull || g_bStop)
+                ++g_dropped;
+            else
+            {
+                g_ringInfo[head % RING_NUM] = info;
+                g_head.store(head + 1, std::memory_order_release);
+                if (depth + 1 > g_maxDepth)
+                    g_maxDepth = depth + 1;
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+/* pPack: a slot for the packed or the compressed frame, when the header says so; pEnd: of the last frame written */
+static unsigned WriterThread(DIRECTFILE f, FILE* fidx, const RawSeqHeader* pHeader, unsigned maxFrames, void* pPack, RawCodec* pCodec, unsigned long long* pEnd)
+{
+    unsigned frames = 0;
+    unsigned long long offset = RAWSEQ_ALIGN;
+    while (true)
+    {
+        const unsigned tail = g_tail.load(std::memory_order_relaxed);
+        if (tail == g_head.load(std::memory_order_acquire))
+        {
+            if (g_bStop)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (frames < maxFrames)
+        {
+            RawSeqRecord rec = { 0 };
+            rec.index = frames;
+            rec.length = (unsigned)RawSeqFrameBytes(*pHeader);
+            rec.offset = offset;
+            rec.info = g_ringInfo[tail % RING_NUM];
+            const void* pData = g_ring[tail % RING_NUM];
+            unsigned length = (unsigned)pHeader->slot;
+            if (pHeader->compression)
+            {
+                rec.length = (unsigned)pCodec->compress(pData, pHeader->width, pHeader->height, (pHeader->bitdepth > 8) ? 2 : 1,
+                                                        ((MAKEFOURCC('G', 'R', 'E', 'Y') == pHeader->fourcc) || (MAKEFOURCC('Y', '8', '0', '0') == pHeader->fourcc)) ? 1 : 2, pPack, (size_t)pHeader->slot);
+                length = (rec.length + RAWSEQ_ALIGN - 1) / RAWSEQ_ALIGN * RAWSEQ_ALIGN;
+                memset((unsigned char*)pPack + rec.length, 0, length - rec.length);
+                pData = pPack;
+            }
+            else if (pHeader->packing)
+            {
+                RawPackFrame(pPack, (const unsigned short*)pData, pHeader->width, pHeader->height, pHeader->packing);
+                pData = pPack;
+            }
+            if (!DirectWrite(f, pData, length, rec.offset))
+                printf("failed to write frame %u\n", frames);
+            else
+            {
+                fwrite(&rec, 1, sizeof(rec), fidx);
+                offset += length;
+                ++frames;
+            }
+        }
+        else
+            ++g_dropped;    /* the container is full */
+        g_tail.store(tail + 1, std::memory_order_release);
+    }
+    *pEnd = offset;
+    return frames;
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned maxFrames = (argc > 1) ? (unsigned)atoi(argv[1]) : 1000;
+    const char* filename = (argc > 2) ? argv[2] : "demorawrec.rawseq";
+    const bool bPack = (argc > 3) && atoi(argv[3]);
+    const unsigned nCompress = (argc > 4) ? (unsigned)atoi(argv[4]) : 0;
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1); /* the highest bit depth of the sensor */
+    RawSeqHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RAWSEQ_MAGIC, sizeof(header.magic));
+    int nWidth = 0, nHeight = 0;
+    unsigned nBitDepth = 8;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (SUCCEEDED(hr))
+        hr = Toupcam_get_RawFormat(g_hcam, &header.fourcc, &nBitDepth);
+    if (SUCCEEDED(hr) && nCompress)
+        header.compression = RAWSEQ_CODEC_RSC1;
+    if (SUCCEEDED(hr) && bPack && ((10 == nBitDepth) || (12 == nBitDepth)))
+    {
+        header.packing = nBitDepth;
+        const int wire = (12 == nBitDepth) ? TOUPCAM_PIXELFORMAT_RAW12PACK : TOUPCAM_PIXELFORMAT_RAW10PACK;
+        int num = 0, fmt = 0;
+        if (SUCCEEDED(Toupcam_get_PixelFormatSupport(g_hcam, -1, &num)))
+        {
+            for (int i = 0; i < num; ++i)
+            {
+                if (SUCCEEDED(Toupcam_get_PixelFormatSupport(g_hcam, (char)i, &fmt)) && (wire == fmt))
+                {
+                    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_PIXEL_FORMAT, wire);
+                    break;
+                }
+            }
+        }
+    }
+    else if (bPack)
+        printf("%u bits: recorded unpacked, only 10 and 12 bits pack\n", nBitDepth);
+    if (header.compression)
+        header.packing = 0;     /* the codec takes the 16 bits samples, the wire format stays */
+    if (FAILED(hr))
+        printf("failed to get size or raw format, hr = 0x%08x\n", hr);
+    else
+    {
+        header.width = nWidth;
+        header.height = nHeight;
+        header.bitdepth = nBitDepth;
+        g_frameBytes = nWidth * nHeight * ((nBitDepth > 8) ? 2 : 1);
+        /* compressed: the largest frame, the file is preallocated for the worst case and truncated at the end */
+        const unsigned long long frameBytes = header.compression ? RawCodec::bound(nWidth, nHeight, (nBitDepth > 8) ? 2 : 1) : RawSeqFrameBytes(header);
+        header.slot = (frameBytes + RAWSEQ_ALIGN - 1) / RAWSEQ_ALIGN * RAWSEQ_ALIGN;
+        const size_t ringBytes = (g_frameBytes + RAWSEQ_ALIGN - 1) / RAWSEQ_ALIGN * RAWSEQ_ALIGN;
+        bool bAlloc = (NULL != (g_pImageData = AlignedAlloc(ringBytes)));
+        for (int i = 0; bAlloc && (i < RING_NUM); ++i)
+            bAlloc = (NULL != (g_ring[i] = AlignedAlloc(ringBytes)));
+        void* pPack = (bAlloc && (header.packing || header.compression)) ? AlignedAlloc((size_t)header.slot) : NULL;
+        if ((header.packing || header.compression) && (NULL == pPack))
+            bAlloc = false;
+        else if (pPack)
+            memset(pPack, 0, (size_t)header.slot);  /* the tail of the slot after the frame */
+        void* pHeaderBlock = bAlloc ? AlignedAlloc(RAWSEQ_ALIGN) : NULL;
+        char idxname[1024];
+        sprintf(idxname, "%s.idx", filename);
+        DIRECTFILE f = DIRECTFILE_INVALID;
+        FILE* fidx = NULL;
+        unsigned frames = 0;
+        unsigned long long end = RAWSEQ_ALIGN;
+        RawCodec codec(nCompress ? (nCompress - 1) : 0);
+        if (NULL == pHeaderBlock)
+            printf("failed to malloc\n");
+        else if (DIRECTFILE_INVALID == (f = DirectCreate(filename, RAWSEQ_ALIGN + maxFrames * header.slot)))
+            printf("failed to create %s\n", filename);
+        else if (NULL == (fidx = fopen(idxname, "wb")))
+            printf("failed to create %s\n", idxname);
+        else
+        {
+            fwrite(&header, 1, sizeof(header), fidx);   /* patched at the end */
+            std::thread writer([&]() { frames = WriterThread(f, fidx, &header, maxFrames, pPack, &codec, &end); });
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("recording %u x %u, %u bits%s, up to %u frames, press ENTER to stop\n", header.width, header.height, header.bitdepth,
+                       header.compression ? " compressed" : (header.packing ? " packed" : ""), maxFrames);
+                getc(stdin);
+            }
+            Toupcam_Stop(g_hcam);
+            g_bStop = true;     /* the writer drains what is left in the ring */
+            writer.join();
+
+            header.frames = frames;
+            header.dropped = g_dropped;
+            memset(pHeaderBlock, 0, RAWSEQ_ALIGN);
+            memcpy(pHeaderBlock, &header, sizeof(header));
+            if (!DirectWrite(f, pHeaderBlock, RAWSEQ_ALIGN, 0))
+                printf("failed to write header\n");
+            fseek(fidx, 0, SEEK_SET);
+            fwrite(&header, 1, sizeof(header), fidx);
+            printf("frames = %u, written = %u, dropped = %u, max queue depth = %u / %d\n", g_total, frames, g_dropped.load(), g_maxDepth.load(), RING_NUM);
+            if (frames && header.compression)
+                printf("compressed to %.1f%% of %u bytes a frame\n", 100.0 * (end - RAWSEQ_ALIGN) / frames / g_frameBytes, g_frameBytes);
+        }
+
+        /* cleanup */
+        if (fidx)
+            fclose(fidx);
+        if (DIRECTFILE_INVALID != f)
+            DirectClose(f, end);
+        if (pHeaderBlock)
+            AlignedFree(pHeaderBlock);
+        if (pPack)
+            AlignedFree(pPack);
+    }
+
+    Toupcam_Close(g_hcam);
+    for (int i = 0; i < RING_NUM; ++i)
+    {
+        if (g_ring[i])
+            AlignedFree(g_ring[i]);
+    }
+    if (g_pImageData)
+        AlignedFree(g_pImageData);
+    return 0;
+}
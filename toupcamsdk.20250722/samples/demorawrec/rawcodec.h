@@ -0,0 +1,347 @@
+#ifndef __rawcodec_H__
+#define __rawcodec_H__
+
+/*
+    Lossless codec of the RAW frames of demorawrec (rawseq.h, header.compression = RAWSEQ_CODEC_RSC1): a prediction
+    and a block bit packing, simple enough to run at the rate of the camera on a few threads, in both directions.
+    Prediction, per sample of the same Bayer colour (step 2, or 1 for a mono sensor): the mean of the left and the upper
+    neighbours, the left one on the first rows of a slice, the upper one on the first columns. The residual is taken
+    modulo 2^16 (2^8 for 8 bits samples) and mapped to an unsigned value (zigzag: 0, -1, 1, -2, ... to 0, 1, 2, 3, ...).
+    Coding: the residuals of a row go by blocks of 32, one byte with the bit width of the largest, then the 32 values
+    at that width, LSB first. The noise sets the width: a 12 bits frame with a noise of 8 levels takes 6.4 bits a
+    sample, 2.5 times less than its 16 bits, 30 levels 8.2 bits. There is no entropy coder behind: a Huffman or ANS
+    stage would take another bit a sample or so off, at a fraction of the speed (this runs at about 650 MB/s a core
+    both ways, in 16 bits samples).
+    The frame is cut into slices of rows (RAWCODEC_SLICES, an even number of rows each, so every slice starts on the
+    Bayer phase of the frame) coded on their own: compress() and decompress() spread them over the threads of the
+    codec and the caller, the decoder of a reader scales the same way whatever the encoder ran on.
+    Frame: RawCodecHeader, the compressed bytes of each slice (unsigned each), then the slices back to back.
+    The worst case (white noise at the full 16 bits) is bound(), a little over the size of the frame.
+*/
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define RAWCODEC_MAGIC      0x31435352      /* "RSC1" */
+#define RAWCODEC_SLICES     16
+#define RAWCODEC_BLOCK      32
+
+typedef struct {
+    unsigned magic;
+    unsigned width, height;
+    unsigned short bytes;       /* a sample, 1 or 2 */
+    unsigned short step;        /* of the prediction, 2 Bayer, 1 mono */
+    unsigned slices;
+} RawCodecHeader;
+
+class RawCodec {
+    typedef void (*JOB)(void* ctx, unsigned i);
+
+    struct Slice {
+        const RawCodecHeader* pHeader;
+        const void* src;
+        void* dst;
+        size_t bytes;           /* encode: written, decode: to read */
+        unsigned y0, y1;
+        bool bOk;
+    };
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mtx;
+    std::condition_variable m_cvWork, m_cvDone;
+    unsigned m_generation;
+    bool m_bStop;
+    JOB m_job;
+    void* m_ctx;
+    unsigned m_count, m_active;                 /* m_active: workers inside drain() */
+    std::atomic<unsigned> m_next, m_done;
+
+    RawCodec(const RawCodec&);
+    RawCodec& operator=(const RawCodec&);
+
+    void drain()
+    {
+        unsigned i;
+        while ((i = m_next.fetch_add(1)) < m_count)
+        {
+            m_job(m_ctx, i);
+            if (m_done.fetch_add(1) + 1 == m_count)
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_cvDone.notify_all();
+            }
+        }
+    }
+
+    void worker()
+    {
+        unsigned generation = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cvWork.wait(lock, [&]() { return m_bStop || (m_generation != generation); });
+                if (m_bStop)
+                    return;
+                generation = m_generation;
+                ++m_active;
+            }
+            drain();
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (0 == --m_active)
+                m_cvDone.notify_all();
+        }
+    }
+
+    /* job(ctx, 0 ... count - 1) on the threads and the caller, returns when all are done */
+    void run(JOB job, void* ctx, unsigned count)
+    {
+        if (m_threads.empty() || (count <= 1))
+        {
+            for (unsigned i = 0; i < count; ++i)
+                job(ctx, i);
+            return;
+        }
+        {
+            /* a worker still on the previous job would pick up the counters reset below */
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cvDone.wait(lock, [&]() { return 0 == m_active; });
+            m_job = job;
+            m_ctx = ctx;
+            m_count = count;
+            m_next = 0;
+            m_done = 0;
+            ++m_generation;
+        }
+        m_cvWork.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvDone.wait(lock, [&]() { return (m_done.load() >= m_count) && (0 == m_active); });
+    }
+
+    static unsigned sliceCount(unsigned height)
+    {
+        unsigned n = height / 16;
+        if (n > RAWCODEC_SLICES)
+            n = RAWCODEC_SLICES;
+        return n ? n : 1;
+    }
+
+    /* an even number of rows a slice, the last one takes the rest */
+    static void sliceRows(unsigned height, unsigned slices, unsigned i, unsigned* y0, unsigned* y1)
+    {
+        const unsigned rows = (height / slices) & ~1u;
+        *y0 = i * rows;
+        *y1 = (i + 1 == slices) ? height : (*y0 + rows);
+    }
+
+    static size_t rowBound(unsigned width, unsigned bytes)
+    {
+        return ((size_t)width + RAWCODEC_BLOCK - 1) / RAWCODEC_BLOCK * (1 + RAWCODEC_BLOCK * bytes);
+    }
+
+    template <typename T>
+    static unsigned predict(const T* cur, const T* up, unsigned x, unsigned step)
+    {
+        if (up)
+            return (x >= step) ? ((unsigned)cur[x - step] + up[x] + 1) >> 1 : up[x];
+        return (x >= step) ? cur[x - step] : 0;
+    }
+
+    template <typename T>
+    static void encodeSlice(void* ctx, unsigned i)
+    {
+        Slice& s = ((Slice*)ctx)[i];
+        const RawCodecHeader& h = *s.pHeader;
+        const unsigned shift = 8 * sizeof(T) - 1;
+        std::vector<unsigned> zig(h.width);
+        unsigned char* out = (unsigned char*)s.dst;
+        for (unsigned y = s.y0; y < s.y1; ++y)
+        {
+            const T* cur = (const T*)s.src + (size_t)y * h.width;
+            const T* up = (y >= s.y0 + h.step) ? (cur - (size_t)h.step * h.width) : NULL;
+            for (unsigned x = 0; x < h.width; ++x)
+            {
+                const int d = (int)(cur[x] - predict(cur, up, x, h.step));
+                const unsigned m = (1u << (shift + 1)) - 1;     /* the residual modulo 2^bits, then zigzag */
+                const int sd = (int)((unsigned)d << (31 - shift)) >> (31 - shift);
+                zig[x] = (((unsigned)sd << 1) ^ (unsigned)(sd >> 31)) & m;
+            }
+            for (unsigned x = 0; x < h.width; x += RAWCODEC_BLOCK)
+            {
+                const unsigned n = (h.width - x < RAWCODEC_BLOCK) ? (h.width - x) : RAWCODEC_BLOCK;
+                unsigned all = 0;
+                for (unsigned k = 0; k < n; ++k)
+                    all |= zig[x + k];
+                unsigned w = 0;
+                while (all >> w)
+                    ++w;
+                *out++ = (unsigned char)w;
+                unsigned long long acc = 0;
+                unsigned bits = 0;
+                for (unsigned k = 0; k < n; ++k)
+                {
+                    acc |= (unsigned long long)zig[x + k] << bits;
+                    bits += w;
+                    while (bits >= 8)
+                    {
+                        *out++ = (unsigned char)acc;
+                        acc >>= 8;
+                        bits -= 8;
+                    }
+                }
+                if (bits)
+                    *out++ = (unsigned char)acc;
+            }
+        }
+        s.bytes = out - (unsigned char*)s.dst;
+    }
+
+    template <typename T>
+    static void decodeSlice(void* ctx, unsigned i)
+    {
+        Slice& s = ((Slice*)ctx)[i];
+        const RawCodecHeader& h = *s.pHeader;
+        const unsigned shift = 8 * sizeof(T) - 1;
+        const unsigned char* in = (const unsigned char*)s.src;
+        const unsigned char* end = in + s.bytes;
+        std::vector<unsigned> zig(h.width);
+        s.bOk = false;
+        for (unsigned y = s.y0; y < s.y1; ++y)
+        {
+            for (unsigned x = 0; x < h.width; x += RAWCODEC_BLOCK)
+            {
+                const unsigned n = (h.width - x < RAWCODEC_BLOCK) ? (h.width - x) : RAWCODEC_BLOCK;
+                if (in >= end)
+                    return;
+                const unsigned w = *in++;
+                if ((w > shift + 1) || ((size_t)(end - in) < (n * w + 7) / 8))
+                    return;
+                const unsigned mask = (1u << w) - 1;
+                unsigned long long acc = 0;
+                unsigned bits = 0;
+                for (unsigned k = 0; k < n; ++k)
+                {
+                    while (bits < w)
+                    {
+                        acc |= (unsigned long long)*in++ << bits;
+                        bits += 8;
+                    }
+                    zig[x + k] = (unsigned)acc & mask;
+                    acc >>= w;
+                    bits -= w;
+                }
+            }
+            T* cur = (T*)s.dst + (size_t)y * h.width;
+            const T* up = (y >= s.y0 + h.step) ? (cur - (size_t)h.step * h.width) : NULL;
+            for (unsigned x = 0; x < h.width; ++x)
+            {
+                const unsigned z = zig[x];
+                const int d = (int)(z >> 1) ^ -(int)(z & 1);
+                cur[x] = (T)(predict(cur, up, x, h.step) + d);
+            }
+        }
+        s.bOk = (in == end);
+    }
+public:
+    /* threads: workers besides the caller, 0: compress() and decompress() run on the caller alone */
+    explicit RawCodec(unsigned threads)
+    : m_generation(0), m_bStop(false), m_job(NULL), m_ctx(NULL), m_count(0), m_active(0), m_next(0), m_done(0)
+    {
+        for (unsigned i = 0; i < threads; ++i)
+            m_threads.push_back(std::thread(&RawCodec::worker, this));
+    }
+
+    ~RawCodec()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStop = true;
+        }
+        m_cvWork.notify_all();
+        for (size_t i = 0; i < m_threads.size(); ++i)
+            m_threads[i].join();
+    }
+
+    /* the largest compressed frame */
+    static size_t bound(unsigned width, unsigned height, unsigned bytes)
+    {
+        return sizeof(RawCodecHeader) + sizeof(unsigned) * RAWCODEC_SLICES + rowBound(width, bytes) * height;
+    }
+
+    /* bytes: 1 or 2 a sample (16 bits little endian); step: 2 Bayer, 1 mono. The compressed size, 0 when dst is too small */
+    size_t compress(const void* src, unsigned width, unsigned height, unsigned bytes, unsigned step, void* dst, size_t dstBytes)
+    {
+        if ((0 == width) || (0 == height) || ((1 != bytes) && (2 != bytes)) || (dstBytes < bound(width, height, bytes)))
+            return 0;
+        RawCodecHeader* pHeader = (RawCodecHeader*)dst;
+        pHeader->magic = RAWCODEC_MAGIC;
+        pHeader->width = width;
+        pHeader->height = height;
+        pHeader->bytes = (unsigned short)bytes;
+        pHeader->step = (unsigned short)((1 == step) ? 1 : 2);
+        pHeader->slices = sliceCount(height);
+        unsigned* pSizes = (unsigned*)(pHeader + 1);
+        unsigned char* pData = (unsigned char*)(pSizes + pHeader->slices);
+        /* every slice coded at the place of its worst case, then moved down after the previous one */
+        std::vector<Slice> slices(pHeader->slices);
+        for (unsigned i = 0; i < pHeader->slices; ++i)
+        {
+            Slice& s = slices[i];
+            s.pHeader = pHeader;
+            s.src = src;
+            sliceRows(height, pHeader->slices, i, &s.y0, &s.y1);
+            s.dst = pData + rowBound(width, bytes) * s.y0;
+            s.bytes = 0;
+        }
+        run((1 == bytes) ? &RawCodec::encodeSlice<unsigned char> : &RawCodec::encodeSlice<unsigned short>, &slices[0], pHeader->slices);
+        unsigned char* p = pData;
+        for (unsigned i = 0; i < pHeader->slices; ++i)
+        {
+            memmove(p, slices[i].dst, slices[i].bytes);
+            pSizes[i] = (unsigned)slices[i].bytes;
+            p += slices[i].bytes;
+        }
+        return p - (unsigned char*)dst;
+    }
+
+    /* dst: width x height samples of bytes each, the size of the frame in the header; false when src is damaged */
+    bool decompress(const void* src, size_t srcBytes, void* dst, unsigned width, unsigned height, unsigned bytes)
+    {
+        const RawCodecHeader* pHeader = (const RawCodecHeader*)src;
+        if ((srcBytes < sizeof(RawCodecHeader)) || (RAWCODEC_MAGIC != pHeader->magic) || (pHeader->width != width) || (pHeader->height != height)
+            || (pHeader->bytes != bytes) || (pHeader->slices != sliceCount(height)) || ((1 != pHeader->step) && (2 != pHeader->step))
+            || (srcBytes < sizeof(RawCodecHeader) + sizeof(unsigned) * pHeader->slices))
+            return false;
+        const unsigned* pSizes = (const unsigned*)(pHeader + 1);
+        const unsigned char* p = (const unsigned char*)(pSizes + pHeader->slices);
+        const unsigned char* end = (const unsigned char*)src + srcBytes;
+        std::vector<Slice> slices(pHeader->slices);
+        for (unsigned i = 0; i < pHeader->slices; ++i)
+        {
+            Slice& s = slices[i];
+            if (pSizes[i] > (size_t)(end - p))
+                return false;
+            s.pHeader = pHeader;
+            s.src = p;
+            s.dst = dst;
+            s.bytes = pSizes[i];
+            sliceRows(height, pHeader->slices, i, &s.y0, &s.y1);
+            s.bOk = false;
+            p += pSizes[i];
+        }
+        run((1 == bytes) ? &RawCodec::decodeSlice<unsigned char> : &RawCodec::decodeSlice<unsigned short>, &slices[0], pHeader->slices);
+        for (unsigned i = 0; i < pHeader->slices; ++i)
+        {
+            if (!slices[i].bOk)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif
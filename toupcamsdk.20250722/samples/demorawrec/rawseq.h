@@ -0,0 +1,306 @@
+#ifndef __rawseq_H__
+#define __rawseq_H__
+
+/*
+    The RAW sequence container of demorawrec, and a memory mapped reader for it.
+    Layout of the container: one RAWSEQ_ALIGN header block (RawSeqHeader), then frame i at
+    RAWSEQ_ALIGN + i * slot, slot = frame size rounded up to RAWSEQ_ALIGN.
+    The index (container.idx) is a RawSeqHeader followed by one RawSeqRecord per frame, for random access without scanning.
+    Packed: a 10 or 12 bits recording may be stored packed (header.packing, the layouts of rawpack.h), a quarter or
+    more smaller. frame() hands out the data as stored, frame16() the 16 bits samples in any case, unpacked into a
+    buffer of the caller when packed. TRAWSEQ1 files (before packing existed, a smaller header) still open, unpacked.
+    Compressed: header.compression = RAWSEQ_CODEC_RSC1, every frame is coded losslessly (rawcodec.h) and takes the
+    slots it needs, the length of its record rounded up to RAWSEQ_ALIGN, rather than one slot each: the offsets of
+    the records are what locates them. frame16() decodes, on the threads of the RawCodec given, if any.
+    RawSeqReader maps both files read only: frame(n) is a pointer into the mapping, no read() and no copy, valid until
+    close(). The pages are brought in by the page faults, willneed() asks the system to read a range of frames ahead
+    and dontneed() gives back the ones a scan has finished with, so a sequential pass over a recording larger than
+    the memory stays at the size of its window.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "toupcam.h"
+#include "../rawpack.h"
+#include "rawcodec.h"
+
+#define RAWSEQ_ALIGN    4096    /* covers the sector size of the usual disks, needed by the direct I/O */
+#define RAWSEQ_MAGIC    "TRAWSEQ2"
+#define RAWSEQ_MAGIC_V1 "TRAWSEQ1"  /* the header ends at dropped */
+#define RAWSEQ_CODEC_RSC1   1       /* rawcodec.h */
+
+typedef struct {
+    char magic[8];
+    unsigned width, height;
+    unsigned bitdepth;          /* 8 or the sensor bit depth, samples are 16 bits little endian when > 8 */
+    unsigned fourcc;            /* Toupcam_get_RawFormat */
+    unsigned long long slot;    /* bytes between two frames */
+    unsigned frames;            /* frames written */
+    unsigned dropped;
+    unsigned packing;           /* 0: as pulled, 10 / 12: packed, see rawpack.h */
+    unsigned compression;       /* 0: none, RAWSEQ_CODEC_RSC1 (then packing is 0) */
+} RawSeqHeader;
+
+#define RAWSEQ_HEADER_V1    offsetof(RawSeqHeader, packing)
+
+/* bytes of one frame in the container, before the rounding to the slot; uncompressed */
+static inline unsigned long long RawSeqFrameBytes(const RawSeqHeader& header)
+{
+    if (header.packing)
+        return (unsigned long long)RawPackRowBytes(header.width, header.packing) * header.height;
+    return (unsigned long long)header.width * header.height * ((header.bitdepth > 8) ? 2 : 1);
+}
+
+typedef struct {
+    unsigned index;
+    unsigned length;            /* bytes of RAW data in the slot */
+    unsigned long long offset;  /* in the container */
+    ToupcamFrameInfoV4 info;
+} RawSeqRecord;
+
+class RawSeqReader {
+    struct Map {
+        const unsigned char* ptr;
+        unsigned long long size;
+#if defined(_WIN32)
+        HANDLE hFile, hMap;
+#else
+        int fd;
+#endif
+    };
+    Map m_data, m_idx;
+    RawSeqHeader m_header;
+    size_t m_headerBytes;       /* in the index, in front of the records */
+    unsigned m_frames;
+
+    static void reset(Map* pMap)
+    {
+        memset(pMap, 0, sizeof(Map));
+#if !defined(_WIN32)
+        pMap->fd = -1;
+#endif
+    }
+
+    static bool mapfile(const char* filename, bool bSequential, Map* pMap)
+    {
+#if defined(_WIN32)
+        pMap->hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, bSequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+        LARGE_INTEGER li;
+        if ((INVALID_HANDLE_VALUE == pMap->hFile) || !GetFileSizeEx(pMap->hFile, &li) || (0 == li.QuadPart))
+            return false;
+        pMap->size = li.QuadPart;
+        pMap->hMap = CreateFileMappingA(pMap->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (pMap->hMap)
+            pMap->ptr = (const unsigned char*)MapViewOfFile(pMap->hMap, FILE_MAP_READ, 0, 0, 0);
+#else
+        struct stat st;
+        pMap->fd = ::open(filename, O_RDONLY);
+        if ((pMap->fd < 0) || (0 != fstat(pMap->fd, &st)) || (0 == st.st_size))
+            return false;
+        pMap->size = st.st_size;
+        void* p = mmap(NULL, (size_t)pMap->size, PROT_READ, MAP_SHARED, pMap->fd, 0);
+        if (MAP_FAILED != p)
+        {
+            pMap->ptr = (const unsigned char*)p;
+            madvise(p, (size_t)pMap->size, bSequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        }
+#endif
+        return (NULL != pMap->ptr);
+    }
+
+    static void unmapfile(Map* pMap)
+    {
+#if defined(_WIN32)
+        if (pMap->ptr)
+            UnmapViewOfFile(pMap->ptr);
+        if (pMap->hMap)
+            CloseHandle(pMap->hMap);
+        if (pMap->hFile && (INVALID_HANDLE_VALUE != pMap->hFile))
+            CloseHandle(pMap->hFile);
+#else
+        if (pMap->ptr)
+            munmap((void*)pMap->ptr, (size_t)pMap->size);
+        if (pMap->fd >= 0)
+            ::close(pMap->fd);
+#endif
+        reset(pMap);
+    }
+
+    static unsigned long long pageSize()
+    {
+#if defined(_WIN32)
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        return si.dwPageSize;
+#else
+        const long n = sysconf(_SC_PAGESIZE);
+        return (n > 0) ? (unsigned long long)n : RAWSEQ_ALIGN;
+#endif
+    }
+
+    /*
+        frames [first, first + count) clipped to the sequence, as a page aligned range of the mapping: the pages they
+        touch (bOuter), or only the pages no other frame shares; RAWSEQ_ALIGN need not be a multiple of the page size
+    */
+    bool range(unsigned first, unsigned count, bool bOuter, unsigned long long* pOffset, unsigned long long* pLength) const
+    {
+        if ((first >= m_frames) || (0 == count))
+            return false;
+        if (count > m_frames - first)
+            count = m_frames - first;
+        const RawSeqRecord* pFirst = record(first);
+        const RawSeqRecord* pLast = record(first + count - 1);
+        const unsigned long long page = pageSize();
+        unsigned long long begin = pFirst->offset, end = pLast->offset + pLast->length;
+        if (bOuter)
+        {
+            begin = begin / page * page;
+            end = (end + page - 1) / page * page;
+            if (end > m_data.size)
+                end = m_data.size;
+        }
+        else
+        {
+            begin = (begin + page - 1) / page * page;
+            end = end / page * page;
+        }
+        if (end <= begin)
+            return false;
+        *pOffset = begin;
+        *pLength = end - begin;
+        return true;
+    }
+public:
+    RawSeqReader()
+    : m_headerBytes(sizeof(RawSeqHeader)), m_frames(0)
+    {
+        reset(&m_data);
+        reset(&m_idx);
+        memset(&m_header, 0, sizeof(m_header));
+    }
+    ~RawSeqReader()
+    {
+        close();
+    }
+
+    /* bSequential: hint the system for a front to back scan, otherwise for random access */
+    bool open(const char* filename, bool bSequential)
+    {
+        close();
+        std::vector<char> idxname(strlen(filename) + 8);
+        sprintf(&idxname[0], "%s.idx", filename);
+        if (!mapfile(filename, bSequential, &m_data) || !mapfile(&idxname[0], false, &m_idx) || (m_idx.size < sizeof(RawSeqHeader)))
+        {
+            close();
+            return false;
+        }
+        memset(&m_header, 0, sizeof(m_header));
+        if (0 == memcmp(m_idx.ptr, RAWSEQ_MAGIC, sizeof(m_header.magic)))
+            m_headerBytes = sizeof(RawSeqHeader);
+        else if (0 == memcmp(m_idx.ptr, RAWSEQ_MAGIC_V1, sizeof(m_header.magic)))
+            m_headerBytes = RAWSEQ_HEADER_V1;
+        else
+        {
+            close();
+            return false;
+        }
+        memcpy(&m_header, m_idx.ptr, m_headerBytes);
+        /* the header is patched when the recording stops: trust the records, when it was not, and the container */
+        m_frames = (unsigned)((m_idx.size - m_headerBytes) / sizeof(RawSeqRecord));
+        if (m_header.frames && (m_header.frames < m_frames))
+            m_frames = m_header.frames;
+        while (m_frames && (record(m_frames - 1)->offset + record(m_frames - 1)->length > m_data.size))
+            --m_frames;
+        return true;
+    }
+
+    void close()
+    {
+        unmapfile(&m_data);
+        unmapfile(&m_idx);
+        m_frames = 0;
+    }
+
+    const RawSeqHeader& header() const { return m_header; }
+    unsigned frames() const { return m_frames; }
+
+    const RawSeqRecord* record(unsigned n) const
+    {
+        return reinterpret_cast<const RawSeqRecord*>(m_idx.ptr + m_headerBytes) + n;
+    }
+
+    /* zero copy: the RAW data of frame n in the mapping, NULL when n is out of range */
+    const void* frame(unsigned n, const ToupcamFrameInfoV4** ppInfo = NULL) const
+    {
+        if (n >= m_frames)
+            return NULL;
+        const RawSeqRecord* pRec = record(n);
+        if (ppInfo)
+            *ppInfo = &pRec->info;
+        return m_data.ptr + pRec->offset;
+    }
+
+    /*
+        the 16 bits samples (8 bits for an 8 bits recording) of frame n: in the mapping when the recording is stored
+        as pulled, otherwise unpacked or decoded into pBuffer, width * height samples; NULL when n is out of range or
+        the frame does not decode. pCodec: the threads to decode on, NULL: the caller's alone
+    */
+    const void* frame16(unsigned n, unsigned short* pBuffer, const ToupcamFrameInfoV4** ppInfo = NULL, RawCodec* pCodec = NULL) const
+    {
+        const void* pData = frame(n, ppInfo);
+        if (NULL == pData)
+            return NULL;
+        if (m_header.compression)
+        {
+            const unsigned bytes = (m_header.bitdepth > 8) ? 2 : 1;
+            if (pCodec)
+                return pCodec->decompress(pData, record(n)->length, pBuffer, m_header.width, m_header.height, bytes) ? pBuffer : NULL;
+            RawCodec codec(0);
+            return codec.decompress(pData, record(n)->length, pBuffer, m_header.width, m_header.height, bytes) ? pBuffer : NULL;
+        }
+        if (0 == m_header.packing)
+            return pData;
+        RawUnpackRows(pBuffer, pData, m_header.width, 0, m_header.height, m_header.packing);
+        return pBuffer;
+    }
+
+    /* start reading frames [first, first + count) in the background, returns at once */
+    void willneed(unsigned first, unsigned count) const
+    {
+        unsigned long long offset, length;
+        if (!range(first, count, true, &offset, &length))
+            return;
+#if defined(_WIN32)
+#if (_WIN32_WINNT >= 0x0602)
+        WIN32_MEMORY_RANGE_ENTRY entry;
+        entry.VirtualAddress = (PVOID)(m_data.ptr + offset);
+        entry.NumberOfBytes = (SIZE_T)length;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+#endif
+#else
+        madvise((void*)(m_data.ptr + offset), (size_t)length, MADV_WILLNEED);
+#endif
+    }
+
+    /* the frames [first, first + count) will not be read again soon, their pages can go */
+    void dontneed(unsigned first, unsigned count) const
+    {
+        unsigned long long offset, length;
+        if (!range(first, count, false, &offset, &length))
+            return;
+#if defined(_WIN32)
+        VirtualUnlock((LPVOID)(m_data.ptr + offset), (SIZE_T)length);  /* removes the clean pages from the working set */
+#else
+        madvise((void*)(m_data.ptr + offset), (size_t)length, MADV_DONTNEED);
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "toupcam.h"
+#include "../camreconnect.h"
+
+/*
+    A stream which survives the camera going away (samples/camreconnect.h): unplug the camera, plug it again, the
+    stream goes on with the settings it had (the exposure, the gain, the deques, RGB24 of this sample), the buffer of
+    the frames is the one allocated at the start. Each second: the frames received and the state; at every
+    reconnection the downtime, from TOUPCAM_EVENT_DISCONNECTED to the stream started again.
+    usage: demoreconnect [seconds, default 60]
+    With simcam: SIMCAM=unplug=5:2 ./demoreconnect 15 (the camera goes away after 5 s, for 2 s).
+*/
+CamReconnect g_cam;
+void* g_pImageData = NULL;
+std::atomic<unsigned> g_total(0);
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_cam.handle(), g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+            ++g_total;
+    }
+    else if (TOUPCAM_EVENT_DISCONNECTED == nEvent)
+        printf("disconnected, reconnecting to %s\n", g_cam.serial());
+    else if (CAMRECONNECT_EVENT_RECONNECTED == nEvent)
+        printf("reconnected, downtime %.0f ms\n", g_cam.downtime());
+    else if (CAMRECONNECT_EVENT_RETRY == nEvent)
+        printf("camera back, but the settings or the start failed: trying again\n");
+    else if (TOUPCAM_EVENT_ERROR == nEvent)
+        printf("event callback: 0x%04x\n", nEvent);
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned seconds = (argc > 1) ? (unsigned)atoi(argv[1]) : 60;
+    HRESULT hr = g_cam.open(NULL);
+    if (FAILED(hr))
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    hr = Toupcam_get_Size(g_cam.handle(), &nWidth, &nHeight);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        g_cam.close();
+        return -1;
+    }
+    g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+
+    /* the settings of the session, replayed after every reconnection */
+    OptionBatch settings;
+    settings.autoExpo(0).expoTime(20000).expoGain(200)
+        .option(TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH, 4).option(TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, 3);
+    hr = g_cam.apply(settings, false, std::function<HRESULT()>());
+    if (FAILED(hr))
+        printf("failed to apply the settings, hr = 0x%08x\n", hr);
+
+    hr = g_cam.start(EventCallback, NULL);
+    if (FAILED(hr))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("%s, %d x %d\n", g_cam.serial(), nWidth, nHeight);
+        unsigned last = 0;
+        for (unsigned t = 1; t <= seconds; ++t)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            const unsigned total = g_total;
+            printf("%3u s: %3u frames, %s\n", t, total - last, g_cam.lost() ? "reconnecting" : "streaming");
+            last = total;
+        }
+    }
+
+    /* cleanup */
+    g_cam.close();
+    printf("frames %u, reconnections %u\n", (unsigned)g_total, g_cam.reconnects());
+    free(g_pImageData);
+    return 0;
+}
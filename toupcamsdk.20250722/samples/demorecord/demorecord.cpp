@@ -1,27 +1,55 @@
 ﻿#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include "toupcam.h"
 #include "toupnam.h"
 
+/*
+    Recording without back pressure on the acquisition:
+    the camera callback pulls the frame straight into a free slot of a preallocated single producer / single consumer
+    ring and returns, a separate encoder thread feeds Toupnam_WriteVideo. When the encoder falls behind and the ring
+    is full, the frame is still pulled (into a scratch buffer, so the SDK deque is drained) and counted as dropped.
+    usage: demorecord [codec = x264] [file = demorecord.mp4]
+    codec is handed to Toupnam_OpenVideo as is, so a hardware encoder available in the Toupnam build (for example
+    h264_nvenc, h264_qsv, h264_amf, h264_videotoolbox) can be picked; when it fails to open, x264 is used instead.
+*/
+#define RING_NUM    8
+
 HToupcam g_hcam = NULL;
 HToupnamVideo g_hrec = NULL;
-void* g_pImageData = NULL;
+void* g_pImageData = NULL;              /* scratch for the frames that do not fit in the ring */
+void* g_ring[RING_NUM] = { NULL };
+std::atomic<unsigned> g_head(0), g_tail(0);     /* written by the callback / by the encoder thread only */
+std::atomic<unsigned> g_dropped(0), g_maxDepth(0), g_written(0);
+std::atomic<bool> g_bStop(false);
 unsigned g_total = 0;
 
 static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
 {
     if (TOUPCAM_EVENT_IMAGE == nEvent)
     {
+        const unsigned head = g_head.load(std::memory_order_relaxed);
+        const unsigned depth = head - g_tail.load(std::memory_order_acquire);
+        const bool bFull = (depth >= RING_NUM);
         ToupcamFrameInfoV4 info = { 0 };
-        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, bFull ? g_pImageData : g_ring[head % RING_NUM], 0, 24, 0, &info);
         if (FAILED(hr))
             printf("failed to pull image, hr = 0x%08x\n", hr);
         else
         {
             /* After we get the image data, we can do anything for the data we want to do */
-            printf("pull image ok, total = %u, res = %u x %u\n", ++g_total, info.v3.width, info.v3.height);
-            if (g_hrec)
-                Toupnam_WriteVideo(g_hrec, g_pImageData, 0);
+            ++g_total;
+            if (bFull)
+                ++g_dropped;
+            else if (g_hrec)
+            {
+                g_head.store(head + 1, std::memory_order_release);
+                if (depth + 1 > g_maxDepth)
+                    g_maxDepth = depth + 1;
+            }
         }
     }
     else
@@ -30,8 +58,28 @@ static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
     }
 }
 
-int main(int, char**)
+static void EncoderThread()
+{
+    while (true)
+    {
+        const unsigned tail = g_tail.load(std::memory_order_relaxed);
+        if (tail == g_head.load(std::memory_order_acquire))
+        {
+            if (g_bStop)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+        Toupnam_WriteVideo(g_hrec, g_ring[tail % RING_NUM], 0);
+        ++g_written;
+        g_tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+int main(int argc, char** argv)
 {
+    const char* codec = (argc > 1) ? argv[1] : "x264";
+    const char* filename = (argc > 2) ? argv[2] : "demorecord.mp4";
     Toupnam_Init(NULL, NULL);
     g_hcam = Toupcam_Open(NULL);
     if (NULL == g_hcam)
@@ -46,20 +94,37 @@ int main(int, char**)
         printf("failed to get size, hr = 0x%08x\n", hr);
     else
     {
-        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
-        if (NULL == g_pImageData)
+        bool bAlloc = (NULL != (g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight)));
+        for (int i = 0; bAlloc && (i < RING_NUM); ++i)
+            bAlloc = (NULL != (g_ring[i] = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight)));
+        if (!bAlloc)
             printf("failed to malloc\n");
         else
         {
-            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
-            if (FAILED(hr))
-                printf("failed to start camera, hr = 0x%08x\n", hr);
+            /* estimate fps */
+            g_hrec = Toupnam_OpenVideo(nWidth, nHeight, 30, 0, 90, filename /* utf8 */, codec);
+            if ((NULL == g_hrec) && strcmp(codec, "x264"))
+            {
+                printf("failed to open encoder %s, fall back to x264\n", codec);
+                g_hrec = Toupnam_OpenVideo(nWidth, nHeight, 30, 0, 90, filename /* utf8 */, "x264");
+            }
+            if (NULL == g_hrec)
+                printf("failed to open video %s\n", filename);
             else
             {
-                /* estimate fps */
-                g_hrec = Toupnam_OpenVideo(nWidth, nHeight, 30, 0, 90, "demorecord.mp4" /* utf8 */, "x264");
-                printf("press ENTER to exit\n");
-                getc(stdin);
+                std::thread encoder(EncoderThread);
+                hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+                if (FAILED(hr))
+                    printf("failed to start camera, hr = 0x%08x\n", hr);
+                else
+                {
+                    printf("press ENTER to exit\n");
+                    getc(stdin);
+                }
+                Toupcam_Stop(g_hcam);
+                g_bStop = true;     /* the encoder drains what is left in the ring */
+                encoder.join();
+                printf("frames = %u, written = %u, dropped = %u, max queue depth = %u / %d\n", g_total, g_written.load(), g_dropped.load(), g_maxDepth.load(), RING_NUM);
             }
         }
     }
@@ -69,6 +134,11 @@ int main(int, char**)
     if (g_hrec)
         Toupnam_CloseVideo(g_hrec);
     Toupnam_Fini();
+    for (int i = 0; i < RING_NUM; ++i)
+    {
+        if (g_ring[i])
+            free(g_ring[i]);
+    }
     if (g_pImageData)
         free(g_pImageData);
     return 0;
@@ -1,7 +1,7 @@
 #!/bin/bash
 os=`uname -s`
 if [[ $os = "Linux" ]]; then
-	g++ -Wl,-rpath -Wl,'$ORIGIN' -L. -g -o demorecord demorecord.cpp -ltoupcam -ltoupnam
+	g++ -Wl,-rpath -Wl,'$ORIGIN' -L. -g -o demorecord demorecord.cpp -ltoupcam -ltoupnam -lpthread
 else
-	clang++ -Wl,-rpath -Wl,@executable_path -L. -g -o demorecord demorecord.cpp -ltoupcam -ltoupnam
+	clang++ -Wl,-rpath -Wl,@executable_path -L. -g -o demorecord demorecord.cpp -ltoupcam -ltoupnam -lpthread
 fi
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "toupcam.h"
+#include "../roidemosaic.h"
+
+/*
+    Demosaic by region on the host (roidemosaic.h), on a color camera: the frame is pulled as RAW 8 bits and turned into
+    RGB, ROIDEMOSAIC_EA inside the region examined, bilinear elsewhere.
+    usage: demoroidemosaic [roi | bilinear | ea] [percent = 25]
+    roi: the region is the center of the frame, percent of its width and of its height; bilinear, ea: one method for the
+    whole frame, for comparison. The time of the demosaic per frame is printed.
+*/
+HToupcam g_hcam = NULL;
+void* g_pRawData = NULL;
+void* g_pRgb = NULL;
+int g_method = ROIDEMOSAIC_EA;
+bool g_bRoi = true;
+unsigned g_percent = 25, g_fourcc = 0, g_total = 0;
+std::vector<unsigned short> g_green;
+double g_ms = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pRawData, 0, 0, -1, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const int w = (int)info.v3.width, h = (int)info.v3.height;
+            RECT roi = { w / 2 - w * (int)g_percent / 200, h / 2 - h * (int)g_percent / 200, 0, 0 };
+            roi.right = w - roi.left;
+            roi.bottom = h - roi.top;
+            const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            RoiDemosaic(g_fourcc, 8, 0, g_pRawData, w, w, h, g_bRoi ? &roi : NULL, g_method, false, g_pRgb, TDIBWIDTHBYTES(24 * w), g_green);
+            g_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            if (0 == (++g_total % 50))
+            {
+                if (g_bRoi)
+                    printf("%d x %d, ea in (%d, %d) - (%d, %d), %.2f ms per frame\n", w, h, roi.left, roi.top, roi.right, roi.bottom, g_ms / g_total);
+                else
+                    printf("%d x %d, %s, %.2f ms per frame\n", w, h, (ROIDEMOSAIC_EA == g_method) ? "ea" : "bilinear", g_ms / g_total);
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        if (0 == strcmp(argv[1], "bilinear"))
+        {
+            g_method = ROIDEMOSAIC_BILINEAR;
+            g_bRoi = false;
+        }
+        else if (0 == strcmp(argv[1], "ea"))
+            g_bRoi = false;
+        else if (0 != strcmp(argv[1], "roi"))
+        {
+            printf("usage: %s [roi | bilinear | ea] [percent = 25]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (argc > 2)
+        g_percent = (unsigned)atoi(argv[2]);
+    if (g_percent > 100)
+        g_percent = 100;
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (Toupcam_query_Model(g_hcam)->flag & TOUPCAM_FLAG_MONO)
+        printf("mono camera, nothing to demosaic\n");
+
+    int nWidth = 0, nHeight = 0;
+    unsigned bitsperpixel = 0;
+    HRESULT hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    if (FAILED(hr))
+        printf("failed to set raw mode, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 0)))
+        printf("failed to set bit depth, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_RawFormat(g_hcam, &g_fourcc, &bitsperpixel)))
+        printf("failed to get raw format, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pRawData = malloc(nWidth * nHeight);
+        g_pRgb = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if ((NULL == g_pRawData) || (NULL == g_pRgb))
+            printf("failed to malloc\n");
+        else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL)))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("press ENTER to exit\n");
+            getc(stdin);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pRawData)
+        free(g_pRawData);
+    if (g_pRgb)
+        free(g_pRgb);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "toupcam.h"
+#include "../roinview.h"
+#include "../hostfocus.h"
+
+/*
+    Multi-area focus on the regions of Toupcam_put_RoiN: four REGION_SIZE regions, centered in the four quarters of the
+    frame. Every frame pulled is split into the four sub-images by RoiNView (roinview.h) and the Tenengrad of each region
+    is computed in place, in the frame buffer: nothing is copied out. The views are independent, so heavier work per
+    region would go to the workers of a pool started once; for four regions of REGION_SIZE the callback thread is
+    faster than starting a thread per region and frame.
+*/
+#define REGION_SIZE     256
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+RoiNView g_roin;
+unsigned g_total = 0;
+bool g_bUnknown = false, g_bBottomUp = false;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            std::vector<RoiNSubImage> views;
+            if (!g_roin.views(g_pImageData, info, 24, 0, g_bBottomUp, views))
+            {
+                if (!g_bUnknown)
+                    printf("the regions do not match the frame of %u x %u, unknown packing\n", info.v3.width, info.v3.height);
+                g_bUnknown = true;
+                return;
+            }
+
+            std::vector<double> fv(views.size());
+            for (size_t i = 0; i < views.size(); ++i)
+            {
+                const HostFocusRoi roi = { 0, 0, views[i].width, views[i].height };
+                fv[views[i].index] = HostFocusMetric(HOSTFOCUS_TENENGRAD, HOSTFOCUS_RGB24, views[i].data, views[i].pitch, roi);
+            }
+
+            if (0 == (++g_total % 10))
+            {
+                printf("seq = %u, %u x %u, layout = %d, focus =", info.v3.seq, info.v3.width, info.v3.height, g_roin.layout());
+                for (size_t i = 0; i < fv.size(); ++i)
+                    printf(" %.1f", fv[i]);
+                printf("\n");
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (NULL == (g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight)))
+        printf("failed to malloc\n");
+    else
+    {
+        const unsigned rw = std::min<unsigned>(REGION_SIZE, nWidth / 2) & ~1u, rh = std::min<unsigned>(REGION_SIZE, nHeight / 2) & ~1u;
+        std::vector<RoiNRect> rect;
+        for (int j = 0; j < 2; ++j)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                const RoiNRect r = { (nWidth / 4 + i * nWidth / 2 - rw / 2) & ~1u, (nHeight / 4 + j * nHeight / 2 - rh / 2) & ~1u, rw, rh };
+                rect.push_back(r);
+            }
+        }
+        int upsideDown = 0;
+        Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_UPSIDE_DOWN, &upsideDown);
+        g_bBottomUp = (0 != upsideDown);
+        if (FAILED(hr = g_roin.put(g_hcam, rect)))
+            printf("failed to put roi, hr = 0x%08x\n", hr);
+        else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL)))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("%u regions of %u x %u, press ENTER to exit\n", (unsigned)rect.size(), rw, rh);
+            getc(stdin);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
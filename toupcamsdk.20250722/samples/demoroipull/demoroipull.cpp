@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "toupcam.h"
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+/*
+    Pull the frame as RAW (TOUPCAM_OPTION_RAW = 1, 8 bits), which skips the full-frame demosaic and RGB conversion in the SDK, and then:
+    1. crop a centre patch (for autofocus) and demosaic only that patch with Toupcam_deBayerV2
+    2. build a 1/DECIMATION preview directly from the Bayer quads, no demosaic at all
+    The sensor ROI (Toupcam_put_Roi) is untouched, so a full-resolution still can still be taken at any time.
+*/
+#define PATCH_SIZE      512
+#define DECIMATION      4       /* must be even, so that every sample starts on a Bayer quad */
+
+HToupcam g_hcam = NULL;
+void* g_pRawData = NULL;        /* full frame, RAW 8 bits */
+void* g_pPatchRaw = NULL;       /* PATCH_SIZE x PATCH_SIZE, RAW 8 bits */
+void* g_pPatchRGB = NULL;       /* PATCH_SIZE x PATCH_SIZE, RGB24 */
+void* g_pPreview = NULL;        /* (width / DECIMATION) x (height / DECIMATION), RGB24 */
+unsigned g_total = 0, g_fourcc = 0;
+
+/* position of the red and blue sample in the 2x2 Bayer quad */
+static void BayerOffset(unsigned fourcc, int* rx, int* ry, int* bx, int* by)
+{
+    if (MAKEFOURCC('R', 'G', 'G', 'B') == fourcc)
+    {
+        *rx = 0; *ry = 0; *bx = 1; *by = 1;
+    }
+    else if (MAKEFOURCC('B', 'G', 'G', 'R') == fourcc)
+    {
+        *rx = 1; *ry = 1; *bx = 0; *by = 0;
+    }
+    else if (MAKEFOURCC('G', 'R', 'B', 'G') == fourcc)
+    {
+        *rx = 1; *ry = 0; *bx = 0; *by = 1;
+    }
+    else /* GBRG */
+    {
+        *rx = 0; *ry = 1; *bx = 1; *by = 0;
+    }
+}
+
+/* x, y, w, h are rounded down to even numbers to keep the Bayer phase, so the patch has the same FourCC as the frame */
+static void CropDemosaic(const unsigned char* pRaw, int width, int x, int y, int w, int h, unsigned char* pPatchRaw, void* pRGB)
+{
+    x &= ~1; y &= ~1; w &= ~1; h &= ~1;
+    for (int j = 0; j < h; ++j)
+        memcpy(pPatchRaw + j * w, pRaw + (y + j) * width + x, w);
+    Toupcam_deBayerV2(g_fourcc, w, h, pPatchRaw, pRGB, 8, 24);
+}
+
+/* each output pixel is taken from one Bayer quad: R, average of the two G, B; the result is BGR like the RGB24 of the SDK */
+static void DecimateRaw(const unsigned char* pRaw, int width, int height, int d, unsigned char* pRGB)
+{
+    const int ow = width / d, oh = height / d, stride = TDIBWIDTHBYTES(ow * 24);
+    if (MAKEFOURCC('Y', 'Y', 'Y', 'Y') == g_fourcc)
+    {
+        for (int j = 0; j < oh; ++j)
+        {
+            const unsigned char* s = pRaw + j * d * width;
+            unsigned char* o = pRGB + j * stride;
+            for (int i = 0; i < ow; ++i, o += 3)
+                o[0] = o[1] = o[2] = s[i * d];
+        }
+        return;
+    }
+
+    int rx, ry, bx, by;
+    BayerOffset(g_fourcc, &rx, &ry, &bx, &by);
+    for (int j = 0; j < oh; ++j)
+    {
+        const unsigned char* s0 = pRaw + j * d * width;
+        const unsigned char* s1 = s0 + width;
+        const unsigned char* sr = ry ? s1 : s0;
+        const unsigned char* sb = by ? s1 : s0;
+        const unsigned char* sg0 = ry ? s0 : s1;    /* green on the red row is at 1 - rx, on the blue row at 1 - bx */
+        const unsigned char* sg1 = ry ? s1 : s0;
+        unsigned char* o = pRGB + j * stride;
+        for (int i = 0; i < ow; ++i, o += 3)
+        {
+            const int x = i * d;
+            o[0] = sb[x + bx];
+            o[1] = (unsigned char)((sg0[x + 1 - bx] + sg1[x + 1 - rx] + 1) >> 1);
+            o[2] = sr[x + rx];
+        }
+    }
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pRawData, 0, 0, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const int w = (int)info.v3.width, h = (int)info.v3.height;
+            const int pw = (w < PATCH_SIZE) ? w : PATCH_SIZE, ph = (h < PATCH_SIZE) ? h : PATCH_SIZE;
+            if (MAKEFOURCC('Y', 'Y', 'Y', 'Y') == g_fourcc)
+            {
+                for (int j = 0; j < ph; ++j)
+                    memcpy((unsigned char*)g_pPatchRGB + j * pw, (const unsigned char*)g_pRawData + ((h - ph) / 2 + j) * w + (w - pw) / 2, pw);
+            }
+            else
+                CropDemosaic((const unsigned char*)g_pRawData, w, (w - pw) / 2, (h - ph) / 2, pw, ph, (unsigned char*)g_pPatchRaw, g_pPatchRGB);
+            DecimateRaw((const unsigned char*)g_pRawData, w, h, DECIMATION, (unsigned char*)g_pPreview);
+
+            /* After we get the image data, we can do anything for the data we want to do */
+            printf("pull image ok, total = %u, res = %u x %u, patch = %d x %d, preview = %d x %d\n", ++g_total, info.v3.width, info.v3.height, pw & ~1, ph & ~1, w / DECIMATION, h / DECIMATION);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    
+    int nWidth = 0, nHeight = 0;
+    unsigned bitsperpixel = 0;
+    HRESULT hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    if (FAILED(hr))
+        printf("failed to set raw mode, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_RawFormat(g_hcam, &g_fourcc, &bitsperpixel)))
+        printf("failed to get raw format, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pRawData = malloc(nWidth * nHeight);
+        g_pPatchRaw = malloc(PATCH_SIZE * PATCH_SIZE);
+        g_pPatchRGB = malloc(TDIBWIDTHBYTES(24 * PATCH_SIZE) * PATCH_SIZE);
+        g_pPreview = malloc(TDIBWIDTHBYTES(24 * (nWidth / DECIMATION)) * (nHeight / DECIMATION));
+        if ((NULL == g_pRawData) || (NULL == g_pPatchRaw) || (NULL == g_pPatchRGB) || (NULL == g_pPreview))
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("press ENTER to exit\n");
+                getc(stdin);
+            }
+        }
+    }
+    
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pRawData)
+        free(g_pRawData);
+    if (g_pPatchRaw)
+        free(g_pPatchRaw);
+    if (g_pPatchRGB)
+        free(g_pPatchRGB);
+    if (g_pPreview)
+        free(g_pPreview);
+    return 0;
+}
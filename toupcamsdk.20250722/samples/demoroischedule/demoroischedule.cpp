@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "toupcam.h"
+#include "../roischedule.h"
+#include "../focusmetric.h"
+
+/*
+    Autofocus and capture interleaved in one stream by an ROI schedule (roischedule.h): AF_FRAMES frames of a centered
+    PATCH_SIZE autofocus patch, each giving a focus value, then one full-resolution capture, then the patch again, in
+    software trigger mode and without ever stopping the camera. Every frame is tagged with its step of the schedule.
+    Best on a camera with TOUPCAM_FLAG_ROI_HARDWARE, where the patch frames come at the frame rate of the patch.
+*/
+#define PATCH_SIZE      256
+#define AF_FRAMES       30
+#define WAIT_MS         1000    /* per frame, before a step is given up */
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+RoiSchedule g_schedule;
+FocusMetric g_focus;
+unsigned g_total = 0, g_captures = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            ++g_total;
+            const int step = g_schedule.tag(info);
+            if (0 == step)          /* the patch is the whole frame */
+            {
+                const double fv = g_focus.value(info, g_pImageData, false);
+                if (0 == (g_total % 10))
+                    printf("af: seq = %u, %u x %u, focus = %.1f\n", info.v3.seq, info.v3.width, info.v3.height, fv);
+            }
+            else if (1 == step)
+                printf("capture %u: seq = %u, %u x %u\n", ++g_captures, info.v3.seq, info.v3.width, info.v3.height);
+            else
+                printf("stale frame: seq = %u, %u x %u\n", info.v3.seq, info.v3.width, info.v3.height);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    const unsigned long long flag = Toupcam_query_Model(g_hcam)->flag;
+    if (0 == (flag & TOUPCAM_FLAG_TRIGGER_SOFTWARE))
+        printf("camera do NOT support software trigger, fallback to simulated trigger\n");
+    if (0 == (flag & TOUPCAM_FLAG_ROI_HARDWARE))
+        printf("camera do NOT support hardware ROI, the patch is cut in software and comes at the full frame rate\n");
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (NULL == (g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight)))
+        printf("failed to malloc\n");
+    else
+    {
+        const unsigned pw = std::min<unsigned>(PATCH_SIZE, nWidth) & ~1u, ph = std::min<unsigned>(PATCH_SIZE, nHeight) & ~1u;
+        std::vector<RoiStep> steps(2);
+        steps[0].xOffset = (nWidth - pw) / 2 & ~1u;
+        steps[0].yOffset = (nHeight - ph) / 2 & ~1u;
+        steps[0].xWidth = pw;
+        steps[0].yHeight = ph;
+        steps[0].count = AF_FRAMES;
+        steps[1].xOffset = steps[1].yOffset = steps[1].xWidth = steps[1].yHeight = 0;
+        steps[1].count = 1;
+
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_TRIGGER, 1);
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else if (!g_schedule.start(g_hcam, steps, WAIT_MS))
+            printf("failed to start the schedule\n");
+        else
+        {
+            printf("%u af frames of %u x %u, then 1 capture of %d x %d, press ENTER to exit\n", AF_FRAMES, pw, ph, nWidth, nHeight);
+            getc(stdin);
+            g_schedule.stop();
+
+            int failed = -1;
+            if (FAILED(hr = g_schedule.result(&failed)))
+                printf("the schedule stopped at step %d, hr = 0x%08x\n", failed, hr);
+            for (size_t i = 0; i < steps.size(); ++i)
+            {
+                const RoiStepStats& s = g_schedule.stats(i);
+                printf("step %u: %u frames, %u timeouts, %.1f fps\n", (unsigned)i, s.frames, s.timeouts, (s.ms > 0) ? s.frames * 1000.0 / s.ms : 0.0);
+            }
+            printf("%u passes, %u stale frames\n", g_schedule.passes(), g_schedule.stale());
+        }
+    }
+
+    /* cleanup */
+    g_schedule.stop();
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "toupcam.h"
+#include "../roitrack.h"
+
+/*
+    Tracking ROI (roitrack.h): a TRACK_SIZE window, first in the middle of the frame, follows the content by moving on
+    the sensor; only when it reaches the edge of the sensor the stage is moved, by G-code on the port, and tracking goes
+    on from the middle again.
+    usage: demoroitrack <um per pixel> [seconds = 60] [port]
+    um per pixel: at the sample, the pixel size of the sensor divided by the magnification. The stage takes back the
+    shift of the target, X with the columns and Y with the rows; flip the signs when the camera is mounted mirrored or
+    turned against the stage axes. Port as in demozsweep: default stdout / stdin.
+*/
+#define TRACK_SIZE      512
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+RoiTracker g_tracker;
+std::mutex g_mutex;
+std::condition_variable g_cv;
+bool g_bStage = false;
+double g_stageX = 0, g_stageY = 0;      /* pixels */
+unsigned g_total = 0, g_moves = 0;
+FILE* g_fout = NULL;
+FILE* g_fin = NULL;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            double dx = 0, dy = 0;
+            std::lock_guard<std::mutex> lock(g_mutex);
+            const int r = g_tracker.update(g_pImageData, info, ROITRACK_RGB24, &dx, &dy);
+            ++g_total;
+            if (ROITRACK_MOVED == r)
+                printf("seq = %u, shift = %.1f, %.1f, window moved to %u, %u (%u moves)\n", info.v3.seq, dx, dy, g_tracker.x(), g_tracker.y(), ++g_moves);
+            else if (ROITRACK_STAGE == r)
+            {
+                g_stageX = dx;
+                g_stageY = dy;
+                g_bStage = true;
+                g_cv.notify_one();
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+/* relative move, waits for the "ok" of all four lines */
+static bool MoveStage(double x, double y)
+{
+    fprintf(g_fout, "G91\nG0 X%.4f Y%.4f\nG90\nM400\n", x, y);
+    fflush(g_fout);
+    char line[256];
+    for (int n = 0; n < 4; )
+    {
+        if (NULL == fgets(line, sizeof(line), g_fin))
+            return false;
+        if (0 == strncmp(line, "ok", 2))
+            ++n;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <um per pixel> [seconds] [port]\n", argv[0]);
+        return -1;
+    }
+    const double umPerPixel = atof(argv[1]);
+    const int seconds = (argc > 2) ? atoi(argv[2]) : 60;
+    g_fout = stdout;
+    g_fin = stdin;
+    if (argc > 3)
+    {
+        /* one FILE per direction: a "r+" FILE may not turn from reading to writing without a seek, which a tty cannot do */
+        g_fout = fopen(argv[3], "w");
+        g_fin = g_fout ? fopen(argv[3], "r") : NULL;
+        if (NULL == g_fin)
+        {
+            printf("failed to open %s\n", argv[3]);
+            if (g_fout)
+                fclose(g_fout);
+            return -1;
+        }
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (NULL == (g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight)))
+        printf("failed to malloc\n");
+    else if (FAILED(hr = g_tracker.start(g_hcam, (nWidth - TRACK_SIZE) / 2, (nHeight - TRACK_SIZE) / 2, TRACK_SIZE, TRACK_SIZE)))
+        printf("failed to put roi, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL)))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        const std::chrono::steady_clock::time_point tEnd = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+        std::unique_lock<std::mutex> lock(g_mutex);
+        while (std::chrono::steady_clock::now() < tEnd)
+        {
+            if (!g_cv.wait_until(lock, tEnd, [] { return g_bStage; }))
+                break;
+            const double x = -g_stageX * umPerPixel / 1000, y = -g_stageY * umPerPixel / 1000;
+            g_bStage = false;
+            lock.unlock();
+            printf("window at the edge of the sensor, stage move %.4f, %.4f mm\n", x, y);
+            const bool bMoved = MoveStage(x, y);
+            lock.lock();
+            if (!bMoved)
+            {
+                printf("failed to move the stage\n");
+                break;
+            }
+            g_tracker.resume();
+        }
+        printf("%u frames, %u window moves\n", g_total, g_moves);
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    if (g_fout && (g_fout != stdout))
+        fclose(g_fout);
+    if (g_fin && (g_fin != stdin))
+        fclose(g_fin);
+    return 0;
+}
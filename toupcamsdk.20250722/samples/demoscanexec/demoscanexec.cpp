@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "toupcam.h"
+#include "../scanexec.h"
+#include "../../extra/imagepro/samples/tileindex.h"
+
+/*
+    Serpentine area scan with the moves, the exposures and the saves pipelined (scanexec.h).
+    usage: demoscanexec [-g retakes] [-i index] <columns> <rows> <dx mm> <dy mm> [feed = 3000 mm/min] [port]
+    The scan starts at the position the stage is at (G90 and G92 X0 Y0 are sent first, the moves are absolute); the
+    G-code goes to the port (a tty of the controller), default stdout, and its answers are read back from it, default
+    from stdin. Every tile is saved by the worker threads as tile_<row>_<column>.rgb (RGB24 rows as pulled: bottom up
+    on Windows, top down on Linux and macOS, see TOUPCAM_OPTION_UPSIDE_DOWN) while the stage moves on. At
+    the end the time per tile is printed, split into the waits for the stage, the exposures and the buffers.
+    -g: the frames are gated (framegate.h, the default thresholds) before they are saved; a black, overexposed, flat
+    or blurred tile is triggered again up to retakes times while the stage is still there (0: not at once), the tiles
+    still rejected are taken again in a second pass at the end.
+    -i: the workers also write every tile into the tile index (tileindex.h): its grid position, the stage position,
+    the frame info, the focus value (focusmetric.h) and its thumbnails; a tile of the second pass replaces the first.
+*/
+#define SAVE_WORKERS    2
+
+HToupcam g_hcam = NULL;
+ScanExecutor g_exec;
+FrameGate g_gate;
+TileIndexWriter g_index;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    g_exec.onEvent(nEvent);
+}
+
+static void SaveTile(void* ctx, const ScanTile& tile, const ToupcamFrameInfoV4& info, const void* data)
+{
+    char filename[64];
+    sprintf(filename, "tile_%03u_%03u.rgb", tile.row, tile.column);
+    FILE* fp = fopen(filename, "wb");
+    if (NULL == fp)
+        printf("failed to create %s\n", filename);
+    else
+    {
+        fwrite(data, 1, TDIBWIDTHBYTES(info.v3.width * 24) * info.v3.height, fp);
+        fclose(fp);
+    }
+    if (g_index.header().columns)
+    {
+        TileIndexRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.row = tile.row;
+        rec.column = tile.column;
+        rec.x = tile.x;
+        rec.y = tile.y;         /* z: no Z axis in this scan */
+        FocusMetric focus;
+        rec.focus = focus.value(info, data, false);
+        rec.focusSource = focus.source();
+        rec.info = info;
+        strcpy(rec.name, filename);
+        HRESULT hr = g_index.add(rec, data, 0, true);
+        if (FAILED(hr))
+            printf("failed to index tile %u, %u, hr = 0x%08x\n", tile.row, tile.column, hr);
+    }
+}
+
+static void PrintStats(const char* pass, bool bDone, const ScanStats& stats)
+{
+    printf("%s %s: %u tiles, %u lost, %.2f s, %.1f ms per tile (stage %.1f ms, exposure %.1f ms, buffers %.1f ms)\n",
+        pass, bDone ? "done" : "aborted", stats.tiles, stats.lost, stats.seconds, stats.tiles ? stats.seconds * 1000 / stats.tiles : 0.0,
+        stats.tiles ? stats.moveWait * 1000 / stats.tiles : 0.0, stats.tiles ? stats.expoWait * 1000 / stats.tiles : 0.0,
+        stats.tiles ? stats.bufferWait * 1000 / stats.tiles : 0.0);
+    if (stats.rejected || stats.retakes || stats.gateWait > 0)
+        printf("    gate: %u frames rejected, %u retakes, %.1f ms per tile waiting for the verdict\n", stats.rejected, stats.retakes, stats.tiles ? stats.gateWait * 1000 / stats.tiles : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    int retakes = -1;
+    const char* index = NULL;
+    while ((argc > 2) && ((0 == strcmp(argv[1], "-g")) || (0 == strcmp(argv[1], "-i"))))
+    {
+        if (0 == strcmp(argv[1], "-g"))
+            retakes = atoi(argv[2]);
+        else
+            index = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 5)
+    {
+        printf("usage: %s [-g retakes] [-i index] <columns> <rows> <dx mm> <dy mm> [feed mm/min] [port]\n", argv[0]);
+        return -1;
+    }
+    const std::vector<ScanTile> tiles = ScanSerpentine(0, 0, atof(argv[3]), atof(argv[4]), (unsigned)atoi(argv[1]), (unsigned)atoi(argv[2]));
+    const double feed = (argc > 5) ? atof(argv[5]) : 3000;
+    FILE* fout = stdout;
+    FILE* fin = stdin;
+    if (argc > 6)
+    {
+        /* one FILE per direction: a "r+" FILE may not turn from reading to writing without a seek, which a tty cannot do */
+        fout = fopen(argv[6], "w");
+        fin = fout ? fopen(argv[6], "r") : NULL;
+        if (NULL == fin)
+        {
+            printf("failed to open %s\n", argv[6]);
+            if (fout)
+                fclose(fout);
+            return -1;
+        }
+    }
+    fprintf(fout, "G90\nG92 X0 Y0\n");
+    fflush(fout);
+    char line[256];
+    for (int ok = 0; (ok < 2) && fgets(line, sizeof(line), fin); )
+    {
+        if (0 == strncmp(line, "ok", 2))
+            ++ok;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int width = 0, height = 0;
+    HRESULT hr = g_exec.init(g_hcam, fout, fin, 24, SCANEXEC_BUFFERS, SAVE_WORKERS);
+    if (FAILED(hr))
+        printf("failed to init, hr = 0x%08x\n", hr);
+    else if (index && (FAILED(hr = Toupcam_get_FinalSize(g_hcam, &width, &height)) || FAILED(hr = g_index.create(index, (unsigned)atoi(argv[1]), (unsigned)atoi(argv[2]), width, height))))
+        printf("failed to create the index %s, hr = 0x%08x\n", index, hr);
+    else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL)))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("end of exposure: %s\n", g_exec.hardwareEvent() ? "TOUPCAM_EVENT_EXPO_STOP" : "frame arrival");
+        if (retakes >= 0)
+        {
+            g_gate.setConfig(FrameGateDefault(), g_hcam);
+            g_exec.setGate(&g_gate, (unsigned)retakes);
+        }
+        ScanStats stats;
+        bool bDone = g_exec.run(tiles, feed, SaveTile, NULL, &stats);
+        PrintStats("scan", bDone, stats);
+        if (bDone && !g_exec.rejected().empty())
+        {
+            /* the tiles rejected, in the order of the scan */
+            std::vector<ScanTile> again;
+            for (size_t i = 0; i < g_exec.rejected().size(); ++i)
+                again.push_back(tiles[g_exec.rejected()[i]]);
+            bDone = g_exec.run(again, feed, SaveTile, NULL, &stats);
+            PrintStats("recapture", bDone, stats);
+            for (size_t i = 0; i < g_exec.rejected().size(); ++i)
+                printf("    still rejected: tile %u, %u\n", again[g_exec.rejected()[i]].row, again[g_exec.rejected()[i]].column);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    g_exec.close();
+    g_index.close();
+    if (fout != stdout)
+        fclose(fout);
+    if (fin != stdin)
+        fclose(fin);
+    return 0;
+}
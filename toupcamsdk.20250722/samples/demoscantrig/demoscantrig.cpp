@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "toupcam.h"
+
+/*
+    Position triggered area scan: the stage moves continuously and the controller fires the camera at every tile.
+    usage: demoscantrig <tiles> [columns = tiles] [exposure us = 1000]
+    Wiring and handshake (ioLine numbers of Toupcam_IoControl):
+        controller tile output  -> opto-isolated input (line 0), the trigger source, rising edge
+        exposure active output  <- opto-isolated output (line 1), high while the sensor exposes
+    The controller raises its output as the stage crosses a tile position, the camera exposes on the rising edge and
+    drives the exposure active line during the exposure: the controller does not start the move which would blur the
+    frame (a move in the other axis, the turn at the end of a row) until that line is low again, otherwise it just
+    keeps moving. Keep the exposure short against the speed of the stage (motion blur = speed x exposure).
+    The camera side counts the trigger edges it saw (TOUPCAM_IOCONTROLTYPE_GET_DEBOUNCER_TRIGGER_NUMBER) and those it
+    exposed (TOUPCAM_IOCONTROLTYPE_GET_EFFECTIVE_TRIGGER_NUMBER): an edge which came while the previous exposure was not
+    over is ignored by the camera, so a difference between both means the stage is too fast for the exposure.
+    Frames are numbered in the order they come and mapped to the serpentine (row, column) of the scan.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned g_tiles = 0, g_columns = 0, g_total = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const unsigned tile = g_total++, row = tile / g_columns;
+            const unsigned column = (row & 1) ? (g_columns - 1 - tile % g_columns) : (tile % g_columns);
+            /* After we get the image data, we can do anything for the data we want to do, such as save it as tile (row, column) */
+            printf("tile %u (%u, %u): seq = %u, timestamp = %llu%s\n", tile, row, column, info.v3.seq, info.v3.timestamp, (g_total == g_tiles) ? ", scan complete" : "");
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <tiles> [columns] [exposure us]\n", argv[0]);
+        return -1;
+    }
+    g_tiles = (unsigned)atoi(argv[1]);
+    g_columns = (argc > 2) ? (unsigned)atoi(argv[2]) : g_tiles;
+    const unsigned expotime = (argc > 3) ? (unsigned)atoi(argv[3]) : 1000;
+    if ((0 == g_tiles) || (0 == g_columns))
+    {
+        printf("bad tiles or columns\n");
+        return -1;
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (0 == (Toupcam_query_Model(g_hcam)->flag & TOUPCAM_FLAG_TRIGGER_EXTERNAL))
+    {
+        printf("camera does not support external trigger\n");
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            Toupcam_put_AutoExpoEnable(g_hcam, 0);
+            Toupcam_put_ExpoTime(g_hcam, expotime);
+            hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_TRIGGER, 2);
+            if (FAILED(hr))
+                printf("failed to set external trigger mode, hr = 0x%08x\n", hr);
+            else
+            {
+                Toupcam_IoControl(g_hcam, 0, TOUPCAM_IOCONTROLTYPE_SET_TRIGGERSOURCE, 0x00, NULL);     // opto-isolated input
+                Toupcam_IoControl(g_hcam, 0, TOUPCAM_IOCONTROLTYPE_SET_INPUTACTIVATION, 0x00, NULL);   // rising edge
+                Toupcam_IoControl(g_hcam, 0, TOUPCAM_IOCONTROLTYPE_SET_DEBOUNCERTIME, 20, NULL);       // us, against the ringing of the controller output
+                Toupcam_IoControl(g_hcam, 0, TOUPCAM_IOCONTROLTYPE_SET_TRIGGERDELAY, 0, NULL);
+                Toupcam_IoControl(g_hcam, 0, TOUPCAM_IOCONTROLTYPE_SET_BURSTCOUNTER, 1, NULL);         // one frame per tile
+                Toupcam_IoControl(g_hcam, 1, TOUPCAM_IOCONTROLTYPE_SET_OUTPUTMODE, 0x01, NULL);        // opto-isolated output -> exposure active
+                Toupcam_IoControl(g_hcam, 1, TOUPCAM_IOCONTROLTYPE_SET_OUTPUTINVERTER, 0, NULL);
+                hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+                if (FAILED(hr))
+                    printf("failed to start camera, hr = 0x%08x\n", hr);
+                else
+                {
+                    printf("start the scan on the controller, ENTER to show the trigger counters, 'x' to exit\n");
+                    do {
+                        char str[1024];
+                        if (fgets(str, 1023, stdin))
+                        {
+                            if (('x' == str[0]) || ('X' == str[0]))
+                                break;
+                            int nSeen = 0, nEffective = 0;
+                            Toupcam_IoControl(g_hcam, 0, TOUPCAM_IOCONTROLTYPE_GET_DEBOUNCER_TRIGGER_NUMBER, 0, &nSeen);
+                            Toupcam_IoControl(g_hcam, 0, TOUPCAM_IOCONTROLTYPE_GET_EFFECTIVE_TRIGGER_NUMBER, 0, &nEffective);
+                            printf("tiles = %u/%u, triggers seen = %d, exposed = %d, ignored = %d\n", g_total, g_tiles, nSeen, nEffective, nSeen - nEffective);
+                        }
+                    } while (true);
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "toupcam.h"
+
+/*
+    Event capture with the self trigger of the camera (TOUPCAM_FLAG_SELFTRIGGER): the camera watches a sensing area and
+    only sends a frame when its content leaves the band around the baseline, the host does no frame differencing.
+    usage: demoselftrig <left> <top> <width> <height> [delta = 20] [count = 5]
+    1. video mode: the mean luminance of the sensing area over BASELINE_FRAMES frames is the baseline
+    2. self trigger mode (TOUPCAM_OPTION_TRIGGER = 4) with ToupcamSelfTrigger: the camera fires when more than count
+       thousandths of the sensing area are brighter than baseline + delta (hThreshold, hCount) or darker than
+       baseline - delta (lThreshold, lCount); the thresholds are in 8 bits, like the baseline
+    Every frame received in 2 is an event, saved as demoselftrig_WxH_n.raw (24 bits DIB: BGR, bottom up) with its time
+    in the output.
+    The camera sends nothing from before the event: a pre-roll, if needed, has to be another camera or video mode.
+*/
+#define BASELINE_FRAMES     10
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+unsigned g_left = 0, g_top = 0, g_width = 0, g_height = 0;
+unsigned g_total = 0, g_events = 0;
+double g_baseline = 0.0;
+std::atomic<bool> g_bSelfTrigger(false);
+std::mutex g_mtx;
+std::condition_variable g_cv;
+
+static double RoiMean(const ToupcamFrameInfoV4& info)
+{
+    const unsigned stride = TDIBWIDTHBYTES(info.v3.width * 24);
+    const unsigned x1 = std::min(g_left + g_width, info.v3.width), y1 = std::min(g_top + g_height, info.v3.height);
+    unsigned long long sum = 0, n = 0;
+    for (unsigned y = g_top; y < y1; ++y)
+    {
+        /* bottom up: row y of the image, the one of the sensing area, is the row height - 1 - y of the buffer */
+        const unsigned char* p = (const unsigned char*)g_pImageData + (size_t)(info.v3.height - 1 - y) * stride + g_left * 3;
+        for (unsigned x = g_left; x < x1; ++x, p += 3, ++n)
+            sum += (p[0] * 29 + p[1] * 150 + p[2] * 77) >> 8;     /* B, G, R */
+    }
+    return n ? (double)sum / n : 0.0;
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (!g_bSelfTrigger)
+        {
+            std::lock_guard<std::mutex> lock(g_mtx);
+            if (g_total < BASELINE_FRAMES)
+            {
+                g_baseline += RoiMean(info) / BASELINE_FRAMES;
+                if (++g_total == BASELINE_FRAMES)
+                    g_cv.notify_all();
+            }
+        }
+        else
+        {
+            char filename[1024];
+            sprintf(filename, "demoselftrig_%ux%u_%u.raw", info.v3.width, info.v3.height, ++g_events);
+            FILE* fp = fopen(filename, "wb");
+            if (fp)
+            {
+                fwrite(g_pImageData, 1, TDIBWIDTHBYTES(info.v3.width * 24) * info.v3.height, fp);
+                fclose(fp);
+            }
+            printf("event %u: seq = %u, timestamp = %llu, area mean = %.1f, save: %s\n", g_events, info.v3.seq, info.v3.timestamp, RoiMean(info), filename);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 5)
+    {
+        printf("usage: %s <left> <top> <width> <height> [delta] [count]\n", argv[0]);
+        return -1;
+    }
+    g_left = (unsigned)atoi(argv[1]);
+    g_top = (unsigned)atoi(argv[2]);
+    g_width = (unsigned)atoi(argv[3]);
+    g_height = (unsigned)atoi(argv[4]);
+    const unsigned delta = (argc > 5) ? (unsigned)atoi(argv[5]) : 20;
+    const unsigned short count = (argc > 6) ? (unsigned short)atoi(argv[6]) : 5;
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if (0 == (Toupcam_query_Model(g_hcam)->flag & TOUPCAM_FLAG_SELFTRIGGER))
+    {
+        printf("camera does not support self trigger\n");
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            Toupcam_put_AutoExpoEnable(g_hcam, 0);  /* the baseline holds for this exposure only */
+            Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BYTEORDER, 1);   /* BGR and */
+            Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_UPSIDE_DOWN, 1); /* bottom-up rows, the defaults on Windows only */
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                {
+                    std::unique_lock<std::mutex> lock(g_mtx);
+                    g_cv.wait(lock, [] { return g_total >= BASELINE_FRAMES; });
+                }
+                ToupcamSelfTrigger st = { 0 };
+                st.sensingLeft = g_left;
+                st.sensingTop = g_top;
+                st.sensingWidth = g_width;
+                st.sensingHeight = g_height;
+                st.hThreshold = std::min(255u, (unsigned)g_baseline + delta);
+                st.lThreshold = ((unsigned)g_baseline > delta) ? ((unsigned)g_baseline - delta) : 0;
+                Toupcam_get_ExpoTime(g_hcam, &st.expoTime);
+                Toupcam_get_ExpoAGain(g_hcam, &st.expoGain);
+                st.hCount = st.lCount = count;
+                printf("baseline = %.1f, thresholds = [%u, %u], count = %u/1000\n", g_baseline, st.lThreshold, st.hThreshold, count);
+                g_bSelfTrigger = true;
+                if (FAILED(hr = Toupcam_put_SelfTrigger(g_hcam, &st)))
+                    printf("failed to set self trigger, hr = 0x%08x\n", hr);
+                else if (FAILED(hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_TRIGGER, 4)))
+                    printf("failed to set self trigger mode, hr = 0x%08x\n", hr);
+                else
+                {
+                    printf("waiting for events, press ENTER to exit\n");
+                    getc(stdin);
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    printf("events = %u\n", g_events);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+#include "../settle.h"
+
+/*
+    Tiles captured as soon as the image is still after each move (settle.h) instead of after a fixed delay.
+    usage: demosettle <step mm> <tiles> [threshold px = 0.5] [port]
+    Every tile is "G91" + "G0 X<step>" + "M400" sent to the port (a tty of the controller), default stdout, and read
+    back "ok" three times, default from stdin; from the last "ok" on, the frames go through the detector and the first
+    still one is the capture of the tile (left in g_pImageData, g_width x g_height, RGB24). The time from "ok" to it and
+    the frames it took are printed per tile, the largest one at the end: that is what a fixed delay would have to be.
+*/
+#define SETTLE_TIMEOUT      5000    /* ms */
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+SettleDetector g_settle;
+std::mutex g_mtx;
+std::condition_variable g_cv;
+bool g_bWatch = false, g_bStill = false;
+unsigned g_width = 0, g_height = 0;
+FILE* g_fout = NULL;
+FILE* g_fin = NULL;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        std::lock_guard<std::mutex> lock(g_mtx);
+        ToupcamFrameInfoV4 info = { 0 };
+        /* a still frame is kept in g_pImageData for the main thread: not overwritten until the next tile */
+        if (!g_bWatch)
+            return;
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (g_settle.add(info, g_pImageData, 24))
+        {
+            g_width = info.v3.width;
+            g_height = info.v3.height;
+            g_bWatch = false;
+            g_bStill = true;
+            g_cv.notify_one();
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static bool Move(double step)
+{
+    fprintf(g_fout, "G91\nG0 X%.4f\nM400\n", step);
+    fflush(g_fout);
+    char line[256];
+    for (int n = 0; n < 3; )
+    {
+        if (NULL == fgets(line, sizeof(line), g_fin))
+            return false;
+        if (0 == strncmp(line, "ok", 2))
+            ++n;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <step mm> <tiles> [threshold px] [port]\n", argv[0]);
+        return -1;
+    }
+    const double step = atof(argv[1]);
+    const int tiles = atoi(argv[2]);
+    if (argc > 3)
+        g_settle.put(atof(argv[3]));
+    g_fout = stdout;
+    g_fin = stdin;
+    if (argc > 4)
+    {
+        /* one FILE per direction: a "r+" FILE may not turn from reading to writing without a seek, which a tty cannot do */
+        g_fout = fopen(argv[4], "w");
+        g_fin = g_fout ? fopen(argv[4], "r") : NULL;
+        if (NULL == g_fin)
+        {
+            printf("failed to open %s\n", argv[4]);
+            if (g_fout)
+                fclose(g_fout);
+            return -1;
+        }
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                double worst = 0;
+                for (int i = 0; i < tiles; ++i)
+                {
+                    if (!Move(step))
+                    {
+                        printf("failed to move, tile %d\n", i);
+                        break;
+                    }
+                    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                    std::unique_lock<std::mutex> lock(g_mtx);
+                    g_settle.reset();
+                    g_bStill = false;
+                    g_bWatch = true;
+                    if (!g_cv.wait_for(lock, std::chrono::milliseconds(SETTLE_TIMEOUT), [] { return g_bStill; }))
+                    {
+                        g_bWatch = false;
+                        printf("tile %d: not still after %u ms, motion = %.2f\n", i, SETTLE_TIMEOUT, g_settle.motion());
+                        continue;
+                    }
+                    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                    if (ms > worst)
+                        worst = ms;
+                    printf("tile %d: still after %.1f ms, %u frames (%s)\n", i, ms, g_settle.frames(), (SETTLE_CAMERA == g_settle.source()) ? "uFV" : "image");
+                }
+                printf("largest settle time: %.1f ms\n", worst);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    if (g_fout && (g_fout != stdout))
+        fclose(g_fout);
+    if (g_fin && (g_fin != stdin))
+        fclose(g_fin);
+    return 0;
+}
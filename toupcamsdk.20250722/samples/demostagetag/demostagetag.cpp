@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../stagetrack.h"
+
+/*
+    Tags every frame with the stage position at the middle of its exposure.
+    usage: demostagetag [out.csv = demostagetag.csv]
+    Stands in for the serial worker of the application: every line "x y z" typed (or piped) on stdin is a stage sample
+    at the time it is read. The frames are tagged from the StageTrack (stagetrack.h) in the callback and written to the
+    csv as seq, timestamp, host time, x, y, z; the frames outside the samples are written without position.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+StageTrack g_track;
+FrameClock g_clock;
+FILE* g_fp = NULL;
+unsigned g_total = 0, g_tagged = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const long long tArrival = HostMicroseconds();
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const long long t = g_clock.frameTime(info, tArrival);
+            StageSample pos;
+            ++g_total;
+            if (g_track.at(t, &pos))
+            {
+                ++g_tagged;
+                fprintf(g_fp, "%u,%llu,%lld,%.4f,%.4f,%.4f\n", info.v3.seq, info.v3.timestamp, t, pos.x, pos.y, pos.z);
+            }
+            else
+                fprintf(g_fp, "%u,%llu,%lld,,,\n", info.v3.seq, info.v3.timestamp, t);
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* filename = (argc > 1) ? argv[1] : "demostagetag.csv";
+    g_fp = fopen(filename, "w");
+    if (NULL == g_fp)
+    {
+        printf("failed to create %s\n", filename);
+        return -1;
+    }
+    fprintf(g_fp, "seq,timestamp,host_us,x,y,z\n");
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        fclose(g_fp);
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("\"x y z\" for a stage sample, 'x' to exit\n");
+                do {
+                    char str[1024];
+                    if (NULL == fgets(str, 1023, stdin))
+                        break;
+                    if (('x' == str[0]) || ('X' == str[0]))
+                        break;
+                    double x = 0.0, y = 0.0, z = 0.0;
+                    if (3 == sscanf(str, "%lf %lf %lf", &x, &y, &z))
+                        g_track.push(HostMicroseconds(), x, y, z);
+                } while (true);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    printf("frames = %u, tagged = %u, saved to %s\n", g_total, g_tagged, filename);
+    fclose(g_fp);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
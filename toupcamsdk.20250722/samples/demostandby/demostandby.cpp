@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include "toupcam.h"
+#include "../camstandby.h"
+
+/*
+    A timelapse with the camera in standby between the points (samples/camstandby.h): a wake once at the start
+    measures the time to the first valid frame, then each point wakes the camera leadTime() before it, takes the first
+    valid frame at or after the point and puts the camera back in standby. Per point: the lead it was woken with, the
+    wake to the first valid frame, and the frame taken, late by how much after the point; with
+    TOUPCAM_OPTION_POWER the power in standby and streaming.
+    usage: demostandby [points, default 10] [interval s, default 5] [level: 0 pause, 1 low power, 2 stop, default 1]
+*/
+typedef std::chrono::steady_clock Clock;
+
+HToupcam g_hcam = NULL;
+CamStandby* g_standby = NULL;
+void* g_pImageData = NULL;
+std::mutex g_mtx;
+std::condition_variable g_cv;
+Clock::time_point g_tPoint;         /* the frame of the point: the first valid one at or after it */
+bool g_bWant = false, g_bTaken = false;
+double g_late = 0.0;
+unsigned g_seq = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);  /* always pulled */
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else if (g_standby->onFrame())
+        {
+            const Clock::time_point t = Clock::now();
+            std::lock_guard<std::mutex> lock(g_mtx);
+            if (g_bWant && (t >= g_tPoint))
+            {
+                g_bWant = false;
+                g_bTaken = true;
+                g_late = std::chrono::duration<double, std::milli>(t - g_tPoint).count();
+                g_seq = info.v3.seq;
+                g_cv.notify_all();
+            }
+        }
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static HRESULT Start()
+{
+    return Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+}
+
+static int Power()
+{
+    int mw = -1;
+    if (FAILED(Toupcam_get_Option(g_hcam, TOUPCAM_OPTION_POWER, &mw)))
+        return -1;
+    return mw;
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned points = (argc > 1) ? (unsigned)atoi(argv[1]) : 10;
+    const double interval = (argc > 2) ? atof(argv[2]) : 5.0;
+    const int level = (argc > 3) ? atoi(argv[3]) : CAMSTANDBY_LOWPOWER;
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+    g_standby = new CamStandby(g_hcam, 1, Start);
+
+    hr = Start();
+    if (FAILED(hr))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        const int mwStreaming = Power();
+        /* the calibration: one standby and one wake */
+        int reached = level;
+        hr = g_standby->standby(level, &reached);
+        if (SUCCEEDED(hr))
+            hr = g_standby->wake();
+        if (FAILED(hr) || (!g_standby->waitValid(10000)))
+            printf("failed to calibrate the wake, hr = 0x%08x\n", hr);
+        else
+        {
+            printf("%d x %d, standby level %d (asked %d), wake %.0f ms, lead %.0f ms\n", nWidth, nHeight, reached, level, g_standby->lastWake(), g_standby->leadTime());
+            int mwStandby = -1;
+            const Clock::time_point t0 = Clock::now();
+            for (unsigned i = 0; i < points; ++i)
+            {
+                g_standby->standby(level);
+                if (0 == i)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                    mwStandby = Power();
+                }
+                const Clock::time_point tPoint = t0 + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval * (i + 1)));
+                const double lead = g_standby->leadTime();
+                std::this_thread::sleep_until(tPoint - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(lead)));
+                {
+                    std::lock_guard<std::mutex> lock(g_mtx);
+                    g_tPoint = tPoint;
+                    g_bWant = true;
+                    g_bTaken = false;
+                }
+                hr = g_standby->wake();
+                if (FAILED(hr))
+                {
+                    printf("failed to wake, hr = 0x%08x\n", hr);
+                    break;
+                }
+                std::unique_lock<std::mutex> lock(g_mtx);
+                if (!g_cv.wait_for(lock, std::chrono::milliseconds(10000), [] { return g_bTaken; }))
+                {
+                    g_bWant = false;
+                    lock.unlock();
+                    printf("point %u: no valid frame\n", i + 1);
+                    continue;
+                }
+                const double late = g_late;
+                const unsigned seq = g_seq;
+                lock.unlock();
+                printf("point %u: lead %.0f ms, wake %.0f ms, frame seq %u, late %.0f ms\n", i + 1, lead, g_standby->lastWake(), seq, late);
+            }
+            if (mwStreaming >= 0)
+                printf("power: streaming %d mW, standby %d mW\n", mwStreaming, mwStandby);
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    delete g_standby;
+    free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "toupcam.h"
+
+/*
+    One call to collect all the pipeline counters which otherwise are separate Toupcam_get_Option reads.
+    The reads are issued back-to-back and the snapshot is stamped with the host time before and after, so a
+    monitor polling at 10 Hz can tell how consistent each snapshot is (span) and correlate drops with load.
+    Callback time and bytes pulled are measured by this sample's own callback. The counters are cumulative, the
+    averages of an interval come from the difference of two snapshots; the maximum callback time is reset only by
+    the snapshots which end an interval (bResetMax), not by every poll.
+*/
+typedef struct {
+    long long timestamp;        /* host time in microseconds when the snapshot was started */
+    unsigned span;              /* microseconds taken to read all the counters */
+    int dropFrame;              /* TOUPCAM_OPTION_NUMBER_DROP_FRAME */
+    int frontendCurrent;        /* TOUPCAM_OPTION_FRONTEND_DEQUE_CURRENT */
+    int backendCurrent;         /* TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT */
+    int frontendFull;           /* TOUPCAM_OPTION_FRONTEND_FULL */
+    int backendFull;            /* TOUPCAM_OPTION_BACKEND_FULL */
+    int packetNumber;           /* TOUPCAM_OPTION_PACKET_NUMBER */
+    unsigned nFrame, nTime, nTotalFrame;    /* Toupcam_get_FrameRate */
+    unsigned long long bytes;   /* bytes pulled by the application */
+    unsigned callbackCount;
+    unsigned long long callbackSum;     /* microseconds */
+    unsigned callbackMax;       /* microseconds, since the previous snapshot with bResetMax */
+} ToupcamStats;
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+static std::atomic<unsigned long long> g_bytes(0), g_callbackSum(0);
+static std::atomic<unsigned> g_callbackCount(0), g_callbackMax(0);
+static std::atomic<bool> g_bStop(false);
+
+static long long HostMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static HRESULT GetStatistics(HToupcam h, ToupcamStats* pStats, bool bResetMax)
+{
+    memset(pStats, 0, sizeof(ToupcamStats));
+    pStats->timestamp = HostMicroseconds();
+    HRESULT hr = Toupcam_get_FrameRate(h, &pStats->nFrame, &pStats->nTime, &pStats->nTotalFrame);
+    if (FAILED(hr))
+        return hr;
+    /* not every camera supports every counter, these are left 0 */
+    Toupcam_get_Option(h, TOUPCAM_OPTION_NUMBER_DROP_FRAME, &pStats->dropFrame);
+    Toupcam_get_Option(h, TOUPCAM_OPTION_FRONTEND_DEQUE_CURRENT, &pStats->frontendCurrent);
+    Toupcam_get_Option(h, TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT, &pStats->backendCurrent);
+    Toupcam_get_Option(h, TOUPCAM_OPTION_FRONTEND_FULL, &pStats->frontendFull);
+    Toupcam_get_Option(h, TOUPCAM_OPTION_BACKEND_FULL, &pStats->backendFull);
+    Toupcam_get_Option(h, TOUPCAM_OPTION_PACKET_NUMBER, &pStats->packetNumber);
+    pStats->bytes = g_bytes;
+    pStats->callbackCount = g_callbackCount;
+    pStats->callbackSum = g_callbackSum;
+    pStats->callbackMax = bResetMax ? g_callbackMax.exchange(0) : g_callbackMax.load();
+    pStats->span = (unsigned)(HostMicroseconds() - pStats->timestamp);
+    return 0;
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const long long t0 = HostMicroseconds();
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            /* After we get the image data, we can do anything for the data we want to do */
+            g_bytes += TDIBWIDTHBYTES(24 * info.v3.width) * info.v3.height;
+        }
+        const unsigned us = (unsigned)(HostMicroseconds() - t0);
+        g_callbackSum += us;
+        ++g_callbackCount;
+        unsigned cur = g_callbackMax;
+        while ((us > cur) && !g_callbackMax.compare_exchange_weak(cur, us))
+            ;
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+/* poll at 10 Hz, print once per second */
+static void MonitorThread()
+{
+    ToupcamStats prev = { 0 }, cur;
+    unsigned n = 0;
+    while (!g_bStop)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const bool bPrint = (0 == ((n + 1) % 10));
+        if (FAILED(GetStatistics(g_hcam, &cur, bPrint)))
+            continue;
+        ++n;
+        if (bPrint && prev.timestamp)
+        {
+            const double sec = (cur.timestamp - prev.timestamp) / 1000000.0;
+            const unsigned count = cur.callbackCount - prev.callbackCount;
+            const unsigned avg = count ? (unsigned)((cur.callbackSum - prev.callbackSum) / count) : 0;
+            printf("fps = %.1f, MB/s = %.1f, drop = %d (+%d), deque = %d/%d, full = %d/%d, packets = %d, callback avg = %u us, max = %u us, span = %u us\n",
+                cur.nTime ? (cur.nFrame * 1000.0 / cur.nTime) : 0.0, (cur.bytes - prev.bytes) / sec / 1048576.0, cur.dropFrame, cur.dropFrame - prev.dropFrame,
+                cur.frontendCurrent, cur.backendCurrent, cur.frontendFull, cur.backendFull, cur.packetNumber, avg, cur.callbackMax, cur.span);
+        }
+        if (bPrint)
+            prev = cur;
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                std::thread monitor(MonitorThread);
+                printf("press ENTER to exit\n");
+                getc(stdin);
+                g_bStop = true;
+                monitor.join();
+            }
+        }
+    }
+    
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
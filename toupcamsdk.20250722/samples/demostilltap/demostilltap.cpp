@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "toupcam.h"
+#include "../stilltap.h"
+
+/*
+    Full resolution stills while a binned preview runs on (samples/stilltap.h), instead of Toupcam_SnapR with a still
+    resolution, which reconfigures the sensor: the camera runs at its full resolution (RAW), the preview is binned on
+    the host, a still is one of the frames of the stream, written by a thread of its own. Per still: the id, the seq
+    of its frame, the time from the request to the file written and the previews shown meanwhile, which go on at the
+    frame rate. On cameras with TOUPCAM_FLAG_DDR the DDR buffers two frames, so the write does not drop frames.
+    usage: demostilltap [bin, 2 ... 8, default 4]
+    then: Enter or 'l' the newest frame (no shutter lag), 'n' the next frame, 'x' exit
+*/
+HToupcam g_hcam = NULL;
+StillTap* g_tap = NULL;
+std::chrono::steady_clock::time_point g_tRequest[64];
+double g_previewMean = 0.0;
+
+static void SaveRaw(const char* filename, const void* pData, unsigned length)
+{
+    FILE* fp = fopen(filename, "wb");
+    if (fp)
+    {
+        fwrite(pData, 1, length, fp);
+        fclose(fp);
+    }
+}
+
+/* on the thread of the event callback */
+static void Preview(void* ctx, const unsigned short* data, unsigned width, unsigned height, const ToupcamFrameInfoV4& info)
+{
+    unsigned long long sum = 0;
+    for (unsigned i = 0; i < width * height; ++i)
+        sum += data[i];
+    g_previewMean = (double)sum / (width * height);
+}
+
+/* on the still thread */
+static void Still(void* ctx, unsigned id, const void* data, const ToupcamFrameInfoV4& info)
+{
+    const unsigned bytes = *(const unsigned*)ctx;
+    char filename[1024];
+    sprintf(filename, "demostilltap_%ux%u_%u.raw", info.v3.width, info.v3.height, id);
+    SaveRaw(filename, data, info.v3.width * info.v3.height * bytes);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - g_tRequest[id % 64]).count();
+    printf("still %u: seq %u, %u x %u, %.0f ms, previews %u, save: %s\n", id, info.v3.seq, info.v3.width, info.v3.height, ms, g_tap->previews(), filename);
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const HRESULT hr = g_tap->onImage();
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned bin = (argc > 1) ? (unsigned)atoi(argv[1]) : 4;
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    /* the full resolution all the time: index 0, RAW at the bit depth of the sensor */
+    Toupcam_put_eSize(g_hcam, 0);
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    const ToupcamModelV2* model = Toupcam_query_Model(g_hcam);
+    if (model->flag & TOUPCAM_FLAG_DDR)
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_DDR_DEPTH, 2);
+    unsigned fourcc = 0, bits = 8;
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_RawFormat(g_hcam, &fourcc, &bits);
+    if (SUCCEEDED(hr) && (bits > 8))
+        hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 1);
+    if (SUCCEEDED(hr))
+        hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    unsigned bytes = (bits > 8) ? 2 : 1;
+    g_tap = new StillTap(g_hcam, nWidth, nHeight, bits, (model->flag & TOUPCAM_FLAG_MONO) ? true : false, bin, 4, Preview, Still, &bytes);
+    if (0 == g_tap->previewWidth())
+    {
+        printf("bin %u out of 2 ... 8\n", bin);
+        delete g_tap;
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+
+    hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+    if (FAILED(hr))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("%d x %d, %u bits, preview %u x %u\n", nWidth, nHeight, bits, g_tap->previewWidth(), g_tap->previewHeight());
+        printf("press Enter or 'l' for a still of the newest frame, 'n' of the next frame, 'x' to exit\n");
+        do {
+            char str[1024];
+            if (!fgets(str, 1023, stdin))
+                break;
+            if (('x' == str[0]) || ('X' == str[0]))
+                break;
+            const std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+            const unsigned id = g_tap->requested() + 1;  /* one thread asks: the id capture() returns */
+            g_tRequest[id % 64] = t;
+            g_tap->capture(('n' != str[0]) && ('N' != str[0]));
+        } while (true);
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    g_tap->stop();
+    printf("stills %u of %u, previews %u, mean of the last one %.1f\n", g_tap->delivered(), g_tap->requested(), g_tap->previews(), g_previewMean);
+    delete g_tap;
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include "toupcam.h"
+#include "../taskgraph.h"
+#include "../hostffc.h"
+#include "../rawluma.h"
+
+/*
+    Processing chain as a task graph (samples/taskgraph.h): pull -> correct -> luma -> process -> encode -> save.
+        pull        the source: the RAW frame (8 bits) from the camera, one item per TOUPCAM_EVENT_IMAGE
+        correct     dark / flat field correction of hostffc.h when a reference file is given, 2 at a time
+        luma        grey of the RAW frame, half resolution (rawluma.h), as many at a time as the workers
+        process     holds the frame for the given time, standing for the EDF or the stitch; as many as the workers
+        encode      PGM in memory, 2 at a time
+        save        in the order of the frames, one at a time: the file written into the directory when one is given
+    Each second: the frame rate of the camera, frames out of the save node, and per node the items per second, the
+    average / maximum time in the node and on its input edge, the input queue and how often the node was held up by
+    a full output edge. When the process node cannot keep up, its input fills, luma and correct stop, the pull stops
+    and the frames drop in the deque of the camera: the graph holds items frames at most, whatever the rate.
+    usage: demotaskgraph [workers, default 4] [process ms per frame, default 100] [seconds, default 10]
+                         [reference file of hostffc.h, or -] [directory of the PGM files]
+*/
+struct Frame {
+    std::vector<unsigned char> raw, luma, file;
+    ToupcamFrameInfoV4 info;
+};
+
+typedef TaskGraph<Frame> Graph;
+
+HToupcam g_hcam = NULL;
+Graph* g_graph = NULL;
+HostFfc g_ffc;
+bool g_bFfc = false;
+unsigned g_fourcc = 0, g_workMs = 100;
+std::string g_dir;
+unsigned g_lastSeq = 0, g_nOutOfOrder = 0, g_nSaved = 0;
+bool g_bFirst = true;
+
+static int Pull(void* ctx, unsigned worker, Graph::Item* item)
+{
+    Frame& f = item->data;
+    memset(&f.info, 0, sizeof(f.info));
+    if (FAILED(Toupcam_PullImageV4(g_hcam, &f.raw[0], 0, 0, 0, &f.info)))
+        return TASKGRAPH_END;   /* dropped by the SDK meanwhile */
+    return 0;
+}
+
+static int Correct(void* ctx, unsigned worker, Graph::Item* item)
+{
+    if (g_bFfc)
+        g_ffc.apply(&item->data.raw[0], &item->data.raw[0]);
+    return 0;
+}
+
+static int Luma(void* ctx, unsigned worker, Graph::Item* item)
+{
+    Frame& f = item->data;
+    const unsigned w = f.info.v3.width / 2;
+    if (!RawLuma(RAWLUMA_HALF_SUM, g_fourcc, 8, &f.raw[0], f.info.v3.width, f.info.v3.width, f.info.v3.height, 8, 0, &f.luma[0], w))
+        return TASKGRAPH_END;
+    return 0;
+}
+
+static int Process(void* ctx, unsigned worker, Graph::Item* item)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(g_workMs));
+    return 0;
+}
+
+static int Encode(void* ctx, unsigned worker, Graph::Item* item)
+{
+    Frame& f = item->data;
+    const unsigned w = f.info.v3.width / 2, h = f.info.v3.height / 2;
+    char header[64];
+    const int n = sprintf(header, "P5\n%u %u\n255\n", w, h);
+    f.file.resize(n + (size_t)w * h);   /* the same size every frame: no allocation after the first */
+    memcpy(&f.file[0], header, n);
+    memcpy(&f.file[n], &f.luma[0], (size_t)w * h);
+    return 0;
+}
+
+/* ordered, one at a time: no lock for the globals it updates */
+static int Save(void* ctx, unsigned worker, Graph::Item* item)
+{
+    const Frame& f = item->data;
+    if ((!g_bFirst) && ((int)(f.info.v3.seq - g_lastSeq) <= 0))
+        ++g_nOutOfOrder;
+    g_bFirst = false;
+    g_lastSeq = f.info.v3.seq;
+    if (!g_dir.empty())
+    {
+        char name[64];
+        sprintf(name, "/%08u.pgm", f.info.v3.seq);
+        FILE* fp = fopen((g_dir + name).c_str(), "wb");
+        if (fp)
+        {
+            fwrite(&f.file[0], 1, f.file.size(), fp);
+            fclose(fp);
+        }
+    }
+    ++g_nSaved;
+    return TASKGRAPH_END;
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+        g_graph->signal();
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static void PrintStats()
+{
+    for (unsigned n = 0; n < g_graph->nodes(); ++n)
+    {
+        const TaskNodeStats s = g_graph->stats(n);
+        printf("    %-8s x%u %6.1f/s, %7.1f ms (max %7.1f), wait %7.1f ms (max %7.1f), queue %u (peak %u), blocked %llu\n",
+            s.name, s.concurrency, s.rate, s.avgMs, s.maxMs, s.avgWaitMs, s.maxWaitMs, s.queued, s.peakQueued, s.blocked);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned workers = (argc > 1) ? (unsigned)atoi(argv[1]) : 4;
+    g_workMs = (argc > 2) ? (unsigned)atoi(argv[2]) : 100;
+    const unsigned seconds = (argc > 3) ? (unsigned)atoi(argv[3]) : 10;
+    const char* ffc = ((argc > 4) && strcmp(argv[4], "-")) ? argv[4] : NULL;
+    if (argc > 5)
+        g_dir = argv[5];
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+    Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 0);
+    int nWidth = 0, nHeight = 0;
+    unsigned nBitDepth = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (SUCCEEDED(hr))
+        hr = Toupcam_get_RawFormat(g_hcam, &g_fourcc, &nBitDepth);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        return -1;
+    }
+    if (ffc)
+    {
+        g_bFfc = g_ffc.load(ffc) && (g_ffc.width() == (unsigned)nWidth) && (g_ffc.height() == (unsigned)nHeight) && (8 == g_ffc.bitdepth());
+        if (!g_bFfc)
+            printf("%s: no reference of %d x %d, 8 bits, not corrected\n", ffc, nWidth, nHeight);
+    }
+
+    g_graph = new Graph(workers + 4, workers);
+    for (unsigned i = 0; i < g_graph->items(); ++i)
+    {
+        g_graph->item(i)->data.raw.resize((size_t)nWidth * nHeight);
+        g_graph->item(i)->data.luma.resize((size_t)(nWidth / 2) * (nHeight / 2));
+    }
+    const int nPull = g_graph->addSource("pull", Pull, NULL);
+    const int nCorrect = g_graph->addNode("correct", Correct, NULL, 2);
+    const int nLuma = g_graph->addNode("luma", Luma, NULL, 0);
+    const int nProcess = g_graph->addNode("process", Process, NULL, 0);
+    const int nEncode = g_graph->addNode("encode", Encode, NULL, 2);
+    const int nSave = g_graph->addNode("save", Save, NULL, 1, true);
+    g_graph->connect(nPull, nCorrect, 2);
+    g_graph->connect(nCorrect, nLuma, 2);
+    g_graph->connect(nLuma, nProcess, 2);
+    g_graph->connect(nProcess, nEncode, 2);
+    g_graph->connect(nEncode, nSave, 2);
+    g_graph->start();
+
+    hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+    if (FAILED(hr))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        printf("%u workers, %u items, processing %u ms per frame\n", g_graph->workers(), g_graph->items(), g_workMs);
+        for (unsigned t = 1; t <= seconds; ++t)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            unsigned nFrame = 0, nTime = 0, nTotal = 0;
+            Toupcam_get_FrameRate(g_hcam, &nFrame, &nTime, &nTotal);
+            printf("%3u s: camera %5.1f fps, saved %llu, in the graph %u\n",
+                t, nTime ? (nFrame * 1000.0 / nTime) : 0.0, g_graph->stats(nSave).items, g_graph->active());
+            PrintStats();
+        }
+    }
+
+    /* cleanup */
+    g_graph->stopSource();
+    g_graph->drain();           /* no pull running: the camera can go */
+    Toupcam_Close(g_hcam);
+    g_graph->stop();
+    printf("saved %u, out of order %u\n", g_nSaved, g_nOutOfOrder);
+    PrintStats();
+    delete g_graph;
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timedtrigger.h"
+
+/*
+    Shots at scheduled instants, such as the end of the stage moves of a raster scan.
+    usage: demotimed
+    Enter "n period_ms [lead_ms = 100]" to schedule n shots period_ms apart, the first one lead_ms from now. For every
+    frame the scheduled instant and the actual exposure start (gps.utcstart) are printed, with their difference.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+TimedTrigger* g_pTimed = NULL;
+long long g_maxLate = 0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const std::deque<TimedShot> done = g_pTimed->onFrame(info);
+            for (size_t i = 0; i < done.size(); ++i)
+            {
+                if (done[i].bMissed)
+                    printf("shot %u: missed\n", done[i].index);
+                else if (0 == done[i].start)
+                    printf("shot %u: seq = %u, no exposure start in the frame info\n", done[i].index, info.v3.seq);
+                else
+                {
+                    const long long late = (long long)(done[i].start - done[i].scheduled);
+                    if (late > g_maxLate)
+                        g_maxLate = late;
+                    printf("shot %u: seq = %u, scheduled = %llu, start = %llu, late = %lld us\n", done[i].index, info.v3.seq, done[i].scheduled, done[i].start, late / 1000);
+                }
+            }
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int, char**)
+{
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        g_pTimed = new TimedTrigger(g_hcam);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_TRIGGER, 1);
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                printf("'x' to exit, \"n period_ms [lead_ms]\" to schedule\n");
+                do {
+                    char str[1024];
+                    if (fgets(str, 1023, stdin))
+                    {
+                        if (('x' == str[0]) || ('X' == str[0]))
+                            break;
+                        unsigned n = 0, period = 0, lead = 100;
+                        if (sscanf(str, "%u %u %u", &n, &period, &lead) >= 2)
+                        {
+                            const unsigned long long t0 = TimedTrigger::now() + lead * 1000000ULL;
+                            for (unsigned i = 0; i < n; ++i)
+                            {
+                                hr = g_pTimed->schedule(t0 + i * period * 1000000ULL);
+                                if (FAILED(hr))
+                                {
+                                    printf("failed to arm the timed trigger, hr = 0x%08x\n", hr);
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                } while (true);
+                printf("pending = %u, missed = %u, max late = %lld us\n", g_pTimed->pending(), g_pTimed->missed(), g_maxLate / 1000);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    delete g_pTimed;
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#ifndef __timedtrigger_H__
+#define __timedtrigger_H__
+
+/*
+    Capture at scheduled instants with the timed trigger (TOUPCAM_OPTION_TIMED_TRIGGER_LOW/HIGH, nanosecond since
+    epoch, on the cameras whose clock is synchronized to UTC, such as the GigE cameras with PTP).
+    schedule() queues absolute instants, scheduleIn() instants relative to now; the queue is kept in order and the
+    earliest instant is armed on the camera, which must be in trigger mode (TOUPCAM_OPTION_TRIGGER = 1). Call onFrame()
+    with the frame info of every frame pulled: it pairs the frame with the armed instant, reports the actual exposure
+    start (gps.utcstart, when the frame has TOUPCAM_FRAMEINFO_FLAG_GPS) and arms the next instant at once, so the shots
+    follow each other back to back and the caller can plan the next stage move from the reported start.
+    One instant is armed at a time: an instant which is already past, or closer than TIMEDTRIGGER_LEAD_NS, when its turn
+    comes is not armed but reported as missed.
+*/
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string.h>
+#include "toupcam.h"
+
+#define TIMEDTRIGGER_LEAD_NS    1000000ULL  /* the camera needs the instant at least this long before it */
+
+typedef struct {
+    unsigned index;                 /* in the order of schedule() */
+    unsigned long long scheduled;   /* ns since epoch */
+    unsigned long long start;       /* actual exposure start, 0 when the frame has no gps.utcstart */
+    bool bMissed;
+} TimedShot;
+
+class TimedTrigger {
+    HToupcam m_hcam;
+    std::deque<TimedShot> m_queue;
+    TimedShot m_armed;
+    bool m_bArmed;
+    unsigned m_nIndex, m_nMissed;
+    std::mutex m_mtx;
+
+    /* with m_mtx held; the missed ones are left in pMissed (may be NULL) */
+    HRESULT armNext(std::deque<TimedShot>* pMissed)
+    {
+        while ((!m_bArmed) && (!m_queue.empty()))
+        {
+            TimedShot shot = m_queue.front();
+            m_queue.pop_front();
+            if (shot.scheduled < now() + TIMEDTRIGGER_LEAD_NS)
+            {
+                shot.bMissed = true;
+                ++m_nMissed;
+                if (pMissed)
+                    pMissed->push_back(shot);
+                continue;
+            }
+            HRESULT hr = Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_TIMED_TRIGGER_LOW, (int)(shot.scheduled & 0xffffffff));
+            if (SUCCEEDED(hr))
+                hr = Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_TIMED_TRIGGER_HIGH, (int)(shot.scheduled >> 32));
+            if (FAILED(hr))
+            {
+                m_queue.push_front(shot);
+                return hr;
+            }
+            m_armed = shot;
+            m_bArmed = true;
+        }
+        return 0;  /* S_OK */
+    }
+public:
+    TimedTrigger(HToupcam h)
+    : m_hcam(h), m_bArmed(false), m_nIndex(0), m_nMissed(0)
+    {
+        memset(&m_armed, 0, sizeof(m_armed));
+    }
+
+    /* the clock of the timed trigger: UTC, nanosecond since epoch */
+    static unsigned long long now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    HRESULT schedule(unsigned long long ns)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        TimedShot shot = { m_nIndex++, ns, 0, false };
+        std::deque<TimedShot>::iterator it = m_queue.begin();
+        while ((it != m_queue.end()) && (it->scheduled <= ns))
+            ++it;
+        m_queue.insert(it, shot);
+        return armNext(NULL);
+    }
+
+    HRESULT scheduleIn(unsigned long long offsetNs)
+    {
+        return schedule(now() + offsetNs);
+    }
+
+    /*
+        Call for every frame pulled, returns the shots completed by this frame: the one it belongs to, if any, and
+        those missed meanwhile, in order. The frame is taken as the armed shot, the camera producing frames only on
+        the trigger.
+    */
+    std::deque<TimedShot> onFrame(const ToupcamFrameInfoV4& info)
+    {
+        std::deque<TimedShot> done;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_bArmed)
+        {
+            m_armed.start = (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_GPS) ? info.gps.utcstart : 0;
+            done.push_back(m_armed);
+            m_bArmed = false;
+        }
+        armNext(&done);
+        return done;
+    }
+
+    /* drops the shots not fired yet; the one armed on the camera may still fire */
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_queue.clear();
+        m_bArmed = false;
+    }
+
+    unsigned pending()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return (unsigned)m_queue.size() + (m_bArmed ? 1 : 0);
+    }
+    unsigned missed()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_nMissed;
+    }
+};
+
+#endif
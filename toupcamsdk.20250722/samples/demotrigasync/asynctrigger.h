@@ -0,0 +1,200 @@
+#ifndef __asynctrigger_H__
+#define __asynctrigger_H__
+
+/*
+    Toupcam_TriggerSyncV4 without the blocking call: trigger() returns at once, the frame is pulled into the caller's
+    buffer from the event callback and the completion is signaled on a waitable object, an eventfd on Linux (a pipe
+    on macOS) or a manual-reset event on Windows. One control thread can wait on the waitable() of several cameras
+    together with its other descriptors (the serial link of the stage, a socket) in one poll/epoll/select, or
+    WaitForMultipleObjects / RegisterWaitForSingleObject on Windows, then call complete() on the ones signaled.
+    AsyncTrigger starts the camera itself (software trigger mode, its own event callback). One trigger is in flight
+    per camera at a time, as with TriggerSync; trigger() returns E_PENDING while the last one is not completed.
+    check() times a request out after its deadline: it cancels the trigger (Toupcam_Trigger(h, 0)) and completes it
+    with E_TIMEOUT, call it when the wait of the control thread expires.
+*/
+#include <string.h>
+#include <mutex>
+#include <chrono>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#endif
+#include "toupcam.h"
+
+#if defined(_WIN32)
+typedef HANDLE ASYNCTRIGGER_WAITABLE;
+#else
+typedef int ASYNCTRIGGER_WAITABLE;
+#endif
+
+class AsyncTrigger {
+    HToupcam m_hcam;
+    void* m_pImageData;
+    int m_bits, m_rowPitch;
+    unsigned m_nWaitMs;
+    std::chrono::steady_clock::time_point m_deadline;
+    bool m_bBusy, m_bDone;
+    HRESULT m_hr;
+    ToupcamFrameInfoV4 m_info;
+    std::mutex m_mtx;
+#if defined(_WIN32)
+    HANDLE m_hEvent;
+#else
+    int m_fd[2];    /* eventfd: both the same */
+#endif
+
+    void signal()
+    {
+#if defined(_WIN32)
+        SetEvent(m_hEvent);
+#else
+        const unsigned long long one = 1;
+        (void)write(m_fd[1], &one, (m_fd[0] == m_fd[1]) ? sizeof(one) : 1);
+#endif
+    }
+
+    void unsignal()
+    {
+#if defined(_WIN32)
+        ResetEvent(m_hEvent);
+#else
+        unsigned long long value;
+        while (read(m_fd[0], &value, sizeof(value)) > 0)
+            ;
+#endif
+    }
+
+    /* with m_mtx held */
+    void finish(HRESULT hr)
+    {
+        m_hr = hr;
+        m_bDone = true;
+        signal();
+    }
+
+    static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+    {
+        AsyncTrigger* pThis = (AsyncTrigger*)pCallbackCtx;
+        std::lock_guard<std::mutex> lock(pThis->m_mtx);
+        if ((!pThis->m_bBusy) || pThis->m_bDone)
+            return;
+        if (TOUPCAM_EVENT_IMAGE == nEvent)
+            pThis->finish(Toupcam_PullImageV4(pThis->m_hcam, pThis->m_pImageData, 0, pThis->m_bits, pThis->m_rowPitch, &pThis->m_info));
+        else if (TOUPCAM_EVENT_TRIGGERFAIL == nEvent)
+            pThis->finish(0x80004005 /* E_FAIL */);
+        else if ((TOUPCAM_EVENT_ERROR == nEvent) || (TOUPCAM_EVENT_DISCONNECTED == nEvent))
+            pThis->finish(0x8007001f /* E_GEN_FAILURE */);
+    }
+public:
+    /* nWaitMs: as Toupcam_TriggerSyncV4, 0 = exposure * 102% + 4000 ms */
+    AsyncTrigger(HToupcam h, unsigned nWaitMs = 0)
+    : m_hcam(h), m_pImageData(NULL), m_bits(24), m_rowPitch(0), m_nWaitMs(nWaitMs), m_bBusy(false), m_bDone(false), m_hr(0)
+    {
+        memset(&m_info, 0, sizeof(m_info));
+#if defined(_WIN32)
+        m_hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+#elif defined(__linux__)
+        m_fd[0] = m_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+        if (0 == pipe(m_fd))
+        {
+            fcntl(m_fd[0], F_SETFL, O_NONBLOCK);
+            fcntl(m_fd[1], F_SETFL, O_NONBLOCK);
+        }
+        else
+            m_fd[0] = m_fd[1] = -1;
+#endif
+    }
+
+    /* call Toupcam_Stop or Toupcam_Close first */
+    ~AsyncTrigger()
+    {
+#if defined(_WIN32)
+        CloseHandle(m_hEvent);
+#else
+        if (m_fd[1] != m_fd[0])
+            ::close(m_fd[1]);
+        ::close(m_fd[0]);
+#endif
+    }
+
+    HRESULT start()
+    {
+        Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_TRIGGER, 1);
+        return Toupcam_StartPullModeWithCallback(m_hcam, EventCallback, this);
+    }
+
+    ASYNCTRIGGER_WAITABLE waitable() const
+    {
+#if defined(_WIN32)
+        return m_hEvent;
+#else
+        return m_fd[0];
+#endif
+    }
+
+    /* pImageData, bits, rowPitch: as Toupcam_PullImageV4, the buffer must stay valid until complete() */
+    HRESULT trigger(void* pImageData, int bits, int rowPitch)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_bBusy)
+            return 0x8000000a;  /* E_PENDING */
+        m_pImageData = pImageData;
+        m_bits = bits;
+        m_rowPitch = rowPitch;
+        unsigned nWaitMs = m_nWaitMs;
+        if (0 == nWaitMs)
+        {
+            unsigned expotime = 0;
+            Toupcam_get_ExpoTime(m_hcam, &expotime);
+            nWaitMs = (unsigned)(expotime * 1.02 / 1000) + 4000;
+        }
+        m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nWaitMs);
+        m_bDone = false;
+        const HRESULT hr = Toupcam_Trigger(m_hcam, 1);
+        if (SUCCEEDED(hr))
+            m_bBusy = true;
+        return hr;
+    }
+
+    /* times out the request past its deadline, returns true when it did */
+    bool check()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if ((!m_bBusy) || m_bDone || (std::chrono::steady_clock::now() < m_deadline))
+            return false;
+        Toupcam_Trigger(m_hcam, 0);
+        finish(0x8001011f); /* E_TIMEOUT */
+        return true;
+    }
+
+    /* milliseconds until the deadline of the request in flight, -1 when there is none: the timeout of the wait */
+    int remaining()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if ((!m_bBusy) || m_bDone)
+            return -1;
+        const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(m_deadline - std::chrono::steady_clock::now()).count();
+        return (ms > 0) ? (int)ms : 0;
+    }
+
+    /* E_PENDING while not completed, otherwise the result of the request (as Toupcam_TriggerSyncV4) and the camera is free again */
+    HRESULT complete(ToupcamFrameInfoV4* pInfo)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if ((!m_bBusy) || (!m_bDone))
+            return 0x8000000a;  /* E_PENDING */
+        unsignal();
+        m_bBusy = m_bDone = false;
+        if (pInfo)
+            *pInfo = m_info;
+        return m_hr;
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+#include "asynctrigger.h"
+
+/*
+    Several cameras triggered from one control thread, without a thread per blocking Toupcam_TriggerSync.
+    usage: demotrigasync [rounds = 10]
+    Every round triggers all the cameras enumerated at once through AsyncTrigger (asynctrigger.h), then waits for their
+    completions in one poll (WaitForMultipleObjects on Windows); a real control loop adds the descriptor of the serial
+    link of the stage to the same wait and issues the next move as soon as the last frame of the round is in.
+*/
+typedef struct {
+    HToupcam hcam;
+    AsyncTrigger* pTrigger;
+    void* data;
+    bool bBusy;
+} ctxCam;
+
+/* waits until at least one of the cameras is signaled or nTimeoutMs, -1 = infinite */
+static void WaitAny(const std::vector<ctxCam>& cams, int nTimeoutMs)
+{
+#if defined(_WIN32)
+    std::vector<HANDLE> handles;
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        if (cams[i].bBusy)
+            handles.push_back(cams[i].pTrigger->waitable());
+    }
+    if (!handles.empty())
+        WaitForMultipleObjects((DWORD)handles.size(), &handles[0], FALSE, (nTimeoutMs < 0) ? INFINITE : (DWORD)nTimeoutMs);
+#else
+    std::vector<pollfd> fds;
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        if (cams[i].bBusy)
+        {
+            pollfd fd = { cams[i].pTrigger->waitable(), POLLIN, 0 };
+            fds.push_back(fd);
+        }
+    }
+    if (!fds.empty())
+        poll(&fds[0], fds.size(), nTimeoutMs);
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned nRounds = (argc > 1) ? (unsigned)atoi(argv[1]) : 10;
+    ToupcamDeviceV2 arr[TOUPCAM_MAX] = { 0 };
+    const unsigned num = Toupcam_EnumV2(arr);
+    if (0 == num)
+    {
+        printf("no camera found\n");
+        return -1;
+    }
+
+    std::vector<ctxCam> cams;
+    for (unsigned i = 0; i < num; ++i)
+    {
+        ctxCam cam = { Toupcam_Open(arr[i].id), NULL, NULL, false };
+        int nWidth = 0, nHeight = 0;
+        HRESULT hr;
+        if (NULL == cam.hcam)
+            printf("%s: open failed\n", arr[i].id);
+        else if (FAILED(hr = Toupcam_get_Size(cam.hcam, &nWidth, &nHeight)))
+        {
+            printf("failed to get size, hr = 0x%08x\n", hr);
+            Toupcam_Close(cam.hcam);
+        }
+        else
+        {
+            Toupcam_put_AutoExpoEnable(cam.hcam, 0);
+            cam.data = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+            cam.pTrigger = new AsyncTrigger(cam.hcam);
+            if (NULL == cam.data)
+                printf("failed to malloc\n");
+            else if (FAILED(hr = cam.pTrigger->start()))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            cams.push_back(cam);
+        }
+    }
+
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    unsigned nOk = 0, nFailed = 0;
+    for (unsigned round = 0; round < nRounds; ++round)
+    {
+        for (size_t i = 0; i < cams.size(); ++i)
+        {
+            const HRESULT hr = cams[i].pTrigger->trigger(cams[i].data, 24, 0);
+            cams[i].bBusy = SUCCEEDED(hr);
+            if (FAILED(hr))
+                printf("camera %u: failed to trigger, hr = 0x%08x\n", (unsigned)i, hr);
+        }
+        /* the control thread is free here: start the next stage move, talk to the serial link, ... */
+        do {
+            int nTimeoutMs = -1;
+            for (size_t i = 0; i < cams.size(); ++i)
+            {
+                const int ms = cams[i].bBusy ? cams[i].pTrigger->remaining() : -1;
+                if ((ms >= 0) && ((nTimeoutMs < 0) || (ms < nTimeoutMs)))
+                    nTimeoutMs = ms;
+            }
+            bool bBusy = false;
+            for (size_t i = 0; i < cams.size(); ++i)
+                bBusy = bBusy || cams[i].bBusy;
+            if (!bBusy)
+                break;
+            WaitAny(cams, nTimeoutMs);
+            for (size_t i = 0; i < cams.size(); ++i)
+            {
+                if (!cams[i].bBusy)
+                    continue;
+                cams[i].pTrigger->check();
+                ToupcamFrameInfoV4 info = { 0 };
+                const HRESULT hr = cams[i].pTrigger->complete(&info);
+                if (0x8000000a /* E_PENDING */ == (unsigned)hr)
+                    continue;
+                cams[i].bBusy = false;
+                if (FAILED(hr))
+                {
+                    ++nFailed;
+                    printf("round %u, camera %u: failed, hr = 0x%08x\n", round, (unsigned)i, hr);
+                }
+                else
+                {
+                    ++nOk;
+                    /* After we get the image data, we can do anything for the data we want to do */
+                    printf("round %u, camera %u: seq = %u, res = %u x %u\n", round, (unsigned)i, info.v3.seq, info.v3.width, info.v3.height);
+                }
+            }
+        } while (true);
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("%u frames, %u failed, %.2f s\n", nOk, nFailed, sec);
+
+    /* cleanup */
+    for (size_t i = 0; i < cams.size(); ++i)
+    {
+        Toupcam_Close(cams[i].hcam);    /* no more callback after this */
+        delete cams[i].pTrigger;
+        if (cams[i].data)
+            free(cams[i].data);
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <atomic>
+#include "trigpipe.h"
+
+/*
+    Software trigger throughput with triggers kept in flight.
+    usage: demotrigpipe [frames = 100] [depth = 4]
+    Takes the frames once with one trigger at a time (depth 1, as demosofttrigger) and once through a TriggerPipe
+    (trigpipe.h) of the given depth, and prints the frame rate of both.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+std::atomic<TriggerPipe*> g_pPipe(NULL);   /* both pipes live until the camera is closed, a late frame never sees a deleted one */
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            TriggerPipe* pPipe = g_pPipe;
+            if (pPipe)
+                pPipe->onImage(info);
+        }
+    }
+    else if (TOUPCAM_EVENT_TRIGGERFAIL == nEvent)
+    {
+        TriggerPipe* pPipe = g_pPipe;
+        if (pPipe)
+            pPipe->onTriggerFail();
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+/* returns the frame rate, 0 on failure */
+static double Run(TriggerPipe* pPipe, unsigned nFrames)
+{
+    g_pPipe = pPipe;
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    unsigned nOk = 0, nFailed = 0;
+    HRESULT hr = pPipe->submit(nFrames, NULL);
+    if (FAILED(hr))
+        printf("failed to trigger, hr = 0x%08x\n", hr);
+    else
+    {
+        TriggerDone done;
+        while ((nOk + nFailed < nFrames) && pPipe->wait(&done, 5000))
+        {
+            if (done.bOk)
+                ++nOk;
+            else
+                ++nFailed;
+        }
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("depth %u: %u frames, %u failed or lost, %u pending, %.2f s, %.1f fps\n", pPipe->depth(), nOk, nFailed, pPipe->pending(), sec, (sec > 0) ? nOk / sec : 0.0);
+    g_pPipe = NULL;
+    return (sec > 0) ? nOk / sec : 0.0;
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned nFrames = (argc > 1) ? (unsigned)atoi(argv[1]) : 100;
+    const unsigned nDepth = (argc > 2) ? (unsigned)atoi(argv[2]) : 4;
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+    if ((Toupcam_query_Model(g_hcam)->flag & TOUPCAM_FLAG_TRIGGER_SOFTWARE) == 0)
+        printf("camera do NOT support software trigger, fallback to simulated trigger\n");
+
+    TriggerPipe *pipe1 = NULL, *pipeN = NULL;
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        pipe1 = new TriggerPipe(g_hcam, 1);
+        pipeN = new TriggerPipe(g_hcam, nDepth);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_TRIGGER, 1);
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                const double fps1 = Run(pipe1, nFrames);
+                const double fpsN = Run(pipeN, nFrames);
+                if (fps1 > 0)
+                    printf("speedup = %.2f\n", fpsN / fps1);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);  /* no more callback after this */
+    delete pipe1;
+    delete pipeN;
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
@@ -0,0 +1,150 @@
+#ifndef __trigpipe_H__
+#define __trigpipe_H__
+
+/*
+    Software triggers kept in flight, so the exposure of a frame overlaps the transfer of the last one.
+    submit() queues trigger requests and returns at once; the pipe issues Toupcam_Trigger for as many of them as fit
+    in the depth (at most the frontend deque length, TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH, less one, so the camera never
+    has to drop a triggered frame for lack of a buffer) and issues more as frames come back. Call onImage() after every
+    frame pulled and onTriggerFail() on TOUPCAM_EVENT_TRIGGERFAIL, both from the event callback.
+    Every request has a ticket, its ordinal since the first submit(); frames are matched to the tickets in order, and
+    with TOUPCAM_FRAMEINFO_FLAG_COUNT by tricount, so a trigger which produced no frame is reported as lost instead of
+    shifting all the frames after it. Completions are polled (poll) or waited for (wait); nothing blocks in between.
+*/
+#include <string.h>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "toupcam.h"
+
+typedef struct {
+    unsigned ticket;
+    bool bOk;               /* false: trigger failed or frame lost */
+    ToupcamFrameInfoV4 info;
+} TriggerDone;
+
+class TriggerPipe {
+    HToupcam m_hcam;
+    unsigned m_nDepth;
+    unsigned m_nNextTicket;     /* of the next submit */
+    unsigned m_nNextIssue;      /* ticket of the next trigger to issue */
+    unsigned m_nOldest;         /* oldest ticket in flight */
+    unsigned m_tricountBase;
+    bool m_bBase;
+    std::deque<TriggerDone> m_done;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+
+    /* with m_mtx held; the requests not issued stay queued */
+    HRESULT issue()
+    {
+        const unsigned n = std::min(m_nNextTicket - m_nNextIssue, m_nDepth - (m_nNextIssue - m_nOldest));
+        if (0 == n)
+            return 0;  /* S_OK */
+        const HRESULT hr = Toupcam_Trigger(m_hcam, (unsigned short)n);
+        if (SUCCEEDED(hr))
+            m_nNextIssue += n;
+        return hr;
+    }
+
+    /* with m_mtx held */
+    void complete(bool bOk, const ToupcamFrameInfoV4* pInfo)
+    {
+        TriggerDone done = { m_nOldest++, bOk };
+        if (pInfo)
+            done.info = *pInfo;
+        else
+            memset(&done.info, 0, sizeof(done.info));
+        m_done.push_back(done);
+    }
+public:
+    TriggerPipe(HToupcam h, unsigned nDepth)
+    : m_hcam(h), m_nDepth(1), m_nNextTicket(0), m_nNextIssue(0), m_nOldest(0), m_tricountBase(0), m_bBase(false)
+    {
+        int nDeque = 4;
+        Toupcam_get_Option(h, TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH, &nDeque);
+        m_nDepth = std::max(1u, std::min(nDepth, (unsigned)std::max(1, nDeque - 1)));
+    }
+
+    unsigned depth() const { return m_nDepth; }
+
+    /* pFirst: ticket of the first of the n requests; on failure the requests stay queued, a later submit retries */
+    HRESULT submit(unsigned n, unsigned* pFirst)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (pFirst)
+            *pFirst = m_nNextTicket;
+        m_nNextTicket += n;
+        return issue();
+    }
+
+    /* returns the ticket the frame completed */
+    unsigned onImage(const ToupcamFrameInfoV4& info)
+    {
+        unsigned ticket;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_nOldest == m_nNextIssue)
+                return (unsigned)-1;    /* not ours, such as a frame of a trigger issued outside the pipe */
+            if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_COUNT)
+            {
+                if (!m_bBase)
+                {
+                    m_tricountBase = info.tricount - m_nOldest;
+                    m_bBase = true;
+                }
+                const unsigned ordinal = info.tricount - m_tricountBase;
+                while ((m_nOldest < ordinal) && (m_nOldest + 1 < m_nNextIssue))
+                    complete(false, NULL);  /* lost */
+            }
+            ticket = m_nOldest;
+            complete(true, &info);
+            issue();
+        }
+        m_cv.notify_all();
+        return ticket;
+    }
+
+    void onTriggerFail()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_nOldest == m_nNextIssue)
+                return;
+            complete(false, NULL);  /* whether the camera counted it or not, the next frame still matches the next ticket */
+            issue();
+        }
+        m_cv.notify_all();
+    }
+
+    bool poll(TriggerDone* pDone)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_done.empty())
+            return false;
+        *pDone = m_done.front();
+        m_done.pop_front();
+        return true;
+    }
+
+    bool wait(TriggerDone* pDone, unsigned nTimeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (!m_cv.wait_for(lock, std::chrono::milliseconds(nTimeoutMs), [this] { return !m_done.empty(); }))
+            return false;
+        *pDone = m_done.front();
+        m_done.pop_front();
+        return true;
+    }
+
+    /* submitted, not completed yet */
+    unsigned pending()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_nNextTicket - m_nOldest;
+    }
+};
+
+#endif
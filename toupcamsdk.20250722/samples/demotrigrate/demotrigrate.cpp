@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "toupcam.h"
+#include "../trigrate.h"
+#include "../simcam/simcam.h"
+
+/*
+    Software triggers at the limit of the sensor (../trigrate.h).
+    usage: demotrigrate [max | keep] [queue | reject | none] [exposure time, us = 10000] [triggers = 200] [speed = 1.25]
+    max: IWR and no global reset where the camera has them, keep: the modes as they are. The triggers are sent at speed
+    times the maximum rate (the inverse of the minimum period): queue holds the early ones, reject refuses them (they
+    are not sent again), none sends them all straight to the camera, which loses the ones it is not ready for. The
+    report: the period and where it comes from, the triggers sent, the frames, the triggers without a frame.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+TrigRate g_rate;
+std::atomic<unsigned> g_frames(0);
+std::atomic<long long> g_tLast(0);  /* us since the first trigger, of the last frame */
+std::chrono::steady_clock::time_point g_t0;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 8, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            g_rate.onImage();
+            ++g_frames;
+            g_tLast = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_t0).count();
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const bool bMax = !((argc > 1) && (0 == strcmp(argv[1], "keep")));
+    const char* policy = (argc > 2) ? argv[2] : "queue";
+    const unsigned expoTime = (argc > 3) ? (unsigned)atoi(argv[3]) : 10000;
+    const unsigned total = (argc > 4) ? (unsigned)atoi(argv[4]) : 200;
+    const double speed = (argc > 5) ? atof(argv[5]) : 1.25;
+    const bool bGate = (0 != strcmp(policy, "none"));
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_TRIGGER, 1);
+    if (FAILED(hr))
+        printf("failed to set trigger mode, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_put_AutoExpoEnable(g_hcam, 0)) || FAILED(hr = Toupcam_put_ExpoTime(g_hcam, expoTime)))
+        printf("failed to set exposure time, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_get_FinalSize(g_hcam, &nWidth, &nHeight)))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else if (NULL == (g_pImageData = malloc(nWidth * nHeight)))
+        printf("failed to malloc\n");
+    else if (FAILED(hr = g_rate.init(g_hcam, bMax, (0 == strcmp(policy, "reject")) ? TRIGRATE_REJECT : TRIGRATE_QUEUE)))
+        printf("failed to init, hr = 0x%08x\n", hr);
+    else if (FAILED(hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL)))
+        printf("failed to start camera, hr = 0x%08x\n", hr);
+    else
+    {
+        const TrigRateInfo& info = g_rate.update();
+        printf("readout mode %d, global reset %d, cancel mode %d; camera period %u us, read time %u us, line time %u ns, exposure %u us\n",
+            info.readoutMode, info.globalReset, info.cancelMode, info.cameraPeriod, info.readTime, info.lineTime, info.expoTime);
+        printf("minimum trigger period %u us (%s), %.1f triggers per second at most\n", info.period, info.source, info.period ? (1e6 / info.period) : 0.0);
+        const unsigned interval = (unsigned)((info.period ? info.period : 33333) / speed);
+        unsigned sent = 0, refused = 0;
+        const std::chrono::steady_clock::time_point t0 = g_t0 = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < total; ++i)
+        {
+            std::this_thread::sleep_until(t0 + std::chrono::microseconds((long long)i * interval));
+            hr = bGate ? g_rate.trigger() : Toupcam_Trigger(g_hcam, 1);
+            if (0x8000000a == (unsigned)hr)
+                ++refused;
+            else if (FAILED(hr))
+                printf("failed to trigger, hr = 0x%08x\n", hr);
+            else
+                ++sent;
+        }
+        /* the queue emptied and the last frames in */
+        while (bGate && (g_rate.sent() + refused < total))
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::this_thread::sleep_for(std::chrono::milliseconds(info.period / 1000 * 4 + 500));
+        const double s = g_tLast / 1e6;
+        int lost = 0;
+        const bool bSim = SUCCEEDED(Toupcam_get_Option(g_hcam, SIMCAM_OPTION_TRIGGER_LOST, &lost));
+        printf("%u triggers asked at %.1f per second: %u accepted, %u refused, %u held; %u frames, %.1f fps, %u triggers without a frame",
+            total, 1e6 / interval, sent, refused, g_rate.held(), g_frames.load(), (s > 0) ? (g_frames / s) : 0.0, bGate ? g_rate.missing() : (sent - g_frames));
+        if (bSim)
+            printf(" (simcam: %d lost)", lost);
+        printf("\n");
+        g_rate.stop();
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    return 0;
+}
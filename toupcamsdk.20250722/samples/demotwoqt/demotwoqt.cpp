@@ -6,7 +6,7 @@ MainWidget::MainWidget(QWidget* parent)
 {
     setMinimumSize(1024, 768);
     memset(m_hcam, 0, sizeof(m_hcam));
-    memset(m_lbl_video, 0, sizeof(m_lbl_video));
+    memset(m_video, 0, sizeof(m_video));
     memset(m_lbl_frame, 0, sizeof(m_lbl_frame));
     memset(m_imgWidth, 0, sizeof(m_imgWidth));
     memset(m_imgHeight, 0, sizeof(m_imgHeight));
@@ -42,12 +42,12 @@ MainWidget::MainWidget(QWidget* parent)
         hlayout->addLayout(vlayout, 1);
     }
     {
-        m_lbl_video[0] = new QLabel();
-        m_lbl_video[1] = new QLabel();
+        m_video[0] = new GLPreview();
+        m_video[1] = new GLPreview();
 
         QVBoxLayout* v = new QVBoxLayout();
-        v->addWidget(m_lbl_video[0]);
-        v->addWidget(m_lbl_video[1]);
+        v->addWidget(m_video[0]);
+        v->addWidget(m_video[1]);
         hlayout->addLayout(v, 4);
     }
     setLayout(hlayout);
@@ -145,18 +145,23 @@ void MainWidget::eventCallBack(unsigned nEvent, void* pCallbackCtx)
 
 void MainWidget::handleImageEvent(int idx)
 {
-    unsigned width = 0, height = 0;
-    if (SUCCEEDED(Toupcam_PullImage(m_hcam[idx], m_pData[idx], 24, &width, &height)))
+    /* pulled straight into the pixel buffer of the preview, uploaded and scaled by the GPU */
+    unsigned pitch = 0;
+    uchar* p = m_video[idx]->beginFrame(m_imgWidth[idx], m_imgHeight[idx], &pitch);
+    ToupcamFrameInfoV4 info = { 0 };
+    if (p)
     {
-        QImage image(m_pData[idx], width, height, QImage::Format_RGB888);
-        QImage newimage = image.scaled(m_lbl_video[idx]->width(), m_lbl_video[idx]->height(), Qt::KeepAspectRatio, Qt::FastTransformation);
-        m_lbl_video[idx]->setPixmap(QPixmap::fromImage(newimage));
+        const HRESULT hr = Toupcam_PullImageV4(m_hcam[idx], p, 0, 24, pitch, &info);
+        m_video[idx]->endFrame(SUCCEEDED(hr) ? info.v3.width : 0, SUCCEEDED(hr) ? info.v3.height : 0);
     }
+    else
+        Toupcam_PullImageV4(m_hcam[idx], m_pData[idx], 0, 24, 0, &info);
 }
 
 int main(int argc, char* argv[])
 {
     Toupcam_GigeEnable(nullptr, nullptr);
+    GLPreview::setDefaultFormat();
     QApplication a(argc, argv);
     MainWidget mw;
     mw.show();
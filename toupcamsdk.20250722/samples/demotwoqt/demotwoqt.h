@@ -10,6 +10,7 @@
 #include <QGridLayout>
 #include <QMessageBox>
 #include <toupcam.h>
+#include "../glpreview.h"
 
 #if defined(_WIN32)
 typedef wchar_t tchar;
@@ -24,10 +25,10 @@ class MainWidget : public QWidget
     QPushButton*    m_btn_open;
     QTimer*         m_timer;
     HToupcam        m_hcam[2];
-    QLabel*         m_lbl_video[2];
+    GLPreview*      m_video[2];
     QLabel*         m_lbl_frame[2];
     int             m_imgWidth[2], m_imgHeight[2];
-    uchar*          m_pData[2];
+    uchar*          m_pData[2];     /* until the preview is initialized */
     struct callBackCtx {
         MainWidget* pthis;
         int idx;
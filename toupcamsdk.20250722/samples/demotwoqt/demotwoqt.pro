@@ -1,4 +1,5 @@
-QT += core gui widgets
-SOURCES += demotwoqt.cpp
-HEADERS += demotwoqt.h
+QT += core gui widgets opengl
+greaterThan(QT_MAJOR_VERSION, 5): QT += openglwidgets
+SOURCES += demotwoqt.cpp ../glpreview.cpp
+HEADERS += demotwoqt.h ../glpreview.h
 LIBS += -ltoupcam
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include "toupcam.h"
+#include "../camuart.h"
+#include "../gcodestream.h"
+#include "../stagetrack.h"
+
+/*
+    The stage controller on the UART of the camera (samples/camuart.h): GcodeStream (gcodestream.h) streams the moves
+    through it, and the G-code, the answers and the frames are written to one csv on the host clock:
+        tx,<host us>,<line>         a line sent, at the transfer to the camera
+        rx,<host us>,<line>         a line received, at the read from the camera
+        frame,<host us>,<seq>,x,y,z the middle of the exposure of a frame (FrameClock), tagged with the stage
+                                    position from the M114 reports (StageTrack, stagetrack.h)
+    The stage goes through points along X, step mm apart, M400 and M114 at each one; per point the time from the G0
+    sent to the "ok" of its M400 and the frames exposed meanwhile.
+    usage: demouartstage [points = 5] [step mm = 1] [baud = 115200] [out.csv = demouartstage.csv]
+    With simcam: SIMCAM=speed=2000 ./demouartstage (simcam has a Marlin on its UART, moving its stage).
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+StageTrack g_track;
+FrameClock g_clock;
+FILE* g_fp = NULL;
+std::mutex g_mtx;                   /* g_fp and the times below, from the UART thread and the event callback */
+long long g_tMove = 0, g_tOk = 0;   /* the last G0 sent, the last "ok" received */
+unsigned g_frames = 0, g_tagged = 0;
+
+static void Line(void* ctx, int dir, long long t, const char* line)
+{
+    std::lock_guard<std::mutex> lock(g_mtx);
+    fprintf(g_fp, "%s,%lld,%s\n", (CAMUART_TX == dir) ? "tx" : "rx", t, line);
+    if ((CAMUART_TX == dir) && (0 == strncmp(line, "G0", 2)))
+        g_tMove = t;
+    else if ((CAMUART_RX == dir) && (0 == strncmp(line, "ok", 2)))
+        g_tOk = t;
+}
+
+static void Position(void* ctx, long long t, double x, double y, double z)
+{
+    g_track.push(t, x, y, z);
+}
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const long long tArrival = HostMicroseconds();
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const long long t = g_clock.frameTime(info, tArrival);
+            StageSample pos;
+            const bool bTagged = g_track.at(t, &pos);
+            std::lock_guard<std::mutex> lock(g_mtx);
+            ++g_frames;
+            if (bTagged)
+            {
+                ++g_tagged;
+                fprintf(g_fp, "frame,%lld,%u,%.4f,%.4f,%.4f\n", t, info.v3.seq, pos.x, pos.y, pos.z);
+            }
+            else
+                fprintf(g_fp, "frame,%lld,%u,,,\n", t, info.v3.seq);
+        }
+    }
+    else if (TOUPCAM_EVENT_ERROR == nEvent || TOUPCAM_EVENT_DISCONNECTED == nEvent)
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const unsigned points = (argc > 1) ? (unsigned)atoi(argv[1]) : 5;
+    const double step = (argc > 2) ? atof(argv[2]) : 1.0;
+    const unsigned baud = (argc > 3) ? (unsigned)atoi(argv[3]) : 115200;
+    const char* filename = (argc > 4) ? argv[4] : "demouartstage.csv";
+    g_fp = fopen(filename, "w");
+    if (NULL == g_fp)
+    {
+        printf("failed to create %s\n", filename);
+        return -1;
+    }
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        fclose(g_fp);
+        return -1;
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+    {
+        printf("failed to get size, hr = 0x%08x\n", hr);
+        Toupcam_Close(g_hcam);
+        fclose(g_fp);
+        return -1;
+    }
+    g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+
+    CamUart uart;
+    uart.setLineCallback(Line, NULL);
+    hr = uart.open(g_hcam, baud);
+    FILE* fout = NULL;
+    FILE* fin = NULL;
+    if (FAILED(hr))
+        printf("failed to open the UART, hr = 0x%08x\n", hr);
+    else if (!uart.stream(&fout, &fin))
+        printf("failed to create the pipes of the stream\n");
+    else
+    {
+        GcodeStream stage;
+        stage.setPositionCallback(Position, NULL);
+        stage.open(fout, fin);
+        hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+        if (FAILED(hr))
+            printf("failed to start camera, hr = 0x%08x\n", hr);
+        else
+        {
+            double x = 0, y = 0, z = 0;
+            if (stage.send("G90") && stage.send("G28") && stage.sync() && stage.position(&x, &y, &z))
+                printf("homed: %.3f %.3f %.3f\n", x, y, z);
+            for (unsigned i = 1; i <= points; ++i)
+            {
+                char gcode[64];
+                sprintf(gcode, "G0 X%.3f", step * i);
+                unsigned frames;
+                {
+                    std::lock_guard<std::mutex> lock(g_mtx);
+                    frames = g_frames;
+                }
+                if (!(stage.send(gcode) && stage.sync()))
+                {
+                    printf("point %u: failed, %s\n", i, stage.lastError().c_str());
+                    break;
+                }
+                /* the line callback has the "ok" before GcodeStream reads it: the last one is the one of the M400 */
+                double ms;
+                {
+                    std::lock_guard<std::mutex> lock(g_mtx);
+                    ms = (g_tOk - g_tMove) / 1000.0;
+                    frames = g_frames - frames;
+                }
+                if (!stage.position(&x, &y, &z))
+                {
+                    printf("point %u: failed, %s\n", i, stage.lastError().c_str());
+                    break;
+                }
+                printf("point %u: %.3f %.3f %.3f, G0 to M400 ok %.1f ms, frames %u\n", i, x, y, z, ms, frames);
+            }
+        }
+        stage.close();
+    }
+
+    /* cleanup */
+    uart.close();
+    Toupcam_Close(g_hcam);
+    printf("frames %u, tagged %u, uart: sent %llu, received %llu, errors %u, save: %s\n", g_frames, g_tagged, uart.sent(), uart.received(), uart.errors(), filename);
+    free(g_pImageData);
+    fclose(g_fp);
+    return 0;
+}
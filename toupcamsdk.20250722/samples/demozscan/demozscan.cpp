@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../focusmetric.h"
+#include "../stagetrack.h"
+#include "zscan.h"
+
+/*
+    Autofocus in one continuous Z move (zscan.h) instead of a move, M400 and settle for every step.
+    usage: demozscan <zmin> <zmax> [speed = 0.5 mm/s] [accel = 10 mm/s^2] [raw] [port]
+    The axis goes to zmin, then "G1 Z<zmax> F<speed>" + "M400" are sent and every frame streamed until the M400 "ok" is
+    scored (focusmetric.h); the frames are then put at their Z with the motion profile anchored at that "ok", the peak
+    is fitted and the axis moved there. speed and accel must be the ones of the Z axis of the controller (the feed rate
+    is clamped to M203 there, the acceleration is M201). Port as in demozsweep: default stdout / stdin.
+*/
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+FocusMetric g_metric;
+FrameClock g_clock;
+FocusTrace g_trace;
+bool g_bRaw = false;
+FILE* g_fout = NULL;
+FILE* g_fin = NULL;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        const long long tArrival = HostMicroseconds();
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, g_bRaw ? 0 : 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+            g_trace.add(g_clock.frameTime(info, tArrival), g_metric.value(info, g_pImageData, g_bRaw));
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+/* returns the host time of the "ok" of M400, 0 if it failed */
+static long long MoveZ(double z, double speed)
+{
+    fprintf(g_fout, "G1 Z%.4f F%.1f\nM400\n", z, speed * 60);
+    fflush(g_fout);
+    char line[256];
+    for (int n = 0; n < 2; )
+    {
+        if (NULL == fgets(line, sizeof(line), g_fin))
+            return 0;
+        if (0 == strncmp(line, "ok", 2))
+            ++n;
+    }
+    return HostMicroseconds();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <zmin> <zmax> [speed] [accel] [raw] [port]\n", argv[0]);
+        return -1;
+    }
+    const double zMin = atof(argv[1]), zMax = atof(argv[2]);
+    const double speed = (argc > 3) ? atof(argv[3]) : 0.5;
+    const double accel = (argc > 4) ? atof(argv[4]) : 10.0;
+    g_bRaw = (argc > 5) && (0 == strcmp(argv[5], "raw"));
+    g_fout = stdout;
+    g_fin = stdin;
+    if (argc > 6)
+    {
+        /* one FILE per direction: a "r+" FILE may not turn from reading to writing without a seek, which a tty cannot do */
+        g_fout = fopen(argv[6], "w");
+        g_fin = g_fout ? fopen(argv[6], "r") : NULL;
+        if (NULL == g_fin)
+        {
+            printf("failed to open %s\n", argv[6]);
+            if (g_fout)
+                fclose(g_fout);
+            return -1;
+        }
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    if (g_bRaw)
+    {
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 0);
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            g_metric.setRoi(g_hcam, nWidth / 4, nHeight / 4, nWidth / 2, nHeight / 2);
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else if (0 == MoveZ(zMin, speed * 4))
+                printf("failed to move to z = %.4f\n", zMin);
+            else
+            {
+                ZMotion motion(zMin, zMax, speed, accel);
+                g_trace.clear();
+                const long long tEnd = MoveZ(zMax, speed);
+                if (0 == tEnd)
+                    printf("failed to move to z = %.4f\n", zMax);
+                else
+                {
+                    motion.setEnd(tEnd);
+                    const size_t n = g_trace.map(motion);
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        double z = 0.0, v = 0.0;
+                        g_trace.point(i, &z, &v);
+                        printf("z = %.4f, focus value = %.1f\n", z, v);
+                    }
+                    double best = 0.0;
+                    bool bFit = false;
+                    if (!g_trace.peak(&best, &bFit))
+                        printf("no frame during the move of %lld ms\n", motion.duration() / 1000);
+                    else
+                    {
+                        printf("%u frames in %lld ms, best z = %.4f (%s)\n", (unsigned)n, motion.duration() / 1000, best, bFit ? "fit" : "highest frame");
+                        if (0 == MoveZ(best, speed * 4))
+                            printf("failed to move to z = %.4f\n", best);
+                    }
+                }
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    if (g_fout && (g_fout != stdout))
+        fclose(g_fout);
+    if (g_fin && (g_fin != stdin))
+        fclose(g_fin);
+    return 0;
+}
@@ -0,0 +1,185 @@
+#ifndef __zscan_H__
+#define __zscan_H__
+
+/*
+    Autofocus from one continuous Z move: the focus value of every frame streamed during the move, each frame put at
+    the Z where it was exposed, and the peak of the curve.
+    ZMotion is the motion profile of the move as the controller plans it: trapezoidal, with the speed and the
+    acceleration of the Z axis (M203 / M201 Z of the controller, the value used must be the one configured there). The
+    host cannot see when the move starts (the "ok" of G1 comes when it is queued), but it sees when it ends (the "ok" of
+    the M400 after it): setEnd() anchors the profile there, and zAt() gives the Z at any host time of the move.
+    FocusTrace collects the focus values with the host time of the middle of the exposure (FrameClock of stagetrack.h),
+    map() puts them at their Z once the end of the move is known, and peak() fits a parabola to the points around the
+    highest one (the ones above ZSCAN_FIT_LEVEL of the range of the curve, at least 3), its vertex being the best Z.
+    The exposure must be short next to the time to cross the depth of field, the move is not stopped for the frames.
+*/
+#include <math.h>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+#define ZSCAN_FIT_LEVEL     0.5
+
+class ZMotion {
+    double m_z0, m_z1, m_v, m_a;
+    double m_ta, m_tc;      /* seconds: acceleration, cruise */
+    long long m_tStart;     /* host microseconds */
+public:
+    /* mm, mm/s, mm/s^2 */
+    ZMotion(double z0, double z1, double v, double a)
+    : m_z0(z0), m_z1(z1), m_v(v), m_a(a), m_ta(0.0), m_tc(0.0), m_tStart(0)
+    {
+        const double d = fabs(z1 - z0);
+        m_ta = v / a;
+        if (a * m_ta * m_ta > d)    /* never at speed: triangle profile */
+        {
+            m_ta = sqrt(d / a);
+            m_v = a * m_ta;
+        }
+        else
+            m_tc = (d - a * m_ta * m_ta) / v;
+    }
+
+    long long duration() const { return (long long)((2 * m_ta + m_tc) * 1000000.0); }
+
+    /* host time the move was reported complete */
+    void setEnd(long long tEnd)
+    {
+        m_tStart = tEnd - duration();
+    }
+
+    bool zAt(long long t, double* pz) const
+    {
+        const double s = (t - m_tStart) / 1000000.0;
+        if ((s < 0.0) || (s > 2 * m_ta + m_tc))
+            return false;
+        double d;
+        if (s < m_ta)
+            d = 0.5 * m_a * s * s;
+        else if (s < m_ta + m_tc)
+            d = 0.5 * m_a * m_ta * m_ta + m_v * (s - m_ta);
+        else
+        {
+            const double r = 2 * m_ta + m_tc - s;
+            d = fabs(m_z1 - m_z0) - 0.5 * m_a * r * r;
+        }
+        *pz = (m_z1 >= m_z0) ? (m_z0 + d) : (m_z0 - d);
+        return true;
+    }
+};
+
+class FocusTrace {
+    struct Point {
+        long long t;
+        double z, value;
+    };
+    std::vector<Point> m_points;
+    mutable std::mutex m_mtx;
+
+    static bool lessZ(const Point& a, const Point& b) { return a.z < b.z; }
+public:
+    /* any thread, usually the event callback */
+    void add(long long t, double value)
+    {
+        Point pt = { t, 0.0, value };
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_points.push_back(pt);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_points.clear();
+    }
+
+    /* keeps the points exposed during the move, in the order of Z; returns how many */
+    size_t map(const ZMotion& motion)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        std::vector<Point> v;
+        for (size_t i = 0; i < m_points.size(); ++i)
+        {
+            Point pt = m_points[i];
+            if (motion.zAt(pt.t, &pt.z))
+                v.push_back(pt);
+        }
+        std::sort(v.begin(), v.end(), lessZ);
+        m_points.swap(v);
+        return m_points.size();
+    }
+
+    size_t count() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_points.size();
+    }
+
+    void point(size_t i, double* pz, double* pValue) const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        *pz = m_points[i].z;
+        *pValue = m_points[i].value;
+    }
+
+    /* after map(); false if there are no points. *pbFit: true for the vertex of the parabola, false for the highest point */
+    bool peak(double* pz, bool* pbFit) const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        *pbFit = false;
+        if (m_points.empty())
+            return false;
+        size_t iMax = 0;
+        double vMin = m_points[0].value;
+        for (size_t i = 1; i < m_points.size(); ++i)
+        {
+            if (m_points[i].value > m_points[iMax].value)
+                iMax = i;
+            vMin = std::min(vMin, m_points[i].value);
+        }
+        *pz = m_points[iMax].z;
+        const double level = vMin + (m_points[iMax].value - vMin) * ZSCAN_FIT_LEVEL;
+        size_t lo = iMax, hi = iMax;
+        while ((lo > 0) && (m_points[lo - 1].value >= level))
+            --lo;
+        while ((hi + 1 < m_points.size()) && (m_points[hi + 1].value >= level))
+            ++hi;
+        while ((hi - lo < 2) && ((lo > 0) || (hi + 1 < m_points.size())))
+        {
+            if (lo > 0)
+                --lo;
+            if (hi + 1 < m_points.size())
+                ++hi;
+        }
+        if (hi - lo < 2)
+            return true;
+
+        /* least squares v = a + b u + c u^2, u = z - z of the highest point */
+        double s[5] = { 0 }, t[3] = { 0 };
+        for (size_t i = lo; i <= hi; ++i)
+        {
+            const double u = m_points[i].z - *pz, v = m_points[i].value;
+            double p = 1.0;
+            for (int k = 0; k < 5; ++k, p *= u)
+            {
+                s[k] += p;
+                if (k < 3)
+                    t[k] += p * v;
+            }
+        }
+        const double det = s[0] * (s[2] * s[4] - s[3] * s[3]) - s[1] * (s[1] * s[4] - s[3] * s[2]) + s[2] * (s[1] * s[3] - s[2] * s[2]);
+        if (0.0 == det)
+            return true;
+        const double b = (s[0] * (t[1] * s[4] - s[3] * t[2]) - t[0] * (s[1] * s[4] - s[3] * s[2]) + s[2] * (s[1] * t[2] - t[1] * s[2])) / det;
+        const double c = (s[0] * (s[2] * t[2] - t[1] * s[3]) - s[1] * (s[1] * t[2] - t[1] * s[2]) + t[0] * (s[1] * s[3] - s[2] * s[2])) / det;
+        if (c >= 0.0)   /* not a peak */
+            return true;
+        const double u = -b / (2 * c);
+        if ((u < m_points[lo].z - *pz) || (u > m_points[hi].z - *pz))
+            return true;
+        *pz += u;
+        *pbFit = true;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "../focusmetric.h"
+
+/*
+    Autofocus with an external Z axis (the stage controller), from the focus value of every frame (focusmetric.h).
+    usage: demozsweep <zmin> <zmax> [steps = 11] [passes = 3] [raw] [port]
+    Every move is sent as "G0 Z<z>" + "M400" (wait for the end of the move) to the port (a tty of the controller),
+    default stdout, and is done when "ok" has been read back twice, default from stdin; the first SETTLE_FRAMES
+    frames after the move are skipped (exposed during the move), the next one is the measure of z.
+    The region is the middle quarter of the frame. At the end the axis is moved to the best z.
+*/
+#define SETTLE_FRAMES       2
+
+HToupcam g_hcam = NULL;
+void* g_pImageData = NULL;
+FocusMetric g_metric;
+bool g_bRaw = false;
+unsigned g_total = 0;
+double g_value = 0.0;
+std::mutex g_mtx;
+std::condition_variable g_cv;
+FILE* g_fout = NULL;
+FILE* g_fin = NULL;
+
+static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+    if (TOUPCAM_EVENT_IMAGE == nEvent)
+    {
+        ToupcamFrameInfoV4 info = { 0 };
+        const HRESULT hr = Toupcam_PullImageV4(g_hcam, g_pImageData, 0, g_bRaw ? 0 : 24, 0, &info);
+        if (FAILED(hr))
+            printf("failed to pull image, hr = 0x%08x\n", hr);
+        else
+        {
+            const double v = g_metric.value(info, g_pImageData, g_bRaw);
+            std::lock_guard<std::mutex> lock(g_mtx);
+            g_value = v;
+            ++g_total;
+            g_cv.notify_all();
+        }
+    }
+    else
+    {
+        printf("event callback: 0x%04x\n", nEvent);
+    }
+}
+
+static bool MoveZ(double z)
+{
+    fprintf(g_fout, "G0 Z%.4f\nM400\n", z);
+    fflush(g_fout);
+    char line[256];
+    for (int n = 0; n < 2; )
+    {
+        if (NULL == fgets(line, sizeof(line), g_fin))
+            return false;
+        if (0 == strncmp(line, "ok", 2))
+            ++n;
+    }
+    return true;
+}
+
+static bool Measure(void* ctx, double z, double* pValue)
+{
+    if (!MoveZ(z))
+    {
+        printf("failed to move to z = %.4f\n", z);
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(g_mtx);
+    const unsigned n = g_total + SETTLE_FRAMES + 1;
+    if (!g_cv.wait_for(lock, std::chrono::seconds(10), [n] { return g_total >= n; }))
+    {
+        printf("no frame at z = %.4f\n", z);
+        return false;
+    }
+    *pValue = g_value;
+    printf("z = %.4f, focus value = %.1f (%s)\n", z, g_value, (FOCUSMETRIC_CAMERA == g_metric.source()) ? "camera" : "host");
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <zmin> <zmax> [steps] [passes] [raw] [port]\n", argv[0]);
+        return -1;
+    }
+    const double zMin = atof(argv[1]), zMax = atof(argv[2]);
+    const unsigned steps = (argc > 3) ? (unsigned)atoi(argv[3]) : 11;
+    const unsigned passes = (argc > 4) ? (unsigned)atoi(argv[4]) : 3;
+    g_bRaw = (argc > 5) && (0 == strcmp(argv[5], "raw"));
+    g_fout = stdout;
+    g_fin = stdin;
+    if (argc > 6)
+    {
+        /* one FILE per direction: a "r+" FILE may not turn from reading to writing without a seek, which a tty cannot do */
+        g_fout = fopen(argv[6], "w");
+        g_fin = g_fout ? fopen(argv[6], "r") : NULL;
+        if (NULL == g_fin)
+        {
+            printf("failed to open %s\n", argv[6]);
+            if (g_fout)
+                fclose(g_fout);
+            return -1;
+        }
+    }
+
+    g_hcam = Toupcam_Open(NULL);
+    if (NULL == g_hcam)
+    {
+        printf("no camera found or open failed\n");
+        return -1;
+    }
+
+    if (g_bRaw)
+    {
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_RAW, 1);
+        Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_BITDEPTH, 0);
+    }
+    int nWidth = 0, nHeight = 0;
+    HRESULT hr = Toupcam_get_Size(g_hcam, &nWidth, &nHeight);
+    if (FAILED(hr))
+        printf("failed to get size, hr = 0x%08x\n", hr);
+    else
+    {
+        g_pImageData = malloc(TDIBWIDTHBYTES(24 * nWidth) * nHeight);
+        if (NULL == g_pImageData)
+            printf("failed to malloc\n");
+        else
+        {
+            if (FAILED(hr = g_metric.setRoi(g_hcam, nWidth / 4, nHeight / 4, nWidth / 2, nHeight / 2)))
+                printf("no focus value from the camera, computed on the host, hr = 0x%08x\n", hr);
+            hr = Toupcam_StartPullModeWithCallback(g_hcam, EventCallback, NULL);
+            if (FAILED(hr))
+                printf("failed to start camera, hr = 0x%08x\n", hr);
+            else
+            {
+                double best = 0.0;
+                const bool bDone = FocusSweep(zMin, zMax, steps, passes, Measure, NULL, &best);
+                printf("%s, best z = %.4f\n", bDone ? "done" : "aborted", best);
+                if (!MoveZ(best))
+                    printf("failed to move to z = %.4f\n", best);
+            }
+        }
+    }
+
+    /* cleanup */
+    Toupcam_Close(g_hcam);
+    if (g_pImageData)
+        free(g_pImageData);
+    if (g_fout && (g_fout != stdout))
+        fclose(g_fout);
+    if (g_fin && (g_fin != stdin))
+        fclose(g_fin);
+    return 0;
+}
@@ -0,0 +1,165 @@
+#ifndef __dequesize_H__
+#define __dequesize_H__
+
+/*
+    Sizes TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH and TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH within a memory budget.
+    Both deques are allocated when the camera starts, frame by frame at the full size of what they hold: too short and
+    a hiccup of the program drops frames, too long and a 25M camera in RGB48 takes gigabytes for nothing.
+    What the deques have to absorb is the jitter of the consumer: while it takes t for one frame, t x fps frames arrive.
+    So DequeSizer collects the time the consumer takes per frame, from the return of one pull to the moment it is ready
+    for the next (sample(), one consumer thread), and plan() sizes both deques for its p99 (DEQUESIZE_PERCENTILE):
+        need    = ceil(p99 x fps) + 1, within [2, 1024]
+        backend = need frames of the output format (TOUPCAM_OPTION_RAW / _RGB / _BITDEPTH, at the current resolution):
+                  it is where the frames wait for a slow consumer
+        frontend = need RAW frames (TOUPCAM_OPTION_PIXEL_FORMAT), when the budget still has room: the frontend takes the
+                  hiccups of the SDK pipeline, which runs on the same host as the consumer
+    When the budget is short of both, the backend is served first and the frontend gets what is left, 2 frames at least.
+    The deques only change at the start of the camera: measure with the defaults (or the last plan), stop, apply(),
+    start again; or keep the plan of a calibration run (DequePlan is plain data) for the next ones.
+    A consumer which is too slow on average (mean x fps >= 1, DequePlan.overload) is out of reach of any deque:
+    lower the frame rate instead (samples/fpsgov.h).
+    Threads: sample() is called by the consumer, the callback of the SDK as the case may be, which may still be in it
+    after Toupcam_Stop returns; plan(), samples() and reset() may be called from any other thread, the state is under
+    a mutex.
+*/
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+#include "toupcam.h"
+
+#define DEQUESIZE_BUCKET_US     500     /* width of one histogram bucket */
+#define DEQUESIZE_BUCKETS       4096    /* up to about 2 s, the last bucket collects everything above */
+#define DEQUESIZE_PERCENTILE    0.99
+#define DEQUESIZE_MIN           2
+#define DEQUESIZE_MAX           1024
+
+typedef struct {
+    unsigned frontLength, backLength;   /* the chosen lengths */
+    unsigned need;                      /* the length the jitter asks for, before the budget */
+    unsigned long long frontFrame, backFrame;   /* bytes of one frame in each deque */
+    unsigned long long bytes;           /* total of both deques */
+    double p99ms, fps;
+    bool overload;                      /* the consumer is too slow on average, no deque length helps */
+} DequePlan;
+
+class DequeSizer {
+    unsigned m_count[DEQUESIZE_BUCKETS];
+    unsigned long long m_total, m_sum;  /* microseconds */
+    mutable std::mutex m_mtx;
+
+    /* with m_mtx: time below which the given fraction of the samples fall, at bucket resolution, microseconds */
+    unsigned long long percentile(double p) const
+    {
+        unsigned long long acc = 0;
+        for (unsigned i = 0; i < DEQUESIZE_BUCKETS; ++i)
+        {
+            acc += m_count[i];
+            if (acc >= m_total * p)
+                return (unsigned long long)(i + 1) * DEQUESIZE_BUCKET_US;
+        }
+        return (unsigned long long)DEQUESIZE_BUCKETS * DEQUESIZE_BUCKET_US;
+    }
+public:
+    DequeSizer() { reset(); }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        std::fill(m_count, m_count + DEQUESIZE_BUCKETS, 0u);
+        m_total = m_sum = 0;
+    }
+
+    /* time the consumer took for one frame */
+    void sample(double ms)
+    {
+        const unsigned long long us = (ms > 0.0) ? (unsigned long long)(ms * 1000.0) : 0;
+        const unsigned long long idx = us / DEQUESIZE_BUCKET_US;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        ++m_count[(idx < DEQUESIZE_BUCKETS) ? idx : (DEQUESIZE_BUCKETS - 1)];
+        ++m_total;
+        m_sum += us;
+    }
+
+    unsigned long long samples() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_total;
+    }
+
+    /* bytes of one frame of the frontend (RAW) and of the backend (the output format), at the current resolution */
+    static HRESULT frameBytes(HToupcam h, unsigned long long* pFront, unsigned long long* pBack)
+    {
+        int w = 0, hgt = 0;
+        HRESULT hr = Toupcam_get_Size(h, &w, &hgt);
+        if (FAILED(hr))
+            return hr;
+        int fmt = TOUPCAM_PIXELFORMAT_RAW8, raw = 0, rgb = 0, bitdepth = 0;
+        Toupcam_get_Option(h, TOUPCAM_OPTION_PIXEL_FORMAT, &fmt);
+        Toupcam_get_Option(h, TOUPCAM_OPTION_RAW, &raw);
+        Toupcam_get_Option(h, TOUPCAM_OPTION_RGB, &rgb);
+        Toupcam_get_Option(h, TOUPCAM_OPTION_BITDEPTH, &bitdepth);
+        const unsigned rawBytes = (TOUPCAM_PIXELFORMAT_RAW8 == fmt) ? 1 : 2;
+        *pFront = (unsigned long long)w * hgt * rawBytes;
+        if (raw)
+            *pBack = *pFront;
+        else
+        {
+            static const unsigned bits[] = { 24, 48, 32, 8, 16, 64 };
+            unsigned b = ((rgb >= 0) && (rgb < 6)) ? bits[rgb] : 24;
+            if ((0 == bitdepth) && ((1 == rgb) || (4 == rgb) || (5 == rgb)))
+                b /= 2;             /* the 16 bits formats only with the bit depth */
+            *pBack = (unsigned long long)TDIBWIDTHBYTES(b * w) * hgt;
+        }
+        return 0;   /* S_OK */
+    }
+
+    /*
+        budgetMB: for both deques together; fps: the frame rate the camera runs at (Toupcam_get_FrameRate, or
+        TOUPCAM_OPTION_PRECISE_FRAMERATE / 10). E_UNEXPECTED without samples; E_OUTOFMEMORY when not even
+        DEQUESIZE_MIN frames of each fit the budget, the plan then holds the minimum.
+    */
+    HRESULT plan(HToupcam h, unsigned budgetMB, double fps, DequePlan* p) const
+    {
+        if ((NULL == h) || (NULL == p) || (fps <= 0.0))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        double p99ms = 0.0, mean = 0.0;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (0 == m_total)
+                return (HRESULT)0x8000ffff; /* E_UNEXPECTED */
+            p99ms = percentile(DEQUESIZE_PERCENTILE) / 1000.0;
+            mean = m_sum / 1000000.0 / m_total;
+        }
+        HRESULT hr = frameBytes(h, &p->frontFrame, &p->backFrame);
+        if (FAILED(hr))
+            return hr;
+        p->fps = fps;
+        p->p99ms = p99ms;
+        p->overload = (mean * fps >= 1.0);
+        p->need = (unsigned)std::min<double>(DEQUESIZE_MAX, std::max<double>(DEQUESIZE_MIN, ceil(p->p99ms * fps / 1000.0) + 1));
+
+        const unsigned long long budget = (unsigned long long)budgetMB << 20;
+        const unsigned long long minimum = DEQUESIZE_MIN * (p->frontFrame + p->backFrame);
+        if (minimum > budget)
+        {
+            p->frontLength = p->backLength = DEQUESIZE_MIN;
+            p->bytes = minimum;
+            return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+        }
+        p->backLength = (unsigned)std::min<unsigned long long>(p->need, (budget - DEQUESIZE_MIN * p->frontFrame) / p->backFrame);
+        p->frontLength = (unsigned)std::min<unsigned long long>(p->need, (budget - p->backLength * p->backFrame) / p->frontFrame);
+        p->bytes = p->frontLength * p->frontFrame + p->backLength * p->backFrame;
+        return 0;   /* S_OK */
+    }
+
+    /* before Toupcam_StartXXXX */
+    static HRESULT apply(HToupcam h, const DequePlan* p)
+    {
+        HRESULT hr = Toupcam_put_Option(h, TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH, (int)p->frontLength);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_put_Option(h, TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, (int)p->backLength);
+        return hr;
+    }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "toupcam.h"
+#include "../dlpackframe.h"
+
+/*
+    libdlframe: the DLPack frame pool of samples/dlpackframe.h as a C library, for ctypes (dlframe.py) and the other
+    languages which can call C. The handle is the one of the program: toupcam.py, or any other binding, opens and
+    starts the camera; put the library next to toupcam.dll / libtoupcam.so so that both use the same one.
+    The same calling convention as toupcam.dll: __stdcall on Windows (ctypes.WinDLL), cdecl elsewhere (ctypes.CDLL).
+*/
+#if defined(_WIN32)
+#define DLFRAME_API(x)      extern "C" __declspec(dllexport) x __stdcall
+#else
+#define DLFRAME_API(x)      extern "C" __attribute__((visibility("default"))) x
+#endif
+
+/* before Toupcam_StartXXXX, see DlFramePool::create; NULL on failure */
+DLFRAME_API(void*) DlFrame_Create(HToupcam h, unsigned slots, int bits)
+{
+    return DlFramePool::create(h, slots, bits);
+}
+
+/* *ppTensor: a DLManagedTensor, to be handed to a consumer of the protocol (or freed by its deleter) */
+DLFRAME_API(HRESULT) DlFrame_Pull(void* pool, unsigned nWaitMS, DLManagedTensor** ppTensor, ToupcamFrameInfoV4* pInfo)
+{
+    if (NULL == pool)
+        return (HRESULT)0x80070057; /* E_INVALIDARG */
+    return ((DlFramePool*)pool)->pull(nWaitMS, ppTensor, pInfo);
+}
+
+/* for the destructor of a capsule nobody consumed: the same as calling the deleter of the tensor */
+DLFRAME_API(void) DlFrame_Free(DLManagedTensor* pTensor)
+{
+    if (pTensor && pTensor->deleter)
+        pTensor->deleter(pTensor);
+}
+
+DLFRAME_API(unsigned) DlFrame_Leased(void* pool)
+{
+    return pool ? ((DlFramePool*)pool)->leased() : 0;
+}
+
+DLFRAME_API(void) DlFrame_Close(void* pool)
+{
+    if (pool)
+        ((DlFramePool*)pool)->close();
+}
@@ -0,0 +1,158 @@
+"""
+Camera frames as DLPack tensors, through libdlframe (dlframe.cpp, samples/dlpackframe.h):
+
+    pool = dlframe.DlFramePool(cam, slots=4, bits=24)   # before cam.StartPullModeWithCallback
+    ...
+    frame = pool.pull()                                 # on TOUPCAM_EVENT_IMAGE, None when there is no frame
+    img = numpy.from_dlpack(frame)                      # or torch.from_dlpack(frame): no copy, RGB, rows top down
+
+The frame is pulled once, into a buffer of the pool, and the array is a view of that buffer; the buffer goes back to
+the pool when the last array (or tensor) made from it is freed. A frame exports once; keep the array, not the Frame.
+A Frame which is dropped unexported gives its buffer back at once. pull() raises HRESULTError(E_OUTOFMEMORY) while
+the program holds all the slots.
+cam is a toupcam.Toupcam of toupcam.py, or the HToupcam of any other binding, as an int.
+"""
+import sys
+import os
+import ctypes
+
+E_OUTOFMEMORY = 0x8007000e
+E_PENDING = 0x8000000a
+E_TIMEOUT = 0x8001011f
+
+
+class HRESULTError(Exception):
+    def __init__(self, hr):
+        Exception.__init__(self, 'hr = 0x{:08x}'.format(hr & 0xffffffff))
+        self.hr = hr & 0xffffffff
+
+
+class FrameInfoV3(ctypes.Structure):
+    _fields_ = [('width', ctypes.c_uint),
+                ('height', ctypes.c_uint),
+                ('flag', ctypes.c_uint),
+                ('seq', ctypes.c_uint),
+                ('timestamp', ctypes.c_ulonglong),
+                ('shutterseq', ctypes.c_uint),
+                ('expotime', ctypes.c_uint),
+                ('expogain', ctypes.c_ushort),
+                ('blacklevel', ctypes.c_ushort)]
+
+
+class Gps(ctypes.Structure):
+    _fields_ = [('utcstart', ctypes.c_ulonglong),
+                ('utcend', ctypes.c_ulonglong),
+                ('longitude', ctypes.c_int),
+                ('latitude', ctypes.c_int),
+                ('altitude', ctypes.c_int),
+                ('satellite', ctypes.c_ushort),
+                ('reserved', ctypes.c_ushort)]
+
+
+class FrameInfoV4(ctypes.Structure):
+    _fields_ = [('v3', FrameInfoV3),
+                ('reserved', ctypes.c_uint),
+                ('uLum', ctypes.c_uint),
+                ('uFV', ctypes.c_ulonglong),
+                ('timecount', ctypes.c_ulonglong),
+                ('framecount', ctypes.c_uint),
+                ('tricount', ctypes.c_uint),
+                ('gps', Gps)]
+
+
+def _load():
+    here = os.path.dirname(os.path.realpath(__file__))
+    if sys.platform == 'win32':
+        lib = ctypes.WinDLL(os.path.join(here, 'dlframe.dll'))
+    elif sys.platform == 'darwin':
+        lib = ctypes.CDLL(os.path.join(here, 'libdlframe.dylib'))
+    else:
+        lib = ctypes.CDLL(os.path.join(here, 'libdlframe.so'))
+    lib.DlFrame_Create.restype = ctypes.c_void_p
+    lib.DlFrame_Create.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_int]
+    lib.DlFrame_Pull.restype = ctypes.c_int
+    lib.DlFrame_Pull.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(FrameInfoV4)]
+    lib.DlFrame_Free.restype = None
+    lib.DlFrame_Free.argtypes = [ctypes.c_void_p]
+    lib.DlFrame_Leased.restype = ctypes.c_uint
+    lib.DlFrame_Leased.argtypes = [ctypes.c_void_p]
+    lib.DlFrame_Close.restype = None
+    lib.DlFrame_Close.argtypes = [ctypes.c_void_p]
+    return lib
+
+
+_lib = _load()
+
+# the capsule of the protocol: named "dltensor" until a consumer takes it, which renames it "used_dltensor"
+_DLTENSOR = b'dltensor'
+_PyCapsule_New = ctypes.pythonapi.PyCapsule_New
+_PyCapsule_New.restype = ctypes.py_object
+_PyCapsule_New.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+_PyCapsule_IsValid = ctypes.PYFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_char_p)(('PyCapsule_IsValid', ctypes.pythonapi))
+_PyCapsule_GetPointer = ctypes.PYFUNCTYPE(ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p)(('PyCapsule_GetPointer', ctypes.pythonapi))
+
+
+@ctypes.CFUNCTYPE(None, ctypes.c_void_p)
+def _capsule_destructor(capsule):
+    # still "dltensor": nobody consumed it, the tensor is freed here
+    if _PyCapsule_IsValid(capsule, _DLTENSOR):
+        _lib.DlFrame_Free(_PyCapsule_GetPointer(capsule, _DLTENSOR))
+
+
+class Frame:
+    """one frame leased from the pool, for numpy.from_dlpack / torch.from_dlpack"""
+    def __init__(self, tensor, info):
+        self._tensor = tensor
+        self.info = info
+
+    def __dlpack__(self, stream=None, **kwargs):
+        if self._tensor is None:
+            raise BufferError('the frame has been exported already')
+        tensor, self._tensor = self._tensor, None
+        return _PyCapsule_New(tensor, _DLTENSOR, ctypes.cast(_capsule_destructor, ctypes.c_void_p))
+
+    def __dlpack_device__(self):
+        return (1, 0)   # kDLCPU
+
+    def __del__(self):
+        if self._tensor is not None:
+            _lib.DlFrame_Free(self._tensor)
+            self._tensor = None
+
+
+class DlFramePool:
+    def __init__(self, cam, slots=4, bits=24):
+        h = getattr(cam, '_Toupcam__h', cam)
+        self._pool = _lib.DlFrame_Create(h, slots, bits)
+        if not self._pool:
+            raise HRESULTError(E_OUTOFMEMORY)
+
+    def pull(self, wait_ms=0):
+        """the newest frame, None when there is none (within wait_ms)"""
+        tensor = ctypes.c_void_p()
+        info = FrameInfoV4()
+        hr = _lib.DlFrame_Pull(self._pool, wait_ms, ctypes.byref(tensor), ctypes.byref(info)) & 0xffffffff
+        if hr in (E_PENDING, E_TIMEOUT):
+            return None
+        if hr & 0x80000000:
+            raise HRESULTError(hr)
+        return Frame(tensor.value, info)
+
+    @property
+    def leased(self):
+        return _lib.DlFrame_Leased(self._pool) if self._pool else 0
+
+    def close(self):
+        """the arrays still alive keep their buffers"""
+        if self._pool:
+            _lib.DlFrame_Close(self._pool)
+            self._pool = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        self.close()
@@ -0,0 +1,7 @@
+#!/bin/bash
+os=`uname -s`
+if [[ $os = "Linux" ]]; then
+	g++ -std=c++11 -O2 -shared -fPIC -Wl,-rpath -Wl,'$ORIGIN' -L. -o libdlframe.so dlframe.cpp -ltoupcam -lpthread
+else
+	clang++ -std=c++11 -O2 -dynamiclib -install_name @rpath/libdlframe.dylib -Wl,-rpath -Wl,@loader_path -L. -o libdlframe.dylib dlframe.cpp -ltoupcam -lpthread
+fi
@@ -0,0 +1,236 @@
+#ifndef __dlpackframe_H__
+#define __dlpackframe_H__
+
+/*
+    Camera frames exported as DLPack tensors (https://dmlc.github.io/dlpack), for numpy, PyTorch, CuPy, JAX and the
+    other consumers of the protocol: the frame is pulled once, into a buffer of the pool, and the tensor points at that
+    buffer; numpy.from_dlpack / torch.from_dlpack take it as it is, no copy on the Python side. The buffer is leased to
+    the tensor: it goes back to the pool when the consumer calls the deleter, that is when the last array or tensor
+    viewing it is freed, on whatever thread that happens.
+    DlFramePool::create() sizes the slots for the largest resolution and sets TOUPCAM_OPTION_BYTEORDER to RGB and
+    TOUPCAM_OPTION_UPSIDE_DOWN off (call it before Toupcam_StartXXXX): the rows come top down in RGB order, the layout
+    numpy, Qt (QImage::Format_RGB888) and PyTorch expect, so there is no BGR to RGB pass and no flip either.
+    pull() (in place of Toupcam_PullImageV4 / Toupcam_WaitImageV4, on TOUPCAM_EVENT_IMAGE) returns
+    E_OUTOFMEMORY while all the slots are leased: the consumer holds too many frames, the frame stays in the SDK.
+    The tensors (rows without padding, strides in elements as DLPack has them):
+        bits 24 / 32    uint8   [height, width, 3 / 4]
+        bits 48 / 64    uint16  [height, width, 3 / 4]
+        bits 8 / 16     uint8 / uint16  [height, width]
+        RAW mode        uint8 / uint16  [height, width], by TOUPCAM_OPTION_PIXEL_FORMAT (bits are ignored)
+    The device is the CPU (kDLCPU): a GPU consumer copies from there (torch: tensor.cuda(non_blocking=True)).
+    The pool is reference counted: close() is the owner's release, the memory goes away with the last tensor.
+    samples/dlpackexport builds it into a C library for ctypes, with dlframe.py on the Python side.
+*/
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
+#include "toupcam.h"
+#include "hugebuf.h"
+
+#if !defined(DLPACK_VERSION)
+/* the ABI of dlpack.h (v0.8 and later), for the trees which do not have it */
+typedef enum {
+    kDLCPU = 1,
+    kDLCUDA = 2,
+    kDLCUDAHost = 3
+} DLDeviceType;
+
+typedef struct {
+    DLDeviceType device_type;
+    int32_t device_id;
+} DLDevice;
+
+typedef enum {
+    kDLInt = 0,
+    kDLUInt = 1,
+    kDLFloat = 2
+} DLDataTypeCode;
+
+typedef struct {
+    uint8_t code;
+    uint8_t bits;
+    uint16_t lanes;
+} DLDataType;
+
+typedef struct {
+    void* data;
+    DLDevice device;
+    int32_t ndim;
+    DLDataType dtype;
+    int64_t* shape;
+    int64_t* strides;       /* in elements, NULL: compact row major */
+    uint64_t byte_offset;
+} DLTensor;
+
+typedef struct DLManagedTensor {
+    DLTensor dl_tensor;
+    void* manager_ctx;
+    void (*deleter)(struct DLManagedTensor* self);
+} DLManagedTensor;
+#endif
+
+class DlFramePool {
+    struct Slot {
+        DLManagedTensor tensor;             /* first: the address of the slot is that of its tensor */
+        int64_t shape[3], strides[3];
+        HugeBuffer buf;
+        ToupcamFrameInfoV4 info;
+        DlFramePool* pool;
+    };
+    HToupcam m_hcam;
+    int m_bits;
+    size_t m_frameBytes;
+    std::vector<Slot> m_slot;
+    std::vector<Slot*> m_free;
+    std::mutex m_mtx;
+    std::atomic<unsigned> m_ref;            /* the owner + the tensors out */
+    std::atomic<unsigned> m_nLeased;
+
+    DlFramePool(HToupcam h, unsigned slots, int bits, size_t frameBytes)
+    : m_hcam(h), m_bits(bits), m_frameBytes(frameBytes), m_slot(slots), m_ref(1), m_nLeased(0)
+    {
+    }
+
+    DlFramePool(const DlFramePool&);
+    DlFramePool& operator=(const DlFramePool&);
+
+    void unref()
+    {
+        if (1 == m_ref.fetch_sub(1))
+            delete this;
+    }
+
+    static void deleter(DLManagedTensor* self)
+    {
+        Slot* s = (Slot*)self->manager_ctx;
+        DlFramePool* pool = s->pool;
+        {
+            std::lock_guard<std::mutex> lock(pool->m_mtx);
+            pool->m_free.push_back(s);
+        }
+        --pool->m_nLeased;
+        pool->unref();
+    }
+
+    /* the layout of what the SDK just wrote into the slot */
+    void describe(Slot* s)
+    {
+        int raw = 0, fmt = TOUPCAM_PIXELFORMAT_RAW8;
+        Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_RAW, &raw);
+        unsigned channels = 1, depth = 8;
+        if (raw)
+        {
+            Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_PIXEL_FORMAT, &fmt);
+            depth = (TOUPCAM_PIXELFORMAT_RAW8 == fmt) ? 8 : 16;
+        }
+        else
+        {
+            switch (m_bits)
+            {
+            case 24: channels = 3; break;
+            case 32: channels = 4; break;
+            case 48: channels = 3; depth = 16; break;
+            case 64: channels = 4; depth = 16; break;
+            case 16: depth = 16; break;
+            default: break;
+            }
+        }
+        DLTensor& t = s->tensor.dl_tensor;
+        memset(&t, 0, sizeof(t));
+        t.data = s->buf.data();
+        t.device.device_type = kDLCPU;
+        t.device.device_id = 0;
+        t.ndim = (channels > 1) ? 3 : 2;
+        t.dtype.code = kDLUInt;
+        t.dtype.bits = (uint8_t)depth;
+        t.dtype.lanes = 1;
+        s->shape[0] = s->info.v3.height;
+        s->shape[1] = s->info.v3.width;
+        s->shape[2] = channels;
+        s->strides[0] = (int64_t)s->info.v3.width * channels;
+        s->strides[1] = channels;
+        s->strides[2] = 1;
+        t.shape = s->shape;
+        t.strides = s->strides;
+        s->tensor.manager_ctx = s;
+        s->tensor.deleter = deleter;
+    }
+public:
+    /*
+        bits: as for Toupcam_PullImageV4, but not 0 (the format of a tensor is fixed when it is made); slots: the frames
+        the consumer may hold at once, plus one. NULL when out of memory or for an invalid parameter.
+    */
+    static DlFramePool* create(HToupcam h, unsigned slots, int bits)
+    {
+        if ((NULL == h) || (0 == slots) || ((8 != bits) && (16 != bits) && (24 != bits) && (32 != bits) && (48 != bits) && (64 != bits)))
+            return NULL;
+        int w = 0, hgt = 0;
+        if (FAILED(Toupcam_get_Resolution(h, 0, &w, &hgt)))
+            return NULL;
+        /* at least 2 bytes a pixel: the slot also takes a 16 bits RAW frame */
+        const size_t frameBytes = (size_t)w * hgt * ((bits / 8 > 2) ? (bits / 8) : 2);
+        DlFramePool* pool = new (std::nothrow) DlFramePool(h, slots, bits, frameBytes);
+        if (NULL == pool)
+            return NULL;
+        for (size_t i = 0; i < pool->m_slot.size(); ++i)
+        {
+            Slot& s = pool->m_slot[i];
+            if (!s.buf.resize(frameBytes))
+            {
+                delete pool;
+                return NULL;
+            }
+            s.pool = pool;
+            pool->m_free.push_back(&s);
+        }
+        Toupcam_put_Option(h, TOUPCAM_OPTION_BYTEORDER, 0);
+        Toupcam_put_Option(h, TOUPCAM_OPTION_UPSIDE_DOWN, 0);
+        return pool;
+    }
+
+    /* the owner is done: no more pull(), the tensors still out keep the pool until they are freed */
+    void close() { unref(); }
+
+    /*
+        nWaitMS: 0 for a frame which is there already (on TOUPCAM_EVENT_IMAGE), as Toupcam_WaitImageV4 otherwise.
+        The tensor is the caller's: hand it to the consumer, or call its deleter.
+    */
+    HRESULT pull(unsigned nWaitMS, DLManagedTensor** ppTensor, ToupcamFrameInfoV4* pInfo = NULL)
+    {
+        if (NULL == ppTensor)
+            return (HRESULT)0x80004003; /* E_POINTER */
+        *ppTensor = NULL;
+        Slot* s = NULL;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_free.empty())
+                return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+            s = m_free.back();
+            m_free.pop_back();
+        }
+        memset(&s->info, 0, sizeof(s->info));
+        const HRESULT hr = Toupcam_WaitImageV4(m_hcam, nWaitMS, s->buf.data(), 0, m_bits, -1, &s->info);
+        if (FAILED(hr))
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_free.push_back(s);
+            return hr;
+        }
+        describe(s);
+        ++m_ref;
+        ++m_nLeased;
+        if (pInfo)
+            *pInfo = s->info;
+        *ppTensor = &s->tensor;
+        return hr;
+    }
+
+    unsigned slots() const { return (unsigned)m_slot.size(); }
+    unsigned leased() const { return m_nLeased; }
+    size_t frameBytes() const { return m_frameBytes; }
+};
+
+#endif
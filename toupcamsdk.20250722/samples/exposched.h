@@ -0,0 +1,227 @@
+#ifndef __exposched_H__
+#define __exposched_H__
+
+/*
+    Exposure changes scheduled on a frame: schedule(seq, time, gain) asks for the settings on frame seq, and every
+    pulled frame is tagged with the request it carries, so a program changing the exposure frame by frame (software
+    bracketing, the series of democns) uses every frame instead of waiting a fixed delay after each change.
+    Toupcam_put_ExpoTime / _ExpoAGain take effect a few frames later: the sensor latches its registers at a frame
+    start, and the pipeline of the SDK holds the frames already exposed. That lag, in frames from the last frame
+    pulled when the settings are put to the first frame which carries them, is stable for a camera and mode, and
+    the frame info tells it after the fact (TOUPCAM_FRAMEINFO_FLAG_EXPOTIME / _EXPOGAIN). ExpoSchedule learns it
+    from the frames: each request is put at the pull of frame target - lag, so it lands on its target; lag() is the
+    largest of the last EXPOSCHED_LAGS observations, EXPOSCHED_LAG until the first one.
+    The tag of a frame comes from its frame info (EXPOSCHED_REPORTED), not from the lag: the sensor takes the
+    requests in order, so the frame carries the request of the previous frame or the oldest after it whose exposure
+    time and gain are the ones in its frame info (of a run of equal requests, the newest the lag says is due); with
+    EXPOSCHED_FIRST on the first frame of the request, and EXPOSCHED_ON_TARGET when that is the target. A frame
+    which carries no request (the auto exposure, a Toupcam_put_ExpoTime of someone else) has no EXPOSCHED_CARRIES.
+    For a camera whose frame info has no exposure time, the request is the one of the lag, put lag frames before (no
+    EXPOSCHED_REPORTED): a prediction. The requests are put one per frame, in the order of their targets, so each of
+    them gets at least one frame even when the program schedules late; one which never shows up (settings replaced
+    before the sensor latched them, frames dropped) is counted in missed(). Settings equal to the ones of the
+    previous frame teach nothing about the lag. expoGain 0: the gain is not changed and not compared.
+    Not thread safe: schedule() and frame() are called from the thread pulling the frames (in the event callback,
+    frame() first, then the scheduling of the next frames); frame() for every frame pulled, in order. reset() after a
+    restart of the camera, which restarts seq.
+*/
+#include "toupcam.h"
+
+#define EXPOSCHED_HISTORY       16      /* requests, put or pending */
+#define EXPOSCHED_LAGS          8       /* observations of the lag */
+#define EXPOSCHED_LAG           2       /* frames, before the first observation */
+
+/* ExpoTag::flag */
+#define EXPOSCHED_CARRIES       0x01    /* the frame carries the settings of request id */
+#define EXPOSCHED_REPORTED      0x02    /* by its frame info, else predicted by the lag */
+#define EXPOSCHED_FIRST         0x04    /* the first frame of the request */
+#define EXPOSCHED_ON_TARGET     0x08    /* the first frame of the request is its target */
+
+struct ExpoTag {
+    unsigned flag;                  /* EXPOSCHED_xxx */
+    unsigned id, user;              /* of the request, with EXPOSCHED_CARRIES */
+    unsigned target, first;         /* seq asked for and seq of the first frame of the request */
+    unsigned expoTime;              /* of the frame */
+    unsigned short expoGain;
+};
+
+class ExpoSchedule {
+    struct Request {
+        unsigned id, user, target, first, issued;   /* issued: seq of the last frame pulled when put */
+        unsigned expoTime;
+        unsigned short expoGain;
+        bool bIssued;                   /* issued is known: put after a frame */
+        bool bSeen;
+    };
+    HToupcam m_hcam;
+    Request m_req[EXPOSCHED_HISTORY];
+    unsigned m_tail, m_issue, m_head;   /* ids: [m_tail, m_issue) put, [m_issue, m_head) pending */
+    unsigned m_last;                    /* seq of the last frame pulled */
+    bool m_bPulled;
+    unsigned m_lag, m_lags[EXPOSCHED_LAGS], m_nLags;
+    unsigned m_prevTime;                /* of the last frame */
+    unsigned short m_prevGain;
+    unsigned m_missed;
+
+    Request& at(unsigned id) { return m_req[id % EXPOSCHED_HISTORY]; }
+
+    bool same(const Request& r, unsigned expoTime, unsigned short expoGain) const
+    {
+        return (r.expoTime == expoTime) && ((0 == r.expoGain) || (0 == expoGain) || (r.expoGain == expoGain));
+    }
+
+    /* on frame seq by the lag */
+    bool due(const Request& r, unsigned seq) const
+    {
+        return (!r.bIssued) || (r.issued + m_lag <= seq);
+    }
+
+    /* the oldest pending request, when it is due; S_FALSE: nothing due */
+    HRESULT issue()
+    {
+        if ((m_issue == m_head) || (m_bPulled && (at(m_issue).target > m_last + m_lag)))
+            return 1;   /* S_FALSE */
+        Request& r = at(m_issue);
+        HRESULT hr = Toupcam_put_ExpoTime(m_hcam, r.expoTime);
+        if (SUCCEEDED(hr) && r.expoGain)
+            hr = Toupcam_put_ExpoAGain(m_hcam, r.expoGain);
+        /* the values of the sensor, rounded, are the ones of the frame info */
+        if (SUCCEEDED(hr))
+            hr = Toupcam_get_ExpoTime(m_hcam, &r.expoTime);
+        if (SUCCEEDED(hr) && r.expoGain)
+            hr = Toupcam_get_ExpoAGain(m_hcam, &r.expoGain);
+        if (FAILED(hr))
+            return hr;
+        r.issued = m_last;
+        r.bIssued = m_bPulled;
+        ++m_issue;
+        return 0;   /* S_OK */
+    }
+
+    void observe(unsigned lag)
+    {
+        m_lags[m_nLags++ % EXPOSCHED_LAGS] = lag;
+        m_lag = 0;
+        for (unsigned i = 0, n = (m_nLags < EXPOSCHED_LAGS) ? m_nLags : EXPOSCHED_LAGS; i < n; ++i)
+        {
+            if (m_lags[i] > m_lag)
+                m_lag = m_lags[i];
+        }
+    }
+public:
+    ExpoSchedule()
+    : m_hcam(NULL), m_lag(EXPOSCHED_LAG), m_nLags(0)
+    {
+        reset();
+    }
+
+    void init(HToupcam h, unsigned lag = EXPOSCHED_LAG)
+    {
+        m_hcam = h;
+        reset();
+        m_lag = lag;
+        m_nLags = 0;
+    }
+
+    /* the requests dropped, the lag kept */
+    void reset()
+    {
+        m_tail = m_issue = m_head = 0;
+        m_last = 0;
+        m_bPulled = false;
+        m_prevTime = 0;
+        m_prevGain = 0;
+        m_missed = 0;
+    }
+
+    /*
+        the settings on frame seq, in the order of the targets: E_INVALIDARG for a target not after the one of the last
+        request, E_OUTOFMEMORY with EXPOSCHED_HISTORY requests not retired yet. A request already due is put at once,
+        before the first frame too (the first frames tell which the camera started with).
+    */
+    HRESULT schedule(unsigned seq, unsigned expoTime, unsigned short expoGain = 0, unsigned user = 0, unsigned* pId = NULL)
+    {
+        if ((NULL == m_hcam) || ((m_head != m_tail) && (seq <= at(m_head - 1).target)))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        if (m_head - m_tail >= EXPOSCHED_HISTORY)
+            return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+        Request& r = at(m_head);
+        r.id = m_head;
+        r.user = user;
+        r.target = seq;
+        r.first = 0;
+        r.issued = 0;
+        r.expoTime = expoTime;
+        r.expoGain = expoGain;
+        r.bIssued = r.bSeen = false;
+        if (pId)
+            *pId = m_head;
+        ++m_head;
+        const HRESULT hr = (m_issue + 1 == m_head) ? issue() : 1;
+        return FAILED(hr) ? hr : 0;
+    }
+
+    /* the tag of a frame pulled, then the request due put; the HRESULT of the put */
+    HRESULT frame(const ToupcamFrameInfoV3& info, ExpoTag* pTag)
+    {
+        ExpoTag tag = { 0 };
+        tag.expoTime = (info.flag & TOUPCAM_FRAMEINFO_FLAG_EXPOTIME) ? info.expotime : 0;
+        tag.expoGain = (info.flag & TOUPCAM_FRAMEINFO_FLAG_EXPOGAIN) ? info.expogain : 0;
+        const bool bReported = (0 != tag.expoTime);
+        /* the carrier is the previous one or after it: the oldest which matches, the newest due of a run of equal ones */
+        unsigned id = m_tail;
+        if (bReported)
+        {
+            while ((id != m_issue) && !same(at(id), tag.expoTime, tag.expoGain))
+                ++id;
+        }
+        else if ((id != m_issue) && !due(at(id), info.seq))
+            id = m_issue;
+        if (id != m_issue)
+        {
+            while ((id + 1 != m_issue) && due(at(id + 1), info.seq) && (!bReported || same(at(id + 1), at(id).expoTime, at(id).expoGain)))
+                ++id;
+            Request& r = at(id);
+            /* the older ones are replaced */
+            for (; m_tail != id; ++m_tail)
+            {
+                if (!at(m_tail).bSeen)
+                    ++m_missed;
+            }
+            tag.flag = EXPOSCHED_CARRIES | (bReported ? EXPOSCHED_REPORTED : 0);
+            if (!r.bSeen)
+            {
+                r.bSeen = true;
+                r.first = info.seq;
+                tag.flag |= EXPOSCHED_FIRST | ((r.first == r.target) ? EXPOSCHED_ON_TARGET : 0);
+                if (bReported && r.bIssued && (info.seq > r.issued) && ((tag.expoTime != m_prevTime) || (tag.expoGain != m_prevGain)))
+                    observe(info.seq - r.issued);
+            }
+            tag.id = r.id;
+            tag.user = r.user;
+            tag.target = r.target;
+            tag.first = r.first;
+            if (!bReported)
+            {
+                tag.expoTime = r.expoTime;
+                tag.expoGain = r.expoGain;
+            }
+        }
+        m_prevTime = tag.expoTime;
+        m_prevGain = tag.expoGain;
+        m_last = info.seq;
+        m_bPulled = true;
+        if (pTag)
+            *pTag = tag;
+        const HRESULT hr = issue();
+        return FAILED(hr) ? hr : 0;
+    }
+
+    unsigned lag() const { return m_lag; }
+    /* the first target a request scheduled now can reach */
+    unsigned earliest() const { return m_bPulled ? (m_last + m_lag) : 0; }
+    unsigned pending() const { return m_head - m_issue; }
+    unsigned missed() const { return m_missed; }
+};
+
+#endif
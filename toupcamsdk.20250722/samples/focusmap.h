@@ -0,0 +1,146 @@
+#ifndef __focusmap_H__
+#define __focusmap_H__
+
+/*
+    Focus map of an area scan: the best Z measured at some XY positions, and a prediction of the best Z anywhere else,
+    so that a tile is only searched when the prediction is not good enough.
+    add() stores a measure (x, y, best z, focus value at best z) in a grid of FOCUSMAP_CELL mm cells. predict() takes
+    the measures within FOCUSMAP_RADIUS of (x, y), the nearest FOCUSMAP_NEIGHBOURS of them, and fits the plane
+    z = a + b dx + c dy weighted by 1 / distance^2; with fewer than 3 measures, or measures on a line, the prediction
+    is their weighted mean, only good as the centre of a search.
+    Its uncertainty is the weighted rms of the fit (FOCUSMAP_MIN_SIGMA at least: the repeatability of the autofocus)
+    plus FOCUSMAP_DRIFT mm per mm of distance to the nearest measure, for the bending of the sample between them; with
+    no measure in the radius there is no prediction.
+    needSearch(): a fine search is needed when there is no plane, its uncertainty is above maxSigma, or the focus
+    value at the predicted z, measured by the caller, is more than FOCUSMAP_FV_DROP below the focus values of the
+    neighbours (a content with less detail than its neighbours is searched too, which costs time, not focus).
+    Units are those of the stage: mm.
+*/
+#include <math.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#define FOCUSMAP_CELL           1.0
+#define FOCUSMAP_RADIUS         5.0
+#define FOCUSMAP_NEIGHBOURS     8
+#define FOCUSMAP_MIN_SIGMA      0.001
+#define FOCUSMAP_DRIFT          0.002   /* mm of Z per mm of XY */
+#define FOCUSMAP_FV_DROP        0.3
+
+typedef struct {
+    double x, y, z, fv;
+} FocusPoint;
+
+typedef struct {
+    double z, sigma;
+    double fv;          /* median focus value of the neighbours */
+    unsigned n;         /* measures used, 0 = no prediction */
+    bool bPlane;        /* false: mean of the measures */
+} FocusPrediction;
+
+class FocusMap {
+    std::vector<FocusPoint> m_points;
+    std::map<std::pair<int, int>, std::vector<size_t> > m_grid;
+
+    static std::pair<int, int> cell(double x, double y)
+    {
+        return std::make_pair((int)floor(x / FOCUSMAP_CELL), (int)floor(y / FOCUSMAP_CELL));
+    }
+public:
+    void add(double x, double y, double z, double fv)
+    {
+        const FocusPoint pt = { x, y, z, fv };
+        m_grid[cell(x, y)].push_back(m_points.size());
+        m_points.push_back(pt);
+    }
+
+    void clear()
+    {
+        m_points.clear();
+        m_grid.clear();
+    }
+
+    size_t count() const { return m_points.size(); }
+
+    FocusPrediction predict(double x, double y) const
+    {
+        FocusPrediction p = { 0.0, 0.0, 0.0, 0, false };
+        std::vector<std::pair<double, size_t> > near;   /* distance^2, index */
+        const int r = (int)ceil(FOCUSMAP_RADIUS / FOCUSMAP_CELL);
+        const std::pair<int, int> c = cell(x, y);
+        for (int i = c.first - r; i <= c.first + r; ++i)
+        {
+            for (int j = c.second - r; j <= c.second + r; ++j)
+            {
+                std::map<std::pair<int, int>, std::vector<size_t> >::const_iterator it = m_grid.find(std::make_pair(i, j));
+                if (it == m_grid.end())
+                    continue;
+                for (size_t k = 0; k < it->second.size(); ++k)
+                {
+                    const FocusPoint& pt = m_points[it->second[k]];
+                    const double d2 = (pt.x - x) * (pt.x - x) + (pt.y - y) * (pt.y - y);
+                    if (d2 <= FOCUSMAP_RADIUS * FOCUSMAP_RADIUS)
+                        near.push_back(std::make_pair(d2, it->second[k]));
+                }
+            }
+        }
+        if (near.empty())
+            return p;
+        std::sort(near.begin(), near.end());
+        if (near.size() > FOCUSMAP_NEIGHBOURS)
+            near.resize(FOCUSMAP_NEIGHBOURS);
+
+        /* weighted least squares of z = a + b dx + c dy */
+        double s[3][3] = { { 0 } }, t[3] = { 0 }, sw = 0.0, swz = 0.0;
+        std::vector<double> fvs;
+        for (size_t k = 0; k < near.size(); ++k)
+        {
+            const FocusPoint& pt = m_points[near[k].second];
+            const double w = 1.0 / (near[k].first + FOCUSMAP_CELL * FOCUSMAP_CELL * 1e-4);
+            const double u[3] = { 1.0, pt.x - x, pt.y - y };
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 3; ++j)
+                    s[i][j] += w * u[i] * u[j];
+                t[i] += w * u[i] * pt.z;
+            }
+            sw += w;
+            swz += w * pt.z;
+            fvs.push_back(pt.fv);
+        }
+        const double det = s[0][0] * (s[1][1] * s[2][2] - s[1][2] * s[2][1]) - s[0][1] * (s[1][0] * s[2][2] - s[1][2] * s[2][0]) + s[0][2] * (s[1][0] * s[2][1] - s[1][1] * s[2][0]);
+        double a = swz / sw, b = 0.0, cc = 0.0;
+        if ((near.size() >= 3) && (fabs(det) > 1e-12 * s[0][0] * s[0][0] * s[0][0]))
+        {
+            a = (t[0] * (s[1][1] * s[2][2] - s[1][2] * s[2][1]) - s[0][1] * (t[1] * s[2][2] - s[1][2] * t[2]) + s[0][2] * (t[1] * s[2][1] - s[1][1] * t[2])) / det;
+            b = (s[0][0] * (t[1] * s[2][2] - s[1][2] * t[2]) - t[0] * (s[1][0] * s[2][2] - s[1][2] * s[2][0]) + s[0][2] * (s[1][0] * t[2] - t[1] * s[2][0])) / det;
+            cc = (s[0][0] * (s[1][1] * t[2] - t[1] * s[2][1]) - s[0][1] * (s[1][0] * t[2] - t[1] * s[2][0]) + t[0] * (s[1][0] * s[2][1] - s[1][1] * s[2][0])) / det;
+            p.bPlane = true;
+        }
+        double swr = 0.0;
+        for (size_t k = 0; k < near.size(); ++k)
+        {
+            const FocusPoint& pt = m_points[near[k].second];
+            const double w = 1.0 / (near[k].first + FOCUSMAP_CELL * FOCUSMAP_CELL * 1e-4);
+            const double res = pt.z - (a + b * (pt.x - x) + cc * (pt.y - y));
+            swr += w * res * res;
+        }
+        std::nth_element(fvs.begin(), fvs.begin() + fvs.size() / 2, fvs.end());
+        p.z = a;
+        p.sigma = std::max(FOCUSMAP_MIN_SIGMA, sqrt(swr / sw)) + FOCUSMAP_DRIFT * sqrt(near[0].first);
+        p.fv = fvs[fvs.size() / 2];
+        p.n = (unsigned)near.size();
+        return p;
+    }
+
+    /* fv: focus value measured at p.z, < 0 if not measured */
+    static bool needSearch(const FocusPrediction& p, double maxSigma, double fv)
+    {
+        if ((!p.bPlane) || (p.sigma > maxSigma))
+            return true;
+        return (fv >= 0.0) && (p.fv > 0.0) && (fv < p.fv * (1.0 - FOCUSMAP_FV_DROP));
+    }
+};
+
+#endif
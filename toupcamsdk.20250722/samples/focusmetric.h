@@ -0,0 +1,103 @@
+#ifndef __focusmetric_H__
+#define __focusmetric_H__
+
+/*
+    Focus value of every frame over a region, for a focus sweep driven by an external Z axis.
+    FocusMetric::setRoi() hands the region to the camera (Toupcam_put_AFRoi) and keeps it for the host. value() returns
+    the focus value of the camera (uFV of ToupcamFrameInfoV4) when the frame carries one (TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS,
+    cameras with TOUPCAM_FLAG_AUTO_FOCUS), otherwise the Tenengrad of the region (hostfocus.h), computed on the host from
+    the frame already pulled: only the region is read, never the whole frame. The two are different scales, a sweep
+    must not mix them: source() tells which one the last value was.
+    RAW mode: 8 bits Bayer (TOUPCAM_OPTION_BITDEPTH = 0); RGB mode: RGB24.
+    FocusSweep() is the coarse to fine search: steps positions over [zMin, zMax], then again around the best one with
+    the step of the previous pass, passes times, never out of [zMin, zMax]; the caller moves the axis and measures in
+    the FOCUSSWEEP_MEASURE.
+*/
+#include <algorithm>
+#include "toupcam.h"
+#include "hostfocus.h"
+
+#define FOCUSMETRIC_CAMERA      1
+#define FOCUSMETRIC_HOST        2
+
+class FocusMetric {
+    unsigned m_left, m_top, m_width, m_height;
+    int m_source;
+public:
+    FocusMetric()
+    : m_left(0), m_top(0), m_width(0), m_height(0), m_source(0)
+    {
+    }
+
+    /* 0, 0, 0, 0 = the whole frame; returns the result of Toupcam_put_AFRoi, the host value does not depend on it */
+    HRESULT setRoi(HToupcam h, unsigned left, unsigned top, unsigned width, unsigned height)
+    {
+        m_left = left;
+        m_top = top;
+        m_width = width;
+        m_height = height;
+        return Toupcam_put_AFRoi(h, left, top, width, height);
+    }
+
+    int source() const { return m_source; }
+
+    /* data: RGB24 (pitch TDIBWIDTHBYTES) or RAW8 (pitch = width) as pulled */
+    double value(const ToupcamFrameInfoV4& info, const void* data, bool bRaw)
+    {
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS)
+        {
+            m_source = FOCUSMETRIC_CAMERA;
+            return (double)info.uFV;
+        }
+        m_source = FOCUSMETRIC_HOST;
+        HostFocusRoi roi = { m_left, m_top, m_width, m_height };
+        if ((0 == roi.width) || (0 == roi.height))
+        {
+            roi.left = roi.top = 0;
+            roi.width = info.v3.width;
+            roi.height = info.v3.height;
+        }
+        roi.width = std::min(roi.width, info.v3.width - std::min(roi.left, info.v3.width));
+        roi.height = std::min(roi.height, info.v3.height - std::min(roi.top, info.v3.height));
+        if (bRaw)
+            return HostFocusMetric(HOSTFOCUS_TENENGRAD, HOSTFOCUS_BAYER8, data, info.v3.width, roi);
+        return HostFocusMetric(HOSTFOCUS_TENENGRAD, HOSTFOCUS_RGB24, data, TDIBWIDTHBYTES(info.v3.width * 24), roi);
+    }
+};
+
+/* moves the axis to z, waits for a frame exposed there and returns its focus value; false to abort the sweep */
+typedef bool (*FOCUSSWEEP_MEASURE)(void* ctx, double z, double* pValue);
+
+/* returns false if aborted, *pBest is then the best position so far */
+static inline bool FocusSweep(double zMin, double zMax, unsigned steps, unsigned passes, FOCUSSWEEP_MEASURE pFun, void* ctx, double* pBest)
+{
+    if (steps < 2)
+        steps = 2;
+    const double lo = zMin, hi = zMax;
+    double best = (zMin + zMax) / 2, bestValue = -1.0;
+    for (unsigned pass = 0; pass < passes; ++pass)
+    {
+        const double step = (zMax - zMin) / (steps - 1);
+        for (unsigned i = 0; i < steps; ++i)
+        {
+            const double z = zMin + step * i;
+            double v = 0.0;
+            if (!pFun(ctx, z, &v))
+            {
+                *pBest = best;
+                return false;
+            }
+            if (v > bestValue)
+            {
+                bestValue = v;
+                best = z;
+            }
+        }
+        zMin = std::max(lo, best - step);
+        zMax = std::min(hi, best + step);
+    }
+    *pBest = best;
+    return true;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef __focusqueue_H__
+#define __focusqueue_H__
+
+/*
+    A list of focus motor positions of the lens (Toupcam_put_AFFMPos), each held for a number of frames, driven from the
+    event callback: a lens Z-stack without a UI timer polling the lens.
+    push() the positions, start() sends the first one. Call onEvent() for TOUPCAM_EVENT_FOCUSPOS and onImage() for
+    every frame pulled, both from the event callback: the position is reached when curFM of Toupcam_get_LensInfo is
+    within the tolerance of it, or when it has not moved for FOCUSQUEUE_STALL frames (the lens stops a step short of
+    some positions, bReached is then false). The FOCUSQUEUE_SETTLE frames after that are skipped, they were exposed
+    during the last step of the motor; the next dwell frames are delivered through FOCUSQUEUE_CALLBACK, the one with
+    n = 0 telling that the position is reached (info.v3.seq), then the next position is sent. done() when the list is
+    over.
+    The lens must be in manual mode (Toupcam_put_AFMode(h, ToupcamAFMode_MANUAL, ...)), as demoaf does before moving it.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "toupcam.h"
+
+#define FOCUSQUEUE_SETTLE   1
+#define FOCUSQUEUE_STALL    10
+
+/* on the callback thread, data valid until it returns; n: 0 ... dwell - 1 */
+typedef void (*FOCUSQUEUE_CALLBACK)(void* ctx, unsigned index, int pos, bool bReached, unsigned n, const void* data, const ToupcamFrameInfoV4& info);
+
+class FocusQueue {
+    struct Entry {
+        int pos;
+        unsigned dwell;
+    };
+    HToupcam m_hcam;
+    FOCUSQUEUE_CALLBACK m_pFun;
+    void* m_ctx;
+    int m_tolerance;
+    std::vector<Entry> m_list;
+    size_t m_index;
+    int m_lastFM;
+    unsigned m_stall, m_skip, m_n;
+    bool m_bMoving, m_bReached;
+
+    void send()
+    {
+        m_bMoving = true;
+        m_bReached = false;
+        m_stall = m_n = 0;
+        m_skip = FOCUSQUEUE_SETTLE;
+        if (m_index < m_list.size())
+            Toupcam_put_AFFMPos(m_hcam, m_list[m_index].pos);
+    }
+
+    void check(bool bFrame)
+    {
+        ToupcamLensInfo lens;
+        memset(&lens, 0, sizeof(lens));
+        if (FAILED(Toupcam_get_LensInfo(m_hcam, &lens)))
+            return;
+        if (abs(lens.curFM - m_list[m_index].pos) <= m_tolerance)
+        {
+            m_bMoving = false;
+            m_bReached = true;
+        }
+        else if (bFrame)
+        {
+            m_stall = (lens.curFM == m_lastFM) ? (m_stall + 1) : 0;
+            if (m_stall >= FOCUSQUEUE_STALL)
+                m_bMoving = false;
+        }
+        m_lastFM = lens.curFM;
+    }
+public:
+    FocusQueue(HToupcam h, FOCUSQUEUE_CALLBACK pFun, void* ctx, int tolerance)
+    : m_hcam(h), m_pFun(pFun), m_ctx(ctx), m_tolerance(tolerance), m_index(0), m_lastFM(0x7fffffff),
+    m_stall(0), m_skip(0), m_n(0), m_bMoving(false), m_bReached(false)
+    {
+    }
+
+    void push(int pos, unsigned dwell)
+    {
+        const Entry e = { pos, dwell ? dwell : 1 };
+        m_list.push_back(e);
+    }
+
+    void start()
+    {
+        m_index = 0;
+        send();
+    }
+
+    bool done() const { return m_index >= m_list.size(); }
+
+    void onEvent(unsigned nEvent)
+    {
+        if ((TOUPCAM_EVENT_FOCUSPOS == nEvent) && m_bMoving && (!done()))
+            check(false);
+    }
+
+    void onImage(const void* data, const ToupcamFrameInfoV4& info)
+    {
+        if (done())
+            return;
+        if (m_bMoving)
+        {
+            check(true);
+            if (m_bMoving)
+                return;
+        }
+        if (m_skip)
+        {
+            --m_skip;
+            return;
+        }
+        m_pFun(m_ctx, (unsigned)m_index, m_list[m_index].pos, m_bReached, m_n, data, info);
+        if (++m_n >= m_list[m_index].dwell)
+        {
+            ++m_index;
+            send();
+        }
+    }
+};
+
+#endif
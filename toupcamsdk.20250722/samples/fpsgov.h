@@ -0,0 +1,203 @@
+#ifndef __fpsgov_H__
+#define __fpsgov_H__
+
+/*
+    Frame rate governor: a closed loop which keeps the frame rate of the camera at what the program actually consumes,
+    so the stream stays free of drops at the highest rate the program can take, instead of the camera producing frames
+    at its maximum and the SDK throwing away whatever the program is too slow for (TOUPCAM_OPTION_BACKEND_FULL).
+    Inputs, over each FPSGOV_INTERVAL_MS:
+        the time the consumer spends on a frame (done(), from the pull to the end of its processing, without the wait
+            for the next frame), averaged: with the number of consumers working in parallel this is the capacity of the
+            program in frames per second
+        the depth of the backend deque (TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT, the highest seen at done() and at tick())
+        the frames dropped (TOUPCAM_OPTION_BACKEND_FULL, TOUPCAM_OPTION_NUMBER_DROP_FRAME)
+    Control, additive increase / multiplicative decrease as the congestion control of a network:
+        a drop, or a deque which has filled up: down to FPSGOV_DECREASE of the current rate, and at most FPSGOV_HEADROOM
+            of the capacity
+        a deque which stayed (nearly) empty without a drop: up by FPSGOV_STEP of the maximum of the camera, as long as
+            it stays under FPSGOV_HEADROOM of the capacity
+        otherwise the rate holds; changes under FPSGOV_HYSTERESIS are ignored, so the camera is not reprogrammed for
+            nothing each interval
+    The rate goes to TOUPCAM_OPTION_PRECISE_FRAMERATE (0.1 fps) on a camera with TOUPCAM_FLAG_PRECISE_FRAMERATE, or
+    to TOUPCAM_OPTION_FRAMERATE (fps) on the others (their maximum is the rate measured before the first change).
+    With a precise frame rate, the USB bandwidth (TOUPCAM_OPTION_BANDWIDTH) follows it with FPSGOV_BANDWIDTH_MARGIN:
+    the less of the bus the camera takes, the more is left to the other cameras on it; TOUPCAM_OPTION_MAX_PRECISE_FRAMERATE
+    is read again after each change of bandwidth, as the range of the frame rate depends on it. A camera without
+    bandwidth control (E_NOTIMPL) just gets the frame rate.
+    Threads: done() from the consumer(s), tick() from any one thread (the consumer itself, or a timer), every frame or
+    every few tens of milliseconds; it only does something once per interval.
+    See samples/demoplan/bwplan.h for planning the bandwidth of several cameras on one bus up front.
+*/
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include "toupcam.h"
+
+#define FPSGOV_INTERVAL_MS          500
+#define FPSGOV_HEADROOM             0.9     /* highest share of the capacity of the consumer */
+#define FPSGOV_DECREASE             0.8     /* factor on a drop */
+#define FPSGOV_STEP                 0.05    /* of the maximum, increase per interval */
+#define FPSGOV_HYSTERESIS           0.02
+#define FPSGOV_BANDWIDTH_MARGIN     1.1
+
+class FpsGovernor {
+    typedef std::chrono::steady_clock Clock;
+    HToupcam m_h;
+    bool m_precise;
+    int m_min, m_max;           /* 0.1 fps; m_max 0: not known yet (no precise frame rate) */
+    int m_maxFull;              /* MAX_PRECISE_FRAMERATE at full bandwidth */
+    int m_rate;                 /* 0.1 fps, current target */
+    int m_bandwidth;            /* 0: not supported */
+    int m_dequeLength;
+    unsigned m_parallel;
+    int m_lastFull, m_lastDrop;
+    unsigned m_drops;
+    Clock::time_point m_last;
+    std::mutex m_lock;          /* what done() touches */
+    double m_ms;                /* average consumer time per frame, 0: nothing reported yet */
+    int m_depth;                /* highest backend deque depth in this interval */
+
+    int option(unsigned iOption, int def)
+    {
+        int val = def;
+        if (FAILED(Toupcam_get_Option(m_h, iOption, &val)))
+            return def;
+        return val;
+    }
+
+    void depth()
+    {
+        const int d = option(TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT, 0);
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_depth = std::max(m_depth, d);
+    }
+
+    HRESULT apply(int rate)
+    {
+        HRESULT hr;
+        if (!m_precise)
+        {
+            hr = Toupcam_put_Option(m_h, TOUPCAM_OPTION_FRAMERATE, std::max(1, (rate + 5) / 10));
+            if (SUCCEEDED(hr))
+                m_rate = rate;
+            return hr;
+        }
+        if (m_bandwidth)
+        {
+            const int bw = std::min(TOUPCAM_BANDWIDTH_MAX, std::max(TOUPCAM_BANDWIDTH_MIN, (int)(100.0 * rate / m_maxFull * FPSGOV_BANDWIDTH_MARGIN + 0.999)));
+            if (bw != m_bandwidth)
+            {
+                hr = Toupcam_put_Option(m_h, TOUPCAM_OPTION_BANDWIDTH, bw);
+                if (SUCCEEDED(hr))
+                {
+                    m_bandwidth = bw;
+                    m_max = option(TOUPCAM_OPTION_MAX_PRECISE_FRAMERATE, m_max);
+                }
+            }
+        }
+        rate = std::min(rate, m_max);
+        hr = Toupcam_put_Option(m_h, TOUPCAM_OPTION_PRECISE_FRAMERATE, rate);
+        if (SUCCEEDED(hr))
+            m_rate = rate;
+        return hr;
+    }
+public:
+    FpsGovernor()
+    : m_h(NULL), m_precise(false), m_min(10), m_max(0), m_maxFull(0), m_rate(0), m_bandwidth(0), m_dequeLength(3), m_parallel(1)
+    , m_lastFull(0), m_lastDrop(0), m_drops(0), m_ms(0.0), m_depth(0)
+    {
+    }
+
+    /* after Toupcam_Open, before or after the start; consumers: frames processed in parallel */
+    HRESULT init(HToupcam h, unsigned consumers = 1)
+    {
+        if ((NULL == h) || (0 == consumers))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        m_h = h;
+        m_parallel = consumers;
+        m_precise = (Toupcam_query_Model(h)->flag & TOUPCAM_FLAG_PRECISE_FRAMERATE) ? true : false;
+        m_dequeLength = option(TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, 3);
+        m_lastFull = option(TOUPCAM_OPTION_BACKEND_FULL, 0);
+        m_lastDrop = option(TOUPCAM_OPTION_NUMBER_DROP_FRAME, 0);
+        m_last = Clock::now();
+        if (!m_precise)
+        {
+            m_min = 10;
+            m_max = m_rate = 0;     /* TOUPCAM_OPTION_FRAMERATE 0: no limit, until the first tick() measures it */
+            return Toupcam_put_Option(h, TOUPCAM_OPTION_FRAMERATE, 0);
+        }
+        /* start at full bandwidth and the maximum frame rate: the loop comes down to what the program takes */
+        m_bandwidth = SUCCEEDED(Toupcam_put_Option(h, TOUPCAM_OPTION_BANDWIDTH, TOUPCAM_BANDWIDTH_MAX)) ? TOUPCAM_BANDWIDTH_MAX : 0;
+        m_min = std::max(1, option(TOUPCAM_OPTION_MIN_PRECISE_FRAMERATE, 10));
+        m_maxFull = m_max = option(TOUPCAM_OPTION_MAX_PRECISE_FRAMERATE, 0);
+        if (m_max <= m_min)
+            return (HRESULT)0x80004001; /* E_NOTIMPL */
+        return apply(m_max);
+    }
+
+    /* the consumer is done with one frame, after ms milliseconds */
+    void done(double ms)
+    {
+        depth();
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_ms = (m_ms > 0.0) ? (m_ms * 0.8 + ms * 0.2) : ms;
+    }
+
+    /* true when it changed the frame rate */
+    bool tick()
+    {
+        if (NULL == m_h)
+            return false;
+        depth();
+        const Clock::time_point now = Clock::now();
+        if (now - m_last < std::chrono::milliseconds(FPSGOV_INTERVAL_MS))
+            return false;
+        m_last = now;
+
+        double ms;
+        int d;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            ms = m_ms;
+            d = m_depth;
+            m_depth = 0;
+        }
+        const int full = option(TOUPCAM_OPTION_BACKEND_FULL, m_lastFull), drop = option(TOUPCAM_OPTION_NUMBER_DROP_FRAME, m_lastDrop);
+        const unsigned dropped = (unsigned)std::max(full - m_lastFull, drop - m_lastDrop);
+        m_lastFull = full;
+        m_lastDrop = drop;
+        m_drops += dropped;
+
+        if (0 == m_max)
+        {
+            unsigned nFrame = 0, nTime = 0, nTotal = 0;
+            if (FAILED(Toupcam_get_FrameRate(m_h, &nFrame, &nTime, &nTotal)) || (0 == nTime) || (0 == nFrame))
+                return false;
+            m_max = m_rate = std::max(m_min, (int)(nFrame * 10000.0 / nTime));
+        }
+
+        const double cap = (ms > 0.0) ? (m_parallel * 10000.0 / ms * FPSGOV_HEADROOM) : m_max;
+        double rate = m_rate;
+        if (dropped || (d >= m_dequeLength))
+            rate = std::min(m_rate * FPSGOV_DECREASE, cap);
+        else if (d <= 1)
+            rate = std::min(m_rate + m_max * FPSGOV_STEP, std::max(cap, (double)m_rate));
+        const int target = std::min(m_max, std::max(m_min, (int)rate));
+        if (std::abs(target - m_rate) < std::max(1, (int)(m_rate * FPSGOV_HYSTERESIS)))
+            return false;
+        return SUCCEEDED(apply(target));
+    }
+
+    double fps() const { return m_rate / 10.0; }            /* target */
+    double maxfps() const { return m_max / 10.0; }
+    int bandwidth() const { return m_bandwidth; }           /* 0: not supported */
+    unsigned drops() const { return m_drops; }              /* since init() */
+    double capacity()                                       /* fps the consumer(s) can take, 0: not known yet */
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return (m_ms > 0.0) ? (m_parallel * 1000.0 / m_ms) : 0.0;
+    }
+};
+
+#endif
@@ -0,0 +1,396 @@
+#ifndef __framebus_H__
+#define __framebus_H__
+
+/*
+    Cross-process frame bus: the process which opened the camera (only one can) publishes every frame into a named
+    shared memory ring, and any number of other processes (a recorder, an analysis tool, a Python app through ctypes
+    and mmap) attach to it by name, read-only, and use the frames in place: no socket, no copy, no serialization.
+    The publisher pulls straight into the next slot (begin, Toupcam_PullImageV4 into the pointer, commit), so there
+    is no copy on that side either.
+    Layout, all fields 32-bit little-endian words unless noted, for the readers in other languages:
+        offset 0        FrameBusHeader
+        offset n * FrameBusHeader.slotStride + FRAMEBUS_ALIGN, slot n % slotCount
+                        FrameBusSlot (begin, end, size, ToupcamFrameInfoV4), then the frame at FRAMEBUS_SLOTHDR
+    A slot is written under a sequence lock: begin = n before the data, end = n after, so a frame is intact when
+    end == begin == its number, read once before and once after it has been used. A reader which holds a frame for
+    longer than the ring lasts (slotCount - 1 frames) finds it overwritten at release() and drops the result; a
+    reader which falls behind skips to the oldest frame still in the ring, and the frames it missed are counted.
+    Notification: FrameBusHeader.seq, the number of the last frame committed, is the word waited on: a futex on Linux,
+    a named auto-reset event per reader on Windows (FRAMEBUS_READERS of them, registered in a small writable section
+    "<name>_readers" so that the ring itself stays read-only to the readers); elsewhere the readers poll every ms.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <limits.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#include "toupcam.h"
+
+#define FRAMEBUS_MAGIC      "TFRMBUS1"
+#define FRAMEBUS_ALIGN      4096
+#define FRAMEBUS_SLOTHDR    256         /* offset of the frame in a slot */
+#define FRAMEBUS_READERS    16
+
+typedef struct {
+    char magic[8];
+    uint32_t slotCount, slotStride, slotSize;   /* slotSize: the largest frame */
+    uint32_t seq;                               /* the last frame committed, 0: none yet */
+} FrameBusHeader;
+
+typedef struct {
+    uint32_t begin, end, size;
+    ToupcamFrameInfoV4 info;
+} FrameBusSlot;
+
+typedef struct {
+    uint32_t generation;                        /* changes with every registration */
+    uint32_t active[FRAMEBUS_READERS];          /* Windows: reader i waits on the event "<name>_reader<i>" */
+} FrameBusReaders;
+
+/* the named mapping, the same on both sides */
+class FrameBusMap {
+protected:
+    void* m_pBase;
+    size_t m_size;
+#if defined(_WIN32)
+    HANDLE m_hMap, m_hRegMap;
+    FrameBusReaders* m_pReaders;
+#else
+    std::string m_shmName;
+#endif
+    std::string m_name;
+
+    FrameBusMap()
+    : m_pBase(NULL), m_size(0)
+#if defined(_WIN32)
+    , m_hMap(NULL), m_hRegMap(NULL), m_pReaders(NULL)
+#endif
+    {
+    }
+
+    ~FrameBusMap() { unmap(); }
+
+    FrameBusHeader* header() const { return (FrameBusHeader*)m_pBase; }
+    FrameBusSlot* slot(uint32_t n) const
+    {
+        return (FrameBusSlot*)((unsigned char*)m_pBase + FRAMEBUS_ALIGN + (size_t)(n % header()->slotCount) * header()->slotStride);
+    }
+    static unsigned char* data(FrameBusSlot* s) { return (unsigned char*)s + FRAMEBUS_SLOTHDR; }
+    std::atomic<uint32_t>* seqWord() const { return (std::atomic<uint32_t>*)&header()->seq; }
+
+    bool map(const char* name, size_t size, bool bCreate)
+    {
+        m_name = name;
+#if defined(_WIN32)
+        const std::string mapName = std::string("Local\\") + name, regName = mapName + "_readers";
+        if (bCreate)
+        {
+            m_hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, mapName.c_str());
+            m_hRegMap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(FrameBusReaders), regName.c_str());
+        }
+        else
+        {
+            m_hMap = OpenFileMappingA(FILE_MAP_READ, FALSE, mapName.c_str());
+            m_hRegMap = OpenFileMappingA(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, regName.c_str());
+        }
+        if ((NULL == m_hMap) || (NULL == m_hRegMap))
+            return false;
+        m_pBase = MapViewOfFile(m_hMap, bCreate ? (FILE_MAP_READ | FILE_MAP_WRITE) : FILE_MAP_READ, 0, 0, size);
+        m_pReaders = (FrameBusReaders*)MapViewOfFile(m_hRegMap, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(FrameBusReaders));
+        if ((NULL == m_pBase) || (NULL == m_pReaders))
+            return false;
+        if (0 == size)
+        {
+            MEMORY_BASIC_INFORMATION mbi;
+            VirtualQuery(m_pBase, &mbi, sizeof(mbi));
+            size = mbi.RegionSize;
+        }
+#else
+        m_shmName = std::string("/") + name;
+        const int fd = bCreate ? shm_open(m_shmName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : shm_open(m_shmName.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        if (bCreate && ftruncate(fd, (off_t)size))
+        {
+            ::close(fd);
+            return false;
+        }
+        if (0 == size)
+        {
+            struct stat st;
+            if (fstat(fd, &st))
+            {
+                ::close(fd);
+                return false;
+            }
+            size = (size_t)st.st_size;
+        }
+        m_pBase = mmap(NULL, size, bCreate ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (MAP_FAILED == m_pBase)
+        {
+            m_pBase = NULL;
+            return false;
+        }
+#endif
+        m_size = size;
+        return true;
+    }
+
+    void unmap()
+    {
+#if defined(_WIN32)
+        if (m_pReaders)
+            UnmapViewOfFile(m_pReaders);
+        if (m_pBase)
+            UnmapViewOfFile(m_pBase);
+        if (m_hRegMap)
+            CloseHandle(m_hRegMap);
+        if (m_hMap)
+            CloseHandle(m_hMap);
+        m_pReaders = NULL;
+        m_hMap = m_hRegMap = NULL;
+#else
+        if (m_pBase)
+            munmap(m_pBase, m_size);
+#endif
+        m_pBase = NULL;
+        m_size = 0;
+    }
+};
+
+class FrameBusWriter : public FrameBusMap {
+#if defined(_WIN32)
+    HANDLE m_hEvent[FRAMEBUS_READERS];
+    uint32_t m_generation;
+#endif
+    uint32_t m_next;
+public:
+    FrameBusWriter()
+    : m_next(1)
+    {
+#if defined(_WIN32)
+        memset(m_hEvent, 0, sizeof(m_hEvent));
+        m_generation = 0;
+#endif
+    }
+
+    ~FrameBusWriter() { close(); }
+
+    /* slotSize: the largest frame, such as TDIBWIDTHBYTES(24 * width) * height */
+    bool create(const char* name, uint32_t slotCount, uint32_t slotSize)
+    {
+        if (slotCount < 2)
+            return false;
+        const uint32_t stride = (FRAMEBUS_SLOTHDR + slotSize + FRAMEBUS_ALIGN - 1) / FRAMEBUS_ALIGN * FRAMEBUS_ALIGN;
+        if (!map(name, FRAMEBUS_ALIGN + (size_t)stride * slotCount, true))
+            return false;
+        FrameBusHeader* h = header();
+        memset(h, 0, sizeof(FrameBusHeader));
+        h->slotCount = slotCount;
+        h->slotStride = stride;
+        h->slotSize = slotSize;
+        for (uint32_t i = 0; i < slotCount; ++i)
+            memset(slot(i), 0, sizeof(FrameBusSlot));
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(h->magic, FRAMEBUS_MAGIC, 8);     /* last: a reader attaching now sees a complete header or none */
+        return true;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        for (int i = 0; i < FRAMEBUS_READERS; ++i)
+        {
+            if (m_hEvent[i])
+                CloseHandle(m_hEvent[i]);
+            m_hEvent[i] = NULL;
+        }
+#else
+        if (m_pBase)
+            shm_unlink(m_shmName.c_str());
+#endif
+        unmap();
+    }
+
+    /* the buffer of the next frame, slotSize bytes; the readers see the slot as being overwritten from now on */
+    void* begin()
+    {
+        FrameBusSlot* s = slot(m_next);
+        ((std::atomic<uint32_t>*)&s->begin)->store(m_next, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return data(s);
+    }
+
+    void commit(const ToupcamFrameInfoV4& info, uint32_t size)
+    {
+        FrameBusSlot* s = slot(m_next);
+        s->size = size;
+        s->info = info;
+        ((std::atomic<uint32_t>*)&s->end)->store(m_next, std::memory_order_release);
+        seqWord()->store(m_next, std::memory_order_release);
+        ++m_next;
+        if (0 == m_next)
+            m_next = 1;     /* 0 is "none" */
+#if defined(__linux__)
+        syscall(SYS_futex, &header()->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#elif defined(_WIN32)
+        if (m_generation != m_pReaders->generation)
+        {
+            m_generation = m_pReaders->generation;
+            for (int i = 0; i < FRAMEBUS_READERS; ++i)
+            {
+                if (m_hEvent[i])
+                    CloseHandle(m_hEvent[i]);
+                m_hEvent[i] = NULL;
+                if (m_pReaders->active[i])
+                {
+                    char evtName[MAX_PATH];
+                    sprintf(evtName, "Local\\%s_reader%d", m_name.c_str(), i);
+                    m_hEvent[i] = OpenEventA(EVENT_MODIFY_STATE, FALSE, evtName);
+                }
+            }
+        }
+        for (int i = 0; i < FRAMEBUS_READERS; ++i)
+        {
+            if (m_hEvent[i])
+                SetEvent(m_hEvent[i]);
+        }
+#endif
+    }
+};
+
+class FrameBusReader : public FrameBusMap {
+#if defined(_WIN32)
+    HANDLE m_hEvent;
+    int m_index;
+#endif
+    uint32_t m_next, m_held;
+public:
+    unsigned received, lost, torn;
+
+    FrameBusReader()
+    : m_next(0), m_held(0), received(0), lost(0), torn(0)
+    {
+#if defined(_WIN32)
+        m_hEvent = NULL;
+        m_index = -1;
+#endif
+    }
+
+    ~FrameBusReader() { close(); }
+
+    bool open(const char* name)
+    {
+        if ((!map(name, 0, false)) || memcmp(header()->magic, FRAMEBUS_MAGIC, 8))
+            return false;
+        m_next = seqWord()->load(std::memory_order_acquire) + 1;     /* from the next frame on */
+#if defined(_WIN32)
+        for (int i = 0; (i < FRAMEBUS_READERS) && (m_index < 0); ++i)
+        {
+            if (0 == InterlockedCompareExchange((volatile LONG*)&m_pReaders->active[i], 1, 0))
+                m_index = i;
+        }
+        if (m_index < 0)
+            return false;
+        char evtName[MAX_PATH];
+        sprintf(evtName, "Local\\%s_reader%d", m_name.c_str(), m_index);
+        m_hEvent = CreateEventA(NULL, FALSE, FALSE, evtName);
+        InterlockedIncrement((volatile LONG*)&m_pReaders->generation);
+#endif
+        return true;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if (m_index >= 0)
+        {
+            InterlockedExchange((volatile LONG*)&m_pReaders->active[m_index], 0);
+            InterlockedIncrement((volatile LONG*)&m_pReaders->generation);
+            m_index = -1;
+        }
+        if (m_hEvent)
+            CloseHandle(m_hEvent);
+        m_hEvent = NULL;
+#endif
+        unmap();
+    }
+
+    /* the next frame, in place: pointer to its data, valid until release(); NULL if none came within waitMs */
+    const void* acquire(unsigned waitMs, ToupcamFrameInfoV4* pInfo, uint32_t* pSize)
+    {
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMs);
+        for (;;)
+        {
+            const uint32_t last = seqWord()->load(std::memory_order_acquire);
+            if (last && ((int32_t)(last - m_next) >= 0))
+            {
+                const uint32_t count = header()->slotCount;
+                if (last - m_next >= count - 1)    /* behind: the oldest one which is not being overwritten */
+                {
+                    lost += last - m_next - (count - 2);
+                    m_next = last - (count - 2);
+                }
+                FrameBusSlot* s = slot(m_next);
+                const uint32_t n = m_next++;
+                if (((std::atomic<uint32_t>*)&s->end)->load(std::memory_order_acquire) != n)
+                {
+                    ++torn;
+                    continue;
+                }
+                *pInfo = s->info;
+                *pSize = s->size;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (((std::atomic<uint32_t>*)&s->begin)->load(std::memory_order_relaxed) != n)
+                {
+                    ++torn;
+                    continue;
+                }
+                m_held = n;
+                ++received;
+                return data(s);
+            }
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+                return NULL;
+            const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+#if defined(__linux__)
+            const timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+            syscall(SYS_futex, &header()->seq, FUTEX_WAIT, last, &ts, NULL, 0);
+#elif defined(_WIN32)
+            WaitForSingleObject(m_hEvent, (DWORD)ms);
+#else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+        }
+    }
+
+    /* false: the frame was overwritten while it was held, what was computed from it is not to be trusted */
+    bool release()
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const bool bok = (((std::atomic<uint32_t>*)&slot(m_held)->begin)->load(std::memory_order_relaxed) == m_held);
+        if (!bok)
+            ++torn;
+        return bok;
+    }
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef __framegate_H__
+#define __framegate_H__
+
+/*
+    Quality gate of a frame, right after Toupcam_PullImageV4 and before it is queued to be saved: a frame which is
+    black (the CheckBlackProc of autotest), overexposed, flat or blurred (taken while the stage was still settling) is
+    rejected before it costs an encode and a write, and while the stage is still at the tile it can be taken again
+    (ScanExecutor::setGate in scanexec.h).
+    measure() reads every FRAMEGATE_STEP-th pixel of every FRAMEGATE_STEP-th row, the frame still in the cache: the
+    mean and the standard deviation of the brightest channel of a pixel, the fraction of the pixels with a channel at
+    full scale, as fractions of full scale (1 << bits of the samples for 8 / 16 bits per pixel, 8 bits for 24 / 32,
+    16 bits for 48 / 64); with TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS the mean is uLum / 255 of the camera. The focus value
+    is uFV of the camera when the frame carries one, otherwise the Tenengrad of the host (focusmetric.h) over
+    the region of FrameGateConfig (RGB24 and RAW8 only; other formats: no focus check).
+    Blur: a focus value is relative to the content of the tile, so the threshold is a fraction of the median of the
+    last FRAMEGATE_HISTORY frames accepted, of the same source; the first ones are accepted on the other checks only.
+    A threshold of 0 is off. check() returns 0 (accepted) or the FRAMEGATE_* of the checks failed.
+*/
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "toupcam.h"
+#include "focusmetric.h"
+
+#define FRAMEGATE_BLACK         0x01    /* mean below minMean */
+#define FRAMEGATE_BRIGHT        0x02    /* mean above maxMean */
+#define FRAMEGATE_SATURATED     0x04    /* more than maxSaturated of the pixels at full scale */
+#define FRAMEGATE_FLAT          0x08    /* standard deviation below minStddev: no image, lens cap, shutter */
+#define FRAMEGATE_BLUR          0x10    /* focus below minFocus x the recent median */
+
+#define FRAMEGATE_STEP          4
+#define FRAMEGATE_HISTORY       8
+
+typedef struct {
+    double minMean, maxMean;    /* 0 ... 1 */
+    double maxSaturated;        /* 0 ... 1 */
+    double minStddev;           /* 0 ... 1 */
+    double minFocus;            /* 0 ... 1 of the median */
+    unsigned roiLeft, roiTop, roiWidth, roiHeight;  /* of the focus value, 0 x 0 = the whole frame */
+} FrameGateConfig;
+
+/* black below 2% of full scale, more than 5% saturated, flat below 0.5%, blurred below 60% of the focus of the recent tiles */
+static inline FrameGateConfig FrameGateDefault()
+{
+    FrameGateConfig c;
+    memset(&c, 0, sizeof(c));
+    c.minMean = 0.02;
+    c.maxMean = 0.0;
+    c.maxSaturated = 0.05;
+    c.minStddev = 0.005;
+    c.minFocus = 0.6;
+    return c;
+}
+
+typedef struct {
+    double mean, stddev, saturated;
+    double focus;
+    int focusSource;            /* FOCUSMETRIC_CAMERA, FOCUSMETRIC_HOST, 0: none */
+} FrameGateStats;
+
+class FrameGate {
+    FrameGateConfig m_cfg;
+    FocusMetric m_focus;
+    std::vector<double> m_history;
+    int m_source;
+
+    template <typename T>
+    static void sample(const void* data, unsigned width, unsigned height, size_t pitch, unsigned channels, unsigned stride, unsigned maxval, FrameGateStats* pStats)
+    {
+        unsigned long long n = 0, sat = 0;
+        double sum = 0, sum2 = 0;
+        for (unsigned y = 0; y < height; y += FRAMEGATE_STEP)
+        {
+            const T* p = reinterpret_cast<const T*>(static_cast<const unsigned char*>(data) + y * pitch);
+            for (unsigned x = 0; x < width; x += FRAMEGATE_STEP)
+            {
+                unsigned v = p[(size_t)x * stride];
+                for (unsigned c = 1; c < channels; ++c)
+                    v = std::max(v, (unsigned)p[(size_t)x * stride + c]);
+                v = std::min(v, maxval);
+                sum += v;
+                sum2 += (double)v * v;
+                if (v == maxval)
+                    ++sat;
+                ++n;
+            }
+        }
+        const double mean = n ? sum / n : 0.0;
+        pStats->mean = mean / maxval;
+        pStats->stddev = n ? sqrt(std::max(0.0, sum2 / n - mean * mean)) / maxval : 0.0;
+        pStats->saturated = n ? (double)sat / n : 0.0;
+    }
+public:
+    FrameGate()
+    : m_cfg(FrameGateDefault()), m_source(0)
+    {
+    }
+
+    /* h: the camera of the frames, the region of the focus value goes to it (Toupcam_put_AFRoi); NULL: the whole frame */
+    void setConfig(const FrameGateConfig& cfg, HToupcam h = NULL)
+    {
+        m_cfg = cfg;
+        if (h)
+            m_focus.setRoi(h, cfg.roiLeft, cfg.roiTop, cfg.roiWidth, cfg.roiHeight);
+        else
+        {
+            FocusMetric f;
+            m_focus = f;
+        }
+    }
+    const FrameGateConfig& config() const { return m_cfg; }
+
+    /* a new scan, new content: the focus history is dropped */
+    void reset()
+    {
+        m_history.clear();
+    }
+
+    /*
+        data: as pulled with bits (24, 32, 48, 64 with TDIBWIDTHBYTES rows; 8, 16 with width rows: RAW, mono),
+        rawBits: the bit depth of the samples of 8 / 16 (Toupcam_get_RawFormat), 0: 8 / 16
+    */
+    void measure(const void* data, int bits, unsigned rawBits, const ToupcamFrameInfoV4& info, FrameGateStats* pStats)
+    {
+        const unsigned w = info.v3.width, h = info.v3.height;
+        switch (bits)
+        {
+        case 8:
+            sample<unsigned char>(data, w, h, w, 1, 1, rawBits ? ((1u << std::min(rawBits, 8u)) - 1) : 0xff, pStats);
+            break;
+        case 16:
+            sample<unsigned short>(data, w, h, (size_t)w * 2, 1, 1, rawBits ? ((1u << std::min(rawBits, 16u)) - 1) : 0xffff, pStats);
+            break;
+        case 32:
+            sample<unsigned char>(data, w, h, TDIBWIDTHBYTES(w * 32), 3, 4, 0xff, pStats);
+            break;
+        case 48:
+            sample<unsigned short>(data, w, h, TDIBWIDTHBYTES(w * 48), 3, 3, 0xffff, pStats);
+            break;
+        case 64:
+            sample<unsigned short>(data, w, h, TDIBWIDTHBYTES(w * 64), 3, 4, 0xffff, pStats);
+            break;
+        default:
+            sample<unsigned char>(data, w, h, TDIBWIDTHBYTES(w * 24), 3, 3, 0xff, pStats);
+            break;
+        }
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS)
+            pStats->mean = info.uLum / 255.0;
+        pStats->focus = 0.0;
+        pStats->focusSource = 0;
+        if ((m_cfg.minFocus > 0) && ((info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS) || (8 == bits) || (24 == bits)))
+        {
+            pStats->focus = m_focus.value(info, data, 8 == bits);
+            pStats->focusSource = m_focus.source();
+        }
+    }
+
+    /* the checks of stats; an accepted frame goes into the focus history */
+    unsigned check(const FrameGateStats& stats)
+    {
+        unsigned verdict = 0;
+        if ((m_cfg.minMean > 0) && (stats.mean < m_cfg.minMean))
+            verdict |= FRAMEGATE_BLACK;
+        if ((m_cfg.maxMean > 0) && (stats.mean > m_cfg.maxMean))
+            verdict |= FRAMEGATE_BRIGHT;
+        if ((m_cfg.maxSaturated > 0) && (stats.saturated > m_cfg.maxSaturated))
+            verdict |= FRAMEGATE_SATURATED;
+        if ((m_cfg.minStddev > 0) && (stats.stddev < m_cfg.minStddev))
+            verdict |= FRAMEGATE_FLAT;
+        if (stats.focusSource)
+        {
+            if (stats.focusSource != m_source)
+            {
+                m_history.clear();
+                m_source = stats.focusSource;
+            }
+            if (m_history.size() >= FRAMEGATE_HISTORY / 2)
+            {
+                std::vector<double> v(m_history);
+                std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+                if (stats.focus < m_cfg.minFocus * v[v.size() / 2])
+                    verdict |= FRAMEGATE_BLUR;
+            }
+            if (0 == verdict)
+            {
+                if (m_history.size() >= FRAMEGATE_HISTORY)
+                    m_history.erase(m_history.begin());
+                m_history.push_back(stats.focus);
+            }
+        }
+        return verdict;
+    }
+
+    unsigned check(const void* data, int bits, unsigned rawBits, const ToupcamFrameInfoV4& info, FrameGateStats* pStats = NULL)
+    {
+        FrameGateStats stats;
+        measure(data, bits, rawBits, info, &stats);
+        if (pStats)
+            *pStats = stats;
+        return check(stats);
+    }
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef __framepool_H__
+#define __framepool_H__
+
+/*
+    Parallel processing of the frames with the results delivered in order: the thread which pulls the frames (the
+    event callback thread in pull mode with callback) hands each one to a pool of worker threads for the heavy work
+    (metrics, encode, correction), and the sink gets the results one at a time, in the order of info.v3.seq,
+    whatever the order the workers finished in. The processing of a frame may then take several frame times, the
+    throughput grows with the workers, and what comes out of the sink is still a plain ordered stream.
+    The slots (frame + info + result R) are allocated at construction: acquire() a free one, pull into slot->buf,
+    submit() it, or cancel() it when the pull failed. With all the slots in use acquire() returns NULL, unless asked to
+    wait: the frame is then the program's to drop (pull it into a scratch buffer so that the SDK moves on), counted
+    by dropped(). slots = workers + 2 or so: more only add latency, a pool which runs out of slots is too slow on
+    average and needs more workers (or a lower frame rate, samples/fpsgov.h).
+    The processing (FRAMEPOOL_PROCESS) runs on the worker threads, several at a time; the sink (FRAMEPOOL_SINK) on
+    whichever worker completed the oldest frame, one at a time, never concurrently with itself. The slot goes back
+    to the pool when the sink returns. seq is compared wrap-around safe; gaps (frames the SDK dropped, frames dropped
+    at acquire) do not hold the stream up, the frames not submitted are just not waited for.
+*/
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+
+template <typename R>
+class FramePool {
+public:
+    struct Slot {
+        std::vector<unsigned char> buf;
+        ToupcamFrameInfoV4 info;
+        R result;
+        bool bDone;
+    };
+    /* worker: 0 ... workers - 1 */
+    typedef void (*FRAMEPOOL_PROCESS)(void* ctx, unsigned worker, Slot* slot);
+    typedef void (*FRAMEPOOL_SINK)(void* ctx, Slot* slot);
+private:
+    FRAMEPOOL_PROCESS m_pProcess;
+    FRAMEPOOL_SINK m_pSink;
+    void* m_ctx;
+    std::vector<Slot> m_slot;
+    std::vector<Slot*> m_free;
+    std::deque<Slot*> m_work;       /* submitted, not taken by a worker yet */
+    std::deque<Slot*> m_order;      /* submitted, not delivered yet, by seq */
+    std::vector<std::thread> m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cvWork, m_cvFree, m_cvIdle;
+    bool m_bQuit, m_bDelivering;
+    unsigned m_nSubmitted, m_nDelivered, m_nDropped, m_peak;
+    double m_maxLatency;            /* ms, from submit() to the return of the sink */
+    std::vector<std::chrono::steady_clock::time_point> m_tSubmit;
+
+    FramePool(const FramePool&);
+    FramePool& operator=(const FramePool&);
+
+    static bool before(unsigned a, unsigned b) { return (int)(a - b) < 0; }
+
+    void worker(unsigned index)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        for (;;)
+        {
+            m_cvWork.wait(lock, [this] { return m_bQuit || (!m_work.empty()); });
+            if (m_work.empty())
+                break;          /* quit, and nothing left to process */
+            Slot* s = m_work.front();
+            m_work.pop_front();
+            lock.unlock();
+            m_pProcess(m_ctx, index, s);
+            lock.lock();
+            s->bDone = true;
+            if (m_bDelivering)
+                continue;       /* the thread delivering picks it up when its turn comes */
+            m_bDelivering = true;
+            while ((!m_order.empty()) && m_order.front()->bDone)
+            {
+                Slot* d = m_order.front();
+                m_order.pop_front();
+                lock.unlock();
+                m_pSink(m_ctx, d);
+                lock.lock();
+                const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_tSubmit[d - &m_slot[0]]).count();
+                if (ms > m_maxLatency)
+                    m_maxLatency = ms;
+                ++m_nDelivered;
+                m_free.push_back(d);
+                m_cvFree.notify_one();
+            }
+            m_bDelivering = false;
+            if (m_order.empty())
+                m_cvIdle.notify_all();
+        }
+    }
+public:
+    /* frameBytes: the size of slot->buf, the largest frame pulled into it */
+    FramePool(unsigned workers, unsigned slots, size_t frameBytes, FRAMEPOOL_PROCESS pProcess, FRAMEPOOL_SINK pSink, void* ctx)
+    : m_pProcess(pProcess), m_pSink(pSink), m_ctx(ctx), m_slot(slots ? slots : 1), m_bQuit(false), m_bDelivering(false),
+    m_nSubmitted(0), m_nDelivered(0), m_nDropped(0), m_peak(0), m_maxLatency(0.0), m_tSubmit(m_slot.size())
+    {
+        for (size_t i = 0; i < m_slot.size(); ++i)
+        {
+            m_slot[i].buf.resize(frameBytes);
+            m_slot[i].bDone = false;
+            m_free.push_back(&m_slot[i]);
+        }
+        for (unsigned i = 0; i < (workers ? workers : 1); ++i)
+            m_thread.push_back(std::thread(&FramePool::worker, this, i));
+    }
+
+    ~FramePool() { stop(); }
+
+    /* processes and delivers what was submitted, then ends the workers */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bQuit = true;
+        }
+        m_cvWork.notify_all();
+        for (size_t i = 0; i < m_thread.size(); ++i)
+            m_thread[i].join();
+        m_thread.clear();
+    }
+
+    /* NULL: all the slots are in use, the frame is dropped */
+    Slot* acquire(bool bWait = false)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (bWait)
+            m_cvFree.wait(lock, [this] { return !m_free.empty(); });
+        if (m_free.empty())
+        {
+            ++m_nDropped;
+            return NULL;
+        }
+        Slot* s = m_free.back();
+        m_free.pop_back();
+        return s;
+    }
+
+    /* the pull into the slot failed */
+    void cancel(Slot* s)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_free.push_back(s);
+        m_cvFree.notify_one();
+    }
+
+    void submit(Slot* s, const ToupcamFrameInfoV4& info)
+    {
+        s->info = info;
+        s->bDone = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_tSubmit[s - &m_slot[0]] = std::chrono::steady_clock::now();
+            /* almost always at the end: frames are pulled in order */
+            typename std::deque<Slot*>::iterator it = m_order.end();
+            while ((it != m_order.begin()) && before(info.v3.seq, (*(it - 1))->info.v3.seq))
+                --it;
+            m_order.insert(it, s);
+            m_work.push_back(s);
+            ++m_nSubmitted;
+            const unsigned inflight = (unsigned)m_order.size();
+            if (inflight > m_peak)
+                m_peak = inflight;
+        }
+        m_cvWork.notify_one();
+    }
+
+    /* waits until everything submitted has been delivered */
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvIdle.wait(lock, [this] { return m_order.empty(); });
+    }
+
+    unsigned workers() const { return (unsigned)m_thread.size(); }
+    unsigned submitted() { std::lock_guard<std::mutex> lock(m_mtx); return m_nSubmitted; }
+    unsigned delivered() { std::lock_guard<std::mutex> lock(m_mtx); return m_nDelivered; }
+    unsigned dropped() { std::lock_guard<std::mutex> lock(m_mtx); return m_nDropped; }
+    /* the most frames in the pool at once, and the longest from submit() to the end of the sink, ms */
+    unsigned peak() { std::lock_guard<std::mutex> lock(m_mtx); return m_peak; }
+    double maxLatency() { std::lock_guard<std::mutex> lock(m_mtx); return m_maxLatency; }
+};
+
+#endif
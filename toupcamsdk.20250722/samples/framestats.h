@@ -0,0 +1,162 @@
+#ifndef __framestats_H__
+#define __framestats_H__
+
+/*
+    Statistics of a frame computed in the thread which pulls it, right after Toupcam_PullImageV4, while the frame is
+    still in the cache: the histogram, the count of saturated pixels and, for up to FRAMESTATS_MAX_ROI rectangles,
+    mean / standard deviation / min / max. One pass over the rows: exposure control and quality checks get their
+    numbers with the frame (FrameStats next to its ToupcamFrameInfoV4) and never read the pixel memory again.
+    Frames of one plane: RAW (TOUPCAM_OPTION_RAW = 1), 8 bits per pixel, or 10 ... 16 bits in 16 bits words, mono cameras
+    pulled with 8 / 16 bits; on RAW the statistics mix the colour channels of the Bayer pattern. bits: the bit depth
+    of the samples (Toupcam_get_RawFormat), the histogram has 1 << bits bins and a pixel is saturated at
+    (1 << bits) - 1 (before any black level offset, TOUPCAM_OPTION_BLACKLEVEL).
+    The rectangles are in the coordinates of the buffer, row 0 first; a rectangle out of the frame is clipped, an empty
+    one has count = 0. Rows of pitch bytes, 0 = width x bytes per pixel (the default row pitch of RAW).
+    The SDK does not compute the statistics in its own conversion threads, this is the nearest place to it.
+*/
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "toupcam.h"
+
+#define FRAMESTATS_MAX_ROI      16
+
+typedef struct {
+    unsigned x, y, width, height;
+} FrameRect;
+
+typedef struct {
+    double mean, stddev;
+    unsigned min, max;
+    unsigned count;         /* pixels, 0 = out of the frame */
+} FrameRectStats;
+
+struct FrameStats {
+    std::vector<unsigned> histogram;
+    unsigned long long saturated, total;
+    double mean;
+    unsigned nRect;
+    FrameRectStats rect[FRAMESTATS_MAX_ROI];
+
+    /* value below which fraction of the pixels are, such as 0.5 for the median, 0.99 for a white point */
+    unsigned percentile(double fraction) const
+    {
+        const unsigned long long target = (unsigned long long)(fraction * total);
+        unsigned long long sum = 0;
+        for (size_t i = 0; i < histogram.size(); ++i)
+        {
+            sum += histogram[i];
+            if (sum > target)
+                return (unsigned)i;
+        }
+        return histogram.empty() ? 0 : (unsigned)histogram.size() - 1;
+    }
+};
+
+class FrameStatsEngine {
+    struct Acc {
+        unsigned long long sum, sum2;
+        unsigned min, max;
+    };
+    unsigned m_bits;
+    std::vector<FrameRect> m_rect;
+
+    template<typename T>
+    void compute(const T* data, unsigned width, unsigned height, unsigned pitch, FrameStats* pStats) const
+    {
+        const unsigned maxval = (1u << m_bits) - 1;
+        unsigned* hist = &pStats->histogram[0];
+        Acc acc[FRAMESTATS_MAX_ROI];
+        FrameRect clip[FRAMESTATS_MAX_ROI];
+        const unsigned nRect = (unsigned)m_rect.size();
+        for (unsigned i = 0; i < nRect; ++i)
+        {
+            acc[i].sum = acc[i].sum2 = 0;
+            acc[i].min = maxval;
+            acc[i].max = 0;
+            clip[i] = m_rect[i];
+            clip[i].width = (clip[i].x < width) ? std::min(clip[i].width, width - clip[i].x) : 0;
+            clip[i].height = (clip[i].y < height) ? std::min(clip[i].height, height - clip[i].y) : 0;
+        }
+        unsigned long long sum = 0;
+        for (unsigned y = 0; y < height; ++y)
+        {
+            const T* p = reinterpret_cast<const T*>(reinterpret_cast<const unsigned char*>(data) + (size_t)y * pitch);
+            for (unsigned x = 0; x < width; ++x)
+            {
+                const unsigned v = std::min((unsigned)p[x], maxval);
+                ++hist[v];
+                sum += v;
+            }
+            for (unsigned i = 0; i < nRect; ++i)
+            {
+                if ((y < clip[i].y) || (y >= clip[i].y + clip[i].height))
+                    continue;
+                const T* q = p + clip[i].x;
+                unsigned long long s = 0, s2 = 0;
+                unsigned lo = acc[i].min, hi = acc[i].max;
+                for (unsigned x = 0; x < clip[i].width; ++x)
+                {
+                    const unsigned v = std::min((unsigned)q[x], maxval);
+                    s += v;
+                    s2 += (unsigned long long)v * v;
+                    lo = std::min(lo, v);
+                    hi = std::max(hi, v);
+                }
+                acc[i].sum += s;
+                acc[i].sum2 += s2;
+                acc[i].min = lo;
+                acc[i].max = hi;
+            }
+        }
+        pStats->saturated = hist[maxval];
+        pStats->total = (unsigned long long)width * height;
+        pStats->mean = pStats->total ? (double)sum / pStats->total : 0.0;
+        pStats->nRect = nRect;
+        for (unsigned i = 0; i < nRect; ++i)
+        {
+            FrameRectStats& r = pStats->rect[i];
+            r.count = clip[i].width * clip[i].height;
+            if (0 == r.count)
+            {
+                r.mean = r.stddev = 0.0;
+                r.min = r.max = 0;
+                continue;
+            }
+            r.mean = (double)acc[i].sum / r.count;
+            r.stddev = sqrt(std::max(0.0, (double)acc[i].sum2 / r.count - r.mean * r.mean));
+            r.min = acc[i].min;
+            r.max = acc[i].max;
+        }
+    }
+public:
+    FrameStatsEngine(unsigned bits = 8)
+    : m_bits(std::max(1u, std::min(16u, bits)))
+    {
+    }
+
+    void setBits(unsigned bits) { m_bits = std::max(1u, std::min(16u, bits)); }
+    unsigned bits() const { return m_bits; }
+
+    /* the first FRAMESTATS_MAX_ROI */
+    void setRects(const FrameRect* pRect, unsigned n)
+    {
+        m_rect.assign(pRect, pRect + std::min(n, (unsigned)FRAMESTATS_MAX_ROI));
+    }
+
+    /* bytesPerPixel: 1 or 2; the histogram of pStats is resized once, then reused */
+    void compute(const void* data, unsigned bytesPerPixel, unsigned pitch, const ToupcamFrameInfoV4& info, FrameStats* pStats) const
+    {
+        pStats->histogram.resize((size_t)1 << m_bits);
+        memset(&pStats->histogram[0], 0, sizeof(unsigned) * pStats->histogram.size());
+        if (0 == pitch)
+            pitch = info.v3.width * bytesPerPixel;
+        if (bytesPerPixel > 1)
+            compute(static_cast<const unsigned short*>(data), info.v3.width, info.v3.height, pitch, pStats);
+        else
+            compute(static_cast<const unsigned char*>(data), info.v3.width, info.v3.height, pitch, pStats);
+    }
+};
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef __gcodestream_H__
+#define __gcodestream_H__
+
+/*
+    G-code streamer for Marlin, with the planner kept full: the lines are sent ahead of their "ok", as long as they fit
+    in the receive window of the controller, instead of one line then its "ok" then the next one.
+    The window is counted in characters and in lines: the lines in flight (sent, no "ok" yet) are at most
+    GCODESTREAM_RX_BUFFER characters ('\n' included) and GCODESTREAM_BUFSIZE lines, the RX_BUFFER_SIZE and BUFSIZE of
+    Configuration_adv.h of the controller (128 and 4 by default); put() them when the build has other values. Marlin
+    answers "ok" for a G0 / G1 as soon as the move is in the planner (BLOCK_BUFFER_SIZE moves), so with the command
+    queue never empty the planner never runs dry and the moves are blended, no stop between two of them.
+    A reader thread parses the answers while the lines go out:
+        "ok"                the oldest line in flight is done, its room in the window is free
+        "echo:busy: ..."    the controller is alive but processing a long command (M400, G28, G29): the timeouts
+                            start again
+        "X:... Y:... Z:..." position report, of M114 or of the auto report (M154 S<seconds>, AUTO_REPORT_POSITION):
+                            kept with its host time and handed to the position callback (to a StageTrack, for example)
+        "Error:..."         kept (lastError()); "Error:Printer halted" / "kill()" stop the stream, send() fails
+    position() is M114 in the stream, behind the lines sent before it: Marlin reports the position once they are
+    planned, the end of the last move queued (M114 R with M114_REALTIME gives where the axes are now instead). sync()
+    is M400 in the stream: the moves before it are done at its "ok".
+    Lines are sent as given after the comment (';' ...) and the surrounding blanks are removed; no line numbers or
+    checksums (a USB link has its own CRC), so "Resend:" is not expected and is counted as an error if it comes.
+    send() blocks while the window is full, up to GCODESTREAM_TIMEOUT ms without any answer.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define GCODESTREAM_RX_BUFFER   128
+#define GCODESTREAM_BUFSIZE     4
+#define GCODESTREAM_TIMEOUT     10000   /* ms without an answer */
+#define GCODESTREAM_LINE        96      /* MAX_CMD_SIZE */
+
+/* host time in microseconds (steady clock), x, y, z in mm */
+typedef void (*GCODESTREAM_POSITION)(void* ctx, long long t, double x, double y, double z);
+
+class GcodeStream {
+    struct Line {
+        unsigned ticket;
+        unsigned length;    /* characters in the window */
+        bool bPosition;     /* M114: the next report is its answer */
+    };
+
+    FILE* m_fout;
+    FILE* m_fin;
+    bool m_bOwn;                /* open(port): the two FILE* are closed by close() */
+    unsigned m_rxSize, m_bufSize;
+    std::deque<Line> m_flight;
+    unsigned m_chars;           /* in flight */
+    unsigned m_next;            /* ticket of the next line */
+    unsigned m_acked;           /* tickets below are done */
+    unsigned m_errors;
+    bool m_bHalted, m_bEof, m_bQuit;
+    std::string m_lastError;
+    std::chrono::steady_clock::time_point m_alive;  /* last answer */
+    double m_pos[3];
+    long long m_posTime;
+    unsigned m_posTicket;       /* the M114 the report answered, 0: auto report */
+    unsigned m_reports;
+    GCODESTREAM_POSITION m_cbPosition;
+    void* m_ctxPosition;
+    std::thread m_reader;
+    mutable std::mutex m_mtx;
+    std::condition_variable m_cv;
+
+    static long long now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static bool parsePosition(const char* s, double pos[3])
+    {
+        const char* end = strstr(s, "Count");
+        static const char axis[3][3] = { "X:", "Y:", "Z:" };
+        for (int i = 0; i < 3; ++i)
+        {
+            const char* p = strstr(s, axis[i]);
+            if ((NULL == p) || (end && (p > end)))
+                return false;
+            pos[i] = atof(p + 2);
+        }
+        return true;
+    }
+
+    void reader()
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), m_fin))
+        {
+            line[strcspn(line, "\r\n")] = 0;
+            double pos[3];
+            const bool bPos = ('X' == line[0]) && parsePosition(line, pos);
+            const long long t = now();
+            GCODESTREAM_POSITION cb = NULL;
+            void* ctx = NULL;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_alive = std::chrono::steady_clock::now();
+                if (0 == strncmp(line, "ok", 2))
+                {
+                    if (!m_flight.empty())
+                    {
+                        m_chars -= m_flight.front().length;
+                        m_acked = m_flight.front().ticket + 1;
+                        m_flight.pop_front();
+                    }
+                    if (m_bQuit && m_flight.empty())
+                    {
+                        m_cv.notify_all();
+                        return;     /* the "ok" of the last M400 of close() */
+                    }
+                }
+                else if (bPos)
+                {
+                    m_posTicket = 0;
+                    for (size_t i = 0; i < m_flight.size(); ++i)
+                    {
+                        if (m_flight[i].bPosition)
+                        {
+                            m_posTicket = m_flight[i].ticket;
+                            m_flight[i].bPosition = false;
+                            break;
+                        }
+                    }
+                    memcpy(m_pos, pos, sizeof(m_pos));
+                    m_posTime = t;
+                    ++m_reports;
+                    cb = m_cbPosition;
+                    ctx = m_ctxPosition;
+                }
+                else if ((0 == strncmp(line, "Error:", 6)) || (0 == strncmp(line, "Resend:", 7)))
+                {
+                    ++m_errors;
+                    m_lastError = line;
+                    if (strstr(line, "halted") || strstr(line, "kill"))
+                        m_bHalted = true;
+                }
+                m_cv.notify_all();
+            }
+            if (cb)
+                cb(ctx, t, pos[0], pos[1], pos[2]);
+        }
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_bEof = true;
+        m_cv.notify_all();
+    }
+
+    /* with the lock held: wait for pred, the timeout restarts at every answer */
+    template <typename Pred>
+    bool waitAlive(std::unique_lock<std::mutex>& lock, unsigned ms, Pred pred)
+    {
+        while (!pred())
+        {
+            if (m_bHalted || m_bEof)
+                return false;
+            const std::chrono::steady_clock::time_point deadline = m_alive + std::chrono::milliseconds(ms);
+            if (std::cv_status::timeout == m_cv.wait_until(lock, deadline))
+            {
+                if (pred())
+                    return true;
+                if (std::chrono::steady_clock::now() >= m_alive + std::chrono::milliseconds(ms))
+                    return false;
+            }
+        }
+        return true;
+    }
+public:
+    GcodeStream()
+    : m_fout(NULL), m_fin(NULL), m_bOwn(false), m_rxSize(GCODESTREAM_RX_BUFFER), m_bufSize(GCODESTREAM_BUFSIZE), m_chars(0), m_next(1), m_acked(1), m_errors(0),
+    m_bHalted(false), m_bEof(false), m_bQuit(false), m_posTime(0), m_posTicket(0), m_reports(0), m_cbPosition(NULL), m_ctxPosition(NULL)
+    {
+        m_pos[0] = m_pos[1] = m_pos[2] = 0;
+    }
+
+    ~GcodeStream()
+    {
+        close();
+    }
+
+    /* the RX_BUFFER_SIZE and BUFSIZE of the controller, before open() */
+    void put(unsigned rxSize, unsigned bufSize)
+    {
+        m_rxSize = rxSize;
+        m_bufSize = bufSize ? bufSize : 1;
+    }
+
+    void setPositionCallback(GCODESTREAM_POSITION cb, void* ctx)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_cbPosition = cb;
+        m_ctxPosition = ctx;
+    }
+
+    /*
+        fout / fin: the two directions of the link, two FILE* of the tty (fopen "w" and "r"): the reader thread waits in
+        fgets holding the lock of fin, one FILE* "r+" for both would block every send until the next answer
+    */
+    bool open(FILE* fout, FILE* fin)
+    {
+        if (m_reader.joinable() || (NULL == fout) || (NULL == fin) || (fout == fin))
+            return false;
+        m_fout = fout;
+        m_fin = fin;
+        m_bOwn = false;
+        m_flight.clear();
+        m_chars = m_errors = 0;
+        m_next = m_acked = 1;   /* ticket 0: the auto reports */
+        m_bHalted = m_bEof = m_bQuit = false;
+        m_alive = std::chrono::steady_clock::now();
+        m_reader = std::thread(&GcodeStream::reader, this);
+        return true;
+    }
+
+    /* the tty (or pty) of the controller, opened twice, for writing and for reading, as open(fout, fin) needs */
+    bool open(const char* port)
+    {
+        if (m_reader.joinable() || (NULL == port))
+            return false;
+        FILE* fout = fopen(port, "w");
+        FILE* fin = fout ? fopen(port, "r") : NULL;
+        if ((NULL == fin) || !open(fout, fin))
+        {
+            if (fout)
+                fclose(fout);
+            if (fin)
+                fclose(fin);
+            return false;
+        }
+        m_bOwn = true;
+        return true;
+    }
+
+    /* queue one line, blocks while the window is full; pTicket: to wait() for its "ok" */
+    bool send(const char* gcode, unsigned* pTicket = NULL)
+    {
+        char buf[GCODESTREAM_LINE + 2];
+        const char* s = gcode;
+        while ((' ' == *s) || ('\t' == *s))
+            ++s;
+        size_t n = strcspn(s, ";\r\n");
+        while (n && ((' ' == s[n - 1]) || ('\t' == s[n - 1])))
+            --n;
+        if (0 == n)
+            return true;    /* comment or blank, nothing to send */
+        if (n > GCODESTREAM_LINE)
+            return false;
+        memcpy(buf, s, n);
+        buf[n++] = '\n';
+        buf[n] = 0;
+
+        std::unique_lock<std::mutex> lock(m_mtx);
+        const unsigned length = (unsigned)n;
+        if (!waitAlive(lock, GCODESTREAM_TIMEOUT, [this, length] { return (m_flight.size() < m_bufSize) && (m_chars + length <= m_rxSize); }))
+            return false;
+        const Line l = { m_next++, length, 0 == strncmp(buf, "M114", 4) };
+        m_flight.push_back(l);
+        m_chars += length;
+        if (pTicket)
+            *pTicket = l.ticket;
+        /* written with the lock held: the "ok" cannot come before the line is in m_flight */
+        if ((fputs(buf, m_fout) < 0) || fflush(m_fout))
+        {
+            m_bEof = true;
+            return false;
+        }
+        return true;
+    }
+
+    /* the "ok" of ticket; the timeout restarts with every answer ("busy" included) */
+    bool wait(unsigned ticket, unsigned ms = GCODESTREAM_TIMEOUT)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        return waitAlive(lock, ms, [this, ticket] { return (int)(m_acked - ticket) > 0; });
+    }
+
+    /* every line sent has its "ok" */
+    bool drain(unsigned ms = GCODESTREAM_TIMEOUT)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        return waitAlive(lock, ms, [this] { return m_flight.empty(); });
+    }
+
+    /* M400 in the stream: the moves sent before are done */
+    bool sync(unsigned ms = GCODESTREAM_TIMEOUT)
+    {
+        unsigned ticket = 0;
+        return send("M400", &ticket) && wait(ticket, ms);
+    }
+
+    /* M114 in the stream: the position once the lines sent before are planned */
+    bool position(double* x, double* y, double* z, unsigned ms = GCODESTREAM_TIMEOUT)
+    {
+        unsigned ticket = 0;
+        if (!(send("M114", &ticket) && wait(ticket, ms)))
+            return false;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_posTicket != ticket)
+            return false;   /* no report before its "ok" */
+        *x = m_pos[0];
+        *y = m_pos[1];
+        *z = m_pos[2];
+        return true;
+    }
+
+    /* the last report, M114 or auto report, and its host time (us); false: none yet */
+    bool lastPosition(double pos[3], long long* pTime) const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (0 == m_reports)
+            return false;
+        memcpy(pos, m_pos, sizeof(m_pos));
+        if (pTime)
+            *pTime = m_posTime;
+        return true;
+    }
+
+    unsigned inFlight() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return (unsigned)m_flight.size();
+    }
+
+    unsigned errors() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_errors;
+    }
+
+    std::string lastError() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_lastError;
+    }
+
+    bool halted() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_bHalted || m_bEof;
+    }
+
+    /*
+        drains the stream and ends the reader with a last M400; the FILE* of open(fout, fin) are the caller's, closed
+        after, those of open(port) are closed here. A controller which no longer answers leaves the reader blocked in
+        fgets: it is detached then, and ends with the link (fin of open(port) is left open to it)
+    */
+    void close()
+    {
+        if (!m_reader.joinable())
+            return;
+        bool bSync = false;
+        if (drain())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_bQuit = true;
+            }
+            bSync = sync();
+        }
+        const bool bJoin = bSync || m_bEof;
+        if (bJoin)
+            m_reader.join();
+        else
+            m_reader.detach();
+        if (m_bOwn)
+        {
+            fclose(m_fout);
+            if (bJoin)
+                fclose(m_fin);
+            m_fout = m_fin = NULL;
+            m_bOwn = false;
+        }
+    }
+};
+
+#endif
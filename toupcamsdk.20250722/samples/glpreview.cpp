@@ -0,0 +1,420 @@
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <QSurfaceFormat>
+#include <QVector3D>
+#include <toupcam.h>
+#include "glpreview.h"
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+static const char* s_vertex =
+    "const vec2 pos[4] = vec2[4](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0));\n"
+    "out vec2 uv;\n"
+    "void main() {\n"
+    "    uv = vec2(pos[gl_VertexID].x * 0.5 + 0.5, 0.5 - pos[gl_VertexID].y * 0.5);\n"
+    "    gl_Position = vec4(pos[gl_VertexID], 0.0, 1.0);\n"
+    "}\n";
+
+static const char* s_fragment =
+    "uniform sampler2D tex;\n"
+    "uniform sampler2D curveTab;\n"    /* 256 x 1 */
+    "uniform sampler2D mapTab;\n"      /* 256 x 1 */
+    "uniform int raw;\n"
+    "uniform ivec2 red;\n"  /* position of the red pixel in the 2 x 2 cell */
+    "uniform vec3 low;\n"
+    "uniform vec3 gain;\n"  /* 1 / (high - low) */
+    "uniform int curve;\n"
+    "uniform int pseudo;\n"
+    "in vec2 uv;\n"
+    "out vec4 color;\n"
+    "float px(ivec2 p, ivec2 dims) { return texelFetch(tex, clamp(p, ivec2(0, 0), dims - 1), 0).r; }\n"
+    "vec2 tab(float v) { return vec2(v * (255.0 / 256.0) + 0.5 / 256.0, 0.5); }\n"
+    "vec4 tone(vec3 rgb) {\n"
+    "    rgb = clamp((rgb - low) * gain, 0.0, 1.0);\n"
+    "    if (0 != curve)\n"
+    "        rgb = vec3(texture(curveTab, tab(rgb.r)).r, texture(curveTab, tab(rgb.g)).r, texture(curveTab, tab(rgb.b)).r);\n"
+    "    if (0 != pseudo)\n"
+    "        rgb = texture(mapTab, tab(dot(rgb, vec3(0.299, 0.587, 0.114)))).rgb;\n"
+    "    return vec4(rgb, 1.0);\n"
+    "}\n"
+    "void main() {\n"
+    "    if (0 == raw) {\n"
+    "        color = tone(texture(tex, uv).rgb);\n"
+    "        return;\n"
+    "    }\n"
+    "    ivec2 dims = textureSize(tex, 0);\n"
+    "    ivec2 p = min(ivec2(uv * vec2(dims)), dims - 1);\n"
+    "    int ox = (p.x + red.x) & 1, oy = (p.y + red.y) & 1;\n"
+    "    float c = px(p, dims);\n"
+    "    float horz = (px(p + ivec2(-1, 0), dims) + px(p + ivec2(1, 0), dims)) * 0.5;\n"
+    "    float vert = (px(p + ivec2(0, -1), dims) + px(p + ivec2(0, 1), dims)) * 0.5;\n"
+    "    float diag = (px(p + ivec2(-1, -1), dims) + px(p + ivec2(1, -1), dims) + px(p + ivec2(-1, 1), dims) + px(p + ivec2(1, 1), dims)) * 0.25;\n"
+    "    vec3 rgb;\n"
+    "    if ((0 == ox) && (0 == oy))\n"
+    "        rgb = vec3(c, (horz + vert) * 0.5, diag);\n"
+    "    else if ((1 == ox) && (1 == oy))\n"
+    "        rgb = vec3(diag, (horz + vert) * 0.5, c);\n"
+    "    else if (0 == oy)\n"
+    "        rgb = vec3(horz, c, vert);\n"
+    "    else\n"
+    "        rgb = vec3(vert, c, horz);\n"
+    "    color = tone(rgb);\n"
+    "}\n";
+
+static double clamp01(double v)
+{
+    return (v < 0.0) ? 0.0 : ((v > 1.0) ? 1.0 : v);
+}
+
+GLPreview::GLPreview(QWidget* parent)
+    : QOpenGLWidget(parent)
+    , m_program(nullptr), m_tex(0), m_texCurve(0), m_texMap(0)
+    , m_index(0), m_width(0), m_height(0), m_pitch(0)
+    , m_fourcc(0), m_bRaw(false), m_bMapped(false), m_bFrame(false)
+    , m_bAuto(false), m_bAutoFirst(true), m_bCurve(false), m_bTables(true), m_pseudo(0)
+{
+    memset(m_pbo, 0, sizeof(m_pbo));
+    for (int i = 0; i < 3; ++i)
+    {
+        m_low[i] = 0.0;
+        m_high[i] = 255.0;
+    }
+    for (int i = 0; i < 256; ++i)
+        m_curve[i] = static_cast<uchar>(i);
+    memset(m_map, 0, sizeof(m_map));
+}
+
+GLPreview::~GLPreview()
+{
+    if (m_program)
+    {
+        makeCurrent();
+        glDeleteBuffers(GLPREVIEW_PBOS, m_pbo);
+        glDeleteTextures(1, &m_tex);
+        glDeleteTextures(1, &m_texCurve);
+        glDeleteTextures(1, &m_texMap);
+        m_vao.destroy();
+        delete m_program;
+        doneCurrent();
+    }
+}
+
+void GLPreview::setDefaultFormat()
+{
+    QSurfaceFormat fmt = QSurfaceFormat::defaultFormat();
+    if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGL)
+    {
+        fmt.setVersion(3, 3);
+        fmt.setProfile(QSurfaceFormat::CoreProfile);
+    }
+    else
+        fmt.setVersion(3, 0);
+    fmt.setSwapInterval(1);
+    QSurfaceFormat::setDefaultFormat(fmt);
+}
+
+void GLPreview::setRaw(bool bRaw, unsigned fourcc)
+{
+    m_bRaw = bRaw;
+    m_fourcc = fourcc;
+    m_width = m_height = 0; /* new texture format on the next frame */
+}
+
+void GLPreview::setOverlay(const std::function<void(QPainter&, const QRect&)>& overlay)
+{
+    m_overlay = overlay;
+    update();
+}
+
+void GLPreview::setLevels(const unsigned short aLow[4], const unsigned short aHigh[4])
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        m_low[i] = std::min<unsigned short>(aLow[i], 254);
+        m_high[i] = std::max<double>(std::min<unsigned short>(aHigh[i], 255), m_low[i] + 1);
+    }
+    update();
+}
+
+void GLPreview::getLevels(unsigned short aLow[4], unsigned short aHigh[4]) const
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        aLow[i] = static_cast<unsigned short>(m_low[i] + 0.5);
+        aHigh[i] = static_cast<unsigned short>(m_high[i] + 0.5);
+    }
+    aLow[3] = 0;
+    aHigh[3] = 255;
+}
+
+void GLPreview::setLevelsAuto(bool bAuto)
+{
+    m_bAuto = bAuto;
+    m_bAutoFirst = true;    /* the levels of the next frame at once */
+    if (!bAuto)
+    {
+        const unsigned short aLow[4] = { 0, 0, 0, 0 }, aHigh[4] = { 255, 255, 255, 255 };
+        setLevels(aLow, aHigh);
+    }
+}
+
+void GLPreview::setCurve(const uchar* v8)
+{
+    m_bCurve = (nullptr != v8);
+    if (v8)
+        memcpy(m_curve, v8, sizeof(m_curve));
+    m_bTables = true;
+    update();
+}
+
+bool GLPreview::setPseudoColor(int map, unsigned startColor, unsigned endColor)
+{
+    uchar tab[256 * 3];
+    for (int i = 0; i < 256; ++i)
+    {
+        const double t = i / 255.0;
+        double r = t, g = t, b = t;
+        switch (map)
+        {
+        case 0: break;
+        case -1:
+            r = ((startColor & 0xff) + (((endColor & 0xff) - (double)(startColor & 0xff)) * t)) / 255.0;
+            g = (((startColor >> 8) & 0xff) + ((((endColor >> 8) & 0xff) - (double)((startColor >> 8) & 0xff)) * t)) / 255.0;
+            b = (((startColor >> 16) & 0xff) + ((((endColor >> 16) & 0xff) - (double)((startColor >> 16) & 0xff)) * t)) / 255.0;
+            break;
+        case 2: r = 1.0; g = t; b = 1.0 - t; break;                         /* spring */
+        case 3: r = t; g = 0.5 + t * 0.5; b = 0.4; break;                   /* summer */
+        case 4: r = 1.0; g = t; b = 0.0; break;                             /* autumn */
+        case 5: r = 0.0; g = t; b = 1.0 - t * 0.5; break;                   /* winter */
+        case 7:                                                             /* jet */
+            r = clamp01(1.5 - fabs(4.0 * t - 3.0));
+            g = clamp01(1.5 - fabs(4.0 * t - 2.0));
+            b = clamp01(1.5 - fabs(4.0 * t - 1.0));
+            break;
+        case 11: r = t; g = 1.0 - t; b = 1.0; break;                        /* cool */
+        case 12:                                                            /* hsv: the hue once round */
+            r = clamp01(fabs(t * 6.0 - 3.0) - 1.0);
+            g = clamp01(2.0 - fabs(t * 6.0 - 2.0));
+            b = clamp01(2.0 - fabs(t * 6.0 - 4.0));
+            break;
+        case 14: r = clamp01(t * 3.0); g = clamp01(t * 3.0 - 1.0); b = clamp01(t * 3.0 - 2.0); break;   /* hot */
+        default:
+            return false;
+        }
+        tab[i * 3] = static_cast<uchar>(r * 255.0 + 0.5);
+        tab[i * 3 + 1] = static_cast<uchar>(g * 255.0 + 0.5);
+        tab[i * 3 + 2] = static_cast<uchar>(b * 255.0 + 0.5);
+    }
+    memcpy(m_map, tab, sizeof(m_map));
+    m_pseudo = map;
+    m_bTables = true;
+    update();
+    return true;
+}
+
+/* the levels of a sparse grid of the frame, a part of the way from the current ones */
+void GLPreview::autoLevels(const uchar* data, unsigned width, unsigned height, unsigned pitch)
+{
+    unsigned hist[3][256] = { { 0 } };
+    const bool bRedX = (MAKEFOURCC('G', 'R', 'B', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc);
+    const bool bRedY = (MAKEFOURCC('G', 'B', 'R', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc);
+    for (unsigned y = 0; y + 1 < height; y += GLPREVIEW_AUTO_STEP)
+    {
+        const uchar* row = data + static_cast<size_t>(y) * pitch;
+        for (unsigned x = 0; x + 1 < width; x += GLPREVIEW_AUTO_STEP)
+        {
+            if (!m_bRaw)
+            {
+                ++hist[0][row[x * 3]];
+                ++hist[1][row[x * 3 + 1]];
+                ++hist[2][row[x * 3 + 2]];
+                continue;
+            }
+            /* the 2 x 2 cell: one red, two green, one blue */
+            for (unsigned k = 0; k < 4; ++k)
+            {
+                const unsigned ox = k & 1, oy = k >> 1;
+                const unsigned cx = (ox + (bRedX ? 1 : 0)) & 1, cy = (oy + (bRedY ? 1 : 0)) & 1;
+                ++hist[(cx == cy) ? (cx ? 2 : 0) : 1][row[static_cast<size_t>(oy) * pitch + x + ox]];
+            }
+        }
+    }
+    for (int c = 0; c < 3; ++c)
+    {
+        unsigned total = 0;
+        for (int i = 0; i < 256; ++i)
+            total += hist[c][i];
+        if (0 == total)
+            return;
+        const unsigned clip = static_cast<unsigned>(total * GLPREVIEW_AUTO_CLIP);
+        int lo = 0, hi = 255;
+        for (unsigned n = 0; (lo < 255) && ((n += hist[c][lo]) <= clip); ++lo)
+            ;
+        for (unsigned n = 0; (hi > 0) && ((n += hist[c][hi]) <= clip); --hi)
+            ;
+        if (hi <= lo)
+        {
+            hi = std::min(lo + 1, 255);
+            lo = hi - 1;
+        }
+        const double rate = m_bAutoFirst ? 1.0 : GLPREVIEW_AUTO_RATE;
+        m_low[c] += (lo - m_low[c]) * rate;
+        m_high[c] += (hi - m_high[c]) * rate;
+    }
+    m_bAutoFirst = false;
+}
+
+void GLPreview::initializeGL()
+{
+    initializeOpenGLFunctions();
+    const QByteArray version = context()->isOpenGLES() ? "#version 300 es\nprecision highp float;\nprecision highp int;\n" : "#version 330 core\n";
+    m_program = new QOpenGLShaderProgram();
+    m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, version + s_vertex);
+    m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, version + s_fragment);
+    m_program->link();
+    m_vao.create();
+    glGenTextures(1, &m_tex);
+    glGenTextures(1, &m_texCurve);
+    glGenTextures(1, &m_texMap);
+    glGenBuffers(GLPREVIEW_PBOS, m_pbo);
+    m_bTables = true;
+}
+
+uchar* GLPreview::beginFrame(unsigned width, unsigned height, unsigned* pPitch)
+{
+    if ((nullptr == m_program) || m_bMapped)
+        return nullptr;
+    m_pitch = m_bRaw ? width : TDIBWIDTHBYTES(width * 24);
+    makeCurrent();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[m_index]);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, m_pitch * height, nullptr, GL_STREAM_DRAW);    /* orphan */
+    uchar* p = static_cast<uchar*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_pitch * height, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    doneCurrent();
+    m_bMapped = (nullptr != p);
+    *pPitch = m_pitch;
+    return p;
+}
+
+void GLPreview::endFrame(unsigned width, unsigned height)
+{
+    if (!m_bMapped)
+        return;
+    m_bMapped = false;
+    makeCurrent();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[m_index]);
+    if ((!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) || (0 == width) || (0 == height))   /* 0: the pull failed */
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        doneCurrent();
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, m_tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, m_bRaw ? 1 : 4);
+    if ((width != m_width) || (height != m_height))
+    {
+        m_width = width;
+        m_height = height;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (m_bRaw)
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, m_bRaw ? GL_RED : GL_RGB, GL_UNSIGNED_BYTE, nullptr);    /* from the pbo */
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    doneCurrent();
+    m_index = (m_index + 1) % GLPREVIEW_PBOS;
+    m_bFrame = true;
+    update();
+}
+
+bool GLPreview::showFrame(const uchar* data, unsigned width, unsigned height, unsigned pitch)
+{
+    unsigned dstPitch = 0;
+    uchar* p = beginFrame(width, height, &dstPitch);
+    if (nullptr == p)
+        return false;
+    if (m_bAuto)
+        autoLevels(data, width, height, pitch);
+    if (pitch == dstPitch)
+        memcpy(p, data, pitch * height);
+    else
+    {
+        for (unsigned y = 0; y < height; ++y)
+            memcpy(p + y * dstPitch, data + y * pitch, std::min(pitch, dstPitch));
+    }
+    endFrame(width, height);
+    return true;
+}
+
+QRect GLPreview::imageRect() const
+{
+    if ((0 == m_width) || (0 == m_height))
+        return rect();
+    const double scale = std::min(width() / (double)m_width, height() / (double)m_height);
+    const int w = static_cast<int>(m_width * scale), h = static_cast<int>(m_height * scale);
+    return QRect((width() - w) / 2, (height() - h) / 2, w, h);
+}
+
+void GLPreview::paintGL()
+{
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    const QRect rc = imageRect();
+    if (m_bFrame)
+    {
+        const qreal dpr = devicePixelRatioF();
+        glViewport(static_cast<GLint>(rc.x() * dpr), static_cast<GLint>((height() - rc.bottom() - 1) * dpr), static_cast<GLsizei>(rc.width() * dpr), static_cast<GLsizei>(rc.height() * dpr));
+        if (m_bTables)
+        {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glBindTexture(GL_TEXTURE_2D, m_texCurve);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 256, 1, 0, GL_RED, GL_UNSIGNED_BYTE, m_curve);
+            glBindTexture(GL_TEXTURE_2D, m_texMap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 256, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, m_map);
+            m_bTables = false;
+        }
+        m_program->bind();
+        m_program->setUniformValue("tex", 0);
+        m_program->setUniformValue("curveTab", 1);
+        m_program->setUniformValue("mapTab", 2);
+        m_program->setUniformValue("curve", m_bCurve ? 1 : 0);
+        m_program->setUniformValue("pseudo", m_pseudo ? 1 : 0);
+        m_program->setUniformValue("low", QVector3D(float(m_low[0] / 255.0), float(m_low[1] / 255.0), float(m_low[2] / 255.0)));
+        m_program->setUniformValue("gain", QVector3D(float(255.0 / (m_high[0] - m_low[0])), float(255.0 / (m_high[1] - m_low[1])), float(255.0 / (m_high[2] - m_low[2]))));
+        m_program->setUniformValue("raw", m_bRaw ? 1 : 0);
+        const bool bRedX = (MAKEFOURCC('G', 'R', 'B', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc);
+        const bool bRedY = (MAKEFOURCC('G', 'B', 'R', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc);
+        glUniform2i(m_program->uniformLocation("red"), bRedX ? 1 : 0, bRedY ? 1 : 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_texCurve);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, m_texMap);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_tex);
+        m_vao.bind();
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        m_vao.release();
+        m_program->release();
+    }
+    if (m_overlay)
+    {
+        QPainter painter(this);
+        m_overlay(painter, rc);
+    }
+}
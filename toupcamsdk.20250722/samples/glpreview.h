@@ -0,0 +1,88 @@
+#ifndef __glpreview_H__
+#define __glpreview_H__
+
+/*
+    Live preview widget on OpenGL (QOpenGLWidget): the frame is written straight into a pixel buffer object, uploaded
+    to a texture by the GPU and scaled by the GPU to the widget, keeping the aspect ratio; no QImage, no QPixmap, no
+    scaling on the CPU.
+    beginFrame() maps the next one of GLPREVIEW_PBOS pixel buffers (orphaned, so the GPU may still be reading the
+    previous frame) and returns where to pull the frame (Toupcam_PullImageV4 ... with pitch); endFrame() unmaps it,
+    starts the upload and schedules a repaint. Both in the UI thread. showFrame() does the same from a frame already
+    pulled into a buffer of the caller (such as the front() of a LatestFrame): one copy into the pixel buffer.
+    RGB24 (rows of TDIBWIDTHBYTES, byte order RGB: TOUPCAM_OPTION_BYTEORDER = 0) or, setRaw(), RAW8 Bayer (rows of width
+    bytes) with a bilinear demosaic in the fragment shader.
+    setOverlay(): drawn with QPainter on top of the frame in every repaint, imageRect being where the frame is.
+    Display adjustments on the GPU, in the fragment shader, instead of Toupcam_put_LevelRange(V2) / LevelRangeAuto,
+    put_Curve / put_Linear and TOUPCAM_OPTION_PSEUDO_COLOR_ENABLE in the pipeline of the SDK, which touch every pixel on
+    the CPU and every frame the program pulls, saved ones included: here they are parameters of the draw, the frames
+    stay as pulled (leave the SDK linear), a change costs a repaint. In this order:
+        setLevels()         per channel, low to 0, high to 255, the layout of Toupcam_put_LevelRange
+        setLevelsAuto()     the levels follow the frames: showFrame() samples every GLPREVIEW_AUTO_STEP pixel of every
+                            GLPREVIEW_AUTO_STEP row, GLPREVIEW_AUTO_CLIP of the samples below low and above high, and
+                            moves the levels GLPREVIEW_AUTO_RATE of the way per frame, so they do not jump with the
+                            noise (beginFrame() / endFrame(): the frame is not read, the levels stay)
+        setCurve()          a table of 256, the v8 of Toupcam_put_Curve, on R, G and B
+        setPseudoColor()    the luminance through a colour map, the values of TOUPCAM_OPTION_PSEUDO_COLOR_ENABLE
+                            (-1 custom from a start to an end colour, BGR, and the maps computed here: spring, summer,
+                            autumn, winter, jet, cool, hsv, hot; false for the others)
+    Needs OpenGL 3.3 core (setDefaultFormat() before QApplication) or OpenGL ES 3.0.
+*/
+#include <QOpenGLWidget>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QPainter>
+#include <functional>
+
+#define GLPREVIEW_PBOS          2
+#define GLPREVIEW_AUTO_STEP     8
+#define GLPREVIEW_AUTO_CLIP     0.001
+#define GLPREVIEW_AUTO_RATE     0.25
+
+class GLPreview : public QOpenGLWidget, protected QOpenGLExtraFunctions
+{
+    QOpenGLShaderProgram*       m_program;
+    QOpenGLVertexArrayObject    m_vao;
+    GLuint          m_tex, m_pbo[GLPREVIEW_PBOS], m_texCurve, m_texMap;
+    unsigned        m_index, m_width, m_height, m_pitch;    /* m_width, m_height: of the texture */
+    unsigned        m_fourcc;
+    bool            m_bRaw, m_bMapped, m_bFrame;
+    double          m_low[3], m_high[3];    /* levels, 0 ... 255 */
+    bool            m_bAuto, m_bAutoFirst;
+    uchar           m_curve[256], m_map[256 * 3];
+    bool            m_bCurve, m_bTables;    /* m_bTables: to upload */
+    int             m_pseudo;
+    std::function<void(QPainter&, const QRect&)> m_overlay;
+public:
+    GLPreview(QWidget* parent = nullptr);
+    ~GLPreview();
+
+    static void setDefaultFormat();
+
+    /* fourcc of Toupcam_get_RawFormat */
+    void setRaw(bool bRaw, unsigned fourcc);
+    void setOverlay(const std::function<void(QPainter&, const QRect&)>& overlay);
+
+    /* aLow, aHigh: 0 ... 255, [0] ... [2] R, G, B, [3] not used (no grey frames here) */
+    void setLevels(const unsigned short aLow[4], const unsigned short aHigh[4]);
+    void getLevels(unsigned short aLow[4], unsigned short aHigh[4]) const;
+    void setLevelsAuto(bool bAuto);
+    /* v8: 256 entries, nullptr: linear */
+    void setCurve(const uchar* v8);
+    /* map: TOUPCAM_OPTION_PSEUDO_COLOR_ENABLE, 0: off; startColor, endColor: of -1, BGR */
+    bool setPseudoColor(int map, unsigned startColor = 0x000000, unsigned endColor = 0xffffff);
+
+    /* nullptr before the widget is shown */
+    uchar* beginFrame(unsigned width, unsigned height, unsigned* pPitch);
+    void endFrame(unsigned width, unsigned height);
+    /* pitch: of data, false before the widget is shown */
+    bool showFrame(const uchar* data, unsigned width, unsigned height, unsigned pitch);
+protected:
+    void initializeGL() override;
+    void paintGL() override;
+private:
+    QRect imageRect() const;
+    void autoLevels(const uchar* data, unsigned width, unsigned height, unsigned pitch);
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef __histring_H__
+#define __histring_H__
+
+/*
+    Continuous histograms (TOUPCAM_OPTION_HISTOGRAM = 1, one Toupcam_GetHistogramV2) from the thread of the SDK to
+    one consumer, the UI, without a lock on either side: the callback copies the histogram into the next free slot of
+    a ring of HISTRING_SLOTS, tags it and publishes it; the consumer takes the newest at its own rate (a repaint, a
+    timer) with latest(), or every one in order with pop(). The slots are allocated by the constructor for the bit
+    depth given, so the callback never allocates, never waits and never calls into the UI.
+    The tag is the seq of the frame pulled last when the histogram came (frame(), from the thread which pulls) and the
+    host time of the callback: PITOUPCAM_HISTOGRAM_CALLBACKV2 says nothing of the frame, the histogram is of that
+    frame or of the next one (the SDK computes it in the pipeline, ahead of TOUPCAM_EVENT_IMAGE).
+    A slot returned to the consumer is its own until its next latest() or pop(): it is read in place, not copied.
+    When the consumer does not come for HISTRING_SLOTS - 1 histograms the ring is full and the new ones are dropped
+    (dropped()); the next latest() frees the ring at once.
+    The layout of the histogram is the one of the callback: 1 << (nFlag & 0x0f) bins, one channel if
+    nFlag & 0x00008000 (mono), otherwise three channels one after another.
+*/
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include "toupcam.h"
+#include "stagetrack.h"
+
+#define HISTRING_SLOTS  8
+
+struct HistSlot {
+    unsigned seq;               /* of the frame pulled last */
+    unsigned flag;              /* nFlag of the callback */
+    unsigned bins, channels;
+    long long t;                /* HostMicroseconds() of stagetrack.h */
+    const unsigned* hist;       /* channels x bins */
+};
+
+class HistRing {
+    struct Slot {
+        HistSlot s;
+        std::vector<unsigned> data;
+    };
+    std::vector<Slot> m_slot;
+    const unsigned m_maxBins;
+    std::atomic<unsigned> m_head;       /* next slot the producer writes */
+    std::atomic<unsigned> m_tail;       /* oldest slot of the consumer: held or not read yet */
+    unsigned m_read;                    /* consumer: next slot not read */
+    bool m_bHeld;                       /* consumer: m_read - 1 is held */
+    std::atomic<unsigned> m_seq;        /* the last frame pulled */
+    std::atomic<unsigned> m_nPushed, m_nDropped;
+
+    HistRing(const HistRing&);
+    HistRing& operator=(const HistRing&);
+public:
+    /* maxBits: the deepest histogram expected (8 for RGB, up to the bit depth of the sensor for RAW) */
+    explicit HistRing(unsigned maxBits = 8)
+    : m_slot(HISTRING_SLOTS), m_maxBins(1u << maxBits), m_head(0), m_tail(0), m_read(0), m_bHeld(false), m_seq(0), m_nPushed(0), m_nDropped(0)
+    {
+        for (size_t i = 0; i < m_slot.size(); ++i)
+        {
+            m_slot[i].data.resize((size_t)m_maxBins * 3);
+            memset(&m_slot[i].s, 0, sizeof(m_slot[i].s));
+        }
+    }
+
+    /* Toupcam_GetHistogramV2(h, HistRing::callback, &ring) */
+    static void __stdcall callback(const unsigned* aHist, unsigned nFlag, void* ctxHistogramV2)
+    {
+        static_cast<HistRing*>(ctxHistogramV2)->push(aHist, nFlag);
+    }
+
+    /* the thread which pulls, after each pull */
+    void frame(unsigned seq) { m_seq.store(seq, std::memory_order_relaxed); }
+
+    /* producer, the histogram callback; false: dropped */
+    bool push(const unsigned* aHist, unsigned nFlag)
+    {
+        const unsigned bins = 1u << (nFlag & 0x0f), channels = (nFlag & 0x00008000) ? 1 : 3;
+        const unsigned head = m_head.load(std::memory_order_relaxed);
+        if ((bins > m_maxBins) || (head - m_tail.load(std::memory_order_acquire) >= HISTRING_SLOTS))
+        {
+            m_nDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Slot& slot = m_slot[head % HISTRING_SLOTS];
+        memcpy(&slot.data[0], aHist, sizeof(unsigned) * bins * channels);
+        slot.s.seq = m_seq.load(std::memory_order_relaxed);
+        slot.s.flag = nFlag;
+        slot.s.bins = bins;
+        slot.s.channels = channels;
+        slot.s.t = HostMicroseconds();
+        slot.s.hist = &slot.data[0];
+        m_head.store(head + 1, std::memory_order_release);
+        m_nPushed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /* consumer: the newest histogram, the older ones skipped; pFresh: not returned before; NULL: none yet */
+    const HistSlot* latest(bool* pFresh = NULL)
+    {
+        const unsigned head = m_head.load(std::memory_order_acquire);
+        const bool bFresh = (head != m_read);
+        if (pFresh)
+            *pFresh = bFresh;
+        if (bFresh)
+        {
+            m_read = head;
+            m_bHeld = true;
+            m_tail.store(head - 1, std::memory_order_release);
+        }
+        return m_bHeld ? &m_slot[(m_read - 1) % HISTRING_SLOTS].s : NULL;
+    }
+
+    /* consumer: the oldest histogram not read yet, in order; NULL: none */
+    const HistSlot* pop()
+    {
+        const unsigned head = m_head.load(std::memory_order_acquire);
+        if (head == m_read)
+        {
+            if (m_bHeld)
+                m_tail.store(m_read, std::memory_order_release);
+            m_bHeld = false;
+            return NULL;
+        }
+        m_tail.store(m_read, std::memory_order_release);
+        m_bHeld = true;
+        return &m_slot[m_read++ % HISTRING_SLOTS].s;
+    }
+
+    unsigned pushed() const { return m_nPushed.load(std::memory_order_relaxed); }
+    unsigned dropped() const { return m_nDropped.load(std::memory_order_relaxed); }
+};
+
+#endif
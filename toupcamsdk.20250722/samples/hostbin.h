@@ -0,0 +1,135 @@
+#ifndef __hostbin_H__
+#define __hostbin_H__
+
+/*
+    Binning on the host, n x n with n = 2 ... 8, sum or average, into 16 bits, for the frames pulled as RAW: low light
+    fluorescence at a low resolution gets the signal of n x n pixels in one sample, and n x n times fewer bytes go
+    through the rest of the pipeline. The method is the one of Toupcam_put_Binning, the result is documented here:
+    HOSTBIN_SUM       sum of the n x n samples, 16 bits, saturated at 65535: the bit depth grows by log2(n x n), which
+                      fits 8 bits up to 16 x 16, 10 bits up to 8 x 8, 12 bits up to 4 x 4; beyond it the brightest
+                      pixels saturate, use HOSTBIN_AVERAGE or a smaller n then
+    HOSTBIN_AVERAGE   sum / (n x n), rounded, same bit depth as the input (in 16 bits)
+    Formats: 8 / 16 bits mono, 8 / 16 bits Bayer RAW, as pulled; 16 bits is little endian (TOUPCAM_OPTION_BITDEPTH = 1).
+    Bayer: the samples of one color are binned together, n x n cells of 2 x 2 give one cell of 2 x 2 with the pattern
+    (FourCC) of the input, so the output can still be demosaiced; the output is (width / 2n * 2) x (height / 2n * 2).
+    Mono: (width / n) x (height / n). The pixels beyond the last full bin are dropped.
+    The n rows of one output row are first summed into 32 bits per column (the bulk of the work: AVX2 when built for it,
+    -mavx2 or -march=native, /arch:AVX2, NEON on ARM, scalar otherwise), then the n columns of each output sample; the
+    three give the same result. acc holds the column sums and is kept by the caller, so a stream costs no allocation.
+*/
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HOSTBIN_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOSTBIN_NEON
+#endif
+
+#define HOSTBIN_SUM         0
+#define HOSTBIN_AVERAGE     1
+
+#define HOSTBIN_MONO8       0
+#define HOSTBIN_MONO16      1
+#define HOSTBIN_BAYER8      2
+#define HOSTBIN_BAYER16     3
+
+/* acc[x] += r[x], x = 0 ... n - 1 */
+static void HostBinAccumulate8(unsigned* acc, const unsigned char* r, unsigned n)
+{
+    unsigned x = 0;
+#if defined(HOSTBIN_AVX2)
+    for (; x + 16 <= n; x += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(r + x));
+        __m256i* a = (__m256i*)(acc + x);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_cvtepu8_epi32(v)));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1), _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+    }
+#elif defined(HOSTBIN_NEON)
+    for (; x + 16 <= n; x += 16)
+    {
+        const uint8x16_t v = vld1q_u8(r + x);
+        const uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+        vst1q_u32(acc + x, vaddw_u16(vld1q_u32(acc + x), vget_low_u16(lo)));
+        vst1q_u32(acc + x + 4, vaddw_u16(vld1q_u32(acc + x + 4), vget_high_u16(lo)));
+        vst1q_u32(acc + x + 8, vaddw_u16(vld1q_u32(acc + x + 8), vget_low_u16(hi)));
+        vst1q_u32(acc + x + 12, vaddw_u16(vld1q_u32(acc + x + 12), vget_high_u16(hi)));
+    }
+#endif
+    for (; x < n; ++x)
+        acc[x] += r[x];
+}
+
+static void HostBinAccumulate16(unsigned* acc, const unsigned short* r, unsigned n)
+{
+    unsigned x = 0;
+#if defined(HOSTBIN_AVX2)
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256i* a = (__m256i*)(acc + x);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(r + x)))));
+    }
+#elif defined(HOSTBIN_NEON)
+    for (; x + 8 <= n; x += 8)
+    {
+        const uint16x8_t v = vld1q_u16(r + x);
+        vst1q_u32(acc + x, vaddw_u16(vld1q_u32(acc + x), vget_low_u16(v)));
+        vst1q_u32(acc + x + 4, vaddw_u16(vld1q_u32(acc + x + 4), vget_high_u16(v)));
+    }
+#endif
+    for (; x < n; ++x)
+        acc[x] += r[x];
+}
+
+/* size of the output, false if n is out of 2 ... 8 or the frame is smaller than one bin */
+static bool HostBinSize(int format, unsigned width, unsigned height, unsigned n, unsigned* pw, unsigned* ph)
+{
+    const bool bBayer = (HOSTBIN_BAYER8 == format) || (HOSTBIN_BAYER16 == format);
+    if ((n < 2) || (n > 8))
+        return false;
+    *pw = bBayer ? (width / (2 * n) * 2) : (width / n);
+    *ph = bBayer ? (height / (2 * n) * 2) : (height / n);
+    return (*pw > 0) && (*ph > 0);
+}
+
+/* src, srcPitch: the frame as pulled (pitch in bytes); dst: 16 bits, dstPitch in bytes; pw, ph: the output size */
+static bool HostBin(int format, const void* src, size_t srcPitch, unsigned width, unsigned height, unsigned n, int method,
+                    unsigned short* dst, size_t dstPitch, std::vector<unsigned>& acc, unsigned* pw, unsigned* ph)
+{
+    if (!HostBinSize(format, width, height, n, pw, ph))
+        return false;
+    const bool bBayer = (HOSTBIN_BAYER8 == format) || (HOSTBIN_BAYER16 == format);
+    const bool b16 = (HOSTBIN_MONO16 == format) || (HOSTBIN_BAYER16 == format);
+    const unsigned step = bBayer ? 2 : 1, cols = bBayer ? (*pw / 2 * 2 * n) : (*pw * n), nn = n * n;
+    acc.resize(cols);
+    for (unsigned oy = 0; oy < *ph; ++oy)
+    {
+        /* first input row of the output row: mono oy * n, Bayer the same color phase in the cell of 2n rows */
+        const unsigned y0 = bBayer ? ((oy >> 1) * 2 * n + (oy & 1)) : (oy * n);
+        memset(&acc[0], 0, cols * sizeof(unsigned));
+        for (unsigned k = 0; k < n; ++k)
+        {
+            const unsigned char* r = (const unsigned char*)src + (size_t)(y0 + k * step) * srcPitch;
+            if (b16)
+                HostBinAccumulate16(&acc[0], (const unsigned short*)r, cols);
+            else
+                HostBinAccumulate8(&acc[0], r, cols);
+        }
+
+        unsigned short* o = (unsigned short*)((unsigned char*)dst + oy * dstPitch);
+        for (unsigned ox = 0; ox < *pw; ++ox)
+        {
+            const unsigned x0 = bBayer ? ((ox >> 1) * 2 * n + (ox & 1)) : (ox * n);
+            unsigned s = 0;
+            for (unsigned k = 0; k < n; ++k)
+                s += acc[x0 + k * step];
+            o[ox] = (unsigned short)((HOSTBIN_AVERAGE == method) ? ((s + nn / 2) / nn) : std::min(s, 65535u));
+        }
+    }
+    return true;
+}
+
+#endif
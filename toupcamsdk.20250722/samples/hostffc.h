@@ -0,0 +1,362 @@
+#ifndef __hostffc_H__
+#define __hostffc_H__
+
+/*
+    Dark field and flat field correction on the host, for the RAW frames recorded without the correction of the camera
+    (demoraw, demostillraw, demorawrec): out = (raw - dark) x gain, per pixel, clamped to the bit depth.
+    The files of Toupcam_FfcExport / Toupcam_DfcExport are in a format private to the camera, so the references are
+    built here, the same way the camera does: dark is the mean of frames taken with the light path closed, gain is
+    the mean of flat frames (an empty, evenly lit field) less dark, normalised to the mean of its Bayer color (of the
+    frame for mono) and inverted. They are kept in a file of their own (HostFfcFileHeader, then dark and gain, width x
+    height each, 16 bits), written by save() and read by load().
+    gain is fixed point, HOSTFFC_GAINBITS fraction bits: up to x 16, the rest is a dead pixel for the correction. The
+    product is rounded to the nearest; AVX2 when built for it (-mavx2 or -march=native, /arch:AVX2), NEON on ARM,
+    scalar otherwise, the same result.
+    The references are built incrementally, init / addDark, addFlat for every frame / finish, from running sums: the
+    memory is a few bytes per pixel whatever the number of frames, so 256 flats at full resolution cost what one does,
+    and the frames can come straight from the camera or from a recording. With a sigma clip, secondPass() turns the
+    sums into a range per pixel and the same frames are added once more, keeping only the values in the range. The
+    accumulation and apply() split the rows over threads worker threads (0: one per core).
+    Formats: RAW 8 bits, or 16 bits little endian for a bit depth of 9 ... 16 (TOUPCAM_OPTION_BITDEPTH = 1).
+*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HOSTFFC_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOSTFFC_NEON
+#endif
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+#define HOSTFFC_GAINBITS    12
+#define HOSTFFC_MAGIC       "THOSTFFC"
+
+typedef struct {
+    char magic[8];
+    unsigned width, height;
+    unsigned bitdepth;          /* of the frames the references were built from */
+    unsigned fourcc;            /* Toupcam_get_RawFormat */
+    unsigned darkFrames, flatFrames;
+} HostFfcFileHeader;
+
+/* o[x] = min(((max(r[x] - d[x], 0) * g[x]) + round) >> HOSTFFC_GAINBITS, vmax), x = 0 ... n - 1 */
+template <typename T>
+static void HostFfcRow(const T* r, const unsigned short* d, const unsigned short* g, T* o, unsigned n, unsigned vmax)
+{
+    unsigned x = 0;
+#if defined(HOSTFFC_AVX2)
+    const __m256i round = _mm256_set1_epi32(1 << (HOSTFFC_GAINBITS - 1)), vm = _mm256_set1_epi32((int)vmax);
+    for (; x + 8 <= n; x += 8)
+    {
+        const __m256i rv = (1 == sizeof(T)) ? _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(r + x))) : _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(r + x)));
+        const __m256i dv = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(d + x)));
+        const __m256i gv = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(g + x)));
+        __m256i v = _mm256_max_epi32(_mm256_sub_epi32(rv, dv), _mm256_setzero_si256());
+        v = _mm256_min_epi32(_mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(v, gv), round), HOSTFFC_GAINBITS), vm);
+        const __m128i w = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), _MM_SHUFFLE(3, 1, 2, 0)));
+        if (1 == sizeof(T))
+            _mm_storel_epi64((__m128i*)(o + x), _mm_packus_epi16(w, w));
+        else
+            _mm_storeu_si128((__m128i*)(o + x), w);
+    }
+#elif defined(HOSTFFC_NEON)
+    const uint16x8_t vm = vdupq_n_u16((unsigned short)vmax);
+    for (; x + 8 <= n; x += 8)
+    {
+        const uint16x8_t rv = (1 == sizeof(T)) ? vmovl_u8(vld1_u8((const uint8_t*)(r + x))) : vld1q_u16((const uint16_t*)(r + x));
+        const uint16x8_t v = vqsubq_u16(rv, vld1q_u16(d + x)), gv = vld1q_u16(g + x);
+        const uint16x8_t w = vminq_u16(vcombine_u16(vqrshrn_n_u32(vmull_u16(vget_low_u16(v), vget_low_u16(gv)), HOSTFFC_GAINBITS),
+                                                    vqrshrn_n_u32(vmull_u16(vget_high_u16(v), vget_high_u16(gv)), HOSTFFC_GAINBITS)), vm);
+        if (1 == sizeof(T))
+            vst1_u8((uint8_t*)(o + x), vmovn_u16(w));
+        else
+            vst1q_u16((uint16_t*)(o + x), w);
+    }
+#endif
+    for (; x < n; ++x)
+    {
+        const unsigned v = (r[x] > d[x]) ? ((((unsigned)r[x] - d[x]) * g[x] + (1u << (HOSTFFC_GAINBITS - 1))) >> HOSTFFC_GAINBITS) : 0;
+        o[x] = (T)std::min(v, vmax);
+    }
+}
+
+class HostFfc {
+    /* running statistics of one reference: the memory does not depend on the number of frames */
+    struct Stack {
+        unsigned frames;                        /* added in the first pass */
+        std::vector<unsigned> sum;              /* first pass: of all the frames, second pass: of the frames kept */
+        std::vector<unsigned long long> sq;     /* first pass with a sigma clip: sum of the squares */
+        std::vector<unsigned short> lo, hi;     /* second pass: the range kept */
+        std::vector<unsigned short> kept;       /* second pass: frames kept */
+    };
+    unsigned m_width, m_height, m_bitdepth, m_fourcc;
+    unsigned m_threads, m_pass;
+    double m_sigma;
+    unsigned m_darkFrames, m_flatFrames;
+    Stack m_darkStack, m_flatStack;
+    std::vector<unsigned short> m_dark, m_gain;
+
+    size_t count() const { return (size_t)m_width * m_height; }
+
+    bool bayer() const
+    {
+        return (MAKEFOURCC('G', 'B', 'R', 'G') == m_fourcc) || (MAKEFOURCC('R', 'G', 'G', 'B') == m_fourcc)
+            || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc) || (MAKEFOURCC('G', 'R', 'B', 'G') == m_fourcc);
+    }
+
+    /* f(y0, y1) over the rows, on m_threads worker threads */
+    template <typename F> void parallel_rows(F f) const
+    {
+        const unsigned n = std::max(1u, std::min<unsigned>(m_threads ? m_threads : std::thread::hardware_concurrency(), (m_height + 63) / 64));
+        if (n <= 1)
+            f(0, m_height);
+        else
+        {
+            std::vector<std::thread> vecThread;
+            for (unsigned t = 0; t < n; ++t)
+                vecThread.push_back(std::thread(f, m_height * t / n, m_height * (t + 1) / n));
+            for (size_t i = 0; i < vecThread.size(); ++i)
+                vecThread[i].join();
+        }
+    }
+
+    template <typename T> void accumulate(Stack& s, const T* p)
+    {
+        parallel_rows([&](unsigned y0, unsigned y1)
+        {
+            const size_t i0 = (size_t)y0 * m_width, i1 = (size_t)y1 * m_width;
+            if (2 == m_pass)
+            {
+                for (size_t i = i0; i < i1; ++i)
+                {
+                    if ((p[i] >= s.lo[i]) && (p[i] <= s.hi[i]))
+                    {
+                        s.sum[i] += p[i];
+                        ++s.kept[i];
+                    }
+                }
+            }
+            else if (s.sq.empty())
+            {
+                for (size_t i = i0; i < i1; ++i)
+                    s.sum[i] += p[i];
+            }
+            else
+            {
+                for (size_t i = i0; i < i1; ++i)
+                {
+                    s.sum[i] += p[i];
+                    s.sq[i] += (unsigned)p[i] * p[i];
+                }
+            }
+        });
+    }
+
+    void add(Stack& s, const void* data)
+    {
+        if (m_bitdepth > 8)
+            accumulate(s, (const unsigned short*)data);
+        else
+            accumulate(s, (const unsigned char*)data);
+        if (1 == m_pass)
+            ++s.frames;
+    }
+
+    void reset(Stack& s)
+    {
+        s.frames = 0;
+        s.sum.assign(count(), 0);
+        s.sq.assign((m_sigma > 0) ? count() : 0, 0);
+        std::vector<unsigned short>().swap(s.lo);
+        std::vector<unsigned short>().swap(s.hi);
+        std::vector<unsigned short>().swap(s.kept);
+    }
+
+    /* mean +- sigma x standard deviation of the first pass becomes the range of the second */
+    void clip(Stack& s)
+    {
+        if (0 == s.frames)
+            return;
+        s.lo.resize(count());
+        s.hi.resize(count());
+        s.kept.assign(count(), 0);
+        for (size_t i = 0; i < count(); ++i)
+        {
+            const double mean = (double)s.sum[i] / s.frames, sd = sqrt(std::max(0.0, (double)s.sq[i] / s.frames - mean * mean));
+            s.lo[i] = (unsigned short)std::max(0.0, floor(mean - m_sigma * sd));
+            s.hi[i] = (unsigned short)std::min(65535.0, ceil(mean + m_sigma * sd));
+        }
+        std::fill(s.sum.begin(), s.sum.end(), 0u);
+        std::vector<unsigned long long>().swap(s.sq);
+    }
+
+    /* mean of pixel i, of the frames kept after a second pass (the middle of the range when none was) */
+    double mean(const Stack& s, size_t i) const
+    {
+        if (s.kept.empty())
+            return (double)s.sum[i] / s.frames;
+        return s.kept[i] ? ((double)s.sum[i] / s.kept[i]) : ((s.lo[i] + s.hi[i]) / 2.0);
+    }
+public:
+    HostFfc()
+    : m_width(0), m_height(0), m_bitdepth(8), m_fourcc(0), m_threads(0), m_pass(1), m_sigma(0), m_darkFrames(0), m_flatFrames(0)
+    {
+    }
+
+    /*
+        start new references for frames of this size and format, dark 0 and gain 1 until finish();
+        threads: of the accumulation and of apply (0: one per core); sigma > 0: reject, per pixel, the frames further
+        than sigma standard deviations from the mean (hot pixels of a cosmic ray, dust that moved), in a second pass
+    */
+    void init(unsigned width, unsigned height, unsigned bitdepth, unsigned fourcc, unsigned threads = 0, double sigma = 0)
+    {
+        m_width = width;
+        m_height = height;
+        m_bitdepth = bitdepth;
+        m_fourcc = fourcc;
+        m_threads = threads;
+        m_sigma = sigma;
+        m_pass = 1;
+        m_darkFrames = m_flatFrames = 0;
+        reset(m_darkStack);
+        reset(m_flatStack);
+        m_dark.assign(count(), 0);
+        m_gain.assign(count(), 1 << HOSTFFC_GAINBITS);
+    }
+
+    /* one frame, packed rows; the second pass takes the same frames again, up to 65535 */
+    void addDark(const void* data) { add(m_darkStack, data); }
+    void addFlat(const void* data) { add(m_flatStack, data); }
+
+    /*
+        after the first pass: true if the frames have to be added once more for the sigma clip, the statistics of the
+        first pass are then replaced by the range of the values kept
+    */
+    bool secondPass()
+    {
+        if ((m_sigma <= 0) || (1 != m_pass))
+            return false;
+        clip(m_darkStack);
+        clip(m_flatStack);
+        m_pass = 2;
+        return true;
+    }
+
+    /* dark and gain from the frames added, with no dark frame dark stays 0, with no flat frame gain stays 1 */
+    void finish()
+    {
+        m_darkFrames = m_darkStack.frames;
+        m_flatFrames = m_flatStack.frames;
+        if (m_darkFrames)
+        {
+            for (size_t i = 0; i < count(); ++i)
+                m_dark[i] = (unsigned short)(mean(m_darkStack, i) + 0.5);
+        }
+        if (0 == m_flatFrames)
+            return;
+        /* flat less dark, and its mean per color phase of the 2 x 2 cell (one phase for mono) */
+        const unsigned phases = bayer() ? 4 : 1;
+        std::vector<double> flat(count()), avg(phases, 0.0);
+        std::vector<size_t> n(phases, 0);
+        for (unsigned y = 0; y < m_height; ++y)
+        {
+            for (unsigned x = 0; x < m_width; ++x)
+            {
+                const size_t i = (size_t)y * m_width + x;
+                const unsigned ph = (4 == phases) ? (((y & 1) << 1) | (x & 1)) : 0;
+                flat[i] = std::max(0.0, mean(m_flatStack, i) - m_dark[i]);
+                avg[ph] += flat[i];
+                ++n[ph];
+            }
+        }
+        for (unsigned ph = 0; ph < phases; ++ph)
+            avg[ph] = n[ph] ? (avg[ph] / n[ph]) : 0.0;
+        for (unsigned y = 0; y < m_height; ++y)
+        {
+            for (unsigned x = 0; x < m_width; ++x)
+            {
+                const size_t i = (size_t)y * m_width + x;
+                const unsigned ph = (4 == phases) ? (((y & 1) << 1) | (x & 1)) : 0;
+                const double g = (flat[i] > 0) ? (avg[ph] / flat[i] * (1 << HOSTFFC_GAINBITS) + 0.5) : 65535.0;
+                m_gain[i] = (unsigned short)std::min(g, 65535.0);
+            }
+        }
+    }
+
+    bool save(const char* filename) const
+    {
+        FILE* fp = fopen(filename, "wb");
+        if (NULL == fp)
+            return false;
+        HostFfcFileHeader header = { { 0 } };
+        memcpy(header.magic, HOSTFFC_MAGIC, sizeof(header.magic));
+        header.width = m_width;
+        header.height = m_height;
+        header.bitdepth = m_bitdepth;
+        header.fourcc = m_fourcc;
+        header.darkFrames = m_darkFrames;
+        header.flatFrames = m_flatFrames;
+        const bool ret = (fwrite(&header, sizeof(header), 1, fp) == 1) && (fwrite(&m_dark[0], sizeof(unsigned short), count(), fp) == count())
+            && (fwrite(&m_gain[0], sizeof(unsigned short), count(), fp) == count());
+        fclose(fp);
+        return ret;
+    }
+
+    /* threads: of apply, as in init */
+    bool load(const char* filename, unsigned threads = 0)
+    {
+        FILE* fp = fopen(filename, "rb");
+        if (NULL == fp)
+            return false;
+        HostFfcFileHeader header;
+        bool ret = (fread(&header, sizeof(header), 1, fp) == 1) && (0 == memcmp(header.magic, HOSTFFC_MAGIC, sizeof(header.magic)));
+        if (ret)
+        {
+            init(header.width, header.height, header.bitdepth, header.fourcc, threads);
+            m_darkFrames = header.darkFrames;
+            m_flatFrames = header.flatFrames;
+            ret = (fread(&m_dark[0], sizeof(unsigned short), count(), fp) == count()) && (fread(&m_gain[0], sizeof(unsigned short), count(), fp) == count());
+        }
+        fclose(fp);
+        return ret;
+    }
+
+    unsigned width() const { return m_width; }
+    unsigned height() const { return m_height; }
+    unsigned bitdepth() const { return m_bitdepth; }
+    unsigned fourcc() const { return m_fourcc; }
+    unsigned darkFrames() const { return m_darkFrames; }
+    unsigned flatFrames() const { return m_flatFrames; }
+
+    /* the dark reference, width() x height(): kept per exposure by darklib.h, replaced to switch at once */
+    const unsigned short* dark() const { return m_dark.empty() ? NULL : &m_dark[0]; }
+    void putDark(const unsigned short* dark) { memcpy(&m_dark[0], dark, count() * sizeof(unsigned short)); }
+
+    /* one frame of width() x height() at bitdepth(), packed rows; dst may be src */
+    void apply(const void* src, void* dst) const
+    {
+        const unsigned vmax = (1u << m_bitdepth) - 1;
+        parallel_rows([&](unsigned y0, unsigned y1)
+        {
+            for (unsigned y = y0; y < y1; ++y)
+            {
+                const size_t i = (size_t)y * m_width;
+                if (m_bitdepth > 8)
+                    HostFfcRow((const unsigned short*)src + i, &m_dark[i], &m_gain[i], (unsigned short*)dst + i, m_width, vmax);
+                else
+                    HostFfcRow((const unsigned char*)src + i, &m_dark[i], &m_gain[i], (unsigned char*)dst + i, m_width, vmax);
+            }
+        });
+    }
+};
+
+#endif
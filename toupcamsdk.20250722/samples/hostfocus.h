@@ -0,0 +1,329 @@
+#ifndef __hostfocus_H__
+#define __hostfocus_H__
+
+/*
+    Focus metrics computed on the host, over one region or a batch of regions of a frame, for the cameras which do not
+    send a focus value (uFV) of their own.
+    Metrics: HOSTFOCUS_LAPLACIAN (variance of the 4 neighbour Laplacian), HOSTFOCUS_TENENGRAD (mean squared Sobel
+    gradient), HOSTFOCUS_BRENNER (mean squared difference of the pixels two apart on a row), HOSTFOCUS_NORMVAR (variance
+    divided by the mean, which does not change with the brightness).
+    Formats: 8 / 16 bits mono, 8 / 16 bits Bayer RAW (each 2 x 2 cell is summed into one sample, so the colors of the
+    pattern do not show as edges; the region is aligned to the cell), RGB24 (luminance); 16 bits is little endian, as
+    pulled with TOUPCAM_OPTION_BITDEPTH = 1. pitch is in bytes, the regions must lie in the frame.
+    The region is first converted into float rows, then the rows go through the kernels of the metric: AVX2 when built
+    for it (-mavx2 or -march=native, /arch:AVX2), NEON on ARM, scalar otherwise; the results of the three differ only by
+    the rounding of the float sums. HostFocusMetricBatch() keeps the rows of one region for the next one, so the patches
+    of a focus map cost no allocation; the metrics of two frames should be compared with the same metric, format and
+    region only.
+*/
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HOSTFOCUS_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOSTFOCUS_NEON
+#endif
+
+#define HOSTFOCUS_LAPLACIAN     0
+#define HOSTFOCUS_TENENGRAD     1
+#define HOSTFOCUS_BRENNER       2
+#define HOSTFOCUS_NORMVAR       3
+
+#define HOSTFOCUS_MONO8         0
+#define HOSTFOCUS_MONO16        1
+#define HOSTFOCUS_BAYER8        2
+#define HOSTFOCUS_BAYER16       3
+#define HOSTFOCUS_RGB24         4
+
+typedef struct {
+    unsigned left, top, width, height;  /* pixels of the frame */
+} HostFocusRoi;
+
+#if defined(HOSTFOCUS_AVX2)
+static inline float HostFocusHsum(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+#elif defined(HOSTFOCUS_NEON)
+static inline float HostFocusHsum(float32x4_t v)
+{
+#if defined(__aarch64__)
+    return vaddvq_f32(v);
+#else
+    const float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+}
+#endif
+
+/* sum and sum of squares of r[0 ... n - 1] */
+static inline void HostFocusRowMoments(const float* r, unsigned n, double* pSum, double* pSum2)
+{
+    unsigned x = 0;
+    float s = 0.0f, s2 = 0.0f;
+#if defined(HOSTFOCUS_AVX2)
+    __m256 vs = _mm256_setzero_ps(), vs2 = _mm256_setzero_ps();
+    for (; x + 8 <= n; x += 8)
+    {
+        const __m256 v = _mm256_loadu_ps(r + x);
+        vs = _mm256_add_ps(vs, v);
+        vs2 = _mm256_add_ps(vs2, _mm256_mul_ps(v, v));
+    }
+    s = HostFocusHsum(vs);
+    s2 = HostFocusHsum(vs2);
+#elif defined(HOSTFOCUS_NEON)
+    float32x4_t vs = vdupq_n_f32(0.0f), vs2 = vdupq_n_f32(0.0f);
+    for (; x + 4 <= n; x += 4)
+    {
+        const float32x4_t v = vld1q_f32(r + x);
+        vs = vaddq_f32(vs, v);
+        vs2 = vmlaq_f32(vs2, v, v);
+    }
+    s = HostFocusHsum(vs);
+    s2 = HostFocusHsum(vs2);
+#endif
+    for (; x < n; ++x)
+    {
+        s += r[x];
+        s2 += r[x] * r[x];
+    }
+    *pSum += s;
+    *pSum2 += s2;
+}
+
+/* (r[x + 2] - r[x])^2, x = 0 ... n - 1 */
+static inline double HostFocusRowBrenner(const float* r, unsigned n)
+{
+    unsigned x = 0;
+    float s = 0.0f;
+#if defined(HOSTFOCUS_AVX2)
+    __m256 vs = _mm256_setzero_ps();
+    for (; x + 8 <= n; x += 8)
+    {
+        const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(r + x + 2), _mm256_loadu_ps(r + x));
+        vs = _mm256_add_ps(vs, _mm256_mul_ps(d, d));
+    }
+    s = HostFocusHsum(vs);
+#elif defined(HOSTFOCUS_NEON)
+    float32x4_t vs = vdupq_n_f32(0.0f);
+    for (; x + 4 <= n; x += 4)
+    {
+        const float32x4_t d = vsubq_f32(vld1q_f32(r + x + 2), vld1q_f32(r + x));
+        vs = vmlaq_f32(vs, d, d);
+    }
+    s = HostFocusHsum(vs);
+#endif
+    for (; x < n; ++x)
+    {
+        const float d = r[x + 2] - r[x];
+        s += d * d;
+    }
+    return s;
+}
+
+/* Laplacian at (x + 1) of the row r1, r0 above, r2 below, x = 0 ... n - 1: sum and sum of squares */
+static inline void HostFocusRowLaplacian(const float* r0, const float* r1, const float* r2, unsigned n, double* pSum, double* pSum2)
+{
+    unsigned x = 0;
+    float s = 0.0f, s2 = 0.0f;
+#if defined(HOSTFOCUS_AVX2)
+    const __m256 four = _mm256_set1_ps(4.0f);
+    __m256 vs = _mm256_setzero_ps(), vs2 = _mm256_setzero_ps();
+    for (; x + 8 <= n; x += 8)
+    {
+        const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(r1 + x), _mm256_loadu_ps(r1 + x + 2)), _mm256_add_ps(_mm256_loadu_ps(r0 + x + 1), _mm256_loadu_ps(r2 + x + 1)));
+        const __m256 l = _mm256_sub_ps(a, _mm256_mul_ps(four, _mm256_loadu_ps(r1 + x + 1)));
+        vs = _mm256_add_ps(vs, l);
+        vs2 = _mm256_add_ps(vs2, _mm256_mul_ps(l, l));
+    }
+    s = HostFocusHsum(vs);
+    s2 = HostFocusHsum(vs2);
+#elif defined(HOSTFOCUS_NEON)
+    float32x4_t vs = vdupq_n_f32(0.0f), vs2 = vdupq_n_f32(0.0f);
+    for (; x + 4 <= n; x += 4)
+    {
+        const float32x4_t a = vaddq_f32(vaddq_f32(vld1q_f32(r1 + x), vld1q_f32(r1 + x + 2)), vaddq_f32(vld1q_f32(r0 + x + 1), vld1q_f32(r2 + x + 1)));
+        const float32x4_t l = vmlsq_n_f32(a, vld1q_f32(r1 + x + 1), 4.0f);
+        vs = vaddq_f32(vs, l);
+        vs2 = vmlaq_f32(vs2, l, l);
+    }
+    s = HostFocusHsum(vs);
+    s2 = HostFocusHsum(vs2);
+#endif
+    for (; x < n; ++x)
+    {
+        const float l = r1[x] + r1[x + 2] + r0[x + 1] + r2[x + 1] - 4.0f * r1[x + 1];
+        s += l;
+        s2 += l * l;
+    }
+    *pSum += s;
+    *pSum2 += s2;
+}
+
+/* Sobel gx^2 + gy^2 at (x + 1) of the row r1, x = 0 ... n - 1 */
+static inline double HostFocusRowTenengrad(const float* r0, const float* r1, const float* r2, unsigned n)
+{
+    unsigned x = 0;
+    float s = 0.0f;
+#if defined(HOSTFOCUS_AVX2)
+    const __m256 two = _mm256_set1_ps(2.0f);
+    __m256 vs = _mm256_setzero_ps();
+    for (; x + 8 <= n; x += 8)
+    {
+        const __m256 a0 = _mm256_loadu_ps(r0 + x), a2 = _mm256_loadu_ps(r0 + x + 2);
+        const __m256 c0 = _mm256_loadu_ps(r2 + x), c2 = _mm256_loadu_ps(r2 + x + 2);
+        const __m256 gx = _mm256_add_ps(_mm256_sub_ps(_mm256_add_ps(a2, c2), _mm256_add_ps(a0, c0)), _mm256_mul_ps(two, _mm256_sub_ps(_mm256_loadu_ps(r1 + x + 2), _mm256_loadu_ps(r1 + x))));
+        const __m256 gy = _mm256_add_ps(_mm256_sub_ps(_mm256_add_ps(c0, c2), _mm256_add_ps(a0, a2)), _mm256_mul_ps(two, _mm256_sub_ps(_mm256_loadu_ps(r2 + x + 1), _mm256_loadu_ps(r0 + x + 1))));
+        vs = _mm256_add_ps(vs, _mm256_add_ps(_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy)));
+    }
+    s = HostFocusHsum(vs);
+#elif defined(HOSTFOCUS_NEON)
+    float32x4_t vs = vdupq_n_f32(0.0f);
+    for (; x + 4 <= n; x += 4)
+    {
+        const float32x4_t a0 = vld1q_f32(r0 + x), a2 = vld1q_f32(r0 + x + 2);
+        const float32x4_t c0 = vld1q_f32(r2 + x), c2 = vld1q_f32(r2 + x + 2);
+        const float32x4_t gx = vmlaq_n_f32(vsubq_f32(vaddq_f32(a2, c2), vaddq_f32(a0, c0)), vsubq_f32(vld1q_f32(r1 + x + 2), vld1q_f32(r1 + x)), 2.0f);
+        const float32x4_t gy = vmlaq_n_f32(vsubq_f32(vaddq_f32(c0, c2), vaddq_f32(a0, a2)), vsubq_f32(vld1q_f32(r2 + x + 1), vld1q_f32(r0 + x + 1)), 2.0f);
+        vs = vmlaq_f32(vmlaq_f32(vs, gx, gx), gy, gy);
+    }
+    s = HostFocusHsum(vs);
+#endif
+    for (; x < n; ++x)
+    {
+        const float gx = (r0[x + 2] + 2.0f * r1[x + 2] + r2[x + 2]) - (r0[x] + 2.0f * r1[x] + r2[x]);
+        const float gy = (r2[x] + 2.0f * r2[x + 1] + r2[x + 2]) - (r0[x] + 2.0f * r0[x + 1] + r0[x + 2]);
+        s += gx * gx + gy * gy;
+    }
+    return s;
+}
+
+/* the region as w x h float samples in plane, returns false if it is empty */
+static inline bool HostFocusPlane(int format, const void* data, size_t pitch, const HostFocusRoi& roi, std::vector<float>& plane, unsigned* pw, unsigned* ph)
+{
+    const bool bBayer = (HOSTFOCUS_BAYER8 == format) || (HOSTFOCUS_BAYER16 == format);
+    const bool b16 = (HOSTFOCUS_MONO16 == format) || (HOSTFOCUS_BAYER16 == format);
+    const unsigned left = bBayer ? (roi.left & ~1u) : roi.left, top = bBayer ? (roi.top & ~1u) : roi.top;
+    const unsigned w = bBayer ? (roi.width / 2) : roi.width, h = bBayer ? (roi.height / 2) : roi.height;
+    if ((0 == w) || (0 == h))
+        return false;
+    plane.resize((size_t)w * h);
+    for (unsigned y = 0; y < h; ++y)
+    {
+        float* out = &plane[(size_t)y * w];
+        if (bBayer)
+        {
+            const unsigned char* p0 = (const unsigned char*)data + (top + 2 * y) * pitch;
+            const unsigned char* p1 = p0 + pitch;
+            if (b16)
+            {
+                const unsigned short* q0 = (const unsigned short*)p0 + left;
+                const unsigned short* q1 = (const unsigned short*)p1 + left;
+                for (unsigned x = 0; x < w; ++x)
+                    out[x] = (float)(q0[2 * x] + q0[2 * x + 1] + q1[2 * x] + q1[2 * x + 1]);
+            }
+            else
+            {
+                p0 += left;
+                p1 += left;
+                for (unsigned x = 0; x < w; ++x)
+                    out[x] = (float)(p0[2 * x] + p0[2 * x + 1] + p1[2 * x] + p1[2 * x + 1]);
+            }
+        }
+        else
+        {
+            const unsigned char* p = (const unsigned char*)data + (top + y) * pitch;
+            if (HOSTFOCUS_RGB24 == format)
+            {
+                p += left * 3;
+                for (unsigned x = 0; x < w; ++x, p += 3)
+                    out[x] = 0.25f * p[0] + 0.5f * p[1] + 0.25f * p[2];    /* the same for RGB and BGR */
+            }
+            else if (b16)
+            {
+                const unsigned short* q = (const unsigned short*)p + left;
+                for (unsigned x = 0; x < w; ++x)
+                    out[x] = q[x];
+            }
+            else
+            {
+                p += left;
+                for (unsigned x = 0; x < w; ++x)
+                    out[x] = p[x];
+            }
+        }
+    }
+    *pw = w;
+    *ph = h;
+    return true;
+}
+
+static inline double HostFocusMetricPlane(int metric, const float* plane, unsigned w, unsigned h)
+{
+    double sum = 0.0, sum2 = 0.0, n = 0.0;
+    switch (metric)
+    {
+    case HOSTFOCUS_LAPLACIAN:
+    case HOSTFOCUS_TENENGRAD:
+        if ((w < 3) || (h < 3))
+            return 0.0;
+        for (unsigned y = 1; y + 1 < h; ++y)
+        {
+            const float* r1 = plane + (size_t)y * w;
+            if (HOSTFOCUS_LAPLACIAN == metric)
+                HostFocusRowLaplacian(r1 - w, r1, r1 + w, w - 2, &sum, &sum2);
+            else
+                sum += HostFocusRowTenengrad(r1 - w, r1, r1 + w, w - 2);
+        }
+        n = (double)(w - 2) * (h - 2);
+        if (HOSTFOCUS_TENENGRAD == metric)
+            return sum / n;
+        break;
+    case HOSTFOCUS_BRENNER:
+        if (w < 3)
+            return 0.0;
+        for (unsigned y = 0; y < h; ++y)
+            sum += HostFocusRowBrenner(plane + (size_t)y * w, w - 2);
+        return sum / ((double)(w - 2) * h);
+    case HOSTFOCUS_NORMVAR:
+        for (unsigned y = 0; y < h; ++y)
+            HostFocusRowMoments(plane + (size_t)y * w, w, &sum, &sum2);
+        n = (double)w * h;
+        break;
+    default:
+        return 0.0;
+    }
+    const double mean = sum / n, var = std::max(0.0, sum2 / n - mean * mean);
+    if (HOSTFOCUS_NORMVAR == metric)
+        return (mean > 0.0) ? (var / mean) : 0.0;
+    return var;
+}
+
+/* 0 if the region is too small for the metric */
+static inline double HostFocusMetric(int metric, int format, const void* data, size_t pitch, const HostFocusRoi& roi)
+{
+    std::vector<float> plane;
+    unsigned w = 0, h = 0;
+    if (!HostFocusPlane(format, data, pitch, roi, plane, &w, &h))
+        return 0.0;
+    return HostFocusMetricPlane(metric, &plane[0], w, h);
+}
+
+/* out[i] is the metric of rois[i] */
+static inline void HostFocusMetricBatch(int metric, int format, const void* data, size_t pitch, const HostFocusRoi* rois, unsigned n, double* out)
+{
+    std::vector<float> plane;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        unsigned w = 0, h = 0;
+        out[i] = HostFocusPlane(format, data, pitch, rois[i], plane, &w, &h) ? HostFocusMetricPlane(metric, &plane[0], w, h) : 0.0;
+    }
+}
+
+#endif
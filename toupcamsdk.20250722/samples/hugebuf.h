@@ -0,0 +1,249 @@
+#ifndef __hugebuf_H__
+#define __hugebuf_H__
+
+/*
+    Frame buffers backed by huge pages (Linux) / large pages (Windows), with a fallback down to ordinary pages.
+    A 25M RGB24 frame spans some 18000 pages of 4 KB, and demosaic, conversion and copy walk it row by row, several rows
+    at a time: the TLB misses show in the time of a pull. With pages of 2 MB the same frame is 37 TLB entries.
+    HugeBufAlloc tries, in this order, and tells which one it got (HUGEBUF_xxx):
+        Linux:      HUGEBUF_1G      MAP_HUGETLB | MAP_HUGE_1GB, for 1 GB and more: needs 1 GB pages reserved at boot
+                    HUGEBUF_2M      MAP_HUGETLB: needs pages reserved in /proc/sys/vm/nr_hugepages
+                    HUGEBUF_THP     ordinary anonymous memory aligned on 2 MB with madvise(MADV_HUGEPAGE): transparent
+                                    huge pages, when /sys/kernel/mm/transparent_hugepage/enabled is not "never"; the kernel
+                                    may still back parts of it with small pages (AnonHugePages of /proc/self/smaps)
+        Windows:    HUGEBUF_LARGE   VirtualAlloc MEM_LARGE_PAGES: needs the "Lock pages in memory" right
+                                    (SeLockMemoryPrivilege) of the account, enabled here for the process
+        all:        HUGEBUF_NORMAL  mmap / VirtualAlloc of ordinary pages
+    The size is rounded up to the page size; pass the size of the allocation (not the rounded one) to HugeBufFree.
+    The SDK allocates its own deques internally, so this is for the buffers of the program: the ones it pulls into
+    (Toupcam_PullImageV4, Toupcam_PullStillImageV4), its processing canvases and its per-frame copies. samples/simcam
+    uses it for its simulated deques with SIMCAM huge=1.
+    HugeBuffer is the same as a growable byte array (a resize which grows does not keep the content).
+*/
+#include <stddef.h>
+#include <new>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define HUGEBUF_NORMAL      0
+#define HUGEBUF_THP         1
+#define HUGEBUF_2M          2
+#define HUGEBUF_1G          3
+#define HUGEBUF_LARGE       4
+
+static inline const char* HugeBufName(int kind)
+{
+    switch (kind)
+    {
+    case HUGEBUF_THP: return "transparent huge pages";
+    case HUGEBUF_2M: return "huge pages 2M";
+    case HUGEBUF_1G: return "huge pages 1G";
+    case HUGEBUF_LARGE: return "large pages";
+    default: return "normal pages";
+    }
+}
+
+static inline size_t HugeBufRound(size_t size, size_t page)
+{
+    return (size + page - 1) / page * page;
+}
+
+#if defined(_WIN32)
+/* once per process: the privilege has to be held by the account and enabled in the token */
+static inline SIZE_T HugeBufLargePage()
+{
+    static SIZE_T s_page = (SIZE_T)-1;
+    if ((SIZE_T)-1 == s_page)
+    {
+        s_page = 0;
+        HANDLE hToken = NULL;
+        if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+        {
+            TOKEN_PRIVILEGES tp = { 0 };
+            tp.PrivilegeCount = 1;
+            tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+            if (LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid)
+                && AdjustTokenPrivileges(hToken, FALSE, &tp, 0, NULL, NULL) && (ERROR_SUCCESS == GetLastError()))
+                s_page = GetLargePageMinimum();
+            CloseHandle(hToken);
+        }
+    }
+    return s_page;
+}
+#endif
+
+static inline void* HugeBufAlloc(size_t size, int* pKind)
+{
+    int kind = HUGEBUF_NORMAL;
+    void* p = NULL;
+    if (size)
+    {
+#if defined(_WIN32)
+        const SIZE_T page = HugeBufLargePage();
+        if (page)
+        {
+            p = VirtualAlloc(NULL, HugeBufRound(size, page), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (p)
+                kind = HUGEBUF_LARGE;
+        }
+        if (NULL == p)
+            p = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        const size_t M2 = (size_t)2 << 20;
+#if defined(__linux__) && defined(MAP_HUGETLB)
+#if defined(MAP_HUGE_1GB)
+        if (size >= ((size_t)1 << 30))
+        {
+            p = mmap(NULL, HugeBufRound(size, (size_t)1 << 30), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+            if (MAP_FAILED == p)
+                p = NULL;
+            else
+                kind = HUGEBUF_1G;
+        }
+#endif
+        if (NULL == p)
+        {
+            p = mmap(NULL, HugeBufRound(size, M2), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (MAP_FAILED == p)
+                p = NULL;
+            else
+                kind = HUGEBUF_2M;
+        }
+#endif
+        if (NULL == p)
+        {
+            /* over-allocate by 2 MB, keep the aligned part: the kernel can only use huge pages on aligned ranges */
+            const size_t len = HugeBufRound(size, M2);
+            char* base = (char*)mmap(NULL, len + M2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (MAP_FAILED != (void*)base)
+            {
+                char* aligned = (char*)HugeBufRound((size_t)base, M2);
+                if (aligned > base)
+                    munmap(base, aligned - base);
+                if (aligned + len < base + len + M2)
+                    munmap(aligned + len, base + len + M2 - (aligned + len));
+                p = aligned;
+#if defined(MADV_HUGEPAGE)
+                if (0 == madvise(p, len, MADV_HUGEPAGE))
+                    kind = HUGEBUF_THP;
+#endif
+            }
+        }
+#endif
+    }
+    if (pKind)
+        *pKind = p ? kind : HUGEBUF_NORMAL;
+    return p;
+}
+
+/* size and kind as given to / returned by HugeBufAlloc */
+static inline void HugeBufFree(void* p, size_t size, int kind)
+{
+    if (NULL == p)
+        return;
+#if defined(_WIN32)
+    (void)size;
+    (void)kind;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    size_t page = (size_t)2 << 20;
+    if (HUGEBUF_1G == kind)
+        page = (size_t)1 << 30;
+    munmap(p, HugeBufRound(size, page));
+#endif
+}
+
+class HugeBuffer {
+    unsigned char* m_p;
+    size_t m_size, m_capacity;
+    int m_kind;
+    bool m_bHuge;               /* false: plain new[], to compare */
+
+    HugeBuffer(const HugeBuffer&);
+    HugeBuffer& operator=(const HugeBuffer&);
+
+    void release()
+    {
+        if (m_bHuge)
+            HugeBufFree(m_p, m_capacity, m_kind);
+        else
+            delete[] m_p;
+        m_p = NULL;
+        m_size = m_capacity = 0;
+        m_kind = HUGEBUF_NORMAL;
+    }
+public:
+    explicit HugeBuffer(bool bHuge = true)
+    : m_p(NULL), m_size(0), m_capacity(0), m_kind(HUGEBUF_NORMAL), m_bHuge(bHuge)
+    {
+    }
+
+    HugeBuffer(HugeBuffer&& other)
+    : m_p(other.m_p), m_size(other.m_size), m_capacity(other.m_capacity), m_kind(other.m_kind), m_bHuge(other.m_bHuge)
+    {
+        other.m_p = NULL;
+        other.m_size = other.m_capacity = 0;
+    }
+
+    HugeBuffer& operator=(HugeBuffer&& other)
+    {
+        if (this != &other)
+        {
+            release();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~HugeBuffer() { release(); }
+
+    /* frees the buffer, the next resize() allocates with huge pages or without */
+    void huge(bool bHuge)
+    {
+        if (bHuge != m_bHuge)
+        {
+            release();
+            m_bHuge = bHuge;
+        }
+    }
+
+    /* false when out of memory */
+    bool resize(size_t size)
+    {
+        if (size > m_capacity)
+        {
+            release();
+            if (m_bHuge)
+                m_p = (unsigned char*)HugeBufAlloc(size, &m_kind);
+            else
+                m_p = new (std::nothrow) unsigned char[size];
+            if (NULL == m_p)
+                return false;
+            m_capacity = size;
+        }
+        m_size = size;
+        return true;
+    }
+
+    void swap(HugeBuffer& other)
+    {
+        unsigned char* p = m_p; m_p = other.m_p; other.m_p = p;
+        size_t n = m_size; m_size = other.m_size; other.m_size = n;
+        n = m_capacity; m_capacity = other.m_capacity; other.m_capacity = n;
+        int k = m_kind; m_kind = other.m_kind; other.m_kind = k;
+        bool b = m_bHuge; m_bHuge = other.m_bHuge; other.m_bHuge = b;
+    }
+
+    unsigned char* data() { return m_p; }
+    const unsigned char* data() const { return m_p; }
+    unsigned char& operator[](size_t i) { return m_p[i]; }
+    const unsigned char& operator[](size_t i) const { return m_p[i]; }
+    size_t size() const { return m_size; }
+    bool empty() const { return 0 == m_size; }
+    int kind() const { return m_kind; }
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __latestframe_H__
+#define __latestframe_H__
+
+/*
+    Lock-free "latest frame" handoff from one producer thread (typically the thread which calls Toupcam_PullImageV4,
+    the event callback thread in pull mode with callback) to one consumer thread (preview, processing, recording).
+    Triple buffer: the producer fills back(), publish() swaps it with the middle slot; the consumer's update() swaps the
+    middle slot with front() when something new was published since its last update(). Neither side ever waits for
+    the other, there is no mutex and no per-frame signal; a frame published before the consumer picked up the previous
+    one replaces it (counted by overwritten()), so the consumer always gets the freshest frame and never a torn one.
+    T is the slot, such as a struct with a std::vector<unsigned char> and a ToupcamFrameInfoV4: size the three slots
+    through slot() before the producer starts, so publishing never allocates.
+    One LatestFrame per consumer: several consumers of the same camera each get their own, filled by the producer in turn.
+*/
+#include <atomic>
+
+template <typename T>
+class LatestFrame {
+    enum { FRESH = 4 };             /* set on the middle index when it holds a frame the consumer has not seen yet */
+    T m_slot[3];
+    unsigned m_back, m_front;       /* owned by the producer and by the consumer */
+    std::atomic<unsigned> m_middle;
+    std::atomic<unsigned> m_nPublished, m_nOverwritten;
+public:
+    LatestFrame()
+    : m_back(0), m_front(1), m_middle(2), m_nPublished(0), m_nOverwritten(0)
+    {
+    }
+
+    /* direct access to the three slots, only while there is neither producer nor consumer */
+    T& slot(unsigned index) { return m_slot[index]; }
+
+    /* producer side */
+    T& back() { return m_slot[m_back]; }
+    void publish()
+    {
+        const unsigned prev = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+        m_back = prev & ~FRESH;
+        ++m_nPublished;
+        if (prev & FRESH)
+            ++m_nOverwritten;
+    }
+
+    /* consumer side: true when front() is a new frame */
+    bool update()
+    {
+        if (0 == (m_middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+    const T& front() const { return m_slot[m_front]; }
+
+    /* frames published, and those replaced before the consumer got them */
+    unsigned published() const { return m_nPublished; }
+    unsigned overwritten() const { return m_nOverwritten; }
+};
+
+#endif
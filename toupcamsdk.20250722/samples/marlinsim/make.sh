@@ -0,0 +1,7 @@
+#!/bin/bash
+os=`uname -s`
+if [[ $os = "Linux" ]]; then
+	g++ -g -o marlinsim marlinsim.cpp
+else
+	clang++ -g -o marlinsim marlinsim.cpp
+fi
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <deque>
+#include <string>
+#include <chrono>
+
+/*
+    Stand-in for a Marlin controller on a virtual serial port (a pty), to benchmark the host side without a board:
+    gcodestream.h, scanexec.h, demozscan, any tool which talks G-code on a tty.
+    usage: marlinsim [-x speedup = 1] [-a accel = 3000 mm/s^2] [-f feed = 300 mm/s] [-j junction = 0.013 mm]
+                     [-r rx = 128] [-b bufsize = 4] [-p blocks = 16] [-l moves.csv]
+    The path of the port is printed, open it as the controller's (once "w" and once "r", see gcodestream.h).
+    Modelled as the firmware does it:
+        - the receive buffer of rx characters: what comes beyond it while it is full is lost and counted, as on a
+          board (no flow control): a host which keeps to the window never loses anything
+        - the command queue of bufsize lines (BUFSIZE), "ok" once a line is done: a G0 / G1 once it is in the planner
+        - the planner of blocks moves (BLOCK_BUFFER_SIZE), look ahead through all of them: junction deviation at every
+          corner, a trapezoid for every move, stop at the end of the last one; a move into an empty planner starts
+          after 100 ms (BLOCK_DELAY_FOR_1ST_MOVE), the move started is not planned again
+        - M400 waits for the planner to be empty, G4 too then dwells; "echo:busy: processing" every 2 s of a command
+          which keeps the queue (DEFAULT_KEEPALIVE_INTERVAL)
+        - M114: "X: Y: Z: E: Count X: Y: Z:" of the end of the last move queued, M114 R where the axes are now;
+          M154 S<s> auto reports the position every s seconds; G90 / G91, G92, G28 (instant)
+    The clock is the host clock times speedup: at -x 10 a move of one second takes 100 ms, and the times printed are
+    in the simulated clock. Every stall is printed: the planner ran dry between two moves, the axes stopped while the
+    host was late; that is the queue starvation of a stream. Ctrl+C prints the totals. -l writes every move as
+    "start s, end s, x, y, z" (simulated clock) for the timing of triggers against the moves.
+    POSIX only (posix_openpt).
+*/
+#define KEEPALIVE       2.0     /* s */
+#define MIN_SPEED       0.05    /* mm/s, MINIMUM_PLANNER_SPEED */
+#define FIRST_MOVE      0.1     /* s, BLOCK_DELAY_FOR_1ST_MOVE: a move into an empty planner waits for the next ones */
+
+struct Block {
+    double start[3], end[3];
+    double length, unit[3];
+    double nominal, accel;
+    double entryMax, entry, exit;
+    double t0, duration;        /* set when the block starts */
+};
+
+static double g_speedup = 1, g_accel = 3000, g_feedMax = 300, g_junction = 0.013;
+static unsigned g_rxSize = 128, g_bufSize = 4, g_blocks = 16;
+static const double g_axisFeed[3] = { 300, 300, 5 };        /* mm/s, DEFAULT_MAX_FEEDRATE */
+static const double g_axisAccel[3] = { 3000, 3000, 100 };   /* mm/s^2, DEFAULT_MAX_ACCELERATION */
+static int g_master = -1;
+static std::chrono::steady_clock::time_point g_t0;
+static std::string g_rx;
+static std::deque<std::string> g_queue;
+static std::deque<Block> g_planner;     /* front: the block moving, if started */
+static bool g_bRunning = false;         /* front started */
+static double g_planned[3] = { 0 };     /* end of the last move queued */
+static double g_feed = 50;              /* mm/s, modal F */
+static bool g_bRelative = false;
+static double g_autoReport = 0, g_nextReport = 0;
+static double g_busySince = -1, g_nextBusy = 0;
+static double g_dwellEnd = -1;
+static double g_deliver = 0;            /* the front is not started before */
+static volatile sig_atomic_t g_bQuit = 0;
+static FILE* g_log = NULL;
+/* totals */
+static unsigned long long g_lines = 0, g_moves = 0, g_stalls = 0, g_lost = 0;
+static double g_moveTime = 0, g_stallTime = 0, g_idleSince = -1;
+static bool g_bStallWatch = false;      /* the planner ran dry after a move, not after M400 */
+
+static double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - g_t0).count() * g_speedup;
+}
+
+static void Send(const char* s)
+{
+    const size_t n = strlen(s);
+    if (write(g_master, s, n) != (ssize_t)n)
+        g_bQuit = 1;
+}
+
+static void SendPosition(const double pos[3])
+{
+    char buf[160];
+    sprintf(buf, "X:%.2f Y:%.2f Z:%.2f E:0.00 Count X:%ld Y:%ld Z:%ld\n", pos[0], pos[1], pos[2], lround(pos[0] * 80), lround(pos[1] * 80), lround(pos[2] * 400));
+    Send(buf);
+}
+
+/* time of a trapezoid from entry to exit over length, cruise at nominal */
+static double TrapezoidTime(double length, double entry, double exit, double nominal, double accel)
+{
+    const double dAcc = (nominal * nominal - entry * entry) / (2 * accel);
+    const double dDec = (nominal * nominal - exit * exit) / (2 * accel);
+    if (dAcc + dDec > length)
+    {
+        const double peak = sqrt((2 * accel * length + entry * entry + exit * exit) / 2);
+        return (peak - entry) / accel + (peak - exit) / accel;
+    }
+    return (nominal - entry) / accel + (nominal - exit) / accel + (length - dAcc - dDec) / nominal;
+}
+
+/* distance covered t seconds into the block */
+static double TrapezoidDistance(const Block& b, double t)
+{
+    const double dAcc = (b.nominal * b.nominal - b.entry * b.entry) / (2 * b.accel);
+    const double dDec = (b.nominal * b.nominal - b.exit * b.exit) / (2 * b.accel);
+    double peak = b.nominal, tAcc, tCruise;
+    if (dAcc + dDec > b.length)
+    {
+        peak = sqrt((2 * b.accel * b.length + b.entry * b.entry + b.exit * b.exit) / 2);
+        tCruise = 0;
+    }
+    else
+        tCruise = (b.length - dAcc - dDec) / b.nominal;
+    tAcc = (peak - b.entry) / b.accel;
+    if (t <= tAcc)
+        return b.entry * t + b.accel * t * t / 2;
+    const double sAcc = (peak * peak - b.entry * b.entry) / (2 * b.accel);
+    if (t <= tAcc + tCruise)
+        return sAcc + peak * (t - tAcc);
+    const double td = fmin(t - tAcc - tCruise, (peak - b.exit) / b.accel);
+    return fmin(b.length, sAcc + peak * tCruise + peak * td - b.accel * td * td / 2);
+}
+
+/* look ahead over the blocks not started: backward from a stop at the end, then forward */
+static void Recalculate()
+{
+    const size_t first = g_bRunning ? 1 : 0;
+    if (first >= g_planner.size())
+        return;
+    double exit = 0;
+    for (size_t i = g_planner.size(); i-- > first; )
+    {
+        Block& b = g_planner[i];
+        b.exit = exit;
+        b.entry = fmin(b.entryMax, sqrt(exit * exit + 2 * b.accel * b.length));
+        exit = b.entry;
+    }
+    if (g_bRunning)
+        g_planner[1].entry = g_planner[0].exit;     /* fixed when the front started */
+    else
+        g_planner[0].entry = fmin(g_planner[0].entry, MIN_SPEED);
+    for (size_t i = first; i + 1 < g_planner.size(); ++i)
+    {
+        Block& b = g_planner[i];
+        Block& n = g_planner[i + 1];
+        n.entry = fmin(n.entry, sqrt(b.entry * b.entry + 2 * b.accel * b.length));
+        b.exit = n.entry;
+    }
+}
+
+static void AddMove(const double target[3], double now)
+{
+    Block b;
+    memcpy(b.start, g_planned, sizeof(b.start));
+    memcpy(b.end, target, sizeof(b.end));
+    double sq = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+        b.unit[k] = target[k] - g_planned[k];
+        sq += b.unit[k] * b.unit[k];
+    }
+    b.length = sqrt(sq);
+    memcpy(g_planned, target, sizeof(g_planned));
+    if (b.length < 1e-6)
+        return;
+    b.nominal = fmin(g_feed, g_feedMax);
+    b.accel = g_accel;
+    for (int k = 0; k < 3; ++k)
+    {
+        b.unit[k] /= b.length;
+        if (fabs(b.unit[k]) > 1e-9)
+        {
+            b.nominal = fmin(b.nominal, g_axisFeed[k] / fabs(b.unit[k]));
+            b.accel = fmin(b.accel, g_axisAccel[k] / fabs(b.unit[k]));
+        }
+    }
+    /* junction deviation with the move before, if still in the planner */
+    b.entryMax = MIN_SPEED;
+    if (!g_planner.empty())
+    {
+        const Block& p = g_planner.back();
+        const double cosTheta = -(p.unit[0] * b.unit[0] + p.unit[1] * b.unit[1] + p.unit[2] * b.unit[2]);
+        double v = MIN_SPEED;
+        if (cosTheta < -0.999999)
+            v = 1e9;    /* straight on */
+        else if (cosTheta < 0.999999)
+        {
+            const double sinHalf = sqrt(0.5 * (1 - cosTheta));
+            v = sqrt(b.accel * g_junction * sinHalf / (1 - sinHalf));
+        }
+        b.entryMax = fmax(MIN_SPEED, fmin(v, fmin(b.nominal, p.nominal)));
+    }
+    b.entry = b.exit = 0;
+    b.t0 = b.duration = 0;
+    if (g_planner.empty())
+        g_deliver = now + FIRST_MOVE;
+    g_planner.push_back(b);
+    Recalculate();
+    ++g_moves;
+}
+
+/* the axes up to now: blocks done are dropped, the next one started */
+static void Step(double now)
+{
+    while (!g_planner.empty())
+    {
+        if (!g_bRunning)
+        {
+            if (now < g_deliver)
+                return;
+            Block& b = g_planner.front();
+            if (g_bStallWatch && (g_idleSince >= 0))
+            {
+                ++g_stalls;
+                g_stallTime += now - g_idleSince;
+                printf("stall: %.1f ms at %.3f s, before X%.3f Y%.3f Z%.3f\n", (now - g_idleSince) * 1000, g_idleSince, b.end[0], b.end[1], b.end[2]);
+            }
+            b.t0 = now;
+            b.duration = TrapezoidTime(b.length, b.entry, b.exit, b.nominal, b.accel);
+            g_bRunning = true;
+            g_idleSince = -1;
+        }
+        Block& b = g_planner.front();
+        if (now < b.t0 + b.duration)
+            return;
+        g_moveTime += b.duration;
+        if (g_log)
+            fprintf(g_log, "%.6f,%.6f,%.4f,%.4f,%.4f\n", b.t0, b.t0 + b.duration, b.end[0], b.end[1], b.end[2]);
+        const double tEnd = b.t0 + b.duration;
+        g_planner.pop_front();
+        g_bRunning = false;
+        if (g_planner.empty())
+        {
+            g_idleSince = tEnd;
+            g_bStallWatch = true;
+        }
+        else
+        {
+            g_planner.front().t0 = tEnd;   /* back to back */
+            g_planner.front().duration = TrapezoidTime(g_planner.front().length, g_planner.front().entry, g_planner.front().exit, g_planner.front().nominal, g_planner.front().accel);
+            g_bRunning = true;
+        }
+    }
+}
+
+static void Current(double now, double pos[3])
+{
+    if (g_planner.empty() || !g_bRunning)
+    {
+        const double* p = g_planner.empty() ? g_planned : g_planner.front().start;
+        memcpy(pos, p, 3 * sizeof(double));
+        return;
+    }
+    const Block& b = g_planner.front();
+    const double s = TrapezoidDistance(b, fmax(0.0, now - b.t0));
+    for (int k = 0; k < 3; ++k)
+        pos[k] = b.start[k] + b.unit[k] * s;
+}
+
+static bool Param(const char* line, char c, double* v)
+{
+    for (const char* p = line; *p; ++p)
+    {
+        if ((*p == c) && ((p == line) || (' ' == p[-1])))
+        {
+            *v = atof(p + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* the front of the queue; false: it keeps the queue (planner full, M400, dwell) */
+static bool Execute(const std::string& cmd, double now)
+{
+    const char* line = cmd.c_str();
+    double v;
+    if ((0 == strncmp(line, "G0", 2) || 0 == strncmp(line, "G1", 2)) && !isdigit((unsigned char)line[2]))
+    {
+        if (g_planner.size() >= g_blocks)
+            return false;
+        if (Param(line, 'F', &v))
+            g_feed = v / 60;
+        double target[3];
+        memcpy(target, g_planned, sizeof(target));
+        static const char axis[3] = { 'X', 'Y', 'Z' };
+        for (int k = 0; k < 3; ++k)
+        {
+            if (Param(line, axis[k], &v))
+                target[k] = g_bRelative ? target[k] + v : v;
+        }
+        AddMove(target, now);
+        Step(now);
+    }
+    else if ((0 == strncmp(line, "M400", 4)) || (0 == strncmp(line, "G4", 2)))
+    {
+        if (!g_planner.empty())
+            return false;
+        g_bStallWatch = false;
+        if ('G' == line[0])
+        {
+            if (g_dwellEnd < 0)
+                g_dwellEnd = now + (Param(line, 'P', &v) ? v / 1000 : 0) + (Param(line, 'S', &v) ? v : 0);
+            if (now < g_dwellEnd)
+                return false;
+            g_dwellEnd = -1;
+        }
+    }
+    else if (0 == strncmp(line, "M114", 4))
+    {
+        double pos[3];
+        if (strstr(line, " R"))
+            Current(now, pos);
+        else
+            memcpy(pos, g_planned, sizeof(pos));
+        SendPosition(pos);
+    }
+    else if (0 == strncmp(line, "M154", 4))
+    {
+        g_autoReport = Param(line, 'S', &v) ? v : 0;
+        g_nextReport = now + g_autoReport;
+    }
+    else if (0 == strncmp(line, "G90", 3))
+        g_bRelative = false;
+    else if (0 == strncmp(line, "G91", 3))
+        g_bRelative = true;
+    else if ((0 == strncmp(line, "G92", 3)) || (0 == strncmp(line, "G28", 3)))
+    {
+        if (!g_planner.empty())
+            return false;
+        static const char axis[3] = { 'X', 'Y', 'Z' };
+        const bool bHome = (0 == strncmp(line, "G28", 3));
+        const bool bAll = bHome && !strpbrk(line + 3, "XYZ");
+        for (int k = 0; k < 3; ++k)
+        {
+            if (Param(line, axis[k], &v))
+                g_planned[k] = bHome ? 0 : v;
+            else if (bAll)
+                g_planned[k] = 0;
+        }
+        g_bStallWatch = false;
+    }
+    Send("ok\n");
+    return true;
+}
+
+static void OnSignal(int)
+{
+    g_bQuit = 1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* logname = NULL;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (0 == strcmp(argv[i], "-x"))
+            g_speedup = atof(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-a"))
+            g_accel = atof(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-f"))
+            g_feedMax = atof(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-j"))
+            g_junction = atof(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-r"))
+            g_rxSize = (unsigned)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-b"))
+            g_bufSize = (unsigned)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-p"))
+            g_blocks = (unsigned)atoi(argv[i + 1]);
+        else if (0 == strcmp(argv[i], "-l"))
+            logname = argv[i + 1];
+        else
+        {
+            printf("usage: %s [-x speedup] [-a accel] [-f feed] [-j junction] [-r rx] [-b bufsize] [-p blocks] [-l moves.csv]\n", argv[0]);
+            return -1;
+        }
+    }
+    if ((g_speedup <= 0) || (g_accel <= 0) || (g_feedMax <= 0) || (0 == g_rxSize) || (0 == g_bufSize) || (0 == g_blocks))
+    {
+        printf("invalid parameter\n");
+        return -1;
+    }
+    if (logname && (NULL == (g_log = fopen(logname, "w"))))
+    {
+        printf("failed to create %s\n", logname);
+        return -1;
+    }
+
+    g_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((g_master < 0) || grantpt(g_master) || unlockpt(g_master))
+    {
+        printf("failed to create the pty\n");
+        return -1;
+    }
+    const char* name = ptsname(g_master);
+    /* raw, no echo; held open so that the port outlives the host closing it */
+    const int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if ((slave < 0) || tcgetattr(slave, &tio))
+    {
+        printf("failed to open %s\n", name);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    printf("port: %s, rx %u, bufsize %u, blocks %u, accel %.0f mm/s^2, junction %.3f mm, x%.1f\n", name, g_rxSize, g_bufSize, g_blocks, g_accel, g_junction, g_speedup);
+    fflush(stdout);
+
+    g_t0 = std::chrono::steady_clock::now();
+    char buf[256];
+    while (!g_bQuit)
+    {
+        struct pollfd pfd = { g_master, POLLIN, 0 };
+        poll(&pfd, 1, 1);
+        const double now = Now();
+        if (pfd.revents & POLLIN)
+        {
+            const ssize_t n = read(g_master, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; ++i)
+            {
+                if (g_rx.size() < g_rxSize)
+                    g_rx.push_back(buf[i]);
+                else
+                    ++g_lost;   /* overrun: the firmware drops it */
+            }
+        }
+        /* lines from the receive buffer into the command queue, as long as there is room */
+        size_t eol;
+        while ((g_queue.size() < g_bufSize) && (std::string::npos != (eol = g_rx.find_first_of("\r\n"))))
+        {
+            std::string line = g_rx.substr(0, eol);
+            g_rx.erase(0, eol + 1);
+            const size_t c = line.find(';');
+            if (std::string::npos != c)
+                line.erase(c);
+            line.erase(0, line.find_first_not_of(" \t"));
+            if (!line.empty())
+            {
+                g_queue.push_back(line);
+                ++g_lines;
+            }
+        }
+        Step(now);
+        while (!g_queue.empty())
+        {
+            if (!Execute(g_queue.front(), now))
+            {
+                if (g_busySince < 0)
+                {
+                    g_busySince = now;
+                    g_nextBusy = now + KEEPALIVE;
+                }
+                else if (now >= g_nextBusy)
+                {
+                    Send("echo:busy: processing\n");
+                    g_nextBusy += KEEPALIVE;
+                }
+                break;
+            }
+            g_busySince = -1;
+            g_queue.pop_front();
+        }
+        if ((g_autoReport > 0) && (now >= g_nextReport))
+        {
+            double pos[3];
+            Current(now, pos);
+            SendPosition(pos);
+            g_nextReport += g_autoReport;
+        }
+    }
+
+    printf("%llu lines, %llu moves, %.3f s moving, %llu stalls (%.1f ms), %llu characters lost\n", g_lines, g_moves, g_moveTime, g_stalls, g_stallTime * 1000, g_lost);
+
+    /* cleanup */
+    close(slave);
+    close(g_master);
+    if (g_log)
+        fclose(g_log);
+    return 0;
+}
@@ -0,0 +1,328 @@
+#ifndef __numaplace_H__
+#define __numaplace_H__
+
+/*
+    NUMA placement of a camera: its frame buffers and its threads on the node of the controller it is attached to.
+    On a host of several sockets each USB / PCIe controller and each network card hangs off one node; a frame which the
+    controller writes on one node and the SDK and the program then process on the cores and in the memory of another
+    crosses the socket link several times (DMA, demosaic, pull, processing).
+    The SDK has no placement of its own, but what it creates in Toupcam_StartXXXX (the deques, the grab and image
+    processing threads, TOUPCAM_OPTION_MULTITHREAD workers, the callback thread) inherits the calling thread on Linux:
+    NumaStartPullModeWithCallback binds the caller to the CPUs of the node and prefers the memory of the node
+    (set_mempolicy) for the duration of the start, pins the threads the start created (samples/demopin/threadpin.h,
+    which also covers Windows where threads inherit the affinity of the process only), and restores the caller.
+    Locality of a camera (NumaLocate), Linux:
+        USB         the devices of /sys/bus/usb/devices with a vendor / product id of the SDK (Toupcam_get_Model) and
+                    the model of the camera; the serial number (Toupcam_get_SerialNumber) picks one out of several of
+                    the same model, or they all have to be on the same node; the node is the numa_node of the first
+                    parent (the PCI controller) which has one
+        hint        "3" (a node), "eth2" (the network card of a GigE camera) or a path in /sys (a controller)
+    Windows: the node comes from a number only; NumaNodeCpus / NumaAlloc use the NUMA API of the system (the
+    processors of group 0). macOS has no NUMA. On a host of one node everything is node 0 and this costs nothing.
+    NumaAlloc / NumaFree: memory of the program (the buffers pulled into) on a node, mbind MPOL_PREFERRED (Linux),
+    VirtualAllocExNuma (Windows).
+    Masks are 64 bits as in threadpin.h: CPUs beyond 63 are left out.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <limits.h>
+#if defined(__linux__)
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#include "toupcam.h"
+#include "demopin/threadpin.h"
+
+#define NUMAPLACE_MAXNODE       64
+#define NUMAPLACE_MPOL_DEFAULT  0
+#define NUMAPLACE_MPOL_PREFERRED 1
+
+typedef struct {
+    int node;                   /* -1: unknown, see how */
+    unsigned long long cpus;    /* of the node, 0: unknown */
+    char how[128];              /* where the node comes from */
+    unsigned pinned;            /* threads of the SDK pinned at the start */
+} NumaPlacement;
+
+#if defined(__linux__)
+static bool NumaReadLine(const std::string& path, char* buf, size_t len)
+{
+    FILE* fp = fopen(path.c_str(), "r");
+    if (NULL == fp)
+        return false;
+    const bool ret = (NULL != fgets(buf, (int)len, fp));
+    fclose(fp);
+    if (ret)
+        buf[strcspn(buf, "\r\n")] = '\0';
+    return ret;
+}
+
+/* the numa_node of the device or of its first parent which has one, -1: none */
+static int NumaNodeOfSysfs(const std::string& path)
+{
+    char real[PATH_MAX];
+    if (NULL == realpath(path.c_str(), real))
+        return -1;
+    std::string dir(real);
+    while ((dir.size() > 12) && (0 == dir.compare(0, 12, "/sys/devices")))
+    {
+        char buf[32];
+        if (NumaReadLine(dir + "/numa_node", buf, sizeof(buf)))
+            return atoi(buf);       /* -1 from the kernel: no affinity */
+        const size_t slash = dir.rfind('/');
+        if ((std::string::npos == slash) || (0 == slash))
+            break;
+        dir.resize(slash);
+    }
+    return -1;
+}
+#endif
+
+/* 1 on a host without NUMA */
+static int NumaNodeCount()
+{
+#if defined(_WIN32)
+    ULONG highest = 0;
+    return GetNumaHighestNodeNumber(&highest) ? (int)highest + 1 : 1;
+#elif defined(__linux__)
+    int n = 0;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir)
+    {
+        while (struct dirent* ent = readdir(dir))
+        {
+            if ((0 == strncmp(ent->d_name, "node", 4)) && (ent->d_name[4] >= '0') && (ent->d_name[4] <= '9'))
+                ++n;
+        }
+        closedir(dir);
+    }
+    return n ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+static unsigned long long NumaNodeCpus(int node)
+{
+    if (node < 0)
+        return 0;
+#if defined(_WIN32)
+    GROUP_AFFINITY ga = { 0 };
+    if ((!GetNumaNodeProcessorMaskEx((USHORT)node, &ga)) || (0 != ga.Group))
+        return 0;
+    return (unsigned long long)ga.Mask;
+#elif defined(__linux__)
+    char buf[512];
+    std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+    if (!NumaReadLine(path, buf, sizeof(buf)))
+        return (0 == node) ? (unsigned long long)-1 : 0;    /* no NUMA in the kernel: all the CPUs are node 0 */
+    unsigned long long mask = 0;
+    for (char* tok = strtok(buf, ","); tok; tok = strtok(NULL, ","))
+    {
+        unsigned lo = 0, hi = 0;
+        const int n = sscanf(tok, "%u-%u", &lo, &hi);
+        if (n < 1)
+            continue;
+        if (n < 2)
+            hi = lo;
+        for (unsigned i = lo; (i <= hi) && (i < 64); ++i)
+            mask |= 1ULL << i;
+    }
+    return mask;
+#else
+    return 0;
+#endif
+}
+
+#if defined(__linux__)
+/* the USB devices of the model, the one of the serial number if its descriptor has it */
+static int NumaLocateUsb(const ToupcamModelV2* model, const char* sn, char* how, size_t len)
+{
+    DIR* dir = opendir("/sys/bus/usb/devices");
+    if (NULL == dir)
+    {
+        snprintf(how, len, "no /sys/bus/usb");
+        return -1;
+    }
+    int node = -1, nodeSn = -1, nCand = 0;
+    bool bSame = true;
+    std::string path, pathSn;
+    while (struct dirent* ent = readdir(dir))
+    {
+        if (('.' == ent->d_name[0]) || strchr(ent->d_name, ':'))    /* interfaces have a colon */
+            continue;
+        const std::string dev = std::string("/sys/bus/usb/devices/") + ent->d_name;
+        char vid[16], pid[16], serial[64];
+        if ((!NumaReadLine(dev + "/idVendor", vid, sizeof(vid))) || (!NumaReadLine(dev + "/idProduct", pid, sizeof(pid))))
+            continue;
+        const ToupcamModelV2* m = Toupcam_get_Model((unsigned short)strtoul(vid, NULL, 16), (unsigned short)strtoul(pid, NULL, 16));
+        if ((NULL == m) || ((m != model) && strcmp(m->name, model->name)))
+            continue;
+        const int n = NumaNodeOfSysfs(dev);
+        if (nCand && (n != node))
+            bSame = false;
+        node = n;
+        path = dev;
+        ++nCand;
+        if (sn && sn[0] && NumaReadLine(dev + "/serial", serial, sizeof(serial)) && (0 == strcmp(serial, sn)))
+        {
+            nodeSn = n;
+            pathSn = dev;
+        }
+    }
+    closedir(dir);
+    if (pathSn.size())
+    {
+        snprintf(how, len, "%s, serial number", pathSn.c_str());
+        return nodeSn;
+    }
+    if (0 == nCand)
+        snprintf(how, len, "not found on USB");
+    else if (1 == nCand)
+        snprintf(how, len, "%s", path.c_str());
+    else if (bSame)
+        snprintf(how, len, "%d cameras of the model, all on one node", nCand);
+    else
+    {
+        snprintf(how, len, "%d cameras of the model on several nodes, give a hint", nCand);
+        return -1;
+    }
+    return node;
+}
+#endif
+
+/*
+    dev: from Toupcam_EnumV2; h: the camera opened, for its serial number (NULL: by the model only);
+    hint: NULL, or a node number, a network interface, a path in /sys
+*/
+static void NumaLocate(const ToupcamDeviceV2& dev, HToupcam h, const char* hint, NumaPlacement* p)
+{
+    memset(p, 0, sizeof(*p));
+    p->node = -1;
+    if (hint && hint[0])
+    {
+        char* end = NULL;
+        const long n = strtol(hint, &end, 10);
+        if (end && ('\0' == *end))
+        {
+            p->node = (int)n;
+            snprintf(p->how, sizeof(p->how), "given");
+        }
+#if defined(__linux__)
+        else if ('/' == hint[0])
+        {
+            p->node = NumaNodeOfSysfs(hint);
+            snprintf(p->how, sizeof(p->how), "%s", hint);
+        }
+        else
+        {
+            p->node = NumaNodeOfSysfs(std::string("/sys/class/net/") + hint + "/device");
+            snprintf(p->how, sizeof(p->how), "network interface %s", hint);
+        }
+#else
+        else
+            snprintf(p->how, sizeof(p->how), "hint %s: only a node number on this system", hint);
+#endif
+    }
+    else if (1 == NumaNodeCount())
+    {
+        p->node = 0;
+        snprintf(p->how, sizeof(p->how), "one node");
+    }
+    else
+    {
+#if defined(__linux__)
+        char sn[32] = { 0 };
+        if (h)
+            Toupcam_get_SerialNumber(h, sn);
+        p->node = NumaLocateUsb(dev.model, sn, p->how, sizeof(p->how));
+#else
+        snprintf(p->how, sizeof(p->how), "no detection on this system, give a hint");
+#endif
+    }
+    p->cpus = NumaNodeCpus(p->node);
+}
+
+static void* NumaAlloc(size_t size, int node)
+{
+#if defined(_WIN32)
+    if (node >= 0)
+        return VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == p)
+        return NULL;
+#if defined(__linux__) && defined(SYS_mbind)
+    if ((node >= 0) && (node < NUMAPLACE_MAXNODE))
+    {
+        unsigned long mask[NUMAPLACE_MAXNODE / (8 * sizeof(unsigned long))] = { 0 };
+        mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+        syscall(SYS_mbind, p, size, NUMAPLACE_MPOL_PREFERRED, mask, (unsigned long)NUMAPLACE_MAXNODE + 1, 0);
+    }
+#endif
+    return p;
+#endif
+}
+
+static void NumaFree(void* p, size_t size)
+{
+    if (NULL == p)
+        return;
+#if defined(_WIN32)
+    (void)size;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+
+/* the start of the camera with its threads and deques on the node of p; unknown node: a plain start */
+static HRESULT NumaStartPullModeWithCallback(HToupcam h, NumaPlacement* p, PTOUPCAM_EVENT_CALLBACK funEvent, void* ctxEvent)
+{
+    if ((p->node < 0) || (0 == p->cpus))
+        return Toupcam_StartPullModeWithCallback(h, funEvent, ctxEvent);
+#if defined(__linux__)
+    cpu_set_t saved;
+    const bool bSaved = (0 == sched_getaffinity(0, sizeof(saved), &saved));
+    PinSelf(p->cpus);
+    bool bPolicy = false;
+    int oldMode = NUMAPLACE_MPOL_DEFAULT;
+    unsigned long oldMask[NUMAPLACE_MAXNODE / (8 * sizeof(unsigned long))] = { 0 };
+#if defined(SYS_set_mempolicy) && defined(SYS_get_mempolicy)
+    if ((p->node < NUMAPLACE_MAXNODE) && (0 == syscall(SYS_get_mempolicy, &oldMode, oldMask, (unsigned long)NUMAPLACE_MAXNODE + 1, NULL, 0UL)))
+    {
+        unsigned long mask[NUMAPLACE_MAXNODE / (8 * sizeof(unsigned long))] = { 0 };
+        mask[p->node / (8 * sizeof(unsigned long))] = 1UL << (p->node % (8 * sizeof(unsigned long)));
+        bPolicy = (0 == syscall(SYS_set_mempolicy, NUMAPLACE_MPOL_PREFERRED, mask, (unsigned long)NUMAPLACE_MAXNODE + 1));
+    }
+#endif
+#elif defined(_WIN32)
+    const DWORD_PTR saved = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)p->cpus);
+#endif
+    const ThreadPinList before = ThreadList();
+    const HRESULT hr = Toupcam_StartPullModeWithCallback(h, funEvent, ctxEvent);
+    p->pinned = SUCCEEDED(hr) ? PinNewThreads(before, p->cpus) : 0;
+#if defined(__linux__)
+#if defined(SYS_set_mempolicy)
+    if (bPolicy)
+        syscall(SYS_set_mempolicy, oldMode, (NUMAPLACE_MPOL_DEFAULT == oldMode) ? NULL : oldMask, (NUMAPLACE_MPOL_DEFAULT == oldMode) ? 0UL : (unsigned long)NUMAPLACE_MAXNODE + 1);
+#endif
+    if (bSaved)
+        sched_setaffinity(0, sizeof(saved), &saved);
+#elif defined(_WIN32)
+    if (saved)
+        SetThreadAffinityMask(GetCurrentThread(), saved);
+#endif
+    return hr;
+}
+
+#endif
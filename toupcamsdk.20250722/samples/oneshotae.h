@@ -0,0 +1,180 @@
+#ifndef __oneshotae_H__
+#define __oneshotae_H__
+
+/*
+    One shot auto exposure: the exposure time and gain of the target brightness computed from the histogram of one
+    metering frame, instead of the damped loop of the SDK (TOUPCAM_OPTION_AUTOEXP_EXPOTIME_DAMP / _GAIN_DAMP) which
+    takes many frames before TOUPCAM_OPTION_AUTOEXPO_CONV.
+    The sensor is linear above the black level: (value - black) is proportional to exposure time x gain, so the
+    ratio target / mean of the metering frame scales expotime x gain straight to the target. The ratio is capped so
+    that the percentile OSAE_HIGHLIGHT of the brightest channel stays below OSAE_HEADROOM of the full scale, and by
+    OSAE_MAXSTEP both ways: a frame which is mostly saturated (or black) does not tell how far off it is, solve()
+    returns false then, the exposure moves by the cap and the next frame is metered again.
+    The product is split into time first, up to the maximum of Toupcam_get_AutoExpoRange, then analog gain
+    (Toupcam_get_AutoExpoRange too) for the rest; a product below the minimum time x minimum gain is clamped.
+    apply() puts them with the auto exposure off and reads them back, the time with Toupcam_get_RealExpoTime, rounded
+    to what the sensor can do (Toupcam_get_ExpoTime returns the requested one): exposed(info) is true for the first frame (and the next ones) whose ToupcamFrameInfoV4 reports that exposure time
+    and gain, the first correctly exposed frame. The SDK has no flag of its own for it in the frame info.
+    The histogram is the one of Toupcam_GetHistogramV2 (nFlag: bit depth & 0x0f, 0x8000 mono, else 3 channels one
+    after another) or any histogram of bins x channels (FrameStats::histogram of a RAW or mono frame: 1 channel).
+    target: the mean brightness on the scale of 8 bits (Toupcam_get_AutoExpoTarget, default 120), black: the black
+    level on the scale of the histogram, 0 when the pipeline removes it.
+*/
+#include <math.h>
+#include "toupcam.h"
+
+#define OSAE_HIGHLIGHT      0.995   /* 99.5% of the pixels ... */
+#define OSAE_HEADROOM       0.95    /* ... below 95% of the full scale */
+#define OSAE_MAXSTEP        8.0     /* ratio of one shot, both ways */
+#define OSAE_TIMETOL        1       /* us, frame info against Toupcam_get_RealExpoTime */
+
+class OneShotAE {
+    unsigned m_minTime, m_maxTime;
+    unsigned short m_minGain, m_maxGain;
+    unsigned m_target, m_black;
+    unsigned m_expoTime;            /* applied, 0: none */
+    unsigned short m_expoGain;
+
+    /* value below which fraction of the pixels of one channel are */
+    static unsigned percentile(const unsigned* hist, unsigned bins, unsigned long long total, double fraction)
+    {
+        const unsigned long long target = (unsigned long long)(fraction * total);
+        unsigned long long sum = 0;
+        for (unsigned i = 0; i < bins; ++i)
+        {
+            sum += hist[i];
+            if (sum > target)
+                return i;
+        }
+        return bins - 1;
+    }
+public:
+    OneShotAE()
+    : m_minTime(1), m_maxTime(1000000), m_minGain(100), m_maxGain(100), m_target(120), m_black(0), m_expoTime(0), m_expoGain(0)
+    {
+    }
+
+    /* the range and target of the auto exposure of the camera */
+    HRESULT init(HToupcam h, unsigned black = 0)
+    {
+        HRESULT hr = Toupcam_get_AutoExpoRange(h, &m_maxTime, &m_minTime, &m_maxGain, &m_minGain);
+        if (SUCCEEDED(hr))
+        {
+            unsigned short target = 0;
+            hr = Toupcam_get_AutoExpoTarget(h, &target);
+            m_target = target;
+        }
+        m_black = black;
+        m_expoTime = 0;
+        return hr;
+    }
+
+    void put(unsigned minTime, unsigned maxTime, unsigned short minGain, unsigned short maxGain, unsigned target, unsigned black = 0)
+    {
+        m_minTime = minTime;
+        m_maxTime = maxTime;
+        m_minGain = minGain;
+        m_maxGain = maxGain;
+        m_target = target;
+        m_black = black;
+    }
+
+    /*
+        expotime (us) and gain (percent) of the target from the histogram of a frame taken at curTime, curGain;
+        false: the frame is clipped or black, the result moved by OSAE_MAXSTEP only, meter the next frame again
+    */
+    bool solve(const unsigned* hist, unsigned bins, unsigned channels, unsigned curTime, unsigned short curGain, unsigned* pTime, unsigned short* pGain) const
+    {
+        double mean[3] = { 0 }, top = 0;
+        unsigned long long total = 0;
+        for (unsigned c = 0; (c < channels) && (c < 3); ++c)
+        {
+            const unsigned* p = hist + (size_t)c * bins;
+            unsigned long long n = 0;
+            double sum = 0;
+            for (unsigned i = 0; i < bins; ++i)
+            {
+                n += p[i];
+                sum += (double)p[i] * ((i > m_black) ? i - m_black : 0);
+            }
+            mean[c] = n ? sum / n : 0;
+            if (n)
+                top = fmax(top, (double)percentile(p, bins, n, OSAE_HIGHLIGHT));
+            total = n;
+        }
+        /* (R + 2G + B) / 4: the same whichever order the SDK puts R and B in */
+        const double luma = (channels >= 3) ? (mean[0] + 2 * mean[1] + mean[2]) / 4 : mean[0];
+        const double full = (double)(bins - 1 - m_black);
+        const double target = (double)m_target * (bins - 1) / 255.0 - m_black;
+        bool exact = (total > 0) && (luma > 0.5);
+        double ratio = exact ? target / luma : OSAE_MAXSTEP;
+        if (top >= bins - 1)
+        {
+            /* the highlights are clipped, where they are is not known */
+            exact = false;
+            ratio = fmin(ratio, 1.0 / OSAE_MAXSTEP);
+        }
+        else if (top > m_black)
+            ratio = fmin(ratio, OSAE_HEADROOM * full / (top - m_black));
+        if (ratio > OSAE_MAXSTEP)
+        {
+            ratio = OSAE_MAXSTEP;
+            exact = false;
+        }
+        else if (ratio < 1.0 / OSAE_MAXSTEP)
+        {
+            ratio = 1.0 / OSAE_MAXSTEP;
+            exact = false;
+        }
+
+        /* time first, then gain */
+        const double product = (double)curTime * curGain * ratio;
+        double t = product / m_minGain;
+        unsigned short g = m_minGain;
+        if (t > m_maxTime)
+        {
+            t = m_maxTime;
+            g = (unsigned short)fmin((double)m_maxGain, floor(product / m_maxTime + 0.5));
+        }
+        else if (t < m_minTime)
+            t = m_minTime;
+        *pTime = (unsigned)(t + 0.5);
+        *pGain = g;
+        return exact;
+    }
+
+    bool solve(const unsigned* hist, unsigned nFlag, unsigned curTime, unsigned short curGain, unsigned* pTime, unsigned short* pGain) const
+    {
+        return solve(hist, 1u << (nFlag & 0x0f), (nFlag & 0x00008000) ? 1 : 3, curTime, curGain, pTime, pGain);
+    }
+
+    /* auto exposure off, the exposure on the camera as the sensor rounds it */
+    HRESULT apply(HToupcam h, unsigned expoTime, unsigned short expoGain)
+    {
+        HRESULT hr = Toupcam_put_AutoExpoEnable(h, 0);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_put_ExpoTime(h, expoTime);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_put_ExpoAGain(h, expoGain);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_get_RealExpoTime(h, &m_expoTime);
+        if (SUCCEEDED(hr))
+            hr = Toupcam_get_ExpoAGain(h, &m_expoGain);
+        if (FAILED(hr))
+            m_expoTime = 0;
+        return hr;
+    }
+
+    /* the frame is taken with the exposure of the last apply() */
+    bool exposed(const ToupcamFrameInfoV4& info) const
+    {
+        const unsigned need = TOUPCAM_FRAMEINFO_FLAG_EXPOTIME | TOUPCAM_FRAMEINFO_FLAG_EXPOGAIN;
+        return m_expoTime && ((info.v3.flag & need) == need) && (info.v3.expotime + OSAE_TIMETOL >= m_expoTime) && (info.v3.expotime <= m_expoTime + OSAE_TIMETOL) && (info.v3.expogain == m_expoGain);
+    }
+
+    unsigned expoTime() const { return m_expoTime; }
+    unsigned short expoGain() const { return m_expoGain; }
+    unsigned target() const { return m_target; }
+};
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef __optbatch_H__
+#define __optbatch_H__
+
+/*
+    A batch of camera settings (options, eSize, ROI, exposure, gain, speed, auto exposure) applied as one transaction,
+    for the switch between the profiles of two objectives: every setting is a control transfer and some of them
+    reconfigure the pipeline, so the batch
+        - keeps the last value of each setting and drops the ones which are already on the camera (OptionShadow:
+          switching profiles changes what differs, not the dozens of calls of the full setup),
+        - validates the values against the capabilities (CamCaps of capcache.h) before anything is sent,
+        - orders them (the resolution before the ROI, auto exposure off before the exposure time, ...) and, when one
+          of them cannot be changed while streaming, stops the camera once, applies those and restarts once,
+        - and on a failure puts back the values it had changed, so the camera is left in the old profile, not between two.
+    The settings which need the camera stopped are the eSize and the options of OptionBatch::needStop(); any other one
+    which is refused with E_UNEXPECTED while streaming is tried again with the camera stopped.
+*/
+#include <string.h>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "toupcam.h"
+#include "capcache.h"
+
+#define OPTBATCH_OPTION     0   /* Toupcam_put_Option(id, v[0]) */
+#define OPTBATCH_ESIZE      1
+#define OPTBATCH_ROI        2   /* v[0..3]: xOffset, yOffset, xWidth, yHeight */
+#define OPTBATCH_EXPOTIME   3
+#define OPTBATCH_EXPOGAIN   4
+#define OPTBATCH_SPEED      5
+#define OPTBATCH_AUTOEXPO   6
+
+typedef struct {
+    int kind, id, v[4];
+} OptItem;
+
+/* what is known to be on the camera, the values applied or read since it was opened */
+class OptionShadow {
+    std::vector<OptItem> m_known;
+public:
+    const OptItem* find(int kind, int id) const
+    {
+        for (size_t i = 0; i < m_known.size(); ++i)
+        {
+            if ((m_known[i].kind == kind) && (m_known[i].id == id))
+                return &m_known[i];
+        }
+        return NULL;
+    }
+
+    void set(const OptItem& item)
+    {
+        for (size_t i = 0; i < m_known.size(); ++i)
+        {
+            if ((m_known[i].kind == item.kind) && (m_known[i].id == item.id))
+            {
+                m_known[i] = item;
+                return;
+            }
+        }
+        m_known.push_back(item);
+    }
+
+    /* after a Toupcam_Close / Toupcam_Open, or anything set behind the back of the batch */
+    void clear() { m_known.clear(); }
+};
+
+class OptionBatch {
+    std::vector<OptItem> m_items;
+
+    OptionBatch& add(int kind, int id, int v0, int v1 = 0, int v2 = 0, int v3 = 0)
+    {
+        const OptItem item = { kind, id, { v0, v1, v2, v3 } };
+        m_items.push_back(item);
+        return *this;
+    }
+
+    static bool same(const OptItem& a, const OptItem& b)
+    {
+        return (a.kind == b.kind) && (a.id == b.id) && (0 == memcmp(a.v, b.v, sizeof(a.v)));
+    }
+
+    /* the order of application */
+    static int rank(const OptItem& item)
+    {
+        switch (item.kind)
+        {
+        case OPTBATCH_ESIZE: return 0;
+        case OPTBATCH_OPTION: return needStop(item.id) ? 1 : 7;
+        case OPTBATCH_ROI: return 2;
+        case OPTBATCH_SPEED: return 3;
+        case OPTBATCH_AUTOEXPO: return item.v[0] ? 8 : 4;  /* off before the exposure is set, on after */
+        case OPTBATCH_EXPOTIME: return 5;
+        default: return 6;
+        }
+    }
+
+    static HRESULT put(HToupcam h, const OptItem& item)
+    {
+        switch (item.kind)
+        {
+        case OPTBATCH_OPTION: return Toupcam_put_Option(h, item.id, item.v[0]);
+        case OPTBATCH_ESIZE: return Toupcam_put_eSize(h, item.v[0]);
+        case OPTBATCH_ROI: return Toupcam_put_Roi(h, item.v[0], item.v[1], item.v[2], item.v[3]);
+        case OPTBATCH_EXPOTIME: return Toupcam_put_ExpoTime(h, item.v[0]);
+        case OPTBATCH_EXPOGAIN: return Toupcam_put_ExpoAGain(h, (unsigned short)item.v[0]);
+        case OPTBATCH_SPEED: return Toupcam_put_Speed(h, (unsigned short)item.v[0]);
+        default: return Toupcam_put_AutoExpoEnable(h, item.v[0]);
+        }
+    }
+
+    static HRESULT get(HToupcam h, OptItem* pItem)
+    {
+        memset(pItem->v, 0, sizeof(pItem->v));
+        unsigned u[4] = { 0 };
+        unsigned short s = 0;
+        HRESULT hr;
+        switch (pItem->kind)
+        {
+        case OPTBATCH_OPTION:
+            return Toupcam_get_Option(h, pItem->id, &pItem->v[0]);
+        case OPTBATCH_ESIZE:
+            hr = Toupcam_get_eSize(h, &u[0]);
+            break;
+        case OPTBATCH_ROI:
+            hr = Toupcam_get_Roi(h, &u[0], &u[1], &u[2], &u[3]);
+            break;
+        case OPTBATCH_EXPOTIME:
+            hr = Toupcam_get_ExpoTime(h, &u[0]);
+            break;
+        case OPTBATCH_EXPOGAIN:
+            hr = Toupcam_get_ExpoAGain(h, &s);
+            u[0] = s;
+            break;
+        case OPTBATCH_SPEED:
+            hr = Toupcam_get_Speed(h, &s);
+            u[0] = s;
+            break;
+        default:
+            return Toupcam_get_AutoExpoEnable(h, &pItem->v[0]);
+        }
+        for (int i = 0; i < 4; ++i)
+            pItem->v[i] = (int)u[i];
+        return hr;
+    }
+public:
+    /* the options which reconfigure the pipeline, only set with the camera stopped */
+    static bool needStop(int id)
+    {
+        return (TOUPCAM_OPTION_RAW == id) || (TOUPCAM_OPTION_BITDEPTH == id) || (TOUPCAM_OPTION_PIXEL_FORMAT == id)
+            || (TOUPCAM_OPTION_BINNING == id) || (TOUPCAM_OPTION_ROTATE == id);
+    }
+
+    OptionBatch& option(int id, int value) { return add(OPTBATCH_OPTION, id, value); }
+    OptionBatch& eSize(unsigned index) { return add(OPTBATCH_ESIZE, 0, (int)index); }
+    OptionBatch& roi(unsigned x, unsigned y, unsigned w, unsigned h) { return add(OPTBATCH_ROI, 0, (int)x, (int)y, (int)w, (int)h); }
+    OptionBatch& expoTime(unsigned us) { return add(OPTBATCH_EXPOTIME, 0, (int)us); }
+    OptionBatch& expoGain(unsigned short gain) { return add(OPTBATCH_EXPOGAIN, 0, gain); }
+    OptionBatch& speed(unsigned short speed) { return add(OPTBATCH_SPEED, 0, speed); }
+    OptionBatch& autoExpo(int enable) { return add(OPTBATCH_AUTOEXPO, 0, enable); }
+
+    size_t size() const { return m_items.size(); }
+    const OptItem& item(size_t i) const { return m_items[i]; }
+    void clear() { m_items.clear(); }
+
+    /* E_INVALIDARG and the index of the first value out of the capabilities; nothing is sent to the camera */
+    HRESULT validate(const CamCaps& caps, size_t* pIndex) const
+    {
+        unsigned maxW = 0, maxH = 0;
+        for (unsigned i = 0; i < caps.nRes; ++i)
+        {
+            maxW = std::max(maxW, caps.resWidth[i]);
+            maxH = std::max(maxH, caps.resHeight[i]);
+        }
+        for (size_t i = 0; i < m_items.size(); ++i)
+        {
+            const OptItem& t = m_items[i];
+            bool bok = true;
+            switch (t.kind)
+            {
+            case OPTBATCH_ESIZE:
+                bok = (t.v[0] >= 0) && ((unsigned)t.v[0] < caps.nRes);
+                break;
+            case OPTBATCH_ROI:
+                bok = (0 == ((t.v[0] | t.v[1] | t.v[2] | t.v[3]) & 1)) && (t.v[0] >= 0) && (t.v[1] >= 0)
+                    && (((0 == t.v[2]) && (0 == t.v[3])) || ((t.v[2] > 0) && (t.v[3] > 0)  /* 0 x 0: ROI off */
+                    && ((unsigned)(t.v[0] + t.v[2]) <= maxW) && ((unsigned)(t.v[1] + t.v[3]) <= maxH)));
+                break;
+            case OPTBATCH_EXPOTIME:
+                bok = ((unsigned)t.v[0] >= caps.expoMin) && ((unsigned)t.v[0] <= caps.expoMax);
+                break;
+            case OPTBATCH_EXPOGAIN:
+                bok = (t.v[0] >= caps.gainMin) && (t.v[0] <= caps.gainMax);
+                break;
+            case OPTBATCH_SPEED:
+                bok = (t.v[0] >= 0) && ((unsigned)t.v[0] <= caps.maxSpeed);
+                break;
+            case OPTBATCH_OPTION:
+                if ((TOUPCAM_OPTION_PIXEL_FORMAT == t.id) && caps.nFmt)
+                    bok = (std::find(caps.fmt, caps.fmt + caps.nFmt, t.v[0]) != caps.fmt + caps.nFmt);
+                break;
+            default:
+                break;
+            }
+            if (!bok)
+            {
+                if (pIndex)
+                    *pIndex = i;
+                return (HRESULT)0x80070057; /* E_INVALIDARG */
+            }
+        }
+        return 0;
+    }
+
+    /*
+        bRunning: the camera is streaming; restart: starts it again (Toupcam_StartXXXX as the application does), called
+        once if the batch had to stop the camera, whether it succeeded or not.
+        Returns the first failure (and its index in pIndex), after the values already changed have been put back.
+        pApplied: how many settings were actually sent, those of the shadow dropped.
+    */
+    HRESULT apply(HToupcam h, OptionShadow& shadow, bool bRunning, const std::function<HRESULT()>& restart, size_t* pIndex = NULL, unsigned* pApplied = NULL)
+    {
+        /* the last value of each setting, minus those already on the camera, in the order of application */
+        std::vector<std::pair<OptItem, size_t>> todo;
+        std::vector<const OptItem*> seen;
+        for (size_t i = m_items.size(); i-- > 0;)
+        {
+            const OptItem& t = m_items[i];
+            bool bDup = false;
+            for (size_t j = 0; (j < seen.size()) && (!bDup); ++j)
+                bDup = (seen[j]->kind == t.kind) && (seen[j]->id == t.id);
+            if (bDup)
+                continue;
+            seen.push_back(&t);
+            const OptItem* known = shadow.find(t.kind, t.id);
+            if ((NULL == known) || (!same(*known, t)))
+                todo.push_back(std::make_pair(t, i));
+        }
+        std::stable_sort(todo.begin(), todo.end(), [](const std::pair<OptItem, size_t>& a, const std::pair<OptItem, size_t>& b) {
+            return rank(a.first) < rank(b.first);
+        });
+        if (pApplied)
+            *pApplied = (unsigned)todo.size();
+        if (todo.empty())
+            return 0;
+
+        bool bStopped = false;
+        if (bRunning)
+        {
+            for (size_t i = 0; (i < todo.size()) && (!bStopped); ++i)
+                bStopped = (OPTBATCH_ESIZE == todo[i].first.kind) || ((OPTBATCH_OPTION == todo[i].first.kind) && needStop(todo[i].first.id));
+            if (bStopped)
+                Toupcam_Stop(h);
+        }
+
+        std::vector<OptItem> undo;
+        HRESULT hr = 0;
+        for (size_t i = 0; i < todo.size(); ++i)
+        {
+            const OptItem& t = todo[i].first;
+            OptItem prev = t;
+            const OptItem* known = shadow.find(t.kind, t.id);
+            bool bPrev = true;
+            if (known)
+                prev = *known;
+            else
+                bPrev = SUCCEEDED(get(h, &prev));
+            hr = put(h, t);
+            if (((HRESULT)0x8000ffff == hr) && bRunning && (!bStopped))   /* E_UNEXPECTED: not while streaming */
+            {
+                Toupcam_Stop(h);
+                bStopped = true;
+                hr = put(h, t);
+            }
+            /* the failed one too: a refused ROI or resolution may have been half applied */
+            if (bPrev)
+                undo.push_back(prev);
+            if (FAILED(hr))
+            {
+                if (pIndex)
+                    *pIndex = todo[i].second;
+                break;
+            }
+        }
+        if (FAILED(hr))
+        {
+            /* in the reverse order of application, so each one is put back in the state it was changed in */
+            for (size_t i = undo.size(); i-- > 0;)
+                put(h, undo[i]);
+        }
+        else
+        {
+            for (size_t i = 0; i < todo.size(); ++i)
+                shadow.set(todo[i].first);
+        }
+        if (bStopped && restart)
+        {
+            const HRESULT r = restart();
+            if (SUCCEEDED(hr) && FAILED(r))
+                hr = r;
+        }
+        return hr;
+    }
+};
+
+#endif
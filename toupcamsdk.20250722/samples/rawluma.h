@@ -0,0 +1,134 @@
+#ifndef __rawluma_H__
+#define __rawluma_H__
+
+/*
+    Grey straight from the Bayer RAW frame, for autofocus and mono previews of a color camera: no demosaic, no RGB.
+    Toupcam_put_Chrome(h, 1) gives a grey image too, but the SDK demosaics the frame before; pulling RAW
+    (TOUPCAM_OPTION_RAW = 1) and taking the luminance here costs a few operations per output pixel instead.
+    RAWLUMA_HALF_SUM    (R + G + G + B) / 4 of every 2 x 2 cell, half resolution: the cheapest, all the light
+    RAWLUMA_HALF_GREEN  (G + G) / 2 of every cell, half resolution: green only, the sharpest channel of most optics
+    RAWLUMA_FULL_GREEN  full resolution: G where the pixel is green, the mean of the 4 green neighbours elsewhere
+                        (the 2 of the nearest row or column at the borders)
+    The input is 8 or 16 bits (TOUPCAM_OPTION_BITDEPTH = 1, little endian), the output 8 or 16 bits: 16 bits in and
+    8 bits out is shifted right by shift (bit depth - 8), 8 in and 16 out is the same value. The pitches are in bytes;
+    the sizes of the half modes are width / 2 x height / 2. RAWLUMA_HALF_SUM from 8 bits into 8 bits is the one of
+    autofocus: AVX2 when built for it (-mavx2 or -march=native, /arch:AVX2), NEON on ARM, scalar otherwise, the same
+    result (rounded to the nearest).
+*/
+#include <stddef.h>
+#include "toupcam.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RAWLUMA_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RAWLUMA_NEON
+#endif
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+#define RAWLUMA_HALF_SUM    0
+#define RAWLUMA_HALF_GREEN  1
+#define RAWLUMA_FULL_GREEN  2
+
+/* o[x] = (r0[2x] + r0[2x + 1] + r1[2x] + r1[2x + 1] + 2) / 4, x = 0 ... n - 1 */
+static void RawLumaRowHalfSum8(const unsigned char* r0, const unsigned char* r1, unsigned char* o, unsigned n)
+{
+    unsigned x = 0;
+#if defined(RAWLUMA_AVX2)
+    const __m256i ones = _mm256_set1_epi8(1), two = _mm256_set1_epi16(2);
+    for (; x + 16 <= n; x += 16)
+    {
+        const __m256i s = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(r0 + 2 * x)), ones),
+                                           _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(r1 + 2 * x)), ones));
+        const __m256i v = _mm256_srli_epi16(_mm256_add_epi16(s, two), 2);
+        _mm_storeu_si128((__m128i*)(o + x), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+#elif defined(RAWLUMA_NEON)
+    for (; x + 8 <= n; x += 8)
+    {
+        const uint16x8_t s = vaddq_u16(vpaddlq_u8(vld1q_u8(r0 + 2 * x)), vpaddlq_u8(vld1q_u8(r1 + 2 * x)));
+        vst1_u8(o + x, vrshrn_n_u16(s, 2));
+    }
+#endif
+    for (; x < n; ++x)
+        o[x] = (unsigned char)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+}
+
+/* true if the top left pixel of the 2 x 2 cell is green */
+static bool RawLumaGreenFirst(unsigned fourcc)
+{
+    return (MAKEFOURCC('G', 'R', 'B', 'G') == fourcc) || (MAKEFOURCC('G', 'B', 'R', 'G') == fourcc);
+}
+
+/* fourcc, bits: Toupcam_get_RawFormat; srcBits, dstBits: 8 or 16 */
+static bool RawLuma(int mode, unsigned fourcc, int srcBits, const void* src, size_t srcPitch, unsigned width, unsigned height,
+                    int dstBits, unsigned shift, void* dst, size_t dstPitch)
+{
+    if (((8 != srcBits) && (16 != srcBits)) || ((8 != dstBits) && (16 != dstBits)) || (width < 2) || (height < 2))
+        return false;
+    const unsigned g0 = RawLumaGreenFirst(fourcc) ? 0 : 1;  /* x of the green of the first row of a cell */
+    const unsigned sh = ((16 == srcBits) && (8 == dstBits)) ? shift : 0;
+    const unsigned vmax = (8 == dstBits) ? 255 : 65535;
+#define RAWLUMA_IN(r, x)    ((16 == srcBits) ? ((const unsigned short*)(r))[x] : ((const unsigned char*)(r))[x])
+#define RAWLUMA_OUT(r, x, v) \
+    do { \
+        unsigned t = (v) >> sh; \
+        t = (t > vmax) ? vmax : t; \
+        if (8 == dstBits) \
+            ((unsigned char*)(r))[x] = (unsigned char)t; \
+        else \
+            ((unsigned short*)(r))[x] = (unsigned short)t; \
+    } while (0)
+
+    if (RAWLUMA_FULL_GREEN != mode)
+    {
+        const unsigned w = width / 2, h = height / 2;
+        for (unsigned y = 0; y < h; ++y)
+        {
+            const unsigned char* r0 = (const unsigned char*)src + (size_t)(2 * y) * srcPitch;
+            const unsigned char* r1 = r0 + srcPitch;
+            unsigned char* o = (unsigned char*)dst + (size_t)y * dstPitch;
+            if ((RAWLUMA_HALF_SUM == mode) && (8 == srcBits) && (8 == dstBits))
+                RawLumaRowHalfSum8(r0, r1, o, w);
+            else if (RAWLUMA_HALF_SUM == mode)
+            {
+                for (unsigned x = 0; x < w; ++x)
+                    RAWLUMA_OUT(o, x, (RAWLUMA_IN(r0, 2 * x) + RAWLUMA_IN(r0, 2 * x + 1) + RAWLUMA_IN(r1, 2 * x) + RAWLUMA_IN(r1, 2 * x + 1) + 2) >> 2);
+            }
+            else
+            {
+                for (unsigned x = 0; x < w; ++x)
+                    RAWLUMA_OUT(o, x, (RAWLUMA_IN(r0, 2 * x + g0) + RAWLUMA_IN(r1, 2 * x + 1 - g0) + 1) >> 1);
+            }
+        }
+    }
+    else
+    {
+        for (unsigned y = 0; y < height; ++y)
+        {
+            const unsigned char* r = (const unsigned char*)src + (size_t)y * srcPitch;
+            const unsigned char* ru = (y > 0) ? (r - srcPitch) : (r + srcPitch);
+            const unsigned char* rd = (y + 1 < height) ? (r + srcPitch) : (r - srcPitch);
+            const unsigned gx = (y & 1) ? (1 - g0) : g0;    /* x parity of the green pixels of this row */
+            unsigned char* o = (unsigned char*)dst + (size_t)y * dstPitch;
+            for (unsigned x = 0; x < width; ++x)
+            {
+                if ((x & 1) == gx)
+                    RAWLUMA_OUT(o, x, RAWLUMA_IN(r, x));
+                else
+                {
+                    const unsigned xl = (x > 0) ? (x - 1) : (x + 1), xr = (x + 1 < width) ? (x + 1) : (x - 1);
+                    RAWLUMA_OUT(o, x, (RAWLUMA_IN(r, xl) + RAWLUMA_IN(r, xr) + RAWLUMA_IN(ru, x) + RAWLUMA_IN(rd, x) + 2) >> 2);
+                }
+            }
+        }
+    }
+#undef RAWLUMA_IN
+#undef RAWLUMA_OUT
+    return true;
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef __rawpack_H__
+#define __rawpack_H__
+
+/*
+    Packed 10 / 12 bits RAW on the host: the 16 bits samples of a RAW pull packed for the disk, and unpacked again on
+    read, a row at a time. A 12 bits sample stored in 16 bits wastes a quarter of the bytes, a 10 bits one
+    three eighths: a recording packed is 25% (RAW12) or 37.5% (RAW10) smaller and needs that much less write bandwidth.
+    TOUPCAM_PIXELFORMAT_RAW12PACK / RAW10PACK pack the data on the wire, the pull still hands out 16 bits samples, so
+    the packing for the disk is done here, by the writer, off the camera thread.
+    The layouts are those of MIPI CSI-2, which the other tools read as well:
+        RAW12   2 samples in 3 bytes: p0[11:4], p1[11:4], p1[3:0] << 4 | p0[3:0]
+        RAW10   4 samples in 5 bytes: p0[9:2], p1[9:2], p2[9:2], p3[9:2], p3[1:0] << 6 | p2[1:0] << 4 | p1[1:0] << 2 | p0[1:0]
+    A row is packed on its own, RawPackRowBytes() bytes for width samples, the last group padded with 0: the rows
+    can be unpacked in any order, or a band of them straight into the buffer of a demosaic (imagepro_demosaic takes the
+    16 bits samples). The samples above the bit depth are dropped by the packing, as the sensor has none.
+    The unpacking is SSE4.1 (any x64 built for AVX2, -mavx2 or -march=native, /arch:AVX2, or -msse4.1), NEON on ARM
+    (RAW10: AArch64), scalar otherwise; all of them give the same result.
+*/
+#include <stddef.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <smmintrin.h>
+#define RAWPACK_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RAWPACK_NEON
+#endif
+
+/* bytes of a packed row of width samples; bits: 10 or 12 */
+static inline size_t RawPackRowBytes(unsigned width, unsigned bits)
+{
+    if (12 == bits)
+        return ((size_t)width + 1) / 2 * 3;
+    return ((size_t)width + 3) / 4 * 5;
+}
+
+static inline void RawPack12(unsigned char* dst, const unsigned short* src, unsigned width)
+{
+    unsigned x = 0;
+    for (; x + 2 <= width; x += 2, dst += 3)
+    {
+        const unsigned p0 = src[x] & 0xfff, p1 = src[x + 1] & 0xfff;
+        dst[0] = (unsigned char)(p0 >> 4);
+        dst[1] = (unsigned char)(p1 >> 4);
+        dst[2] = (unsigned char)(((p1 & 0xf) << 4) | (p0 & 0xf));
+    }
+    if (x < width)
+    {
+        const unsigned p0 = src[x] & 0xfff;
+        dst[0] = (unsigned char)(p0 >> 4);
+        dst[1] = 0;
+        dst[2] = (unsigned char)(p0 & 0xf);
+    }
+}
+
+static inline void RawPack10(unsigned char* dst, const unsigned short* src, unsigned width)
+{
+    unsigned x = 0;
+    for (; x + 4 <= width; x += 4, dst += 5)
+    {
+        unsigned low = 0;
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            const unsigned p = src[x + i] & 0x3ff;
+            dst[i] = (unsigned char)(p >> 2);
+            low |= (p & 3) << (2 * i);
+        }
+        dst[4] = (unsigned char)low;
+    }
+    if (x < width)
+    {
+        unsigned low = 0;
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            const unsigned p = (x + i < width) ? (src[x + i] & 0x3ff) : 0;
+            dst[i] = (unsigned char)(p >> 2);
+            low |= (p & 3) << (2 * i);
+        }
+        dst[4] = (unsigned char)low;
+    }
+}
+
+static inline void RawUnpack12(unsigned short* dst, const unsigned char* src, unsigned width)
+{
+    unsigned x = 0;
+#if defined(RAWPACK_SSE)
+    /* 12 bytes in, 8 samples out; the load reads 16, so the last groups of the row are left to the scalar loop */
+    const __m128i shuf = _mm_setr_epi8(0, 2, 1, 2, 3, 5, 4, 5, 6, 8, 7, 8, 9, 11, 10, 11);
+    const __m128i mhi = _mm_set1_epi16(0x0ff0), mlo = _mm_set1_epi16(0x000f);
+    const size_t bytes = RawPackRowBytes(width, 12);
+    for (; (x + 8 <= width) && (x / 2 * 3 + 16 <= bytes); x += 8)
+    {
+        /* lane 2k: p0 byte | the shared byte << 8, lane 2k + 1: p1 byte | the shared byte << 8 */
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x / 2 * 3)), shuf);
+        const __m128i lo = _mm_blend_epi16(_mm_and_si128(_mm_srli_epi16(v, 8), mlo), _mm_srli_epi16(v, 12), 0xaa);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 4), mhi), lo));
+    }
+#elif defined(RAWPACK_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x8x3_t v = vld3_u8(src + x / 2 * 3);
+        uint16x8x2_t p;
+        p.val[0] = vorrq_u16(vshll_n_u8(v.val[0], 4), vmovl_u8(vand_u8(v.val[2], vdup_n_u8(0xf))));
+        p.val[1] = vorrq_u16(vshll_n_u8(v.val[1], 4), vmovl_u8(vshr_n_u8(v.val[2], 4)));
+        vst2q_u16(dst + x, p);
+    }
+#endif
+    for (; x + 2 <= width; x += 2)
+    {
+        const unsigned char* s = src + x / 2 * 3;
+        dst[x] = (unsigned short)((s[0] << 4) | (s[2] & 0xf));
+        dst[x + 1] = (unsigned short)((s[1] << 4) | (s[2] >> 4));
+    }
+    if (x < width)
+    {
+        const unsigned char* s = src + x / 2 * 3;
+        dst[x] = (unsigned short)((s[0] << 4) | (s[2] & 0xf));
+    }
+}
+
+static inline void RawUnpack10(unsigned short* dst, const unsigned char* src, unsigned width)
+{
+    unsigned x = 0;
+#if defined(RAWPACK_SSE)
+    /* 10 bytes in, 8 samples out: lane i of a group, the high byte | the shared byte << 8, whose bits 2i + 1 ... 2i the
+       high half of a multiply by 2^(8 - 2i) brings down to bits 1 ... 0 */
+    const __m128i shuf = _mm_setr_epi8(0, 4, 1, 4, 2, 4, 3, 4, 5, 9, 6, 9, 7, 9, 8, 9);
+    const __m128i mul = _mm_setr_epi16(256, 64, 16, 4, 256, 64, 16, 4);
+    const __m128i mhi = _mm_set1_epi16(0x03fc), mlo = _mm_set1_epi16(0x0003);
+    const size_t bytes = RawPackRowBytes(width, 10);
+    for (; (x + 8 <= width) && (x / 4 * 5 + 16 <= bytes); x += 8)
+    {
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x / 4 * 5)), shuf);
+        const __m128i lo = _mm_and_si128(_mm_mulhi_epu16(v, mul), mlo);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 2), mhi), lo));
+    }
+#elif defined(RAWPACK_NEON) && defined(__aarch64__)
+    static const unsigned char s_tbl[16] = { 0, 4, 1, 4, 2, 4, 3, 4, 5, 9, 6, 9, 7, 9, 8, 9 };
+    static const short s_shift[8] = { -8, -10, -12, -14, -8, -10, -12, -14 };
+    const uint8x16_t tbl = vld1q_u8(s_tbl);
+    const int16x8_t shift = vld1q_s16(s_shift);
+    const size_t bytes = RawPackRowBytes(width, 10);
+    for (; (x + 8 <= width) && (x / 4 * 5 + 16 <= bytes); x += 8)
+    {
+        const uint16x8_t v = vreinterpretq_u16_u8(vqtbl1q_u8(vld1q_u8(src + x / 4 * 5), tbl));
+        const uint16x8_t lo = vandq_u16(vshlq_u16(v, shift), vdupq_n_u16(3));
+        vst1q_u16(dst + x, vorrq_u16(vandq_u16(vshlq_n_u16(v, 2), vdupq_n_u16(0x03fc)), lo));
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        const unsigned char* s = src + x / 4 * 5;
+        const unsigned i = x % 4;
+        dst[x] = (unsigned short)((s[i] << 2) | ((s[4] >> (2 * i)) & 3));
+    }
+}
+
+/* a frame of height rows, the rows of src pitch bytes (0: no padding) */
+static inline void RawPackFrame(void* dst, const unsigned short* src, unsigned width, unsigned height, unsigned bits, size_t srcPitch = 0)
+{
+    const size_t rowBytes = RawPackRowBytes(width, bits);
+    if (0 == srcPitch)
+        srcPitch = (size_t)width * 2;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        const unsigned short* s = (const unsigned short*)((const unsigned char*)src + y * srcPitch);
+        unsigned char* d = (unsigned char*)dst + y * rowBytes;
+        if (12 == bits)
+            RawPack12(d, s, width);
+        else
+            RawPack10(d, s, width);
+    }
+}
+
+/* rows [y0, y0 + rows) of a packed frame into 16 bits, the rows of dst pitch bytes (0: no padding) */
+static inline void RawUnpackRows(unsigned short* dst, const void* src, unsigned width, unsigned y0, unsigned rows, unsigned bits, size_t dstPitch = 0)
+{
+    const size_t rowBytes = RawPackRowBytes(width, bits);
+    if (0 == dstPitch)
+        dstPitch = (size_t)width * 2;
+    for (unsigned y = 0; y < rows; ++y)
+    {
+        const unsigned char* s = (const unsigned char*)src + (y0 + y) * rowBytes;
+        unsigned short* d = (unsigned short*)((unsigned char*)dst + y * dstPitch);
+        if (12 == bits)
+            RawUnpack12(d, s, width);
+        else
+            RawUnpack10(d, s, width);
+    }
+}
+
+#endif
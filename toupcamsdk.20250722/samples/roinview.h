@@ -0,0 +1,161 @@
+#ifndef __roinview_H__
+#define __roinview_H__
+
+/*
+    The regions of Toupcam_put_RoiN as separate sub-images of the frame pulled, without copying them out: RoiNView
+    keeps the regions it sets on the camera, and views() returns, for every region, the pointer to its first pixel in
+    the frame buffer, the pitch of the frame, its size and its index in the put() order. The views can then be
+    processed in parallel, each worker reads only its own region.
+    The SDK does not say how the regions are packed into the frame, so views() takes the packing the size of the frame
+    matches, in this order:
+    ROINVIEW_GRID: the rows of the union of the y ranges and the columns of the union of the x ranges, gaps removed
+        (multi-area readout of the sensor); with no gap between the regions this is also their bounding box;
+    ROINVIEW_BOUNDS: the bounding box of the regions, gaps kept;
+    ROINVIEW_STACK: the regions one below the other, in the put() order, left aligned.
+    None of these = false, the caller falls back to the whole frame. The rows of a bottom-up frame (a DIB, with
+    TOUPCAM_OPTION_UPSIDE_DOWN on, the default on Windows) are flipped: the region at the top of the image is at the end
+    of the buffer, and every view is bottom-up like the frame. Mirror, flip, rotate and binning are not taken into
+    account; offsets and sizes must be even (Toupcam_put_RoiN), so a RAW view keeps the Bayer phase of the frame.
+*/
+#include <vector>
+#include <algorithm>
+#include "toupcam.h"
+
+#define ROINVIEW_GRID       1
+#define ROINVIEW_BOUNDS     2
+#define ROINVIEW_STACK      3
+
+struct RoiNRect {
+    unsigned xOffset, yOffset, xWidth, yHeight;
+};
+
+struct RoiNSubImage {
+    const unsigned char* data;  /* first pixel of the region in the frame buffer, the lower left one when bottom-up */
+    int pitch;                  /* bytes, the one of the frame */
+    unsigned width, height;
+    unsigned index;             /* in the put() order */
+};
+
+class RoiNView {
+    std::vector<RoiNRect> m_rect;
+    int m_layout;
+
+    /* the ranges [v, v + n) merged into disjoint sorted intervals, as pairs begin, end */
+    static std::vector<std::pair<unsigned, unsigned>> merge(std::vector<std::pair<unsigned, unsigned>> r)
+    {
+        std::sort(r.begin(), r.end());
+        std::vector<std::pair<unsigned, unsigned>> out;
+        for (size_t i = 0; i < r.size(); ++i)
+        {
+            if ((!out.empty()) && (r[i].first <= out.back().second))
+                out.back().second = std::max(out.back().second, r[i].second);
+            else
+                out.push_back(r[i]);
+        }
+        return out;
+    }
+
+    /* position of v once the gaps between the intervals are removed */
+    static unsigned packed(const std::vector<std::pair<unsigned, unsigned>>& iv, unsigned v)
+    {
+        unsigned p = 0;
+        for (size_t i = 0; i < iv.size(); ++i)
+        {
+            if (v < iv[i].second)
+                return p + (v - iv[i].first);
+            p += iv[i].second - iv[i].first;
+        }
+        return p;
+    }
+
+public:
+    RoiNView()
+    : m_layout(0)
+    {
+    }
+
+    HRESULT put(HToupcam h, const std::vector<RoiNRect>& rect)
+    {
+        std::vector<unsigned> x(rect.size()), y(rect.size()), w(rect.size()), hh(rect.size());
+        for (size_t i = 0; i < rect.size(); ++i)
+        {
+            x[i] = rect[i].xOffset;
+            y[i] = rect[i].yOffset;
+            w[i] = rect[i].xWidth;
+            hh[i] = rect[i].yHeight;
+        }
+        const HRESULT hr = Toupcam_put_RoiN(h, rect.empty() ? NULL : &x[0], rect.empty() ? NULL : &y[0], rect.empty() ? NULL : &w[0], rect.empty() ? NULL : &hh[0], (unsigned)rect.size());
+        if (SUCCEEDED(hr))
+            m_rect = rect;
+        return hr;
+    }
+
+    size_t size() const { return m_rect.size(); }
+
+    /* ROINVIEW_xxx of the last views() which succeeded, 0 = none yet */
+    int layout() const { return m_layout; }
+
+    /* data, info, rowPitch as pulled (rowPitch: 0 = TDIBWIDTHBYTES, -1 = packed, or the bytes), bits per pixel of the pull,
+       bBottomUp: the last row of the image first in the buffer (TOUPCAM_OPTION_UPSIDE_DOWN) */
+    bool views(const void* data, const ToupcamFrameInfoV4& info, int bits, int rowPitch, bool bBottomUp, std::vector<RoiNSubImage>& out)
+    {
+        out.clear();
+        if (m_rect.empty())
+            return false;
+        const unsigned bpp = (bits + 7) / 8;
+        const int pitch = (rowPitch > 0) ? rowPitch : ((rowPitch < 0) ? (int)(info.v3.width * bpp) : (int)TDIBWIDTHBYTES(info.v3.width * bits));
+
+        std::vector<std::pair<unsigned, unsigned>> xs, ys;
+        unsigned minX = m_rect[0].xOffset, minY = m_rect[0].yOffset, maxX = 0, maxY = 0, maxW = 0, sumH = 0;
+        for (size_t i = 0; i < m_rect.size(); ++i)
+        {
+            const RoiNRect& r = m_rect[i];
+            xs.push_back(std::make_pair(r.xOffset, r.xOffset + r.xWidth));
+            ys.push_back(std::make_pair(r.yOffset, r.yOffset + r.yHeight));
+            minX = std::min(minX, r.xOffset);
+            minY = std::min(minY, r.yOffset);
+            maxX = std::max(maxX, r.xOffset + r.xWidth);
+            maxY = std::max(maxY, r.yOffset + r.yHeight);
+            maxW = std::max(maxW, r.xWidth);
+            sumH += r.yHeight;
+        }
+        const std::vector<std::pair<unsigned, unsigned>> xi = merge(xs), yi = merge(ys);
+        const unsigned gridW = packed(xi, maxX), gridH = packed(yi, maxY);
+
+        int layout = 0;
+        if ((info.v3.width == gridW) && (info.v3.height == gridH))
+            layout = ROINVIEW_GRID;
+        else if ((info.v3.width == maxX - minX) && (info.v3.height == maxY - minY))
+            layout = ROINVIEW_BOUNDS;
+        else if ((info.v3.width == maxW) && (info.v3.height == sumH))
+            layout = ROINVIEW_STACK;
+        else
+            return false;
+
+        unsigned y = 0;
+        for (size_t i = 0; i < m_rect.size(); ++i)
+        {
+            const RoiNRect& r = m_rect[i];
+            unsigned px = 0, py = y;
+            if (ROINVIEW_GRID == layout)
+            {
+                px = packed(xi, r.xOffset);
+                py = packed(yi, r.yOffset);
+            }
+            else if (ROINVIEW_BOUNDS == layout)
+            {
+                px = r.xOffset - minX;
+                py = r.yOffset - minY;
+            }
+            y += r.yHeight;
+            if (bBottomUp)
+                py = info.v3.height - py - r.yHeight;
+            RoiNSubImage v = { (const unsigned char*)data + (size_t)py * pitch + (size_t)px * bpp, pitch, r.xWidth, r.yHeight, (unsigned)i };
+            out.push_back(v);
+        }
+        m_layout = layout;
+        return true;
+    }
+};
+
+#endif
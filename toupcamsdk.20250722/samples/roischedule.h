@@ -0,0 +1,172 @@
+#ifndef __roischedule_H__
+#define __roischedule_H__
+
+/*
+    ROI schedule: a table of sensor ROIs the camera cycles through in software trigger mode, such as a small
+    autofocus patch for many frames, then the full frame for one capture, then the patch again, all in one stream
+    and without Toupcam_Stop. The schedule thread sets the ROI of a step (Toupcam_put_Roi, skipped when it does not
+    change), triggers the count of frames of the step in one Toupcam_Trigger, waits for them and goes to the next
+    step. tag(), called from the image callback after the pull, returns the index of the step the frame belongs to.
+    On cameras with TOUPCAM_FLAG_ROI_HARDWARE the sensor reads out only the ROI, so the patch frames come at the
+    higher frame rate of the smaller ROI; on the others the ROI is cut in software, the table still works but the
+    frame rate is the one of the full frame.
+    A frame is matched on its geometry: a frame whose size is not the one of the step in flight (a late frame of a
+    step which timed out) is counted by stale() and tagged -1. Two consecutive steps of the same size cannot be told
+    apart this way, only when a frame is late.
+    xWidth = yHeight = 0 is the full frame (Toupcam_put_Roi(h, 0, 0, 0, 0)); offsets and sizes must be even.
+*/
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "toupcam.h"
+
+struct RoiStep {
+    unsigned xOffset, yOffset, xWidth, yHeight;
+    unsigned short count;   /* frames of the step, triggered at once */
+};
+
+struct RoiStepStats {
+    unsigned frames;        /* tagged with the step */
+    unsigned timeouts;      /* times the step did not get all its frames in time */
+    double ms;              /* time from the trigger to the last frame, summed over the passes through the step */
+};
+
+class RoiSchedule {
+    HToupcam m_h;
+    std::vector<RoiStep> m_steps;
+    std::vector<RoiStepStats> m_stats;
+    unsigned m_fullWidth, m_fullHeight, m_nWaitMS;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_bRun;
+    int m_step;             /* step in flight, -1 = none */
+    unsigned m_pending;     /* frames of the step in flight still to come */
+    unsigned m_nStale, m_nPass;
+    HRESULT m_hr;           /* first failure of put_Roi or Trigger, which ends the schedule */
+    int m_failed;           /* its step */
+
+    /* the SDK is called without the lock: tag() runs in the callback thread and must never wait on it */
+    void run()
+    {
+        int roi = -1;       /* step whose ROI is on the camera */
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_bRun)
+        {
+            for (size_t i = 0; (i < m_steps.size()) && m_bRun; ++i)
+            {
+                const RoiStep& s = m_steps[i];
+                const bool bRoi = (roi < 0) || (s.xOffset != m_steps[roi].xOffset) || (s.yOffset != m_steps[roi].yOffset)
+                    || (s.xWidth != m_steps[roi].xWidth) || (s.yHeight != m_steps[roi].yHeight);
+                m_step = (int)i;
+                m_pending = s.count;
+                lock.unlock();
+                const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                HRESULT hr = bRoi ? Toupcam_put_Roi(m_h, s.xOffset, s.yOffset, s.xWidth, s.yHeight) : 0;
+                if (SUCCEEDED(hr))
+                    hr = Toupcam_Trigger(m_h, s.count);
+                lock.lock();
+                if (FAILED(hr))
+                {
+                    m_hr = hr;
+                    m_failed = (int)i;
+                    m_bRun = false;
+                    break;
+                }
+                roi = (int)i;
+                if (!m_cv.wait_for(lock, std::chrono::milliseconds(m_nWaitMS * s.count), [this] { return (0 == m_pending) || (!m_bRun); }))
+                {
+                    lock.unlock();
+                    Toupcam_Trigger(m_h, 0); /* cancel what is left, the late frames are counted as stale */
+                    lock.lock();
+                    ++m_stats[i].timeouts;
+                }
+                m_stats[i].ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            }
+            if (m_bRun)
+                ++m_nPass;
+        }
+        m_step = -1;
+    }
+
+public:
+    RoiSchedule()
+    : m_h(NULL), m_fullWidth(0), m_fullHeight(0), m_nWaitMS(0), m_bRun(false), m_step(-1), m_pending(0), m_nStale(0), m_nPass(0), m_hr(0), m_failed(-1)
+    {
+    }
+
+    ~RoiSchedule()
+    {
+        stop();
+    }
+
+    /* the camera must be running in software trigger mode (TOUPCAM_OPTION_TRIGGER = 1);
+       nWaitMS: the longest time one frame of a step may take (exposure + readout + transfer) */
+    bool start(HToupcam h, const std::vector<RoiStep>& steps, unsigned nWaitMS)
+    {
+        stop();
+        int nWidth = 0, nHeight = 0;
+        if (steps.empty() || FAILED(Toupcam_get_Size(h, &nWidth, &nHeight)))
+            return false;
+        m_h = h;
+        m_steps = steps;
+        m_stats.assign(steps.size(), RoiStepStats());
+        m_fullWidth = (unsigned)nWidth;
+        m_fullHeight = (unsigned)nHeight;
+        m_nWaitMS = nWaitMS;
+        m_nStale = m_nPass = 0;
+        m_hr = 0;
+        m_failed = -1;
+        m_bRun = true;
+        m_thread = std::thread(&RoiSchedule::run, this);
+        return true;
+    }
+
+    /* the schedule ends on the current step, the camera is left on its ROI */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bRun = false;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    /* step of the frame just pulled, -1 = not expected */
+    int tag(const ToupcamFrameInfoV4& info)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if ((m_step >= 0) && (m_pending > 0))
+        {
+            const RoiStep& s = m_steps[m_step];
+            const unsigned w = s.xWidth ? s.xWidth : m_fullWidth, h = s.yHeight ? s.yHeight : m_fullHeight;
+            if ((info.v3.width == w) && (info.v3.height == h))
+            {
+                ++m_stats[m_step].frames;
+                if (0 == --m_pending)
+                    m_cv.notify_all();
+                return m_step;
+            }
+        }
+        ++m_nStale;
+        return -1;
+    }
+
+    /* only when stopped */
+    const std::vector<RoiStep>& steps() const { return m_steps; }
+    const RoiStepStats& stats(size_t i) const { return m_stats[i]; }
+    unsigned stale() const { return m_nStale; }
+    unsigned passes() const { return m_nPass; }
+    HRESULT result(int* pStep) const
+    {
+        if (pStep)
+            *pStep = m_failed;
+        return m_hr;
+    }
+};
+
+#endif
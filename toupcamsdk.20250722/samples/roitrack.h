@@ -0,0 +1,208 @@
+#ifndef __roitrack_H__
+#define __roitrack_H__
+
+/*
+    Tracking ROI: the readout window follows a drifting target (a cell in a timelapse, the tile under the objective
+    while stitching) by moving the window on the sensor, which takes one frame, instead of moving the stage, which takes
+    a move and a settle. The shift of every frame against the reference (the first frame after start() or resume()) is
+    estimated from the row and column projections of the luminance (1D search, parabolic sub-pixel fit), which is much
+    cheaper than a 2D registration and good enough for a translation; imagepro has no registration of its own to use.
+    When the shift is 2 pixels or more the window is moved by it: Toupcam_put_XY, which shifts the window of a running
+    camera; the first move is read back with Toupcam_get_Roi and the camera falls back to Toupcam_put_Roi if it did not
+    land. The frames already exposed with the old window are skipped (ROITRACK_SETTLE). When the window would leave the
+    sensor, it is put back in the middle and update() returns ROITRACK_STAGE with the shift left to the stage, in
+    pixels; the caller moves the stage and calls resume(), which takes a new reference.
+    Formats: ROITRACK_RGB24 (pitch TDIBWIDTHBYTES), ROITRACK_MONO8 (pitch = width, also RAW 8 bits: the Bayer pattern
+    does not move the projections). The rows of a bottom-up frame (TOUPCAM_OPTION_UPSIDE_DOWN, read by start(); on by
+    default on Windows) are flipped, so the shift is in the rows of the image, the ones of the ROI offsets. Offsets are
+    kept even, as Toupcam_put_Roi wants.
+*/
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "toupcam.h"
+
+#define ROITRACK_RGB24      0
+#define ROITRACK_MONO8      1
+
+#define ROITRACK_IDLE       0   /* frame not used: other size, settling, waiting for the stage */
+#define ROITRACK_OK         1   /* the target is where it should be */
+#define ROITRACK_MOVED      2   /* the window was moved */
+#define ROITRACK_STAGE      3   /* the window is at the edge of the sensor: move the stage, then resume() */
+
+#define ROITRACK_SETTLE     2   /* frames skipped after a move, exposed before the window moved */
+#define ROITRACK_MAXSHIFT   64  /* pixels per frame, at most a quarter of the window */
+
+class RoiTracker {
+    HToupcam m_h;
+    unsigned m_sensorWidth, m_sensorHeight;
+    unsigned m_x, m_y, m_width, m_height;
+    std::vector<double> m_refCol, m_refRow, m_col, m_row;
+    bool m_bRef, m_bWaitStage, m_bChecked, m_bRoiOnly, m_bBottomUp;
+    unsigned m_settle;
+
+    /* projections of the frame, mean removed so that a change of brightness does not look like a shift */
+    void project(const unsigned char* p, int format, std::vector<double>& col, std::vector<double>& row) const
+    {
+        col.assign(m_width, 0.0);
+        row.assign(m_height, 0.0);
+        const size_t pitch = (ROITRACK_RGB24 == format) ? TDIBWIDTHBYTES(m_width * 24) : m_width;
+        for (unsigned j = 0; j < m_height; ++j)
+        {
+            const unsigned char* s = p + (size_t)(m_bBottomUp ? (m_height - 1 - j) : j) * pitch;
+            unsigned sum = 0;
+            for (unsigned i = 0; i < m_width; ++i)
+            {
+                const unsigned v = (ROITRACK_RGB24 == format) ? ((s[3 * i] + 2 * s[3 * i + 1] + s[3 * i + 2]) >> 2) : s[i];
+                col[i] += v;
+                sum += v;
+            }
+            row[j] = sum;
+        }
+        demean(col);
+        demean(row);
+    }
+
+    static void demean(std::vector<double>& v)
+    {
+        double m = 0;
+        for (size_t i = 0; i < v.size(); ++i)
+            m += v[i];
+        m /= v.size();
+        for (size_t i = 0; i < v.size(); ++i)
+            v[i] -= m;
+    }
+
+    /* d such that cur[i] ~ ref[i - d]: the content moved by +d */
+    static double shift(const std::vector<double>& ref, const std::vector<double>& cur)
+    {
+        const int n = (int)ref.size(), maxd = std::min<int>(ROITRACK_MAXSHIFT, n / 4);
+        std::vector<double> e(2 * maxd + 1);
+        int best = 0;
+        for (int d = -maxd; d <= maxd; ++d)
+        {
+            double s = 0;
+            const int i0 = std::max(0, d), i1 = std::min(n, n + d);
+            for (int i = i0; i < i1; ++i)
+                s += (cur[i] - ref[i - d]) * (cur[i] - ref[i - d]);
+            e[d + maxd] = s / (i1 - i0);
+            if (e[d + maxd] < e[best + maxd])
+                best = d;
+        }
+        if ((best > -maxd) && (best < maxd))
+        {
+            const double a = e[best + maxd - 1], b = e[best + maxd], c = e[best + maxd + 1];
+            if (a + c - 2 * b > 0)
+                return best + 0.5 * (a - c) / (a + c - 2 * b);
+        }
+        return best;
+    }
+
+    HRESULT move(unsigned x, unsigned y)
+    {
+        HRESULT hr = (HRESULT)0x8000ffff;
+        if (!m_bRoiOnly)
+        {
+            hr = Toupcam_put_XY(m_h, (int)x, (int)y);
+            if (SUCCEEDED(hr) && (!m_bChecked))
+            {
+                unsigned rx = 0, ry = 0;
+                m_bChecked = true;
+                if (FAILED(Toupcam_get_Roi(m_h, &rx, &ry, NULL, NULL)) || (rx != x) || (ry != y))
+                    hr = (HRESULT)0x8000ffff;
+            }
+            if (FAILED(hr))
+                m_bRoiOnly = true;
+        }
+        if (m_bRoiOnly)
+            hr = Toupcam_put_Roi(m_h, x, y, m_width, m_height);
+        if (SUCCEEDED(hr))
+        {
+            m_x = x;
+            m_y = y;
+            m_settle = ROITRACK_SETTLE;
+        }
+        return hr;
+    }
+
+public:
+    RoiTracker()
+    : m_h(NULL), m_sensorWidth(0), m_sensorHeight(0), m_x(0), m_y(0), m_width(0), m_height(0),
+      m_bRef(false), m_bWaitStage(false), m_bChecked(false), m_bRoiOnly(false), m_bBottomUp(false), m_settle(0)
+    {
+    }
+
+    /* the window the target is in, in pixels of the current resolution (before Toupcam_put_Roi) */
+    HRESULT start(HToupcam h, unsigned x, unsigned y, unsigned width, unsigned height)
+    {
+        int nWidth = 0, nHeight = 0;
+        HRESULT hr = Toupcam_get_Size(h, &nWidth, &nHeight);
+        if (FAILED(hr))
+            return hr;
+        m_h = h;
+        m_sensorWidth = (unsigned)nWidth;
+        m_sensorHeight = (unsigned)nHeight;
+        int upsideDown = 0;
+        Toupcam_get_Option(h, TOUPCAM_OPTION_UPSIDE_DOWN, &upsideDown);
+        m_bBottomUp = (0 != upsideDown);
+        m_width = std::min(width, m_sensorWidth) & ~1u;
+        m_height = std::min(height, m_sensorHeight) & ~1u;
+        hr = Toupcam_put_Roi(h, std::min(x, m_sensorWidth - m_width) & ~1u, std::min(y, m_sensorHeight - m_height) & ~1u, m_width, m_height);
+        if (SUCCEEDED(hr))
+        {
+            Toupcam_get_Roi(h, &m_x, &m_y, NULL, NULL);
+            m_bRef = m_bWaitStage = false;
+            m_settle = 0;
+        }
+        return hr;
+    }
+
+    /* the stage has moved after ROITRACK_STAGE: the next frame is the new reference */
+    void resume()
+    {
+        m_bWaitStage = m_bRef = false;
+        m_settle = ROITRACK_SETTLE;
+    }
+
+    /* frame as pulled (rowPitch 0); pdx, pdy: the shift of the frame against the reference, or for ROITRACK_STAGE
+       the shift of the target from the middle of the sensor the stage has to take back */
+    int update(const void* data, const ToupcamFrameInfoV4& info, int format, double* pdx, double* pdy)
+    {
+        *pdx = *pdy = 0;
+        if (m_bWaitStage || (info.v3.width != m_width) || (info.v3.height != m_height))
+            return ROITRACK_IDLE;
+        if (m_settle > 0)
+        {
+            --m_settle;
+            return ROITRACK_IDLE;
+        }
+        if (!m_bRef)
+        {
+            project((const unsigned char*)data, format, m_refCol, m_refRow);
+            m_bRef = true;
+            return ROITRACK_OK;
+        }
+
+        project((const unsigned char*)data, format, m_col, m_row);
+        *pdx = shift(m_refCol, m_col);
+        *pdy = shift(m_refRow, m_row);
+        if ((fabs(*pdx) < 2) && (fabs(*pdy) < 2))
+            return ROITRACK_OK;
+
+        const long nx = (long)m_x + ((long)floor(*pdx / 2 + 0.5) * 2), ny = (long)m_y + ((long)floor(*pdy / 2 + 0.5) * 2);
+        if ((nx >= 0) && (ny >= 0) && (nx + m_width <= m_sensorWidth) && (ny + m_height <= m_sensorHeight))
+            return SUCCEEDED(move((unsigned)nx, (unsigned)ny)) ? ROITRACK_MOVED : ROITRACK_OK;
+
+        const unsigned cx = (m_sensorWidth - m_width) / 2 & ~1u, cy = (m_sensorHeight - m_height) / 2 & ~1u;
+        *pdx = (double)nx - cx;
+        *pdy = (double)ny - cy;
+        move(cx, cy);
+        m_bWaitStage = true;
+        return ROITRACK_STAGE;
+    }
+
+    unsigned x() const { return m_x; }
+    unsigned y() const { return m_y; }
+};
+
+#endif
@@ -0,0 +1,393 @@
+#ifndef __scanexec_H__
+#define __scanexec_H__
+
+/*
+    Area scan executor: the stage moves, the camera exposes and the frames are saved in a pipeline, not one after the
+    other. The camera is in software trigger mode and the stage is a G-code controller on a serial link (Marlin:
+    every command is answered "ok", M400 once the moves before it are done). For every tile of the path:
+        1. the move to the tile is done (the "ok" of its M400),
+        2. Toupcam_Trigger(1),
+        3. the end of the exposure: TOUPCAM_EVENT_EXPO_STOP when the camera has hardware events
+           (TOUPCAM_FLAG_EVENT_HARDWARE, enabled by init()), otherwise the arrival of the frame,
+        4. the move to the next tile is sent at once, while the frame is still read out, transferred and pulled,
+        5. the frame is pulled into a buffer of a pool of buffers and queued to the worker threads, which hand it to
+           the sink (save, stitch); the buffer goes back to the pool when the sink returns.
+    So a tile takes the move plus the exposure; the readout, the transfer and the save are under the next move. The
+    stage cannot move during an exposure (the frame would be smeared), so the move and the exposure do not overlap.
+    A tile is triggered only when a buffer is free for its frame: a sink slower than the stage holds the scan back
+    instead of losing frames. Frames are matched to the tiles in the order of the triggers; a trigger which fails
+    (TOUPCAM_EVENT_TRIGGERFAIL) loses its tile, which is counted, and the scan goes on.
+    onEvent() is called from the event callback of the camera for every event (Toupcam_StartPullModeWithCallback is
+    the caller's), run() from one thread, it returns when every frame of the path has gone through the sink.
+    The exposure signal on a pin (TOUPCAM_IOCONTROLTYPE_SET_OUTPUTMODE 0x01, as in demotriggerout) is the same edge as
+    TOUPCAM_EVENT_EXPO_STOP; the host event is used here since the controller is driven from the host anyway.
+    setGate() checks every frame (framegate.h) in onEvent, right after it is pulled: a black, overexposed, flat or
+    blurred frame never reaches the sink, its buffer is free again at once. With retakes, run() waits for the verdict
+    of the frame before the move to the next tile (the readout and the transfer are no longer under the move, the
+    price of the stage still being at the tile) and triggers again, up to retakes times; a tile still rejected, or
+    rejected with no retakes, is in rejected() after run(), to be taken again by a second run() over those tiles.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+#include "framegate.h"
+
+#define SCANEXEC_BUFFERS    4
+#define SCANEXEC_TIMEOUT    10000   /* ms, move or exposure */
+#define SCANEXEC_PENDING    0xfffffffe  /* verdict of a frame not yet arrived or not yet checked */
+
+typedef struct {
+    double x, y;            /* mm */
+    unsigned row, column;
+} ScanTile;
+
+/* rows x columns tiles from (x0, y0), the odd rows from right to left */
+static std::vector<ScanTile> ScanSerpentine(double x0, double y0, double dx, double dy, unsigned columns, unsigned rows)
+{
+    std::vector<ScanTile> v;
+    for (unsigned r = 0; r < rows; ++r)
+    {
+        for (unsigned k = 0; k < columns; ++k)
+        {
+            const unsigned c = (r & 1) ? columns - 1 - k : k;
+            const ScanTile t = { x0 + c * dx, y0 + r * dy, r, c };
+            v.push_back(t);
+        }
+    }
+    return v;
+}
+
+typedef struct {
+    unsigned tiles, lost;
+    double seconds;
+    double moveWait, expoWait;  /* seconds the executor waited for the stage, for the exposures */
+    double bufferWait;          /* seconds it waited for a free buffer: the sink is the bottleneck */
+    unsigned rejected;          /* frames rejected by the gate, retakes included; the tiles: rejected() */
+    unsigned retakes;           /* triggers again of a tile rejected */
+    double gateWait;            /* seconds it waited for the verdict of the gate before a move */
+} ScanStats;
+
+/* on a worker thread; data: the frame as pulled with bits, valid until it returns */
+typedef void (*SCANEXEC_SINK)(void* ctx, const ScanTile& tile, const ToupcamFrameInfoV4& info, const void* data);
+
+class ScanExecutor {
+    struct Job {
+        unsigned tile, buffer;
+        ToupcamFrameInfoV4 info;
+    };
+
+    HToupcam m_hcam;
+    FILE* m_fout;
+    FILE* m_fin;
+    int m_bits;
+    bool m_bHwEvent;
+    std::vector<std::vector<unsigned char> > m_pool;
+    std::vector<unsigned char> m_scratch;   /* the frames not of the scan */
+    std::vector<unsigned> m_free;
+    std::deque<Job> m_jobs;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    unsigned m_triggered, m_exposed, m_frames, m_lost, m_busy, m_gating;
+    bool m_bQuit;
+    FrameGate* m_pGate;
+    unsigned m_retakes, m_rawBits;
+    std::vector<unsigned> m_trigTile;       /* the tile of every trigger of the run */
+    std::vector<unsigned> m_verdict;        /* of every frame of the run, FRAMEGATE_*, ~0: lost, SCANEXEC_PENDING */
+    std::vector<unsigned> m_rejected;
+    const std::vector<ScanTile>* m_pTiles;
+    SCANEXEC_SINK m_sink;
+    void* m_sinkCtx;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        while (1)
+        {
+            m_cv.wait(lock, [this] { return m_bQuit || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return;
+            const Job job = m_jobs.front();
+            m_jobs.pop_front();
+            ++m_busy;
+            lock.unlock();
+            m_sink(m_sinkCtx, (*m_pTiles)[job.tile], job.info, &m_pool[job.buffer][0]);
+            lock.lock();
+            --m_busy;
+            m_free.push_back(job.buffer);
+            m_cv.notify_all();
+        }
+    }
+
+    bool send(const ScanTile& t, double feed)
+    {
+        if (fprintf(m_fout, "G0 X%.4f Y%.4f F%.0f\nM400\n", t.x, t.y, feed) < 0)
+            return false;
+        fflush(m_fout);
+        return true;
+    }
+
+    /* the "ok" of G0 and of M400 */
+    bool waitMove()
+    {
+        char line[256];
+        for (int n = 0; n < 2; )
+        {
+            if (NULL == fgets(line, sizeof(line), m_fin))
+                return false;
+            if (0 == strncmp(line, "ok", 2))
+                ++n;
+        }
+        return true;
+    }
+
+    static double since(std::chrono::steady_clock::time_point t0)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+public:
+    ScanExecutor()
+    : m_hcam(NULL), m_fout(NULL), m_fin(NULL), m_bits(24), m_bHwEvent(false), m_triggered(0), m_exposed(0), m_frames(0), m_lost(0), m_busy(0), m_gating(0), m_bQuit(false), m_pGate(NULL), m_retakes(0), m_rawBits(0), m_pTiles(NULL), m_sink(NULL), m_sinkCtx(NULL)
+    {
+    }
+
+    ~ScanExecutor()
+    {
+        close();
+    }
+
+    /*
+        before Toupcam_StartPullModeWithCallback: software trigger mode, hardware events when the camera has them;
+        bits as Toupcam_PullImageV4 (24, 32, 48, 8, 16; 8 or 16 for a RAW frame: the bytes of its samples)
+    */
+    HRESULT init(HToupcam h, FILE* fout, FILE* fin, int bits = 24, unsigned buffers = SCANEXEC_BUFFERS, unsigned workers = 1)
+    {
+        int nWidth = 0, nHeight = 0;
+        HRESULT hr = Toupcam_get_Size(h, &nWidth, &nHeight);
+        if (FAILED(hr))
+            return hr;
+        if (FAILED(hr = Toupcam_put_Option(h, TOUPCAM_OPTION_TRIGGER, 1)))
+            return hr;
+        m_bHwEvent = false;
+        if (Toupcam_query_Model(h)->flag & TOUPCAM_FLAG_EVENT_HARDWARE)
+        {
+            m_bHwEvent = SUCCEEDED(Toupcam_put_Option(h, TOUPCAM_OPTION_EVENT_HARDWARE, 1))
+                && SUCCEEDED(Toupcam_put_Option(h, TOUPCAM_OPTION_EVENT_HARDWARE | TOUPCAM_EVENT_EXPO_STOP, 1));
+        }
+        m_hcam = h;
+        m_fout = fout;
+        m_fin = fin;
+        m_bits = bits;
+        m_scratch.resize(TDIBWIDTHBYTES(nWidth * bits) * nHeight);
+        m_pool.assign(buffers ? buffers : 1, m_scratch);
+        m_free.clear();
+        for (unsigned i = 0; i < m_pool.size(); ++i)
+            m_free.push_back(i);
+        m_bQuit = false;
+        for (unsigned i = 0; i < (workers ? workers : 1); ++i)
+            m_workers.push_back(std::thread(&ScanExecutor::worker, this));
+        return 0;
+    }
+
+    bool hardwareEvent() const { return m_bHwEvent; }
+
+    /*
+        before run(); pGate: NULL to save every frame, it outlives the runs and is used on the thread of the event
+        callback; retakes: the triggers again of a rejected tile, 0: rejected() only; rawBits: as FrameGate::measure
+    */
+    void setGate(FrameGate* pGate, unsigned retakes = 1, unsigned rawBits = 0)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_pGate = pGate;
+        m_retakes = retakes;
+        m_rawBits = rawBits;
+    }
+
+    /* the indexes in the tiles of the last run() of the tiles rejected by the gate, in the order of the scan */
+    const std::vector<unsigned>& rejected() const { return m_rejected; }
+
+    void onEvent(unsigned nEvent)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (TOUPCAM_EVENT_IMAGE == nEvent)
+        {
+            if ((NULL == m_pTiles) || (m_frames >= m_triggered) || m_free.empty())
+            {
+                Toupcam_PullImageV4(m_hcam, &m_scratch[0], 0, m_bits, 0, NULL);  /* not of a tile: drop it */
+                if (m_pTiles && (m_frames < m_triggered))
+                {
+                    m_verdict[m_frames++] = ~0u;    /* no buffer, run() reserves one per trigger: not expected */
+                    ++m_lost;
+                    m_exposed = (m_exposed > m_frames) ? m_exposed : m_frames;
+                    m_cv.notify_all();
+                }
+                return;
+            }
+            Job job;
+            job.tile = m_trigTile[m_frames];
+            job.buffer = m_free.back();
+            const HRESULT hr = Toupcam_PullImageV4(m_hcam, &m_pool[job.buffer][0], 0, m_bits, 0, &job.info);
+            const unsigned k = m_frames++;
+            if (!m_bHwEvent)
+                m_exposed = m_frames;
+            if (FAILED(hr))
+            {
+                m_verdict[k] = ~0u;
+                ++m_lost;
+            }
+            else
+            {
+                unsigned verdict = 0;
+                if (m_pGate)
+                {
+                    /* the check out of the lock: the next trigger, the sink go on meanwhile */
+                    m_free.pop_back();
+                    ++m_gating;
+                    m_cv.notify_all();
+                    lock.unlock();
+                    verdict = m_pGate->check(&m_pool[job.buffer][0], m_bits, m_rawBits, job.info);
+                    lock.lock();
+                    --m_gating;
+                    m_free.push_back(job.buffer);
+                }
+                m_verdict[k] = verdict;
+                if (0 == verdict)   /* rejected: not saved, the buffer free again */
+                {
+                    m_free.pop_back();
+                    m_jobs.push_back(job);
+                }
+            }
+            m_cv.notify_all();
+        }
+        else if ((TOUPCAM_EVENT_EXPO_STOP == nEvent) && m_bHwEvent)
+        {
+            ++m_exposed;
+            m_cv.notify_all();
+        }
+        else if ((TOUPCAM_EVENT_TRIGGERFAIL == nEvent) && (m_frames < m_triggered))
+        {
+            m_verdict[m_frames++] = ~0u;
+            ++m_lost;
+            m_exposed = m_frames > m_exposed ? m_frames : m_exposed;
+            m_cv.notify_all();
+        }
+    }
+
+    /* feed: mm/min of the moves; false: the stage or the camera did not answer, the tiles after are not taken */
+    bool run(const std::vector<ScanTile>& tiles, double feed, SCANEXEC_SINK sink, void* sinkCtx, ScanStats* pStats)
+    {
+        ScanStats stats;
+        memset(&stats, 0, sizeof(stats));
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_triggered = m_exposed = m_frames = m_lost = 0;
+            m_trigTile.clear();
+            m_verdict.clear();
+            m_rejected.clear();
+            m_pTiles = &tiles;
+            m_sink = sink;
+            m_sinkCtx = sinkCtx;
+        }
+        const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        bool ret = tiles.empty() || (send(tiles[0], feed) && waitMove());
+        unsigned retake = 0;
+        for (size_t i = 0; ret && (i < tiles.size()); )
+        {
+            std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(m_mtx);
+            /* a buffer for every frame in flight and for this one */
+            if (!m_cv.wait_for(lock, std::chrono::milliseconds(SCANEXEC_TIMEOUT), [this] { return m_free.size() > m_triggered - m_frames; }))
+            {
+                ret = false;
+                break;
+            }
+            stats.bufferWait += since(t);
+            const HRESULT hr = Toupcam_Trigger(m_hcam, 1);
+            if (FAILED(hr))
+            {
+                ret = false;
+                break;
+            }
+            m_trigTile.push_back((unsigned)i);
+            m_verdict.push_back(SCANEXEC_PENDING);
+            const unsigned n = ++m_triggered;
+            t = std::chrono::steady_clock::now();
+            if (!m_cv.wait_for(lock, std::chrono::milliseconds(SCANEXEC_TIMEOUT), [this, n] { return m_exposed >= n; }))
+            {
+                ret = false;
+                break;
+            }
+            stats.expoWait += since(t);
+            if (m_pGate && m_retakes)
+            {
+                t = std::chrono::steady_clock::now();
+                if (!m_cv.wait_for(lock, std::chrono::milliseconds(SCANEXEC_TIMEOUT), [this, n] { return SCANEXEC_PENDING != m_verdict[n - 1]; }))
+                {
+                    ret = false;
+                    break;
+                }
+                stats.gateWait += since(t);
+                if ((0 != m_verdict[n - 1]) && (~0u != m_verdict[n - 1]) && (retake < m_retakes))
+                {
+                    ++retake;
+                    ++stats.retakes;
+                    continue;   /* the same tile, the stage has not moved */
+                }
+            }
+            retake = 0;
+            ++i;
+            lock.unlock();
+            if (i < tiles.size())
+            {
+                t = std::chrono::steady_clock::now();
+                ret = send(tiles[i], feed) && waitMove();
+                stats.moveWait += since(t);
+            }
+        }
+        {
+            /* the frames still on the way, then the sink */
+            std::unique_lock<std::mutex> lock(m_mtx);
+            if (!m_cv.wait_for(lock, std::chrono::milliseconds(SCANEXEC_TIMEOUT), [this] { return m_frames >= m_triggered; }))
+                ret = false;
+            m_cv.wait(lock, [this] { return m_jobs.empty() && (0 == m_busy) && (0 == m_gating); });
+            stats.tiles = m_triggered - stats.retakes;
+            stats.lost = m_lost + (m_triggered - m_frames);
+            /* the verdict of a tile is that of its last frame */
+            for (unsigned k = 0; k < m_frames; ++k)
+            {
+                if ((0 != m_verdict[k]) && (~0u != m_verdict[k]) && (SCANEXEC_PENDING != m_verdict[k]))
+                {
+                    ++stats.rejected;
+                    if ((k + 1 == m_frames) || (m_trigTile[k + 1] != m_trigTile[k]))
+                        m_rejected.push_back(m_trigTile[k]);
+                }
+            }
+            m_triggered = m_frames;
+            m_pTiles = NULL;
+        }
+        stats.seconds = since(t0);
+        if (pStats)
+            *pStats = stats;
+        return ret;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bQuit = true;
+            m_cv.notify_all();
+        }
+        for (size_t i = 0; i < m_workers.size(); ++i)
+            m_workers[i].join();
+        m_workers.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef __settle_H__
+#define __settle_H__
+
+/*
+    Settle detector: instead of a fixed delay after a move (M400, then sleep the worst case of every tile),
+    the frames are watched and the capture starts as soon as the image stops moving.
+    Every frame is reduced to a grid of SETTLE_GRID_X x SETTLE_GRID_Y cell means of the luminance (every SETTLE_STEP-th
+    pixel of every SETTLE_STEP-th row, (R + 2G + B) / 4 for RGB24 or BGR24, the value for 8 bits grey or RAW). The motion
+    between two frames is the mean absolute difference of their grids over the mean gradient of the newer one, times
+    the cell size: for a small shift of a textured scene that is the shift itself, in pixels of the frame, so the
+    threshold is a distance (SETTLE_THRESHOLD, 0.5 pixel). The image is still when hold successive pairs are below it;
+    the last frame of them was exposed with the stage still, and is the capture itself.
+    The cameras with TOUPCAM_FLAG_AUTO_FOCUS give uFV / uLum in the frame info (TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS):
+    no pixel is read then, the image is still when uFV and uLum change by less than fvThreshold (relative, default
+    SETTLE_FV_THRESHOLD) hold times running. A moving image is smeared, its uFV climbs while it slows down and stops
+    climbing when it stops. source() tells which of the two the frame went through.
+    A scene without texture has no gradient and never shows motion: add() says still at once, the caller keeps a minimum
+    delay (the time of one frame after the move ends) if it has such tiles.
+*/
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "toupcam.h"
+
+#define SETTLE_GRID_X           64
+#define SETTLE_GRID_Y           48
+#define SETTLE_STEP             2
+#define SETTLE_THRESHOLD        0.5     /* pixels */
+#define SETTLE_FV_THRESHOLD     0.02    /* relative change of uFV / uLum */
+#define SETTLE_HOLD             2       /* pairs below the threshold */
+
+#define SETTLE_IMAGE            1
+#define SETTLE_CAMERA           2
+
+class SettleDetector {
+    std::vector<float> m_grid[2];
+    unsigned m_cur;                 /* index of the newest grid */
+    unsigned m_frames;              /* since reset() */
+    unsigned m_still;               /* pairs below the threshold, running */
+    unsigned m_hold;
+    double m_threshold, m_fvThreshold, m_motion;
+    unsigned long long m_fv;
+    unsigned m_lum;
+    int m_source;
+
+    /* cell means of the frame into m_grid[m_cur]; the cell size in pixels */
+    double reduce(const void* data, int bits, unsigned width, unsigned height, int pitch)
+    {
+        std::vector<float>& g = m_grid[m_cur];
+        g.assign(SETTLE_GRID_X * SETTLE_GRID_Y, 0.0f);
+        const unsigned bpp = (24 == bits) ? 3 : 1;
+        const size_t stride = pitch ? (size_t)pitch : ((24 == bits) ? TDIBWIDTHBYTES(width * 24) : width);
+        const unsigned cw = width / SETTLE_GRID_X, ch = height / SETTLE_GRID_Y;
+        if ((0 == cw) || (0 == ch))
+            return 0.0;
+        const unsigned n = ((cw + SETTLE_STEP - 1) / SETTLE_STEP) * ((ch + SETTLE_STEP - 1) / SETTLE_STEP);
+        for (unsigned gy = 0; gy < SETTLE_GRID_Y; ++gy)
+        {
+            float* out = &g[gy * SETTLE_GRID_X];
+            for (unsigned y = gy * ch; y < (gy + 1) * ch; y += SETTLE_STEP)
+            {
+                const unsigned char* row = (const unsigned char*)data + y * stride;
+                for (unsigned gx = 0; gx < SETTLE_GRID_X; ++gx)
+                {
+                    unsigned sum = 0;
+                    const unsigned char* p = row + (size_t)gx * cw * bpp;
+                    if (3 == bpp)
+                    {
+                        for (unsigned x = 0; x < cw; x += SETTLE_STEP, p += 3 * SETTLE_STEP)
+                            sum += p[0] + 2 * p[1] + p[2];
+                    }
+                    else
+                    {
+                        for (unsigned x = 0; x < cw; x += SETTLE_STEP, p += SETTLE_STEP)
+                            sum += 4 * p[0];
+                    }
+                    out[gx] += (float)sum;
+                }
+            }
+            for (unsigned gx = 0; gx < SETTLE_GRID_X; ++gx)
+                out[gx] /= 4.0f * n;
+        }
+        return sqrt((double)cw * ch);
+    }
+
+    /* shift between the two grids, in cells */
+    double shift() const
+    {
+        const std::vector<float>& a = m_grid[m_cur];
+        const std::vector<float>& b = m_grid[m_cur ^ 1];
+        double diff = 0, grad = 0;
+        for (unsigned y = 1; y + 1 < SETTLE_GRID_Y; ++y)
+        {
+            for (unsigned x = 1; x + 1 < SETTLE_GRID_X; ++x)
+            {
+                const unsigned i = y * SETTLE_GRID_X + x;
+                diff += fabs(a[i] - b[i]);
+                grad += (fabs(a[i + 1] - a[i - 1]) + fabs(a[i + SETTLE_GRID_X] - a[i - SETTLE_GRID_X])) / 4;
+            }
+        }
+        return (grad > 1e-3 * (SETTLE_GRID_X - 2) * (SETTLE_GRID_Y - 2)) ? diff / grad : 0.0;
+    }
+public:
+    SettleDetector()
+    : m_cur(0), m_frames(0), m_still(0), m_hold(SETTLE_HOLD), m_threshold(SETTLE_THRESHOLD), m_fvThreshold(SETTLE_FV_THRESHOLD), m_motion(0), m_fv(0), m_lum(0), m_source(0)
+    {
+    }
+
+    void put(double threshold, unsigned hold = SETTLE_HOLD, double fvThreshold = SETTLE_FV_THRESHOLD)
+    {
+        m_threshold = threshold;
+        m_hold = hold ? hold : 1;
+        m_fvThreshold = fvThreshold;
+    }
+
+    /* a move was sent: the frames before are not compared with the ones after */
+    void reset()
+    {
+        m_frames = m_still = 0;
+        m_motion = 0;
+    }
+
+    /*
+        the frame just pulled, RGB24 / BGR24 (bits = 24) or 8 bits (grey, RAW), rows of pitch bytes (0: the default
+        pitch of the pull); true: the image is still, this frame included
+    */
+    bool add(const ToupcamFrameInfoV4& info, const void* data, int bits, int pitch = 0)
+    {
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS)
+        {
+            m_source = SETTLE_CAMERA;
+            if (m_frames)
+            {
+                const double fv = fabs((double)info.uFV - (double)m_fv) / (double)((info.uFV > m_fv ? info.uFV : m_fv) + 1);
+                const double lum = fabs((double)info.uLum - (double)m_lum) / (double)((info.uLum > m_lum ? info.uLum : m_lum) + 1);
+                m_motion = (fv > lum) ? fv : lum;
+                m_still = (m_motion < m_fvThreshold) ? m_still + 1 : 0;
+            }
+            m_fv = info.uFV;
+            m_lum = info.uLum;
+        }
+        else
+        {
+            m_source = SETTLE_IMAGE;
+            m_cur ^= 1;
+            const double cell = reduce(data, bits, info.v3.width, info.v3.height, pitch);
+            if (m_frames)
+            {
+                m_motion = shift() * cell;
+                m_still = (m_motion < m_threshold) ? m_still + 1 : 0;
+            }
+        }
+        ++m_frames;
+        return m_still >= m_hold;
+    }
+
+    bool still() const { return m_still >= m_hold; }
+    double motion() const { return m_motion; }     /* of the last pair: pixels, or the relative change of uFV / uLum */
+    unsigned frames() const { return m_frames; }
+    int source() const { return m_source; }
+};
+
+#endif
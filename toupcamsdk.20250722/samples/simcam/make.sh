@@ -0,0 +1,7 @@
+#!/bin/bash
+os=`uname -s`
+if [[ $os = "Linux" ]]; then
+	g++ -std=c++11 -O2 -shared -fPIC -I../../inc -o libtoupcam.so simcam.cpp -lpthread
+else
+	clang++ -std=c++11 -O2 -dynamiclib -install_name @rpath/libtoupcam.dylib -I../../inc -o libtoupcam.dylib simcam.cpp
+fi
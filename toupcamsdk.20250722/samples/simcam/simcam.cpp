@@ -0,0 +1,2348 @@
+/*
+    simcam: a simulated camera, built as a libtoupcam of its own (make.sh), which a program links instead of the SDK
+    to be run and benchmarked without the hardware: copy libtoupcam.so (libtoupcam.dylib) next to the program (the
+    samples link with the rpath $ORIGIN) or put this directory first in LD_LIBRARY_PATH.
+    It implements the subset of the API of the pull mode which the samples use (see the end of this file): a program
+    calling anything else fails to link (or to load), there is no stub which would pretend to work.
+
+    The cameras enumerate with Toupcam_EnumV2 like USB cameras ("sim-0", "sim-1", ..., sn "SIM0000000", ...) and go
+    through the stages of the SDK, with their threads and deques:
+        generator:  paced by the frame rate (or Toupcam_Trigger), raises TOUPCAM_EVENT_EXPO_START / _EXPO_STOP if the
+                    hardware events are on, renders the RAW frame of the sensor into the frontend deque
+                    (TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH, default 4, the oldest frame dropped when it is full)
+        pipeline:   RAW to RGB24, RGB32 or 8 bits grey (TOUPCAM_OPTION_RAW, _RGB, _BYTEORDER), the auto exposure, into
+                    the backend deque (TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH, default 3), then TOUPCAM_EVENT_IMAGE
+        pull:       Toupcam_PullImageV4 / Toupcam_WaitImageV4 convert to the bits and row pitch asked for
+    so the counters of the SDK (TOUPCAM_OPTION_FRONTEND_FULL, _BACKEND_FULL, _NUMBER_DROP_FRAME, Toupcam_get_FrameRate)
+    tell where a program does not keep up.
+
+    The scene is a tile of SIM_SCENE x SIM_SCENE pixels (wrapping around), in focus and at SIM_LEVELS - 1 depths of
+    blur. X and Y of the simulated stage (simcam.h) shift it, Z blurs it; the exposure time x gain scales it, the
+    noise is gaussian. With af=1 the model has TOUPCAM_FLAG_AUTO_FOCUS and the frames carry uLum / uFV.
+    Replay: with replay=<file.rawseq>, a RAW sequence of demorawrec (samples/demorawrec/rawseq.h) takes the place of
+    the scene, the camera has the resolution, bit depth and bayer pattern of the recording. Its frames go through the
+    same deques and pipeline with their ToupcamFrameInfoV4 as recorded, at the intervals of their timestamps over
+    rate (2: twice as fast), no noise, no stage: the same input run after run, for before / after comparisons of a
+    program. At rate 0 the frames go as fast as the program pulls them and the deques wait for room instead of
+    dropping: every frame of the recording is delivered, the run measures the throughput of the program. Without loop=1 the camera stops producing frames at the end of
+    the recording (SIMCAM_OPTION_REPLAY_POS rewinds it); with it, seq and timestamp keep growing over the loops.
+    A packed recording is unpacked into the frame, a compressed one decoded into it over the threads (below).
+
+    Configuration: the environment variable SIMCAM, "key=value" separated by commas, read once:
+        w, h        resolution, default 2592 x 1944; 5120 x 4880 for 25M (res 1 and 2 are the halves and quarters)
+        fps         maximum frame rate, default 30
+        format      raw8 or raw12 (RAW of the sensor, TOUPCAM_OPTION_BITDEPTH 1 for 12 bits), default raw8
+        mono        1: monochrome sensor, default 0 (RGGB)
+        pattern     texture, grid or checker, default texture
+        noise       standard deviation in levels of 8 bits, default 2
+        motion      vx:vy drift of the scene, pixels per second, default 0:0
+        focus       amplitude:period, sweep of Z around the stage, micrometres and seconds, default 0:0
+        dof         micrometres of Z per level of blur, default 5
+        umpx        micrometres of X and Y per pixel, default 1
+        speed       of the stage, micrometres per second, 0: moves at once, default 0
+        af          1: uLum / uFV in the frame info, default 0
+        count       number of cameras, default 1
+        threads     threads rendering and converting one frame, default 4
+        seed        of the scene and the noise, default 1
+        replay      a recording of demorawrec to replay instead of the scene
+        rate        of the replay, default 1
+        loop        1: the replay starts again at the end, default 0
+        huge        1: the buffers of the deques on huge pages (samples/hugebuf.h), default 0
+        unplug      at:for, seconds: sim-0 goes away at seconds after its first start (TOUPCAM_EVENT_DISCONNECTED, no
+                    more frames, absent from Toupcam_EnumV2 and Toupcam_Open) and is back for seconds later, once;
+                    the callback of Toupcam_HotPlug is called both times; default 0:0, never
+        expolag     frames of the sensor between Toupcam_put_ExpoTime / _ExpoAGain and the first frame exposed with
+                    them (the registers latched at a frame start, as a CMOS sensor does), up to SIM_EXPO_LAG_MAX;
+                    default 0, the next frame to start; the frame info carries the values of its own exposure
+        trigdrop    1: a Toupcam_Trigger(1) while the sensor is busy (below) is lost, as an edge on a trigger line
+                    is, and counted in SIMCAM_OPTION_TRIGGER_LOST; default 0, the triggers add up and wait
+        clockppm    rate error of the clock of the timestamps against the host, ppm, sim-n at n + 1 times it (two
+                    cameras drift apart as well); default 0. TOUPCAM_OPTION_RESET_SEQ_TIMESTAMP restarts seq and
+                    the timestamp at the next frame, as does a Toupcam_StartXXXX
+    such as SIMCAM=w=5120,h=4880,fps=60,noise=3,motion=200:0 ./demorecord
+         or SIMCAM=replay=scan.rawseq,rate=0 ./demofocusstack
+    The frames are rendered at the rate asked for only if the machine keeps up: a generator which falls behind simply
+    runs late, as a camera on a saturated link does.
+    Histogram: Toupcam_GetHistogramV2 calls back on the pipeline thread, before TOUPCAM_EVENT_IMAGE of the frame, with
+    the histogram of the RAW frame at 8 bits (R, G, B, or one channel of a mono sensor; a sparse grid of the pixels),
+    of the next frame, or of every frame from then on with TOUPCAM_OPTION_HISTOGRAM 1.
+    UART: Toupcam_IoControl has the settings of the UART (TOUPCAM_IOCONTROLTYPE_GET_ / SET_UART_XXX, everything else
+    is E_NOTIMPL), and a Marlin is wired to it: G0 / G1 X Y Z (mm, absolute) move the stage, G28 homes it to 0, M114
+    reports the position, M400 waits for the stage, every line is answered "ok". Its planner holds one move: the "ok"
+    of a move comes when the move before it has ended. The baud rate is not simulated, the answers are there at once.
+    Readout and binning: fps is the frame rate of the whole sensor and the readout takes as long as the rows read, so
+    a frame is shorter with fewer rows (unless the frame rate options or the exposure time limit it). Toupcam_put_Mode
+    bin (the default) reads all the rows and averages 2^k x 2^k pixels for resolution k, skip reads the rows of k
+    only, at the noise of one pixel. Toupcam_put_Binning (1x1 ... 4x4, Average, Add, Skip) bins in the sensor: the
+    rows read and the frame divided by n, the noise averaged (Average), grown by n with the signal by n x n (Add) or
+    left (Skip). TOUPCAM_OPTION_BINNING (2 ... 8, saturating add or 0x80 average) bins "in the SDK": the frame is
+    rendered binned, the noise averaged or summed, the readout that of the full frame. TOUPCAM_OPTION_CG 1 (HCG)
+    takes the noise by SIM_HCG_NOISE, TOUPCAM_OPTION_LOW_NOISE by SIM_LOW_NOISE at SIM_LOW_NOISE_RATE of the
+    readout rate. All but the conversion gain are set while the camera is stopped; none of them in a replay.
+    TOUPCAM_OPTION_READOUT_MODE 0 (IWR, the default) exposes a frame during the readout of the one before, the sensor
+    is ready again after the longer of the exposure time and the readout; 1 (ITR) and TOUPCAM_OPTION_GLOBAL_RESET_MODE
+    1 read after the exposure, after the sum of both. That is the frame period (TOUPCAM_OPTION_CAMERA_PERIOD, us; the
+    frame rate options only lengthen it) and, in trigger mode, the earliest start of the next triggered frame:
+    a trigger before it waits (or is lost with trigdrop=1, by then less than that after the last one taken). TOUPCAM_OPTION_READ_TIME (us) and _LINE_TIME (ns) are of
+    the rows read. TOUPCAM_OPTION_TRIGGER_CANCEL_MODE is kept and read back, Toupcam_Trigger(0) drops the waiting ones.
+    Toupcam_Version returns a version ending with "sim" for a program to tell it from the SDK.
+    Linux and macOS only (char camId; make.sh), there is no project for Windows.
+*/
+#define TOUPCAM_HRESULT_ERRORCODE_NEEDED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+#include "../demorawrec/rawseq.h"
+#include "../hugebuf.h"
+#include "simcam.h"
+
+#define SIM_SCENE           2048        /* power of 2 */
+#define SIM_LEVELS          6
+#define SIM_RESOLUTIONS     3
+#define SIM_NOISE           65536       /* power of 2 */
+#define SIM_EXPO_REF        10000       /* us x 100% which gives the scene as is */
+#define SIM_EXPO_MIN        10
+#define SIM_EXPO_MAX        5000000
+#define SIM_GAIN_MAX        5000
+#define SIM_EXPO_LAG_MAX    8           /* frames, expolag */
+#define SIM_AE_MAX_TIME     350000      /* default of Toupcam_get_AutoExpoRange */
+#define SIM_AE_MAX_GAIN     500
+#define SIM_AE_ONCE_FRAMES  30          /* once mode fails after */
+#define SIM_REPLAY_AHEAD    8           /* frames of the recording asked from the disk ahead */
+#define SIM_PATTERN_TEXTURE 0
+#define SIM_PATTERN_GRID    1
+#define SIM_PATTERN_CHECKER 2
+#define SIM_BIN_AVERAGE     0           /* methods of Toupcam_put_Binning */
+#define SIM_BIN_ADD         1
+#define SIM_BIN_SKIP        2
+#define SIM_HCG_NOISE       0.5         /* of the noise with HCG (TOUPCAM_OPTION_CG 1) */
+#define SIM_LOW_NOISE       0.7         /* of the noise in the low noise mode */
+#define SIM_LOW_NOISE_RATE  0.5         /* of the readout rate in the low noise mode */
+
+#ifndef MAKEFOURCC
+#define MAKEFOURCC(a, b, c, d) ((unsigned)(unsigned char)(a) | ((unsigned)(unsigned char)(b) << 8) | ((unsigned)(unsigned char)(c) << 16) | ((unsigned)(unsigned char)(d) << 24))
+#endif
+
+typedef std::chrono::steady_clock SimClock;
+
+static const int g_radius[SIM_LEVELS] = { 0, 1, 2, 4, 8, 16 };
+
+struct SimConfig {
+    unsigned width, height, count, threads, seed;
+    int bits, mono, af, pattern, loop, huge;
+    unsigned expoLag;
+    int trigDrop;
+    double clockPpm;
+    double fps, noise, vx, vy, focusAmp, focusPeriod, dof, umpx, speed, rate, unplugAt, unplugFor;
+    char replay[256];
+};
+
+static SimConfig g_cfg;
+static ToupcamModelV2 g_model;
+static char g_modelName[64];
+static unsigned g_fourcc;
+static RawSeqReader g_replay;       /* frames() > 0: replay */
+static RawCodec* g_replayCodec;     /* compressed recording */
+
+static void parseConfig()
+{
+    g_cfg.width = 2592;
+    g_cfg.height = 1944;
+    g_cfg.count = 1;
+    g_cfg.threads = 4;
+    g_cfg.seed = 1;
+    g_cfg.expoLag = 0;
+    g_cfg.trigDrop = 0;
+    g_cfg.clockPpm = 0;
+    g_cfg.bits = 8;
+    g_cfg.mono = g_cfg.af = 0;
+    g_cfg.pattern = SIM_PATTERN_TEXTURE;
+    g_cfg.fps = 30;
+    g_cfg.noise = 2;
+    g_cfg.vx = g_cfg.vy = g_cfg.focusAmp = g_cfg.focusPeriod = 0;
+    g_cfg.dof = 5;
+    g_cfg.umpx = 1;
+    g_cfg.speed = 0;
+    g_cfg.rate = 1;
+    g_cfg.loop = 0;
+    g_cfg.huge = 0;
+    g_cfg.unplugAt = g_cfg.unplugFor = 0;
+    g_cfg.replay[0] = '\0';
+
+    const char* env = getenv("SIMCAM");
+    char buf[512] = { 0 };
+    if (env)
+        strncpy(buf, env, sizeof(buf) - 1);
+    for (char* tok = strtok(buf, ","); tok; tok = strtok(NULL, ","))
+    {
+        char* val = strchr(tok, '=');
+        if (NULL == val)
+            continue;
+        *val++ = '\0';
+        if (0 == strcmp(tok, "w"))
+            g_cfg.width = (unsigned)atoi(val);
+        else if (0 == strcmp(tok, "h"))
+            g_cfg.height = (unsigned)atoi(val);
+        else if (0 == strcmp(tok, "fps"))
+            g_cfg.fps = atof(val);
+        else if (0 == strcmp(tok, "format"))
+            g_cfg.bits = (0 == strcmp(val, "raw12")) ? 12 : 8;
+        else if (0 == strcmp(tok, "mono"))
+            g_cfg.mono = atoi(val);
+        else if (0 == strcmp(tok, "pattern"))
+            g_cfg.pattern = (0 == strcmp(val, "grid")) ? SIM_PATTERN_GRID : ((0 == strcmp(val, "checker")) ? SIM_PATTERN_CHECKER : SIM_PATTERN_TEXTURE);
+        else if (0 == strcmp(tok, "noise"))
+            g_cfg.noise = atof(val);
+        else if (0 == strcmp(tok, "motion"))
+            sscanf(val, "%lf:%lf", &g_cfg.vx, &g_cfg.vy);
+        else if (0 == strcmp(tok, "focus"))
+            sscanf(val, "%lf:%lf", &g_cfg.focusAmp, &g_cfg.focusPeriod);
+        else if (0 == strcmp(tok, "dof"))
+            g_cfg.dof = atof(val);
+        else if (0 == strcmp(tok, "umpx"))
+            g_cfg.umpx = atof(val);
+        else if (0 == strcmp(tok, "speed"))
+            g_cfg.speed = atof(val);
+        else if (0 == strcmp(tok, "af"))
+            g_cfg.af = atoi(val);
+        else if (0 == strcmp(tok, "count"))
+            g_cfg.count = (unsigned)atoi(val);
+        else if (0 == strcmp(tok, "threads"))
+            g_cfg.threads = (unsigned)atoi(val);
+        else if (0 == strcmp(tok, "seed"))
+            g_cfg.seed = (unsigned)atoi(val);
+        else if (0 == strcmp(tok, "replay"))
+            snprintf(g_cfg.replay, sizeof(g_cfg.replay), "%s", val);
+        else if (0 == strcmp(tok, "rate"))
+            g_cfg.rate = atof(val);
+        else if (0 == strcmp(tok, "loop"))
+            g_cfg.loop = atoi(val);
+        else if (0 == strcmp(tok, "huge"))
+            g_cfg.huge = atoi(val);
+        else if (0 == strcmp(tok, "unplug"))
+            sscanf(val, "%lf:%lf", &g_cfg.unplugAt, &g_cfg.unplugFor);
+        else if (0 == strcmp(tok, "expolag"))
+            g_cfg.expoLag = (unsigned)atoi(val);
+        else if (0 == strcmp(tok, "trigdrop"))
+            g_cfg.trigDrop = atoi(val);
+        else if (0 == strcmp(tok, "clockppm"))
+            g_cfg.clockPpm = atof(val);
+        else
+            fprintf(stderr, "simcam: unknown key %s\n", tok);
+    }
+    /* even, for the 2 x 2 of the bayer pattern, and the quarter at least 16 pixels */
+    g_cfg.width = (g_cfg.width < 64) ? 64 : (g_cfg.width & ~1u);
+    g_cfg.height = (g_cfg.height < 64) ? 64 : (g_cfg.height & ~1u);
+    if ((g_cfg.count < 1) || (g_cfg.count > TOUPCAM_MAX))
+        g_cfg.count = 1;
+    if (g_cfg.threads < 1)
+        g_cfg.threads = 1;
+    if (g_cfg.fps <= 0)
+        g_cfg.fps = 30;
+    if (g_cfg.dof <= 0)
+        g_cfg.dof = 5;
+    if (g_cfg.umpx <= 0)
+        g_cfg.umpx = 1;
+    if (g_cfg.rate < 0)
+        g_cfg.rate = 0;
+    if (g_cfg.expoLag > SIM_EXPO_LAG_MAX)
+        g_cfg.expoLag = SIM_EXPO_LAG_MAX;
+    g_fourcc = g_cfg.mono ? MAKEFOURCC('G', 'R', 'E', 'Y') : MAKEFOURCC('R', 'G', 'G', 'B');
+
+    /* the recording gives the sensor */
+    const char* kind = "";
+    if (g_cfg.replay[0])
+    {
+        if (!g_replay.open(g_cfg.replay, true) || (0 == g_replay.frames()))
+        {
+            fprintf(stderr, "simcam: failed to open the recording %s\n", g_cfg.replay);
+            g_replay.close();
+            g_cfg.count = 0;
+        }
+        else
+        {
+            const RawSeqHeader& header = g_replay.header();
+            g_cfg.width = header.width;
+            g_cfg.height = header.height;
+            g_cfg.bits = header.bitdepth;
+            g_fourcc = header.fourcc;
+            g_cfg.mono = (MAKEFOURCC('G', 'R', 'E', 'Y') == header.fourcc) || (MAKEFOURCC('Y', '8', '0', '0') == header.fourcc);
+            g_cfg.af = 0;
+            if (header.compression)
+                g_replayCodec = new RawCodec(g_cfg.threads - 1);
+            kind = " replay";
+        }
+    }
+
+    snprintf(g_modelName, sizeof(g_modelName), "SimCam%s %ux%u%s", kind, g_cfg.width, g_cfg.height, g_cfg.mono ? " M" : "");
+    memset(&g_model, 0, sizeof(g_model));
+    g_model.name = g_modelName;
+    g_model.flag = TOUPCAM_FLAG_CMOS | TOUPCAM_FLAG_USB30 | TOUPCAM_FLAG_TRIGGER_SOFTWARE | TOUPCAM_FLAG_RAW8 | TOUPCAM_FLAG_PRECISE_FRAMERATE;
+    if (10 == g_cfg.bits)
+        g_model.flag |= TOUPCAM_FLAG_RAW10;
+    else if (12 == g_cfg.bits)
+        g_model.flag |= TOUPCAM_FLAG_RAW12;
+    else if (14 == g_cfg.bits)
+        g_model.flag |= TOUPCAM_FLAG_RAW14;
+    else if (16 == g_cfg.bits)
+        g_model.flag |= TOUPCAM_FLAG_RAW16;
+    if (g_cfg.mono)
+        g_model.flag |= TOUPCAM_FLAG_MONO;
+    if (g_cfg.af)
+        g_model.flag |= TOUPCAM_FLAG_AUTO_FOCUS;
+    if (0 == g_replay.frames())
+        g_model.flag |= TOUPCAM_FLAG_BINSKIP_SUPPORTED | TOUPCAM_FLAG_CG | TOUPCAM_FLAG_LOW_NOISE;
+    g_model.preview = g_replay.frames() ? 1 : SIM_RESOLUTIONS;
+    g_model.xpixsz = g_model.ypixsz = 2.4f;
+    for (unsigned i = 0; i < g_model.preview; ++i)
+    {
+        g_model.res[i].width = (g_cfg.width >> i) & ~1u;
+        g_model.res[i].height = (g_cfg.height >> i) & ~1u;
+    }
+}
+
+static void initConfig()
+{
+    static std::once_flag once;
+    std::call_once(once, parseConfig);
+}
+
+/* unplug=: the state of sim-0 on the bus */
+static std::mutex g_plugLock;
+static bool g_bFirstStart = true, g_bUnplugged = false;
+static SimClock::time_point g_firstStart, g_backAt;
+static PTOUPCAM_HOTPLUG g_funHotPlug;
+static void* g_ctxHotPlug;
+
+static bool present(unsigned index)
+{
+    std::lock_guard<std::mutex> lock(g_plugLock);
+    return (0 != index) || (!g_bUnplugged) || (SimClock::now() >= g_backAt);
+}
+
+static void hotplug()
+{
+    PTOUPCAM_HOTPLUG fun;
+    void* ctx;
+    {
+        std::lock_guard<std::mutex> lock(g_plugLock);
+        fun = g_funHotPlug;
+        ctx = g_ctxHotPlug;
+    }
+    if (fun)
+        fun(ctx);
+}
+
+/* from the generator of sim-0: true once, when it is time to go away */
+static bool unplugNow()
+{
+    if (g_cfg.unplugFor <= 0)
+        return false;
+    std::lock_guard<std::mutex> lock(g_plugLock);
+    if (g_bUnplugged || g_bFirstStart || (std::chrono::duration<double>(SimClock::now() - g_firstStart).count() < g_cfg.unplugAt))
+        return false;
+    g_bUnplugged = true;
+    g_backAt = SimClock::now() + std::chrono::microseconds((long long)(g_cfg.unplugFor * 1e6));
+    /* the arrival, as the system notifies it */
+    std::thread([] { std::this_thread::sleep_until(g_backAt); hotplug(); }).detach();
+    return true;
+}
+
+/* microseconds between the frames of the recording: the mean, then from frame n to the next (over the loop: the mean) */
+static double replayMean()
+{
+    const unsigned n = g_replay.frames();
+    const ToupcamFrameInfoV4& first = g_replay.record(0)->info;
+    const ToupcamFrameInfoV4& last = g_replay.record(n - 1)->info;
+    if ((n < 2) || !(first.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP) || (last.v3.timestamp <= first.v3.timestamp))
+        return 1e6 / g_cfg.fps;
+    return (double)(last.v3.timestamp - first.v3.timestamp) / (n - 1);
+}
+
+static double replayInterval(unsigned n)
+{
+    if (n + 1 >= g_replay.frames())
+        return replayMean();
+    const ToupcamFrameInfoV4& a = g_replay.record(n)->info;
+    const ToupcamFrameInfoV4& b = g_replay.record(n + 1)->info;
+    if (!(a.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP))
+        return 1e6 / g_cfg.fps;
+    return (b.v3.timestamp > a.v3.timestamp) ? (double)(b.v3.timestamp - a.v3.timestamp) : 0.0;
+}
+
+/* index of the red sample in the 2 x 2 of the bayer pattern, green: the two others, blue: the one opposite */
+static unsigned bayerRed(unsigned fourcc)
+{
+    if (MAKEFOURCC('G', 'R', 'B', 'G') == fourcc)
+        return 1;
+    if (MAKEFOURCC('G', 'B', 'R', 'G') == fourcc)
+        return 2;
+    if (MAKEFOURCC('B', 'G', 'G', 'R') == fourcc)
+        return 3;
+    return 0;
+}
+
+static unsigned xorshift(unsigned& s)
+{
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
+
+/* the scene, RGB planes of SIM_SCENE x SIM_SCENE at every level of blur, shared by the cameras */
+class SimScene {
+    std::vector<unsigned char> m_level[SIM_LEVELS];
+    double m_fv[SIM_LEVELS];        /* mean gradient of G */
+    double m_mean;                  /* mean luma, levels of 8 bits */
+
+    /* smooth noise of period p pixels (a divisor of SIM_SCENE), [0, 1] */
+    static void valueNoise(std::vector<float>& out, unsigned p, float amp, unsigned& seed)
+    {
+        const unsigned n = SIM_SCENE / p;
+        std::vector<float> grid(n * n);
+        for (size_t i = 0; i < grid.size(); ++i)
+            grid[i] = (xorshift(seed) & 0xffff) / 65535.0f;
+        for (unsigned y = 0; y < SIM_SCENE; ++y)
+        {
+            const unsigned gy = y / p, gy1 = (gy + 1) % n;
+            float fy = (float)(y % p) / p;
+            fy = fy * fy * (3 - 2 * fy);
+            for (unsigned x = 0; x < SIM_SCENE; ++x)
+            {
+                const unsigned gx = x / p, gx1 = (gx + 1) % n;
+                float fx = (float)(x % p) / p;
+                fx = fx * fx * (3 - 2 * fx);
+                const float a = grid[gy * n + gx] + (grid[gy * n + gx1] - grid[gy * n + gx]) * fx;
+                const float b = grid[gy1 * n + gx] + (grid[gy1 * n + gx1] - grid[gy1 * n + gx]) * fx;
+                out[(size_t)y * SIM_SCENE + x] += amp * (a + (b - a) * fy);
+            }
+        }
+    }
+
+    /* box blur of radius r along rows (step 1) or columns (step SIM_SCENE) of one plane, wrapping around */
+    static void box(const unsigned char* src, unsigned char* dst, int r, size_t step, size_t next)
+    {
+        const int n = SIM_SCENE, d = 2 * r + 1;
+        for (int line = 0; line < n; ++line)
+        {
+            const unsigned char* s = src + line * next;
+            unsigned char* o = dst + line * next;
+            int sum = 0;
+            for (int i = -r; i <= r; ++i)
+                sum += s[((i + n) % n) * step];
+            for (int i = 0; i < n; ++i)
+            {
+                o[i * step] = (unsigned char)((sum + d / 2) / d);
+                sum += s[((i + r + 1) % n) * step] - s[((i - r + n) % n) * step];
+            }
+        }
+    }
+public:
+    void build(int pattern, unsigned seed)
+    {
+        const size_t area = (size_t)SIM_SCENE * SIM_SCENE;
+        std::vector<unsigned char>& base = m_level[0];
+        base.resize(3 * area);
+        if (SIM_PATTERN_TEXTURE == pattern)
+        {
+            /* octaves of value noise for the grey, a slow tint for the colour */
+            std::vector<float> grey(area, 0.0f), t1(area, 0.0f), t2(area, 0.0f);
+            valueNoise(grey, 256, 0.4f, seed);
+            valueNoise(grey, 64, 0.3f, seed);
+            valueNoise(grey, 16, 0.2f, seed);
+            valueNoise(grey, 4, 0.1f, seed);
+            valueNoise(t1, 512, 1.0f, seed);
+            valueNoise(t2, 512, 1.0f, seed);
+            for (size_t i = 0; i < area; ++i)
+            {
+                const float g = 128 + 1.6f * 255 * (grey[i] - 0.5f);
+                const float r = g * (0.7f + 0.6f * t1[i]), b = g * (0.7f + 0.6f * t2[i]);
+                base[i] = (unsigned char)fminf(fmaxf(r, 0.0f), 255.0f);
+                base[area + i] = (unsigned char)fminf(fmaxf(g, 0.0f), 255.0f);
+                base[2 * area + i] = (unsigned char)fminf(fmaxf(b, 0.0f), 255.0f);
+            }
+        }
+        else
+        {
+            for (unsigned y = 0; y < SIM_SCENE; ++y)
+            {
+                for (unsigned x = 0; x < SIM_SCENE; ++x)
+                {
+                    unsigned char v;
+                    if (SIM_PATTERN_GRID == pattern)
+                        v = (((x & 63) < 2) || ((y & 63) < 2) || (((x & 63) >= 28) && ((x & 63) < 36) && ((y & 63) >= 28) && ((y & 63) < 36))) ? 30 : 220;
+                    else
+                        v = (((x >> 5) ^ (y >> 5)) & 1) ? 215 : 40;
+                    base[(size_t)y * SIM_SCENE + x] = base[area + (size_t)y * SIM_SCENE + x] = base[2 * area + (size_t)y * SIM_SCENE + x] = v;
+                }
+            }
+        }
+
+        std::vector<unsigned char> tmp(area);
+        for (int l = 1; l < SIM_LEVELS; ++l)
+        {
+            m_level[l].resize(3 * area);
+            for (int c = 0; c < 3; ++c)
+            {
+                box(&base[c * area], &tmp[0], g_radius[l], 1, SIM_SCENE);
+                box(&tmp[0], &m_level[l][c * area], g_radius[l], SIM_SCENE, 1);
+            }
+        }
+
+        double sum = 0;
+        for (size_t i = 0; i < area; i += 7)
+            sum += (base[i] + 2 * base[area + i] + base[2 * area + i]) / 4.0;
+        m_mean = sum / ((area + 6) / 7);
+        for (int l = 0; l < SIM_LEVELS; ++l)
+        {
+            const unsigned char* g = &m_level[l][area];
+            double grad = 0;
+            unsigned n = 0;
+            for (unsigned y = 0; y + 1 < SIM_SCENE; y += 3)
+            {
+                for (unsigned x = 0; x + 1 < SIM_SCENE; x += 3, ++n)
+                {
+                    const unsigned char* p = g + (size_t)y * SIM_SCENE + x;
+                    grad += abs(p[1] - p[0]) + abs(p[SIM_SCENE] - p[0]);
+                }
+            }
+            m_fv[l] = grad / n;
+        }
+    }
+
+    /* channel 0 R, 1 G, 2 B */
+    const unsigned char* plane(int level, int c) const { return &m_level[level][(size_t)c * SIM_SCENE * SIM_SCENE]; }
+    double fv(int level) const { return m_fv[level]; }
+    double mean() const { return m_mean; }
+};
+
+static SimScene g_scene;
+
+static void initScene()
+{
+    static std::once_flag once;
+    std::call_once(once, []() { g_scene.build(g_cfg.pattern, g_cfg.seed ? g_cfg.seed : 1); });
+}
+
+/* rows [0, n) split over the threads */
+template<typename F> static void parallelRows(unsigned n, F fn)
+{
+    const unsigned k = (g_cfg.threads < n) ? g_cfg.threads : 1;
+    std::vector<std::thread> th;
+    for (unsigned i = 1; i < k; ++i)
+        th.push_back(std::thread(fn, n * i / k, n * (i + 1) / k));
+    fn(0, n / k);
+    for (size_t i = 0; i < th.size(); ++i)
+        th[i].join();
+}
+
+/* one row of the sensor, the even pixels from the plane p0 of the scene, the odd ones from p1, step pixels of the scene apart */
+template<typename T> static void renderRow(T* out, unsigned w, const unsigned char* p0, const unsigned char* p1, unsigned step, long ox, const int* lut, const short* noise, unsigned n, int maxv)
+{
+    for (unsigned x = 0; x < w; x += 2)
+    {
+        const unsigned s0 = (unsigned)(((long)(x * step) + ox) & (SIM_SCENE - 1));
+        const unsigned s1 = (unsigned)(((long)((x + 1) * step) + ox) & (SIM_SCENE - 1));
+        const int v0 = lut[p0[s0]] + noise[(n + x) & (SIM_NOISE - 1)];
+        const int v1 = lut[p1[s1]] + noise[(n + x + 1) & (SIM_NOISE - 1)];
+        out[x] = (T)((v0 < 0) ? 0 : ((v0 > maxv) ? maxv : v0));
+        out[x + 1] = (T)((v1 < 0) ? 0 : ((v1 > maxv) ? maxv : v1));
+    }
+}
+
+template<typename T, unsigned BPP> static void convertRowT(unsigned char* out, unsigned w, const T* r0, const T* r1, int shift, unsigned red, bool mono, bool bgr)
+{
+    for (unsigned x = 0; x < w; x += 2)
+    {
+        unsigned p[2][3];
+        if (mono)
+        {
+            p[0][0] = p[0][1] = p[0][2] = r0[x] >> shift;
+            p[1][0] = p[1][1] = p[1][2] = r0[x + 1] >> shift;
+        }
+        else
+        {
+            /* nearest: both pixels of the 2 x 2 get its R, mean G and B */
+            const unsigned q[4] = { r0[x], r0[x + 1], r1[x], r1[x + 1] };
+            p[0][0] = p[1][0] = q[red] >> shift;
+            p[0][1] = p[1][1] = ((q[0] + q[1] + q[2] + q[3] - q[red] - q[3 - red]) >> shift) >> 1;
+            p[0][2] = p[1][2] = q[3 - red] >> shift;
+        }
+        for (unsigned j = 0; j < 2; ++j)
+        {
+            unsigned char* o = out + (size_t)(x + j) * BPP;
+            if (1 == BPP)
+                o[0] = (unsigned char)((p[j][0] + 2 * p[j][1] + p[j][2]) >> 2);
+            else
+            {
+                o[0] = (unsigned char)p[j][bgr ? 2 : 0];
+                o[1] = (unsigned char)p[j][1];
+                o[2] = (unsigned char)p[j][bgr ? 0 : 2];
+                if (4 == BPP)
+                    o[3] = 0xff;
+            }
+        }
+    }
+}
+
+/* a row of RGB24, RGB32 or grey 8 (bpp 3, 4, 1) from the RAW rows r0, r1; red: bayerRed() */
+template<typename T> static void convertRow(unsigned char* out, unsigned w, const T* r0, const T* r1, int shift, unsigned red, unsigned bpp, bool mono, bool bgr)
+{
+    if (1 == bpp)
+        convertRowT<T, 1>(out, w, r0, r1, shift, red, mono, bgr);
+    else if (3 == bpp)
+        convertRowT<T, 3>(out, w, r0, r1, shift, red, mono, bgr);
+    else
+        convertRowT<T, 4>(out, w, r0, r1, shift, red, mono, bgr);
+}
+
+struct SimFrame {
+    HugeBuffer data;
+    ToupcamFrameInfoV4 info;
+    int raw;
+    int bits;                       /* RAW: 8, 16; RGB: 24, 32, 8 */
+    unsigned pitch;
+};
+
+/* buffers of a deque: length frames queued at most, the producer and the consumer holding one each on top */
+class SimDeque {
+    std::vector<SimFrame> m_pool;
+    std::vector<SimFrame*> m_free;
+    std::deque<SimFrame*> m_ready;
+    unsigned m_full;
+public:
+    SimDeque() : m_full(0) {}
+
+    void init(unsigned length)
+    {
+        m_pool.clear();
+        m_pool.resize(length + 2);
+        m_free.clear();
+        m_ready.clear();
+        for (size_t i = 0; i < m_pool.size(); ++i)
+        {
+            m_pool[i].data.huge(0 != g_cfg.huge);
+            m_free.push_back(&m_pool[i]);
+        }
+        m_full = 0;
+    }
+
+    /* a buffer to fill: the oldest frame queued is dropped when the deque is full */
+    SimFrame* acquire()
+    {
+        if (m_free.size() <= 1)
+        {
+            if (m_ready.empty())
+                return NULL;
+            m_free.push_back(m_ready.front());
+            m_ready.pop_front();
+            ++m_full;
+        }
+        SimFrame* f = m_free.back();
+        m_free.pop_back();
+        return f;
+    }
+
+    void push(SimFrame* f) { m_ready.push_back(f); }
+    void release(SimFrame* f) { m_free.push_back(f); }
+
+    SimFrame* pop()
+    {
+        if (m_ready.empty())
+            return NULL;
+        SimFrame* f = m_ready.front();
+        m_ready.pop_front();
+        return f;
+    }
+
+    unsigned flush()
+    {
+        const unsigned n = (unsigned)m_ready.size();
+        while (!m_ready.empty())
+        {
+            m_free.push_back(m_ready.front());
+            m_ready.pop_front();
+        }
+        return n;
+    }
+
+    unsigned size() const { return (unsigned)m_ready.size(); }
+    unsigned full() const { return m_full; }
+    bool room() const { return m_free.size() > 1; }     /* acquire() drops nothing */
+};
+
+/* one axis of the stage, micrometres */
+struct SimAxis {
+    double pos, target;
+
+    void update(double dt)
+    {
+        const double d = target - pos, step = g_cfg.speed * dt;
+        pos = ((g_cfg.speed <= 0) || (fabs(d) <= step)) ? target : pos + ((d > 0) ? step : -step);
+    }
+};
+
+class SimCamera : public Toupcam_t {
+public:
+    unsigned m_index;
+    unsigned m_res;
+    int m_raw, m_bitdepth, m_rgb, m_trigger, m_framerate, m_precise, m_testpattern, m_byteorder;
+    int m_frontLength, m_backLength, m_noframeTimeout, m_callbackThread, m_hwMaster, m_hwMask;
+    int m_noise;                    /* 1/100 of a level of 8 bits */
+    int m_mode;                     /* Toupcam_put_Mode: 0 bin, 1 skip */
+    unsigned m_hwBin, m_hwMethod;   /* Toupcam_put_Binning: n x n, SIM_BIN_AVERAGE, _ADD, _SKIP */
+    int m_swBin;                    /* TOUPCAM_OPTION_BINNING */
+    int m_cg, m_lowNoise;
+    int m_readoutMode, m_globalReset, m_triggerCancel;
+    SimClock::time_point m_ready;   /* the sensor can start the next triggered frame */
+    SimClock::time_point m_trigReady;   /* the trigger input takes the next one, trigdrop=1 */
+    unsigned m_triggerLost;
+    unsigned m_expoTime;
+    unsigned short m_expoGain;
+    std::deque<std::pair<unsigned, unsigned short> > m_expoPipe;   /* of the generator: expolag frames old, at the front */
+    int m_aeEnable, m_aeThreshold;
+    unsigned short m_aeTarget;
+    unsigned m_aeMaxTime, m_aeMinTime;
+    unsigned short m_aeMaxGain, m_aeMinGain;
+    unsigned m_aeFrames;
+    SimAxis m_axis[3];
+    SimClock::time_point m_stageTime;
+
+    std::mutex m_lock;
+    std::condition_variable m_genCond, m_pipeCond, m_pullCond;
+    std::mutex m_cbLock;
+    PTOUPCAM_EVENT_CALLBACK m_funEvent;
+    void* m_ctxEvent;
+    std::thread m_gen, m_pipe;
+    bool m_running, m_paused, m_stopping, m_unplugged;
+    int m_histMode;                         /* TOUPCAM_OPTION_HISTOGRAM */
+    PITOUPCAM_HISTOGRAM_CALLBACKV2 m_funHist;   /* NULL: no histogram wanted */
+    void* m_ctxHist;
+    int m_uartEnable, m_uartBaud, m_uartLineMode;
+    std::string m_uartIn, m_uartOut;        /* the Marlin of the UART: the partial line, the answers not read yet */
+    std::deque<std::string> m_uartLines;    /* received, not answered yet */
+    unsigned m_triggers, m_tricount;
+    SimDeque m_front, m_back;
+    unsigned m_seq, m_generated, m_rateFrames;
+    unsigned m_replayPos, m_replayLoop;    /* next frame of the recording, times it went round */
+    SimClock::time_point m_start, m_rateStart;
+    SimClock::time_point m_stampStart;  /* timestamp 0 */
+    int m_resetSeqStamp;                /* TOUPCAM_OPTION_RESET_SEQ_TIMESTAMP, at the next frame */
+    std::vector<short> m_noiseTable;    /* of the generator */
+    int m_noiseBuilt;
+
+    explicit SimCamera(unsigned index)
+    : m_index(index), m_res(0), m_raw(0), m_bitdepth((g_replay.frames() && (g_cfg.bits > 8)) ? 1 : 0), m_rgb(0), m_trigger(0), m_framerate(0), m_precise(0), m_testpattern(0),
+#if defined(_WIN32)
+      m_byteorder(1),
+#else
+      m_byteorder(0),
+#endif
+      m_frontLength(4), m_backLength(3), m_noframeTimeout(0), m_callbackThread(0), m_hwMaster(0), m_hwMask(0xff),
+      m_noise((int)(g_cfg.noise * 100 + 0.5)), m_mode(0), m_hwBin(1), m_hwMethod(SIM_BIN_AVERAGE), m_swBin(1), m_cg(0), m_lowNoise(0),
+      m_readoutMode(0), m_globalReset(0), m_triggerCancel(0), m_ready(SimClock::now()), m_trigReady(m_ready), m_triggerLost(0), m_expoTime(SIM_EXPO_REF), m_expoGain(TOUPCAM_EXPOGAIN_DEF),
+      m_aeEnable(0), m_aeThreshold(TOUPCAM_AUTOEXPO_THRESHOLD_DEF), m_aeTarget(TOUPCAM_AETARGET_DEF),
+      m_aeMaxTime(SIM_AE_MAX_TIME), m_aeMinTime(SIM_EXPO_MIN), m_aeMaxGain(SIM_AE_MAX_GAIN), m_aeMinGain(TOUPCAM_EXPOGAIN_MIN), m_aeFrames(0),
+      m_stageTime(SimClock::now()), m_funEvent(NULL), m_ctxEvent(NULL), m_running(false), m_paused(false), m_stopping(false), m_unplugged(false),
+      m_histMode(0), m_funHist(NULL), m_ctxHist(NULL), m_uartEnable(0), m_uartBaud(4), m_uartLineMode(0), m_triggers(0), m_tricount(0), m_seq(0), m_generated(0), m_rateFrames(0), m_replayPos(0), m_replayLoop(0), m_resetSeqStamp(0), m_noiseBuilt(-1)
+    {
+        memset(m_axis, 0, sizeof(m_axis));
+    }
+
+    /* binned by the sensor (Toupcam_put_Binning) and by the SDK (TOUPCAM_OPTION_BINNING), rounded down to even */
+    unsigned width() const { return (g_model.res[m_res].width / (m_hwBin * swBin())) & ~1u; }
+    unsigned height() const { return (g_model.res[m_res].height / (m_hwBin * swBin())) & ~1u; }
+    unsigned swBin() const { return m_swBin & 0x0f; }
+    /* pixels of the scene from one pixel of the frame to the next */
+    unsigned step() const { return (1u << m_res) * m_hwBin * swBin(); }
+    /* of the signal: the binning Add sums n x n pixels, so does the saturating add of the SDK */
+    unsigned signalGain() const { return ((SIM_BIN_ADD == m_hwMethod) ? m_hwBin * m_hwBin : 1) * ((m_swBin & 0x80) ? 1 : swBin() * swBin()); }
+
+    /* of a pixel of the frame, 1/100 of a level of 8 bits, m_lock held (TOUPCAM_OPTION_CG changes while running) */
+    int pixelNoise() const
+    {
+        double n = m_noise;
+        if (0 == m_mode)
+            n /= (1 << m_res);  /* the bin mode averages 2^k x 2^k pixels into one */
+        if (SIM_BIN_AVERAGE == m_hwMethod)
+            n /= m_hwBin;
+        else if (SIM_BIN_ADD == m_hwMethod)
+            n *= m_hwBin;
+        n = (m_swBin & 0x80) ? (n / swBin()) : (n * swBin());
+        if (1 == m_cg)
+            n *= SIM_HCG_NOISE;
+        if (m_lowNoise)
+            n *= SIM_LOW_NOISE;
+        return (int)(n + 0.5);
+    }
+    int rawBits() const { return (m_bitdepth && (g_cfg.bits > 8)) ? g_cfg.bits : 8; }
+
+    /* the bits of the backend, which are the default of a pull */
+    int outBits() const
+    {
+        if (m_raw)
+            return (rawBits() > 8) ? 16 : 8;
+        return (2 == m_rgb) ? 32 : ((3 == m_rgb) ? 8 : 24);
+    }
+
+    /* m_lock held */
+    void updateStage()
+    {
+        const SimClock::time_point now = SimClock::now();
+        const double dt = std::chrono::duration<double>(now - m_stageTime).count();
+        m_stageTime = now;
+        for (int i = 0; i < 3; ++i)
+            m_axis[i].update(dt);
+    }
+
+    bool moving() const
+    {
+        return (m_axis[0].pos != m_axis[0].target) || (m_axis[1].pos != m_axis[1].target) || (m_axis[2].pos != m_axis[2].target);
+    }
+
+    /*
+        m_lock held: the answers of the lines received, in order, as far as the stage allows. A planner of one move: a
+        G0 / G1 / G28 waits for the move before it to end, M400 for the stage to stop, then "ok"
+    */
+    void marlin()
+    {
+        updateStage();
+        while (!m_uartLines.empty())
+        {
+            const std::string& l = m_uartLines.front();
+            const bool bMove = ('G' == l[0]) && ((1 == atoi(l.c_str() + 1)) || (0 == atoi(l.c_str() + 1)) || (28 == atoi(l.c_str() + 1)));
+            if ((bMove || (0 == l.compare(0, 4, "M400"))) && moving())
+                break;
+            if (bMove)
+            {
+                static const char axis[] = "XYZ";
+                const bool bHome = (28 == atoi(l.c_str() + 1));
+                for (int i = 0; i < 3; ++i)
+                {
+                    const char* p = strchr(l.c_str(), axis[i]);
+                    if (p || bHome)
+                    {
+                        m_axis[i].target = (p && (!bHome)) ? atof(p + 1) * 1000 : 0;  /* mm */
+                        if (g_cfg.speed <= 0)
+                            m_axis[i].pos = m_axis[i].target;
+                    }
+                }
+            }
+            else if (0 == l.compare(0, 4, "M114"))
+            {
+                char str[128];
+                snprintf(str, sizeof(str), "X:%.3f Y:%.3f Z:%.3f E:0.000 Count X:0 Y:0 Z:0\n", m_axis[0].pos / 1000, m_axis[1].pos / 1000, m_axis[2].pos / 1000);
+                m_uartOut += str;
+            }
+            m_uartOut += "ok\n";
+            m_uartLines.pop_front();
+        }
+    }
+
+    void fire(unsigned nEvent)
+    {
+        std::lock_guard<std::mutex> lock(m_cbLock);
+        if (m_funEvent)
+            m_funEvent(nEvent, m_ctxEvent);
+    }
+
+    /* replay at rate 0: the deques wait for room instead of dropping, every frame of the recording is delivered */
+    static bool lossless() { return g_replay.frames() && (g_cfg.rate <= 0); }
+
+    /* m_lock held */
+    bool hardwareEvent(unsigned nEvent) const
+    {
+        return m_hwMaster && (m_hwMask & (1 << (nEvent & 0x0f)));
+    }
+
+    unsigned rowsRead() const { return (m_mode ? g_model.res[m_res].height : g_model.res[0].height) / m_hwBin; }
+
+    double readout() const  /* seconds */
+    {
+        /* fps is the one of the whole sensor: the readout is as long as the rows read */
+        return rowsRead() / (g_cfg.fps * g_model.res[0].height * (m_lowNoise ? SIM_LOW_NOISE_RATE : 1.0));
+    }
+
+    /* from one frame start to the next the sensor can do, seconds: IWR overlaps the exposure with the readout */
+    double sensorPeriod(unsigned expoTime) const
+    {
+        return (m_readoutMode || m_globalReset) ? (readout() + expoTime / 1e6) : fmax(readout(), expoTime / 1e6);
+    }
+
+    double period() const  /* seconds */
+    {
+        double per = sensorPeriod(m_expoTime);
+        if (m_framerate > 0)
+            per = fmax(per, 1.0 / m_framerate);
+        if (m_precise > 0)
+            per = fmax(per, 10.0 / m_precise);
+        return per;
+    }
+
+    void buildNoise(int bits, int noise)
+    {
+        const double sigma = noise / 100.0 * ((bits > 8) ? 16 : 1);
+        unsigned s = (g_cfg.seed ? g_cfg.seed : 1) * 2654435761u + m_index;
+        m_noiseTable.resize(SIM_NOISE);
+        for (unsigned i = 0; i < SIM_NOISE; ++i)
+        {
+            /* Box-Muller */
+            const double u1 = ((xorshift(s) & 0xffffff) + 1) / 16777217.0, u2 = (xorshift(s) & 0xffffff) / 16777216.0;
+            m_noiseTable[i] = (short)floor(sigma * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2) + 0.5);
+        }
+        m_noiseBuilt = noise * 100 + bits;
+    }
+
+    /* the RAW frame of the sensor and its frame info, RGGB or mono, 8 bits or 12 bits in 16 */
+    void render(SimFrame* f, int bits, int noise, int level, long ox, long oy, unsigned short gain, unsigned expoTime, int testpattern, unsigned long long stamp)
+    {
+        const unsigned w = width(), h = height(), k = step();
+        const int maxv = (bits > 8) ? 4095 : 255;
+        const unsigned bpp = (bits > 8) ? 2 : 1;
+        f->raw = 1;
+        f->bits = (bits > 8) ? 16 : 8;
+        f->pitch = w * bpp;
+        f->data.resize((size_t)f->pitch * h);
+        if (m_noiseBuilt != noise * 100 + bits)
+            buildNoise(bits, noise);
+
+        int lut[256];
+        const double scale = (double)expoTime * gain / (SIM_EXPO_REF * 100.0) * maxv / 255.0 * signalGain();
+        for (int i = 0; i < 256; ++i)
+            lut[i] = (int)(i * scale + 0.5);
+        const unsigned seq = m_seq;
+        unsigned nseed = seq * 2246822519u + 1;
+        const unsigned nbase = xorshift(nseed);
+        const short* table = &m_noiseTable[0];
+        const int mono = g_cfg.mono;
+
+        parallelRows(h, [&](unsigned y0, unsigned y1) {
+            for (unsigned y = y0; y < y1; ++y)
+            {
+                unsigned char* row = &f->data[(size_t)y * f->pitch];
+                const unsigned sy = (unsigned)(((long)(y * k) + oy) & (SIM_SCENE - 1));
+                /* RGGB: R G on the even rows, G B on the odd ones */
+                const int c0 = mono ? 1 : ((y & 1) ? 1 : 0), c1 = mono ? 1 : ((y & 1) ? 2 : 1);
+                const unsigned char* p0 = g_scene.plane(level, c0) + (size_t)sy * SIM_SCENE;
+                const unsigned char* p1 = g_scene.plane(level, c1) + (size_t)sy * SIM_SCENE;
+                const unsigned nrow = nbase + y * 40503u;
+                if (testpattern)
+                {
+                    /* 3: diagonal, 5: vertical, 7: horizontal stripes, 9: chromatic diagonal */
+                    for (unsigned x = 0; x < w; ++x)
+                    {
+                        const unsigned t = (7 == testpattern) ? y : ((5 == testpattern) ? x : x + y);
+                        int v = lut[((9 == testpattern) && !mono) ? ((t + 85 * (((y & 1) << 1) | (x & 1))) & 0xff) : ((t + seq * 2) & 0xff)];
+                        v += table[(nrow + x) & (SIM_NOISE - 1)];
+                        v = (v < 0) ? 0 : ((v > maxv) ? maxv : v);
+                        if (2 == bpp)
+                            ((unsigned short*)row)[x] = (unsigned short)v;
+                        else
+                            row[x] = (unsigned char)v;
+                    }
+                }
+                else if (2 == bpp)
+                    renderRow((unsigned short*)row, w, p0, p1, k, ox, lut, table, nrow, maxv);
+                else
+                    renderRow(row, w, p0, p1, k, ox, lut, table, nrow, maxv);
+            }
+        });
+
+        ToupcamFrameInfoV4& info = f->info;
+        memset(&info, 0, sizeof(info));
+        info.v3.width = width();
+        info.v3.height = height();
+        info.v3.flag = TOUPCAM_FRAMEINFO_FLAG_SEQ | TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP | TOUPCAM_FRAMEINFO_FLAG_EXPOTIME | TOUPCAM_FRAMEINFO_FLAG_EXPOGAIN | TOUPCAM_FRAMEINFO_FLAG_COUNT;
+        info.v3.seq = m_seq;
+        info.v3.timestamp = stamp;
+        info.v3.expotime = expoTime;
+        info.v3.expogain = gain;
+        info.timecount = info.v3.timestamp;
+        info.framecount = m_seq;
+        info.tricount = m_tricount;
+        if (g_cfg.af)
+        {
+            info.v3.flag |= TOUPCAM_FRAMEINFO_FLAG_AUTOFOCUS;
+            info.uLum = (unsigned)fmin(255.0, g_scene.mean() * expoTime * gain / (SIM_EXPO_REF * 100.0));
+            info.uFV = (unsigned long long)(g_scene.fv(level) * info.v3.width * info.v3.height / 16);
+        }
+    }
+
+    /* RAW to the RGB bits of the backend (24, 32 or 8) */
+    void convert(const SimFrame* f, SimFrame* b, int bits)
+    {
+        const unsigned w = width(), h = height();
+        const unsigned bpp = bits / 8;
+        const int shift = (16 == f->bits) ? rawBits() - 8 : 0;
+        const unsigned red = bayerRed(g_fourcc);
+        const bool bgr = (0 != m_byteorder);
+        const int mono = g_cfg.mono;
+        b->raw = 0;
+        b->bits = bits;
+        b->pitch = (32 == bits) ? w * 4 : TDIBWIDTHBYTES(bits * w);
+        b->data.resize((size_t)b->pitch * h);
+        const unsigned char* src = &f->data[0];
+        parallelRows(h, [&](unsigned y0, unsigned y1) {
+            for (unsigned y = y0; y < y1; ++y)
+            {
+                unsigned char* out = &b->data[(size_t)y * b->pitch];
+                /* mono: the row itself; bayer: the two rows of the 2 x 2 it is in */
+                const size_t i0 = (size_t)(mono ? y : (y & ~1u)) * w, i1 = mono ? i0 : i0 + w;
+                if (16 == f->bits)
+                    convertRow(out, w, (const unsigned short*)src + i0, (const unsigned short*)src + i1, shift, red, bpp, mono, bgr);
+                else
+                    convertRow(out, w, src + i0, src + i1, shift, red, bpp, mono, bgr);
+            }
+        });
+    }
+
+    /* mean of the RAW frame on the scale of 8 bits */
+    static double rawMean(const SimFrame* f, unsigned w, unsigned h, int bits)
+    {
+        double sum = 0;
+        unsigned n = 0;
+        for (unsigned y = 0; y < h; y += 16)
+        {
+            for (unsigned x = 0; x < w; x += 15, ++n)
+            {
+                const size_t i = (size_t)y * w + x;
+                sum += (16 == f->bits) ? ((const unsigned short*)&f->data[0])[i] / (double)(1 << (bits - 8)) : f->data[i];
+            }
+        }
+        return n ? sum / n : 0;
+    }
+
+    /* of the RAW frame, 8 bits: 256 bins, R, G, B one after another (mono: one channel), every 4th 2 x 2 cell */
+    static void rawHistogram(const SimFrame* f, unsigned w, unsigned h, int bits, unsigned* hist)
+    {
+        const unsigned red = bayerRed(g_fourcc);
+        const int shift = (16 == f->bits) ? bits - 8 : 0;
+        memset(hist, 0, sizeof(unsigned) * 256 * (g_cfg.mono ? 1 : 3));
+        for (unsigned y = 0; y + 1 < h; y += 8)
+        {
+            for (unsigned x = 0; x + 1 < w; x += 8)
+            {
+                unsigned q[4];
+                for (unsigned k = 0; k < 4; ++k)
+                {
+                    const size_t i = (size_t)(y + (k >> 1)) * w + x + (k & 1);
+                    const unsigned v = (16 == f->bits) ? (((const unsigned short*)&f->data[0])[i] >> shift) : f->data[i];
+                    q[k] = (v > 255) ? 255 : v;
+                }
+                if (g_cfg.mono)
+                {
+                    for (unsigned k = 0; k < 4; ++k)
+                        ++hist[q[k]];
+                }
+                else
+                {
+                    ++hist[q[red]];
+                    ++hist[512 + q[3 - red]];
+                    for (unsigned k = 0; k < 4; ++k)
+                    {
+                        if ((k != red) && (k != 3 - red))
+                            ++hist[256 + q[k]];
+                    }
+                }
+            }
+        }
+    }
+
+    /* one step of the auto exposure from the mean of the frame, m_lock held */
+    unsigned autoExposure(double mean)
+    {
+        if (0 == m_aeEnable)
+            return 0;
+        ++m_aeFrames;
+        if (fabs(mean - m_aeTarget) <= m_aeThreshold)
+        {
+            if (2 == m_aeEnable)
+            {
+                m_aeEnable = 0;
+                return TOUPCAM_EVENT_AUTOEXPO_CONV;
+            }
+            return 0;
+        }
+        if ((2 == m_aeEnable) && (m_aeFrames > SIM_AE_ONCE_FRAMES))
+        {
+            m_aeEnable = 0;
+            return TOUPCAM_EVENT_AUTOEXPO_CONVFAIL;
+        }
+        /* damped: ratio^0.7, at most 4x a step; time first, then gain */
+        const double ratio = fmin(fmax(pow(m_aeTarget / fmax(mean, 0.5), 0.7), 0.25), 4.0);
+        const double product = (double)m_expoTime * m_expoGain * ratio;
+        double t = product / m_aeMinGain;
+        unsigned short g = m_aeMinGain;
+        if (t > m_aeMaxTime)
+        {
+            t = m_aeMaxTime;
+            g = (unsigned short)fmin((double)m_aeMaxGain, floor(product / m_aeMaxTime + 0.5));
+        }
+        else if (t < m_aeMinTime)
+            t = m_aeMinTime;
+        if (((unsigned)(t + 0.5) == m_expoTime) && (g == m_expoGain))
+            return 0;
+        m_expoTime = (unsigned)(t + 0.5);
+        m_expoGain = g;
+        return TOUPCAM_EVENT_EXPOSURE;
+    }
+
+    void generator()
+    {
+        SimClock::time_point next = SimClock::now();
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            /* a recording played without loop=1 stops at its end, until SIMCAM_OPTION_REPLAY_POS rewinds it */
+            m_genCond.wait(lock, [this]() { return m_stopping || (!m_paused && ((0 == m_trigger) || m_triggers) && (g_cfg.loop || (m_replayPos < g_replay.frames()) || (0 == g_replay.frames())) && (!lossless() || m_front.room())); });
+            if (m_stopping)
+                break;
+            const bool triggered = (0 != m_trigger);
+            if (triggered)
+            {
+                /* the sensor busy with the frame before */
+                if (m_genCond.wait_until(lock, m_ready, [this]() { return m_stopping || m_paused || (0 == m_triggers); }))
+                    continue;
+                if (0xffff != m_triggers)
+                    --m_triggers;
+                ++m_tricount;
+            }
+            const bool replaying = (0 != g_replay.frames());
+            unsigned replayIndex = 0, replayLoop = 0;
+            double per;
+            unsigned expoTime = 0;
+            if (replaying)
+            {
+                if (m_replayPos >= g_replay.frames())
+                {
+                    m_replayPos = 0;
+                    ++m_replayLoop;
+                }
+                replayIndex = m_replayPos++;
+                replayLoop = m_replayLoop;
+                /* the intervals of the recording over the rate, rate 0: as fast as the pipeline goes */
+                per = (g_cfg.rate > 0) ? replayInterval(replayIndex) / 1e6 / g_cfg.rate : 0.0;
+                expoTime = (g_cfg.rate > 0) ? (unsigned)(g_replay.record(replayIndex)->info.v3.expotime / g_cfg.rate) : 0;
+            }
+            else
+                per = period();
+            const bool expoStart = hardwareEvent(TOUPCAM_EVENT_EXPO_START), expoStop = hardwareEvent(TOUPCAM_EVENT_EXPO_STOP);
+            if (!triggered)
+            {
+                /* Stop and Pause break the wait */
+                if (m_genCond.wait_until(lock, next, [this]() { return m_stopping || m_paused; }))
+                    continue;
+            }
+            if ((0 == m_index) && unplugNow())
+            {
+                m_unplugged = true;
+                lock.unlock();
+                fire(TOUPCAM_EVENT_DISCONNECTED);
+                hotplug();
+                lock.lock();
+                m_genCond.wait(lock, [this]() { return m_stopping; });
+                break;
+            }
+            /* the registers latched at the frame start, used expolag frames later */
+            m_expoPipe.push_back(std::make_pair(m_expoTime, m_expoGain));
+            while (m_expoPipe.size() > g_cfg.expoLag + 1)
+                m_expoPipe.pop_front();
+            if (!replaying)
+                expoTime = m_expoPipe.front().first;
+            const unsigned short expoGain = m_expoPipe.front().second;
+            const SimClock::time_point t0 = SimClock::now();
+            m_ready = t0 + std::chrono::microseconds((long long)(sensorPeriod(expoTime) * 1e6));
+            if (m_resetSeqStamp & 1)
+                m_seq = 0;
+            if (m_resetSeqStamp & 2)
+                m_stampStart = t0;
+            m_resetSeqStamp = 0;
+            /* at the end of the exposure, on a clock of its own */
+            const unsigned long long stamp = (unsigned long long)((std::chrono::duration<double, std::micro>(t0 - m_stampStart).count() + expoTime) * (1.0 + g_cfg.clockPpm * (m_index + 1) * 1e-6));
+            lock.unlock();
+
+            if (expoStart)
+                fire(TOUPCAM_EVENT_EXPO_START);
+            std::this_thread::sleep_until(t0 + std::chrono::microseconds(expoTime));
+            if (expoStop)
+                fire(TOUPCAM_EVENT_EXPO_STOP);
+
+            lock.lock();
+            if (m_stopping)
+                break;
+            updateStage();
+            const double t = std::chrono::duration<double>(t0 - m_start).count() + expoTime / 2e6;
+            double z = m_axis[2].pos;
+            if (g_cfg.focusPeriod > 0)
+                z += g_cfg.focusAmp * sin(2 * M_PI * t / g_cfg.focusPeriod);
+            const int level = (int)fmin(SIM_LEVELS - 1, floor(fabs(z) / g_cfg.dof + 0.5));
+            const long ox = (long)floor(m_axis[0].pos / g_cfg.umpx + g_cfg.vx * t + 0.5);
+            const long oy = (long)floor(m_axis[1].pos / g_cfg.umpx + g_cfg.vy * t + 0.5);
+            const int bits = rawBits(), noise = pixelNoise(), testpattern = m_testpattern;
+            SimFrame* f = m_front.acquire();
+            lock.unlock();
+            if (NULL == f)
+                continue;
+
+            if (replaying)
+                replay(f, replayIndex, replayLoop);
+            else
+                render(f, bits, noise, level, ox, oy, expoGain, expoTime, testpattern, stamp);
+
+            lock.lock();
+            ++m_seq;
+            ++m_generated;
+            m_front.push(f);
+            m_pipeCond.notify_one();
+            lock.unlock();
+
+            next = t0 + std::chrono::microseconds((long long)(per * 1e6));
+            if (next < SimClock::now())
+                next = SimClock::now();
+        }
+    }
+
+    /* frame n of the recording, as recorded but for seq and timestamp, which go on over the loops */
+    void replay(SimFrame* f, unsigned n, unsigned loop)
+    {
+        const RawSeqHeader& header = g_replay.header();
+        const ToupcamFrameInfoV4* pInfo = NULL;
+        const void* data = g_replay.frame(n, &pInfo);
+        const unsigned bpp = (header.bitdepth > 8) ? 2 : 1;
+        f->raw = 1;
+        f->bits = 8 * bpp;
+        f->pitch = header.width * bpp;
+        f->data.resize((size_t)f->pitch * header.height);
+        const size_t length = g_replay.record(n)->length;
+        if (header.compression)
+        {
+            if (NULL == g_replay.frame16(n, (unsigned short*)&f->data[0], NULL, g_replayCodec))
+                memset(&f->data[0], 0, f->data.size());     /* damaged */
+        }
+        else if (header.packing)
+            RawUnpackRows((unsigned short*)&f->data[0], data, header.width, 0, header.height, header.packing);
+        else
+            memcpy(&f->data[0], data, (length < f->data.size()) ? length : f->data.size());
+        f->info = *pInfo;
+        if (loop)
+        {
+            f->info.v3.seq += loop * g_replay.frames();
+            const ToupcamFrameInfoV4& first = g_replay.record(0)->info;
+            const ToupcamFrameInfoV4& last = g_replay.record(g_replay.frames() - 1)->info;
+            f->info.v3.timestamp += loop * (unsigned long long)(last.v3.timestamp - first.v3.timestamp + replayMean());
+        }
+        g_replay.willneed(n + 1, SIM_REPLAY_AHEAD);
+    }
+
+    void pipeline()
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_pipeCond.wait(lock, [this]() { return m_stopping || (m_front.size() && (!lossless() || m_back.room())); });
+            if (m_stopping)
+                break;
+            SimFrame* f = m_front.pop();
+            SimFrame* b = m_back.acquire();
+            const int raw = m_raw, bits = outBits();
+            PITOUPCAM_HISTOGRAM_CALLBACKV2 funHist = m_funHist;
+            void* ctxHist = m_ctxHist;
+            if (0 == m_histMode)
+                m_funHist = NULL;   /* one only */
+            lock.unlock();
+
+            const double mean = rawMean(f, width(), height(), rawBits());
+            if (funHist)
+            {
+                unsigned hist[256 * 3];
+                rawHistogram(f, width(), height(), rawBits(), hist);
+                funHist(hist, 8 | (g_cfg.mono ? 0x00008000 : 0), ctxHist);
+            }
+            if (raw)
+            {
+                /* nothing to do but hand the buffer over */
+                b->data.swap(f->data);
+                b->raw = 1;
+                b->bits = f->bits;
+                b->pitch = f->pitch;
+            }
+            else
+                convert(f, b, bits);
+            b->info = f->info;
+
+            lock.lock();
+            const unsigned ae = autoExposure(mean);
+            m_front.release(f);
+            m_back.push(b);
+            ++m_rateFrames;
+            lock.unlock();
+            m_genCond.notify_all();
+            m_pullCond.notify_all();
+            if (ae)
+                fire(ae);
+            fire(TOUPCAM_EVENT_IMAGE);
+        }
+    }
+
+    HRESULT start(PTOUPCAM_EVENT_CALLBACK funEvent, void* ctxEvent)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_running)
+            return E_BUSY;
+        m_funEvent = funEvent;
+        m_ctxEvent = ctxEvent;
+        m_front.init(m_frontLength);
+        m_back.init(m_backLength);
+        m_stopping = m_paused = false;
+        m_seq = m_generated = m_rateFrames = 0;
+        m_expoPipe.clear();
+        m_triggers = m_tricount = m_triggerLost = 0;
+        m_ready = m_trigReady = SimClock::now();
+        m_start = m_rateStart = m_stampStart = SimClock::now();
+        m_resetSeqStamp = 0;
+        m_running = true;
+        if (0 == m_index)
+        {
+            std::lock_guard<std::mutex> plug(g_plugLock);
+            if (g_bFirstStart)
+                g_firstStart = m_start;
+            g_bFirstStart = false;
+        }
+        m_gen = std::thread(&SimCamera::generator, this);
+        m_pipe = std::thread(&SimCamera::pipeline, this);
+        return S_OK;
+    }
+
+    HRESULT stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_running)
+                return S_FALSE;
+            if ((std::this_thread::get_id() == m_gen.get_id()) || (std::this_thread::get_id() == m_pipe.get_id()))
+                return E_WRONG_THREAD;
+            m_stopping = true;
+        }
+        m_genCond.notify_all();
+        m_pipeCond.notify_all();
+        m_pullCond.notify_all();
+        m_gen.join();
+        m_pipe.join();
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_running = false;
+        m_funEvent = NULL;
+        return S_OK;
+    }
+
+    /* m_lock held by the caller through lock; nWaitMS 0: no wait */
+    HRESULT pull(std::unique_lock<std::mutex>& lock, unsigned nWaitMS, void* pImageData, int bits, int rowPitch, ToupcamFrameInfoV4* pInfo)
+    {
+        if (!m_running)
+            return E_UNEXPECTED;
+        if (nWaitMS && (0 == m_back.size()))
+        {
+            const auto ready = [this]() { return m_stopping || m_back.size(); };
+            if (0xffffffff == nWaitMS)
+                m_pullCond.wait(lock, ready);
+            else
+                m_pullCond.wait_for(lock, std::chrono::milliseconds(nWaitMS), ready);
+            if (m_stopping)
+                return E_UNEXPECTED;
+        }
+        if (m_unplugged)
+            return E_UNEXPECTED;
+        SimFrame* b = m_back.pop();
+        if (NULL == b)
+            return nWaitMS ? E_TIMEOUT : E_PENDING;
+        if (pInfo)
+            *pInfo = b->info;
+        HRESULT hr = S_OK;
+        if (pImageData)
+        {
+            lock.unlock();
+            hr = copyOut(b, pImageData, bits, rowPitch);
+            lock.lock();
+        }
+        m_back.release(b);
+        m_pipeCond.notify_one();
+        return hr;
+    }
+
+    /* a frame of the backend into the buffer of the caller */
+    HRESULT copyOut(const SimFrame* b, void* pImageData, int bits, int rowPitch) const
+    {
+        const unsigned w = b->info.v3.width, h = b->info.v3.height;
+        if (b->raw || (0 == bits))
+            bits = b->bits;     /* ignored in RAW mode */
+        else if ((8 != bits) && (24 != bits) && (32 != bits))
+            return E_INVALIDARG;
+        const unsigned dbpp = bits / 8, sbpp = b->bits / 8;
+        size_t pitch;
+        if (rowPitch > 0)
+            pitch = rowPitch;
+        else if ((rowPitch < 0) || b->raw || (32 == bits))
+            pitch = (size_t)w * dbpp;
+        else
+            pitch = TDIBWIDTHBYTES(bits * w);
+        if (pitch < (size_t)w * dbpp)
+            return E_INVALIDARG;
+
+        unsigned char* dst = (unsigned char*)pImageData;
+        if (bits == b->bits)
+        {
+            for (unsigned y = 0; y < h; ++y)
+                memcpy(dst + y * pitch, &b->data[(size_t)y * b->pitch], (size_t)w * dbpp);
+            return S_OK;
+        }
+        for (unsigned y = 0; y < h; ++y)
+        {
+            const unsigned char* s = &b->data[(size_t)y * b->pitch];
+            unsigned char* d = dst + y * pitch;
+            for (unsigned x = 0; x < w; ++x, s += sbpp, d += dbpp)
+            {
+                if (8 == bits)
+                    d[0] = (unsigned char)((s[0] + 2 * s[1] + s[2]) >> 2);  /* R and B weigh the same: any byte order */
+                else if (8 == b->bits)
+                {
+                    d[0] = d[1] = d[2] = s[0];
+                    if (4 == dbpp)
+                        d[3] = 0xff;
+                }
+                else
+                {
+                    d[0] = s[0];
+                    d[1] = s[1];
+                    d[2] = s[2];
+                    if (4 == dbpp)
+                        d[3] = 0xff;
+                }
+            }
+        }
+        return S_OK;
+    }
+};
+
+static std::mutex g_openLock;
+static SimCamera* g_open[TOUPCAM_MAX];
+
+static SimCamera* cam(HToupcam h)
+{
+    return static_cast<SimCamera*>(h);
+}
+
+static const char* g_version = "59.29030.20250722.sim";
+
+const char* Toupcam_Version()
+{
+    return g_version;
+}
+
+unsigned Toupcam_EnumV2(ToupcamDeviceV2 arr[TOUPCAM_MAX])
+{
+    initConfig();
+    unsigned n = 0;
+    for (unsigned i = 0; i < g_cfg.count; ++i)
+    {
+        if (!present(i))
+            continue;
+        if (arr)
+        {
+            memset(&arr[n], 0, sizeof(arr[n]));
+            snprintf(arr[n].displayname, sizeof(arr[n].displayname), "%s", g_modelName);
+            snprintf(arr[n].id, sizeof(arr[n].id), "sim-%u", i);
+            arr[n].model = &g_model;
+        }
+        ++n;
+    }
+    return n;
+}
+
+void Toupcam_HotPlug(PTOUPCAM_HOTPLUG funHotPlug, void* ctxHotPlug)
+{
+    std::lock_guard<std::mutex> lock(g_plugLock);
+    g_funHotPlug = funHotPlug;
+    g_ctxHotPlug = ctxHotPlug;
+}
+
+unsigned Toupcam_EnumWithName(ToupcamDeviceV2 pti[TOUPCAM_MAX])
+{
+    return Toupcam_EnumV2(pti);
+}
+
+HToupcam Toupcam_OpenByIndex(unsigned index)
+{
+    initConfig();
+    if ((index >= g_cfg.count) || (!present(index)))
+        return NULL;
+    std::lock_guard<std::mutex> lock(g_openLock);
+    if (g_open[index])
+        return NULL;    /* in use */
+    initScene();
+    g_open[index] = new SimCamera(index);
+    return g_open[index];
+}
+
+HToupcam Toupcam_Open(const char* camId)
+{
+    initConfig();
+    unsigned index = 0;
+    if (camId && camId[0])
+    {
+        /* all the cameras have the same name, which opens the first */
+        if ((0 == strncmp(camId, "name:", 5)) && (0 == strcmp(camId + 5, g_modelName)))
+            index = 0;
+        else if ((1 != sscanf(camId, "sim-%u", &index)) && (1 != sscanf(camId, "sn:SIM%u", &index)))
+            return NULL;
+    }
+    return Toupcam_OpenByIndex(index);
+}
+
+void Toupcam_Close(HToupcam h)
+{
+    if (NULL == h)
+        return;
+    SimCamera* c = cam(h);
+    if (E_WRONG_THREAD == c->stop())
+        return;         /* from the callback, the SDK deadlocks there */
+    std::lock_guard<std::mutex> lock(g_openLock);
+    g_open[c->m_index] = NULL;
+    delete c;
+}
+
+HRESULT Toupcam_StartPullModeWithCallback(HToupcam h, PTOUPCAM_EVENT_CALLBACK funEvent, void* ctxEvent)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    return cam(h)->start(funEvent, ctxEvent);
+}
+
+HRESULT Toupcam_Stop(HToupcam h)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    return cam(h)->stop();
+}
+
+HRESULT Toupcam_Pause(HToupcam h, int bPause)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    {
+        std::lock_guard<std::mutex> lock(c->m_lock);
+        if (!c->m_running)
+            return E_UNEXPECTED;
+        c->m_paused = (0 != bPause);
+    }
+    c->m_genCond.notify_all();
+    return S_OK;
+}
+
+HRESULT Toupcam_Trigger(HToupcam h, unsigned short nNumber)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    {
+        std::lock_guard<std::mutex> lock(c->m_lock);
+        if ((!c->m_running) || (0 == c->m_trigger))
+            return E_UNEXPECTED;
+        if (g_cfg.trigDrop && (1 == nNumber))
+        {
+            /* by the time of the triggers, not of the generator, which may run late */
+            const SimClock::time_point now = SimClock::now();
+            if (now < c->m_trigReady)
+            {
+                ++c->m_triggerLost;     /* no error, no event: the camera did not see it */
+                return S_OK;
+            }
+            c->m_trigReady = now + std::chrono::microseconds((long long)(c->sensorPeriod(c->m_expoTime) * 1e6));
+        }
+        if ((0 == nNumber) || (0xffff == nNumber) || (0xffff == c->m_triggers))
+            c->m_triggers = nNumber;
+        else
+            c->m_triggers += nNumber;
+    }
+    c->m_genCond.notify_all();
+    return S_OK;
+}
+
+HRESULT Toupcam_WaitImageV4(HToupcam h, unsigned nWaitMS, void* pImageData, int bStill, int bits, int rowPitch, ToupcamFrameInfoV4* pInfo)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    if (bStill)
+        return E_NOTIMPL;
+    SimCamera* c = cam(h);
+    std::unique_lock<std::mutex> lock(c->m_lock);
+    return c->pull(lock, nWaitMS, pImageData, bits, rowPitch, pInfo);
+}
+
+HRESULT Toupcam_PullImageV4(HToupcam h, void* pImageData, int bStill, int bits, int rowPitch, ToupcamFrameInfoV4* pInfo)
+{
+    return Toupcam_WaitImageV4(h, 0, pImageData, bStill, bits, rowPitch, pInfo);
+}
+
+HRESULT Toupcam_WaitImageV3(HToupcam h, unsigned nWaitMS, void* pImageData, int bStill, int bits, int rowPitch, ToupcamFrameInfoV3* pInfo)
+{
+    ToupcamFrameInfoV4 info;
+    const HRESULT hr = Toupcam_WaitImageV4(h, nWaitMS, pImageData, bStill, bits, rowPitch, &info);
+    if (SUCCEEDED(hr) && pInfo)
+        *pInfo = info.v3;
+    return hr;
+}
+
+HRESULT Toupcam_PullImageV3(HToupcam h, void* pImageData, int bStill, int bits, int rowPitch, ToupcamFrameInfoV3* pInfo)
+{
+    return Toupcam_WaitImageV3(h, 0, pImageData, bStill, bits, rowPitch, pInfo);
+}
+
+HRESULT Toupcam_PullImageWithRowPitchV2(HToupcam h, void* pImageData, int bits, int rowPitch, ToupcamFrameInfoV2* pInfo)
+{
+    ToupcamFrameInfoV4 info;
+    const HRESULT hr = Toupcam_WaitImageV4(h, 0, pImageData, 0, bits, rowPitch, &info);
+    if (SUCCEEDED(hr) && pInfo)
+    {
+        pInfo->width = info.v3.width;
+        pInfo->height = info.v3.height;
+        pInfo->flag = info.v3.flag;
+        pInfo->seq = info.v3.seq;
+        pInfo->timestamp = info.v3.timestamp;
+    }
+    return hr;
+}
+
+HRESULT Toupcam_PullImageV2(HToupcam h, void* pImageData, int bits, ToupcamFrameInfoV2* pInfo)
+{
+    return Toupcam_PullImageWithRowPitchV2(h, pImageData, bits, 0, pInfo);
+}
+
+HRESULT Toupcam_PullImageWithRowPitch(HToupcam h, void* pImageData, int bits, int rowPitch, unsigned* pnWidth, unsigned* pnHeight)
+{
+    ToupcamFrameInfoV4 info;
+    const HRESULT hr = Toupcam_WaitImageV4(h, 0, pImageData, 0, bits, rowPitch, &info);
+    if (SUCCEEDED(hr))
+    {
+        if (pnWidth)
+            *pnWidth = info.v3.width;
+        if (pnHeight)
+            *pnHeight = info.v3.height;
+    }
+    return hr;
+}
+
+HRESULT Toupcam_PullImage(HToupcam h, void* pImageData, int bits, unsigned* pnWidth, unsigned* pnHeight)
+{
+    return Toupcam_PullImageWithRowPitch(h, pImageData, bits, 0, pnWidth, pnHeight);
+}
+
+HRESULT Toupcam_get_ResolutionNumber(HToupcam h)
+{
+    return h ? (HRESULT)g_model.preview : E_INVALIDARG;
+}
+
+HRESULT Toupcam_get_Resolution(HToupcam h, unsigned nResolutionIndex, int* pWidth, int* pHeight)
+{
+    if ((NULL == h) || (nResolutionIndex >= g_model.preview))
+        return E_INVALIDARG;
+    if (pWidth)
+        *pWidth = (int)g_model.res[nResolutionIndex].width;
+    if (pHeight)
+        *pHeight = (int)g_model.res[nResolutionIndex].height;
+    return S_OK;
+}
+
+HRESULT Toupcam_put_eSize(HToupcam h, unsigned nResolutionIndex)
+{
+    if ((NULL == h) || (nResolutionIndex >= g_model.preview))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (c->m_running)
+        return E_UNEXPECTED;
+    c->m_res = nResolutionIndex;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_eSize(HToupcam h, unsigned* pnResolutionIndex)
+{
+    if ((NULL == h) || (NULL == pnResolutionIndex))
+        return E_INVALIDARG;
+    *pnResolutionIndex = cam(h)->m_res;
+    return S_OK;
+}
+
+HRESULT Toupcam_put_Size(HToupcam h, int nWidth, int nHeight)
+{
+    for (unsigned i = 0; i < g_model.preview; ++i)
+    {
+        if (((unsigned)nWidth == g_model.res[i].width) && ((unsigned)nHeight == g_model.res[i].height))
+            return Toupcam_put_eSize(h, i);
+    }
+    return E_INVALIDARG;
+}
+
+HRESULT Toupcam_get_Size(HToupcam h, int* pWidth, int* pHeight)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    return Toupcam_get_Resolution(h, cam(h)->m_res, pWidth, pHeight);
+}
+
+HRESULT Toupcam_get_FinalSize(HToupcam h, int* pWidth, int* pHeight)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    if (pWidth)
+        *pWidth = (int)cam(h)->width();
+    if (pHeight)
+        *pHeight = (int)cam(h)->height();
+    return S_OK;
+}
+
+HRESULT Toupcam_put_Mode(HToupcam h, int bSkip)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    if (g_replay.frames())
+        return E_NOTIMPL;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (c->m_running)
+        return E_UNEXPECTED;
+    c->m_mode = bSkip ? 1 : 0;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_Mode(HToupcam h, int* bSkip)
+{
+    if ((NULL == h) || (NULL == bSkip))
+        return E_INVALIDARG;
+    *bSkip = cam(h)->m_mode;
+    return S_OK;
+}
+
+static const char* g_binValue[] = { "1x1", "2x2", "3x3", "4x4" };
+static const char* g_binMethod[] = { "Average", "Add", "Skip" };   /* SIM_BIN_AVERAGE, _ADD, _SKIP */
+
+HRESULT Toupcam_get_BinningNumber(HToupcam h)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    return g_replay.frames() ? E_NOTIMPL : (HRESULT)(sizeof(g_binValue) / sizeof(g_binValue[0]));
+}
+
+/* the values and the methods are two lists, each method goes with each value */
+HRESULT Toupcam_get_BinningValue(HToupcam h, unsigned index, const char** ppValue)
+{
+    if ((NULL == h) || (NULL == ppValue) || (index >= sizeof(g_binValue) / sizeof(g_binValue[0])))
+        return E_INVALIDARG;
+    *ppValue = g_binValue[index];
+    return S_OK;
+}
+
+HRESULT Toupcam_get_BinningMethod(HToupcam h, unsigned index, const char** ppMethod)
+{
+    if ((NULL == h) || (NULL == ppMethod) || (index >= sizeof(g_binMethod) / sizeof(g_binMethod[0])))
+        return E_INVALIDARG;
+    *ppMethod = g_binMethod[index];
+    return S_OK;
+}
+
+HRESULT Toupcam_put_Binning(HToupcam h, const char* pValue, const char* pMethod)
+{
+    if ((NULL == h) || (NULL == pValue) || (NULL == pMethod))
+        return E_INVALIDARG;
+    if (g_replay.frames())
+        return E_NOTIMPL;
+    unsigned n = 0, m = 0;
+    while ((n < sizeof(g_binValue) / sizeof(g_binValue[0])) && strcmp(pValue, g_binValue[n]))
+        ++n;
+    while ((m < sizeof(g_binMethod) / sizeof(g_binMethod[0])) && strcmp(pMethod, g_binMethod[m]))
+        ++m;
+    if ((n >= sizeof(g_binValue) / sizeof(g_binValue[0])) || (m >= sizeof(g_binMethod) / sizeof(g_binMethod[0])))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (c->m_running)
+        return E_UNEXPECTED;
+    c->m_hwBin = n + 1;
+    c->m_hwMethod = m;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_Binning(HToupcam h, const char** ppValue, const char** ppMethod)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    if (ppValue)
+        *ppValue = g_binValue[c->m_hwBin - 1];
+    if (ppMethod)
+        *ppMethod = g_binMethod[c->m_hwMethod];
+    return S_OK;
+}
+
+HRESULT Toupcam_get_RawFormat(HToupcam h, unsigned* pFourCC, unsigned* pBitsPerPixel)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    if (pFourCC)
+        *pFourCC = g_fourcc;
+    if (pBitsPerPixel)
+        *pBitsPerPixel = cam(h)->rawBits();
+    return S_OK;
+}
+
+/* RAW8, and the RAW of the sensor above 8 bits; the link is not simulated, so there is no packed format */
+HRESULT Toupcam_get_PixelFormatSupport(HToupcam h, char cmd, int* pixelFormat)
+{
+    if ((NULL == h) || (NULL == pixelFormat))
+        return E_INVALIDARG;
+    const int num = (g_cfg.bits > 8) ? 2 : 1;
+    if (-1 == cmd)
+        *pixelFormat = num;
+    else if ((cmd < 0) || (cmd >= num))
+        return E_INVALIDARG;
+    else
+        *pixelFormat = (0 == cmd) ? TOUPCAM_PIXELFORMAT_RAW8 : (g_cfg.bits - 8) / 2;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_MaxBitDepth(HToupcam h)
+{
+    return h ? g_cfg.bits : E_INVALIDARG;
+}
+
+HRESULT Toupcam_get_MonoMode(HToupcam h)
+{
+    return h ? (g_cfg.mono ? S_OK : S_FALSE) : E_INVALIDARG;
+}
+
+HRESULT Toupcam_get_SerialNumber(HToupcam h, char sn[32])
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    snprintf(sn, 32, "SIM%07u", cam(h)->m_index);
+    return S_OK;
+}
+
+HRESULT Toupcam_get_FwVersion(HToupcam h, char fwver[16])
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    snprintf(fwver, 16, "sim");
+    return S_OK;
+}
+
+const ToupcamModelV2* Toupcam_query_Model(HToupcam h)
+{
+    return h ? &g_model : NULL;
+}
+
+/* no USB vendor / product id is a simulated camera: what looks the cameras up on the bus finds none of them */
+const ToupcamModelV2* Toupcam_get_Model(unsigned short idVendor, unsigned short idProduct)
+{
+    return NULL;
+}
+
+HRESULT Toupcam_get_ExpoTime(HToupcam h, unsigned* Time)
+{
+    if ((NULL == h) || (NULL == Time))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    *Time = c->m_expoTime;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_RealExpoTime(HToupcam h, unsigned* Time)
+{
+    return Toupcam_get_ExpoTime(h, Time);
+}
+
+HRESULT Toupcam_put_ExpoTime(HToupcam h, unsigned Time)
+{
+    if ((NULL == h) || (Time < SIM_EXPO_MIN) || (Time > SIM_EXPO_MAX))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (Time == c->m_expoTime)
+        return S_FALSE;
+    c->m_expoTime = Time;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_ExpTimeRange(HToupcam h, unsigned* nMin, unsigned* nMax, unsigned* nDef)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    if (nMin)
+        *nMin = SIM_EXPO_MIN;
+    if (nMax)
+        *nMax = SIM_EXPO_MAX;
+    if (nDef)
+        *nDef = SIM_EXPO_REF;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_ExpoAGain(HToupcam h, unsigned short* Gain)
+{
+    if ((NULL == h) || (NULL == Gain))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    *Gain = c->m_expoGain;
+    return S_OK;
+}
+
+HRESULT Toupcam_put_ExpoAGain(HToupcam h, unsigned short Gain)
+{
+    if ((NULL == h) || (Gain < TOUPCAM_EXPOGAIN_MIN) || (Gain > SIM_GAIN_MAX))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (Gain == c->m_expoGain)
+        return S_FALSE;
+    c->m_expoGain = Gain;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_ExpoAGainRange(HToupcam h, unsigned short* nMin, unsigned short* nMax, unsigned short* nDef)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    if (nMin)
+        *nMin = TOUPCAM_EXPOGAIN_MIN;
+    if (nMax)
+        *nMax = SIM_GAIN_MAX;
+    if (nDef)
+        *nDef = TOUPCAM_EXPOGAIN_DEF;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_AutoExpoEnable(HToupcam h, int* bAutoExposure)
+{
+    if ((NULL == h) || (NULL == bAutoExposure))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    *bAutoExposure = c->m_aeEnable;
+    return S_OK;
+}
+
+HRESULT Toupcam_put_AutoExpoEnable(HToupcam h, int bAutoExposure)
+{
+    if ((NULL == h) || (bAutoExposure < 0) || (bAutoExposure > 2))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    c->m_aeEnable = bAutoExposure;
+    c->m_aeFrames = 0;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_AutoExpoTarget(HToupcam h, unsigned short* Target)
+{
+    if ((NULL == h) || (NULL == Target))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    *Target = c->m_aeTarget;
+    return S_OK;
+}
+
+HRESULT Toupcam_put_AutoExpoTarget(HToupcam h, unsigned short Target)
+{
+    if ((NULL == h) || (Target < TOUPCAM_AETARGET_MIN) || (Target > TOUPCAM_AETARGET_MAX))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    c->m_aeTarget = Target;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_AutoExpoRange(HToupcam h, unsigned* maxTime, unsigned* minTime, unsigned short* maxGain, unsigned short* minGain)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (maxTime)
+        *maxTime = c->m_aeMaxTime;
+    if (minTime)
+        *minTime = c->m_aeMinTime;
+    if (maxGain)
+        *maxGain = c->m_aeMaxGain;
+    if (minGain)
+        *minGain = c->m_aeMinGain;
+    return S_OK;
+}
+
+HRESULT Toupcam_put_AutoExpoRange(HToupcam h, unsigned maxTime, unsigned minTime, unsigned short maxGain, unsigned short minGain)
+{
+    if ((NULL == h) || (minTime < SIM_EXPO_MIN) || (maxTime > SIM_EXPO_MAX) || (minTime > maxTime)
+        || (minGain < TOUPCAM_EXPOGAIN_MIN) || (maxGain > SIM_GAIN_MAX) || (minGain > maxGain))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    c->m_aeMaxTime = maxTime;
+    c->m_aeMinTime = minTime;
+    c->m_aeMaxGain = maxGain;
+    c->m_aeMinGain = minGain;
+    return S_OK;
+}
+
+HRESULT Toupcam_get_FrameRate(HToupcam h, unsigned* nFrame, unsigned* nTime, unsigned* nTotalFrame)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    const SimClock::time_point now = SimClock::now();
+    const unsigned ms = (unsigned)std::chrono::duration_cast<std::chrono::milliseconds>(now - c->m_rateStart).count();
+    if (nFrame)
+        *nFrame = c->m_rateFrames;
+    if (nTime)
+        *nTime = ms;
+    if (nTotalFrame)
+        *nTotalFrame = c->m_seq;
+    /* the most recent few seconds */
+    if (ms >= 2000)
+    {
+        c->m_rateStart = now;
+        c->m_rateFrames = 0;
+    }
+    return S_OK;
+}
+
+HRESULT Toupcam_put_Option(HToupcam h, unsigned iOption, int iValue)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::unique_lock<std::mutex> lock(c->m_lock);
+    if ((iOption & TOUPCAM_OPTION_EVENT_HARDWARE) && (iOption < 0x7f000000))
+    {
+        if (TOUPCAM_OPTION_EVENT_HARDWARE == iOption)
+            c->m_hwMaster = iValue ? 1 : 0;
+        else
+        {
+            const int bit = 1 << (iOption & 0x0f);
+            c->m_hwMask = iValue ? (c->m_hwMask | bit) : (c->m_hwMask & ~bit);
+        }
+        return S_OK;
+    }
+    switch (iOption)
+    {
+    case TOUPCAM_OPTION_RAW:
+    case TOUPCAM_OPTION_BITDEPTH:
+    case TOUPCAM_OPTION_PIXEL_FORMAT:
+    case TOUPCAM_OPTION_RGB:
+    case TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH:
+    case TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH:
+    case TOUPCAM_OPTION_BINNING:
+    case TOUPCAM_OPTION_LOW_NOISE:
+        if (c->m_running)
+            return E_UNEXPECTED;
+        break;
+    default:
+        break;
+    }
+    switch (iOption)
+    {
+    case TOUPCAM_OPTION_RAW:
+        c->m_raw = iValue ? 1 : 0;
+        return S_OK;
+    case TOUPCAM_OPTION_BITDEPTH:
+        /* a recording is replayed at its own depth */
+        if ((iValue && (8 == g_cfg.bits)) || (g_replay.frames() && ((iValue ? 1 : 0) != c->m_bitdepth)))
+            return E_NOTIMPL;
+        c->m_bitdepth = iValue ? 1 : 0;
+        return S_OK;
+    case TOUPCAM_OPTION_PIXEL_FORMAT:
+        /* RAW10, 12, 14, 16 follow RAW8 */
+        if ((TOUPCAM_PIXELFORMAT_RAW8 != iValue) && ((g_cfg.bits <= 8) || (iValue != (g_cfg.bits - 8) / 2)))
+            return E_NOTIMPL;
+        if (g_replay.frames() && ((TOUPCAM_PIXELFORMAT_RAW8 != iValue) != (0 != c->m_bitdepth)))
+            return E_NOTIMPL;
+        c->m_bitdepth = (TOUPCAM_PIXELFORMAT_RAW8 != iValue) ? 1 : 0;
+        return S_OK;
+    case TOUPCAM_OPTION_RGB:
+        if ((0 != iValue) && (2 != iValue) && ((3 != iValue) || !g_cfg.mono))
+            return E_NOTIMPL;
+        c->m_rgb = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_TRIGGER:
+        if ((iValue < 0) || (iValue > 3) || (2 == iValue))
+            return E_NOTIMPL;   /* no external trigger input */
+        c->m_trigger = iValue;
+        c->m_triggers = 0;
+        lock.unlock();
+        c->m_genCond.notify_all();
+        return S_OK;
+    case TOUPCAM_OPTION_FRAMERATE:
+        if (iValue < 0)
+            return E_INVALIDARG;
+        c->m_framerate = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_PRECISE_FRAMERATE:
+        if ((iValue < 10) || (iValue > (int)(g_cfg.fps * 10)))
+            return E_INVALIDARG;
+        c->m_precise = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_TESTPATTERN:
+        if ((0 != iValue) && (3 != iValue) && (5 != iValue) && (7 != iValue) && (9 != iValue))
+            return E_INVALIDARG;
+        c->m_testpattern = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_BYTEORDER:
+        c->m_byteorder = iValue ? 1 : 0;
+        return S_OK;
+    case TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH:
+    case TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH:
+        if ((iValue < 2) || (iValue > 1024))
+            return E_INVALIDARG;
+        if (TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH == iOption)
+            c->m_frontLength = iValue;
+        else
+            c->m_backLength = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_FLUSH:
+        if ((iValue < 1) || (iValue > 3))
+            return E_INVALIDARG;
+        return (iValue & 2) ? (HRESULT)(c->m_front.flush() + c->m_back.flush()) : S_OK;
+    case TOUPCAM_OPTION_NOFRAME_TIMEOUT:
+        c->m_noframeTimeout = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_HISTOGRAM:
+        c->m_histMode = iValue ? 1 : 0;
+        return S_OK;
+    case TOUPCAM_OPTION_BINNING:
+        /* saturating add or average; the unsaturated add (0x40) changes the bit depth of RAW, not simulated */
+        if (((iValue & 0x0f) < 1) || ((iValue & 0x0f) > 8) || (iValue & ~0x8f) || g_replay.frames())
+            return E_NOTIMPL;
+        c->m_swBin = (1 == (iValue & 0x0f)) ? 1 : iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_CG:
+        if ((iValue < 0) || (iValue > 1) || g_replay.frames())
+            return E_NOTIMPL;
+        c->m_cg = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_LOW_NOISE:
+        if (g_replay.frames())
+            return E_NOTIMPL;
+        c->m_lowNoise = iValue ? 1 : 0;
+        return S_OK;
+    case TOUPCAM_OPTION_CALLBACK_THREAD:
+        c->m_callbackThread = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_RESET_SEQ_TIMESTAMP:
+        if ((iValue < 1) || (iValue > 3))
+            return E_INVALIDARG;
+        c->m_resetSeqStamp |= iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_READOUT_MODE:
+    case TOUPCAM_OPTION_GLOBAL_RESET_MODE:
+    case TOUPCAM_OPTION_TRIGGER_CANCEL_MODE:
+        if ((iValue < 0) || (iValue > 1))
+            return E_INVALIDARG;
+        if (TOUPCAM_OPTION_READOUT_MODE == iOption)
+            c->m_readoutMode = iValue;
+        else if (TOUPCAM_OPTION_GLOBAL_RESET_MODE == iOption)
+            c->m_globalReset = iValue;
+        else
+            c->m_triggerCancel = iValue;
+        return S_OK;
+    case TOUPCAM_OPTION_AUTOEXP_THRESHOLD:
+        if ((iValue < TOUPCAM_AUTOEXPO_THRESHOLD_MIN) || (iValue > TOUPCAM_AUTOEXPO_THRESHOLD_MAX))
+            return E_INVALIDARG;
+        c->m_aeThreshold = iValue;
+        return S_OK;
+    case SIMCAM_OPTION_STAGE_X:
+    case SIMCAM_OPTION_STAGE_Y:
+    case SIMCAM_OPTION_STAGE_Z:
+        c->updateStage();
+        c->m_axis[iOption - SIMCAM_OPTION_STAGE_X].target = iValue / 1000.0;
+        if (g_cfg.speed <= 0)
+            c->m_axis[iOption - SIMCAM_OPTION_STAGE_X].pos = iValue / 1000.0;
+        return S_OK;
+    case SIMCAM_OPTION_NOISE:
+        if (iValue < 0)
+            return E_INVALIDARG;
+        c->m_noise = iValue;
+        return S_OK;
+    case SIMCAM_OPTION_REPLAY_POS:
+        if ((iValue < 0) || ((unsigned)iValue >= g_replay.frames()))
+            return E_INVALIDARG;
+        c->m_replayPos = iValue;
+        c->m_replayLoop = 0;
+        lock.unlock();
+        c->m_genCond.notify_all();
+        return S_OK;
+    default:
+        return E_NOTIMPL;
+    }
+}
+
+HRESULT Toupcam_get_Option(HToupcam h, unsigned iOption, int* piValue)
+{
+    if ((NULL == h) || (NULL == piValue))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if ((iOption & TOUPCAM_OPTION_EVENT_HARDWARE) && (iOption < 0x7f000000))
+    {
+        *piValue = (TOUPCAM_OPTION_EVENT_HARDWARE == iOption) ? c->m_hwMaster : ((c->m_hwMask >> (iOption & 0x0f)) & 1);
+        return S_OK;
+    }
+    switch (iOption)
+    {
+    case TOUPCAM_OPTION_RAW: *piValue = c->m_raw; return S_OK;
+    case TOUPCAM_OPTION_BITDEPTH: *piValue = c->m_bitdepth; return S_OK;
+    case TOUPCAM_OPTION_PIXEL_FORMAT: *piValue = c->m_bitdepth ? (g_cfg.bits - 8) / 2 : TOUPCAM_PIXELFORMAT_RAW8; return S_OK;
+    case TOUPCAM_OPTION_RGB: *piValue = c->m_rgb; return S_OK;
+    case TOUPCAM_OPTION_TRIGGER: *piValue = c->m_trigger; return S_OK;
+    case TOUPCAM_OPTION_FRAMERATE: *piValue = c->m_framerate; return S_OK;
+    case TOUPCAM_OPTION_MAX_PRECISE_FRAMERATE: *piValue = (int)(g_cfg.fps * 10); return S_OK;
+    case TOUPCAM_OPTION_MIN_PRECISE_FRAMERATE: *piValue = 10; return S_OK;
+    case TOUPCAM_OPTION_PRECISE_FRAMERATE: *piValue = c->m_precise ? c->m_precise : (int)(g_cfg.fps * 10); return S_OK;
+    case TOUPCAM_OPTION_TESTPATTERN: *piValue = c->m_testpattern; return S_OK;
+    case TOUPCAM_OPTION_BYTEORDER: *piValue = c->m_byteorder; return S_OK;
+    case TOUPCAM_OPTION_FRONTEND_DEQUE_LENGTH: *piValue = c->m_frontLength; return S_OK;
+    case TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH: *piValue = c->m_backLength; return S_OK;
+    case TOUPCAM_OPTION_FRONTEND_DEQUE_CURRENT: *piValue = (int)c->m_front.size(); return S_OK;
+    case TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT: *piValue = (int)c->m_back.size(); return S_OK;
+    case TOUPCAM_OPTION_FRONTEND_FULL: *piValue = (int)c->m_front.full(); return S_OK;
+    case TOUPCAM_OPTION_BACKEND_FULL: *piValue = (int)c->m_back.full(); return S_OK;
+    case TOUPCAM_OPTION_NUMBER_DROP_FRAME: *piValue = (int)(c->m_front.full() + c->m_back.full()); return S_OK;
+    case TOUPCAM_OPTION_NOFRAME_TIMEOUT: *piValue = c->m_noframeTimeout; return S_OK;
+    case TOUPCAM_OPTION_HISTOGRAM: *piValue = c->m_histMode; return S_OK;
+    case TOUPCAM_OPTION_BINNING: *piValue = c->m_swBin; return S_OK;
+    case TOUPCAM_OPTION_CG: *piValue = c->m_cg; return S_OK;
+    case TOUPCAM_OPTION_LOW_NOISE: *piValue = c->m_lowNoise; return S_OK;
+    case TOUPCAM_OPTION_CALLBACK_THREAD: *piValue = c->m_callbackThread; return S_OK;
+    case TOUPCAM_OPTION_READOUT_MODE: *piValue = c->m_readoutMode; return S_OK;
+    case TOUPCAM_OPTION_GLOBAL_RESET_MODE: *piValue = c->m_globalReset; return S_OK;
+    case TOUPCAM_OPTION_TRIGGER_CANCEL_MODE: *piValue = c->m_triggerCancel; return S_OK;
+    case TOUPCAM_OPTION_LINE_TIME: *piValue = (int)(c->readout() / c->rowsRead() * 1e9 + 0.5); return S_OK;
+    case TOUPCAM_OPTION_READ_TIME: *piValue = (int)(c->readout() * 1e6 + 0.5); return S_OK;
+    case TOUPCAM_OPTION_CAMERA_PERIOD: *piValue = (int)(c->period() * 1e6 + 0.5); return S_OK;
+    case SIMCAM_OPTION_TRIGGER_LOST: *piValue = (int)c->m_triggerLost; return S_OK;
+    case TOUPCAM_OPTION_AUTOEXP_THRESHOLD: *piValue = c->m_aeThreshold; return S_OK;
+    case SIMCAM_OPTION_STAGE_X:
+    case SIMCAM_OPTION_STAGE_Y:
+    case SIMCAM_OPTION_STAGE_Z:
+        c->updateStage();
+        *piValue = (int)floor(c->m_axis[iOption - SIMCAM_OPTION_STAGE_X].pos * 1000 + 0.5);
+        return S_OK;
+    case SIMCAM_OPTION_MOVING:
+        c->updateStage();
+        *piValue = c->moving() ? 1 : 0;
+        return S_OK;
+    case SIMCAM_OPTION_NOISE: *piValue = c->m_noise; return S_OK;
+    case SIMCAM_OPTION_GENERATED: *piValue = (int)c->m_generated; return S_OK;
+    case SIMCAM_OPTION_REPLAY_POS: *piValue = (int)c->m_replayPos; return S_OK;
+    case SIMCAM_OPTION_REPLAY_FRAMES: *piValue = (int)g_replay.frames(); return S_OK;
+    default:
+        return E_NOTIMPL;
+    }
+}
+
+HRESULT Toupcam_IoControl(HToupcam h, unsigned ioLine, unsigned nType, int outVal, int* inVal)
+{
+    if (NULL == h)
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    int* p = NULL;
+    switch ((nType + 1) & ~1u)    /* GET_XXX is SET_XXX - 1 */
+    {
+    case TOUPCAM_IOCONTROLTYPE_SET_UART_ENABLE: p = &c->m_uartEnable; break;
+    case TOUPCAM_IOCONTROLTYPE_SET_UART_BAUDRATE: p = &c->m_uartBaud; break;
+    case TOUPCAM_IOCONTROLTYPE_SET_UART_LINEMODE: p = &c->m_uartLineMode; break;
+    default:
+        return E_NOTIMPL;
+    }
+    if (nType & 1)
+    {
+        if (NULL == inVal)
+            return E_POINTER;
+        *inVal = *p;
+        return S_OK;
+    }
+    if ((outVal < 0) || (outVal > ((TOUPCAM_IOCONTROLTYPE_SET_UART_BAUDRATE == nType) ? 4 : 1)))
+        return E_INVALIDARG;
+    *p = outVal;
+    if ((TOUPCAM_IOCONTROLTYPE_SET_UART_ENABLE == nType) && (0 == outVal))
+    {
+        c->m_uartIn.clear();
+        c->m_uartOut.clear();
+        c->m_uartLines.clear();
+    }
+    return S_OK;
+}
+
+HRESULT Toupcam_write_UART(HToupcam h, const unsigned char* pData, unsigned nDataLen)
+{
+    if ((NULL == h) || (NULL == pData))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (!c->m_uartEnable)
+        return E_UNEXPECTED;
+    for (unsigned i = 0; i < nDataLen; ++i)
+    {
+        const char ch = (char)pData[i];
+        if ('\n' == ch)
+        {
+            const size_t n = c->m_uartIn.find_first_of(";\r");
+            c->m_uartIn.erase((std::string::npos == n) ? c->m_uartIn.size() : n);
+            if (!c->m_uartIn.empty())
+                c->m_uartLines.push_back(c->m_uartIn);
+            c->m_uartIn.clear();
+        }
+        else
+            c->m_uartIn += ch;
+    }
+    c->marlin();
+    return S_OK;
+}
+
+HRESULT Toupcam_read_UART(HToupcam h, unsigned char* pBuffer, unsigned nBufferLen)
+{
+    if ((NULL == h) || (NULL == pBuffer))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (!c->m_uartEnable)
+        return E_UNEXPECTED;
+    c->marlin();
+    const unsigned n = (unsigned)((c->m_uartOut.size() < nBufferLen) ? c->m_uartOut.size() : nBufferLen);
+    memcpy(pBuffer, c->m_uartOut.data(), n);
+    c->m_uartOut.erase(0, n);
+    return (HRESULT)n;
+}
+
+HRESULT Toupcam_GetHistogramV2(HToupcam h, PITOUPCAM_HISTOGRAM_CALLBACKV2 funHistogramV2, void* ctxHistogramV2)
+{
+    if ((NULL == h) || (NULL == funHistogramV2))
+        return E_INVALIDARG;
+    SimCamera* c = cam(h);
+    std::lock_guard<std::mutex> lock(c->m_lock);
+    if (!c->m_running)
+        return E_UNEXPECTED;
+    c->m_funHist = funHistogramV2;
+    c->m_ctxHist = ctxHistogramV2;
+    return S_OK;
+}
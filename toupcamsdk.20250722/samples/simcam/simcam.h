@@ -0,0 +1,21 @@
+#ifndef __simcam_H__
+#define __simcam_H__
+
+/*
+    Options of the simulated camera (libtoupcam of samples/simcam) beyond these of toupcam.h, for Toupcam_put_Option /
+    Toupcam_get_Option. A real camera returns E_NOTIMPL for them, so a program may put them unconditionally.
+    The stage moves the scene under the simulated sensor: X and Y shift the image (by SIMCAM umpx micrometres per
+    pixel), Z moves it out of the focal plane (blurred by one level each SIMCAM dof micrometres). A put sets the
+    target, the stage goes there at SIMCAM speed micrometres per second (0: at once); a get reads the position now.
+*/
+#define SIMCAM_OPTION_STAGE_X       0x7f000001  /* [RW] nanometres */
+#define SIMCAM_OPTION_STAGE_Y       0x7f000002  /* [RW] nanometres */
+#define SIMCAM_OPTION_STAGE_Z       0x7f000003  /* [RW] nanometres, 0 is in focus */
+#define SIMCAM_OPTION_MOVING        0x7f000004  /* [RO] 1: the stage has not reached its target yet */
+#define SIMCAM_OPTION_NOISE         0x7f000005  /* [RW] standard deviation of the noise, 1/100 of a level of 8 bits */
+#define SIMCAM_OPTION_GENERATED     0x7f000006  /* [RO] frames generated since start */
+#define SIMCAM_OPTION_REPLAY_POS    0x7f000007  /* [RW] replay: index of the next frame of the recording */
+#define SIMCAM_OPTION_REPLAY_FRAMES 0x7f000008  /* [RO] replay: frames of the recording, 0: no replay */
+#define SIMCAM_OPTION_TRIGGER_LOST  0x7f000009  /* [RO] software triggers lost since start, SIMCAM trigdrop=1 */
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __stagetrack_H__
+#define __stagetrack_H__
+
+/*
+    Stage position of every frame, from the stage samples recorded around it.
+    StageTrack keeps the last STAGETRACK_NUM stage samples (host time, X, Y, Z) pushed by whatever knows the stage
+    position (the serial worker reading M114, a status stream of the controller) and interpolates the position at any
+    time between the oldest and the newest sample. A frame is tagged with the position at the middle of its exposure:
+    FrameClock puts the camera timestamp of the frame on the host clock (offset = minimum of arrival - timestamp, as in
+    demolatency), takes STAGETRACK_LATENCY_US for the transfer of the fastest frame, which the host cannot measure, and
+    goes back half the exposure time, so no M114 round trip is needed per frame.
+    The times are microseconds on one host clock (HostMicroseconds(), steady). A frame later than the newest sample is
+    tagged with the newest position only if that sample is at most STAGETRACK_HOLD_US old, which covers a stage standing
+    still between two samples; otherwise it is not tagged and at() returns false.
+*/
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "toupcam.h"
+
+#define STAGETRACK_NUM          4096
+#define STAGETRACK_HOLD_US      200000
+#define STAGETRACK_LATENCY_US   0       /* calibrate: end of exposure to TOUPCAM_EVENT_IMAGE of the fastest frame */
+
+typedef struct {
+    long long t;        /* host microseconds */
+    double x, y, z;     /* mm */
+} StageSample;
+
+static long long HostMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class StageTrack {
+    std::vector<StageSample> m_ring;
+    size_t m_head, m_count;     /* m_head: next slot to write */
+    mutable std::mutex m_mtx;
+
+    const StageSample& sample(size_t i) const   /* 0 = the oldest */
+    {
+        return m_ring[(m_head + STAGETRACK_NUM - m_count + i) % STAGETRACK_NUM];
+    }
+public:
+    StageTrack()
+    : m_ring(STAGETRACK_NUM), m_head(0), m_count(0)
+    {
+    }
+
+    /* in time order; a sample older than the newest one is dropped */
+    void push(long long t, double x, double y, double z)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_count && (t < sample(m_count - 1).t))
+            return;
+        StageSample& s = m_ring[m_head];
+        s.t = t;
+        s.x = x;
+        s.y = y;
+        s.z = z;
+        m_head = (m_head + 1) % STAGETRACK_NUM;
+        if (m_count < STAGETRACK_NUM)
+            ++m_count;
+    }
+
+    bool at(long long t, StageSample* pOut) const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if ((0 == m_count) || (t < sample(0).t))
+            return false;
+        const StageSample& newest = sample(m_count - 1);
+        if (t >= newest.t)
+        {
+            if (t - newest.t > STAGETRACK_HOLD_US)
+                return false;
+            *pOut = newest;
+            pOut->t = t;
+            return true;
+        }
+        size_t lo = 0, hi = m_count - 1;    /* sample(lo).t <= t < sample(hi).t */
+        while (hi - lo > 1)
+        {
+            const size_t mid = (lo + hi) / 2;
+            if (sample(mid).t <= t)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        const StageSample& a = sample(lo);
+        const StageSample& b = sample(hi);
+        const double f = (b.t > a.t) ? (double)(t - a.t) / (b.t - a.t) : 0.0;
+        pOut->t = t;
+        pOut->x = a.x + (b.x - a.x) * f;
+        pOut->y = a.y + (b.y - a.y) * f;
+        pOut->z = a.z + (b.z - a.z) * f;
+        return true;
+    }
+};
+
+/* one per camera */
+class FrameClock {
+    long long m_offset;
+    bool m_bOffset;
+public:
+    FrameClock()
+    : m_offset(0), m_bOffset(false)
+    {
+    }
+
+    /* host time of the middle of the exposure of the frame, tArrival: host time of its TOUPCAM_EVENT_IMAGE */
+    long long frameTime(const ToupcamFrameInfoV4& info, long long tArrival)
+    {
+        long long t = tArrival;
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP)
+        {
+            const long long diff = tArrival - (long long)info.v3.timestamp;
+            if ((!m_bOffset) || (diff < m_offset))
+            {
+                m_offset = diff;
+                m_bOffset = true;
+            }
+            t = (long long)info.v3.timestamp + m_offset - STAGETRACK_LATENCY_US;
+        }
+        if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_EXPOTIME)
+            t -= info.v3.expotime / 2;  /* the timestamp is taken as the end of the exposure */
+        return t;
+    }
+};
+
+#endif
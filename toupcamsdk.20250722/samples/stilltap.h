@@ -0,0 +1,199 @@
+#ifndef __stilltap_H__
+#define __stilltap_H__
+
+/*
+    Full resolution stills without interrupting a low resolution preview. Toupcam_Snap / SnapR with a still resolution
+    other than the one of the video switch the sensor to another readout: the preview stalls for the restart and the
+    auto exposure converges again. Here the sensor is never switched: it reads out at the still resolution all the
+    time (put_eSize with the index of the still, RAW), every frame is pulled at full resolution into a small ring of
+    slots, and the preview is binned from it on the host (hostbin.h, n x n average, 16 bits, the Bayer pattern kept).
+    A capture pins a slot of the ring and hands it to the still thread, which delivers it (STILLTAP_STILL) while the
+    preview goes on from the other slots: the frame of the still is previewed as well, nothing is restarted and
+    nothing is copied.
+        capture(false)  the next frame pulled, exposed after the request
+        capture(true)   the newest frame already pulled (no shutter lag: the frame of the moment of the request)
+    On cameras with TOUPCAM_FLAG_DDR the frames wait in the DDR of the camera while the host is busy
+    (TOUPCAM_OPTION_DDR_DEPTH), so a still written to a slow disk does not drop frames either.
+    The interleaving of a full resolution frame into a binned readout is not a mode of the camera (the sensor modes are
+    those of Toupcam_put_eSize and Toupcam_put_Binning, each a reconfiguration), so the link carries full frames: the
+    frame rate is the one of the full resolution, the binning on the host costs one pass over each frame.
+    With all the slots pinned (the still thread behind) the frame is pulled into the scratch slot, previewed and a
+    next-frame capture waits for a free slot. onImage() is for the event callback, capture() for any thread.
+*/
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "toupcam.h"
+#include "hostbin.h"
+
+/* on the thread of onImage(): the binned frame, 16 bits, width x height, packed rows */
+typedef void (*STILLTAP_PREVIEW)(void* ctx, const unsigned short* data, unsigned width, unsigned height, const ToupcamFrameInfoV4& info);
+/* on the still thread: the full frame as pulled (8 or 16 bits per sample, packed rows), id of capture() */
+typedef void (*STILLTAP_STILL)(void* ctx, unsigned id, const void* data, const ToupcamFrameInfoV4& info);
+
+class StillTap {
+    struct Slot {
+        std::vector<unsigned char> buf;
+        ToupcamFrameInfoV4 info;
+        bool bPinned;
+        unsigned id;
+    };
+    HToupcam m_hcam;
+    const unsigned m_width, m_height, m_bytes, m_bin;
+    const int m_format;
+    STILLTAP_PREVIEW m_pPreview;
+    STILLTAP_STILL m_pStill;
+    void* m_ctx;
+    std::vector<Slot> m_slot;           /* the ring, and the last one is the scratch */
+    std::vector<unsigned short> m_preview;
+    std::vector<unsigned> m_acc;
+    unsigned m_pw, m_ph;
+    int m_newest;                       /* slot of the newest frame pulled, -1: none */
+    unsigned m_next;                    /* ring position of the next pull */
+    std::deque<unsigned> m_want;        /* ids waiting for the next frame */
+    std::deque<Slot*> m_queue;          /* pinned, for the still thread */
+    unsigned m_nId, m_nStill, m_nPreview;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    bool m_bQuit;
+    std::thread m_thread;
+
+    StillTap(const StillTap&);
+    StillTap& operator=(const StillTap&);
+
+    void stiller()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        for (;;)
+        {
+            m_cv.wait(lock, [this] { return m_bQuit || (!m_queue.empty()); });
+            if (m_queue.empty())
+                return;
+            Slot* s = m_queue.front();
+            m_queue.pop_front();
+            lock.unlock();
+            m_pStill(m_ctx, s->id, &s->buf[0], s->info);
+            lock.lock();
+            s->bPinned = false;
+            ++m_nStill;
+        }
+    }
+
+    /* under m_mtx */
+    void pin(Slot* s, unsigned id)
+    {
+        s->bPinned = true;
+        s->id = id;
+        m_queue.push_back(s);
+        m_cv.notify_one();
+    }
+public:
+    /* width, height: the still resolution the camera runs at; bits: 8, or 9 ... 16 pulled as 16 bits
+       (TOUPCAM_OPTION_BITDEPTH = 1); bin: 2 ... 8; ring: slots for the pulls and the stills in flight, 3 at least */
+    StillTap(HToupcam h, unsigned width, unsigned height, unsigned bits, bool bMono, unsigned bin, unsigned ring,
+             STILLTAP_PREVIEW pPreview, STILLTAP_STILL pStill, void* ctx)
+    : m_hcam(h), m_width(width), m_height(height), m_bytes((bits > 8) ? 2 : 1), m_bin(bin),
+    m_format(bMono ? ((bits > 8) ? HOSTBIN_MONO16 : HOSTBIN_MONO8) : ((bits > 8) ? HOSTBIN_BAYER16 : HOSTBIN_BAYER8)),
+    m_pPreview(pPreview), m_pStill(pStill), m_ctx(ctx), m_slot(((ring < 3) ? 3 : ring) + 1), m_pw(0), m_ph(0),
+    m_newest(-1), m_next(0), m_nId(0), m_nStill(0), m_nPreview(0), m_bQuit(false)
+    {
+        for (size_t i = 0; i < m_slot.size(); ++i)
+        {
+            m_slot[i].buf.resize((size_t)width * height * m_bytes);
+            m_slot[i].bPinned = false;
+            m_slot[i].id = 0;
+        }
+        if (HostBinSize(m_format, width, height, bin, &m_pw, &m_ph))
+            m_preview.resize((size_t)m_pw * m_ph);
+        m_thread = std::thread(&StillTap::stiller, this);
+    }
+
+    ~StillTap() { stop(); }
+
+    /* the stills queued are delivered first */
+    void stop()
+    {
+        if (!m_thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bQuit = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+    unsigned previewWidth() const { return m_pw; }
+    unsigned previewHeight() const { return m_ph; }
+
+    /* TOUPCAM_EVENT_IMAGE */
+    HRESULT onImage()
+    {
+        Slot* s = NULL;
+        int index = -1;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            const unsigned ring = (unsigned)m_slot.size() - 1;
+            for (unsigned i = 0; i < ring; ++i)
+            {
+                const unsigned k = (m_next + i) % ring;
+                if ((!m_slot[k].bPinned) && ((int)k != m_newest))
+                {
+                    index = (int)k;
+                    m_next = (k + 1) % ring;
+                    break;
+                }
+            }
+        }
+        s = (index >= 0) ? &m_slot[index] : &m_slot.back();
+        memset(&s->info, 0, sizeof(s->info));
+        const HRESULT hr = Toupcam_PullImageV4(m_hcam, &s->buf[0], 0, 0, 0, &s->info);
+        if (FAILED(hr))
+            return hr;
+        if ((s->info.v3.width != m_width) || (s->info.v3.height != m_height))
+            return (HRESULT)0x8000ffff; /* E_UNEXPECTED: not the resolution of the still */
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (index >= 0)
+            {
+                m_newest = index;
+                if (!m_want.empty())
+                {
+                    pin(s, m_want.front());
+                    m_want.pop_front();
+                }
+            }
+        }
+        /* the still thread only reads a pinned slot, the preview may read it as well */
+        unsigned pw, ph;
+        if (m_pPreview && (!m_preview.empty()) && HostBin(m_format, &s->buf[0], (size_t)m_width * m_bytes, m_width, m_height, m_bin, HOSTBIN_AVERAGE,
+                                                         &m_preview[0], (size_t)m_pw * sizeof(unsigned short), m_acc, &pw, &ph))
+        {
+            m_pPreview(m_ctx, &m_preview[0], pw, ph, s->info);
+            std::lock_guard<std::mutex> lock(m_mtx);
+            ++m_nPreview;
+        }
+        return 0;   /* S_OK */
+    }
+
+    /* returns the id the still is delivered with; bLatest: the newest frame pulled, otherwise the next one */
+    unsigned capture(bool bLatest)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        const unsigned id = ++m_nId;
+        if (bLatest && (m_newest >= 0) && (!m_slot[m_newest].bPinned))
+            pin(&m_slot[m_newest], id);
+        else
+            m_want.push_back(id);   /* nothing pulled yet, or the newest one is already a still: the next frame */
+        return id;
+    }
+
+    unsigned requested() { std::lock_guard<std::mutex> lock(m_mtx); return m_nId; }
+    unsigned delivered() { std::lock_guard<std::mutex> lock(m_mtx); return m_nStill; }
+    unsigned previews() { std::lock_guard<std::mutex> lock(m_mtx); return m_nPreview; }
+};
+
+#endif
@@ -0,0 +1,470 @@
+#ifndef __taskgraph_H__
+#define __taskgraph_H__
+
+/*
+    Dataflow scheduler for a processing chain of several stages, such as pull -> dark / flat correction -> demosaic ->
+    EDF -> stitch -> encode -> save: every stage is a node, the stages are linked by edges of bounded capacity, and a
+    pool of worker threads runs whichever node has work, as many items of a node at once as its concurrency allows.
+    A slow node then holds up only itself: its input edge fills, the node before it stops (it runs only when there
+    is room on all its output edges, so an item never waits half done on a full queue), and so on up to the source,
+    which stops pulling: the frames stay in the deque of the SDK (TOUPCAM_OPTION_FRAME_DEQUE_LENGTH) and the camera
+    drops the newest ones there, not the pipeline in the middle of a correction.
+    Items: a fixed pool of items T (allocated at construction, sized by the program through item() before start(), so
+    running never allocates) goes round the graph. The source node (addSource) gets a free item for every pending
+    frame, signal() from the event callback adds one; the other nodes (addNode) get the items queued to their input.
+    A node function returns the output port the item goes on (its edges, in the order connected: 0 for the first),
+    or TASKGRAPH_END, which recycles the item (the save node, or an item dropped on the way, or a failed pull).
+    Nodes are added in the order of the chain, an edge goes from a node to one added after it: no cycles.
+    The input of every node is taken the oldest item first. Ordered nodes (bOrdered, concurrency 1): the items are
+    taken in the order of the source, whatever the order the nodes before finished them in; an item waits while one
+    sourced before it is still upstream (on a node before), and that one passes the full edges on its way.
+    Work stealing: every worker has a deque of its own; the items a worker makes runnable go to its own deque and it
+    takes the newest from there (the data just written is still in its cache), an idle worker steals the oldest of
+    the others. The graph state (queues, credits, counters) is under one mutex, held only to dispatch, never while a
+    node runs.
+    Metrics (stats): items per node, throughput, service time (in the node function) and waiting time (queued on the
+    input edge) average and maximum, the peak of the input queue, and how often the node had input but a full output
+    (blocked): the node after it is the bottleneck.
+*/
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+
+#define TASKGRAPH_END       (-1)
+
+struct TaskNodeStats {
+    const char* name;
+    unsigned concurrency;           /* limit */
+    unsigned running;               /* now */
+    unsigned queued, peakQueued;    /* input edges, now and the most */
+    unsigned long long items;       /* through the node function */
+    unsigned long long blocked;     /* dispatches skipped for a full output edge */
+    double rate;                    /* items per second since start() */
+    double avgMs, maxMs;            /* in the node function */
+    double avgWaitMs, maxWaitMs;    /* on the input edge, 0 for the source */
+    double busy;                    /* of the time since start(), in units of one worker: 2.5 = 2.5 workers busy */
+};
+
+template <typename T>
+class TaskGraph {
+public:
+    struct Item {
+        T data;
+        unsigned seq;               /* in the order of the source */
+        std::chrono::steady_clock::time_point tSource;
+    private:
+        friend class TaskGraph;
+        int node;                   /* queued on or running in, -1: free */
+        int edge;                   /* queued through */
+        std::chrono::steady_clock::time_point tQueued;
+    };
+    /* worker: 0 ... workers - 1; returns the output port, or TASKGRAPH_END */
+    typedef int (*TASKGRAPH_FUNC)(void* ctx, unsigned worker, Item* item);
+private:
+    struct Edge {
+        int to;
+        unsigned capacity, queued, reserved;    /* reserved: items running in the node before, which may come */
+    };
+    struct Node {
+        std::string name;
+        TASKGRAPH_FUNC f;
+        void* ctx;
+        unsigned limit, running, peak;
+        bool bOrdered, bSource;
+        std::vector<int> out;       /* edges, by port */
+        std::deque<Item*> in;       /* by seq */
+        unsigned long long items, blocked;
+        double service, maxService, wait, maxWait;
+    };
+    struct Task {
+        int node;
+        Item* item;
+    };
+    struct Worker {
+        std::mutex mtx;
+        std::deque<Task> dq;
+    };
+
+    std::vector<Item> m_item;
+    std::vector<Item*> m_free;
+    std::vector<Node> m_node;
+    std::vector<Edge> m_edge;
+    std::vector<std::unique_ptr<Worker> > m_worker;
+    std::vector<std::thread> m_thread;
+    std::mutex m_mtx;               /* the graph */
+    std::condition_variable m_cvIdle;
+    std::mutex m_mtxWake;           /* the workers waiting for a task */
+    std::condition_variable m_cvWake;
+    unsigned m_nTasks;              /* in the deques, under m_mtxWake */
+    bool m_bQuit, m_bSourceOn;
+    unsigned m_pending, m_nextSeq, m_active, m_rr;
+    std::chrono::steady_clock::time_point m_tStart;
+
+    TaskGraph(const TaskGraph&);
+    TaskGraph& operator=(const TaskGraph&);
+
+    static bool before(unsigned a, unsigned b) { return (int)(a - b) < 0; }
+    static double ms(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+    {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    }
+
+    bool outputFree(const Node& nd) const
+    {
+        for (size_t i = 0; i < nd.out.size(); ++i)
+        {
+            const Edge& e = m_edge[nd.out[i]];
+            if (e.queued + e.reserved >= e.capacity + nd.limit)
+                return false;
+        }
+        return true;
+    }
+
+    /* the oldest item of an ordered node may go when nothing sourced before it is on a node before */
+    bool inOrder(int n, const Item* it) const
+    {
+        for (size_t i = 0; i < m_item.size(); ++i)
+        {
+            const Item& o = m_item[i];
+            if ((o.node >= 0) && (o.node < n) && before(o.seq, it->seq))
+                return false;
+        }
+        return true;
+    }
+
+    /* the item is the one an ordered node after n waits for: it goes on even if an output edge is full, or the items
+       queued after it would never leave */
+    bool urgent(int n, const Item* it) const
+    {
+        for (size_t m = n + 1; m < m_node.size(); ++m)
+        {
+            const Node& o = m_node[m];
+            if (o.bOrdered && (!o.in.empty()) && before(it->seq, o.in.front()->seq))
+                return true;
+        }
+        return false;
+    }
+
+    /* under m_mtx: the tasks runnable now, downstream first (an item done frees room for the ones behind it) */
+    void collect(std::vector<Task>& vec)
+    {
+        for (int n = (int)m_node.size() - 1; n >= 0; --n)
+        {
+            Node& nd = m_node[n];
+            while (nd.running < nd.limit)
+            {
+                Item* it = NULL;
+                if (nd.bSource)
+                {
+                    if ((0 == m_pending) || m_free.empty())
+                        break;
+                }
+                else if (nd.in.empty() || (nd.bOrdered && (!inOrder(n, nd.in.front()))))
+                    break;
+                if ((!outputFree(nd)) && (nd.bSource || (!urgent(n, nd.in.front()))))
+                {
+                    ++nd.blocked;
+                    break;
+                }
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if (nd.bSource)
+                {
+                    --m_pending;
+                    it = m_free.back();
+                    m_free.pop_back();
+                    it->seq = m_nextSeq++;
+                    it->tSource = now;
+                    ++m_active;
+                }
+                else
+                {
+                    it = nd.in.front();
+                    nd.in.pop_front();
+                    --m_edge[it->edge].queued;
+                    const double w = ms(it->tQueued, now);
+                    nd.wait += w;
+                    if (w > nd.maxWait)
+                        nd.maxWait = w;
+                }
+                it->node = n;
+                for (size_t i = 0; i < nd.out.size(); ++i)
+                    ++m_edge[nd.out[i]].reserved;
+                ++nd.running;
+                Task t = { n, it };
+                vec.push_back(t);
+            }
+        }
+    }
+
+    /* self: the worker which made them runnable, -1 from outside */
+    void dispatch(int self)
+    {
+        std::vector<Task> vec;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            collect(vec);
+        }
+        if (vec.empty())
+            return;
+        Worker* w;
+        if (self >= 0)
+            w = m_worker[self].get();
+        else
+        {
+            std::lock_guard<std::mutex> lock(m_mtxWake);
+            w = m_worker[m_rr++ % m_worker.size()].get();
+        }
+        {
+            std::lock_guard<std::mutex> lock(w->mtx);
+            for (size_t i = 0; i < vec.size(); ++i)
+                w->dq.push_back(vec[i]);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mtxWake);
+            m_nTasks += (unsigned)vec.size();
+        }
+        if (vec.size() > 1)
+            m_cvWake.notify_all();
+        else
+            m_cvWake.notify_one();
+    }
+
+    bool take(unsigned self, Task& t)
+    {
+        {
+            Worker* w = m_worker[self].get();
+            std::lock_guard<std::mutex> lock(w->mtx);
+            if (!w->dq.empty())
+            {
+                t = w->dq.back();
+                w->dq.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < m_worker.size(); ++i)
+        {
+            Worker* w = m_worker[(self + i) % m_worker.size()].get();
+            std::lock_guard<std::mutex> lock(w->mtx);
+            if (!w->dq.empty())
+            {
+                t = w->dq.front();
+                w->dq.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void complete(const Task& t, int port, double service)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        Node& nd = m_node[t.node];
+        Item* it = t.item;
+        --nd.running;
+        for (size_t i = 0; i < nd.out.size(); ++i)
+            --m_edge[nd.out[i]].reserved;
+        ++nd.items;
+        nd.service += service;
+        if (service > nd.maxService)
+            nd.maxService = service;
+        if ((port >= 0) && (port < (int)nd.out.size()))
+        {
+            Edge& e = m_edge[nd.out[port]];
+            Node& to = m_node[e.to];
+            ++e.queued;
+            it->edge = nd.out[port];
+            it->node = e.to;
+            it->tQueued = std::chrono::steady_clock::now();
+            /* by seq, the oldest first; almost always at the end */
+            typename std::deque<Item*>::iterator pos = to.in.end();
+            while ((pos != to.in.begin()) && before(it->seq, (*(pos - 1))->seq))
+                --pos;
+            to.in.insert(pos, it);
+            if (to.in.size() > to.peak)
+                to.peak = (unsigned)to.in.size();
+        }
+        else
+        {
+            it->node = -1;
+            m_free.push_back(it);
+            if ((0 == --m_active) && ((0 == m_pending) || (!m_bSourceOn)))
+                m_cvIdle.notify_all();
+        }
+    }
+
+    void worker(unsigned self)
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mtxWake);
+                m_cvWake.wait(lock, [this] { return m_bQuit || (m_nTasks > 0); });
+                if (0 == m_nTasks)
+                    return;         /* quit, nothing left */
+                --m_nTasks;
+            }
+            Task t;
+            while (!take(self, t))
+                std::this_thread::yield(); /* not reached: a task is pushed before it is counted */
+            Node& nd = m_node[t.node];
+            const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            const int port = nd.f(nd.ctx, self, t.item);
+            complete(t, port, ms(t0, std::chrono::steady_clock::now()));
+            dispatch((int)self);
+        }
+    }
+
+    int add(const char* name, TASKGRAPH_FUNC f, void* ctx, unsigned concurrency, bool bOrdered, bool bSource)
+    {
+        Node nd;
+        nd.name = name;
+        nd.f = f;
+        nd.ctx = ctx;
+        nd.limit = bOrdered ? 1 : (concurrency ? concurrency : (unsigned)m_worker.size());
+        nd.running = nd.peak = 0;
+        nd.bOrdered = bOrdered;
+        nd.bSource = bSource;
+        nd.items = nd.blocked = 0;
+        nd.service = nd.maxService = nd.wait = nd.maxWait = 0.0;
+        m_node.push_back(nd);
+        return (int)m_node.size() - 1;
+    }
+public:
+    /* items: in the graph at once, the memory of the pipeline; workers: 0, one per core */
+    TaskGraph(unsigned items, unsigned workers)
+    : m_item(items ? items : 1), m_nTasks(0), m_bQuit(false), m_bSourceOn(false), m_pending(0), m_nextSeq(0), m_active(0), m_rr(0)
+    {
+        if (0 == workers)
+            workers = std::thread::hardware_concurrency();
+        for (unsigned i = 0; i < (workers ? workers : 1); ++i)
+            m_worker.push_back(std::unique_ptr<Worker>(new Worker));
+        for (size_t i = 0; i < m_item.size(); ++i)
+        {
+            m_item[i].seq = 0;
+            m_item[i].node = m_item[i].edge = -1;
+            m_free.push_back(&m_item[i]);
+        }
+    }
+
+    ~TaskGraph() { stop(); }
+
+    /* to size the data of the items before start() */
+    Item* item(unsigned index) { return &m_item[index]; }
+    unsigned items() const { return (unsigned)m_item.size(); }
+    unsigned workers() const { return (unsigned)m_worker.size(); }
+
+    /* the graph is built before start(); returns the index of the node */
+    int addSource(const char* name, TASKGRAPH_FUNC f, void* ctx)
+    {
+        return add(name, f, ctx, 1, false, true);
+    }
+    /* concurrency: items in the node at once, 0: as many as the workers; bOrdered: one at a time, in the source order */
+    int addNode(const char* name, TASKGRAPH_FUNC f, void* ctx, unsigned concurrency = 1, bool bOrdered = false)
+    {
+        return add(name, f, ctx, concurrency, bOrdered, false);
+    }
+    /* the next port of from; capacity: items queued on the edge, waiting for the node after, with all the ones running
+       in the node before done (which never wait for room: the node runs only with room for them); false if the graph
+       would not be acyclic */
+    bool connect(int from, int to, unsigned capacity)
+    {
+        if ((from < 0) || (to <= from) || (to >= (int)m_node.size()) || m_node[to].bSource)
+            return false;
+        Edge e = { to, capacity ? capacity : 1, 0, 0 };
+        m_edge.push_back(e);
+        m_node[from].out.push_back((int)m_edge.size() - 1);
+        return true;
+    }
+
+    void start()
+    {
+        m_tStart = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bSourceOn = true;
+        }
+        for (unsigned i = 0; i < m_worker.size(); ++i)
+            m_thread.push_back(std::thread(&TaskGraph::worker, this, i));
+    }
+
+    /* n more frames for the source: from the event callback, any thread */
+    void signal(unsigned n = 1)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_bSourceOn)
+                return;
+            m_pending += n;
+        }
+        dispatch(-1);
+    }
+
+    /* no more pulls, the frames pending are forgotten; the items in the graph go on to the end. Then wait for drain()
+       before the camera is closed, a pull may be running */
+    void stopSource()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_bSourceOn = false;
+        m_pending = 0;
+        if (0 == m_active)
+            m_cvIdle.notify_all();
+    }
+
+    /* waits until the graph is empty: no frame pending, no item in a node or on an edge */
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvIdle.wait(lock, [this] { return (0 == m_active) && (0 == m_pending); });
+    }
+
+    /* stopSource(), drain(), then ends the workers */
+    void stop()
+    {
+        if (m_thread.empty())
+            return;
+        stopSource();
+        drain();
+        {
+            std::lock_guard<std::mutex> lock(m_mtxWake);
+            m_bQuit = true;
+        }
+        m_cvWake.notify_all();
+        for (size_t i = 0; i < m_thread.size(); ++i)
+            m_thread[i].join();
+        m_thread.clear();
+    }
+
+    unsigned nodes() const { return (unsigned)m_node.size(); }
+    /* items out of the free pool, in a node or on an edge */
+    unsigned active() { std::lock_guard<std::mutex> lock(m_mtx); return m_active; }
+    unsigned pending() { std::lock_guard<std::mutex> lock(m_mtx); return m_pending; }
+
+    TaskNodeStats stats(int n)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        const Node& nd = m_node[n];
+        const double elapsed = ms(m_tStart, std::chrono::steady_clock::now());
+        TaskNodeStats s;
+        s.name = nd.name.c_str();
+        s.concurrency = nd.limit;
+        s.running = nd.running;
+        s.queued = (unsigned)nd.in.size();
+        s.peakQueued = nd.peak;
+        s.items = nd.items;
+        s.blocked = nd.blocked;
+        s.rate = (elapsed > 0.0) ? (nd.items * 1000.0 / elapsed) : 0.0;
+        s.avgMs = nd.items ? (nd.service / nd.items) : 0.0;
+        s.maxMs = nd.maxService;
+        s.avgWaitMs = nd.items ? (nd.wait / nd.items) : 0.0;
+        s.maxWaitMs = nd.maxWait;
+        s.busy = (elapsed > 0.0) ? (nd.service / elapsed) : 0.0;
+        return s;
+    }
+};
+
+#endif
@@ -11,6 +11,9 @@
 #define IDC_STATIC2                     1006
 #define IDC_CHECK1                      1007
 #define IDC_STATIC3                     1008
+#define IDC_EDIT3                       1009
+#define IDC_EDIT4                       1010
+#define IDC_CHECK2                      1011
 #define ID_CAMERA00                     3000
 #define ID_CAMERA01                     3001
 #define ID_CAMERA02                     3002
@@ -34,7 +37,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        103
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1009
+#define _APS_NEXT_CONTROL_VALUE         1012
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
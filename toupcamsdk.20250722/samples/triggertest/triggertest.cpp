@@ -7,16 +7,21 @@ CAppModule _Module;
 #include <atltypes.h>
 #include <atlstr.h>
 #include "toupcam.h"
-#include <memory>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <deque>
+#include <vector>
+#include <atomic>
 #include <fcntl.h>
 #include <io.h>
 #include "resource.h"
 
 #define MSG_EVENT	(WM_APP + 1)
+#define QUEUE_DEF	16		/* number of preallocated frame buffers for saving, the most frames queued */
+#define QUEUE_MAX	256
+#define SAVER_DEF	2		/* number of saver threads */
+#define SAVER_MAX	16
 
 static CString FormatString(const wchar_t* szFormat, ...)
 {
@@ -96,17 +101,23 @@ class CMainDlg : public CDialogImpl<CMainDlg>, public CMessageFilter
 	const ToupcamModelV2* m_model;
 	volatile bool m_loop;
 	bool m_save;
+	bool m_block;				/* queue full: the callback waits for a saver, otherwise the frame is dropped */
 	void* m_data;
-	unsigned m_interval, m_trigger, m_image, m_savenum;
+	unsigned m_interval, m_trigger, m_image;
+	unsigned m_saver, m_queue, m_queuePeak;
+	std::atomic<unsigned> m_savenum, m_dropped;
 	DWORD m_tick;
-	std::unique_ptr<std::thread> m_thread;
+	std::vector<std::thread> m_threads;
 	std::deque<void*> m_deque;
+	std::deque<void*> m_free;	/* buffers of the pool which are not queued for saving */
+	std::vector<void*> m_pool;	/* page-aligned, allocated at start, m_queue of them */
 	std::mutex m_mtx;
-	std::condition_variable m_cv;
+	std::condition_variable m_cv, m_cvFree;
 public:
 	enum { IDD = IDD_MAIN };
 	CMainDlg()
-	: m_hcam(nullptr), m_model(nullptr), m_loop(false), m_save(true), m_data(nullptr), m_interval(0), m_trigger(0), m_image(0), m_savenum(0), m_tick(0)
+	: m_hcam(nullptr), m_model(nullptr), m_loop(false), m_save(true), m_block(false), m_data(nullptr), m_interval(0), m_trigger(0), m_image(0),
+	m_saver(SAVER_DEF), m_queue(QUEUE_DEF), m_queuePeak(0), m_savenum(0), m_dropped(0), m_tick(0)
 	{
 	}
 
@@ -131,6 +142,8 @@ private:
 		GetDlgItem(IDC_BUTTON2).EnableWindow(FALSE);
 		SetDlgItemInt(IDC_EDIT1, 1000);
 		SetDlgItemInt(IDC_EDIT2, 100);
+		SetDlgItemInt(IDC_EDIT3, SAVER_DEF);
+		SetDlgItemInt(IDC_EDIT4, QUEUE_DEF);
 		SetDlgItemText(IDC_STATIC1, L"0");
 		SetDlgItemText(IDC_STATIC2, L"0");
 		SetDlgItemText(IDC_STATIC3, L"0");
@@ -181,26 +194,26 @@ private:
 	{
 		if (m_loop)
 		{
-			m_loop = false;
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_loop = false;
+			}
+			m_cvFree.notify_all();	// a callback blocked on a full queue
 			KillTimer(1);
 			Sleep(m_interval + 50); // wait for the last trigger to complete
 			Toupcam_Stop(m_hcam);
 			if (m_save)
 			{
-				m_cv.notify_one();
-				if (m_thread)
-				{
-					m_thread->join();
-					m_thread.reset();
-				}
+				m_cv.notify_all();
+				for (size_t i = 0; i < m_threads.size(); ++i)
+					m_threads[i].join();
+				m_threads.clear();
 
-				if (!m_deque.empty())
-				{
-					for (size_t i = 0; i < m_deque.size(); ++i)
-						free(m_deque[i]);
-					m_deque.clear();
-				}
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_free.insert(m_free.end(), m_deque.begin(), m_deque.end());
+				m_deque.clear();
 			}
+			UpdateText();
 		}
 		else
 		{
@@ -211,6 +224,20 @@ private:
 
 			if (GetDlgInt(this, IDC_EDIT2, m_interval, 1u, 1000000u))
 				return 0;
+			m_save = IsDlgButtonChecked(IDC_CHECK1) ? true : false;
+			if (m_save)
+			{
+				if (GetDlgInt(this, IDC_EDIT3, m_saver, 1u, (unsigned)SAVER_MAX))
+					return 0;
+				if (GetDlgInt(this, IDC_EDIT4, m_queue, 1u, (unsigned)QUEUE_MAX))
+					return 0;
+				if (!AllocPool(m_queue))
+				{
+					AtlMessageBox(m_hWnd, L"Out of memory.", (LPCTSTR)nullptr, MB_OK | MB_ICONWARNING);
+					return 0;
+				}
+			}
+			m_block = IsDlgButtonChecked(IDC_CHECK2) ? true : false;
 
 			Toupcam_put_ExpoTime(m_hcam, expoTime);
 			if (FAILED(Toupcam_StartPullModeWithCallback(m_hcam, StaticCameraCallback, this)))
@@ -222,23 +249,29 @@ private:
 			SetDlgItemText(IDC_STATIC1, L"0");
 			SetDlgItemText(IDC_STATIC2, L"0");
 			SetDlgItemText(IDC_STATIC3, L"0");
-			m_save = IsDlgButtonChecked(IDC_CHECK1) ? true : false;
 			m_loop = true;
-			m_trigger = m_image = m_savenum = 0;
+			m_trigger = m_image = m_queuePeak = 0;
+			m_savenum = m_dropped = 0;
 			m_tick = GetTickCount();
 			SetTimer(1, m_interval, nullptr);
 			if (m_save)
 			{
-				m_thread = std::make_unique<std::thread>([this]()
-					{
-						loopsave();
-					});
+				for (unsigned i = 0; i < m_saver; ++i)
+				{
+					m_threads.push_back(std::thread([this]()
+						{
+							loopsave();
+						}));
+				}
 			}
 		}
 
 		GetDlgItem(IDC_EDIT1).EnableWindow(!m_loop);
 		GetDlgItem(IDC_EDIT2).EnableWindow(!m_loop);
+		GetDlgItem(IDC_EDIT3).EnableWindow(!m_loop);
+		GetDlgItem(IDC_EDIT4).EnableWindow(!m_loop);
 		GetDlgItem(IDC_CHECK1).EnableWindow(!m_loop);
+		GetDlgItem(IDC_CHECK2).EnableWindow(!m_loop);
 		SetDlgItemText(IDC_BUTTON2, m_loop ? L"Stop" : L"Start");
 		return 0;
 	}
@@ -250,7 +283,37 @@ private:
 			SetDlgItemInt(IDC_STATIC1, ++m_trigger);
 			Toupcam_Trigger(m_hcam, 1);
 			ATLTRACE("%s: %u\n", __func__, GetTickCount());
+			UpdateText();	// the savers go on when no frame comes
+		}
+	}
+
+	void UpdateText()
+	{
+		wchar_t str[256];
+		const DWORD tick = GetTickCount();
+		if (tick - m_tick > 1000)
+			swprintf(str, L"%u; fps = %.1f", m_image, m_image * 1000.0 / (tick - m_tick));
+		else
+			swprintf(str, L"%u", m_image);
+		SetDlgItemText(IDC_STATIC2, str);
+		if (m_save)
+		{
+			size_t depth = 0;
+			unsigned peak = 0;
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				depth = m_deque.size();
+				peak = m_queuePeak;
+			}
+			const unsigned savenum = m_savenum;
+			const int len = (tick - m_tick > 1000) ? swprintf(str, L"%u; fps = %.1f", savenum, savenum * 1000.0 / (tick - m_tick)) : swprintf(str, L"%u", savenum);
+			swprintf(str + len, _countof(str) - len, L"; queue = %u/%u, peak %u; dropped %u", (unsigned)depth, m_queue, peak, m_dropped.load());
 		}
+		else
+		{
+			swprintf(str, L"%u", m_savenum.load());
+		}
+		SetDlgItemText(IDC_STATIC3, str);
 	}
 
 	LRESULT OnMsgEvent(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/)
@@ -259,17 +322,7 @@ private:
 		if (FAILED(hr))
 			AtlMessageBoxHresult(m_hWnd, hr);
 		else
-		{
-			wchar_t str[256];
-			DWORD tick = GetTickCount();
-			if (tick - m_tick > 1000)
-				swprintf(str, L"%u; fps = %.1f", m_image, m_image * 1000.0 / (tick - m_tick));
-			else
-				swprintf(str, L"%u", m_image);
-			SetDlgItemText(IDC_STATIC2, str);
-			swprintf(str, L"%u", m_savenum);
-			SetDlgItemText(IDC_STATIC3, str);
-		}
+			UpdateText();
 		return 0;
 	}
 private:
@@ -286,12 +339,23 @@ private:
 			void* pdata = m_data;
 			if (m_save)
 			{
-				pdata = malloc(TDIBWIDTHBYTES(m_model->res[0].width * 24) * m_model->res[0].height);
-				if (nullptr == pdata)
+				std::unique_lock<std::mutex> lock(m_mtx);
+				if (m_block)
+				{
+					/* the frames wait in the deques of the SDK meanwhile, which drops them only when those are full too */
+					m_cvFree.wait(lock, [this]() { return (!m_loop) || (!m_free.empty()); });
+				}
+				if (m_free.empty())
 				{
-					PostMessage(MSG_EVENT, HRESULT_FROM_WIN32(ERROR_OUTOFMEMORY));
+					/* all buffers are waiting to be saved, pull into m_data to drain the frame and count the drop */
+					lock.unlock();
+					Toupcam_PullImageV4(m_hcam, m_data, 0, 24, 0, nullptr);
+					++m_dropped;
+					PostMessage(MSG_EVENT, S_OK);
 					return;
 				}
+				pdata = m_free.front();
+				m_free.pop_front();
 			}
 
 			const HRESULT hr = Toupcam_PullImageV4(m_hcam, pdata, 0, 24, 0, nullptr);
@@ -303,10 +367,17 @@ private:
 					{
 						std::unique_lock<std::mutex> lock(m_mtx);
 						m_deque.push_back(pdata);
+						if (m_deque.size() > m_queuePeak)
+							m_queuePeak = (unsigned)m_deque.size();
 					}
 					m_cv.notify_one();
 				}
 			}
+			else if (m_save)
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_free.push_back(pdata);
+			}
 			PostMessage(MSG_EVENT, hr);
 		}
 	}
@@ -347,30 +418,63 @@ private:
 			free(m_data);
 			m_data = nullptr;
 		}
+		FreePool();
 		GetDlgItem(IDC_BUTTON2).EnableWindow(FALSE);
 		SetDlgItemText(IDC_BUTTON1, L"Open");
 	}
 
+	void FreePool()
+	{
+		for (size_t i = 0; i < m_pool.size(); ++i)
+			VirtualFree(m_pool[i], 0, MEM_RELEASE);
+		m_pool.clear();
+		m_free.clear();
+		m_deque.clear();
+	}
+
+	/* the save buffers, allocated at start so nothing is allocated at frame rate; VirtualAlloc returns page-aligned memory which could also be locked or pinned for DMA */
+	bool AllocPool(unsigned num)
+	{
+		if (m_pool.size() == num)
+			return true;
+		FreePool();
+		for (unsigned i = 0; i < num; ++i)
+		{
+			void* p = VirtualAlloc(nullptr, TDIBWIDTHBYTES(m_model->res[0].width * 24) * m_model->res[0].height, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+			if (nullptr == p)
+			{
+				FreePool();
+				return false;
+			}
+			m_pool.push_back(p);
+		}
+		m_free.assign(m_pool.begin(), m_pool.end());
+		return true;
+	}
+
+	/* m_saver of them: the files are numbered in the order of saving, which is the order of the frames only with one saver */
 	void loopsave()
 	{
 		void* pdata = nullptr;
 		wchar_t filename[MAX_PATH];
-		while (m_loop)
+		for (;;)
 		{
 			{
 				std::unique_lock<std::mutex> lock(m_mtx);
-				if (m_deque.empty())
-				{
-					m_cv.wait(lock);
-					continue;
-				}
+				m_cv.wait(lock, [this]() { return (!m_loop) || (!m_deque.empty()); });
+				if (!m_loop)
+					break;
 				pdata = m_deque.front();
 				m_deque.pop_front();
 			}
 			
 			swprintf(filename, L"%08u.bmp", ++m_savenum);
 			savebitmap(m_model->res[0].width, m_model->res[0].height, pdata, TDIBWIDTHBYTES(m_model->res[0].width * 24) * m_model->res[0].height, filename);
-			free(pdata);
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_free.push_back(pdata);
+			}
+			m_cvFree.notify_one();
 		}
 	}
 };
@@ -0,0 +1,251 @@
+#ifndef __trigrate_H__
+#define __trigrate_H__
+
+/*
+    Software triggers at the rate of the sensor, none lost. A triggered camera accepts the next trigger only when the
+    sensor can start a frame: in ITR (Integrate Then Read, TOUPCAM_OPTION_READOUT_MODE 1) or with the global reset
+    (TOUPCAM_OPTION_GLOBAL_RESET_MODE 1) after the exposure and the readout, in IWR (0) after the longer of the two,
+    the exposure of a frame under the readout of the one before. A trigger sent earlier is ignored by many cameras,
+    without an error or an event: the frame is simply missing.
+    init(h, bMax) with bMax puts IWR where the camera has it (a put which fails is a camera without the mode), the
+    global reset off and TOUPCAM_OPTION_TRIGGER_CANCEL_MODE 0 (a cancel outputs no frame, which would occupy the
+    readout). update() computes the minimum trigger period, in the order of preference:
+        TOUPCAM_OPTION_CAMERA_PERIOD    the period of the camera for the current settings, us
+        TOUPCAM_OPTION_READ_TIME        the readout, us, and the exposure time as above
+        TOUPCAM_OPTION_LINE_TIME        ns per row, times the rows of the frame (Toupcam_get_FinalSize), the readout
+    times TRIGRATE_MARGIN; none of them: period() is 0 and nothing is held back. Call it again after a change of the
+    exposure time, the resolution, the binning or the readout mode.
+    trigger() from any thread: a trigger at least period() after the last one is sent at once; an earlier one is
+    refused with E_PENDING (TRIGRATE_REJECT), the caller knows it has to come back, or held and sent at its earliest
+    time by the thread of TrigRate (TRIGRATE_QUEUE, up to TRIGRATE_QUEUE_MAX waiting, E_OUTOFMEMORY beyond). In both
+    the triggers reach the camera at most one per period, so every accepted trigger gives a frame. onImage() counts
+    the frames, missing() is the triggers sent without a frame yet.
+    The stage-triggered scans (scanexec.h) trigger after the move, usually slower than the sensor: there the gate only
+    matters when the moves are short, and queue is the policy which keeps the scan going.
+*/
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "toupcam.h"
+
+#define TRIGRATE_REJECT     0
+#define TRIGRATE_QUEUE      1
+#define TRIGRATE_MARGIN     1.02
+#define TRIGRATE_QUEUE_MAX  64
+
+typedef struct {
+    int readoutMode, globalReset, cancelMode;   /* -1: not supported */
+    unsigned cameraPeriod, readTime;            /* us, 0: not supported */
+    unsigned lineTime;                          /* ns, 0: not supported */
+    unsigned expoTime;                          /* us */
+    unsigned period;                            /* us, minimum trigger period, 0: unknown */
+    const char* source;                         /* the option it comes from */
+} TrigRateInfo;
+
+class TrigRate {
+    HToupcam m_hcam;
+    int m_policy;
+    TrigRateInfo m_info;
+    std::chrono::steady_clock::time_point m_last;   /* of the last trigger sent */
+    bool m_bSent;
+    unsigned m_queued;                              /* waiting */
+    unsigned m_sent, m_rejected, m_held, m_frames;
+    bool m_bStop;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+
+    static int option(HToupcam h, unsigned iOption, int def)
+    {
+        int val = 0;
+        return SUCCEEDED(Toupcam_get_Option(h, iOption, &val)) ? val : def;
+    }
+
+    std::chrono::steady_clock::time_point due() const
+    {
+        return m_last + std::chrono::microseconds(m_info.period);
+    }
+
+    /* with m_mtx held */
+    HRESULT send()
+    {
+        const HRESULT hr = Toupcam_Trigger(m_hcam, 1);
+        if (SUCCEEDED(hr))
+        {
+            m_last = std::chrono::steady_clock::now();
+            m_bSent = true;
+            ++m_sent;
+        }
+        return hr;
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        while (true)
+        {
+            m_cv.wait(lock, [this]() { return m_bStop || m_queued; });
+            if (m_bStop)
+                break;
+            if (m_cv.wait_until(lock, due(), [this]() { return m_bStop; }))
+                break;
+            if (std::chrono::steady_clock::now() < due())   /* the period grew meanwhile */
+                continue;
+            --m_queued;
+            send();
+        }
+    }
+public:
+    TrigRate()
+    : m_hcam(NULL), m_policy(TRIGRATE_QUEUE), m_bSent(false), m_queued(0), m_sent(0), m_rejected(0), m_held(0), m_frames(0), m_bStop(false)
+    {
+        memset(&m_info, 0, sizeof(m_info));
+    }
+
+    ~TrigRate()
+    {
+        stop();
+    }
+
+    /* the camera in software trigger mode (TOUPCAM_OPTION_TRIGGER 1); before Toupcam_StartXXXX, or between runs */
+    HRESULT init(HToupcam h, bool bMax, int policy = TRIGRATE_QUEUE)
+    {
+        if ((NULL == h) || ((TRIGRATE_REJECT != policy) && (TRIGRATE_QUEUE != policy)))
+            return (HRESULT)0x80070057; /* E_INVALIDARG */
+        stop();
+        m_hcam = h;
+        m_policy = policy;
+        m_bSent = false;
+        m_queued = m_sent = m_rejected = m_held = m_frames = 0;
+        if (bMax)
+        {
+            Toupcam_put_Option(h, TOUPCAM_OPTION_READOUT_MODE, 0);
+            Toupcam_put_Option(h, TOUPCAM_OPTION_GLOBAL_RESET_MODE, 0);
+            Toupcam_put_Option(h, TOUPCAM_OPTION_TRIGGER_CANCEL_MODE, 0);
+        }
+        update();
+        if (TRIGRATE_QUEUE == policy)
+        {
+            m_bStop = false;
+            m_thread = std::thread(&TrigRate::worker, this);
+        }
+        return 0;   /* S_OK */
+    }
+
+    /* the waiting triggers dropped */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_bStop = true;
+            m_queued = 0;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    const TrigRateInfo& update()
+    {
+        TrigRateInfo info;
+        info.readoutMode = option(m_hcam, TOUPCAM_OPTION_READOUT_MODE, -1);
+        info.globalReset = option(m_hcam, TOUPCAM_OPTION_GLOBAL_RESET_MODE, -1);
+        info.cancelMode = option(m_hcam, TOUPCAM_OPTION_TRIGGER_CANCEL_MODE, -1);
+        info.cameraPeriod = (unsigned)std::max(0, option(m_hcam, TOUPCAM_OPTION_CAMERA_PERIOD, 0));
+        info.readTime = (unsigned)std::max(0, option(m_hcam, TOUPCAM_OPTION_READ_TIME, 0));
+        info.lineTime = (unsigned)std::max(0, option(m_hcam, TOUPCAM_OPTION_LINE_TIME, 0));
+        info.expoTime = 0;
+        Toupcam_get_ExpoTime(m_hcam, &info.expoTime);
+        double readout = 0.0;
+        info.source = "none";
+        if (info.readTime)
+        {
+            readout = info.readTime;
+            info.source = "read time";
+        }
+        else if (info.lineTime)
+        {
+            int w = 0, h = 0;
+            if (SUCCEEDED(Toupcam_get_FinalSize(m_hcam, &w, &h)))
+            {
+                readout = info.lineTime / 1000.0 * h;
+                info.source = "line time";
+            }
+        }
+        double period = 0.0;
+        if (info.cameraPeriod)
+        {
+            period = info.cameraPeriod;
+            info.source = "camera period";
+        }
+        else if (readout > 0.0)
+        {
+            /* unknown modes counted as ITR, the slower */
+            const bool bOverlap = (0 == info.readoutMode) && (info.globalReset <= 0);
+            period = bOverlap ? std::max(readout, (double)info.expoTime) : (readout + info.expoTime);
+        }
+        info.period = (unsigned)(period * TRIGRATE_MARGIN + 0.5);
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_info = info;
+        }
+        m_cv.notify_all();
+        return m_info;
+    }
+
+    /* S_OK: sent or held (TRIGRATE_QUEUE); E_PENDING: too early (TRIGRATE_REJECT); the error of Toupcam_Trigger */
+    HRESULT trigger()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if ((0 == m_queued) && ((!m_bSent) || (std::chrono::steady_clock::now() >= due())))
+            return send();
+        if (TRIGRATE_REJECT == m_policy)
+        {
+            ++m_rejected;
+            return (HRESULT)0x8000000a; /* E_PENDING */
+        }
+        if (m_queued >= TRIGRATE_QUEUE_MAX)
+            return (HRESULT)0x8007000e; /* E_OUTOFMEMORY */
+        ++m_queued;
+        ++m_held;
+        lock.unlock();
+        m_cv.notify_all();
+        return 0;   /* S_OK */
+    }
+
+    /* for every frame pulled */
+    void onImage()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        ++m_frames;
+    }
+
+    const TrigRateInfo& info() const { return m_info; }
+    unsigned period() const { return m_info.period; }
+    unsigned sent()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_sent;
+    }
+    unsigned rejected()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_rejected;
+    }
+    /* by the queue, since init() */
+    unsigned held()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_held;
+    }
+    unsigned missing()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_sent - m_frames;
+    }
+};
+
+#endif
@@ -0,0 +1,317 @@
+#pragma once
+
+/*
+ * Asynchronous image saving, shared by democpp, demoaf and autotest.
+ * Save takes ownership of a malloc'ed DIB (bottom-up, TDIBWIDTHBYTES rows) and returns at once: a pool of worker
+ * threads encodes the images in parallel by WIC (.bmp, .jpg, .png, .tif) and frees them, so the camera event handler
+ * is back to Toupcam_PullImageV4 while the last image is still being compressed and written. Images to the same file
+ * (a fixed name saved again and again) are written one after the other, in the order of Save, never by two workers at once.
+ * The memory is bounded: when the images not yet saved reach the budget, Save waits for the workers to catch up.
+ * The callback, if any, is called on a worker thread after each image: post a message to get back to the UI thread.
+ * With ASYNCSAVE_IPWRITER defined, .png and .tif are written by ipwriter.h instead (extra/imagepro/samples, and
+ * IPWRITER_ZLIB with zlib for the deflate levels): the rows compressed in parallel at IPWRITER_LEVEL, by the workers
+ * of the pool not busy with another image, and the metadata given to Save in the file.
+ */
+#include <atlbase.h>
+#include <shlwapi.h>
+#include <wincodec.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "toupcam.h"
+#if defined(ASYNCSAVE_IPWRITER)
+#include "../../extra/imagepro/samples/ipwriter.h"
+#endif
+
+/* https://docs.microsoft.com/en-us/windows/desktop/wic/-wic-lh */
+static BOOL SaveImageByWIC(const wchar_t* strFilename, const void* pData, const BITMAPINFOHEADER* pHeader)
+{
+	GUID guidContainerFormat;
+	if (PathMatchSpec(strFilename, L"*.bmp"))
+		guidContainerFormat = GUID_ContainerFormatBmp;
+	else if (PathMatchSpec(strFilename, L"*.jpg"))
+		guidContainerFormat = GUID_ContainerFormatJpeg;
+	else if (PathMatchSpec(strFilename, L"*.png"))
+		guidContainerFormat = GUID_ContainerFormatPng;
+	else if (PathMatchSpec(strFilename, L"*.tif") || PathMatchSpec(strFilename, L"*.tiff"))
+		guidContainerFormat = GUID_ContainerFormatTiff;
+	else
+		return FALSE;
+
+	CComPtr<IWICImagingFactory> spIWICImagingFactory;
+	HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (LPVOID*)&spIWICImagingFactory);
+	if (FAILED(hr))
+		return FALSE;
+
+	CComPtr<IWICBitmapEncoder> spIWICBitmapEncoder;
+	hr = spIWICImagingFactory->CreateEncoder(guidContainerFormat, NULL, &spIWICBitmapEncoder);
+	if (FAILED(hr))
+		return FALSE;
+
+	CComPtr<IWICStream> spIWICStream;
+	hr = spIWICImagingFactory->CreateStream(&spIWICStream);
+	if (FAILED(hr))
+		return FALSE;
+
+	hr = spIWICStream->InitializeFromFilename(strFilename, GENERIC_WRITE);
+	if (FAILED(hr))
+		return FALSE;
+
+	hr = spIWICBitmapEncoder->Initialize(spIWICStream, WICBitmapEncoderNoCache);
+	if (FAILED(hr))
+		return FALSE;
+
+	CComPtr<IWICBitmapFrameEncode> spIWICBitmapFrameEncode;
+	CComPtr<IPropertyBag2> spIPropertyBag2;
+	hr = spIWICBitmapEncoder->CreateNewFrame(&spIWICBitmapFrameEncode, &spIPropertyBag2);
+	if (FAILED(hr))
+		return FALSE;
+
+	if (GUID_ContainerFormatJpeg == guidContainerFormat)
+	{
+		PROPBAG2 option = { 0 };
+		option.pstrName = L"ImageQuality"; /* jpg quality, you can change this setting */
+		CComVariant varValue(0.75f);
+		spIPropertyBag2->Write(1, &option, &varValue);
+	}
+	hr = spIWICBitmapFrameEncode->Initialize(spIPropertyBag2);
+	if (FAILED(hr))
+		return FALSE;
+
+	hr = spIWICBitmapFrameEncode->SetSize(pHeader->biWidth, pHeader->biHeight);
+	if (FAILED(hr))
+		return FALSE;
+
+	WICPixelFormatGUID formatGUID = GUID_WICPixelFormat24bppBGR;
+	hr = spIWICBitmapFrameEncode->SetPixelFormat(&formatGUID);
+	if (FAILED(hr))
+		return FALSE;
+
+	const LONG nWidthBytes = TDIBWIDTHBYTES(pHeader->biWidth * pHeader->biBitCount);
+	for (LONG i = 0; i < pHeader->biHeight; ++i)
+	{
+		hr = spIWICBitmapFrameEncode->WritePixels(1, nWidthBytes, nWidthBytes, ((BYTE*)pData) + nWidthBytes * (pHeader->biHeight - i - 1));
+		if (FAILED(hr))
+			return FALSE;
+	}
+
+	hr = spIWICBitmapFrameEncode->Commit();
+	if (FAILED(hr))
+		return FALSE;
+	hr = spIWICBitmapEncoder->Commit();
+	if (FAILED(hr))
+		return FALSE;
+
+	return TRUE;
+}
+
+#if defined(ASYNCSAVE_IPWRITER)
+/* 24 bits DIB, as SaveImageByWIC; meta: NULL for none */
+static BOOL SaveImageByIpWriter(const wchar_t* strFilename, const void* pData, const BITMAPINFOHEADER* pHeader, const IpWriterMeta* pMeta, unsigned nThreads)
+{
+	const IpWriterImage img = { (unsigned)pHeader->biWidth, (unsigned)pHeader->biHeight, pHeader->biBitCount, 0, 1, 0 };
+	return SUCCEEDED(IpWriteImage(strFilename, pData, img, pMeta, IPWRITER_LEVEL, nThreads)) ? TRUE : FALSE;
+}
+#endif
+
+typedef void (__stdcall* PASYNCSAVE_CALLBACK)(const wchar_t* strFilename, BOOL bSuccess, void* ctxCallback);
+
+#define ASYNCSAVE_BUDGET	(512 * 1024 * 1024)	/* default bytes of images waiting or being encoded */
+
+class CAsyncSaver
+{
+	struct Job {
+		std::wstring		strFilename;
+		void*				pData;
+		BITMAPINFOHEADER	header;
+#if defined(ASYNCSAVE_IPWRITER)
+		IpWriterMeta		meta;
+#endif
+	};
+	const size_t				m_cbBudget;
+	PASYNCSAVE_CALLBACK			m_pCallback;
+	void*						m_ctxCallback;
+	std::deque<Job>				m_queue;
+	std::vector<std::wstring>	m_vecBusy;	/* the files being written by the workers */
+	std::vector<std::thread>	m_vecThread;
+	std::mutex					m_mtx;
+	std::condition_variable		m_cvWork, m_cvDone;
+	size_t						m_cbInflight;
+	unsigned					m_nInflight, m_nSaved, m_nFailed, m_nBusy;
+	bool						m_bStop;
+
+	/* under m_mtx: the first job queued whose file no worker is writing */
+	std::deque<Job>::iterator NextJob()
+	{
+		std::deque<Job>::iterator it = m_queue.begin();
+		for (; it != m_queue.end(); ++it)
+		{
+			size_t i = 0;
+			while ((i < m_vecBusy.size()) && _wcsicmp(m_vecBusy[i].c_str(), it->strFilename.c_str()))
+				++i;
+			if (i >= m_vecBusy.size())
+				break;
+		}
+		return it;
+	}
+
+	void Worker()
+	{
+		CoInitializeEx(NULL, COINIT_MULTITHREADED);
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				std::deque<Job>::iterator it;
+				m_cvWork.wait(lock, [this, &it] { it = NextJob(); return (it != m_queue.end()) || (m_bStop && m_queue.empty()); });
+				if (it == m_queue.end())
+					break;	/* stopped and drained */
+				job = *it;
+				m_queue.erase(it);
+				m_vecBusy.push_back(job.strFilename);
+				++m_nBusy;
+			}
+#if defined(ASYNCSAVE_IPWRITER)
+			BOOL bSuccess;
+			if (PathMatchSpec(job.strFilename.c_str(), L"*.png") || PathMatchSpec(job.strFilename.c_str(), L"*.tif") || PathMatchSpec(job.strFilename.c_str(), L"*.tiff"))
+			{
+				/* the share of the pool: all of it for one image, one worker each when they are all busy */
+				unsigned nBusy;
+				{
+					std::unique_lock<std::mutex> lock(m_mtx);
+					nBusy = m_nBusy + (unsigned)m_queue.size();
+				}
+				const unsigned nShare = (nBusy < m_vecThread.size()) ? (unsigned)(m_vecThread.size() / nBusy) : 1;
+				bSuccess = SaveImageByIpWriter(job.strFilename.c_str(), job.pData, &job.header, &job.meta, nShare);
+			}
+			else
+				bSuccess = SaveImageByWIC(job.strFilename.c_str(), job.pData, &job.header);
+#else
+			const BOOL bSuccess = SaveImageByWIC(job.strFilename.c_str(), job.pData, &job.header);
+#endif
+			free(job.pData);
+			if (m_pCallback)
+				m_pCallback(job.strFilename.c_str(), bSuccess, m_ctxCallback);
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_cbInflight -= job.header.biSizeImage;
+				--m_nInflight;
+				--m_nBusy;
+				for (size_t i = 0; i < m_vecBusy.size(); ++i)
+				{
+					if (m_vecBusy[i] == job.strFilename)
+					{
+						m_vecBusy.erase(m_vecBusy.begin() + i);
+						break;
+					}
+				}
+				if (bSuccess)
+					++m_nSaved;
+				else
+					++m_nFailed;
+			}
+			m_cvDone.notify_all();
+			m_cvWork.notify_all();	/* a job waiting for this file */
+		}
+		CoUninitialize();
+	}
+public:
+	/* nThreads = 0: one per processor, but one left for the camera and the UI */
+	CAsyncSaver(unsigned nThreads = 0, size_t cbBudget = ASYNCSAVE_BUDGET, PASYNCSAVE_CALLBACK pCallback = NULL, void* ctxCallback = NULL)
+	: m_cbBudget(cbBudget), m_pCallback(pCallback), m_ctxCallback(ctxCallback), m_cbInflight(0), m_nInflight(0), m_nSaved(0), m_nFailed(0), m_nBusy(0), m_bStop(false)
+	{
+		if (0 == nThreads)
+		{
+			nThreads = std::thread::hardware_concurrency();
+			nThreads = (nThreads > 1) ? (nThreads - 1) : 1;
+		}
+		for (unsigned i = 0; i < nThreads; ++i)
+			m_vecThread.push_back(std::thread(&CAsyncSaver::Worker, this));
+	}
+
+	/* saves everything queued before returning */
+	~CAsyncSaver()
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			m_bStop = true;
+		}
+		m_cvWork.notify_all();
+		for (size_t i = 0; i < m_vecThread.size(); ++i)
+			m_vecThread[i].join();
+	}
+
+	/* pData: allocated by malloc, owned by the saver from now on, whatever the result */
+#if defined(ASYNCSAVE_IPWRITER)
+	/* pMeta: copied, written into .png and .tif */
+	BOOL Save(const wchar_t* strFilename, void* pData, const BITMAPINFOHEADER* pHeader, const IpWriterMeta* pMeta = NULL)
+#else
+	BOOL Save(const wchar_t* strFilename, void* pData, const BITMAPINFOHEADER* pHeader)
+#endif
+	{
+		Job job;
+		job.strFilename = strFilename;
+		job.pData = pData;
+		job.header = *pHeader;
+#if defined(ASYNCSAVE_IPWRITER)
+		if (pMeta)
+			job.meta = *pMeta;
+#endif
+		if (0 == job.header.biSizeImage)
+			job.header.biSizeImage = TDIBWIDTHBYTES(pHeader->biWidth * pHeader->biBitCount) * pHeader->biHeight;
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			if (m_bStop)
+			{
+				lock.unlock();
+				free(pData);
+				return FALSE;
+			}
+			/* an image larger than the whole budget is still accepted when nothing else is in flight */
+			m_cvDone.wait(lock, [&] { return (0 == m_nInflight) || (m_cbInflight + job.header.biSizeImage <= m_cbBudget); });
+			m_cbInflight += job.header.biSizeImage;
+			++m_nInflight;
+			m_queue.push_back(job);
+		}
+		m_cvWork.notify_one();
+		return TRUE;
+	}
+
+	/* copies pData, for the buffers which are pulled into again, such as the preview buffer */
+#if defined(ASYNCSAVE_IPWRITER)
+	BOOL SaveCopy(const wchar_t* strFilename, const void* pData, const BITMAPINFOHEADER* pHeader, const IpWriterMeta* pMeta = NULL)
+#else
+	BOOL SaveCopy(const wchar_t* strFilename, const void* pData, const BITMAPINFOHEADER* pHeader)
+#endif
+	{
+		const DWORD cbImage = pHeader->biSizeImage ? pHeader->biSizeImage : TDIBWIDTHBYTES(pHeader->biWidth * pHeader->biBitCount) * pHeader->biHeight;
+		void* pCopy = malloc(cbImage);
+		if (NULL == pCopy)
+			return FALSE;
+		memcpy(pCopy, pData, cbImage);
+#if defined(ASYNCSAVE_IPWRITER)
+		return Save(strFilename, pCopy, pHeader, pMeta);
+#else
+		return Save(strFilename, pCopy, pHeader);
+#endif
+	}
+
+	/* waits until everything queued so far is saved */
+	void Flush()
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_cvDone.wait(lock, [this] { return 0 == m_nInflight; });
+	}
+
+	void GetStatistics(unsigned* pInflight, unsigned* pSaved, unsigned* pFailed)
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		*pInflight = m_nInflight;
+		*pSaved = m_nSaved;
+		*pFailed = m_nFailed;
+	}
+};
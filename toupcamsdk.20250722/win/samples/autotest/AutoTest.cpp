@@ -2,11 +2,13 @@
 #include "global.h"
 #include "AutoTest.h"
 #include "AutoTestDlg.h"
+#include "Benchmark.h"
 
 BEGIN_MESSAGE_MAP(CAutoTestApp, CWinApp)
 END_MESSAGE_MAP()
 
 CAutoTestApp::CAutoTestApp()
+: m_nExitCode(-1)
 {
 }
 
@@ -45,6 +47,19 @@ BOOL CAutoTestApp::InitInstance()
 	g_bEnableCheckBlack = GetProfileInt(_T("Options"), _T("CheckBlack"), g_bCheckBlack ? 1 : 0) ? true : false;
 	g_bRealtime = GetProfileInt(_T("Options"), _T("Realtime"), g_bRealtime ? 1 : 0) ? true : false;
 
+	if (CBenchmark::IsBenchmark(__argc, __wargv))
+	{
+		/* the output of printf to the console which launched us, if any */
+		if (AttachConsole(ATTACH_PARENT_PROCESS))
+		{
+			FILE* fp = nullptr;
+			_wfreopen_s(&fp, L"CONOUT$", L"w", stdout);
+		}
+		CBenchmark bench;
+		m_nExitCode = bench.Parse(__argc, __wargv) ? bench.Run() : 2;
+		return FALSE;
+	}
+
 	CAutoTestDlg dlg;
 	m_pMainWnd = &dlg;
 	if (dlg.DoModal() == -1)
@@ -60,4 +75,10 @@ BOOL CAutoTestApp::InitInstance()
 	// Since the dialog has been closed, return FALSE so that we exit the
 	//  application, rather than start the application's message pump.
 	return FALSE;
+}
+
+int CAutoTestApp::ExitInstance()
+{
+	const int ret = CWinApp::ExitInstance();
+	return (m_nExitCode >= 0) ? m_nExitCode : ret;
 }
\ No newline at end of file
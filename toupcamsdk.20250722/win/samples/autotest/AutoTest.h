@@ -8,11 +8,13 @@
 
 class CAutoTestApp : public CWinApp
 {
+	int m_nExitCode;	/* of the benchmark, -1: the dialog */
 public:
 	CAutoTestApp();
 
 public:
 	virtual BOOL InitInstance();
+	virtual int ExitInstance();
 	DECLARE_MESSAGE_MAP()
 };
 
@@ -9,93 +9,17 @@
 #include "CTestPropertySheet.h"
 #include <Dbt.h>
 #include <vector>
+#include "../asyncsave.h"
+#include "DropTrace.h"
 
 CAutoTestDlg* g_pMainDlg = nullptr;
 bool g_work = false;
 std::vector<HANDLE> g_thrd;
 
 
-static BOOL SaveImageByWIC(const wchar_t* strFilename, const void* pData, const BITMAPINFOHEADER* pHeader)
-{
-	GUID guidContainerFormat;
-	if (PathMatchSpec(strFilename, L"*.bmp"))
-		guidContainerFormat = GUID_ContainerFormatBmp;
-	else if (PathMatchSpec(strFilename, L"*.jpg"))
-		guidContainerFormat = GUID_ContainerFormatJpeg;
-	else if (PathMatchSpec(strFilename, L"*.png"))
-		guidContainerFormat = GUID_ContainerFormatPng;
-	else
-		return FALSE;
-
-	CComPtr<IWICImagingFactory> spIWICImagingFactory;
-	HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (LPVOID*)&spIWICImagingFactory);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICBitmapEncoder> spIWICBitmapEncoder;
-	hr = spIWICImagingFactory->CreateEncoder(guidContainerFormat, nullptr, &spIWICBitmapEncoder);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICStream> spIWICStream;
-	spIWICImagingFactory->CreateStream(&spIWICStream);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICStream->InitializeFromFilename(strFilename, GENERIC_WRITE);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICBitmapEncoder->Initialize(spIWICStream, WICBitmapEncoderNoCache);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICBitmapFrameEncode> spIWICBitmapFrameEncode;
-	CComPtr<IPropertyBag2> spIPropertyBag2;
-	hr = spIWICBitmapEncoder->CreateNewFrame(&spIWICBitmapFrameEncode, &spIPropertyBag2);
-	if (FAILED(hr))
-		return FALSE;
-
-	if (GUID_ContainerFormatJpeg == guidContainerFormat)
-	{
-		PROPBAG2 option = { 0 };
-		option.pstrName = L"ImageQuality"; /* jpg quality, you can change this setting */
-		CComVariant varValue(0.75f);
-		spIPropertyBag2->Write(1, &option, &varValue);
-	}
-	hr = spIWICBitmapFrameEncode->Initialize(spIPropertyBag2);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICBitmapFrameEncode->SetSize(pHeader->biWidth, pHeader->biHeight);
-	if (FAILED(hr))
-		return FALSE;
-
-	WICPixelFormatGUID formatGUID = GUID_WICPixelFormat24bppBGR;
-	hr = spIWICBitmapFrameEncode->SetPixelFormat(&formatGUID);
-	if (FAILED(hr))
-		return FALSE;
-
-	LONG nWidthBytes = TDIBWIDTHBYTES(pHeader->biWidth * pHeader->biBitCount);
-	for (LONG i = 0; i < pHeader->biHeight; ++i)
-	{
-		hr = spIWICBitmapFrameEncode->WritePixels(1, nWidthBytes, nWidthBytes, ((BYTE*)pData) + nWidthBytes * (pHeader->biHeight - i - 1));
-		if (FAILED(hr))
-			return FALSE;
-	}
-
-	hr = spIWICBitmapFrameEncode->Commit();
-	if (FAILED(hr))
-		return FALSE;
-	hr = spIWICBitmapEncoder->Commit();
-	if (FAILED(hr))
-		return FALSE;
-
-	return TRUE;
-}
-
 CAutoTestDlg::CAutoTestDlg(CWnd* pParent /*=nullptr*/)
-: CDialog(IDD_AUTOTEST_DIALOG, pParent), m_pImageData(nullptr), m_pSettingPropertySheet(nullptr), m_dwHeartbeat(0)
+: CDialog(IDD_AUTOTEST_DIALOG, pParent), m_pImageData(nullptr), m_pSettingPropertySheet(nullptr), m_pSaver(new CAsyncSaver()), m_dwHeartbeat(0)
+, m_tStart(0.0), m_tRecover(0.0), m_bWaitFrame(false), m_bReopen(false)
 {
 	g_pMainDlg = this;
 
@@ -105,6 +29,11 @@ CAutoTestDlg::CAutoTestDlg(CWnd* pParent /*=nullptr*/)
 	m_header.biBitCount = 24;
 }
 
+CAutoTestDlg::~CAutoTestDlg()
+{
+	delete m_pSaver;	/* waits for the images still being saved */
+}
+
 void CAutoTestDlg::DoDataExchange(CDataExchange* pDX)
 {
 	CDialog::DoDataExchange(pDX);
@@ -117,6 +46,7 @@ BEGIN_MESSAGE_MAP(CAutoTestDlg, CDialog)
 	ON_MESSAGE(MSG_CAMEVENT, &CAutoTestDlg::OnMsgCamevent)
 	ON_MESSAGE(WM_USER_PREVIEW_CHANGE, &CAutoTestDlg::OnPreviewResChanged)
 	ON_MESSAGE(WM_USER_OPEN_CLOSE, &CAutoTestDlg::OnCloseOpen)
+	ON_MESSAGE(WM_USER_RECOVER, &CAutoTestDlg::OnRecover)
 	ON_WM_CLOSE()
 	ON_BN_CLICKED(IDC_BUTTON_SETTING, &CAutoTestDlg::OnBnClickedButtonSetting)
 	ON_BN_CLICKED(IDC_BUTTON_TEST, &CAutoTestDlg::OnBnClickedButtonTest)
@@ -177,9 +107,12 @@ LRESULT CAutoTestDlg::OnMsgCamevent(WPARAM wp, LPARAM lp)
 	case TOUPCAM_EVENT_NOFRAMETIMEOUT:
 	case TOUPCAM_EVENT_NOPACKETTIMEOUT:
 	case TOUPCAM_EVENT_DISCONNECTED:
+		g_dropTrace.OnEvent((unsigned)wp);
 		OnEventError();
 		break;
 	case TOUPCAM_EVENT_IMAGE:
+		if (m_bWaitFrame)
+			OnFirstFrame();
 		OnEventImage();
 		break;
 	case TOUPCAM_EVENT_EXPOSURE:
@@ -261,6 +194,33 @@ LRESULT CAutoTestDlg::OnCloseOpen(WPARAM wp, LPARAM lp)
 	return 0;
 }
 
+LRESULT CAutoTestDlg::OnRecover(WPARAM wp, LPARAM lp)
+{
+	RecoverCamera(wp ? true : false);
+	return 0;
+}
+
+bool CAutoTestDlg::IsStreaming() const
+{
+	return g_hcam && !m_bWaitFrame;
+}
+
+double CAutoTestDlg::RecoverElapsed() const
+{
+	return GetTickMs() - m_tRecover;
+}
+
+/* stops timing the recovery; bReopen: a camera closed by it is opened again all the same, at once if it is back,
+   else when it arrives */
+void CAutoTestDlg::CancelRecover(bool bReopen)
+{
+	const bool bPending = IsRecovering() && (nullptr == g_hcam);
+	m_tRecover = 0.0;
+	m_bReopen = bReopen && bPending;
+	if (m_bReopen)
+		EnumCamera();
+}
+
 void CAutoTestDlg::EnumCamera()
 {
 	g_cameraCnt = Toupcam_EnumV2(g_cam);
@@ -277,6 +237,22 @@ void CAutoTestDlg::EnumCamera()
 		m_camList.SetCurSel(index);
 
 	UpdateButtonsState();
+
+	/* the camera being recovered is back */
+	if ((IsRecovering() || m_bReopen) && (nullptr == g_hcam))
+	{
+		for (int i = 0; i < g_cameraCnt; ++i)
+		{
+			if (m_strRecoverId == g_cam[i].id)
+			{
+				m_bReopen = false;
+				m_camList.SetCurSel(i);
+				OpenCamera(-1);
+				UpdateButtonsState();
+				break;
+			}
+		}
+	}
 }
 
 void CAutoTestDlg::UpdateButtonsState()
@@ -295,30 +271,8 @@ void CAutoTestDlg::OnBnClickedButtonStart()
 	GetDlgItemText(IDC_BUTTON_START, startBtnText);
 	if (0 == startBtnText.Compare(_T("Open")))
 	{
-		if (g_cameraCnt <= 0)
+		if ((g_cameraCnt <= 0) || !OpenCamera(-1))
 			return;
-
-		g_cur = g_cam[m_camList.GetCurSel()];
-		g_hcam = Toupcam_Open(g_cur.id);
-		if (nullptr == g_hcam)
-			return;
-
-		m_dwHeartbeat = 0;
-		if (g_HeartbeatTimeout && (g_cur.model->flag & TOUPCAM_FLAG_EVENT_HARDWARE))
-		{
-			Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_EVENT_HARDWARE, 1);
-			Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_EVENT_HARDWARE | TOUPCAM_EVENT_HEARTBEAT, 1);
-
-			SetTimer(1, 1000, nullptr);
-		}
-		Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_NOPACKET_TIMEOUT, g_NopacketTimeout);
-		Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_NOFRAME_TIMEOUT, g_NoframeTimeout);
-		Toupcam_put_RealTime(g_hcam, g_bRealtime ? 1 : 0);
-
-		StartCamera();
-
-		SetDlgItemText(IDC_BUTTON_START, _T("Close"));
-		UpdateInfo();
 	}
 	else
 	{
@@ -331,6 +285,37 @@ void CAutoTestDlg::OnBnClickedButtonStart()
 	UpdateButtonsState();
 }
 
+/* the selected camera, nRes: preview resolution, < 0 = unchanged */
+bool CAutoTestDlg::OpenCamera(int nRes)
+{
+	g_cur = g_cam[m_camList.GetCurSel()];
+	const double t = GetTickMs();
+	g_hcam = Toupcam_Open(g_cur.id);
+	if (nullptr == g_hcam)
+		return false;
+	if (g_bTesting)
+		g_vecOpenTime.push_back(GetTickMs() - t);
+
+	m_dwHeartbeat = 0;
+	if (g_HeartbeatTimeout && (g_cur.model->flag & TOUPCAM_FLAG_EVENT_HARDWARE))
+	{
+		Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_EVENT_HARDWARE, 1);
+		Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_EVENT_HARDWARE | TOUPCAM_EVENT_HEARTBEAT, 1);
+
+		SetTimer(1, 1000, nullptr);
+	}
+	Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_NOPACKET_TIMEOUT, g_NopacketTimeout);
+	Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_NOFRAME_TIMEOUT, g_NoframeTimeout);
+	Toupcam_put_RealTime(g_hcam, g_bRealtime ? 1 : 0);
+	if (nRes >= 0)
+		Toupcam_put_eSize(g_hcam, nRes);
+	StartCamera();
+
+	SetDlgItemText(IDC_BUTTON_START, _T("Close"));
+	UpdateInfo();
+	return true;
+}
+
 void CAutoTestDlg::StartCamera()
 {
 	int width = 0, height = 0;
@@ -344,17 +329,55 @@ void CAutoTestDlg::StartCamera()
 		m_pImageData = nullptr;
 	}
 	m_pImageData = malloc(m_header.biSizeImage);
+	m_tStart = GetTickMs();
+	m_bWaitFrame = true;
 	Toupcam_StartPullModeWithWndMsg(g_hcam, m_hWnd, MSG_CAMEVENT);
 }
 
+void CAutoTestDlg::OnFirstFrame()
+{
+	m_bWaitFrame = false;
+	const double now = GetTickMs();
+	if (g_bTesting)
+		g_vecFirstFrameTime.push_back(now - m_tStart);
+	if (IsRecovering())
+	{
+		g_vecRecoverTime.push_back(now - m_tRecover);
+		m_tRecover = 0.0;
+	}
+}
+
+/* a reset comes back as an error event, then the device arrives again (EnumCamera); the recovery lasts until the
+   first frame of the reopened camera */
+void CAutoTestDlg::RecoverCamera(bool bReplug)
+{
+	if (nullptr == g_hcam)
+		return;
+	m_strRecoverId = g_cur.id;
+	m_tRecover = GetTickMs();
+	if (bReplug)
+	{
+		CloseCamera();
+		SetDlgItemText(IDC_BUTTON_START, _T("Open"));
+		SetWindowText(_T(""));
+		UpdateButtonsState();
+		if (FAILED(Toupcam_Replug((LPCTSTR)m_strRecoverId)))
+			m_tRecover = 0.0;
+	}
+	else if (FAILED(Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_DEVICE_RESET, 1)))
+		m_tRecover = 0.0;
+}
+
 void CAutoTestDlg::CloseCamera()
 {
 	if (g_hcam)
 	{
+		g_dropTrace.Stop();
 		Toupcam_Close(g_hcam);
 		g_hcam = nullptr;
 	}
 	memset(&g_cur, 0, sizeof(g_cur));
+	m_bWaitFrame = false;
 
 	if (m_pImageData)
 	{
@@ -366,13 +389,15 @@ void CAutoTestDlg::CloseCamera()
 void CAutoTestDlg::OnEventError()
 {
 	CloseCamera();
-	if (g_bReplug)
+	if (g_bReplug && !IsRecovering())
 		OnBnClickedButton1();
 
 	SetDlgItemText(IDC_BUTTON_START, _T("Open"));
 	SetWindowText(_T(""));
 
 	UpdateButtonsState();
+	if (IsRecovering())
+		EnumCamera();	/* it may be back already */
 }
 
 void CAutoTestDlg::OnEventImage()
@@ -381,6 +406,7 @@ void CAutoTestDlg::OnEventImage()
 	HRESULT hr = Toupcam_PullImageV4(g_hcam, m_pImageData, 0, 24, 0, &info);
 	if (SUCCEEDED(hr))
 	{
+		g_dropTrace.OnFrame(info.v3);
 		if (g_bROITest && g_bROITest_SnapStart)
 		{
 			unsigned offsetX = 0, offsetY = 0, width = 0, height = 0;
@@ -398,7 +424,7 @@ void CAutoTestDlg::OnEventImage()
 				SYSTEMTIME tm;
 				GetLocalTime(&tm);
 				str.Format(g_snapDir + _T("\\%d_%dx%d_%04hu%02hu%02hu_%02hu%02hu%02hu_%03hu.jpg"), g_ROITestCount++, info.v3.width, info.v3.height, tm.wYear, tm.wMonth, tm.wDay, tm.wHour, tm.wMinute, tm.wSecond, tm.wMilliseconds);
-				SaveImageByWIC(str, m_pImageData, &header);
+				m_pSaver->SaveCopy(str, m_pImageData, &header);
 				g_bROITest_SnapStart = false;
 				g_bROITest_SnapFinish = true;
 			}
@@ -409,7 +435,7 @@ void CAutoTestDlg::OnEventImage()
 			GetLocalTime(&tm);
 			CString str;
 			str.Format(g_snapDir + _T("\\%d_%04hu%02hu%02hu_%02hu%02hu%02hu_%03hu.jpg"), g_TriggerTestCount, tm.wYear, tm.wMonth, tm.wDay, tm.wHour, tm.wMinute, tm.wSecond, tm.wMilliseconds);
-			SaveImageByWIC(str, m_pImageData, &m_header);
+			m_pSaver->SaveCopy(str, m_pImageData, &m_header);
 		}
 		else if (g_bImageSnap)
 		{
@@ -419,7 +445,7 @@ void CAutoTestDlg::OnEventImage()
 			SYSTEMTIME tm;
 			GetLocalTime(&tm);
 			str.Format(g_snapDir + _T("\\%d_%dx%d_%04hu%02hu%02hu_%02hu%02hu%02hu_%03hu.jpg"), g_snapCount, resWidth, resHeight, tm.wYear, tm.wMonth, tm.wDay, tm.wHour, tm.wMinute, tm.wSecond, tm.wMilliseconds);
-			SaveImageByWIC(str, m_pImageData, &m_header);
+			m_pSaver->SaveCopy(str, m_pImageData, &m_header);
 			CheckBlackProc();
 			g_bImageSnap = false;
 		}
@@ -433,7 +459,7 @@ void CAutoTestDlg::OnEventImage()
 			SYSTEMTIME tm;
 			GetLocalTime(&tm);
 			str.Format(g_snapDir + _T("\\%d_%dx%d_%S_%04hu%02hu%02hu_%02hu%02hu%02hu_%03hu.jpg"), g_snapCount, resWidth, resHeight, formatName, tm.wYear, tm.wMonth, tm.wDay, tm.wHour, tm.wMinute, tm.wSecond, tm.wMilliseconds);
-			SaveImageByWIC(str, m_pImageData, &m_header);
+			m_pSaver->SaveCopy(str, m_pImageData, &m_header);
 			CheckBlackProc();
 			g_bBitdepthTest = false;
 		}
@@ -495,7 +521,8 @@ void CAutoTestDlg::OnEventStillImage()
 				Toupcam_get_Size(g_hcam, &resWidth, &resHeight);
 				CString str;
 				str.Format(g_snapDir + _T("\\%d_%dx%d_%dx%d.jpg"), g_snapCount, resWidth, resHeight, info.v3.width, info.v3.height);
-				SaveImageByWIC(str, pData, &header);
+				m_pSaver->Save(str, pData, &header);
+				pData = nullptr;
 				CheckBlackProc();
 				g_bSnapFinish = true;
 			}
@@ -504,7 +531,8 @@ void CAutoTestDlg::OnEventStillImage()
 				static int index = 0;
 				CString str;
 				str.Format(_T("autotest_%d.jpg"), ++index);
-				SaveImageByWIC(str, pData, &header);
+				m_pSaver->Save(str, pData, &header);
+				pData = nullptr;
 			}
 		}
 		free(pData);
@@ -529,30 +557,8 @@ void CAutoTestDlg::OpenCloseCamera(unsigned nRes)
 	GetDlgItemText(IDC_BUTTON_START, startBtnText);
 	if (0 == startBtnText.Compare(_T("Open")))
 	{
-		if (g_cameraCnt <= 0)
-			return;
-
-		g_cur = g_cam[m_camList.GetCurSel()];
-		g_hcam = Toupcam_Open(g_cur.id);
-		if (nullptr == g_hcam)
+		if ((g_cameraCnt <= 0) || !OpenCamera(nRes))
 			return;
-
-		m_dwHeartbeat = 0;
-		if (g_HeartbeatTimeout && (g_cur.model->flag & TOUPCAM_FLAG_EVENT_HARDWARE))
-		{
-			Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_EVENT_HARDWARE, 1);
-			Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_EVENT_HARDWARE | TOUPCAM_EVENT_HEARTBEAT, 1);
-
-			SetTimer(1, 1000, nullptr);
-		}
-		Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_NOPACKET_TIMEOUT, g_NopacketTimeout);
-		Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_NOFRAME_TIMEOUT, g_NoframeTimeout);
-		Toupcam_put_RealTime(g_hcam, g_bRealtime ? 1 : 0);
-		Toupcam_put_eSize(g_hcam, nRes);
-		StartCamera();
-
-		SetDlgItemText(IDC_BUTTON_START, _T("Close"));
-		UpdateInfo();
 	}
 	else
 	{
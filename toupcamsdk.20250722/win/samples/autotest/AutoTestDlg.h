@@ -1,6 +1,7 @@
 #pragma once
 
 class CSettingPropertySheet;
+class CAsyncSaver;
 class CAutoTestDlg : public CDialog
 {
 	CComboBox m_camList;
@@ -8,8 +9,19 @@ class CAutoTestDlg : public CDialog
 	BITMAPINFOHEADER m_header;
 	void* m_pImageData;
 	CSettingPropertySheet* m_pSettingPropertySheet;
+	CAsyncSaver* m_pSaver;
+	double m_tStart, m_tRecover;	/* GetTickMs() of StartCamera, of the reset / replug being recovered (0: none) */
+	bool m_bWaitFrame;				/* no frame since StartCamera */
+	bool m_bReopen;					/* a recovery cancelled: m_strRecoverId is opened again when it arrives, not timed */
+	CString m_strRecoverId;
 public:
 	CAutoTestDlg(CWnd* pParent = nullptr);
+	~CAutoTestDlg();
+
+	bool IsStreaming() const;		/* open, and the first frame arrived */
+	bool IsRecovering() const { return m_tRecover > 0.0; }
+	double RecoverElapsed() const;
+	void CancelRecover(bool bReopen = false);
 
 #ifdef AFX_DESIGN_TIME
 	enum { IDD = IDD_AUTOTEST_DIALOG };
@@ -22,6 +34,7 @@ protected:
 	afx_msg LRESULT OnMsgCamevent(WPARAM wp, LPARAM lp);
 	afx_msg LRESULT OnPreviewResChanged(WPARAM wp, LPARAM lp);
 	afx_msg LRESULT OnCloseOpen(WPARAM wp, LPARAM lp);
+	afx_msg LRESULT OnRecover(WPARAM wp, LPARAM lp);
 	afx_msg void OnBnClickedButtonStart();
 	afx_msg void OnClose();
 	afx_msg void OnBnClickedButtonSetting();
@@ -34,6 +47,7 @@ protected:
 private:
 	void EnumCamera();
 	void UpdateButtonsState();
+	bool OpenCamera(int nRes);
 	void StartCamera();
 	void CloseCamera();
 	void OnEventError();
@@ -43,6 +57,8 @@ private:
 	void OnEventStillImage();
 	void UpdateInfo();
 	void OpenCloseCamera(unsigned nRes);
+	void RecoverCamera(bool bReplug);
+	void OnFirstFrame();
 	void CheckBlackProc();
 };
 
@@ -0,0 +1,425 @@
+#include "stdafx.h"
+#include "global.h"
+#include "Benchmark.h"
+#include <algorithm>
+#include <string>
+
+static double HostTime()	/* us */
+{
+	static LARGE_INTEGER freq = { 0 };
+	if (0 == freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart * 1000000.0 / freq.QuadPart;
+}
+
+static double ProcessTime()	/* us, user + kernel */
+{
+	FILETIME ftCreate, ftExit, ftKernel, ftUser;
+	if (!GetProcessTimes(GetCurrentProcess(), &ftCreate, &ftExit, &ftKernel, &ftUser))
+		return 0.0;
+	const ULONGLONG k = ((ULONGLONG)ftKernel.dwHighDateTime << 32) | ftKernel.dwLowDateTime;
+	const ULONGLONG u = ((ULONGLONG)ftUser.dwHighDateTime << 32) | ftUser.dwLowDateTime;
+	return (k + u) / 10.0;
+}
+
+/* p50, p95, p99, max in ms; bRelative: minus the smallest one */
+static void Percentiles(std::vector<double>& v, bool bRelative, double out[4])
+{
+	out[0] = out[1] = out[2] = out[3] = 0.0;
+	if (v.empty())
+		return;
+	std::sort(v.begin(), v.end());
+	const double base = bRelative ? v[0] : 0.0;
+	const double p[3] = { 0.50, 0.95, 0.99 };
+	for (int i = 0; i < 3; ++i)
+		out[i] = (v[(size_t)(p[i] * (v.size() - 1) + 0.5)] - base) / 1000.0;
+	out[3] = (v.back() - base) / 1000.0;
+}
+
+static std::string JsonString(const char* str)
+{
+	std::string s = "\"";
+	for (; *str; ++str)
+	{
+		if (('"' == *str) || ('\\' == *str))
+			s += '\\';
+		if ((unsigned char)*str >= 0x20)
+			s += *str;
+	}
+	return s + "\"";
+}
+
+CBenchmark::CBenchmark()
+: m_bRaw(false), m_nCam(0), m_nWarmup(2), m_nTime(10), m_hcam(nullptr), m_pData(nullptr)
+, m_bMeasure(false), m_nFrames(0), m_seqGaps(0), m_lastSeq(0), m_bSeq(false), m_lastArrival(0.0)
+{
+	memset(&m_dev, 0, sizeof(m_dev));
+	m_vecRoi.push_back(1);
+	m_vecSpeed.push_back(INT_MAX);		/* the highest one */
+	m_vecFmt.push_back(-1);
+	m_vecBandwidth.push_back(100);
+}
+
+CBenchmark::~CBenchmark()
+{
+	if (m_hcam)
+		Toupcam_Close(m_hcam);
+	if (m_pData)
+		free(m_pData);
+}
+
+bool CBenchmark::IsBenchmark(int argc, wchar_t** argv)
+{
+	return (argc > 1) && ((0 == _wcsicmp(argv[1], L"/bench")) || (0 == _wcsicmp(argv[1], L"-bench")));
+}
+
+/* "all" leaves v empty: every value the camera has */
+bool CBenchmark::ParseList(const wchar_t* str, std::vector<int>& v)
+{
+	v.clear();
+	if (0 == _wcsicmp(str, L"all"))
+		return true;
+	while (*str)
+	{
+		wchar_t* end = nullptr;
+		v.push_back(wcstol(str, &end, 10));
+		if (end == str)
+			return false;
+		str = (L',' == *end) ? end + 1 : end;
+	}
+	return !v.empty();
+}
+
+bool CBenchmark::Parse(int argc, wchar_t** argv)
+{
+	for (int i = 2; i < argc; ++i)
+	{
+		const wchar_t* arg = argv[i];
+		if ((L'/' != arg[0]) && (L'-' != arg[0]))
+			return false;
+		++arg;
+		const wchar_t* val = wcschr(arg, L':');
+		const size_t len = val ? val - arg : wcslen(arg);
+		if (val)
+			++val;
+		bool bok = true;
+		if ((3 == len) && (0 == _wcsnicmp(arg, L"raw", len)))
+			m_bRaw = true;
+		else if (nullptr == val)
+			bok = false;
+		else if ((3 == len) && (0 == _wcsnicmp(arg, L"cam", len)))
+			m_nCam = _wtoi(val);
+		else if ((3 == len) && (0 == _wcsnicmp(arg, L"res", len)))
+			bok = ParseList(val, m_vecRes);
+		else if ((3 == len) && (0 == _wcsnicmp(arg, L"fmt", len)))
+			bok = ParseList(val, m_vecFmt);
+		else if ((3 == len) && (0 == _wcsnicmp(arg, L"roi", len)))
+			bok = ParseList(val, m_vecRoi);
+		else if ((5 == len) && (0 == _wcsnicmp(arg, L"speed", len)))
+			bok = ParseList(val, m_vecSpeed);
+		else if ((2 == len) && (0 == _wcsnicmp(arg, L"bw", len)))
+			bok = ParseList(val, m_vecBandwidth);
+		else if ((6 == len) && (0 == _wcsnicmp(arg, L"warmup", len)))
+			m_nWarmup = _wtoi(val);
+		else if ((4 == len) && (0 == _wcsnicmp(arg, L"time", len)))
+			bok = ((m_nTime = _wtoi(val)) > 0);
+		else if ((3 == len) && (0 == _wcsnicmp(arg, L"out", len)))
+			m_strOut = val;
+		else
+			bok = false;
+		if (!bok)
+		{
+			wprintf(L"invalid argument: %s\n", argv[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+std::vector<BenchCase> CBenchmark::Cases() const
+{
+	std::vector<int> vecRes(m_vecRes), vecFmt(m_vecFmt), vecRoi(m_vecRoi), vecSpeed(m_vecSpeed), vecBandwidth(m_vecBandwidth);
+	if (vecRes.empty())
+	{
+		for (unsigned i = 0; i < m_dev.model->preview; ++i)
+			vecRes.push_back(i);
+	}
+	if (vecFmt.empty())
+	{
+		int n = 0;
+		if (SUCCEEDED(Toupcam_get_PixelFormatSupport(m_hcam, -1, &n)))
+		{
+			for (int i = 0; i < n; ++i)
+			{
+				int fmt = 0;
+				if (SUCCEEDED(Toupcam_get_PixelFormatSupport(m_hcam, (char)i, &fmt)))
+					vecFmt.push_back(fmt);
+			}
+		}
+		if (vecFmt.empty())
+			vecFmt.push_back(-1);
+	}
+	if (vecRoi.empty())
+	{
+		const int roi[] = { 1, 2, 4 };
+		vecRoi.assign(roi, roi + _countof(roi));
+	}
+	if (vecSpeed.empty())
+	{
+		for (unsigned i = 0; i <= m_dev.model->maxspeed; ++i)
+			vecSpeed.push_back(i);
+	}
+	for (size_t i = 0; i < vecSpeed.size(); ++i)
+		vecSpeed[i] = std::min(vecSpeed[i], (int)m_dev.model->maxspeed);
+	if (0 == (m_dev.model->flag & TOUPCAM_FLAG_PRECISE_FRAMERATE))
+		vecBandwidth.assign(1, -1);
+	else if (vecBandwidth.empty())
+	{
+		const int bw[] = { 100, 75, 50, 25 };
+		vecBandwidth.assign(bw, bw + _countof(bw));
+	}
+
+	std::vector<BenchCase> vecCase;
+	for (size_t a = 0; a < vecRes.size(); ++a)
+		for (size_t b = 0; b < vecFmt.size(); ++b)
+			for (size_t c = 0; c < vecRoi.size(); ++c)
+				for (size_t d = 0; d < vecSpeed.size(); ++d)
+					for (size_t e = 0; e < vecBandwidth.size(); ++e)
+					{
+						const BenchCase bc = { vecRes[a], vecFmt[b], vecRoi[c], vecSpeed[d], vecBandwidth[e] };
+						vecCase.push_back(bc);
+					}
+	return vecCase;
+}
+
+void __stdcall CBenchmark::EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+	if (TOUPCAM_EVENT_IMAGE == nEvent)
+		static_cast<CBenchmark*>(pCallbackCtx)->OnImage();
+}
+
+void CBenchmark::OnImage()
+{
+	ToupcamFrameInfoV4 info = { 0 };
+	const HRESULT hr = Toupcam_PullImageV4(m_hcam, m_pData, 0, m_bRaw ? 0 : 24, 0, &info);
+	const double now = HostTime();
+	if (FAILED(hr))
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (!m_bMeasure)
+		return;
+	++m_nFrames;
+	if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_SEQ)
+	{
+		if (m_bSeq && (info.v3.seq > m_lastSeq + 1))
+			m_seqGaps += info.v3.seq - m_lastSeq - 1;
+		m_lastSeq = info.v3.seq;
+		m_bSeq = true;
+	}
+	if (m_lastArrival > 0.0)
+		m_vecInterval.push_back(now - m_lastArrival);
+	m_lastArrival = now;
+	if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP)
+		m_vecLatency.push_back(now - (double)info.v3.timestamp);
+}
+
+BenchResult CBenchmark::Measure(const BenchCase& c)
+{
+	BenchResult r;
+	memset(&r, 0, sizeof(r));
+	r.c = c;
+
+	Toupcam_Stop(m_hcam);
+	HRESULT hr = S_OK;
+	if (c.res >= 0)
+		hr = Toupcam_put_eSize(m_hcam, c.res);
+	if (SUCCEEDED(hr) && (c.fmt >= 0))
+		hr = Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_PIXEL_FORMAT, c.fmt);
+	if (SUCCEEDED(hr))
+	{
+		int w = 0, h = 0;
+		Toupcam_get_Size(m_hcam, &w, &h);
+		if (c.roi > 1)
+		{
+			const unsigned rw = (w / c.roi) & ~1u, rh = (h / c.roi) & ~1u;
+			hr = Toupcam_put_Roi(m_hcam, ((w - rw) / 2) & ~1u, ((h - rh) / 2) & ~1u, rw, rh);
+		}
+		else
+			hr = Toupcam_put_Roi(m_hcam, 0, 0, 0, 0);
+	}
+	if (SUCCEEDED(hr) && (c.speed >= 0))
+		hr = Toupcam_put_Speed(m_hcam, (USHORT)c.speed);
+	if (SUCCEEDED(hr) && (c.bandwidth > 0))
+		hr = Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_BANDWIDTH, c.bandwidth);
+	if (SUCCEEDED(hr))
+	{
+		int w = 0, h = 0;
+		hr = Toupcam_get_FinalSize(m_hcam, &w, &h);
+		if (SUCCEEDED(hr))
+		{
+			r.width = w;
+			r.height = h;
+			if (m_pData)
+				free(m_pData);
+			m_pData = malloc((size_t)TDIBWIDTHBYTES(32 * w) * h);	/* RGB24 or RAW of up to 16 bits */
+			if (nullptr == m_pData)
+				hr = E_OUTOFMEMORY;
+		}
+	}
+	if (SUCCEEDED(hr))
+	{
+		/* the values in effect, "unchanged" or clamped ones included */
+		unsigned res = 0;
+		USHORT speed = 0;
+		if (SUCCEEDED(Toupcam_get_eSize(m_hcam, &res)))
+			r.c.res = res;
+		Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_PIXEL_FORMAT, &r.c.fmt);
+		if (SUCCEEDED(Toupcam_get_Speed(m_hcam, &speed)))
+			r.c.speed = speed;
+		if (c.bandwidth > 0)
+			Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_BANDWIDTH, &r.c.bandwidth);
+		hr = Toupcam_StartPullModeWithCallback(m_hcam, EventCallback, this);
+	}
+	if (FAILED(hr))
+	{
+		r.hr = hr;
+		return r;
+	}
+
+	Sleep(m_nWarmup * 1000);
+	int drop0 = 0, drop1 = 0;
+	double t0, cpu0;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_nFrames = m_seqGaps = 0;
+		m_bSeq = false;
+		m_lastArrival = 0.0;
+		m_vecInterval.clear();
+		m_vecLatency.clear();
+		Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_NUMBER_DROP_FRAME, &drop0);
+		t0 = HostTime();
+		cpu0 = ProcessTime();
+		m_bMeasure = true;
+	}
+	Sleep(m_nTime * 1000);
+	std::vector<double> vecInterval, vecLatency;
+	double t1, cpu1;
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_bMeasure = false;
+		t1 = HostTime();
+		cpu1 = ProcessTime();
+		Toupcam_get_Option(m_hcam, TOUPCAM_OPTION_NUMBER_DROP_FRAME, &drop1);
+		vecInterval.swap(m_vecInterval);
+		vecLatency.swap(m_vecLatency);
+		r.frames = m_nFrames;
+		r.seqGaps = m_seqGaps;
+	}
+	Toupcam_Stop(m_hcam);
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	r.drops = (drop1 > drop0) ? drop1 - drop0 : 0;
+	r.fps = r.frames * 1000000.0 / (t1 - t0);
+	r.cpu = 100.0 * (cpu1 - cpu0) / (t1 - t0) / std::max(1ul, (unsigned long)si.dwNumberOfProcessors);
+	Percentiles(vecInterval, false, r.interval);
+	Percentiles(vecLatency, true, r.latency);
+	return r;
+}
+
+bool CBenchmark::Write(const std::vector<BenchResult>& vecResult) const
+{
+	CString strBase = m_strOut.IsEmpty() ? GetAppTimeDir(_T("Bench")) : m_strOut;
+	FILE* fjson = _wfopen((LPCTSTR)(strBase + L".json"), L"wt");
+	FILE* fcsv = _wfopen((LPCTSTR)(strBase + L".csv"), L"wt");
+	if ((nullptr == fjson) || (nullptr == fcsv))
+	{
+		wprintf(L"failed to create %s.json / .csv\n", (LPCTSTR)strBase);
+		if (fjson)
+			fclose(fjson);
+		if (fcsv)
+			fclose(fcsv);
+		return false;
+	}
+
+	char sn[32] = { 0 }, fw[16] = { 0 };
+	Toupcam_get_SerialNumber(m_hcam, sn);
+	Toupcam_get_FwVersion(m_hcam, fw);
+	fprintf(fjson, "{\n\t\"sdk\": %s,\n\t\"camera\": %s,\n\t\"sn\": %s,\n\t\"fw\": %s,\n\t\"raw\": %s,\n\t\"warmup\": %u,\n\t\"time\": %u,\n\t\"results\": [\n",
+		JsonString(CW2A(Toupcam_Version(), CP_UTF8)).c_str(), JsonString(CW2A(m_dev.displayname, CP_UTF8)).c_str(),
+		JsonString(sn).c_str(), JsonString(fw).c_str(), m_bRaw ? "true" : "false", m_nWarmup, m_nTime);
+	fputs("res,width,height,format,roi,speed,bandwidth,hr,frames,fps,drops,seqgaps,cpu,"
+		"interval_p50,interval_p95,interval_p99,interval_max,latency_p50,latency_p95,latency_p99,latency_max\n", fcsv);
+	for (size_t i = 0; i < vecResult.size(); ++i)
+	{
+		const BenchResult& r = vecResult[i];
+		const char* szFmt = (r.c.fmt >= 0) ? Toupcam_get_PixelFormatName(r.c.fmt) : nullptr;
+		fprintf(fjson, "\t\t{ \"res\": %d, \"width\": %u, \"height\": %u, \"format\": %s, \"roi\": %d, \"speed\": %d, \"bandwidth\": %d, \"hr\": \"0x%08x\", "
+			"\"frames\": %u, \"fps\": %.2f, \"drops\": %u, \"seqgaps\": %u, \"cpu\": %.1f, "
+			"\"interval\": [%.3f, %.3f, %.3f, %.3f], \"latency\": [%.3f, %.3f, %.3f, %.3f] }%s\n",
+			r.c.res, r.width, r.height, JsonString(szFmt ? szFmt : "").c_str(), r.c.roi, r.c.speed, r.c.bandwidth, r.hr,
+			r.frames, r.fps, r.drops, r.seqGaps, r.cpu,
+			r.interval[0], r.interval[1], r.interval[2], r.interval[3], r.latency[0], r.latency[1], r.latency[2], r.latency[3],
+			(i + 1 < vecResult.size()) ? "," : "");
+		fprintf(fcsv, "%d,%u,%u,%s,%d,%d,%d,0x%08x,%u,%.2f,%u,%u,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+			r.c.res, r.width, r.height, szFmt ? szFmt : "", r.c.roi, r.c.speed, r.c.bandwidth, r.hr,
+			r.frames, r.fps, r.drops, r.seqGaps, r.cpu,
+			r.interval[0], r.interval[1], r.interval[2], r.interval[3], r.latency[0], r.latency[1], r.latency[2], r.latency[3]);
+	}
+	fputs("\t]\n}\n", fjson);
+	fclose(fjson);
+	fclose(fcsv);
+	wprintf(L"results: %s.json, %s.csv\n", (LPCTSTR)strBase, (LPCTSTR)strBase);
+	return true;
+}
+
+int CBenchmark::Run()
+{
+	Toupcam_GigeEnable(nullptr, nullptr);
+	ToupcamDeviceV2 arr[TOUPCAM_MAX] = { 0 };
+	const unsigned n = Toupcam_EnumV2(arr);
+	if (m_nCam >= n)
+	{
+		wprintf(L"camera %u not found, %u camera(s)\n", m_nCam, n);
+		return 2;
+	}
+	m_dev = arr[m_nCam];
+	m_hcam = Toupcam_Open(m_dev.id);
+	if (nullptr == m_hcam)
+	{
+		wprintf(L"failed to open camera %s\n", m_dev.displayname);
+		return 2;
+	}
+	if (m_bRaw)
+		Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_RAW, 1);
+
+	const std::vector<BenchCase> vecCase = Cases();
+	std::vector<BenchResult> vecResult;
+	size_t nRan = 0;
+	wprintf(L"%s, %u combination(s), %u + %u s each\n", m_dev.displayname, (unsigned)vecCase.size(), m_nWarmup, m_nTime);
+	for (size_t i = 0; i < vecCase.size(); ++i)
+	{
+		const BenchResult r = Measure(vecCase[i]);
+		if (FAILED(r.hr))
+		{
+			wprintf(L"[%u/%u] res %d, fmt %d, roi 1/%d, speed %d, bandwidth %d: failed, hr = 0x%08x\n", (unsigned)i + 1, (unsigned)vecCase.size(),
+				r.c.res, r.c.fmt, r.c.roi, r.c.speed, r.c.bandwidth, r.hr);
+		}
+		else
+		{
+			++nRan;
+			wprintf(L"[%u/%u] %u x %u, fmt %d, roi 1/%d, speed %d, bandwidth %d: %.2f fps, %u dropped, cpu %.1f%%, interval p99 %.2f ms, latency p99 %.2f ms\n",
+				(unsigned)i + 1, (unsigned)vecCase.size(), r.width, r.height, r.c.fmt, r.c.roi, r.c.speed, r.c.bandwidth,
+				r.fps, r.drops + r.seqGaps, r.cpu, r.interval[2], r.latency[2]);
+		}
+		vecResult.push_back(r);
+	}
+	if (!Write(vecResult))
+		return 2;
+	if (0 == nRan)
+		return 2;
+	return (nRan == vecCase.size()) ? 0 : 1;
+}
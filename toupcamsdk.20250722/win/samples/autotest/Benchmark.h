@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * Headless throughput benchmark, run instead of the dialog when the command line starts with /bench:
+ *   AutoTest.exe /bench [/cam:n] [/res:list] [/fmt:list] [/roi:list] [/speed:list] [/bw:list] [/raw] [/warmup:s] [/time:s] [/out:path]
+ * Every combination of resolution x pixel format x ROI x speed x bandwidth is streamed for warmup + time seconds, the
+ * same settings as the resolution, bit depth, ROI and frame rate pages, and measured over the last time seconds:
+ *   fps			frames pulled / time
+ *   drops			TOUPCAM_OPTION_NUMBER_DROP_FRAME during the measure, plus the gaps of the frame sequence numbers
+ *   cpu			user + kernel time of the process / time, in % of all the logical processors
+ *   interval		host time between two frames, p50 / p95 / p99 / max, ms
+ *   latency		host arrival time - frame timestamp, minus the smallest one of the run: the camera clock is not the
+ *					host clock, so this is the spread of the latency (the queueing in the USB / Ethernet path and the
+ *					SDK), p50 / p95 / p99 / max, ms
+ * Lists are comma separated numbers or "all"; by default: all the resolutions, the current pixel format (-1), full
+ * frame (roi 1; n = a centred ROI of 1/n of the width and height), the highest speed, bandwidth 100 (when the camera
+ * supports TOUPCAM_FLAG_PRECISE_FRAMERATE). /raw pulls the RAW data instead of RGB24. Results go to path.json and
+ * path.csv, by default next to the executable. Exit code: 0 = every combination ran, 1 = some failed, 2 = none ran
+ * (all failed, no camera, or the results could not be written).
+ */
+#include <vector>
+#include <mutex>
+
+struct BenchCase {
+	int		res, fmt, roi, speed, bandwidth;	/* -1: unchanged */
+};
+
+struct BenchResult {
+	BenchCase	c;
+	HRESULT		hr;					/* the first failure setting up or starting, S_OK */
+	unsigned	width, height;
+	unsigned	frames, drops, seqGaps;
+	double		fps, cpu;
+	double		interval[4], latency[4];	/* p50, p95, p99, max, ms */
+};
+
+class CBenchmark
+{
+	std::vector<int>	m_vecRes, m_vecFmt, m_vecRoi, m_vecSpeed, m_vecBandwidth;
+	bool				m_bRaw;
+	unsigned			m_nCam, m_nWarmup, m_nTime;
+	CString				m_strOut;
+
+	HToupcam			m_hcam;
+	ToupcamDeviceV2		m_dev;
+	void*				m_pData;
+	std::mutex			m_mtx;
+	bool				m_bMeasure;
+	unsigned			m_nFrames, m_seqGaps, m_lastSeq;
+	bool				m_bSeq;
+	double				m_lastArrival;
+	std::vector<double>	m_vecInterval, m_vecLatency;	/* us */
+
+	static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx);
+	void OnImage();
+	static bool ParseList(const wchar_t* str, std::vector<int>& v);
+	std::vector<BenchCase> Cases() const;
+	BenchResult Measure(const BenchCase& c);
+	bool Write(const std::vector<BenchResult>& vecResult) const;
+public:
+	CBenchmark();
+	~CBenchmark();
+
+	static bool IsBenchmark(int argc, wchar_t** argv);
+	bool Parse(int argc, wchar_t** argv);
+	int Run();
+};
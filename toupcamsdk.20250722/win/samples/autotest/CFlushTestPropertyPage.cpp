@@ -2,6 +2,7 @@
 #include "global.h"
 #include "AutoTest.h"
 #include "CFlushTestPropertyPage.h"
+#include "DropTrace.h"
 
 CFlushTestPropertyPage::CFlushTestPropertyPage()
 	: CTestPropertyPage(IDD_PROPERTY_FLUSH_TEST)
@@ -51,29 +52,34 @@ void CFlushTestPropertyPage::OnEnChangeEditInterval()
 
 void CFlushTestPropertyPage::OnTimer(UINT_PTR nIDEvent)
 {
+	g_dropTrace.Mark(DROP_FLUSH, "flush");
 	Toupcam_put_Option(g_hcam, TOUPCAM_OPTION_FLUSH, ((CComboBox*)GetDlgItem(IDC_COMBO1))->GetCurSel() + 1);
 
 	++m_count;
 	UpdateHint();
 	if (m_count >= m_totalCount)
 	{
-		Stop();
-		AfxMessageBox(_T("Flush test completed."));
+		AfxMessageBox(_T("Flush test completed.") + Stop());
 	}
 }
 
-void CFlushTestPropertyPage::Stop()
+CString CFlushTestPropertyPage::Stop()
 {
 	m_bStart = g_bTesting = false;
 	KillTimer(1);
 	SetDlgItemText(IDC_BUTTON_FLUSH_TEST_START, _T("Start"));
 	GetDlgItem(IDC_EDIT_FLUSH_TEST_CNT)->EnableWindow(TRUE);
+	return StopDropTrace();
 }
 
 void CFlushTestPropertyPage::OnBnClickedButtonFlushTestStart()
 {
 	if (m_bStart)
-		Stop();
+	{
+		const CString str = Stop();
+		if (!str.IsEmpty())
+			AfxMessageBox(_T("Flush test stopped.") + str);
+	}
 	else if (OnStart())
 	{
 		m_bStart = g_bTesting = true;
@@ -81,6 +87,7 @@ void CFlushTestPropertyPage::OnBnClickedButtonFlushTestStart()
 		m_count = 0;
 		SetDlgItemText(IDC_BUTTON_FLUSH_TEST_START, _T("Stop"));
 		GetDlgItem(IDC_EDIT_FLUSH_TEST_CNT)->EnableWindow(FALSE);
+		StartDropTrace(_T("FlushTest"));
 		SetTimer(1, m_interval, nullptr);
 	}
 }
\ No newline at end of file
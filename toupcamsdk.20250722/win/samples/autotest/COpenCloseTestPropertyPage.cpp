@@ -4,9 +4,11 @@
 #include "COpenCloseTestPropertyPage.h"
 #include "AutoTestDlg.h"
 
+#define RECOVER_TIMEOUT		30000	/* ms without the camera back: counted as failed */
+
 COpenCloseTestPropertyPage::COpenCloseTestPropertyPage()
 	: CTestPropertyPage(IDD_PROPERTY_OPEN_CLOSE_TEST)
-	, m_initFlag(false), m_interval(2000)
+	, m_initFlag(false), m_interval(2000), m_mode(0), m_nFailed(0)
 {
 }
 
@@ -31,6 +33,11 @@ BOOL COpenCloseTestPropertyPage::OnInitDialog()
 	GetDlgItem(IDC_BUTTON_OPEN_CLOSE_TEST_START)->EnableWindow(m_totalCount > 0 && m_interval >= 100);
 	SetDlgItemInt(IDC_EDIT_OPEN_CLOSE_CNT, m_totalCount, FALSE);
 	SetDlgItemInt(IDC_EDIT_OPEN_CLOSE_INTERVAL, m_interval, FALSE);
+	CComboBox* pCombox = (CComboBox*)GetDlgItem(IDC_COMBO_OPEN_CLOSE_MODE);
+	pCombox->AddString(_T("Open / close"));
+	pCombox->AddString(_T("Device reset"));
+	pCombox->AddString(_T("Replug"));
+	pCombox->SetCurSel(m_mode);
 	return TRUE;
 }
 
@@ -50,13 +57,19 @@ void COpenCloseTestPropertyPage::OnEnChangeEditOpenCloseInterval()
 void COpenCloseTestPropertyPage::OnTimer(UINT_PTR nIDEvent)
 {
 	KillTimer(1);
-	if (m_count >= m_totalCount || g_bBlack)
+	/* the last reset / replug is over only once the camera is back: its recovery is timed too */
+	if (g_bBlack || ((m_count >= m_totalCount) && !g_pMainDlg->IsRecovering()))
 	{
 		Stop();
 		if (g_bBlack)
 			AfxMessageBox(_T("Image is completely black."), MB_ICONEXCLAMATION | MB_OK);
 		else
-			AfxMessageBox(_T("Open/close test completed."), MB_ICONINFORMATION | MB_OK);
+			AfxMessageBox(_T("Open/close test completed.\n\n") + Report(), MB_ICONINFORMATION | MB_OK);
+		return;
+	}
+	if (m_mode)
+	{
+		OnTimerRecover();
 		return;
 	}
 	if (m_conModel)
@@ -87,6 +100,56 @@ void COpenCloseTestPropertyPage::OnTimer(UINT_PTR nIDEvent)
 	}
 }
 
+/* reset or replug the camera once it streams, then wait for it to come back */
+void COpenCloseTestPropertyPage::OnTimerRecover()
+{
+	if (g_pMainDlg->IsRecovering())
+	{
+		if (g_pMainDlg->RecoverElapsed() > RECOVER_TIMEOUT)
+		{
+			++m_nFailed;
+			g_pMainDlg->CancelRecover();
+		}
+	}
+	else if (nullptr == g_hcam)
+		g_pMainDlg->SendMessage(WM_USER_OPEN_CLOSE);	/* the first open, or after a recovery timed out */
+	else if (g_pMainDlg->IsStreaming())
+	{
+		g_pMainDlg->SendMessage(WM_USER_RECOVER, (2 == m_mode) ? 1 : 0);
+		g_snapCount = ++m_count;
+		UpdateHint();
+	}
+	SetTimer(1, g_pMainDlg->IsRecovering() ? 100 : m_interval, nullptr);
+}
+
+/* percentiles of the timings, also saved to latency.csv of the test directory */
+CString COpenCloseTestPropertyPage::Report() const
+{
+	CString str = FormatLatency(_T("open"), g_vecOpenTime) + FormatLatency(_T("first frame"), g_vecFirstFrameTime);
+	if (m_mode)
+	{
+		str += FormatLatency((2 == m_mode) ? _T("replug") : _T("device reset"), g_vecRecoverTime);
+		CString strFailed;
+		strFailed.Format(_T("failed: %u\n"), m_nFailed);
+		str += strFailed;
+	}
+
+	FILE* fp = _wfopen((LPCTSTR)(g_snapDir + _T("\\latency.csv")), L"wt");
+	if (fp)
+	{
+		const std::vector<double>* v[] = { &g_vecOpenTime, &g_vecFirstFrameTime, &g_vecRecoverTime };
+		const char* name[] = { "open", "first frame", "recover" };
+		fputs("event,ms\n", fp);
+		for (int i = 0; i < _countof(v); ++i)
+		{
+			for (size_t j = 0; j < v[i]->size(); ++j)
+				fprintf(fp, "%s,%.3f\n", name[i], (*v[i])[j]);
+		}
+		fclose(fp);
+	}
+	return str;
+}
+
 void COpenCloseTestPropertyPage::Stop()
 {
 	KillTimer(1);
@@ -94,6 +157,8 @@ void COpenCloseTestPropertyPage::Stop()
 	SetDlgItemText(IDC_BUTTON_OPEN_CLOSE_TEST_START, _T("Start"));
 	GetDlgItem(IDC_EDIT_OPEN_CLOSE_CNT)->EnableWindow(TRUE);
 	GetDlgItem(IDC_EDIT_OPEN_CLOSE_INTERVAL)->EnableWindow(TRUE);
+	GetDlgItem(IDC_COMBO_OPEN_CLOSE_MODE)->EnableWindow(TRUE);
+	g_pMainDlg->CancelRecover(true);	/* stopped during a reset / replug: the camera is not left closed */
 	m_count = 0;
 	UpdateHint();
 }
@@ -112,9 +177,15 @@ void COpenCloseTestPropertyPage::OnBnClickedButtonOpenCloseTestStart()
 		m_initFlag = g_bBlack = false;
 		m_conModel = g_hcam ? false : true;
 		m_count = g_snapCount = m_resCount = 0;
+		m_mode = ((CComboBox*)GetDlgItem(IDC_COMBO_OPEN_CLOSE_MODE))->GetCurSel();
+		m_nFailed = 0;
+		g_vecOpenTime.clear();
+		g_vecFirstFrameTime.clear();
+		g_vecRecoverTime.clear();
 		SetDlgItemText(IDC_BUTTON_OPEN_CLOSE_TEST_START, _T("Stop"));
 		GetDlgItem(IDC_EDIT_OPEN_CLOSE_CNT)->EnableWindow(FALSE);
 		GetDlgItem(IDC_EDIT_OPEN_CLOSE_INTERVAL)->EnableWindow(FALSE);
+		GetDlgItem(IDC_COMBO_OPEN_CLOSE_MODE)->EnableWindow(FALSE);
 		SetTimer(1, m_interval, nullptr);
 	}
 }
@@ -9,6 +9,8 @@ class COpenCloseTestPropertyPage : public CTestPropertyPage
 	bool m_initFlag;
 	int m_resCount;
 	int m_resNum;
+	int m_mode;				/* 0: open / close, 1: TOUPCAM_OPTION_DEVICE_RESET, 2: Toupcam_Replug */
+	unsigned m_nFailed;		/* recoveries timed out */
 public:
 	COpenCloseTestPropertyPage();
 
@@ -26,4 +28,6 @@ protected:
 private:
 	void Stop();
 	void UpdateHint();
+	void OnTimerRecover();
+	CString Report() const;
 };
\ No newline at end of file
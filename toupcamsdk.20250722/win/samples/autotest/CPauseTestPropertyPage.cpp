@@ -2,6 +2,7 @@
 #include "global.h"
 #include "AutoTest.h"
 #include "CPauseTestPropertyPage.h"
+#include "DropTrace.h"
 
 CPauseTestPropertyPage::CPauseTestPropertyPage()
 	: CTestPropertyPage(IDD_PROPERTY_PAUSE_TEST)
@@ -50,28 +51,33 @@ void CPauseTestPropertyPage::OnEnChangeEditInterval()
 void CPauseTestPropertyPage::OnTimer(UINT_PTR nIDEvent)
 {
 	++m_count;
+	g_dropTrace.Mark(DROP_PAUSE, (m_count % 2) ? "pause" : "resume");
 	Toupcam_Pause(g_hcam, m_count % 2);
 	UpdateHint();
 	if (m_count >= m_totalCount * 2)
 	{
-		Stop();
-		AfxMessageBox(_T("Pause test completed."));
+		AfxMessageBox(_T("Pause test completed.") + Stop());
 	}
 }
 
-void CPauseTestPropertyPage::Stop()
+CString CPauseTestPropertyPage::Stop()
 {
 	Toupcam_Pause(g_hcam, 0);
 	m_bStart = g_bTesting = false;
 	KillTimer(1);
 	SetDlgItemText(IDC_BUTTON_PAUSE_TEST_START, _T("Start"));
 	GetDlgItem(IDC_EDIT_PAUSE_TEST_CNT)->EnableWindow(TRUE);
+	return StopDropTrace();
 }
 
 void CPauseTestPropertyPage::OnBnClickedButtonPauseTestStart()
 {
 	if (m_bStart)
-		Stop();
+	{
+		const CString str = Stop();
+		if (!str.IsEmpty())
+			AfxMessageBox(_T("Pause test stopped.") + str);
+	}
 	else if (OnStart())
 	{
 		m_bStart = g_bTesting = true;
@@ -79,6 +85,7 @@ void CPauseTestPropertyPage::OnBnClickedButtonPauseTestStart()
 		m_count = 0;
 		SetDlgItemText(IDC_BUTTON_PAUSE_TEST_START, _T("Stop"));
 		GetDlgItem(IDC_EDIT_PAUSE_TEST_CNT)->EnableWindow(FALSE);
+		StartDropTrace(_T("PauseTest"));
 		SetTimer(1, m_interval, nullptr);
 	}
 }
\ No newline at end of file
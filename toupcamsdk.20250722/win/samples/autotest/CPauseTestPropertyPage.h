@@ -21,5 +21,5 @@ protected:
 	DECLARE_MESSAGE_MAP()
 private:
 	void UpdateHint();
-	void Stop();
+	CString Stop();
 };
\ No newline at end of file
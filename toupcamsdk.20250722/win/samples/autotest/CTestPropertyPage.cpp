@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "global.h"
+#include "AutoTest.h"
 #include "CTestPropertyPage.h"
+#include "DropTrace.h"
 
 CTestPropertyPage::CTestPropertyPage(UINT nIDTemplate)
 	: CPropertyPage(nIDTemplate)
@@ -26,4 +28,25 @@ bool CTestPropertyPage::OnStart()
 		return false;
 	}
 	return true;
+}
+
+void CTestPropertyPage::StartDropTrace(const TCHAR* header)
+{
+	GetDlgItem(IDC_CHECK_DROP_TRACE)->EnableWindow(FALSE);
+	if (BST_CHECKED != IsDlgButtonChecked(IDC_CHECK_DROP_TRACE))
+		return;
+	g_snapDir = GetAppTimeDir(header);
+	if (!PathIsDirectory((LPCTSTR)g_snapDir))
+		SHCreateDirectory(m_hWnd, (LPCTSTR)g_snapDir);
+	if (!g_dropTrace.Start(g_hcam, g_snapDir + _T("\\droptrace.csv")))
+		AfxMessageBox(_T("Failed to create droptrace.csv."));
+}
+
+/* "\n\nframes: ..., lost: ...", empty without a trace */
+CString CTestPropertyPage::StopDropTrace()
+{
+	GetDlgItem(IDC_CHECK_DROP_TRACE)->EnableWindow(TRUE);
+	if (!g_dropTrace.IsRunning())
+		return CString();
+	return _T("\n\n") + g_dropTrace.Stop() + _T("\n\n") + g_snapDir + _T("\\droptrace.csv");
 }
\ No newline at end of file
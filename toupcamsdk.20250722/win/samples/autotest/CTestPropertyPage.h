@@ -11,4 +11,6 @@ protected:
 	virtual BOOL OnQueryCancel();
 
 	bool OnStart();
+	void StartDropTrace(const TCHAR* header);	/* when IDC_CHECK_DROP_TRACE is checked, see DropTrace.h */
+	CString StopDropTrace();
 };
\ No newline at end of file
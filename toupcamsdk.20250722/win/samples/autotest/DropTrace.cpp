@@ -0,0 +1,178 @@
+#include "stdafx.h"
+#include "global.h"
+#include "DropTrace.h"
+#include <algorithm>
+#include <stdarg.h>
+#include <mmsystem.h>
+
+#pragma comment(lib, "winmm.lib")
+
+static const char* g_stageName[DROP_STAGES] = { "flush", "pause", "backend", "frontend", "processing", "link" };
+
+CDropTrace g_dropTrace;
+
+/* how much a counter moved, 0 when not supported */
+static unsigned Delta(int cur, int prev)
+{
+	return ((cur >= 0) && (prev >= 0) && (cur > prev)) ? (unsigned)(cur - prev) : 0;
+}
+
+CDropTrace::CDropTrace()
+: m_hcam(nullptr), m_fp(nullptr), m_bRun(false), m_t0(0.0), m_lastSeq(0), m_frames(0), m_bSeq(false), m_mark(-1)
+{
+	memset(&m_last, 0, sizeof(m_last));
+	memset(m_lost, 0, sizeof(m_lost));
+}
+
+CDropTrace::~CDropTrace()
+{
+	Stop();
+}
+
+DropCounters CDropTrace::Read(HToupcam h)
+{
+	const unsigned opt[6] = { TOUPCAM_OPTION_FRONTEND_FULL, TOUPCAM_OPTION_BACKEND_FULL, TOUPCAM_OPTION_PACKET_NUMBER,
+		TOUPCAM_OPTION_NUMBER_DROP_FRAME, TOUPCAM_OPTION_FRONTEND_DEQUE_CURRENT, TOUPCAM_OPTION_BACKEND_DEQUE_CURRENT };
+	int val[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		if (FAILED(Toupcam_get_Option(h, opt[i], &val[i])))
+			val[i] = -1;
+	}
+	const DropCounters c = { val[0], val[1], val[2], val[3], val[4], val[5] };
+	return c;
+}
+
+void CDropTrace::Write(const char* fmt, ...)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	if (m_fp)
+	{
+		fprintf(m_fp, "%.3f,", GetTickMs() - m_t0);
+		va_list ap;
+		va_start(ap, fmt);
+		vfprintf(m_fp, fmt, ap);
+		va_end(ap);
+	}
+}
+
+void CDropTrace::Sampler()
+{
+	timeBeginPeriod(1);
+	DropCounters prev;
+	memset(&prev, 0xff, sizeof(prev));
+	while (m_bRun)
+	{
+		const DropCounters c = Read(m_hcam);
+		if (memcmp(&c, &prev, sizeof(c)))
+		{
+			Write("counters,%d,%d,%d,%d,%d,%d\n", c.frontFull, c.backFull, c.packets, c.drops, c.frontCur, c.backCur);
+			prev = c;
+		}
+		Sleep(1);
+	}
+	timeEndPeriod(1);
+}
+
+bool CDropTrace::Start(HToupcam h, const CString& strPath)
+{
+	Stop();
+	m_fp = _wfopen((LPCTSTR)strPath, L"wt");
+	if (nullptr == m_fp)
+		return false;
+	fprintf(m_fp, "ms,type,...\n");
+	m_hcam = h;
+	m_t0 = GetTickMs();
+	m_last = Read(h);
+	m_bSeq = false;
+	m_frames = 0;
+	m_mark = -1;
+	memset(m_lost, 0, sizeof(m_lost));
+	m_bRun = true;
+	m_thread = std::thread(&CDropTrace::Sampler, this);
+	return true;
+}
+
+void CDropTrace::OnFrame(const ToupcamFrameInfoV3& info)
+{
+	if ((nullptr == m_fp) || (0 == (info.flag & TOUPCAM_FRAMEINFO_FLAG_SEQ)))
+		return;
+	const DropCounters c = Read(m_hcam);
+	Write("frame,%u,%llu\n", info.seq, info.timestamp);
+	++m_frames;
+	if (m_bSeq && (info.seq > m_lastSeq + 1))	/* a smaller one: the camera restarted the sequence */
+	{
+		unsigned n = info.seq - m_lastSeq - 1, share[DROP_STAGES] = { 0 };
+		if (m_mark >= 0)
+			share[m_mark] = n;
+		else
+		{
+			const unsigned back = Delta(c.backFull, m_last.backFull), front = Delta(c.frontFull, m_last.frontFull), drops = Delta(c.drops, m_last.drops);
+			share[DROP_BACKEND] = std::min(n, back);
+			n -= share[DROP_BACKEND];
+			share[DROP_FRONTEND] = std::min(n, front);
+			n -= share[DROP_FRONTEND];
+			share[DROP_PROCESSING] = std::min(n, (drops > back + front) ? drops - back - front : 0);
+			share[DROP_LINK] = n - share[DROP_PROCESSING];
+		}
+		unsigned first = m_lastSeq + 1;
+		for (int k = 0; k < DROP_STAGES; ++k)
+		{
+			if (share[k])
+			{
+				Write("lost,%u,%u,%s\n", first, share[k], g_stageName[k]);
+				first += share[k];
+				m_lost[k] += share[k];
+			}
+		}
+	}
+	m_last = c;
+	m_lastSeq = info.seq;
+	m_bSeq = true;
+	m_mark = -1;
+}
+
+void CDropTrace::OnEvent(unsigned nEvent)
+{
+	if (m_fp)
+		Write("event,0x%04x\n", nEvent);
+}
+
+void CDropTrace::Mark(DropStage stage, const char* name)
+{
+	if (m_fp)
+	{
+		Write("mark,%s\n", name);
+		m_mark = stage;
+	}
+}
+
+CString CDropTrace::Stop()
+{
+	if (nullptr == m_fp)
+		return CString();
+	m_bRun = false;
+	if (m_thread.joinable())
+		m_thread.join();
+
+	unsigned total = 0;
+	for (int k = 0; k < DROP_STAGES; ++k)
+		total += m_lost[k];
+	CString str, strTmp;
+	str.Format(_T("frames: %u, lost: %u"), m_frames, total);
+	for (int k = 0; k < DROP_STAGES; ++k)
+	{
+		fprintf(m_fp, "# %s,%u\n", g_stageName[k], m_lost[k]);
+		if (m_lost[k])
+		{
+			strTmp.Format(_T("\n%hs: %u"), g_stageName[k], m_lost[k]);
+			str += strTmp;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		fclose(m_fp);
+		m_fp = nullptr;
+	}
+	return str;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+ * Root cause of the lost frames, run along the flush and pause tests when "Drop trace" is checked:
+ *   a sampler thread reads the counters of the SDK every millisecond and traces their changes
+ *   every frame pulled reads them again, and a gap of the frame sequence numbers since the previous frame is split
+ *   over the stages by how much each counter moved meanwhile, in this order:
+ *     flush, pause		the test flushed or paused the camera since the previous frame: the whole gap
+ *     backend			TOUPCAM_OPTION_BACKEND_FULL: the application did not pull in time
+ *     frontend			TOUPCAM_OPTION_FRONTEND_FULL: the processing did not keep up with the link
+ *     processing		TOUPCAM_OPTION_NUMBER_DROP_FRAME not explained by the two above: received, dropped by the SDK
+ *     link				the rest, never received whole: the USB / Ethernet link or the camera; a flat
+ *						TOUPCAM_OPTION_PACKET_NUMBER or a TOUPCAM_EVENT_NOPACKETTIMEOUT in the timeline around it tells which
+ * Trace, CSV, "ms,type,..." with ms the host time since Start:
+ *   ms,counters,frontFull,backFull,packets,drops,frontCur,backCur		when one of them changed, -1 = not supported
+ *   ms,frame,seq,timestamp
+ *   ms,lost,firstSeq,count,stage
+ *   ms,event,nEvent
+ *   ms,mark,name
+ */
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+enum DropStage { DROP_FLUSH, DROP_PAUSE, DROP_BACKEND, DROP_FRONTEND, DROP_PROCESSING, DROP_LINK, DROP_STAGES };
+
+struct DropCounters {
+	int		frontFull, backFull, packets, drops, frontCur, backCur;
+};
+
+class CDropTrace
+{
+	HToupcam			m_hcam;
+	FILE*				m_fp;
+	std::mutex			m_mtx;			/* m_fp, written by both threads */
+	std::thread			m_thread;
+	std::atomic<bool>	m_bRun;
+	double				m_t0;
+	DropCounters		m_last;			/* at the previous frame */
+	unsigned			m_lastSeq, m_frames;
+	bool				m_bSeq;
+	int					m_mark;			/* DROP_FLUSH, DROP_PAUSE since the previous frame, -1 */
+	unsigned			m_lost[DROP_STAGES];
+
+	static DropCounters Read(HToupcam h);
+	void Sampler();
+	void Write(const char* fmt, ...);
+public:
+	CDropTrace();
+	~CDropTrace();
+
+	bool IsRunning() const { return nullptr != m_fp; }
+	bool Start(HToupcam h, const CString& strPath);
+	void OnFrame(const ToupcamFrameInfoV3& info);
+	void OnEvent(unsigned nEvent);
+	void Mark(DropStage stage, const char* name);
+	CString Stop();		/* the lost frames per stage */
+};
+
+extern CDropTrace g_dropTrace;
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "global.h"
+#include <algorithm>
 
 HToupcam g_hcam = nullptr;
 ToupcamDeviceV2 g_cur = { 0 };
@@ -26,6 +27,7 @@ unsigned g_HeartbeatTimeout = 0;
 unsigned g_NopacketTimeout = 0;
 unsigned g_NoframeTimeout = 0;
 CString g_snapDir;
+std::vector<double> g_vecOpenTime, g_vecFirstFrameTime, g_vecRecoverTime;
 
 CString GetAppTimeDir(const TCHAR* header)
 {
@@ -38,4 +40,30 @@ CString GetAppTimeDir(const TCHAR* header)
 	PathAppend(path, (LPCTSTR)str);
 	str = path;
 	return str;
+}
+
+double GetTickMs()
+{
+	static LARGE_INTEGER freq = { 0 };
+	if (0 == freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart * 1000.0 / freq.QuadPart;
+}
+
+/* "name: n = 10, p50 = 1.0 ms, p95 = ..., p99 = ..., max = ..." */
+CString FormatLatency(const TCHAR* name, std::vector<double> v)
+{
+	CString str;
+	if (v.empty())
+		str.Format(_T("%s: n = 0\n"), name);
+	else
+	{
+		std::sort(v.begin(), v.end());
+		const size_t n = v.size() - 1;
+		str.Format(_T("%s: n = %u, p50 = %.1f ms, p95 = %.1f ms, p99 = %.1f ms, max = %.1f ms\n"), name, (unsigned)v.size(),
+			v[(size_t)(n * 0.50 + 0.5)], v[(size_t)(n * 0.95 + 0.5)], v[(size_t)(n * 0.99 + 0.5)], v[n]);
+	}
+	return str;
 }
\ No newline at end of file
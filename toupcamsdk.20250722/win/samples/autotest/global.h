@@ -1,6 +1,7 @@
 #pragma once
 
 #include "toupcam.h"
+#include <vector>
 
 extern HToupcam g_hcam;
 extern ToupcamDeviceV2 g_cur;
@@ -27,5 +28,8 @@ extern unsigned g_HeartbeatTimeout;
 extern unsigned g_NopacketTimeout;
 extern unsigned g_NoframeTimeout;
 extern CString g_snapDir;
+extern std::vector<double> g_vecOpenTime, g_vecFirstFrameTime, g_vecRecoverTime;	/* ms, recorded while testing */
 
-CString GetAppTimeDir(const TCHAR* header);
\ No newline at end of file
+CString GetAppTimeDir(const TCHAR* header);
+double GetTickMs();
+CString FormatLatency(const TCHAR* name, std::vector<double> v);
\ No newline at end of file
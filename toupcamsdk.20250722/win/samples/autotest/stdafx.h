@@ -28,6 +28,7 @@
 #define WM_USER_OPEN_CLOSE				(WM_APP + 4)
 
 #define MSG_GIGEHOTPLUG					(WM_APP + 5)
+#define WM_USER_RECOVER					(WM_APP + 6)
 
 #ifdef _UNICODE
 #if defined _M_IX86
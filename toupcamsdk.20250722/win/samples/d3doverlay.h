@@ -0,0 +1,433 @@
+#pragma once
+
+/*
+ * Overlays of the Direct3D 11 renderers (CD3D11Render of demod3d11, CTileView): rectangles, lines, ellipses, text and
+ * a scale bar over the frame, composited in the present pass instead of drawn by GDI on the window after every
+ * frame (CRectTrackerEx of demoaf) or burnt into a copy of the frame: the pixels of the frame, saved or recorded,
+ * never have them.
+ * The items are retained: Add() once, Set() or Remove() when they change, from any thread. The renderer calls
+ * Draw() before its Present: the items are rasterized by Direct2D / DirectWrite into a BGRA texture of the window
+ * only when they changed (an item, the window size, the mapping of the frame on the window), and every present just
+ * blends that texture over the back buffer, whatever its format (R10G10B10A2 included, which Direct2D cannot target).
+ * An item is in frame pixels (OVERLAY_FRAME, top-down: it follows the zoom and the pan) or in window pixels
+ * (OVERLAY_WINDOW). The scale bar, when SetScaleBar has the size of a frame pixel, is at the bottom right of the
+ * window with a round length of about a fifth of its width.
+ * The device must be created with D3D11_CREATE_DEVICE_BGRA_SUPPORT. Init, Resize and Draw on the thread of the
+ * renderer, with the immediate context held; Draw restores the state of the pipeline it changes.
+ */
+#include <atlbase.h>
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <d2d1.h>
+#include <dwrite.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+#pragma comment(lib, "d2d1.lib")
+#pragma comment(lib, "dwrite.lib")
+
+/* OverlayItem.type */
+#define OVERLAY_RECT		0		/* x0, y0 - x1, y1 outline */
+#define OVERLAY_FILLRECT	1
+#define OVERLAY_LINE		2		/* x0, y0 to x1, y1 */
+#define OVERLAY_ELLIPSE		3		/* in the rectangle x0, y0 - x1, y1 */
+#define OVERLAY_TEXT		4		/* from x0, y0, fontSize in window pixels */
+
+/* OverlayItem.space */
+#define OVERLAY_FRAME		0
+#define OVERLAY_WINDOW		1
+
+#define OVERLAY_SCALEBAR_FRACTION	5		/* of the window width, about */
+
+typedef struct {
+	int type, space;
+	float x0, y0, x1, y1;
+	COLORREF color;
+	float alpha;		/* 0 .. 1 */
+	float width;		/* of the line, window pixels */
+	float fontSize;
+	std::wstring text;
+} OverlayItem;
+
+class CD3DOverlay
+{
+	struct Entry {
+		unsigned id;
+		OverlayItem item;
+	};
+	std::mutex m_mtx;					/* m_entry, m_umPerPixel, m_version */
+	std::vector<Entry> m_entry;
+	unsigned m_nextId, m_version;
+	double m_umPerPixel;
+
+	/* the thread of the renderer */
+	CComPtr<ID3D11Device> m_device;
+	CComPtr<ID2D1Factory> m_d2d;
+	CComPtr<IDWriteFactory> m_dwrite;
+	CComPtr<ID3D11Texture2D> m_texture;
+	CComPtr<ID3D11ShaderResourceView> m_srv;
+	CComPtr<ID2D1RenderTarget> m_target;
+	CComPtr<ID3D11VertexShader> m_vs;
+	CComPtr<ID3D11PixelShader> m_ps;
+	CComPtr<ID3D11SamplerState> m_sampler;
+	CComPtr<ID3D11BlendState> m_blend;
+	int m_width, m_height;
+	unsigned m_drawn;					/* m_version rasterized */
+	float m_map[4];						/* of the rasterized items: window = frame * scale + offset; sx, sy, ox, oy */
+	bool m_bEmpty;						/* nothing rasterized: no blend */
+
+	HRESULT CreateShaders()
+	{
+		/* a quad over the whole viewport from the vertex id, no vertex buffer */
+		const char* vsCode = R"(
+			struct VS_OUT {
+				float4 pos : SV_POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			VS_OUT VS(uint id : SV_VertexID) {
+				VS_OUT output;
+				output.uv = float2(id & 1, id >> 1);
+				output.pos = float4(output.uv.x * 2.0 - 1.0, 1.0 - output.uv.y * 2.0, 0.0, 1.0);
+				return output;
+			})";
+		CComPtr<ID3DBlob> vsBlob;
+		HRESULT hr = D3DCompile(vsCode, strlen(vsCode), NULL, NULL, NULL, "VS", "vs_4_0", 0, 0, &vsBlob, NULL);
+		if (FAILED(hr))
+			return hr;
+		hr = m_device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), NULL, &m_vs);
+		if (FAILED(hr))
+			return hr;
+
+		const char* psCode = R"(
+			Texture2D tex : register(t0);
+			SamplerState sam : register(s0);
+			struct PS_IN {
+				float4 pos : SV_POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			float4 PS(PS_IN input) : SV_Target {
+				return tex.Sample(sam, input.uv);
+			})";
+		CComPtr<ID3DBlob> psBlob;
+		hr = D3DCompile(psCode, strlen(psCode), NULL, NULL, NULL, "PS", "ps_4_0", 0, 0, &psBlob, NULL);
+		if (FAILED(hr))
+			return hr;
+		return m_device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), NULL, &m_ps);
+	}
+
+	HRESULT CreateTarget()
+	{
+		D3D11_TEXTURE2D_DESC texDesc = {};
+		texDesc.Width = m_width;
+		texDesc.Height = m_height;
+		texDesc.MipLevels = texDesc.ArraySize = texDesc.SampleDesc.Count = 1;
+		texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		texDesc.Usage = D3D11_USAGE_DEFAULT;
+		texDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+		HRESULT hr = m_device->CreateTexture2D(&texDesc, NULL, &m_texture);
+		if (FAILED(hr))
+			return hr;
+		hr = m_device->CreateShaderResourceView(m_texture, NULL, &m_srv);
+		if (FAILED(hr))
+			return hr;
+		CComQIPtr<IDXGISurface> spIDXGISurface(m_texture);
+		if (!spIDXGISurface)
+			return E_NOINTERFACE;
+		const D2D1_RENDER_TARGET_PROPERTIES props = D2D1::RenderTargetProperties(D2D1_RENDER_TARGET_TYPE_DEFAULT,
+			D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED), 96.0f, 96.0f);
+		return m_d2d->CreateDxgiSurfaceRenderTarget(spIDXGISurface, &props, &m_target);
+	}
+
+	/* 1, 2 or 5 times a power of ten, the longest within um */
+	static double RoundLength(double um)
+	{
+		const double p = pow(10.0, floor(log10(um)));
+		if (um >= 5.0 * p)
+			return 5.0 * p;
+		if (um >= 2.0 * p)
+			return 2.0 * p;
+		return p;
+	}
+
+	void Rasterize(const std::vector<Entry>& entry, double umPerPixel, const float map[4])
+	{
+		m_target->BeginDraw();
+		m_target->Clear(D2D1::ColorF(0, 0.0f));
+		CComPtr<ID2D1SolidColorBrush> brush;
+		if (FAILED(m_target->CreateSolidColorBrush(D2D1::ColorF(0, 1.0f), &brush)))
+		{
+			m_target->EndDraw();
+			return;
+		}
+		for (const auto& e : entry)
+		{
+			const OverlayItem& it = e.item;
+			brush->SetColor(D2D1::ColorF(GetRValue(it.color) / 255.0f, GetGValue(it.color) / 255.0f, GetBValue(it.color) / 255.0f, it.alpha));
+			float x0 = it.x0, y0 = it.y0, x1 = it.x1, y1 = it.y1;
+			if (OVERLAY_FRAME == it.space)
+			{
+				x0 = x0 * map[0] + map[2];
+				x1 = x1 * map[0] + map[2];
+				y0 = y0 * map[1] + map[3];
+				y1 = y1 * map[1] + map[3];
+			}
+			const D2D1_RECT_F rc = D2D1::RectF(__min(x0, x1), __min(y0, y1), __max(x0, x1), __max(y0, y1));
+			switch (it.type)
+			{
+			case OVERLAY_RECT:
+				m_target->DrawRectangle(rc, brush, it.width);
+				break;
+			case OVERLAY_FILLRECT:
+				m_target->FillRectangle(rc, brush);
+				break;
+			case OVERLAY_LINE:
+				m_target->DrawLine(D2D1::Point2F(x0, y0), D2D1::Point2F(x1, y1), brush, it.width);
+				break;
+			case OVERLAY_ELLIPSE:
+				m_target->DrawEllipse(D2D1::Ellipse(D2D1::Point2F((rc.left + rc.right) / 2, (rc.top + rc.bottom) / 2), (rc.right - rc.left) / 2, (rc.bottom - rc.top) / 2), brush, it.width);
+				break;
+			case OVERLAY_TEXT:
+				Text(it.text.c_str(), it.fontSize, D2D1::RectF(x0, y0, (float)m_width, (float)m_height), brush);
+				break;
+			default:
+				break;
+			}
+		}
+		if ((umPerPixel > 0.0) && (map[0] > 0.0f))
+		{
+			/* the length in um of a fifth of the window, rounded down */
+			const double um = RoundLength(m_width / (double)OVERLAY_SCALEBAR_FRACTION / map[0] * umPerPixel);
+			const float len = (float)(um / umPerPixel * map[0]);
+			const float right = m_width - 16.0f, bottom = m_height - 16.0f;
+			wchar_t label[32];
+			if (um >= 1000.0)
+				swprintf(label, _countof(label), L"%g mm", um / 1000.0);
+			else
+				swprintf(label, _countof(label), L"%g \x00b5m", um);
+			brush->SetColor(D2D1::ColorF(0, 0.5f));
+			m_target->FillRectangle(D2D1::RectF(right - len - 6.0f, bottom - 28.0f, right + 6.0f, bottom + 6.0f), brush);
+			brush->SetColor(D2D1::ColorF(0xffffff, 1.0f));
+			m_target->FillRectangle(D2D1::RectF(right - len, bottom - 4.0f, right, bottom), brush);
+			Text(label, 14.0f, D2D1::RectF(right - len, bottom - 26.0f, right, bottom - 4.0f), brush);
+		}
+		m_target->EndDraw();
+	}
+
+	void Text(const wchar_t* str, float fontSize, const D2D1_RECT_F& rc, ID2D1Brush* brush)
+	{
+		CComPtr<IDWriteTextFormat> format;
+		if (SUCCEEDED(m_dwrite->CreateTextFormat(L"Segoe UI", NULL, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, (fontSize > 0.0f) ? fontSize : 14.0f, L"", &format)))
+			m_target->DrawText(str, (UINT32)wcslen(str), format, rc, brush);
+	}
+public:
+	CD3DOverlay()
+	: m_nextId(1), m_version(1), m_umPerPixel(0.0), m_width(0), m_height(0), m_drawn(0), m_bEmpty(true)
+	{
+		memset(m_map, 0, sizeof(m_map));
+	}
+
+	/* the id, for Set and Remove */
+	unsigned Add(const OverlayItem& item)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		Entry e = { m_nextId++, item };
+		m_entry.push_back(e);
+		++m_version;
+		return e.id;
+	}
+
+	bool Set(unsigned id, const OverlayItem& item)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		for (auto& e : m_entry)
+		{
+			if (e.id == id)
+			{
+				e.item = item;
+				++m_version;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Remove(unsigned id)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		for (auto it = m_entry.begin(); it != m_entry.end(); ++it)
+		{
+			if (it->id == id)
+			{
+				m_entry.erase(it);
+				++m_version;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_entry.clear();
+		++m_version;
+	}
+
+	/* um of a frame pixel (on the sensor, or on the object with the magnification), 0: no scale bar */
+	void SetScaleBar(double umPerPixel)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_umPerPixel = umPerPixel;
+		++m_version;
+	}
+
+	HRESULT Init(ID3D11Device* device)
+	{
+		m_device = device;
+		HRESULT hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &m_d2d);
+		if (SUCCEEDED(hr))
+			hr = DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), (IUnknown**)&m_dwrite);
+		if (SUCCEEDED(hr))
+			hr = CreateShaders();
+		if (SUCCEEDED(hr))
+		{
+			D3D11_SAMPLER_DESC sampDesc = {};
+			sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+			sampDesc.AddressU = sampDesc.AddressV = sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+			hr = m_device->CreateSamplerState(&sampDesc, &m_sampler);
+		}
+		if (SUCCEEDED(hr))
+		{
+			/* premultiplied, as Direct2D draws */
+			D3D11_BLEND_DESC blendDesc = {};
+			blendDesc.RenderTarget[0].BlendEnable = TRUE;
+			blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+			blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+			blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+			blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+			blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+			blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+			blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+			hr = m_device->CreateBlendState(&blendDesc, &m_blend);
+		}
+		if (FAILED(hr))
+			Release();
+		return hr;
+	}
+
+	/* the device is gone (or going): the GPU objects dropped, the items kept for the next Init */
+	void Release()
+	{
+		m_target.Release();
+		m_srv.Release();
+		m_texture.Release();
+		m_blend.Release();
+		m_sampler.Release();
+		m_ps.Release();
+		m_vs.Release();
+		m_dwrite.Release();
+		m_d2d.Release();
+		m_device.Release();
+		m_drawn = 0;
+	}
+
+	/* the window size, before ResizeBuffers of the swap chain or after */
+	void Resize(int width, int height)
+	{
+		if ((width != m_width) || (height != m_height))
+		{
+			m_target.Release();
+			m_srv.Release();
+			m_texture.Release();
+			m_width = width;
+			m_height = height;
+			m_drawn = 0;
+		}
+	}
+
+	/*
+	 * over the render target of the context, the whole of it; window = frame * scale + offset;
+	 * scaleX, scaleY, offsetX, offsetY: as the renderer draws the frame now
+	 */
+	void Draw(ID3D11DeviceContext* context, float scaleX, float scaleY, float offsetX, float offsetY)
+	{
+		if (!m_device || (m_width <= 0) || (m_height <= 0))
+			return;
+		std::vector<Entry> entry;
+		double umPerPixel = 0.0;
+		unsigned version;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			version = m_version;
+			if ((version != m_drawn) || (scaleX != m_map[0]) || (scaleY != m_map[1]) || (offsetX != m_map[2]) || (offsetY != m_map[3]))
+			{
+				entry = m_entry;
+				umPerPixel = m_umPerPixel;
+			}
+			else if (m_bEmpty)
+				return;
+			else
+				version = 0;	/* as rasterized */
+		}
+		if (version)
+		{
+			const float map[4] = { scaleX, scaleY, offsetX, offsetY };
+			if (entry.empty() && (umPerPixel <= 0.0))
+				m_bEmpty = true;
+			else
+			{
+				if ((!m_target) && FAILED(CreateTarget()))
+					return;
+				Rasterize(entry, umPerPixel, map);
+				m_bEmpty = false;
+			}
+			memcpy(m_map, map, sizeof(m_map));
+			m_drawn = version;
+			if (m_bEmpty)
+				return;
+		}
+
+		/* the state it changes, for the renderer which sets it once */
+		D3D11_VIEWPORT vp[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+		UINT nvp = _countof(vp);
+		context->RSGetViewports(&nvp, vp);
+		CComPtr<ID3D11VertexShader> vs;
+		CComPtr<ID3D11PixelShader> ps;
+		CComPtr<ID3D11InputLayout> layout;
+		CComPtr<ID3D11ShaderResourceView> srv;
+		CComPtr<ID3D11SamplerState> sampler;
+		CComPtr<ID3D11BlendState> blend;
+		FLOAT blendFactor[4];
+		UINT sampleMask;
+		D3D11_PRIMITIVE_TOPOLOGY topology;
+		context->VSGetShader(&vs, NULL, NULL);
+		context->PSGetShader(&ps, NULL, NULL);
+		context->IAGetInputLayout(&layout);
+		context->IAGetPrimitiveTopology(&topology);
+		context->PSGetShaderResources(0, 1, &srv);
+		context->PSGetSamplers(0, 1, &sampler);
+		context->OMGetBlendState(&blend, blendFactor, &sampleMask);
+
+		const D3D11_VIEWPORT full = { 0.0f, 0.0f, (float)m_width, (float)m_height, 0.0f, 1.0f };
+		context->RSSetViewports(1, &full);
+		context->VSSetShader(m_vs, NULL, 0);
+		context->PSSetShader(m_ps, NULL, 0);
+		context->IASetInputLayout(NULL);
+		context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+		context->PSSetShaderResources(0, 1, &m_srv.p);
+		context->PSSetSamplers(0, 1, &m_sampler.p);
+		context->OMSetBlendState(m_blend, NULL, 0xffffffff);
+		context->Draw(4, 0);
+
+		context->OMSetBlendState(blend, blendFactor, sampleMask);
+		context->PSSetSamplers(0, 1, &sampler.p);
+		context->PSSetShaderResources(0, 1, &srv.p);
+		context->IASetPrimitiveTopology(topology);
+		context->IASetInputLayout(layout);
+		context->PSSetShader(ps, NULL, 0);
+		context->VSSetShader(vs, NULL, 0);
+		context->RSSetViewports(nvp, vp);
+	}
+};
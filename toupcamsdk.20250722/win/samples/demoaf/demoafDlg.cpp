@@ -3,88 +3,10 @@
 #include "demoafDlg.h"
 #include <InitGuid.h>
 #include <wincodec.h>
-
-static BOOL SaveImageByWIC(const wchar_t* strFilename, const void* pData, const BITMAPINFOHEADER* pHeader)
-{
-	GUID guidContainerFormat;
-	if (PathMatchSpec(strFilename, L"*.bmp"))
-		guidContainerFormat = GUID_ContainerFormatBmp;
-	else if (PathMatchSpec(strFilename, L"*.jpg"))
-		guidContainerFormat = GUID_ContainerFormatJpeg;
-	else if (PathMatchSpec(strFilename, L"*.png"))
-		guidContainerFormat = GUID_ContainerFormatPng;
-	else
-		return FALSE;
-
-	CComPtr<IWICImagingFactory> spIWICImagingFactory;
-	HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (LPVOID*)&spIWICImagingFactory);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICBitmapEncoder> spIWICBitmapEncoder;
-	hr = spIWICImagingFactory->CreateEncoder(guidContainerFormat, NULL, &spIWICBitmapEncoder);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICStream> spIWICStream;
-	spIWICImagingFactory->CreateStream(&spIWICStream);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICStream->InitializeFromFilename(strFilename, GENERIC_WRITE);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICBitmapEncoder->Initialize(spIWICStream, WICBitmapEncoderNoCache);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICBitmapFrameEncode> spIWICBitmapFrameEncode;
-	CComPtr<IPropertyBag2> spIPropertyBag2;
-	hr = spIWICBitmapEncoder->CreateNewFrame(&spIWICBitmapFrameEncode, &spIPropertyBag2);
-	if (FAILED(hr))
-		return FALSE;
-
-	if (GUID_ContainerFormatJpeg == guidContainerFormat)
-	{
-		PROPBAG2 option = { 0 };
-		option.pstrName = L"ImageQuality"; /* jpg quality, you can change this setting */
-		CComVariant varValue(0.75f);
-		spIPropertyBag2->Write(1, &option, &varValue);
-	}
-	hr = spIWICBitmapFrameEncode->Initialize(spIPropertyBag2);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICBitmapFrameEncode->SetSize(pHeader->biWidth, pHeader->biHeight);
-	if (FAILED(hr))
-		return FALSE;
-
-	WICPixelFormatGUID formatGUID = GUID_WICPixelFormat24bppBGR;
-	hr = spIWICBitmapFrameEncode->SetPixelFormat(&formatGUID);
-	if (FAILED(hr))
-		return FALSE;
-
-	LONG nWidthBytes = TDIBWIDTHBYTES(pHeader->biWidth * pHeader->biBitCount);
-	for (LONG i = 0; i < pHeader->biHeight; ++i)
-	{
-		hr = spIWICBitmapFrameEncode->WritePixels(1, nWidthBytes, nWidthBytes, ((BYTE*)pData) + nWidthBytes * (pHeader->biHeight - i - 1));
-		if (FAILED(hr))
-			return FALSE;
-	}
-
-	hr = spIWICBitmapFrameEncode->Commit();
-	if (FAILED(hr))
-		return FALSE;
-	hr = spIWICBitmapEncoder->Commit();
-	if (FAILED(hr))
-		return FALSE;
-
-	return TRUE;
-}
+#include "../asyncsave.h"
 
 CdemoafDlg::CdemoafDlg(CWnd* pParent /*=NULL*/)
-	: CDialog(CdemoafDlg::IDD, pParent), m_hcam(NULL), m_pImageData(NULL), m_dFV(0), m_dLum(0)
+	: CDialog(CdemoafDlg::IDD, pParent), m_hcam(NULL), m_pImageData(NULL), m_pSaver(new CAsyncSaver()), m_dFV(0), m_dLum(0)
 {
 	memset(&m_header, 0, sizeof(m_header));
 	m_header.biSize = sizeof(m_header);
@@ -97,6 +19,11 @@ CdemoafDlg::CdemoafDlg(CWnd* pParent /*=NULL*/)
 	m_revision = 0;
 }
 
+CdemoafDlg::~CdemoafDlg()
+{
+	delete m_pSaver;	/* waits for the images still being saved */
+}
+
 BEGIN_MESSAGE_MAP(CdemoafDlg, CDialog)
 	ON_BN_CLICKED(IDC_BUTTON1, &CdemoafDlg::OnBnClickedButton1)
 	ON_CBN_SELCHANGE(IDC_COMBO1, &CdemoafDlg::OnCbnSelchangeCombo1)
@@ -500,7 +427,8 @@ void CdemoafDlg::OnEventStillImage()
 			header.biWidth = info.v3.width;
 			header.biHeight = info.v3.height;
 			header.biSizeImage = TDIBWIDTHBYTES(header.biWidth * header.biBitCount) * header.biHeight;
-			SaveImageByWIC(L"demoaf.jpg", pData, &header);
+			m_pSaver->Save(L"demoaf.jpg", pData, &header);	/* the saver owns and frees pData */
+			pData = NULL;
 		}
 		free(pData);
 	}
@@ -1,6 +1,8 @@
 #pragma once
 #include "CRectTrackerEx.h"
 
+class CAsyncSaver;
+
 #define MY_EXPOTUER_TIME_MAX 500000
 
 typedef struct
@@ -17,6 +19,7 @@ class CdemoafDlg : public CDialog
 	void*				m_pImageData;
 	BITMAPINFOHEADER	m_header;
 	CRectTrackerEx*		m_rectTracker;
+	CAsyncSaver*		m_pSaver;
 	
 	FV_ROI_ST m_ClarityROI;
 	ToupcamLensInfo m_afLensInfo;
@@ -29,6 +32,7 @@ class CdemoafDlg : public CDialog
 
 public:
 	CdemoafDlg(CWnd* pParent = NULL);
+	~CdemoafDlg();
 
 	enum { IDD = IDD_DEMOAF };
 
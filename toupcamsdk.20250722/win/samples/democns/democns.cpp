@@ -15,10 +15,16 @@ CAppModule _Module;
 #include "toupcam.h"
 #include "dpi.h"
 #include "graph.h"
+#include "../roistats.h"
+#include "../wndmsgcoalesce.h"
+#include "../../../samples/exposched.h"
+#include "emva.h"
+#include <thread>
 #include <stdexcept>
 #include "resource.h"
 
 #define MSG_CAMERA			(WM_APP + 1)
+#define MSG_EMVA			(WM_APP + 2)
 #define TIMER_EPSILON		10
 #define TIMER_ID			1
 #define TIMER_TEMP			2
@@ -206,6 +212,7 @@ class CConfigDlg : public CDialogImpl<CConfigDlg>
 	const bool m_bSupportGain;
 	HToupcam	m_hcam;
 	DWORD		m_area, m_bin, m_temp, m_scale;
+	bool		m_bEmva;
 	CRegKey		m_regkey;
 	unsigned		m_expoTimeRange[2];
 	unsigned short	m_expoGainRange[2];
@@ -214,7 +221,7 @@ class CConfigDlg : public CDialogImpl<CConfigDlg>
 public:
 	enum { IDD = IDD_CONFIG };
 	CConfigDlg(HToupcam hcam, const ToupcamModelV2* pModel)
-		: m_bSupportGain(IsSupportGain(hcam)), m_hcam(hcam), m_pModel(pModel), m_area(5), m_bin(1), m_temp(0), m_scale(0)
+		: m_bSupportGain(IsSupportGain(hcam)), m_hcam(hcam), m_pModel(pModel), m_area(5), m_bin(1), m_temp(0), m_scale(0), m_bEmva(false)
 	{
 		m_regkey.Create(HKEY_CURRENT_USER, L"Software\\democns");
 		m_regkey.QueryDWORDValue(L"area", m_area);
@@ -459,6 +466,12 @@ private:
 			GetDlgItem(IDC_EDIT8).EnableWindow(FALSE);
 		}
 
+		{
+			DWORD val = 0;
+			m_regkey.QueryDWORDValue(L"emva", val);
+			CheckDlgButton(IDC_CHECK4, val ? 1 : 0);
+		}
+
 		GetDlgItem(IDC_BUTTON2).EnableWindow(FALSE);
 		GetDlgItem(IDOK).EnableWindow(!m_vecExpo.empty());
 
@@ -623,6 +636,8 @@ private:
 			}
 		}
 
+		m_bEmva = IsDlgButtonChecked(IDC_CHECK4) ? true : false;
+		m_regkey.SetDWORDValue(L"emva", m_bEmva ? 1 : 0);
 		m_regkey.SetDWORDValue(L"area", m_area);
 		m_regkey.SetBinaryValue(L"expo", &m_vecExpo[0], sizeof(Expo) * m_vecExpo.size());
 		m_regkey.SetDWORDValue(L"binvalue", m_bin);
@@ -1119,6 +1134,7 @@ class CMainFrame : public CFrameWindowImpl<CMainFrame>, public CUpdateUI<CMainFr
 	unsigned		m_area, m_bitdepth;
 	DWORD			m_tickLast;
 	bool			m_bTriggerMode, m_bWantTigger, m_bTemperature, m_bSupportGain;
+	bool			m_bSequencer; // the exposures are cycled by the camera sequencer, not by software
 	CVideoView		m_view;
 	CTabCtrl		m_tabCtrl;
 	CGraph			m_tempGraph; //temperature
@@ -1128,11 +1144,26 @@ class CMainFrame : public CFrameWindowImpl<CMainFrame>, public CUpdateUI<CMainFr
 	std::vector<CGraph>	m_vecGraph;
 	std::vector<Expo>	m_vecExpo;
 	std::vector<POINT>	m_vecPt;
+	CWndMsgCoalesce	m_coalesce;		// one image message at a time in the queue
+	ExpoSchedule	m_sched;		// continuous mode: every frame tagged with the exposure it carries
+	unsigned		m_idSched;		// the newest request of m_sched, for m_idxExpo
+	unsigned		m_idAdded;		// the request of the last frame taken
+	unsigned		m_target;		// its frame
+	DWORD			m_tickFirst;	// of the first frame of the exposure carried
+	CRoiStats		m_roiStats;		// the m_area x m_area box around every point of m_vecPt
+	std::vector<RoiResult>	m_vecResult;
+	std::vector<int>	m_vecVal;
+	enum { EMVA_OFF, EMVA_LIGHT, EMVA_WAIT, EMVA_DARK, EMVA_COMPUTE };
+	int				m_emvaState;
+	unsigned		m_emvaSkip;		// frames of the pipeline still taken with light when the dark series starts
+	CEmva			m_emva;
+	EmvaResult		m_emvaResult;
+	std::thread		m_emvaThread;
 public:
 	CMainFrame()
 	: m_hcam(nullptr), m_pModel(nullptr), m_pRawData(nullptr), m_curGraph(nullptr), m_curWnd(nullptr), m_idxExpo(-1)
-	, m_bTriggerMode(false), m_bWantTigger(false), m_bTemperature(false), m_bSupportGain(true), m_ymax(0), m_bitdepth(0), m_scale(1), m_area(5)
-	, m_tempGraph(true)
+	, m_bTriggerMode(false), m_bWantTigger(false), m_bTemperature(false), m_bSupportGain(true), m_bSequencer(false), m_ymax(0), m_bitdepth(0), m_scale(1), m_area(5)
+	, m_tempGraph(true), m_emvaState(EMVA_OFF), m_emvaSkip(0), m_idSched(0), m_idAdded(0), m_target(0), m_tickFirst(0)
 	{
 	}
 
@@ -1141,6 +1172,7 @@ public:
 		MSG_WM_TIMER(OnTimer)
 		MESSAGE_HANDLER(WM_DESTROY, OnWmDestroy)
 		MESSAGE_HANDLER(MSG_CAMERA, OnMsgCamera)
+		MESSAGE_HANDLER(MSG_EMVA, OnMsgEmva)
 		COMMAND_ID_HANDLER(ID_BESTFIT, OnBestfit)
 		COMMAND_ID_HANDLER(ID_ZOOMIN_X, OnZoominX)
 		COMMAND_ID_HANDLER(ID_ZOOMOUT_X, OnZoomoutX)
@@ -1386,11 +1418,12 @@ public:
 							if (!ReadValue(fp, datasize) || (datasize <= 0))
 								throw std::runtime_error("");
 							vv[i].resize(vecPt.size());
+							std::vector<int> y(datasize);
 							for (int j = 0; j < (int)vecPt.size(); ++j)
 							{
-								vv[i][j].y.resize(datasize);
-								if (datasize * sizeof(int) != fread(&vv[i][j].y[0], 1, sizeof(int) * datasize, fp))
+								if (datasize * sizeof(int) != fread(&y[0], 1, sizeof(int) * datasize, fp))
 									throw std::runtime_error("");
+								vv[i][j].y.assign(&y[0], datasize);
 							}
 						}
 
@@ -1505,18 +1538,26 @@ public:
 							fwrite(&voffset[0], 1, m_vecPt.size() * sizeof(int), fp);
 						}
 						
-						int n = v[0].y.size();
+						/* the samples still held by the rings */
+						std::vector<int> y;
+						v[0].y.copy(y);
+						int n = (int)y.size();
 						fwrite(&n, 1, sizeof(n), fp);
 						for (size_t j = 0; j < m_vecPt.size(); ++j)
-							fwrite(&v[j].y[0], 1, sizeof(int) * v[j].y.size(), fp);
+						{
+							v[j].y.copy(y);
+							fwrite(&y[0], 1, sizeof(int) * y.size(), fp);
+						}
 					}
 
 					if (bTemperature)
 					{
 						const std::vector<Data>& v = m_tempGraph.GetData();
-						int n = (int)v[0].y.size();
+						std::vector<int> y;
+						v[0].y.copy(y);
+						int n = (int)y.size();
 						fwrite(&n, 1, sizeof(n), fp);
-						fwrite(&v[0].y[0], 1, sizeof(int) * v[0].y.size(), fp);
+						fwrite(&y[0], 1, sizeof(int) * y.size(), fp);
 					}
 
 					fwrite("@CNS", 1, 4, fp);
@@ -1641,7 +1682,11 @@ public:
 			AtlMessageBox(m_hWnd, L"Camera disconnect.", (LPCTSTR)nullptr, MB_OK | MB_ICONWARNING);
 			break;
 		case TOUPCAM_EVENT_IMAGE:
-			OnEventImage();
+			{
+				/* every frame counts here: all those the message stands for, none is skipped */
+				unsigned n = m_coalesce.Take();
+				while (n-- && m_hcam && OnEventImage());
+			}
 			break;
 		default:
 			break;
@@ -1649,6 +1694,41 @@ public:
 		return 0;
 	}
 
+	LRESULT OnMsgEmva(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/)
+	{
+		if (EMVA_WAIT == wParam)
+		{
+			/* the frames still go to the graphs while the message box is up */
+			AtlMessageBox(m_hWnd, L"Flat fields done. Cover the camera for the dark frames, then press OK.", (LPCTSTR)nullptr, MB_OK | MB_ICONINFORMATION);
+			if (m_hcam && (EMVA_WAIT == m_emvaState))
+			{
+				m_emva.BeginDark();
+				m_emvaSkip = (unsigned)m_vecExpo.size();	// one more cycle of exposures
+				m_emvaState = EMVA_DARK;
+			}
+			return 0;
+		}
+		if (m_emvaThread.joinable())
+			m_emvaThread.join();
+		if (EMVA_COMPUTE == m_emvaState)
+		{
+			m_emvaState = EMVA_OFF;
+			CFileDialog dlg(FALSE, L"txt", L"emva1288.txt", OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT, L"Text Files (*.txt)\0*.txt\0All Files (*.*)\0*.*\0\0", m_hWnd);
+			if (IDOK == dlg.DoModal())
+			{
+				FILE* fp = _wfopen(dlg.m_szFileName, L"w, ccs=UTF-8");
+				if (nullptr == fp)
+					AtlMessageBox(m_hWnd, L"Save file failed.", (LPCTSTR)nullptr, MB_OK | MB_ICONWARNING);
+				else
+				{
+					fputws(m_emva.Report(m_emvaResult, m_pModel ? m_pModel->name : L"").c_str(), fp);
+					fclose(fp);
+				}
+			}
+		}
+		return 0;
+	}
+
 	void OnTimer(UINT_PTR nIDEvent)
 	{
 		switch (nIDEvent)
@@ -1782,6 +1862,15 @@ private:
 			int w = 0, h = 0;
 			Toupcam_get_FinalSize(m_hcam, &w, &h);
 			m_pRawData = malloc(w * h * ((m_bitdepth > 8) ? 2 : 1));
+			SetBoxes(h);
+			m_emvaState = EMVA_OFF;
+			if (dlg.m_bEmva)
+			{
+				m_emva.Init(m_vecExpo.size(), w, h);
+				for (size_t i = 0; i < m_vecExpo.size(); ++i)
+					m_emva.SetExposure(i, m_vecExpo[i].expoTime, m_vecExpo[i].expoGain);
+				m_emvaState = EMVA_LIGHT;
+			}
 
 			m_tempGraph.Init(0, 0);
 			m_view.Init(w, h, nFourCC, m_bitdepth);
@@ -1815,13 +1904,29 @@ private:
 			m_bTriggerMode = (val != 0);
 			
 			m_idxExpo = 0;
-			Toupcam_put_ExpoTime(m_hcam, m_vecExpo[m_idxExpo].expoTime);
-			if (m_bSupportGain)
-				Toupcam_put_ExpoAGain(m_hcam, m_vecExpo[m_idxExpo].expoGain);
-			Toupcam_StartPullModeWithWndMsg(m_hcam, m_hWnd, MSG_CAMERA);
+			m_bSequencer = (m_vecExpo.size() > 1) && StartSequencer();
+			if (m_bSequencer)
+			{
+				/* the sequencer sets the exposures */
+			}
+			else if (m_bTriggerMode)
+			{
+				Toupcam_put_ExpoTime(m_hcam, m_vecExpo[m_idxExpo].expoTime);
+				if (m_bSupportGain)
+					Toupcam_put_ExpoAGain(m_hcam, m_vecExpo[m_idxExpo].expoGain);
+			}
+			else
+			{
+				/* the first exposure on the first frame */
+				m_sched.init(m_hcam);
+				m_target = 0;
+				m_idAdded = UINT_MAX;
+				m_sched.schedule(m_target, m_vecExpo[m_idxExpo].expoTime, m_bSupportGain ? m_vecExpo[m_idxExpo].expoGain : 0, m_idxExpo, &m_idSched);
+			}
+			m_coalesce.Start(m_hcam, m_hWnd, MSG_CAMERA);
 			if (m_bTriggerMode)
 			{
-				Toupcam_Trigger(m_hcam, 1);
+				Toupcam_Trigger(m_hcam, m_bSequencer ? 0xffff : 1); // the sequencer steps through the groups by itself, trigger continuously
 				m_bWantTigger = false;
 			}
 			SetTimer(TIMER_ID, TIMER_EPSILON, nullptr);
@@ -1832,13 +1937,60 @@ private:
 		}
 	}
 
+	/* program every exposure of the list into a group of the hardware sequencer, false if the camera has no sequencer */
+	bool StartSequencer()
+	{
+		if (m_vecExpo.size() > 255)
+			return false;
+		if (FAILED(Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_SEQUENCER_NUMBER, (int)m_vecExpo.size())))
+			return false;
+		for (size_t i = 0; i < m_vecExpo.size(); ++i)
+		{
+			/* the groups are numbered from 1 */
+			if (FAILED(Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_SEQUENCER_EXPOTIME | (int)(i + 1), m_vecExpo[i].expoTime)))
+				return false;
+			if (m_bSupportGain && FAILED(Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_SEQUENCER_EXPOGAIN | (int)(i + 1), m_vecExpo[i].expoGain)))
+				return false;
+		}
+		return SUCCEEDED(Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_SEQUENCER_ONOFF, 1));
+	}
+
+	/*
+	 * the exposure of the list a frame of the sequencer was taken with, -1 for a frame which is not settled yet
+	 * (the exposure in its frame info is none of the list, such as the frames in the pipeline when the sequencer starts)
+	 */
+	int SequencerIndex(const ToupcamFrameInfoV4& info) const
+	{
+		if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_EXPOTIME)
+		{
+			const bool bGain = m_bSupportGain && (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_EXPOGAIN);
+			for (size_t i = 0; i < m_vecExpo.size(); ++i)
+			{
+				if ((m_vecExpo[i].expoTime == info.v3.expotime) && ((!bGain) || (m_vecExpo[i].expoGain == info.v3.expogain)))
+					return (int)i;
+			}
+			return -1;
+		}
+		if (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_SHUTTERSEQ)
+			return (int)(info.v3.shutterseq % m_vecExpo.size());
+		return (int)(info.v3.seq % m_vecExpo.size());
+	}
+
 	void CloseCamera()
 	{
 		if (m_hcam)
 		{
+			if (m_bSequencer)
+			{
+				Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_SEQUENCER_ONOFF, 0);
+				m_bSequencer = false;
+			}
 			Toupcam_Close(m_hcam);
 			m_hcam = nullptr;
 		}
+		if (m_emvaThread.joinable())
+			m_emvaThread.join();
+		m_emvaState = EMVA_OFF;
 		if (m_pRawData)
 		{
 			free(m_pRawData);
@@ -1848,49 +2000,96 @@ private:
 		KillTimer(TIMER_TEMP);
 	}
 
-	template<typename T>
-	void GetData(int* arr, const T* pData, const ToupcamFrameInfoV4& info)
+	/* the raw data is bottom-up: row 0 of the buffer is the last row of the image */
+	void SetBoxes(int height)
 	{
 		const int r = m_area / 2;
-		for (int i = 0; i < (int)m_vecPt.size(); ++i)
+		std::vector<RoiBox> vecBox(m_vecPt.size());
+		for (size_t i = 0; i < m_vecPt.size(); ++i)
+		{
+			vecBox[i].x = m_vecPt[i].x - r;
+			vecBox[i].y = height - 1 - (m_vecPt[i].y + r);
+			vecBox[i].width = vecBox[i].height = m_area;
+		}
+		m_roiStats.SetBoxes(vecBox);
+		m_vecResult.resize(m_vecPt.size());
+		m_vecVal.resize(m_vecPt.size());
+	}
+
+	template<typename T>
+	const int* GetData(const T* pData, const ToupcamFrameInfoV4& info)
+	{
+		m_roiStats.Compute(pData, info.v3.width, m_vecResult.data());
+		for (size_t i = 0; i < m_vecResult.size(); ++i)
+			m_vecVal[i] = (int)(m_vecResult[i].mean * m_scale);
+		return m_vecVal.data();	/* nullptr without points, which CGraph::AddData does not read then */
+	}
+
+	/* the frames of the characterisation: pairs of flat fields, then pairs of dark frames, then the computation on a worker thread */
+	void EmvaAdd(size_t idx, const ToupcamFrameInfoV4& info)
+	{
+		if ((EMVA_LIGHT != m_emvaState) && (EMVA_DARK != m_emvaState))
+			return;
+		if (m_emvaSkip)
 		{
-			long long sum = 0;
-			for (int y = m_vecPt[i].y - r; y < m_vecPt[i].y + r; ++y)
+			--m_emvaSkip;
+			return;
+		}
+		const bool bDone = (m_bitdepth > 8) ? m_emva.Add(idx, (const USHORT*)m_pRawData, info.v3.width) : m_emva.Add(idx, (const BYTE*)m_pRawData, info.v3.width);
+		if (!bDone)
+			return;
+		if (EMVA_LIGHT == m_emvaState)
+		{
+			m_emvaState = EMVA_WAIT;	// the prompt is not shown from inside the frame handler
+			PostMessage(MSG_EMVA, EMVA_WAIT);
+		}
+		else
+		{
+			m_emvaState = EMVA_COMPUTE;
+			m_emvaThread = std::thread([this]()
 			{
-				const T* p = pData + info.v3.width * (info.v3.height - 1 - y);
-				for (int x = m_vecPt[i].x - r; x < m_vecPt[i].x + r; ++x)
-					sum += p[x];
-			}
-			arr[i] = sum * m_scale / (m_area * m_area);
+				m_emvaResult = m_emva.Compute();
+				PostMessage(MSG_EMVA, EMVA_COMPUTE);
+			});
 		}
 	}
 
-	void OnEventImage()
+	/* false when there is no frame left */
+	bool OnEventImage()
 	{
 		const DWORD dwTick = GetTickCount();
-		bool bAdd = false;
 		ToupcamFrameInfoV4 info = { 0 };
 		const HRESULT hr = Toupcam_PullImageV4(m_hcam, m_pRawData, 0, 0, 0, &info);
-		if (SUCCEEDED(hr))
+		if (SUCCEEDED(hr) && m_bSequencer)
 		{
-			if (m_bTriggerMode)
-				bAdd = true;
-			else if (dwTick - m_tickLast >= m_vecExpo[m_idxExpo].delayTime + TIMER_EPSILON)
-				bAdd = true;
-			if (bAdd)
+			/* every frame has its own exposure: no exposure change and no delay, only the frames not settled are skipped */
+			const int idx = SequencerIndex(info);
+			if (idx >= 0)
 			{
-				int* arr = (int*)alloca(sizeof(int) * m_vecPt.size());
 				if (m_bitdepth > 8)
-					GetData(arr, (const PUSHORT)m_pRawData, info);
+					m_vecGraph[idx].AddData(GetData((const USHORT*)m_pRawData, info));
 				else
-					GetData(arr, (const PBYTE)m_pRawData, info);
-				m_vecGraph[m_idxExpo].AddData(arr);
+					m_vecGraph[idx].AddData(GetData((const BYTE*)m_pRawData, info));
+				EmvaAdd(idx, info);
 			}
 			m_view.SetData(m_pRawData);
+			return true;
 		}
-
-		if (bAdd)
+		if (SUCCEEDED(hr) && !m_bTriggerMode)
+		{
+			OnScheduledImage(info, dwTick);
+			return true;
+		}
+		if (SUCCEEDED(hr))
 		{
+			/* trigger mode: the frame of the trigger, sent delayTime after the exposure was put */
+			if (m_bitdepth > 8)
+				m_vecGraph[m_idxExpo].AddData(GetData((const USHORT*)m_pRawData, info));
+			else
+				m_vecGraph[m_idxExpo].AddData(GetData((const BYTE*)m_pRawData, info));
+			EmvaAdd(m_idxExpo, info);
+			m_view.SetData(m_pRawData);
+
 			m_tickLast = dwTick;
 
 			if (m_vecExpo.size() > 1)
@@ -1900,12 +2099,51 @@ private:
 				if (m_bSupportGain)
 					Toupcam_put_ExpoAGain(m_hcam, m_vecExpo[m_idxExpo].expoGain);
 			}
-			if (m_bTriggerMode)
+			if (0 == m_vecExpo[m_idxExpo].delayTime)
+				Toupcam_Trigger(m_hcam, 1);
+			else
+				m_bWantTigger = true;
+		}
+		return SUCCEEDED(hr);
+	}
+
+	/*
+	 * continuous mode: the frame counts for the exposure its tag says it carries, no delay after a change: without
+	 * delayTime every frame counts and the next exposure is scheduled at once, on the next frame the schedule can
+	 * still reach (one exposure per frame, no frame wasted); with it, one frame per exposure, delayTime after the
+	 * first frame which carries it, and the next exposure (the same one again for a single exposure) after that
+	 */
+	void OnScheduledImage(const ToupcamFrameInfoV4& info, DWORD dwTick)
+	{
+		ExpoTag tag;
+		m_sched.frame(info.v3, &tag);
+		bool bNewest = false;
+		if (tag.flag & EXPOSCHED_CARRIES)
+		{
+			if (tag.flag & EXPOSCHED_FIRST)
+				m_tickFirst = dwTick;
+			const UINT delay = m_vecExpo[tag.user].delayTime;
+			if ((0 == delay) || ((dwTick - m_tickFirst >= delay) && (tag.id != m_idAdded)))
 			{
-				if (0 == m_vecExpo[m_idxExpo].delayTime)
-					Toupcam_Trigger(m_hcam, 1);
+				m_idAdded = tag.id;
+				if (m_bitdepth > 8)
+					m_vecGraph[tag.user].AddData(GetData((const USHORT*)m_pRawData, info));
 				else
-					m_bWantTigger = true;
+					m_vecGraph[tag.user].AddData(GetData((const BYTE*)m_pRawData, info));
+				EmvaAdd(tag.user, info);
+				bNewest = (tag.id == m_idSched);
+			}
+		}
+		m_view.SetData(m_pRawData);
+
+		if (m_vecExpo[m_idxExpo].delayTime ? bNewest : (m_vecExpo.size() > 1))
+		{
+			const int idx = (m_idxExpo + 1) % m_vecExpo.size();
+			const unsigned target = (m_sched.earliest() + 1 > m_target + 1) ? (m_sched.earliest() + 1) : (m_target + 1);
+			if (SUCCEEDED(m_sched.schedule(target, m_vecExpo[idx].expoTime, m_bSupportGain ? m_vecExpo[idx].expoGain : 0, idx, &m_idSched)))
+			{
+				m_idxExpo = idx;
+				m_target = target;
 			}
 		}
 	}
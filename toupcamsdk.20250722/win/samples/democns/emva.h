@@ -0,0 +1,272 @@
+#pragma once
+
+/*
+ * Photon transfer characterisation of a camera, the EMVA 1288 way, from the exposure list of democns.
+ * For every exposure two flat field frames (A, B) with light, then, the camera covered, two dark frames (C, D), all
+ * restricted to a centred region of at most EMVA_REGION x EMVA_REGION pixels. From each pair:
+ *   mean			(A + B) / 2 averaged over the region
+ *   temporal variance	var(A - B) / 2, which cancels the fixed pattern
+ *   spatial variance	var((A + B) / 2) - temporal variance / 2
+ * and from the whole series:
+ *   saturation			the exposure with the largest temporal variance
+ *   conversion gain K	slope of (temporal variance - dark temporal variance) against (mean - dark mean), DN/e-,
+ *						fitted up to EMVA_FIT_MAX of saturation
+ *   read noise			sqrt(dark temporal variance) / K at the shortest exposure, e-
+ *   full well			(mean - dark mean) at saturation / K, e-; dynamic range = full well / read noise
+ *   DSNU				sqrt(dark spatial variance) / K at the shortest exposure, e-
+ *   PRNU				sqrt(spatial variance - dark spatial variance) / (mean - dark mean) at the exposure nearest to
+ *						half saturation, %
+ *   linearity error	(max - min) / 2 of the relative deviation of (mean - dark mean) from a line through the exposure
+ *						times, between EMVA_LIN_MIN and EMVA_LIN_MAX of saturation, %
+ * The light must be constant and the exposures must differ by the exposure time only (one gain), the photons being
+ * proportional to it. Add() is called with the frames of the UI thread, Compute() on a worker thread once both series
+ * are complete; there is no other shared state.
+ */
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#define EMVA_REGION		512
+#define EMVA_FIT_MAX	0.7
+#define EMVA_LIN_MIN	0.05
+#define EMVA_LIN_MAX	0.95
+
+typedef struct {
+	double mean, temporal, spatial;
+} EmvaPairStats;
+
+typedef struct {
+	double K, readNoise, fullWell, dynamicRange, dsnu, prnu, linearity;
+	int saturation;		/* index of the exposure, -1: not enough points */
+} EmvaResult;
+
+class CEmva
+{
+	struct Step {
+		UINT	expoTime;
+		USHORT	expoGain;
+		std::vector<USHORT>	frame[4];	/* A, B light, C, D dark */
+		EmvaPairStats	light, dark;
+	};
+	std::vector<Step>	m_vecStep;
+	int		m_x, m_y, m_w, m_h;
+	bool	m_bDark;
+
+	template<typename T>
+	void Copy(std::vector<USHORT>& v, const T* pData, int width) const
+	{
+		v.resize((size_t)m_w * m_h);
+		for (int y = 0; y < m_h; ++y)
+		{
+			const T* p = pData + (size_t)(m_y + y) * width + m_x;
+			for (int x = 0; x < m_w; ++x)
+				v[(size_t)y * m_w + x] = p[x];
+		}
+	}
+
+	static EmvaPairStats Pair(const std::vector<USHORT>& a, const std::vector<USHORT>& b)
+	{
+		const size_t n = a.size();
+		double s = 0.0, s2 = 0.0, d = 0.0, d2 = 0.0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			const double m = 0.5 * (a[i] + b[i]), diff = (double)a[i] - b[i];
+			s += m;
+			s2 += m * m;
+			d += diff;
+			d2 += diff * diff;
+		}
+		EmvaPairStats r;
+		r.mean = s / n;
+		r.temporal = 0.5 * std::max(0.0, d2 / n - (d / n) * (d / n));
+		r.spatial = std::max(0.0, s2 / n - r.mean * r.mean - 0.5 * r.temporal);
+		return r;
+	}
+
+	/* least squares y = a + b x */
+	static void Fit(const std::vector<double>& x, const std::vector<double>& y, double& a, double& b)
+	{
+		const double n = (double)x.size();
+		double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+		for (size_t i = 0; i < x.size(); ++i)
+		{
+			sx += x[i];
+			sy += y[i];
+			sxx += x[i] * x[i];
+			sxy += x[i] * y[i];
+		}
+		const double det = n * sxx - sx * sx;
+		b = (det != 0.0) ? (n * sxy - sx * sy) / det : 0.0;
+		a = (n > 0.0) ? (sy - b * sx) / n : 0.0;
+	}
+public:
+	CEmva()
+	: m_x(0), m_y(0), m_w(0), m_h(0), m_bDark(false)
+	{
+	}
+
+	void Init(size_t nStep, int width, int height)
+	{
+		m_vecStep.clear();
+		m_vecStep.resize(nStep);
+		m_w = std::min(width, EMVA_REGION);
+		m_h = std::min(height, EMVA_REGION);
+		m_x = (width - m_w) / 2;
+		m_y = (height - m_h) / 2;
+		m_bDark = false;
+	}
+
+	void SetExposure(size_t idx, UINT expoTime, USHORT expoGain)
+	{
+		m_vecStep[idx].expoTime = expoTime;
+		m_vecStep[idx].expoGain = expoGain;
+	}
+
+	bool IsDark() const { return m_bDark; }
+	void BeginDark() { m_bDark = true; }
+
+	/* frame of exposure idx, ignored once its pair is complete; true when the series (light or dark) is complete */
+	template<typename T>
+	bool Add(size_t idx, const T* pData, int width)
+	{
+		Step& s = m_vecStep[idx];
+		const int first = m_bDark ? 2 : 0;
+		if (s.frame[first].empty())
+			Copy(s.frame[first], pData, width);
+		else if (s.frame[first + 1].empty())
+			Copy(s.frame[first + 1], pData, width);
+		for (size_t i = 0; i < m_vecStep.size(); ++i)
+		{
+			if (m_vecStep[i].frame[first + 1].empty())
+				return false;
+		}
+		return true;
+	}
+
+	EmvaResult Compute()
+	{
+		EmvaResult r = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, -1 };
+		if (m_vecStep.size() < 3)
+			return r;
+		for (size_t i = 0; i < m_vecStep.size(); ++i)
+		{
+			Step& s = m_vecStep[i];
+			s.light = Pair(s.frame[0], s.frame[1]);
+			s.dark = Pair(s.frame[2], s.frame[3]);
+		}
+		/* in the order of the exposure time */
+		std::vector<size_t> order(m_vecStep.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return m_vecStep[a].expoTime < m_vecStep[b].expoTime; });
+
+		size_t sat = order[0];
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			if (m_vecStep[order[i]].light.temporal > m_vecStep[sat].light.temporal)
+				sat = order[i];
+		}
+		const double satSignal = m_vecStep[sat].light.mean - m_vecStep[sat].dark.mean;
+		if (satSignal <= 0.0)
+			return r;
+		r.saturation = (int)sat;
+
+		std::vector<double> x, y;
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			const Step& s = m_vecStep[order[i]];
+			const double signal = s.light.mean - s.dark.mean;
+			if ((signal > 0.0) && (signal <= EMVA_FIT_MAX * satSignal))
+			{
+				x.push_back(signal);
+				y.push_back(s.light.temporal - s.dark.temporal);
+			}
+		}
+		if (x.size() < 2)
+		{
+			r.saturation = -1;
+			return r;
+		}
+		double a = 0.0;
+		Fit(x, y, a, r.K);
+		if (r.K <= 0.0)
+		{
+			r.saturation = -1;
+			return r;
+		}
+
+		const Step& shortest = m_vecStep[order[0]];
+		r.readNoise = sqrt(shortest.dark.temporal) / r.K;
+		r.fullWell = satSignal / r.K;
+		r.dynamicRange = (r.readNoise > 0.0) ? r.fullWell / r.readNoise : 0.0;
+		r.dsnu = sqrt(shortest.dark.spatial) / r.K;
+
+		size_t half = order[0];
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			const Step& s = m_vecStep[order[i]];
+			if (fabs(s.light.mean - s.dark.mean - 0.5 * satSignal) < fabs(m_vecStep[half].light.mean - m_vecStep[half].dark.mean - 0.5 * satSignal))
+				half = order[i];
+		}
+		{
+			const Step& s = m_vecStep[half];
+			const double signal = s.light.mean - s.dark.mean;
+			r.prnu = (signal > 0.0) ? 100.0 * sqrt(std::max(0.0, s.light.spatial - s.dark.spatial)) / signal : 0.0;
+		}
+
+		x.clear();
+		y.clear();
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			const Step& s = m_vecStep[order[i]];
+			const double signal = s.light.mean - s.dark.mean;
+			if ((signal >= EMVA_LIN_MIN * satSignal) && (signal <= EMVA_LIN_MAX * satSignal))
+			{
+				x.push_back(s.expoTime);
+				y.push_back(signal);
+			}
+		}
+		if (x.size() >= 2)
+		{
+			double b = 0.0, dmin = 0.0, dmax = 0.0;
+			Fit(x, y, a, b);
+			for (size_t i = 0; i < x.size(); ++i)
+			{
+				const double fit = a + b * x[i];
+				const double dev = (fit != 0.0) ? (y[i] - fit) / fit : 0.0;
+				dmin = (0 == i) ? dev : std::min(dmin, dev);
+				dmax = (0 == i) ? dev : std::max(dmax, dev);
+			}
+			r.linearity = 100.0 * (dmax - dmin) / 2;
+		}
+		return r;
+	}
+
+	/* tab separated, one line per exposure then the summary; after Compute() */
+	std::wstring Report(const EmvaResult& r, const wchar_t* szModel) const
+	{
+		std::wstring str;
+		wchar_t line[512];
+		swprintf(line, _countof(line), L"EMVA 1288 characterisation\t%s\nregion\t%d x %d\n\n", szModel, m_w, m_h);
+		str += line;
+		str += L"exposure (us)\tgain\tmean\ttemporal var\tspatial var\tdark mean\tdark temporal var\tdark spatial var\n";
+		for (size_t i = 0; i < m_vecStep.size(); ++i)
+		{
+			const Step& s = m_vecStep[i];
+			swprintf(line, _countof(line), L"%u\t%hu\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", s.expoTime, s.expoGain,
+				s.light.mean, s.light.temporal, s.light.spatial, s.dark.mean, s.dark.temporal, s.dark.spatial);
+			str += line;
+		}
+		if (r.saturation < 0)
+			str += L"\nnot enough valid exposures: use at least 3 exposure times from dark to saturation\n";
+		else
+		{
+			swprintf(line, _countof(line), L"\nsaturation\t%u us\nconversion gain\t%.5f DN/e-\nread noise\t%.3f e-\nfull well\t%.1f e-\n"
+				L"dynamic range\t%.1f dB\nDSNU\t%.3f e-\nPRNU\t%.3f %%\nlinearity error\t%.3f %%\n", m_vecStep[r.saturation].expoTime,
+				r.K, r.readNoise, r.fullWell, (r.dynamicRange > 0.0) ? 20.0 * log10(r.dynamicRange) : 0.0, r.dsnu, r.prnu, r.linearity);
+			str += line;
+		}
+		return str;
+	}
+};
@@ -355,7 +355,7 @@ void CGraph::AddData(const int arr[])
 		for (size_t i = 0; i < m_data.size(); ++i)
 			m_data[i].y.push_back(arr[i]);
 	}
-	if (1 == m_data[0].y.size())
+	if (1 == dataNum())
 		Zoom11();
 	else
 	{
@@ -449,7 +449,7 @@ void CGraph::Up()
 
 void CGraph::Zoom11()
 {
-	m_xmin = 0;
+	m_xmin = firstData();
 	m_yminCur = m_ymin;
 	m_ymaxCur = m_ymax;
 	m_xStepNum = m_xDefStep;
@@ -698,18 +698,72 @@ void CGraph::GetPoint(int x, int y, CPoint& pt)const
 	pt.y = (LONG)(m_rect.bottom - (y - m_yminCur) * m_rect.Height() / fyRange);
 }
 
+/* the oldest sample still held, at the coarsest level */
+int CGraph::firstData()const
+{
+	if (m_data.size())
+		return m_data[0].y.first(SERIES_LEVELS - 1);
+	return 0;
+}
+
 void CGraph::DrawLine(CDCHandle* pDC, const Data& data)const
 {
+	const int last = std::min(dataNum(), m_xmin + m_rect.Width() * m_xStepDen / m_xStepNum + 2);
+	const int level = data.y.Level((double)m_xStepDen / m_xStepNum, m_xmin);
+	int i = std::max(m_xmin, data.y.first(level));
+	if (i >= last)
+		return;
+
 	CPoint pt;
-	GetPoint(m_xmin, data.y[m_xmin] + data.offset, pt);
-	pDC->MoveTo(pt);
-	for (int i = m_xmin + 1; i < dataNum(); ++i)
+	if (0 == level)
 	{
-		GetPoint(i, data.y[i] + data.offset, pt);
-		pDC->LineTo(pt);
-		if (pt.x > m_rect.right)
-			break;
+		GetPoint(i, data.y.at(i) + data.offset, pt);
+		pDC->MoveTo(pt);
+		for (++i; i < last; ++i)
+		{
+			GetPoint(i, data.y.at(i) + data.offset, pt);
+			pDC->LineTo(pt);
+		}
+		return;
+	}
+
+	/* several blocks per column: one vertical stroke from the min to the max of the column */
+	bool bFirst = true;
+	auto stroke = [&](int x, const SeriesRange& r) {
+		CPoint lo, hi;
+		GetPoint(0, r.lo + data.offset, lo);
+		GetPoint(0, r.hi + data.offset, hi);
+		if (bFirst)
+			pDC->MoveTo(x, lo.y);
+		else
+			pDC->LineTo(x, lo.y);
+		pDC->LineTo(x, hi.y - 1);
+		bFirst = false;
+	};
+	const int n = CSeries::Block(level);
+	SeriesRange col = { 0, 0 };
+	int x = 0;
+	bool bCol = false;
+	for (i -= i % n; i < last; i += n)
+	{
+		const SeriesRange r = data.y.range(level, i);
+		GetPoint(i, 0, pt);
+		if (bCol && (pt.x == x))
+		{
+			col.lo = std::min(col.lo, r.lo);
+			col.hi = std::max(col.hi, r.hi);
+		}
+		else
+		{
+			if (bCol)
+				stroke(x, col);
+			x = pt.x;
+			col = r;
+			bCol = true;
+		}
 	}
+	if (bCol)
+		stroke(x, col);
 }
 
 void CGraph::DrawX(CDCHandle* pDC, const CRect& rect)const
@@ -832,8 +886,8 @@ void CGraph::Move()
 	if (x)
 	{
 		m_xmin = m_oldxmin - x * m_xStepDen / m_xStepNum;
-		if (m_xmin < 0)
-			m_xmin = 0;
+		if (m_xmin < firstData())
+			m_xmin = firstData();
 		else if (m_xmin + 1 >= dataNum())
 			m_xmin = dataNum() - 1;
 	}
@@ -1027,26 +1081,28 @@ void CGraph::OnCsv(const wchar_t* szFullPath)const
 	FILE* fp = _wfopen(szFullPath, L"wt");
 	if (fp)
 	{
+		/* the samples still held by the ring, oldest first */
+		const int first = m_data[0].y.first(0), last = dataNum();
 		if (m_bTemp)
 		{
-			for (size_t i = 0; i < m_data[0].y.size(); ++i)
+			for (int i = first; i < last; ++i)
 			{
-				fprintf(fp, "%.1f", m_data[0].y[i] / 10.0);
-				if (i + 1 != m_data[0].y.size())
+				fprintf(fp, "%.1f", m_data[0].y.at(i) / 10.0);
+				if (i + 1 != last)
 					fputs("\n", fp);
 			}
 		}
 		else
 		{
-			for (size_t i = 0; i < m_data[0].y.size(); ++i)
+			for (int i = first; i < last; ++i)
 			{
 				for (size_t j = 0; j < m_data.size(); ++j)
 				{
-					fprintf(fp, "%d", m_data[j].y[i]);
+					fprintf(fp, "%d", m_data[j].y.at(i));
 					if (j + 1 != m_data.size())
 						fputs(",", fp);
 				}
-				if (i + 1 != m_data[0].y.size())
+				if (i + 1 != last)
 					fputs("\n", fp);
 			}
 		}
@@ -3,6 +3,7 @@
 
 #include <amvideo.h>
 #include <vector>
+#include "series.h"
 
 #define MAX_ZOOM		100
 #define MAX_XSTEP		15
@@ -11,7 +12,7 @@
 typedef struct {
 	BYTE	visible;
 	int		offset;
-	std::vector<int>	y;
+	CSeries	y;
 } Data;
 
 class CGraph : public CWindowImpl<CGraph>
@@ -84,7 +85,7 @@ public:
 	int dataNum()const
 	{
 		if (m_data.size())
-			return (int)(m_data[0].y.size());
+			return m_data[0].y.count();
 		return 0;
 	}
 	void Zoom11();
@@ -112,6 +113,7 @@ private:
 	void GetPoint(int x, int y, CPoint& pt)const;
 	void OnSizeChanged();
 	void Move();
+	int firstData()const;
 	bool CalcZoomInY(int& newminY, int& newmaxY)const;
 	void AdjustZoomY(int& yVal1, int& yVal2)const;
 	void SaveReg();
@@ -0,0 +1,138 @@
+#ifndef __series_h__
+#define __series_h__
+
+/*
+ * One time series of a graph, bounded in memory however long the acquisition runs:
+ *   level 0		the last SERIES_CAPACITY samples, a ring
+ *   level k > 0	min / max of blocks of SERIES_FACTOR^k samples, a ring of SERIES_CAPACITY blocks each, so the coarser
+ *					levels reach further back (the coarsest one SERIES_CAPACITY x SERIES_FACTOR^(SERIES_LEVELS - 1) samples)
+ * Samples are numbered from the first one ever added (count() is the next one), whatever has been dropped since;
+ * Level() picks the level of a resolution, so that a graph of w pixels reads O(w) entries, never the whole history.
+ * The rings grow with the samples up to their capacity, a short series costs what it holds.
+ */
+#include <vector>
+#include <algorithm>
+
+#define SERIES_CAPACITY		(1 << 16)
+#define SERIES_FACTOR		16
+#define SERIES_LEVELS		4
+
+typedef struct {
+	int lo, hi;
+} SeriesRange;
+
+class CSeries
+{
+	std::vector<int>	m_raw;
+	std::vector<SeriesRange>	m_level[SERIES_LEVELS - 1];
+	SeriesRange			m_cur[SERIES_LEVELS - 1];		/* the block being filled */
+	int					m_count;
+
+	static int BlockSize(int level)
+	{
+		int n = 1;
+		while (level-- > 0)
+			n *= SERIES_FACTOR;
+		return n;
+	}
+
+	template<typename T>
+	static void Put(std::vector<T>& ring, int idx, const T& v)
+	{
+		if (ring.size() < SERIES_CAPACITY)
+			ring.push_back(v);
+		else
+			ring[idx % SERIES_CAPACITY] = v;
+	}
+public:
+	CSeries()
+	: m_count(0)
+	{
+	}
+
+	void clear()
+	{
+		std::vector<int>().swap(m_raw);
+		for (int k = 0; k < SERIES_LEVELS - 1; ++k)
+			std::vector<SeriesRange>().swap(m_level[k]);
+		m_count = 0;
+	}
+
+	int count() const { return m_count; }
+
+	void push_back(int v)
+	{
+		Put(m_raw, m_count, v);
+		for (int k = 0; k < SERIES_LEVELS - 1; ++k)
+		{
+			const int n = BlockSize(k + 1);
+			SeriesRange& r = m_cur[k];
+			if (0 == m_count % n)
+				r.lo = r.hi = v;
+			else
+			{
+				r.lo = std::min(r.lo, v);
+				r.hi = std::max(r.hi, v);
+			}
+			if (0 == (m_count + 1) % n)
+				Put(m_level[k], m_count / n, r);
+		}
+		++m_count;
+	}
+
+	void assign(const int* p, int n)
+	{
+		clear();
+		for (int i = 0; i < n; ++i)
+			push_back(p[i]);
+	}
+
+	/* samples per entry of a level */
+	static int Block(int level) { return BlockSize(level); }
+
+	/* the first sample still held by a level */
+	int first(int level) const
+	{
+		const int n = BlockSize(level);
+		return std::max(0, m_count / n - SERIES_CAPACITY) * n;
+	}
+
+	/* the finest level with no more than nPerPixel samples per entry that still holds sample idx */
+	int Level(double nPerPixel, int idx) const
+	{
+		int k = 0;
+		while ((k + 1 < SERIES_LEVELS) && (BlockSize(k + 1) <= nPerPixel))
+			++k;
+		while ((k + 1 < SERIES_LEVELS) && (idx < first(k)))
+			++k;
+		return k;
+	}
+
+	/* sample idx, first(0) <= idx < count() */
+	int at(int idx) const { return m_raw[idx % SERIES_CAPACITY]; }
+
+	/* min / max of the entry of a level holding sample idx, first(level) <= idx < count(); the last one may be partial */
+	SeriesRange range(int level, int idx) const
+	{
+		if (0 == level)
+		{
+			const SeriesRange r = { at(idx), at(idx) };
+			return r;
+		}
+		const int n = BlockSize(level), block = idx / n;
+		if ((block + 1) * n > m_count)
+			return m_cur[level - 1];
+		return m_level[level - 1][block % SERIES_CAPACITY];
+	}
+
+	/* the samples held at level 0, oldest first */
+	void copy(std::vector<int>& v) const
+	{
+		v.clear();
+		v.reserve(m_count - first(0));
+		for (int i = first(0); i < m_count; ++i)
+			v.push_back(at(i));
+	}
+};
+
+#endif
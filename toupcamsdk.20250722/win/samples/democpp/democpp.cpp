@@ -16,10 +16,19 @@ CAppModule _Module;
 #include "resource.h"
 #include <sstream>
 #include <iomanip>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <InitGuid.h>
 #include <wincodec.h>
 #include <wmsdkidl.h>
 #include <Dbt.h>
+#include "../asyncsave.h"
+#include "../wndmsgcoalesce.h"
+#include "../tileview.h"
 
 #define MSG_CAMEVENT			(WM_APP + 1)
 #define MSG_CAMENUM				(WM_APP + 2)
@@ -44,84 +53,6 @@ static BOOL SaveImageBmp(const wchar_t* strFilename, const void* pData, const BI
 	return FALSE;
 }
 
-/* https://docs.microsoft.com/en-us/windows/desktop/wic/-wic-lh */
-static BOOL SaveImageByWIC(const wchar_t* strFilename, const void* pData, const BITMAPINFOHEADER* pHeader)
-{
-	GUID guidContainerFormat;
-	if (PathMatchSpec(strFilename, L"*.jpg"))
-		guidContainerFormat = GUID_ContainerFormatJpeg;
-	else if (PathMatchSpec(strFilename, L"*.png"))
-		guidContainerFormat = GUID_ContainerFormatPng;
-	else
-		return FALSE;
-
-	CComPtr<IWICImagingFactory> spIWICImagingFactory;
-	HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (LPVOID*)&spIWICImagingFactory);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICBitmapEncoder> spIWICBitmapEncoder;
-	hr = spIWICImagingFactory->CreateEncoder(guidContainerFormat, NULL, &spIWICBitmapEncoder);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICStream> spIWICStream;
-	spIWICImagingFactory->CreateStream(&spIWICStream);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICStream->InitializeFromFilename(strFilename, GENERIC_WRITE);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICBitmapEncoder->Initialize(spIWICStream, WICBitmapEncoderNoCache);
-	if (FAILED(hr))
-		return FALSE;
-
-	CComPtr<IWICBitmapFrameEncode> spIWICBitmapFrameEncode;
-	CComPtr<IPropertyBag2> spIPropertyBag2;
-	hr = spIWICBitmapEncoder->CreateNewFrame(&spIWICBitmapFrameEncode, &spIPropertyBag2);
-	if (FAILED(hr))
-		return FALSE;
-
-	if (GUID_ContainerFormatJpeg == guidContainerFormat)
-	{
-		PROPBAG2 option = { 0 };
-		option.pstrName = L"ImageQuality"; /* jpg quality, you can change this setting */
-		CComVariant varValue(0.75f);
-		spIPropertyBag2->Write(1, &option, &varValue);
-	}
-	hr = spIWICBitmapFrameEncode->Initialize(spIPropertyBag2);
-	if (FAILED(hr))
-		return FALSE;
-
-	hr = spIWICBitmapFrameEncode->SetSize(pHeader->biWidth, pHeader->biHeight);
-	if (FAILED(hr))
-		return FALSE;
-
-	WICPixelFormatGUID formatGUID = GUID_WICPixelFormat24bppBGR;
-	hr = spIWICBitmapFrameEncode->SetPixelFormat(&formatGUID);
-	if (FAILED(hr))
-		return FALSE;
-
-	const LONG nWidthBytes = TDIBWIDTHBYTES(pHeader->biWidth * pHeader->biBitCount);
-	for (LONG i = 0; i < pHeader->biHeight; ++i)
-	{
-		hr = spIWICBitmapFrameEncode->WritePixels(1, nWidthBytes, nWidthBytes, ((BYTE*)pData) + nWidthBytes * (pHeader->biHeight - i - 1));
-		if (FAILED(hr))
-			return FALSE;
-	}
-
-	hr = spIWICBitmapFrameEncode->Commit();
-	if (FAILED(hr))
-		return FALSE;
-	hr = spIWICBitmapEncoder->Commit();
-	if (FAILED(hr))
-		return FALSE;
-	
-	return TRUE;
-}
-
 class CExposureTimeDlg : public CDialogImpl<CExposureTimeDlg>
 {
 	HToupcam	m_hcam;
@@ -1376,21 +1307,34 @@ private:
 	}
 };
 
+/* the frame by tiles on the GPU (../tileview.h), StretchDIBits of the visible part when there is no device
+ * wheel: zoom about the cursor, drag: pan, double click: fit / 1:1 at the cursor
+ */
 class CMainView : public CWindowImpl<CMainView>
 {
 	CMainFrame*	m_pMainFrame;
-	LONG		m_nOldWidth, m_nOldHeight;
+	CTileView	m_tile;
+	bool		m_bDrag;
+	POINT		m_ptDrag;
 
 	BEGIN_MSG_MAP(CMainView)
+		MESSAGE_HANDLER(WM_CREATE, OnWmCreate)
 		MESSAGE_HANDLER(WM_PAINT, OnWmPaint)
 		MESSAGE_HANDLER(WM_ERASEBKGND, OnEraseBkgnd)
+		MESSAGE_HANDLER(WM_SIZE, OnWmSize)
+		MESSAGE_HANDLER(WM_MOUSEWHEEL, OnWmMouseWheel)
+		MESSAGE_HANDLER(WM_LBUTTONDOWN, OnWmLButtonDown)
+		MESSAGE_HANDLER(WM_MOUSEMOVE, OnWmMouseMove)
+		MESSAGE_HANDLER(WM_LBUTTONUP, OnWmLButtonUp)
+		MESSAGE_HANDLER(WM_CAPTURECHANGED, OnWmCaptureChanged)
+		MESSAGE_HANDLER(WM_LBUTTONDBLCLK, OnWmLButtonDblClk)
 	END_MSG_MAP()
 
 	static ATL::CWndClassInfo& GetWndClassInfo()
 	{
 		static ATL::CWndClassInfo wc =
 		{
-			{ sizeof(WNDCLASSEX), CS_HREDRAW | CS_VREDRAW, StartWindowProc,
+			{ sizeof(WNDCLASSEX), CS_HREDRAW | CS_VREDRAW | CS_DBLCLKS, StartWindowProc,
 			  0, 0, NULL, NULL, NULL, (HBRUSH)NULL_BRUSH, NULL, NULL, NULL },
 			NULL, NULL, IDC_ARROW, TRUE, 0, L""
 		};
@@ -1398,8 +1342,32 @@ class CMainView : public CWindowImpl<CMainView>
 	}
 public:
 	CMainView(CMainFrame* pMainFrame)
-	: m_pMainFrame(pMainFrame), m_nOldWidth(0), m_nOldHeight(0)
+	: m_pMainFrame(pMainFrame), m_bDrag(false)
+	{
+		m_ptDrag.x = m_ptDrag.y = 0;
+	}
+
+	/* the data of GetData changed */
+	void NewFrame()
 	{
+		m_tile.NewFrame();
+		Invalidate();
+	}
+
+	double GetZoom() const
+	{
+		return m_tile.GetZoom();
+	}
+
+	CD3DOverlay& GetOverlay()
+	{
+		return m_tile.GetOverlay();
+	}
+
+	/* tiles uploaded since the last call, -1: drawn by GDI */
+	int GetUploadCount()
+	{
+		return m_tile.Ready() ? (int)m_tile.GetUploadCount() : -1;
 	}
 private:
 	LRESULT OnWmPaint(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
@@ -1407,6 +1375,74 @@ private:
 	{
 		return 1;
 	}
+
+	LRESULT OnWmCreate(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		if (!m_tile.Attach(m_hWnd))
+			AtlTrace(L"no Direct3D 11 device, drawn by GDI\n");
+		return 0;
+	}
+
+	LRESULT OnWmSize(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		m_tile.Resize(LOWORD(lParam), HIWORD(lParam));
+		return 0;
+	}
+
+	LRESULT OnWmMouseWheel(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+		ScreenToClient(&pt);
+		m_tile.ZoomAt(pt, pow(1.25, GET_WHEEL_DELTA_WPARAM(wParam) / (double)WHEEL_DELTA));
+		Invalidate();
+		return 0;
+	}
+
+	LRESULT OnWmLButtonDown(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		m_ptDrag.x = GET_X_LPARAM(lParam);
+		m_ptDrag.y = GET_Y_LPARAM(lParam);
+		m_bDrag = true;
+		SetCapture();
+		return 0;
+	}
+
+	LRESULT OnWmMouseMove(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		if (m_bDrag)
+		{
+			const POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+			m_tile.Pan(pt.x - m_ptDrag.x, pt.y - m_ptDrag.y);
+			m_ptDrag = pt;
+			Invalidate();
+		}
+		return 0;
+	}
+
+	LRESULT OnWmLButtonUp(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		if (m_bDrag)
+			ReleaseCapture();
+		return 0;
+	}
+
+	LRESULT OnWmCaptureChanged(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		m_bDrag = false;
+		return 0;
+	}
+
+	LRESULT OnWmLButtonDblClk(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+		const double z = m_tile.GetZoom();
+		if (fabs(z - 1.0) < 1e-6)
+			m_tile.Fit();
+		else
+			m_tile.ZoomAt(pt, 1.0 / z);
+		Invalidate();
+		return 0;
+	}
 };
 
 class CWmvRecord
@@ -1531,7 +1567,8 @@ public:
 		}
 	}
 
-	BOOL WriteSample(const void* pData)
+	/* cnsSampleTime: 100 nanoseconds */
+	BOOL WriteSample(const void* pData, QWORD cnsSampleTime)
 	{
 		CComPtr<INSSBuffer> spINSSBuffer;
 		if (SUCCEEDED(m_spIWMWriter->AllocateSample(TDIBWIDTHBYTES(m_lFrameWidth * 24) * m_lFrameHeight, &spINSSBuffer)))
@@ -1541,15 +1578,20 @@ public:
 			{
 				memcpy(pBuffer, pData, TDIBWIDTHBYTES(m_lFrameWidth * 24) * m_lFrameHeight);
 				spINSSBuffer->SetLength(TDIBWIDTHBYTES(m_lFrameWidth * 24) * m_lFrameHeight);
-				QWORD cnsSampleTime = GetTickCount();
-				m_spIWMWriter->WriteSample(0, cnsSampleTime * 1000 * 10, 0, spINSSBuffer);
-				return TRUE;
+				return SUCCEEDED(m_spIWMWriter->WriteSample(0, cnsSampleTime, 0, spINSSBuffer));
 			}
 		}
 
 		return FALSE;
 	}
 
+	BOOL GetStatistics(WM_WRITER_STATISTICS* pStats)
+	{
+		CComPtr<IWMWriterAdvanced> spIWMWriterAdvanced;
+		m_spIWMWriter->QueryInterface(__uuidof(IWMWriterAdvanced), (void**)&spIWMWriterAdvanced);
+		return spIWMWriterAdvanced && SUCCEEDED(spIWMWriterAdvanced->GetStatistics(0, pStats));
+	}
+
 private:
 	HRESULT SetInputProps()
 	{
@@ -1655,6 +1697,172 @@ private:
 	}
 };
 
+#define RECORD_RING_NUM		8
+
+/*
+ * Recording off the UI thread: Write only copies the frame into a free buffer of a preallocated ring and returns,
+ * a recorder thread owns the CWmvRecord (created, fed and stopped there) and encodes the queued samples in order.
+ * When the encoder falls behind, the oldest queued sample is dropped to make room, so a sample never waits longer
+ * than RECORD_RING_NUM frames and the recording stays live instead of lagging further and further behind.
+ */
+class CRecorder
+{
+	const LONG				m_lFrameWidth, m_lFrameHeight;
+	const size_t			m_cbFrame;
+	struct Sample {
+		BYTE*	pData;
+		QWORD	cnsTime;
+	};
+	std::vector<BYTE*>		m_vecPool;
+	std::deque<BYTE*>		m_free;
+	std::deque<Sample>		m_queue;
+	std::mutex				m_mtx;
+	std::condition_variable	m_cv;
+	std::thread				m_thread;
+	bool					m_bStop;
+	int						m_nStart;	/* 0: starting, 1: recording, -1: failed to start */
+	QWORD					m_cnsFirst;
+	ULONGLONG				m_tickStart;
+	std::atomic<unsigned>	m_nWritten, m_nDropped;
+	std::atomic<unsigned long long>	m_nBytes;	/* compressed output */
+
+	void Run(const std::wstring& strFilename, DWORD dwBitrate)
+	{
+		CoInitializeEx(NULL, COINIT_MULTITHREADED);
+		{
+			CWmvRecord wmv(m_lFrameWidth, m_lFrameHeight);
+			const BOOL bStart = wmv.StartRecord(strFilename.c_str(), dwBitrate);
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_nStart = bStart ? 1 : -1;
+			}
+			m_cv.notify_all();
+			if (bStart)
+			{
+				while (true)
+				{
+					Sample sample;
+					{
+						std::unique_lock<std::mutex> lock(m_mtx);
+						m_cv.wait(lock, [this] { return m_bStop || !m_queue.empty(); });
+						if (m_queue.empty())
+							break;	/* stopped and drained */
+						sample = m_queue.front();
+						m_queue.pop_front();
+					}
+					if (wmv.WriteSample(sample.pData, sample.cnsTime))
+						++m_nWritten;
+
+					WM_WRITER_STATISTICS stats = { 0 };
+					if (wmv.GetStatistics(&stats))
+						m_nBytes = stats.qwByteCount;
+					{
+						std::unique_lock<std::mutex> lock(m_mtx);
+						m_free.push_back(sample.pData);
+					}
+				}
+				wmv.StopRecord();
+			}
+		}
+		CoUninitialize();
+	}
+public:
+	CRecorder(LONG lFrameWidth, LONG lFrameHeight)
+	: m_lFrameWidth(lFrameWidth), m_lFrameHeight(lFrameHeight), m_cbFrame(TDIBWIDTHBYTES(lFrameWidth * 24) * lFrameHeight)
+	, m_bStop(false), m_nStart(0), m_cnsFirst(0), m_tickStart(0), m_nWritten(0), m_nDropped(0), m_nBytes(0)
+	{
+	}
+
+	~CRecorder()
+	{
+		StopRecord();
+		for (size_t i = 0; i < m_vecPool.size(); ++i)
+			free(m_vecPool[i]);
+	}
+
+	BOOL StartRecord(const wchar_t* strFilename, DWORD dwBitrate)
+	{
+		for (int i = 0; i < RECORD_RING_NUM; ++i)
+		{
+			BYTE* pData = (BYTE*)malloc(m_cbFrame);
+			if (NULL == pData)
+				return FALSE;
+			m_vecPool.push_back(pData);
+			m_free.push_back(pData);
+		}
+
+		m_thread = std::thread(&CRecorder::Run, this, std::wstring(strFilename), dwBitrate);
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_cv.wait(lock, [this] { return 0 != m_nStart; });
+		if (m_nStart < 0)
+		{
+			lock.unlock();
+			m_thread.join();
+			return FALSE;
+		}
+		m_tickStart = GetTickCount64();
+		return TRUE;
+	}
+
+	/* this is called in the UI thread and never waits for the encoder */
+	void WriteSample(const void* pData)
+	{
+		const QWORD cnsNow = GetTickCount64() * 1000 * 10;
+		BYTE* pBuffer = NULL;
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			if (!m_free.empty())
+			{
+				pBuffer = m_free.front();
+				m_free.pop_front();
+			}
+			else if (!m_queue.empty())
+			{
+				pBuffer = m_queue.front().pData;	/* bounded latency: the oldest sample goes */
+				m_queue.pop_front();
+				++m_nDropped;
+			}
+			else
+			{
+				++m_nDropped;	/* all the buffers are with the encoder */
+				return;
+			}
+		}
+		memcpy(pBuffer, pData, m_cbFrame);
+		if (0 == m_cnsFirst)
+			m_cnsFirst = cnsNow;
+		{
+			std::unique_lock<std::mutex> lock(m_mtx);
+			Sample sample = { pBuffer, cnsNow - m_cnsFirst };
+			m_queue.push_back(sample);
+		}
+		m_cv.notify_one();
+	}
+
+	/* encodes what is still queued, then closes the file */
+	void StopRecord()
+	{
+		if (m_thread.joinable())
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_bStop = true;
+			}
+			m_cv.notify_all();
+			m_thread.join();
+		}
+	}
+
+	/* achieved frame rate and bitrate since the start */
+	void GetStatistics(double* pFps, double* pKbps, unsigned* pDropped)
+	{
+		const double sec = (GetTickCount64() - m_tickStart) / 1000.0;
+		*pFps = (sec > 0) ? m_nWritten / sec : 0;
+		*pKbps = (sec > 0) ? m_nBytes * 8 / sec / 1000 : 0;
+		*pDropped = m_nDropped;
+	}
+};
+
 class CMainFrame : public CFrameWindowImpl<CMainFrame>, public CUpdateUI<CMainFrame>
 {
 	HToupcam		m_hcam;
@@ -1667,7 +1875,9 @@ class CMainFrame : public CFrameWindowImpl<CMainFrame>, public CUpdateUI<CMainFr
 
 	wchar_t			m_szFilePath[MAX_PATH];
 
-	CWmvRecord*		m_pWmvRecord;
+	CRecorder*		m_pRecorder;
+	CAsyncSaver		m_saver;
+	CWndMsgCoalesce	m_coalesce;	// the image messages do not queue up behind a busy UI
 	BYTE*			m_pData;
 	BITMAPINFOHEADER	m_header;
 
@@ -1680,6 +1890,7 @@ class CMainFrame : public CFrameWindowImpl<CMainFrame>, public CUpdateUI<CMainFr
 	unsigned short	m_nTriggerNumber;
 
 	unsigned		m_xRoiOffset, m_yRoiOffset, m_xRoiWidth, m_yRoiHeight;
+	unsigned		m_nAeRect, m_nAeLabel;	/* items of the overlay of m_view, 0: none */
 
 	BEGIN_MSG_MAP_EX(CMainFrame)
 		MSG_WM_CREATE(OnCreate)
@@ -1776,7 +1987,7 @@ class CMainFrame : public CFrameWindowImpl<CMainFrame>, public CUpdateUI<CMainFr
 	END_UPDATE_UI_MAP()
 public:
 	CMainFrame()
-	: m_hcam(NULL), m_bPaused(FALSE), m_nSnapType(0), m_nSnapSeq(0), m_nSnapFile(0), m_pWmvRecord(NULL), m_pData(NULL), m_view(this)
+	: m_hcam(NULL), m_bPaused(FALSE), m_nSnapType(0), m_nSnapSeq(0), m_nSnapFile(0), m_pRecorder(NULL), m_pData(NULL), m_view(this)
 	{
 		m_bTriggerMode = false;
 		m_nTriggerNumber = 1;
@@ -1791,6 +2002,7 @@ public:
 		m_header.biBitCount = 24;
 
 		m_xRoiOffset = m_yRoiOffset = m_xRoiWidth = m_yRoiHeight = 0;
+		m_nAeRect = m_nAeLabel = 0;
 	}
 
 	bool GetData(BITMAPINFOHEADER** pHeader, BYTE** pData)
@@ -2059,6 +2271,7 @@ private:
 					Toupcam_get_Roi(m_hcam, NULL, NULL, (unsigned*)&m_header.biWidth, (unsigned*)&m_header.biHeight);
 					m_header.biSizeImage = TDIBWIDTHBYTES(m_header.biWidth * m_header.biBitCount) * m_header.biHeight;
 					UpdateResolutionText();
+					UpdateOverlay();
 				}
 			}
 		}
@@ -2247,50 +2460,48 @@ private:
 			return;
 
 		unsigned eSize = 0;
-		if (SUCCEEDED(Toupcam_get_eSize(m_hcam, &eSize)))
-		{
-			if (eSize != nID - ID_PREVIEW_RESOLUTION0)
-			{
-				if (SUCCEEDED(Toupcam_Stop(m_hcam)))
-				{
-					OnStopRecord(0, 0, NULL);
+		const unsigned nRes = nID - ID_PREVIEW_RESOLUTION0;
+		if (FAILED(Toupcam_get_eSize(m_hcam, &eSize)) || (eSize == nRes))
+			return;
 
-					m_bPaused = FALSE;
-					m_nSnapType = 0;
-					m_nSnapSeq = 0;
-					UISetCheck(ID_ACTION_PAUSE, FALSE);
+		OnStopRecord(0, 0, NULL);
+		/* switch on the running stream first: m_pData holds the largest frame and OnEventImage takes the
+		   size of each frame, so nothing is reallocated and no frame is lost; stop and restart only if the camera refuses */
+		if (FAILED(Toupcam_put_eSize(m_hcam, nRes)))
+		{
+			if (FAILED(Toupcam_Stop(m_hcam)))
+				return;
 
-					Toupcam_put_eSize(m_hcam, nID - ID_PREVIEW_RESOLUTION0);
-					for (unsigned i = 0; i < m_dev.model->preview; ++i)
-						UISetCheck(ID_PREVIEW_RESOLUTION0 + i, (nID - ID_PREVIEW_RESOLUTION0 == i) ? 1 : 0);
-					UpdateSnapMenu();
-					if (SUCCEEDED(Toupcam_get_Size(m_hcam, (int*)&m_header.biWidth, (int*)&m_header.biHeight)))
-					{
-						UpdateResolutionText();
-						UpdateStatusText(3, L"");
-						UpdateStatusText(4, L"");
-						UpdateExposureTimeText();
+			m_bPaused = FALSE;
+			m_nSnapType = 0;
+			m_nSnapSeq = 0;
+			UISetCheck(ID_ACTION_PAUSE, FALSE);
 
-						m_header.biSizeImage = TDIBWIDTHBYTES(m_header.biWidth * m_header.biBitCount) * m_header.biHeight;
-						if (m_pData)
-						{
-							free(m_pData);
-							m_pData = NULL;
-						}
-						m_pData = (BYTE*)malloc(m_header.biSizeImage);
-						if (SUCCEEDED(Toupcam_StartPullModeWithWndMsg(m_hcam, m_hWnd, MSG_CAMEVENT)))
-						{
-							UIEnable(ID_ACTION_PAUSE, TRUE);
-							UIEnable(ID_ACTION_STARTRECORD, TRUE);
-							UIEnable(ID_TESTPATTERN0, TRUE);
-							UIEnable(ID_TESTPATTERN1, TRUE);
-							UIEnable(ID_TESTPATTERN2, TRUE);
-							UIEnable(ID_TESTPATTERN3, TRUE);
-						}
-					}
-				}
+			Toupcam_put_eSize(m_hcam, nRes);
+			if (SUCCEEDED(m_coalesce.Start(m_hcam, m_hWnd, MSG_CAMEVENT)))
+			{
+				UIEnable(ID_ACTION_PAUSE, TRUE);
+				UIEnable(ID_ACTION_STARTRECORD, TRUE);
+				UIEnable(ID_TESTPATTERN0, TRUE);
+				UIEnable(ID_TESTPATTERN1, TRUE);
+				UIEnable(ID_TESTPATTERN2, TRUE);
+				UIEnable(ID_TESTPATTERN3, TRUE);
 			}
 		}
+
+		for (unsigned i = 0; i < m_dev.model->preview; ++i)
+			UISetCheck(ID_PREVIEW_RESOLUTION0 + i, (nRes == i) ? 1 : 0);
+		UpdateSnapMenu();
+		if (SUCCEEDED(Toupcam_get_Size(m_hcam, (int*)&m_header.biWidth, (int*)&m_header.biHeight)))
+		{
+			UpdateResolutionText();
+			UpdateOverlay();
+			UpdateStatusText(3, L"");
+			UpdateStatusText(4, L"");
+			UpdateExposureTimeText();
+
+			m_header.biSizeImage = TDIBWIDTHBYTES(m_header.biWidth * m_header.biBitCount) * m_header.biHeight;
+		}
 	}
 
 	void OnSnapResolution(UINT /*uNotifyCode*/, int nID, HWND /*wndCtl*/)
@@ -2369,14 +2580,16 @@ private:
 			if ((m_header.biWidth > 0) && (m_header.biHeight > 0))
 			{
 				m_header.biSizeImage = TDIBWIDTHBYTES(m_header.biWidth * m_header.biBitCount) * m_header.biHeight;
-				m_pData = (BYTE*)malloc(m_header.biSizeImage);
+				/* once, for the largest resolution (index 0) in either orientation, so that resolution, ROI and rotate can change while running */
+				const unsigned w = m_dev.model->res[0].width, h = m_dev.model->res[0].height;
+				m_pData = (BYTE*)malloc(max(TDIBWIDTHBYTES(w * m_header.biBitCount) * h, TDIBWIDTHBYTES(h * m_header.biBitCount) * w));
 				unsigned eSize = 0;
 				if (SUCCEEDED(Toupcam_get_eSize(m_hcam, &eSize)))
 				{
 					for (unsigned i = 0; i < m_dev.model->preview; ++i)
 						UISetCheck(ID_PREVIEW_RESOLUTION0 + i, (eSize == i) ? 1 : 0);
 				}
-				if (SUCCEEDED(Toupcam_StartPullModeWithWndMsg(m_hcam, m_hWnd, MSG_CAMEVENT)))
+				if (SUCCEEDED(m_coalesce.Start(m_hcam, m_hWnd, MSG_CAMEVENT)))
 				{
 					UIEnable(ID_ACTION_PAUSE, TRUE);
 					UIEnable(ID_ACTION_STARTRECORD, TRUE);
@@ -2397,16 +2610,16 @@ private:
 			StopRecord();
 
 			DWORD dwBitrate = 4 * 1024 * 1024; /* bitrate, you can change this setting */
-			CWmvRecord* pWmvRecord = new CWmvRecord(m_header.biWidth, m_header.biHeight);
-			if (pWmvRecord->StartRecord(dlg.m_szFileName, dwBitrate))
+			CRecorder* pRecorder = new CRecorder(m_header.biWidth, m_header.biHeight);
+			if (pRecorder->StartRecord(dlg.m_szFileName, dwBitrate))
 			{
-				m_pWmvRecord = pWmvRecord;
+				m_pRecorder = pRecorder;
 				UIEnable(ID_ACTION_STARTRECORD, FALSE);
 				UIEnable(ID_ACTION_STOPRECORD, TRUE);
 			}
 			else
 			{
-				delete pWmvRecord;
+				delete pRecorder;
 			}
 		}
 	}
@@ -2419,20 +2632,42 @@ private:
 		UIEnable(ID_ACTION_STOPRECORD, FALSE);
 	}
 
+	/* one message for all the frames which arrived while it was queued */
 	void OnEventImage()
 	{
+		unsigned n = m_coalesce.Take();
 		ToupcamFrameInfoV4 info = { 0 };
-		HRESULT hr = Toupcam_PullImageV4(m_hcam, m_pData, 0, m_header.biBitCount, 0, &info);
-		if (FAILED(hr))
-			return;
+		if (m_pRecorder)
+		{
+			/* the recorder writes every frame, those which arrive meanwhile have their own message */
+			while (n-- && m_pRecorder && SUCCEEDED(Toupcam_PullImageV4(m_hcam, m_pData, 0, m_header.biBitCount, 0, &info)))
+				OnFrame(info);
+		}
+		else if (SUCCEEDED(m_coalesce.PullLatest(m_pData, m_header.biBitCount, 0, &info)))
+		{
+			/* the preview only shows the newest one */
+			OnFrame(info);
+		}
+	}
+
+	void OnFrame(const ToupcamFrameInfoV4& info)
+	{
 		if ((info.v3.width != m_header.biWidth) || (info.v3.height != m_header.biHeight))
-			return;
+		{
+			/* the geometry changed on the running stream, the frame is already in m_pData: take its size, the recorder has the old one */
+			OnStopRecord(0, 0, NULL);
+			m_header.biWidth = info.v3.width;
+			m_header.biHeight = info.v3.height;
+			m_header.biSizeImage = TDIBWIDTHBYTES(m_header.biWidth * m_header.biBitCount) * m_header.biHeight;
+			UpdateResolutionText();
+			UpdateOverlay();
+		}
 
-		m_view.Invalidate();
+		m_view.NewFrame();
 
 		UpdateFrameInfoText(info);
-		if (m_pWmvRecord)
-			m_pWmvRecord->WriteSample(m_pData);
+		if (m_pRecorder)
+			m_pRecorder->WriteSample(m_pData);
 	}
 
 	void OnEventSnap()
@@ -2458,14 +2693,18 @@ private:
 					{
 						wchar_t strPath[MAX_PATH];
 						swprintf(strPath, L"%04u.jpg", m_nSnapFile++);
-						SaveImageByWIC(strPath, pSnapData, &header);
+						m_saver.Save(strPath, pSnapData, &header);	/* the saver owns and frees pSnapData */
+						pSnapData = NULL;
 					}
 					else
 					{
 						if (PathMatchSpec(m_szFilePath, L"*.bmp"))
 							SaveImageBmp(m_szFilePath, pSnapData, &header);
 						else
-							SaveImageByWIC(m_szFilePath, pSnapData, &header);
+						{
+							m_saver.Save(m_szFilePath, pSnapData, &header);
+							pSnapData = NULL;
+						}
 					}
 				}
 
@@ -2542,6 +2781,7 @@ private:
 				m_pData = NULL;
 			}
 		}
+		UpdateOverlay();
 		OnDeviceChanged();
 	}
 
@@ -2595,6 +2835,7 @@ private:
 			UpdateSnapMenu();
 
 			UpdateResolutionText();
+			UpdateOverlay();
 			UpdateExposureTimeText();
 
 			int nTemp = TOUPCAM_TEMP_DEF, nTint = TOUPCAM_TINT_DEF;
@@ -2703,6 +2944,36 @@ private:
 		}
 	}
 
+	/* the auto exposure rectangle and the scale bar, composited by the view: never in the frames saved or recorded */
+	void UpdateOverlay()
+	{
+		CD3DOverlay& overlay = m_view.GetOverlay();
+		RECT rc = { 0 };
+		if (m_hcam && SUCCEEDED(Toupcam_get_AEAuxRect(m_hcam, &rc)))
+		{
+			OverlayItem item = { OVERLAY_RECT, OVERLAY_FRAME, (float)rc.left, (float)rc.top, (float)rc.right, (float)rc.bottom, RGB(0xff, 0, 0), 1.0f, 2.0f, 0.0f };
+			if (!overlay.Set(m_nAeRect, item))
+				m_nAeRect = overlay.Add(item);
+			item.type = OVERLAY_TEXT;
+			item.fontSize = 14.0f;
+			item.text = L"AE";
+			if (!overlay.Set(m_nAeLabel, item))
+				m_nAeLabel = overlay.Add(item);
+		}
+		else
+		{
+			overlay.Remove(m_nAeRect);
+			overlay.Remove(m_nAeLabel);
+			m_nAeRect = m_nAeLabel = 0;
+		}
+		unsigned eSize = 0;
+		float x = 0.0f, y = 0.0f;
+		if (m_hcam && SUCCEEDED(Toupcam_get_eSize(m_hcam, &eSize)) && SUCCEEDED(Toupcam_get_PixelSize(m_hcam, eSize, &x, &y)))
+			overlay.SetScaleBar(x);	/* on the sensor */
+		else
+			overlay.SetScaleBar(0.0);
+	}
+
 	void UpdateStatusText(int nPane, const wchar_t* str)
 	{
 		CStatusBarCtrl statusbar(m_hWndStatusBar);
@@ -2719,6 +2990,27 @@ private:
 				swprintf(str, L"total: %u, fps: %.1f", nTotalFrame, nFrame * 1000.0 / nTime);
 			else
 				swprintf(str, L"total: %u", nTotalFrame);
+			if (m_pRecorder)
+			{
+				double fps = 0, kbps = 0;
+				unsigned nDropped = 0;
+				m_pRecorder->GetStatistics(&fps, &kbps, &nDropped);
+				const size_t len = wcslen(str);
+				swprintf(str + len, _countof(str) - len, L", rec: %.1f fps, %.0f kbps, dropped %u", fps, kbps, nDropped);
+			}
+			if (m_coalesce.Coalesced() || m_coalesce.Discarded())
+			{
+				const size_t len = wcslen(str);
+				swprintf(str + len, _countof(str) - len, L", coalesced %u, stale %u", m_coalesce.Coalesced(), m_coalesce.Discarded());
+			}
+			{
+				const size_t len = wcslen(str);
+				const int nUpload = m_view.GetUploadCount();
+				if (nUpload >= 0)
+					swprintf(str + len, _countof(str) - len, L", zoom %.0f%%, tiles %u", m_view.GetZoom() * 100.0, nUpload);
+				else
+					swprintf(str + len, _countof(str) - len, L", zoom %.0f%%", m_view.GetZoom() * 100.0);
+			}
 			UpdateStatusText(3, str);
 		}
 	}
@@ -2745,12 +3037,12 @@ private:
 	/* this is called in the UI thread */
 	void StopRecord()
 	{
-		if (m_pWmvRecord)
+		if (m_pRecorder)
 		{
-			m_pWmvRecord->StopRecord();
+			m_pRecorder->StopRecord();
 
-			delete m_pWmvRecord;
-			m_pWmvRecord = NULL;
+			delete m_pRecorder;
+			m_pRecorder = NULL;
 		}
 	}
 };
@@ -2759,26 +3051,26 @@ LRESULT CMainView::OnWmPaint(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHan
 {
 	CPaintDC dc(m_hWnd);
 
-	RECT rc;
-	GetClientRect(&rc);
 	BITMAPINFOHEADER* pHeader = NULL;
 	BYTE* pData = NULL;
-	if (m_pMainFrame->GetData(&pHeader, &pData))
+	if (!m_pMainFrame->GetData(&pHeader, &pData))
+		pHeader = NULL;
+	if (m_tile.Paint(pHeader, pData, RGB(0xff, 0xff, 0xff)))
+		return 0;
+
+	RECT rc;
+	GetClientRect(&rc);
+	RECT rcFrame, rcWindow;
+	if (pHeader && m_tile.GetMapping(pHeader->biWidth, abs(pHeader->biHeight), rcFrame, rcWindow))
 	{
-		if ((m_nOldWidth != pHeader->biWidth) || (m_nOldHeight != pHeader->biHeight))
-		{
-			m_nOldWidth = pHeader->biWidth;
-			m_nOldHeight = pHeader->biHeight;
-			dc.FillRect(&rc, (HBRUSH)WHITE_BRUSH);
-		}
+		/* the visible part only, the rows from the bottom of the DIB */
 		const int m = dc.SetStretchBltMode(COLORONCOLOR);
-		StretchDIBits(dc, rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top, 0, 0, pHeader->biWidth, pHeader->biHeight, pData, (BITMAPINFO*)pHeader, DIB_RGB_COLORS, SRCCOPY);
+		StretchDIBits(dc, rcWindow.left, rcWindow.top, rcWindow.right - rcWindow.left, rcWindow.bottom - rcWindow.top,
+			rcFrame.left, pHeader->biHeight - rcFrame.bottom, rcFrame.right - rcFrame.left, rcFrame.bottom - rcFrame.top, pData, (BITMAPINFO*)pHeader, DIB_RGB_COLORS, SRCCOPY);
 		dc.SetStretchBltMode(m);
+		dc.ExcludeClipRect(&rcWindow);
 	}
-	else
-	{
-		dc.FillRect(&rc, (HBRUSH)WHITE_BRUSH);
-	}
+	dc.FillRect(&rc, (HBRUSH)WHITE_BRUSH);
 
 	return 0;
 }
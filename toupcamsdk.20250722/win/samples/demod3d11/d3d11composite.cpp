@@ -0,0 +1,487 @@
+#include "stdafx.h"
+#include "d3d11composite.h"
+#include "../spantrace.h"
+
+static unsigned get_precise_tick()
+{
+	return (unsigned)(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+CD3D11Composite::CD3D11Composite(HWND hwndTarget)
+: m_hwnd(hwndTarget), m_windowWidth(INT_MIN), m_windowHeight(INT_MIN), m_totalFrame(0), m_nFrame(0), m_nTick(get_precise_tick())
+, m_resize(0), m_loop(true), m_evtFresh(nullptr), m_waitable(nullptr)
+{
+}
+
+CD3D11Composite::~CD3D11Composite()
+{
+	m_loop = false;
+	for (auto& t : m_tile)
+	{
+		if (t->thrd)
+		{
+			SetEvent(t->evt);
+			t->thrd->join();
+		}
+	}
+	if (m_thrd)
+	{
+		SetEvent(m_evtFresh);
+		m_thrd->join();
+	}
+	for (auto& t : m_tile)
+	{
+		if (t->evt)
+			CloseHandle(t->evt);
+	}
+	if (m_evtFresh)
+		CloseHandle(m_evtFresh);
+	if (m_waitable)
+		CloseHandle(m_waitable);
+}
+
+int CD3D11Composite::Add(HToupcam hcam)
+{
+	if (m_device)
+		return -1;
+	std::unique_ptr<Tile> t(new Tile);
+	t->hcam = hcam;
+	t->index = (unsigned)m_tile.size();
+	t->bMono = (Toupcam_get_MonoMode(hcam) == S_OK);
+	unsigned fourcc = 0;
+	t->bitdepth = 8;
+	Toupcam_get_RawFormat(hcam, &fourcc, &t->bitdepth);
+	t->width = t->height = 0;
+	if (FAILED(Toupcam_get_Size(hcam, &t->width, &t->height)))
+		return -1;
+	t->evt = nullptr;
+	t->back = 0;
+	t->front = 1;
+	t->middle = 2;
+	t->bFrame = false;
+	memset(t->seq, 0, sizeof(t->seq));
+	t->nFrame = t->totalFrame = 0;
+	memset(&t->vp, 0, sizeof(t->vp));
+	m_tile.push_back(std::move(t));
+	return (int)m_tile.size() - 1;
+}
+
+bool CD3D11Composite::GetFrameRate(unsigned& nFrame, unsigned& nTime, unsigned& nTotal)
+{
+	unsigned tick = get_precise_tick();
+	unsigned diff = tick - m_nTick;
+	if (diff > 500)
+	{
+		nTime = diff;
+		nFrame = m_nFrame;
+		nTotal = m_totalFrame;
+		m_nTick = tick;
+		m_nFrame = 0;
+		return true;
+	}
+	return false;
+}
+
+bool CD3D11Composite::GetFrameRate(int index, unsigned& nFrame, unsigned& nTotal)
+{
+	if ((index < 0) || (index >= (int)m_tile.size()))
+		return false;
+	std::lock_guard<std::mutex> lock(m_mtx);
+	nFrame = m_tile[index]->nFrame;
+	nTotal = m_tile[index]->totalFrame;
+	m_tile[index]->nFrame = 0;
+	return true;
+}
+
+bool CD3D11Composite::Init()
+{
+	if (m_tile.empty())
+		return false;
+	bool bDeep = false;
+	for (auto& t : m_tile)
+		bDeep = bDeep || (t->bitdepth > 8);
+
+	UINT creationFlags = 0;
+#ifdef _DEBUG
+	creationFlags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+	DXGI_SWAP_CHAIN_DESC scd = {};
+	scd.BufferCount = BUFFERCOUNT;
+	scd.BufferDesc.Format = bDeep ? DXGI_FORMAT_R10G10B10A2_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+	scd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+	scd.OutputWindow = m_hwnd;
+	scd.SampleDesc.Count = 1;
+	scd.Windowed = TRUE;
+	scd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+	scd.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+	D3D_FEATURE_LEVEL featureLevel;
+	HRESULT hr = D3D11CreateDeviceAndSwapChain(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, creationFlags, NULL, 0, D3D11_SDK_VERSION, &scd, &m_swapChain, &m_device, &featureLevel, &m_context);
+	if (FAILED(hr))
+	{
+		scd.Flags = 0; /* before Windows 8.1 */
+		hr = D3D11CreateDeviceAndSwapChain(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, creationFlags, NULL, 0, D3D11_SDK_VERSION, &scd, &m_swapChain, &m_device, &featureLevel, &m_context);
+		if (FAILED(hr))
+			return false;
+	}
+
+	{
+		CComQIPtr<IDXGISwapChain2> spIDXGISwapChain2(m_swapChain);
+		if (spIDXGISwapChain2 && scd.Flags)
+		{
+			spIDXGISwapChain2->SetMaximumFrameLatency(1);
+			m_waitable = spIDXGISwapChain2->GetFrameLatencyWaitableObject();
+		}
+		else
+		{
+			CComQIPtr<IDXGIDevice1> spIDXGIDevice1(m_device);
+			if (spIDXGIDevice1)
+				spIDXGIDevice1->SetMaximumFrameLatency(1);
+		}
+	}
+
+	for (auto& t : m_tile)
+	{
+		hr = CreateTile(*t);
+		if (FAILED(hr))
+			return false;
+	}
+	hr = CreateShaders();
+	if (FAILED(hr))
+		return false;
+	D3D11_SAMPLER_DESC sampDesc = {};
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	sampDesc.AddressU = sampDesc.AddressV = sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	hr = m_device->CreateSamplerState(&sampDesc, &m_sampler);
+	if (FAILED(hr))
+		return false;
+
+	RECT rc;
+	GetClientRect(m_hwnd, &rc);
+	Resize(rc.right - rc.left, rc.bottom - rc.top);
+
+	m_context->PSSetSamplers(0, 1, &m_sampler.p);
+	m_context->IASetInputLayout(m_inputLayout);
+	m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	UINT stride = sizeof(float) * 6, offset = 0;
+	m_context->IASetVertexBuffers(0, 1, &m_vertexBuffer.p, &stride, &offset);
+	m_context->VSSetShader(m_vs, NULL, 0);
+	m_context->PSSetShader(m_ps, NULL, 0);
+
+	m_evtFresh = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_thrd = std::make_shared<std::thread>([this]()
+		{
+			Loop();
+		});
+	for (auto& t : m_tile)
+	{
+		Tile* p = t.get();
+		p->evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+		p->thrd = std::make_shared<std::thread>([this, p]()
+			{
+				PullLoop(*p);
+			});
+	}
+	return true;
+}
+
+HRESULT CD3D11Composite::CreateTile(Tile& tile)
+{
+	D3D11_TEXTURE2D_DESC texDesc = {};
+	texDesc.Width = tile.width;
+	texDesc.Height = tile.height;
+	texDesc.MipLevels = texDesc.ArraySize = texDesc.SampleDesc.Count = 1;
+	if (tile.bMono)
+		texDesc.Format = (tile.bitdepth > 8) ? DXGI_FORMAT_R16_UNORM : DXGI_FORMAT_R8_UNORM;
+	else
+		texDesc.Format = (tile.bitdepth > 8) ? DXGI_FORMAT_R16G16B16A16_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+	texDesc.Usage = D3D11_USAGE_DYNAMIC;
+	texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = texDesc.Format;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	for (int i = 0; i < UPLOADCOUNT; ++i)
+	{
+		HRESULT hr = m_device->CreateTexture2D(&texDesc, NULL, &tile.texture[i]);
+		if (FAILED(hr))
+			return hr;
+		hr = m_device->CreateShaderResourceView(tile.texture[i], &srvDesc, &tile.srv[i]);
+		if (FAILED(hr))
+			return hr;
+	}
+
+	/* the scale of the bit depth and the mono flag of the camera, constant: one buffer per camera */
+	const float param[4] = {
+		((tile.bitdepth <= 8) || (tile.bitdepth >= 16)) ? 1.0f : (float)(65535.0 / ((1 << tile.bitdepth) - 1)),
+		tile.bMono ? 1.0f : 0.0f, 0.0f, 0.0f
+	};
+	D3D11_BUFFER_DESC bd = {};
+	bd.Usage = D3D11_USAGE_IMMUTABLE;
+	bd.ByteWidth = sizeof(param);
+	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	D3D11_SUBRESOURCE_DATA initData = { param };
+	return m_device->CreateBuffer(&bd, &initData, &tile.param);
+}
+
+HRESULT CD3D11Composite::CreateShaders()
+{
+	const char* vsCode = R"(
+			struct VS_IN {
+				float4 pos : POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			struct VS_OUT {
+				float4 pos : SV_POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			VS_OUT VS(VS_IN input) {
+				VS_OUT output;
+				output.pos = input.pos;
+				output.uv = input.uv;
+				return output;
+			})";
+	CComPtr<ID3DBlob> vsBlob;
+	HRESULT hr = D3DCompile(vsCode, strlen(vsCode), NULL, NULL, NULL, "VS", "vs_5_0", 0, 0, &vsBlob, NULL);
+	if (FAILED(hr))
+		return hr;
+	hr = m_device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), NULL, &m_vs);
+	if (FAILED(hr))
+		return hr;
+
+	/* one shader for all the cameras, the differences are in the constant buffer of each */
+	const char* psCode = R"(
+			Texture2D tex : register(t0);
+			SamplerState sam : register(s0);
+			cbuffer Param : register(b0) {
+				float4 param;	/* scale, mono */
+			};
+			struct PS_IN {
+				float4 pos : SV_POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			float4 PS(PS_IN input) : SV_Target {
+				float4 color = tex.Sample(sam, input.uv);
+				if (param.y > 0.5)
+					color = float4(color.r, color.r, color.r, 1.0);
+				return float4(color.rgb * param.x, 1.0);
+			})";
+	CComPtr<ID3DBlob> psBlob;
+	hr = D3DCompile(psCode, strlen(psCode), NULL, NULL, NULL, "PS", "ps_5_0", 0, 0, &psBlob, NULL);
+	if (FAILED(hr))
+		return hr;
+	hr = m_device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), NULL, &m_ps);
+	if (FAILED(hr))
+		return hr;
+
+	D3D11_INPUT_ELEMENT_DESC layout[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,       0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+	};
+	hr = m_device->CreateInputLayout(layout, 2, vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), &m_inputLayout);
+	if (FAILED(hr))
+		return hr;
+
+	const struct Vertex {
+		float x, y, z, w;
+		float u, v;
+	} vertices[] = {
+		{ -1.0f,  1.0f, 0.0f, 1.0f, 0.0f, 0.0f },
+		{  1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 0.0f },
+		{ -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 1.0f },
+		{  1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 1.0f }
+	};
+	D3D11_BUFFER_DESC bd = {};
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = sizeof(vertices);
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	D3D11_SUBRESOURCE_DATA initData = { vertices };
+	return m_device->CreateBuffer(&bd, &initData, &m_vertexBuffer);
+}
+
+void CD3D11Composite::Resize()
+{
+	RECT rc;
+	GetClientRect(m_hwnd, &rc);
+	if ((m_windowWidth != rc.right - rc.left) || (m_windowHeight != rc.bottom - rc.top))
+	{
+		int cx = rc.right - rc.left, cy = rc.bottom - rc.top;
+		TOUPCAM_LOG_VERBOSE("%s: %d %d", __func__, cx, cy);
+		m_resize.store(0x80000000 | (cx << 16) | cy);
+		SetEvent(m_evtFresh);
+	}
+}
+
+HRESULT CD3D11Composite::Resize(int windowWidth, int windowHeight)
+{
+	TOUPCAM_LOG_VERBOSE("%s: %d %d", __func__, windowWidth, windowHeight);
+	m_windowWidth = windowWidth;
+	m_windowHeight = windowHeight;
+	m_context->OMSetRenderTargets(0, NULL, NULL);
+
+	DXGI_SWAP_CHAIN_DESC scd = {};
+	HRESULT hr = m_swapChain->GetDesc(&scd);
+	if (FAILED(hr))
+		return hr;
+	hr = m_swapChain->ResizeBuffers(scd.BufferCount, m_windowWidth, m_windowHeight, scd.BufferDesc.Format, scd.Flags);
+	if (FAILED(hr))
+		return hr;
+
+	/* the grid, each camera centered in its cell */
+	const int n = (int)m_tile.size();
+	int cols = 1;
+	while (cols * cols < n)
+		++cols;
+	const int rows = (n + cols - 1) / cols;
+	const float cellW = m_windowWidth / (float)cols, cellH = m_windowHeight / (float)rows;
+	for (int i = 0; i < n; ++i)
+	{
+		Tile& t = *m_tile[i];
+		const float scale = __min(cellW / t.width, cellH / t.height);
+		const float vpW = (float)(int)(t.width * scale), vpH = (float)(int)(t.height * scale);
+		t.vp.TopLeftX = (float)(int)((i % cols) * cellW + (cellW - vpW) / 2);
+		t.vp.TopLeftY = (float)(int)((i / cols) * cellH + (cellH - vpH) / 2);
+		t.vp.Width = vpW;
+		t.vp.Height = vpH;
+		t.vp.MinDepth = 0.0f;
+		t.vp.MaxDepth = 1.0f;
+	}
+	return S_OK;
+}
+
+bool CD3D11Composite::SetupRtv()
+{
+	CComPtr<ID3D11Texture2D> backBuffer;
+	if (SUCCEEDED(m_swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&backBuffer)))
+	{
+		CComPtr<ID3D11RenderTargetView> rtv;
+		if (SUCCEEDED(m_device->CreateRenderTargetView(backBuffer, nullptr, &rtv)))
+		{
+			m_context->OMSetRenderTargets(1, &rtv.p, nullptr);
+			const float bgColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+			m_context->ClearRenderTargetView(rtv, bgColor);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CD3D11Composite::Render(int index)
+{
+	if ((index >= 0) && (index < (int)m_tile.size()) && m_tile[index]->evt)
+		SetEvent(m_tile[index]->evt);
+}
+
+void CD3D11Composite::PullLoop(Tile& tile)
+{
+	char name[32];
+	sprintf(name, "pull %u", tile.index);
+	CSpanTrace::Get().SetThreadName(name);
+	while (m_loop)
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		HRESULT hr;
+		{
+			CSpan span("map");
+			std::lock_guard<std::mutex> lock(m_mtx);
+			hr = m_context->Map(tile.texture[tile.back], 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		}
+		if (SUCCEEDED(hr))
+		{
+			ToupcamFrameInfoV4 info = { 0 };
+			{
+				CSpan span("pull");
+				hr = Toupcam_PullImageV4(tile.hcam, mapped.pData, 0, tile.bMono ? ((tile.bitdepth > 8) ? 16 : 8) : ((tile.bitdepth > 8) ? 64 : 32), mapped.RowPitch, &info);
+				span.SetFrame(info.v3.seq);
+			}
+			tile.seq[tile.back] = info.v3.seq;
+			CSpan span("unmap", info.v3.seq);
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_context->Unmap(tile.texture[tile.back], 0);
+			if (SUCCEEDED(hr))
+			{
+				++tile.nFrame;
+				++tile.totalFrame;
+			}
+		}
+		if (FAILED(hr))
+		{
+			CSpan span("wait");
+			WaitForSingleObject(tile.evt, INFINITE);
+			continue;
+		}
+
+		/* publish: an unpresented frame in the middle is overwritten, the camera does not wait for the display */
+		tile.back = tile.middle.exchange(tile.back | FRESH) & ~FRESH;
+		SetEvent(m_evtFresh);
+	}
+}
+
+void CD3D11Composite::Loop()
+{
+	CSpanTrace::Get().SetThreadName("render");
+	bool bWait = true;
+	while (m_loop)
+	{
+		if (bWait && m_waitable)
+		{
+			CSpan span("vsync");
+			WaitForSingleObjectEx(m_waitable, 1000, TRUE);
+		}
+		bWait = false;
+		bool bResized = false;
+		{
+			unsigned val = m_resize.load();
+			if (val & 0x80000000)
+			{
+				m_resize.store(0);
+				std::lock_guard<std::mutex> lock(m_mtx);
+				Resize((val >> 16) & 0x7fff, val & 0x7fff);
+				bResized = true;
+			}
+		}
+
+		/* the latest frame of every camera which has a new one; nothing new, nothing to present */
+		bool bFresh = false;
+		for (auto& t : m_tile)
+		{
+			if (t->middle.load() & FRESH)
+			{
+				t->front = t->middle.exchange(t->front) & ~FRESH;
+				t->bFrame = true;
+				bFresh = true;
+			}
+		}
+		if (!(bFresh || bResized))
+		{
+			CSpan span("wait");
+			WaitForSingleObject(m_evtFresh, INFINITE);
+			continue;
+		}
+
+		CSpan span("render");
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (SetupRtv())
+		{
+			for (auto& t : m_tile)
+			{
+				if (!t->bFrame)
+					continue;
+				m_context->RSSetViewports(1, &t->vp);
+				m_context->PSSetConstantBuffers(0, 1, &t->param.p);
+				m_context->PSSetShaderResources(0, 1, &t->srv[t->front].p);
+				m_context->Draw(4, 0);
+			}
+			CSpan spanPresent("present");
+			const HRESULT hr = m_swapChain->Present(1, 0);
+			if (SUCCEEDED(hr))
+			{
+				++m_totalFrame;
+				++m_nFrame;
+			}
+			bWait = true;
+			TOUPCAM_LOG_VERBOSE("%s: Present, 0x%08x", __func__, hr);
+		}
+	}
+}
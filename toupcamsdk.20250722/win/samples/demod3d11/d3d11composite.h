@@ -0,0 +1,84 @@
+#ifndef __D3D11Composite_h__
+#define __D3D11Composite_h__
+
+#include <atlbase.h>
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <dxgi1_3.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include "toupcam.h"
+
+/*
+	N cameras in one window: one device, one swap chain, one present per vsync, whatever the number of cameras;
+	CD3D11Render once per camera costs a device, a swap chain and a present loop each
+	every camera has UPLOADCOUNT textures and a thread of its own which pulls into the back one and publishes it, as
+	PullLoop of CD3D11Render, so a slow camera never holds the others; Loop waits on the frame latency waitable object,
+	takes the latest published texture of each camera and draws them all, each in its cell of a grid (columns:
+	ceil(sqrt(N))), keeping the aspect ratio; a camera without a new frame is drawn again from its last one
+	Add every camera before Init, then Toupcam_StartPullModeWithCallback (or WndMsg) for each, Render(i) on its
+	TOUPCAM_EVENT_IMAGE; RGB32 / RGB64 or mono 8 / 16 bits, as CD3D11Render, no demosaic of RAW
+*/
+class CD3D11Composite
+{
+	enum { BUFFERCOUNT = 2, UPLOADCOUNT = 3, FRESH = 4 };
+	struct Tile {
+		HToupcam hcam;
+		unsigned index;
+		bool bMono;
+		unsigned bitdepth;
+		int width, height;
+		HANDLE evt;
+		std::shared_ptr<std::thread> thrd;
+		unsigned back, front;			/* back for its PullLoop only, front for Loop only */
+		std::atomic<unsigned> middle;	/* | FRESH when published and not presented yet */
+		bool bFrame;					/* front holds a frame */
+		unsigned seq[UPLOADCOUNT];
+		unsigned nFrame, totalFrame;	/* pulled */
+		CComPtr<ID3D11Texture2D> texture[UPLOADCOUNT];
+		CComPtr<ID3D11ShaderResourceView> srv[UPLOADCOUNT];
+		CComPtr<ID3D11Buffer> param;	/* scale, mono */
+		D3D11_VIEWPORT vp;
+	};
+public:
+	CD3D11Composite(HWND hwndTarget);
+	~CD3D11Composite();
+	int Add(HToupcam hcam);				/* the index of the camera, -1: failed or after Init */
+	bool Init();
+	void Render(int index);
+	void Resize();
+	bool GetFrameRate(unsigned& nFrame, unsigned& nTime, unsigned& nTotal);
+	bool GetFrameRate(int index, unsigned& nFrame, unsigned& nTotal);	/* pulled, since the last call */
+
+private:
+	const HWND m_hwnd;
+	int m_windowWidth, m_windowHeight;
+	unsigned m_totalFrame, m_nFrame, m_nTick;
+	std::atomic<unsigned> m_resize;
+	volatile bool m_loop;
+	HANDLE m_evtFresh, m_waitable;
+	std::shared_ptr<std::thread> m_thrd;
+	std::vector<std::unique_ptr<Tile>> m_tile;
+	std::mutex m_mtx;					/* the immediate context is not thread safe */
+
+	CComPtr<ID3D11Device> m_device;
+	CComPtr<ID3D11DeviceContext> m_context;
+	CComPtr<IDXGISwapChain> m_swapChain;
+	CComPtr<ID3D11SamplerState> m_sampler;
+	CComPtr<ID3D11VertexShader> m_vs;
+	CComPtr<ID3D11PixelShader> m_ps;
+	CComPtr<ID3D11InputLayout> m_inputLayout;
+	CComPtr<ID3D11Buffer> m_vertexBuffer;
+
+	HRESULT CreateShaders();
+	HRESULT CreateTile(Tile& tile);
+	HRESULT Resize(int windowWidth, int windowHeight);
+	bool SetupRtv();
+	void Loop();
+	void PullLoop(Tile& tile);
+};
+
+#endif
@@ -1,29 +1,50 @@
 #include "stdafx.h"
 #include "d3d11render.h"
+#include "../spantrace.h"
 
 static unsigned get_precise_tick()
 {
 	return (unsigned)(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
 }
 
-CD3D11Render::CD3D11Render(HToupcam hcam, HWND hwndTarget, int imageWidth, int imageHeight)
+CD3D11Render::CD3D11Render(HToupcam hcam, HWND hwndTarget, int imageWidth, int imageHeight, bool bRaw)
 : m_hcam(hcam), m_bMono(Toupcam_get_MonoMode(m_hcam) == S_OK), m_hwnd(hwndTarget), m_imageWidth(imageWidth), m_imageHeight(imageHeight)
-, m_windowWidth(INT_MIN), m_windowHeight(INT_MIN), m_loop(true), m_evt(nullptr), m_resize(0)
-, m_totalFrame(0), m_nFrame(0), m_nTick(get_precise_tick())
+, m_windowWidth(INT_MIN), m_windowHeight(INT_MIN), m_loop(true), m_evt(nullptr), m_evtFresh(nullptr), m_waitable(nullptr), m_resize(0)
+, m_totalFrame(0), m_nFrame(0), m_nTick(get_precise_tick()), m_back(0), m_front(1), m_middle(2)
+, m_fourcc(0), m_bColorDirty(true), m_bAwb(false)
 {
-	Toupcam_get_RawFormat(m_hcam, NULL, &m_bitdepth);
+	Toupcam_get_RawFormat(m_hcam, &m_fourcc, &m_bitdepth);
+	m_bRaw = bRaw && (!m_bMono);
+	memset(&m_color, 0, sizeof(m_color));
+	for (int i = 0; i < 3; ++i)
+	{
+		m_color.gain[i] = 1.0f;
+		m_color.matrix[i][i] = 1.0f;
+	}
+	m_color.gamma[0] = 1.0f / 2.2f;
+	memset(m_seq, 0, sizeof(m_seq));
+	memset(m_map, 0, sizeof(m_map));
 }
 
 CD3D11Render::~CD3D11Render()
 {
-	if (m_thrd)
+	m_loop = false;
+	if (m_thrdPull)
 	{
-		m_loop = false;
 		SetEvent(m_evt);
+		m_thrdPull->join();
+	}
+	if (m_thrd)
+	{
+		SetEvent(m_evtFresh);
 		m_thrd->join();
 	}
 	if (m_evt)
 		CloseHandle(m_evt);
+	if (m_evtFresh)
+		CloseHandle(m_evtFresh);
+	if (m_waitable)
+		CloseHandle(m_waitable);
 }
 
 bool CD3D11Render::GetFrameRate(unsigned& nFrame, unsigned& nTime, unsigned& nTotal)
@@ -42,9 +63,27 @@ bool CD3D11Render::GetFrameRate(unsigned& nFrame, unsigned& nTime, unsigned& nTo
 	return false;
 }
 
+void CD3D11Render::SetColor(const float gain[3], const float matrix[9], float gamma)
+{
+	std::lock_guard<std::mutex> lock(m_mtx);
+	for (int i = 0; i < 3; ++i)
+	{
+		m_color.gain[i] = gain[i];
+		for (int j = 0; j < 3; ++j)
+			m_color.matrix[i][j] = matrix[i * 3 + j];
+	}
+	m_color.gamma[0] = 1.0f / gamma;
+	m_bColorDirty = true;
+}
+
+void CD3D11Render::AwbOnce()
+{
+	m_bAwb = true;
+}
+
 bool CD3D11Render::Init()
 {
-	UINT creationFlags = 0;
+	UINT creationFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT; /* Direct2D of m_overlay */
 #ifdef _DEBUG
 	creationFlags |= D3D11_CREATE_DEVICE_DEBUG;
 #endif
@@ -56,39 +95,57 @@ bool CD3D11Render::Init()
 	scd.SampleDesc.Count = 1;
 	scd.Windowed = TRUE;
 	scd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+	scd.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
 	D3D_FEATURE_LEVEL featureLevel;
 	HRESULT hr = D3D11CreateDeviceAndSwapChain(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, creationFlags, NULL, 0, D3D11_SDK_VERSION, &scd, &m_swapChain, &m_device, &featureLevel, &m_context);
 	if (FAILED(hr))
-		return false;
+	{
+		scd.Flags = 0; /* before Windows 8.1 */
+		hr = D3D11CreateDeviceAndSwapChain(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, creationFlags, NULL, 0, D3D11_SDK_VERSION, &scd, &m_swapChain, &m_device, &featureLevel, &m_context);
+		if (FAILED(hr))
+			return false;
+	}
 
 	{
-		CComQIPtr<IDXGIDevice1> spIDXGIDevice1(m_device);
-		if (spIDXGIDevice1)
-			spIDXGIDevice1->SetMaximumFrameLatency(1);
+		CComQIPtr<IDXGISwapChain2> spIDXGISwapChain2(m_swapChain);
+		if (spIDXGISwapChain2 && scd.Flags)
+		{
+			spIDXGISwapChain2->SetMaximumFrameLatency(1);
+			m_waitable = spIDXGISwapChain2->GetFrameLatencyWaitableObject();
+		}
+		else
+		{
+			/* no waitable object: Present blocks on the vsync, holding m_mtx, PullLoop may wait behind it */
+			CComQIPtr<IDXGIDevice1> spIDXGIDevice1(m_device);
+			if (spIDXGIDevice1)
+				spIDXGIDevice1->SetMaximumFrameLatency(1);
+		}
 	}
 
 	D3D11_TEXTURE2D_DESC texDesc = {};
 	texDesc.Width = m_imageWidth;
 	texDesc.Height = m_imageHeight;
 	texDesc.MipLevels = texDesc.ArraySize = texDesc.SampleDesc.Count = 1;
-	if (m_bMono)
+	if (m_bMono || m_bRaw)
 		texDesc.Format = (m_bitdepth > 8) ? DXGI_FORMAT_R16_UNORM : DXGI_FORMAT_R8_UNORM;
 	else
 		texDesc.Format = (m_bitdepth > 8) ? DXGI_FORMAT_R16G16B16A16_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
 	texDesc.Usage = D3D11_USAGE_DYNAMIC;
 	texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
 	texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	hr = m_device->CreateTexture2D(&texDesc, NULL, &m_textureImage);
-	if (FAILED(hr))
-		return false;
-
 	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 	srvDesc.Format = texDesc.Format;
 	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
 	srvDesc.Texture2D.MipLevels = 1;
-	hr = m_device->CreateShaderResourceView(m_textureImage, &srvDesc, &m_srv);
-	if (FAILED(hr))
-		return false;
+	for (int i = 0; i < UPLOADCOUNT; ++i)
+	{
+		hr = m_device->CreateTexture2D(&texDesc, NULL, &m_textureImage[i]);
+		if (FAILED(hr))
+			return false;
+		hr = m_device->CreateShaderResourceView(m_textureImage[i], &srvDesc, &m_srv[i]);
+		if (FAILED(hr))
+			return false;
+	}
 
 	hr = CreateShaders();
 	if (FAILED(hr))
@@ -96,6 +153,20 @@ bool CD3D11Render::Init()
 	hr = CreateSampler();
 	if (FAILED(hr))
 		return false;
+	if (FAILED(m_overlay.Init(m_device)))
+		TOUPCAM_LOG_ERROR("%s: no overlay", __func__);
+	if (m_bRaw)
+	{
+		D3D11_BUFFER_DESC bd = {};
+		bd.Usage = D3D11_USAGE_DYNAMIC;
+		bd.ByteWidth = sizeof(m_color);
+		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		hr = m_device->CreateBuffer(&bd, NULL, &m_colorBuffer);
+		if (FAILED(hr))
+			return false;
+		m_context->PSSetConstantBuffers(0, 1, &m_colorBuffer.p);
+	}
 
 	RECT rc;
 	GetClientRect(m_hwnd, &rc);
@@ -113,10 +184,15 @@ bool CD3D11Render::Init()
 	m_context->PSSetShader(m_ps, NULL, 0);
 
 	m_evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_evtFresh = CreateEvent(NULL, FALSE, FALSE, NULL);
 	m_thrd = std::make_shared<std::thread>([this]()
 		{
 			Loop();
 		});
+	m_thrdPull = std::make_shared<std::thread>([this]()
+		{
+			PullLoop();
+		});
 	return true;
 }
 
@@ -148,11 +224,42 @@ HRESULT CD3D11Render::CreateShaders()
 	const char* psCode = R"(
 			Texture2D tex : register(t0);
 			SamplerState sam : register(s0);
+			cbuffer Color : register(b0) {
+				float4 gain;
+				float4 m0, m1, m2;
+				float4 gamma;
+			};
 			struct PS_IN {
 				float4 pos : SV_POSITION;
 				float2 uv  : TEXCOORD;
 			};
+			float raw(int2 p, int2 dims) {
+				return tex.Load(int3(clamp(p, int2(0, 0), dims - 1), 0)).r;
+			}
 			float4 PS(PS_IN input) : SV_Target {
+			#if RAW == 1
+				uint w, h;
+				tex.GetDimensions(w, h);
+				const int2 dims = int2(w, h);
+				const int2 p = min(int2(input.uv * float2(w, h)), dims - 1);
+				const int ox = (p.x + REDX) & 1, oy = (p.y + REDY) & 1;
+				const float c = raw(p, dims);
+				const float horz = (raw(p + int2(-1, 0), dims) + raw(p + int2(1, 0), dims)) * 0.5;
+				const float vert = (raw(p + int2(0, -1), dims) + raw(p + int2(0, 1), dims)) * 0.5;
+				const float diag = (raw(p + int2(-1, -1), dims) + raw(p + int2(1, -1), dims) + raw(p + int2(-1, 1), dims) + raw(p + int2(1, 1), dims)) * 0.25;
+				float3 rgb;
+				if ((0 == ox) && (0 == oy))
+					rgb = float3(c, (horz + vert) * 0.5, diag);
+				else if ((1 == ox) && (1 == oy))
+					rgb = float3(diag, (horz + vert) * 0.5, c);
+				else if (0 == oy)
+					rgb = float3(horz, c, vert);	/* green on a red row */
+				else
+					rgb = float3(vert, c, horz);	/* green on a blue row */
+				rgb *= SCALE * gain.rgb;
+				rgb = float3(dot(m0.rgb, rgb), dot(m1.rgb, rgb), dot(m2.rgb, rgb));
+				return float4(pow(saturate(rgb), gamma.x), 1.0);
+			#else
 			#if MONO == 1
 				float gray = tex.Sample(sam, input.uv).r;
 				float4 color = float4(gray, gray, gray, 1.0);
@@ -161,6 +268,7 @@ HRESULT CD3D11Render::CreateShaders()
 			#endif
 				color *= SCALE;
 				return color;
+			#endif
 			})";
 	char scale[32];
 	if ((m_bitdepth <= 8) || (m_bitdepth >= 16))
@@ -170,8 +278,14 @@ HRESULT CD3D11Render::CreateShaders()
 		const double denom = double((1 << m_bitdepth) - 1);
 		sprintf(scale, "%.8f", 65535.0 / denom);
 	}
+	/* position of the red pixel in the 2 x 2 cell */
+	const bool bRedX = (MAKEFOURCC('G', 'R', 'B', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc);
+	const bool bRedY = (MAKEFOURCC('G', 'B', 'R', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc);
 	D3D_SHADER_MACRO macro[] = {
 		{ "MONO", m_bMono ? "1" : "0" },
+		{ "RAW", m_bRaw ? "1" : "0" },
+		{ "REDX", bRedX ? "1" : "0" },
+		{ "REDY", bRedY ? "1" : "0" },
 		{ "SCALE", scale },
 		{ nullptr, nullptr }
 	};
@@ -225,7 +339,7 @@ void CD3D11Render::Resize()
 		int cx = rc.right - rc.left, cy = rc.bottom - rc.top;
 		TOUPCAM_LOG_VERBOSE("%s: %d %d", __func__, cx, cy);
 		m_resize.store(0x80000000 | (cx << 16) | cy);
-		SetEvent(m_evt);
+		SetEvent(m_evtFresh);
 	}
 }
 
@@ -255,6 +369,11 @@ HRESULT CD3D11Render::Resize(int windowWidth, int windowHeight)
 		0.0f, 1.0f
 	};
 	m_context->RSSetViewports(1, &vp);
+	m_map[0] = vpW / (float)m_imageWidth;
+	m_map[1] = vpH / (float)m_imageHeight;
+	m_map[2] = (float)vpX;
+	m_map[3] = (float)vpY;
+	m_overlay.Resize(m_windowWidth, m_windowHeight);
 	return S_OK;
 }
 
@@ -282,47 +401,143 @@ void CD3D11Render::Render()
 	SetEvent(m_evt);
 }
 
+void CD3D11Render::PullLoop()
+{
+	CSpanTrace::Get().SetThreadName("pull");
+	while (m_loop)
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		HRESULT hr;
+		{
+			CSpan span("map");
+			std::lock_guard<std::mutex> lock(m_mtx);
+			hr = m_context->Map(m_textureImage[m_back], 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+		}
+		if (SUCCEEDED(hr))
+		{
+			ToupcamFrameInfoV4 info = { 0 };
+			{
+				CSpan span("pull");
+				hr = Toupcam_PullImageV4(m_hcam, mapped.pData, 0, (m_bMono || m_bRaw) ? ((m_bitdepth > 8) ? 16 : 8) : ((m_bitdepth > 8) ? 64 : 32), mapped.RowPitch, &info);
+				span.SetFrame(info.v3.seq);
+				if (SUCCEEDED(hr) && (info.v3.flag & TOUPCAM_FRAMEINFO_FLAG_TIMESTAMP))
+					CSpanTrace::Get().Transit(info.v3.seq, info.v3.timestamp, span.Begin());
+			}
+			m_seq[m_back] = info.v3.seq;
+			if (SUCCEEDED(hr) && m_bRaw && m_bAwb.exchange(false))
+			{
+				CSpan span("awb", info.v3.seq);
+				GrayWorld(mapped.pData, mapped.RowPitch);
+			}
+			CSpan span("unmap", info.v3.seq);
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_context->Unmap(m_textureImage[m_back], 0);
+		}
+		if (FAILED(hr))
+		{
+			CSpan span("wait");
+			WaitForSingleObject(m_evt, INFINITE);
+			continue;
+		}
+
+		/* publish: an unpresented frame in the middle is overwritten, the camera does not wait for the display */
+		m_back = m_middle.exchange(m_back | FRESH) & ~FRESH;
+		SetEvent(m_evtFresh);
+	}
+}
+
+/* gains which make the means of the red and blue pixels those of the green ones, every 8th cell */
+void CD3D11Render::GrayWorld(const void* data, unsigned rowPitch)
+{
+	const int rx = ((MAKEFOURCC('G', 'R', 'B', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc)) ? 1 : 0;
+	const int ry = ((MAKEFOURCC('G', 'B', 'R', 'G') == m_fourcc) || (MAKEFOURCC('B', 'G', 'G', 'R') == m_fourcc)) ? 1 : 0;
+	double sum[3] = { 0 };
+	for (int y = 0; y + 1 < m_imageHeight; y += 16)
+	{
+		const unsigned char* row[2] = { (const unsigned char*)data + (size_t)y * rowPitch, (const unsigned char*)data + (size_t)(y + 1) * rowPitch };
+		for (int x = 0; x + 1 < m_imageWidth; x += 16)
+		{
+			for (int j = 0; j < 2; ++j)
+			{
+				for (int i = 0; i < 2; ++i)
+				{
+					const double v = (m_bitdepth > 8) ? ((const unsigned short*)row[j])[x + i] : row[j][x + i];
+					if ((i == rx) && (j == ry))
+						sum[0] += v;
+					else if ((i != rx) && (j != ry))
+						sum[2] += v;
+					else
+						sum[1] += v * 0.5;
+				}
+			}
+		}
+	}
+	if ((sum[0] > 0.0) && (sum[2] > 0.0))
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_color.gain[0] = (float)(sum[1] / sum[0]);
+		m_color.gain[1] = 1.0f;
+		m_color.gain[2] = (float)(sum[1] / sum[2]);
+		m_bColorDirty = true;
+	}
+}
+
 void CD3D11Render::Loop()
 {
+	CSpanTrace::Get().SetThreadName("render");
+	bool bWait = true;
 	while (m_loop)
 	{
+		if (bWait && m_waitable)
+		{
+			CSpan span("vsync");
+			WaitForSingleObjectEx(m_waitable, 1000, TRUE);
+		}
+		bWait = false;
 		{
 			unsigned val = m_resize.load();
 			if (val & 0x80000000)
 			{
 				m_resize.store(0);
+				std::lock_guard<std::mutex> lock(m_mtx);
 				Resize((val >> 16) & 0x7fff, val & 0x7fff);
-				continue;
 			}
 		}
 
-		unsigned tick;
-		D3D11_MAPPED_SUBRESOURCE mapped = {};
-		HRESULT hr = m_context->Map(m_textureImage, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
-		if (SUCCEEDED(hr))
-		{
-			hr = Toupcam_PullImageWithRowPitch(m_hcam, mapped.pData, m_bMono ? ((m_bitdepth > 8) ? 16 : 8) : ((m_bitdepth > 8) ? 64 : 32), mapped.RowPitch, NULL, NULL);
-			if (SUCCEEDED(hr))
-				tick = get_precise_tick();
-			m_context->Unmap(m_textureImage, 0);
-		}
-		if (FAILED(hr))
+		if (0 == (m_middle.load() & FRESH))
 		{
-			WaitForSingleObject(m_evt, INFINITE);
+			CSpan span("wait");
+			WaitForSingleObject(m_evtFresh, INFINITE);
 			continue;
 		}
+		m_front = m_middle.exchange(m_front) & ~FRESH;
 
+		CSpan span("render", m_seq[m_front]);
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (m_colorBuffer && m_bColorDirty)
+		{
+			D3D11_MAPPED_SUBRESOURCE mapped = {};
+			if (SUCCEEDED(m_context->Map(m_colorBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+			{
+				memcpy(mapped.pData, &m_color, sizeof(m_color));
+				m_context->Unmap(m_colorBuffer, 0);
+				m_bColorDirty = false;
+			}
+		}
 		if (SetupRtv())
 		{
-			m_context->PSSetShaderResources(0, 1, &m_srv.p);
+			m_context->PSSetShaderResources(0, 1, &m_srv[m_front].p);
 			m_context->Draw(4, 0);
-			hr = m_swapChain->Present(1, 0);
+			m_overlay.Draw(m_context, m_map[0], m_map[1], m_map[2], m_map[3]);
+			CSpan spanPresent("present", m_seq[m_front]);
+			const HRESULT hr = m_swapChain->Present(1, 0);
 			if (SUCCEEDED(hr))
 			{
 				++m_totalFrame;
 				++m_nFrame;
 			}
-			TOUPCAM_LOG_VERBOSE("%s: Present, 0x%08x, tick = %u", __func__, hr, get_precise_tick() - tick);
+			bWait = true;
+			TOUPCAM_LOG_VERBOSE("%s: Present, 0x%08x", __func__, hr);
 		}
 	}
 }
@@ -4,51 +4,81 @@
 #include <atlbase.h>
 #include <d3d11.h>
 #include <d3dcompiler.h>
-#include <dxgi.h>
+#include <dxgi1_3.h>
 #include <thread>
 #include <atomic>
+#include <mutex>
 #include "toupcam.h"
+#include "../d3doverlay.h"
 
+/*
+	two threads: PullLoop pulls every frame into the back one of UPLOADCOUNT textures and publishes it, Loop waits on
+	the frame latency waitable object of the swap chain, then presents the latest published texture; the camera never
+	waits for the vsync and the display never spins waiting for the camera
+	bRaw (color cameras, TOUPCAM_OPTION_RAW = 1): the Bayer data is uploaded as it is, the pixel shader does the demosaic
+	(bilinear), the white balance, the color matrix and the gamma of SetColor; AwbOnce takes the gains from the next frame
+	GetOverlay: the items over the frame (../d3doverlay.h), in the pixels of the image, blended before each present
+*/
 class CD3D11Render
 {
-	enum { BUFFERCOUNT = 2 };
+	enum { BUFFERCOUNT = 2, UPLOADCOUNT = 3, FRESH = 4 };
 public:
-	CD3D11Render(HToupcam hcam, HWND hwndTarget, int imageWidth, int imageHeight);
+	CD3D11Render(HToupcam hcam, HWND hwndTarget, int imageWidth, int imageHeight, bool bRaw = false);
 	~CD3D11Render();
 	bool Init();
 	void Render();
 	void Resize();
 	bool GetFrameRate(unsigned& nFrame, unsigned& nTime, unsigned& nTotal);
+	void SetColor(const float gain[3], const float matrix[9], float gamma);
+	void AwbOnce();
+	CD3DOverlay& GetOverlay() { return m_overlay; }
 
 private:
 	const HToupcam m_hcam;
 	const bool m_bMono;
 	const HWND m_hwnd;
 	const int m_imageWidth, m_imageHeight;
-	unsigned m_bitdepth;
+	unsigned m_bitdepth, m_fourcc;
+	bool m_bRaw;
 	int m_windowWidth, m_windowHeight;
 	unsigned m_totalFrame, m_nFrame, m_nTick;
 	std::atomic<unsigned> m_resize;
 	volatile bool m_loop;
-	HANDLE m_evt;
-	std::shared_ptr<std::thread> m_thrd;
+	HANDLE m_evt, m_evtFresh, m_waitable;
+	std::shared_ptr<std::thread> m_thrd, m_thrdPull;
+	unsigned m_back, m_front;			/* index of the texture: m_back for PullLoop only, m_front for Loop only */
+	std::atomic<unsigned> m_middle;		/* the third one, | FRESH when published and not presented yet */
+	unsigned m_seq[UPLOADCOUNT];		/* frame sequence number in each texture, for the spans */
+	std::mutex m_mtx;					/* the immediate context is not thread safe, m_color */
+	struct {
+		float gain[4];					/* r, g, b, - */
+		float matrix[3][4];				/* rows */
+		float gamma[4];					/* 1 / gamma, -, -, - */
+	} m_color;
+	bool m_bColorDirty;
+	std::atomic<bool> m_bAwb;
+	CD3DOverlay m_overlay;
+	float m_map[4];						/* the image on the window, for m_overlay: scale x, y, offset x, y */
 
 	CComPtr<ID3D11Device> m_device;
 	CComPtr<ID3D11DeviceContext> m_context;
 	CComPtr<IDXGISwapChain> m_swapChain;
-	CComPtr<ID3D11Texture2D> m_textureImage;
-	CComPtr<ID3D11ShaderResourceView> m_srv;
+	CComPtr<ID3D11Texture2D> m_textureImage[UPLOADCOUNT];
+	CComPtr<ID3D11ShaderResourceView> m_srv[UPLOADCOUNT];
 	CComPtr<ID3D11SamplerState> m_sampler;
 	CComPtr<ID3D11VertexShader> m_vs;
 	CComPtr<ID3D11PixelShader> m_ps;
 	CComPtr<ID3D11InputLayout> m_inputLayout;
 	CComPtr<ID3D11Buffer> m_vertexBuffer;
+	CComPtr<ID3D11Buffer> m_colorBuffer;
 
 	HRESULT CreateShaders();
 	HRESULT CreateSampler();
 	HRESULT Resize(int windowWidth, int windowHeight);
 	bool SetupRtv();
 	void Loop();
+	void PullLoop();
+	void GrayWorld(const void* data, unsigned rowPitch);
 };
 
 #endif
\ No newline at end of file
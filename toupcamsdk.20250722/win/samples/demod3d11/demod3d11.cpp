@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "demod3d11.h"
 #include "demod3d11Dlg.h"
+#include "demod3d11Wall.h"
+#include "../spantrace.h"
 
 Cdemod3d11App theApp;
 
@@ -16,10 +18,52 @@ BOOL Cdemod3d11App::InitInstance()
 
 	SetRegistryKey(_T("demod3d11"));
 
+	/*
+		demod3d11.exe /trace[:path]: spans of the frame path, written to path (default: trace.json next to the exe) at exit, see spantrace.h
+		demod3d11.exe /wall: every camera in one window, see d3d11composite.h
+	*/
+	bool bWall = false;
+	for (int i = 1; i < __argc; ++i)
+	{
+		if (0 == _wcsicmp(__wargv[i], L"/wall"))
+			bWall = true;
+		else if (0 == _wcsnicmp(__wargv[i], L"/trace", 6))
+		{
+			if (L':' == __wargv[i][6])
+				m_strTrace = __wargv[i] + 7;
+			else
+			{
+				wchar_t path[MAX_PATH + 1] = { 0 };
+				GetModuleFileName(NULL, path, MAX_PATH);
+				PathRemoveFileSpec(path);
+				PathAppend(path, L"trace.json");
+				m_strTrace = path;
+			}
+		}
+	}
+	if (!m_strTrace.IsEmpty())
+	{
+		CSpanTrace::Get().SetThreadName("ui");
+		CSpanTrace::Get().Start();
+	}
+
+	if (bWall)
+		return Cdemod3d11Wall::Open() ? TRUE : FALSE;	/* TRUE: the message loop of the wall window */
+
 	Cdemod3d11Dlg dlg;
 	m_pMainWnd = &dlg;
 	dlg.DoModal();
-
 	return FALSE;
 }
 
+int Cdemod3d11App::ExitInstance()
+{
+	if (!m_strTrace.IsEmpty())
+	{
+		CSpanTrace::Get().Stop();
+		if (!CSpanTrace::Get().Save(m_strTrace))
+			AfxMessageBox(_T("Failed to save ") + m_strTrace);
+	}
+	return CWinApp::ExitInstance();
+}
+
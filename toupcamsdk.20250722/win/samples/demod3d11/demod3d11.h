@@ -8,8 +8,10 @@
 
 class Cdemod3d11App : public CWinApp
 {
+	CString m_strTrace;
 public:
 	virtual BOOL InitInstance();
+	virtual int ExitInstance();
 };
 
 extern Cdemod3d11App theApp;
\ No newline at end of file
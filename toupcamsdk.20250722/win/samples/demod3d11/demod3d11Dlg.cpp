@@ -1,6 +1,7 @@
 #include "stdafx.h"
 #include "demod3d11.h"
 #include "demod3d11Dlg.h"
+#include "../spantrace.h"
 #include <InitGuid.h>
 #include <wincodec.h>
 
@@ -165,6 +166,8 @@ void Cdemod3d11Dlg::StartDevice()
 	if (FAILED(hr))
 		return;
 
+	const bool bRaw = IsDlgButtonChecked(IDC_CHECK3) && (S_OK != Toupcam_get_MonoMode(m_hcam));
+	Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_RAW, bRaw ? 1 : 0);	// demosaic in the pixel shader
 	if (IsDlgButtonChecked(IDC_CHECK2))
 	{
 		Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_BITDEPTH, 1);
@@ -176,10 +179,29 @@ void Cdemod3d11Dlg::StartDevice()
 		Toupcam_put_Option(m_hcam, TOUPCAM_OPTION_RGB, Toupcam_get_MonoMode(m_hcam) ? 2 : 3);	// RGB32
 	}
 
-	m_render = std::make_shared<CD3D11Render>(m_hcam, GetDlgItem(IDC_STATIC4)->GetSafeHwnd(), nWidth, nHeight);
+	m_render = std::make_shared<CD3D11Render>(m_hcam, GetDlgItem(IDC_STATIC4)->GetSafeHwnd(), nWidth, nHeight, bRaw);
 	if (!m_render->Init())
 		return;
 
+	{
+		/* composited by the renderer, the frames pulled stay as they are */
+		CD3DOverlay& overlay = m_render->GetOverlay();
+		RECT rc = { 0 };
+		if (SUCCEEDED(Toupcam_get_AEAuxRect(m_hcam, &rc)))
+		{
+			OverlayItem item = { OVERLAY_RECT, OVERLAY_FRAME, (float)rc.left, (float)rc.top, (float)rc.right, (float)rc.bottom, RGB(0xff, 0, 0), 1.0f, 2.0f, 0.0f };
+			overlay.Add(item);
+			item.type = OVERLAY_TEXT;
+			item.fontSize = 14.0f;
+			item.text = L"AE";
+			overlay.Add(item);
+		}
+		unsigned nResolutionIndex = 0;
+		float x = 0.0f, y = 0.0f;
+		if (SUCCEEDED(Toupcam_get_eSize(m_hcam, &nResolutionIndex)) && SUCCEEDED(Toupcam_get_PixelSize(m_hcam, nResolutionIndex, &x, &y)))
+			overlay.SetScaleBar(x);	/* on the sensor */
+	}
+
 	Toupcam_StartPullModeWithWndMsg(m_hcam, m_hWnd, MSG_CAMEVENT);
 
 	BOOL bEnableAutoExpo = TRUE;
@@ -301,6 +323,7 @@ void Cdemod3d11Dlg::OnEventTempTint()
 
 void Cdemod3d11Dlg::OnEventImage()
 {
+	CSpanTrace::Get().Instant("image event", 0);	/* the window message of TOUPCAM_EVENT_IMAGE */
 	if (m_render)
 		m_render->Render();
 }
@@ -411,7 +434,9 @@ void Cdemod3d11Dlg::OnBnClickedCheck1()
 
 void Cdemod3d11Dlg::OnBnClickedButton3()
 {
-	if (m_hcam)
+	if (m_render && IsDlgButtonChecked(IDC_CHECK3))
+		m_render->AwbOnce();
+	else if (m_hcam)
 		Toupcam_AwbOnce(m_hcam, NULL, NULL);
 }
 
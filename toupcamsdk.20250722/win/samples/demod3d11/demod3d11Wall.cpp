@@ -0,0 +1,131 @@
+#include "stdafx.h"
+#include "demod3d11Wall.h"
+
+BEGIN_MESSAGE_MAP(Cdemod3d11Wall, CWnd)
+	ON_WM_DESTROY()
+	ON_WM_SIZE()
+	ON_WM_TIMER()
+	ON_WM_ERASEBKGND()
+END_MESSAGE_MAP()
+
+bool Cdemod3d11Wall::Open()
+{
+	Cdemod3d11Wall* pWall = new Cdemod3d11Wall;
+	const CString strClass = AfxRegisterWndClass(CS_HREDRAW | CS_VREDRAW, LoadCursor(NULL, IDC_ARROW), NULL, AfxGetApp()->LoadStandardIcon(IDI_APPLICATION));
+	if (!pWall->CreateEx(0, strClass, _T("demod3d11 wall"), WS_OVERLAPPEDWINDOW | WS_VISIBLE, CW_USEDEFAULT, CW_USEDEFAULT, 1280, 960, NULL, NULL))
+	{
+		delete pWall;
+		return false;
+	}
+	if (!pWall->Create())
+	{
+		pWall->DestroyWindow();		/* deletes it */
+		return false;
+	}
+	AfxGetApp()->m_pMainWnd = pWall;
+	return true;
+}
+
+bool Cdemod3d11Wall::Create()
+{
+	ToupcamDeviceV2 arr[TOUPCAM_MAX] = { 0 };
+	const unsigned num = Toupcam_EnumV2(arr);
+	if (0 == num)
+	{
+		AfxMessageBox(_T("No camera found."));
+		return false;
+	}
+
+	m_composite = std::make_shared<CD3D11Composite>(m_hWnd);
+	for (unsigned i = 0; i < num; ++i)
+	{
+		HToupcam hcam = Toupcam_Open(arr[i].id);
+		if (NULL == hcam)
+			continue;
+		/* RGB32 or mono 8 bits, as the dialog without 16 bits */
+		Toupcam_put_Option(hcam, TOUPCAM_OPTION_RAW, 0);
+		Toupcam_put_Option(hcam, TOUPCAM_OPTION_BITDEPTH, 0);
+		Toupcam_put_Option(hcam, TOUPCAM_OPTION_RGB, Toupcam_get_MonoMode(hcam) ? 2 : 3);
+		const int index = m_composite->Add(hcam);
+		if (index < 0)
+		{
+			Toupcam_Close(hcam);
+			continue;
+		}
+		std::unique_ptr<Cam> cam(new Cam);
+		cam->pWall = this;
+		cam->index = index;
+		cam->hcam = hcam;
+		m_cam.push_back(std::move(cam));
+	}
+	if (m_cam.empty() || !m_composite->Init())
+	{
+		AfxMessageBox(_T("Failed to start the cameras."));
+		return false;
+	}
+	for (auto& c : m_cam)
+		Toupcam_StartPullModeWithCallback(c->hcam, EventCallback, c.get());
+	SetTimer(1, 1000, NULL);
+	return true;
+}
+
+/* on the threads of the SDK: SetEvent only */
+void __stdcall Cdemod3d11Wall::EventCallback(unsigned nEvent, void* pCallbackCtx)
+{
+	if (TOUPCAM_EVENT_IMAGE == nEvent)
+	{
+		const Cam* pCam = (const Cam*)pCallbackCtx;
+		pCam->pWall->m_composite->Render(pCam->index);
+	}
+}
+
+void Cdemod3d11Wall::OnSize(UINT nType, int cx, int cy)
+{
+	CWnd::OnSize(nType, cx, cy);
+	if ((nType != SIZE_MINIMIZED) && m_composite)
+		m_composite->Resize();
+}
+
+BOOL Cdemod3d11Wall::OnEraseBkgnd(CDC* /*pDC*/)
+{
+	return TRUE;	/* the swap chain covers it all */
+}
+
+void Cdemod3d11Wall::OnTimer(UINT_PTR nIDEvent)
+{
+	if ((1 == nIDEvent) && m_composite)
+	{
+		unsigned nFrame = 0, nTime = 0, nTotal = 0;
+		if (m_composite->GetFrameRate(nFrame, nTime, nTotal) && nTime)
+		{
+			CString str;
+			str.Format(_T("demod3d11 wall: %u cameras, present %.1f"), (unsigned)m_cam.size(), nFrame * 1000.0 / nTime);
+			for (auto& c : m_cam)
+			{
+				unsigned n = 0, total = 0;
+				if (m_composite->GetFrameRate(c->index, n, total))
+					str.AppendFormat(_T("; %d: %.1f"), c->index, n * 1000.0 / nTime);
+			}
+			SetWindowText(str);
+		}
+	}
+	CWnd::OnTimer(nIDEvent);
+}
+
+void Cdemod3d11Wall::OnDestroy()
+{
+	/* the cameras stop before the composite, which their callbacks use */
+	for (auto& c : m_cam)
+		Toupcam_Stop(c->hcam);
+	m_composite.reset();
+	for (auto& c : m_cam)
+		Toupcam_Close(c->hcam);
+	m_cam.clear();
+
+	CWnd::OnDestroy();
+}
+
+void Cdemod3d11Wall::PostNcDestroy()
+{
+	delete this;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+#include "d3d11composite.h"
+
+/* demod3d11.exe /wall: every camera in one window, one swap chain (CD3D11Composite) */
+class Cdemod3d11Wall : public CWnd
+{
+	struct Cam {
+		Cdemod3d11Wall* pWall;
+		int index;
+		HToupcam hcam;
+	};
+	std::vector<std::unique_ptr<Cam>> m_cam;
+	std::shared_ptr<CD3D11Composite> m_composite;
+
+	bool Create();
+public:
+	static bool Open();		/* the main window of the app; false: no camera or no device */
+
+protected:
+	DECLARE_MESSAGE_MAP()
+	virtual void PostNcDestroy();
+public:
+	afx_msg void OnDestroy();
+	afx_msg void OnSize(UINT nType, int cx, int cy);
+	afx_msg void OnTimer(UINT_PTR nIDEvent);
+	afx_msg BOOL OnEraseBkgnd(CDC* pDC);
+private:
+	static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx);
+};
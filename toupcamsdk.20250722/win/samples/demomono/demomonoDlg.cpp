@@ -3,6 +3,72 @@
 #include "demomonoDlg.h"
 #include <InitGuid.h>
 #include <wincodec.h>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <tmmintrin.h>
+#endif
+
+/* grey to BGR24 for display: every source pixel is replicated to three bytes, 16 bits grey is shifted down to 8 bits first */
+#if defined(_M_IX86) || defined(_M_X64)
+static bool HasSSSE3()
+{
+	static int ret = -1;
+	if (ret < 0)
+	{
+		int info[4] = { 0 };
+		__cpuid(info, 1);
+		ret = (info[2] & (1 << 9)) ? 1 : 0;
+	}
+	return (ret > 0);
+}
+
+/* 16 grey pixels to 48 bytes */
+static inline void ReplicateGrey16x3(__m128i v, BYTE* pDst)
+{
+	const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+	_mm_storeu_si128((__m128i*)pDst, _mm_shuffle_epi8(v, m0));
+	_mm_storeu_si128((__m128i*)(pDst + 16), _mm_shuffle_epi8(v, m1));
+	_mm_storeu_si128((__m128i*)(pDst + 32), _mm_shuffle_epi8(v, m2));
+}
+#endif
+
+static void Grey8ToBGR24(const BYTE* pSrc, BYTE* pDst, int width)
+{
+	int j = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+	if (HasSSSE3())
+	{
+		for (; j + 16 <= width; j += 16)
+			ReplicateGrey16x3(_mm_loadu_si128((const __m128i*)(pSrc + j)), pDst + 3 * j);
+	}
+#endif
+	for (; j < width; ++j)
+		pDst[3 * j] = pDst[3 * j + 1] = pDst[3 * j + 2] = pSrc[j];
+}
+
+static void Grey16ToBGR24(const USHORT* pSrc, BYTE* pDst, int width, int shift)
+{
+	int j = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+	if (HasSSSE3())
+	{
+		const __m128i count = _mm_cvtsi32_si128(shift);
+		for (; j + 16 <= width; j += 16)
+		{
+			const __m128i lo = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(pSrc + j)), count);
+			const __m128i hi = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(pSrc + j + 8)), count);
+			ReplicateGrey16x3(_mm_packus_epi16(lo, hi), pDst + 3 * j);
+		}
+	}
+#endif
+	for (; j < width; ++j)
+	{
+		const USHORT value = pSrc[j] >> shift;
+		pDst[3 * j] = pDst[3 * j + 1] = pDst[3 * j + 2] = (BYTE)((value > 255) ? 255 : value);
+	}
+}
 
 CdemomonoDlg::CdemomonoDlg(CWnd* pParent /*=NULL*/)
 	: CDialog(CdemomonoDlg::IDD, pParent)
@@ -219,30 +285,13 @@ void CdemomonoDlg::OnEventImage()
 		{
 			int pitchSrc = TDIBWIDTHBYTES(header.biWidth * 16);
 			for (int i = 0; i < header.biHeight; ++i)
-			{
-				for (int j = 0; j < header.biWidth; ++j)
-				{
-					unsigned short value = (*((PUSHORT)(m_pImageData + i * pitchSrc + j * 2))) >> (m_maxBitDepth - 8);
-					*(m_pDisplayData + i * pitchDst + 3 * j)
-						= *(m_pDisplayData + i * pitchDst + 3 * j + 1)
-						= *(m_pDisplayData + i * pitchDst + 3 * j + 2)
-						= value;
-				}
-			}
+				Grey16ToBGR24((const USHORT*)(m_pImageData + i * pitchSrc), m_pDisplayData + i * pitchDst, header.biWidth, m_maxBitDepth - 8);
 		}
 		else
 		{
 			int pitchSrc = TDIBWIDTHBYTES(header.biWidth * 8);
 			for (int i = 0; i < header.biHeight; ++i)
-			{
-				for (int j = 0; j < header.biWidth; ++j)
-				{
-					*(m_pDisplayData + i * pitchDst + 3 * j)
-						= *(m_pDisplayData + i * pitchDst + 3 * j + 1)
-						= *(m_pDisplayData + i * pitchDst + 3 * j + 2)
-						= *(m_pImageData + i * pitchSrc + j);
-				}
-			}
+				Grey8ToBGR24(m_pImageData + i * pitchSrc, m_pDisplayData + i * pitchDst, header.biWidth);
 		}
 		
 		CClientDC dc(this);
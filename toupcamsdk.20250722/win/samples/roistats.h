@@ -0,0 +1,227 @@
+#pragma once
+
+/*
+ * Mean and variance of many boxes of a RAW or mono frame, 8 or 16 bits per pixel, such as the sample points of democns.
+ * Two ways to the sums, chosen by SetBoxes from the boxes:
+ *   direct: the rows of every box summed with SSE2 (pixels and squares), when the boxes cover less pixels than
+ *     ROISTATS_INTEGRAL_RATIO times their bounding rectangle;
+ *   integral: one integral image of the pixels and of their squares over the bounding rectangle, then four reads per
+ *     box, when the boxes overlap so much that summing every box would read the same pixels many times.
+ * Either way the boxes are split over the worker threads when there are more than ROISTATS_PARALLEL_PIXELS to read.
+ * The boxes are in the coordinates of the buffer (row 0 is the first row in memory) and must lie inside the frame;
+ * pitch is in pixels. Compute may be called from any single thread, the threads are started per call.
+ */
+#include <vector>
+#include <thread>
+#include <algorithm>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define ROISTATS_SSE2
+#endif
+
+#define ROISTATS_INTEGRAL_RATIO		2		/* box pixels / bounding pixels above which the integral image pays */
+#define ROISTATS_PARALLEL_PIXELS	(256 * 1024)
+
+typedef struct {
+	int x, y, width, height;
+} RoiBox;
+
+typedef struct {
+	double mean, variance;
+} RoiResult;
+
+class CRoiStats
+{
+	std::vector<RoiBox>				m_vecBox;
+	RECT							m_bound;
+	unsigned long long				m_nPixels;		/* sum of the box areas */
+	unsigned						m_nThreads;
+	bool							m_bIntegral;
+	std::vector<unsigned long long>	m_vecSum, m_vecSum2;	/* (bound width + 1) x (bound height + 1) */
+
+	static void RowSum(const BYTE* p, int n, unsigned long long& sum, unsigned long long& sum2)
+	{
+		int x = 0;
+#ifdef ROISTATS_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		__m128i s = zero, s2 = zero;
+		for (; x + 16 <= n; x += 16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(p + x));
+			s = _mm_add_epi64(s, _mm_sad_epu8(v, zero));
+			const __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+			const __m128i q = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));	/* 4 x at most 4 x 255^2 */
+			s2 = _mm_add_epi64(s2, _mm_add_epi64(_mm_unpacklo_epi32(q, zero), _mm_unpackhi_epi32(q, zero)));
+		}
+		unsigned long long a[2], b[2];
+		_mm_storeu_si128((__m128i*)a, s);
+		_mm_storeu_si128((__m128i*)b, s2);
+		sum += a[0] + a[1];
+		sum2 += b[0] + b[1];
+#endif
+		for (; x < n; ++x)
+		{
+			sum += p[x];
+			sum2 += (unsigned)p[x] * p[x];
+		}
+	}
+
+	static void RowSum(const USHORT* p, int n, unsigned long long& sum, unsigned long long& sum2)
+	{
+		int x = 0;
+#ifdef ROISTATS_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		__m128i s = zero, s2 = zero;
+		for (; x + 8 <= n; x += 8)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(p + x));
+			const __m128i lo = _mm_unpacklo_epi16(v, zero), hi = _mm_unpackhi_epi16(v, zero);	/* 4 x 32 bits each */
+			const __m128i t = _mm_add_epi32(lo, hi);
+			s = _mm_add_epi64(s, _mm_add_epi64(_mm_unpacklo_epi32(t, zero), _mm_unpackhi_epi32(t, zero)));
+			/* squares of 16 bits need 32 bits unsigned: _mm_mul_epu32 on the even and the odd lanes */
+			s2 = _mm_add_epi64(s2, _mm_add_epi64(_mm_mul_epu32(lo, lo), _mm_mul_epu32(_mm_srli_epi64(lo, 32), _mm_srli_epi64(lo, 32))));
+			s2 = _mm_add_epi64(s2, _mm_add_epi64(_mm_mul_epu32(hi, hi), _mm_mul_epu32(_mm_srli_epi64(hi, 32), _mm_srli_epi64(hi, 32))));
+		}
+		unsigned long long a[2], b[2];
+		_mm_storeu_si128((__m128i*)a, s);
+		_mm_storeu_si128((__m128i*)b, s2);
+		sum += a[0] + a[1];
+		sum2 += b[0] + b[1];
+#endif
+		for (; x < n; ++x)
+		{
+			sum += p[x];
+			sum2 += (unsigned long long)p[x] * p[x];
+		}
+	}
+
+	template<typename T>
+	void Direct(const T* pData, int pitch, size_t first, size_t last, RoiResult* pResult) const
+	{
+		for (size_t i = first; i < last; ++i)
+		{
+			const RoiBox& b = m_vecBox[i];
+			unsigned long long sum = 0, sum2 = 0;
+			for (int y = b.y; y < b.y + b.height; ++y)
+				RowSum(pData + (size_t)y * pitch + b.x, b.width, sum, sum2);
+			Result(sum, sum2, (unsigned long long)b.width * b.height, pResult[i]);
+		}
+	}
+
+	/* one row of the integral images per source row, each row from the previous one, so it is not split */
+	template<typename T>
+	void BuildIntegral(const T* pData, int pitch)
+	{
+		const int w = m_bound.right - m_bound.left, h = m_bound.bottom - m_bound.top;
+		for (int y = 0; y < h; ++y)
+		{
+			const T* p = pData + (size_t)(m_bound.top + y) * pitch + m_bound.left;
+			const unsigned long long* prev = &m_vecSum[(size_t)y * (w + 1)];
+			const unsigned long long* prev2 = &m_vecSum2[(size_t)y * (w + 1)];
+			unsigned long long* cur = &m_vecSum[(size_t)(y + 1) * (w + 1)];
+			unsigned long long* cur2 = &m_vecSum2[(size_t)(y + 1) * (w + 1)];
+			unsigned long long row = 0, row2 = 0;
+			for (int x = 0; x < w; ++x)
+			{
+				row += p[x];
+				row2 += (unsigned long long)p[x] * p[x];
+				cur[x + 1] = prev[x + 1] + row;
+				cur2[x + 1] = prev2[x + 1] + row2;
+			}
+		}
+	}
+
+	void Integral(size_t first, size_t last, RoiResult* pResult) const
+	{
+		const size_t stride = m_bound.right - m_bound.left + 1;
+		for (size_t i = first; i < last; ++i)
+		{
+			const RoiBox& b = m_vecBox[i];
+			const size_t x0 = b.x - m_bound.left, y0 = b.y - m_bound.top, x1 = x0 + b.width, y1 = y0 + b.height;
+			const unsigned long long sum = m_vecSum[y1 * stride + x1] - m_vecSum[y0 * stride + x1] - m_vecSum[y1 * stride + x0] + m_vecSum[y0 * stride + x0];
+			const unsigned long long sum2 = m_vecSum2[y1 * stride + x1] - m_vecSum2[y0 * stride + x1] - m_vecSum2[y1 * stride + x0] + m_vecSum2[y0 * stride + x0];
+			Result(sum, sum2, (unsigned long long)b.width * b.height, pResult[i]);
+		}
+	}
+
+	static void Result(unsigned long long sum, unsigned long long sum2, unsigned long long n, RoiResult& r)
+	{
+		if (0 == n)
+			r.mean = r.variance = 0.0;
+		else
+		{
+			r.mean = (double)sum / n;
+			r.variance = std::max(0.0, (double)sum2 / n - r.mean * r.mean);
+		}
+	}
+
+	/* run fun(first, last) on slices of the boxes */
+	template<typename F>
+	void Split(unsigned long long nWork, F fun) const
+	{
+		const size_t nBox = m_vecBox.size();
+		const unsigned nThreads = (nWork < ROISTATS_PARALLEL_PIXELS) ? 1 : (unsigned)std::min<size_t>(m_nThreads, nBox);
+		if (nThreads <= 1)
+		{
+			fun((size_t)0, nBox);
+			return;
+		}
+		std::vector<std::thread> vecThread;
+		for (unsigned i = 1; i < nThreads; ++i)
+			vecThread.push_back(std::thread(fun, nBox * i / nThreads, nBox * (i + 1) / nThreads));
+		fun((size_t)0, nBox / nThreads);
+		for (size_t i = 0; i < vecThread.size(); ++i)
+			vecThread[i].join();
+	}
+public:
+	CRoiStats(unsigned nThreads = 0)
+	: m_nPixels(0), m_nThreads(nThreads ? nThreads : std::max(1u, std::thread::hardware_concurrency())), m_bIntegral(false)
+	{
+		SetRectEmpty(&m_bound);
+	}
+
+	void SetBoxes(const std::vector<RoiBox>& vecBox)
+	{
+		m_vecBox = vecBox;
+		m_nPixels = 0;
+		SetRectEmpty(&m_bound);
+		for (size_t i = 0; i < m_vecBox.size(); ++i)
+		{
+			const RoiBox& b = m_vecBox[i];
+			const RECT rc = { b.x, b.y, b.x + b.width, b.y + b.height };
+			UnionRect(&m_bound, &m_bound, &rc);
+			m_nPixels += (unsigned long long)b.width * b.height;
+		}
+		const unsigned long long nBound = (unsigned long long)(m_bound.right - m_bound.left) * (m_bound.bottom - m_bound.top);
+		m_bIntegral = (nBound > 0) && (m_nPixels > nBound * ROISTATS_INTEGRAL_RATIO);
+		if (m_bIntegral)
+		{
+			const size_t n = (size_t)(m_bound.right - m_bound.left + 1) * (m_bound.bottom - m_bound.top + 1);
+			m_vecSum.assign(n, 0);	/* row 0 and column 0 stay 0 */
+			m_vecSum2.assign(n, 0);
+		}
+		else
+		{
+			std::vector<unsigned long long>().swap(m_vecSum);
+			std::vector<unsigned long long>().swap(m_vecSum2);
+		}
+	}
+
+	size_t GetCount() const { return m_vecBox.size(); }
+	bool IsIntegral() const { return m_bIntegral; }
+
+	/* pResult: GetCount() entries, in the order of the boxes */
+	template<typename T>
+	void Compute(const T* pData, int pitch, RoiResult* pResult)
+	{
+		if (m_vecBox.empty())
+			return;
+		if (m_bIntegral)
+		{
+			BuildIntegral(pData, pitch);
+			Split(m_vecBox.size() * 64, [this, pResult](size_t first, size_t last) { Integral(first, last, pResult); });
+		}
+		else
+			Split(m_nPixels, [this, pData, pitch, pResult](size_t first, size_t last) { Direct(pData, pitch, first, last, pResult); });
+	}
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+/*
+ * Spans of the frame path in the Chrome trace event format, which chrome://tracing and https://ui.perfetto.dev open
+ * as it is. The stages inside the SDK (USB transfer, frontend deque, demosaic) are not visible from outside, so the
+ * application traces its own where they begin and end, on the thread they run, tagged with the frame sequence number:
+ *   CSpan span("pull"); Toupcam_PullImageV4(...); span.SetFrame(info.v3.seq);
+ * and Transit draws the time from the camera timestamp of a frame to its pull as an async span: the camera clock is
+ * not the host one, it is mapped once by the difference of the first frame after Start, the reference, so the span is
+ * what the frame spent in the link and the SDK above that frame, on one offset for the whole trace (a frame faster
+ * than the reference is drawn as a zero span). Nothing is recorded before Start; the events are kept in memory, up to
+ * SPANTRACE_MAX, and written by Save.
+ */
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <utility>
+
+#define SPANTRACE_MAX	(1 << 20)
+
+class CSpanTrace
+{
+	struct Event {
+		const char*	name;		/* a literal */
+		char		ph;			/* 'X' complete, 'b' / 'e' async, 'i' instant */
+		DWORD		tid;
+		double		ts, dur;	/* us since Start */
+		unsigned	frame;
+	};
+	std::vector<Event>	m_vecEvent;
+	std::vector<std::pair<DWORD, std::string>>	m_vecThread;
+	std::mutex			m_mtx;
+	volatile bool		m_bOn;
+	LARGE_INTEGER		m_freq, m_t0;
+	double				m_offset;	/* host - camera, us, of the reference frame */
+	bool				m_bOffset;
+
+	CSpanTrace()
+	: m_bOn(false), m_offset(0.0), m_bOffset(false)
+	{
+		QueryPerformanceFrequency(&m_freq);
+		m_t0.QuadPart = 0;
+	}
+
+	void Add(const char* name, char ph, double ts, double dur, unsigned frame)
+	{
+		const Event e = { name, ph, GetCurrentThreadId(), ts, dur, frame };
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (m_vecEvent.size() < SPANTRACE_MAX)
+			m_vecEvent.push_back(e);
+	}
+public:
+	static CSpanTrace& Get()
+	{
+		static CSpanTrace t;
+		return t;
+	}
+
+	bool IsOn() const { return m_bOn; }
+
+	void Start()
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_vecEvent.clear();
+		m_vecEvent.reserve(SPANTRACE_MAX / 16);
+		m_bOffset = false;
+		QueryPerformanceCounter(&m_t0);
+		m_bOn = true;
+	}
+
+	void Stop() { m_bOn = false; }
+
+	double Now() const
+	{
+		LARGE_INTEGER t;
+		QueryPerformanceCounter(&t);
+		return (t.QuadPart - m_t0.QuadPart) * 1000000.0 / m_freq.QuadPart;
+	}
+
+	/* of the calling thread, shown as its track */
+	void SetThreadName(const char* name)
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_vecThread.push_back(std::make_pair(GetCurrentThreadId(), std::string(name)));
+	}
+
+	/* from ts to now */
+	void Complete(const char* name, double ts, unsigned frame)
+	{
+		if (m_bOn)
+			Add(name, 'X', ts, Now() - ts, frame);
+	}
+
+	void Instant(const char* name, unsigned frame)
+	{
+		if (m_bOn)
+			Add(name, 'i', Now(), 0.0, frame);
+	}
+
+	/* timestamp: of the frame, camera clock, us; ts: when it was pulled, Now() */
+	void Transit(unsigned frame, unsigned long long timestamp, double ts)
+	{
+		if (!m_bOn)
+			return;
+		double begin;
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			if (!m_bOffset)
+			{
+				m_offset = ts - (double)timestamp;
+				m_bOffset = true;
+			}
+			begin = (double)timestamp + m_offset;
+			if (begin > ts)
+				begin = ts;
+		}
+		Add("transit", 'b', begin, 0.0, frame);
+		Add("transit", 'e', ts, 0.0, frame);
+	}
+
+	bool Save(const wchar_t* path)
+	{
+		FILE* fp = _wfopen(path, L"wt");
+		if (nullptr == fp)
+			return false;
+		std::lock_guard<std::mutex> lock(m_mtx);
+		fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"camera\"}}");
+		for (size_t i = 0; i < m_vecThread.size(); ++i)
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}", m_vecThread[i].first, m_vecThread[i].second.c_str());
+		for (size_t i = 0; i < m_vecEvent.size(); ++i)
+		{
+			const Event& e = m_vecEvent[i];
+			if ('X' == e.ph)
+				fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}", e.name, e.tid, e.ts, e.dur, e.frame);
+			else if ('i' == e.ph)
+				fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"args\":{\"frame\":%u}}", e.name, e.tid, e.ts, e.frame);
+			else
+				fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"%c\",\"id\":%u,\"pid\":1,\"tid\":%lu,\"ts\":%.3f}", e.name, e.ph, e.frame, e.tid, e.ts);
+		}
+		fprintf(fp, "\n]}\n");
+		fclose(fp);
+		return true;
+	}
+};
+
+/* a complete span of the scope */
+class CSpan
+{
+	const char*	m_name;
+	unsigned	m_frame;
+	double		m_ts;
+public:
+	explicit CSpan(const char* name, unsigned frame = 0)
+	: m_name(name), m_frame(frame), m_ts(CSpanTrace::Get().IsOn() ? CSpanTrace::Get().Now() : 0.0)
+	{
+	}
+
+	~CSpan()
+	{
+		CSpanTrace::Get().Complete(m_name, m_ts, m_frame);
+	}
+
+	void SetFrame(unsigned frame) { m_frame = frame; }
+	double Begin() const { return m_ts; }
+};
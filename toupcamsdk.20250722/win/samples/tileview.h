@@ -0,0 +1,535 @@
+#pragma once
+
+/*
+ * A zoomable, pannable view of the frame drawn by Direct3D 11 from tiles, for the WTL samples which paint the whole
+ * DIB with StretchDIBits: that converts and scales every pixel of the frame on the CPU at every paint, however little
+ * of it the window shows, and a 20 MP frame at 1:1 can no longer keep up with the camera.
+ * The frame is kept on the GPU as TILEVIEW_TILE square textures. NewFrame() only marks them stale; Paint() uploads
+ * the stale tiles which meet the visible part of the frame and draws those alone, so at 1:1 the upload is the window,
+ * not the frame. Zoomed out, a tile is uploaded at the mip level of the zoom, one pixel of 2^k by 2^k (the nearest,
+ * no averaging), and the fit of a large frame uploads a fraction of it. The tiles out of view are left stale until
+ * a pan brings them in, from the frame data of that paint.
+ * Zoom 1:1 and above is drawn with point sampling, the pixels as squares; below, linear.
+ * Zoom and pan: Fit() (the start), ZoomAt() about a point of the window (the wheel), Pan() by window pixels (a drag);
+ * GetMapping() gives the part of the frame in view and where it goes, for a GDI fallback (Attach failed, or the
+ * device was lost: Ready() is false) which stretches that part only.
+ * GetOverlay(): the items over the frame (d3doverlay.h), in frame pixels they follow the zoom and the pan; not drawn
+ * by the GDI fallback.
+ * The DIB is bottom-up (TDIBWIDTHBYTES rows, biHeight > 0) or top-down, 8 (gray), 24 or 32 bits.
+ * Everything from the UI thread of the window.
+ */
+#include <atlbase.h>
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <vector>
+#include <math.h>
+#include "toupcam.h"
+#include "d3doverlay.h"
+
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "d3dcompiler.lib")
+
+#define TILEVIEW_TILE		512		/* pixels, a side of a tile */
+#define TILEVIEW_LEVELS		5		/* mip levels of a tile, down to 1:16 */
+#define TILEVIEW_ZOOM_MIN	(1.0 / 64)
+#define TILEVIEW_ZOOM_MAX	32.0		/* a tile within the viewport bounds of D3D11 */
+
+class CTileView
+{
+	struct Tile {
+		CComPtr<ID3D11Texture2D> texture;
+		CComPtr<ID3D11ShaderResourceView> srv;
+		int x, y, width, height;	/* in the frame */
+		unsigned seq;				/* of the frame uploaded */
+		int levels;					/* of the texture */
+		int level;					/* uploaded, -1: none */
+	};
+	HWND m_hWnd;
+	CComPtr<ID3D11Device> m_device;
+	CComPtr<ID3D11DeviceContext> m_context;
+	CComPtr<IDXGISwapChain> m_swapChain;
+	CComPtr<ID3D11VertexShader> m_vs;
+	CComPtr<ID3D11PixelShader> m_ps;
+	CComPtr<ID3D11InputLayout> m_inputLayout;
+	CComPtr<ID3D11Buffer> m_vertexBuffer, m_param;
+	CComPtr<ID3D11SamplerState> m_point, m_linear;
+	std::vector<Tile> m_tile;
+	std::vector<BYTE> m_scratch;
+	int m_frameWidth, m_frameHeight, m_cols;	/* the frame of the last paint */
+	int m_windowWidth, m_windowHeight;
+	unsigned m_seq;
+	double m_zoom;					/* window pixels per frame pixel, <= 0: fit */
+	double m_cx, m_cy;				/* the frame point at the center of the window */
+	unsigned m_nUpload;				/* tiles uploaded, since the last call of GetUploadCount */
+	CD3DOverlay m_overlay;
+
+	HRESULT CreateShaders()
+	{
+		const char* vsCode = R"(
+			struct VS_IN {
+				float4 pos : POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			struct VS_OUT {
+				float4 pos : SV_POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			VS_OUT VS(VS_IN input) {
+				VS_OUT output;
+				output.pos = input.pos;
+				output.uv = input.uv;
+				return output;
+			})";
+		CComPtr<ID3DBlob> vsBlob;
+		HRESULT hr = D3DCompile(vsCode, strlen(vsCode), NULL, NULL, NULL, "VS", "vs_4_0", 0, 0, &vsBlob, NULL);
+		if (FAILED(hr))
+			return hr;
+		hr = m_device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), NULL, &m_vs);
+		if (FAILED(hr))
+			return hr;
+
+		/* the level uploaded, the others of the tile are not */
+		const char* psCode = R"(
+			Texture2D tex : register(t0);
+			SamplerState sam : register(s0);
+			cbuffer Param : register(b0) {
+				float4 param;	/* level */
+			};
+			struct PS_IN {
+				float4 pos : SV_POSITION;
+				float2 uv  : TEXCOORD;
+			};
+			float4 PS(PS_IN input) : SV_Target {
+				return float4(tex.SampleLevel(sam, input.uv, param.x).rgb, 1.0);
+			})";
+		CComPtr<ID3DBlob> psBlob;
+		hr = D3DCompile(psCode, strlen(psCode), NULL, NULL, NULL, "PS", "ps_4_0", 0, 0, &psBlob, NULL);
+		if (FAILED(hr))
+			return hr;
+		hr = m_device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), NULL, &m_ps);
+		if (FAILED(hr))
+			return hr;
+
+		D3D11_INPUT_ELEMENT_DESC layout[] = {
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,       0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+		};
+		hr = m_device->CreateInputLayout(layout, 2, vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), &m_inputLayout);
+		if (FAILED(hr))
+			return hr;
+
+		/* the whole viewport, a tile is drawn by its viewport */
+		const struct Vertex {
+			float x, y, z, w;
+			float u, v;
+		} vertices[] = {
+			{ -1.0f,  1.0f, 0.0f, 1.0f, 0.0f, 0.0f },
+			{  1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 0.0f },
+			{ -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 1.0f },
+			{  1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 1.0f }
+		};
+		D3D11_BUFFER_DESC bd = {};
+		bd.Usage = D3D11_USAGE_DEFAULT;
+		bd.ByteWidth = sizeof(vertices);
+		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		D3D11_SUBRESOURCE_DATA initData = { vertices };
+		hr = m_device->CreateBuffer(&bd, &initData, &m_vertexBuffer);
+		if (FAILED(hr))
+			return hr;
+
+		bd.ByteWidth = sizeof(float) * 4;
+		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		return m_device->CreateBuffer(&bd, NULL, &m_param);
+	}
+
+	/* the grid of a new frame size */
+	HRESULT CreateTiles(int width, int height)
+	{
+		m_tile.clear();
+		m_frameWidth = width;
+		m_frameHeight = height;
+		m_cols = (width + TILEVIEW_TILE - 1) / TILEVIEW_TILE;
+		const int rows = (height + TILEVIEW_TILE - 1) / TILEVIEW_TILE;
+		m_tile.resize(m_cols * rows);
+		for (int i = 0; i < (int)m_tile.size(); ++i)
+		{
+			Tile& t = m_tile[i];
+			t.x = (i % m_cols) * TILEVIEW_TILE;
+			t.y = (i / m_cols) * TILEVIEW_TILE;
+			t.width = __min(TILEVIEW_TILE, width - t.x);
+			t.height = __min(TILEVIEW_TILE, height - t.y);
+			t.seq = 0;
+			t.level = -1;
+			t.levels = 1;
+			while ((t.levels < TILEVIEW_LEVELS) && ((__max(t.width, t.height) >> t.levels) > 0))
+				++t.levels;
+			D3D11_TEXTURE2D_DESC texDesc = {};
+			texDesc.Width = t.width;
+			texDesc.Height = t.height;
+			texDesc.MipLevels = t.levels;
+			texDesc.ArraySize = 1;
+			texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+			texDesc.SampleDesc.Count = 1;
+			texDesc.Usage = D3D11_USAGE_DEFAULT;
+			texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			HRESULT hr = m_device->CreateTexture2D(&texDesc, NULL, &t.texture);
+			if (FAILED(hr))
+				return hr;
+			hr = m_device->CreateShaderResourceView(t.texture, NULL, &t.srv);
+			if (FAILED(hr))
+				return hr;
+		}
+		return S_OK;
+	}
+
+	/* level of a tile from the DIB: one pixel of every 2^level by 2^level, converted to BGRA */
+	void Upload(Tile& t, int level, const BITMAPINFOHEADER* pHeader, const BYTE* pData)
+	{
+		const int w = __max(1, t.width >> level), h = __max(1, t.height >> level);
+		const int bpp = pHeader->biBitCount / 8;
+		const int stride = TDIBWIDTHBYTES(pHeader->biWidth * pHeader->biBitCount);
+		BYTE* d = &m_scratch[0];
+		for (int j = 0; j < h; ++j)
+		{
+			const int y = t.y + (j << level);
+			const BYTE* s = pData + (size_t)stride * ((pHeader->biHeight > 0) ? (m_frameHeight - 1 - y) : y) + (size_t)t.x * bpp;
+			const int step = bpp << level;
+			if (4 == bpp)
+			{
+				if (0 == level)
+					memcpy(d, s, w * 4);
+				else
+				{
+					for (int i = 0; i < w; ++i, s += step)
+						((DWORD*)d)[i] = *(const DWORD*)s;
+				}
+			}
+			else if (3 == bpp)
+			{
+				for (int i = 0; i < w; ++i, s += step)
+				{
+					d[i * 4] = s[0];
+					d[i * 4 + 1] = s[1];
+					d[i * 4 + 2] = s[2];
+					d[i * 4 + 3] = 0xff;
+				}
+			}
+			else
+			{
+				for (int i = 0; i < w; ++i, s += step)
+				{
+					d[i * 4] = d[i * 4 + 1] = d[i * 4 + 2] = s[0];
+					d[i * 4 + 3] = 0xff;
+				}
+			}
+			d += w * 4;
+		}
+		m_context->UpdateSubresource(t.texture, D3D11CalcSubresource(level, 0, t.levels), NULL, &m_scratch[0], w * 4, 0);
+		t.level = level;
+		++m_nUpload;
+	}
+
+	double Zoom() const
+	{
+		if (m_zoom > 0.0)
+			return m_zoom;
+		if ((m_frameWidth <= 0) || (m_frameHeight <= 0) || (m_windowWidth <= 0) || (m_windowHeight <= 0))
+			return 1.0;
+		return __min(m_windowWidth / (double)m_frameWidth, m_windowHeight / (double)m_frameHeight);
+	}
+
+	/* the frame point at the center of the window, which stays on the frame */
+	void Center(double& cx, double& cy) const
+	{
+		if (m_zoom <= 0.0)
+		{
+			cx = m_frameWidth / 2.0;
+			cy = m_frameHeight / 2.0;
+		}
+		else
+		{
+			cx = __max(0.0, __min((double)m_frameWidth, m_cx));
+			cy = __max(0.0, __min((double)m_frameHeight, m_cy));
+		}
+	}
+
+	HRESULT ResizeBuffers()
+	{
+		m_context->OMSetRenderTargets(0, NULL, NULL);
+		DXGI_SWAP_CHAIN_DESC scd = {};
+		HRESULT hr = m_swapChain->GetDesc(&scd);
+		if (SUCCEEDED(hr))
+			hr = m_swapChain->ResizeBuffers(scd.BufferCount, __max(1, m_windowWidth), __max(1, m_windowHeight), scd.BufferDesc.Format, scd.Flags);
+		return hr;
+	}
+public:
+	CTileView()
+	: m_hWnd(NULL), m_frameWidth(0), m_frameHeight(0), m_cols(0), m_windowWidth(0), m_windowHeight(0)
+	, m_seq(1), m_zoom(0.0), m_cx(0.0), m_cy(0.0), m_nUpload(0)
+	{
+	}
+
+	/* the device and the swap chain of the window; false: draw by GDI */
+	bool Attach(HWND hWnd)
+	{
+		Detach();
+		m_hWnd = hWnd;
+		RECT rc;
+		::GetClientRect(hWnd, &rc);
+		m_windowWidth = rc.right - rc.left;
+		m_windowHeight = rc.bottom - rc.top;
+
+		DXGI_SWAP_CHAIN_DESC scd = {};
+		scd.BufferCount = 2;
+		scd.BufferDesc.Width = __max(1, m_windowWidth);
+		scd.BufferDesc.Height = __max(1, m_windowHeight);
+		scd.BufferDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		scd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+		scd.OutputWindow = hWnd;
+		scd.SampleDesc.Count = 1;
+		scd.Windowed = TRUE;
+		scd.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+		D3D_FEATURE_LEVEL featureLevel;
+		const UINT creationFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT; /* Direct2D of m_overlay */
+		HRESULT hr = D3D11CreateDeviceAndSwapChain(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, creationFlags, NULL, 0, D3D11_SDK_VERSION, &scd, &m_swapChain, &m_device, &featureLevel, &m_context);
+		if (FAILED(hr))
+		{
+			scd.SwapEffect = DXGI_SWAP_EFFECT_DISCARD; /* before Windows 10 */
+			hr = D3D11CreateDeviceAndSwapChain(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, creationFlags, NULL, 0, D3D11_SDK_VERSION, &scd, &m_swapChain, &m_device, &featureLevel, &m_context);
+		}
+		if (SUCCEEDED(hr))
+			hr = CreateShaders();
+		if (SUCCEEDED(hr))
+		{
+			D3D11_SAMPLER_DESC sampDesc = {};
+			sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+			sampDesc.AddressU = sampDesc.AddressV = sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+			sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+			hr = m_device->CreateSamplerState(&sampDesc, &m_point);
+			if (SUCCEEDED(hr))
+			{
+				sampDesc.Filter = D3D11_FILTER_MIN_MAG_LINEAR_MIP_POINT;
+				hr = m_device->CreateSamplerState(&sampDesc, &m_linear);
+			}
+		}
+		if (FAILED(hr))
+		{
+			Detach();
+			return false;
+		}
+		m_scratch.resize(TILEVIEW_TILE * TILEVIEW_TILE * 4);
+		if (SUCCEEDED(m_overlay.Init(m_device)))
+			m_overlay.Resize(m_windowWidth, m_windowHeight);
+		return true;
+	}
+
+	void Detach()
+	{
+		m_tile.clear();
+		m_frameWidth = m_frameHeight = m_cols = 0;
+		m_overlay.Release();
+		m_point.Release();
+		m_linear.Release();
+		m_param.Release();
+		m_vertexBuffer.Release();
+		m_inputLayout.Release();
+		m_ps.Release();
+		m_vs.Release();
+		m_swapChain.Release();
+		m_context.Release();
+		m_device.Release();
+	}
+
+	CD3DOverlay& GetOverlay()
+	{
+		return m_overlay;
+	}
+
+	bool Ready() const
+	{
+		return (m_swapChain != NULL);
+	}
+
+	/* the frame data changed, the tiles are uploaded again as they come into view */
+	void NewFrame()
+	{
+		++m_seq;
+	}
+
+	/* WM_SIZE */
+	void Resize(int width, int height)
+	{
+		m_windowWidth = width;
+		m_windowHeight = height;
+		m_overlay.Resize(width, height);
+		if (m_swapChain && FAILED(ResizeBuffers()))
+			Detach();
+	}
+
+	void Fit()
+	{
+		m_zoom = 0.0;
+	}
+
+	/* zoom by factor, the frame point under pt (client) staying there; near 1:1 snaps to it */
+	void ZoomAt(POINT pt, double factor)
+	{
+		const double z = Zoom();
+		double cx, cy;
+		Center(cx, cy);
+		const double fx = cx + (pt.x - m_windowWidth / 2.0) / z, fy = cy + (pt.y - m_windowHeight / 2.0) / z;
+		double nz = __max(TILEVIEW_ZOOM_MIN, __min(TILEVIEW_ZOOM_MAX, z * factor));
+		if (fabs(nz - 1.0) < 0.05)
+			nz = 1.0;
+		m_zoom = nz;
+		m_cx = fx - (pt.x - m_windowWidth / 2.0) / nz;
+		m_cy = fy - (pt.y - m_windowHeight / 2.0) / nz;
+	}
+
+	/* the frame moved by dx, dy window pixels */
+	void Pan(int dx, int dy)
+	{
+		const double z = Zoom();
+		double cx, cy;
+		Center(cx, cy);
+		m_zoom = z;
+		m_cx = cx - dx / z;
+		m_cy = cy - dy / z;
+	}
+
+	/* window pixels per frame pixel */
+	double GetZoom() const
+	{
+		return Zoom();
+	}
+
+	/* tiles uploaded since the last call */
+	unsigned GetUploadCount()
+	{
+		const unsigned n = m_nUpload;
+		m_nUpload = 0;
+		return n;
+	}
+
+	/*
+	 * the part of a frame of width by height in view (rcFrame, top-down pixels, clipped to the frame) and the client
+	 * rectangle it goes to (rcWindow); false: nothing of the frame in view
+	 */
+	bool GetMapping(int width, int height, RECT& rcFrame, RECT& rcWindow)
+	{
+		m_frameWidth = width;
+		m_frameHeight = height;
+		const double z = Zoom();
+		double cx, cy;
+		Center(cx, cy);
+		const double x0 = cx - m_windowWidth / 2.0 / z, y0 = cy - m_windowHeight / 2.0 / z;
+		rcFrame.left = __max(0, (int)floor(x0));
+		rcFrame.top = __max(0, (int)floor(y0));
+		rcFrame.right = __min(width, (int)ceil(x0 + m_windowWidth / z));
+		rcFrame.bottom = __min(height, (int)ceil(y0 + m_windowHeight / z));
+		if ((rcFrame.left >= rcFrame.right) || (rcFrame.top >= rcFrame.bottom))
+			return false;
+		rcWindow.left = (LONG)floor((rcFrame.left - x0) * z + 0.5);
+		rcWindow.top = (LONG)floor((rcFrame.top - y0) * z + 0.5);
+		rcWindow.right = (LONG)floor((rcFrame.right - x0) * z + 0.5);
+		rcWindow.bottom = (LONG)floor((rcFrame.bottom - y0) * z + 0.5);
+		return true;
+	}
+
+	/* WM_PAINT, pHeader NULL: no frame; false: not drawn (not Ready, or the device was lost just now) */
+	bool Paint(const BITMAPINFOHEADER* pHeader, const BYTE* pData, COLORREF background)
+	{
+		if (!m_swapChain)
+			return false;
+		CComPtr<ID3D11Texture2D> backBuffer;
+		CComPtr<ID3D11RenderTargetView> rtv;
+		HRESULT hr = m_swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&backBuffer);
+		if (SUCCEEDED(hr))
+			hr = m_device->CreateRenderTargetView(backBuffer, nullptr, &rtv);
+		if (FAILED(hr))
+		{
+			Detach();
+			return false;
+		}
+		m_context->OMSetRenderTargets(1, &rtv.p, nullptr);
+		const float bgColor[4] = { GetRValue(background) / 255.0f, GetGValue(background) / 255.0f, GetBValue(background) / 255.0f, 1.0f };
+		m_context->ClearRenderTargetView(rtv, bgColor);
+
+		const int bpp = pHeader ? pHeader->biBitCount : 0;
+		if ((8 == bpp) || (24 == bpp) || (32 == bpp))
+		{
+			const int width = pHeader->biWidth, height = abs(pHeader->biHeight);
+			if ((width != m_frameWidth) || (height != m_frameHeight) || m_tile.empty())
+			{
+				if (FAILED(CreateTiles(width, height)))
+				{
+					Detach();
+					return false;
+				}
+			}
+			RECT rcFrame, rcWindow;
+			if (GetMapping(width, height, rcFrame, rcWindow))
+			{
+				const double z = Zoom();
+				int level = 0;
+				while ((level < TILEVIEW_LEVELS - 1) && (z * (2 << level) <= 1.0))
+					++level;
+				int drawn = -1;		/* the level in m_param */
+				m_context->IASetInputLayout(m_inputLayout);
+				m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+				UINT stride = sizeof(float) * 6, offset = 0;
+				m_context->IASetVertexBuffers(0, 1, &m_vertexBuffer.p, &stride, &offset);
+				m_context->VSSetShader(m_vs, NULL, 0);
+				m_context->PSSetShader(m_ps, NULL, 0);
+				m_context->PSSetConstantBuffers(0, 1, &m_param.p);
+				m_context->PSSetSamplers(0, 1, (z >= 1.0) ? &m_point.p : &m_linear.p);
+
+				double cx, cy;
+				Center(cx, cy);
+				const double x0 = cx - m_windowWidth / 2.0 / z, y0 = cy - m_windowHeight / 2.0 / z;
+				const int c0 = rcFrame.left / TILEVIEW_TILE, c1 = (rcFrame.right - 1) / TILEVIEW_TILE;
+				const int r0 = rcFrame.top / TILEVIEW_TILE, r1 = (rcFrame.bottom - 1) / TILEVIEW_TILE;
+				for (int r = r0; r <= r1; ++r)
+				{
+					for (int c = c0; c <= c1; ++c)
+					{
+						Tile& t = m_tile[r * m_cols + c];
+						const int want = __min(level, t.levels - 1);
+						if ((t.seq != m_seq) || (t.level != want))
+						{
+							Upload(t, want, pHeader, pData);
+							t.seq = m_seq;
+						}
+						D3D11_VIEWPORT vp;
+						vp.TopLeftX = (float)((t.x - x0) * z);
+						vp.TopLeftY = (float)((t.y - y0) * z);
+						vp.Width = (float)(t.width * z);
+						vp.Height = (float)(t.height * z);
+						vp.MinDepth = 0.0f;
+						vp.MaxDepth = 1.0f;
+						m_context->RSSetViewports(1, &vp);
+						if (t.level != drawn)
+						{
+							/* a small tile at the right or bottom edge has fewer levels */
+							const float param[4] = { (float)t.level, 0.0f, 0.0f, 0.0f };
+							m_context->UpdateSubresource(m_param, 0, NULL, param, 0, 0);
+							drawn = t.level;
+						}
+						m_context->PSSetShaderResources(0, 1, &t.srv.p);
+						m_context->Draw(4, 0);
+					}
+				}
+				m_overlay.Draw(m_context, (float)z, (float)z, (float)(-x0 * z), (float)(-y0 * z));
+			}
+		}
+
+		/* not waiting for the vertical blank on the UI thread: the flip model shows the latest anyway */
+		hr = m_swapChain->Present(0, 0);
+		if ((DXGI_ERROR_DEVICE_REMOVED == hr) || (DXGI_ERROR_DEVICE_RESET == hr))
+		{
+			Detach();
+			return false;
+		}
+		return true;
+	}
+};
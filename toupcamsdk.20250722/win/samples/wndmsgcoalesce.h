@@ -0,0 +1,89 @@
+#pragma once
+
+/*
+ * Window message mode with the image notifications coalesced. Toupcam_StartPullModeWithWndMsg posts one message per
+ * frame: when the UI thread is busy (a resize, a menu, a slow paint) they queue up, every one of them pulls a frame
+ * the window is no longer showing, and the view lags further behind the camera the longer the load lasts.
+ * CWndMsgCoalesce starts the camera with an event callback and posts the same messages (wParam = the event, lParam = 0)
+ * to the same window, except that there is at most one TOUPCAM_EVENT_IMAGE in the queue: the frames which arrive while
+ * it is pending only add to its count, Take() in its handler. The other events are posted one by one as they come.
+ * PullLatest() then pulls the newest frame and discards the older ones still in the backend deque: a preview shows
+ * what the camera sees now, however long the UI thread was away. A program which needs every frame (a recorder, a
+ * measurement) pulls until E_PENDING in the handler instead.
+ * The stale frames are pulled into the same buffer, one conversion each; TOUPCAM_OPTION_BACKEND_DEQUE_LENGTH = 2 keeps
+ * that to one frame at most, the SDK itself dropping the rest.
+ * Call the SDK functions on the handle as before: only Toupcam_StartPullModeWithWndMsg is replaced.
+ */
+#include <atomic>
+
+class CWndMsgCoalesce
+{
+	HToupcam			m_hcam;
+	HWND				m_hWnd;
+	UINT				m_nMsg;
+	std::atomic<unsigned>	m_nPending;		/* images notified since the last Take, the message is in the queue when not 0 */
+	unsigned			m_nCoalesced, m_nDiscarded;
+
+	static void __stdcall EventCallback(unsigned nEvent, void* pCallbackCtx)
+	{
+		CWndMsgCoalesce* pThis = (CWndMsgCoalesce*)pCallbackCtx;
+		if (TOUPCAM_EVENT_IMAGE == nEvent)
+		{
+			if (0 != pThis->m_nPending.fetch_add(1))
+				return;
+		}
+		PostMessage(pThis->m_hWnd, pThis->m_nMsg, nEvent, 0);
+	}
+public:
+	CWndMsgCoalesce()
+	: m_hcam(nullptr), m_hWnd(nullptr), m_nMsg(0), m_nPending(0), m_nCoalesced(0), m_nDiscarded(0)
+	{
+	}
+
+	/* in place of Toupcam_StartPullModeWithWndMsg(h, hWnd, nMsg) */
+	HRESULT Start(HToupcam h, HWND hWnd, UINT nMsg)
+	{
+		m_hcam = h;
+		m_hWnd = hWnd;
+		m_nMsg = nMsg;
+		m_nPending = 0;
+		return Toupcam_StartPullModeWithCallback(h, EventCallback, this);
+	}
+
+	/* in the handler of TOUPCAM_EVENT_IMAGE, first: the frames notified by this message, the next frame posts a new one */
+	unsigned Take()
+	{
+		const unsigned n = m_nPending.exchange(0);
+		if (n > 1)
+			m_nCoalesced += n - 1;
+		return n;
+	}
+
+	/*
+	 * the same parameters as Toupcam_PullImageV4 (live frames); E_PENDING when there is no frame, such as for a message
+	 * whose frames were already pulled by the PullLatest of the previous one
+	 */
+	HRESULT PullLatest(void* pImageData, int bits, int rowPitch, ToupcamFrameInfoV4* pInfo, unsigned* pnDiscarded = nullptr)
+	{
+		unsigned nDiscarded = 0;
+		HRESULT hr = Toupcam_PullImageV4(m_hcam, pImageData, 0, bits, rowPitch, pInfo);
+		if (SUCCEEDED(hr))
+		{
+			ToupcamFrameInfoV4 info = { 0 };
+			while (SUCCEEDED(Toupcam_PullImageV4(m_hcam, pImageData, 0, bits, rowPitch, &info)))
+			{
+				if (pInfo)
+					*pInfo = info;
+				++nDiscarded;
+			}
+			m_nDiscarded += nDiscarded;
+		}
+		if (pnDiscarded)
+			*pnDiscarded = nDiscarded;
+		return hr;
+	}
+
+	/* image messages saved by the coalescing, and frames discarded by PullLatest, since the construction */
+	unsigned Coalesced() const { return m_nCoalesced; }
+	unsigned Discarded() const { return m_nDiscarded; }
+};